@@ -181,6 +181,7 @@ solution("xenia")
   include("src/xenia/base")
   include("src/xenia/cpu")
   include("src/xenia/cpu/backend/x64")
+  include("src/xenia/debug/server")
   include("src/xenia/debug/ui")
   include("src/xenia/gpu")
   include("src/xenia/gpu/gl4")
@@ -194,6 +195,9 @@ solution("xenia")
   include("src/xenia/ui/vulkan")
   include("src/xenia/vfs")
 
+  if os.is("linux") then
+    include("src/xenia/apu/alsa")
+  end
   if os.is("windows") then
     include("src/xenia/apu/xaudio2")
     include("src/xenia/hid/winkey")
@@ -18,6 +18,8 @@
 #include "xenia/base/platform.h"
 #include "xenia/base/profiling.h"
 #include "xenia/base/threading.h"
+#include "xenia/cpu/cpu_flags.h"
+#include "xenia/cpu/export_resolver.h"
 #include "xenia/emulator.h"
 #include "xenia/gpu/graphics_system.h"
 
@@ -94,6 +96,9 @@ bool EmulatorWindow::Initialize() {
         CpuTimeScalarSetDouble();
       } break;
 
+      case 0x71: {  // VK_F2
+        Profiler::CaptureTrace();
+      } break;
       case 0x72: {  // F3
         Profiler::ToggleDisplay();
       } break;
@@ -104,6 +109,9 @@ bool EmulatorWindow::Initialize() {
       case 0x74: {  // VK_F5
         GpuClearCaches();
       } break;
+      case 0x75: {  // VK_F6
+        CpuDumpKernelCallProfile();
+      } break;
       case 0x76: {  // VK_F7
         // Save to file
         // TODO: Choose path based on user input, or from options
@@ -176,12 +184,18 @@ bool EmulatorWindow::Initialize() {
     cpu_menu->AddChild(MenuItem::Create(MenuItem::Type::kString,
                                         L"&Pause/Resume Profiler", L"`",
                                         []() { Profiler::TogglePause(); }));
+    cpu_menu->AddChild(MenuItem::Create(MenuItem::Type::kString,
+                                        L"&Capture Profiler Trace", L"F2",
+                                        []() { Profiler::CaptureTrace(); }));
   }
   cpu_menu->AddChild(MenuItem::Create(MenuItem::Type::kSeparator));
   {
     cpu_menu->AddChild(MenuItem::Create(
         MenuItem::Type::kString, L"&Break and Show Debugger", L"Pause/Break",
         std::bind(&EmulatorWindow::CpuBreakIntoDebugger, this)));
+    cpu_menu->AddChild(MenuItem::Create(
+        MenuItem::Type::kString, L"Dump &Kernel Call Profile", L"F6",
+        std::bind(&EmulatorWindow::CpuDumpKernelCallProfile, this)));
   }
   main_menu->AddChild(std::move(cpu_menu));
 
@@ -310,6 +324,17 @@ void EmulatorWindow::CpuBreakIntoDebugger() {
   }
 }
 
+void EmulatorWindow::CpuDumpKernelCallProfile() {
+  if (!FLAGS_profile_kernel_calls) {
+    xe::ui::ImGuiDialog::ShowMessageBox(
+        window_.get(), "Kernel Call Profile",
+        "Xenia must be launched with the --profile_kernel_calls flag in "
+        "order to profile kernel calls.");
+    return;
+  }
+  emulator()->export_resolver()->DumpProfile();
+}
+
 void EmulatorWindow::GpuTraceFrame() {
   emulator()->graphics_system()->RequestFrameTrace();
 }
@@ -47,6 +47,7 @@ class EmulatorWindow {
   void CpuTimeScalarSetHalf();
   void CpuTimeScalarSetDouble();
   void CpuBreakIntoDebugger();
+  void CpuDumpKernelCallProfile();
   void GpuTraceFrame();
   void GpuClearCaches();
   void ToggleFullscreen();
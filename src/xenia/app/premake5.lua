@@ -16,6 +16,7 @@ project("xenia-app")
     "xenia-core",
     "xenia-cpu",
     "xenia-cpu-backend-x64",
+    "xenia-debug-server",
     "xenia-debug-ui",
     "xenia-gpu",
     "xenia-gpu-gl4",
@@ -46,6 +47,11 @@ project("xenia-app")
     project_root,
   })
 
+  filter("platforms:Linux")
+    links({
+      "xenia-apu-alsa",
+    })
+
   filter("platforms:Windows")
     links({
       "xenia-apu-xaudio2",
@@ -15,14 +15,18 @@
 #include "xenia/base/main.h"
 #include "xenia/base/profiling.h"
 #include "xenia/base/threading.h"
+#include "xenia/debug/server/debug_server.h"
 #include "xenia/debug/ui/debug_window.h"
 #include "xenia/emulator.h"
+#include "xenia/kernel/kernel_state.h"
 #include "xenia/ui/file_picker.h"
 
 // Available audio systems:
 #include "xenia/apu/nop/nop_audio_system.h"
 #if XE_PLATFORM_WIN32
 #include "xenia/apu/xaudio2/xaudio2_audio_system.h"
+#elif XE_PLATFORM_LINUX
+#include "xenia/apu/alsa/alsa_audio_system.h"
 #endif  // XE_PLATFORM_WIN32
 
 // Available graphics systems:
@@ -36,11 +40,14 @@
 #include "xenia/hid/xinput/xinput_hid.h"
 #endif  // XE_PLATFORM_WIN32
 
-DEFINE_string(apu, "any", "Audio system. Use: [any, nop, xaudio2]");
+DEFINE_string(apu, "any", "Audio system. Use: [any, nop, xaudio2, alsa]");
 DEFINE_string(gpu, "any", "Graphics system. Use: [any, gl4, vulkan]");
 DEFINE_string(hid, "any", "Input system. Use: [any, nop, winkey, xinput]");
 
 DEFINE_string(target, "", "Specifies the target .xex or .iso to execute.");
+DEFINE_int32(debug_server_port, 0,
+             "Serves the debugger to a remote client on this local TCP port "
+             "instead of opening the debug window. 0 disables it.");
 
 namespace xe {
 namespace app {
@@ -51,6 +58,9 @@ std::unique_ptr<apu::AudioSystem> CreateAudioSystem(cpu::Processor* processor) {
 #if XE_PLATFORM_WIN32
   } else if (FLAGS_apu.compare("xaudio2") == 0) {
     return apu::xaudio2::XAudio2AudioSystem::Create(processor);
+#elif XE_PLATFORM_LINUX
+  } else if (FLAGS_apu.compare("alsa") == 0) {
+    return apu::alsa::AlsaAudioSystem::Create(processor);
 #endif  // XE_PLATFORM_WIN32
   } else {
     // Create best available.
@@ -61,6 +71,11 @@ std::unique_ptr<apu::AudioSystem> CreateAudioSystem(cpu::Processor* processor) {
     if (best) {
       return best;
     }
+#elif XE_PLATFORM_LINUX
+    best = apu::alsa::AlsaAudioSystem::Create(processor);
+    if (best) {
+      return best;
+    }
 #endif  // XE_PLATFORM_WIN32
 
     // Fallback to nop.
@@ -69,7 +84,11 @@ std::unique_ptr<apu::AudioSystem> CreateAudioSystem(cpu::Processor* processor) {
 }
 
 std::unique_ptr<gpu::GraphicsSystem> CreateGraphicsSystem() {
-  if (FLAGS_gpu.compare("gl4") == 0) {
+  if (FLAGS_headless && FLAGS_gpu.compare("gl4") != 0) {
+    // Only the Vulkan backend can render without a window.
+    return std::unique_ptr<gpu::GraphicsSystem>(
+        new xe::gpu::vulkan::VulkanGraphicsSystem());
+  } else if (FLAGS_gpu.compare("gl4") == 0) {
     return std::unique_ptr<gpu::GraphicsSystem>(
         new xe::gpu::gl4::GL4GraphicsSystem());
   } else if (FLAGS_gpu.compare("vulkan") == 0) {
@@ -93,7 +112,7 @@ std::unique_ptr<gpu::GraphicsSystem> CreateGraphicsSystem() {
 std::vector<std::unique_ptr<hid::InputDriver>> CreateInputDrivers(
     ui::Window* window) {
   std::vector<std::unique_ptr<hid::InputDriver>> drivers;
-  if (FLAGS_hid.compare("nop") == 0) {
+  if (FLAGS_hid.compare("nop") == 0 || !window) {
     drivers.emplace_back(xe::hid::nop::Create(window));
 #if XE_PLATFORM_WIN32
   } else if (FLAGS_hid.compare("winkey") == 0) {
@@ -127,14 +146,17 @@ int xenia_main(const std::vector<std::wstring>& args) {
   // Create the emulator but don't initialize so we can setup the window.
   auto emulator = std::make_unique<Emulator>(L"");
 
-  // Main emulator display window.
-  auto emulator_window = EmulatorWindow::Create(emulator.get());
+  // Main emulator display window, unless running headless.
+  std::unique_ptr<EmulatorWindow> emulator_window;
+  if (!FLAGS_headless) {
+    emulator_window = EmulatorWindow::Create(emulator.get());
+  }
 
   // Setup and initialize all subsystems. If we can't do something
   // (unsupported system, memory issues, etc) this will fail early.
-  X_STATUS result =
-      emulator->Setup(emulator_window->window(), CreateAudioSystem,
-                      CreateGraphicsSystem, CreateInputDrivers);
+  X_STATUS result = emulator->Setup(
+      emulator_window ? emulator_window->window() : nullptr,
+      CreateAudioSystem, CreateGraphicsSystem, CreateInputDrivers);
   if (XFAILED(result)) {
     XELOGE("Failed to setup emulator: %.8X", result);
     return 1;
@@ -142,8 +164,16 @@ int xenia_main(const std::vector<std::wstring>& args) {
 
   // Set a debug handler.
   // This will respond to debugging requests so we can open the debug UI.
+  std::unique_ptr<xe::debug::server::DebugServer> debug_server;
   std::unique_ptr<xe::debug::ui::DebugWindow> debug_window;
-  if (FLAGS_debug) {
+  if (FLAGS_debug_server_port) {
+    debug_server = xe::debug::server::DebugServer::Create(
+        emulator.get(), uint16_t(FLAGS_debug_server_port));
+    if (debug_server) {
+      emulator->processor()->set_debug_listener_request_handler(
+          [&](xe::cpu::Processor* processor) { return debug_server.get(); });
+    }
+  } else if (FLAGS_debug && emulator_window) {
     emulator->processor()->set_debug_listener_request_handler([&](
         xe::cpu::Processor* processor) {
       if (debug_window) {
@@ -163,15 +193,19 @@ int xenia_main(const std::vector<std::wstring>& args) {
 
   auto evt = xe::threading::Event::CreateAutoResetEvent(false);
   emulator->on_launch.AddListener([&]() {
-    emulator_window->UpdateTitle();
+    if (emulator_window) {
+      emulator_window->UpdateTitle();
+    }
     evt->Set();
   });
 
   bool exiting = false;
-  emulator_window->loop()->on_quit.AddListener([&](ui::UIEvent* e) {
-    exiting = true;
-    evt->Set();
-  });
+  if (emulator_window) {
+    emulator_window->loop()->on_quit.AddListener([&](ui::UIEvent* e) {
+      exiting = true;
+      evt->Set();
+    });
+  }
 
   // Grab path from the flag or unnamed argument.
   std::wstring path;
@@ -187,12 +221,17 @@ int xenia_main(const std::vector<std::wstring>& args) {
     }
   }
 
+  if (path.empty() && !emulator_window) {
+    XELOGE("Running headless requires a target to launch");
+    return 1;
+  }
   if (!path.empty()) {
     // Normalize the path and make absolute.
     std::wstring abs_path = xe::to_absolute_path(path);
     result = emulator->LaunchPath(abs_path);
     if (XFAILED(result)) {
       XELOGE("Failed to launch target: %.8X", result);
+      debug_server.reset();
       emulator.reset();
       emulator_window.reset();
       return 1;
@@ -212,8 +251,13 @@ int xenia_main(const std::vector<std::wstring>& args) {
         break;
       }
     }
+    if (!emulator_window) {
+      // Headless runs end with the title, as nothing else can quit.
+      exiting = true;
+    }
   }
 
+  debug_server.reset();
   debug_window.reset();
   emulator.reset();
   emulator_window.reset();
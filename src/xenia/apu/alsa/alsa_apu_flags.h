@@ -0,0 +1,17 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2016 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#ifndef XENIA_APU_ALSA_ALSA_APU_FLAGS_H_
+#define XENIA_APU_ALSA_ALSA_APU_FLAGS_H_
+
+#include <gflags/gflags.h>
+
+DECLARE_string(alsa_device);
+
+#endif  // XENIA_APU_ALSA_ALSA_APU_FLAGS_H_
@@ -0,0 +1,141 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2016 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#include "xenia/apu/alsa/alsa_audio_driver.h"
+
+#include <alsa/asoundlib.h>
+
+#include "xenia/apu/alsa/alsa_apu_flags.h"
+#include "xenia/apu/apu_flags.h"
+#include "xenia/base/logging.h"
+
+namespace xe {
+namespace apu {
+namespace alsa {
+
+// How much audio the device itself buffers, beyond the queued frames.
+constexpr uint32_t kDeviceLatencyUs = 20000;
+
+const float AlsaAudioDriver::kSilence[kFrameSamples] = {};
+
+AlsaAudioDriver::AlsaAudioDriver(Memory* memory,
+                                 xe::threading::Semaphore* semaphore)
+    : AudioDriver(memory), semaphore_(semaphore) {
+  pulls_frames_ = true;
+}
+
+AlsaAudioDriver::~AlsaAudioDriver() = default;
+
+bool AlsaAudioDriver::Initialize() {
+  int err = snd_pcm_open(&pcm_, FLAGS_alsa_device.c_str(),
+                         SND_PCM_STREAM_PLAYBACK, 0);
+  if (err < 0) {
+    XELOGE("snd_pcm_open(%s) failed: %s", FLAGS_alsa_device.c_str(),
+           snd_strerror(err));
+    pcm_ = nullptr;
+    return false;
+  }
+  // The plug layer of the default device converts to whatever the hardware
+  // takes.
+  err = snd_pcm_set_params(pcm_, SND_PCM_FORMAT_FLOAT_LE,
+                           SND_PCM_ACCESS_RW_INTERLEAVED, kFrameChannels,
+                           kSampleRate, 1, kDeviceLatencyUs);
+  if (err < 0) {
+    XELOGE("snd_pcm_set_params failed: %s", snd_strerror(err));
+    snd_pcm_close(pcm_);
+    pcm_ = nullptr;
+    return false;
+  }
+
+  playback_running_ = true;
+  playback_thread_ =
+      xe::threading::Thread::Create({}, [this]() { PlaybackThreadMain(); });
+  playback_thread_->set_name("ALSA Audio Playback");
+  return true;
+}
+
+void AlsaAudioDriver::SubmitFrame(uint32_t frame_ptr) {
+  // The client semaphore keeps the guest from having more frames queued than
+  // the ring has.
+  auto output_frame = CopyFrame(frame_ptr);
+  assert_not_null(output_frame);
+  if (!output_frame) {
+    semaphore_->Release(1, nullptr);
+    return;
+  }
+  QueueFrame();
+}
+
+void AlsaAudioDriver::PlaybackThreadMain() {
+  // Only the first frame missed after playing counts as an underrun, as the
+  // guest may simply have nothing to play.
+  bool played = false;
+  while (playback_running_) {
+    auto frame = PeekFrame();
+    if (!frame) {
+      if (!WriteFrame(kSilence)) {
+        break;
+      }
+      if (played) {
+        played = false;
+        uint32_t frame_count = MissFrame();
+        if (frame_count) {
+          semaphore_->Release(frame_count, nullptr);
+        }
+      }
+      continue;
+    }
+    // The guest time scalar isn't followed, the device plays at 48 kHz.
+    if (!WriteFrame(FLAGS_mute ? kSilence : frame)) {
+      break;
+    }
+    played = true;
+    uint32_t frame_count = ReleaseFrame();
+    if (frame_count) {
+      semaphore_->Release(frame_count, nullptr);
+    }
+  }
+}
+
+bool AlsaAudioDriver::WriteFrame(const float* frame) {
+  snd_pcm_uframes_t offset = 0;
+  while (offset < kChannelSamples) {
+    snd_pcm_sframes_t written = snd_pcm_writei(
+        pcm_, frame + offset * kFrameChannels, kChannelSamples - offset);
+    if (written < 0) {
+      // Recovers from the device running dry, silently.
+      int err = snd_pcm_recover(pcm_, int(written), 1);
+      if (err < 0) {
+        XELOGE("snd_pcm_writei failed: %s", snd_strerror(err));
+        return false;
+      }
+      continue;
+    }
+    offset += snd_pcm_uframes_t(written);
+  }
+  return true;
+}
+
+void AlsaAudioDriver::Shutdown() {
+  if (playback_thread_) {
+    // Writes block for a device period at most.
+    playback_running_ = false;
+    xe::threading::Wait(playback_thread_.get(), false);
+    playback_thread_.reset();
+  }
+  if (pcm_) {
+    snd_pcm_drop(pcm_);
+    snd_pcm_close(pcm_);
+    pcm_ = nullptr;
+  }
+}
+
+}  // namespace alsa
+}  // namespace apu
+}  // namespace xe
@@ -0,0 +1,54 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2016 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#ifndef XENIA_APU_ALSA_ALSA_AUDIO_DRIVER_H_
+#define XENIA_APU_ALSA_ALSA_AUDIO_DRIVER_H_
+
+#include <atomic>
+#include <memory>
+
+#include "xenia/apu/audio_driver.h"
+#include "xenia/base/threading.h"
+
+typedef struct _snd_pcm snd_pcm_t;
+
+namespace xe {
+namespace apu {
+namespace alsa {
+
+// Plays the queued frames on a thread of its own, which pulls them from the
+// ring as the device has room for them. Writing to the device blocks, so the
+// thread takes no locks and allocates nothing, and waits for nothing else.
+class AlsaAudioDriver : public AudioDriver {
+ public:
+  AlsaAudioDriver(Memory* memory, xe::threading::Semaphore* semaphore);
+  ~AlsaAudioDriver() override;
+
+  bool Initialize();
+  void SubmitFrame(uint32_t frame_ptr) override;
+  void Shutdown();
+
+ private:
+  void PlaybackThreadMain();
+  // Returns false if the device can't recover from an error.
+  bool WriteFrame(const float* frame);
+
+  xe::threading::Semaphore* semaphore_ = nullptr;
+  snd_pcm_t* pcm_ = nullptr;
+  std::unique_ptr<xe::threading::Thread> playback_thread_;
+  std::atomic<bool> playback_running_ = {false};
+
+  static const float kSilence[kFrameSamples];
+};
+
+}  // namespace alsa
+}  // namespace apu
+}  // namespace xe
+
+#endif  // XENIA_APU_ALSA_ALSA_AUDIO_DRIVER_H_
@@ -0,0 +1,65 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2016 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#include "xenia/apu/alsa/alsa_audio_system.h"
+
+#include <alsa/asoundlib.h>
+
+#include "xenia/apu/alsa/alsa_apu_flags.h"
+#include "xenia/apu/alsa/alsa_audio_driver.h"
+#include "xenia/base/logging.h"
+
+namespace xe {
+namespace apu {
+namespace alsa {
+
+std::unique_ptr<AudioSystem> AlsaAudioSystem::Create(
+    cpu::Processor* processor) {
+  // Each client opens the device for itself, so only check it's there.
+  snd_pcm_t* pcm;
+  int err = snd_pcm_open(&pcm, FLAGS_alsa_device.c_str(),
+                         SND_PCM_STREAM_PLAYBACK, SND_PCM_NONBLOCK);
+  if (err < 0) {
+    XELOGW("ALSA device %s unavailable: %s", FLAGS_alsa_device.c_str(),
+           snd_strerror(err));
+    return nullptr;
+  }
+  snd_pcm_close(pcm);
+  return std::make_unique<AlsaAudioSystem>(processor);
+}
+
+AlsaAudioSystem::AlsaAudioSystem(cpu::Processor* processor)
+    : AudioSystem(processor) {}
+
+AlsaAudioSystem::~AlsaAudioSystem() = default;
+
+X_STATUS AlsaAudioSystem::CreateDriver(size_t index,
+                                       xe::threading::Semaphore* semaphore,
+                                       AudioDriver** out_driver) {
+  assert_not_null(out_driver);
+  auto driver = new AlsaAudioDriver(memory_, semaphore);
+  if (!driver->Initialize()) {
+    driver->Shutdown();
+    delete driver;
+    return X_STATUS_UNSUCCESSFUL;
+  }
+  *out_driver = driver;
+  return X_STATUS_SUCCESS;
+}
+
+void AlsaAudioSystem::DestroyDriver(AudioDriver* driver) {
+  assert_not_null(driver);
+  auto alsa_driver = static_cast<AlsaAudioDriver*>(driver);
+  alsa_driver->Shutdown();
+  delete alsa_driver;
+}
+
+}  // namespace alsa
+}  // namespace apu
+}  // namespace xe
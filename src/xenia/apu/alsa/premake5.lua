@@ -0,0 +1,19 @@
+project_root = "../../../.."
+include(project_root.."/tools/build")
+
+group("src")
+project("xenia-apu-alsa")
+  uuid("5b8e2d61-0f4c-4a97-b3d2-7c91e6a4f058")
+  kind("StaticLib")
+  language("C++")
+  links({
+    "asound",
+    "xenia-base",
+    "xenia-apu",
+  })
+  defines({
+  })
+  includedirs({
+    project_root.."/third_party/gflags/src",
+  })
+  local_platform_files()
@@ -10,3 +10,21 @@
 #include "xenia/apu/apu_flags.h"
 
 DEFINE_bool(mute, false, "Mutes all audio output.");
+DEFINE_bool(audio_mixer, false,
+            "Mixes all audio clients into one host stream, rather than "
+            "playing each with a host voice of its own.");
+DEFINE_int32(xma_decoder_threads, 0,
+             "Number of threads decoding XMA contexts, or 0 to pick one "
+             "based on the number of logical processors.");
+DEFINE_string(xma_decoder_cpus, "",
+              "Host logical processors the XMA decoder threads are pinned "
+              "to, e.g. \"8-11\". Empty to not pin them.");
+DEFINE_int32(xma_frame_cache_mb, 32,
+             "Megabytes of decoded XMA frames kept to play again without "
+             "decoding, or 0 to always decode.");
+DEFINE_int32(audio_target_latency_ms, 64,
+             "Least audio kept queued to the host, in milliseconds. More is "
+             "queued after the host runs out, until it keeps up again.");
+DEFINE_int32(apu_stats_interval_ms, 0,
+             "Interval at which XMA decode times and audio latencies are "
+             "logged, in milliseconds, or 0 to not log them.");
@@ -13,5 +13,11 @@
 #include <gflags/gflags.h>
 
 DECLARE_bool(mute);
+DECLARE_bool(audio_mixer);
+DECLARE_int32(xma_decoder_threads);
+DECLARE_string(xma_decoder_cpus);
+DECLARE_int32(audio_target_latency_ms);
+DECLARE_int32(xma_frame_cache_mb);
+DECLARE_int32(apu_stats_interval_ms);
 
 #endif  // XENIA_APU_APU_FLAGS_H_
@@ -9,12 +9,144 @@
 
 #include "xenia/apu/audio_driver.h"
 
+#include <algorithm>
+#include <cstdlib>
+
+#include "xenia/apu/apu_flags.h"
+#include "xenia/base/byte_order.h"
+#include "xenia/base/clock.h"
+#include "xenia/base/profiling.h"
+
 namespace xe {
 namespace apu {
 
-AudioDriver::AudioDriver(Memory* memory) : memory_(memory) {}
+AudioDriver::AudioDriver(Memory* memory) : memory_(memory) {
+  set_target_latency_ms(uint32_t(std::max(FLAGS_audio_target_latency_ms, 0)));
+}
+
+void AudioDriver::set_target_latency_ms(uint32_t latency_ms) {
+  uint64_t sample_count = uint64_t(latency_ms) * kSampleRate / 1000;
+  uint32_t frame_count = uint32_t(std::min(
+      (sample_count + kChannelSamples - 1) / kChannelSamples,
+      uint64_t(kFrameCount)));
+  // At least one frame has to be queued while the next one is submitted.
+  min_queue_frame_count_ = std::min(std::max(frame_count, 2u), kFrameCount);
+  queue_frame_count_.store(min_queue_frame_count_, std::memory_order_relaxed);
+}
 
 AudioDriver::~AudioDriver() = default;
 
+float* AudioDriver::CopyFrame(uint32_t samples_ptr) {
+  // Frames before the read index have been played, and only this thread
+  // moves the write index.
+  uint32_t write_index = write_index_.load(std::memory_order_relaxed);
+  if (write_index - read_index_.load(std::memory_order_acquire) >=
+      kFrameCount) {
+    return nullptr;
+  }
+
+  // The guest frame holds the channels one after another, as big endian
+  // floats.
+  // How far the guest keeps ahead of the host, and how evenly it submits.
+  uint32_t queued_frame_count =
+      write_index - read_index_.load(std::memory_order_relaxed);
+  uint64_t tick = Clock::QueryHostTickCount();
+  if (last_copy_tick_) {
+    int64_t interval_us = int64_t((tick - last_copy_tick_) * 1000000 /
+                                  Clock::host_tick_frequency());
+    int64_t frame_us = int64_t(kChannelSamples) * 1000000 / kSampleRate;
+    COUNT_profile_cpu("apu/audio_driver/submit_jitter_us",
+                      int(std::abs(interval_us - frame_us)));
+  }
+  last_copy_tick_ = tick;
+  COUNT_profile_cpu("apu/audio_driver/queued_ms",
+                    int(queued_frame_count * kChannelSamples * 1000 /
+                        kSampleRate));
+  COUNT_profile_cpu("apu/audio_driver/queue_frames", int(queue_frame_count()));
+  COUNT_profile_cpu("apu/audio_driver/underruns",
+                    int(underrun_count_.load(std::memory_order_relaxed)));
+
+  auto input_frame = memory_->TranslateVirtual<const float*>(samples_ptr);
+  frame_ticks_[write_index % kFrameCount] = tick;
+  auto output_frame = frames_[write_index % kFrameCount];
+  for (uint32_t index = 0, o = 0; index < kChannelSamples; ++index) {
+    for (uint32_t channel = 0, table = 0; channel < kFrameChannels;
+         ++channel, table += kChannelSamples) {
+      output_frame[o++] = xe::byte_swap(input_frame[table + index]);
+    }
+  }
+  return output_frame;
+}
+
+uint32_t AudioDriver::ReleaseFrame() {
+  uint32_t read_index = read_index_.load(std::memory_order_relaxed);
+  uint64_t latency_us =
+      (Clock::QueryHostTickCount() - frame_ticks_[read_index % kFrameCount]) *
+      1000000 / Clock::host_tick_frequency();
+  COUNT_profile_cpu("apu/audio_driver/playback_latency_us", int(latency_us));
+  interval_played_frame_count_.fetch_add(1, std::memory_order_relaxed);
+  interval_total_latency_us_.fetch_add(latency_us, std::memory_order_relaxed);
+  // Only the consumer raises the max, so it can't be raised meanwhile.
+  if (latency_us > interval_max_latency_us_.load(std::memory_order_relaxed)) {
+    interval_max_latency_us_.store(latency_us, std::memory_order_relaxed);
+  }
+  read_index_.store(++read_index, std::memory_order_release);
+
+  if (!pulls_frames_ &&
+      read_index == write_index_.load(std::memory_order_acquire)) {
+    // Everything has been played, and the host is waiting for the guest.
+    return 1 + MissFrame();
+  }
+  uint32_t queue_frame_count =
+      queue_frame_count_.load(std::memory_order_relaxed);
+  if (++frames_since_underrun_ >= kShrinkFrames &&
+      queue_frame_count > min_queue_frame_count_) {
+    frames_since_underrun_ = 0;
+    queue_frame_count_.store(queue_frame_count - 1, std::memory_order_relaxed);
+    return 0;
+  }
+  return 1;
+}
+
+const float* AudioDriver::PeekFrame() const {
+  uint32_t read_index = read_index_.load(std::memory_order_relaxed);
+  if (read_index == write_index_.load(std::memory_order_acquire)) {
+    return nullptr;
+  }
+  return frames_[read_index % kFrameCount];
+}
+
+AudioDriverStats AudioDriver::TakeIntervalStats() {
+  // Frames released while taking them may be counted in either interval.
+  AudioDriverStats stats;
+  stats.played_frame_count =
+      interval_played_frame_count_.exchange(0, std::memory_order_relaxed);
+  stats.total_latency_us =
+      interval_total_latency_us_.exchange(0, std::memory_order_relaxed);
+  stats.max_latency_us =
+      interval_max_latency_us_.exchange(0, std::memory_order_relaxed);
+  uint32_t underrun_count = underrun_count_.load(std::memory_order_relaxed);
+  stats.underrun_count = underrun_count - interval_underrun_base_;
+  interval_underrun_base_ = underrun_count;
+  // The read index first, so it can't be past the write index.
+  uint32_t read_index = read_index_.load(std::memory_order_acquire);
+  stats.queued_frame_count =
+      write_index_.load(std::memory_order_relaxed) - read_index;
+  stats.queue_frame_count = queue_frame_count();
+  return stats;
+}
+
+uint32_t AudioDriver::MissFrame() {
+  underrun_count_.fetch_add(1, std::memory_order_relaxed);
+  frames_since_underrun_ = 0;
+  uint32_t queue_frame_count =
+      queue_frame_count_.load(std::memory_order_relaxed);
+  if (queue_frame_count >= kFrameCount) {
+    return 0;
+  }
+  queue_frame_count_.store(queue_frame_count + 1, std::memory_order_relaxed);
+  return 1;
+}
+
 }  // namespace apu
 }  // namespace xe
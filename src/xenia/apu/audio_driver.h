@@ -10,12 +10,26 @@
 #ifndef XENIA_APU_AUDIO_DRIVER_H_
 #define XENIA_APU_AUDIO_DRIVER_H_
 
+#include <atomic>
+
 #include "xenia/memory.h"
 #include "xenia/xbox.h"
 
 namespace xe {
 namespace apu {
 
+// Time from the guest submitting frames to the host being done playing them,
+// and how much was queued meanwhile.
+struct AudioDriverStats {
+  uint32_t played_frame_count;
+  uint64_t total_latency_us;
+  uint64_t max_latency_us;
+  uint32_t underrun_count;
+  // At the time the stats were taken.
+  uint32_t queued_frame_count;
+  uint32_t queue_frame_count;
+};
+
 class AudioDriver {
  public:
   explicit AudioDriver(Memory* memory);
@@ -23,12 +37,84 @@ class AudioDriver {
 
   virtual void SubmitFrame(uint32_t samples_ptr) = 0;
 
+  static const uint32_t kFrameCount = 64;
+  static const uint32_t kFrameChannels = 6;
+  static const uint32_t kChannelSamples = 256;
+  static const uint32_t kFrameSamples = kFrameChannels * kChannelSamples;
+  static const uint32_t kFrameSize = sizeof(float) * kFrameSamples;
+  static const uint32_t kSampleRate = 48000;
+
+  // Sets how much audio is queued to the host at least. Each time the host
+  // plays all that was queued, one more frame is allowed, up to kFrameCount,
+  // and a frame less again after kShrinkFrames without that happening.
+  // Must be set before the guest is allowed to submit anything.
+  void set_target_latency_ms(uint32_t latency_ms);
+  // Frames the guest may currently have queued.
+  uint32_t queue_frame_count() const {
+    return queue_frame_count_.load(std::memory_order_relaxed);
+  }
+  // Drivers able to resample follow the guest time scalar by default. The
+  // mixed stream is already resampled.
+  void set_follow_time_scalar(bool follow) { follow_time_scalar_ = follow; }
+
+  // Returns the stats since the last call. Any thread may take them, but
+  // only one at a time.
+  AudioDriverStats TakeIntervalStats();
+
  protected:
+  static const uint32_t kShrinkFrames = 1024;
+
+  // The frames queued to the host form a ring with a single producer, the
+  // audio worker thread submitting guest frames, and a single consumer, the
+  // host API thread where the frames finish playing, so neither ever locks.
+  // The guest frame is copied once, straight into the next frame of the
+  // ring, interleaved as the host expects.
+  // Returns nullptr if all frames are queued.
+  float* CopyFrame(uint32_t samples_ptr);
+  // Makes the frame returned by CopyFrame the newest queued one.
+  void QueueFrame() {
+    write_index_.store(write_index_.load(std::memory_order_relaxed) + 1,
+                       std::memory_order_release);
+  }
+  // Called by the consumer once the oldest queued frame has been played.
+  // Returns how many frames the guest may submit for it, which is 1 unless
+  // the queue is resized.
+  uint32_t ReleaseFrame();
+
+  // For consumers pulling the frames to play themselves, which must set
+  // pulls_frames_. Returns the oldest queued frame, or nullptr if none is.
+  const float* PeekFrame() const;
+  // Called by pulling consumers when no frame was queued in time, counting
+  // an underrun. Returns how many more frames the guest may submit.
+  uint32_t MissFrame();
+
   inline uint8_t* TranslatePhysical(uint32_t guest_address) const {
     return memory_->TranslatePhysical(guest_address);
   }
 
   Memory* memory_ = nullptr;
+  // Underruns are counted by MissFrame rather than when the queue runs dry.
+  bool pulls_frames_ = false;
+  bool follow_time_scalar_ = true;
+
+ private:
+  std::atomic<uint32_t> write_index_ = {0};
+  std::atomic<uint32_t> read_index_ = {0};
+  float frames_[kFrameCount][kFrameSamples];
+  // Host ticks at which the guest submitted the frames.
+  uint64_t frame_ticks_[kFrameCount] = {};
+
+  uint32_t min_queue_frame_count_ = kFrameCount;
+  std::atomic<uint32_t> queue_frame_count_ = {kFrameCount};
+  // Only used by the consumer.
+  uint32_t frames_since_underrun_ = 0;
+  std::atomic<uint32_t> underrun_count_ = {0};
+  std::atomic<uint32_t> interval_played_frame_count_ = {0};
+  std::atomic<uint64_t> interval_total_latency_us_ = {0};
+  std::atomic<uint64_t> interval_max_latency_us_ = {0};
+  uint32_t interval_underrun_base_ = 0;
+  // Only used by the producer.
+  uint64_t last_copy_tick_ = 0;
 };
 
 }  // namespace apu
@@ -0,0 +1,201 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2016 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#include "xenia/apu/audio_mixer.h"
+
+#include <emmintrin.h>
+
+#include <algorithm>
+#include <cstring>
+
+#include "xenia/base/assert.h"
+#include "xenia/base/byte_order.h"
+#include "xenia/base/clock.h"
+#include "xenia/base/math.h"
+#include "xenia/base/profiling.h"
+
+namespace xe {
+namespace apu {
+
+constexpr double AudioMixer::kMinRatio;
+constexpr double AudioMixer::kMaxRatio;
+
+// Queues the frames of a client like a host driver would, for the mixer to
+// pull them from.
+class AudioMixer::Input : public AudioDriver {
+ public:
+  Input(Memory* memory, xe::threading::Semaphore* semaphore)
+      : AudioDriver(memory), semaphore_(semaphore) {
+    pulls_frames_ = true;
+    staged_.resize(kStagedSamples * kFrameChannels);
+  }
+
+  void SubmitFrame(uint32_t frame_ptr) override {
+    // The client semaphore keeps the guest from having more frames queued
+    // than the ring has.
+    auto output_frame = CopyFrame(frame_ptr);
+    assert_not_null(output_frame);
+    if (!output_frame) {
+      semaphore_->Release(1, nullptr);
+      return;
+    }
+    QueueFrame();
+  }
+
+  // Adds the next frame to the mix, resampled by the ratio.
+  void Mix(double ratio, float volume, float* mix);
+
+ private:
+  // Enough for the samples of a frame at the highest ratio, those
+  // interpolated with, and one more input frame.
+  static const size_t kStagedSamples =
+      size_t(kChannelSamples * (kMaxRatio + 1)) + 8;
+
+  // Pulls frames until at least sample_count samples are staged. Missing
+  // frames are played as silence.
+  void Stage(size_t sample_count);
+
+  xe::threading::Semaphore* semaphore_ = nullptr;
+  // Interleaved samples from position_ on, where the next mixed frame
+  // starts, between two of them.
+  std::vector<float> staged_;
+  size_t staged_count_ = 0;
+  double position_ = 0.0;
+  // Only the first frame missed after playing counts as an underrun, as the
+  // guest may simply have nothing to play.
+  bool played_ = false;
+};
+
+void AudioMixer::Input::Stage(size_t sample_count) {
+  while (staged_count_ < sample_count) {
+    assert_true(staged_count_ + kChannelSamples <= kStagedSamples);
+    float* staged = staged_.data() + staged_count_ * kFrameChannels;
+    uint32_t frame_count = 0;
+    auto frame = PeekFrame();
+    if (frame) {
+      std::memcpy(staged, frame, kFrameSize);
+      frame_count = ReleaseFrame();
+      played_ = true;
+    } else {
+      std::memset(staged, 0, kFrameSize);
+      if (played_) {
+        played_ = false;
+        frame_count = MissFrame();
+      }
+    }
+    staged_count_ += kChannelSamples;
+    if (frame_count) {
+      semaphore_->Release(frame_count, nullptr);
+    }
+  }
+}
+
+void AudioMixer::Input::Mix(double ratio, float volume, float* mix) {
+  // Interpolating the last sample needs the one after it.
+  Stage(size_t(position_ + (kChannelSamples - 1) * ratio) + 2);
+
+  const float* staged = staged_.data();
+  __m128 volume_vector = _mm_set1_ps(volume);
+  if (volume == 0.0f) {
+    // Muted, so the frames are only consumed.
+  } else if (ratio == 1.0 && position_ == 0.0) {
+    // The samples line up with the mixed ones.
+    for (uint32_t i = 0; i < kFrameSamples; i += 4) {
+      __m128 sum = _mm_add_ps(
+          _mm_loadu_ps(mix + i),
+          _mm_mul_ps(_mm_loadu_ps(staged + i), volume_vector));
+      _mm_storeu_ps(mix + i, sum);
+    }
+  } else {
+    // Linear interpolation, four channels and then the other two.
+    static_assert(kFrameChannels == 6, "Mixing assumes 6 channels");
+    for (uint32_t j = 0; j < kChannelSamples; ++j) {
+      double position = position_ + j * ratio;
+      size_t index = size_t(position);
+      __m128 t = _mm_set1_ps(float(position - index));
+      const float* a = staged + index * kFrameChannels;
+      const float* b = a + kFrameChannels;
+      float* out = mix + j * kFrameChannels;
+
+      __m128 a_low = _mm_loadu_ps(a);
+      __m128 b_low = _mm_loadu_ps(b);
+      __m128 low =
+          _mm_add_ps(a_low, _mm_mul_ps(t, _mm_sub_ps(b_low, a_low)));
+      _mm_storeu_ps(out, _mm_add_ps(_mm_loadu_ps(out),
+                                    _mm_mul_ps(low, volume_vector)));
+
+      __m128 zero = _mm_setzero_ps();
+      __m128 a_high =
+          _mm_loadl_pi(zero, reinterpret_cast<const __m64*>(a + 4));
+      __m128 b_high =
+          _mm_loadl_pi(zero, reinterpret_cast<const __m64*>(b + 4));
+      __m128 high =
+          _mm_add_ps(a_high, _mm_mul_ps(t, _mm_sub_ps(b_high, a_high)));
+      __m128 out_high =
+          _mm_loadl_pi(zero, reinterpret_cast<const __m64*>(out + 4));
+      _mm_storel_pi(reinterpret_cast<__m64*>(out + 4),
+                    _mm_add_ps(out_high, _mm_mul_ps(high, volume_vector)));
+    }
+  }
+
+  // The position may end up past the staged samples when downsampling.
+  position_ += kChannelSamples * ratio;
+  size_t consumed = std::min(size_t(position_), staged_count_);
+  position_ -= consumed;
+  staged_count_ -= consumed;
+  std::memmove(staged_.data(), staged + consumed * kFrameChannels,
+               staged_count_ * kFrameChannels * sizeof(float));
+}
+
+AudioMixer::AudioMixer(Memory* memory) : memory_(memory) {}
+
+AudioMixer::~AudioMixer() {
+  for (auto input : inputs_) {
+    delete input;
+  }
+  inputs_.clear();
+}
+
+AudioDriver* AudioMixer::CreateInput(xe::threading::Semaphore* semaphore) {
+  auto input = new Input(memory_, semaphore);
+  inputs_.push_back(input);
+  return input;
+}
+
+void AudioMixer::DestroyInput(AudioDriver* input) {
+  auto it = std::find(inputs_.begin(), inputs_.end(), input);
+  assert_true(it != inputs_.end());
+  if (it != inputs_.end()) {
+    inputs_.erase(it);
+  }
+  delete static_cast<Input*>(input);
+}
+
+void AudioMixer::MixFrame(float volume, float* output_frame) {
+  SCOPE_profile_cpu_f("apu");
+
+  double ratio = xe::clamp(Clock::guest_time_scalar(), kMinRatio, kMaxRatio);
+  std::memset(mix_, 0, sizeof(mix_));
+  for (auto input : inputs_) {
+    input->Mix(ratio, volume, mix_);
+  }
+
+  // Back to the layout of guest frames.
+  for (uint32_t index = 0, i = 0; index < AudioDriver::kChannelSamples;
+       ++index) {
+    for (uint32_t channel = 0, table = 0;
+         channel < AudioDriver::kFrameChannels;
+         ++channel, table += AudioDriver::kChannelSamples) {
+      output_frame[table + index] = xe::byte_swap(xe::saturate(mix_[i++]));
+    }
+  }
+}
+
+}  // namespace apu
+}  // namespace xe
@@ -0,0 +1,56 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2016 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#ifndef XENIA_APU_AUDIO_MIXER_H_
+#define XENIA_APU_AUDIO_MIXER_H_
+
+#include <vector>
+
+#include "xenia/apu/audio_driver.h"
+#include "xenia/base/threading.h"
+#include "xenia/memory.h"
+
+namespace xe {
+namespace apu {
+
+// Mixes the frames of all clients into one stream for a single host driver,
+// resampling them to follow the guest time scalar. The inputs are drivers
+// queuing the guest frames, from which the mixer pulls as many as it needs
+// for each mixed frame. The AudioSystem lock must be held for everything.
+class AudioMixer {
+ public:
+  explicit AudioMixer(Memory* memory);
+  ~AudioMixer();
+
+  // Frames the mixer takes from the input are released to the semaphore.
+  AudioDriver* CreateInput(xe::threading::Semaphore* semaphore);
+  void DestroyInput(AudioDriver* input);
+
+  // Mixes the next frame of all inputs at the volume, writing it to the
+  // guest frame, as big endian floats with the channels one after another.
+  void MixFrame(float volume, float* output_frame);
+
+  // Input is resampled by up to this ratio, and the guest time scalar is
+  // clamped to the range.
+  static constexpr double kMinRatio = 0.25;
+  static constexpr double kMaxRatio = 4.0;
+
+ private:
+  class Input;
+
+  Memory* memory_ = nullptr;
+  std::vector<Input*> inputs_;
+  // Interleaved, as the inputs queue them.
+  float mix_[AudioDriver::kFrameSamples];
+};
+
+}  // namespace apu
+}  // namespace xe
+
+#endif  // XENIA_APU_AUDIO_MIXER_H_
@@ -9,10 +9,15 @@
 
 #include "xenia/apu/audio_system.h"
 
+#include <cinttypes>
+
 #include "xenia/apu/apu_flags.h"
 #include "xenia/apu/audio_driver.h"
+#include "xenia/apu/audio_mixer.h"
 #include "xenia/apu/xma_decoder.h"
 #include "xenia/base/byte_stream.h"
+#include "xenia/base/clock.h"
+#include "xenia/base/counters.h"
 #include "xenia/base/logging.h"
 #include "xenia/base/math.h"
 #include "xenia/base/profiling.h"
@@ -33,6 +38,8 @@
 // and let the normal AudioSystem handling take it, to prevent duplicate
 // implementations. They can be found in xboxkrnl_audio_xma.cc
 
+DEFINE_counter(audio_frames, "apu.frames");
+
 namespace xe {
 namespace apu {
 
@@ -49,6 +56,8 @@ AudioSystem::AudioSystem(cpu::Processor* processor)
   }
   shutdown_event_ = xe::threading::Event::CreateAutoResetEvent(false);
   wait_handles_[kMaximumClientCount] = shutdown_event_.get();
+  mixer_semaphore_ = xe::threading::Semaphore::Create(0, kMaximumQueuedFrames);
+  wait_handles_[kMaximumClientCount + 1] = mixer_semaphore_.get();
 
   xma_decoder_ = std::make_unique<xe::apu::XmaDecoder>(processor_);
 
@@ -67,6 +76,20 @@ X_STATUS AudioSystem::Setup(kernel::KernelState* kernel_state) {
     return result;
   }
 
+  if (FLAGS_audio_mixer) {
+    AudioDriver* driver = nullptr;
+    if (XSUCCEEDED(CreateDriver(kMaximumClientCount, mixer_semaphore_.get(),
+                                &driver))) {
+      mixer_ = std::make_unique<AudioMixer>(memory_);
+      mixer_driver_ = driver;
+      mixer_driver_->set_follow_time_scalar(false);
+      mixer_frame_ptr_ = memory()->SystemHeapAlloc(AudioDriver::kFrameSize);
+      mixer_semaphore_->Release(mixer_driver_->queue_frame_count(), nullptr);
+    } else {
+      XELOGW("AudioSystem: no driver for the mixed stream, not mixing");
+    }
+  }
+
   worker_running_ = true;
   worker_thread_ = kernel::object_ref<kernel::XHostThread>(
       new kernel::XHostThread(kernel_state, 128 * 1024, 0, [this]() {
@@ -85,18 +108,37 @@ void AudioSystem::WorkerThreadMain() {
   // Initialize driver and ringbuffer.
   Initialize();
 
+  auto stats_interval = std::chrono::milliseconds::max();
+  if (FLAGS_apu_stats_interval_ms > 0) {
+    stats_interval = std::chrono::milliseconds(FLAGS_apu_stats_interval_ms);
+    last_stats_tick_ = Clock::QueryHostTickCount();
+  }
+
   // Main run loop.
   while (worker_running_) {
     // These handles signify the number of submitted samples. Once we reach
     // 64 samples, we wait until our audio backend releases a semaphore
     // (signaling a sample has finished playing)
-    auto result =
-        xe::threading::WaitAny(wait_handles_, xe::countof(wait_handles_), true);
-    if (result.first == xe::threading::WaitResult::kFailed) {
+    auto result = xe::threading::WaitAny(
+        wait_handles_, xe::countof(wait_handles_), true, stats_interval);
+    if (FLAGS_apu_stats_interval_ms > 0 &&
+        (Clock::QueryHostTickCount() - last_stats_tick_) * 1000 >=
+            uint64_t(FLAGS_apu_stats_interval_ms) *
+                Clock::host_tick_frequency()) {
+      LogStats();
+    }
+    if (result.first == xe::threading::WaitResult::kFailed ||
+        result.first == xe::threading::WaitResult::kTimeout) {
       // TODO: Assert?
       continue;
     }
 
+    if (result.first == threading::WaitResult::kSuccess &&
+        result.second == kMaximumClientCount + 1) {
+      MixFrame();
+      continue;
+    }
+
     if (result.first == threading::WaitResult::kSuccess &&
         result.second == kMaximumClientCount) {
       // Shutdown event signaled.
@@ -142,6 +184,83 @@ void AudioSystem::WorkerThreadMain() {
   // TODO(benvanik): call module API to kill?
 }
 
+void AudioSystem::LogStats() {
+  uint64_t tick = Clock::QueryHostTickCount();
+  uint64_t interval_ms =
+      (tick - last_stats_tick_) * 1000 / Clock::host_tick_frequency();
+  last_stats_tick_ = tick;
+
+  auto xma_stats = xma_decoder_->TakeIntervalStats();
+  if (xma_stats.decode_count) {
+    XELOGAPU("AudioSystem: %" PRIu64 " XMA decodes in %" PRIu64
+             " ms, latency %" PRIu64 " us average, %" PRIu64
+             " us max, decode %" PRIu64 " us average, %" PRIu64 " us max",
+             xma_stats.decode_count, interval_ms,
+             xma_stats.total_latency_us / xma_stats.decode_count,
+             xma_stats.max_latency_us,
+             xma_stats.total_decode_us / xma_stats.decode_count,
+             xma_stats.max_decode_us);
+  }
+
+  auto global_lock = global_critical_region_.Acquire();
+  for (size_t i = 0; i < kMaximumClientCount; ++i) {
+    if (!clients_[i].in_use || !clients_[i].driver) {
+      continue;
+    }
+    auto stats = clients_[i].driver->TakeIntervalStats();
+    uint64_t average_latency_us =
+        stats.played_frame_count
+            ? stats.total_latency_us / stats.played_frame_count
+            : 0;
+    XELOGAPU("AudioSystem: client %zu played %u frames, latency %" PRIu64
+             " us average, %" PRIu64 " us max, %u underruns, %u/%u queued",
+             i, stats.played_frame_count, average_latency_us,
+             stats.max_latency_us, stats.underrun_count,
+             stats.queued_frame_count, stats.queue_frame_count);
+  }
+  if (mixer_driver_) {
+    auto stats = mixer_driver_->TakeIntervalStats();
+    uint64_t average_latency_us =
+        stats.played_frame_count
+            ? stats.total_latency_us / stats.played_frame_count
+            : 0;
+    XELOGAPU("AudioSystem: mixer played %u frames, latency %" PRIu64
+             " us average, %" PRIu64 " us max, %u underruns, %u/%u queued",
+             stats.played_frame_count, average_latency_us,
+             stats.max_latency_us, stats.underrun_count,
+             stats.queued_frame_count, stats.queue_frame_count);
+  }
+}
+
+void AudioSystem::MixFrame() {
+  auto global_lock = global_critical_region_.Acquire();
+  if (!mixer_driver_) {
+    return;
+  }
+  // Muting costs the driver nothing, it plays the silence like any frame.
+  mixer_->MixFrame(FLAGS_mute ? 0.0f : 1.0f,
+                   memory()->TranslateVirtual<float*>(mixer_frame_ptr_));
+  mixer_driver_->SubmitFrame(mixer_frame_ptr_);
+}
+
+X_STATUS AudioSystem::CreateClientDriver(size_t index,
+                                         xe::threading::Semaphore* semaphore,
+                                         AudioDriver** out_driver) {
+  if (mixer_) {
+    *out_driver = mixer_->CreateInput(semaphore);
+    return X_STATUS_SUCCESS;
+  }
+  return CreateDriver(index, semaphore, out_driver);
+}
+
+void AudioSystem::DestroyClientDriver(AudioDriver* driver) {
+  if (mixer_) {
+    mixer_->DestroyInput(driver);
+    return;
+  }
+  DestroyDriver(driver);
+}
+
 int AudioSystem::FindFreeClient() {
   for (int i = 0; i < kMaximumClientCount; i++) {
     auto& client = clients_[i];
@@ -160,6 +279,13 @@ void AudioSystem::Shutdown() {
   shutdown_event_->Set();
   worker_thread_->Wait(0, 0, 0, nullptr);
   worker_thread_.reset();
+
+  if (mixer_driver_) {
+    DestroyDriver(mixer_driver_);
+    mixer_driver_ = nullptr;
+    memory()->SystemHeapFree(mixer_frame_ptr_);
+    mixer_frame_ptr_ = 0;
+  }
 }
 
 X_STATUS AudioSystem::RegisterClient(uint32_t callback, uint32_t callback_arg,
@@ -170,16 +296,17 @@ X_STATUS AudioSystem::RegisterClient(uint32_t callback, uint32_t callback_arg,
   assert_true(index >= 0);
 
   auto client_semaphore = client_semaphores_[index].get();
-  auto ret = client_semaphore->Release(kMaximumQueuedFrames, nullptr);
-  assert_true(ret);
-
   AudioDriver* driver;
-  auto result = CreateDriver(index, client_semaphore, &driver);
+  auto result = CreateClientDriver(index, client_semaphore, &driver);
   if (XFAILED(result)) {
     return result;
   }
   assert_not_null(driver);
 
+  // The driver lets the guest submit more as the queued frames are played.
+  auto ret = client_semaphore->Release(driver->queue_frame_count(), nullptr);
+  assert_true(ret);
+
   uint32_t ptr = memory()->SystemHeapAlloc(0x4);
   xe::store_and_swap<uint32_t>(memory()->TranslateVirtual(ptr), callback_arg);
 
@@ -198,6 +325,7 @@ void AudioSystem::SubmitFrame(size_t index, uint32_t samples_ptr) {
   auto global_lock = global_critical_region_.Acquire();
   assert_true(index < kMaximumClientCount);
   assert_true(clients_[index].driver != NULL);
+  INCREMENT_counter(audio_frames, 1);
   (clients_[index].driver)->SubmitFrame(samples_ptr);
 }
 
@@ -206,7 +334,7 @@ void AudioSystem::UnregisterClient(size_t index) {
 
   auto global_lock = global_critical_region_.Acquire();
   assert_true(index < kMaximumClientCount);
-  DestroyDriver(clients_[index].driver);
+  DestroyClientDriver(clients_[index].driver);
   memory()->SystemHeapFree(clients_[index].wrapped_callback_arg);
   clients_[index] = {0};
 
@@ -273,11 +401,8 @@ bool AudioSystem::Restore(ByteStream* stream) {
     client.in_use = true;
 
     auto client_semaphore = client_semaphores_[id].get();
-    auto ret = client_semaphore->Release(kMaximumQueuedFrames, nullptr);
-    assert_true(ret);
-
     AudioDriver* driver = nullptr;
-    auto status = CreateDriver(id, client_semaphore, &driver);
+    auto status = CreateClientDriver(id, client_semaphore, &driver);
     if (XFAILED(status)) {
       XELOGE(
           "AudioSystem::Restore - Call to CreateDriver failed with status %.8X",
@@ -287,6 +412,9 @@ bool AudioSystem::Restore(ByteStream* stream) {
 
     assert_not_null(driver);
     client.driver = driver;
+
+    auto ret = client_semaphore->Release(driver->queue_frame_count(), nullptr);
+    assert_true(ret);
   }
 
   return true;
@@ -11,6 +11,7 @@
 #define XENIA_APU_AUDIO_SYSTEM_H_
 
 #include <atomic>
+#include <memory>
 #include <queue>
 
 #include "xenia/base/mutex.h"
@@ -24,6 +25,7 @@ namespace xe {
 namespace apu {
 
 class AudioDriver;
+class AudioMixer;
 class XmaDecoder;
 
 class AudioSystem {
@@ -55,11 +57,20 @@ class AudioSystem {
   virtual void Initialize();
 
   void WorkerThreadMain();
+  // Logs the XMA and driver stats since the last call.
+  void LogStats();
+  // Mixes the clients into the next frame of the mixed stream.
+  void MixFrame();
 
   virtual X_STATUS CreateDriver(size_t index,
                                 xe::threading::Semaphore* semaphore,
                                 AudioDriver** out_driver) = 0;
   virtual void DestroyDriver(AudioDriver* driver) = 0;
+  // Creates a driver for the client, a mixer input if clients are mixed.
+  X_STATUS CreateClientDriver(size_t index,
+                              xe::threading::Semaphore* semaphore,
+                              AudioDriver** out_driver);
+  void DestroyClientDriver(AudioDriver* driver);
 
   // TODO(gibbed): respect XAUDIO2_MAX_QUEUED_BUFFERS somehow (ie min(64,
   // XAUDIO2_MAX_QUEUED_BUFFERS))
@@ -88,7 +99,18 @@ class AudioSystem {
       client_semaphores_[kMaximumClientCount];
   // Event is always there in case we have no clients.
   std::unique_ptr<xe::threading::Event> shutdown_event_;
-  xe::threading::WaitHandle* wait_handles_[kMaximumClientCount + 1];
+  xe::threading::WaitHandle* wait_handles_[kMaximumClientCount + 2];
+
+  // With the mixer, the only host driver, playing the mixed stream. Its
+  // semaphore is signaled for every frame to mix, into the guest memory
+  // frame it's then submitted from.
+  std::unique_ptr<AudioMixer> mixer_;
+  AudioDriver* mixer_driver_ = nullptr;
+  std::unique_ptr<xe::threading::Semaphore> mixer_semaphore_;
+  uint32_t mixer_frame_ptr_ = 0;
+
+  // Only used by the worker thread.
+  uint64_t last_stats_tick_ = 0;
 
   bool paused_ = false;
   threading::Fence pause_fence_;
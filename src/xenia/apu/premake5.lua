@@ -10,6 +10,7 @@ project("xenia-apu")
     "libavcodec",
     "libavutil",
     "xenia-base",
+    "xxhash",
   })
   defines({
   })
@@ -18,3 +19,27 @@ project("xenia-apu")
     project_root.."/third_party/libav/",
   })
   local_platform_files()
+
+group("src")
+project("xenia-apu-xma-convert-benchmark")
+  uuid("8c2e5b7a-93d4-4f1e-a6b0-5d7c1e9f3a24")
+  kind("ConsoleApp")
+  language("C++")
+  links({
+    "gflags",
+    "libavcodec",
+    "libavutil",
+    "xenia-apu",
+    "xenia-base",
+    "xxhash",
+  })
+  defines({
+  })
+  includedirs({
+    project_root.."/third_party/gflags/src",
+    project_root.."/third_party/libav/",
+  })
+  files({
+    "xma_convert_benchmark_main.cc",
+    "../base/main_"..platform_suffix..".cc",
+  })
@@ -24,29 +24,35 @@ namespace xaudio2 {
 
 class XAudio2AudioDriver::VoiceCallback : public IXAudio2VoiceCallback {
  public:
-  explicit VoiceCallback(xe::threading::Semaphore* semaphore)
-      : semaphore_(semaphore) {}
+  VoiceCallback(XAudio2AudioDriver* driver,
+                xe::threading::Semaphore* semaphore)
+      : driver_(driver), semaphore_(semaphore) {}
   ~VoiceCallback() {}
 
   void OnStreamEnd() {}
   void OnVoiceProcessingPassEnd() {}
   void OnVoiceProcessingPassStart(uint32_t samples_required) {}
   void OnBufferEnd(void* context) {
-    auto ret = semaphore_->Release(1, nullptr);
-    assert_true(ret);
+    // Buffers end in the order they were submitted.
+    uint32_t frame_count = driver_->ReleaseFrame();
+    if (frame_count) {
+      auto ret = semaphore_->Release(frame_count, nullptr);
+      assert_true(ret);
+    }
   }
   void OnBufferStart(void* context) {}
   void OnLoopEnd(void* context) {}
   void OnVoiceError(void* context, HRESULT result) {}
 
  private:
+  XAudio2AudioDriver* driver_ = nullptr;
   xe::threading::Semaphore* semaphore_ = nullptr;
 };
 
 XAudio2AudioDriver::XAudio2AudioDriver(Memory* memory,
                                        xe::threading::Semaphore* semaphore)
     : AudioDriver(memory), semaphore_(semaphore) {
-  static_assert(frame_count_ == XAUDIO2_MAX_QUEUED_BUFFERS,
+  static_assert(kFrameCount == XAUDIO2_MAX_QUEUED_BUFFERS,
                 "xaudio header differs");
 }
 
@@ -62,7 +68,7 @@ const DWORD ChannelMasks[] = {
 void XAudio2AudioDriver::Initialize() {
   HRESULT hr;
 
-  voice_callback_ = new VoiceCallback(semaphore_);
+  voice_callback_ = new VoiceCallback(this, semaphore_);
 
   hr = XAudio2Create(&audio_, 0, XAUDIO2_DEFAULT_PROCESSOR);
   if (FAILED(hr)) {
@@ -90,7 +96,7 @@ void XAudio2AudioDriver::Initialize() {
   WAVEFORMATIEEEFLOATEX waveformat;
 
   waveformat.Format.wFormatTag = WAVE_FORMAT_EXTENSIBLE;
-  waveformat.Format.nChannels = frame_channels_;
+  waveformat.Format.nChannels = kFrameChannels;
   waveformat.Format.nSamplesPerSec = 48000;
   waveformat.Format.wBitsPerSample = 32;
   waveformat.Format.nBlockAlign =
@@ -130,28 +136,21 @@ void XAudio2AudioDriver::SubmitFrame(uint32_t frame_ptr) {
   // Process samples! They are big-endian floats.
   HRESULT hr;
 
-  XAUDIO2_VOICE_STATE state;
-  pcm_voice_->GetState(&state, XAUDIO2_VOICE_NOSAMPLESPLAYED);
-  assert_true(state.BuffersQueued < frame_count_);
-
-  auto input_frame = memory_->TranslateVirtual<float*>(frame_ptr);
-  auto output_frame = reinterpret_cast<float*>(frames_[current_frame_]);
-  auto interleave_channels = frame_channels_;
-
-  // interleave the data
-  for (uint32_t index = 0, o = 0; index < channel_samples_; ++index) {
-    for (uint32_t channel = 0, table = 0; channel < interleave_channels;
-         ++channel, table += channel_samples_) {
-      output_frame[o++] = xe::byte_swap(input_frame[table + index]);
-    }
+  // The client semaphore keeps the guest from having more frames queued than
+  // the ring has, without asking the voice.
+  auto output_frame = CopyFrame(frame_ptr);
+  assert_not_null(output_frame);
+  if (!output_frame) {
+    semaphore_->Release(1, nullptr);
+    return;
   }
 
   XAUDIO2_BUFFER buffer;
   buffer.Flags = 0;
   buffer.pAudioData = reinterpret_cast<BYTE*>(output_frame);
-  buffer.AudioBytes = frame_size_;
+  buffer.AudioBytes = kFrameSize;
   buffer.PlayBegin = 0;
-  buffer.PlayLength = channel_samples_;
+  buffer.PlayLength = kChannelSamples;
   buffer.LoopBegin = XAUDIO2_NO_LOOP_REGION;
   buffer.LoopLength = 0;
   buffer.LoopCount = 0;
@@ -162,13 +161,19 @@ void XAudio2AudioDriver::SubmitFrame(uint32_t frame_ptr) {
     assert_always();
     return;
   }
-
-  current_frame_ = (current_frame_ + 1) % frame_count_;
+  // The buffer may end before it's queued here, but the ring is only checked
+  // for free frames on this thread, after that.
+  QueueFrame();
 
   // Update playback ratio to our time scalar.
-  // This will keep audio in sync with the game clock.
-  pcm_voice_->SetFrequencyRatio(
-      static_cast<float>(xe::Clock::guest_time_scalar()));
+  // This will keep audio in sync with the game clock. Setting it takes the
+  // engine lock, so that's only done when it changes.
+  double guest_time_scalar =
+      follow_time_scalar_ ? xe::Clock::guest_time_scalar() : 1.0;
+  if (guest_time_scalar != frequency_ratio_) {
+    frequency_ratio_ = guest_time_scalar;
+    pcm_voice_->SetFrequencyRatio(static_cast<float>(guest_time_scalar));
+  }
 }
 
 void XAudio2AudioDriver::Shutdown() {
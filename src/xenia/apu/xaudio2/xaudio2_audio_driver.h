@@ -39,13 +39,8 @@ class XAudio2AudioDriver : public AudioDriver {
   class VoiceCallback;
   VoiceCallback* voice_callback_ = nullptr;
 
-  static const uint32_t frame_count_ = 64;
-  static const uint32_t frame_channels_ = 6;
-  static const uint32_t channel_samples_ = 256;
-  static const uint32_t frame_samples_ = frame_channels_ * channel_samples_;
-  static const uint32_t frame_size_ = sizeof(float) * frame_samples_;
-  float frames_[frame_count_][frame_samples_];
-  uint32_t current_frame_ = 0;
+  // Last guest time scalar given to the voice as its frequency ratio.
+  double frequency_ratio_ = 0.0;
 };
 
 }  // namespace xaudio2
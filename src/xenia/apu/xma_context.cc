@@ -9,9 +9,12 @@
 
 #include "xenia/apu/xma_context.h"
 
+#include <emmintrin.h>
+
 #include <algorithm>
 #include <cstring>
 
+#include "third_party/xxhash/xxhash.h"
 #include "xenia/apu/xma_decoder.h"
 #include "xenia/apu/xma_helpers.h"
 #include "xenia/base/bit_stream.h"
@@ -50,10 +53,12 @@ XmaContext::~XmaContext() {
   }
 }
 
-int XmaContext::Setup(uint32_t id, Memory* memory, uint32_t guest_ptr) {
+int XmaContext::Setup(uint32_t id, Memory* memory, uint32_t guest_ptr,
+                      XmaFrameCache* frame_cache) {
   id_ = id;
   memory_ = memory;
   guest_ptr_ = guest_ptr;
+  frame_cache_ = frame_cache;
 
   // Allocate important stuff.
   codec_ = &ff_xma2_decoder;
@@ -155,6 +160,7 @@ void XmaContext::Clear() {
   data.output_buffer_write_offset = 0;
 
   data.Store(context_ptr);
+  previous_frame_valid_ = false;
 }
 
 void XmaContext::Disable() {
@@ -350,6 +356,10 @@ void XmaContext::DecodePackets(XMA_CONTEXT_DATA* data) {
 
   // We can only decode an entire frame and write it out at a time, so
   // don't save any samples.
+  // Hashed for the frame cache once the first complete frame is decoded.
+  uint64_t input_buffer_hash = 0;
+  bool input_buffer_hashed = false;
+
   size_t output_remaining_bytes = output_rb.write_count();
   output_remaining_bytes -= data->is_stereo ? (output_remaining_bytes % 2048)
                                             : (output_remaining_bytes % 1024);
@@ -496,9 +506,64 @@ void XmaContext::DecodePackets(XMA_CONTEXT_DATA* data) {
     int invalid_frame = 0;  // invalid frame?
     int got_frame = 0;      // successfully decoded a frame?
     int frame_size = 0;
-    int len =
-        xma2_decode_frame(context_, packet_, decoded_frame_, &got_frame,
-                          &invalid_frame, &frame_size, !partial, bit_offset);
+    int len = 0;
+
+    // Samples are written straight to the output buffer, unless the frame
+    // would wrap around its end.
+    size_t frame_bytes = kBytesPerFrame * num_channels;
+    bool output_in_place =
+        output_rb.write_offset() + frame_bytes <= output_rb.capacity();
+    uint8_t* frame_output = output_in_place
+                                ? output_rb.buffer() + output_rb.write_offset()
+                                : current_frame_;
+
+    // Frames in the same input buffer as the one before them may have been
+    // decoded already, and then frame_output gets their samples.
+    XmaFrameCache::Key cache_key;
+    bool cacheable = false;
+    bool from_cache = false;
+    if (frame_cache_ && !partial) {
+      if (!input_buffer_hashed) {
+        input_buffer_hash =
+            XXH64(current_input_buffer, current_input_size, 0);
+        input_buffer_hashed = true;
+      }
+      cacheable = previous_frame_valid_ &&
+                  previous_frame_buffer_hash_ == input_buffer_hash;
+      if (cacheable) {
+        cache_key = {input_buffer_hash,
+                     uint32_t(current_input_size),
+                     uint32_t(bit_offset),
+                     previous_frame_offset_bits_,
+                     data->sample_rate,
+                     uint32_t(num_channels)};
+        from_cache =
+            frame_cache_->Find(cache_key, frame_output, frame_bytes, &len);
+      }
+    }
+    if (from_cache) {
+      got_frame = 1;
+      decoder_stale_ = true;
+    } else {
+      if (decoder_stale_ && cacheable) {
+        // Decode the frame before again for the state libav carries over
+        // from it, discarding its samples.
+        int previous_got_frame = 0;
+        int previous_invalid_frame = 0;
+        int previous_frame_size = 0;
+        xma2_decode_frame(context_, packet_, decoded_frame_,
+                          &previous_got_frame, &previous_invalid_frame,
+                          &previous_frame_size, 1,
+                          previous_frame_offset_bits_);
+      }
+      decoder_stale_ = false;
+      len = xma2_decode_frame(context_, packet_, decoded_frame_, &got_frame,
+                              &invalid_frame, &frame_size, !partial,
+                              bit_offset);
+    }
+    previous_frame_valid_ = got_frame && input_buffer_hashed && !partial;
+    previous_frame_buffer_hash_ = input_buffer_hash;
+    previous_frame_offset_bits_ = uint32_t(bit_offset);
     if (!partial && len == 0) {
       // Got the last frame of a packet. Advance the read offset to the next
       // packet.
@@ -569,23 +634,32 @@ void XmaContext::DecodePackets(XMA_CONTEXT_DATA* data) {
       // Copy to the output buffer.
       size_t written_bytes = 0;
 
-      // Validity checks.
-      assert(decoded_frame_->nb_samples <= kSamplesPerFrame);
-      assert(context_->sample_fmt == AV_SAMPLE_FMT_FLTP);
-
-      // Check the returned buffer size.
-      assert(av_samples_get_buffer_size(NULL, context_->channels,
-                                        decoded_frame_->nb_samples,
-                                        context_->sample_fmt, 1) ==
-             context_->channels * decoded_frame_->nb_samples * sizeof(float));
-
-      // Convert the frame.
-      ConvertFrame((const uint8_t**)decoded_frame_->data, context_->channels,
-                   decoded_frame_->nb_samples, current_frame_);
+      if (!from_cache) {
+        // Validity checks.
+        assert(decoded_frame_->nb_samples <= kSamplesPerFrame);
+        assert(context_->sample_fmt == AV_SAMPLE_FMT_FLTP);
+
+        // Check the returned buffer size.
+        assert(av_samples_get_buffer_size(NULL, context_->channels,
+                                          decoded_frame_->nb_samples,
+                                          context_->sample_fmt, 1) ==
+               context_->channels * decoded_frame_->nb_samples * sizeof(float));
+
+        // Convert the frame.
+        ConvertFrame((const uint8_t**)decoded_frame_->data, context_->channels,
+                     decoded_frame_->nb_samples, frame_output);
+        if (cacheable && len >= 0) {
+          frame_cache_->Insert(cache_key, frame_output, frame_bytes, len);
+        }
+      }
 
-      assert_true(output_remaining_bytes >= kBytesPerFrame * num_channels);
-      output_rb.Write(current_frame_, kBytesPerFrame * num_channels);
-      written_bytes = kBytesPerFrame * num_channels;
+      assert_true(output_remaining_bytes >= frame_bytes);
+      if (output_in_place) {
+        output_rb.AdvanceWrite(frame_bytes);
+      } else {
+        output_rb.Write(current_frame_, frame_bytes);
+      }
+      written_bytes = frame_bytes;
 
       output_remaining_bytes -= written_bytes;
       data->output_buffer_write_offset = output_rb.write_offset() / 256;
@@ -636,6 +710,9 @@ int XmaContext::PrepareDecoder(uint8_t* block, size_t size, int sample_rate,
       XELOGE("XmaContext: Failed to reopen libav context");
       return 1;
     }
+    // Nothing is carried over from the frames decoded before.
+    previous_frame_valid_ = false;
+    decoder_stale_ = false;
   }
 
   av_frame_unref(decoded_frame_);
@@ -645,12 +722,44 @@ int XmaContext::PrepareDecoder(uint8_t* block, size_t size, int sample_rate,
 
 bool XmaContext::ConvertFrame(const uint8_t** samples, int num_channels,
                               int num_samples, uint8_t* output_buffer) {
+  // Mono and stereo are converted 8 samples per channel at a time. As in the
+  // scalar loop, samples are clamped with NaN becoming 1, and truncated.
+  int i = 0;
+  if (num_channels == 1 || num_channels == 2) {
+    const __m128 one = _mm_set1_ps(1.0f);
+    const __m128 minus_one = _mm_set1_ps(-1.0f);
+    const __m128 scale = _mm_set1_ps(float((1 << 15) - 1));
+    auto convert = [&](const uint8_t* channel_samples, int first) {
+      auto src = reinterpret_cast<const float*>(channel_samples) + first;
+      __m128 low = _mm_loadu_ps(src);
+      __m128 high = _mm_loadu_ps(src + 4);
+      low = _mm_max_ps(_mm_min_ps(low, one), minus_one);
+      high = _mm_max_ps(_mm_min_ps(high, one), minus_one);
+      return _mm_packs_epi32(_mm_cvttps_epi32(_mm_mul_ps(low, scale)),
+                             _mm_cvttps_epi32(_mm_mul_ps(high, scale)));
+    };
+    auto swap_and_store = [](uint8_t* dest, __m128i value) {
+      value = _mm_or_si128(_mm_slli_epi16(value, 8), _mm_srli_epi16(value, 8));
+      _mm_storeu_si128(reinterpret_cast<__m128i*>(dest), value);
+    };
+    for (; i + 8 <= num_samples; i += 8) {
+      __m128i left = convert(samples[0], i);
+      if (num_channels == 1) {
+        swap_and_store(output_buffer + i * 2, left);
+        continue;
+      }
+      __m128i right = convert(samples[1], i);
+      swap_and_store(output_buffer + i * 4, _mm_unpacklo_epi16(left, right));
+      swap_and_store(output_buffer + i * 4 + 16,
+                     _mm_unpackhi_epi16(left, right));
+    }
+  }
+
   // Loop through every sample, convert and drop it into the output array.
   // If more than one channel, we need to interleave the samples from each
   // channel next to each other.
-  // TODO: This can definitely be optimized with AVX/SSE intrinsics!
-  uint32_t o = 0;
-  for (int i = 0; i < num_samples; i++) {
+  uint32_t o = uint32_t(i * num_channels);
+  for (; i < num_samples; i++) {
     for (int j = 0; j < num_channels; j++) {
       // Select the appropriate array based on the current channel.
       auto sample_array = reinterpret_cast<const float*>(samples[j]);
@@ -15,6 +15,7 @@
 #include <queue>
 #include <vector>
 
+#include "xenia/apu/xma_frame_cache.h"
 #include "xenia/memory.h"
 #include "xenia/xbox.h"
 
@@ -146,7 +147,9 @@ class XmaContext {
   explicit XmaContext();
   ~XmaContext();
 
-  int Setup(uint32_t id, Memory* memory, uint32_t guest_ptr);
+  // The frame cache is optional.
+  int Setup(uint32_t id, Memory* memory, uint32_t guest_ptr,
+            XmaFrameCache* frame_cache);
   void Work();
 
   void Enable();
@@ -165,6 +168,11 @@ class XmaContext {
   void set_is_allocated(bool is_allocated) { is_allocated_ = is_allocated; }
   void set_is_enabled(bool is_enabled) { is_enabled_ = is_enabled; }
 
+  // Converts planar float samples in [-1, 1] to interleaved big endian 16-bit
+  // ones, as the guest expects them in the output buffer.
+  static bool ConvertFrame(const uint8_t** samples, int num_channels,
+                           int num_samples, uint8_t* output_buffer);
+
  private:
   static int GetSampleRate(int id);
 
@@ -177,8 +185,6 @@ class XmaContext {
   int PrepareDecoder(uint8_t* block, size_t size, int sample_rate,
                      int channels);
 
-  bool ConvertFrame(const uint8_t** samples, int num_channels, int num_samples,
-                    uint8_t* output_buffer);
 
   int StartPacket(XMA_CONTEXT_DATA* data);
 
@@ -211,7 +217,16 @@ class XmaContext {
   size_t partial_frame_offset_bits_ = 0;  // blah internal don't use this
   std::vector<uint8_t> partial_frame_buffer_;
 
+  // Samples of a frame that wraps around the end of the output buffer.
   uint8_t* current_frame_ = nullptr;
+
+  XmaFrameCache* frame_cache_ = nullptr;
+  // The last frame decoded, which the samples of the next one depend on.
+  bool previous_frame_valid_ = false;
+  uint64_t previous_frame_buffer_hash_ = 0;
+  uint32_t previous_frame_offset_bits_ = 0;
+  // Whether libav hasn't seen the last frame, as it came from the cache.
+  bool decoder_stale_ = false;
 };
 
 }  // namespace apu
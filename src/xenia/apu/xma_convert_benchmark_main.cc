@@ -0,0 +1,110 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2016 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#include <gflags/gflags.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <vector>
+
+#include "xenia/apu/xma_context.h"
+#include "xenia/base/clock.h"
+#include "xenia/base/logging.h"
+#include "xenia/base/main.h"
+#include "xenia/base/math.h"
+#include "xenia/base/memory.h"
+
+DEFINE_int32(xma_convert_benchmark_frames, 4096,
+             "Number of frames converted per channel count.");
+
+namespace xe {
+namespace apu {
+namespace test {
+
+// The per-sample loop XmaContext::ConvertFrame replaced.
+void ConvertFrameScalar(const uint8_t** samples, int num_channels,
+                        int num_samples, uint8_t* output_buffer) {
+  uint32_t o = 0;
+  for (int i = 0; i < num_samples; i++) {
+    for (int j = 0; j < num_channels; j++) {
+      auto sample_array = reinterpret_cast<const float*>(samples[j]);
+      float raw_sample = xe::saturate(sample_array[i]);
+      float scaled_sample = raw_sample * ((1 << 15) - 1);
+      int sample = static_cast<int>(scaled_sample);
+      xe::store_and_swap<uint16_t>(&output_buffer[o++ * 2], sample & 0xFFFF);
+    }
+  }
+}
+
+int main(const std::vector<std::wstring>& args) {
+  int32_t frames = std::max(FLAGS_xma_convert_benchmark_frames, 1);
+  double ticks_to_us = 1000000.0 / Clock::host_tick_frequency();
+
+  std::printf("%-10s %10s %10s %8s %s\n", "channels", "scalar_us", "simd_us",
+              "speedup", "result");
+  int mismatch_count = 0;
+  for (int num_channels = 1; num_channels <= 6; ++num_channels) {
+    // A sample count that isn't a multiple of 8 exercises the scalar tail.
+    for (int num_samples : {int(XmaContext::kSamplesPerFrame), 509}) {
+      std::vector<std::vector<float>> channels(num_channels);
+      std::vector<const uint8_t*> samples(num_channels);
+      for (int j = 0; j < num_channels; ++j) {
+        channels[j].resize(num_samples);
+        for (int i = 0; i < num_samples; ++i) {
+          // Out of range values and NaNs are clamped.
+          uint32_t hash = uint32_t(i * num_channels + j) * 2654435761u;
+          channels[j][i] = ((hash >> 8) & 0xFFFF) / 24576.0f - 1.3333f;
+        }
+        channels[j][0] = NAN;
+        samples[j] = reinterpret_cast<const uint8_t*>(channels[j].data());
+      }
+      size_t output_size = size_t(num_samples) * num_channels * 2;
+      std::vector<uint8_t> scalar_output(output_size);
+      std::vector<uint8_t> simd_output(output_size);
+
+      uint64_t start = Clock::QueryHostTickCount();
+      for (int32_t k = 0; k < frames; ++k) {
+        ConvertFrameScalar(samples.data(), num_channels, num_samples,
+                           scalar_output.data());
+      }
+      uint64_t scalar_ticks = Clock::QueryHostTickCount() - start;
+      start = Clock::QueryHostTickCount();
+      for (int32_t k = 0; k < frames; ++k) {
+        XmaContext::ConvertFrame(samples.data(), num_channels, num_samples,
+                                 simd_output.data());
+      }
+      uint64_t simd_ticks = Clock::QueryHostTickCount() - start;
+
+      bool matches = scalar_output == simd_output;
+      if (!matches) {
+        ++mismatch_count;
+      }
+      double scalar_us = scalar_ticks * ticks_to_us / frames;
+      double simd_us = simd_ticks * ticks_to_us / frames;
+      char name[16];
+      std::snprintf(name, sizeof(name), "%d x %d", num_channels, num_samples);
+      std::printf("%-10s %10.3f %10.3f %7.2fx %s\n", name, scalar_us, simd_us,
+                  simd_us > 0.0 ? scalar_us / simd_us : 0.0,
+                  matches ? "ok" : "MISMATCH");
+    }
+  }
+  if (mismatch_count) {
+    XELOGE("%d sample layouts converted differently", mismatch_count);
+    return 1;
+  }
+  return 0;
+}
+
+}  // namespace test
+}  // namespace apu
+}  // namespace xe
+
+DEFINE_ENTRY_POINT(L"xenia-apu-xma-convert-benchmark",
+                   L"xenia-apu-xma-convert-benchmark", xe::apu::test::main);
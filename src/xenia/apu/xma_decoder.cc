@@ -11,12 +11,20 @@
 
 #include <gflags/gflags.h>
 
+#include <algorithm>
+#include <cinttypes>
+#include <string>
+
+#include "xenia/apu/apu_flags.h"
 #include "xenia/apu/xma_context.h"
+#include "xenia/base/clock.h"
+#include "xenia/base/counters.h"
 #include "xenia/base/logging.h"
 #include "xenia/base/math.h"
 #include "xenia/base/profiling.h"
 #include "xenia/base/ring_buffer.h"
 #include "xenia/base/string_buffer.h"
+#include "xenia/base/threading.h"
 #include "xenia/cpu/processor.h"
 #include "xenia/cpu/thread_state.h"
 #include "xenia/kernel/xthread.h"
@@ -51,6 +59,8 @@ extern "C" {
 
 DEFINE_bool(libav_verbose, false, "Verbose libav output (debug and above)");
 
+DEFINE_counter(xma_decode_us, "apu.xma_decode_us");
+
 namespace xe {
 namespace apu {
 
@@ -105,50 +115,138 @@ X_STATUS XmaDecoder::Setup(kernel::KernelState* kernel_state) {
       context_data_first_ptr_ + (sizeof(XMA_CONTEXT_DATA) * kContextCount - 1);
   registers_.context_array_ptr = context_data_first_ptr_;
 
+  if (FLAGS_xma_frame_cache_mb > 0) {
+    frame_cache_ = std::make_unique<XmaFrameCache>(
+        size_t(FLAGS_xma_frame_cache_mb) * 1024 * 1024);
+  }
+
   // Setup XMA contexts.
   for (int i = 0; i < kContextCount; ++i) {
     uint32_t guest_ptr =
         registers_.context_array_ptr + i * sizeof(XMA_CONTEXT_DATA);
     XmaContext& context = contexts_[i];
-    if (context.Setup(i, memory(), guest_ptr)) {
+    if (context.Setup(i, memory(), guest_ptr, frame_cache_.get())) {
       assert_always();
     }
   }
   registers_.next_context = 1;
 
+  uint32_t thread_count = uint32_t(std::max(FLAGS_xma_decoder_threads, 0));
+  if (!thread_count) {
+    thread_count =
+        std::min(std::max(xe::threading::logical_processor_count() / 2, 1u),
+                 4u);
+  }
+  uint64_t host_affinity_mask = 0;
+  if (!xe::threading::ParseProcessorSet(FLAGS_xma_decoder_cpus,
+                                        &host_affinity_mask)) {
+    XELOGE("Invalid --xma_decoder_cpus, not pinning");
+  }
   worker_running_ = true;
-  worker_thread_ = kernel::object_ref<kernel::XHostThread>(
-      new kernel::XHostThread(kernel_state, 128 * 1024, 0, [this]() {
-        WorkerThreadMain();
-        return 0;
-      }));
-  worker_thread_->set_name("XMA Decoder Worker");
-  worker_thread_->set_can_debugger_suspend(true);
-  worker_thread_->Create();
+  for (uint32_t i = 0; i < thread_count; ++i) {
+    auto worker_thread = kernel::object_ref<kernel::XHostThread>(
+        new kernel::XHostThread(kernel_state, 128 * 1024, 0, [this]() {
+          WorkerThreadMain();
+          return 0;
+        }));
+    worker_thread->set_name("XMA Decoder Worker " + std::to_string(i));
+    worker_thread->set_can_debugger_suspend(true);
+    worker_thread->set_host_affinity_mask(host_affinity_mask);
+    worker_thread->Create();
+    worker_threads_.push_back(std::move(worker_thread));
+  }
 
   return X_STATUS_SUCCESS;
 }
 
+void XmaDecoder::KickContext(uint32_t context_id) {
+  {
+    std::lock_guard<std::mutex> lock(work_mutex_);
+    switch (context_work_[context_id]) {
+      case ContextWork::kIdle:
+        context_work_[context_id] = ContextWork::kQueued;
+        context_kick_ticks_[context_id] = Clock::QueryHostTickCount();
+        work_queue_.push_back(context_id);
+        break;
+      case ContextWork::kDecoding:
+        context_work_[context_id] = ContextWork::kDecodingKicked;
+        context_kick_ticks_[context_id] = Clock::QueryHostTickCount();
+        return;
+      default:
+        // Already going to be decoded.
+        return;
+    }
+  }
+  work_cond_.notify_one();
+}
+
 void XmaDecoder::WorkerThreadMain() {
-  while (worker_running_) {
-    // Okay, let's loop through XMA contexts to find ones we need to decode!
-    for (uint32_t n = 0; n < kContextCount; n++) {
-      XmaContext& context = contexts_[n];
-      context.Work();
-
-      // TODO: Need thread safety to do this.
-      // Probably not too important though.
-      // registers_.current_context = n;
-      // registers_.next_context = (n + 1) % kContextCount;
+  std::unique_lock<std::mutex> lock(work_mutex_);
+  while (true) {
+    work_cond_.wait(lock, [this]() {
+      return !worker_running_ || !work_queue_.empty();
+    });
+    if (!worker_running_) {
+      break;
+    }
+    uint32_t context_id = work_queue_.front();
+    work_queue_.pop_front();
+    context_work_[context_id] = ContextWork::kDecoding;
+    uint64_t kick_tick = context_kick_ticks_[context_id];
+    lock.unlock();
+
+    uint64_t latency_us;
+    uint64_t decode_us;
+    {
+      SCOPE_profile_cpu_i("apu", "xe::apu::XmaDecoder decode");
+      uint64_t start_tick = Clock::QueryHostTickCount();
+      contexts_[context_id].Work();
+      uint64_t end_tick = Clock::QueryHostTickCount();
+      latency_us =
+          (end_tick - kick_tick) * 1000000 / Clock::host_tick_frequency();
+      decode_us =
+          (end_tick - start_tick) * 1000000 / Clock::host_tick_frequency();
+      COUNT_profile_cpu("apu/xma/decode_latency_us", int(latency_us));
+      COUNT_profile_cpu("apu/xma/decode_us", int(decode_us));
+    }
+
+    lock.lock();
+    context_stats_[context_id].Add(latency_us, decode_us);
+    interval_stats_.Add(latency_us, decode_us);
+    INCREMENT_counter(xma_decode_us, decode_us);
+    if (context_work_[context_id] == ContextWork::kDecodingKicked) {
+      // Behind the contexts kicked meanwhile, so none of them starves.
+      context_work_[context_id] = ContextWork::kQueued;
+      work_queue_.push_back(context_id);
+      work_cond_.notify_one();
+    } else {
+      context_work_[context_id] = ContextWork::kIdle;
     }
-    xe::threading::MaybeYield();
   }
 }
 
 void XmaDecoder::Shutdown() {
-  worker_running_ = false;
-  worker_fence_.Signal();
-  worker_thread_.reset();
+  {
+    std::lock_guard<std::mutex> lock(work_mutex_);
+    worker_running_ = false;
+  }
+  work_cond_.notify_all();
+  for (auto& worker_thread : worker_threads_) {
+    worker_thread->Wait(0, 0, 0, nullptr);
+  }
+  worker_threads_.clear();
+  for (uint32_t i = 0; i < kContextCount; ++i) {
+    auto& stats = context_stats_[i];
+    if (stats.decode_count) {
+      XELOGAPU("XmaDecoder: context %u decoded %" PRIu64
+               " times, latency %" PRIu64 " us average, %" PRIu64
+               " us max, decode %" PRIu64 " us average, %" PRIu64 " us max",
+               i, stats.decode_count,
+               stats.total_latency_us / stats.decode_count,
+               stats.max_latency_us, stats.total_decode_us / stats.decode_count,
+               stats.max_decode_us);
+    }
+  }
 
   memory()->SystemHeapFree(registers_.context_array_ptr);
 }
@@ -197,6 +295,29 @@ bool XmaDecoder::BlockOnContext(uint32_t guest_ptr, bool poll) {
   return context.Block(poll);
 }
 
+XmaContextStats XmaDecoder::GetContextStats(uint32_t guest_ptr) {
+  auto context_id = GetContextId(guest_ptr);
+  assert_true(context_id >= 0);
+
+  std::lock_guard<std::mutex> lock(work_mutex_);
+  return context_stats_[context_id];
+}
+
+XmaContextStats XmaDecoder::TakeIntervalStats() {
+  std::lock_guard<std::mutex> lock(work_mutex_);
+  XmaContextStats stats = interval_stats_;
+  interval_stats_ = {};
+  return stats;
+}
+
+void XmaContextStats::Add(uint64_t latency_us, uint64_t decode_us) {
+  ++decode_count;
+  total_latency_us += latency_us;
+  max_latency_us = std::max(max_latency_us, latency_us);
+  total_decode_us += decode_us;
+  max_decode_us = std::max(max_decode_us, decode_us);
+}
+
 // free60 may be useful here, however it looks like it's using a different
 // piece of hardware:
 // https://github.com/Free60Project/libxenon/blob/master/libxenon/drivers/xenon_sound/sound.c
@@ -249,11 +370,9 @@ void XmaDecoder::WriteRegister(uint32_t addr, uint32_t value) {
         uint32_t context_id = base_context_id + i;
         XmaContext& context = contexts_[context_id];
         context.Enable();
+        KickContext(context_id);
       }
     }
-
-    // Signal the decoder thread to start processing.
-    worker_fence_.Signal();
   } else if (r >= 0x1A40 && r <= 0x1A40 + 9 * 4) {
     // Context lock command.
     // This requests a lock by flagging the context.
@@ -266,9 +385,6 @@ void XmaDecoder::WriteRegister(uint32_t addr, uint32_t value) {
         context.Disable();
       }
     }
-
-    // Signal the decoder thread to start processing.
-    worker_fence_.Signal();
   } else if (r >= 0x1A80 && r <= 0x1A80 + 9 * 4) {
     // Context clear command.
     // This will reset the given hardware contexts.
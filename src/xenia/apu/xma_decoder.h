@@ -11,10 +11,14 @@
 #define XENIA_APU_XMA_DECODER_H_
 
 #include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <memory>
 #include <mutex>
-#include <queue>
+#include <vector>
 
 #include "xenia/apu/xma_context.h"
+#include "xenia/apu/xma_frame_cache.h"
 #include "xenia/kernel/xthread.h"
 #include "xenia/xbox.h"
 
@@ -23,6 +27,18 @@ namespace apu {
 
 struct XMA_CONTEXT_DATA;
 
+// Time from the guest kicking a context to it being decoded, and time spent
+// decoding it.
+struct XmaContextStats {
+  uint64_t decode_count;
+  uint64_t total_latency_us;
+  uint64_t max_latency_us;
+  uint64_t total_decode_us;
+  uint64_t max_decode_us;
+
+  void Add(uint64_t latency_us, uint64_t decode_us);
+};
+
 class XmaDecoder {
  public:
   explicit XmaDecoder(cpu::Processor* processor);
@@ -39,6 +55,9 @@ class XmaDecoder {
   uint32_t AllocateContext();
   void ReleaseContext(uint32_t guest_ptr);
   bool BlockOnContext(uint32_t guest_ptr, bool poll);
+  XmaContextStats GetContextStats(uint32_t guest_ptr);
+  // Returns the stats of all contexts since the last call.
+  XmaContextStats TakeIntervalStats();
 
   uint32_t ReadRegister(uint32_t addr);
   void WriteRegister(uint32_t addr, uint32_t value);
@@ -47,6 +66,9 @@ class XmaDecoder {
   int GetContextId(uint32_t guest_ptr);
 
  private:
+  // Queues the context to be decoded once more, after any decoding queued or
+  // in progress for it.
+  void KickContext(uint32_t context_id);
   void WorkerThreadMain();
 
   static uint32_t MMIOReadRegisterThunk(void* ppc_context, XmaDecoder* as,
@@ -62,9 +84,15 @@ class XmaDecoder {
   Memory* memory_ = nullptr;
   cpu::Processor* processor_ = nullptr;
 
-  std::atomic<bool> worker_running_ = {false};
-  kernel::object_ref<kernel::XHostThread> worker_thread_;
-  xe::threading::Fence worker_fence_;
+  // Contexts kicked by the guest are decoded by the first idle worker. A
+  // context is only ever queued or being decoded once, so the work on each
+  // context stays in order.
+  std::vector<kernel::object_ref<kernel::XHostThread>> worker_threads_;
+  // Guards everything of the workers below.
+  std::mutex work_mutex_;
+  std::condition_variable work_cond_;
+  bool worker_running_ = false;
+  std::deque<uint32_t> work_queue_;
 
   std::mutex lock_;
 
@@ -91,6 +119,19 @@ class XmaDecoder {
 
   static const uint32_t kContextCount = 320;
   XmaContext contexts_[kContextCount];
+  std::unique_ptr<XmaFrameCache> frame_cache_;
+  enum class ContextWork : uint8_t {
+    kIdle,
+    kQueued,
+    kDecoding,
+    // Kicked again while being decoded, and queued again once done.
+    kDecodingKicked,
+  };
+  ContextWork context_work_[kContextCount] = {};
+  // Host tick of the earliest kick not yet decoded.
+  uint64_t context_kick_ticks_[kContextCount] = {};
+  XmaContextStats context_stats_[kContextCount] = {};
+  XmaContextStats interval_stats_ = {};
 
   uint32_t context_data_first_ptr_ = 0;
   uint32_t context_data_last_ptr_ = 0;
@@ -0,0 +1,62 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2016 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#include "xenia/apu/xma_frame_cache.h"
+
+#include <cstring>
+
+#include "xenia/base/profiling.h"
+
+namespace xe {
+namespace apu {
+
+XmaFrameCache::XmaFrameCache(size_t capacity_bytes)
+    : capacity_bytes_(capacity_bytes) {}
+
+bool XmaFrameCache::Find(const Key& key, uint8_t* output, size_t output_size,
+                         int* out_length_bits) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto it = frame_map_.find(key);
+  if (it == frame_map_.end() || it->second->samples.size() != output_size) {
+    ++miss_count_;
+    COUNT_profile_cpu("apu/xma/frame_cache_misses", int(miss_count_));
+    return false;
+  }
+  frames_.splice(frames_.begin(), frames_, it->second);
+  std::memcpy(output, it->second->samples.data(), output_size);
+  *out_length_bits = it->second->length_bits;
+  ++hit_count_;
+  COUNT_profile_cpu("apu/xma/frame_cache_hits", int(hit_count_));
+  return true;
+}
+
+void XmaFrameCache::Insert(const Key& key, const uint8_t* samples,
+                           size_t samples_size, int length_bits) {
+  if (samples_size > capacity_bytes_) {
+    return;
+  }
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (frame_map_.count(key)) {
+    // Decoded by another context meanwhile.
+    return;
+  }
+  while (size_bytes_ + samples_size > capacity_bytes_) {
+    auto& oldest = frames_.back();
+    size_bytes_ -= oldest.samples.size();
+    frame_map_.erase(oldest.key);
+    frames_.pop_back();
+  }
+  frames_.push_front({key, length_bits,
+                      std::vector<uint8_t>(samples, samples + samples_size)});
+  frame_map_.emplace(key, frames_.begin());
+  size_bytes_ += samples_size;
+}
+
+}  // namespace apu
+}  // namespace xe
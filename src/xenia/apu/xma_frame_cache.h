@@ -0,0 +1,89 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2016 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#ifndef XENIA_APU_XMA_FRAME_CACHE_H_
+#define XENIA_APU_XMA_FRAME_CACHE_H_
+
+#include <cstdint>
+#include <list>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+namespace xe {
+namespace apu {
+
+// Frames decoded by any XMA context, converted to the samples written to the
+// output buffers, so playing the same input buffer again skips libav. The
+// samples of a frame also depend on the frame decoded before it, so that is
+// part of the key, and only frames following one in the same input buffer
+// are cached. The least recently used frames are dropped past the capacity.
+class XmaFrameCache {
+ public:
+  struct Key {
+    // Of the whole input buffer holding the frame.
+    uint64_t buffer_hash;
+    uint32_t buffer_size;
+    uint32_t frame_offset_bits;
+    uint32_t previous_frame_offset_bits;
+    uint32_t sample_rate;
+    uint32_t channels;
+
+    bool operator==(const Key& other) const {
+      return buffer_hash == other.buffer_hash &&
+             buffer_size == other.buffer_size &&
+             frame_offset_bits == other.frame_offset_bits &&
+             previous_frame_offset_bits == other.previous_frame_offset_bits &&
+             sample_rate == other.sample_rate && channels == other.channels;
+    }
+  };
+
+  explicit XmaFrameCache(size_t capacity_bytes);
+
+  // Copies the samples of the frame to output and returns true if it's
+  // cached, along with the bits the decoder consumed for it.
+  bool Find(const Key& key, uint8_t* output, size_t output_size,
+            int* out_length_bits);
+  void Insert(const Key& key, const uint8_t* samples, size_t samples_size,
+              int length_bits);
+
+ private:
+  struct KeyHasher {
+    size_t operator()(const Key& key) const {
+      uint64_t hash = key.buffer_hash;
+      hash ^= (uint64_t(key.frame_offset_bits) << 32 |
+               key.previous_frame_offset_bits) *
+              0x9E3779B97F4A7C15ull;
+      hash ^= (uint64_t(key.buffer_size) << 8 | key.sample_rate << 4 |
+               key.channels) *
+              0xC2B2AE3D27D4EB4Full;
+      return size_t(hash ^ (hash >> 29));
+    }
+  };
+  struct Frame {
+    Key key;
+    int length_bits;
+    std::vector<uint8_t> samples;
+  };
+
+  size_t capacity_bytes_;
+  // Guards everything below, as the decoder workers share the cache.
+  std::mutex mutex_;
+  size_t size_bytes_ = 0;
+  // Most recently used first.
+  std::list<Frame> frames_;
+  std::unordered_map<Key, std::list<Frame>::iterator, KeyHasher> frame_map_;
+  uint64_t hit_count_ = 0;
+  uint64_t miss_count_ = 0;
+};
+
+}  // namespace apu
+}  // namespace xe
+
+#endif  // XENIA_APU_XMA_FRAME_CACHE_H_
@@ -11,11 +11,61 @@
 
 #include <cstring>
 #include <memory>
+#include <mutex>
+#include <utility>
+#include <vector>
 
 #include "xenia/base/assert.h"
 
 namespace xe {
 
+namespace {
+
+// Chunk buffers of destroyed arenas, reused by new ones so that short-lived
+// arenas don't allocate fresh memory each time. Taken rarely enough, as
+// arenas keep their own chunks across Reset, for a lock to be fine.
+const size_t kMaxFreeChunkBuffers = 8;
+struct FreeChunkBuffers {
+  std::mutex mutex;
+  // Capacity and buffer.
+  std::vector<std::pair<size_t, uint8_t*>> buffers;
+};
+// Never destroyed, as arenas with static storage may outlive it.
+FreeChunkBuffers* free_chunk_buffers() {
+  static auto free_buffers = new FreeChunkBuffers();
+  return free_buffers;
+}
+
+uint8_t* AllocateChunkBuffer(size_t capacity) {
+  auto free_buffers = free_chunk_buffers();
+  {
+    std::lock_guard<std::mutex> lock(free_buffers->mutex);
+    auto& buffers = free_buffers->buffers;
+    for (auto it = buffers.begin(); it != buffers.end(); ++it) {
+      if (it->first == capacity) {
+        uint8_t* buffer = it->second;
+        buffers.erase(it);
+        return buffer;
+      }
+    }
+  }
+  return reinterpret_cast<uint8_t*>(malloc(capacity));
+}
+
+void FreeChunkBuffer(size_t capacity, uint8_t* buffer) {
+  auto free_buffers = free_chunk_buffers();
+  {
+    std::lock_guard<std::mutex> lock(free_buffers->mutex);
+    if (free_buffers->buffers.size() < kMaxFreeChunkBuffers) {
+      free_buffers->buffers.emplace_back(capacity, buffer);
+      return;
+    }
+  }
+  free(buffer);
+}
+
+}  // namespace
+
 Arena::Arena(size_t chunk_size)
     : chunk_size_(chunk_size), head_chunk_(nullptr), active_chunk_(nullptr) {}
 
@@ -112,12 +162,12 @@ void Arena::CloneContents(void* buffer, size_t buffer_length) {
 
 Arena::Chunk::Chunk(size_t chunk_size)
     : next(nullptr), capacity(chunk_size), buffer(0), offset(0) {
-  buffer = reinterpret_cast<uint8_t*>(malloc(capacity));
+  buffer = AllocateChunkBuffer(capacity);
 }
 
 Arena::Chunk::~Chunk() {
   if (buffer) {
-    free(buffer);
+    FreeChunkBuffer(capacity, buffer);
   }
 }
 
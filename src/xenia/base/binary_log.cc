@@ -0,0 +1,463 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2016 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#include "xenia/base/binary_log.h"
+
+#include <cstddef>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cwchar>
+
+#include "xenia/base/string.h"
+
+namespace xe {
+namespace binary_log {
+
+namespace {
+
+enum class Modifier {
+  kNone,
+  kChar,        // hh
+  kShort,       // h
+  kLong,        // l
+  kLongLong,    // ll, q, I64
+  kSize,        // z
+  kMax,         // j
+  kPtrdiff,     // t, I
+  kInt32,       // I32
+  kLongDouble,  // L
+  kWide,        // w
+};
+
+// A conversion of a printf format, without the leading %.
+struct Conversion {
+  const char* flags;
+  size_t flags_length;
+  bool width_star;
+  const char* width;
+  size_t width_length;
+  bool has_precision;
+  bool precision_star;
+  const char* precision;
+  size_t precision_length;
+  Modifier modifier;
+  // 0 if the format ended within the conversion.
+  char conversion;
+};
+
+// Parses the conversion following a %, returning where the format continues.
+const char* ParseConversion(const char* p, Conversion* c) {
+  std::memset(c, 0, sizeof(*c));
+  c->flags = p;
+  while (*p && std::strchr("-+ #0'", *p)) {
+    ++p;
+  }
+  c->flags_length = p - c->flags;
+
+  c->width = p;
+  if (*p == '*') {
+    c->width_star = true;
+    ++p;
+  }
+  while (*p >= '0' && *p <= '9') {
+    ++p;
+  }
+  c->width_length = c->width_star ? 0 : p - c->width;
+
+  if (*p == '.') {
+    c->has_precision = true;
+    c->precision = ++p;
+    if (*p == '*') {
+      c->precision_star = true;
+      ++p;
+    }
+    while (*p >= '0' && *p <= '9') {
+      ++p;
+    }
+    c->precision_length = c->precision_star ? 0 : p - c->precision;
+  }
+
+  switch (*p) {
+    case 'h':
+      if (*++p == 'h') {
+        ++p;
+        c->modifier = Modifier::kChar;
+      } else {
+        c->modifier = Modifier::kShort;
+      }
+      break;
+    case 'l':
+      if (*++p == 'l') {
+        ++p;
+        c->modifier = Modifier::kLongLong;
+      } else {
+        c->modifier = Modifier::kLong;
+      }
+      break;
+    case 'q':
+      ++p;
+      c->modifier = Modifier::kLongLong;
+      break;
+    case 'z':
+      ++p;
+      c->modifier = Modifier::kSize;
+      break;
+    case 'j':
+      ++p;
+      c->modifier = Modifier::kMax;
+      break;
+    case 't':
+      ++p;
+      c->modifier = Modifier::kPtrdiff;
+      break;
+    case 'L':
+      ++p;
+      c->modifier = Modifier::kLongDouble;
+      break;
+    case 'w':
+      ++p;
+      c->modifier = Modifier::kWide;
+      break;
+    case 'I':
+      ++p;
+      if (p[0] == '6' && p[1] == '4') {
+        p += 2;
+        c->modifier = Modifier::kLongLong;
+      } else if (p[0] == '3' && p[1] == '2') {
+        p += 2;
+        c->modifier = Modifier::kInt32;
+      } else {
+        c->modifier = Modifier::kPtrdiff;
+      }
+      break;
+  }
+
+  c->conversion = *p;
+  return *p ? p + 1 : p;
+}
+
+bool IsWideString(const Conversion& c) {
+  return c.conversion == 'S' ||
+         (c.conversion == 's' &&
+          (c.modifier == Modifier::kLong || c.modifier == Modifier::kWide));
+}
+
+void PutInteger(std::vector<uint8_t>* buffer, uint64_t value) {
+  auto bytes = reinterpret_cast<const uint8_t*>(&value);
+  buffer->insert(buffer->end(), bytes, bytes + sizeof(value));
+}
+
+void PutString(std::vector<uint8_t>* buffer, const char* str,
+               uint32_t length) {
+  auto bytes = reinterpret_cast<const uint8_t*>(&length);
+  buffer->insert(buffer->end(), bytes, bytes + sizeof(length));
+  buffer->insert(buffer->end(), str, str + length);
+}
+
+int64_t ReadSigned(va_list* args, Modifier modifier) {
+  switch (modifier) {
+    case Modifier::kChar:
+      return static_cast<signed char>(va_arg(*args, int));
+    case Modifier::kShort:
+      return static_cast<short>(va_arg(*args, int));
+    case Modifier::kLong:
+      return va_arg(*args, long);
+    case Modifier::kLongLong:
+      return va_arg(*args, long long);
+    case Modifier::kSize:
+    case Modifier::kPtrdiff:
+      return va_arg(*args, ptrdiff_t);
+    case Modifier::kMax:
+      return va_arg(*args, intmax_t);
+    case Modifier::kInt32:
+      return va_arg(*args, int32_t);
+    default:
+      return va_arg(*args, int);
+  }
+}
+
+uint64_t ReadUnsigned(va_list* args, Modifier modifier) {
+  switch (modifier) {
+    case Modifier::kChar:
+      return static_cast<unsigned char>(va_arg(*args, unsigned int));
+    case Modifier::kShort:
+      return static_cast<unsigned short>(va_arg(*args, unsigned int));
+    case Modifier::kLong:
+      return va_arg(*args, unsigned long);
+    case Modifier::kLongLong:
+      return va_arg(*args, unsigned long long);
+    case Modifier::kSize:
+    case Modifier::kPtrdiff:
+      return va_arg(*args, size_t);
+    case Modifier::kMax:
+      return va_arg(*args, uintmax_t);
+    case Modifier::kInt32:
+      return va_arg(*args, uint32_t);
+    default:
+      return va_arg(*args, unsigned int);
+  }
+}
+
+class ArgumentReader {
+ public:
+  ArgumentReader(const uint8_t* data, size_t length)
+      : ptr_(data), end_(data + length) {}
+
+  bool at_end() const { return ptr_ == end_; }
+
+  bool GetInteger(uint64_t* out_value) {
+    if (size_t(end_ - ptr_) < sizeof(*out_value)) {
+      return false;
+    }
+    std::memcpy(out_value, ptr_, sizeof(*out_value));
+    ptr_ += sizeof(*out_value);
+    return true;
+  }
+
+  bool GetString(std::string* out_value) {
+    uint32_t length;
+    if (size_t(end_ - ptr_) < sizeof(length)) {
+      return false;
+    }
+    std::memcpy(&length, ptr_, sizeof(length));
+    ptr_ += sizeof(length);
+    if (size_t(end_ - ptr_) < length) {
+      return false;
+    }
+    out_value->assign(reinterpret_cast<const char*>(ptr_), length);
+    ptr_ += length;
+    return true;
+  }
+
+ private:
+  const uint8_t* ptr_;
+  const uint8_t* end_;
+};
+
+template <typename T>
+void AppendFormatted(std::string* out, const std::string& spec, T value) {
+  int length = std::snprintf(nullptr, 0, spec.c_str(), value);
+  if (length <= 0) {
+    return;
+  }
+  size_t offset = out->size();
+  out->resize(offset + length + 1);
+  std::snprintf(&(*out)[offset], length + 1, spec.c_str(), value);
+  out->resize(offset + length);
+}
+
+}  // namespace
+
+void EncodeArguments(const char* format, va_list args,
+                     std::vector<uint8_t>* buffer) {
+  va_list list;
+  va_copy(list, args);
+  for (const char* p = format; *p;) {
+    if (*p++ != '%') {
+      continue;
+    }
+    if (*p == '%') {
+      ++p;
+      continue;
+    }
+    Conversion c;
+    p = ParseConversion(p, &c);
+    int64_t precision = -1;
+    if (c.width_star) {
+      PutInteger(buffer, uint64_t(int64_t(va_arg(list, int))));
+    }
+    if (c.precision_star) {
+      precision = va_arg(list, int);
+      PutInteger(buffer, uint64_t(precision));
+    } else if (c.has_precision) {
+      precision = std::atoi(c.precision);
+    }
+
+    switch (c.conversion) {
+      case 'd':
+      case 'i':
+        PutInteger(buffer, uint64_t(ReadSigned(&list, c.modifier)));
+        break;
+      case 'u':
+      case 'x':
+      case 'X':
+      case 'o':
+        PutInteger(buffer, ReadUnsigned(&list, c.modifier));
+        break;
+      case 'c':
+      case 'C':
+        PutInteger(buffer, uint64_t(int64_t(va_arg(list, int))));
+        break;
+      case 'e':
+      case 'E':
+      case 'f':
+      case 'F':
+      case 'g':
+      case 'G':
+      case 'a':
+      case 'A': {
+        double value = c.modifier == Modifier::kLongDouble
+                           ? double(va_arg(list, long double))
+                           : va_arg(list, double);
+        uint64_t bits;
+        std::memcpy(&bits, &value, sizeof(bits));
+        PutInteger(buffer, bits);
+        break;
+      }
+      case 'p':
+        PutInteger(buffer, uint64_t(uintptr_t(va_arg(list, void*))));
+        break;
+      case 's':
+      case 'S': {
+        // Only as much as the precision allows is read, as the string
+        // doesn't need to be terminated then.
+        size_t max_length = precision >= 0 ? size_t(precision) : SIZE_MAX;
+        if (IsWideString(c)) {
+          auto str = va_arg(list, const wchar_t*);
+          std::string narrow = "(null)";
+          if (str) {
+            size_t length = 0;
+            while (length < max_length && str[length]) {
+              ++length;
+            }
+            narrow = xe::to_string(std::wstring(str, length));
+          }
+          PutString(buffer, narrow.data(), uint32_t(narrow.size()));
+        } else {
+          auto str = va_arg(list, const char*);
+          if (!str) {
+            str = "(null)";
+          }
+          size_t length = 0;
+          while (length < max_length && str[length]) {
+            ++length;
+          }
+          PutString(buffer, str, uint32_t(length));
+        }
+        break;
+      }
+      case 'n':
+        va_arg(list, void*);
+        break;
+    }
+  }
+  va_end(list);
+}
+
+bool FormatArguments(const char* format, const uint8_t* arguments,
+                     size_t length, std::string* out_line) {
+  ArgumentReader reader(arguments, length);
+  out_line->clear();
+  for (const char* p = format; *p;) {
+    if (*p != '%') {
+      out_line->push_back(*p++);
+      continue;
+    }
+    const char* start = p++;
+    if (*p == '%') {
+      out_line->push_back(*p++);
+      continue;
+    }
+    Conversion c;
+    p = ParseConversion(p, &c);
+    if (!c.conversion) {
+      out_line->append(start);
+      break;
+    }
+
+    // The arguments were widened when stored, so the spec is rebuilt with
+    // the length modifier of the stored type.
+    std::string spec = "%";
+    spec.append(c.flags, c.flags_length);
+    uint64_t value;
+    if (c.width_star) {
+      if (!reader.GetInteger(&value)) {
+        return false;
+      }
+      spec += std::to_string(int64_t(value));
+    } else {
+      spec.append(c.width, c.width_length);
+    }
+    if (c.precision_star) {
+      if (!reader.GetInteger(&value)) {
+        return false;
+      }
+      if (int64_t(value) >= 0) {
+        spec += "." + std::to_string(int64_t(value));
+      }
+    } else if (c.has_precision) {
+      spec += ".";
+      spec.append(c.precision, c.precision_length);
+    }
+
+    std::string str;
+    switch (c.conversion) {
+      case 'd':
+      case 'i':
+      case 'u':
+      case 'x':
+      case 'X':
+      case 'o':
+        if (!reader.GetInteger(&value)) {
+          return false;
+        }
+        spec += "ll";
+        spec += c.conversion;
+        AppendFormatted(out_line, spec, static_cast<long long>(value));
+        break;
+      case 'c':
+      case 'C':
+        if (!reader.GetInteger(&value)) {
+          return false;
+        }
+        AppendFormatted(out_line, spec + "c", static_cast<int>(value));
+        break;
+      case 'e':
+      case 'E':
+      case 'f':
+      case 'F':
+      case 'g':
+      case 'G':
+      case 'a':
+      case 'A': {
+        if (!reader.GetInteger(&value)) {
+          return false;
+        }
+        double float_value;
+        std::memcpy(&float_value, &value, sizeof(float_value));
+        AppendFormatted(out_line, spec + c.conversion, float_value);
+        break;
+      }
+      case 'p':
+        if (!reader.GetInteger(&value)) {
+          return false;
+        }
+        AppendFormatted(out_line, spec + "p",
+                        reinterpret_cast<void*>(uintptr_t(value)));
+        break;
+      case 's':
+      case 'S':
+        if (!reader.GetString(&str)) {
+          return false;
+        }
+        AppendFormatted(out_line, spec + "s", str.c_str());
+        break;
+      case 'n':
+        break;
+      default:
+        out_line->append(start, p - start);
+        break;
+    }
+  }
+  return reader.at_end();
+}
+
+}  // namespace binary_log
+}  // namespace xe
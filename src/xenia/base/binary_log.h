@@ -0,0 +1,51 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2016 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#ifndef XENIA_BASE_BINARY_LOG_H_
+#define XENIA_BASE_BINARY_LOG_H_
+
+#include <cstdarg>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace xe {
+namespace binary_log {
+
+// A binary log is the magic and version, followed by records starting with
+// their RecordType, with host byte order fields:
+//   kFormat: u64 format id, u32 length, the format string.
+//   kLine:   u64 format id, u32 thread id, u8 level, u32 length, the
+//            arguments as EncodeArguments wrote them.
+//   kText:   u32 thread id, u8 level, u32 length, the line.
+// Each format is recorded once, before the first line using it.
+const char kMagic[4] = {'X', 'L', 'O', 'G'};
+const uint32_t kVersion = 1;
+
+enum RecordType : uint8_t {
+  kFormat = 1,
+  kLine = 2,
+  kText = 3,
+};
+
+// Appends the arguments the printf format takes from the list to the buffer,
+// without formatting them. Integers, floats and pointers are stored as 8
+// bytes and strings by value, narrowed if wide.
+void EncodeArguments(const char* format, va_list args,
+                     std::vector<uint8_t>* buffer);
+
+// Formats the line from the arguments stored by EncodeArguments for the same
+// format, returning false if they don't match it.
+bool FormatArguments(const char* format, const uint8_t* arguments,
+                     size_t length, std::string* out_line);
+
+}  // namespace binary_log
+}  // namespace xe
+
+#endif  // XENIA_BASE_BINARY_LOG_H_
@@ -18,7 +18,9 @@
 namespace xe {
 
 BitStream::BitStream(uint8_t* buffer, size_t size_in_bits)
-    : buffer_(buffer), size_bits_(size_in_bits) {}
+    : buffer_(buffer), size_bits_(size_in_bits) {
+  Refill();
+}
 
 BitStream::~BitStream() = default;
 
@@ -29,40 +31,20 @@ void BitStream::SetOffset(size_t offset_bits) {
 
 size_t BitStream::BitsRemaining() { return size_bits_ - offset_bits_; }
 
-uint64_t BitStream::Peek(size_t num_bits) {
-  // FYI: The reason we can't copy more than 57 bits is:
+void BitStream::Refill() {
+  // FYI: The reason we can't peek more than 57 bits is:
   // 57 = 7 * 8 + 1 - that can only span a maximum of 8 bytes.
-  // We can't read in 9 bytes (easily), so we limit it.
-  assert_false(num_bits > 57);
-  assert_false(offset_bits_ + num_bits > size_bits_);
-
   size_t offset_bytes = offset_bits_ >> 3;
-  size_t rel_offset_bits = offset_bits_ - (offset_bytes << 3);
-
-  // offset -->
-  // ..[junk]..| target bits |....[junk].............
-  uint64_t bits = *(uint64_t*)(buffer_ + offset_bytes);
-
+  window_start_bits_ = offset_bytes << 3;
+  size_t size_bytes = (size_bits_ + 7) >> 3;
+  uint64_t bits = 0;
+  if (offset_bytes + 8 <= size_bytes) {
+    std::memcpy(&bits, buffer_ + offset_bytes, 8);
+  } else if (offset_bytes < size_bytes) {
+    std::memcpy(&bits, buffer_ + offset_bytes, size_bytes - offset_bytes);
+  }
   // We need the data in little endian.
-  // TODO: Have a flag specifying endianness of data?
-  bits = xe::byte_swap(bits);
-
-  // Shift right
-  // .....[junk]........| target bits |
-  bits >>= 64 - (rel_offset_bits + num_bits);
-
-  // AND with mask
-  // ...................| target bits |
-  bits &= (1 << num_bits) - 1;
-
-  return bits;
-}
-
-uint64_t BitStream::Read(size_t num_bits) {
-  uint64_t val = Peek(num_bits);
-  Advance(num_bits);
-
-  return val;
+  window_ = xe::byte_swap(bits);
 }
 
 // TODO: This is totally not tested!
@@ -74,7 +56,7 @@ bool BitStream::Write(uint64_t val, size_t num_bits) {
   size_t rel_offset_bits = offset_bits_ - (offset_bytes << 3);
 
   // Construct a mask
-  uint64_t mask = (1 << num_bits) - 1;
+  uint64_t mask = (uint64_t(1) << num_bits) - 1;
   mask <<= 64 - (rel_offset_bits + num_bits);
   mask = ~mask;
 
@@ -95,6 +77,8 @@ bool BitStream::Write(uint64_t val, size_t num_bits) {
 
   // Store into the bitstream.
   *(uint64_t*)(buffer_ + offset_bytes) = bits;
+  // The window may hold the old bits.
+  Refill();
 
   // Advance the bitstream forward.
   Advance(num_bits);
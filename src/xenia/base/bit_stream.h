@@ -13,8 +13,13 @@
 #include <cstddef>
 #include <cstdint>
 
+#include "xenia/base/assert.h"
+
 namespace xe {
 
+// Reads big endian bit fields. Peeks are served from a 64-bit window of the
+// buffer, loaded with one unaligned big endian load whenever the bits go past
+// it, and never past the end of the buffer.
 class BitStream {
  public:
   BitStream(uint8_t* buffer, size_t size_in_bits);
@@ -30,16 +35,38 @@ class BitStream {
   size_t BitsRemaining();
 
   // Note: num_bits MUST be in the range 0-57 (inclusive)
-  uint64_t Peek(size_t num_bits);
-  uint64_t Read(size_t num_bits);
+  uint64_t Peek(size_t num_bits) {
+    assert_false(num_bits > 57);
+    assert_false(offset_bits_ + num_bits > size_bits_);
+    // Wraps around to refill when going back before the window too.
+    size_t window_offset_bits = offset_bits_ - window_start_bits_;
+    if (window_offset_bits > 64 - num_bits) {
+      Refill();
+      window_offset_bits = offset_bits_ & 7;
+    }
+    // Shifted in two steps, so no shift is by 64 when num_bits is 0.
+    return ((window_ << window_offset_bits) >> 1) >> (63 - num_bits);
+  }
+  uint64_t Read(size_t num_bits) {
+    uint64_t val = Peek(num_bits);
+    Advance(num_bits);
+    return val;
+  }
   bool Write(uint64_t val, size_t num_bits);  // TODO(DrChat): Not tested!
 
   size_t Copy(uint8_t* dest_buffer, size_t num_bits);
 
  private:
+  // Loads the window from the byte holding the current bit.
+  void Refill();
+
   uint8_t* buffer_ = nullptr;
   size_t offset_bits_ = 0;
   size_t size_bits_ = 0;
+  // Bits from window_start_bits_ on, a byte boundary, the first in the top
+  // bit. Past the end of the buffer, the window is padded with zeros.
+  uint64_t window_ = 0;
+  size_t window_start_bits_ = 0;
 };
 
 }  // namespace xe
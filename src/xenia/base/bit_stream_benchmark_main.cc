@@ -0,0 +1,119 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2016 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#include <gflags/gflags.h>
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+#include "xenia/base/bit_stream.h"
+#include "xenia/base/clock.h"
+#include "xenia/base/logging.h"
+#include "xenia/base/main.h"
+
+DEFINE_int32(bit_stream_benchmark_passes, 256,
+             "Number of passes over the buffer per field layout.");
+
+namespace xe {
+namespace test {
+
+// Reads the bits one byte at a time, as a reference for BitStream.
+uint64_t ReadBitsScalar(const uint8_t* buffer, size_t* offset_bits,
+                        size_t num_bits) {
+  uint64_t val = 0;
+  for (size_t i = 0; i < num_bits; ++i) {
+    size_t bit = *offset_bits + i;
+    val = (val << 1) | ((buffer[bit >> 3] >> (7 - (bit & 7))) & 1);
+  }
+  *offset_bits += num_bits;
+  return val;
+}
+
+int main(const std::vector<std::wstring>& args) {
+  int32_t passes = std::max(FLAGS_bit_stream_benchmark_passes, 1);
+  double ticks_to_us = 1000000.0 / Clock::host_tick_frequency();
+
+  // 64 XMA packets of 2048 bytes.
+  std::vector<uint8_t> buffer(64 * 2048);
+  for (size_t i = 0; i < buffer.size(); ++i) {
+    buffer[i] = uint8_t((uint32_t(i) * 2654435761u) >> 24);
+  }
+  size_t size_bits = buffer.size() * 8;
+
+  // Field sizes read in turn: XMA frame lengths are 15 bits, followed by a
+  // few flags, and the packet headers have 6 to 26 bit fields.
+  const std::vector<std::vector<size_t>> layouts = {
+      {15, 1},
+      {15},
+      {6, 15, 3, 26, 1},
+      {57, 1, 32},
+  };
+
+  std::printf("%-12s %10s %10s %8s %s\n", "fields", "scalar_us", "stream_us",
+              "speedup", "result");
+  int mismatch_count = 0;
+  for (auto& layout : layouts) {
+    uint64_t scalar_sum = 0;
+    uint64_t start = Clock::QueryHostTickCount();
+    for (int32_t k = 0; k < passes; ++k) {
+      size_t offset_bits = 0;
+      for (size_t i = 0;; i = (i + 1) % layout.size()) {
+        if (offset_bits + layout[i] > size_bits) {
+          break;
+        }
+        scalar_sum =
+            scalar_sum * 31 + ReadBitsScalar(buffer.data(), &offset_bits,
+                                             layout[i]);
+      }
+    }
+    uint64_t scalar_ticks = Clock::QueryHostTickCount() - start;
+
+    uint64_t stream_sum = 0;
+    start = Clock::QueryHostTickCount();
+    for (int32_t k = 0; k < passes; ++k) {
+      BitStream stream(buffer.data(), size_bits);
+      for (size_t i = 0;; i = (i + 1) % layout.size()) {
+        if (stream.BitsRemaining() < layout[i]) {
+          break;
+        }
+        stream_sum = stream_sum * 31 + stream.Read(layout[i]);
+      }
+    }
+    uint64_t stream_ticks = Clock::QueryHostTickCount() - start;
+
+    bool matches = scalar_sum == stream_sum;
+    if (!matches) {
+      ++mismatch_count;
+    }
+    char name[32] = "";
+    for (size_t num_bits : layout) {
+      size_t length = std::strlen(name);
+      std::snprintf(name + length, sizeof(name) - length,
+                    length ? ",%zu" : "%zu", num_bits);
+    }
+    double scalar_us = scalar_ticks * ticks_to_us / passes;
+    double stream_us = stream_ticks * ticks_to_us / passes;
+    std::printf("%-12s %10.3f %10.3f %7.2fx %s\n", name, scalar_us, stream_us,
+                stream_us > 0.0 ? scalar_us / stream_us : 0.0,
+                matches ? "ok" : "MISMATCH");
+  }
+  if (mismatch_count) {
+    XELOGE("%d field layouts read differently", mismatch_count);
+    return 1;
+  }
+  return 0;
+}
+
+}  // namespace test
+}  // namespace xe
+
+DEFINE_ENTRY_POINT(L"xenia-base-bit-stream-benchmark",
+                   L"xenia-base-bit-stream-benchmark", xe::test::main);
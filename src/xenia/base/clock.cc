@@ -9,10 +9,24 @@
 
 #include "xenia/base/clock.h"
 
+#include <gflags/gflags.h>
+
 #include <algorithm>
 #include <climits>
 
 #include "xenia/base/assert.h"
+#include "xenia/base/platform.h"
+
+#if XE_COMPILER_MSVC
+#include <intrin.h>
+#else
+#include <cpuid.h>
+#include <x86intrin.h>
+#endif  // XE_COMPILER_MSVC
+
+DEFINE_bool(clock_tsc, true,
+            "Reads the guest clock from the CPU timestamp counter when it "
+            "runs at a constant rate, instead of the host tick API.");
 
 namespace xe {
 
@@ -24,27 +38,90 @@ uint64_t guest_tick_frequency_ = Clock::host_tick_frequency();
 uint64_t guest_system_time_base_ = Clock::QueryHostSystemTime();
 // Combined time and frequency scalar (computed by RecomputeGuestTickScalar).
 double guest_tick_scalar_ = 1.0;
-// Native guest ticks.
-thread_local uint64_t guest_tick_count_ = 0;
-// 100ns ticks, relative to guest_system_time_base_.
-thread_local uint64_t guest_time_filetime_ = 0;
-// Last sampled host tick count.
-thread_local uint64_t last_host_tick_count_ = Clock::QueryHostTickCount();
+// Starts out counting host ticks at the guest frequency, which is the host
+// frequency until RecomputeGuestTickScalar.
+Clock::GuestClockParams guest_clock_params_ = {Clock::QueryHostTickCount(), 0,
+                                               1ull << 32, false};
+
+namespace {
+
+// Whether the timestamp counter runs at the same rate in all power states.
+bool HasInvariantTsc() {
+  uint32_t registers[4];
+#if XE_COMPILER_MSVC
+  __cpuid(reinterpret_cast<int*>(registers), 0x80000000);
+#else
+  __cpuid(0x80000000, registers[0], registers[1], registers[2], registers[3]);
+#endif  // XE_COMPILER_MSVC
+  if (registers[0] < 0x80000007) {
+    return false;
+  }
+#if XE_COMPILER_MSVC
+  __cpuid(reinterpret_cast<int*>(registers), 0x80000007);
+#else
+  __cpuid(0x80000007, registers[0], registers[1], registers[2], registers[3]);
+#endif  // XE_COMPILER_MSVC
+  const uint32_t kInvariantTsc = 1u << 8;
+  return (registers[3] & kInvariantTsc) != 0;
+}
+
+// Measures the timestamp counter against the host ticks for 20ms.
+uint64_t CalibrateTscFrequency() {
+  uint64_t host_frequency = Clock::host_tick_frequency();
+  uint64_t host_start = Clock::QueryHostTickCount();
+  uint64_t tsc_start = __rdtsc();
+  uint64_t host_end;
+  do {
+    host_end = Clock::QueryHostTickCount();
+  } while (host_end - host_start < host_frequency / 50);
+  uint64_t tsc_end = __rdtsc();
+  return uint64_t((tsc_end - tsc_start) * (double(host_frequency) /
+                                           double(host_end - host_start)));
+}
+
+uint64_t ReadGuestClockCounter() {
+  return guest_clock_params_.uses_tsc ? __rdtsc() : Clock::QueryHostTickCount();
+}
+
+uint64_t GuestTickCountAt(uint64_t counter) {
+  const auto& params = guest_clock_params_;
+  uint64_t delta =
+      counter > params.counter_base ? counter - params.counter_base : 0;
+#if XE_COMPILER_MSVC
+  uint64_t high;
+  uint64_t low = _umul128(delta, params.scale, &high);
+  return params.tick_base + ((high << 32) | (low >> 32));
+#else
+  return params.tick_base +
+         uint64_t((unsigned __int128)delta * params.scale >> 32);
+#endif  // XE_COMPILER_MSVC
+}
+
+// Converts guest ticks to 100ns units, without overflowing for long runs.
+uint64_t GuestTicksToFileTime(uint64_t tick_count) {
+  return (tick_count / guest_tick_frequency_) * 10000000 +
+         (tick_count % guest_tick_frequency_) * 10000000 /
+             guest_tick_frequency_;
+}
+
+}  // namespace
 
 void RecomputeGuestTickScalar() {
   guest_tick_scalar_ = (guest_tick_frequency_ * guest_time_scalar_) /
                        static_cast<double>(Clock::host_tick_frequency());
-}
 
-void UpdateGuestClock() {
-  uint64_t host_tick_count = Clock::QueryHostTickCount();
-  uint64_t host_tick_delta = host_tick_count > last_host_tick_count_
-                                 ? host_tick_count - last_host_tick_count_
-                                 : 0;
-  last_host_tick_count_ = host_tick_count;
-  uint64_t guest_tick_delta = uint64_t(host_tick_delta * guest_tick_scalar_);
-  guest_tick_count_ += guest_tick_delta;
-  guest_time_filetime_ += (guest_tick_delta * 10000000) / guest_tick_frequency_;
+  static const uint64_t tsc_frequency =
+      FLAGS_clock_tsc && HasInvariantTsc() ? CalibrateTscFrequency() : 0;
+  // Continues from the current guest time at the new rate.
+  uint64_t tick_count = Clock::QueryGuestTickCount();
+  auto& params = guest_clock_params_;
+  params.uses_tsc = tsc_frequency != 0;
+  uint64_t counter_frequency =
+      params.uses_tsc ? tsc_frequency : Clock::host_tick_frequency();
+  params.counter_base = ReadGuestClockCounter();
+  params.tick_base = tick_count;
+  params.scale = uint64_t(guest_tick_frequency_ * guest_time_scalar_ *
+                          4294967296.0 / counter_frequency);
 }
 
 double Clock::guest_time_scalar() { return guest_time_scalar_; }
@@ -57,6 +134,7 @@ void Clock::set_guest_time_scalar(double scalar) {
 uint64_t Clock::guest_tick_frequency() { return guest_tick_frequency_; }
 
 void Clock::set_guest_tick_frequency(uint64_t frequency) {
+  // The ticks so far are kept, but mean a different time from now on.
   guest_tick_frequency_ = frequency;
   RecomputeGuestTickScalar();
 }
@@ -68,30 +146,32 @@ void Clock::set_guest_system_time_base(uint64_t time_base) {
 }
 
 uint64_t Clock::QueryGuestTickCount() {
-  UpdateGuestClock();
-  return guest_tick_count_;
+  return GuestTickCountAt(ReadGuestClockCounter());
 }
 
 uint64_t Clock::QueryGuestSystemTime() {
-  UpdateGuestClock();
-  return guest_system_time_base_ + guest_time_filetime_;
+  return guest_system_time_base_ + GuestTicksToFileTime(QueryGuestTickCount());
 }
 
 uint32_t Clock::QueryGuestUptimeMillis() {
-  UpdateGuestClock();
-  uint64_t uptime_millis = guest_tick_count_ / (guest_tick_frequency_ / 1000);
+  uint64_t uptime_millis =
+      QueryGuestTickCount() / (guest_tick_frequency_ / 1000);
   uint32_t result = uint32_t(std::min(uptime_millis, uint64_t(UINT_MAX)));
   return result;
 }
 
 void Clock::SetGuestTickCount(uint64_t tick_count) {
-  last_host_tick_count_ = Clock::QueryHostTickCount();
-  guest_tick_count_ = tick_count;
+  guest_clock_params_.counter_base = ReadGuestClockCounter();
+  guest_clock_params_.tick_base = tick_count;
 }
 
 void Clock::SetGuestSystemTime(uint64_t system_time) {
-  last_host_tick_count_ = Clock::QueryHostTickCount();
-  guest_time_filetime_ = system_time - guest_system_time_base_;
+  guest_system_time_base_ =
+      system_time - GuestTicksToFileTime(QueryGuestTickCount());
+}
+
+const Clock::GuestClockParams* Clock::guest_clock_params() {
+  return &guest_clock_params_;
 }
 
 uint32_t Clock::ScaleGuestDurationMillis(uint32_t guest_ms) {
@@ -47,11 +47,26 @@ class Clock {
   // Queries the milliseconds since the guest began, accounting for scaling.
   static uint32_t QueryGuestUptimeMillis();
 
-  // Sets the guest tick count for the current thread.
+  // Sets the guest tick count, continuing from it.
   static void SetGuestTickCount(uint64_t tick_count);
-  // Sets the system time for the current thread.
+  // Sets the guest system time, continuing from it.
   static void SetGuestSystemTime(uint64_t system_time);
 
+  // The guest tick count is computed from a host counter as
+  //   tick_base + ((counter - counter_base) * scale >> 32),
+  // clamping counter - counter_base to 0, where the counter is the CPU
+  // timestamp counter when uses_tsc, or else QueryHostTickCount. When the
+  // JIT reads these, the guest clock must not be set or rescaled while guest
+  // code runs.
+  struct GuestClockParams {
+    uint64_t counter_base;
+    uint64_t tick_base;
+    // Guest ticks per counter tick, in 32.32 fixed point.
+    uint64_t scale;
+    bool uses_tsc;
+  };
+  static const GuestClockParams* guest_clock_params();
+
   // Scales a time duration in milliseconds, from guest time.
   static uint32_t ScaleGuestDurationMillis(uint32_t guest_ms);
   // Scales a time duration in 100ns ticks like FILETIME, from guest time.
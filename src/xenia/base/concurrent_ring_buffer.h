@@ -0,0 +1,303 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2016 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#ifndef XENIA_BASE_CONCURRENT_RING_BUFFER_H_
+#define XENIA_BASE_CONCURRENT_RING_BUFFER_H_
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <type_traits>
+
+#include "xenia/base/assert.h"
+#include "xenia/base/math.h"
+
+namespace xe {
+
+// Assumed size of a cache line. State written by different threads is kept
+// this far apart so the threads don't invalidate each other's caches.
+const size_t kCacheLineSize = 64;
+
+// Items of a ring buffer, split in two where they wrap around its end.
+template <typename T>
+struct RingBufferRange {
+  T* first;
+  size_t first_count;
+  T* second;
+  size_t second_count;
+  // Position of the first item, as counted since the buffer was created.
+  size_t index;
+
+  size_t count() const { return first_count + second_count; }
+  T& operator[](size_t i) const {
+    return i < first_count ? first[i] : second[i - first_count];
+  }
+};
+
+// A bounded queue from one producer thread to one consumer thread, without
+// locks. The capacity is rounded up to a power of two.
+//
+// Batches are written in place between BeginWrite and EndWrite and read in
+// place between BeginRead and EndRead, like with RingBuffer; each side only
+// touches the shared indices once per batch.
+template <typename T>
+class SpscRingBuffer {
+ public:
+  static_assert(std::is_trivially_copyable<T>::value,
+                "Items are copied in and out of the buffer");
+  typedef RingBufferRange<T> Range;
+
+  explicit SpscRingBuffer(size_t capacity)
+      : capacity_(xe::next_pow2(std::max(capacity, size_t(2)))),
+        mask_(capacity_ - 1),
+        items_(new T[capacity_]) {}
+
+  size_t capacity() const { return capacity_; }
+  // Exact only when called by the producer or the consumer.
+  size_t size() const {
+    return write_index_.load(std::memory_order_acquire) -
+           read_index_.load(std::memory_order_acquire);
+  }
+  bool empty() const { return size() == 0; }
+
+  // Producer only. Returns room for up to max_count items, which are added
+  // once EndWrite is called.
+  Range BeginWrite(size_t max_count) {
+    size_t index = write_index_.load(std::memory_order_relaxed);
+    size_t free_count = capacity_ - (index - cached_read_index_);
+    if (free_count < max_count) {
+      cached_read_index_ = read_index_.load(std::memory_order_acquire);
+      free_count = capacity_ - (index - cached_read_index_);
+    }
+    return MakeRange(index, std::min(max_count, free_count));
+  }
+  // Adds the first count items of the range from BeginWrite.
+  void EndWrite(size_t count) {
+    size_t index = write_index_.load(std::memory_order_relaxed);
+    write_index_.store(index + count, std::memory_order_release);
+  }
+  bool Push(const T& item) {
+    auto range = BeginWrite(1);
+    if (!range.first_count) {
+      return false;
+    }
+    *range.first = item;
+    EndWrite(1);
+    return true;
+  }
+  // Adds as many of the items as fit, returning how many did.
+  size_t Write(const T* items, size_t count) {
+    auto range = BeginWrite(count);
+    std::copy(items, items + range.first_count, range.first);
+    std::copy(items + range.first_count, items + range.count(),
+              range.second);
+    EndWrite(range.count());
+    return range.count();
+  }
+
+  // Consumer only. Returns up to max_count of the oldest items, which stay
+  // in the buffer until EndRead is called.
+  Range BeginRead(size_t max_count) {
+    size_t index = read_index_.load(std::memory_order_relaxed);
+    size_t count = cached_write_index_ - index;
+    if (count < max_count) {
+      cached_write_index_ = write_index_.load(std::memory_order_acquire);
+      count = cached_write_index_ - index;
+    }
+    return MakeRange(index, std::min(max_count, count));
+  }
+  // Removes the first count items of the range from BeginRead.
+  void EndRead(size_t count) {
+    size_t index = read_index_.load(std::memory_order_relaxed);
+    read_index_.store(index + count, std::memory_order_release);
+  }
+  bool Pop(T* out_item) {
+    auto range = BeginRead(1);
+    if (!range.first_count) {
+      return false;
+    }
+    *out_item = *range.first;
+    EndRead(1);
+    return true;
+  }
+  // Removes up to count items into the buffer, returning how many.
+  size_t Read(T* items, size_t count) {
+    auto range = BeginRead(count);
+    std::copy(range.first, range.first + range.first_count, items);
+    std::copy(range.second, range.second + range.second_count,
+              items + range.first_count);
+    EndRead(range.count());
+    return range.count();
+  }
+
+ private:
+  Range MakeRange(size_t index, size_t count) const {
+    size_t start = index & mask_;
+    size_t first_count = std::min(count, capacity_ - start);
+    return {&items_[start], first_count, items_.get(), count - first_count,
+            index};
+  }
+
+  const size_t capacity_;
+  const size_t mask_;
+  const std::unique_ptr<T[]> items_;
+
+  // Written by the producer.
+  uint8_t padding0_[kCacheLineSize];
+  std::atomic<size_t> write_index_ = {0};
+  size_t cached_read_index_ = 0;
+
+  // Written by the consumer.
+  uint8_t padding1_[kCacheLineSize];
+  std::atomic<size_t> read_index_ = {0};
+  size_t cached_write_index_ = 0;
+  uint8_t padding2_[kCacheLineSize];
+};
+
+// A bounded queue from any number of producer threads to one consumer
+// thread, without locks. The capacity is rounded up to a power of two.
+//
+// Every slot has a sequence number telling whether it is free for the
+// producers or holds an item for the consumer, so a producer only has to
+// claim slots from the others, and publishes them without waiting on anyone.
+// A producer stalled between BeginWrite and EndWrite holds up the consumer
+// at its slots, though not the other producers.
+template <typename T>
+class MpscRingBuffer {
+ public:
+  static_assert(std::is_trivially_copyable<T>::value,
+                "Items are copied in and out of the buffer");
+  typedef RingBufferRange<T> Range;
+
+  explicit MpscRingBuffer(size_t capacity)
+      : capacity_(xe::next_pow2(std::max(capacity, size_t(2)))),
+        mask_(capacity_ - 1),
+        items_(new T[capacity_]),
+        sequences_(new std::atomic<size_t>[capacity_]) {
+    for (size_t i = 0; i < capacity_; ++i) {
+      sequences_[i].store(i, std::memory_order_relaxed);
+    }
+  }
+
+  size_t capacity() const { return capacity_; }
+  // Includes items still being written. Approximate.
+  size_t size() const {
+    return write_index_.load(std::memory_order_acquire) -
+           read_index_.load(std::memory_order_acquire);
+  }
+  bool empty() const { return size() == 0; }
+
+  // Any thread. Claims room for exactly count consecutive items, returning an
+  // empty range if there isn't that much. The items are published to the
+  // consumer with EndWrite.
+  Range BeginWrite(size_t count) {
+    if (!count || count > capacity_) {
+      return MakeRange(0, 0);
+    }
+    size_t index = write_index_.load(std::memory_order_relaxed);
+    while (true) {
+      // The consumer frees slots in order, so the rest are free if the last
+      // one is.
+      size_t last = index + count - 1;
+      auto& sequence = sequences_[last & mask_];
+      auto difference =
+          intptr_t(sequence.load(std::memory_order_acquire) - last);
+      if (difference < 0) {
+        // Still holds an item from the previous lap.
+        return MakeRange(0, 0);
+      } else if (difference > 0) {
+        // Another producer got the slot first.
+        index = write_index_.load(std::memory_order_relaxed);
+      } else if (write_index_.compare_exchange_weak(
+                     index, index + count, std::memory_order_relaxed)) {
+        return MakeRange(index, count);
+      }
+    }
+  }
+  // Publishes all items of the range from BeginWrite.
+  void EndWrite(const Range& range) {
+    for (size_t i = 0; i < range.count(); ++i) {
+      size_t index = range.index + i;
+      sequences_[index & mask_].store(index + 1, std::memory_order_release);
+    }
+  }
+  bool Push(const T& item) {
+    auto range = BeginWrite(1);
+    if (!range.first_count) {
+      return false;
+    }
+    *range.first = item;
+    EndWrite(range);
+    return true;
+  }
+
+  // Consumer only. Returns up to max_count of the oldest published items,
+  // which stay in the buffer until EndRead is called.
+  Range BeginRead(size_t max_count) {
+    size_t index = read_index_.load(std::memory_order_relaxed);
+    size_t count = 0;
+    max_count = std::min(max_count, capacity_);
+    while (count < max_count) {
+      size_t slot_index = index + count;
+      if (sequences_[slot_index & mask_].load(std::memory_order_acquire) !=
+          slot_index + 1) {
+        break;
+      }
+      ++count;
+    }
+    return MakeRange(index, count);
+  }
+  // Frees the first count items of the range from BeginRead.
+  void EndRead(size_t count) {
+    size_t index = read_index_.load(std::memory_order_relaxed);
+    for (size_t i = 0; i < count; ++i) {
+      size_t slot_index = index + i;
+      sequences_[slot_index & mask_].store(slot_index + capacity_,
+                                           std::memory_order_release);
+    }
+    read_index_.store(index + count, std::memory_order_release);
+  }
+  bool Pop(T* out_item) {
+    auto range = BeginRead(1);
+    if (!range.first_count) {
+      return false;
+    }
+    *out_item = *range.first;
+    EndRead(1);
+    return true;
+  }
+
+ private:
+  Range MakeRange(size_t index, size_t count) const {
+    size_t start = index & mask_;
+    size_t first_count = std::min(count, capacity_ - start);
+    return {&items_[start], first_count, items_.get(), count - first_count,
+            index};
+  }
+
+  const size_t capacity_;
+  const size_t mask_;
+  const std::unique_ptr<T[]> items_;
+  const std::unique_ptr<std::atomic<size_t>[]> sequences_;
+
+  // Written by the producers.
+  uint8_t padding0_[kCacheLineSize];
+  std::atomic<size_t> write_index_ = {0};
+
+  // Written by the consumer.
+  uint8_t padding1_[kCacheLineSize];
+  std::atomic<size_t> read_index_ = {0};
+  uint8_t padding2_[kCacheLineSize];
+};
+
+}  // namespace xe
+
+#endif  // XENIA_BASE_CONCURRENT_RING_BUFFER_H_
@@ -0,0 +1,129 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2016 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#include <gflags/gflags.h>
+
+#include <algorithm>
+#include <cstdio>
+#include <vector>
+
+#include "xenia/base/clock.h"
+#include "xenia/base/logging.h"
+#include "xenia/base/main.h"
+#include "xenia/base/memory.h"
+
+DEFINE_int32(copy_and_swap_benchmark_kb, 256,
+             "Size of the buffer copied per pass, in KiB.");
+DEFINE_int32(copy_and_swap_benchmark_passes, 64,
+             "Number of passes per width, alignment and instruction set.");
+
+namespace xe {
+namespace test {
+
+// Moves byte i of each unit to i ^ swap_mask, as a reference.
+void CopyAndSwapScalar(uint8_t* dest, const uint8_t* src, size_t size,
+                       size_t swap_mask) {
+  for (size_t i = 0; i < size; ++i) {
+    dest[i] = src[i ^ swap_mask];
+  }
+}
+
+int main(const std::vector<std::wstring>& args) {
+  int32_t passes = std::max(FLAGS_copy_and_swap_benchmark_passes, 1);
+  size_t size = size_t(std::max(FLAGS_copy_and_swap_benchmark_kb, 1)) * 1024;
+  double ticks_to_us = 1000000.0 / Clock::host_tick_frequency();
+
+  struct Width {
+    const char* name;
+    size_t unit_size;
+    size_t swap_mask;
+    void (*function)(void* dest, const void* src, size_t count);
+  };
+  const Width widths[] = {
+      {"16", 2, 1, xe::copy_and_swap_16_unaligned},
+      {"32", 4, 3, xe::copy_and_swap_32_unaligned},
+      {"64", 8, 7, xe::copy_and_swap_64_unaligned},
+      {"16in32", 4, 2, xe::copy_and_swap_16_in_32_aligned},
+  };
+  const struct {
+    const char* name;
+    CopyAndSwapIsa isa;
+  } isas[] = {
+      {"ssse3", CopyAndSwapIsa::kSSSE3},
+      {"avx2", CopyAndSwapIsa::kAVX2},
+      {"avx512", CopyAndSwapIsa::kAVX512},
+  };
+
+  // Room for the misaligned offsets of both buffers.
+  std::vector<uint8_t> src(size + 64);
+  for (size_t i = 0; i < src.size(); ++i) {
+    src[i] = uint8_t((uint32_t(i) * 2654435761u) >> 24);
+  }
+  std::vector<uint8_t> scalar_dest(size + 64);
+  std::vector<uint8_t> dest(size + 64);
+
+  std::printf("%-8s %-7s %-8s %10s %10s %8s %s\n", "width", "isa", "offsets",
+              "scalar_us", "simd_us", "speedup", "result");
+  auto default_isa = copy_and_swap_isa();
+  int mismatch_count = 0;
+  for (auto& width : widths) {
+    // Aligned to the vectors, to the units only, and not at all.
+    const size_t offsets[][2] = {
+        {0, 0}, {width.unit_size, 0}, {0, width.unit_size}, {1, 3}};
+    for (auto& offset : offsets) {
+      size_t count = size / width.unit_size;
+      const uint8_t* src_data = src.data() + offset[0];
+      uint64_t start = Clock::QueryHostTickCount();
+      for (int32_t k = 0; k < passes; ++k) {
+        CopyAndSwapScalar(scalar_dest.data() + offset[1], src_data, size,
+                          width.swap_mask);
+      }
+      uint64_t scalar_ticks = Clock::QueryHostTickCount() - start;
+
+      for (auto& isa : isas) {
+        if (!set_copy_and_swap_isa(isa.isa)) {
+          continue;
+        }
+        start = Clock::QueryHostTickCount();
+        for (int32_t k = 0; k < passes; ++k) {
+          width.function(dest.data() + offset[1], src_data, count);
+        }
+        uint64_t simd_ticks = Clock::QueryHostTickCount() - start;
+
+        bool matches = dest == scalar_dest;
+        if (!matches) {
+          ++mismatch_count;
+        }
+        double scalar_us = scalar_ticks * ticks_to_us / passes;
+        double simd_us = simd_ticks * ticks_to_us / passes;
+        char offset_name[16];
+        std::snprintf(offset_name, sizeof(offset_name), "%zu/%zu", offset[0],
+                      offset[1]);
+        std::printf("%-8s %-7s %-8s %10.3f %10.3f %7.2fx %s\n", width.name,
+                    isa.name, offset_name, scalar_us, simd_us,
+                    simd_us > 0.0 ? scalar_us / simd_us : 0.0,
+                    matches ? "ok" : "MISMATCH");
+        std::fill(dest.begin(), dest.end(), uint8_t(0));
+      }
+      std::fill(scalar_dest.begin(), scalar_dest.end(), uint8_t(0));
+    }
+  }
+  set_copy_and_swap_isa(default_isa);
+  if (mismatch_count) {
+    XELOGE("%d layouts were swapped differently", mismatch_count);
+    return 1;
+  }
+  return 0;
+}
+
+}  // namespace test
+}  // namespace xe
+
+DEFINE_ENTRY_POINT(L"xenia-base-copy-and-swap-benchmark",
+                   L"xenia-base-copy-and-swap-benchmark", xe::test::main);
@@ -0,0 +1,246 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2016 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#include "xenia/base/counters.h"
+
+#include <gflags/gflags.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cinttypes>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <mutex>
+#include <string>
+
+#include "xenia/base/clock.h"
+#include "xenia/base/filesystem.h"
+#include "xenia/base/logging.h"
+#include "xenia/base/math.h"
+#include "xenia/base/platform.h"
+#include "xenia/base/socket.h"
+#include "xenia/base/string.h"
+#include "xenia/base/threading.h"
+
+DEFINE_string(counters_export, "",
+              "Writes the counters as JSON lines to this file, or to a TCP "
+              "server given as tcp:host:port. Empty disables it.");
+DEFINE_int32(counters_export_interval_ms, 1000,
+             "Interval between writes of the counters, in milliseconds.");
+
+namespace xe {
+
+namespace {
+
+struct ThreadValues {
+  std::atomic<uint64_t> values[256] = {};
+};
+
+struct Registry {
+  std::mutex mutex;
+  std::vector<Counter*> counters;
+  std::vector<ThreadValues*> threads;
+  // Values of threads that have exited.
+  uint64_t retired_values[256] = {};
+  // Zeroed values of threads that have exited, for new threads. They are
+  // reused rather than freed as counting may still happen in the destructors
+  // of other thread locals.
+  std::vector<ThreadValues*> free_threads;
+};
+
+// Never destroyed, as counters with static storage may outlive it.
+Registry* registry() {
+  static auto registry = new Registry();
+  return registry;
+}
+
+// Folds the values of the thread into the retired ones when it exits.
+struct ThreadValuesRef {
+  ThreadValues* values = nullptr;
+  ~ThreadValuesRef() {
+    if (!values) {
+      return;
+    }
+    auto registry = xe::registry();
+    std::lock_guard<std::mutex> lock(registry->mutex);
+    for (size_t i = 0; i < xe::countof(values->values); ++i) {
+      registry->retired_values[i] += values->values[i].exchange(0);
+    }
+    auto& threads = registry->threads;
+    threads.erase(std::find(threads.begin(), threads.end(), values));
+    registry->free_threads.push_back(values);
+  }
+};
+thread_local ThreadValuesRef thread_values_ref_;
+
+class Exporter {
+ public:
+  Exporter() : start_millis_(Clock::QueryHostUptimeMillis()) {
+    stop_event_ = xe::threading::Event::CreateManualResetEvent(false);
+    thread_ = xe::threading::Thread::Create({}, [this]() { ThreadMain(); });
+    thread_->set_name("Counter Exporter");
+  }
+  ~Exporter() {
+    stop_event_->Set();
+    xe::threading::Wait(thread_.get(), false);
+    if (file_) {
+      std::fclose(file_);
+    }
+  }
+
+ private:
+  void ThreadMain() {
+    auto interval = std::chrono::milliseconds(
+        std::max(FLAGS_counters_export_interval_ms, 10));
+    bool stopping = false;
+    while (!stopping) {
+      stopping = xe::threading::Wait(stop_event_.get(), false, interval) ==
+                 xe::threading::WaitResult::kSuccess;
+      Export();
+    }
+  }
+
+  // {"time_ms":1000,"counters":{"gpu.draws":123,...}}
+  void Export() {
+    std::string line = "{\"time_ms\":";
+    line += std::to_string(Clock::QueryHostUptimeMillis() - start_millis_);
+    line += ",\"counters\":{";
+    bool first = true;
+    for (auto& counter : Counter::Snapshot()) {
+      line += first ? "\"" : ",\"";
+      line += counter.first;
+      line += "\":";
+      line += std::to_string(counter.second);
+      first = false;
+    }
+    line += "}}\n";
+
+    const std::string& target = FLAGS_counters_export;
+    if (target.compare(0, 4, "tcp:") == 0) {
+#if XE_PLATFORM_WIN32
+      if (!socket_ || !socket_->is_connected()) {
+        size_t colon = target.rfind(':');
+        socket_ = Socket::Connect(
+            target.substr(4, colon - 4),
+            uint16_t(std::strtoul(target.c_str() + colon + 1, nullptr, 10)));
+      }
+      if (socket_ && !socket_->Send(line.data(), line.size())) {
+        socket_.reset();
+      }
+#else
+      if (!warned_) {
+        XELOGE("Exporting counters over TCP isn't supported on this platform");
+        warned_ = true;
+      }
+#endif  // XE_PLATFORM_WIN32
+      return;
+    }
+    if (!file_) {
+      auto path = xe::to_wstring(target);
+      xe::filesystem::CreateParentFolder(path);
+      file_ = xe::filesystem::OpenFile(path, "wb");
+      if (!file_) {
+        if (!warned_) {
+          XELOGE("Counters file %s could not be created", target.c_str());
+          warned_ = true;
+        }
+        return;
+      }
+    }
+    std::fwrite(line.data(), 1, line.size(), file_);
+    std::fflush(file_);
+  }
+
+  uint32_t start_millis_;
+  std::unique_ptr<xe::threading::Event> stop_event_;
+  std::unique_ptr<xe::threading::Thread> thread_;
+  FILE* file_ = nullptr;
+#if XE_PLATFORM_WIN32
+  std::unique_ptr<Socket> socket_;
+#endif  // XE_PLATFORM_WIN32
+  bool warned_ = false;
+};
+
+std::mutex exporter_mutex_;
+std::unique_ptr<Exporter> exporter_;
+
+}  // namespace
+
+thread_local std::atomic<uint64_t>* Counter::thread_values_ = nullptr;
+
+Counter::Counter(const char* name) : name_(name) {
+  static_assert(sizeof(ThreadValues::values) / sizeof(uint64_t) ==
+                    kMaxCount + 1,
+                "One slot per counter and one for the rest");
+  auto registry = xe::registry();
+  std::lock_guard<std::mutex> lock(registry->mutex);
+  index_ = std::min(registry->counters.size(), size_t(kMaxCount));
+  registry->counters.push_back(this);
+}
+
+uint64_t Counter::Read() const {
+  auto registry = xe::registry();
+  std::lock_guard<std::mutex> lock(registry->mutex);
+  uint64_t value = registry->retired_values[index_];
+  for (auto thread : registry->threads) {
+    value += thread->values[index_].load(std::memory_order_relaxed);
+  }
+  return value;
+}
+
+std::vector<std::pair<const char*, uint64_t>> Counter::Snapshot() {
+  auto registry = xe::registry();
+  std::lock_guard<std::mutex> lock(registry->mutex);
+  std::vector<std::pair<const char*, uint64_t>> values;
+  values.reserve(registry->counters.size());
+  for (auto counter : registry->counters) {
+    uint64_t value = registry->retired_values[counter->index_];
+    for (auto thread : registry->threads) {
+      value += thread->values[counter->index_].load(std::memory_order_relaxed);
+    }
+    values.emplace_back(counter->name_, value);
+  }
+  return values;
+}
+
+void Counter::StartExport() {
+  if (FLAGS_counters_export.empty()) {
+    return;
+  }
+  std::lock_guard<std::mutex> lock(exporter_mutex_);
+  if (!exporter_) {
+    exporter_.reset(new Exporter());
+  }
+}
+
+void Counter::StopExport() {
+  std::lock_guard<std::mutex> lock(exporter_mutex_);
+  exporter_.reset();
+}
+
+std::atomic<uint64_t>* Counter::AttachThread() {
+  ThreadValues* values;
+  {
+    auto registry = xe::registry();
+    std::lock_guard<std::mutex> lock(registry->mutex);
+    if (registry->free_threads.empty()) {
+      values = new ThreadValues();
+    } else {
+      values = registry->free_threads.back();
+      registry->free_threads.pop_back();
+    }
+    registry->threads.push_back(values);
+  }
+  thread_values_ref_.values = values;
+  thread_values_ = values->values;
+  return thread_values_;
+}
+
+}  // namespace xe
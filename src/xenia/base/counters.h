@@ -0,0 +1,79 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2016 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#ifndef XENIA_BASE_COUNTERS_H_
+#define XENIA_BASE_COUNTERS_H_
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+namespace xe {
+
+// Defines an always-on event counter, named like "gpu.draws".
+// Use `INCREMENT_counter(name, value)` to count.
+#define DEFINE_counter(name, counter_name) \
+  ::xe::Counter g_counter_##name(counter_name)
+// Declares a previously defined counter. Use outside of any namespace.
+#define DECLARE_counter(name) extern ::xe::Counter g_counter_##name
+// Adds the value to a previously defined counter.
+#define INCREMENT_counter(name, value) g_counter_##name.Increment(value)
+
+// A counter that any thread may increment for the cost of a thread-local
+// add, unlike the profiler's counters, which need the profiler running.
+// Each thread adds to its own values, which are summed when read. The
+// counters are written to --counters_export periodically once StartExport
+// has been called.
+//
+// Must have static storage duration, as with DEFINE_counter.
+class Counter {
+ public:
+  explicit Counter(const char* name);
+  Counter(const Counter&) = delete;
+  Counter& operator=(const Counter&) = delete;
+
+  const char* name() const { return name_; }
+
+  void Increment(uint64_t value = 1) {
+    auto values = thread_values_ ? thread_values_ : AttachThread();
+    // Only this thread writes its values.
+    auto& thread_value = values[index_];
+    thread_value.store(thread_value.load(std::memory_order_relaxed) + value,
+                       std::memory_order_relaxed);
+  }
+
+  // Sums the counter over all threads, including those that have exited.
+  uint64_t Read() const;
+
+  // Reads all counters, in the order they were registered.
+  static std::vector<std::pair<const char*, uint64_t>> Snapshot();
+
+  // Starts writing the counters every --counters_export_interval_ms, if
+  // --counters_export is set.
+  static void StartExport();
+  // Writes the counters a last time and stops.
+  static void StopExport();
+
+ private:
+  // Counters beyond this many are counted together in the last slot.
+  static const size_t kMaxCount = 255;
+
+  static std::atomic<uint64_t>* AttachThread();
+
+  static thread_local std::atomic<uint64_t>* thread_values_;
+
+  const char* name_;
+  size_t index_;
+};
+
+}  // namespace xe
+
+#endif  // XENIA_BASE_COUNTERS_H_
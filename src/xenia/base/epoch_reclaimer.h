@@ -0,0 +1,107 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2016 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#ifndef XENIA_BASE_EPOCH_RECLAIMER_H_
+#define XENIA_BASE_EPOCH_RECLAIMER_H_
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <vector>
+
+namespace xe {
+
+// Defers freeing things that readers may still be using without a lock.
+// Readers count themselves in the current epoch while they read. Things are
+// retired in the current epoch once replaced, and reclaimed once two more
+// epochs have begun, by which time the readers that could see them have
+// left.
+//
+// There are only two reader counts, so an epoch only begins once the readers
+// of the one before the current one have left. This never waits, as a reader
+// may be on a suspended guest thread; retired things are reclaimed by a later
+// call instead.
+//
+// Retire and Reclaim must be called with the writer's lock held.
+template <typename T>
+class EpochReclaimer {
+ public:
+  uint32_t BeginRead() {
+    while (true) {
+      uint32_t epoch = epoch_;
+      read_counts_[epoch & 1]++;
+      // Counted in an epoch that already ended, the next may have begun
+      // without this reader having left.
+      if (epoch_ == epoch) {
+        return epoch;
+      }
+      read_counts_[epoch & 1]--;
+    }
+  }
+  void EndRead(uint32_t epoch) { read_counts_[epoch & 1]--; }
+
+  bool empty() const { return retired_.empty(); }
+
+  void Retire(T value) { retired_.push_back({epoch_, value}); }
+
+  // Passes the retired things no reader can still be using to reclaim.
+  template <typename F>
+  void Reclaim(F reclaim) {
+    if (retired_.empty()) {
+      return;
+    }
+    if (TryAdvance()) {
+      TryAdvance();
+    }
+    uint32_t epoch = epoch_;
+    auto it = std::remove_if(retired_.begin(), retired_.end(),
+                             [epoch, &reclaim](const Retired& retired) {
+                               if (epoch - retired.epoch < 2) {
+                                 return false;
+                               }
+                               reclaim(retired.value);
+                               return true;
+                             });
+    retired_.erase(it, retired_.end());
+  }
+
+  // Passes everything retired to reclaim, once no reader can be left.
+  template <typename F>
+  void ReclaimAll(F reclaim) {
+    for (auto& retired : retired_) {
+      reclaim(retired.value);
+    }
+    retired_.clear();
+  }
+
+ private:
+  struct Retired {
+    uint32_t epoch;
+    T value;
+  };
+
+  // Begins a new epoch if the readers of the one before the current one have
+  // all left, as it shares its count with the next one.
+  bool TryAdvance() {
+    uint32_t epoch = epoch_;
+    if (read_counts_[(epoch - 1) & 1]) {
+      return false;
+    }
+    epoch_ = epoch + 1;
+    return true;
+  }
+
+  std::atomic<uint32_t> epoch_ = {0};
+  std::atomic<uint32_t> read_counts_[2] = {{0}, {0}};
+  std::vector<Retired> retired_;
+};
+
+}  // namespace xe
+
+#endif  // XENIA_BASE_EPOCH_RECLAIMER_H_
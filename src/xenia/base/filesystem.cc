@@ -15,10 +15,22 @@ namespace xe {
 namespace filesystem {
 
 std::string CanonicalizePath(const std::string& original_path) {
+  std::string path(original_path);
+  CanonicalizePath(&path);
+  return path;
+}
+
+void CanonicalizePath(std::string* path_ptr) {
   char path_sep(xe::kPathSeparator);
-  std::string path(xe::fix_path_separators(original_path, path_sep));
+  std::string& path = *path_ptr;
+  xe::fix_path_separators(&path, path_sep);
 
-  std::vector<std::string::size_type> path_breaks;
+  // Separators before the current one all start parts that are kept, as
+  // those that don't are erased on the way, so the last of them is where a
+  // .. goes back to.
+  auto last_break = [&path, path_sep](std::string::size_type pos) {
+    return pos ? path.rfind(path_sep, pos - 1) : std::string::npos;
+  };
 
   std::string::size_type pos(path.find_first_of(path_sep));
   std::string::size_type pos_n(std::string::npos);
@@ -43,14 +55,13 @@ std::string CanonicalizePath(const std::string& original_path) {
         if (path[pos + 1] == '.') {
           path.erase(pos, 2);
           pos_n -= 2;
-        } else {
-          path_breaks.push_back(pos);
         }
         break;
       case 3:
         // Potential marker for parent directory.
         if (path[pos + 1] == '.' && path[pos + 2] == '.') {
-          if (path_breaks.empty()) {
+          auto last(last_break(pos));
+          if (last == std::string::npos) {
             // Ensure we don't override the device name.
             std::string::size_type loc(path.find_first_of(':'));
             auto req(pos + 3);
@@ -62,20 +73,14 @@ std::string CanonicalizePath(const std::string& original_path) {
               pos_n -= req - (loc + 1);
             }
           } else {
-            auto last(path_breaks.back());
             auto last_diff((pos + 3) - last);
             path.erase(last, last_diff);
             pos_n = last;
-            // Also remove path reference.
-            path_breaks.erase(path_breaks.end() - 1);
           }
-        } else {
-          path_breaks.push_back(pos);
         }
         break;
 
       default:
-        path_breaks.push_back(pos);
         break;
     }
 
@@ -90,10 +95,8 @@ std::string CanonicalizePath(const std::string& original_path) {
   // Final sanity check for dead paths.
   if ((path.size() == 1 && (path[0] == '.' || path[0] == path_sep)) ||
       (path.size() == 2 && path[0] == '.' && path[1] == '.')) {
-    return "";
+    path.clear();
   }
-
-  return path;
 }
 
 bool CreateParentFolder(const std::wstring& path) {
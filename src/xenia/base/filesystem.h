@@ -22,6 +22,8 @@ namespace filesystem {
 
 // Canonicalizes a path, removing ..'s.
 std::string CanonicalizePath(const std::string& original_path);
+// Canonicalizes a path in place, without allocating.
+void CanonicalizePath(std::string* path);
 
 // Returns true of the specified path exists as either a directory or file.
 bool PathExists(const std::wstring& path);
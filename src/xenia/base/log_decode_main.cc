@@ -0,0 +1,139 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2016 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#include <gflags/gflags.h>
+
+#include <cinttypes>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "xenia/base/binary_log.h"
+#include "xenia/base/filesystem.h"
+#include "xenia/base/logging.h"
+#include "xenia/base/main.h"
+
+namespace xe {
+namespace binary_log {
+
+template <typename T>
+bool ReadValue(FILE* file, T* out_value) {
+  return std::fread(out_value, sizeof(*out_value), 1, file) == 1;
+}
+
+bool ReadBytes(FILE* file, uint32_t length, std::vector<uint8_t>* out_data) {
+  out_data->resize(length);
+  return !length || std::fread(out_data->data(), length, 1, file) == 1;
+}
+
+void WriteLine(FILE* file, char level_char, uint32_t thread_id,
+               const char* line, size_t length) {
+  std::fprintf(file, "%c> %08" PRIX32 " ", level_char, thread_id);
+  std::fwrite(line, 1, length, file);
+  if (!length || line[length - 1] != '\n') {
+    std::fputc('\n', file);
+  }
+}
+
+// Formats a log written with --log_binary into the text log it stands for.
+// A log cut short, as by a crash, is decoded up to the last whole record.
+int log_decode_main(const std::vector<std::wstring>& args) {
+  if (args.size() < 2) {
+    XELOGE("Usage: xenia-base-log-decode <log.xlog> [log.txt]");
+    return 1;
+  }
+  FILE* input = xe::filesystem::OpenFile(args[1], "rb");
+  if (!input) {
+    XELOGE("Binary log could not be opened");
+    return 1;
+  }
+  FILE* output = stdout;
+  if (args.size() >= 3) {
+    output = xe::filesystem::OpenFile(args[2], "wt");
+    if (!output) {
+      XELOGE("Output could not be created");
+      std::fclose(input);
+      return 1;
+    }
+  }
+
+  char magic[sizeof(kMagic)];
+  uint32_t version = 0;
+  if (std::fread(magic, sizeof(magic), 1, input) != 1 ||
+      std::memcmp(magic, kMagic, sizeof(magic)) ||
+      !ReadValue(input, &version) || version != kVersion) {
+    XELOGE("Not a binary log of version %u", kVersion);
+    std::fclose(input);
+    return 1;
+  }
+
+  std::unordered_map<uint64_t, std::string> formats;
+  std::vector<uint8_t> data;
+  std::string line;
+  uint64_t undecodable_count = 0;
+  RecordType type;
+  while (ReadValue(input, &type)) {
+    uint64_t format_id = 0;
+    uint32_t thread_id;
+    char level_char;
+    uint32_t length;
+    if (type == kFormat) {
+      if (!ReadValue(input, &format_id) || !ReadValue(input, &length) ||
+          !ReadBytes(input, length, &data)) {
+        break;
+      }
+      formats[format_id].assign(data.begin(), data.end());
+      continue;
+    } else if (type == kLine) {
+      if (!ReadValue(input, &format_id)) {
+        break;
+      }
+    } else if (type != kText) {
+      XELOGE("Unknown record type %u, the log is damaged", type);
+      break;
+    }
+    if (!ReadValue(input, &thread_id) || !ReadValue(input, &level_char) ||
+        !ReadValue(input, &length) || !ReadBytes(input, length, &data)) {
+      break;
+    }
+
+    if (type == kText) {
+      WriteLine(output, level_char, thread_id,
+                reinterpret_cast<const char*>(data.data()), data.size());
+      continue;
+    }
+    auto it = formats.find(format_id);
+    if (it == formats.end() ||
+        !FormatArguments(it->second.c_str(), data.data(), data.size(),
+                         &line)) {
+      // Written as the bare format, so the line still shows where it was.
+      ++undecodable_count;
+      line = it != formats.end() ? it->second : "<unknown format>";
+    }
+    WriteLine(output, level_char, thread_id, line.data(), line.size());
+  }
+
+  if (undecodable_count) {
+    XELOGW("%" PRIu64 " lines didn't match their format", undecodable_count);
+  }
+  std::fclose(input);
+  if (output != stdout) {
+    std::fclose(output);
+  }
+  return 0;
+}
+
+}  // namespace binary_log
+}  // namespace xe
+
+DEFINE_ENTRY_POINT(L"xenia-base-log-decode",
+                   L"xenia-base-log-decode <log.xlog> [log.txt]",
+                   xe::binary_log::log_decode_main);
@@ -11,16 +11,20 @@
 
 #include <gflags/gflags.h>
 
+#include <algorithm>
 #include <atomic>
 #include <cinttypes>
 #include <cstdarg>
+#include <cstring>
+#include <memory>
 #include <mutex>
+#include <unordered_set>
 #include <vector>
 
+#include "xenia/base/binary_log.h"
 #include "xenia/base/filesystem.h"
 #include "xenia/base/main.h"
 #include "xenia/base/math.h"
-#include "xenia/base/ring_buffer.h"
 #include "xenia/base/threading.h"
 
 // For MessageBox:
@@ -32,6 +36,16 @@
 DEFINE_string(log_file, "",
               "Logs are written to the given file instead of the default.");
 DEFINE_bool(flush_log, true, "Flush log file after each log line batch.");
+DEFINE_bool(log_binary, false,
+            "Writes the formats and raw arguments of lines instead of "
+            "formatting them on the logging thread. Binary logs are read "
+            "with xenia-base-log-decode.");
+DEFINE_int32(log_thread_buffer_kb, 1024,
+             "Size of the buffer of each thread the log writer drains, in "
+             "KiB.");
+DEFINE_bool(log_drop_when_full, false,
+            "Drops lines logged while the buffer of the thread is full, so "
+            "logging never waits for the writer.");
 
 namespace xe {
 
@@ -39,18 +53,27 @@ class Logger;
 
 Logger* logger_ = nullptr;
 thread_local std::vector<char> log_format_buffer_(64 * 1024);
+thread_local std::vector<uint8_t> log_argument_buffer_;
 
+// Every thread logs into a buffer of its own, which only the writer thread
+// reads from, so logging takes no locks. Lines carry a sequence number to
+// be written in the order they were logged in across threads.
 class Logger {
  public:
   explicit Logger(const std::wstring& app_name)
-      : ring_buffer_(buffer_, kBufferSize), running_(true) {
+      : binary_(FLAGS_log_binary), running_(true) {
+    const char* mode = binary_ ? "wb" : "wt";
     if (!FLAGS_log_file.empty()) {
       auto file_path = xe::to_wstring(FLAGS_log_file.c_str());
       xe::filesystem::CreateParentFolder(file_path);
-      file_ = xe::filesystem::OpenFile(file_path, "wt");
+      file_ = xe::filesystem::OpenFile(file_path, mode);
     } else {
-      auto file_path = app_name + L".log";
-      file_ = xe::filesystem::OpenFile(file_path, "wt");
+      auto file_path = app_name + (binary_ ? L".xlog" : L".log");
+      file_ = xe::filesystem::OpenFile(file_path, mode);
+    }
+    if (binary_) {
+      fwrite(binary_log::kMagic, 1, sizeof(binary_log::kMagic), file_);
+      WriteValue(binary_log::kVersion);
     }
 
     flush_event_ = xe::threading::Event::CreateAutoResetEvent(false);
@@ -67,106 +90,291 @@ class Logger {
     fclose(file_);
   }
 
-  void AppendLine(uint32_t thread_id, const char level_char, const char* buffer,
-                  size_t buffer_length) {
-    LogLine line;
+  bool is_binary() const { return binary_; }
+
+  // Appends the line, or in binary logs the encoded arguments of the format
+  // if there is one.
+  void AppendLine(uint32_t thread_id, const char level_char,
+                  const void* buffer, size_t buffer_length,
+                  const char* format = nullptr) {
+    auto thread_buffer = GetThreadBuffer();
+    LineHeader line;
+    line.format = format;
     line.thread_id = thread_id;
+    line.length = uint32_t(
+        std::min(buffer_length, thread_buffer->size() - sizeof(line)));
     line.level_char = level_char;
-    line.buffer_length = buffer_length;
-    while (true) {
-      mutex_.lock();
-      if (ring_buffer_.write_count() < sizeof(line) + buffer_length) {
-        // Buffer is full. Stall.
-        mutex_.unlock();
-        xe::threading::MaybeYield();
-        continue;
+    line.sequence = next_sequence_++;
+    while (!thread_buffer->Write(line, buffer)) {
+      if (FLAGS_log_drop_when_full) {
+        ++thread_buffer->dropped_count;
+        return;
       }
-      ring_buffer_.Write(&line, sizeof(LogLine));
-      ring_buffer_.Write(buffer, buffer_length);
-      mutex_.unlock();
-      break;
+      // Buffer is full. Stall until the writer makes room.
+      WakeWriter();
+      xe::threading::MaybeYield();
     }
-    flush_event_->Set();
+    WakeWriter();
   }
 
  private:
-  static const size_t kBufferSize = 32 * 1024 * 1024;
-
-  struct LogLine {
+  struct LineHeader {
+    uint64_t sequence;
+    // The format the arguments were encoded for, or null for text.
+    const char* format;
     uint32_t thread_id;
+    uint32_t length;
     char level_char;
-    size_t buffer_length;
   };
 
+  // Lines are written only by the thread owning the buffer, and read only
+  // by the writer thread.
+  class ThreadBuffer {
+   public:
+    ThreadBuffer(size_t size, uint32_t thread_id)
+        : thread_id(thread_id), data_(size) {}
+
+    size_t size() const { return data_.size(); }
+    bool empty() const { return write_offset_ == read_offset_; }
+
+    // Returns false if there isn't room for the line.
+    bool Write(const LineHeader& line, const void* buffer) {
+      uint64_t write_offset = write_offset_.load(std::memory_order_relaxed);
+      uint64_t used =
+          write_offset - read_offset_.load(std::memory_order_acquire);
+      if (data_.size() - used < sizeof(line) + line.length) {
+        return false;
+      }
+      CopyIn(write_offset, &line, sizeof(line));
+      CopyIn(write_offset + sizeof(line), buffer, line.length);
+      write_offset_ = write_offset + sizeof(line) + line.length;
+      return true;
+    }
+
+    // Returns false if there is no line to read.
+    bool Peek(LineHeader* out_line) const {
+      uint64_t read_offset = read_offset_.load(std::memory_order_relaxed);
+      if (write_offset_ == read_offset) {
+        return false;
+      }
+      CopyOut(read_offset, out_line, sizeof(*out_line));
+      return true;
+    }
+
+    // Reads the data of the line returned by Peek, and drops the line.
+    void Read(const LineHeader& line, std::vector<uint8_t>* out_data) {
+      uint64_t read_offset = read_offset_.load(std::memory_order_relaxed);
+      out_data->resize(line.length);
+      CopyOut(read_offset + sizeof(line), out_data->data(), line.length);
+      read_offset_.store(read_offset + sizeof(line) + line.length,
+                         std::memory_order_release);
+    }
+
+    const uint32_t thread_id;
+    std::atomic<bool> exited = {false};
+    std::atomic<uint64_t> dropped_count = {0};
+
+   private:
+    void CopyIn(uint64_t offset, const void* src, size_t length) {
+      size_t start = size_t(offset % data_.size());
+      size_t first_length = std::min(length, data_.size() - start);
+      std::memcpy(data_.data() + start, src, first_length);
+      std::memcpy(data_.data(),
+                  static_cast<const uint8_t*>(src) + first_length,
+                  length - first_length);
+    }
+    void CopyOut(uint64_t offset, void* dest, size_t length) const {
+      size_t start = size_t(offset % data_.size());
+      size_t first_length = std::min(length, data_.size() - start);
+      std::memcpy(dest, data_.data() + start, first_length);
+      std::memcpy(static_cast<uint8_t*>(dest) + first_length, data_.data(),
+                  length - first_length);
+    }
+
+    std::vector<uint8_t> data_;
+    // Total bytes ever written and read.
+    std::atomic<uint64_t> write_offset_ = {0};
+    std::atomic<uint64_t> read_offset_ = {0};
+  };
+
+  // Marks the buffer of the thread as exited, so the writer frees it once
+  // it has been drained.
+  struct ThreadBufferRef {
+    ~ThreadBufferRef() {
+      if (buffer) {
+        buffer->exited = true;
+      }
+    }
+    std::shared_ptr<ThreadBuffer> buffer;
+  };
+  static thread_local ThreadBufferRef thread_buffer_;
+
+  ThreadBuffer* GetThreadBuffer() {
+    if (!thread_buffer_.buffer) {
+      size_t size = size_t(std::max(FLAGS_log_thread_buffer_kb, 64)) * 1024;
+      auto buffer = std::make_shared<ThreadBuffer>(
+          size, xe::threading::current_thread_id());
+      std::lock_guard<std::mutex> lock(buffers_mutex_);
+      buffers_.push_back(buffer);
+      thread_buffer_.buffer = std::move(buffer);
+    }
+    return thread_buffer_.buffer.get();
+  }
+
+  void WakeWriter() {
+    // The writer sets this before checking the buffers a last time, so
+    // either it sees the line or the line sees it asleep.
+    if (writer_sleeping_ && writer_sleeping_.exchange(false)) {
+      flush_event_->Set();
+    }
+  }
+
+  template <typename T>
+  void WriteValue(T value) {
+    fwrite(&value, sizeof(value), 1, file_);
+  }
+
+  void WriteLine(const LineHeader& line, const std::vector<uint8_t>& data) {
+    if (binary_) {
+      if (line.format) {
+        auto format_id = uint64_t(reinterpret_cast<uintptr_t>(line.format));
+        if (written_formats_.insert(line.format).second) {
+          uint32_t format_length = uint32_t(std::strlen(line.format));
+          WriteValue(binary_log::kFormat);
+          WriteValue(format_id);
+          WriteValue(format_length);
+          fwrite(line.format, 1, format_length, file_);
+        }
+        WriteValue(binary_log::kLine);
+        WriteValue(format_id);
+      } else {
+        WriteValue(binary_log::kText);
+      }
+      WriteValue(line.thread_id);
+      WriteValue(line.level_char);
+      WriteValue(line.length);
+      fwrite(data.data(), 1, data.size(), file_);
+      return;
+    }
+
+    // Write out the line prefix.
+    char prefix[] = {
+        line.level_char,
+        '>',
+        ' ',
+        '0',  // Thread ID gets placed here (8 chars).
+        '0',
+        '0',
+        '0',
+        '0',
+        '0',
+        '0',
+        '0',
+        ' ',
+        0,
+    };
+    std::snprintf(prefix + 3, sizeof(prefix) - 3, "%08" PRIX32 " ",
+                  line.thread_id);
+    fwrite(prefix, 1, sizeof(prefix) - 1, file_);
+    fwrite(data.data(), 1, data.size(), file_);
+    // Always ensure there is a newline.
+    if (data.empty() || data.back() != '\n') {
+      const char suffix[1] = {'\n'};
+      fwrite(suffix, 1, sizeof(suffix), file_);
+    }
+  }
+
+  // Returns whether any buffer has lines, dropping the drained buffers of
+  // exited threads.
+  bool HasPendingLines() {
+    std::lock_guard<std::mutex> lock(buffers_mutex_);
+    bool pending = false;
+    for (auto it = buffers_.begin(); it != buffers_.end();) {
+      if (!(*it)->empty()) {
+        pending = true;
+      } else if ((*it)->exited && !(*it)->dropped_count) {
+        it = buffers_.erase(it);
+        continue;
+      }
+      ++it;
+    }
+    return pending;
+  }
+
   void WriteThread() {
-    while (running_) {
-      mutex_.lock();
+    std::vector<std::shared_ptr<ThreadBuffer>> buffers;
+    std::vector<uint8_t> data;
+    while (true) {
+      bool running = running_;
+      {
+        std::lock_guard<std::mutex> lock(buffers_mutex_);
+        buffers = buffers_;
+      }
       bool did_write = false;
-      while (!ring_buffer_.empty()) {
-        did_write = true;
-
-        // Read line header and write out the line prefix.
-        LogLine line;
-        ring_buffer_.Read(&line, sizeof(line));
-        char prefix[] = {
-            line.level_char,
-            '>',
-            ' ',
-            '0',  // Thread ID gets placed here (8 chars).
-            '0',
-            '0',
-            '0',
-            '0',
-            '0',
-            '0',
-            '0',
-            ' ',
-            0,
-        };
-        std::snprintf(prefix + 3, sizeof(prefix) - 3, "%08" PRIX32 " ",
-                      line.thread_id);
-        fwrite(prefix, 1, sizeof(prefix) - 1, file_);
-        if (line.buffer_length) {
-          // Get access to the line data - which may be split in the ring buffer
-          // - and write it out in parts.
-          auto line_range = ring_buffer_.BeginRead(line.buffer_length);
-          fwrite(line_range.first, 1, line_range.first_length, file_);
-          if (line_range.second_length) {
-            fwrite(line_range.second, 1, line_range.second_length, file_);
+      while (true) {
+        ThreadBuffer* next_buffer = nullptr;
+        LineHeader next_line;
+        for (auto& buffer : buffers) {
+          LineHeader line;
+          if (buffer->Peek(&line) &&
+              (!next_buffer || line.sequence < next_line.sequence)) {
+            next_buffer = buffer.get();
+            next_line = line;
           }
-          // Always ensure there is a newline.
-          char last_char = line_range.second
-                               ? line_range.second[line_range.second_length - 1]
-                               : line_range.first[line_range.first_length - 1];
-          if (last_char != '\n') {
-            const char suffix[1] = {'\n'};
-            fwrite(suffix, 1, sizeof(suffix), file_);
-          }
-          ring_buffer_.EndRead(std::move(line_range));
-        } else {
-          const char suffix[1] = {'\n'};
-          fwrite(suffix, 1, sizeof(suffix), file_);
+        }
+        if (!next_buffer) {
+          break;
+        }
+        next_buffer->Read(next_line, &data);
+        WriteLine(next_line, data);
+        did_write = true;
+      }
+      for (auto& buffer : buffers) {
+        uint64_t dropped_count = buffer->dropped_count.exchange(0);
+        if (dropped_count) {
+          auto text = "Dropped " + std::to_string(dropped_count) +
+                      " lines logged while the buffer was full";
+          LineHeader line = {0, nullptr, buffer->thread_id,
+                             uint32_t(text.size()), 'w'};
+          data.assign(text.begin(), text.end());
+          WriteLine(line, data);
+          did_write = true;
         }
       }
-      mutex_.unlock();
+      buffers.clear();
       if (did_write) {
         if (FLAGS_flush_log) {
           fflush(file_);
         }
       }
+      if (!running) {
+        break;
+      }
+      writer_sleeping_ = true;
+      if (HasPendingLines()) {
+        writer_sleeping_ = false;
+        continue;
+      }
       xe::threading::Wait(flush_event_.get(), true);
+      writer_sleeping_ = false;
     }
   }
 
   FILE* file_ = nullptr;
-  uint8_t buffer_[kBufferSize];
-  RingBuffer ring_buffer_;
-  std::mutex mutex_;
+  bool binary_ = false;
   std::atomic<bool> running_;
+  std::atomic<uint64_t> next_sequence_ = {0};
+  std::mutex buffers_mutex_;
+  std::vector<std::shared_ptr<ThreadBuffer>> buffers_;
+  std::atomic<bool> writer_sleeping_ = {false};
   std::unique_ptr<xe::threading::Event> flush_event_;
   std::unique_ptr<xe::threading::Thread> write_thread_;
+  // Only used on the writer thread.
+  std::unordered_set<const char*> written_formats_;
 };
 
+thread_local Logger::ThreadBufferRef Logger::thread_buffer_;
+
 void InitializeLogging(const std::wstring& app_name) {
   // We leak this intentionally - lots of cleanup code needs it.
   logger_ = new Logger(app_name);
@@ -175,12 +383,24 @@ void InitializeLogging(const std::wstring& app_name) {
 void LogLineFormat(const char level_char, const char* fmt, ...) {
   va_list args;
   va_start(args, fmt);
-  size_t chars_written = vsnprintf(log_format_buffer_.data(),
-                                   log_format_buffer_.capacity(), fmt, args);
+  if (logger_->is_binary()) {
+    // Formatted when the log is decoded.
+    log_argument_buffer_.clear();
+    binary_log::EncodeArguments(fmt, args, &log_argument_buffer_);
+    va_end(args);
+    logger_->AppendLine(xe::threading::current_thread_id(), level_char,
+                        log_argument_buffer_.data(),
+                        log_argument_buffer_.size(), fmt);
+    return;
+  }
+  int chars_written = vsnprintf(log_format_buffer_.data(),
+                                log_format_buffer_.capacity(), fmt, args);
   va_end(args);
-  if (chars_written != std::string::npos) {
+  if (chars_written >= 0) {
     logger_->AppendLine(xe::threading::current_thread_id(), level_char,
-                        log_format_buffer_.data(), chars_written);
+                        log_format_buffer_.data(),
+                        std::min(size_t(chars_written),
+                                 log_format_buffer_.capacity() - 1));
   } else {
     logger_->AppendLine(xe::threading::current_thread_id(), level_char, fmt,
                         std::strlen(fmt));
@@ -188,10 +408,13 @@ void LogLineFormat(const char level_char, const char* fmt, ...) {
 }
 
 void LogLineVarargs(const char level_char, const char* fmt, va_list args) {
-  size_t chars_written = vsnprintf(log_format_buffer_.data(),
-                                   log_format_buffer_.capacity(), fmt, args);
-  logger_->AppendLine(xe::threading::current_thread_id(), level_char,
-                      log_format_buffer_.data(), chars_written);
+  int chars_written = vsnprintf(log_format_buffer_.data(),
+                                log_format_buffer_.capacity(), fmt, args);
+  logger_->AppendLine(
+      xe::threading::current_thread_id(), level_char,
+      log_format_buffer_.data(),
+      std::min(size_t(std::max(chars_written, 0)),
+               log_format_buffer_.capacity() - 1));
 }
 
 void LogLine(const char level_char, const char* str, size_t str_length) {
@@ -43,6 +43,10 @@ class MappedMemory {
   virtual void Close(uint64_t truncate_size = 0) {}
   virtual void Flush() {}
 
+  // Hints the host to read the pages of the range from the file in the
+  // background, so accessing them later doesn't have to wait for the disk.
+  void Prefetch(size_t offset, size_t length);
+
   // Changes the offset inside the file. This will update data() and size()!
   virtual bool Remap(size_t offset, size_t length) { return false; }
 
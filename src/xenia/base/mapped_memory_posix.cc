@@ -10,6 +10,8 @@
 #include "xenia/base/mapped_memory.h"
 
 #include <sys/mman.h>
+#include <unistd.h>
+#include <algorithm>
 #include <cstdio>
 
 #include "xenia/base/string.h"
@@ -74,4 +76,15 @@ std::unique_ptr<MappedMemory> MappedMemory::Open(const std::wstring& path,
   return std::move(mm);
 }
 
+void MappedMemory::Prefetch(size_t offset, size_t length) {
+  if (offset >= size_ || !length) {
+    return;
+  }
+  length = std::min(length, size_ - offset);
+  static const uintptr_t page_size = uintptr_t(sysconf(_SC_PAGESIZE));
+  uintptr_t start = uintptr_t(data() + offset) & ~(page_size - 1);
+  uintptr_t end = uintptr_t(data() + offset + length);
+  madvise(reinterpret_cast<void*>(start), end - start, MADV_WILLNEED);
+}
+
 }  // namespace xe
@@ -9,6 +9,7 @@
 
 #include "xenia/base/mapped_memory.h"
 
+#include <algorithm>
 #include <memory>
 #include <mutex>
 #include <vector>
@@ -155,6 +156,30 @@ std::unique_ptr<MappedMemory> MappedMemory::Open(const std::wstring& path,
   return std::move(mm);
 }
 
+void MappedMemory::Prefetch(size_t offset, size_t length) {
+  if (offset >= size_ || !length) {
+    return;
+  }
+  // PrefetchVirtualMemory is only available on Windows 8 and later.
+  struct MemoryRangeEntry {
+    PVOID VirtualAddress;
+    SIZE_T NumberOfBytes;
+  };
+  typedef BOOL(WINAPI * PrefetchVirtualMemoryFunction)(
+      HANDLE process, ULONG_PTR entry_count, MemoryRangeEntry * entries,
+      ULONG flags);
+  static const auto prefetch_virtual_memory =
+      reinterpret_cast<PrefetchVirtualMemoryFunction>(GetProcAddress(
+          GetModuleHandleW(L"kernel32.dll"), "PrefetchVirtualMemory"));
+  if (!prefetch_virtual_memory) {
+    return;
+  }
+  MemoryRangeEntry entry;
+  entry.VirtualAddress = data() + offset;
+  entry.NumberOfBytes = std::min(length, size_ - offset);
+  prefetch_virtual_memory(GetCurrentProcess(), 1, &entry, 0);
+}
+
 class Win32ChunkedMappedMemoryWriter : public ChunkedMappedMemoryWriter {
  public:
   Win32ChunkedMappedMemoryWriter(const std::wstring& path, size_t chunk_size,
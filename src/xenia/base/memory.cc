@@ -11,115 +11,384 @@
 
 #include <algorithm>
 
+#include "xenia/base/math.h"
+#include "xenia/base/platform.h"
+
+#if !XE_COMPILER_MSVC
+#include <cpuid.h>
+#endif  // !XE_COMPILER_MSVC
+
+#if XE_COMPILER_MSVC
+#define XE_TARGET_AVX2
+#define XE_TARGET_AVX512
+// AVX-512 intrinsics are only in Visual Studio 2017 and later.
+#define XE_HAS_AVX512 (_MSC_VER >= 1910)
+#else
+#define XE_TARGET_AVX2 __attribute__((target("avx2")))
+#define XE_TARGET_AVX512 __attribute__((target("avx512f,avx512bw")))
+#define XE_HAS_AVX512 1
+#endif  // XE_COMPILER_MSVC
+
 namespace xe {
 
-// TODO(benvanik): fancy AVX versions.
-// http://gnuradio.org/redmine/projects/gnuradio/repository/revisions/cb32b70b79f430456208a2cd521d028e0ece5d5b/entry/volk/kernels/volk/volk_16u_byteswap.h
-// http://gnuradio.org/redmine/projects/gnuradio/repository/revisions/f2bc76cc65ffba51a141950f98e75364e49df874/entry/volk/kernels/volk/volk_32u_byteswap.h
-// http://gnuradio.org/redmine/projects/gnuradio/repository/revisions/2c4c371885c31222362f70a1cd714415d1398021/entry/volk/kernels/volk/volk_64u_byteswap.h
+namespace {
+
+// Byte indices for pshufb rearranging the bytes of each swapped unit.
+alignas(16) const uint8_t kSwap16Mask[16] = {1, 0, 3,  2,  5,  4,  7,  6,
+                                             9, 8, 11, 10, 13, 12, 15, 14};
+alignas(16) const uint8_t kSwap32Mask[16] = {3,  2,  1,  0,  7,  6,  5,  4,
+                                             11, 10, 9,  8,  15, 14, 13, 12};
+alignas(16) const uint8_t kSwap64Mask[16] = {7,  6,  5,  4,  3,  2,  1, 0,
+                                             15, 14, 13, 12, 11, 10, 9, 8};
+alignas(16) const uint8_t kSwap16In32Mask[16] = {2,  3,  0,  1,  6,  7,
+                                                 4,  5,  10, 11, 8,  9,
+                                                 14, 15, 12, 13};
+
+// Shuffles the bytes of each 16 byte block of src into dest. The size must
+// be a multiple of the swapped unit, which the mask doesn't cross, so the
+// tail is shuffled as a partial block.
+typedef void (*SwapBytesFunction)(uint8_t* dest, const uint8_t* src,
+                                  size_t size, const uint8_t* mask);
+
+void SwapTail(uint8_t* dest, const uint8_t* src, size_t size, __m128i mask) {
+  alignas(16) uint8_t block[16];
+  std::memcpy(block, src, size);
+  __m128i output =
+      _mm_shuffle_epi8(_mm_load_si128(reinterpret_cast<__m128i*>(block)), mask);
+  _mm_store_si128(reinterpret_cast<__m128i*>(block), output);
+  std::memcpy(dest, block, size);
+}
+
+void SwapBytesSSSE3(uint8_t* dest, const uint8_t* src, size_t size,
+                    const uint8_t* mask_bytes) {
+  __m128i mask = _mm_load_si128(reinterpret_cast<const __m128i*>(mask_bytes));
+  size_t i = 0;
+  for (; i + 64 <= size; i += 64) {
+    auto input = reinterpret_cast<const __m128i*>(src + i);
+    auto output = reinterpret_cast<__m128i*>(dest + i);
+    __m128i block_0 = _mm_loadu_si128(input);
+    __m128i block_1 = _mm_loadu_si128(input + 1);
+    __m128i block_2 = _mm_loadu_si128(input + 2);
+    __m128i block_3 = _mm_loadu_si128(input + 3);
+    _mm_storeu_si128(output, _mm_shuffle_epi8(block_0, mask));
+    _mm_storeu_si128(output + 1, _mm_shuffle_epi8(block_1, mask));
+    _mm_storeu_si128(output + 2, _mm_shuffle_epi8(block_2, mask));
+    _mm_storeu_si128(output + 3, _mm_shuffle_epi8(block_3, mask));
+  }
+  for (; i + 16 <= size; i += 16) {
+    __m128i input = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(dest + i),
+                     _mm_shuffle_epi8(input, mask));
+  }
+  if (i < size) {
+    SwapTail(dest + i, src + i, size - i, mask);
+  }
+}
+
+XE_TARGET_AVX2 void SwapBytesAVX2(uint8_t* dest, const uint8_t* src,
+                                  size_t size, const uint8_t* mask_bytes) {
+  // vpshufb shuffles within each 128-bit lane.
+  __m256i mask = _mm256_broadcastsi128_si256(
+      _mm_load_si128(reinterpret_cast<const __m128i*>(mask_bytes)));
+  size_t i = 0;
+  for (; i + 64 <= size; i += 64) {
+    auto input = reinterpret_cast<const __m256i*>(src + i);
+    auto output = reinterpret_cast<__m256i*>(dest + i);
+    __m256i block_0 = _mm256_loadu_si256(input);
+    __m256i block_1 = _mm256_loadu_si256(input + 1);
+    _mm256_storeu_si256(output, _mm256_shuffle_epi8(block_0, mask));
+    _mm256_storeu_si256(output + 1, _mm256_shuffle_epi8(block_1, mask));
+  }
+  if (i + 32 <= size) {
+    __m256i input =
+        _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + i));
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(dest + i),
+                        _mm256_shuffle_epi8(input, mask));
+    i += 32;
+  }
+  // Avoids the penalty of mixing VEX and legacy SSE encodings.
+  _mm256_zeroupper();
+  SwapBytesSSSE3(dest + i, src + i, size - i, mask_bytes);
+}
+
+#if XE_HAS_AVX512
+XE_TARGET_AVX512 void SwapBytesAVX512(uint8_t* dest, const uint8_t* src,
+                                      size_t size, const uint8_t* mask_bytes) {
+  __m512i mask = _mm512_broadcast_i32x4(
+      _mm_load_si128(reinterpret_cast<const __m128i*>(mask_bytes)));
+  size_t i = 0;
+  for (; i + 128 <= size; i += 128) {
+    auto input = reinterpret_cast<const __m512i*>(src + i);
+    auto output = reinterpret_cast<__m512i*>(dest + i);
+    __m512i block_0 = _mm512_loadu_si512(input);
+    __m512i block_1 = _mm512_loadu_si512(input + 1);
+    _mm512_storeu_si512(output, _mm512_shuffle_epi8(block_0, mask));
+    _mm512_storeu_si512(output + 1, _mm512_shuffle_epi8(block_1, mask));
+  }
+  if (i + 64 <= size) {
+    __m512i input =
+        _mm512_loadu_si512(reinterpret_cast<const __m512i*>(src + i));
+    _mm512_storeu_si512(reinterpret_cast<__m512i*>(dest + i),
+                        _mm512_shuffle_epi8(input, mask));
+    i += 64;
+  }
+  _mm256_zeroupper();
+  SwapBytesSSSE3(dest + i, src + i, size - i, mask_bytes);
+}
+#endif  // XE_HAS_AVX512
+
+void QueryCpuid(uint32_t leaf, uint32_t subleaf, uint32_t registers[4]) {
+#if XE_COMPILER_MSVC
+  __cpuidex(reinterpret_cast<int*>(registers), int(leaf), int(subleaf));
+#else
+  __cpuid_count(leaf, subleaf, registers[0], registers[1], registers[2],
+                registers[3]);
+#endif  // XE_COMPILER_MSVC
+}
+
+// The instruction sets the CPU and OS support, as the OS must save the wider
+// registers on context switches.
+CopyAndSwapIsa QuerySupportedIsa() {
+  uint32_t registers[4];
+  QueryCpuid(0, 0, registers);
+  uint32_t max_leaf = registers[0];
+  QueryCpuid(1, 0, registers);
+  const uint32_t kOsxsave = 1u << 27;
+  const uint32_t kAvx = 1u << 28;
+  if (max_leaf < 7 || (registers[2] & (kOsxsave | kAvx)) != (kOsxsave | kAvx)) {
+    return CopyAndSwapIsa::kSSSE3;
+  }
+#if XE_COMPILER_MSVC
+  uint64_t xcr0 = _xgetbv(0);
+#else
+  uint32_t xcr0_low, xcr0_high;
+  __asm__("xgetbv" : "=a"(xcr0_low), "=d"(xcr0_high) : "c"(0));
+  uint64_t xcr0 = (uint64_t(xcr0_high) << 32) | xcr0_low;
+#endif  // XE_COMPILER_MSVC
+  QueryCpuid(7, 0, registers);
+  const uint32_t kAvx2 = 1u << 5;
+  const uint32_t kAvx512F = 1u << 16;
+  const uint32_t kAvx512BW = 1u << 30;
+  // XMM and YMM, then the opmask and both halves of the ZMM registers.
+  const uint64_t kYmmState = 0x6;
+  const uint64_t kZmmState = 0xE6;
+  if (XE_HAS_AVX512 && (xcr0 & kZmmState) == kZmmState &&
+      (registers[1] & (kAvx512F | kAvx512BW)) == (kAvx512F | kAvx512BW)) {
+    return CopyAndSwapIsa::kAVX512;
+  }
+  if ((xcr0 & kYmmState) == kYmmState && (registers[1] & kAvx2)) {
+    return CopyAndSwapIsa::kAVX2;
+  }
+  return CopyAndSwapIsa::kSSSE3;
+}
+
+struct SwapBytesDispatch {
+  SwapBytesDispatch() : supported_isa(QuerySupportedIsa()) {
+    Select(supported_isa);
+  }
+  void Select(CopyAndSwapIsa selected_isa) {
+    isa = selected_isa;
+    switch (isa) {
+#if XE_HAS_AVX512
+      case CopyAndSwapIsa::kAVX512:
+        function = SwapBytesAVX512;
+        break;
+#endif  // XE_HAS_AVX512
+      case CopyAndSwapIsa::kAVX2:
+        function = SwapBytesAVX2;
+        break;
+      default:
+        function = SwapBytesSSSE3;
+        break;
+    }
+  }
+  CopyAndSwapIsa supported_isa;
+  CopyAndSwapIsa isa;
+  SwapBytesFunction function;
+};
+
+// Constructed on first use, as static initializers elsewhere may copy.
+SwapBytesDispatch& swap_bytes_dispatch() {
+  static SwapBytesDispatch dispatch;
+  return dispatch;
+}
+
+void SwapBytes(void* dest, const void* src, size_t size,
+               const uint8_t* mask) {
+  swap_bytes_dispatch().function(reinterpret_cast<uint8_t*>(dest),
+                                 reinterpret_cast<const uint8_t*>(src), size,
+                                 mask);
+}
+
+}  // namespace
+
+CopyAndSwapIsa copy_and_swap_isa() { return swap_bytes_dispatch().isa; }
+
+bool set_copy_and_swap_isa(CopyAndSwapIsa isa) {
+  auto& dispatch = swap_bytes_dispatch();
+  if (isa > dispatch.supported_isa) {
+    return false;
+  }
+  dispatch.Select(isa);
+  return true;
+}
 
 void copy_128_aligned(void* dest, const void* src, size_t count) {
   std::memcpy(dest, src, count * 16);
 }
 
 void copy_and_swap_16_aligned(void* dest, const void* src, size_t count) {
-  return copy_and_swap_16_unaligned(dest, src, count);
+  SwapBytes(dest, src, count * 2, kSwap16Mask);
 }
 
-void copy_and_swap_16_unaligned(void* dest_ptr, const void* src_ptr,
-                                size_t count) {
-  auto dest = reinterpret_cast<uint16_t*>(dest_ptr);
-  auto src = reinterpret_cast<const uint16_t*>(src_ptr);
-  size_t i;
-  for (i = 0; i + 8 <= count; i += 8) {
-    __m128i input = _mm_loadu_si128(reinterpret_cast<const __m128i*>(&src[i]));
-    __m128i output =
-        _mm_or_si128(_mm_slli_epi16(input, 8), _mm_srli_epi16(input, 8));
-    _mm_storeu_si128(reinterpret_cast<__m128i*>(&dest[i]), output);
-  }
-  for (; i < count; ++i) {  // handle residual elements
-    dest[i] = byte_swap(src[i]);
-  }
+void copy_and_swap_16_unaligned(void* dest, const void* src, size_t count) {
+  SwapBytes(dest, src, count * 2, kSwap16Mask);
 }
 
 void copy_and_swap_32_aligned(void* dest, const void* src, size_t count) {
-  return copy_and_swap_32_unaligned(dest, src, count);
+  SwapBytes(dest, src, count * 4, kSwap32Mask);
 }
 
-void copy_and_swap_32_unaligned(void* dest_ptr, const void* src_ptr,
-                                size_t count) {
-  auto dest = reinterpret_cast<uint32_t*>(dest_ptr);
+void copy_and_swap_32_unaligned(void* dest, const void* src, size_t count) {
+  SwapBytes(dest, src, count * 4, kSwap32Mask);
+}
+
+void copy_and_swap_64_aligned(void* dest, const void* src, size_t count) {
+  SwapBytes(dest, src, count * 8, kSwap64Mask);
+}
+
+void copy_and_swap_64_unaligned(void* dest, const void* src, size_t count) {
+  SwapBytes(dest, src, count * 8, kSwap64Mask);
+}
+
+void copy_and_swap_16_in_32_aligned(void* dest, const void* src,
+                                    size_t count) {
+  SwapBytes(dest, src, count * 4, kSwap16In32Mask);
+}
+
+size_t count_equal_bytes(const void* a_ptr, const void* b_ptr, size_t size) {
+  auto a = reinterpret_cast<const uint8_t*>(a_ptr);
+  auto b = reinterpret_cast<const uint8_t*>(b_ptr);
+  size_t count = 0;
+  size_t i;
+  for (i = 0; i + 16 <= size; i += 16) {
+    __m128i input_a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(&a[i]));
+    __m128i input_b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(&b[i]));
+    count += bit_count(
+        uint32_t(_mm_movemask_epi8(_mm_cmpeq_epi8(input_a, input_b))));
+  }
+  for (; i < size; ++i) {  // handle residual elements
+    count += a[i] == b[i];
+  }
+  return count;
+}
+
+size_t count_equal_32(const void* src_ptr, uint32_t value, size_t count) {
   auto src = reinterpret_cast<const uint32_t*>(src_ptr);
-  __m128i byte2mask = _mm_set1_epi32(0x00FF0000);
-  __m128i byte3mask = _mm_set1_epi32(0x0000FF00);
+  __m128i values = _mm_set1_epi32(int(value));
+  size_t equal_count = 0;
   size_t i;
   for (i = 0; i + 4 <= count; i += 4) {
     __m128i input = _mm_loadu_si128(reinterpret_cast<const __m128i*>(&src[i]));
-    // Do the four shifts.
-    __m128i byte1 = _mm_slli_epi32(input, 24);
-    __m128i byte2 = _mm_slli_epi32(input, 8);
-    __m128i byte3 = _mm_srli_epi32(input, 8);
-    __m128i byte4 = _mm_srli_epi32(input, 24);
-    // OR bytes together.
-    __m128i output = _mm_or_si128(byte1, byte4);
-    byte2 = _mm_and_si128(byte2, byte2mask);
-    output = _mm_or_si128(output, byte2);
-    byte3 = _mm_and_si128(byte3, byte3mask);
-    output = _mm_or_si128(output, byte3);
-    _mm_storeu_si128(reinterpret_cast<__m128i*>(&dest[i]), output);
+    // 4 mask bits per equal value.
+    equal_count +=
+        bit_count(uint32_t(_mm_movemask_epi8(_mm_cmpeq_epi32(input, values)))) /
+        4;
   }
   for (; i < count; ++i) {  // handle residual elements
-    dest[i] = byte_swap(src[i]);
+    equal_count += src[i] == value;
   }
+  return equal_count;
 }
 
-void copy_and_swap_64_aligned(void* dest, const void* src, size_t count) {
-  return copy_and_swap_64_unaligned(dest, src, count);
-}
-
-void copy_and_swap_64_unaligned(void* dest_ptr, const void* src_ptr,
-                                size_t count) {
-  auto dest = reinterpret_cast<uint64_t*>(dest_ptr);
-  auto src = reinterpret_cast<const uint64_t*>(src_ptr);
-  __m128i byte2mask = _mm_set1_epi32(0x00FF0000);
-  __m128i byte3mask = _mm_set1_epi32(0x0000FF00);
+size_t find_first_equal_32(const void* src_ptr, uint32_t value,
+                           size_t count) {
+  auto src = reinterpret_cast<const uint32_t*>(src_ptr);
+  __m128i values = _mm_set1_epi32(int(value));
   size_t i;
-  for (i = 0; i + 2 <= count; i += 2) {
-    __m128i input = _mm_loadu_si128(reinterpret_cast<const __m128i*>(&src[i]));
-    // Do the four shifts.
-    __m128i byte1 = _mm_slli_epi32(input, 24);
-    __m128i byte2 = _mm_slli_epi32(input, 8);
-    __m128i byte3 = _mm_srli_epi32(input, 8);
-    __m128i byte4 = _mm_srli_epi32(input, 24);
-    // OR bytes together.
-    __m128i output = _mm_or_si128(byte1, byte4);
-    byte2 = _mm_and_si128(byte2, byte2mask);
-    output = _mm_or_si128(output, byte2);
-    byte3 = _mm_and_si128(byte3, byte3mask);
-    output = _mm_or_si128(output, byte3);
-    // Reorder the two words.
-    output = _mm_shuffle_epi32(output, _MM_SHUFFLE(2, 3, 0, 1));
-    _mm_storeu_si128(reinterpret_cast<__m128i*>(&dest[i]), output);
+  // 16 values are compared at once, and only searched if any matched.
+  for (i = 0; i + 16 <= count; i += 16) {
+    auto input = reinterpret_cast<const __m128i*>(&src[i]);
+    __m128i equal_0 = _mm_cmpeq_epi32(_mm_loadu_si128(input), values);
+    __m128i equal_1 = _mm_cmpeq_epi32(_mm_loadu_si128(input + 1), values);
+    __m128i equal_2 = _mm_cmpeq_epi32(_mm_loadu_si128(input + 2), values);
+    __m128i equal_3 = _mm_cmpeq_epi32(_mm_loadu_si128(input + 3), values);
+    __m128i equal_any = _mm_or_si128(_mm_or_si128(equal_0, equal_1),
+                                     _mm_or_si128(equal_2, equal_3));
+    if (!_mm_movemask_epi8(equal_any)) {
+      continue;
+    }
+    uint32_t mask = uint32_t(_mm_movemask_ps(_mm_castsi128_ps(equal_0))) |
+                    uint32_t(_mm_movemask_ps(_mm_castsi128_ps(equal_1))) << 4 |
+                    uint32_t(_mm_movemask_ps(_mm_castsi128_ps(equal_2))) << 8 |
+                    uint32_t(_mm_movemask_ps(_mm_castsi128_ps(equal_3))) << 12;
+    uint32_t index;
+    bit_scan_forward(mask, &index);
+    return i + index;
   }
   for (; i < count; ++i) {  // handle residual elements
-    dest[i] = byte_swap(src[i]);
+    if (src[i] == value) {
+      return i;
+    }
   }
+  return count;
 }
 
-void copy_and_swap_16_in_32_aligned(void* dest_ptr, const void* src_ptr,
-                                    size_t count) {
-  auto dest = reinterpret_cast<uint64_t*>(dest_ptr);
-  auto src = reinterpret_cast<const uint64_t*>(src_ptr);
+void fill_32(void* dest_ptr, uint32_t value, size_t count) {
+  auto dest = reinterpret_cast<uint32_t*>(dest_ptr);
+  __m128i values = _mm_set1_epi32(int(value));
   size_t i;
   for (i = 0; i + 4 <= count; i += 4) {
-    __m128i input = _mm_loadu_si128(reinterpret_cast<const __m128i*>(&src[i]));
-    __m128i output =
-        _mm_or_si128(_mm_slli_epi32(input, 16), _mm_srli_epi32(input, 16));
-    _mm_storeu_si128(reinterpret_cast<__m128i*>(&dest[i]), output);
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(&dest[i]), values);
   }
   for (; i < count; ++i) {  // handle residual elements
-    dest[i] = (src[i] >> 16) | (src[i] << 16);
+    dest[i] = value;
+  }
+}
+
+void copy_streaming(void* dest_ptr, const void* src_ptr, size_t size) {
+  auto dest = reinterpret_cast<uint8_t*>(dest_ptr);
+  auto src = reinterpret_cast<const uint8_t*>(src_ptr);
+  // Streaming forwards would overwrite the source of later bytes.
+  if (dest > src && dest < src + size) {
+    std::memmove(dest, src, size);
+    return;
+  }
+  // Non-temporal stores must be aligned.
+  size_t head = std::min(size, (16 - uintptr_t(dest) % 16) % 16);
+  std::memmove(dest, src, head);
+  size_t i;
+  for (i = head; i + 64 <= size; i += 64) {
+    auto input = reinterpret_cast<const __m128i*>(&src[i]);
+    auto output = reinterpret_cast<__m128i*>(&dest[i]);
+    __m128i input_0 = _mm_loadu_si128(input);
+    __m128i input_1 = _mm_loadu_si128(input + 1);
+    __m128i input_2 = _mm_loadu_si128(input + 2);
+    __m128i input_3 = _mm_loadu_si128(input + 3);
+    _mm_stream_si128(output, input_0);
+    _mm_stream_si128(output + 1, input_1);
+    _mm_stream_si128(output + 2, input_2);
+    _mm_stream_si128(output + 3, input_3);
+  }
+  _mm_sfence();
+  std::memmove(&dest[i], &src[i], size - i);
+}
+
+void fill_streaming(void* dest_ptr, uint8_t value, size_t size) {
+  auto dest = reinterpret_cast<uint8_t*>(dest_ptr);
+  size_t head = std::min(size, (16 - uintptr_t(dest) % 16) % 16);
+  std::memset(dest, value, head);
+  __m128i values = _mm_set1_epi8(char(value));
+  size_t i;
+  for (i = head; i + 64 <= size; i += 64) {
+    auto output = reinterpret_cast<__m128i*>(&dest[i]);
+    _mm_stream_si128(output, values);
+    _mm_stream_si128(output + 1, values);
+    _mm_stream_si128(output + 2, values);
+    _mm_stream_si128(output + 3, values);
   }
+  _mm_sfence();
+  std::memset(&dest[i], value, size - i);
 }
 
 }  // namespace xe
@@ -29,6 +29,14 @@ size_t page_size();
 // This is likely 64KiB.
 size_t allocation_granularity();
 
+// Returns the size of the large pages file mappings can be backed by, in
+// bytes, or 0 if the process can't lock them in memory. This is likely 2MiB.
+size_t large_page_size();
+
+// Returns the bytes of the process resident in host memory, including pages
+// shared with other processes, or 0 if unknown.
+size_t QueryResidentSize();
+
 enum class PageAccess {
   kNoAccess = 0,
   kReadOnly = 1 << 0,
@@ -97,12 +105,23 @@ void AlignedFree(T* ptr) {
 
 typedef void* FileMappingHandle;
 
+// Large page mappings are always committed, and their views, offsets and
+// lengths must be multiples of large_page_size().
 FileMappingHandle CreateFileMappingHandle(std::wstring path, size_t length,
-                                          PageAccess access, bool commit);
+                                          PageAccess access, bool commit,
+                                          bool large_pages = false);
 void CloseFileMappingHandle(FileMappingHandle handle);
 void* MapFileView(FileMappingHandle handle, void* base_address, size_t length,
-                  PageAccess access, size_t file_offset);
+                  PageAccess access, size_t file_offset,
+                  bool large_pages = false);
 bool UnmapFileView(FileMappingHandle handle, void* base_address, size_t length);
+// Maps an existing file, or returns nullptr. Only copy-on-write views can be
+// mapped from it.
+FileMappingHandle OpenFileMappingHandle(const std::wstring& path);
+// Pages of the view are shared with every other process and view mapping the
+// file, until written, when the view gets a private copy of the page.
+void* MapFileViewCopyOnWrite(FileMappingHandle handle, void* base_address,
+                             size_t length, size_t file_offset);
 
 inline size_t hash_combine(size_t seed) { return seed; }
 
@@ -123,6 +142,21 @@ inline void* low_address(void* address) {
 
 void copy_128_aligned(void* dest, const void* src, size_t count);
 
+// Instruction sets the byte swapping copies are dispatched between at
+// runtime, from the narrowest.
+enum class CopyAndSwapIsa {
+  kSSSE3,
+  kAVX2,
+  kAVX512,
+};
+// The instruction set used, which is the widest supported unless lowered.
+CopyAndSwapIsa copy_and_swap_isa();
+// Returns false if the instruction set isn't supported. For benchmarks and
+// tests, as it mustn't be changed while other threads copy.
+bool set_copy_and_swap_isa(CopyAndSwapIsa isa);
+
+// Counts are of the swapped units. The 16 in 32 copy swaps the 16-bit halves
+// of each 32-bit value.
 void copy_and_swap_16_aligned(void* dest, const void* src, size_t count);
 void copy_and_swap_16_unaligned(void* dest, const void* src, size_t count);
 void copy_and_swap_32_aligned(void* dest, const void* src, size_t count);
@@ -131,6 +165,21 @@ void copy_and_swap_64_aligned(void* dest, const void* src, size_t count);
 void copy_and_swap_64_unaligned(void* dest, const void* src, size_t count);
 void copy_and_swap_16_in_32_aligned(void* dest, const void* src, size_t count);
 
+// Returns how many of the bytes at the same offsets of both buffers are equal.
+size_t count_equal_bytes(const void* a, const void* b, size_t size);
+// Returns how many of the 32-bit values are equal to value, which is compared
+// as stored.
+size_t count_equal_32(const void* src, uint32_t value, size_t count);
+// Returns the index of the first of the 32-bit values equal to value, which
+// is compared as stored, or count if none is.
+size_t find_first_equal_32(const void* src, uint32_t value, size_t count);
+void fill_32(void* dest, uint32_t value, size_t count);
+
+// Copies or fills with non-temporal stores bypassing the caches, for
+// transfers too large to stay cached anyway. The buffers may overlap.
+void copy_streaming(void* dest, const void* src, size_t size);
+void fill_streaming(void* dest, uint8_t value, size_t size);
+
 template <typename T>
 void copy_and_swap(T* dest, const T* src, size_t count) {
   bool is_aligned = reinterpret_cast<uintptr_t>(dest) % 32 == 0 &&
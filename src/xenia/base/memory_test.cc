@@ -9,9 +9,107 @@
 
 #include "xenia/base/memory.h"
 
+#include <algorithm>
+#include <vector>
+
 #include "third_party/catch/include/catch.hpp"
 
-TEST_CASE("copy_and_swap_16_aligned", "Copy and Swap") {
-  // TODO(benvanik): tests.
-  REQUIRE(true == true);
+TEST_CASE("copy_and_swap", "Copy and Swap") {
+  std::vector<uint8_t> src(300);
+  for (size_t i = 0; i < src.size(); ++i) {
+    src[i] = uint8_t(i * 7 + 1);
+  }
+  // Swapping moves byte i of each unit to i ^ swap_mask.
+  struct Layout {
+    size_t unit_size;
+    size_t swap_mask;
+    void (*function)(void* dest, const void* src, size_t count);
+  };
+  const Layout layouts[] = {
+      {2, 1, xe::copy_and_swap_16_unaligned},
+      {4, 3, xe::copy_and_swap_32_unaligned},
+      {8, 7, xe::copy_and_swap_64_unaligned},
+      {4, 2, xe::copy_and_swap_16_in_32_aligned},
+  };
+  auto isa = xe::copy_and_swap_isa();
+  for (auto tested_isa : {xe::CopyAndSwapIsa::kSSSE3,
+                          xe::CopyAndSwapIsa::kAVX2,
+                          xe::CopyAndSwapIsa::kAVX512}) {
+    if (!xe::set_copy_and_swap_isa(tested_isa)) {
+      continue;
+    }
+    for (auto& layout : layouts) {
+      // Counts up to a few of the widest vectors and their tails, at
+      // offsets misaligning both buffers.
+      for (size_t offset = 0; offset < 8; ++offset) {
+        for (size_t count = 0; count * layout.unit_size + 8 <= 288; ++count) {
+          size_t size = count * layout.unit_size;
+          std::vector<uint8_t> dest(size + 16, 0xCD);
+          layout.function(dest.data() + 8 - offset, src.data() + offset,
+                          count);
+          bool matches = true;
+          for (size_t i = 0; i < dest.size(); ++i) {
+            size_t j = i - (8 - offset);
+            uint8_t expected = 0xCD;
+            if (i >= 8 - offset && j < size) {
+              expected = src[offset + (j ^ layout.swap_mask)];
+            }
+            matches = matches && dest[i] == expected;
+          }
+          REQUIRE(matches);
+        }
+      }
+    }
+  }
+  xe::set_copy_and_swap_isa(isa);
+}
+
+TEST_CASE("find_first_equal_32", "Search") {
+  std::vector<uint32_t> values(100, 0x11223344);
+  // Every position, in the vector loop or the residual elements.
+  for (size_t i = 0; i < values.size(); ++i) {
+    values[i] = 0xAABBCCDD;
+    REQUIRE(xe::find_first_equal_32(values.data(), 0xAABBCCDD,
+                                    values.size()) == i);
+    REQUIRE(xe::find_first_equal_32(values.data(), 0xAABBCCDD, i) == i);
+    values[i] = 0x11223344;
+  }
+  // The first of several matches.
+  values[40] = values[37] = values[90] = 0xAABBCCDD;
+  REQUIRE(xe::find_first_equal_32(values.data(), 0xAABBCCDD,
+                                  values.size()) == 37);
+  REQUIRE(xe::find_first_equal_32(values.data() + 38, 0xAABBCCDD, 62) == 2);
+}
+
+TEST_CASE("copy_streaming", "Copy") {
+  std::vector<uint8_t> src(1000);
+  for (size_t i = 0; i < src.size(); ++i) {
+    src[i] = uint8_t(i * 7);
+  }
+  // Unaligned destinations and sizes with both head and tail bytes.
+  for (size_t offset = 0; offset < 16; ++offset) {
+    std::vector<uint8_t> dest(src.size() + 16, 0xFF);
+    xe::copy_streaming(dest.data() + offset, src.data() + 1, 900 - offset);
+    REQUIRE(std::equal(src.begin() + 1, src.begin() + 901 - offset,
+                       dest.begin() + offset));
+    REQUIRE(dest[900] == 0xFF);
+  }
+  // Overlapping forwards and backwards.
+  std::vector<uint8_t> buffer(src);
+  xe::copy_streaming(buffer.data() + 3, buffer.data(), 900);
+  REQUIRE(std::equal(src.begin(), src.begin() + 900, buffer.begin() + 3));
+  buffer = src;
+  xe::copy_streaming(buffer.data(), buffer.data() + 5, 900);
+  REQUIRE(std::equal(src.begin() + 5, src.begin() + 905, buffer.begin()));
+}
+
+TEST_CASE("fill_streaming", "Fill") {
+  for (size_t offset = 0; offset < 16; ++offset) {
+    std::vector<uint8_t> dest(1000, 0xFF);
+    xe::fill_streaming(dest.data() + offset, 0x5A, 900);
+    for (size_t i = 0; i < dest.size(); ++i) {
+      bool filled = i >= offset && i < offset + 900;
+      REQUIRE(dest[i] == (filled ? 0x5A : 0xFF));
+    }
+  }
 }
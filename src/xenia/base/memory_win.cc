@@ -11,6 +11,14 @@
 
 #include "xenia/base/platform_win.h"
 
+// Included after windows.h.
+#include <psapi.h>
+
+#ifndef FILE_MAP_LARGE_PAGES
+// Only defined by the Windows 10 Creators Update SDK and later.
+#define FILE_MAP_LARGE_PAGES 0x20000000
+#endif  // FILE_MAP_LARGE_PAGES
+
 namespace xe {
 namespace memory {
 
@@ -34,6 +42,40 @@ size_t allocation_granularity() {
   return value;
 }
 
+size_t large_page_size() {
+  static size_t value = SIZE_MAX;
+  if (value == SIZE_MAX) {
+    value = 0;
+    // Large pages need the lock memory privilege, which must be enabled
+    // before it can be used.
+    HANDLE token;
+    if (OpenProcessToken(GetCurrentProcess(),
+                         TOKEN_ADJUST_PRIVILEGES | TOKEN_QUERY, &token)) {
+      TOKEN_PRIVILEGES privileges;
+      privileges.PrivilegeCount = 1;
+      privileges.Privileges[0].Attributes = SE_PRIVILEGE_ENABLED;
+      if (LookupPrivilegeValueW(nullptr, SE_LOCK_MEMORY_NAME,
+                                &privileges.Privileges[0].Luid) &&
+          AdjustTokenPrivileges(token, FALSE, &privileges, 0, nullptr,
+                                nullptr) &&
+          GetLastError() == ERROR_SUCCESS) {
+        value = GetLargePageMinimum();
+      }
+      CloseHandle(token);
+    }
+  }
+  return value;
+}
+
+size_t QueryResidentSize() {
+  PROCESS_MEMORY_COUNTERS counters;
+  if (!GetProcessMemoryInfo(GetCurrentProcess(), &counters,
+                            sizeof(counters))) {
+    return 0;
+  }
+  return counters.WorkingSetSize;
+}
+
 DWORD ToWin32ProtectFlags(PageAccess access) {
   switch (access) {
     case PageAccess::kNoAccess:
@@ -145,9 +187,14 @@ bool QueryProtect(void* base_address, size_t& length, PageAccess& access_out) {
 }
 
 FileMappingHandle CreateFileMappingHandle(std::wstring path, size_t length,
-                                          PageAccess access, bool commit) {
-  DWORD protect =
-      ToWin32ProtectFlags(access) | (commit ? SEC_COMMIT : SEC_RESERVE);
+                                          PageAccess access, bool commit,
+                                          bool large_pages) {
+  DWORD protect = ToWin32ProtectFlags(access);
+  if (large_pages) {
+    protect |= SEC_COMMIT | SEC_LARGE_PAGES;
+  } else {
+    protect |= commit ? SEC_COMMIT : SEC_RESERVE;
+  }
   return CreateFileMappingW(INVALID_HANDLE_VALUE, NULL, protect,
                             static_cast<DWORD>(length >> 32),
                             static_cast<DWORD>(length), path.c_str());
@@ -156,7 +203,7 @@ FileMappingHandle CreateFileMappingHandle(std::wstring path, size_t length,
 void CloseFileMappingHandle(FileMappingHandle handle) { CloseHandle(handle); }
 
 void* MapFileView(FileMappingHandle handle, void* base_address, size_t length,
-                  PageAccess access, size_t file_offset) {
+                  PageAccess access, size_t file_offset, bool large_pages) {
   DWORD target_address_low = static_cast<DWORD>(file_offset);
   DWORD target_address_high = static_cast<DWORD>(file_offset >> 32);
   DWORD file_access = 0;
@@ -175,10 +222,35 @@ void* MapFileView(FileMappingHandle handle, void* base_address, size_t length,
       assert_unhandled_case(access);
       return nullptr;
   }
+  if (large_pages) {
+    file_access |= FILE_MAP_LARGE_PAGES;
+  }
   return MapViewOfFileEx(handle, file_access, target_address_high,
                          target_address_low, length, base_address);
 }
 
+FileMappingHandle OpenFileMappingHandle(const std::wstring& path) {
+  HANDLE file = CreateFileW(path.c_str(), GENERIC_READ, FILE_SHARE_READ,
+                            nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL,
+                            nullptr);
+  if (file == INVALID_HANDLE_VALUE) {
+    return nullptr;
+  }
+  // The mapping keeps the file open.
+  HANDLE handle =
+      CreateFileMappingW(file, nullptr, PAGE_WRITECOPY, 0, 0, nullptr);
+  CloseHandle(file);
+  return handle;
+}
+
+void* MapFileViewCopyOnWrite(FileMappingHandle handle, void* base_address,
+                             size_t length, size_t file_offset) {
+  return MapViewOfFileEx(handle, FILE_MAP_COPY,
+                         static_cast<DWORD>(file_offset >> 32),
+                         static_cast<DWORD>(file_offset), length,
+                         base_address);
+}
+
 bool UnmapFileView(FileMappingHandle handle, void* base_address,
                    size_t length) {
   return UnmapViewOfFile(base_address) ? true : false;
@@ -9,11 +9,194 @@
 
 #include "xenia/base/mutex.h"
 
+#include <algorithm>
+#include <cinttypes>
+#include <map>
+#include <utility>
+#include <vector>
+
+#include "xenia/base/clock.h"
+#include "xenia/base/logging.h"
+#include "xenia/base/platform.h"
+
+#if XE_COMPILER_MSVC
+#include <intrin.h>
+#define XE_NOINLINE __declspec(noinline)
+#define XE_RETURN_ADDRESS() _ReturnAddress()
+#else
+#define XE_NOINLINE __attribute__((noinline))
+#define XE_RETURN_ADDRESS() __builtin_return_address(0)
+#endif  // XE_COMPILER_MSVC
+
 namespace xe {
 
-std::recursive_mutex& global_critical_region::mutex() {
-  static std::recursive_mutex global_mutex;
+namespace {
+
+struct LockProfile {
+  uint64_t acquire_count = 0;
+  uint64_t contended_count = 0;
+  uint64_t total_wait_ticks = 0;
+  uint64_t max_wait_ticks = 0;
+  uint64_t total_hold_ticks = 0;
+  uint64_t max_hold_ticks = 0;
+  // Wait ticks by the call site holding the lock when the wait began.
+  std::map<void*, uint64_t> blocking_wait_ticks;
+};
+
+// By lock name and call site. Only used with profiling enabled, so a plain
+// mutex is fine.
+std::mutex& lock_profiles_mutex() {
+  static std::mutex mutex;
+  return mutex;
+}
+std::map<std::pair<const char*, void*>, LockProfile>& lock_profiles() {
+  static std::map<std::pair<const char*, void*>, LockProfile> profiles;
+  return profiles;
+}
+
+}  // namespace
+
+profiled_mutex& global_critical_region::mutex() {
+  static profiled_mutex global_mutex("global_critical_region");
   return global_mutex;
 }
 
+XE_NOINLINE std::unique_lock<profiled_mutex>
+global_critical_region::AcquireDirect() {
+  auto& global_mutex = mutex();
+  global_mutex.lock(XE_RETURN_ADDRESS());
+  return std::unique_lock<profiled_mutex>(global_mutex, std::adopt_lock);
+}
+
+XE_NOINLINE std::unique_lock<profiled_mutex>
+global_critical_region::Acquire() {
+  auto& global_mutex = mutex();
+  global_mutex.lock(XE_RETURN_ADDRESS());
+  return std::unique_lock<profiled_mutex>(global_mutex, std::adopt_lock);
+}
+
+bool profiled_mutex::profiling_enabled_ = false;
+
+void profiled_mutex::set_profiling_enabled(bool enabled) {
+  profiling_enabled_ = enabled;
+}
+
+XE_NOINLINE std::unique_lock<profiled_mutex> profiled_mutex::Acquire() {
+  lock(XE_RETURN_ADDRESS());
+  return std::unique_lock<profiled_mutex>(*this, std::adopt_lock);
+}
+
+void profiled_mutex::lock(void* call_site) {
+  if (!profiling_enabled_) {
+    mutex_.lock();
+    ++depth_;
+    return;
+  }
+  uint64_t wait_ticks = 0;
+  bool contended = false;
+  void* blocking_call_site = nullptr;
+  if (!mutex_.try_lock()) {
+    // May be stale if the holder is just leaving, which is rare enough.
+    blocking_call_site = owner_call_site_.load(std::memory_order_relaxed);
+    uint64_t start_tick = Clock::QueryHostTickCount();
+    mutex_.lock();
+    wait_ticks = Clock::QueryHostTickCount() - start_tick;
+    contended = true;
+  }
+  if (depth_++) {
+    // Held by this thread already.
+    return;
+  }
+  call_site_ = call_site;
+  wait_ticks_ = wait_ticks;
+  contended_ = contended;
+  blocking_call_site_ = blocking_call_site;
+  owner_call_site_.store(call_site, std::memory_order_relaxed);
+  acquire_tick_ = Clock::QueryHostTickCount();
+}
+
+bool profiled_mutex::try_lock() {
+  if (!mutex_.try_lock()) {
+    return false;
+  }
+  if (!depth_++ && profiling_enabled_) {
+    call_site_ = nullptr;
+    wait_ticks_ = 0;
+    contended_ = false;
+    blocking_call_site_ = nullptr;
+    owner_call_site_.store(nullptr, std::memory_order_relaxed);
+    acquire_tick_ = Clock::QueryHostTickCount();
+  }
+  return true;
+}
+
+void profiled_mutex::unlock() {
+  if (--depth_ || !acquire_tick_) {
+    mutex_.unlock();
+    return;
+  }
+  uint64_t hold_ticks = Clock::QueryHostTickCount() - acquire_tick_;
+  void* call_site = call_site_;
+  uint64_t wait_ticks = wait_ticks_;
+  bool contended = contended_;
+  void* blocking_call_site = blocking_call_site_;
+  acquire_tick_ = 0;
+  owner_call_site_.store(nullptr, std::memory_order_relaxed);
+  mutex_.unlock();
+  RecordAcquire(name_, call_site, wait_ticks, hold_ticks, contended,
+                blocking_call_site);
+}
+
+void profiled_mutex::RecordAcquire(const char* name, void* call_site,
+                                   uint64_t wait_ticks, uint64_t hold_ticks,
+                                   bool contended, void* blocking_call_site) {
+  std::lock_guard<std::mutex> lock(lock_profiles_mutex());
+  auto& profile = lock_profiles()[std::make_pair(name, call_site)];
+  ++profile.acquire_count;
+  if (contended) {
+    ++profile.contended_count;
+    profile.blocking_wait_ticks[blocking_call_site] += wait_ticks;
+  }
+  profile.total_wait_ticks += wait_ticks;
+  profile.max_wait_ticks = std::max(profile.max_wait_ticks, wait_ticks);
+  profile.total_hold_ticks += hold_ticks;
+  profile.max_hold_ticks = std::max(profile.max_hold_ticks, hold_ticks);
+}
+
+void profiled_mutex::DumpProfile() {
+  std::vector<std::pair<std::pair<const char*, void*>, LockProfile>> profiles;
+  {
+    std::lock_guard<std::mutex> lock(lock_profiles_mutex());
+    profiles.assign(lock_profiles().begin(), lock_profiles().end());
+  }
+  if (profiles.empty()) {
+    return;
+  }
+  std::sort(profiles.begin(), profiles.end(), [](const auto& a, const auto& b) {
+    return a.second.total_wait_ticks > b.second.total_wait_ticks;
+  });
+  double ticks_to_ms = 1000.0 / Clock::host_tick_frequency();
+  XELOGI("Lock profile (wait and hold in ms, total/max):");
+  for (auto& entry : profiles) {
+    auto& profile = entry.second;
+    XELOGI("  %s at %p: %" PRIu64 " acquires, %" PRIu64
+           " contended, wait %.3f/%.3f, hold %.3f/%.3f",
+           entry.first.first, entry.first.second, profile.acquire_count,
+           profile.contended_count,
+           profile.total_wait_ticks * ticks_to_ms,
+           profile.max_wait_ticks * ticks_to_ms,
+           profile.total_hold_ticks * ticks_to_ms,
+           profile.max_hold_ticks * ticks_to_ms);
+    // The holders it waited for the longest.
+    std::vector<std::pair<void*, uint64_t>> blocking(
+        profile.blocking_wait_ticks.begin(), profile.blocking_wait_ticks.end());
+    std::sort(blocking.begin(), blocking.end(),
+              [](const auto& a, const auto& b) { return a.second > b.second; });
+    for (size_t i = 0; i < std::min(blocking.size(), size_t(3)); ++i) {
+      XELOGI("    blocked by %p: wait %.3f", blocking[i].first,
+             blocking[i].second * ticks_to_ms);
+    }
+  }
+}
+
 }  // namespace xe
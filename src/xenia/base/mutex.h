@@ -10,10 +10,67 @@
 #ifndef XENIA_BASE_MUTEX_H_
 #define XENIA_BASE_MUTEX_H_
 
+#include <atomic>
+#include <cstdint>
 #include <mutex>
 
 namespace xe {
 
+// A recursive mutex for state split off the global critical region, and the
+// mutex of the region itself. When lock profiling is enabled, the time spent
+// waiting for it and holding it is recorded by the call site of Acquire,
+// along with the call sites holding it when the waits began. Locked through
+// lock(), as by std::condition_variable_any or generated code, it counts
+// under an unknown call site. With profiling disabled it costs a branch or
+// two over the mutex.
+class profiled_mutex {
+ public:
+  explicit profiled_mutex(const char* name) : name_(name) {}
+  profiled_mutex(const profiled_mutex&) = delete;
+  profiled_mutex& operator=(const profiled_mutex&) = delete;
+
+  const char* name() const { return name_; }
+
+  std::unique_lock<profiled_mutex> Acquire();
+
+  void lock() { lock(nullptr); }
+  bool try_lock();
+  void unlock();
+
+  // Enabled before any profiled lock is taken, and never disabled.
+  static void set_profiling_enabled(bool enabled);
+  static bool is_profiling_enabled() { return profiling_enabled_; }
+  // Logs the waits and holds recorded by lock and call site, the longest
+  // total wait first.
+  static void DumpProfile();
+
+  // Records an acquisition of the lock at the call site, which waited for
+  // the holder at the blocking call site if contended.
+  static void RecordAcquire(const char* name, void* call_site,
+                            uint64_t wait_ticks, uint64_t hold_ticks,
+                            bool contended, void* blocking_call_site);
+
+ private:
+  friend class global_critical_region;
+
+  void lock(void* call_site);
+
+  static bool profiling_enabled_;
+
+  std::recursive_mutex mutex_;
+  const char* name_;
+  // Only used by the owner.
+  uint32_t depth_ = 0;
+  void* call_site_ = nullptr;
+  uint64_t acquire_tick_ = 0;
+  uint64_t wait_ticks_ = 0;
+  bool contended_ = false;
+  void* blocking_call_site_ = nullptr;
+  // Call site of the holder, read by waiters to find who blocks them. Only
+  // kept with profiling enabled.
+  std::atomic<void*> owner_call_site_ = {nullptr};
+};
+
 // The global critical region mutex singleton.
 // This must guard any operation that may suspend threads or be sensitive to
 // being suspended such as global table locks and such.
@@ -52,27 +109,26 @@ namespace xe {
 //   xe::global_critical_region global_critical_region_;
 //   std::list<...> my_list_;
 // };
+//
+// With lock profiling enabled, the region is profiled like a profiled_mutex
+// by the call site of Acquire and AcquireDirect, so they aren't inlined.
 class global_critical_region {
  public:
-  static std::recursive_mutex& mutex();
+  static profiled_mutex& mutex();
 
   // Acquires a lock on the global critical section.
   // Use this when keeping an instance is not possible. Otherwise, prefer
   // to keep an instance of global_critical_region near the members requiring
   // it to keep things readable.
-  static std::unique_lock<std::recursive_mutex> AcquireDirect() {
-    return std::unique_lock<std::recursive_mutex>(mutex());
-  }
+  static std::unique_lock<profiled_mutex> AcquireDirect();
 
   // Acquires a lock on the global critical section.
-  inline std::unique_lock<std::recursive_mutex> Acquire() {
-    return std::unique_lock<std::recursive_mutex>(mutex());
-  }
+  std::unique_lock<profiled_mutex> Acquire();
 
   // Tries to acquire a lock on the glboal critical section.
   // Check owns_lock() to see if the lock was successfully acquired.
-  inline std::unique_lock<std::recursive_mutex> TryAcquire() {
-    return std::unique_lock<std::recursive_mutex>(mutex(), std::try_to_lock);
+  inline std::unique_lock<profiled_mutex> TryAcquire() {
+    return std::unique_lock<profiled_mutex>(mutex(), std::try_to_lock);
   }
 };
 
@@ -24,3 +24,75 @@ test_suite("xenia-base-tests", project_root, ".", {
     "xenia-base",
   },
 })
+
+project("xenia-base-bit-stream-benchmark")
+  uuid("3f7d2a91-6c4e-4b8a-9e15-b2d0c8a47f63")
+  kind("ConsoleApp")
+  language("C++")
+  links({
+    "gflags",
+    "xenia-base",
+  })
+  defines({
+  })
+  includedirs({
+    project_root.."/third_party/gflags/src",
+  })
+  files({
+    "bit_stream_benchmark_main.cc",
+    "main_"..platform_suffix..".cc",
+  })
+
+project("xenia-base-copy-and-swap-benchmark")
+  uuid("a0d06b22-abcc-4139-bfc0-b8c180323316")
+  kind("ConsoleApp")
+  language("C++")
+  links({
+    "gflags",
+    "xenia-base",
+  })
+  defines({
+  })
+  includedirs({
+    project_root.."/third_party/gflags/src",
+  })
+  files({
+    "copy_and_swap_benchmark_main.cc",
+    "main_"..platform_suffix..".cc",
+  })
+
+project("xenia-base-ring-buffer-benchmark")
+  uuid("5b9e3c17-8a42-4d6f-b1e0-7c24a9f8d356")
+  kind("ConsoleApp")
+  language("C++")
+  links({
+    "gflags",
+    "xenia-base",
+  })
+  defines({
+  })
+  includedirs({
+    project_root.."/third_party/gflags/src",
+  })
+  files({
+    "ring_buffer_benchmark_main.cc",
+    "main_"..platform_suffix..".cc",
+  })
+
+project("xenia-base-log-decode")
+  uuid("c81e4b7a-2d95-4f63-a0b8-5e7d13f9c2a4")
+  kind("ConsoleApp")
+  language("C++")
+  links({
+    "gflags",
+    "xenia-base",
+  })
+  defines({
+  })
+  includedirs({
+    project_root.."/third_party/gflags/src",
+  })
+  files({
+    "log_decode_main.cc",
+    "main_"..platform_suffix..".cc",
+  })
@@ -9,7 +9,14 @@
 
 #include <gflags/gflags.h>
 
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <memory>
+#include <mutex>
 #include <string>
+#include <vector>
 
 // NOTE: this must be included before microprofile as macro expansion needs
 // XELOGI.
@@ -30,7 +37,10 @@
 #include "third_party/microprofile/microprofile.h"
 
 #include "xenia/base/assert.h"
+#include "xenia/base/concurrent_ring_buffer.h"
+#include "xenia/base/filesystem.h"
 #include "xenia/base/profiling.h"
+#include "xenia/base/threading.h"
 #include "xenia/ui/window.h"
 
 #if XE_OPTION_PROFILING
@@ -43,9 +53,18 @@
 #endif  // XE_OPTION_PROFILING_UI
 
 DEFINE_bool(show_profiler, false, "Show profiling UI by default.");
+DEFINE_string(profile_trace_path, "profile_trace.json",
+              "File profiler traces are written to.");
+DEFINE_int32(profile_trace_seconds, 5,
+             "Length of profiler traces, in seconds.");
+DEFINE_bool(profile_trace_on_start, false,
+            "Captures a profiler trace from startup, such as on hosts "
+            "without a display.");
 
 namespace xe {
 
+GpuTimestampSource* Profiler::gpu_timestamp_source_ = nullptr;
+
 #if XE_OPTION_PROFILING_UI
 ui::Window* Profiler::window_ = nullptr;
 std::unique_ptr<ui::MicroprofileDrawer> Profiler::drawer_ = nullptr;
@@ -53,6 +72,216 @@ std::unique_ptr<ui::MicroprofileDrawer> Profiler::drawer_ = nullptr;
 
 #if XE_OPTION_PROFILING
 
+namespace {
+
+// Writes the scopes of the frames the profiler has finished as Chrome trace
+// events. The frames are copied out of the per-thread logs of microprofile
+// on the flipping thread, and formatted and written on a thread of its own.
+class TraceCapture {
+ public:
+  static std::unique_ptr<TraceCapture> Create(const std::wstring& path,
+                                              int64_t duration_ticks) {
+    xe::filesystem::CreateParentFolder(path);
+    FILE* file = xe::filesystem::OpenFile(path, "wb");
+    if (!file) {
+      XELOGE("Profiler trace file could not be created");
+      return nullptr;
+    }
+    return std::unique_ptr<TraceCapture>(
+        new TraceCapture(file, duration_ticks));
+  }
+
+  ~TraceCapture() {
+    stopping_ = true;
+    wake_event_->Set();
+    xe::threading::Wait(writer_thread_.get(), false);
+    WriteMetadata();
+    std::fputs("\n]}\n", file_);
+    std::fclose(file_);
+    if (dropped_count_) {
+      XELOGW("Profiler trace dropped %u events", dropped_count_);
+    }
+  }
+
+  // Copies the frame the last flip finished. Returns false once the capture
+  // is complete.
+  bool AddFrame() {
+    auto& S = g_MicroProfile;
+    std::lock_guard<std::recursive_mutex> lock(MicroProfileMutex());
+    if (S.nFrameCurrentIndex == last_frame_index_) {
+      // Paused.
+      return true;
+    }
+    last_frame_index_ = S.nFrameCurrentIndex;
+    uint32_t frame_index = S.nFrameCurrent;
+    uint32_t next_frame_index =
+        (frame_index + 1) % MICROPROFILE_MAX_FRAME_HISTORY;
+    auto& frame = S.Frames[frame_index];
+    auto& next_frame = S.Frames[next_frame_index];
+    if (frame.nFrameStartCpu < start_tick_) {
+      // Started before the capture.
+      return true;
+    }
+    if (frame.nFrameStartCpu >= start_tick_ + duration_ticks_) {
+      return false;
+    }
+
+    double cpu_to_us = 1000000.0 / MicroProfileTicksPerSecondCpu();
+    int64_t gpu_ticks_per_second = MicroProfileTicksPerSecondGpu();
+    double gpu_to_us =
+        gpu_ticks_per_second ? 1000000.0 / gpu_ticks_per_second : 0.0;
+    double frame_start_us = (frame.nFrameStartCpu - start_tick_) * cpu_to_us;
+    for (uint32_t i = 0; i < S.nNumLogs; ++i) {
+      auto log = S.Pool[i];
+      if (!log) {
+        continue;
+      }
+      if (log->nGpu && (!gpu_to_us || frame.nFrameStartGpu == -1)) {
+        continue;
+      }
+      int64_t frame_start_tick =
+          log->nGpu ? frame.nFrameStartGpu : frame.nFrameStartCpu;
+      double to_us = log->nGpu ? gpu_to_us : cpu_to_us;
+      for (uint32_t k = frame.nLogStart[i]; k != next_frame.nLogStart[i];
+           k = (k + 1) % MICROPROFILE_BUFFER_SIZE) {
+        MicroProfileLogEntry entry = log->Log[k];
+        uint32_t type = uint32_t(MicroProfileLogType(entry));
+        if (type == MP_LOG_META) {
+          continue;
+        }
+        Event event;
+        event.thread_index = i;
+        event.type = type;
+        event.timer_index = uint32_t(MicroProfileLogTimerIndex(entry));
+        event.time_us =
+            frame_start_us +
+            MicroProfileLogTickDifference(frame_start_tick, entry) * to_us;
+        if (!events_.Push(event)) {
+          ++dropped_count_;
+        }
+      }
+      if (thread_indices_.size() <= i) {
+        thread_indices_.resize(i + 1);
+      }
+      thread_indices_[i] = true;
+    }
+    wake_event_->Set();
+    return true;
+  }
+
+ private:
+  struct Event {
+    uint32_t thread_index;
+    // MP_LOG_ENTER or MP_LOG_LEAVE.
+    uint32_t type;
+    uint32_t timer_index;
+    double time_us;
+  };
+
+  TraceCapture(FILE* file, int64_t duration_ticks)
+      : file_(file),
+        start_tick_(MP_TICK()),
+        duration_ticks_(duration_ticks),
+        last_frame_index_(g_MicroProfile.nFrameCurrentIndex),
+        events_(1 << 18) {
+    std::fputs("{\"displayTimeUnit\":\"ms\",\"traceEvents\":[", file_);
+    wake_event_ = xe::threading::Event::CreateAutoResetEvent(false);
+    writer_thread_ =
+        xe::threading::Thread::Create({}, [this]() { WriterMain(); });
+    writer_thread_->set_name("Profiler Trace Writer");
+  }
+
+  void WriterMain() {
+    while (true) {
+      bool stopping = stopping_.load();
+      Event event;
+      while (events_.Pop(&event)) {
+        WriteEvent(event);
+      }
+      if (stopping) {
+        break;
+      }
+      xe::threading::Wait(wake_event_.get(), false,
+                          std::chrono::milliseconds(100));
+    }
+  }
+
+  void WriteEvent(const Event& event) {
+    if (depths_.size() <= event.thread_index) {
+      depths_.resize(event.thread_index + 1);
+    }
+    uint32_t& depth = depths_[event.thread_index];
+    if (event.type == MP_LOG_ENTER) {
+      ++depth;
+    } else if (depth) {
+      --depth;
+    } else {
+      // Entered before the capture.
+      return;
+    }
+    auto& timer = g_MicroProfile.TimerInfo[event.timer_index];
+    std::fprintf(file_,
+                 "%s\n{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"%c\","
+                 "\"pid\":1,\"tid\":%u,\"ts\":%.3f}",
+                 first_event_ ? "" : ",", Escape(timer.pName).c_str(),
+                 Escape(g_MicroProfile.GroupInfo[timer.nGroupIndex].pName)
+                     .c_str(),
+                 event.type == MP_LOG_ENTER ? 'B' : 'E', event.thread_index,
+                 event.time_us);
+    first_event_ = false;
+  }
+
+  // Names the threads, as chrome://tracing only shows their indices.
+  void WriteMetadata() {
+    std::lock_guard<std::recursive_mutex> lock(MicroProfileMutex());
+    for (uint32_t i = 0; i < thread_indices_.size(); ++i) {
+      auto log = g_MicroProfile.Pool[i];
+      if (!thread_indices_[i] || !log) {
+        continue;
+      }
+      std::fprintf(file_,
+                   "%s\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,"
+                   "\"tid\":%u,\"args\":{\"name\":\"%s\"}}",
+                   first_event_ ? "" : ",", i,
+                   log->nGpu ? "GPU" : Escape(log->ThreadName).c_str());
+      first_event_ = false;
+    }
+  }
+
+  static std::string Escape(const char* value) {
+    std::string escaped;
+    for (; *value; ++value) {
+      if (*value == '"' || *value == '\\') {
+        escaped += '\\';
+      }
+      escaped += *value;
+    }
+    return escaped;
+  }
+
+  FILE* file_;
+  int64_t start_tick_;
+  int64_t duration_ticks_;
+  // Used by the flipping thread only.
+  uint32_t last_frame_index_;
+  std::vector<bool> thread_indices_;
+  uint32_t dropped_count_ = 0;
+
+  xe::SpscRingBuffer<Event> events_;
+  std::unique_ptr<xe::threading::Event> wake_event_;
+  std::unique_ptr<xe::threading::Thread> writer_thread_;
+  std::atomic<bool> stopping_ = {false};
+
+  // Used by the writer thread only.
+  std::vector<uint32_t> depths_;
+  bool first_event_ = true;
+};
+
+std::mutex trace_capture_mutex_;
+std::unique_ptr<TraceCapture> trace_capture_;
+
+}  // namespace
+
 bool Profiler::is_enabled() { return true; }
 
 bool Profiler::is_visible() { return is_enabled() && MicroProfileIsDrawing(); }
@@ -85,6 +314,10 @@ void Profiler::Initialize() {
   MicroProfileSetEnableAllGroups(true);
   MicroProfileSetForceMetaCounters(false);
 #endif  // XE_OPTION_PROFILING_UI
+
+  if (FLAGS_profile_trace_on_start) {
+    CaptureTrace();
+  }
 }
 
 void Profiler::Dump() {
@@ -96,6 +329,10 @@ void Profiler::Dump() {
 }
 
 void Profiler::Shutdown() {
+  {
+    std::lock_guard<std::mutex> lock(trace_capture_mutex_);
+    trace_capture_.reset();
+  }
   drawer_.reset();
   window_ = nullptr;
   MicroProfileShutdown();
@@ -246,7 +483,34 @@ void Profiler::Present() {
 #endif  // XE_OPTION_PROFILING_UI
 }
 
-void Profiler::Flip() { MicroProfileFlip(); }
+void Profiler::Flip() {
+  MicroProfileFlip();
+  std::lock_guard<std::mutex> lock(trace_capture_mutex_);
+  if (trace_capture_ && !trace_capture_->AddFrame()) {
+    trace_capture_.reset();
+    XELOGI("Profiler trace written to %s", FLAGS_profile_trace_path.c_str());
+  }
+}
+
+void Profiler::CaptureTrace() {
+  std::lock_guard<std::mutex> lock(trace_capture_mutex_);
+  if (trace_capture_) {
+    return;
+  }
+  trace_capture_ = TraceCapture::Create(
+      xe::to_wstring(FLAGS_profile_trace_path),
+      std::max(FLAGS_profile_trace_seconds, 1) *
+          MicroProfileTicksPerSecondCpu());
+  if (trace_capture_) {
+    XELOGI("Capturing a profiler trace for %d seconds",
+           FLAGS_profile_trace_seconds);
+  }
+}
+
+bool Profiler::is_capturing_trace() {
+  std::lock_guard<std::mutex> lock(trace_capture_mutex_);
+  return trace_capture_ != nullptr;
+}
 
 #else
 
@@ -268,16 +532,30 @@ void Profiler::ToggleDisplay() {}
 void Profiler::TogglePause() {}
 void Profiler::set_window(ui::Window* window) {}
 void Profiler::Present() {}
+void Profiler::Flip() {}
+void Profiler::CaptureTrace() {
+  XELOGW("Profiler traces aren't supported on this platform");
+}
+bool Profiler::is_capturing_trace() { return false; }
 
 #endif  // XE_OPTION_PROFILING
 
 }  // namespace xe
 
-uint32_t MicroProfileGpuInsertTimeStamp() { return 0; }
+uint32_t MicroProfileGpuInsertTimeStamp() {
+  auto source = xe::Profiler::gpu_timestamp_source();
+  return source ? source->InsertTimestamp() : 0;
+}
 
-uint64_t MicroProfileGpuGetTimeStamp(uint32_t nKey) { return 0; }
+uint64_t MicroProfileGpuGetTimeStamp(uint32_t nKey) {
+  auto source = xe::Profiler::gpu_timestamp_source();
+  return source ? source->GetTimestamp(nKey) : 0;
+}
 
-uint64_t MicroProfileTicksPerSecondGpu() { return 0; }
+uint64_t MicroProfileTicksPerSecondGpu() {
+  auto source = xe::Profiler::gpu_timestamp_source();
+  return source ? source->ticks_per_second() : 0;
+}
 
 const char* MicroProfileGetThreadName() { return "TODO: get thread name!"; }
 
@@ -88,6 +88,14 @@ namespace xe {
   MICROPROFILE_SCOPEGPUI(group_name, __FUNCTION__, \
                          xe::Profiler::GetColor(__FUNCTION__))
 
+// Enters a previously defined GPU profiling scope for work that doesn't
+// match a block, returning what LEAVE_profile_gpu takes to leave it.
+#define ENTER_profile_gpu(name) MicroProfileGpuEnter(g_mp_##name)
+
+// Leaves a GPU profiling scope entered with ENTER_profile_gpu.
+#define LEAVE_profile_gpu(name, enter_tick) \
+  MicroProfileGpuLeave(g_mp_##name, enter_tick)
+
 // Tracks a CPU value counter.
 #define COUNT_profile_cpu(name, count) MICROPROFILE_META_CPU(name, count)
 
@@ -118,6 +126,10 @@ namespace xe {
 #define SCOPE_profile_gpu_i(group_name, scope_name) \
   do {                                              \
   } while (false)
+#define ENTER_profile_gpu(name) uint64_t(0)
+#define LEAVE_profile_gpu(name, enter_tick) \
+  do {                                      \
+  } while (false)
 #define COUNT_profile_cpu(name, count) \
   do {                                 \
   } while (false)
@@ -132,6 +144,19 @@ namespace xe {
 
 #endif  // XE_OPTION_PROFILING
 
+// Supplies the timestamps of GPU profiling scopes. They are inserted into the
+// work being recorded on the thread flipping the profiler and looked up a few
+// frames later, once the GPU is done with them.
+class GpuTimestampSource {
+ public:
+  virtual ~GpuTimestampSource() = default;
+
+  // Returns the key to look the timestamp up with.
+  virtual uint32_t InsertTimestamp() = 0;
+  virtual uint64_t GetTimestamp(uint32_t key) = 0;
+  virtual uint64_t ticks_per_second() const = 0;
+};
+
 class Profiler {
  public:
   static bool is_enabled();
@@ -171,7 +196,22 @@ class Profiler {
   // Starts a new frame on the profiler
   static void Flip();
 
+  // Starts writing the profiling scopes of the next --profile_trace_seconds
+  // to --profile_trace_path, as a Chrome trace that chrome://tracing and
+  // Perfetto load. Does nothing if a capture is already running.
+  static void CaptureTrace();
+  static bool is_capturing_trace();
+
+  // Sets where GPU profiling scopes get their timestamps from, if anywhere.
+  static GpuTimestampSource* gpu_timestamp_source() {
+    return gpu_timestamp_source_;
+  }
+  static void set_gpu_timestamp_source(GpuTimestampSource* source) {
+    gpu_timestamp_source_ = source;
+  }
+
  private:
+  static GpuTimestampSource* gpu_timestamp_source_;
   static ui::Window* window_;
   static std::unique_ptr<ui::MicroprofileDrawer> drawer_;
 };
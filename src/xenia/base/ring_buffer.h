@@ -16,6 +16,7 @@
 
 #include "xenia/base/assert.h"
 #include "xenia/base/byte_order.h"
+#include "xenia/base/memory.h"
 
 namespace xe {
 
@@ -85,6 +86,22 @@ class RingBuffer {
     return imm;
   }
 
+  // Reads count elements, byte swapping all of them at once.
+  template <typename T>
+  size_t ReadAndSwap(T* buffer, size_t count) {
+    auto read_range = BeginRead(count * sizeof(T));
+    size_t first_count = read_range.first_length / sizeof(T);
+    xe::copy_and_swap(buffer, reinterpret_cast<const T*>(read_range.first),
+                      first_count);
+    if (read_range.second) {
+      xe::copy_and_swap(buffer + first_count,
+                        reinterpret_cast<const T*>(read_range.second),
+                        read_range.second_length / sizeof(T));
+    }
+    EndRead(read_range);
+    return read_range.first_length + read_range.second_length;
+  }
+
   size_t Write(const uint8_t* buffer, size_t count);
   template <typename T>
   size_t Write(const T* buffer, size_t count) {
@@ -0,0 +1,201 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2016 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#include <gflags/gflags.h>
+
+#include <algorithm>
+#include <cstdio>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "xenia/base/clock.h"
+#include "xenia/base/concurrent_ring_buffer.h"
+#include "xenia/base/logging.h"
+#include "xenia/base/main.h"
+#include "xenia/base/ring_buffer.h"
+
+DEFINE_int32(ring_buffer_benchmark_items, 4 * 1024 * 1024,
+             "Number of items passed through the buffer per case.");
+DEFINE_int32(ring_buffer_benchmark_capacity, 4096,
+             "Capacity of the buffers, in items.");
+
+namespace xe {
+namespace test {
+
+// A RingBuffer behind a mutex, as a reference for the lock-free buffers.
+class LockedRingBuffer {
+ public:
+  explicit LockedRingBuffer(size_t capacity)
+      : data_(capacity * sizeof(uint64_t)),
+        buffer_(data_.data(), data_.size()) {}
+
+  // Writes all items that fit, returning how many did.
+  size_t Write(const uint64_t* items, size_t count) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    // One byte is kept free, as a full buffer would look empty.
+    size_t free_count = (buffer_.write_count() - 1) / sizeof(uint64_t);
+    count = std::min(count, free_count);
+    buffer_.Write(items, count * sizeof(uint64_t));
+    return count;
+  }
+  size_t Read(uint64_t* items, size_t count) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    count = std::min(count, buffer_.read_count() / sizeof(uint64_t));
+    buffer_.Read(items, count * sizeof(uint64_t));
+    return count;
+  }
+
+ private:
+  std::vector<uint8_t> data_;
+  std::mutex mutex_;
+  RingBuffer buffer_;
+};
+
+typedef std::function<size_t(const uint64_t*, size_t)> WriteFunction;
+typedef std::function<size_t(uint64_t*, size_t)> ReadFunction;
+
+// Passes item_count items from each producer to the consumer in batches of
+// the given size, returning the time taken and whether every item arrived.
+bool RunCase(const char* name, size_t producer_count, size_t item_count,
+             size_t batch_size, WriteFunction write, ReadFunction read) {
+  std::vector<std::thread> producers;
+  uint64_t start = Clock::QueryHostTickCount();
+  for (size_t p = 0; p < producer_count; ++p) {
+    producers.emplace_back([=]() {
+      std::vector<uint64_t> items(batch_size);
+      for (size_t i = 0; i < item_count; i += batch_size) {
+        size_t count = std::min(batch_size, item_count - i);
+        for (size_t j = 0; j < count; ++j) {
+          items[j] = (uint64_t(p) << 32) | (i + j);
+        }
+        for (size_t written = 0; written < count;) {
+          size_t n = write(items.data() + written, count - written);
+          if (!n) {
+            std::this_thread::yield();
+          }
+          written += n;
+        }
+      }
+    });
+  }
+
+  // Items of each producer must arrive in order.
+  std::vector<uint64_t> next_items(producer_count);
+  std::vector<uint64_t> items(batch_size);
+  size_t total_count = producer_count * item_count;
+  bool ordered = true;
+  for (size_t received = 0; received < total_count;) {
+    size_t count = read(items.data(), batch_size);
+    if (!count) {
+      std::this_thread::yield();
+    }
+    for (size_t i = 0; i < count; ++i) {
+      size_t p = size_t(items[i] >> 32);
+      if (p >= producer_count || (items[i] & 0xFFFFFFFF) != next_items[p]) {
+        ordered = false;
+        continue;
+      }
+      ++next_items[p];
+    }
+    received += count;
+  }
+  for (auto& producer : producers) {
+    producer.join();
+  }
+  uint64_t ticks = Clock::QueryHostTickCount() - start;
+
+  double seconds = double(ticks) / Clock::host_tick_frequency();
+  std::printf("%-24s %9zu %5zu %10.1f %10.2f %s\n", name, producer_count,
+              batch_size, seconds * 1000.0,
+              seconds > 0 ? total_count / seconds / 1000000.0 : 0.0,
+              ordered ? "ok" : "MISMATCH");
+  return ordered;
+}
+
+int main(const std::vector<std::wstring>& args) {
+  size_t item_count = size_t(std::max(FLAGS_ring_buffer_benchmark_items, 1));
+  size_t capacity = size_t(std::max(FLAGS_ring_buffer_benchmark_capacity, 2));
+  bool ok = true;
+
+  std::printf("%-24s %9s %5s %10s %10s\n", "buffer", "producers", "batch",
+              "ms", "Mitems/s");
+  // One item at a time, as with command queues, and in batches, as with
+  // audio samples.
+  for (size_t batch_size : {size_t(1), size_t(64)}) {
+    LockedRingBuffer locked(capacity);
+    ok &= RunCase("locked RingBuffer", 1, item_count, batch_size,
+                  [&](const uint64_t* items, size_t count) {
+                    return locked.Write(items, count);
+                  },
+                  [&](uint64_t* items, size_t count) {
+                    return locked.Read(items, count);
+                  });
+
+    SpscRingBuffer<uint64_t> spsc(capacity);
+    ok &= RunCase("SpscRingBuffer", 1, item_count, batch_size,
+                  [&](const uint64_t* items, size_t count) {
+                    return spsc.Write(items, count);
+                  },
+                  [&](uint64_t* items, size_t count) {
+                    return spsc.Read(items, count);
+                  });
+  }
+
+  // Several threads queueing work for one, like guest threads logging or
+  // submitting IO.
+  for (size_t producer_count : {size_t(1), size_t(2), size_t(4)}) {
+    for (size_t batch_size : {size_t(1), size_t(16)}) {
+      size_t per_producer = item_count / producer_count;
+      LockedRingBuffer locked(capacity);
+      ok &= RunCase("locked RingBuffer", producer_count, per_producer,
+                    batch_size,
+                    [&](const uint64_t* items, size_t count) {
+                      return locked.Write(items, count);
+                    },
+                    [&](uint64_t* items, size_t count) {
+                      return locked.Read(items, count);
+                    });
+
+      MpscRingBuffer<uint64_t> mpsc(capacity);
+      ok &= RunCase("MpscRingBuffer", producer_count, per_producer,
+                    batch_size,
+                    [&](const uint64_t* items, size_t count) {
+                      auto range = mpsc.BeginWrite(count);
+                      for (size_t i = 0; i < range.count(); ++i) {
+                        range[i] = items[i];
+                      }
+                      mpsc.EndWrite(range);
+                      return range.count();
+                    },
+                    [&](uint64_t* items, size_t count) {
+                      auto range = mpsc.BeginRead(count);
+                      for (size_t i = 0; i < range.count(); ++i) {
+                        items[i] = range[i];
+                      }
+                      mpsc.EndRead(range.count());
+                      return range.count();
+                    });
+    }
+  }
+
+  if (!ok) {
+    XELOGE("Items were lost or reordered");
+    return 1;
+  }
+  return 0;
+}
+
+}  // namespace test
+}  // namespace xe
+
+DEFINE_ENTRY_POINT(L"xenia-base-ring-buffer-benchmark",
+                   L"xenia-base-ring-buffer-benchmark",
+                   xe::test::main);
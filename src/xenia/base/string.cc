@@ -104,6 +104,15 @@ std::string::size_type find_first_of_case(const std::string& target,
   }
 }
 
+std::string to_lower_ascii(std::string value) {
+  for (auto& c : value) {
+    if (c >= 'A' && c <= 'Z') {
+      c += 'a' - 'A';
+    }
+  }
+  return value;
+}
+
 std::wstring to_absolute_path(const std::wstring& path) {
 #if XE_PLATFORM_WIN32
   wchar_t buffer[kMaxPath];
@@ -183,29 +192,34 @@ std::wstring fix_path_separators(const std::wstring& source, wchar_t new_sep) {
 }
 
 std::string fix_path_separators(const std::string& source, char new_sep) {
-  // Swap all separators to new_sep.
-  char old_sep = new_sep == '\\' ? '/' : '\\';
-  std::string::size_type pos = 0;
   std::string dest = source;
-  while ((pos = source.find_first_of(old_sep, pos)) != std::string::npos) {
-    dest[pos] = new_sep;
-    ++pos;
-  }
-  // Replace redundant separators.
-  pos = 0;
-  while ((pos = dest.find_first_of(new_sep, pos)) != std::string::npos) {
-    if (pos < dest.size() - 1) {
-      if (dest[pos + 1] == new_sep) {
-        dest.erase(pos + 1, 1);
-      }
+  fix_path_separators(&dest, new_sep);
+  return dest;
+}
+
+void fix_path_separators(std::string* path, char new_sep) {
+  // Swap all separators to new_sep, dropping any following another.
+  char old_sep = new_sep == '\\' ? '/' : '\\';
+  size_t dest_length = 0;
+  for (char c : *path) {
+    if (c == old_sep) {
+      c = new_sep;
+    }
+    if (c != new_sep || !dest_length || (*path)[dest_length - 1] != new_sep) {
+      (*path)[dest_length++] = c;
     }
-    ++pos;
   }
-  return dest;
+  path->resize(dest_length);
 }
 
 std::string find_name_from_path(const std::string& path, char sep) {
-  std::string name(path);
+  std::string name;
+  find_name_from_path(path, &name, sep);
+  return name;
+}
+
+void find_name_from_path(const std::string& path, std::string* out_name,
+                         char sep) {
   if (!path.empty()) {
     std::string::size_type from(std::string::npos);
     if (path.back() == sep) {
@@ -214,14 +228,15 @@ std::string find_name_from_path(const std::string& path, char sep) {
     auto pos(path.find_last_of(sep, from));
     if (pos != std::string::npos) {
       if (from == std::string::npos) {
-        name = path.substr(pos + 1);
+        out_name->assign(path, pos + 1, std::string::npos);
       } else {
         auto len(from - pos);
-        name = path.substr(pos + 1, len);
+        out_name->assign(path, pos + 1, len);
       }
+      return;
     }
   }
-  return name;
+  out_name->assign(path);
 }
 
 std::wstring find_name_from_path(const std::wstring& path, wchar_t sep) {
@@ -245,18 +260,25 @@ std::wstring find_name_from_path(const std::wstring& path, wchar_t sep) {
 }
 
 std::string find_base_path(const std::string& path, char sep) {
+  std::string base_path;
+  find_base_path(path, &base_path, sep);
+  return base_path;
+}
+
+void find_base_path(const std::string& path, std::string* out_base_path,
+                    char sep) {
   auto last_slash = path.find_last_of(sep);
   if (last_slash == std::string::npos) {
-    return path;
+    out_base_path->assign(path);
   } else if (last_slash == path.length() - 1) {
     auto prev_slash = path.find_last_of(sep, last_slash - 1);
     if (prev_slash == std::string::npos) {
-      return "";
+      out_base_path->clear();
     } else {
-      return path.substr(0, prev_slash + 1);
+      out_base_path->assign(path, 0, prev_slash + 1);
     }
   } else {
-    return path.substr(0, last_slash + 1);
+    out_base_path->assign(path, 0, last_slash + 1);
   }
 }
 
@@ -44,6 +44,9 @@ inline std::wstring format_string(const wchar_t* format, ...) {
 std::string::size_type find_first_of_case(const std::string& target,
                                           const std::string& search);
 
+// Lowercases the ASCII letters, for keys compared case insensitively.
+std::string to_lower_ascii(std::string value);
+
 // Converts the given path to an absolute path based on cwd.
 std::wstring to_absolute_path(const std::wstring& path);
 
@@ -75,6 +78,16 @@ std::string find_base_path(const std::string& path,
 std::wstring find_base_path(const std::wstring& path,
                             wchar_t sep = xe::kPathSeparator);
 
+// Variants of the above writing into a string of the caller, which must not
+// be the source. They don't allocate when it has the capacity already, so
+// hot paths can reuse one, such as a thread local.
+void fix_path_separators(std::string* path,
+                         char new_sep = xe::kPathSeparator);
+void find_name_from_path(const std::string& path, std::string* out_name,
+                         char sep = xe::kPathSeparator);
+void find_base_path(const std::string& path, std::string* out_base_path,
+                    char sep = xe::kPathSeparator);
+
 // Tests a match against a case-insensitive fuzzy filter.
 // Returns the score of the match or 0 if none.
 int fuzzy_match(const std::string& pattern, const char* value);
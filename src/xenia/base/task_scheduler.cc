@@ -0,0 +1,259 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2016 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#include "xenia/base/task_scheduler.h"
+
+#include <gflags/gflags.h>
+
+#include <algorithm>
+#include <chrono>
+
+#include "xenia/base/logging.h"
+
+DEFINE_int32(task_scheduler_threads, 0,
+             "Number of worker threads of the shared task scheduler. 0 picks "
+             "one per host logical processor.");
+DEFINE_string(task_scheduler_cpus, "",
+              "Host logical processors the shared task scheduler runs on, "
+              "such as \"6-11\". Empty keeps it off the processors the guest "
+              "hardware threads are pinned to, if any others are left.");
+
+namespace xe {
+namespace threading {
+
+namespace {
+
+thread_local TaskScheduler* current_scheduler_ = nullptr;
+thread_local size_t current_worker_index_ = SIZE_MAX;
+
+std::mutex shared_mutex_;
+// Must be guarded by shared_mutex_.
+TaskScheduler* shared_scheduler_ = nullptr;
+uint64_t avoided_processor_mask_ = 0;
+
+uint64_t all_processors_mask() {
+  uint32_t count = logical_processor_count();
+  return count < 64 ? (1ull << count) - 1 : UINT64_MAX;
+}
+
+// Must be called with shared_mutex_ held.
+uint64_t shared_affinity_mask() {
+  uint64_t mask = 0;
+  if (!FLAGS_task_scheduler_cpus.empty()) {
+    if (!ParseProcessorSet(FLAGS_task_scheduler_cpus, &mask)) {
+      XELOGE("Invalid --task_scheduler_cpus, not pinning");
+      return 0;
+    }
+    return mask;
+  }
+  if (!avoided_processor_mask_) {
+    return 0;
+  }
+  return all_processors_mask() & ~avoided_processor_mask_;
+}
+
+}  // namespace
+
+TaskScheduler::TaskScheduler(const std::string& name, size_t worker_count,
+                             uint64_t affinity_mask) {
+  worker_count = std::max(worker_count, size_t(1));
+  for (size_t i = 0; i < worker_count; ++i) {
+    workers_.emplace_back(new Worker());
+  }
+  // Started once all workers exist, as they steal from each other.
+  for (size_t i = 0; i < worker_count; ++i) {
+    auto& thread = workers_[i]->thread;
+    thread = Thread::Create({}, [this, i]() { WorkerMain(i); });
+    thread->set_name(name + " " + std::to_string(i));
+    if (affinity_mask) {
+      thread->set_affinity_mask(affinity_mask);
+    }
+  }
+}
+
+TaskScheduler::~TaskScheduler() {
+  {
+    std::lock_guard<std::mutex> lock(sleep_mutex_);
+    running_ = false;
+  }
+  sleep_cond_.notify_all();
+  for (auto& worker : workers_) {
+    xe::threading::Wait(worker->thread.get(), false);
+  }
+}
+
+TaskScheduler* TaskScheduler::shared() {
+  std::lock_guard<std::mutex> lock(shared_mutex_);
+  if (!shared_scheduler_) {
+    size_t worker_count = size_t(std::max(FLAGS_task_scheduler_threads, 0));
+    if (!worker_count) {
+      worker_count = logical_processor_count();
+    }
+    shared_scheduler_ =
+        new TaskScheduler("Task Worker", worker_count, shared_affinity_mask());
+  }
+  return shared_scheduler_;
+}
+
+void TaskScheduler::AvoidProcessors(uint64_t processor_mask) {
+  std::lock_guard<std::mutex> lock(shared_mutex_);
+  avoided_processor_mask_ |= processor_mask;
+  if (shared_scheduler_) {
+    shared_scheduler_->set_affinity_mask(shared_affinity_mask());
+  }
+}
+
+void TaskScheduler::set_affinity_mask(uint64_t affinity_mask) {
+  if (!affinity_mask) {
+    affinity_mask = all_processors_mask();
+  }
+  for (auto& worker : workers_) {
+    worker->thread->set_affinity_mask(affinity_mask);
+  }
+}
+
+void TaskScheduler::Submit(std::function<void()> task, TaskPriority priority,
+                           TaskGroup* group) {
+  if (group) {
+    ++group->pending_count_;
+  }
+  size_t worker_index = current_worker_index();
+  if (worker_index == SIZE_MAX) {
+    worker_index = next_worker_index_++ % workers_.size();
+  }
+  // Counted first so it never drops below the number of queued tasks.
+  ++queued_count_;
+  auto& worker = *workers_[worker_index];
+  {
+    std::lock_guard<std::mutex> lock(worker.mutex);
+    worker.queues[size_t(priority)].push_back({std::move(task), group});
+  }
+  if (sleeping_count_.load()) {
+    // Taking the lock makes sure a worker about to sleep sees the task.
+    std::lock_guard<std::mutex> lock(sleep_mutex_);
+    sleep_cond_.notify_one();
+  }
+}
+
+void TaskScheduler::Wait(TaskGroup* group) {
+  size_t worker_index = current_worker_index();
+  while (group->pending_count_.load()) {
+    Task task;
+    if (FindTask(worker_index, &task)) {
+      RunTask(&task);
+      continue;
+    }
+    // The group's tasks are running elsewhere, though they may still queue
+    // more, so the queues are checked again now and then.
+    std::unique_lock<std::mutex> lock(group->mutex_);
+    group->done_cond_.wait_for(lock, std::chrono::milliseconds(1), [group]() {
+      return group->pending_count_.load() == 0;
+    });
+  }
+  // The last task may still be notifying, so the group must not be destroyed
+  // before it has released the lock.
+  std::lock_guard<std::mutex> lock(group->mutex_);
+}
+
+void TaskScheduler::ParallelFor(size_t count,
+                                const std::function<void(size_t)>& function,
+                                TaskPriority priority) {
+  std::atomic<size_t> next_index(0);
+  auto run = [&]() {
+    size_t index;
+    while ((index = next_index.fetch_add(1)) < count) {
+      function(index);
+    }
+  };
+  TaskGroup group;
+  size_t task_count = std::min(workers_.size(), count);
+  for (size_t i = 1; i < task_count; ++i) {
+    Submit(run, priority, &group);
+  }
+  run();
+  Wait(&group);
+}
+
+size_t TaskScheduler::current_worker_index() const {
+  return current_scheduler_ == this ? current_worker_index_ : SIZE_MAX;
+}
+
+bool TaskScheduler::FindTask(size_t worker_index, Task* out_task) {
+  if (!queued_count_.load()) {
+    return false;
+  }
+  size_t worker_count = workers_.size();
+  size_t start_index = worker_index == SIZE_MAX
+                           ? next_worker_index_.load() % worker_count
+                           : worker_index;
+  for (size_t priority = 0; priority < kPriorityCount; ++priority) {
+    if (worker_index != SIZE_MAX) {
+      auto& worker = *workers_[worker_index];
+      std::lock_guard<std::mutex> lock(worker.mutex);
+      auto& queue = worker.queues[priority];
+      if (!queue.empty()) {
+        *out_task = std::move(queue.back());
+        queue.pop_back();
+        --queued_count_;
+        return true;
+      }
+    }
+    for (size_t i = 0; i < worker_count; ++i) {
+      size_t victim_index = (start_index + i) % worker_count;
+      if (victim_index == worker_index) {
+        continue;
+      }
+      auto& victim = *workers_[victim_index];
+      std::lock_guard<std::mutex> lock(victim.mutex);
+      auto& queue = victim.queues[priority];
+      if (!queue.empty()) {
+        *out_task = std::move(queue.front());
+        queue.pop_front();
+        --queued_count_;
+        return true;
+      }
+    }
+  }
+  return false;
+}
+
+void TaskScheduler::RunTask(Task* task) {
+  task->function();
+  task->function = nullptr;
+  if (task->group) {
+    auto group = task->group;
+    std::lock_guard<std::mutex> lock(group->mutex_);
+    if (!--group->pending_count_) {
+      group->done_cond_.notify_all();
+    }
+  }
+}
+
+void TaskScheduler::WorkerMain(size_t worker_index) {
+  current_scheduler_ = this;
+  current_worker_index_ = worker_index;
+  while (true) {
+    Task task;
+    if (FindTask(worker_index, &task)) {
+      RunTask(&task);
+      continue;
+    }
+    std::unique_lock<std::mutex> lock(sleep_mutex_);
+    ++sleeping_count_;
+    sleep_cond_.wait(lock,
+                     [this]() { return !running_ || queued_count_.load(); });
+    --sleeping_count_;
+    if (!running_ && !queued_count_.load()) {
+      break;
+    }
+  }
+}
+
+}  // namespace threading
+}  // namespace xe
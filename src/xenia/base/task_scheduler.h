@@ -0,0 +1,132 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2016 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#ifndef XENIA_BASE_TASK_SCHEDULER_H_
+#define XENIA_BASE_TASK_SCHEDULER_H_
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "xenia/base/threading.h"
+
+namespace xe {
+namespace threading {
+
+// Queued tasks of a higher priority run before any of a lower one.
+enum class TaskPriority {
+  kHigh = 0,
+  kNormal = 1,
+  kLow = 2,
+};
+
+// Tasks that can be waited on together with TaskScheduler::Wait. Must
+// outlive its tasks.
+class TaskGroup {
+ public:
+  TaskGroup() = default;
+  TaskGroup(const TaskGroup&) = delete;
+  TaskGroup& operator=(const TaskGroup&) = delete;
+
+  // Whether all tasks added to the group so far have run.
+  bool is_done() const { return pending_count_.load() == 0; }
+
+ private:
+  friend class TaskScheduler;
+
+  std::atomic<size_t> pending_count_ = {0};
+  std::mutex mutex_;
+  std::condition_variable done_cond_;
+};
+
+// A pool of worker threads running short background tasks, such as
+// translation, decoding and IO completion.
+//
+// Each worker has its own queues, one per priority. Tasks submitted by a
+// worker go to its own queues, where it takes the newest first, while those
+// from other threads are spread over all workers. Workers without tasks steal
+// the oldest ones from the others before going to sleep.
+class TaskScheduler {
+ public:
+  // Creates worker_count workers, restricted to the processors in the
+  // affinity mask if it isn't 0.
+  TaskScheduler(const std::string& name, size_t worker_count,
+                uint64_t affinity_mask = 0);
+  // Runs the queued tasks before returning.
+  ~TaskScheduler();
+
+  // The scheduler shared by the emulator, created on first use with
+  // --task_scheduler_threads workers. Never destroyed.
+  static TaskScheduler* shared();
+
+  // Hints that the processors in the mask are busy with other work, such as
+  // the guest hardware threads, so workers of the shared scheduler run on
+  // the others. Ignored if --task_scheduler_cpus is set or it would leave no
+  // processors.
+  static void AvoidProcessors(uint64_t processor_mask);
+
+  size_t worker_count() const { return workers_.size(); }
+  void set_affinity_mask(uint64_t affinity_mask);
+
+  // Queues the task, adding it to the group if there is one.
+  void Submit(std::function<void()> task,
+              TaskPriority priority = TaskPriority::kNormal,
+              TaskGroup* group = nullptr);
+  // Returns once all tasks of the group have run, running queued tasks on
+  // the calling thread meanwhile, so workers may wait on groups as well.
+  void Wait(TaskGroup* group);
+  // Calls the function with each index below the count on the workers and
+  // the calling thread, returning once all calls have.
+  void ParallelFor(size_t count, const std::function<void(size_t)>& function,
+                   TaskPriority priority = TaskPriority::kNormal);
+
+ private:
+  static const size_t kPriorityCount = 3;
+
+  struct Task {
+    std::function<void()> function;
+    TaskGroup* group;
+  };
+  struct Worker {
+    std::unique_ptr<Thread> thread;
+    // Guards the queues.
+    std::mutex mutex;
+    std::deque<Task> queues[kPriorityCount];
+  };
+
+  // Index of the calling thread's worker in this scheduler, or -1.
+  size_t current_worker_index() const;
+  // Takes the highest priority task of the worker or, failing that, of the
+  // others. worker_index may be -1 to only steal.
+  bool FindTask(size_t worker_index, Task* out_task);
+  void RunTask(Task* task);
+  void WorkerMain(size_t worker_index);
+
+  std::vector<std::unique_ptr<Worker>> workers_;
+  std::atomic<size_t> next_worker_index_ = {0};
+  // Tasks in all queues.
+  std::atomic<size_t> queued_count_ = {0};
+
+  std::mutex sleep_mutex_;
+  std::condition_variable sleep_cond_;
+  std::atomic<size_t> sleeping_count_ = {0};
+  // Must be guarded by sleep_mutex_.
+  bool running_ = true;
+};
+
+}  // namespace threading
+}  // namespace xe
+
+#endif  // XENIA_BASE_TASK_SCHEDULER_H_
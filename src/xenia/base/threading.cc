@@ -9,6 +9,10 @@
 
 #include "xenia/base/threading.h"
 
+#include <algorithm>
+#include <cstdlib>
+#include <map>
+
 namespace xe {
 namespace threading {
 
@@ -20,6 +24,41 @@ uint32_t logical_processor_count() {
   return value;
 }
 
+bool ParseProcessorSet(const std::string& processor_set, uint64_t* out_mask) {
+  uint64_t mask = 0;
+  size_t offset = 0;
+  while (offset < processor_set.size()) {
+    size_t end = processor_set.find(',', offset);
+    if (end == std::string::npos) {
+      end = processor_set.size();
+    }
+    std::string range = processor_set.substr(offset, end - offset);
+    const char* range_start = range.c_str();
+    char* range_end;
+    unsigned long first = std::strtoul(range_start, &range_end, 10);
+    if (range_end == range_start) {
+      return false;
+    }
+    unsigned long last = first;
+    if (*range_end == '-') {
+      const char* last_start = range_end + 1;
+      last = std::strtoul(last_start, &range_end, 10);
+      if (range_end == last_start) {
+        return false;
+      }
+    }
+    if (*range_end || first > last || last >= 64) {
+      return false;
+    }
+    for (unsigned long i = first; i <= last; ++i) {
+      mask |= 1ull << i;
+    }
+    offset = end + 1;
+  }
+  *out_mask = mask;
+  return true;
+}
+
 thread_local uint32_t current_thread_id_ = UINT_MAX;
 
 uint32_t current_thread_id() {
@@ -29,5 +68,180 @@ uint32_t current_thread_id() {
 
 void set_current_thread_id(uint32_t id) { current_thread_id_ = id; }
 
+void ParallelFor(const std::string& name_prefix, size_t count,
+                 const std::function<void(size_t)>& function) {
+  size_t thread_count =
+      std::min(size_t(std::max(1u, logical_processor_count())), count);
+  std::atomic<size_t> next_index(0);
+  auto worker = [&]() {
+    size_t index;
+    while ((index = next_index.fetch_add(1)) < count) {
+      function(index);
+    }
+  };
+  std::vector<std::unique_ptr<Thread>> threads;
+  for (size_t i = 1; i < thread_count; ++i) {
+    auto thread = Thread::Create({}, worker);
+    thread->set_name(name_prefix + " " + std::to_string(i));
+    threads.push_back(std::move(thread));
+  }
+  worker();
+  for (auto& thread : threads) {
+    Wait(thread.get(), false);
+  }
+}
+
+namespace {
+
+// Runs every HighResolutionTimer on one thread, which sleeps until the latest
+// time the earliest of the timers allows and then runs all that are due.
+class TimerService {
+ public:
+  using Clock = std::chrono::steady_clock;
+
+  struct Timer {
+    Clock::time_point due_time;
+    // Zero if the timer fires once.
+    Clock::duration period;
+    Clock::duration tolerance;
+    std::function<void()> callback;
+    // Must be guarded by the mutex of the service.
+    bool queued = false;
+    std::multimap<Clock::time_point, Timer*>::iterator queue_it;
+  };
+
+  // Never destroyed, as timers may outlive static destruction.
+  static TimerService* shared() {
+    static auto service = new TimerService();
+    return service;
+  }
+
+  void Add(Timer* timer) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!thread_) {
+      Thread::CreationParameters params;
+      params.initial_priority = ThreadPriority::kHighest;
+      thread_ = Thread::Create(params, [this]() { ThreadMain(); });
+      thread_->set_name("High Resolution Timer");
+    }
+    Enqueue(timer);
+    wake_cond_.notify_one();
+  }
+
+  // Returns once the callback of the timer isn't running, unless called from
+  // it.
+  void Remove(Timer* timer) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    if (timer->queued) {
+      queue_.erase(timer->queue_it);
+      timer->queued = false;
+    }
+    if (std::this_thread::get_id() != thread_id_) {
+      idle_cond_.wait(lock, [this, timer]() { return running_ != timer; });
+    }
+  }
+
+ private:
+  void Enqueue(Timer* timer) {
+    timer->queue_it = queue_.emplace(timer->due_time, timer);
+    timer->queued = true;
+  }
+
+  void ThreadMain() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    thread_id_ = std::this_thread::get_id();
+    while (true) {
+      if (queue_.empty()) {
+        wake_cond_.wait(lock);
+        continue;
+      }
+      // Timers due later than the wakeup can't move it earlier, as it is
+      // never before their due time.
+      auto wake_time = Clock::time_point::max();
+      for (auto& it : queue_) {
+        if (it.first >= wake_time) {
+          break;
+        }
+        wake_time = std::min(wake_time, it.first + it.second->tolerance);
+      }
+      auto now = Clock::now();
+      if (now < wake_time) {
+        wake_cond_.wait_until(lock, wake_time);
+        continue;
+      }
+      while (!queue_.empty() && queue_.begin()->first <= now) {
+        auto timer = queue_.begin()->second;
+        queue_.erase(queue_.begin());
+        timer->queued = false;
+        if (timer->period.count()) {
+          timer->due_time += timer->period;
+          if (timer->due_time <= now) {
+            timer->due_time +=
+                ((now - timer->due_time) / timer->period + 1) * timer->period;
+          }
+          Enqueue(timer);
+        }
+        running_ = timer;
+        lock.unlock();
+        timer->callback();
+        lock.lock();
+        running_ = nullptr;
+        idle_cond_.notify_all();
+      }
+    }
+  }
+
+  std::mutex mutex_;
+  std::condition_variable wake_cond_;
+  std::condition_variable idle_cond_;
+  std::multimap<Clock::time_point, Timer*> queue_;
+  Timer* running_ = nullptr;
+  std::unique_ptr<Thread> thread_;
+  std::thread::id thread_id_;
+};
+
+class ServiceHighResolutionTimer : public HighResolutionTimer {
+ public:
+  ServiceHighResolutionTimer(std::chrono::nanoseconds delay,
+                             std::chrono::nanoseconds period,
+                             std::chrono::nanoseconds tolerance,
+                             std::function<void()> callback) {
+    timer_.due_time = TimerService::Clock::now() +
+                      std::chrono::duration_cast<TimerService::Clock::duration>(
+                          delay);
+    timer_.period =
+        std::chrono::duration_cast<TimerService::Clock::duration>(period);
+    timer_.tolerance =
+        std::chrono::duration_cast<TimerService::Clock::duration>(tolerance);
+    timer_.callback = std::move(callback);
+    TimerService::shared()->Add(&timer_);
+  }
+  ~ServiceHighResolutionTimer() override {
+    TimerService::shared()->Remove(&timer_);
+  }
+
+ private:
+  TimerService::Timer timer_;
+};
+
+}  // namespace
+
+std::unique_ptr<HighResolutionTimer> HighResolutionTimer::CreateRepeating(
+    std::chrono::milliseconds period, std::function<void()> callback,
+    std::chrono::milliseconds tolerance) {
+  if (period.count() <= 0) {
+    return nullptr;
+  }
+  return std::make_unique<ServiceHighResolutionTimer>(
+      period, period, tolerance, std::move(callback));
+}
+
+std::unique_ptr<HighResolutionTimer> HighResolutionTimer::CreateOnce(
+    std::chrono::microseconds delay, std::function<void()> callback,
+    std::chrono::milliseconds tolerance) {
+  return std::make_unique<ServiceHighResolutionTimer>(
+      delay, std::chrono::nanoseconds(0), tolerance, std::move(callback));
+}
+
 }  // namespace threading
 }  // namespace xe
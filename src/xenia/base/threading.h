@@ -16,6 +16,7 @@
 #include <climits>
 #include <condition_variable>
 #include <cstdint>
+#include <functional>
 #include <memory>
 #include <mutex>
 #include <string>
@@ -55,6 +56,10 @@ uint32_t logical_processor_count();
 // Must be called at startup before attempting to set thread affinity.
 void EnableAffinityConfiguration();
 
+// Parses a set of logical processors such as "0-3,8,10-11" into an affinity
+// mask. An empty set gives an empty mask. Returns false if malformed.
+bool ParseProcessorSet(const std::string& processor_set, uint64_t* out_mask);
+
 // Gets a stable thread-specific ID, but may not be. Use for informative
 // purposes only.
 uint32_t current_thread_system_id();
@@ -109,15 +114,24 @@ bool SetTlsValue(TlsHandle handle, uintptr_t value);
 // A high-resolution timer capable of firing at millisecond-precision.
 // All timers created in this way are executed in the same thread so
 // callbacks must be kept short or else all timers will be impacted.
+//
+// A timer may fire up to its tolerance late, so timers due around the same
+// time fire on a single wakeup of the thread. Destroying a timer waits for
+// its callback if it is running on another thread.
 class HighResolutionTimer {
  public:
   virtual ~HighResolutionTimer() = default;
 
   // Creates a new repeating timer with the given period.
   // The given function will be called back as close to the given period as
-  // possible.
+  // possible. Periods missed while the thread was busy are skipped.
   static std::unique_ptr<HighResolutionTimer> CreateRepeating(
-      std::chrono::milliseconds period, std::function<void()> callback);
+      std::chrono::milliseconds period, std::function<void()> callback,
+      std::chrono::milliseconds tolerance = std::chrono::milliseconds(0));
+  // Creates a timer calling the function once after the delay.
+  static std::unique_ptr<HighResolutionTimer> CreateOnce(
+      std::chrono::microseconds delay, std::function<void()> callback,
+      std::chrono::milliseconds tolerance = std::chrono::milliseconds(0));
 };
 
 // Results for a WaitHandle operation.
@@ -404,6 +418,11 @@ class Thread : public WaitHandle {
   std::string name_;
 };
 
+// Calls the function with each index below the count, spread over all host
+// cores, on threads named after the prefix. Returns once all calls have.
+void ParallelFor(const std::string& name_prefix, size_t count,
+                 const std::function<void(size_t)>& function);
+
 }  // namespace threading
 }  // namespace xe
 
@@ -9,13 +9,386 @@
 
 #include "xenia/base/threading.h"
 
+#include <linux/futex.h>
 #include <pthread.h>
+#include <sys/syscall.h>
 #include <time.h>
+#include <unistd.h>
+
+#include <algorithm>
 
 namespace xe {
 namespace threading {
 
 void MaybeYield() { pthread_yield(); }
 
+// The wait handles are dispatcher objects like those of the NT kernel: each
+// keeps its state and the threads waiting on it behind a mutex, and a
+// waiting thread sleeps on a futex of its own that any of the objects it
+// waits on can wake. Waits lock all of their objects at once, in address
+// order, so wait-all acquires every object atomically and no signal is
+// missed between checking the objects and going to sleep.
+//
+// User callbacks are not implemented on this platform, so alertable waits
+// never end with WaitResult::kUserCallback.
+
+namespace {
+
+int Futex(std::atomic<uint32_t>* word, int op, uint32_t value,
+          const timespec* timeout) {
+  return int(syscall(SYS_futex, reinterpret_cast<uint32_t*>(word),
+                     op | FUTEX_PRIVATE_FLAG, value, timeout, nullptr, 0));
+}
+
+// Incremented by each pulse of an event. Changed with the event locked.
+std::atomic<uint64_t> pulse_generation = {0};
+
+struct Waiter {
+  // Set to 1 when any of the objects waited on changes state.
+  std::atomic<uint32_t> futex_word = {0};
+  // The pulse generation when the thread last went to sleep, with its
+  // objects locked. Pulses after it are the ones the thread was waiting for.
+  // No pulse is seen before the thread first sleeps.
+  uint64_t pulse_generation = UINT64_MAX;
+};
+
+class Dispatcher {
+ public:
+  virtual ~Dispatcher() = default;
+
+  std::mutex& mutex() { return mutex_; }
+
+  // Called with the mutex held. The waiter is null for a thread that hasn't
+  // started waiting.
+  virtual bool IsSignaled(const Waiter* waiter) const = 0;
+  // Consumes the signal for a satisfied wait. Called with the mutex held.
+  virtual void Satisfy(const Waiter* waiter) = 0;
+
+  void AddWaiter(Waiter* waiter) { waiters_.push_back(waiter); }
+  void RemoveWaiter(Waiter* waiter) {
+    auto it = std::find(waiters_.begin(), waiters_.end(), waiter);
+    if (it != waiters_.end()) {
+      *it = waiters_.back();
+      waiters_.pop_back();
+    }
+  }
+
+ protected:
+  // Wakes all waiting threads to check their objects again, as a wait-all
+  // may not be satisfied by this object alone. Called with the mutex held.
+  void WakeWaiters() {
+    for (auto waiter : waiters_) {
+      WakeWaiter(waiter);
+    }
+  }
+  static void WakeWaiter(Waiter* waiter) {
+    waiter->futex_word.store(1, std::memory_order_release);
+    Futex(&waiter->futex_word, FUTEX_WAKE, 1, nullptr);
+  }
+
+  std::vector<Waiter*> waiters_;
+
+ private:
+  std::mutex mutex_;
+};
+
+template <typename T>
+class LinuxHandle : public T, public Dispatcher {
+ public:
+  void* native_handle() const override {
+    return static_cast<Dispatcher*>(const_cast<LinuxHandle*>(this));
+  }
+};
+
+Dispatcher* GetDispatcher(WaitHandle* wait_handle) {
+  return reinterpret_cast<Dispatcher*>(wait_handle->native_handle());
+}
+
+}  // namespace
+
+std::pair<WaitResult, size_t> WaitMultiple(WaitHandle* wait_handles[],
+                                           size_t wait_handle_count,
+                                           bool wait_all, bool is_alertable,
+                                           std::chrono::milliseconds timeout) {
+  if (!wait_handle_count) {
+    return std::pair<WaitResult, size_t>(WaitResult::kFailed, 0);
+  }
+  std::vector<Dispatcher*> dispatchers(wait_handle_count);
+  for (size_t i = 0; i < wait_handle_count; ++i) {
+    dispatchers[i] = GetDispatcher(wait_handles[i]);
+  }
+  // The same object may be waited on more than once, but is locked once.
+  std::vector<Dispatcher*> lock_order(dispatchers);
+  std::sort(lock_order.begin(), lock_order.end());
+  lock_order.erase(std::unique(lock_order.begin(), lock_order.end()),
+                   lock_order.end());
+  auto lock_all = [&lock_order]() {
+    for (auto dispatcher : lock_order) {
+      dispatcher->mutex().lock();
+    }
+  };
+  auto unlock_all = [&lock_order]() {
+    for (auto dispatcher : lock_order) {
+      dispatcher->mutex().unlock();
+    }
+  };
+
+  bool infinite = timeout == std::chrono::milliseconds::max();
+  auto deadline = std::chrono::steady_clock::now();
+  if (!infinite) {
+    deadline += timeout;
+  }
+  Waiter waiter;
+  bool registered = false;
+  lock_all();
+  while (true) {
+    if (wait_all) {
+      bool all_signaled = std::all_of(
+          lock_order.begin(), lock_order.end(),
+          [&waiter](Dispatcher* dispatcher) {
+            return dispatcher->IsSignaled(&waiter);
+          });
+      if (all_signaled) {
+        for (auto dispatcher : lock_order) {
+          dispatcher->Satisfy(&waiter);
+        }
+        break;
+      }
+    } else {
+      size_t index = 0;
+      while (index < wait_handle_count &&
+             !dispatchers[index]->IsSignaled(&waiter)) {
+        ++index;
+      }
+      if (index < wait_handle_count) {
+        dispatchers[index]->Satisfy(&waiter);
+        if (registered) {
+          for (auto dispatcher : lock_order) {
+            dispatcher->RemoveWaiter(&waiter);
+          }
+        }
+        unlock_all();
+        return std::pair<WaitResult, size_t>(WaitResult::kSuccess, index);
+      }
+    }
+
+    timespec remaining_timespec;
+    if (!infinite) {
+      auto remaining = deadline - std::chrono::steady_clock::now();
+      if (remaining <= std::chrono::steady_clock::duration::zero()) {
+        if (registered) {
+          for (auto dispatcher : lock_order) {
+            dispatcher->RemoveWaiter(&waiter);
+          }
+        }
+        unlock_all();
+        return std::pair<WaitResult, size_t>(WaitResult::kTimeout, 0);
+      }
+      auto remaining_ns =
+          std::chrono::duration_cast<std::chrono::nanoseconds>(remaining);
+      remaining_timespec.tv_sec = time_t(remaining_ns.count() / 1000000000);
+      remaining_timespec.tv_nsec = long(remaining_ns.count() % 1000000000);
+    }
+
+    // Signalers set the word with the object locked, so clearing it before
+    // unlocking misses no wake.
+    if (!registered) {
+      for (auto dispatcher : lock_order) {
+        dispatcher->AddWaiter(&waiter);
+      }
+      registered = true;
+    }
+    waiter.futex_word.store(0, std::memory_order_relaxed);
+    // Pulses that didn't satisfy the wait by now are missed, as they are
+    // instantaneous.
+    waiter.pulse_generation = pulse_generation;
+    unlock_all();
+    Futex(&waiter.futex_word, FUTEX_WAIT, 0,
+          infinite ? nullptr : &remaining_timespec);
+    lock_all();
+  }
+  if (registered) {
+    for (auto dispatcher : lock_order) {
+      dispatcher->RemoveWaiter(&waiter);
+    }
+  }
+  unlock_all();
+  return std::pair<WaitResult, size_t>(WaitResult::kSuccess, 0);
+}
+
+WaitResult Wait(WaitHandle* wait_handle, bool is_alertable,
+                std::chrono::milliseconds timeout) {
+  // Objects that are already signaled are taken without any allocation.
+  auto dispatcher = GetDispatcher(wait_handle);
+  {
+    std::lock_guard<std::mutex> lock(dispatcher->mutex());
+    if (dispatcher->IsSignaled(nullptr)) {
+      dispatcher->Satisfy(nullptr);
+      return WaitResult::kSuccess;
+    }
+  }
+  return WaitMultiple(&wait_handle, 1, false, is_alertable, timeout).first;
+}
+
+WaitResult SignalAndWait(WaitHandle* wait_handle_to_signal,
+                         WaitHandle* wait_handle_to_wait_on, bool is_alertable,
+                         std::chrono::milliseconds timeout) {
+  // Not atomic as on Windows, but no wake of the waited object is missed.
+  if (auto event = dynamic_cast<Event*>(wait_handle_to_signal)) {
+    event->Set();
+  } else if (auto semaphore = dynamic_cast<Semaphore*>(wait_handle_to_signal)) {
+    if (!semaphore->Release(1, nullptr)) {
+      return WaitResult::kFailed;
+    }
+  } else if (auto mutant = dynamic_cast<Mutant*>(wait_handle_to_signal)) {
+    if (!mutant->Release()) {
+      return WaitResult::kFailed;
+    }
+  } else {
+    return WaitResult::kFailed;
+  }
+  return Wait(wait_handle_to_wait_on, is_alertable, timeout);
+}
+
+class LinuxEvent : public LinuxHandle<Event> {
+ public:
+  LinuxEvent(bool manual_reset, bool initial_state)
+      : manual_reset_(manual_reset), signaled_(initial_state) {}
+  ~LinuxEvent() override = default;
+
+  bool IsSignaled(const Waiter* waiter) const override {
+    return signaled_ || IsPulsed(waiter);
+  }
+  void Satisfy(const Waiter* waiter) override {
+    if (!signaled_) {
+      // Released by a pulse, which an auto reset event gives to one waiter.
+      pulsed_waiter_ = nullptr;
+    } else if (!manual_reset_) {
+      signaled_ = false;
+    }
+  }
+
+  void Set() override {
+    std::lock_guard<std::mutex> lock(mutex());
+    signaled_ = true;
+    WakeWaiters();
+  }
+  void Reset() override {
+    std::lock_guard<std::mutex> lock(mutex());
+    signaled_ = false;
+  }
+  void Pulse() override {
+    // Releases the threads waiting now (or one of them for auto reset
+    // events). Threads that start waiting after it never see the pulse.
+    std::lock_guard<std::mutex> lock(mutex());
+    if (signaled_ || waiters_.empty()) {
+      return;
+    }
+    last_pulse_generation_ = ++pulse_generation;
+    if (manual_reset_) {
+      WakeWaiters();
+    } else {
+      auto waiter = waiters_.front();
+      pulsed_waiter_ = waiter;
+      WakeWaiter(waiter);
+    }
+  }
+
+ private:
+  bool IsPulsed(const Waiter* waiter) const {
+    // Registered waiters took their generation before the pulse, with the
+    // event locked.
+    if (!waiter || waiter->pulse_generation >= last_pulse_generation_) {
+      return false;
+    }
+    return manual_reset_ || waiter == pulsed_waiter_;
+  }
+
+  bool manual_reset_;
+  bool signaled_;
+  uint64_t last_pulse_generation_ = 0;
+  // The waiter an auto reset event was last pulsed for, until it takes it.
+  const Waiter* pulsed_waiter_ = nullptr;
+};
+
+std::unique_ptr<Event> Event::CreateManualResetEvent(bool initial_state) {
+  return std::make_unique<LinuxEvent>(true, initial_state);
+}
+
+std::unique_ptr<Event> Event::CreateAutoResetEvent(bool initial_state) {
+  return std::make_unique<LinuxEvent>(false, initial_state);
+}
+
+class LinuxSemaphore : public LinuxHandle<Semaphore> {
+ public:
+  LinuxSemaphore(int initial_count, int maximum_count)
+      : count_(initial_count), maximum_count_(maximum_count) {}
+  ~LinuxSemaphore() override = default;
+
+  bool IsSignaled(const Waiter* waiter) const override { return count_ > 0; }
+  void Satisfy(const Waiter* waiter) override { --count_; }
+
+  bool Release(int release_count, int* out_previous_count) override {
+    std::lock_guard<std::mutex> lock(mutex());
+    if (release_count <= 0 || release_count > maximum_count_ - count_) {
+      return false;
+    }
+    if (out_previous_count) {
+      *out_previous_count = count_;
+    }
+    count_ += release_count;
+    WakeWaiters();
+    return true;
+  }
+
+ private:
+  int count_;
+  int maximum_count_;
+};
+
+std::unique_ptr<Semaphore> Semaphore::Create(int initial_count,
+                                             int maximum_count) {
+  return std::make_unique<LinuxSemaphore>(initial_count, maximum_count);
+}
+
+class LinuxMutant : public LinuxHandle<Mutant> {
+ public:
+  explicit LinuxMutant(bool initial_owner) {
+    if (initial_owner) {
+      owner_ = std::this_thread::get_id();
+      recursion_count_ = 1;
+    }
+  }
+  ~LinuxMutant() override = default;
+
+  bool IsSignaled(const Waiter* waiter) const override {
+    return !recursion_count_ || owner_ == std::this_thread::get_id();
+  }
+  void Satisfy(const Waiter* waiter) override {
+    owner_ = std::this_thread::get_id();
+    ++recursion_count_;
+  }
+
+  bool Release() override {
+    std::lock_guard<std::mutex> lock(mutex());
+    if (!recursion_count_ || owner_ != std::this_thread::get_id()) {
+      return false;
+    }
+    if (!--recursion_count_) {
+      owner_ = std::thread::id();
+      WakeWaiters();
+    }
+    return true;
+  }
+
+ private:
+  std::thread::id owner_;
+  uint32_t recursion_count_ = 0;
+};
+
+std::unique_ptr<Mutant> Mutant::Create(bool initial_owner) {
+  return std::make_unique<LinuxMutant>(initial_owner);
+}
+
 }  // namespace threading
 }  // namespace xe
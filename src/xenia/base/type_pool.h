@@ -10,48 +10,88 @@
 #ifndef XENIA_BASE_TYPE_POOL_H_
 #define XENIA_BASE_TYPE_POOL_H_
 
-#include <mutex>
-#include <vector>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <new>
+#include <type_traits>
+
+#include "xenia/base/assert.h"
 
 namespace xe {
 
+// Recycles objects between threads without locking. Released objects are
+// kept on a lock-free stack, whose head pointer carries a counter in its
+// upper 16 bits so a pop can't be fooled by the same node being popped and
+// pushed again meanwhile (as user mode pointers on x64 are 48 bits).
+//
+// Reset must not race with Allocate or Release.
 template <class T, typename A>
 class TypePool {
  public:
   ~TypePool() { Reset(); }
 
   void Reset() {
-    std::lock_guard<std::mutex> guard(lock_);
-    for (auto it = list_.begin(); it != list_.end(); ++it) {
-      T* value = *it;
-      delete value;
+    uint64_t head = head_.exchange(0);
+    Node* node = node_pointer(head);
+    while (node) {
+      Node* next = node->next.load(std::memory_order_relaxed);
+      node->value()->~T();
+      delete node;
+      node = next;
     }
-    list_.clear();
   }
 
   T* Allocate(A arg0) {
-    T* result = 0;
-    {
-      std::lock_guard<std::mutex> guard(lock_);
-      if (list_.size()) {
-        result = list_.back();
-        list_.pop_back();
+    uint64_t head = head_.load(std::memory_order_acquire);
+    while (Node* node = node_pointer(head)) {
+      // The node may be popped by another thread before this one gets it,
+      // in which case the next pointer is stale but the exchange fails. Nodes
+      // aren't freed before Reset, so reading it is safe either way.
+      Node* next = node->next.load(std::memory_order_relaxed);
+      if (head_.compare_exchange_weak(head, pack(next, head),
+                                      std::memory_order_acquire,
+                                      std::memory_order_acquire)) {
+        return node->value();
       }
     }
-    if (!result) {
-      result = new T(arg0);
-    }
-    return result;
+    auto node = new Node();
+    new (&node->storage) T(arg0);
+    return node->value();
   }
 
   void Release(T* value) {
-    std::lock_guard<std::mutex> guard(lock_);
-    list_.push_back(value);
+    auto node = reinterpret_cast<Node*>(reinterpret_cast<uint8_t*>(value) -
+                                        offsetof(Node, storage));
+    uint64_t head = head_.load(std::memory_order_relaxed);
+    do {
+      node->next.store(node_pointer(head), std::memory_order_relaxed);
+    } while (!head_.compare_exchange_weak(head, pack(node, head),
+                                          std::memory_order_release,
+                                          std::memory_order_relaxed));
   }
 
  private:
-  std::mutex lock_;
-  std::vector<T*> list_;
+  struct Node {
+    std::atomic<Node*> next = {nullptr};
+    typename std::aligned_storage<sizeof(T), alignof(T)>::type storage;
+
+    T* value() { return reinterpret_cast<T*>(&storage); }
+  };
+
+  static const uint64_t kPointerMask = (1ull << 48) - 1;
+
+  static Node* node_pointer(uint64_t head) {
+    return reinterpret_cast<Node*>(head & kPointerMask);
+  }
+  // Packs the new head pointer with the counter of the old head, advanced.
+  static uint64_t pack(Node* node, uint64_t old_head) {
+    uint64_t pointer = uint64_t(node);
+    assert_true(!(pointer & ~kPointerMask));
+    return ((old_head & ~kPointerMask) + (1ull << 48)) | pointer;
+  }
+
+  std::atomic<uint64_t> head_ = {0};
 };
 
 }  // namespace xe
@@ -41,6 +41,10 @@ class Assembler {
                         uint32_t debug_info_flags,
                         std::unique_ptr<FunctionDebugInfo> debug_info) = 0;
 
+  // Installs previously generated code for the (scanned) function if the
+  // backend has a valid cached copy. Returns false if it must be translated.
+  virtual bool AssembleFromCache(GuestFunction* function) { return false; }
+
  protected:
   Backend* backend_;
 };
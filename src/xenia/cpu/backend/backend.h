@@ -10,7 +10,10 @@
 #ifndef XENIA_CPU_BACKEND_BACKEND_H_
 #define XENIA_CPU_BACKEND_BACKEND_H_
 
+#include <cstdint>
 #include <memory>
+#include <utility>
+#include <vector>
 
 #include "xenia/cpu/backend/machine_info.h"
 #include "xenia/cpu/thread_debug_info.h"
@@ -49,6 +52,11 @@ class Backend {
   virtual void CommitExecutableRange(uint32_t guest_low,
                                      uint32_t guest_high) = 0;
 
+  // Called once a guest module has been loaded into memory with its code
+  // occupying the given range.
+  virtual void OnModuleLoaded(Module* module, uint32_t guest_low,
+                              uint32_t guest_high) {}
+
   virtual std::unique_ptr<Assembler> CreateAssembler() = 0;
 
   virtual std::unique_ptr<GuestFunction> CreateGuestFunction(
@@ -63,6 +71,25 @@ class Backend {
   virtual void InstallBreakpoint(Breakpoint* breakpoint) {}
   virtual void InstallBreakpoint(Breakpoint* breakpoint, Function* fn) {}
   virtual void UninstallBreakpoint(Breakpoint* breakpoint) {}
+  // Returns code that runs the instructions displaced by the breakpoint
+  // installed at host_pc and then continues after them, so that a thread can
+  // resume past it while it stays installed. 0 if the breakpoint must be
+  // uninstalled to resume.
+  virtual uint64_t LookupBreakpointTrampoline(uint64_t host_pc) { return 0; }
+
+  // Points calls to the function back at ResolveFunction and retires its
+  // code, once a write to its guest code left the code stale.
+  virtual void InvalidateFunction(GuestFunction* function) {}
+
+  // True if replaced code is waiting to be reclaimed.
+  virtual bool HasReclaimableCode() { return false; }
+  // Frees replaced code that is not referenced by host_pcs, which must hold
+  // the program counters and return addresses of every suspended thread.
+  virtual void ReclaimCode(const std::vector<uint64_t>& host_pcs) {}
+
+  // Appends the host memory used by the backend, in bytes by name.
+  virtual void GetMemoryUsage(
+      std::vector<std::pair<const char*, uint64_t>>* usage) {}
 
  protected:
   Processor* processor_;
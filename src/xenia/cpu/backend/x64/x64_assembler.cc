@@ -10,9 +10,12 @@
 #include "xenia/cpu/backend/x64/x64_assembler.h"
 
 #include <climits>
+#include <cstring>
 
 #include "third_party/capstone/include/capstone.h"
 #include "third_party/capstone/include/x86.h"
+#include "xenia/base/assert.h"
+#include "xenia/base/atomic.h"
 #include "xenia/base/profiling.h"
 #include "xenia/base/reset_scope.h"
 #include "xenia/cpu/backend/x64/x64_backend.h"
@@ -23,6 +26,7 @@
 #include "xenia/cpu/hir/hir_builder.h"
 #include "xenia/cpu/hir/label.h"
 #include "xenia/cpu/processor.h"
+#include "xenia/memory.h"
 
 namespace xe {
 namespace cpu {
@@ -91,19 +95,137 @@ bool X64Assembler::Assemble(GuestFunction* function, HIRBuilder* builder,
   }
 
   function->set_debug_info(std::move(debug_info));
+  if (!InstallMachineCode(function, machine_code, code_size)) {
+    // Stale already, so not worth caching.
+    return true;
+  }
+
+  if (emitter_->is_cacheable()) {
+    StoreInPersistentCache(function, machine_code, code_size);
+  }
+
+  return true;
+}
+
+bool X64Assembler::AssembleFromCache(GuestFunction* function) {
+  SCOPE_profile_cpu_f("cpu");
+
+  auto persistent_cache =
+      x64_backend_->LookupPersistentCache(function->address());
+  if (!persistent_cache) {
+    return false;
+  }
+  if (x64_backend_->HasMMIOSites(function->address(),
+                                 function->end_address())) {
+    // Cached code predates what we've learned about its MMIO accesses.
+    return false;
+  }
+
+  X64PersistentCache::Entry entry;
+  if (!persistent_cache->Lookup(function->address(), function->end_address(),
+                                HashFunctionSource(function), &entry)) {
+    return false;
+  }
+  if (!x64_backend_->ApplyRelocations(entry.code.data(), entry.code.size(),
+                                      entry.relocations)) {
+    return false;
+  }
+
+  // Placing the code also points the indirection table at it.
+  auto machine_code = x64_backend_->code_cache()->PlaceGuestCode(
+      function->address(), entry.code.data(), entry.code.size(),
+      entry.stack_size, function, &entry.call_sites);
+  function->source_map() = std::move(entry.source_map);
+  InstallMachineCode(function, machine_code, entry.code.size());
+
+  return true;
+}
+
+bool X64Assembler::InstallMachineCode(GuestFunction* function,
+                                      void* machine_code, size_t code_size) {
+  // Checked with the lock held, as invalidation takes it too.
+  auto global_lock = global_critical_region_.Acquire();
+  auto code_cache = x64_backend_->code_cache();
+  if (function->is_invalidated()) {
+    // Its code changed while being translated, so the next call translates
+    // it again. The placed code was never made reachable.
+    code_cache->RetireCode(machine_code);
+    return false;
+  }
+  auto previous_code = static_cast<X64Function*>(function)->machine_code();
   static_cast<X64Function*>(function)->Setup(
       reinterpret_cast<uint8_t*>(machine_code), code_size);
 
   // Install into indirection table.
   uint64_t host_address = reinterpret_cast<uint64_t>(machine_code);
   assert_true((host_address >> 32) == 0);
-  reinterpret_cast<X64CodeCache*>(backend_->code_cache())
-      ->AddIndirection(function->address(),
-                       static_cast<uint32_t>(host_address));
-
+  code_cache->AddIndirection(function->address(),
+                             static_cast<uint32_t>(host_address));
+  if (previous_code) {
+    RetireMachineCode(function, previous_code, machine_code);
+  }
   return true;
 }
 
+void X64Assembler::RedirectMachineCode(uint8_t* old_code, void* new_code) {
+  // Code compiled against the old version may still call it directly, so
+  // overwrite its first instruction (the 7 byte sub rsp) with a jmp to the new
+  // version. Code is 16b aligned so this can be done with one atomic store,
+  // keeping the tail bytes intact for anyone mid-decode.
+  assert_zero(reinterpret_cast<uintptr_t>(old_code) & 0x7);
+  auto rel32 = int32_t(reinterpret_cast<intptr_t>(new_code) -
+                       reinterpret_cast<intptr_t>(old_code + 5));
+  uint8_t patch[8];
+  std::memcpy(patch, old_code, sizeof(patch));
+  patch[0] = 0xE9;  // jmp rel32
+  std::memcpy(patch + 1, &rel32, sizeof(rel32));
+  int64_t patch_value;
+  std::memcpy(&patch_value, patch, sizeof(patch_value));
+  xe::atomic_exchange(patch_value,
+                      reinterpret_cast<volatile int64_t*>(old_code));
+}
+
+void X64Assembler::RetireMachineCode(GuestFunction* function,
+                                     uint8_t* old_code, void* new_code) {
+  RedirectMachineCode(old_code, new_code);
+  // Once nothing links to the old code directly it can be reclaimed as soon
+  // as no thread is running it.
+  x64_backend_->RetargetInlineCaches(
+      function->address(), uint32_t(reinterpret_cast<uintptr_t>(new_code)));
+  x64_backend_->code_cache()->RetireCode(old_code);
+}
+
+uint64_t X64Assembler::HashFunctionSource(GuestFunction* function) {
+  auto memory = backend_->processor()->memory();
+  return X64PersistentCache::HashSource(
+      memory->TranslateVirtual(function->address()),
+      function->end_address() - function->address() + 4);
+}
+
+void X64Assembler::StoreInPersistentCache(GuestFunction* function,
+                                          void* machine_code,
+                                          size_t code_size) {
+  auto persistent_cache =
+      x64_backend_->LookupPersistentCache(function->address());
+  if (!persistent_cache) {
+    return;
+  }
+
+  // Stored with the current values in place; they are all overwritten by
+  // relocations when loaded.
+  X64PersistentCache::Entry entry;
+  entry.guest_address = function->address();
+  entry.guest_end_address = function->end_address();
+  entry.source_hash = HashFunctionSource(function);
+  entry.stack_size = static_cast<uint32_t>(emitter_->stack_size());
+  auto code = reinterpret_cast<const uint8_t*>(machine_code);
+  entry.code.assign(code, code + code_size);
+  entry.relocations = emitter_->relocations();
+  entry.call_sites = emitter_->call_sites();
+  entry.source_map = function->source_map();
+  persistent_cache->Store(std::move(entry));
+}
+
 void X64Assembler::DumpMachineCode(
     void* machine_code, size_t code_size,
     const std::vector<SourceMapEntry>& source_map, StringBuffer* str) {
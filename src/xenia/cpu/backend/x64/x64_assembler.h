@@ -13,6 +13,7 @@
 #include <memory>
 #include <vector>
 
+#include "xenia/base/mutex.h"
 #include "xenia/base/string_buffer.h"
 #include "xenia/cpu/backend/assembler.h"
 #include "xenia/cpu/function.h"
@@ -39,11 +40,25 @@ class X64Assembler : public Assembler {
                 uint32_t debug_info_flags,
                 std::unique_ptr<FunctionDebugInfo> debug_info) override;
 
+  bool AssembleFromCache(GuestFunction* function) override;
+
  private:
   void DumpMachineCode(void* machine_code, size_t code_size,
                        const std::vector<SourceMapEntry>& source_map,
                        StringBuffer* str);
 
+  // Makes placed code the function's, unless the function was invalidated
+  // while it was translated, in which case it is retired instead.
+  bool InstallMachineCode(GuestFunction* function, void* machine_code,
+                          size_t code_size);
+  static void RedirectMachineCode(uint8_t* old_code, void* new_code);
+  // Redirects and retires code replaced by a retranslation of the function.
+  void RetireMachineCode(GuestFunction* function, uint8_t* old_code,
+                         void* new_code);
+  uint64_t HashFunctionSource(GuestFunction* function);
+  void StoreInPersistentCache(GuestFunction* function, void* machine_code,
+                              size_t code_size);
+
  private:
   X64Backend* x64_backend_;
   std::unique_ptr<X64Emitter> emitter_;
@@ -51,6 +66,7 @@ class X64Assembler : public Assembler {
   uintptr_t capstone_handle_;
 
   StringBuffer string_buffer_;
+  xe::global_critical_region global_critical_region_;
 };
 
 }  // namespace x64
@@ -9,9 +9,15 @@
 
 #include "xenia/cpu/backend/x64/x64_backend.h"
 
+#include <algorithm>
+#include <cstring>
+
 #include "third_party/capstone/include/capstone.h"
 #include "third_party/capstone/include/x86.h"
+#include "xenia/base/atomic.h"
 #include "xenia/base/exception_handler.h"
+#include "xenia/base/logging.h"
+#include "xenia/base/string.h"
 #include "xenia/cpu/backend/x64/x64_assembler.h"
 #include "xenia/cpu/backend/x64/x64_code_cache.h"
 #include "xenia/cpu/backend/x64/x64_emitter.h"
@@ -19,12 +25,23 @@
 #include "xenia/cpu/backend/x64/x64_sequences.h"
 #include "xenia/cpu/backend/x64/x64_stack_layout.h"
 #include "xenia/cpu/breakpoint.h"
+#include "xenia/cpu/cpu_flags.h"
+#include "xenia/cpu/module.h"
 #include "xenia/cpu/processor.h"
 #include "xenia/cpu/stack_walker.h"
 
 DEFINE_bool(
     enable_haswell_instructions, true,
     "Uses the AVX2/FMA/etc instructions on Haswell processors, if available.");
+DEFINE_int32(inline_cache_size, 4,
+             "Number of targets cached at indirect call sites (max 4). 0 to "
+             "always dispatch through the indirection table.");
+DEFINE_bool(dump_inline_cache_stats, false,
+            "Log inline cache hit/miss counts for the busiest indirect call "
+            "sites on shutdown.");
+DEFINE_bool(learn_mmio_sites, true,
+            "Retranslate functions whose loads and stores trap on MMIO to "
+            "call the MMIO handlers directly.");
 
 namespace xe {
 namespace cpu {
@@ -38,6 +55,7 @@ class X64ThunkEmitter : public X64Emitter {
   HostToGuestThunk EmitHostToGuestThunk();
   GuestToHostThunk EmitGuestToHostThunk();
   ResolveFunctionThunk EmitResolveFunctionThunk();
+  void* EmitCallLinkStub();
 };
 
 X64Backend::X64Backend(Processor* processor)
@@ -51,6 +69,10 @@ X64Backend::X64Backend(Processor* processor)
 }
 
 X64Backend::~X64Backend() {
+  if (FLAGS_dump_inline_cache_stats) {
+    DumpInlineCacheStats();
+  }
+
   if (emitter_data_) {
     processor()->memory()->SystemHeapFree(emitter_data_);
     emitter_data_ = 0;
@@ -60,6 +82,9 @@ X64Backend::~X64Backend() {
   }
 
   ExceptionHandler::Uninstall(&ExceptionCallbackThunk, this);
+  if (FLAGS_learn_mmio_sites && MMIOHandler::global_handler()) {
+    MMIOHandler::global_handler()->set_fault_callback(nullptr, nullptr);
+  }
 }
 
 bool X64Backend::Initialize() {
@@ -110,6 +135,12 @@ bool X64Backend::Initialize() {
   code_cache_->set_indirection_default(
       uint32_t(uint64_t(resolve_function_thunk_)));
 
+  // Guest calls are patched to direct calls when possible, falling back to
+  // the indirection table via this stub.
+  if (FLAGS_link_direct_calls) {
+    code_cache_->set_call_link_stub(thunk_emitter.EmitCallLinkStub());
+  }
+
   // Allocate some special indirections.
   code_cache_->CommitExecutableRange(0x9FFF0000, 0x9FFFFFFF);
 
@@ -118,6 +149,10 @@ bool X64Backend::Initialize() {
 
   // Setup exception callback
   ExceptionHandler::Install(&ExceptionCallbackThunk, this);
+  if (FLAGS_learn_mmio_sites && MMIOHandler::global_handler()) {
+    MMIOHandler::global_handler()->set_fault_callback(&MMIOFaultCallbackThunk,
+                                                      this);
+  }
 
   return true;
 }
@@ -127,6 +162,279 @@ void X64Backend::CommitExecutableRange(uint32_t guest_low,
   code_cache_->CommitExecutableRange(guest_low, guest_high);
 }
 
+void X64Backend::OnModuleLoaded(Module* module, uint32_t guest_low,
+                                uint32_t guest_high) {
+  if (FLAGS_code_cache_path.empty()) {
+    return;
+  }
+  if (!code_cache_->host_image_identity()) {
+    XELOGW("Persistent code cache is not supported on this host");
+    return;
+  }
+
+  // Everything the generated code depends on that isn't relocated must match
+  // for the cache to be reused. The module hash covers all of its code so
+  // that anything derived from other functions (call targets, prolog/epilog
+  // helpers, etc) is identical too.
+  X64PersistentCache::Header header = {0};
+  header.magic = X64PersistentCache::kFileMagic;
+  header.version = X64PersistentCache::kFileVersion;
+  header.host_image_identity = code_cache_->host_image_identity();
+  header.module_hash = X64PersistentCache::HashSource(
+      processor()->memory()->TranslateVirtual(guest_low),
+      guest_high - guest_low);
+  header.guest_low = guest_low;
+  header.guest_high = guest_high;
+  header.feature_flags = X64Emitter::QueryFeatureFlags();
+  header.emitter_data = emitter_data_;
+  header.host_to_guest_thunk = uint32_t(uint64_t(host_to_guest_thunk_));
+  header.guest_to_host_thunk = uint32_t(uint64_t(guest_to_host_thunk_));
+  header.resolve_function_thunk = uint32_t(uint64_t(resolve_function_thunk_));
+  if (code_cache_->has_call_linking()) {
+    header.options |= X64PersistentCache::kOptionCallLinking;
+  }
+
+  auto file_name = xe::format_string(L"%S.%.16llX.xcc", module->name().c_str(),
+                                     header.module_hash);
+  auto path =
+      xe::join_paths(xe::to_wstring(FLAGS_code_cache_path), file_name);
+  auto persistent_cache =
+      X64PersistentCache::Open(path, header, FLAGS_code_cache_read_only);
+  if (!persistent_cache) {
+    return;
+  }
+
+  auto global_lock = global_critical_region_.Acquire();
+  persistent_caches_.push_back(std::move(persistent_cache));
+}
+
+X64PersistentCache* X64Backend::LookupPersistentCache(uint32_t guest_address) {
+  auto global_lock = global_critical_region_.Acquire();
+  for (auto& persistent_cache : persistent_caches_) {
+    if (persistent_cache->ContainsAddress(guest_address)) {
+      return persistent_cache.get();
+    }
+  }
+  return nullptr;
+}
+
+X64InlineCache* X64Backend::AllocateInlineCache(uint32_t guest_address) {
+  X64InlineCache initial_state = {0};
+  initial_state.guest_address = guest_address;
+  auto inline_cache =
+      reinterpret_cast<X64InlineCache*>(uintptr_t(code_cache_->PlaceData(
+          &initial_state, sizeof(initial_state))));
+
+  auto global_lock = global_critical_region_.Acquire();
+  inline_caches_.push_back(inline_cache);
+  return inline_cache;
+}
+
+uint32_t X64Backend::OnInlineCacheMiss(X64InlineCache* inline_cache,
+                                       uint32_t target_address) {
+  // Whatever the indirection table holds is what the site would have called
+  // anyway: either the generated code or the ResolveFunction thunk.
+  uint32_t host_address =
+      *reinterpret_cast<uint32_t*>(uintptr_t(target_address));
+  if (host_address == uint32_t(uint64_t(resolve_function_thunk_))) {
+    // Not generated yet. We'll pick it up on the next miss.
+    return host_address;
+  }
+
+  auto global_lock = global_critical_region_.Acquire();
+  if (!inline_cache->code_address ||
+      inline_cache->entry_count >= inline_cache->entry_capacity) {
+    return host_address;
+  }
+  for (uint32_t i = 0; i < inline_cache->entry_count; ++i) {
+    if (inline_cache->entry_targets[i] == target_address) {
+      // Another thread added it while we were on our way here.
+      return host_address;
+    }
+  }
+
+  // Point the branch at the target before enabling the compare, so a thread
+  // racing through the entry never matches without a valid branch.
+  uint32_t n = inline_cache->entry_count;
+  auto code = reinterpret_cast<uint8_t*>(uintptr_t(inline_cache->code_address));
+  uint8_t* branch = code + inline_cache->entry_branch_offsets[n];
+  uint8_t* compare = code + inline_cache->entry_compare_offsets[n];
+  auto rel32 = int32_t(int64_t(host_address) -
+                       int64_t(reinterpret_cast<uintptr_t>(branch + 4)));
+  xe::atomic_exchange(rel32, reinterpret_cast<volatile int32_t*>(branch));
+  xe::atomic_exchange(int32_t(target_address),
+                      reinterpret_cast<volatile int32_t*>(compare));
+  inline_cache->entry_targets[n] = target_address;
+  inline_cache->entry_count = n + 1;
+  return host_address;
+}
+
+void X64Backend::RetargetInlineCaches(uint32_t target_address,
+                                      uint32_t host_address) {
+  auto global_lock = global_critical_region_.Acquire();
+  for (auto inline_cache : inline_caches_) {
+    if (!inline_cache->code_address) {
+      continue;
+    }
+    auto code =
+        reinterpret_cast<uint8_t*>(uintptr_t(inline_cache->code_address));
+    for (uint32_t i = 0; i < inline_cache->entry_count; ++i) {
+      if (inline_cache->entry_targets[i] != target_address) {
+        continue;
+      }
+      uint8_t* branch = code + inline_cache->entry_branch_offsets[i];
+      auto rel32 = int32_t(int64_t(host_address) -
+                           int64_t(reinterpret_cast<uintptr_t>(branch + 4)));
+      xe::atomic_exchange(rel32, reinterpret_cast<volatile int32_t*>(branch));
+    }
+  }
+}
+
+void X64Backend::DropInlineCacheEntries(uint32_t target_address) {
+  auto global_lock = global_critical_region_.Acquire();
+  for (auto inline_cache : inline_caches_) {
+    if (!inline_cache->code_address) {
+      continue;
+    }
+    auto code =
+        reinterpret_cast<uint8_t*>(uintptr_t(inline_cache->code_address));
+    for (uint32_t i = 0; i < inline_cache->entry_count; ++i) {
+      if (inline_cache->entry_targets[i] != target_address) {
+        continue;
+      }
+      // No guest code is at 0, and the entry isn't used again.
+      uint8_t* compare = code + inline_cache->entry_compare_offsets[i];
+      xe::atomic_exchange(int32_t(0),
+                          reinterpret_cast<volatile int32_t*>(compare));
+      inline_cache->entry_targets[i] = 0;
+    }
+  }
+}
+
+void X64Backend::InvalidateFunction(GuestFunction* function) {
+  // Calls go through the ResolveFunction thunk again, which translates the
+  // function anew, and nothing is left branching to the old code directly.
+  code_cache_->AddIndirection(function->address(),
+                              uint32_t(uint64_t(resolve_function_thunk_)));
+  DropInlineCacheEntries(function->address());
+  auto x64_function = static_cast<X64Function*>(function);
+  if (x64_function->machine_code()) {
+    // Freed once no thread is running it.
+    code_cache_->RetireCode(x64_function->machine_code());
+    x64_function->Setup(nullptr, 0);
+  }
+}
+
+bool X64Backend::HasReclaimableCode() {
+  return code_cache_->ShouldReclaimCode();
+}
+
+void X64Backend::GetMemoryUsage(
+    std::vector<std::pair<const char*, uint64_t>>* usage) {
+  usage->emplace_back("cpu.code", code_cache_->QueryStats().committed_size);
+  uint64_t private_size = 0;
+  uint64_t mapped_size = 0;
+  {
+    auto global_lock = global_critical_region_.Acquire();
+    for (auto& persistent_cache : persistent_caches_) {
+      private_size += persistent_cache->private_size();
+      mapped_size += persistent_cache->mapped_size();
+    }
+  }
+  usage->emplace_back("cpu.code_cache", private_size);
+  usage->emplace_back("cpu.code_cache_mapped", mapped_size);
+}
+
+void X64Backend::ReclaimCode(const std::vector<uint64_t>& host_pcs) {
+  auto freed = code_cache_->ReclaimCode(host_pcs);
+  if (freed.empty()) {
+    return;
+  }
+
+  // Inline caches owned by freed code must never be patched again.
+  auto global_lock = global_critical_region_.Acquire();
+  uint64_t code_base = code_cache_->base_address();
+  for (auto it = inline_caches_.begin(); it != inline_caches_.end();) {
+    auto inline_cache = *it;
+    uint64_t offset = inline_cache->code_address - code_base;
+    auto range = std::upper_bound(
+        freed.begin(), freed.end(),
+        X64CodeCache::CodeRange(uint32_t(offset), UINT32_MAX));
+    if (inline_cache->code_address && range != freed.begin() &&
+        offset < std::prev(range)->second) {
+      inline_cache->code_address = 0;
+      it = inline_caches_.erase(it);
+    } else {
+      ++it;
+    }
+  }
+}
+
+void X64Backend::DumpInlineCacheStats() {
+  auto global_lock = global_critical_region_.Acquire();
+  auto sorted_caches = inline_caches_;
+  std::sort(sorted_caches.begin(), sorted_caches.end(),
+            [](const X64InlineCache* a, const X64InlineCache* b) {
+              return a->call_count > b->call_count;
+            });
+  XELOGI("Inline cache stats (%d sites):", int(sorted_caches.size()));
+  size_t count = std::min(sorted_caches.size(), size_t(100));
+  for (size_t i = 0; i < count; ++i) {
+    auto inline_cache = sorted_caches[i];
+    if (!inline_cache->call_count) {
+      break;
+    }
+    bool megamorphic =
+        inline_cache->entry_count == inline_cache->entry_capacity &&
+        inline_cache->miss_count > inline_cache->call_count / 2;
+    XELOGI("  %.8X: %10u calls, %10u misses, %u targets%s",
+           inline_cache->guest_address, inline_cache->call_count,
+           inline_cache->miss_count, inline_cache->entry_count,
+           megamorphic ? " (megamorphic)" : "");
+  }
+}
+
+bool X64Backend::ApplyRelocations(
+    uint8_t* code, size_t code_size,
+    const std::vector<X64CodeRelocation>& relocations) {
+  for (auto& relocation : relocations) {
+    if (relocation.code_offset + sizeof(uint64_t) > code_size) {
+      return false;
+    }
+    uint64_t value = 0;
+    switch (relocation.type) {
+      case X64CodeRelocation::Type::kHostImage:
+        if (relocation.key >= code_cache_->host_image_size()) {
+          return false;
+        }
+        value = code_cache_->host_image_base() + relocation.key;
+        break;
+      case X64CodeRelocation::Type::kBuiltinArg0:
+      case X64CodeRelocation::Type::kBuiltinArg1: {
+        auto symbol = processor()->builtin_module()->LookupSymbol(
+            uint32_t(relocation.key), false);
+        if (!symbol || symbol->type() != Symbol::Type::kFunction) {
+          return false;
+        }
+        auto function = static_cast<Function*>(symbol);
+        if (function->behavior() != Function::Behavior::kBuiltin) {
+          return false;
+        }
+        auto builtin_function = static_cast<BuiltinFunction*>(function);
+        value = reinterpret_cast<uint64_t>(
+            relocation.type == X64CodeRelocation::Type::kBuiltinArg0
+                ? builtin_function->arg0()
+                : builtin_function->arg1());
+        break;
+      }
+      default:
+        return false;
+    }
+    std::memcpy(code + relocation.code_offset, &value, sizeof(value));
+  }
+  return true;
+}
+
 std::unique_ptr<Assembler> X64Backend::CreateAssembler() {
   return std::make_unique<X64Assembler>(this);
 }
@@ -321,10 +629,11 @@ uint64_t X64Backend::CalculateNextHostInstruction(ThreadDebugInfo* thread_info,
 }
 
 void X64Backend::InstallBreakpoint(Breakpoint* breakpoint) {
-  breakpoint->ForEachHostAddress([breakpoint](uint64_t host_address) {
+  breakpoint->ForEachHostAddress([this, breakpoint](uint64_t host_address) {
     auto ptr = reinterpret_cast<void*>(host_address);
     auto original_bytes = xe::load_and_swap<uint16_t>(ptr);
     assert_true(original_bytes != 0x0F0B);
+    PrepareBreakpointTrampoline(host_address);
     xe::store_and_swap<uint16_t>(ptr, 0x0F0B);
     breakpoint->backend_data().emplace_back(host_address, original_bytes);
   });
@@ -345,6 +654,7 @@ void X64Backend::InstallBreakpoint(Breakpoint* breakpoint, Function* fn) {
   auto ptr = reinterpret_cast<void*>(host_address);
   auto original_bytes = xe::load_and_swap<uint16_t>(ptr);
   assert_true(original_bytes != 0x0F0B);
+  PrepareBreakpointTrampoline(host_address);
   xe::store_and_swap<uint16_t>(ptr, 0x0F0B);
   breakpoint->backend_data().emplace_back(host_address, original_bytes);
 }
@@ -359,6 +669,92 @@ void X64Backend::UninstallBreakpoint(Breakpoint* breakpoint) {
   breakpoint->backend_data().clear();
 }
 
+void X64Backend::PrepareBreakpointTrampoline(uint64_t host_address) {
+  auto code = reinterpret_cast<const uint8_t*>(host_address);
+  auto it = breakpoint_trampolines_.find(host_address);
+  if (it != breakpoint_trampolines_.end()) {
+    auto& trampoline = it->second;
+    if (!std::memcmp(trampoline.displaced_bytes, code,
+                     trampoline.displaced_length)) {
+      return;
+    }
+    breakpoint_trampolines_.erase(it);
+  }
+
+  // The ud2 covers the first two bytes, so whole instructions up to there are
+  // displaced. They are only copied if they don't depend on where they run:
+  // no rip-relative or control flow instructions, and no memory operands
+  // other than the stack and context, which can't fault into handlers that
+  // look up the faulting code.
+  const uint8_t* machine_code_ptr = code;
+  size_t remaining_machine_code_size = 16;
+  uint64_t address = host_address;
+  uint32_t displaced_length = 0;
+  cs_insn insn = {0};
+  cs_detail all_detail = {0};
+  insn.detail = &all_detail;
+  while (displaced_length < 2) {
+    if (!cs_disasm_iter(capstone_handle_, &machine_code_ptr,
+                        &remaining_machine_code_size, &address, &insn)) {
+      return;
+    }
+    if (cs_insn_group(capstone_handle_, &insn, CS_GRP_JUMP) ||
+        cs_insn_group(capstone_handle_, &insn, CS_GRP_CALL) ||
+        cs_insn_group(capstone_handle_, &insn, CS_GRP_RET) ||
+        cs_insn_group(capstone_handle_, &insn, CS_GRP_INT) ||
+        cs_insn_group(capstone_handle_, &insn, CS_GRP_IRET)) {
+      return;
+    }
+    auto& detail = all_detail.x86;
+    for (uint8_t i = 0; i < detail.op_count; ++i) {
+      auto& operand = detail.operands[i];
+      if (operand.type == X86_OP_MEM &&
+          ((operand.mem.base != X86_REG_RSP &&
+            operand.mem.base != X86_REG_RSI) ||
+           operand.mem.index != X86_REG_INVALID)) {
+        return;
+      }
+    }
+    displaced_length += insn.size;
+  }
+
+  // Displaced instructions followed by a jmp rel32 back. Data placed in the
+  // code cache is executable and within range of all generated code.
+  uint8_t buffer[16 + 5];
+  std::memcpy(buffer, code, displaced_length);
+  buffer[displaced_length] = 0xE9;
+  uint32_t trampoline_address = code_cache_->PlaceData(buffer, sizeof(buffer));
+  int64_t displacement = int64_t(host_address + displaced_length) -
+                         int64_t(trampoline_address + displaced_length + 5);
+  assert_true(displacement == int32_t(displacement));
+  xe::store<int32_t>(
+      reinterpret_cast<void*>(trampoline_address + displaced_length + 1),
+      int32_t(displacement));
+
+  BreakpointTrampoline trampoline;
+  std::memcpy(trampoline.displaced_bytes, code, displaced_length);
+  trampoline.displaced_length = displaced_length;
+  trampoline.address = trampoline_address;
+  breakpoint_trampolines_.emplace(host_address, trampoline);
+}
+
+uint64_t X64Backend::LookupBreakpointTrampoline(uint64_t host_pc) {
+  auto it = breakpoint_trampolines_.find(host_pc);
+  if (it == breakpoint_trampolines_.end() ||
+      xe::load_and_swap<uint16_t>(reinterpret_cast<void*>(host_pc)) !=
+          0x0F0B) {
+    return 0;
+  }
+  auto& trampoline = it->second;
+  // Everything past the ud2 must still be what was copied.
+  if (std::memcmp(trampoline.displaced_bytes + 2,
+                  reinterpret_cast<const uint8_t*>(host_pc) + 2,
+                  trampoline.displaced_length - 2)) {
+    return 0;
+  }
+  return trampoline.address;
+}
+
 bool X64Backend::ExceptionCallbackThunk(Exception* ex, void* data) {
   auto backend = reinterpret_cast<X64Backend*>(data);
   return backend->ExceptionCallback(ex);
@@ -384,6 +780,47 @@ bool X64Backend::ExceptionCallback(Exception* ex) {
   return processor()->OnThreadBreakpointHit(ex);
 }
 
+void X64Backend::MMIOFaultCallbackThunk(void* context, uint64_t host_pc,
+                                        const MMIORange* range) {
+  reinterpret_cast<X64Backend*>(context)->OnMMIOFault(host_pc, range);
+}
+
+void X64Backend::OnMMIOFault(uint64_t host_pc, const MMIORange* range) {
+  auto function = code_cache_->LookupFunction(host_pc);
+  if (!function) {
+    return;
+  }
+  auto code = reinterpret_cast<uint64_t>(function->machine_code());
+  if (host_pc < code || host_pc >= code + function->machine_code_length()) {
+    // Old code that has since been replaced.
+    return;
+  }
+  uint32_t guest_address =
+      function->MapMachineCodeToGuestAddress(uintptr_t(host_pc));
+  {
+    auto global_lock = global_critical_region_.Acquire();
+    if (!mmio_sites_.emplace(guest_address, range).second) {
+      // Already known; the new code is on its way.
+      return;
+    }
+  }
+  XELOGD("Retranslating %.8X for MMIO access at %.8X", function->address(),
+         guest_address);
+  processor()->RetranslateFunction(function);
+}
+
+const MMIORange* X64Backend::LookupMMIOSite(uint32_t guest_address) {
+  auto global_lock = global_critical_region_.Acquire();
+  auto it = mmio_sites_.find(guest_address);
+  return it != mmio_sites_.end() ? it->second : nullptr;
+}
+
+bool X64Backend::HasMMIOSites(uint32_t guest_low, uint32_t guest_high) {
+  auto global_lock = global_critical_region_.Acquire();
+  auto it = mmio_sites_.lower_bound(guest_low);
+  return it != mmio_sites_.end() && it->first <= guest_high;
+}
+
 X64ThunkEmitter::X64ThunkEmitter(X64Backend* backend, XbyakAllocator* allocator)
     : X64Emitter(backend, allocator) {}
 
@@ -393,16 +830,14 @@ HostToGuestThunk X64ThunkEmitter::EmitHostToGuestThunk() {
   // rcx = target
   // rdx = arg0
   // r8 = arg1
+  // Only the registers the host expects preserved are saved: rcx, rdx and r8
+  // are volatile, so they are neither spilled nor restored.
 
   const size_t stack_size = StackLayout::THUNK_STACK_SIZE;
   // rsp + 0 = return address
-  mov(qword[rsp + 8 * 3], r8);
-  mov(qword[rsp + 8 * 2], rdx);
-  mov(qword[rsp + 8 * 1], rcx);
   sub(rsp, stack_size);
 
   mov(qword[rsp + 48], rbx);
-  mov(qword[rsp + 56], rcx);
   mov(qword[rsp + 64], rbp);
   mov(qword[rsp + 72], rsi);
   mov(qword[rsp + 80], rdi);
@@ -439,7 +874,6 @@ HostToGuestThunk X64ThunkEmitter::EmitHostToGuestThunk() {
   movaps(xmm15, ptr[rsp + 272]);*/
 
   mov(rbx, qword[rsp + 48]);
-  mov(rcx, qword[rsp + 56]);
   mov(rbp, qword[rsp + 64]);
   mov(rsi, qword[rsp + 72]);
   mov(rdi, qword[rsp + 80]);
@@ -449,9 +883,6 @@ HostToGuestThunk X64ThunkEmitter::EmitHostToGuestThunk() {
   mov(r15, qword[rsp + 112]);
 
   add(rsp, stack_size);
-  mov(rcx, qword[rsp + 8 * 1]);
-  mov(rdx, qword[rsp + 8 * 2]);
-  mov(r8, qword[rsp + 8 * 3]);
   ret();
 
   void* fn = Emplace(stack_size);
@@ -554,6 +985,16 @@ ResolveFunctionThunk X64ThunkEmitter::EmitResolveFunctionThunk() {
   return (ResolveFunctionThunk)fn;
 }
 
+void* X64ThunkEmitter::EmitCallLinkStub() {
+  // ebx = target PPC address
+  // Entered by call/jmp from an unlinked call site, so this must leave the
+  // stack untouched for the target (or the ResolveFunction thunk).
+  mov(eax, dword[ebx]);
+  jmp(rax);
+
+  return Emplace(0);
+}
+
 }  // namespace x64
 }  // namespace backend
 }  // namespace cpu
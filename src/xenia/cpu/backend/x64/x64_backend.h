@@ -12,11 +12,18 @@
 
 #include <gflags/gflags.h>
 
+#include <map>
 #include <memory>
+#include <unordered_map>
+#include <vector>
 
+#include "xenia/base/mutex.h"
 #include "xenia/cpu/backend/backend.h"
+#include "xenia/cpu/backend/x64/x64_persistent_cache.h"
+#include "xenia/cpu/mmio_handler.h"
 
 DECLARE_bool(enable_haswell_instructions);
+DECLARE_int32(inline_cache_size);
 
 namespace xe {
 class Exception;
@@ -56,6 +63,42 @@ class X64Backend : public Backend {
   bool Initialize() override;
 
   void CommitExecutableRange(uint32_t guest_low, uint32_t guest_high) override;
+  void OnModuleLoaded(Module* module, uint32_t guest_low,
+                      uint32_t guest_high) override;
+
+  // Returns the persistent code cache covering the guest address, if any.
+  X64PersistentCache* LookupPersistentCache(uint32_t guest_address);
+  // Patches cached code for use in this process. Returns false if any
+  // relocation can no longer be resolved.
+  bool ApplyRelocations(uint8_t* code, size_t code_size,
+                        const std::vector<X64CodeRelocation>& relocations);
+
+  // Allocates an empty inline cache for the indirect call at guest_address.
+  X64InlineCache* AllocateInlineCache(uint32_t guest_address);
+  // Handles a miss at an inline cache site, possibly caching the target.
+  // Returns the host address to dispatch to.
+  uint32_t OnInlineCacheMiss(X64InlineCache* inline_cache,
+                             uint32_t target_address);
+  // Logs hit/miss statistics for the busiest inline cache sites.
+  void DumpInlineCacheStats();
+
+  // Returns the MMIO range the load or store at the guest address has
+  // trapped on before, if any. Such accesses are emitted with an inline range
+  // check and a direct call to the handler.
+  const MMIORange* LookupMMIOSite(uint32_t guest_address);
+  bool HasMMIOSites(uint32_t guest_low, uint32_t guest_high);
+  // Points inline cache entries for the guest function at its new code.
+  void RetargetInlineCaches(uint32_t target_address, uint32_t host_address);
+  // Stops inline cache entries for the guest function from matching, so that
+  // calls to it dispatch through the indirection table.
+  void DropInlineCacheEntries(uint32_t target_address);
+  void InvalidateFunction(GuestFunction* function) override;
+
+  bool HasReclaimableCode() override;
+  void ReclaimCode(const std::vector<uint64_t>& host_pcs) override;
+
+  void GetMemoryUsage(
+      std::vector<std::pair<const char*, uint64_t>>* usage) override;
 
   std::unique_ptr<Assembler> CreateAssembler() override;
 
@@ -68,10 +111,18 @@ class X64Backend : public Backend {
   void InstallBreakpoint(Breakpoint* breakpoint) override;
   void InstallBreakpoint(Breakpoint* breakpoint, Function* fn) override;
   void UninstallBreakpoint(Breakpoint* breakpoint) override;
+  uint64_t LookupBreakpointTrampoline(uint64_t host_pc) override;
 
  private:
   static bool ExceptionCallbackThunk(Exception* ex, void* data);
   bool ExceptionCallback(Exception* ex);
+  static void MMIOFaultCallbackThunk(void* context, uint64_t host_pc,
+                                     const MMIORange* range);
+  void OnMMIOFault(uint64_t host_pc, const MMIORange* range);
+
+  // Copies the instructions about to be covered by a breakpoint at the given
+  // address out of line, if they can run anywhere.
+  void PrepareBreakpointTrampoline(uint64_t host_address);
 
   uintptr_t capstone_handle_ = 0;
 
@@ -82,6 +133,22 @@ class X64Backend : public Backend {
   HostToGuestThunk host_to_guest_thunk_;
   GuestToHostThunk guest_to_host_thunk_;
   ResolveFunctionThunk resolve_function_thunk_;
+
+  xe::global_critical_region global_critical_region_;
+  std::vector<std::unique_ptr<X64PersistentCache>> persistent_caches_;
+  std::vector<X64InlineCache*> inline_caches_;
+  std::map<uint32_t, const MMIORange*> mmio_sites_;
+
+  struct BreakpointTrampoline {
+    // Instructions displaced by the breakpoint, to verify the trampoline
+    // still matches if the code at the address has since been replaced.
+    uint8_t displaced_bytes[16];
+    uint32_t displaced_length;
+    uint32_t address;
+  };
+  // Trampolines by breakpoint host address. Kept after the breakpoint is
+  // removed, as it is likely to be added again.
+  std::unordered_map<uint64_t, BreakpointTrampoline> breakpoint_trampolines_;
 };
 
 }  // namespace x64
@@ -9,24 +9,42 @@
 
 #include "xenia/cpu/backend/x64/x64_code_cache.h"
 
+#include <gflags/gflags.h>
+
+#include <algorithm>
 #include <cstdlib>
 #include <cstring>
 
 #include "xenia/base/assert.h"
+#include "xenia/base/atomic.h"
 #include "xenia/base/clock.h"
 #include "xenia/base/logging.h"
 #include "xenia/base/math.h"
 #include "xenia/base/memory.h"
 #include "xenia/cpu/function.h"
 
+DEFINE_int32(code_cache_reclaim_threshold, 4,
+             "Megabytes of replaced code to accumulate before suspending the "
+             "guest to reclaim it. 0 to never reclaim.");
+
 namespace xe {
 namespace cpu {
 namespace backend {
 namespace x64 {
 
+// Minimum time between reclaim passes, as each suspends every guest thread.
+static const uint32_t kReclaimIntervalMillis = 1000;
+
 X64CodeCache::X64CodeCache() = default;
 
 X64CodeCache::~X64CodeCache() {
+  if (lookup_pages_) {
+    for (size_t i = 0; i < (kGeneratedCodeSize >> kLookupPageShift) + 1; ++i) {
+      std::free(lookup_pages_[i].load());
+    }
+  }
+  retired_lookup_pages_.ReclaimAll([](LookupPage* page) { std::free(page); });
+
   if (indirection_table_base_) {
     xe::memory::DeallocFixed(indirection_table_base_, 0,
                              xe::memory::DeallocationType::kRelease);
@@ -42,6 +60,12 @@ X64CodeCache::~X64CodeCache() {
 }
 
 bool X64CodeCache::Initialize() {
+  size_t lookup_page_count = (kGeneratedCodeSize >> kLookupPageShift) + 1;
+  lookup_pages_.reset(new std::atomic<LookupPage*>[lookup_page_count]);
+  for (size_t i = 0; i < lookup_page_count; ++i) {
+    lookup_pages_[i].store(nullptr, std::memory_order_relaxed);
+  }
+
   indirection_table_base_ = reinterpret_cast<uint8_t*>(xe::memory::AllocFixed(
       reinterpret_cast<void*>(kIndirectionTableBase), kIndirectionTableSize,
       xe::memory::AllocationType::kReserve,
@@ -91,10 +115,61 @@ void X64CodeCache::set_indirection_default(uint32_t default_value) {
 void X64CodeCache::AddIndirection(uint32_t guest_address,
                                   uint32_t host_address) {
   assert_not_null(indirection_table_base_);
+  auto global_lock = global_critical_region_.Acquire();
 
-  uint32_t* indirection_slot = reinterpret_cast<uint32_t*>(
+  // Guest threads may be reading the slot concurrently, so swap it in
+  // atomically.
+  auto indirection_slot = reinterpret_cast<volatile int32_t*>(
       indirection_table_base_ + (guest_address - kIndirectionTableBase));
-  *indirection_slot = host_address;
+  xe::atomic_exchange(int32_t(host_address), indirection_slot);
+
+  if (call_link_stub_) {
+    auto& links = call_links_[guest_address];
+    links.host_address = host_address;
+    for (auto site : links.sites) {
+      PatchCallSite(site, host_address);
+    }
+  }
+}
+
+void X64CodeCache::LinkCallSites(uint8_t* code,
+                                 const std::vector<X64CallSite>& call_sites) {
+  assert_not_null(call_link_stub_);
+  auto global_lock = global_critical_region_.Acquire();
+  for (auto& call_site : call_sites) {
+    uint8_t* site = code + call_site.code_offset;
+    auto& links = call_links_[call_site.target_address];
+    links.sites.push_back(site);
+    PatchCallSite(site, links.host_address
+                            ? links.host_address
+                            : reinterpret_cast<uint64_t>(call_link_stub_));
+  }
+}
+
+void X64CodeCache::UnlinkCallSites(uint32_t target_address) {
+  if (!call_link_stub_) {
+    return;
+  }
+  auto global_lock = global_critical_region_.Acquire();
+  auto it = call_links_.find(target_address);
+  if (it == call_links_.end()) {
+    return;
+  }
+  it->second.host_address = 0;
+  for (auto site : it->second.sites) {
+    PatchCallSite(site, reinterpret_cast<uint64_t>(call_link_stub_));
+  }
+}
+
+void X64CodeCache::PatchCallSite(uint8_t* rel32_address,
+                                 uint64_t target_address) {
+  // The rel32 is 4b aligned so threads executing the call see either the old
+  // or the new target.
+  assert_zero(reinterpret_cast<uintptr_t>(rel32_address) & 0x3);
+  auto rel32 = int32_t(int64_t(target_address) -
+                       int64_t(reinterpret_cast<uintptr_t>(rel32_address + 4)));
+  xe::atomic_exchange(rel32,
+                      reinterpret_cast<volatile int32_t*>(rel32_address));
 }
 
 void X64CodeCache::CommitExecutableRange(uint32_t guest_low,
@@ -124,133 +199,430 @@ void* X64CodeCache::PlaceHostCode(uint32_t guest_address, void* machine_code,
                         nullptr);
 }
 
-void* X64CodeCache::PlaceGuestCode(uint32_t guest_address, void* machine_code,
-                                   size_t code_size, size_t stack_size,
-                                   GuestFunction* function_info) {
-  // Hold a lock while we bump the pointers up. This is important as the
-  // unwind table requires entries AND code to be sorted in order.
-  size_t low_mark;
+void* X64CodeCache::PlaceGuestCode(
+    uint32_t guest_address, void* machine_code, size_t code_size,
+    size_t stack_size, GuestFunction* function_info,
+    const std::vector<X64CallSite>* call_sites,
+    const std::vector<X64ConstantSite>* constant_sites) {
+  // Hold a lock while we reserve space. This is important as the unwind table
+  // requires entries to be sorted in order.
   size_t high_mark;
   uint8_t* code_address = nullptr;
   UnwindReservation unwind_reservation;
   {
     auto global_lock = global_critical_region_.Acquire();
 
-    low_mark = generated_code_offset_;
-
-    // Reserve code.
+    // Reserve code and unwind info together.
     // Always move the code to land on 16b alignment.
-    code_address = generated_code_base_ + generated_code_offset_;
-    generated_code_offset_ += xe::round_up(code_size, 16);
-
-    // Reserve unwind info.
     // We go on the high size of the unwind info as we don't know how big we
     // need it, and a few extra bytes of padding isn't the worst thing.
-    unwind_reservation =
-        RequestUnwindReservation(generated_code_base_ + generated_code_offset_);
-    generated_code_offset_ += unwind_reservation.data_size;
+    size_t aligned_code_size = xe::round_up(code_size, 16);
+    size_t offset = AllocateCode(aligned_code_size + unwind_data_size());
+    code_address = generated_code_base_ + offset;
+    high_mark = offset + aligned_code_size + unwind_data_size();
 
-    high_mark = generated_code_offset_;
-
-    // Store in map. It is maintained in sorted order of host PC dependent on
-    // us also being append-only.
-    generated_code_map_.emplace_back(
-        (uint64_t(code_address - generated_code_base_) << 32) |
-            generated_code_offset_,
-        function_info);
+    // Reserve unwind info.
+    unwind_reservation = RequestUnwindReservation(
+        code_address + aligned_code_size, code_address, code_size);
+
+    // Store in map, maintained in sorted order of host PC.
+    auto entry =
+        std::make_pair((uint64_t(offset) << 32) | high_mark, function_info);
+    generated_code_map_.insert(
+        std::upper_bound(generated_code_map_.begin(),
+                         generated_code_map_.end(), entry,
+                         [](const std::pair<uint64_t, GuestFunction*>& a,
+                            const std::pair<uint64_t, GuestFunction*>& b) {
+                           return a.first < b.first;
+                         }),
+        entry);
+    if (function_info) {
+      AddLookupEntry(uint32_t(offset), uint32_t(high_mark), function_info);
+    }
   }
 
-  // If we are going above the high water mark of committed memory, commit some
-  // more. It's ok if multiple threads do this, as redundant commits aren't
-  // harmful.
-  size_t old_commit_mark = generated_code_commit_mark_;
-  if (high_mark > old_commit_mark) {
-    size_t new_commit_mark = old_commit_mark + 16 * 1024 * 1024;
-    xe::memory::AllocFixed(generated_code_base_, new_commit_mark,
-                           xe::memory::AllocationType::kCommit,
-                           xe::memory::PageAccess::kExecuteReadWrite);
-    generated_code_commit_mark_.compare_exchange_strong(old_commit_mark,
-                                                        new_commit_mark);
-  }
+  CommitCode(high_mark);
 
   // Copy code.
   std::memcpy(code_address, machine_code, code_size);
+  if (constant_sites) {
+    for (auto& constant_site : *constant_sites) {
+      uint8_t* site = code_address + constant_site.code_offset;
+      xe::store<int32_t>(
+          site, int32_t(int64_t(constant_site.constant_address) -
+                        int64_t(reinterpret_cast<uintptr_t>(site + 4))));
+    }
+  }
 
   // Notify subclasses of placed code.
   PlaceCode(guest_address, machine_code, code_size, stack_size, code_address,
             unwind_reservation);
 
+  // Calls must be pointed somewhere valid before anyone can run the code.
+  if (call_sites && !call_sites->empty()) {
+    LinkCallSites(code_address, *call_sites);
+  }
+
   // Now that everything is ready, fix up the indirection table.
   // Note that we do support code that doesn't have an indirection fixup, so
   // ignore those when we see them.
   if (guest_address && indirection_table_base_) {
-    uint32_t* indirection_slot = reinterpret_cast<uint32_t*>(
-        indirection_table_base_ + (guest_address - kIndirectionTableBase));
-    *indirection_slot = uint32_t(reinterpret_cast<uint64_t>(code_address));
+    // Code of a function whose guest code changed while it was translated
+    // must stay unreachable, which the lock orders with the invalidation.
+    auto global_lock = global_critical_region_.Acquire();
+    if (!function_info || !function_info->is_invalidated()) {
+      AddIndirection(guest_address,
+                     uint32_t(reinterpret_cast<uint64_t>(code_address)));
+    }
   }
 
   return code_address;
 }
 
 uint32_t X64CodeCache::PlaceData(const void* data, size_t length) {
-  // Hold a lock while we bump the pointers up.
+  // Hold a lock while we reserve space.
   size_t high_mark;
   uint8_t* data_address = nullptr;
   {
     auto global_lock = global_critical_region_.Acquire();
 
-    // Reserve code.
-    // Always move the code to land on 16b alignment.
-    data_address = generated_code_base_ + generated_code_offset_;
-    generated_code_offset_ += xe::round_up(length, 16);
+    // Always move the data to land on 16b alignment.
+    size_t aligned_length = xe::round_up(length, 16);
+    size_t offset = AllocateCode(aligned_length);
+    data_address = generated_code_base_ + offset;
+    high_mark = offset + aligned_length;
+  }
+
+  CommitCode(high_mark);
 
-    high_mark = generated_code_offset_;
+  // Copy data.
+  std::memcpy(data_address, data, length);
+
+  return uint32_t(uintptr_t(data_address));
+}
+
+uint32_t X64CodeCache::PlaceConstant(const vec128_t& value) {
+  const size_t kChunkSize = 4096;
+  auto key = std::make_pair(value.low, value.high);
+  size_t high_mark = 0;
+  uint8_t* constant_address;
+  {
+    auto global_lock = global_critical_region_.Acquire();
+    auto it = constants_.find(key);
+    if (it != constants_.end()) {
+      return it->second;
+    }
+    if (!constant_chunk_ || constant_chunk_used_ == kChunkSize) {
+      // Allocations are only 16b aligned, so over-allocate to align lines.
+      size_t offset = AllocateCode(kChunkSize + 48);
+      high_mark = offset + kChunkSize + 48;
+      constant_chunk_ = reinterpret_cast<uint8_t*>(xe::round_up(
+          reinterpret_cast<uintptr_t>(generated_code_base_ + offset), 64));
+      constant_chunk_used_ = 0;
+    }
+    constant_address = constant_chunk_ + constant_chunk_used_;
+    constant_chunk_used_ += sizeof(vec128_t);
+    if (high_mark) {
+      CommitCode(high_mark);
+    }
+    std::memcpy(constant_address, &value, sizeof(vec128_t));
+    constants_.emplace(key, uint32_t(uintptr_t(constant_address)));
   }
+  return uint32_t(uintptr_t(constant_address));
+}
 
+size_t X64CodeCache::AllocateCode(size_t size) {
+  // First fit. Blocks are 16b multiples so remainders stay aligned.
+  for (auto it = free_blocks_.begin(); it != free_blocks_.end(); ++it) {
+    if (it->second < size) {
+      continue;
+    }
+    size_t offset = it->first;
+    size_t remaining = it->second - size;
+    free_blocks_.erase(it);
+    if (remaining) {
+      free_blocks_.emplace(offset + size, remaining);
+    }
+    free_size_ -= size;
+    return offset;
+  }
+  size_t offset = generated_code_offset_;
+  generated_code_offset_ += size;
+  return offset;
+}
+
+void X64CodeCache::FreeCode(size_t offset, size_t size) {
+  free_size_ += size;
+  auto next = free_blocks_.lower_bound(offset);
+  if (next != free_blocks_.begin()) {
+    auto prev = std::prev(next);
+    if (prev->first + prev->second == offset) {
+      offset = prev->first;
+      size += prev->second;
+      free_blocks_.erase(prev);
+    }
+  }
+  if (next != free_blocks_.end() && offset + size == next->first) {
+    size += next->second;
+    free_blocks_.erase(next);
+  }
+  if (offset + size == generated_code_offset_) {
+    // Top of the heap; just lower the high water mark.
+    generated_code_offset_ = offset;
+    free_size_ -= size;
+    return;
+  }
+  free_blocks_.emplace(offset, size);
+}
+
+void X64CodeCache::CommitCode(size_t high_mark) {
   // If we are going above the high water mark of committed memory, commit some
   // more. It's ok if multiple threads do this, as redundant commits aren't
   // harmful.
   size_t old_commit_mark = generated_code_commit_mark_;
   if (high_mark > old_commit_mark) {
-    size_t new_commit_mark = old_commit_mark + 16 * 1024 * 1024;
+    size_t new_commit_mark = xe::round_up(high_mark, 16 * 1024 * 1024);
     xe::memory::AllocFixed(generated_code_base_, new_commit_mark,
                            xe::memory::AllocationType::kCommit,
                            xe::memory::PageAccess::kExecuteReadWrite);
     generated_code_commit_mark_.compare_exchange_strong(old_commit_mark,
                                                         new_commit_mark);
   }
+}
 
-  // Copy code.
-  std::memcpy(data_address, data, length);
+void X64CodeCache::RetireCode(void* code_address) {
+  auto global_lock = global_critical_region_.Acquire();
+  uint64_t offset =
+      reinterpret_cast<uint8_t*>(code_address) - generated_code_base_;
+  auto it = std::lower_bound(
+      generated_code_map_.begin(), generated_code_map_.end(), offset << 32,
+      [](const std::pair<uint64_t, GuestFunction*>& a, uint64_t key) {
+        return a.first < key;
+      });
+  if (it == generated_code_map_.end() || (it->first >> 32) != offset) {
+    assert_always("retiring code that was never placed");
+    return;
+  }
+  CodeRange range(uint32_t(offset), uint32_t(it->first));
+  for (auto& retired : retired_code_) {
+    if (retired.range == range) {
+      return;
+    }
+  }
+  retired_code_.push_back({range, reclaim_epoch_});
+  retired_size_ += range.second - range.first;
+}
 
-  return uint32_t(uintptr_t(data_address));
+bool X64CodeCache::ShouldReclaimCode() {
+  if (FLAGS_code_cache_reclaim_threshold <= 0) {
+    return false;
+  }
+  auto global_lock = global_critical_region_.Acquire();
+  if (retired_size_ <
+      size_t(FLAGS_code_cache_reclaim_threshold) * 1024 * 1024) {
+    return false;
+  }
+  return Clock::QueryHostUptimeMillis() - last_reclaim_time_ >=
+         kReclaimIntervalMillis;
 }
 
-GuestFunction* X64CodeCache::LookupFunction(uint64_t host_pc) {
-  uint32_t key = uint32_t(host_pc - kGeneratedCodeBase);
-  void* fn_entry = std::bsearch(
-      &key, generated_code_map_.data(), generated_code_map_.size() + 1,
-      sizeof(std::pair<uint32_t, Function*>),
-      [](const void* key_ptr, const void* element_ptr) {
-        auto key = *reinterpret_cast<const uint32_t*>(key_ptr);
-        auto element =
-            reinterpret_cast<const std::pair<uint64_t, GuestFunction*>*>(
-                element_ptr);
-        if (key < (element->first >> 32)) {
-          return -1;
-        } else if (key > uint32_t(element->first)) {
-          return 1;
-        } else {
-          return 0;
+std::vector<X64CodeCache::CodeRange> X64CodeCache::ReclaimCode(
+    std::vector<uint64_t> host_pcs) {
+  std::sort(host_pcs.begin(), host_pcs.end());
+  auto global_lock = global_critical_region_.Acquire();
+  last_reclaim_time_ = Clock::QueryHostUptimeMillis();
+
+  std::vector<CodeRange> freed;
+  for (auto it = retired_code_.begin(); it != retired_code_.end();) {
+    const auto& range = it->range;
+    uint64_t start = uint64_t(generated_code_base_) + range.first;
+    uint64_t end = uint64_t(generated_code_base_) + range.second;
+    auto pc = std::lower_bound(host_pcs.begin(), host_pcs.end(), start);
+    if (it->epoch == reclaim_epoch_ ||
+        (pc != host_pcs.end() && *pc < end)) {
+      // Too new, or something is still running it.
+      ++it;
+      continue;
+    }
+    freed.push_back(range);
+    it = retired_code_.erase(it);
+  }
+  ++reclaim_epoch_;
+
+  if (freed.empty()) {
+    return freed;
+  }
+  std::sort(freed.begin(), freed.end());
+
+  auto is_freed = [&freed](uint64_t offset) {
+    auto it = std::upper_bound(freed.begin(), freed.end(),
+                               CodeRange(uint32_t(offset), UINT32_MAX));
+    return it != freed.begin() && offset < std::prev(it)->second;
+  };
+
+  // Call sites within the code must never be patched again.
+  for (auto& it : call_links_) {
+    auto& sites = it.second.sites;
+    sites.erase(std::remove_if(sites.begin(), sites.end(),
+                               [&](uint8_t* site) {
+                                 return is_freed(site - generated_code_base_);
+                               }),
+                sites.end());
+  }
+
+  generated_code_map_.erase(
+      std::remove_if(generated_code_map_.begin(), generated_code_map_.end(),
+                     [&](const std::pair<uint64_t, GuestFunction*>& entry) {
+                       return is_freed(entry.first >> 32);
+                     }),
+      generated_code_map_.end());
+
+  RemoveLookupEntries(freed);
+  ReleaseUnwindEntries(freed);
+
+  size_t freed_size = 0;
+  for (auto& range : freed) {
+    // Make anything that still jumps in fault loudly rather than run
+    // whatever gets placed here next.
+    std::memset(generated_code_base_ + range.first, 0xCC,
+                range.second - range.first);
+    FreeCode(range.first, range.second - range.first);
+    retired_size_ -= range.second - range.first;
+    freed_size += range.second - range.first;
+  }
+
+  auto stats = QueryStats();
+  XELOGI(
+      "Code cache: reclaimed %dKB in %d blocks; %dKB used, %dKB free in %d "
+      "blocks (%d%% fragmented), %dKB retired, %d functions, %d constants",
+      int(freed_size / 1024), int(freed.size()), int(stats.used_size / 1024),
+      int(stats.free_size / 1024), int(stats.free_block_count),
+      stats.free_size
+          ? int(100 - stats.largest_free_size * 100 / stats.free_size)
+          : 0,
+      int(stats.retired_size / 1024), int(stats.function_count),
+      int(stats.constant_count));
+  return freed;
+}
+
+X64CodeCache::Stats X64CodeCache::QueryStats() {
+  auto global_lock = global_critical_region_.Acquire();
+  Stats stats;
+  stats.used_size = generated_code_offset_;
+  stats.committed_size = generated_code_commit_mark_;
+  stats.free_size = free_size_;
+  stats.free_block_count = free_blocks_.size();
+  stats.largest_free_size = 0;
+  for (auto& it : free_blocks_) {
+    stats.largest_free_size = std::max(stats.largest_free_size, it.second);
+  }
+  stats.retired_size = retired_size_;
+  stats.function_count = generated_code_map_.size() - retired_code_.size();
+  stats.constant_count = constants_.size();
+  return stats;
+}
+
+X64CodeCache::LookupPage* X64CodeCache::AllocateLookupPage(uint32_t count) {
+  auto page = reinterpret_cast<LookupPage*>(std::malloc(
+      sizeof(LookupPage) + (count - 1) * sizeof(LookupPage::Entry)));
+  page->count = count;
+  return page;
+}
+
+void X64CodeCache::AddLookupEntry(uint32_t start, uint32_t end,
+                                  GuestFunction* function) {
+  LookupPage::Entry entry = {start, end, function};
+  for (size_t i = start >> kLookupPageShift;
+       i <= (end - 1) >> kLookupPageShift; ++i) {
+    auto old_page = lookup_pages_[i].load(std::memory_order_relaxed);
+    uint32_t old_count = old_page ? old_page->count : 0;
+    auto new_page = AllocateLookupPage(old_count + 1);
+    uint32_t n = 0;
+    for (uint32_t j = 0; j < old_count; ++j) {
+      if (n == j && old_page->entries[j].start > start) {
+        new_page->entries[n++] = entry;
+      }
+      new_page->entries[n++] = old_page->entries[j];
+    }
+    if (n == old_count) {
+      new_page->entries[n++] = entry;
+    }
+    RetireLookupPage(i, new_page);
+  }
+  FreeRetiredLookupPages();
+}
+
+void X64CodeCache::RemoveLookupEntries(const std::vector<CodeRange>& ranges) {
+  for (auto& range : ranges) {
+    for (size_t i = range.first >> kLookupPageShift;
+         i <= (range.second - 1) >> kLookupPageShift; ++i) {
+      auto old_page = lookup_pages_[i].load(std::memory_order_relaxed);
+      if (!old_page) {
+        continue;
+      }
+      uint32_t n = 0;
+      for (uint32_t j = 0; j < old_page->count; ++j) {
+        auto& entry = old_page->entries[j];
+        if (entry.start < range.first || entry.start >= range.second) {
+          ++n;
         }
-      });
-  if (fn_entry) {
-    return reinterpret_cast<const std::pair<uint64_t, GuestFunction*>*>(
-               fn_entry)
-        ->second;
-  } else {
+      }
+      if (n == old_page->count) {
+        continue;
+      }
+      LookupPage* new_page = nullptr;
+      if (n) {
+        new_page = AllocateLookupPage(n);
+        n = 0;
+        for (uint32_t j = 0; j < old_page->count; ++j) {
+          auto& entry = old_page->entries[j];
+          if (entry.start < range.first || entry.start >= range.second) {
+            new_page->entries[n++] = entry;
+          }
+        }
+      }
+      RetireLookupPage(i, new_page);
+    }
+  }
+  FreeRetiredLookupPages();
+}
+
+void X64CodeCache::RetireLookupPage(size_t page_index, LookupPage* new_page) {
+  auto old_page =
+      lookup_pages_[page_index].exchange(new_page, std::memory_order_release);
+  if (old_page) {
+    retired_lookup_pages_.Retire(old_page);
+  }
+}
+
+void X64CodeCache::FreeRetiredLookupPages() {
+  // Pages a running lookup may still read are freed by the next change to
+  // the pages.
+  retired_lookup_pages_.Reclaim([](LookupPage* page) { std::free(page); });
+}
+
+GuestFunction* X64CodeCache::LookupFunction(uint64_t host_pc) {
+  uint64_t offset = host_pc - kGeneratedCodeBase;
+  if (host_pc < kGeneratedCodeBase || offset >= kGeneratedCodeSize) {
     return nullptr;
   }
+  uint32_t epoch = retired_lookup_pages_.BeginRead();
+  auto page = lookup_pages_[offset >> kLookupPageShift].load(
+      std::memory_order_acquire);
+  GuestFunction* function = nullptr;
+  if (page) {
+    for (uint32_t i = 0; i < page->count; ++i) {
+      auto& entry = page->entries[i];
+      if (offset < entry.start) {
+        break;
+      } else if (offset < entry.end) {
+        function = entry.function;
+        break;
+      }
+    }
+  }
+  retired_lookup_pages_.EndRead(epoch);
+  return function;
 }
 
 }  // namespace x64
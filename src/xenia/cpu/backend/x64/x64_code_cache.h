@@ -11,13 +11,18 @@
 #define XENIA_CPU_BACKEND_X64_X64_CODE_CACHE_H_
 
 #include <atomic>
+#include <functional>
+#include <map>
 #include <memory>
 #include <string>
+#include <unordered_map>
 #include <utility>
 #include <vector>
 
+#include "xenia/base/epoch_reclaimer.h"
 #include "xenia/base/memory.h"
 #include "xenia/base/mutex.h"
+#include "xenia/base/vec128.h"
 #include "xenia/cpu/backend/code_cache.h"
 
 namespace xe {
@@ -25,8 +30,68 @@ namespace cpu {
 namespace backend {
 namespace x64 {
 
+// A patchable rel32 of a guest-to-guest call or tail jmp. It initially targets
+// the call link stub, which goes through the indirection table, and is pointed
+// directly at the callee once that has been placed.
+struct X64CallSite {
+  // Offset of the 4b aligned rel32 from the start of the function code.
+  uint32_t code_offset;
+  // Guest address of the callee.
+  uint32_t target_address;
+};
+
+// A rip-relative disp32 of an instruction loading from the constant pool,
+// which must be the last 4 bytes of the instruction.
+struct X64ConstantSite {
+  // Offset of the disp32 from the start of the function code.
+  uint32_t code_offset;
+  // Host address of the constant, from PlaceConstant.
+  uint32_t constant_address;
+};
+
+// State of an inline cache at an indirect call site. Each entry in the
+// generated code is a 'cmp ebx, imm32' followed by a direct call/jmp rel32;
+// entries are filled on miss by patching the rel32 and then the imm32.
+// Lives in generated code memory so it can be addressed with 32-bit pointers.
+struct X64InlineCache {
+  static const int kMaxEntryCount = 4;
+
+  // Times the site was executed and how many of those fell through all
+  // entries. Not atomic; only used for statistics.
+  uint32_t call_count;
+  uint32_t miss_count;
+  // Guest address of the branch, for reporting.
+  uint32_t guest_address;
+  // Host address of the emitting function, 0 until it has been placed.
+  uint32_t code_address;
+  uint32_t entry_capacity;
+  uint32_t entry_count;
+  uint32_t entry_targets[kMaxEntryCount];
+  // Offsets from code_address of each entry's imm32 and rel32.
+  uint32_t entry_compare_offsets[kMaxEntryCount];
+  uint32_t entry_branch_offsets[kMaxEntryCount];
+};
+
 class X64CodeCache : public CodeCache {
  public:
+  // [start, end) offsets of a block of generated code from base_address().
+  typedef std::pair<uint32_t, uint32_t> CodeRange;
+
+  struct Stats {
+    // High water mark of allocations and how much of it is committed.
+    size_t used_size;
+    size_t committed_size;
+    // Space available for reuse below the high water mark.
+    size_t free_size;
+    size_t free_block_count;
+    size_t largest_free_size;
+    // Replaced code waiting for a safe point before it is reused.
+    size_t retired_size;
+    size_t function_count;
+    // Distinct constants in the pool.
+    size_t constant_count;
+  };
+
   ~X64CodeCache() override;
 
   static std::unique_ptr<X64CodeCache> Create();
@@ -47,15 +112,61 @@ class X64CodeCache : public CodeCache {
 
   void CommitExecutableRange(uint32_t guest_low, uint32_t guest_high);
 
+  // Direct call linking is disabled until a stub is set. The stub is entered
+  // with the guest target address in ebx and must dispatch through the
+  // indirection table.
+  bool has_call_linking() const { return call_link_stub_ != nullptr; }
+  void set_call_link_stub(void* stub) {
+    call_link_stub_ = reinterpret_cast<uint8_t*>(stub);
+  }
+  // Points the given call sites in placed code at their targets, or at the
+  // stub if the target hasn't been placed yet.
+  void LinkCallSites(uint8_t* code, const std::vector<X64CallSite>& call_sites);
+  // Points all call sites targeting the given function back at the stub, for
+  // when its code is invalidated.
+  void UnlinkCallSites(uint32_t target_address);
+
   void* PlaceHostCode(uint32_t guest_address, void* machine_code,
                       size_t code_size, size_t stack_size);
-  void* PlaceGuestCode(uint32_t guest_address, void* machine_code,
-                       size_t code_size, size_t stack_size,
-                       GuestFunction* function_info);
+  void* PlaceGuestCode(
+      uint32_t guest_address, void* machine_code, size_t code_size,
+      size_t stack_size, GuestFunction* function_info,
+      const std::vector<X64CallSite>* call_sites = nullptr,
+      const std::vector<X64ConstantSite>* constant_sites = nullptr);
   uint32_t PlaceData(const void* data, size_t length);
+  // Returns the address of a 16b constant in the pool shared by all code,
+  // adding it if it isn't there yet. Constants are never removed.
+  uint32_t PlaceConstant(const vec128_t& value);
+
+  // Marks previously placed guest code as replaced. Callers must have already
+  // pointed the indirection table and anything else at the new code. It
+  // stays intact until ReclaimCode can prove no thread is still using it.
+  void RetireCode(void* code_address);
+  // True once enough code has been retired for a reclaim pass to be worth
+  // suspending the guest for.
+  bool ShouldReclaimCode();
+  // Returns retired code to the free list. host_pcs must hold the program
+  // counter and every return address of all threads that may run guest code,
+  // captured while they were suspended. Code retired since the previous pass
+  // is kept regardless, as a thread may have loaded its address just before.
+  // Returns the ranges that were freed.
+  std::vector<CodeRange> ReclaimCode(std::vector<uint64_t> host_pcs);
+  Stats QueryStats();
 
   GuestFunction* LookupFunction(uint64_t host_pc) override;
 
+  // Bounds of the host executable image. Pointers into it (host functions and
+  // static data) can be relocated when reusing generated code across runs.
+  uint64_t host_image_base() const { return host_image_base_; }
+  uint64_t host_image_size() const { return host_image_size_; }
+  // Value that changes whenever the host executable changes, or 0 if the
+  // platform cannot provide one (and code must not be reused across runs).
+  uint64_t host_image_identity() const { return host_image_identity_; }
+  bool IsHostImageAddress(uint64_t address) const {
+    return address >= host_image_base_ &&
+           address < host_image_base_ + host_image_size_;
+  }
+
  protected:
   // All executable code falls within 0x80000000 to 0x9FFFFFFF, so we can
   // only map enough for lookups within that range.
@@ -80,17 +191,58 @@ class X64CodeCache : public CodeCache {
 
   X64CodeCache();
 
-  virtual UnwindReservation RequestUnwindReservation(uint8_t* entry_address) {
+  // Bytes of unwind data placed after each function.
+  virtual size_t unwind_data_size() const { return 0; }
+  // Called with the global critical region held, once the code location is
+  // known but before any code is copied.
+  virtual UnwindReservation RequestUnwindReservation(uint8_t* entry_address,
+                                                     void* code_address,
+                                                     size_t code_size) {
     return UnwindReservation();
   }
+  // Called with the global critical region held when code is reclaimed.
+  virtual void ReleaseUnwindEntries(const std::vector<CodeRange>& ranges) {}
   virtual void PlaceCode(uint32_t guest_address, void* machine_code,
                          size_t code_size, size_t stack_size,
                          void* code_address,
                          UnwindReservation unwind_reservation) {}
 
+  static void PatchCallSite(uint8_t* rel32_address, uint64_t target_address);
+
+  // Functions overlapping one page of generated code, sorted by address.
+  // Immutable once published so that lookups need no lock.
+  static const uint32_t kLookupPageShift = 12;
+  struct LookupPage {
+    struct Entry {
+      uint32_t start;
+      uint32_t end;
+      GuestFunction* function;
+    };
+    uint32_t count;
+    Entry entries[1];
+  };
+  static LookupPage* AllocateLookupPage(uint32_t count);
+  // Adds or removes the function in the [start, end) range from the lookup
+  // pages it covers. Must be called with the global critical region held.
+  void AddLookupEntry(uint32_t start, uint32_t end, GuestFunction* function);
+  void RemoveLookupEntries(const std::vector<CodeRange>& ranges);
+  void RetireLookupPage(size_t page_index, LookupPage* new_page);
+  void FreeRetiredLookupPages();
+
+  // Reserves space for code or data, reusing freed blocks where possible.
+  // Must be called with the global critical region held.
+  size_t AllocateCode(size_t size);
+  void FreeCode(size_t offset, size_t size);
+  void CommitCode(size_t high_mark);
+
   std::wstring file_name_;
   xe::memory::FileMappingHandle mapping_ = nullptr;
 
+  // Populated by platform implementations, if supported.
+  uint64_t host_image_base_ = 0;
+  uint64_t host_image_size_ = 0;
+  uint64_t host_image_identity_ = 0;
+
   // NOTE: the global critical region must be held when manipulating the offsets
   // or counts of anything, to keep the tables consistent and ordered.
   xe::global_critical_region global_critical_region_;
@@ -107,12 +259,53 @@ class X64CodeCache : public CodeCache {
   uint8_t* generated_code_base_ = nullptr;
   // Current offset to empty space in generated code.
   size_t generated_code_offset_ = 0;
+  // Reclaimed blocks below generated_code_offset_, by offset to size.
+  // Adjacent blocks are always merged.
+  std::map<size_t, size_t> free_blocks_;
+  size_t free_size_ = 0;
   // Current high water mark of COMMITTED code.
   std::atomic<size_t> generated_code_commit_mark_ = {0};
   // Sorted map by host PC base offsets to source function info.
   // This can be used to bsearch on host PC to find the guest function.
   // The key is [start address | end address].
   std::vector<std::pair<uint64_t, GuestFunction*>> generated_code_map_;
+  // Same information indexed by page of host PC for LookupFunction, which
+  // runs on every fault and stack walk. Lookups count themselves in
+  // retired_lookup_pages_ while they read a page, and replaced pages are kept
+  // there until no lookup can still read them.
+  std::unique_ptr<std::atomic<LookupPage*>[]> lookup_pages_;
+  xe::EpochReclaimer<LookupPage*> retired_lookup_pages_;
+
+  struct RetiredCode {
+    CodeRange range;
+    // Value of reclaim_epoch_ when retired.
+    uint32_t epoch;
+  };
+  std::vector<RetiredCode> retired_code_;
+  size_t retired_size_ = 0;
+  uint32_t reclaim_epoch_ = 0;
+  uint32_t last_reclaim_time_ = 0;
+
+  // Linked call sites by target guest address, along with the host address
+  // they currently point to (0 if the target hasn't been placed).
+  struct CallLinks {
+    uint32_t host_address = 0;
+    std::vector<uint8_t*> sites;
+  };
+  uint8_t* call_link_stub_ = nullptr;
+  std::unordered_map<uint32_t, CallLinks> call_links_;
+
+  // Constant pool, filled a 64b aligned chunk of lines at a time so that
+  // constants used together tend to share lines. Deduplicated by value.
+  struct ConstantHash {
+    size_t operator()(const std::pair<uint64_t, uint64_t>& value) const {
+      return std::hash<uint64_t>()(value.first ^ (value.second * 31));
+    }
+  };
+  std::unordered_map<std::pair<uint64_t, uint64_t>, uint32_t, ConstantHash>
+      constants_;
+  uint8_t* constant_chunk_ = nullptr;
+  size_t constant_chunk_used_ = 0;
 };
 
 }  // namespace x64
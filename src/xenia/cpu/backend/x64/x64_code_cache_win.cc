@@ -9,11 +9,13 @@
 
 #include "xenia/cpu/backend/x64/x64_code_cache.h"
 
+#include <algorithm>
 #include <cstdlib>
 #include <cstring>
 
 #include "xenia/base/assert.h"
 #include "xenia/base/clock.h"
+#include "xenia/base/epoch_reclaimer.h"
 #include "xenia/base/logging.h"
 #include "xenia/base/math.h"
 #include "xenia/base/memory.h"
@@ -43,21 +45,52 @@ class Win32X64CodeCache : public X64CodeCache {
   void* LookupUnwindInfo(uint64_t host_pc) override;
 
  private:
-  UnwindReservation RequestUnwindReservation(uint8_t* entry_address) override;
+  size_t unwind_data_size() const override {
+    return xe::round_up(kUnwindInfoSize, 16);
+  }
+  UnwindReservation RequestUnwindReservation(uint8_t* entry_address,
+                                             void* code_address,
+                                             size_t code_size) override;
+  void ReleaseUnwindEntries(const std::vector<CodeRange>& ranges) override;
   void PlaceCode(uint32_t guest_address, void* machine_code, size_t code_size,
                  size_t stack_size, void* code_address,
                  UnwindReservation unwind_reservation) override;
 
   void InitializeUnwindEntry(uint8_t* unwind_entry_address,
-                             size_t unwind_table_slot, void* code_address,
-                             size_t code_size, size_t stack_size);
+                             size_t stack_size);
+  // Returns the table to edit other than by appending, copying the
+  // registered one into the spare the first time. Must be called with the
+  // global critical region held.
+  std::vector<RUNTIME_FUNCTION>& BeginUnwindTableEdit();
+  // Tells the system about table changes. Must be called with the global
+  // critical region held.
+  void UpdateUnwindTable();
+
+  struct UnwindTable {
+    std::vector<RUNTIME_FUNCTION> entries;
+    // Number of entries while registered, for LookupUnwindInfo.
+    std::atomic<uint32_t> registered_count = {0};
+  };
 
   // Growable function table system handle.
   void* unwind_table_handle_ = nullptr;
-  // Actual unwind table entries.
-  std::vector<RUNTIME_FUNCTION> unwind_table_;
-  // Current number of entries in the table.
-  std::atomic<uint32_t> unwind_table_count_ = {0};
+  // Actual unwind table entries. The system reads the registered table while
+  // we edit, so it's only ever appended to past the registered count. Other
+  // edits are made to a spare table, which is then registered in its place.
+  std::vector<std::unique_ptr<UnwindTable>> unwind_tables_;
+  // Tables neither registered nor possibly still read by LookupUnwindInfo.
+  std::vector<UnwindTable*> spare_unwind_tables_;
+  // Table being edited, the registered one unless dirty.
+  UnwindTable* unwind_table_ = nullptr;
+  // Current number of entries in the table being edited.
+  uint32_t unwind_table_count_ = 0;
+  // Set when entries were inserted out of order or removed, as the system
+  // only supports appending to a registered table.
+  bool unwind_table_dirty_ = false;
+  std::atomic<UnwindTable*> registered_unwind_table_ = {nullptr};
+  // LookupUnwindInfo counts itself in here while it reads the registered
+  // table, and replaced tables only become spares once it can't be.
+  xe::EpochReclaimer<UnwindTable*> retired_unwind_tables_;
 };
 
 std::unique_ptr<X64CodeCache> X64CodeCache::Create() {
@@ -84,16 +117,31 @@ bool Win32X64CodeCache::Initialize() {
     return false;
   }
 
+  // Find our own image so that generated code can be relocated between runs.
+  // The link timestamp and image size identify the exact build.
+  auto image_base = reinterpret_cast<uint8_t*>(GetModuleHandle(nullptr));
+  auto dos_header = reinterpret_cast<const IMAGE_DOS_HEADER*>(image_base);
+  auto nt_headers = reinterpret_cast<const IMAGE_NT_HEADERS*>(
+      image_base + dos_header->e_lfanew);
+  host_image_base_ = reinterpret_cast<uint64_t>(image_base);
+  host_image_size_ = nt_headers->OptionalHeader.SizeOfImage;
+  host_image_identity_ =
+      (uint64_t(nt_headers->FileHeader.TimeDateStamp) << 32) |
+      nt_headers->OptionalHeader.SizeOfImage;
+
   // Compute total number of unwind entries we should allocate.
   // We don't support reallocing right now, so this should be high.
-  unwind_table_.resize(kMaximumFunctionCount);
+  unwind_tables_.emplace_back(new UnwindTable());
+  unwind_table_ = unwind_tables_.back().get();
+  unwind_table_->entries.resize(kMaximumFunctionCount);
+  registered_unwind_table_ = unwind_table_;
 
 #ifdef USE_GROWABLE_FUNCTION_TABLE
   // Create table and register with the system. It's empty now, but we'll grow
   // it as functions are added.
   if (RtlAddGrowableFunctionTable(
-          &unwind_table_handle_, unwind_table_.data(), unwind_table_count_,
-          DWORD(unwind_table_.size()),
+          &unwind_table_handle_, unwind_table_->entries.data(),
+          unwind_table_count_, DWORD(unwind_table_->entries.size()),
           reinterpret_cast<ULONG_PTR>(generated_code_base_),
           reinterpret_cast<ULONG_PTR>(generated_code_base_ +
                                       kGeneratedCodeSize))) {
@@ -121,30 +169,126 @@ bool Win32X64CodeCache::Initialize() {
 }
 
 Win32X64CodeCache::UnwindReservation
-Win32X64CodeCache::RequestUnwindReservation(uint8_t* entry_address) {
-  UnwindReservation unwind_reservation;
-  unwind_reservation.data_size = xe::round_up(kUnwindInfoSize, 16);
-  unwind_reservation.table_slot = ++unwind_table_count_;
-  unwind_reservation.entry_address = entry_address;
+Win32X64CodeCache::RequestUnwindReservation(uint8_t* entry_address,
+                                            void* code_address,
+                                            size_t code_size) {
   assert_false(unwind_table_count_ >= kMaximumFunctionCount);
 
+  // Reused space may land anywhere, so keep the table sorted by address.
+  RUNTIME_FUNCTION fn_entry;
+  fn_entry.BeginAddress =
+      (DWORD)(reinterpret_cast<uint8_t*>(code_address) - generated_code_base_);
+  fn_entry.EndAddress = (DWORD)(fn_entry.BeginAddress + code_size);
+  fn_entry.UnwindData = (DWORD)(entry_address - generated_code_base_);
+  auto begin = unwind_table_->entries.begin();
+  auto end = begin + unwind_table_count_;
+  auto it = std::upper_bound(
+      begin, end, fn_entry,
+      [](const RUNTIME_FUNCTION& a, const RUNTIME_FUNCTION& b) {
+        return a.BeginAddress < b.BeginAddress;
+      });
+  if (it != end) {
+    auto& spare = BeginUnwindTableEdit();
+    it = spare.begin() + (it - begin);
+    begin = spare.begin();
+    end = begin + unwind_table_count_;
+    std::move_backward(it, end, end + 1);
+  }
+  *it = fn_entry;
+
+  UnwindReservation unwind_reservation;
+  unwind_reservation.data_size = unwind_data_size();
+  unwind_reservation.table_slot = it - begin;
+  unwind_reservation.entry_address = entry_address;
+  ++unwind_table_count_;
   return unwind_reservation;
 }
 
+void Win32X64CodeCache::ReleaseUnwindEntries(
+    const std::vector<CodeRange>& ranges) {
+  auto begin = BeginUnwindTableEdit().begin();
+  auto end = std::remove_if(
+      begin, begin + unwind_table_count_, [&](const RUNTIME_FUNCTION& entry) {
+        auto it = std::upper_bound(ranges.begin(), ranges.end(),
+                                   CodeRange(entry.BeginAddress, UINT32_MAX));
+        return it != ranges.begin() &&
+               entry.BeginAddress < std::prev(it)->second;
+      });
+  unwind_table_count_ = uint32_t(end - begin);
+  UpdateUnwindTable();
+}
+
+std::vector<RUNTIME_FUNCTION>& Win32X64CodeCache::BeginUnwindTableEdit() {
+  if (!unwind_table_dirty_) {
+    unwind_table_dirty_ = true;
+    // Tables a lookup may still be reading are reused by a later edit, so
+    // this may need a new one.
+    retired_unwind_tables_.Reclaim([this](UnwindTable* table) {
+      spare_unwind_tables_.push_back(table);
+    });
+    if (spare_unwind_tables_.empty()) {
+      unwind_tables_.emplace_back(new UnwindTable());
+      unwind_tables_.back()->entries.resize(kMaximumFunctionCount);
+      spare_unwind_tables_.push_back(unwind_tables_.back().get());
+    }
+    auto& registered = unwind_table_->entries;
+    unwind_table_ = spare_unwind_tables_.back();
+    spare_unwind_tables_.pop_back();
+    std::copy(registered.begin(), registered.begin() + unwind_table_count_,
+              unwind_table_->entries.begin());
+  }
+  return unwind_table_->entries;
+}
+
+void Win32X64CodeCache::UpdateUnwindTable() {
+#ifdef USE_GROWABLE_FUNCTION_TABLE
+  if (unwind_table_dirty_) {
+    // The edited table is registered before the old one is removed, so that
+    // unwinding always finds one of them. Once removed, the system no longer
+    // reads the old one.
+    unwind_table_dirty_ = false;
+    auto& table = unwind_table_->entries;
+    void* old_handle = unwind_table_handle_;
+    if (RtlAddGrowableFunctionTable(
+            &unwind_table_handle_, table.data(), unwind_table_count_,
+            DWORD(table.size()),
+            reinterpret_cast<ULONG_PTR>(generated_code_base_),
+            reinterpret_cast<ULONG_PTR>(generated_code_base_ +
+                                        kGeneratedCodeSize))) {
+      XELOGE("Unable to recreate unwind function table");
+      unwind_table_handle_ = nullptr;
+    }
+    if (old_handle) {
+      RtlDeleteGrowableFunctionTable(old_handle);
+    }
+  } else {
+    RtlGrowFunctionTable(unwind_table_handle_, unwind_table_count_);
+  }
+#else
+  unwind_table_dirty_ = false;
+#endif  // USE_GROWABLE_FUNCTION_TABLE
+  unwind_table_->registered_count.store(unwind_table_count_,
+                                        std::memory_order_release);
+  auto old_table = registered_unwind_table_.exchange(unwind_table_);
+  if (old_table != unwind_table_) {
+    // Becomes a spare once LookupUnwindInfo can no longer be reading it.
+    retired_unwind_tables_.Retire(old_table);
+  }
+}
+
 void Win32X64CodeCache::PlaceCode(uint32_t guest_address, void* machine_code,
                                   size_t code_size, size_t stack_size,
                                   void* code_address,
                                   UnwindReservation unwind_reservation) {
-  // Add unwind info.
-  InitializeUnwindEntry(unwind_reservation.entry_address,
-                        unwind_reservation.table_slot, code_address, code_size,
-                        stack_size);
-
-#ifdef USE_GROWABLE_FUNCTION_TABLE
-  // Notify that the unwind table has grown.
-  // We do this outside of the lock, but with the latest total count.
-  RtlGrowFunctionTable(unwind_table_handle_, unwind_table_count_);
-#endif  // USE_GROWABLE_FUNCTION_TABLE
+  // Add unwind info. The table entry pointing at it was added with the
+  // reservation.
+  InitializeUnwindEntry(unwind_reservation.entry_address, stack_size);
+
+  {
+    // Notify that the unwind table has changed, with the latest total count.
+    auto global_lock = global_critical_region_.Acquire();
+    UpdateUnwindTable();
+  }
 
   // This isn't needed on x64 (probably), but is convention.
   FlushInstructionCache(GetCurrentProcess(), code_address, code_size);
@@ -210,9 +354,6 @@ typedef struct _UNWIND_INFO {
 } UNWIND_INFO, *PUNWIND_INFO;
 
 void Win32X64CodeCache::InitializeUnwindEntry(uint8_t* unwind_entry_address,
-                                              size_t unwind_table_slot,
-                                              void* code_address,
-                                              size_t code_size,
                                               size_t stack_size) {
   auto unwind_info = reinterpret_cast<UNWIND_INFO*>(unwind_entry_address);
 
@@ -266,18 +407,16 @@ void Win32X64CodeCache::InitializeUnwindEntry(uint8_t* unwind_entry_address,
     unwind_code = unwind_info->UnwindCode[co++];
     unwind_code.FrameOffset = (USHORT)(stack_size) / 8;
   }
-
-  // Add entry.
-  auto& fn_entry = unwind_table_[unwind_table_slot];
-  fn_entry.BeginAddress =
-      (DWORD)(reinterpret_cast<uint8_t*>(code_address) - generated_code_base_);
-  fn_entry.EndAddress = (DWORD)(fn_entry.BeginAddress + code_size);
-  fn_entry.UnwindData = (DWORD)(unwind_entry_address - generated_code_base_);
 }
 
 void* Win32X64CodeCache::LookupUnwindInfo(uint64_t host_pc) {
-  return std::bsearch(
-      &host_pc, unwind_table_.data(), unwind_table_count_ + 1,
+  // Returned as a copy, as the table may be reused once this returns.
+  static thread_local RUNTIME_FUNCTION found_entry;
+  uint32_t epoch = retired_unwind_tables_.BeginRead();
+  auto table = registered_unwind_table_.load(std::memory_order_acquire);
+  auto entry = std::bsearch(
+      &host_pc, table->entries.data(),
+      table->registered_count.load(std::memory_order_acquire),
       sizeof(RUNTIME_FUNCTION),
       [](const void* key_ptr, const void* element_ptr) {
         auto key =
@@ -291,6 +430,11 @@ void* Win32X64CodeCache::LookupUnwindInfo(uint64_t host_pc) {
           return 0;
         }
       });
+  if (entry) {
+    found_entry = *reinterpret_cast<RUNTIME_FUNCTION*>(entry);
+  }
+  retired_unwind_tables_.EndRead(epoch);
+  return entry ? &found_entry : nullptr;
 }
 
 }  // namespace x64
@@ -11,7 +11,9 @@
 
 #include <gflags/gflags.h>
 
+#include <algorithm>
 #include <climits>
+#include <cstddef>
 #include <cstring>
 
 #include "xenia/base/assert.h"
@@ -69,14 +71,7 @@ X64Emitter::X64Emitter(X64Backend* backend, XbyakAllocator* allocator)
       backend_(backend),
       code_cache_(backend->code_cache()),
       allocator_(allocator) {
-  if (FLAGS_enable_haswell_instructions) {
-    feature_flags_ |= cpu_.has(Xbyak::util::Cpu::tAVX2) ? kX64EmitAVX2 : 0;
-    feature_flags_ |= cpu_.has(Xbyak::util::Cpu::tFMA) ? kX64EmitFMA : 0;
-    feature_flags_ |= cpu_.has(Xbyak::util::Cpu::tLZCNT) ? kX64EmitLZCNT : 0;
-    feature_flags_ |= cpu_.has(Xbyak::util::Cpu::tBMI2) ? kX64EmitBMI2 : 0;
-    feature_flags_ |= cpu_.has(Xbyak::util::Cpu::tF16C) ? kX64EmitF16C : 0;
-    feature_flags_ |= cpu_.has(Xbyak::util::Cpu::tMOVBE) ? kX64EmitMovbe : 0;
-  }
+  feature_flags_ = QueryFeatureFlags();
 
   if (!cpu_.has(Xbyak::util::Cpu::tAVX)) {
     xe::FatalError(
@@ -88,6 +83,28 @@ X64Emitter::X64Emitter(X64Backend* backend, XbyakAllocator* allocator)
 
 X64Emitter::~X64Emitter() = default;
 
+uint32_t X64Emitter::QueryFeatureFlags() {
+  uint32_t feature_flags = 0;
+  if (FLAGS_enable_haswell_instructions) {
+    Xbyak::util::Cpu cpu;
+    feature_flags |= cpu.has(Xbyak::util::Cpu::tAVX2) ? kX64EmitAVX2 : 0;
+    feature_flags |= cpu.has(Xbyak::util::Cpu::tFMA) ? kX64EmitFMA : 0;
+    feature_flags |= cpu.has(Xbyak::util::Cpu::tLZCNT) ? kX64EmitLZCNT : 0;
+    feature_flags |= cpu.has(Xbyak::util::Cpu::tBMI2) ? kX64EmitBMI2 : 0;
+    feature_flags |= cpu.has(Xbyak::util::Cpu::tF16C) ? kX64EmitF16C : 0;
+    feature_flags |= cpu.has(Xbyak::util::Cpu::tMOVBE) ? kX64EmitMovbe : 0;
+  }
+  return feature_flags;
+}
+
+// Called from baseline tier code once it has become hot.
+uint64_t TierUpFunction(void* raw_context, uint64_t function_ptr) {
+  auto thread_state = *reinterpret_cast<ThreadState**>(raw_context);
+  thread_state->processor()->OnFunctionHot(
+      reinterpret_cast<GuestFunction*>(function_ptr));
+  return 0;
+}
+
 bool X64Emitter::Emit(GuestFunction* function, HIRBuilder* builder,
                       uint32_t debug_info_flags, FunctionDebugInfo* debug_info,
                       void** out_code_address, size_t* out_code_size,
@@ -98,7 +115,22 @@ bool X64Emitter::Emit(GuestFunction* function, HIRBuilder* builder,
   debug_info_ = debug_info;
   debug_info_flags_ = debug_info_flags;
   trace_data_ = &function->trace_data();
+  block_coverage_ = &function->block_coverage();
   source_map_arena_.Reset();
+  bool is_baseline = function->tier() == GuestFunction::Tier::kBaseline;
+  tier_up_function_ = is_baseline ? function : nullptr;
+
+  // Code destined for the persistent cache must not contain any host pointers
+  // we can't fix up in a later run. Debug/trace code embeds plenty of them.
+  // Baseline code is short lived so we only ever cache its replacement.
+  relocatable_ = !debug_info_flags && !is_baseline &&
+                 backend_->LookupPersistentCache(function->address());
+  cacheable_ = relocatable_;
+  relocations_.clear();
+  call_sites_.clear();
+  constant_sites_.clear();
+  inline_caches_.clear();
+  current_guest_address_ = function->address();
 
   // Fill the generator with code.
   size_t stack_size = 0;
@@ -110,6 +142,12 @@ bool X64Emitter::Emit(GuestFunction* function, HIRBuilder* builder,
   *out_code_size = getSize();
   *out_code_address = Emplace(stack_size, function);
 
+  // Inline caches can start filling now that they know where their code is.
+  for (auto inline_cache : inline_caches_) {
+    inline_cache->code_address =
+        uint32_t(reinterpret_cast<uintptr_t>(*out_code_address));
+  }
+
   // Stash source map.
   source_map_arena_.CloneContents(out_source_map);
 
@@ -125,7 +163,8 @@ void* X64Emitter::Emplace(size_t stack_size, GuestFunction* function) {
   void* new_address;
   if (function) {
     new_address = code_cache_->PlaceGuestCode(function->address(), top_, size_,
-                                              stack_size, function);
+                                              stack_size, function,
+                                              &call_sites_, &constant_sites_);
   } else {
     new_address = code_cache_->PlaceHostCode(0, top_, size_, stack_size);
   }
@@ -146,6 +185,11 @@ bool X64Emitter::Emit(HIRBuilder* builder, size_t* out_stack_size) {
   size_t stack_offset = StackLayout::GUEST_STACK_SIZE;
   for (auto it = locals.begin(); it != locals.end(); ++it) {
     auto slot = *it;
+    if (slot->reg.set) {
+      // Assigned a register for the whole function; see LOAD_LOCAL.
+      slot->set_constant(uint32_t(0));
+      continue;
+    }
     size_t type_size = GetTypeSize(slot->type);
     // Align to natural size.
     stack_offset = xe::align(stack_offset, type_size);
@@ -176,6 +220,18 @@ bool X64Emitter::Emit(HIRBuilder* builder, size_t* out_stack_size) {
   mov(qword[rsp + StackLayout::GUEST_RET_ADDR], rdx);
   mov(qword[rsp + StackLayout::GUEST_CALL_RET_ADDR], 0);
 
+  // Baseline code counts its calls and asks to be recompiled once hot.
+  // The counter is racy but only ever steps down by one, so it hits zero.
+  if (tier_up_function_) {
+    Xbyak::Label not_hot;
+    mov(rax,
+        reinterpret_cast<uint64_t>(tier_up_function_->tier_up_countdown()));
+    dec(dword[rax]);
+    jnz(not_hot);
+    CallNative(TierUpFunction, reinterpret_cast<uint64_t>(tier_up_function_));
+    L(not_hot);
+  }
+
   // Safe now to do some tracing.
   if (debug_info_flags_ & DebugInfoFlags::kDebugInfoTraceFunctions) {
     // We require 32-bit addresses.
@@ -216,6 +272,9 @@ bool X64Emitter::Emit(HIRBuilder* builder, size_t* out_stack_size) {
       L(label->name);
       label = label->next;
     }
+    if (debug_info_flags_ & DebugInfoFlags::kDebugInfoTraceBlockCoverage) {
+      EmitBlockCoverage(block);
+    }
 
     // Process instructions.
     const Instr* instr = block->instr_head;
@@ -257,6 +316,7 @@ void X64Emitter::MarkSourceOffset(const Instr* i) {
   entry->guest_address = static_cast<uint32_t>(i->src1.offset);
   entry->hir_offset = uint32_t(i->block->ordinal << 16) | i->ordinal;
   entry->code_offset = static_cast<uint32_t>(getSize());
+  current_guest_address_ = entry->guest_address;
 
   if (FLAGS_emit_source_annotations) {
     nop();
@@ -275,6 +335,25 @@ void X64Emitter::MarkSourceOffset(const Instr* i) {
   }
 }
 
+void X64Emitter::EmitBlockCoverage(const hir::Block* block) {
+  // Blocks split off within a guest instruction have no source offset and
+  // share the byte of the instruction.
+  for (auto instr = block->instr_head; instr; instr = instr->next) {
+    if (instr->opcode != &hir::OPCODE_SOURCE_OFFSET_info) {
+      continue;
+    }
+    auto guest_address = static_cast<uint32_t>(instr->src1.offset);
+    uint8_t* state = block_coverage_->block_state(guest_address);
+    if (*state == FunctionBlockCoverage::kNotBlock) {
+      *state = FunctionBlockCoverage::kBlockNotHit;
+    }
+    // We require 32-bit addresses.
+    assert_true(uint64_t(state) < UINT_MAX);
+    mov(byte[low_address(state)], FunctionBlockCoverage::kBlockHit);
+    return;
+  }
+}
+
 void X64Emitter::EmitGetCurrentThreadId() {
   // rcx must point to context. We could fetch from the stack if needed.
   mov(ax, word[rcx + offsetof(ppc::PPCContext, thread_id)]);
@@ -359,8 +438,14 @@ extern "C" uint64_t ResolveFunction(void* raw_context,
 void X64Emitter::Call(const hir::Instr* instr, GuestFunction* function) {
   assert_not_null(function);
   auto fn = static_cast<X64Function*>(function);
-  // Resolve address to the function to call and store in rax.
-  if (fn->machine_code()) {
+  if (code_cache_->has_call_linking()) {
+    CallLinked(instr, function);
+    return;
+  }
+
+  // Resolve address to the function to call and store in rax. Code that can
+  // be invalidated is only reached through the indirection table.
+  if (fn->machine_code() && !relocatable_ && !FLAGS_invalidate_code_on_write) {
     // TODO(benvanik): is it worth it to do this? It removes the need for
     // a ResolveFunction call, but makes the table less useful.
     assert_zero(uint64_t(fn->machine_code()) & 0xFFFFFFFF00000000);
@@ -375,7 +460,7 @@ void X64Emitter::Call(const hir::Instr* instr, GuestFunction* function) {
     // Old-style resolve.
     // Not too important because indirection table is almost always available.
     // TODO: Overwrite the call-site with a straight call.
-    mov(rax, reinterpret_cast<uint64_t>(ResolveFunction));
+    MovHostAddress(rax, reinterpret_cast<void*>(ResolveFunction));
     mov(rdx, function->address());
     call(rax);
     ReloadECX();
@@ -400,6 +485,33 @@ void X64Emitter::Call(const hir::Instr* instr, GuestFunction* function) {
   }
 }
 
+void X64Emitter::CallLinked(const hir::Instr* instr, GuestFunction* function) {
+  if (instr->flags & hir::CALL_TAIL) {
+    // Since we skip the prolog we need to mark the return here.
+    EmitTraceUserCallReturn();
+
+    // Pass the callers return address over.
+    mov(rdx, qword[rsp + StackLayout::GUEST_RET_ADDR]);
+
+    add(rsp, static_cast<uint32_t>(stack_size()));
+  } else {
+    // Return address is from the previous SET_RETURN_ADDRESS.
+    mov(rdx, qword[rsp + StackLayout::GUEST_CALL_RET_ADDR]);
+  }
+
+  // The code cache points the rel32 at the call link stub (which dispatches
+  // through the indirection table with ebx, like below) until the target is
+  // placed, and then straight at the target. It must be 4b aligned so it can
+  // be swapped atomically; code is placed at 16b alignment.
+  while ((getSize() + 5 + 1) & 0x3) {
+    nop();
+  }
+  mov(ebx, function->address());
+  db(instr->flags & hir::CALL_TAIL ? 0xE9 : 0xE8);  // jmp/call rel32
+  call_sites_.push_back({uint32_t(getSize()), function->address()});
+  dd(0);
+}
+
 void X64Emitter::CallIndirect(const hir::Instr* instr,
                               const Xbyak::Reg64& reg) {
   // Check if return.
@@ -408,6 +520,14 @@ void X64Emitter::CallIndirect(const hir::Instr* instr,
     je(epilog_label(), CodeGenerator::T_NEAR);
   }
 
+  // Likely returns are handled above and rarely worth caching. Cache state
+  // is per-process, so it's also kept out of persistently cached code.
+  if (FLAGS_inline_cache_size > 0 && code_cache_->has_indirection_table() &&
+      !(instr->flags & hir::CALL_POSSIBLE_RETURN) && !relocatable_) {
+    CallIndirectCached(instr, reg);
+    return;
+  }
+
   // Load the pointer to the indirection table maintained in X64CodeCache.
   // The target dword will either contain the address of the generated code
   // or a thunk to ResolveAddress.
@@ -420,7 +540,7 @@ void X64Emitter::CallIndirect(const hir::Instr* instr,
     // Old-style resolve.
     // Not too important because indirection table is almost always available.
     mov(edx, reg.cvt32());
-    mov(rax, reinterpret_cast<uint64_t>(ResolveFunction));
+    MovHostAddress(rax, reinterpret_cast<void*>(ResolveFunction));
     call(rax);
     ReloadECX();
     ReloadEDX();
@@ -444,6 +564,102 @@ void X64Emitter::CallIndirect(const hir::Instr* instr,
   }
 }
 
+// Called from an inline cache site when the target isn't cached.
+uint64_t InlineCacheMiss(void* raw_context, uint64_t inline_cache_ptr,
+                         uint64_t target_address) {
+  auto thread_state = *reinterpret_cast<ThreadState**>(raw_context);
+  auto backend =
+      reinterpret_cast<X64Backend*>(thread_state->processor()->backend());
+  return backend->OnInlineCacheMiss(
+      reinterpret_cast<X64InlineCache*>(inline_cache_ptr),
+      uint32_t(target_address));
+}
+
+void X64Emitter::CallIndirectCached(const hir::Instr* instr,
+                                    const Xbyak::Reg64& reg) {
+  bool is_tail = (instr->flags & hir::CALL_TAIL) != 0;
+  if (reg.cvt32() != ebx) {
+    mov(ebx, reg.cvt32());
+  }
+
+  auto inline_cache = backend_->AllocateInlineCache(current_guest_address_);
+  inline_caches_.push_back(inline_cache);
+  uint32_t inline_cache_address =
+      uint32_t(reinterpret_cast<uintptr_t>(inline_cache));
+  int entry_count =
+      std::min(FLAGS_inline_cache_size,
+               int32_t(X64InlineCache::kMaxEntryCount));
+  inline_cache->entry_capacity = entry_count;
+
+  mov(eax, inline_cache_address);
+  inc(dword[rax + offsetof(X64InlineCache, call_count)]);
+
+  // Entries start out never matching (there's no code at guest 0) and are
+  // patched in by the backend. The imm32 and rel32 are 4b aligned so that
+  // they can be swapped atomically.
+  Xbyak::Label done;
+  for (int n = 0; n < entry_count; ++n) {
+    Xbyak::Label next;
+    while ((getSize() + 2) & 0x3) {
+      nop();
+    }
+    db(0x81);
+    db(0xFB);  // cmp ebx, imm32
+    inline_cache->entry_compare_offsets[n] = uint32_t(getSize());
+    dd(0);
+    jne(next, T_NEAR);
+    if (is_tail) {
+      EmitTraceUserCallReturn();
+      mov(rdx, qword[rsp + StackLayout::GUEST_RET_ADDR]);
+      add(rsp, static_cast<uint32_t>(stack_size()));
+    } else {
+      mov(rdx, qword[rsp + StackLayout::GUEST_CALL_RET_ADDR]);
+    }
+    while ((getSize() + 1) & 0x3) {
+      nop();
+    }
+    db(is_tail ? 0xE9 : 0xE8);  // jmp/call rel32
+    inline_cache->entry_branch_offsets[n] = uint32_t(getSize());
+    dd(0);
+    if (!is_tail) {
+      jmp(done, T_NEAR);
+    }
+    L(next);
+  }
+
+  // Miss. While there are free entries let the backend try to cache the
+  // target, otherwise go through the indirection table as usual.
+  Xbyak::Label megamorphic;
+  Xbyak::Label dispatch;
+  mov(eax, inline_cache_address);
+  inc(dword[rax + offsetof(X64InlineCache, miss_count)]);
+  cmp(dword[rax + offsetof(X64InlineCache, entry_count)], entry_count);
+  jae(megamorphic, T_NEAR);
+  mov(r8d, ebx);
+  mov(rdx, inline_cache_address);
+  MovHostAddress(rax, reinterpret_cast<void*>(InlineCacheMiss));
+  call(rax);
+  ReloadECX();
+  ReloadEDX();
+  jmp(dispatch, T_NEAR);
+  L(megamorphic);
+  mov(eax, dword[ebx]);
+  L(dispatch);
+
+  // Actually jump/call to rax. ebx still holds the target for the
+  // ResolveFunction thunk.
+  if (is_tail) {
+    EmitTraceUserCallReturn();
+    mov(rdx, qword[rsp + StackLayout::GUEST_RET_ADDR]);
+    add(rsp, static_cast<uint32_t>(stack_size()));
+    jmp(rax);
+  } else {
+    mov(rdx, qword[rsp + StackLayout::GUEST_CALL_RET_ADDR]);
+    call(rax);
+  }
+  L(done);
+}
+
 uint64_t UndefinedCallExtern(void* raw_context, uint64_t function_ptr) {
   auto function = reinterpret_cast<Function*>(function_ptr);
   if (!FLAGS_ignore_undefined_externs) {
@@ -465,9 +681,10 @@ void X64Emitter::CallExtern(const hir::Instr* instr, const Function* function) {
       // rdx = target host function
       // r8  = arg0
       // r9  = arg1
-      mov(rdx, reinterpret_cast<uint64_t>(builtin_function->handler()));
-      mov(r8, reinterpret_cast<uint64_t>(builtin_function->arg0()));
-      mov(r9, reinterpret_cast<uint64_t>(builtin_function->arg1()));
+      MovHostAddress(rdx,
+                     reinterpret_cast<void*>(builtin_function->handler()));
+      MovBuiltinArg(r8, builtin_function, 0);
+      MovBuiltinArg(r9, builtin_function, 1);
       auto thunk = backend()->guest_to_host_thunk();
       mov(rax, reinterpret_cast<uint64_t>(thunk));
       call(rax);
@@ -477,12 +694,22 @@ void X64Emitter::CallExtern(const hir::Instr* instr, const Function* function) {
     }
   } else if (function->behavior() == Function::Behavior::kExtern) {
     auto extern_function = static_cast<const GuestFunction*>(function);
+    auto export_data = extern_function->export_data();
     if (extern_function->extern_handler()) {
       undefined = false;
       // rcx = context
       // rdx = target host function
-      mov(rdx, reinterpret_cast<uint64_t>(extern_function->extern_handler()));
-      mov(r8, qword[rcx + offsetof(ppc::PPCContext, kernel_state)]);
+      if (export_data && export_data->profile &&
+          !export_data->function_data.trampoline) {
+        // DEPRECATED shims are timed by a wrapper that gets the export.
+        MovHostAddress(
+            rdx, reinterpret_cast<void*>(&ExportResolver::CallProfiledShim));
+        MovHostAddress(r8, export_data);
+      } else {
+        MovHostAddress(
+            rdx, reinterpret_cast<void*>(extern_function->extern_handler()));
+        mov(r8, qword[rcx + offsetof(ppc::PPCContext, kernel_state)]);
+      }
       auto thunk = backend()->guest_to_host_thunk();
       mov(rax, reinterpret_cast<uint64_t>(thunk));
       call(rax);
@@ -492,26 +719,28 @@ void X64Emitter::CallExtern(const hir::Instr* instr, const Function* function) {
     }
   }
   if (undefined) {
+    // The Function pointer is only valid for this run.
+    cacheable_ = false;
     CallNative(UndefinedCallExtern, reinterpret_cast<uint64_t>(function));
   }
 }
 
 void X64Emitter::CallNative(void* fn) {
-  mov(rax, reinterpret_cast<uint64_t>(fn));
+  MovHostAddress(rax, fn);
   call(rax);
   ReloadECX();
   ReloadEDX();
 }
 
 void X64Emitter::CallNative(uint64_t (*fn)(void* raw_context)) {
-  mov(rax, reinterpret_cast<uint64_t>(fn));
+  MovHostAddress(rax, reinterpret_cast<void*>(fn));
   call(rax);
   ReloadECX();
   ReloadEDX();
 }
 
 void X64Emitter::CallNative(uint64_t (*fn)(void* raw_context, uint64_t arg0)) {
-  mov(rax, reinterpret_cast<uint64_t>(fn));
+  MovHostAddress(rax, reinterpret_cast<void*>(fn));
   call(rax);
   ReloadECX();
   ReloadEDX();
@@ -520,7 +749,7 @@ void X64Emitter::CallNative(uint64_t (*fn)(void* raw_context, uint64_t arg0)) {
 void X64Emitter::CallNative(uint64_t (*fn)(void* raw_context, uint64_t arg0),
                             uint64_t arg0) {
   mov(rdx, arg0);
-  mov(rax, reinterpret_cast<uint64_t>(fn));
+  MovHostAddress(rax, reinterpret_cast<void*>(fn));
   call(rax);
   ReloadECX();
   ReloadEDX();
@@ -532,7 +761,7 @@ void X64Emitter::CallNativeSafe(void* fn) {
   // r8  = arg0
   // r9  = arg1
   // r10 = arg2
-  mov(rdx, reinterpret_cast<uint64_t>(fn));
+  MovHostAddress(rdx, fn);
   auto thunk = backend()->guest_to_host_thunk();
   mov(rax, reinterpret_cast<uint64_t>(thunk));
   call(rax);
@@ -541,6 +770,55 @@ void X64Emitter::CallNativeSafe(void* fn) {
   // rax = host return
 }
 
+void X64Emitter::MovHostAddress(const Xbyak::Reg64& dest,
+                                const void* address) {
+  uint64_t value = reinterpret_cast<uint64_t>(address);
+  if (!relocatable_) {
+    mov(dest, value);
+  } else if (code_cache_->IsHostImageAddress(value)) {
+    MovRelocatable(dest, value, X64CodeRelocation::Type::kHostImage,
+                   value - code_cache_->host_image_base());
+  } else {
+    // Heap pointers and such can't be recovered in another process.
+    cacheable_ = false;
+    mov(dest, value);
+  }
+}
+
+const MMIORange* X64Emitter::LookupMMIOSite() const {
+  return backend_->LookupMMIOSite(current_guest_address_);
+}
+
+void X64Emitter::MovRelocatable(const Xbyak::Reg64& dest, uint64_t value,
+                                X64CodeRelocation::Type type, uint64_t key) {
+  // Always encode as a full movabs (REX.W B8+r imm64) so that the immediate
+  // is at a known position regardless of its value.
+  db(0x48 | (dest.getIdx() >= 8 ? 0x01 : 0x00));
+  db(0xB8 | (dest.getIdx() & 0x7));
+  X64CodeRelocation relocation;
+  relocation.code_offset = static_cast<uint32_t>(getSize());
+  relocation.type = type;
+  relocation.key = key;
+  relocations_.push_back(relocation);
+  dq(value);
+}
+
+void X64Emitter::MovBuiltinArg(const Xbyak::Reg64& dest,
+                               const BuiltinFunction* function, int arg_index) {
+  void* arg = arg_index ? function->arg1() : function->arg0();
+  uint64_t value = reinterpret_cast<uint64_t>(arg);
+  if (!relocatable_ || code_cache_->IsHostImageAddress(value)) {
+    MovHostAddress(dest, arg);
+    return;
+  }
+  // Builtin args are usually pointers to runtime objects. Builtins are
+  // defined at startup so we can look them up again by address on load.
+  MovRelocatable(dest, value,
+                 arg_index ? X64CodeRelocation::Type::kBuiltinArg1
+                           : X64CodeRelocation::Type::kBuiltinArg0,
+                 function->address());
+}
+
 void X64Emitter::SetReturnAddress(uint64_t value) {
   mov(rax, value);
   mov(qword[rsp + StackLayout::GUEST_CALL_RET_ADDR], rax);
@@ -677,6 +955,13 @@ uint32_t X64Emitter::PlaceData(Memory* memory) {
                                            0x80000000u, 0x80000000u),
       /* XMMShortMinPS          */ vec128f(SHRT_MIN),
       /* XMMShortMaxPS          */ vec128f(SHRT_MAX),
+      /* XMMShiftMaskPI8        */ vec128b(0x07),
+      /* XMMShiftMaskPI16       */ vec128s(0x000F),
+      /* XMMShrByteMask1        */ vec128b(0x7F),
+      /* XMMShrByteMask2        */ vec128b(0x3F),
+      /* XMMShrByteMask4        */ vec128b(0x0F),
+      /* XMMShaByteSignBits     */ vec128i(0x10204080u, 0x01020408u,
+                                           0x00000000u, 0x00000000u),
   };
   uint32_t ptr = memory->SystemHeapAlloc(sizeof(xmm_consts));
   std::memcpy(memory->TranslateVirtual(ptr), xmm_consts, sizeof(xmm_consts));
@@ -697,9 +982,14 @@ void X64Emitter::LoadConstantXmm(Xbyak::Xmm dest, const vec128_t& v) {
   } else if (v.low == ~0ull && v.high == ~0ull) {
     // 1111...
     vpcmpeqb(dest, dest);
+  } else if (!relocatable_) {
+    // From the pool shared by all functions, patched with the pool address
+    // when the code is placed.
+    vmovdqa(dest, ptr[rip]);
+    constant_sites_.push_back(
+        {uint32_t(getSize() - 4), code_cache_->PlaceConstant(v)});
   } else {
-    // TODO(benvanik): see what other common values are.
-    // TODO(benvanik): build constant table - 99% are reused.
+    // The pool isn't saved with persistently cached code.
     MovMem64(rsp + kStashOffset, v.low);
     MovMem64(rsp + kStashOffset + 8, v.high);
     vmovdqa(dest, ptr[rsp + kStashOffset]);
@@ -13,6 +13,7 @@
 #include <vector>
 
 #include "xenia/base/arena.h"
+#include "xenia/cpu/backend/x64/x64_persistent_cache.h"
 #include "xenia/cpu/function.h"
 #include "xenia/cpu/function_trace_data.h"
 #include "xenia/cpu/hir/hir_builder.h"
@@ -27,6 +28,7 @@
 namespace xe {
 namespace cpu {
 class Processor;
+struct MMIORange;
 }  // namespace cpu
 }  // namespace xe
 
@@ -89,6 +91,12 @@ enum XmmConst {
   XMMSignMaskF32,
   XMMShortMinPS,
   XMMShortMaxPS,
+  XMMShiftMaskPI8,
+  XMMShiftMaskPI16,
+  XMMShrByteMask1,
+  XMMShrByteMask2,
+  XMMShrByteMask4,
+  XMMShaByteSignBits,
 };
 
 // Unfortunately due to the design of xbyak we have to pass this to the ctor.
@@ -121,6 +129,9 @@ class X64Emitter : public Xbyak::CodeGenerator {
 
   static uint32_t PlaceData(Memory* memory);
 
+  // Returns the X64EmitterFeatureFlags usable on the host.
+  static uint32_t QueryFeatureFlags();
+
  public:
   // Reserved:  rsp
   // Scratch:   rax/rcx/rdx
@@ -168,6 +179,12 @@ class X64Emitter : public Xbyak::CodeGenerator {
   void CallNative(uint64_t (*fn)(void* raw_context, uint64_t arg0),
                   uint64_t arg0);
   void CallNativeSafe(void* fn);
+  // Moves a host pointer into the given register. If the code is being
+  // generated for the persistent code cache this records a relocation, or
+  // marks the function uncacheable if the pointer cannot be relocated.
+  void MovHostAddress(const Xbyak::Reg64& dest, const void* address);
+  // MMIO range the guest instruction being emitted has trapped on, if any.
+  const MMIORange* LookupMMIOSite() const;
   void SetReturnAddress(uint64_t value);
   void ReloadECX();
   void ReloadEDX();
@@ -194,11 +211,28 @@ class X64Emitter : public Xbyak::CodeGenerator {
 
   size_t stack_size() const { return stack_size_; }
 
+  // True if the last emitted function can be stored in the persistent cache.
+  bool is_cacheable() const { return cacheable_; }
+  // Relocations that must be applied to reuse the last emitted function.
+  const std::vector<X64CodeRelocation>& relocations() const {
+    return relocations_;
+  }
+  // Linkable guest calls in the last emitted function.
+  const std::vector<X64CallSite>& call_sites() const { return call_sites_; }
+
  protected:
   void* Emplace(size_t stack_size, GuestFunction* function = nullptr);
   bool Emit(hir::HIRBuilder* builder, size_t* out_stack_size);
+  // Records the entry to the block in the block coverage of the function.
+  void EmitBlockCoverage(const hir::Block* block);
   void EmitGetCurrentThreadId();
   void EmitTraceUserCallReturn();
+  void MovRelocatable(const Xbyak::Reg64& dest, uint64_t value,
+                      X64CodeRelocation::Type type, uint64_t key);
+  void MovBuiltinArg(const Xbyak::Reg64& dest,
+                     const BuiltinFunction* function, int arg_index);
+  void CallLinked(const hir::Instr* instr, GuestFunction* function);
+  void CallIndirectCached(const hir::Instr* instr, const Xbyak::Reg64& reg);
 
  protected:
   Processor* processor_ = nullptr;
@@ -215,10 +249,23 @@ class X64Emitter : public Xbyak::CodeGenerator {
   FunctionDebugInfo* debug_info_ = nullptr;
   uint32_t debug_info_flags_ = 0;
   FunctionTraceData* trace_data_ = nullptr;
+  FunctionBlockCoverage* block_coverage_ = nullptr;
   Arena source_map_arena_;
+  // Set when emitting baseline tier code that counts calls until hot.
+  GuestFunction* tier_up_function_ = nullptr;
 
   size_t stack_size_ = 0;
 
+  // When set all host pointers are emitted so that they can be relocated.
+  bool relocatable_ = false;
+  bool cacheable_ = false;
+  std::vector<X64CodeRelocation> relocations_;
+  std::vector<X64CallSite> call_sites_;
+  std::vector<X64ConstantSite> constant_sites_;
+  std::vector<X64InlineCache*> inline_caches_;
+  // Guest address of the instruction being emitted, for reporting.
+  uint32_t current_guest_address_ = 0;
+
   static const uint32_t gpr_reg_map_[GPR_COUNT];
   static const uint32_t xmm_reg_map_[XMM_COUNT];
 };
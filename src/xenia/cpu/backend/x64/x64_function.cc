@@ -31,6 +31,13 @@ void X64Function::Setup(uint8_t* machine_code, size_t machine_code_length) {
 }
 
 bool X64Function::CallImpl(ThreadState* thread_state, uint32_t return_address) {
+  if (is_invalidated()) {
+    // Translated again on the way.
+    thread_state->processor()->ResolveFunction(address());
+    if (!machine_code_) {
+      return false;
+    }
+  }
   auto backend =
       reinterpret_cast<X64Backend*>(thread_state->processor()->backend());
   auto thunk = backend->host_to_guest_thunk();
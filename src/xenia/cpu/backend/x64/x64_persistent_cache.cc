@@ -0,0 +1,291 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2016 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#include "xenia/cpu/backend/x64/x64_persistent_cache.h"
+
+#include <cstring>
+
+#include "third_party/xxhash/xxhash.h"
+#include "xenia/base/assert.h"
+#include "xenia/base/filesystem.h"
+#include "xenia/base/logging.h"
+#include "xenia/base/string.h"
+
+namespace xe {
+namespace cpu {
+namespace backend {
+namespace x64 {
+
+std::unique_ptr<X64PersistentCache> X64PersistentCache::Open(
+    const std::wstring& path, const Header& header, bool read_only) {
+  auto cache =
+      std::unique_ptr<X64PersistentCache>(new X64PersistentCache(path, header));
+
+  if (read_only) {
+    cache->mapping_ = MappedMemory::Open(path, MappedMemory::Mode::kRead);
+    if (!cache->mapping_ || cache->mapping_->size() < sizeof(Header) ||
+        std::memcmp(cache->mapping_->data(), &header, sizeof(header))) {
+      XELOGI("No matching code cache %S to share", path.c_str());
+      return nullptr;
+    }
+    if (!cache->IndexMappedEntries()) {
+      // Entries before the damage are still good, and it isn't ours to fix.
+      XELOGW("Code cache %S is damaged", path.c_str());
+    }
+    XELOGI("Mapped %d cached functions from %S",
+           int(cache->mapped_entries_.size()), path.c_str());
+    return cache;
+  }
+
+  // Load whatever is already present. If the header doesn't match or the log
+  // is damaged we rewrite the file with only the entries we trust.
+  bool needs_rewrite = true;
+  FILE* file = xe::filesystem::OpenFile(path, "rb");
+  if (file) {
+    Header file_header;
+    if (fread(&file_header, sizeof(file_header), 1, file) == 1 &&
+        !std::memcmp(&file_header, &header, sizeof(header))) {
+      needs_rewrite = !cache->ReadEntries(file);
+    } else {
+      XELOGI("Discarding stale code cache %S", path.c_str());
+    }
+    fclose(file);
+  }
+
+  if (needs_rewrite) {
+    xe::filesystem::CreateParentFolder(path);
+    file = xe::filesystem::OpenFile(path, "wb");
+    if (!file) {
+      XELOGE("Unable to create code cache file %S", path.c_str());
+      return nullptr;
+    }
+    fwrite(&header, sizeof(header), 1, file);
+    for (auto& it : cache->entries_) {
+      cache->WriteEntry(file, it.second);
+    }
+    fclose(file);
+  }
+
+  cache->file_ = xe::filesystem::OpenFile(path, "ab");
+  if (!cache->file_) {
+    XELOGE("Unable to open code cache file %S", path.c_str());
+    return nullptr;
+  }
+
+  XELOGI("Loaded %d cached functions from %S", int(cache->entries_.size()),
+         path.c_str());
+  return cache;
+}
+
+X64PersistentCache::X64PersistentCache(const std::wstring& path,
+                                       const Header& header)
+    : path_(path), header_(header) {}
+
+X64PersistentCache::~X64PersistentCache() {
+  if (file_) {
+    fclose(file_);
+    file_ = nullptr;
+  }
+}
+
+size_t X64PersistentCache::entry_count() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return entries_.size() + mapped_entries_.size();
+}
+
+size_t X64PersistentCache::private_size() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return private_size_;
+}
+
+uint64_t X64PersistentCache::HashSource(const void* source, size_t length) {
+  return XXH64(source, length, 0);
+}
+
+bool X64PersistentCache::Lookup(uint32_t guest_address,
+                                uint32_t guest_end_address,
+                                uint64_t source_hash, Entry* out_entry) {
+  if (mapping_) {
+    // Immutable once opened.
+    auto it = mapped_entries_.find(guest_address);
+    if (it == mapped_entries_.end()) {
+      return false;
+    }
+    auto entry_header =
+        reinterpret_cast<const EntryHeader*>(mapping_->data() + it->second);
+    if (entry_header->guest_end_address != guest_end_address ||
+        entry_header->source_hash != source_hash) {
+      return false;
+    }
+    DecodeEntry(*entry_header,
+                reinterpret_cast<const uint8_t*>(entry_header + 1), out_entry);
+    return true;
+  }
+
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto it = entries_.find(guest_address);
+  if (it == entries_.end()) {
+    return false;
+  }
+  const auto& entry = it->second;
+  if (entry.guest_end_address != guest_end_address ||
+      entry.source_hash != source_hash) {
+    // Source has changed since the entry was generated (patched or
+    // self-modifying code). It'll be replaced when retranslated.
+    return false;
+  }
+  *out_entry = entry;
+  return true;
+}
+
+void X64PersistentCache::Store(Entry entry) {
+  if (mapping_) {
+    return;
+  }
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (file_) {
+    WriteEntry(file_, entry);
+    fflush(file_);
+  }
+  private_size_ += GetEntrySize(entry);
+  auto& stored_entry = entries_[entry.guest_address];
+  private_size_ -= GetEntrySize(stored_entry);
+  stored_entry = std::move(entry);
+}
+
+size_t X64PersistentCache::GetPayloadSize(const EntryHeader& entry_header) {
+  return entry_header.code_size +
+         entry_header.relocation_count * sizeof(X64CodeRelocation) +
+         entry_header.call_site_count * sizeof(X64CallSite) +
+         entry_header.source_map_count * sizeof(SourceMapEntry);
+}
+
+size_t X64PersistentCache::GetEntrySize(const Entry& entry) {
+  return entry.code.size() +
+         entry.relocations.size() * sizeof(X64CodeRelocation) +
+         entry.call_sites.size() * sizeof(X64CallSite) +
+         entry.source_map.size() * sizeof(SourceMapEntry);
+}
+
+void X64PersistentCache::DecodeEntry(const EntryHeader& entry_header,
+                                     const uint8_t* payload,
+                                     Entry* out_entry) {
+  size_t code_length = entry_header.code_size;
+  size_t relocations_length =
+      entry_header.relocation_count * sizeof(X64CodeRelocation);
+  size_t call_sites_length =
+      entry_header.call_site_count * sizeof(X64CallSite);
+  size_t source_map_length =
+      entry_header.source_map_count * sizeof(SourceMapEntry);
+
+  auto& entry = *out_entry;
+  entry.guest_address = entry_header.guest_address;
+  entry.guest_end_address = entry_header.guest_end_address;
+  entry.source_hash = entry_header.source_hash;
+  entry.stack_size = entry_header.stack_size;
+  auto p = payload;
+  entry.code.assign(p, p + code_length);
+  p += code_length;
+  entry.relocations.resize(entry_header.relocation_count);
+  std::memcpy(entry.relocations.data(), p, relocations_length);
+  p += relocations_length;
+  entry.call_sites.resize(entry_header.call_site_count);
+  std::memcpy(entry.call_sites.data(), p, call_sites_length);
+  p += call_sites_length;
+  entry.source_map.resize(entry_header.source_map_count);
+  std::memcpy(entry.source_map.data(), p, source_map_length);
+}
+
+bool X64PersistentCache::ReadEntries(FILE* file) {
+  std::vector<uint8_t> payload;
+  while (true) {
+    EntryHeader entry_header;
+    size_t read = fread(&entry_header, 1, sizeof(entry_header), file);
+    if (!read) {
+      // Clean end of the log.
+      return true;
+    }
+    if (read != sizeof(entry_header) || entry_header.magic != kEntryMagic) {
+      return false;
+    }
+
+    payload.resize(GetPayloadSize(entry_header));
+    if (fread(payload.data(), 1, payload.size(), file) != payload.size() ||
+        HashSource(payload.data(), payload.size()) !=
+            entry_header.payload_hash) {
+      // Truncated (likely a crash while writing) or damaged.
+      return false;
+    }
+
+    // Later entries supersede earlier ones for the same function.
+    auto& entry = entries_[entry_header.guest_address];
+    private_size_ -= GetEntrySize(entry);
+    DecodeEntry(entry_header, payload.data(), &entry);
+    private_size_ += GetEntrySize(entry);
+  }
+}
+
+bool X64PersistentCache::IndexMappedEntries() {
+  const uint8_t* data = mapping_->data();
+  size_t size = mapping_->size();
+  size_t offset = sizeof(Header);
+  while (offset < size) {
+    if (size - offset < sizeof(EntryHeader)) {
+      return false;
+    }
+    auto entry_header = reinterpret_cast<const EntryHeader*>(data + offset);
+    size_t payload_size = GetPayloadSize(*entry_header);
+    if (entry_header->magic != kEntryMagic ||
+        size - offset - sizeof(EntryHeader) < payload_size ||
+        HashSource(entry_header + 1, payload_size) !=
+            entry_header->payload_hash) {
+      return false;
+    }
+    mapped_entries_[entry_header->guest_address] = offset;
+    offset += sizeof(EntryHeader) + payload_size;
+  }
+  return true;
+}
+
+void X64PersistentCache::WriteEntry(FILE* file, const Entry& entry) {
+  size_t relocations_length =
+      entry.relocations.size() * sizeof(X64CodeRelocation);
+  size_t call_sites_length = entry.call_sites.size() * sizeof(X64CallSite);
+  size_t source_map_length = entry.source_map.size() * sizeof(SourceMapEntry);
+
+  XXH64_state_t hash_state;
+  XXH64_reset(&hash_state, 0);
+  XXH64_update(&hash_state, entry.code.data(), entry.code.size());
+  XXH64_update(&hash_state, entry.relocations.data(), relocations_length);
+  XXH64_update(&hash_state, entry.call_sites.data(), call_sites_length);
+  XXH64_update(&hash_state, entry.source_map.data(), source_map_length);
+
+  EntryHeader entry_header;
+  entry_header.magic = kEntryMagic;
+  entry_header.guest_address = entry.guest_address;
+  entry_header.guest_end_address = entry.guest_end_address;
+  entry_header.stack_size = entry.stack_size;
+  entry_header.source_hash = entry.source_hash;
+  entry_header.code_size = uint32_t(entry.code.size());
+  entry_header.relocation_count = uint32_t(entry.relocations.size());
+  entry_header.source_map_count = uint32_t(entry.source_map.size());
+  entry_header.call_site_count = uint32_t(entry.call_sites.size());
+  entry_header.payload_hash = XXH64_digest(&hash_state);
+
+  fwrite(&entry_header, sizeof(entry_header), 1, file);
+  fwrite(entry.code.data(), 1, entry.code.size(), file);
+  fwrite(entry.relocations.data(), 1, relocations_length, file);
+  fwrite(entry.call_sites.data(), 1, call_sites_length, file);
+  fwrite(entry.source_map.data(), 1, source_map_length, file);
+}
+
+}  // namespace x64
+}  // namespace backend
+}  // namespace cpu
+}  // namespace xe
@@ -0,0 +1,170 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2016 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#ifndef XENIA_CPU_BACKEND_X64_X64_PERSISTENT_CACHE_H_
+#define XENIA_CPU_BACKEND_X64_X64_PERSISTENT_CACHE_H_
+
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "xenia/base/mapped_memory.h"
+#include "xenia/cpu/backend/x64/x64_code_cache.h"
+#include "xenia/cpu/function.h"
+
+namespace xe {
+namespace cpu {
+namespace backend {
+namespace x64 {
+
+// A 64-bit immediate in emitted code that must be patched before the code can
+// be reused in another process.
+struct X64CodeRelocation {
+  enum class Type : uint32_t {
+    // Address within the host executable image (functions, static data).
+    // key is the offset from the image base.
+    kHostImage = 0,
+    // arg0/arg1 of the builtin function at guest address key.
+    kBuiltinArg0 = 1,
+    kBuiltinArg1 = 2,
+  };
+
+  // Offset of the 8 byte immediate from the start of the function code.
+  uint32_t code_offset;
+  Type type;
+  uint64_t key;
+};
+
+// On-disk cache of generated guest code for a single module.
+// The file is an append-only log of entries following a header describing the
+// host and module it was generated for. Any mismatch in the header discards the
+// whole file and entries are individually validated against the current guest
+// instructions before use, so a stale cache only ever results in
+// retranslation.
+//
+// A read-only cache maps the file instead of loading it, so processes using
+// the same file share its pages, and never writes to it.
+class X64PersistentCache {
+ public:
+  static const uint32_t kFileMagic = 'XCC1';
+  static const uint32_t kEntryMagic = 'XCCE';
+  // Bump whenever the emitter output or serialization format changes.
+  static const uint32_t kFileVersion = 7;
+
+  // Emitter options that change the shape of generated code.
+  enum Options : uint32_t {
+    kOptionCallLinking = 1 << 0,
+  };
+
+  struct Header {
+    uint32_t magic;
+    uint32_t version;
+    uint64_t host_image_identity;
+    uint64_t module_hash;
+    uint32_t guest_low;
+    uint32_t guest_high;
+    uint32_t feature_flags;
+    uint32_t emitter_data;
+    uint32_t host_to_guest_thunk;
+    uint32_t guest_to_host_thunk;
+    uint32_t resolve_function_thunk;
+    uint32_t options;
+  };
+  static_assert(sizeof(Header) == 56, "header layout must be stable");
+
+  struct Entry {
+    uint32_t guest_address = 0;
+    uint32_t guest_end_address = 0;
+    uint64_t source_hash = 0;
+    uint32_t stack_size = 0;
+    std::vector<uint8_t> code;
+    std::vector<X64CodeRelocation> relocations;
+    std::vector<X64CallSite> call_sites;
+    std::vector<SourceMapEntry> source_map;
+  };
+
+  // Opens the cache file at the given path, creating it if required.
+  // Existing contents are only kept if their header matches the given one.
+  // Read-only caches fail to open if the file doesn't exist or match.
+  static std::unique_ptr<X64PersistentCache> Open(const std::wstring& path,
+                                                  const Header& header,
+                                                  bool read_only = false);
+
+  ~X64PersistentCache();
+
+  const std::wstring& path() const { return path_; }
+  const Header& header() const { return header_; }
+  size_t entry_count();
+  // Bytes of entries held in memory, and of the file mapped if read-only.
+  size_t private_size();
+  size_t mapped_size() const { return mapping_ ? mapping_->size() : 0; }
+
+  bool ContainsAddress(uint32_t guest_address) const {
+    return guest_address >= header_.guest_low &&
+           guest_address < header_.guest_high;
+  }
+
+  // Hashes guest instructions. Used for both module and function keys.
+  static uint64_t HashSource(const void* source, size_t length);
+
+  // Copies out the entry for the given function if one exists that was
+  // generated from identical source instructions.
+  bool Lookup(uint32_t guest_address, uint32_t guest_end_address,
+              uint64_t source_hash, Entry* out_entry);
+
+  // Records a new entry and appends it to the file. Dropped if read-only.
+  void Store(Entry entry);
+
+ private:
+  struct EntryHeader {
+    uint32_t magic;
+    uint32_t guest_address;
+    uint32_t guest_end_address;
+    uint32_t stack_size;
+    uint64_t source_hash;
+    uint32_t code_size;
+    uint32_t relocation_count;
+    uint32_t source_map_count;
+    uint32_t call_site_count;
+    uint64_t payload_hash;
+  };
+
+  X64PersistentCache(const std::wstring& path, const Header& header);
+
+  static size_t GetPayloadSize(const EntryHeader& entry_header);
+  static size_t GetEntrySize(const Entry& entry);
+  static void DecodeEntry(const EntryHeader& entry_header,
+                          const uint8_t* payload, Entry* out_entry);
+  bool ReadEntries(FILE* file);
+  // Indexes the entries of the mapped file.
+  bool IndexMappedEntries();
+  void WriteEntry(FILE* file, const Entry& entry);
+
+  std::wstring path_;
+  Header header_;
+
+  std::mutex mutex_;
+  FILE* file_ = nullptr;
+  std::unordered_map<uint32_t, Entry> entries_;
+  size_t private_size_ = 0;
+
+  std::unique_ptr<MappedMemory> mapping_;
+  // Offsets of the entry headers in the mapping, by guest address.
+  std::unordered_map<uint32_t, size_t> mapped_entries_;
+};
+
+}  // namespace x64
+}  // namespace backend
+}  // namespace cpu
+}  // namespace xe
+
+#endif  // XENIA_CPU_BACKEND_X64_X64_PERSISTENT_CACHE_H_
@@ -25,6 +25,7 @@
 #include "xenia/cpu/backend/x64/x64_sequences.h"
 
 #include <algorithm>
+#include <cstddef>
 #include <cstring>
 #include <unordered_map>
 
@@ -34,7 +35,9 @@
 #include "xenia/base/threading.h"
 #include "xenia/cpu/backend/x64/x64_emitter.h"
 #include "xenia/cpu/backend/x64/x64_tracers.h"
+#include "xenia/cpu/cpu_flags.h"
 #include "xenia/cpu/hir/hir_builder.h"
+#include "xenia/cpu/ppc/ppc_context.h"
 #include "xenia/cpu/processor.h"
 
 // For OPCODE_PACK/OPCODE_UNPACK
@@ -671,7 +674,7 @@ struct COMMENT : Sequence<COMMENT, I<OPCODE_COMMENT, VoidOp, OffsetOp>> {
       // TODO(benvanik): pass through.
       // TODO(benvanik): don't just leak this memory.
       auto str_copy = strdup(str);
-      e.mov(e.rdx, reinterpret_cast<uint64_t>(str_copy));
+      e.MovHostAddress(e.rdx, str_copy);
       e.CallNative(reinterpret_cast<void*>(TraceString));
     }
   }
@@ -1599,14 +1602,14 @@ struct LOAD_VECTOR_SHL_I8
     if (i.src1.is_constant) {
       auto sh = i.src1.constant();
       assert_true(sh < xe::countof(lvsl_table));
-      e.mov(e.rax, (uintptr_t)&lvsl_table[sh]);
+      e.MovHostAddress(e.rax, &lvsl_table[sh]);
       e.vmovaps(i.dest, e.ptr[e.rax]);
     } else {
       // TODO(benvanik): find a cheaper way of doing this.
       e.movzx(e.rdx, i.src1);
       e.and_(e.dx, 0xF);
       e.shl(e.dx, 4);
-      e.mov(e.rax, (uintptr_t)lvsl_table);
+      e.MovHostAddress(e.rax, lvsl_table);
       e.vmovaps(i.dest, e.ptr[e.rax + e.rdx]);
       e.ReloadEDX();
     }
@@ -1641,14 +1644,14 @@ struct LOAD_VECTOR_SHR_I8
     if (i.src1.is_constant) {
       auto sh = i.src1.constant();
       assert_true(sh < xe::countof(lvsr_table));
-      e.mov(e.rax, (uintptr_t)&lvsr_table[sh]);
+      e.MovHostAddress(e.rax, &lvsr_table[sh]);
       e.vmovaps(i.dest, e.ptr[e.rax]);
     } else {
       // TODO(benvanik): find a cheaper way of doing this.
       e.movzx(e.rdx, i.src1);
       e.and_(e.dx, 0xF);
       e.shl(e.dx, 4);
-      e.mov(e.rax, (uintptr_t)lvsr_table);
+      e.MovHostAddress(e.rax, lvsr_table);
       e.vmovaps(i.dest, e.ptr[e.rax + e.rdx]);
       e.ReloadEDX();
     }
@@ -1661,9 +1664,30 @@ EMITTER_OPCODE_TABLE(OPCODE_LOAD_VECTOR_SHR, LOAD_VECTOR_SHR_I8);
 // ============================================================================
 struct LOAD_CLOCK : Sequence<LOAD_CLOCK, I<OPCODE_LOAD_CLOCK, I64Op>> {
   static void Emit(X64Emitter& e, const EmitArgType& i) {
-    // It'd be cool to call QueryPerformanceCounter directly, but w/e.
-    e.CallNative(LoadClock);
+    auto params = Clock::guest_clock_params();
+    if (!params->uses_tsc) {
+      e.CallNative(LoadClock);
+      e.mov(i.dest, e.rax);
+      return;
+    }
+    // Clock::QueryGuestTickCount from the timestamp counter, inline.
+    e.rdtsc();
+    e.shl(e.rdx, 32);
+    e.or_(e.rax, e.rdx);
+    e.MovHostAddress(e.rcx, params);
+    e.sub(e.rax,
+          e.qword[e.rcx + offsetof(Clock::GuestClockParams, counter_base)]);
+    // Counters from before the base, as read on another core, count as 0.
+    e.sbb(e.rdx, e.rdx);
+    e.not_(e.rdx);
+    e.and_(e.rax, e.rdx);
+    e.mul(e.qword[e.rcx + offsetof(Clock::GuestClockParams, scale)]);
+    e.shrd(e.rax, e.rdx, 32);
+    e.add(e.rax, e.qword[e.rcx + offsetof(Clock::GuestClockParams, tick_base)]);
     e.mov(i.dest, e.rax);
+    // rcx held the context and rdx the membase.
+    e.ReloadECX();
+    e.ReloadEDX();
   }
   static uint64_t LoadClock(void* raw_context) {
     return Clock::QueryGuestTickCount();
@@ -1675,9 +1699,23 @@ EMITTER_OPCODE_TABLE(OPCODE_LOAD_CLOCK, LOAD_CLOCK);
 // OPCODE_LOAD_LOCAL
 // ============================================================================
 // Note: all types are always aligned on the stack.
+// Locals given a register by the register allocator live there instead.
+template <typename REG>
+bool GetLocalReg(const Instr::Op& slot, REG* out_reg) {
+  if (!slot.value->reg.set) {
+    return false;
+  }
+  X64Emitter::SetupReg(slot.value, *out_reg);
+  return true;
+}
 struct LOAD_LOCAL_I8
     : Sequence<LOAD_LOCAL_I8, I<OPCODE_LOAD_LOCAL, I8Op, I32Op>> {
   static void Emit(X64Emitter& e, const EmitArgType& i) {
+    Reg8 reg;
+    if (GetLocalReg(i.instr->src1, &reg)) {
+      e.mov(i.dest, reg);
+      return;
+    }
     e.mov(i.dest, e.byte[e.rsp + i.src1.constant()]);
     // e.TraceLoadI8(DATA_LOCAL, i.src1.constant, i.dest);
   }
@@ -1685,6 +1723,11 @@ struct LOAD_LOCAL_I8
 struct LOAD_LOCAL_I16
     : Sequence<LOAD_LOCAL_I16, I<OPCODE_LOAD_LOCAL, I16Op, I32Op>> {
   static void Emit(X64Emitter& e, const EmitArgType& i) {
+    Reg16 reg;
+    if (GetLocalReg(i.instr->src1, &reg)) {
+      e.mov(i.dest, reg);
+      return;
+    }
     e.mov(i.dest, e.word[e.rsp + i.src1.constant()]);
     // e.TraceLoadI16(DATA_LOCAL, i.src1.constant, i.dest);
   }
@@ -1692,6 +1735,11 @@ struct LOAD_LOCAL_I16
 struct LOAD_LOCAL_I32
     : Sequence<LOAD_LOCAL_I32, I<OPCODE_LOAD_LOCAL, I32Op, I32Op>> {
   static void Emit(X64Emitter& e, const EmitArgType& i) {
+    Reg32 reg;
+    if (GetLocalReg(i.instr->src1, &reg)) {
+      e.mov(i.dest, reg);
+      return;
+    }
     e.mov(i.dest, e.dword[e.rsp + i.src1.constant()]);
     // e.TraceLoadI32(DATA_LOCAL, i.src1.constant, i.dest);
   }
@@ -1699,6 +1747,11 @@ struct LOAD_LOCAL_I32
 struct LOAD_LOCAL_I64
     : Sequence<LOAD_LOCAL_I64, I<OPCODE_LOAD_LOCAL, I64Op, I32Op>> {
   static void Emit(X64Emitter& e, const EmitArgType& i) {
+    Reg64 reg;
+    if (GetLocalReg(i.instr->src1, &reg)) {
+      e.mov(i.dest, reg);
+      return;
+    }
     e.mov(i.dest, e.qword[e.rsp + i.src1.constant()]);
     // e.TraceLoadI64(DATA_LOCAL, i.src1.constant, i.dest);
   }
@@ -1706,6 +1759,11 @@ struct LOAD_LOCAL_I64
 struct LOAD_LOCAL_F32
     : Sequence<LOAD_LOCAL_F32, I<OPCODE_LOAD_LOCAL, F32Op, I32Op>> {
   static void Emit(X64Emitter& e, const EmitArgType& i) {
+    Xmm reg;
+    if (GetLocalReg(i.instr->src1, &reg)) {
+      e.vmovaps(i.dest, reg);
+      return;
+    }
     e.vmovss(i.dest, e.dword[e.rsp + i.src1.constant()]);
     // e.TraceLoadF32(DATA_LOCAL, i.src1.constant, i.dest);
   }
@@ -1713,6 +1771,11 @@ struct LOAD_LOCAL_F32
 struct LOAD_LOCAL_F64
     : Sequence<LOAD_LOCAL_F64, I<OPCODE_LOAD_LOCAL, F64Op, I32Op>> {
   static void Emit(X64Emitter& e, const EmitArgType& i) {
+    Xmm reg;
+    if (GetLocalReg(i.instr->src1, &reg)) {
+      e.vmovaps(i.dest, reg);
+      return;
+    }
     e.vmovsd(i.dest, e.qword[e.rsp + i.src1.constant()]);
     // e.TraceLoadF64(DATA_LOCAL, i.src1.constant, i.dest);
   }
@@ -1720,6 +1783,11 @@ struct LOAD_LOCAL_F64
 struct LOAD_LOCAL_V128
     : Sequence<LOAD_LOCAL_V128, I<OPCODE_LOAD_LOCAL, V128Op, I32Op>> {
   static void Emit(X64Emitter& e, const EmitArgType& i) {
+    Xmm reg;
+    if (GetLocalReg(i.instr->src1, &reg)) {
+      e.vmovaps(i.dest, reg);
+      return;
+    }
     e.vmovaps(i.dest, e.ptr[e.rsp + i.src1.constant()]);
     // e.TraceLoadV128(DATA_LOCAL, i.src1.constant, i.dest);
   }
@@ -1735,6 +1803,15 @@ EMITTER_OPCODE_TABLE(OPCODE_LOAD_LOCAL, LOAD_LOCAL_I8, LOAD_LOCAL_I16,
 struct STORE_LOCAL_I8
     : Sequence<STORE_LOCAL_I8, I<OPCODE_STORE_LOCAL, VoidOp, I32Op, I8Op>> {
   static void Emit(X64Emitter& e, const EmitArgType& i) {
+    Reg8 reg;
+    if (GetLocalReg(i.instr->src1, &reg)) {
+      if (i.src2.is_constant) {
+        e.mov(reg, i.src2.constant());
+      } else {
+        e.mov(reg, i.src2);
+      }
+      return;
+    }
     // e.TraceStoreI8(DATA_LOCAL, i.src1.constant, i.src2);
     e.mov(e.byte[e.rsp + i.src1.constant()], i.src2);
   }
@@ -1742,6 +1819,15 @@ struct STORE_LOCAL_I8
 struct STORE_LOCAL_I16
     : Sequence<STORE_LOCAL_I16, I<OPCODE_STORE_LOCAL, VoidOp, I32Op, I16Op>> {
   static void Emit(X64Emitter& e, const EmitArgType& i) {
+    Reg16 reg;
+    if (GetLocalReg(i.instr->src1, &reg)) {
+      if (i.src2.is_constant) {
+        e.mov(reg, i.src2.constant());
+      } else {
+        e.mov(reg, i.src2);
+      }
+      return;
+    }
     // e.TraceStoreI16(DATA_LOCAL, i.src1.constant, i.src2);
     e.mov(e.word[e.rsp + i.src1.constant()], i.src2);
   }
@@ -1749,6 +1835,15 @@ struct STORE_LOCAL_I16
 struct STORE_LOCAL_I32
     : Sequence<STORE_LOCAL_I32, I<OPCODE_STORE_LOCAL, VoidOp, I32Op, I32Op>> {
   static void Emit(X64Emitter& e, const EmitArgType& i) {
+    Reg32 reg;
+    if (GetLocalReg(i.instr->src1, &reg)) {
+      if (i.src2.is_constant) {
+        e.mov(reg, i.src2.constant());
+      } else {
+        e.mov(reg, i.src2);
+      }
+      return;
+    }
     // e.TraceStoreI32(DATA_LOCAL, i.src1.constant, i.src2);
     e.mov(e.dword[e.rsp + i.src1.constant()], i.src2);
   }
@@ -1756,6 +1851,15 @@ struct STORE_LOCAL_I32
 struct STORE_LOCAL_I64
     : Sequence<STORE_LOCAL_I64, I<OPCODE_STORE_LOCAL, VoidOp, I32Op, I64Op>> {
   static void Emit(X64Emitter& e, const EmitArgType& i) {
+    Reg64 reg;
+    if (GetLocalReg(i.instr->src1, &reg)) {
+      if (i.src2.is_constant) {
+        e.mov(reg, i.src2.constant());
+      } else {
+        e.mov(reg, i.src2);
+      }
+      return;
+    }
     // e.TraceStoreI64(DATA_LOCAL, i.src1.constant, i.src2);
     e.mov(e.qword[e.rsp + i.src1.constant()], i.src2);
   }
@@ -1763,6 +1867,15 @@ struct STORE_LOCAL_I64
 struct STORE_LOCAL_F32
     : Sequence<STORE_LOCAL_F32, I<OPCODE_STORE_LOCAL, VoidOp, I32Op, F32Op>> {
   static void Emit(X64Emitter& e, const EmitArgType& i) {
+    Xmm reg;
+    if (GetLocalReg(i.instr->src1, &reg)) {
+      if (i.src2.is_constant) {
+        e.LoadConstantXmm(reg, i.src2.constant());
+      } else {
+        e.vmovaps(reg, i.src2);
+      }
+      return;
+    }
     // e.TraceStoreF32(DATA_LOCAL, i.src1.constant, i.src2);
     e.vmovss(e.dword[e.rsp + i.src1.constant()], i.src2);
   }
@@ -1770,6 +1883,15 @@ struct STORE_LOCAL_F32
 struct STORE_LOCAL_F64
     : Sequence<STORE_LOCAL_F64, I<OPCODE_STORE_LOCAL, VoidOp, I32Op, F64Op>> {
   static void Emit(X64Emitter& e, const EmitArgType& i) {
+    Xmm reg;
+    if (GetLocalReg(i.instr->src1, &reg)) {
+      if (i.src2.is_constant) {
+        e.LoadConstantXmm(reg, i.src2.constant());
+      } else {
+        e.vmovaps(reg, i.src2);
+      }
+      return;
+    }
     // e.TraceStoreF64(DATA_LOCAL, i.src1.constant, i.src2);
     e.vmovsd(e.qword[e.rsp + i.src1.constant()], i.src2);
   }
@@ -1777,6 +1899,15 @@ struct STORE_LOCAL_F64
 struct STORE_LOCAL_V128
     : Sequence<STORE_LOCAL_V128, I<OPCODE_STORE_LOCAL, VoidOp, I32Op, V128Op>> {
   static void Emit(X64Emitter& e, const EmitArgType& i) {
+    Xmm reg;
+    if (GetLocalReg(i.instr->src1, &reg)) {
+      if (i.src2.is_constant) {
+        e.LoadConstantXmm(reg, i.src2.constant());
+      } else {
+        e.vmovaps(reg, i.src2);
+      }
+      return;
+    }
     // e.TraceStoreV128(DATA_LOCAL, i.src1.constant, i.src2);
     e.vmovaps(e.ptr[e.rsp + i.src1.constant()], i.src2);
   }
@@ -2027,7 +2158,7 @@ struct LOAD_MMIO_I32
     // uint64_t (context, addr)
     auto mmio_range = reinterpret_cast<MMIORange*>(i.src1.value);
     auto read_address = uint32_t(i.src2.value);
-    e.mov(e.r8, uint64_t(mmio_range->callback_context));
+    e.MovHostAddress(e.r8, mmio_range->callback_context);
     e.mov(e.r9d, read_address);
     e.CallNativeSafe(reinterpret_cast<void*>(mmio_range->read));
     e.bswap(e.eax);
@@ -2052,7 +2183,7 @@ struct STORE_MMIO_I32
     // void (context, addr, value)
     auto mmio_range = reinterpret_cast<MMIORange*>(i.src1.value);
     auto write_address = uint32_t(i.src2.value);
-    e.mov(e.r8, uint64_t(mmio_range->callback_context));
+    e.MovHostAddress(e.r8, mmio_range->callback_context);
     e.mov(e.r9d, write_address);
     if (i.src3.is_constant) {
       e.mov(e.r10d, xe::byte_swap(i.src3.constant()));
@@ -2093,6 +2224,27 @@ RegExp ComputeMemoryAddress(X64Emitter& e, const T& guest) {
     return e.rdx + e.rax;
   }
 }
+// Loads and stores that have trapped on MMIO before check for the range
+// inline and call its handler directly. Returns the range if the check was
+// emitted, in which case the caller emits the call and then the regular
+// access at the given label.
+template <typename T>
+const MMIORange* EmitMMIOSiteCheck(X64Emitter& e, const T& guest,
+                                   Xbyak::Label& not_mmio) {
+  if (guest.is_constant) {
+    // Constant propagation already turned MMIO accesses into LOAD/STORE_MMIO.
+    return nullptr;
+  }
+  auto mmio_range = e.LookupMMIOSite();
+  if (!mmio_range) {
+    return nullptr;
+  }
+  e.mov(e.eax, guest.reg().cvt32());
+  e.and_(e.eax, mmio_range->mask);
+  e.cmp(e.eax, mmio_range->address);
+  e.jne(not_mmio, e.T_NEAR);
+  return mmio_range;
+}
 struct LOAD_I8 : Sequence<LOAD_I8, I<OPCODE_LOAD, I8Op, I64Op>> {
   static void Emit(X64Emitter& e, const EmitArgType& i) {
     auto addr = ComputeMemoryAddress(e, i.src1);
@@ -2126,6 +2278,21 @@ struct LOAD_I16 : Sequence<LOAD_I16, I<OPCODE_LOAD, I16Op, I64Op>> {
 };
 struct LOAD_I32 : Sequence<LOAD_I32, I<OPCODE_LOAD, I32Op, I64Op>> {
   static void Emit(X64Emitter& e, const EmitArgType& i) {
+    Xbyak::Label not_mmio, done;
+    auto mmio_range = EmitMMIOSiteCheck(e, i.src1, not_mmio);
+    if (mmio_range) {
+      // Handlers return host order, which a load without swap would see
+      // swapped.
+      e.MovHostAddress(e.r8, mmio_range->callback_context);
+      e.mov(e.r9d, i.src1.reg().cvt32());
+      e.CallNativeSafe(reinterpret_cast<void*>(mmio_range->read));
+      if (!(i.instr->flags & LoadStoreFlags::LOAD_STORE_BYTE_SWAP)) {
+        e.bswap(e.eax);
+      }
+      e.mov(i.dest, e.eax);
+      e.jmp(done, e.T_NEAR);
+      e.L(not_mmio);
+    }
     auto addr = ComputeMemoryAddress(e, i.src1);
     if (i.instr->flags & LoadStoreFlags::LOAD_STORE_BYTE_SWAP) {
       if (e.IsFeatureEnabled(kX64EmitMovbe)) {
@@ -2142,6 +2309,7 @@ struct LOAD_I32 : Sequence<LOAD_I32, I<OPCODE_LOAD, I32Op, I64Op>> {
       e.lea(e.rdx, e.ptr[addr]);
       e.CallNative(reinterpret_cast<void*>(TraceMemoryLoadI32));
     }
+    e.L(done);
   }
 };
 struct LOAD_I64 : Sequence<LOAD_I64, I<OPCODE_LOAD, I64Op, I64Op>> {
@@ -2258,6 +2426,26 @@ struct STORE_I16 : Sequence<STORE_I16, I<OPCODE_STORE, VoidOp, I64Op, I16Op>> {
 };
 struct STORE_I32 : Sequence<STORE_I32, I<OPCODE_STORE, VoidOp, I64Op, I32Op>> {
   static void Emit(X64Emitter& e, const EmitArgType& i) {
+    Xbyak::Label not_mmio, done;
+    auto mmio_range = EmitMMIOSiteCheck(e, i.src1, not_mmio);
+    if (mmio_range) {
+      bool byte_swap =
+          (i.instr->flags & LoadStoreFlags::LOAD_STORE_BYTE_SWAP) != 0;
+      e.MovHostAddress(e.r8, mmio_range->callback_context);
+      e.mov(e.r9d, i.src1.reg().cvt32());
+      if (i.src2.is_constant) {
+        e.mov(e.r10d, byte_swap ? uint32_t(i.src2.constant())
+                                : xe::byte_swap(uint32_t(i.src2.constant())));
+      } else {
+        e.mov(e.r10d, i.src2);
+        if (!byte_swap) {
+          e.bswap(e.r10d);
+        }
+      }
+      e.CallNativeSafe(reinterpret_cast<void*>(mmio_range->write));
+      e.jmp(done, e.T_NEAR);
+      e.L(not_mmio);
+    }
     auto addr = ComputeMemoryAddress(e, i.src1);
     if (i.instr->flags & LoadStoreFlags::LOAD_STORE_BYTE_SWAP) {
       assert_false(i.src2.is_constant);
@@ -2279,6 +2467,7 @@ struct STORE_I32 : Sequence<STORE_I32, I<OPCODE_STORE, VoidOp, I64Op, I32Op>> {
       e.lea(e.rdx, e.ptr[addr]);
       e.CallNative(reinterpret_cast<void*>(TraceMemoryStoreI32));
     }
+    e.L(done);
   }
 };
 struct STORE_I64 : Sequence<STORE_I64, I<OPCODE_STORE, VoidOp, I64Op, I64Op>> {
@@ -2381,7 +2570,12 @@ EMITTER_OPCODE_TABLE(OPCODE_STORE, STORE_I8, STORE_I16, STORE_I32, STORE_I64,
 struct PREFETCH
     : Sequence<PREFETCH, I<OPCODE_PREFETCH, VoidOp, I64Op, OffsetOp>> {
   static void Emit(X64Emitter& e, const EmitArgType& i) {
-    // TODO(benvanik): prefetch addr -> length.
+    // Prefetches never fault, so the guest address needs no checks. Stores
+    // are prefetched the same way, as prefetchw isn't available everywhere.
+    auto addr = ComputeMemoryAddress(e, i.src1);
+    for (uint64_t offset = 0; offset < i.src2.value; offset += 64) {
+      e.prefetcht0(e.ptr[addr + uint32_t(offset)]);
+    }
   }
 };
 EMITTER_OPCODE_TABLE(OPCODE_PREFETCH, PREFETCH);
@@ -2395,6 +2589,32 @@ struct MEMORY_BARRIER
 };
 EMITTER_OPCODE_TABLE(OPCODE_MEMORY_BARRIER, MEMORY_BARRIER);
 
+// ============================================================================
+// OPCODE_SPIN_WAIT
+// ============================================================================
+struct SPIN_WAIT : Sequence<SPIN_WAIT, I<OPCODE_SPIN_WAIT, VoidOp>> {
+  static uint64_t EmulateSpinWait(void* raw_context) {
+    // Gives the host threads the guest may be waiting on a chance to run on
+    // oversubscribed hosts.
+    auto context = reinterpret_cast<ppc::PPCContext*>(raw_context);
+    context->spin_wait_countdown = FLAGS_spin_wait_yield_interval - 1;
+    xe::threading::MaybeYield();
+    return 0;
+  }
+  static void Emit(X64Emitter& e, const EmitArgType& i) {
+    e.pause();
+    if (FLAGS_spin_wait_yield_interval > 0) {
+      // Counted down inline, only calling out to yield once it runs out.
+      Xbyak::Label skip;
+      e.dec(e.dword[e.rcx + offsetof(ppc::PPCContext, spin_wait_countdown)]);
+      e.jns(skip, CodeGenerator::T_NEAR);
+      e.CallNativeSafe(reinterpret_cast<void*>(EmulateSpinWait));
+      e.L(skip);
+    }
+  }
+};
+EMITTER_OPCODE_TABLE(OPCODE_SPIN_WAIT, SPIN_WAIT);
+
 // ============================================================================
 // OPCODE_MEMSET
 // ============================================================================
@@ -2405,22 +2625,18 @@ struct MEMSET_I64_I8_I64
     assert_true(i.src2.is_constant);
     assert_true(i.src3.is_constant);
     assert_true(i.src2.constant() == 0);
-    e.vpxor(e.xmm0, e.xmm0);
+    // dcbz and dcbz128 clear whole aligned cache blocks, so this is a run of
+    // aligned 32 byte stores. The upper halves are cleared afterwards to
+    // avoid AVX to SSE transition stalls in host code.
     auto addr = ComputeMemoryAddress(e, i.src1);
     switch (i.src3.constant()) {
       case 32:
-        e.vmovaps(e.ptr[addr + 0 * 16], e.xmm0);
-        e.vmovaps(e.ptr[addr + 1 * 16], e.xmm0);
-        break;
       case 128:
-        e.vmovaps(e.ptr[addr + 0 * 16], e.xmm0);
-        e.vmovaps(e.ptr[addr + 1 * 16], e.xmm0);
-        e.vmovaps(e.ptr[addr + 2 * 16], e.xmm0);
-        e.vmovaps(e.ptr[addr + 3 * 16], e.xmm0);
-        e.vmovaps(e.ptr[addr + 4 * 16], e.xmm0);
-        e.vmovaps(e.ptr[addr + 5 * 16], e.xmm0);
-        e.vmovaps(e.ptr[addr + 6 * 16], e.xmm0);
-        e.vmovaps(e.ptr[addr + 7 * 16], e.xmm0);
+        e.vxorps(e.ymm0, e.ymm0, e.ymm0);
+        for (int64_t offset = 0; offset < i.src3.constant(); offset += 32) {
+          e.vmovaps(e.ptr[addr + uint32_t(offset)], e.ymm0);
+        }
+        e.vzeroupper();
         break;
       default:
         assert_unhandled_case(i.src3.constant());
@@ -5369,6 +5585,125 @@ struct SHA_I64 : Sequence<SHA_I64, I<OPCODE_SHA, I64Op, I64Op, I8Op>> {
 };
 EMITTER_OPCODE_TABLE(OPCODE_SHA, SHA_I8, SHA_I16, SHA_I32, SHA_I64);
 
+// ============================================================================
+// Variable per-lane vector shifts
+// ============================================================================
+// x64 has no per-byte shifts and only gained per-word variable shifts with
+// AVX-512BW, so VMX byte/halfword shifts are built from wider operations.
+enum class VectorShiftOp {
+  kShl,
+  kShr,
+  kSha,
+  kRotateLeft,
+};
+
+// Shifts each byte by the low 3 bits of the matching byte in src2. The
+// count bits are moved into the byte sign bits one at a time to select
+// between the value and the value shifted by 4, 2 and then 1.
+// Arithmetic shifts are done logically and then sign extended from the new
+// top bit with (v ^ m) - m, taking m = 0x80 >> n from a table.
+template <typename ARGS>
+void EmitVectorShiftI8(X64Emitter& e, const ARGS& i, VectorShiftOp op) {
+  if (i.src2.is_constant) {
+    e.LoadConstantXmm(e.xmm1, i.src2.constant());
+    e.vpsllw(e.xmm1, e.xmm1, 5);
+  } else {
+    e.vpsllw(e.xmm1, i.src2, 5);
+  }
+  if (i.src1.is_constant) {
+    e.LoadConstantXmm(e.xmm0, i.src1.constant());
+  } else {
+    e.vmovdqa(e.xmm0, i.src1);
+  }
+  static const XmmConst shr_masks[] = {XMMShrByteMask4, XMMShrByteMask2,
+                                       XMMShrByteMask1};
+  for (int n = 0; n < 3; ++n) {
+    int amount = 4 >> n;
+    if (op == VectorShiftOp::kShl) {
+      // Byte adds double each byte without carrying into its neighbor.
+      e.vpaddb(e.xmm2, e.xmm0, e.xmm0);
+      for (int m = 1; m < amount; ++m) {
+        e.vpaddb(e.xmm2, e.xmm2, e.xmm2);
+      }
+    } else {
+      e.vpsrlw(e.xmm2, e.xmm0, amount);
+      e.vpand(e.xmm2, e.xmm2, e.GetXmmConstPtr(shr_masks[n]));
+    }
+    e.vpblendvb(e.xmm0, e.xmm0, e.xmm2, e.xmm1);
+    if (n < 2) {
+      e.vpaddb(e.xmm1, e.xmm1, e.xmm1);
+    }
+  }
+  if (op == VectorShiftOp::kSha) {
+    if (i.src2.is_constant) {
+      e.LoadConstantXmm(e.xmm1, i.src2.constant());
+      e.vpand(e.xmm1, e.xmm1, e.GetXmmConstPtr(XMMShiftMaskPI8));
+    } else {
+      e.vpand(e.xmm1, i.src2, e.GetXmmConstPtr(XMMShiftMaskPI8));
+    }
+    e.vmovdqa(e.xmm2, e.GetXmmConstPtr(XMMShaByteSignBits));
+    e.vpshufb(e.xmm2, e.xmm2, e.xmm1);
+    e.vpxor(e.xmm0, e.xmm0, e.xmm2);
+    e.vpsubb(i.dest, e.xmm0, e.xmm2);
+  } else {
+    e.vmovdqa(i.dest, e.xmm0);
+  }
+}
+
+// AVX2 only has variable dword shifts, so the words are widened to dwords
+// in a ymm register, shifted there and narrowed back.
+template <typename ARGS>
+void EmitVectorShiftI16AVX2(X64Emitter& e, const ARGS& i, VectorShiftOp op) {
+  Xmm src1 = e.xmm2;
+  if (i.src1.is_constant) {
+    e.LoadConstantXmm(src1, i.src1.constant());
+  } else {
+    src1 = i.src1;
+  }
+  if (i.src2.is_constant) {
+    e.LoadConstantXmm(e.xmm1, i.src2.constant());
+    e.vpand(e.xmm1, e.xmm1, e.GetXmmConstPtr(XMMShiftMaskPI16));
+  } else {
+    e.vpand(e.xmm1, i.src2, e.GetXmmConstPtr(XMMShiftMaskPI16));
+  }
+  e.vpmovzxwd(e.ymm1, e.xmm1);
+  bool is_signed = false;
+  switch (op) {
+    case VectorShiftOp::kShl:
+      // Shift from the high half so bits past 16 fall off.
+      e.vpmovzxwd(e.ymm0, src1);
+      e.vpslld(e.ymm0, e.ymm0, 16);
+      e.vpsllvd(e.ymm0, e.ymm0, e.ymm1);
+      e.vpsrld(e.ymm0, e.ymm0, 16);
+      break;
+    case VectorShiftOp::kShr:
+      e.vpmovzxwd(e.ymm0, src1);
+      e.vpsrlvd(e.ymm0, e.ymm0, e.ymm1);
+      break;
+    case VectorShiftOp::kSha:
+      e.vpmovsxwd(e.ymm0, src1);
+      e.vpsravd(e.ymm0, e.ymm0, e.ymm1);
+      is_signed = true;
+      break;
+    case VectorShiftOp::kRotateLeft:
+      // With the word in both halves the high half receives the rotation.
+      e.vpmovzxwd(e.ymm0, src1);
+      e.vpslld(e.ymm2, e.ymm0, 16);
+      e.vpor(e.ymm0, e.ymm0, e.ymm2);
+      e.vpsllvd(e.ymm0, e.ymm0, e.ymm1);
+      e.vpsrld(e.ymm0, e.ymm0, 16);
+      break;
+  }
+  e.vextracti128(e.xmm1, e.ymm0, 1);
+  if (is_signed) {
+    e.vpackssdw(i.dest, e.xmm0, e.xmm1);
+  } else {
+    e.vpackusdw(i.dest, e.xmm0, e.xmm1);
+  }
+  // Host code may not be VEX encoded.
+  e.vzeroupper();
+}
+
 // ============================================================================
 // OPCODE_VECTOR_SHL
 // ============================================================================
@@ -5390,27 +5725,8 @@ struct VECTOR_SHL_V128
         break;
     }
   }
-  static __m128i EmulateVectorShlI8(void*, __m128i src1, __m128i src2) {
-    alignas(16) uint8_t value[16];
-    alignas(16) uint8_t shamt[16];
-    _mm_store_si128(reinterpret_cast<__m128i*>(value), src1);
-    _mm_store_si128(reinterpret_cast<__m128i*>(shamt), src2);
-    for (size_t i = 0; i < 16; ++i) {
-      value[i] = value[i] << (shamt[i] & 0x7);
-    }
-    return _mm_load_si128(reinterpret_cast<__m128i*>(value));
-  }
   static void EmitInt8(X64Emitter& e, const EmitArgType& i) {
-    // TODO(benvanik): native version (with shift magic).
-    if (i.src2.is_constant) {
-      e.LoadConstantXmm(e.xmm0, i.src2.constant());
-      e.lea(e.r9, e.StashXmm(1, e.xmm0));
-    } else {
-      e.lea(e.r9, e.StashXmm(1, i.src2));
-    }
-    e.lea(e.r8, e.StashXmm(0, i.src1));
-    e.CallNativeSafe(reinterpret_cast<void*>(EmulateVectorShlI8));
-    e.vmovaps(i.dest, e.xmm0);
+    EmitVectorShiftI8(e, i, VectorShiftOp::kShl);
   }
   static __m128i EmulateVectorShlI16(void*, __m128i src1, __m128i src2) {
     alignas(16) uint16_t value[8];
@@ -5439,6 +5755,11 @@ struct VECTOR_SHL_V128
       }
     }
 
+    if (e.IsFeatureEnabled(kX64EmitAVX2)) {
+      EmitVectorShiftI16AVX2(e, i, VectorShiftOp::kShl);
+      return;
+    }
+
     // Shift 8 words in src1 by amount specified in src2.
     Xbyak::Label emu, end;
 
@@ -5574,27 +5895,8 @@ struct VECTOR_SHR_V128
         break;
     }
   }
-  static __m128i EmulateVectorShrI8(void*, __m128i src1, __m128i src2) {
-    alignas(16) uint8_t value[16];
-    alignas(16) uint8_t shamt[16];
-    _mm_store_si128(reinterpret_cast<__m128i*>(value), src1);
-    _mm_store_si128(reinterpret_cast<__m128i*>(shamt), src2);
-    for (size_t i = 0; i < 16; ++i) {
-      value[i] = value[i] >> (shamt[i] & 0x7);
-    }
-    return _mm_load_si128(reinterpret_cast<__m128i*>(value));
-  }
   static void EmitInt8(X64Emitter& e, const EmitArgType& i) {
-    // TODO(benvanik): native version (with shift magic).
-    if (i.src2.is_constant) {
-      e.LoadConstantXmm(e.xmm0, i.src2.constant());
-      e.lea(e.r9, e.StashXmm(1, e.xmm0));
-    } else {
-      e.lea(e.r9, e.StashXmm(1, i.src2));
-    }
-    e.lea(e.r8, e.StashXmm(0, i.src1));
-    e.CallNativeSafe(reinterpret_cast<void*>(EmulateVectorShrI8));
-    e.vmovaps(i.dest, e.xmm0);
+    EmitVectorShiftI8(e, i, VectorShiftOp::kShr);
   }
   static __m128i EmulateVectorShrI16(void*, __m128i src1, __m128i src2) {
     alignas(16) uint16_t value[8];
@@ -5623,6 +5925,11 @@ struct VECTOR_SHR_V128
       }
     }
 
+    if (e.IsFeatureEnabled(kX64EmitAVX2)) {
+      EmitVectorShiftI16AVX2(e, i, VectorShiftOp::kShr);
+      return;
+    }
+
     // Shift 8 words in src1 by amount specified in src2.
     Xbyak::Label emu, end;
 
@@ -5742,28 +6049,8 @@ EMITTER_OPCODE_TABLE(OPCODE_VECTOR_SHR, VECTOR_SHR_V128);
 // ============================================================================
 struct VECTOR_SHA_V128
     : Sequence<VECTOR_SHA_V128, I<OPCODE_VECTOR_SHA, V128Op, V128Op, V128Op>> {
-  static __m128i EmulateVectorShaI8(void*, __m128i src1, __m128i src2) {
-    alignas(16) int8_t value[16];
-    alignas(16) int8_t shamt[16];
-    _mm_store_si128(reinterpret_cast<__m128i*>(value), src1);
-    _mm_store_si128(reinterpret_cast<__m128i*>(shamt), src2);
-    for (size_t i = 0; i < 16; ++i) {
-      value[i] = value[i] >> (shamt[i] & 0x7);
-    }
-    return _mm_load_si128(reinterpret_cast<__m128i*>(value));
-  }
-
   static void EmitInt8(X64Emitter& e, const EmitArgType& i) {
-    // TODO(benvanik): native version (with shift magic).
-    if (i.src2.is_constant) {
-      e.LoadConstantXmm(e.xmm0, i.src2.constant());
-      e.lea(e.r9, e.StashXmm(1, e.xmm0));
-    } else {
-      e.lea(e.r9, e.StashXmm(1, i.src2));
-    }
-    e.lea(e.r8, e.StashXmm(0, i.src1));
-    e.CallNativeSafe(reinterpret_cast<void*>(EmulateVectorShaI8));
-    e.vmovaps(i.dest, e.xmm0);
+    EmitVectorShiftI8(e, i, VectorShiftOp::kSha);
   }
 
   static __m128i EmulateVectorShaI16(void*, __m128i src1, __m128i src2) {
@@ -5794,6 +6081,11 @@ struct VECTOR_SHA_V128
       }
     }
 
+    if (e.IsFeatureEnabled(kX64EmitAVX2)) {
+      EmitVectorShiftI16AVX2(e, i, VectorShiftOp::kSha);
+      return;
+    }
+
     // Shift 8 words in src1 by amount specified in src2.
     Xbyak::Label emu, end;
 
@@ -6031,7 +6323,11 @@ struct VECTOR_ROTATE_LEFT_V128
         e.vmovaps(i.dest, e.xmm0);
         break;
       case INT16_TYPE:
-        // TODO(benvanik): native version (with shift magic).
+        if (e.IsFeatureEnabled(kX64EmitAVX2)) {
+          EmitVectorShiftI16AVX2(e, i, VectorShiftOp::kRotateLeft);
+          break;
+        }
+        // TODO(benvanik): non-AVX2 native version.
         e.lea(e.r8, e.StashXmm(0, i.src1));
         if (i.src2.is_constant) {
           e.LoadConstantXmm(e.xmm0, i.src2.constant());
@@ -6438,7 +6734,7 @@ struct EXTRACT_I32
       e.mov(e.al, i.src2);
       e.and_(e.al, 0x03);
       e.shl(e.al, 4);
-      e.mov(e.rdx, reinterpret_cast<uint64_t>(extract_table_32));
+      e.MovHostAddress(e.rdx, extract_table_32);
       e.vmovaps(e.xmm0, e.ptr[e.rdx + e.rax]);
       e.vpshufb(e.xmm0, i.src1, e.xmm0);
       e.vpextrd(i.dest, e.xmm0, 0);
@@ -7537,6 +7833,7 @@ void RegisterSequences() {
   Register_OPCODE_MEMSET();
   Register_OPCODE_PREFETCH();
   Register_OPCODE_MEMORY_BARRIER();
+  Register_OPCODE_SPIN_WAIT();
   Register_OPCODE_MAX();
   Register_OPCODE_VECTOR_MAX();
   Register_OPCODE_MIN();
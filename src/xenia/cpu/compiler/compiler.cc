@@ -9,6 +9,9 @@
 
 #include "xenia/cpu/compiler/compiler.h"
 
+#include <algorithm>
+
+#include "xenia/base/clock.h"
 #include "xenia/base/profiling.h"
 #include "xenia/cpu/compiler/compiler_pass.h"
 
@@ -22,20 +25,62 @@ Compiler::~Compiler() { Reset(); }
 
 void Compiler::AddPass(std::unique_ptr<CompilerPass> pass) {
   pass->Initialize(this);
+  PassStats stats;
+  stats.name = pass->name();
+  pass_stats_.push_back(stats);
   passes_.push_back(std::move(pass));
 }
 
 void Compiler::Reset() {}
 
+void Compiler::ResetStats() {
+  for (auto& stats : pass_stats_) {
+    const char* name = stats.name;
+    stats = PassStats();
+    stats.name = name;
+  }
+}
+
+uint64_t Compiler::CountInstrs(hir::HIRBuilder* builder) {
+  uint64_t count = 0;
+  for (auto block = builder->first_block(); block; block = block->next) {
+    for (auto instr = block->instr_head; instr; instr = instr->next) {
+      ++count;
+    }
+  }
+  return count;
+}
+
+void Compiler::AddSummarizedCallee(GuestFunction* callee) {
+  if (std::find(summarized_callees_.begin(), summarized_callees_.end(),
+                callee) == summarized_callees_.end()) {
+    summarized_callees_.push_back(callee);
+  }
+}
+
 bool Compiler::Compile(xe::cpu::hir::HIRBuilder* builder) {
+  summarized_callees_.clear();
   // TODO(benvanik): sophisticated stuff. Run passes in parallel, run until they
   //                 stop changing things, etc.
   for (size_t i = 0; i < passes_.size(); ++i) {
     auto& pass = passes_[i];
     scratch_arena_.Reset();
-    if (!pass->Run(builder)) {
+    if (!stats_enabled_) {
+      if (!pass->Run(builder)) {
+        return false;
+      }
+      continue;
+    }
+    auto& stats = pass_stats_[i];
+    stats.instr_count_before += CountInstrs(builder);
+    uint64_t start_ticks = Clock::QueryHostTickCount();
+    bool result = pass->Run(builder);
+    stats.host_ticks += Clock::QueryHostTickCount() - start_ticks;
+    if (!result) {
       return false;
     }
+    ++stats.run_count;
+    stats.instr_count_after += CountInstrs(builder);
   }
 
   return true;
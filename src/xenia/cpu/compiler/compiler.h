@@ -18,6 +18,7 @@
 
 namespace xe {
 namespace cpu {
+class GuestFunction;
 class Processor;
 }  // namespace cpu
 }  // namespace xe
@@ -30,6 +31,16 @@ class CompilerPass;
 
 class Compiler {
  public:
+  // Accumulated cost of one entry of the pass list across all compiles since
+  // stats were last reset.
+  struct PassStats {
+    const char* name = nullptr;
+    uint64_t run_count = 0;
+    uint64_t host_ticks = 0;
+    uint64_t instr_count_before = 0;
+    uint64_t instr_count_after = 0;
+  };
+
   explicit Compiler(Processor* processor);
   ~Compiler();
 
@@ -42,11 +53,32 @@ class Compiler {
 
   bool Compile(hir::HIRBuilder* builder);
 
+  // Callees whose context usage the passes relied on during the last compile,
+  // which the compiled function has to be invalidated along with.
+  const std::vector<GuestFunction*>& summarized_callees() const {
+    return summarized_callees_;
+  }
+  void AddSummarizedCallee(GuestFunction* callee);
+
+  // Collecting stats times each pass and counts instructions around it, which
+  // is only meant for benchmarking the compiler itself.
+  bool stats_enabled() const { return stats_enabled_; }
+  void set_stats_enabled(bool enabled) { stats_enabled_ = enabled; }
+  // One entry per pass, in execution order.
+  const std::vector<PassStats>& pass_stats() const { return pass_stats_; }
+  void ResetStats();
+
  private:
+  static uint64_t CountInstrs(hir::HIRBuilder* builder);
+
   Processor* processor_;
   Arena scratch_arena_;
 
   std::vector<std::unique_ptr<CompilerPass>> passes_;
+  std::vector<GuestFunction*> summarized_callees_;
+
+  bool stats_enabled_ = false;
+  std::vector<PassStats> pass_stats_;
 };
 
 }  // namespace compiler
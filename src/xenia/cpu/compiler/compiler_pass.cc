@@ -9,7 +9,12 @@
 
 #include "xenia/cpu/compiler/compiler_pass.h"
 
+#include <gflags/gflags.h>
+
 #include "xenia/cpu/compiler/compiler.h"
+#include "xenia/cpu/cpu_flags.h"
+
+DECLARE_bool(debug);
 
 namespace xe {
 namespace cpu {
@@ -29,6 +34,34 @@ Arena* CompilerPass::scratch_arena() const {
   return compiler_->scratch_arena();
 }
 
+std::shared_ptr<const ContextUsage> CompilerPass::GetCallContextUsage(
+    const hir::Instr* i) const {
+  // Cached callers aren't checked against changes to their callees.
+  if (!FLAGS_summarize_call_context || FLAGS_debug ||
+      !FLAGS_code_cache_path.empty()) {
+    return nullptr;
+  }
+  Function* symbol;
+  if (i->opcode == &hir::OPCODE_CALL_info) {
+    symbol = i->src1.symbol;
+  } else if (i->opcode == &hir::OPCODE_CALL_TRUE_info) {
+    symbol = i->src2.symbol;
+  } else {
+    return nullptr;
+  }
+  // Tail calls return to the caller's caller, which may read anything.
+  if (!symbol || !symbol->is_guest() ||
+      (i->flags & (hir::CALL_TAIL | hir::CALL_POSSIBLE_RETURN))) {
+    return nullptr;
+  }
+  auto callee = static_cast<GuestFunction*>(symbol);
+  auto usage = callee->context_usage();
+  if (usage) {
+    compiler_->AddSummarizedCallee(callee);
+  }
+  return usage;
+}
+
 }  // namespace compiler
 }  // namespace cpu
 }  // namespace xe
@@ -10,7 +10,10 @@
 #ifndef XENIA_CPU_COMPILER_COMPILER_PASS_H_
 #define XENIA_CPU_COMPILER_COMPILER_PASS_H_
 
+#include <memory>
+
 #include "xenia/base/arena.h"
+#include "xenia/cpu/function.h"
 #include "xenia/cpu/hir/hir_builder.h"
 
 namespace xe {
@@ -32,10 +35,18 @@ class CompilerPass {
 
   virtual bool Initialize(Compiler* compiler);
 
+  // Short identifier used when reporting per-pass statistics.
+  virtual const char* name() const = 0;
+
   virtual bool Run(hir::HIRBuilder* builder) = 0;
 
  protected:
   Arena* scratch_arena() const;
+  // Context usage of the callee of a direct call that returns to the caller,
+  // or null if the call may touch any of the context. The callee is recorded
+  // as one the function being compiled depends on.
+  std::shared_ptr<const ContextUsage> GetCallContextUsage(
+      const hir::Instr* i) const;
 
  protected:
   Processor* processor_;
@@ -11,6 +11,9 @@
 
 #include <gflags/gflags.h>
 
+#include <algorithm>
+#include <cstring>
+
 #include "xenia/base/profiling.h"
 #include "xenia/cpu/compiler/compiler.h"
 #include "xenia/cpu/ppc/ppc_context.h"
@@ -20,6 +23,9 @@ DECLARE_bool(debug);
 
 DEFINE_bool(store_all_context_values, false,
             "Don't strip dead context stores to aid in debugging.");
+DEFINE_bool(forward_context_constants, true,
+            "Replace context loads with constants stored on every path from "
+            "earlier blocks.");
 
 namespace xe {
 namespace cpu {
@@ -74,6 +80,12 @@ bool ContextPromotionPass::Run(HIRBuilder* builder) {
     block = block->next;
   }
 
+  // Constants don't need a register to cross blocks, so those can be
+  // forwarded along the CFG as well.
+  if (FLAGS_forward_context_constants) {
+    ForwardConstants(builder);
+  }
+
   // Remove all dead stores.
   // This will break debugging as we can't recover this information when
   // trying to extract stack traces/register values, so we don't do that.
@@ -121,6 +133,138 @@ void ContextPromotionPass::PromoteBlock(Block* block) {
   }
 }
 
+void ContextPromotionPass::ForwardConstants(HIRBuilder* builder) {
+  // Forward dataflow of the constants held by context ranges. A block's
+  // entry state is the intersection of the states of every branch into it
+  // (and the fallthrough from the previous block); the entry block starts
+  // with nothing known. For example:
+  //   store_context +100, 0
+  //   branch_true v0, b
+  // a:
+  //   store_context +100, 0
+  // b:
+  //   v1 = load_context +100   <-- v1 = 0
+  // The CFG is rebuilt from the branches here as ControlFlowSimplificationPass
+  // leaves the one from ControlFlowAnalysisPass stale.
+  uint16_t block_count = 0;
+  for (auto block = builder->first_block(); block; block = block->next) {
+    block->ordinal = block_count++;
+  }
+  if (block_facts_.size() < block_count) {
+    block_facts_.resize(block_count);
+  }
+  block_reached_.assign(block_count, false);
+  block_facts_[0].clear();
+  block_reached_[0] = true;
+
+  // States only ever shrink once a block is reached, so this terminates.
+  bool changed = true;
+  while (changed) {
+    changed = false;
+    for (auto block = builder->first_block(); block; block = block->next) {
+      if (!block_reached_[block->ordinal]) {
+        continue;
+      }
+      facts_ = block_facts_[block->ordinal];
+      for (auto i = block->instr_head; i; i = i->next) {
+        if (i->opcode == &OPCODE_BRANCH_info) {
+          changed |= MergeConstantFacts(i->src1.label->block, facts_);
+        } else if (i->opcode == &OPCODE_BRANCH_TRUE_info ||
+                   i->opcode == &OPCODE_BRANCH_FALSE_info) {
+          changed |= MergeConstantFacts(i->src2.label->block, facts_);
+        } else {
+          ApplyConstantFacts(i, &facts_);
+        }
+      }
+      auto tail = block->instr_tail;
+      if (block->next && (!tail || tail->opcode != &OPCODE_BRANCH_info)) {
+        changed |= MergeConstantFacts(block->next, facts_);
+      }
+    }
+  }
+
+  // Rewrite loads of known constants.
+  for (auto block = builder->first_block(); block; block = block->next) {
+    if (!block_reached_[block->ordinal]) {
+      continue;
+    }
+    facts_ = block_facts_[block->ordinal];
+    for (auto i = block->instr_head; i; i = i->next) {
+      if (i->opcode == &OPCODE_LOAD_CONTEXT_info && !facts_.empty()) {
+        uint32_t offset = static_cast<uint32_t>(i->src1.offset);
+        for (auto& fact : facts_) {
+          if (fact.offset == offset && fact.value->type == i->dest->type) {
+            i->opcode = &hir::OPCODE_ASSIGN_info;
+            i->set_src1(fact.value);
+            break;
+          }
+        }
+        continue;
+      }
+      ApplyConstantFacts(i, &facts_);
+    }
+  }
+}
+
+void ContextPromotionPass::ApplyConstantFacts(Instr* i, ConstantFacts* facts) {
+  if (auto usage = GetCallContextUsage(i)) {
+    // What the callee doesn't write is still there when it returns.
+    auto written = [&usage](const ConstantFact& fact) {
+      auto size = static_cast<uint32_t>(GetTypeSize(fact.value->type));
+      return usage->Writes(fact.offset, fact.offset + size);
+    };
+    facts->erase(std::remove_if(facts->begin(), facts->end(), written),
+                 facts->end());
+  } else if (i->opcode->flags & OPCODE_FLAG_VOLATILE ||
+             i->opcode == &OPCODE_CONTEXT_BARRIER_info) {
+    facts->clear();
+  } else if (i->opcode == &OPCODE_STORE_CONTEXT_info) {
+    uint32_t offset = static_cast<uint32_t>(i->src1.offset);
+    Value* value = i->src2.value;
+    uint32_t end = offset + static_cast<uint32_t>(GetTypeSize(value->type));
+    auto overlaps = [offset, end](const ConstantFact& fact) {
+      auto size = static_cast<uint32_t>(GetTypeSize(fact.value->type));
+      return fact.offset < end && offset < fact.offset + size;
+    };
+    facts->erase(std::remove_if(facts->begin(), facts->end(), overlaps),
+                 facts->end());
+    if (value->IsConstant()) {
+      facts->push_back({offset, value});
+    }
+  }
+}
+
+bool ContextPromotionPass::MergeConstantFacts(Block* dest,
+                                              const ConstantFacts& facts) {
+  auto& dest_facts = block_facts_[dest->ordinal];
+  if (!block_reached_[dest->ordinal]) {
+    block_reached_[dest->ordinal] = true;
+    dest_facts = facts;
+    return true;
+  }
+  if (!dest->ordinal) {
+    // Nothing is known on function entry regardless of loops back to it.
+    return false;
+  }
+  size_t old_count = dest_facts.size();
+  dest_facts.erase(
+      std::remove_if(
+          dest_facts.begin(), dest_facts.end(),
+          [&facts](const ConstantFact& dest_fact) {
+            for (auto& fact : facts) {
+              if (fact.offset == dest_fact.offset &&
+                  fact.value->type == dest_fact.value->type) {
+                return std::memcmp(&fact.value->constant,
+                                   &dest_fact.value->constant,
+                                   GetTypeSize(fact.value->type)) != 0;
+              }
+            }
+            return true;
+          }),
+      dest_facts.end());
+  return dest_facts.size() != old_count;
+}
+
 void ContextPromotionPass::RemoveDeadStoresBlock(Block* block) {
   auto& validity = context_validity_;
   validity.reset();
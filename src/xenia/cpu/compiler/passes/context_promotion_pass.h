@@ -38,15 +38,33 @@ class ContextPromotionPass : public CompilerPass {
 
   bool Initialize(Compiler* compiler) override;
 
+  const char* name() const override { return "context_promotion"; }
+
   bool Run(hir::HIRBuilder* builder) override;
 
  private:
+  // A context range known to hold a constant on entry to a block.
+  struct ConstantFact {
+    uint32_t offset;
+    hir::Value* value;
+  };
+  typedef std::vector<ConstantFact> ConstantFacts;
+
   void PromoteBlock(hir::Block* block);
+  void ForwardConstants(hir::HIRBuilder* builder);
+  void ApplyConstantFacts(hir::Instr* i, ConstantFacts* facts);
+  bool MergeConstantFacts(hir::Block* dest, const ConstantFacts& facts);
   void RemoveDeadStoresBlock(hir::Block* block);
 
  private:
   std::vector<hir::Value*> context_values_;
   llvm::BitVector context_validity_;
+
+  // Constant facts on entry to each block by ordinal, valid if reached.
+  // Kept across runs so their storage is reused.
+  std::vector<ConstantFacts> block_facts_;
+  std::vector<bool> block_reached_;
+  ConstantFacts facts_;
 };
 
 }  // namespace passes
@@ -16,16 +16,6 @@
 #include "xenia/cpu/compiler/compiler.h"
 #include "xenia/cpu/processor.h"
 
-#if XE_COMPILER_MSVC
-#pragma warning(push)
-#pragma warning(disable : 4244)
-#pragma warning(disable : 4267)
-#include <llvm/ADT/BitVector.h>
-#pragma warning(pop)
-#else
-#include <llvm/ADT/BitVector.h>
-#endif  // XE_COMPILER_MSVC
-
 namespace xe {
 namespace cpu {
 namespace compiler {
@@ -74,21 +64,22 @@ void DataFlowAnalysisPass::AnalyzeFlow(HIRBuilder* builder,
   auto value_map = reinterpret_cast<Value**>(
       arena->Alloc(sizeof(Value*) * max_value_estimate));
 
-  // Allocate incoming bitvectors for use by blocks. We don't need outgoing
-  // because they are only used during the block iteration.
-  // Mapped by block ordinal.
-  // TODO(benvanik): cache this list, grow as needed, etc.
-  auto incoming_bitvectors =
-      (llvm::BitVector**)arena->Alloc(sizeof(llvm::BitVector*) * block_count);
+  // Incoming bitvectors for use by blocks. We don't need outgoing because
+  // they are only used during the block iteration.
+  if (incoming_bitvectors_.size() < block_count) {
+    incoming_bitvectors_.resize(block_count);
+  }
   for (auto n = 0u; n < block_count; n++) {
-    incoming_bitvectors[n] = new llvm::BitVector(max_value_estimate);
+    incoming_bitvectors_[n].resize(max_value_estimate);
+    incoming_bitvectors_[n].reset();
   }
+  outgoing_values_.resize(max_value_estimate);
 
   // Walk blocks in reverse and calculate incoming/outgoing values.
   auto block = builder->last_block();
   while (block) {
     // Allocate bitsets based on max value number.
-    block->incoming_values = incoming_bitvectors[block->ordinal];
+    block->incoming_values = &incoming_bitvectors_[block->ordinal];
     auto& incoming_values = *block->incoming_values;
 
     // Walk instructions and gather up incoming values.
@@ -116,7 +107,8 @@ void DataFlowAnalysisPass::AnalyzeFlow(HIRBuilder* builder,
 
     // Add all successor incoming values to our outgoing, as we need to
     // pass them through.
-    llvm::BitVector outgoing_values(max_value_estimate);
+    auto& outgoing_values = outgoing_values_;
+    outgoing_values.reset();
     auto outgoing_edge = block->outgoing_edge_head;
     while (outgoing_edge) {
       if (outgoing_edge->dest->ordinal > block->ordinal) {
@@ -200,11 +192,6 @@ void DataFlowAnalysisPass::AnalyzeFlow(HIRBuilder* builder,
 
     block = block->prev;
   }
-
-  // Cleanup bitvectors.
-  for (auto n = 0u; n < block_count; n++) {
-    delete incoming_bitvectors[n];
-  }
 }
 
 }  // namespace passes
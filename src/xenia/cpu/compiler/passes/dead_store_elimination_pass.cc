@@ -0,0 +1,216 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2016 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#include "xenia/cpu/compiler/passes/dead_store_elimination_pass.h"
+
+#include <gflags/gflags.h>
+
+#include "xenia/base/profiling.h"
+#include "xenia/cpu/compiler/compiler.h"
+#include "xenia/cpu/ppc/ppc_context.h"
+#include "xenia/cpu/processor.h"
+
+DECLARE_bool(debug);
+DECLARE_bool(store_all_context_values);
+
+namespace xe {
+namespace cpu {
+namespace compiler {
+namespace passes {
+
+// TODO(benvanik): remove when enums redefined.
+using namespace xe::cpu::hir;
+
+using xe::cpu::hir::Block;
+using xe::cpu::hir::HIRBuilder;
+using xe::cpu::hir::Instr;
+using xe::cpu::hir::Value;
+
+DeadStoreEliminationPass::DeadStoreEliminationPass() : CompilerPass() {}
+
+DeadStoreEliminationPass::~DeadStoreEliminationPass() {}
+
+bool DeadStoreEliminationPass::Initialize(Compiler* compiler) {
+  if (!CompilerPass::Initialize(compiler)) {
+    return false;
+  }
+
+  context_size_ = static_cast<uint32_t>(sizeof(ppc::PPCContext));
+
+  return true;
+}
+
+bool DeadStoreEliminationPass::Run(HIRBuilder* builder) {
+  // Backwards liveness over context bytes. A store is dead when none of the
+  // bytes it writes are read before being overwritten on every path leaving
+  // it. Example:
+  //   store_context +100, v0  <-- dead, overwritten in both successors
+  //   branch_true v1, label0
+  //   store_context +100, v2
+  //   ...
+  // label0:
+  //   store_context +100, v3
+  // Anything that may leave guest code (calls, returns, traps) or observes
+  // the context asynchronously (barriers) makes the entire context live,
+  // except for direct calls to functions known to read only some of it.
+  SCOPE_profile_cpu_f("cpu");
+
+  if (FLAGS_debug || FLAGS_store_all_context_values) {
+    // Debuggers expect every context write to be visible.
+    return true;
+  }
+
+  // Remove silent stores first so the values they kept alive don't keep
+  // earlier stores alive too.
+  auto block = builder->first_block();
+  uint16_t block_count = 0;
+  while (block) {
+    block->ordinal = block_count++;
+    RemoveSilentStoresBlock(block);
+    block = block->next;
+  }
+
+  if (block_live_in_.size() < block_count) {
+    block_live_in_.resize(block_count);
+  }
+  for (uint16_t n = 0; n < block_count; ++n) {
+    block_live_in_[n].resize(context_size_);
+    block_live_in_[n].reset();
+  }
+
+  // Iterate to a fixed point. Blocks are visited in reverse order as that's
+  // the direction liveness flows and most control flow is forward.
+  auto& live = live_;
+  live.resize(context_size_);
+  bool changed = true;
+  while (changed) {
+    changed = false;
+    block = builder->last_block();
+    while (block) {
+      ProcessBlock(block, &live, false);
+      if (live != block_live_in_[block->ordinal]) {
+        block_live_in_[block->ordinal] = live;
+        changed = true;
+      }
+      block = block->prev;
+    }
+  }
+
+  block = builder->first_block();
+  while (block) {
+    ProcessBlock(block, &live, true);
+    block = block->next;
+  }
+
+  return true;
+}
+
+void DeadStoreEliminationPass::ProcessBlock(Block* block, llvm::BitVector* live,
+                                            bool remove_dead) {
+  // Compute live-out. Blocks fall through to the next block unless they end
+  // in an unconditional branch; the last block falls through to the epilog.
+  Instr* tail = block->instr_tail;
+  if (tail && tail->opcode == &OPCODE_BRANCH_info) {
+    live->reset();
+  } else if (block->next) {
+    *live = block_live_in_[block->next->ordinal];
+  } else {
+    live->set();
+  }
+
+  Instr* i = tail;
+  while (i) {
+    Instr* prev = i->prev;
+    if (i->opcode == &OPCODE_BRANCH_info) {
+      *live |= block_live_in_[i->src1.label->block->ordinal];
+    } else if (i->opcode == &OPCODE_BRANCH_TRUE_info ||
+               i->opcode == &OPCODE_BRANCH_FALSE_info) {
+      *live |= block_live_in_[i->src2.label->block->ordinal];
+    } else if (auto usage = GetCallContextUsage(i)) {
+      // Stores the callee doesn't read are only live if read after it.
+      for (auto& range : usage->reads) {
+        live->set(range.first, range.second);
+      }
+    } else if (i->opcode->flags &
+                   (OPCODE_FLAG_VOLATILE | OPCODE_FLAG_BRANCH) ||
+               i->opcode == &OPCODE_CONTEXT_BARRIER_info) {
+      live->set();
+    } else if (i->opcode == &OPCODE_STORE_CONTEXT_info) {
+      uint32_t offset = static_cast<uint32_t>(i->src1.offset);
+      uint32_t end =
+          offset + static_cast<uint32_t>(GetTypeSize(i->src2.value->type));
+      bool any_live = false;
+      for (uint32_t n = offset; n < end; ++n) {
+        if (live->test(n)) {
+          any_live = true;
+          break;
+        }
+      }
+      if (any_live) {
+        // Partially live stores are kept whole but still kill all their
+        // bytes.
+        live->reset(offset, end);
+      } else if (remove_dead) {
+        i->Remove();
+      }
+    } else if (i->opcode == &OPCODE_LOAD_CONTEXT_info) {
+      uint32_t offset = static_cast<uint32_t>(i->src1.offset);
+      live->set(offset,
+                offset + static_cast<uint32_t>(GetTypeSize(i->dest->type)));
+    }
+    i = prev;
+  }
+}
+
+void DeadStoreEliminationPass::RemoveSilentStoresBlock(Block* block) {
+  // Stores of a value loaded from the same offset earlier in the block are
+  // no-ops as long as nothing could have changed the context in between:
+  //   v0 = load_context +100
+  //   ...
+  //   store_context +100, v0  <-- removed
+  Instr* i = block->instr_head;
+  while (i) {
+    Instr* next = i->next;
+    if (i->opcode == &OPCODE_STORE_CONTEXT_info) {
+      Value* value = i->src2.value;
+      Instr* def = value->def;
+      if (def && def->block == block &&
+          def->opcode == &OPCODE_LOAD_CONTEXT_info &&
+          def->src1.offset == i->src1.offset) {
+        size_t offset = i->src1.offset;
+        size_t end = offset + GetTypeSize(value->type);
+        bool clobbered = false;
+        for (Instr* j = def->next; j != i; j = j->next) {
+          if (j->opcode->flags & (OPCODE_FLAG_VOLATILE | OPCODE_FLAG_BRANCH) ||
+              j->opcode == &OPCODE_CONTEXT_BARRIER_info) {
+            clobbered = true;
+            break;
+          }
+          if (j->opcode == &OPCODE_STORE_CONTEXT_info) {
+            size_t j_offset = j->src1.offset;
+            size_t j_end = j_offset + GetTypeSize(j->src2.value->type);
+            if (j_offset < end && offset < j_end) {
+              clobbered = true;
+              break;
+            }
+          }
+        }
+        if (!clobbered) {
+          i->Remove();
+        }
+      }
+    }
+    i = next;
+  }
+}
+
+}  // namespace passes
+}  // namespace compiler
+}  // namespace cpu
+}  // namespace xe
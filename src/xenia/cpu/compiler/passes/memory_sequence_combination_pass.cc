@@ -9,6 +9,8 @@
 
 #include "xenia/cpu/compiler/passes/memory_sequence_combination_pass.h"
 
+#include <utility>
+
 #include "xenia/base/profiling.h"
 
 namespace xe {
@@ -39,6 +41,8 @@ bool MemorySequenceCombinationPass::Run(HIRBuilder* builder) {
         CombineLoadSequence(i);
       } else if (i->opcode == &OPCODE_STORE_info) {
         CombineStoreSequence(i);
+      } else if (i->opcode == &OPCODE_PERMUTE_info) {
+        CombineUnalignedVectorLoad(i);
       }
       i = i->next;
     }
@@ -68,15 +72,29 @@ void MemorySequenceCombinationPass::CombineLoadSequence(Instr* i) {
 
   // Ensure all uses of the load result are BYTE_SWAP - if it's mixed we
   // shouldn't transform as we'd have to introduce new swaps!
+  // Stores of the value are fine as their swap can be inverted too:
+  //   v1.i32 = load v0
+  //   v2.i32 = byte_swap v1.i32
+  //   store v3, v1.i32
+  // becomes:
+  //   v1.i32 = load v0, [swap]
+  //   store v3, v1.i32, [swap]
+  bool has_swap = false;
   auto use = i->dest->use_head;
   while (use) {
-    if (use->instr->opcode != &OPCODE_BYTE_SWAP_info) {
-      // Not a swap.
+    auto use_instr = use->instr;
+    if (use_instr->opcode == &OPCODE_BYTE_SWAP_info) {
+      has_swap = true;
+    } else if (use_instr->opcode != &OPCODE_STORE_info ||
+               use_instr->src1.value == i->dest) {
+      // Not a swap or a store of the value.
       return;
     }
-    // TODO(benvanik): allow uses by STORE (we can make that swap).
     use = use->next;
   }
+  if (!has_swap) {
+    return;
+  }
 
   // Merge byte swap into load.
   // Note that we may have already been a swapped operation - this inverts that.
@@ -87,8 +105,12 @@ void MemorySequenceCombinationPass::CombineLoadSequence(Instr* i) {
   use = i->dest->use_head;
   while (use) {
     auto next_use = use->next;
-    use->instr->opcode = &OPCODE_ASSIGN_info;
-    use->instr->flags = 0;
+    if (use->instr->opcode == &OPCODE_STORE_info) {
+      use->instr->flags ^= LoadStoreFlags::LOAD_STORE_BYTE_SWAP;
+    } else {
+      use->instr->opcode = &OPCODE_ASSIGN_info;
+      use->instr->flags = 0;
+    }
     use = next_use;
   }
 
@@ -140,6 +162,168 @@ void MemorySequenceCombinationPass::CombineStoreSequence(Instr* i) {
   // TODO(benvanik): extend/truncate.
 }
 
+namespace {
+Value* SkipAssigns(Value* value) {
+  while (value->def && value->def->opcode == &OPCODE_ASSIGN_info) {
+    value = value->def->src1.value;
+  }
+  return value;
+}
+
+bool IsConstantInt64(Value* value, int64_t constant) {
+  return value->IsConstant() && value->type == INT64_TYPE &&
+         value->constant.i64 == constant;
+}
+
+// Whether two addresses are known to be equal. Guest code recomputes them
+// for every instruction, so identical adds are compared too.
+bool IsSameAddress(Value* a, Value* b) {
+  a = SkipAssigns(a);
+  b = SkipAssigns(b);
+  if (a == b) {
+    return true;
+  }
+  if (a->IsConstant() && b->IsConstant()) {
+    return a->type == INT64_TYPE && b->type == INT64_TYPE &&
+           a->constant.i64 == b->constant.i64;
+  }
+  auto a_def = a->def;
+  auto b_def = b->def;
+  if (!a_def || !b_def || a_def->opcode != &OPCODE_ADD_info ||
+      b_def->opcode != &OPCODE_ADD_info) {
+    return false;
+  }
+  auto a1 = SkipAssigns(a_def->src1.value);
+  auto a2 = SkipAssigns(a_def->src2.value);
+  auto b1 = SkipAssigns(b_def->src1.value);
+  auto b2 = SkipAssigns(b_def->src2.value);
+  return (a1 == b1 && a2 == b2) || (a1 == b2 && a2 == b1);
+}
+
+// Returns ea if value is lvsl ea:
+//   v = load_vector_shl (truncate (and ea, 0xF))
+Value* MatchLoadVectorShl(Value* value) {
+  auto def = SkipAssigns(value)->def;
+  if (!def || def->opcode != &OPCODE_LOAD_VECTOR_SHL_info) {
+    return nullptr;
+  }
+  def = SkipAssigns(def->src1.value)->def;
+  if (!def || def->opcode != &OPCODE_TRUNCATE_info) {
+    return nullptr;
+  }
+  def = SkipAssigns(def->src1.value)->def;
+  if (!def || def->opcode != &OPCODE_AND_info ||
+      !IsConstantInt64(def->src2.value, 0xF)) {
+    return nullptr;
+  }
+  return def->src1.value;
+}
+
+// Returns ea if value is lvx ea, with the swap either merged or not:
+//   v = byte_swap (load (and ea, ~0xF))
+// The load is returned in out_load.
+Value* MatchAlignedVectorLoad(Value* value, Instr** out_load) {
+  auto def = SkipAssigns(value)->def;
+  bool swapped = false;
+  if (def && def->opcode == &OPCODE_BYTE_SWAP_info) {
+    swapped = true;
+    def = SkipAssigns(def->src1.value)->def;
+  }
+  if (!def || def->opcode != &OPCODE_LOAD_info ||
+      def->dest->type != VEC128_TYPE ||
+      swapped == !!(def->flags & LoadStoreFlags::LOAD_STORE_BYTE_SWAP)) {
+    return nullptr;
+  }
+  *out_load = def;
+  def = SkipAssigns(def->src1.value)->def;
+  if (!def || def->opcode != &OPCODE_AND_info ||
+      !IsConstantInt64(def->src2.value, ~0xFll)) {
+    return nullptr;
+  }
+  return def->src1.value;
+}
+
+// Whether memory may be different after the instruction, as seen by a load
+// moved past it.
+bool MayChangeMemory(const Instr* i) {
+  if (i->opcode == &OPCODE_LOAD_info) {
+    return false;
+  }
+  return i->opcode == &OPCODE_MEMORY_BARRIER_info ||
+         (i->opcode->flags & (OPCODE_FLAG_MEMORY | OPCODE_FLAG_VOLATILE |
+                              OPCODE_FLAG_BRANCH));
+}
+}  // namespace
+
+void MemorySequenceCombinationPass::CombineUnalignedVectorLoad(Instr* i) {
+  // The AltiVec idiom for an unaligned vector load:
+  //   lvsl v0, 0, r3
+  //   lvx v1, 0, r3
+  //   addi r4, r3, 16 (or 15)
+  //   lvx v2, 0, r4
+  //   vperm v3, v1, v2, v0
+  // selects the 16 bytes at r3 out of the two aligned blocks covering them:
+  //   v0 = load_vector_shl (truncate (and ea, 0xF))
+  //   v1 = byte_swap (load (and ea, ~0xF))
+  //   v2 = byte_swap (load (and (add ea, 16), ~0xF))
+  //   v3 = permute v0, v1, v2
+  // becomes:
+  //   v3 = load ea, [swap]
+  // The aligned loads go away in DCE if their registers are dead. When ea is
+  // aligned and the offset is 15 both lvx read the same block and the
+  // unaligned load reads no further.
+  if (i->flags != INT8_TYPE) {
+    return;
+  }
+  auto ea = MatchLoadVectorShl(i->src1.value);
+  if (!ea) {
+    return;
+  }
+  Instr* low_load = nullptr;
+  auto low_ea = MatchAlignedVectorLoad(i->src2.value, &low_load);
+  if (!low_ea || !IsSameAddress(low_ea, ea)) {
+    return;
+  }
+  Instr* high_load = nullptr;
+  auto high_ea = MatchAlignedVectorLoad(i->src3.value, &high_load);
+  auto high_def = high_ea ? SkipAssigns(high_ea)->def : nullptr;
+  if (!high_def || high_def->opcode != &OPCODE_ADD_info) {
+    return;
+  }
+  auto high_base = high_def->src1.value;
+  auto high_offset = high_def->src2.value;
+  if (high_base->IsConstant()) {
+    std::swap(high_base, high_offset);
+  }
+  if ((!IsConstantInt64(high_offset, 15) &&
+       !IsConstantInt64(high_offset, 16)) ||
+      !IsSameAddress(high_base, ea)) {
+    return;
+  }
+
+  // The unaligned load reads memory where the permute is, so nothing from
+  // the first aligned load on may have changed it: no stores, calls or
+  // barriers.
+  bool low_found = false;
+  bool high_found = false;
+  for (auto prev = i->prev; prev; prev = prev->prev) {
+    low_found |= prev == low_load;
+    high_found |= prev == high_load;
+    if (low_found && high_found) {
+      break;
+    }
+    if (MayChangeMemory(prev)) {
+      return;
+    }
+  }
+  if (!low_found || !high_found) {
+    return;
+  }
+
+  i->Replace(&OPCODE_LOAD_info, LoadStoreFlags::LOAD_STORE_BYTE_SWAP);
+  i->set_src1(ea);
+}
+
 }  // namespace passes
 }  // namespace compiler
 }  // namespace cpu
@@ -22,12 +22,15 @@ class MemorySequenceCombinationPass : public CompilerPass {
   MemorySequenceCombinationPass();
   ~MemorySequenceCombinationPass() override;
 
+  const char* name() const override { return "memory_sequence_combination"; }
+
   bool Run(hir::HIRBuilder* builder) override;
 
  private:
   void CombineMemorySequences(hir::HIRBuilder* builder);
   void CombineLoadSequence(hir::Instr* i);
   void CombineStoreSequence(hir::Instr* i);
+  void CombineUnalignedVectorLoad(hir::Instr* i);
 };
 
 }  // namespace passes
@@ -9,6 +9,8 @@
 
 #include "xenia/cpu/compiler/passes/register_allocation_pass.h"
 
+#include <gflags/gflags.h>
+
 #include <algorithm>
 #include <cstring>
 
@@ -17,6 +19,13 @@
 #include "xenia/base/math.h"
 #include "xenia/base/profiling.h"
 
+DEFINE_bool(global_register_allocation, true,
+            "Keep context values used within loops in host registers across "
+            "blocks. Disable to fall back to purely block-local allocation.");
+
+DECLARE_bool(debug);
+DECLARE_bool(store_all_context_values);
+
 namespace xe {
 namespace cpu {
 namespace compiler {
@@ -26,6 +35,7 @@ namespace passes {
 using namespace xe::cpu::hir;
 
 using xe::cpu::backend::MachineInfo;
+using xe::cpu::hir::Block;
 using xe::cpu::hir::HIRBuilder;
 using xe::cpu::hir::Instr;
 using xe::cpu::hir::OpcodeSignatureType;
@@ -76,6 +86,14 @@ bool RegisterAllocationPass::Run(HIRBuilder* builder) {
   // optimized with some intra-block analysis (dominators/etc).
   // Really, it'd just be nice to have someone who knew what they
   // were doing lower SSA and do this right.
+  // Values live across blocks only through the context, so loops are
+  // handled first by pinning their hottest context values to registers the
+  // per-block allocation then leaves alone.
+  block_reservations_.clear();
+  if (FLAGS_global_register_allocation && !FLAGS_debug &&
+      !FLAGS_store_all_context_values) {
+    AllocateLoopRegisters(builder);
+  }
 
   uint16_t block_ordinal = 0;
   uint32_t instr_ordinal = 0;
@@ -85,7 +103,7 @@ bool RegisterAllocationPass::Run(HIRBuilder* builder) {
     block->ordinal = block_ordinal++;
 
     // Reset all state.
-    PrepareBlockState();
+    PrepareBlockState(block);
 
     // Renumber all instructions in the block. This is required so that
     // we can sort the usage pointers below.
@@ -173,6 +191,348 @@ bool RegisterAllocationPass::Run(HIRBuilder* builder) {
   return true;
 }
 
+namespace {
+// Registers each register set keeps for block-local allocation within loops.
+const uint32_t kMinFreeLoopRegisters = 3;
+// Upper bound on registers pinned per set for a single loop.
+const uint32_t kMaxLoopRegisters = 4;
+
+bool IsLocalBranch(const Instr* i) {
+  return i->opcode == &OPCODE_BRANCH_info ||
+         i->opcode == &OPCODE_BRANCH_TRUE_info ||
+         i->opcode == &OPCODE_BRANCH_FALSE_info;
+}
+
+Block* LocalBranchTarget(const Instr* i) {
+  return i->opcode == &OPCODE_BRANCH_info ? i->src1.label->block
+                                          : i->src2.label->block;
+}
+
+// Returns the first of the branches ending the block, if any.
+Instr* FirstTrailingBranch(Block* block) {
+  Instr* first = nullptr;
+  for (auto i = block->instr_tail; i && IsLocalBranch(i); i = i->prev) {
+    first = i;
+  }
+  return first;
+}
+
+// Moves instr to the end of the block, ahead of any trailing branches.
+// The block must have at least one instruction.
+void MoveToBlockEnd(Instr* instr, Block* block) {
+  auto branch = FirstTrailingBranch(block);
+  if (branch) {
+    instr->MoveBefore(branch);
+  } else {
+    instr->MoveAfter(block->instr_tail);
+  }
+}
+}  // namespace
+
+void RegisterAllocationPass::AllocateLoopRegisters(HIRBuilder* builder) {
+  // Loops are found as block ranges [head, tail] closed by a branch back to
+  // head. Only single-entry loops without calls or other volatile
+  // instructions are handled, as the pinned registers are lost across calls
+  // and the context must be current whenever it may be observed:
+  //   preheader:
+  //     s0 = load_context +100     <-- added
+  //     store_local r15, s0        <-- added
+  //   head:
+  //     v0 = load_context +100     --> v0 = load_local r15
+  //     ...
+  //     store_context +100, v1     --> store_local r15, v1
+  //     branch_true v2, head
+  //   exit:
+  //     s1 = load_local r15        <-- added
+  //     store_context +100, s1     <-- added
+  // Edges are rebuilt from the branches themselves as the CFG built by
+  // ControlFlowAnalysisPass is not kept up to date by later passes.
+  auto& blocks = loop_blocks_;
+  auto& edges = loop_edges_;
+  auto& loops = loops_;
+  blocks.clear();
+  edges.clear();
+  loops.clear();
+  for (auto block = builder->first_block(); block; block = block->next) {
+    block->ordinal = static_cast<uint16_t>(blocks.size());
+    blocks.push_back(block);
+  }
+  for (auto block : blocks) {
+    for (auto i = block->instr_head; i; i = i->next) {
+      if (IsLocalBranch(i)) {
+        auto target = LocalBranchTarget(i);
+        edges.push_back({block, target, false});
+        if (target->ordinal <= block->ordinal) {
+          loops.emplace_back(target->ordinal, block->ordinal);
+        }
+      }
+    }
+    // The last block falls through to the epilog, recorded as a null dest.
+    auto tail = block->instr_tail;
+    if (!tail || tail->opcode != &OPCODE_BRANCH_info) {
+      edges.push_back({block, block->next, true});
+    }
+  }
+  if (loops.empty()) {
+    return;
+  }
+
+  // Prefer inner loops; their bodies run the most.
+  std::sort(loops.begin(), loops.end(),
+            [](const LoopRange& a, const LoopRange& b) {
+              return a.second - a.first < b.second - b.first;
+            });
+
+  block_reservations_.resize(blocks.size());
+  auto& claimed = claimed_loops_;
+  auto& accesses = loop_accesses_;
+  auto& selected = loop_selected_;
+  auto& candidates = loop_candidates_;
+  auto& writeback_blocks = writeback_blocks_;
+  claimed.clear();
+  auto find_access = [&accesses](size_t offset) {
+    auto it = std::lower_bound(
+        accesses.begin(), accesses.end(), offset,
+        [](const std::pair<size_t, LoopContextAccess>& access, size_t value) {
+          return access.first < value;
+        });
+    return it != accesses.end() && it->first == offset ? &it->second
+                                                       : nullptr;
+  };
+  for (auto& loop : loops) {
+    uint16_t head = loop.first;
+    uint16_t tail = loop.second;
+    if (!head) {
+      // No preheader to load values in.
+      continue;
+    }
+    auto in_loop = [&](const Block* block) {
+      return block && block->ordinal >= head && block->ordinal <= tail;
+    };
+
+    // The preheader belongs to the loop as far as register use goes.
+    bool overlaps = false;
+    for (auto& other : claimed) {
+      if (head - 1 <= other.second && other.first <= tail) {
+        overlaps = true;
+        break;
+      }
+    }
+    if (overlaps) {
+      continue;
+    }
+
+    // The only way in must be falling through from the preheader.
+    auto preheader = blocks[head - 1];
+    bool valid = true;
+    bool has_entry = false;
+    for (auto& edge : edges) {
+      if (in_loop(edge.dest) && !in_loop(edge.src)) {
+        if (edge.fallthrough && edge.src == preheader) {
+          has_entry = true;
+        } else {
+          valid = false;
+          break;
+        }
+      }
+    }
+    if (!valid || !has_entry || !preheader->instr_tail) {
+      continue;
+    }
+    auto preheader_last = FirstTrailingBranch(preheader);
+    preheader_last =
+        preheader_last ? preheader_last->prev : preheader->instr_tail;
+    if (preheader_last && preheader_last->opcode->flags &
+                              (OPCODE_FLAG_VOLATILE | OPCODE_FLAG_BRANCH)) {
+      // Ends in a call; there's nowhere to load the values after it.
+      continue;
+    }
+
+    // Gather context accesses, rejecting loops that may leave guest code.
+    accesses.clear();
+    for (uint16_t n = head; valid && n <= tail; ++n) {
+      // Exits must all be at the end of blocks for the write back below.
+      auto trailing_branch = FirstTrailingBranch(blocks[n]);
+      bool in_trailing_branches = false;
+      for (auto i = blocks[n]->instr_head; i; i = i->next) {
+        in_trailing_branches = in_trailing_branches || i == trailing_branch;
+        if ((i->opcode->flags & OPCODE_FLAG_VOLATILE && !IsLocalBranch(i)) ||
+            (IsLocalBranch(i) && !in_trailing_branches) ||
+            i->opcode == &OPCODE_CONTEXT_BARRIER_info) {
+          valid = false;
+          break;
+        }
+        TypeName type;
+        bool stored = false;
+        if (i->opcode == &OPCODE_LOAD_CONTEXT_info) {
+          type = i->dest->type;
+        } else if (i->opcode == &OPCODE_STORE_CONTEXT_info) {
+          type = i->src2.value->type;
+          stored = true;
+        } else {
+          continue;
+        }
+        accesses.push_back({i->src1.offset, {type, 1, stored, true, nullptr}});
+      }
+    }
+    if (!valid || accesses.empty()) {
+      continue;
+    }
+
+    // Merge accesses of the same offset.
+    std::sort(accesses.begin(), accesses.end(),
+              [](const std::pair<size_t, LoopContextAccess>& a,
+                 const std::pair<size_t, LoopContextAccess>& b) {
+                return a.first < b.first;
+              });
+    size_t merged_count = 0;
+    for (auto& it : accesses) {
+      if (merged_count && accesses[merged_count - 1].first == it.first) {
+        auto& access = accesses[merged_count - 1].second;
+        access.valid = access.valid && access.type == it.second.type;
+        access.count++;
+        access.stored = access.stored || it.second.stored;
+      } else {
+        accesses[merged_count++] = it;
+      }
+    }
+    accesses.resize(merged_count);
+
+    // Overlapping accesses of different offsets or sizes can't be split
+    // between a register and the context.
+    size_t cluster_end = 0;
+    auto cluster_begin = accesses.end();
+    for (auto it = accesses.begin(); it != accesses.end(); ++it) {
+      size_t end = it->first + GetTypeSize(it->second.type);
+      if (cluster_begin != accesses.end() && it->first < cluster_end) {
+        for (auto jt = cluster_begin; jt != it; ++jt) {
+          jt->second.valid = false;
+        }
+        it->second.valid = false;
+        cluster_end = std::max(cluster_end, end);
+      } else {
+        cluster_begin = it;
+        cluster_end = end;
+      }
+    }
+
+    // Pick the most used values for each register set.
+    selected.clear();
+    for (size_t set_index = 0; set_index < xe::countof(usage_sets_.all_sets);
+         ++set_index) {
+      auto usage_set = usage_sets_.all_sets[set_index];
+      if (!usage_set || usage_set->count <= kMinFreeLoopRegisters) {
+        continue;
+      }
+      candidates.clear();
+      for (auto& it : accesses) {
+        // A single access gains nothing over the load/store done on entry
+        // and exit.
+        if (it.second.valid && it.second.count > 1 &&
+            RegisterSetForType(it.second.type) == usage_set) {
+          candidates.emplace_back(it.first, &it.second);
+        }
+      }
+      std::sort(candidates.begin(), candidates.end(),
+                [](const LoopCandidate& a, const LoopCandidate& b) {
+                  return a.second->count > b.second->count;
+                });
+      uint32_t max_count = std::min(
+          kMaxLoopRegisters, usage_set->count - kMinFreeLoopRegisters);
+      for (uint32_t n = 0; n < candidates.size() && n < max_count; ++n) {
+        // Taken from the top of the set as the block-local allocator
+        // prefers the bottom.
+        auto access = candidates[n].second;
+        access->slot = builder->AllocLocal(access->type);
+        access->slot->reg.set = usage_set->set;
+        access->slot->reg.index = usage_set->count - 1 - n;
+        for (uint16_t m = head - 1; m <= tail; ++m) {
+          block_reservations_[m].regs[set_index].set(access->slot->reg.index);
+        }
+        selected.push_back(candidates[n]);
+      }
+    }
+    if (selected.empty()) {
+      continue;
+    }
+    claimed.push_back(loop);
+
+    // Load values on entry.
+    for (auto& it : selected) {
+      auto value = builder->LoadContext(it.first, it.second->type);
+      MoveToBlockEnd(builder->last_instr(), preheader);
+      builder->StoreLocal(it.second->slot, value);
+      MoveToBlockEnd(builder->last_instr(), preheader);
+    }
+
+    // Redirect accesses within the loop to the registers.
+    for (uint16_t n = head; n <= tail; ++n) {
+      for (auto i = blocks[n]->instr_head; i; i = i->next) {
+        if (i->opcode != &OPCODE_LOAD_CONTEXT_info &&
+            i->opcode != &OPCODE_STORE_CONTEXT_info) {
+          continue;
+        }
+        auto access = find_access(i->src1.offset);
+        if (!access || !access->slot) {
+          continue;
+        }
+        if (i->opcode == &OPCODE_LOAD_CONTEXT_info) {
+          i->Replace(&OPCODE_LOAD_LOCAL_info, 0);
+          i->set_src1(access->slot);
+        } else {
+          auto value = i->src2.value;
+          i->Replace(&OPCODE_STORE_LOCAL_info, 0);
+          i->set_src1(access->slot);
+          i->set_src2(value);
+        }
+      }
+    }
+
+    // Write back modified values on every exit. Exits to blocks only
+    // reachable from the loop write back there, otherwise it has to happen
+    // on the way out of the exiting block.
+    writeback_blocks.clear();
+    for (auto& edge : edges) {
+      if (!in_loop(edge.src) || in_loop(edge.dest)) {
+        continue;
+      }
+      bool dest_exclusive = edge.dest && edge.dest->instr_head;
+      for (auto& other : edges) {
+        if (other.dest == edge.dest && !in_loop(other.src)) {
+          dest_exclusive = false;
+          break;
+        }
+      }
+      auto block = dest_exclusive ? edge.dest : edge.src;
+      if (std::find(writeback_blocks.begin(), writeback_blocks.end(), block) ==
+          writeback_blocks.end()) {
+        writeback_blocks.push_back(block);
+      }
+    }
+    for (auto block : writeback_blocks) {
+      bool at_head = !in_loop(block);
+      auto head_instr = block->instr_head;
+      for (auto& it : selected) {
+        if (!it.second->stored) {
+          continue;
+        }
+        auto value = builder->LoadLocal(it.second->slot);
+        if (at_head) {
+          builder->last_instr()->MoveBefore(head_instr);
+        } else {
+          MoveToBlockEnd(builder->last_instr(), block);
+        }
+        builder->StoreContext(it.first, value);
+        if (at_head) {
+          builder->last_instr()->MoveBefore(head_instr);
+        } else {
+          MoveToBlockEnd(builder->last_instr(), block);
+        }
+      }
+    }
+  }
+}
+
 void RegisterAllocationPass::DumpUsage(const char* name) {
 #if 0
   fprintf(stdout, "\n%s:\n", name);
@@ -195,12 +555,16 @@ void RegisterAllocationPass::DumpUsage(const char* name) {
 #endif
 }
 
-void RegisterAllocationPass::PrepareBlockState() {
+void RegisterAllocationPass::PrepareBlockState(Block* block) {
   for (size_t i = 0; i < xe::countof(usage_sets_.all_sets); ++i) {
     auto usage_set = usage_sets_.all_sets[i];
     if (usage_set) {
       usage_set->availability.set();
       usage_set->upcoming_uses.clear();
+      if (block->ordinal < block_reservations_.size()) {
+        usage_set->availability &=
+            ~block_reservations_[block->ordinal].regs[i];
+      }
     }
   }
   DumpUsage("PrepareBlockState");
@@ -473,9 +837,14 @@ bool RegisterAllocationPass::SpillOneRegister(HIRBuilder* builder, Block* block,
 
 RegisterAllocationPass::RegisterSetUsage*
 RegisterAllocationPass::RegisterSetForValue(const Value* value) {
-  if (value->type <= INT64_TYPE) {
+  return RegisterSetForType(value->type);
+}
+
+RegisterAllocationPass::RegisterSetUsage*
+RegisterAllocationPass::RegisterSetForType(TypeName type) {
+  if (type <= INT64_TYPE) {
     return usage_sets_.int_set;
-  } else if (value->type <= FLOAT64_TYPE) {
+  } else if (type <= FLOAT64_TYPE) {
     return usage_sets_.float_set;
   } else {
     return usage_sets_.vec_set;
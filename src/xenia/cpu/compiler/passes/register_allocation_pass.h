@@ -13,6 +13,7 @@
 #include <algorithm>
 #include <bitset>
 #include <functional>
+#include <utility>
 #include <vector>
 
 #include "xenia/cpu/backend/machine_info.h"
@@ -28,6 +29,8 @@ class RegisterAllocationPass : public CompilerPass {
   explicit RegisterAllocationPass(const backend::MachineInfo* machine_info);
   ~RegisterAllocationPass() override;
 
+  const char* name() const override { return "register_allocation"; }
+
   bool Run(hir::HIRBuilder* builder) override;
 
  private:
@@ -53,8 +56,12 @@ class RegisterAllocationPass : public CompilerPass {
     std::vector<RegisterUsage> upcoming_uses;
   };
 
+  // Pins context values accessed within simple loops to host registers for
+  // the duration of the loop, writing them back on exit.
+  void AllocateLoopRegisters(hir::HIRBuilder* builder);
+
   void DumpUsage(const char* name);
-  void PrepareBlockState();
+  void PrepareBlockState(hir::Block* block);
   void AdvanceUses(hir::Instr* instr);
   bool IsRegInUse(const hir::RegAssignment& reg);
   RegisterSetUsage* MarkRegUsed(const hir::RegAssignment& reg,
@@ -68,6 +75,7 @@ class RegisterAllocationPass : public CompilerPass {
                         hir::TypeName required_type);
 
   RegisterSetUsage* RegisterSetForValue(const hir::Value* value);
+  RegisterSetUsage* RegisterSetForType(hir::TypeName type);
 
   void SortUsageList(hir::Value* value);
 
@@ -78,6 +86,39 @@ class RegisterAllocationPass : public CompilerPass {
     RegisterSetUsage* vec_set = nullptr;
     RegisterSetUsage* all_sets[3];
   } usage_sets_;
+
+  // Registers pinned by AllocateLoopRegisters, by block ordinal. Indexed as
+  // usage_sets_.all_sets.
+  struct BlockReservation {
+    std::bitset<32> regs[3];
+  };
+  std::vector<BlockReservation> block_reservations_;
+
+  // Scratch state of AllocateLoopRegisters, kept across runs so their storage
+  // is reused.
+  struct LoopEdge {
+    hir::Block* src;
+    hir::Block* dest;
+    bool fallthrough;
+  };
+  struct LoopContextAccess {
+    hir::TypeName type;
+    uint32_t count;
+    bool stored;
+    bool valid;
+    hir::Value* slot;
+  };
+  typedef std::pair<uint16_t, uint16_t> LoopRange;
+  typedef std::pair<size_t, LoopContextAccess*> LoopCandidate;
+  std::vector<hir::Block*> loop_blocks_;
+  std::vector<LoopEdge> loop_edges_;
+  std::vector<LoopRange> loops_;
+  std::vector<LoopRange> claimed_loops_;
+  // Sorted by context offset.
+  std::vector<std::pair<size_t, LoopContextAccess>> loop_accesses_;
+  std::vector<LoopCandidate> loop_candidates_;
+  std::vector<LoopCandidate> loop_selected_;
+  std::vector<hir::Block*> writeback_blocks_;
 };
 
 }  // namespace passes
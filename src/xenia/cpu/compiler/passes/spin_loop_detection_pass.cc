@@ -0,0 +1,195 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2016 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#include "xenia/cpu/compiler/passes/spin_loop_detection_pass.h"
+
+#include "xenia/base/counters.h"
+#include "xenia/base/profiling.h"
+
+DEFINE_counter(jit_spin_loops, "cpu.jit_spin_loops");
+
+namespace xe {
+namespace cpu {
+namespace compiler {
+namespace passes {
+
+// TODO(benvanik): remove when enums redefined.
+using namespace xe::cpu::hir;
+
+using xe::cpu::hir::Block;
+using xe::cpu::hir::HIRBuilder;
+using xe::cpu::hir::Instr;
+using xe::cpu::hir::Value;
+
+SpinLoopDetectionPass::SpinLoopDetectionPass() : CompilerPass() {}
+
+SpinLoopDetectionPass::~SpinLoopDetectionPass() = default;
+
+bool SpinLoopDetectionPass::Run(HIRBuilder* builder) {
+  auto block = builder->first_block();
+  while (block) {
+    if (IsSpinLoop(block)) {
+      InsertSpinWait(builder, block);
+      INCREMENT_counter(jit_spin_loops, 1);
+    }
+    block = block->next;
+  }
+  return true;
+}
+
+bool SpinLoopDetectionPass::IsSpinLoop(Block* block) {
+  // Anything longer is most likely doing work between the polls.
+  const uint32_t kMaxInstrCount = 32;
+  uint32_t instr_count = 0;
+  bool loads = false;
+  auto& stores = context_stores_;
+  stores.clear();
+  // The branches are looked at rather than the edges, as those are stale
+  // after ControlFlowSimplificationPass has merged blocks.
+  for (auto i = block->instr_head; i; i = i->next) {
+    auto opcode = i->opcode;
+    if (opcode == &OPCODE_COMMENT_info ||
+        opcode == &OPCODE_SOURCE_OFFSET_info) {
+      continue;
+    }
+    if (++instr_count > kMaxInstrCount) {
+      return false;
+    }
+    if (opcode == &OPCODE_BRANCH_info || opcode == &OPCODE_BRANCH_TRUE_info ||
+        opcode == &OPCODE_BRANCH_FALSE_info) {
+      // Exits elsewhere are fine; the spin wait goes on the back branch,
+      // which has to close the block.
+      if (LoopBranchTarget(i) == block && i != block->instr_tail) {
+        return false;
+      }
+    } else if (opcode == &OPCODE_LOAD_info ||
+               opcode == &OPCODE_LOAD_MMIO_info ||
+               opcode == &OPCODE_LOAD_CLOCK_info) {
+      loads = true;
+    } else if (opcode == &OPCODE_STORE_CONTEXT_info) {
+      auto offset = static_cast<uint32_t>(i->src1.offset);
+      stores.emplace_back(
+          offset,
+          offset + static_cast<uint32_t>(GetTypeSize(i->src2.value->type)));
+    } else if (opcode == &OPCODE_MEMORY_BARRIER_info) {
+      // lwsync/sync between polls.
+    } else if (opcode->flags & (OPCODE_FLAG_MEMORY | OPCODE_FLAG_VOLATILE)) {
+      // Stores, calls, traps and atomics have effects beyond the loop itself.
+      return false;
+    }
+  }
+  auto tail = block->instr_tail;
+  if (!loads || !tail || LoopBranchTarget(tail) != block) {
+    return false;
+  }
+  if (tail->opcode != &OPCODE_BRANCH_info && !block->next) {
+    // Nothing to exit to once the branch is inverted.
+    return false;
+  }
+  // Loads from an address that changes each iteration are walking memory
+  // rather than waiting on it.
+  for (auto i = block->instr_head; i; i = i->next) {
+    if ((i->opcode == &OPCODE_LOAD_info ||
+         i->opcode == &OPCODE_LOAD_MMIO_info) &&
+        !IsLoopInvariant(block, i->src1.value)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+Block* SpinLoopDetectionPass::LoopBranchTarget(const Instr* i) {
+  if (i->opcode == &OPCODE_BRANCH_info) {
+    return i->src1.label->block;
+  } else if (i->opcode == &OPCODE_BRANCH_TRUE_info ||
+             i->opcode == &OPCODE_BRANCH_FALSE_info) {
+    return i->src2.label->block;
+  }
+  return nullptr;
+}
+
+bool SpinLoopDetectionPass::IsLoopInvariant(const Block* block,
+                                            const Value* value) const {
+  if (value->IsConstant()) {
+    return true;
+  }
+  auto def = value->def;
+  if (!def || def->block != block) {
+    return true;
+  }
+  auto opcode = def->opcode;
+  if (opcode == &OPCODE_LOAD_CONTEXT_info) {
+    // Registers the loop writes are from the last iteration.
+    auto begin = static_cast<uint32_t>(def->src1.offset);
+    auto end = begin + static_cast<uint32_t>(GetTypeSize(value->type));
+    for (auto& store : context_stores_) {
+      if (store.first < end && begin < store.second) {
+        return false;
+      }
+    }
+    return true;
+  }
+  if (opcode == &OPCODE_LOAD_LOCAL_info ||
+      opcode->flags & (OPCODE_FLAG_MEMORY | OPCODE_FLAG_VOLATILE)) {
+    return false;
+  }
+  // Pure operations are invariant if all of their operands are.
+  uint32_t signature = opcode->signature;
+  if (GET_OPCODE_SIG_TYPE_SRC1(signature) == OPCODE_SIG_TYPE_V &&
+      !IsLoopInvariant(block, def->src1.value)) {
+    return false;
+  }
+  if (GET_OPCODE_SIG_TYPE_SRC2(signature) == OPCODE_SIG_TYPE_V &&
+      !IsLoopInvariant(block, def->src2.value)) {
+    return false;
+  }
+  if (GET_OPCODE_SIG_TYPE_SRC3(signature) == OPCODE_SIG_TYPE_V &&
+      !IsLoopInvariant(block, def->src3.value)) {
+    return false;
+  }
+  return true;
+}
+
+void SpinLoopDetectionPass::InsertSpinWait(HIRBuilder* builder,
+                                           Block* block) {
+  auto branch = block->instr_tail;
+  if (branch->opcode == &OPCODE_BRANCH_info) {
+    // Only taken when polling again.
+    builder->SpinWait();
+    builder->last_instr()->MoveBefore(branch);
+    return;
+  }
+
+  // The first poll usually succeeds, so the wait is moved out of its way by
+  // inverting the back branch into an exit:
+  //   branch_true v2, label0
+  // becomes:
+  //   branch_false v2, label1
+  //   spin_wait
+  //   branch label0
+  //   label1:
+  auto loop_label = branch->src2.label;
+  auto exit_label = builder->NewLabel();
+  builder->InsertLabel(exit_label, branch);
+  branch->opcode = branch->opcode == &OPCODE_BRANCH_TRUE_info
+                       ? &OPCODE_BRANCH_FALSE_info
+                       : &OPCODE_BRANCH_TRUE_info;
+  branch->src2.label = exit_label;
+
+  builder->SpinWait();
+  auto spin_wait = builder->last_instr();
+  spin_wait->MoveAfter(branch);
+  builder->InsertBranch(loop_label, spin_wait);
+  builder->InsertLabel(builder->NewLabel(), branch);
+}
+
+}  // namespace passes
+}  // namespace compiler
+}  // namespace cpu
+}  // namespace xe
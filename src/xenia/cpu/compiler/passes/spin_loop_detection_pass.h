@@ -0,0 +1,64 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2016 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#ifndef XENIA_CPU_COMPILER_PASSES_SPIN_LOOP_DETECTION_PASS_H_
+#define XENIA_CPU_COMPILER_PASSES_SPIN_LOOP_DETECTION_PASS_H_
+
+#include <utility>
+#include <vector>
+
+#include "xenia/cpu/compiler/compiler_pass.h"
+
+namespace xe {
+namespace cpu {
+namespace compiler {
+namespace passes {
+
+// Adds a spin_wait to the back branch of loops that do nothing but poll a
+// fixed address or the time base, waiting for another thread. Example:
+//   label0:
+//   v0.i32 = load v1
+//   store_context +104, v0
+//   v2.i8 = compare_eq v0, 0
+//   branch_true v2, label0
+// becomes:
+//   label0:
+//   v0.i32 = load v1
+//   ...
+//   branch_false v2, label1
+//   spin_wait
+//   branch label0
+//   label1:
+// Only loops of a single block closed by their last instruction are
+// recognized.
+class SpinLoopDetectionPass : public CompilerPass {
+ public:
+  SpinLoopDetectionPass();
+  ~SpinLoopDetectionPass() override;
+
+  const char* name() const override { return "spin_loop_detection"; }
+
+  bool Run(hir::HIRBuilder* builder) override;
+
+ private:
+  bool IsSpinLoop(hir::Block* block);
+  static hir::Block* LoopBranchTarget(const hir::Instr* i);
+  bool IsLoopInvariant(const hir::Block* block, const hir::Value* value) const;
+  void InsertSpinWait(hir::HIRBuilder* builder, hir::Block* block);
+
+  // Context ranges [begin, end) stored by the loop being checked.
+  std::vector<std::pair<uint32_t, uint32_t>> context_stores_;
+};
+
+}  // namespace passes
+}  // namespace compiler
+}  // namespace cpu
+}  // namespace xe
+
+#endif  // XENIA_CPU_COMPILER_PASSES_SPIN_LOOP_DETECTION_PASS_H_
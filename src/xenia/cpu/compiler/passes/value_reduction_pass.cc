@@ -9,22 +9,11 @@
 
 #include "xenia/cpu/compiler/passes/value_reduction_pass.h"
 
-#include "xenia/base/platform.h"
 #include "xenia/base/profiling.h"
 #include "xenia/cpu/backend/backend.h"
 #include "xenia/cpu/compiler/compiler.h"
 #include "xenia/cpu/processor.h"
 
-#if XE_COMPILER_MSVC
-#pragma warning(push)
-#pragma warning(disable : 4244)
-#pragma warning(disable : 4267)
-#include <llvm/ADT/BitVector.h>
-#pragma warning(pop)
-#else
-#include <llvm/ADT/BitVector.h>
-#endif  // XE_COMPILER_MSVC
-
 namespace xe {
 namespace cpu {
 namespace compiler {
@@ -34,6 +23,7 @@ namespace passes {
 using namespace xe::cpu::hir;
 
 using xe::cpu::hir::HIRBuilder;
+using xe::cpu::hir::Instr;
 using xe::cpu::hir::OpcodeInfo;
 using xe::cpu::hir::Value;
 
@@ -60,13 +50,40 @@ void ValueReductionPass::ComputeLastUse(Value* value) {
 
 bool ValueReductionPass::Run(HIRBuilder* builder) {
   // Walk each block and reuse variable ordinals as much as possible.
+  // Values that cross block boundaries keep their ordinals as their lifetimes
+  // can't be determined from instruction order within a single block.
 
-  llvm::BitVector ordinals(builder->max_value_ordinal());
+  auto& ordinals = ordinals_;
+  auto& global_ordinals = global_ordinals_;
+  global_ordinals.resize(builder->max_value_ordinal());
+  global_ordinals.reset();
 
   auto block = builder->first_block();
+  while (block) {
+    auto instr = block->instr_head;
+    while (instr) {
+      const OpcodeInfo* info = instr->opcode;
+      auto src1_type = GET_OPCODE_SIG_TYPE_SRC1(info->signature);
+      auto src2_type = GET_OPCODE_SIG_TYPE_SRC2(info->signature);
+      auto src3_type = GET_OPCODE_SIG_TYPE_SRC3(info->signature);
+      if (src1_type == OPCODE_SIG_TYPE_V) {
+        MarkGlobal(instr, instr->src1.value, &global_ordinals);
+      }
+      if (src2_type == OPCODE_SIG_TYPE_V) {
+        MarkGlobal(instr, instr->src2.value, &global_ordinals);
+      }
+      if (src3_type == OPCODE_SIG_TYPE_V) {
+        MarkGlobal(instr, instr->src3.value, &global_ordinals);
+      }
+      instr = instr->next;
+    }
+    block = block->next;
+  }
+
+  block = builder->first_block();
   while (block) {
     // Reset used ordinals.
-    ordinals.reset();
+    ordinals = global_ordinals;
 
     // Renumber all instructions to make liveness tracking easier.
     uint32_t instr_ordinal = 0;
@@ -84,49 +101,26 @@ bool ValueReductionPass::Run(HIRBuilder* builder) {
       auto src2_type = GET_OPCODE_SIG_TYPE_SRC2(info->signature);
       auto src3_type = GET_OPCODE_SIG_TYPE_SRC3(info->signature);
       if (src1_type == OPCODE_SIG_TYPE_V) {
-        auto v = instr->src1.value;
-        if (!v->last_use) {
-          ComputeLastUse(v);
-        }
-        if (v->last_use == instr) {
-          // Available.
-          if (!instr->src1.value->IsConstant()) {
-            ordinals.reset(v->ordinal);
-          }
-        }
+        ReleaseIfLastUse(instr, instr->src1.value, &ordinals);
       }
       if (src2_type == OPCODE_SIG_TYPE_V) {
-        auto v = instr->src2.value;
-        if (!v->last_use) {
-          ComputeLastUse(v);
-        }
-        if (v->last_use == instr) {
-          // Available.
-          if (!instr->src2.value->IsConstant()) {
-            ordinals.reset(v->ordinal);
-          }
-        }
+        ReleaseIfLastUse(instr, instr->src2.value, &ordinals);
       }
       if (src3_type == OPCODE_SIG_TYPE_V) {
-        auto v = instr->src3.value;
-        if (!v->last_use) {
-          ComputeLastUse(v);
-        }
-        if (v->last_use == instr) {
-          // Available.
-          if (!instr->src3.value->IsConstant()) {
-            ordinals.reset(v->ordinal);
-          }
-        }
+        ReleaseIfLastUse(instr, instr->src3.value, &ordinals);
       }
-      if (dest_type == OPCODE_SIG_TYPE_V) {
+      if (dest_type == OPCODE_SIG_TYPE_V && instr->dest &&
+          !global_ordinals.test(instr->dest->ordinal)) {
         // Dest values are processed last, as they may be able to reuse a
         // source value ordinal.
         auto v = instr->dest;
         // Find a lower ordinal.
         for (auto n = 0u; n < ordinals.size(); n++) {
           if (!ordinals.test(n)) {
-            ordinals.set(n);
+            // Values without uses die immediately.
+            if (v->use_head) {
+              ordinals.set(n);
+            }
             v->ordinal = n;
             break;
           }
@@ -142,6 +136,31 @@ bool ValueReductionPass::Run(HIRBuilder* builder) {
   return true;
 }
 
+void ValueReductionPass::MarkGlobal(Instr* instr, Value* value,
+                                    llvm::BitVector* global_ordinals) {
+  if (value->IsConstant()) {
+    return;
+  }
+  if (!value->def || value->def->block != instr->block) {
+    global_ordinals->set(value->ordinal);
+  }
+}
+
+void ValueReductionPass::ReleaseIfLastUse(Instr* instr, Value* value,
+                                          llvm::BitVector* ordinals) {
+  if (value->IsConstant() || !value->def ||
+      value->def->block != instr->block) {
+    return;
+  }
+  if (!value->last_use) {
+    ComputeLastUse(value);
+  }
+  if (value->last_use == instr) {
+    // Available.
+    ordinals->reset(value->ordinal);
+  }
+}
+
 }  // namespace passes
 }  // namespace compiler
 }  // namespace cpu
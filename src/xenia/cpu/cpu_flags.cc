@@ -15,6 +15,62 @@ DEFINE_string(
     load_module_map, "",
     "Loads a .map for symbol names and to diff with the generated symbol "
     "database.");
+DEFINE_bool(hle_memory_functions, true,
+            "Replaces the memcpy, memmove and memset of titles, as named by "
+            "the module map, with host implementations.");
+
+DEFINE_string(code_cache_path, "",
+              "Path to persist generated code between runs. Disabled when "
+              "empty.");
+DEFINE_bool(code_cache_read_only, false,
+            "Maps the code cache files rather than loading and appending to "
+            "them, so many processes can share one cache and its memory. "
+            "Functions missing from it are generated but not stored.");
+
+DEFINE_int32(compile_threads, 0,
+             "Number of background threads translating known call targets "
+             "ahead of their first use. 0 to translate only on demand.");
+
+DEFINE_bool(precompile_modules, false,
+            "Translate every function found in a module while it is loaded, "
+            "on all host cores, instead of on first call.");
+
+DEFINE_int32(tier_up_threshold, 0,
+             "Translate functions with a minimal pass pipeline first and "
+             "recompile them fully optimized after this many calls. 0 to "
+             "always optimize.");
+
+DEFINE_int32(inline_max_instructions, 8,
+             "Calls to straight-line leaf functions of up to this many "
+             "instructions are replaced by their body. Off with "
+             "--code_cache_path, as cached callers aren't checked against "
+             "changes to their callees. 0 to never inline.");
+
+DEFINE_bool(summarize_call_context, true,
+            "Keep context stores and constants across direct calls when the "
+            "callee is known not to read or write them. Off with "
+            "--code_cache_path, like inlining.");
+
+DEFINE_bool(inline_save_restore, true,
+            "Replaces calls to the __savegprlr/__restgprlr, __savefpr/"
+            "__restfpr and __savevmx/__restvmx helpers by their register "
+            "moves.");
+
+DEFINE_bool(detect_spin_loops, true,
+            "Eases off the host core in loops that only poll memory or the "
+            "time base.");
+DEFINE_int32(spin_wait_yield_interval, 64,
+             "Iterations of a detected spin loop between host thread yields. "
+             "0 to only pause.");
+
+DEFINE_bool(link_direct_calls, true,
+            "Patch guest calls into direct calls once their target has been "
+            "generated, avoiding the indirection table.");
+
+DEFINE_bool(invalidate_code_on_write, true,
+            "Watch translated guest code for writes and translate the "
+            "functions written to again on their next call, for titles that "
+            "load overlays or patch their code.");
 
 DEFINE_bool(disassemble_functions, false,
             "Disassemble functions during generation.");
@@ -27,6 +83,20 @@ DEFINE_bool(trace_function_references, false,
             "Generate tracing for function address references.");
 DEFINE_bool(trace_function_data, false,
             "Generate tracing for function result data.");
+DEFINE_bool(trace_block_coverage, false,
+            "Record which basic blocks run into --trace_block_coverage_path, "
+            "with a single store per block.");
+
+DEFINE_bool(profile_guest_code, false,
+            "Sample guest threads to find hot functions, without "
+            "instrumenting generated code.");
+DEFINE_int32(profile_guest_code_interval, 1,
+             "Milliseconds between guest code profiler samples.");
+DEFINE_string(profile_guest_code_path, "",
+              "File to write the guest code profile to on shutdown.");
+DEFINE_bool(profile_kernel_calls, false,
+            "Record the host time spent in each kernel export, logged on "
+            "shutdown and from the CPU menu.");
 
 DEFINE_bool(
     disable_global_lock, false,
@@ -34,6 +104,13 @@ DEFINE_bool(
 
 DEFINE_bool(validate_hir, false,
             "Perform validation checks on the HIR during compilation.");
+DEFINE_bool(eliminate_dead_stores, true,
+            "Remove context stores that are overwritten before being read.");
+DEFINE_bool(reduce_values, true,
+            "Compact HIR value ordinals once optimization has finished.");
+DEFINE_bool(lazy_flags, true,
+            "Defer CR and XER[CA] updates until they are read or the block "
+            "ends.");
 
 // Breakpoints:
 DEFINE_uint64(break_on_instruction, 0,
@@ -15,6 +15,22 @@
 DECLARE_string(cpu);
 
 DECLARE_string(load_module_map);
+DECLARE_bool(hle_memory_functions);
+
+DECLARE_string(code_cache_path);
+DECLARE_bool(code_cache_read_only);
+
+DECLARE_int32(compile_threads);
+DECLARE_bool(precompile_modules);
+DECLARE_int32(tier_up_threshold);
+DECLARE_int32(inline_max_instructions);
+DECLARE_bool(summarize_call_context);
+DECLARE_bool(inline_save_restore);
+DECLARE_bool(detect_spin_loops);
+DECLARE_int32(spin_wait_yield_interval);
+
+DECLARE_bool(link_direct_calls);
+DECLARE_bool(invalidate_code_on_write);
 
 DECLARE_bool(disassemble_functions);
 
@@ -22,10 +38,19 @@ DECLARE_bool(trace_functions);
 DECLARE_bool(trace_function_coverage);
 DECLARE_bool(trace_function_references);
 DECLARE_bool(trace_function_data);
+DECLARE_bool(trace_block_coverage);
+
+DECLARE_bool(profile_guest_code);
+DECLARE_int32(profile_guest_code_interval);
+DECLARE_string(profile_guest_code_path);
+DECLARE_bool(profile_kernel_calls);
 
 DECLARE_bool(disable_global_lock);
 
 DECLARE_bool(validate_hir);
+DECLARE_bool(eliminate_dead_stores);
+DECLARE_bool(reduce_values);
+DECLARE_bool(lazy_flags);
 
 DECLARE_uint64(break_on_instruction);
 DECLARE_int32(break_condition_gpr);
@@ -9,76 +9,138 @@
 
 #include "xenia/cpu/entry_table.h"
 
+#include "xenia/base/assert.h"
 #include "xenia/base/profiling.h"
-#include "xenia/base/threading.h"
 
 namespace xe {
 namespace cpu {
 
-EntryTable::EntryTable() = default;
+EntryTable::Table::Table(uint32_t capacity)
+    : mask(capacity - 1), slots(new std::atomic<Entry*>[capacity]) {
+  for (uint32_t i = 0; i < capacity; ++i) {
+    slots[i].store(nullptr, std::memory_order_relaxed);
+  }
+}
+
+EntryTable::EntryTable() {
+  tables_.emplace_back(new Table(4096));
+  table_ = tables_.back().get();
+}
 
 EntryTable::~EntryTable() {
-  auto global_lock = global_critical_region_.Acquire();
-  for (auto it : map_) {
-    Entry* entry = it.second;
-    delete entry;
+  Table* table = table_;
+  for (uint32_t i = 0; i <= table->mask; ++i) {
+    delete table->slots[i].load(std::memory_order_relaxed);
   }
 }
 
-Entry* EntryTable::Get(uint32_t address) {
-  auto global_lock = global_critical_region_.Acquire();
-  const auto& it = map_.find(address);
-  Entry* entry = it != map_.end() ? it->second : nullptr;
-  if (entry) {
-    // TODO(benvanik): wait if needed?
-    if (entry->status != Entry::STATUS_READY) {
-      entry = nullptr;
+Entry* EntryTable::Find(const Table* table, uint32_t address) {
+  for (uint32_t i = Hash(address);; ++i) {
+    Entry* entry =
+        table->slots[i & table->mask].load(std::memory_order_acquire);
+    if (!entry || entry->address == address) {
+      return entry;
+    }
+  }
+}
+
+void EntryTable::Insert(Entry* entry) {
+  Table* table = table_.load(std::memory_order_relaxed);
+  if ((count_ + 1) * 2 > table->mask + 1) {
+    // Kept at most half full, so probes stay short.
+    auto new_table = std::make_unique<Table>((table->mask + 1) * 2);
+    for (uint32_t i = 0; i <= table->mask; ++i) {
+      Entry* old_entry = table->slots[i].load(std::memory_order_relaxed);
+      if (old_entry) {
+        uint32_t j = Hash(old_entry->address);
+        while (new_table->slots[j & new_table->mask].load(
+            std::memory_order_relaxed)) {
+          ++j;
+        }
+        new_table->slots[j & new_table->mask].store(old_entry,
+                                                     std::memory_order_relaxed);
+      }
     }
+    table = new_table.get();
+    tables_.push_back(std::move(new_table));
+    table_.store(table, std::memory_order_release);
+  }
+  uint32_t i = Hash(entry->address);
+  while (table->slots[i & table->mask].load(std::memory_order_relaxed)) {
+    ++i;
+  }
+  table->slots[i & table->mask].store(entry, std::memory_order_release);
+  ++count_;
+}
+
+Entry* EntryTable::Get(uint32_t address) {
+  Entry* entry = Find(table_.load(std::memory_order_acquire), address);
+  if (entry && entry->status != Entry::STATUS_READY) {
+    entry = nullptr;
   }
   return entry;
 }
 
 Entry::Status EntryTable::GetOrCreate(uint32_t address, Entry** out_entry) {
-  // TODO(benvanik): replace with a map with wait-free for find.
-  // https://github.com/facebook/folly/blob/master/folly/AtomicHashMap.h
+  Entry* entry = Find(table_.load(std::memory_order_acquire), address);
+  if (!entry) {
+    auto lock = mutex_.Acquire();
+    // May have been added since, or be missing from an old table.
+    entry = Find(table_.load(std::memory_order_relaxed), address);
+    if (!entry) {
+      // Create and return for initialization.
+      entry = new Entry();
+      entry->address = address;
+      entry->end_address = 0;
+      entry->status = Entry::STATUS_COMPILING;
+      entry->function = nullptr;
+      Insert(entry);
+      *out_entry = entry;
+      return Entry::STATUS_NEW;
+    }
+  }
 
-  auto global_lock = global_critical_region_.Acquire();
-  const auto& it = map_.find(address);
-  Entry* entry = it != map_.end() ? it->second : nullptr;
-  Entry::Status status;
-  if (entry) {
-    // If we aren't ready yet spin and wait.
-    if (entry->status == Entry::STATUS_COMPILING) {
-      // Still compiling, so spin.
-      do {
-        global_lock.unlock();
-        // TODO(benvanik): sleep for less time?
-        xe::threading::Sleep(std::chrono::microseconds(10));
-        global_lock.lock();
-      } while (entry->status == Entry::STATUS_COMPILING);
+  if (entry->status == Entry::STATUS_COMPILING) {
+    // Sleep until whoever is compiling it is done. The event is only ever
+    // created under the lock, where Complete looks for it.
+    xe::threading::Event* ready_event = nullptr;
+    {
+      auto lock = mutex_.Acquire();
+      if (entry->status == Entry::STATUS_COMPILING) {
+        if (!entry->ready_event) {
+          entry->ready_event =
+              xe::threading::Event::CreateManualResetEvent(false);
+        }
+        ready_event = entry->ready_event.get();
+      }
+    }
+    if (ready_event) {
+      xe::threading::Wait(ready_event, false);
     }
-    status = entry->status;
-  } else {
-    // Create and return for initialization.
-    entry = new Entry();
-    entry->address = address;
-    entry->end_address = 0;
-    entry->status = Entry::STATUS_COMPILING;
-    entry->function = 0;
-    map_[address] = entry;
-    status = Entry::STATUS_NEW;
   }
-  global_lock.unlock();
   *out_entry = entry;
-  return status;
+  return entry->status;
+}
+
+void EntryTable::Complete(Entry* entry, Entry::Status status) {
+  assert_true(status == Entry::STATUS_READY || status == Entry::STATUS_FAILED);
+  entry->status = status;
+  auto lock = mutex_.Acquire();
+  if (entry->ready_event) {
+    entry->ready_event->Set();
+  }
+}
+
+bool EntryTable::Contains(uint32_t address) {
+  return Find(table_.load(std::memory_order_acquire), address) != nullptr;
 }
 
 std::vector<Function*> EntryTable::FindWithAddress(uint32_t address) {
-  auto global_lock = global_critical_region_.Acquire();
+  Table* table = table_.load(std::memory_order_acquire);
   std::vector<Function*> fns;
-  for (auto& it : map_) {
-    Entry* entry = it.second;
-    if (address >= entry->address && address <= entry->end_address) {
+  for (uint32_t i = 0; i <= table->mask; ++i) {
+    Entry* entry = table->slots[i].load(std::memory_order_acquire);
+    if (entry && address >= entry->address && address <= entry->end_address) {
       if (entry->status == Entry::STATUS_READY) {
         fns.push_back(entry->function);
       }
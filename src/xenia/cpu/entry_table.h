@@ -10,10 +10,12 @@
 #ifndef XENIA_CPU_ENTRY_TABLE_H_
 #define XENIA_CPU_ENTRY_TABLE_H_
 
-#include <unordered_map>
+#include <atomic>
+#include <memory>
 #include <vector>
 
 #include "xenia/base/mutex.h"
+#include "xenia/base/threading.h"
 
 namespace xe {
 namespace cpu {
@@ -29,11 +31,16 @@ typedef struct Entry_t {
   } Status;
 
   uint32_t address;
+  // Set along with function before the entry becomes ready.
   uint32_t end_address;
-  Status status;
+  std::atomic<Status> status;
   Function* function;
+  // Created by the first thread to wait for the entry to be compiled.
+  std::unique_ptr<xe::threading::Event> ready_event;
 } Entry;
 
+// Entries by guest address. Lookups are lock-free, and only creating entries
+// and waiting on ones being compiled take the lock.
 class EntryTable {
  public:
   EntryTable();
@@ -41,13 +48,37 @@ class EntryTable {
 
   Entry* Get(uint32_t address);
   Entry::Status GetOrCreate(uint32_t address, Entry** out_entry);
+  // Completes an entry returned as STATUS_NEW from GetOrCreate and wakes any
+  // threads waiting on it.
+  void Complete(Entry* entry, Entry::Status status);
+  // True if any thread has started resolving the given address.
+  bool Contains(uint32_t address);
 
   std::vector<Function*> FindWithAddress(uint32_t address);
 
  private:
-  xe::global_critical_region global_critical_region_;
-  // TODO(benvanik): replace with a better data structure.
-  std::unordered_map<uint32_t, Entry*> map_;
+  // Open addressed with linear probing. Slots are only ever filled, and a
+  // full table is replaced by a larger copy, so readers of an old table
+  // still see valid entries and at worst miss ones added since.
+  struct Table {
+    explicit Table(uint32_t capacity);
+    uint32_t mask;
+    std::unique_ptr<std::atomic<Entry*>[]> slots;
+  };
+
+  static uint32_t Hash(uint32_t address) {
+    // Guest code is 4 byte aligned.
+    return (address >> 2) * 2654435761u;
+  }
+  static Entry* Find(const Table* table, uint32_t address);
+  // Adds the entry, which must not be in the table. Must hold the lock.
+  void Insert(Entry* entry);
+
+  xe::profiled_mutex mutex_{"entry_table"};
+  std::atomic<Table*> table_;
+  uint32_t count_ = 0;
+  // Replaced tables, kept until destruction for readers still using them.
+  std::vector<std::unique_ptr<Table>> tables_;
 };
 
 }  // namespace cpu
@@ -9,12 +9,67 @@
 
 #include "xenia/cpu/export_resolver.h"
 
+#include <algorithm>
+#include <cinttypes>
+
 #include "xenia/base/assert.h"
+#include "xenia/base/clock.h"
+#include "xenia/base/logging.h"
 #include "xenia/base/math.h"
+#include "xenia/cpu/cpu_flags.h"
 
 namespace xe {
 namespace cpu {
 
+uint32_t ExportProfile::BucketIndex(uint64_t ticks) {
+  if (ticks < 4) {
+    return uint32_t(ticks);
+  }
+  uint32_t high_bit = 63 - xe::lzcnt(ticks);
+  return (high_bit - 1) * 4 + uint32_t((ticks >> (high_bit - 2)) & 3);
+}
+
+uint64_t ExportProfile::BucketMaxTicks(uint32_t index) {
+  if (index < 4) {
+    return index;
+  }
+  uint32_t high_bit = index / 4 + 1;
+  uint64_t min_ticks = uint64_t(4 + index % 4) << (high_bit - 2);
+  return min_ticks + (uint64_t(1) << (high_bit - 2)) - 1;
+}
+
+thread_local uint64_t ExportCallScope::thread_blocked_ticks_ = 0;
+thread_local uint32_t ExportCallScope::thread_call_depth_ = 0;
+
+void ExportCallScope::Begin() {
+  ++thread_call_depth_;
+  start_blocked_ticks_ = thread_blocked_ticks_;
+  start_ticks_ = Clock::QueryHostTickCount();
+}
+
+void ExportCallScope::End() {
+  uint64_t ticks = Clock::QueryHostTickCount() - start_ticks_;
+  --thread_call_depth_;
+  // Relaxed, as the counters are only read for dumps.
+  profile_->call_count.fetch_add(1, std::memory_order_relaxed);
+  profile_->total_ticks.fetch_add(ticks, std::memory_order_relaxed);
+  uint64_t blocked_ticks = thread_blocked_ticks_ - start_blocked_ticks_;
+  if (blocked_ticks) {
+    profile_->blocked_ticks.fetch_add(blocked_ticks, std::memory_order_relaxed);
+  }
+  profile_->buckets[ExportProfile::BucketIndex(ticks)].fetch_add(
+      1, std::memory_order_relaxed);
+}
+
+void ExportBlockedScope::Begin() {
+  start_ticks_ = Clock::QueryHostTickCount();
+}
+
+void ExportBlockedScope::End() {
+  ExportCallScope::thread_blocked_ticks_ +=
+      Clock::QueryHostTickCount() - start_ticks_;
+}
+
 ExportResolver::Table::Table(const char* module_name,
                              const std::vector<Export*>* exports_by_ordinal)
     : exports_by_ordinal_(exports_by_ordinal) {
@@ -35,12 +90,20 @@ ExportResolver::Table::Table(const char* module_name,
   }
   std::sort(
       exports_by_name_.begin(), exports_by_name_.end(),
-      [](Export* a, Export* b) { return std::strcmp(a->name, b->name) <= 0; });
+      [](Export* a, Export* b) { return std::strcmp(a->name, b->name) < 0; });
 }
 
 ExportResolver::ExportResolver() = default;
 
-ExportResolver::~ExportResolver() = default;
+ExportResolver::~ExportResolver() {
+  if (!profiles_.empty()) {
+    DumpProfile();
+  }
+  // The exports outlive the resolver.
+  for (auto export_entry : all_exports_by_name_) {
+    export_entry->profile = nullptr;
+  }
+}
 
 void ExportResolver::RegisterTable(
     const char* module_name, const std::vector<xe::cpu::Export*>* exports) {
@@ -51,27 +114,36 @@ void ExportResolver::RegisterTable(
     auto export_entry = exports->at(i);
     if (export_entry) {
       all_exports_by_name_.push_back(export_entry);
+      if (FLAGS_profile_kernel_calls &&
+          export_entry->type == Export::Type::kFunction &&
+          !export_entry->profile) {
+        profiles_.push_back(std::make_unique<ExportProfile>());
+        export_entry->profile = profiles_.back().get();
+      }
     }
   }
   std::sort(
       all_exports_by_name_.begin(), all_exports_by_name_.end(),
-      [](Export* a, Export* b) { return std::strcmp(a->name, b->name) <= 0; });
+      [](Export* a, Export* b) { return std::strcmp(a->name, b->name) < 0; });
 }
 
-Export* ExportResolver::GetExportByOrdinal(const char* module_name,
-                                           uint16_t ordinal) {
+const ExportResolver::Table* ExportResolver::GetTable(
+    const char* module_name) const {
   for (const auto& table : tables_) {
     if (std::strncmp(module_name, table.module_name(),
                      std::strlen(table.module_name())) == 0) {
-      if (ordinal > table.exports_by_ordinal().size()) {
-        return nullptr;
-      }
-      return table.exports_by_ordinal().at(ordinal);
+      return &table;
     }
   }
   return nullptr;
 }
 
+Export* ExportResolver::GetExportByOrdinal(const char* module_name,
+                                           uint16_t ordinal) {
+  auto table = GetTable(module_name);
+  return table ? table->GetExportByOrdinal(ordinal) : nullptr;
+}
+
 void ExportResolver::SetVariableMapping(const char* module_name,
                                         uint16_t ordinal, uint32_t value) {
   auto export_entry = GetExportByOrdinal(module_name, ordinal);
@@ -98,5 +170,68 @@ void ExportResolver::SetFunctionMapping(const char* module_name,
   export_entry->function_data.trampoline = trampoline;
 }
 
+void ExportResolver::CallProfiledShim(ppc::PPCContext* ppc_context,
+                                      Export* export_entry) {
+  ExportCallScope call_scope(export_entry);
+  export_entry->function_data.shim(ppc_context, ppc_context->kernel_state);
+}
+
+void ExportResolver::DumpProfile() {
+  struct Entry {
+    Export* export_entry;
+    uint64_t call_count;
+    uint64_t total_ticks;
+    uint64_t blocked_ticks;
+    uint64_t p99_ticks;
+  };
+  std::vector<Entry> entries;
+  uint64_t all_ticks = 0;
+  for (auto export_entry : all_exports_by_name_) {
+    auto profile = export_entry->profile;
+    if (!profile) {
+      continue;
+    }
+    Entry entry = {export_entry};
+    entry.call_count = profile->call_count.load(std::memory_order_relaxed);
+    if (!entry.call_count) {
+      continue;
+    }
+    entry.total_ticks = profile->total_ticks.load(std::memory_order_relaxed);
+    entry.blocked_ticks =
+        profile->blocked_ticks.load(std::memory_order_relaxed);
+    // The buckets may be a few calls ahead of the count, which is fine.
+    uint64_t p99_count = entry.call_count - entry.call_count / 100;
+    uint64_t count = 0;
+    for (uint32_t i = 0; i < ExportProfile::kBucketCount; ++i) {
+      count += profile->buckets[i].load(std::memory_order_relaxed);
+      if (count >= p99_count) {
+        entry.p99_ticks = ExportProfile::BucketMaxTicks(i);
+        break;
+      }
+    }
+    all_ticks += entry.total_ticks;
+    entries.push_back(entry);
+  }
+  std::sort(entries.begin(), entries.end(),
+            [](const Entry& a, const Entry& b) {
+              return a.total_ticks > b.total_ticks;
+            });
+
+  double ticks_to_us = 1000000.0 / Clock::host_tick_frequency();
+  XELOGI("Kernel call profile, by total host time (%.3fms overall):",
+         all_ticks * ticks_to_us / 1000.0);
+  XELOGI("%10s %12s %10s %10s %8s  %s", "calls", "total_ms", "avg_us",
+         "p99_us", "blocked", "export");
+  for (auto& entry : entries) {
+    XELOGI("%10" PRIu64 " %12.3f %10.3f %10.3f %7.1f%%  %s", entry.call_count,
+           entry.total_ticks * ticks_to_us / 1000.0,
+           entry.total_ticks * ticks_to_us / entry.call_count,
+           entry.p99_ticks * ticks_to_us,
+           entry.total_ticks ? 100.0 * entry.blocked_ticks / entry.total_ticks
+                             : 0.0,
+           entry.export_entry->name);
+  }
+}
+
 }  // namespace cpu
 }  // namespace xe
@@ -10,6 +10,8 @@
 #ifndef XENIA_CPU_EXPORT_RESOLVER_H_
 #define XENIA_CPU_EXPORT_RESOLVER_H_
 
+#include <atomic>
+#include <memory>
 #include <string>
 #include <vector>
 
@@ -56,6 +58,22 @@ typedef void (*xe_kernel_export_shim_fn)(void*, void*);
 
 typedef void (*ExportTrampoline)(ppc::PPCContext* ppc_context);
 
+// The host time spent in calls to an export, recorded by its thunk while
+// --profile_kernel_calls is set. Times are in host ticks.
+struct ExportProfile {
+  // Durations are bucketed by their highest bit and the two bits after it,
+  // which makes percentiles good to within a quarter.
+  static const uint32_t kBucketCount = 256;
+  static uint32_t BucketIndex(uint64_t ticks);
+  static uint64_t BucketMaxTicks(uint32_t index);
+
+  std::atomic<uint64_t> call_count = {0};
+  std::atomic<uint64_t> total_ticks = {0};
+  // Spent waiting in kernel waits and delays, see ExportBlockedScope.
+  std::atomic<uint64_t> blocked_ticks = {0};
+  std::atomic<uint64_t> buckets[kBucketCount] = {};
+};
+
 class Export {
  public:
   enum class Type {
@@ -76,6 +94,8 @@ class Export {
   Type type;
   char name[96];
   ExportTag::type tags;
+  // Only set for functions while kernel calls are profiled.
+  ExportProfile* profile = nullptr;
 
   bool is_implemented() const {
     return (tags & ExportTag::kImplemented) == ExportTag::kImplemented;
@@ -112,6 +132,11 @@ class ExportResolver {
     const std::vector<Export*>& exports_by_name() const {
       return exports_by_name_;
     }
+    Export* GetExportByOrdinal(uint16_t ordinal) const {
+      return ordinal < exports_by_ordinal_->size()
+                 ? (*exports_by_ordinal_)[ordinal]
+                 : nullptr;
+    }
 
    private:
     char module_name_[32] = {0};
@@ -129,6 +154,9 @@ class ExportResolver {
     return all_exports_by_name_;
   }
 
+  // Returns the table of the module, which may be named with or without its
+  // extension, or nullptr. Importers look it up once per import library.
+  const Table* GetTable(const char* module_name) const;
   Export* GetExportByOrdinal(const char* module_name, uint16_t ordinal);
 
   void SetVariableMapping(const char* module_name, uint16_t ordinal,
@@ -138,9 +166,72 @@ class ExportResolver {
   void SetFunctionMapping(const char* module_name, uint16_t ordinal,
                           ExportTrampoline trampoline);
 
+  // Calls a DEPRECATED shim export, timing it. Generated code calls this in
+  // place of the shim when the export is profiled, as the shim itself can't
+  // tell which export it is.
+  static void CallProfiledShim(ppc::PPCContext* ppc_context,
+                               Export* export_entry);
+
+  // Logs the exports with the most host time spent in them so far.
+  void DumpProfile();
+
  private:
   std::vector<Table> tables_;
   std::vector<Export*> all_exports_by_name_;
+  std::vector<std::unique_ptr<ExportProfile>> profiles_;
+};
+
+// Times a call to an export, if it is being profiled. Calls made by guest
+// code the export runs, such as APCs, are counted in the outer call as well.
+class ExportCallScope {
+ public:
+  explicit ExportCallScope(Export* export_entry)
+      : profile_(export_entry->profile) {
+    if (profile_) {
+      Begin();
+    }
+  }
+  ~ExportCallScope() {
+    if (profile_) {
+      End();
+    }
+  }
+
+ private:
+  friend class ExportBlockedScope;
+
+  void Begin();
+  void End();
+
+  // Host ticks spent blocked by this thread while any call was profiled.
+  static thread_local uint64_t thread_blocked_ticks_;
+  static thread_local uint32_t thread_call_depth_;
+
+  ExportProfile* profile_;
+  uint64_t start_ticks_ = 0;
+  uint64_t start_blocked_ticks_ = 0;
+};
+
+// Counts the time until destroyed as blocked, for the profiled export calls
+// in progress on this thread. Wraps the host waits of kernel objects.
+class ExportBlockedScope {
+ public:
+  ExportBlockedScope() {
+    if (ExportCallScope::thread_call_depth_) {
+      Begin();
+    }
+  }
+  ~ExportBlockedScope() {
+    if (start_ticks_) {
+      End();
+    }
+  }
+
+ private:
+  void Begin();
+  void End();
+
+  uint64_t start_ticks_ = 0;
 };
 
 }  // namespace cpu
@@ -10,7 +10,9 @@
 #ifndef XENIA_CPU_FUNCTION_H_
 #define XENIA_CPU_FUNCTION_H_
 
+#include <atomic>
 #include <memory>
+#include <utility>
 #include <vector>
 
 #include "xenia/cpu/function_debug_info.h"
@@ -32,6 +34,23 @@ struct SourceMapEntry {
   uint32_t code_offset;    // Offset from emitted code start.
 };
 
+// Bytes of the PPCContext a guest function may read and write, including
+// through the functions it calls, as sorted non-overlapping [begin, end)
+// ranges.
+struct ContextUsage {
+  std::vector<std::pair<uint32_t, uint32_t>> reads;
+  std::vector<std::pair<uint32_t, uint32_t>> writes;
+
+  bool Writes(uint32_t offset, uint32_t end) const {
+    for (auto& range : writes) {
+      if (range.first < end && offset < range.second) {
+        return true;
+      }
+    }
+    return false;
+  }
+};
+
 class Function : public Symbol {
  public:
   enum class Behavior {
@@ -100,6 +119,14 @@ class GuestFunction : public Function {
   typedef void (*ExternHandler)(ppc::PPCContext* ppc_context,
                                 kernel::KernelState* kernel_state);
 
+  enum class Tier {
+    // Minimal translation with a call counter that requests an optimizing
+    // recompile once the function gets hot.
+    kBaseline,
+    // Full optimization pipeline.
+    kOptimized,
+  };
+
   GuestFunction(Module* module, uint32_t address);
   ~GuestFunction() override;
 
@@ -116,8 +143,32 @@ class GuestFunction : public Function {
     debug_info_ = std::move(debug_info);
   }
   FunctionTraceData& trace_data() { return trace_data_; }
+  FunctionBlockCoverage& block_coverage() { return block_coverage_; }
   std::vector<SourceMapEntry>& source_map() { return source_map_; }
 
+  // Tier the function is being (or has been) translated at.
+  Tier tier() const { return tier_; }
+  void set_tier(Tier value) { tier_ = value; }
+  // Calls remaining until baseline code requests a recompile. Decremented
+  // directly by generated code.
+  int32_t* tier_up_countdown() { return &tier_up_countdown_; }
+  void set_tier_up_countdown(int32_t value) { tier_up_countdown_ = value; }
+
+  // Set once a write to the guest code left the machine code stale. Such
+  // functions are translated again the next time they're resolved.
+  bool is_invalidated() const { return invalidated_; }
+  void set_invalidated(bool value) { invalidated_ = value; }
+
+  // What the function may do to the context, known once it has been
+  // translated, so that calls to it can leave the rest of the context alone.
+  // Null if it may do anything, such as leaving guest code.
+  std::shared_ptr<const ContextUsage> context_usage() const {
+    return std::atomic_load(&context_usage_);
+  }
+  void set_context_usage(std::shared_ptr<const ContextUsage> value) {
+    std::atomic_store(&context_usage_, std::move(value));
+  }
+
   ExternHandler extern_handler() const { return extern_handler_; }
   Export* export_data() const { return export_data_; }
   void SetupExtern(ExternHandler handler, Export* export_data = nullptr);
@@ -138,9 +189,14 @@ class GuestFunction : public Function {
  protected:
   std::unique_ptr<FunctionDebugInfo> debug_info_;
   FunctionTraceData trace_data_;
+  FunctionBlockCoverage block_coverage_;
   std::vector<SourceMapEntry> source_map_;
   ExternHandler extern_handler_ = nullptr;
   Export* export_data_ = nullptr;
+  Tier tier_ = Tier::kOptimized;
+  int32_t tier_up_countdown_ = 0;
+  std::atomic<bool> invalidated_ = {false};
+  std::shared_ptr<const ContextUsage> context_usage_;
 };
 
 }  // namespace cpu
@@ -28,10 +28,13 @@ enum DebugInfoFlags : uint32_t {
   kDebugInfoTraceFunctionCoverage = (1 << 7) | kDebugInfoTraceFunctions,
   kDebugInfoTraceFunctionReferences = (1 << 8) | kDebugInfoTraceFunctions,
   kDebugInfoTraceFunctionData = (1 << 9) | kDebugInfoTraceFunctions,
+  // Independent of kDebugInfoTraceFunctions, as it is meant to be cheap.
+  kDebugInfoTraceBlockCoverage = (1 << 10),
 
   kDebugInfoAllTracing =
       kDebugInfoTraceFunctions | kDebugInfoTraceFunctionCoverage |
-      kDebugInfoTraceFunctionReferences | kDebugInfoTraceFunctionData,
+      kDebugInfoTraceFunctionReferences | kDebugInfoTraceFunctionData |
+      kDebugInfoTraceBlockCoverage,
   kDebugInfoAll = 0xFFFFFFFF,
 };
 
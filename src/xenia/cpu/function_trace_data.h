@@ -13,6 +13,7 @@
 #include <cstdint>
 #include <cstring>
 
+#include "xenia/base/math.h"
 #include "xenia/base/memory.h"
 
 namespace xe {
@@ -87,6 +88,63 @@ class FunctionTraceData {
   Header* header_;
 };
 
+// One byte per instruction of the function, set at the entry of each basic
+// block. Cheap enough to leave on for long runs, unlike the instruction
+// counts of FunctionTraceData.
+class FunctionBlockCoverage {
+ public:
+  // Values of the instruction bytes.
+  enum : uint8_t {
+    // Not the start of a block, or not translated.
+    kNotBlock = 0,
+    kBlockNotHit = 1,
+    kBlockHit = 2,
+  };
+
+  struct Header {
+    // Format is used by tooling, changes must be made across all targets.
+    // + 0   4b  (data size, multiple of 4)
+    // + 4   4b  start_address
+    // + 8   4b  end_address
+    // +12   4b  (reserved)
+    // +16   1b+ block_state[instruction count]
+    uint32_t data_size;
+    uint32_t start_address;
+    uint32_t end_address;
+    uint32_t reserved;
+    // uint8_t block_state[];
+  };
+
+  FunctionBlockCoverage() : header_(nullptr) {}
+
+  void Reset(uint8_t* data, size_t data_size, uint32_t start_address,
+             uint32_t end_address) {
+    header_ = reinterpret_cast<Header*>(data);
+    header_->data_size = uint32_t(data_size);
+    header_->start_address = start_address;
+    header_->end_address = end_address;
+    header_->reserved = 0;
+    std::memset(data + sizeof(Header), kNotBlock, data_size - sizeof(Header));
+  }
+
+  bool is_valid() const { return header_ != nullptr; }
+
+  uint32_t start_address() const { return header_->start_address; }
+
+  uint8_t* block_state(uint32_t guest_address) const {
+    return reinterpret_cast<uint8_t*>(header_) + sizeof(Header) +
+           (guest_address - header_->start_address) / 4;
+  }
+
+  static size_t SizeOf(uint32_t start_address, uint32_t end_address) {
+    uint32_t instruction_count = (end_address - start_address) / 4 + 1;
+    return xe::round_up(sizeof(Header) + instruction_count, 4);
+  }
+
+ private:
+  Header* header_;
+};
+
 }  // namespace cpu
 }  // namespace xe
 
@@ -920,6 +920,29 @@ void HIRBuilder::Branch(Block* block, uint16_t branch_flags) {
   Branch(block->label_head, branch_flags);
 }
 
+Instr* HIRBuilder::InsertBranch(Label* label, Instr* prev_instr,
+                                uint16_t branch_flags) {
+  Block* block = prev_instr->block;
+  Instr* i = arena_->Alloc<Instr>();
+  i->prev = prev_instr;
+  i->next = prev_instr->next;
+  if (i->next) {
+    i->next->prev = i;
+  } else {
+    block->instr_tail = i;
+  }
+  prev_instr->next = i;
+  i->ordinal = UINT32_MAX;
+  i->block = block;
+  i->opcode = &OPCODE_BRANCH_info;
+  i->flags = branch_flags;
+  i->dest = NULL;
+  i->src1.label = label;
+  i->src2.value = i->src3.value = NULL;
+  i->src1_use = i->src2_use = i->src3_use = NULL;
+  return i;
+}
+
 void HIRBuilder::BranchTrue(Value* cond, Label* label, uint16_t branch_flags) {
   if (cond->IsConstant()) {
     if (cond->IsConstantTrue()) {
@@ -1269,6 +1292,8 @@ void HIRBuilder::Prefetch(Value* address, size_t length,
 
 void HIRBuilder::MemoryBarrier() { AppendInstr(OPCODE_MEMORY_BARRIER_info, 0); }
 
+void HIRBuilder::SpinWait() { AppendInstr(OPCODE_SPIN_WAIT_info, 0); }
+
 Value* HIRBuilder::Max(Value* value1, Value* value2) {
   ASSERT_TYPES_EQUAL(value1, value2);
 
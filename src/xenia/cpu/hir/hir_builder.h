@@ -94,6 +94,10 @@ class HIRBuilder {
 
   void Branch(Label* label, uint16_t branch_flags = 0);
   void Branch(Block* block, uint16_t branch_flags = 0);
+  // Inserts the branch right after prev_instr rather than appending it, so
+  // the block being appended to stays open.
+  Instr* InsertBranch(Label* label, Instr* prev_instr,
+                      uint16_t branch_flags = 0);
   void BranchTrue(Value* cond, Label* label, uint16_t branch_flags = 0);
   void BranchFalse(Value* cond, Label* label, uint16_t branch_flags = 0);
 
@@ -152,6 +156,8 @@ class HIRBuilder {
   void Memset(Value* address, Value* value, Value* length);
   void Prefetch(Value* address, size_t length, uint32_t prefetch_flags = 0);
   void MemoryBarrier();
+  // Hints that the code is waiting for another thread, once per iteration.
+  void SpinWait();
 
   Value* Max(Value* value1, Value* value2);
   Value* VectorMax(Value* value1, Value* value2, TypeName part_type,
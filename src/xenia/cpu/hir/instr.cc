@@ -78,6 +78,36 @@ void Instr::MoveBefore(Instr* other) {
   }
 }
 
+void Instr::MoveAfter(Instr* other) {
+  if (prev == other) {
+    return;
+  }
+
+  // Remove from current location.
+  if (prev) {
+    prev->next = next;
+  } else {
+    block->instr_head = next;
+  }
+  if (next) {
+    next->prev = prev;
+  } else {
+    block->instr_tail = prev;
+  }
+
+  // Insert into new location.
+  block = other->block;
+  prev = other;
+  next = other->next;
+  other->next = this;
+  if (next) {
+    next->prev = this;
+  }
+  if (other == block->instr_tail) {
+    block->instr_tail = this;
+  }
+}
+
 void Instr::Replace(const OpcodeInfo* new_opcode, uint16_t new_flags) {
   opcode = new_opcode;
   flags = new_flags;
@@ -157,6 +157,7 @@ enum Opcode {
   OPCODE_MEMSET,
   OPCODE_PREFETCH,
   OPCODE_MEMORY_BARRIER,
+  OPCODE_SPIN_WAIT,
   OPCODE_MAX,
   OPCODE_VECTOR_MAX,
   OPCODE_MIN,
@@ -261,6 +261,12 @@ DEFINE_OPCODE(
     OPCODE_SIG_X,
     OPCODE_FLAG_MEMORY | OPCODE_FLAG_VOLATILE)
 
+DEFINE_OPCODE(
+    OPCODE_SPIN_WAIT,
+    "spin_wait",
+    OPCODE_SIG_X,
+    OPCODE_FLAG_VOLATILE)
+
 DEFINE_OPCODE(
     OPCODE_MAX,
     "max",
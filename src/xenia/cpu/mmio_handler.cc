@@ -9,21 +9,32 @@
 
 #include "xenia/cpu/mmio_handler.h"
 
+#include <algorithm>
+
 #include "xenia/base/assert.h"
 #include "xenia/base/byte_order.h"
+#include "xenia/base/counters.h"
 #include "xenia/base/exception_handler.h"
 #include "xenia/base/logging.h"
 #include "xenia/base/math.h"
 #include "xenia/base/memory.h"
 
+DEFINE_counter(mmio_faults, "cpu.mmio_faults");
+DEFINE_counter(access_watch_faults, "cpu.access_watch_faults");
+
 namespace xe {
 namespace cpu {
 
+// Guest code lives in the views of the 0x80000000 and 0x90000000 heaps.
+const uint32_t kVirtualWatchBase = 0x80000000;
+const uint32_t kVirtualWatchEnd = 0xA0000000;
+
 MMIOHandler* MMIOHandler::global_handler_ = nullptr;
 
 std::unique_ptr<MMIOHandler> MMIOHandler::Install(uint8_t* virtual_membase,
                                                   uint8_t* physical_membase,
-                                                  uint8_t* membase_end) {
+                                                  uint8_t* membase_end,
+                                                  size_t physical_page_size) {
   // There can be only one handler at a time.
   assert_null(global_handler_);
   if (global_handler_) {
@@ -31,7 +42,8 @@ std::unique_ptr<MMIOHandler> MMIOHandler::Install(uint8_t* virtual_membase,
   }
 
   auto handler = std::unique_ptr<MMIOHandler>(
-      new MMIOHandler(virtual_membase, physical_membase, membase_end));
+      new MMIOHandler(virtual_membase, physical_membase, membase_end,
+                      physical_page_size));
 
   // Install the exception handler directed at the MMIOHandler.
   ExceptionHandler::Install(ExceptionCallbackThunk, handler.get());
@@ -51,6 +63,9 @@ bool MMIOHandler::RegisterRange(uint32_t virtual_address, uint32_t mask,
                                 uint32_t size, void* context,
                                 MMIOReadCallback read_callback,
                                 MMIOWriteCallback write_callback) {
+  // Systems register their ranges concurrently during setup. Lookups don't
+  // lock, as nothing is registered once the guest runs.
+  auto global_lock = global_critical_region_.Acquire();
   mapped_ranges_.push_back({
       virtual_address, mask, size, context, read_callback, write_callback,
   });
@@ -98,9 +113,9 @@ uintptr_t MMIOHandler::AddPhysicalAccessWatch(uint32_t guest_address,
   // This means we need to round up, which will cause spurious access
   // violations and invalidations.
   // TODO(benvanik): only invalidate if actually within the region?
-  length = xe::round_up(length + (base_address % xe::memory::page_size()),
-                        xe::memory::page_size());
-  base_address = base_address - (base_address % xe::memory::page_size());
+  length = xe::round_up(length + (base_address % physical_page_size_),
+                        physical_page_size_);
+  base_address = base_address - (base_address % physical_page_size_);
 
   auto lock = global_critical_region_.Acquire();
 
@@ -112,7 +127,7 @@ uintptr_t MMIOHandler::AddPhysicalAccessWatch(uint32_t guest_address,
   entry->callback = callback;
   entry->callback_context = callback_context;
   entry->callback_data = callback_data;
-  access_watches_.push_back(entry);
+  LinkAccessWatch(entry);
 
   auto page_access = memory::PageAccess::kNoAccess;
   switch (type) {
@@ -140,7 +155,85 @@ uintptr_t MMIOHandler::AddPhysicalAccessWatch(uint32_t guest_address,
   return reinterpret_cast<uintptr_t>(entry);
 }
 
+uintptr_t MMIOHandler::AddVirtualWriteWatch(uint32_t virtual_address,
+                                            size_t length,
+                                            AccessWatchCallback callback,
+                                            void* callback_context,
+                                            void* callback_data) {
+  if (virtual_address < kVirtualWatchBase ||
+      virtual_address >= kVirtualWatchEnd) {
+    return 0;
+  }
+  uint32_t base_address =
+      virtual_address - (virtual_address % physical_page_size_);
+  length = xe::round_up(length + (virtual_address - base_address),
+                        physical_page_size_);
+  length = std::min(length, size_t(kVirtualWatchEnd - base_address));
+
+  auto lock = global_critical_region_.Acquire();
+
+  auto entry = new AccessWatchEntry();
+  entry->address = base_address;
+  entry->length = uint32_t(length);
+  entry->type = kWatchWrite;
+  entry->is_virtual = true;
+  entry->callback = callback;
+  entry->callback_context = callback_context;
+  entry->callback_data = callback_data;
+
+  // Pages may already be protected for other watches.
+  uint32_t end_page = (entry->address + entry->length) / physical_page_size_;
+  for (uint32_t page = entry->address / physical_page_size_; page < end_page;
+       ++page) {
+    if (!access_watch_pages_.count(page)) {
+      ProtectVirtualWatchPage(page);
+    }
+  }
+  LinkAccessWatch(entry);
+
+  return reinterpret_cast<uintptr_t>(entry);
+}
+
+void MMIOHandler::ProtectVirtualWatchPage(uint32_t page) {
+  uint8_t* host_address =
+      virtual_membase_ + uint64_t(page) * physical_page_size_;
+  size_t length = physical_page_size_;
+  memory::PageAccess access;
+  if (!memory::QueryProtect(host_address, length, access)) {
+    access = memory::PageAccess::kNoAccess;
+  }
+  virtual_watch_page_access_[page] = access;
+  if (access == memory::PageAccess::kReadWrite ||
+      access == memory::PageAccess::kExecuteReadWrite) {
+    memory::Protect(host_address, physical_page_size_,
+                    memory::PageAccess::kReadOnly, nullptr);
+  }
+}
+
+void MMIOHandler::RestoreVirtualWatchPage(uint32_t page) {
+  auto it = virtual_watch_page_access_.find(page);
+  if (it == virtual_watch_page_access_.end()) {
+    return;
+  }
+  if (it->second == memory::PageAccess::kReadWrite ||
+      it->second == memory::PageAccess::kExecuteReadWrite) {
+    memory::Protect(virtual_membase_ + uint64_t(page) * physical_page_size_,
+                    physical_page_size_, it->second, nullptr);
+  }
+  virtual_watch_page_access_.erase(it);
+}
+
 void MMIOHandler::ClearAccessWatch(AccessWatchEntry* entry) {
+  if (entry->is_virtual) {
+    uint32_t end_page = (entry->address + entry->length) / physical_page_size_;
+    for (uint32_t page = entry->address / physical_page_size_;
+         page < end_page; ++page) {
+      if (!access_watch_pages_.count(page)) {
+        RestoreVirtualWatchPage(page);
+      }
+    }
+    return;
+  }
   memory::Protect(physical_membase_ + entry->address, entry->length,
                   xe::memory::PageAccess::kReadWrite, nullptr);
   memory::Protect(virtual_membase_ + 0xA0000000 + entry->address, entry->length,
@@ -155,53 +248,131 @@ void MMIOHandler::CancelAccessWatch(uintptr_t watch_handle) {
   auto entry = reinterpret_cast<AccessWatchEntry*>(watch_handle);
   auto lock = global_critical_region_.Acquire();
 
+  // Remove from table.
+  auto bucket = access_watch_pages_.find(
+      entry->address / physical_page_size_);
+  bool linked = bucket != access_watch_pages_.end() &&
+                std::find(bucket->second.begin(), bucket->second.end(),
+                          entry) != bucket->second.end();
+  assert_true(linked);
+  if (linked) {
+    UnlinkAccessWatch(entry);
+  }
+
   // Allow access to the range again.
   ClearAccessWatch(entry);
 
-  // Remove from table.
-  auto it = std::find(access_watches_.begin(), access_watches_.end(), entry);
-  assert_false(it == access_watches_.end());
+  if (linked) {
+    delete entry;
+  }
+}
 
-  if (it != access_watches_.end()) {
-    access_watches_.erase(it);
+void MMIOHandler::LinkAccessWatch(AccessWatchEntry* entry) {
+  uint32_t page_size = physical_page_size_;
+  uint32_t end_page = (entry->address + entry->length) / page_size;
+  for (uint32_t page = entry->address / page_size; page < end_page; ++page) {
+    access_watch_pages_[page].push_back(entry);
+  }
+}
+
+void MMIOHandler::UnlinkAccessWatch(AccessWatchEntry* entry) {
+  uint32_t page_size = physical_page_size_;
+  uint32_t end_page = (entry->address + entry->length) / page_size;
+  for (uint32_t page = entry->address / page_size; page < end_page; ++page) {
+    auto bucket = access_watch_pages_.find(page);
+    if (bucket == access_watch_pages_.end()) {
+      continue;
+    }
+    auto& entries = bucket->second;
+    auto it = std::find(entries.begin(), entries.end(), entry);
+    if (it != entries.end()) {
+      *it = entries.back();
+      entries.pop_back();
+    }
+    if (entries.empty()) {
+      access_watch_pages_.erase(bucket);
+    }
   }
+}
 
-  delete entry;
+std::vector<MMIOHandler::AccessWatchEntry*> MMIOHandler::TakeAccessWatches(
+    uint32_t physical_address, size_t length) {
+  // An empty range still covers the page of its address.
+  uint32_t page_size = physical_page_size_;
+  uint64_t first_page = physical_address / page_size;
+  uint64_t end_address =
+      uint64_t(physical_address) + std::max(length, size_t(1));
+  uint64_t end_page = (end_address + page_size - 1) / page_size;
+  std::vector<AccessWatchEntry*> entries;
+  if (end_page - first_page > access_watch_pages_.size()) {
+    // Large ranges have fewer watched pages than pages.
+    for (auto& bucket : access_watch_pages_) {
+      if (bucket.first >= first_page && bucket.first < end_page) {
+        entries.insert(entries.end(), bucket.second.begin(),
+                       bucket.second.end());
+      }
+    }
+  } else {
+    for (uint64_t page = first_page; page < end_page; ++page) {
+      auto bucket = access_watch_pages_.find(uint32_t(page));
+      if (bucket != access_watch_pages_.end()) {
+        entries.insert(entries.end(), bucket->second.begin(),
+                       bucket->second.end());
+      }
+    }
+  }
+  std::sort(entries.begin(), entries.end());
+  entries.erase(std::unique(entries.begin(), entries.end()), entries.end());
+  // Callbacks may add watches, so they're all unlinked before any is called.
+  for (auto entry : entries) {
+    UnlinkAccessWatch(entry);
+  }
+  return entries;
 }
 
 void MMIOHandler::InvalidateRange(uint32_t physical_address, size_t length) {
   auto lock = global_critical_region_.Acquire();
 
-  for (auto it = access_watches_.begin(); it != access_watches_.end();) {
-    auto entry = *it;
-    if ((entry->address <= physical_address &&
-         entry->address + entry->length > physical_address) ||
-        (entry->address >= physical_address &&
-         entry->address < physical_address + length)) {
-      // This watch lies within the range. End it.
-      ClearAccessWatch(entry);
-      entry->callback(entry->callback_context, entry->callback_data,
-                      entry->address);
-
-      it = access_watches_.erase(it);
-      delete entry;
-      continue;
-    }
+  for (auto entry : TakeAccessWatches(physical_address, length)) {
+    // This watch lies within the range. End it.
+    ClearAccessWatch(entry);
+    entry->callback(entry->callback_context, entry->callback_data,
+                    entry->address);
+    delete entry;
+  }
+}
 
-    ++it;
+void MMIOHandler::InvalidateVirtualRange(uint32_t virtual_address,
+                                         size_t length) {
+  uint64_t end_address = uint64_t(virtual_address) + length;
+  if (end_address <= kVirtualWatchBase || virtual_address >= kVirtualWatchEnd) {
+    return;
   }
+  uint32_t base_address = std::max(virtual_address, kVirtualWatchBase);
+  end_address = std::min(end_address, uint64_t(kVirtualWatchEnd));
+  InvalidateRange(base_address, size_t(end_address - base_address));
 }
 
 bool MMIOHandler::IsRangeWatched(uint32_t physical_address, size_t length) {
   auto lock = global_critical_region_.Acquire();
 
-  for (auto it = access_watches_.begin(); it != access_watches_.end(); ++it) {
-    auto entry = *it;
-    if ((entry->address <= physical_address &&
-         entry->address + entry->length > physical_address) ||
-        (entry->address >= physical_address &&
-         entry->address < physical_address + length)) {
-      // This watch lies within the range.
+  // An empty range still covers the page of its address.
+  uint32_t page_size = physical_page_size_;
+  uint64_t first_page = physical_address / page_size;
+  uint64_t end_address =
+      uint64_t(physical_address) + std::max(length, size_t(1));
+  uint64_t end_page = (end_address + page_size - 1) / page_size;
+  if (end_page - first_page > access_watch_pages_.size()) {
+    for (auto& bucket : access_watch_pages_) {
+      if (bucket.first >= first_page && bucket.first < end_page) {
+        return true;
+      }
+    }
+    return false;
+  }
+  for (uint64_t page = first_page; page < end_page; ++page) {
+    if (access_watch_pages_.count(uint32_t(page))) {
+      // A watch lies within the range.
       return true;
     }
   }
@@ -212,22 +383,15 @@ bool MMIOHandler::IsRangeWatched(uint32_t physical_address, size_t length) {
 bool MMIOHandler::CheckAccessWatch(uint32_t physical_address) {
   auto lock = global_critical_region_.Acquire();
 
-  bool hit = false;
-  for (auto it = access_watches_.begin(); it != access_watches_.end();) {
-    auto entry = *it;
-    if (entry->address <= physical_address &&
-        entry->address + entry->length > physical_address) {
-      // Hit! Remove the watch.
-      hit = true;
-      ClearAccessWatch(entry);
-      entry->callback(entry->callback_context, entry->callback_data,
-                      physical_address);
-
-      it = access_watches_.erase(it);
-      delete entry;
-      continue;
-    }
-    ++it;
+  // Watches cover whole pages, so all those of the page were hit.
+  auto entries = TakeAccessWatches(physical_address, 1);
+  bool hit = !entries.empty();
+  for (auto entry : entries) {
+    // Hit! Remove the watch.
+    ClearAccessWatch(entry);
+    entry->callback(entry->callback_context, entry->callback_data,
+                    physical_address);
+    delete entry;
   }
 
   if (!hit) {
@@ -429,8 +593,12 @@ bool MMIOHandler::ExceptionCallback(Exception* ex) {
   if (!range) {
     auto fault_address = reinterpret_cast<uint8_t*>(ex->fault_address());
     uint32_t guest_address = 0;
-    if (fault_address >= virtual_membase_ &&
-        fault_address < physical_membase_) {
+    if (fault_address >= virtual_membase_ + kVirtualWatchBase &&
+        fault_address < virtual_membase_ + kVirtualWatchEnd) {
+      // Faulting on guest code, watched by its virtual address.
+      guest_address = static_cast<uint32_t>(ex->fault_address());
+    } else if (fault_address >= virtual_membase_ &&
+               fault_address < physical_membase_) {
       // Faulting on a virtual address.
       guest_address = static_cast<uint32_t>(ex->fault_address()) & 0x1FFFFFFF;
     } else {
@@ -453,9 +621,11 @@ bool MMIOHandler::ExceptionCallback(Exception* ex) {
 
     // Access is not found within any range, so fail and let the caller handle
     // it (likely by aborting).
+    INCREMENT_counter(access_watch_faults, 1);
     return CheckAccessWatch(guest_address);
   }
 
+  INCREMENT_counter(mmio_faults, 1);
   auto rip = ex->pc();
   auto p = reinterpret_cast<const uint8_t*>(rip);
   DecodedMov mov = {0};
@@ -497,6 +667,10 @@ bool MMIOHandler::ExceptionCallback(Exception* ex) {
   // Advance RIP to the next instruction so that we resume properly.
   ex->set_resume_pc(rip + mov.length);
 
+  if (fault_callback_) {
+    fault_callback_(fault_callback_context_, rip, range);
+  }
+
   return true;
 }
 
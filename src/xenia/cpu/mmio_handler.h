@@ -10,10 +10,11 @@
 #ifndef XENIA_CPU_MMIO_HANDLER_H_
 #define XENIA_CPU_MMIO_HANDLER_H_
 
-#include <list>
 #include <memory>
+#include <unordered_map>
 #include <vector>
 
+#include "xenia/base/memory.h"
 #include "xenia/base/mutex.h"
 
 namespace xe {
@@ -31,6 +32,10 @@ typedef void (*MMIOWriteCallback)(void* ppc_context, void* callback_context,
 typedef void (*AccessWatchCallback)(void* context_ptr, void* data_ptr,
                                     uint32_t address);
 
+struct MMIORange;
+typedef void (*MMIOFaultCallback)(void* context, uint64_t host_pc,
+                                  const MMIORange* range);
+
 struct MMIORange {
   uint32_t address;
   uint32_t mask;
@@ -51,9 +56,12 @@ class MMIOHandler {
     kWatchReadWrite = 2,
   };
 
+  // Access watches are rounded to the host page size of physical memory,
+  // which may be larger than the system one.
   static std::unique_ptr<MMIOHandler> Install(uint8_t* virtual_membase,
                                               uint8_t* physical_membase,
-                                              uint8_t* membase_end);
+                                              uint8_t* membase_end,
+                                              size_t physical_page_size);
   static MMIOHandler* global_handler() { return global_handler_; }
 
   bool RegisterRange(uint32_t virtual_address, uint32_t mask, uint32_t size,
@@ -64,6 +72,13 @@ class MMIOHandler {
   bool CheckLoad(uint32_t virtual_address, uint32_t* out_value);
   bool CheckStore(uint32_t virtual_address, uint32_t value);
 
+  // Called from the exception handler after each MMIO access that had to be
+  // emulated by trapping, with the host instruction that faulted.
+  void set_fault_callback(MMIOFaultCallback callback, void* context) {
+    fault_callback_ = callback;
+    fault_callback_context_ = context;
+  }
+
   // Memory watches: These are one-shot alarms that fire a callback (in the
   // context of the thread that caused the callback) when a memory range is
   // either written to or read from, depending on the watch type. These fire as
@@ -76,37 +91,70 @@ class MMIOHandler {
   void InvalidateRange(uint32_t physical_address, size_t length);
   bool IsRangeWatched(uint32_t physical_address, size_t length);
 
+  // Write watches on the 0x80000000-0x9FFFFFFF views, which aren't backed by
+  // physical memory, for guest code. Pages that aren't writable are left as
+  // they are, and their watches only fire through InvalidateVirtualRange,
+  // which the heaps call before changing them. Returns 0 outside the views.
+  uintptr_t AddVirtualWriteWatch(uint32_t virtual_address, size_t length,
+                                 AccessWatchCallback callback,
+                                 void* callback_context, void* callback_data);
+  void InvalidateVirtualRange(uint32_t virtual_address, size_t length);
+
  protected:
   struct AccessWatchEntry {
     uint32_t address;
     uint32_t length;
     WatchType type;
+    bool is_virtual;
     AccessWatchCallback callback;
     void* callback_context;
     void* callback_data;
   };
 
   MMIOHandler(uint8_t* virtual_membase, uint8_t* physical_membase,
-              uint8_t* membase_end)
+              uint8_t* membase_end, size_t physical_page_size)
       : virtual_membase_(virtual_membase),
         physical_membase_(physical_membase),
-        memory_end_(membase_end) {}
+        memory_end_(membase_end),
+        physical_page_size_(uint32_t(physical_page_size)) {}
 
   static bool ExceptionCallbackThunk(Exception* ex, void* data);
   bool ExceptionCallback(Exception* ex);
 
+  // Virtual watches must be unlinked first, as the pages other watches still
+  // cover stay protected.
   void ClearAccessWatch(AccessWatchEntry* entry);
   bool CheckAccessWatch(uint32_t guest_address);
+  // Keeps the access of a page of the virtual views from before its first
+  // watch, and restores it once the last one is gone.
+  void ProtectVirtualWatchPage(uint32_t page);
+  void RestoreVirtualWatchPage(uint32_t page);
+
+  // Adds the watch to or removes it from the buckets of its pages.
+  void LinkAccessWatch(AccessWatchEntry* entry);
+  void UnlinkAccessWatch(AccessWatchEntry* entry);
+  // Unlinks the watches overlapping the range and returns them, each once.
+  std::vector<AccessWatchEntry*> TakeAccessWatches(uint32_t physical_address,
+                                                   size_t length);
 
   uint8_t* virtual_membase_;
   uint8_t* physical_membase_;
   uint8_t* memory_end_;
+  uint32_t physical_page_size_;
 
   std::vector<MMIORange> mapped_ranges_;
 
+  MMIOFaultCallback fault_callback_ = nullptr;
+  void* fault_callback_context_ = nullptr;
+
   xe::global_critical_region global_critical_region_;
-  // TODO(benvanik): data structure magic.
-  std::list<AccessWatchEntry*> access_watches_;
+  // The watches covering each host page of physical memory that has any, by
+  // page number, so lookups take constant time however many watches exist.
+  // Virtual watches are bucketed with their full addresses, which never
+  // overlap physical ones.
+  std::unordered_map<uint32_t, std::vector<AccessWatchEntry*>>
+      access_watch_pages_;
+  std::unordered_map<uint32_t, memory::PageAccess> virtual_watch_page_access_;
 
   static MMIOHandler* global_handler_;
 };
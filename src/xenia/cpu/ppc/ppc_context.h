@@ -17,6 +17,7 @@
 #include "xenia/base/vec128.h"
 
 namespace xe {
+class profiled_mutex;
 namespace cpu {
 class Processor;
 class ThreadState;
@@ -409,7 +410,7 @@ typedef struct PPCContext_s {
 
   // Global interrupt lock, held while interrupts are disabled or interrupts are
   // executing. This is shared among all threads and comes from the processor.
-  std::recursive_mutex* global_mutex;
+  xe::profiled_mutex* global_mutex;
 
   // Used to shuttle data into externs. Contents volatile.
   uint64_t scratch;
@@ -425,6 +426,11 @@ typedef struct PPCContext_s {
 
   // Value of last reserved load
   uint64_t reserved_val;
+  // Address of last reserved load, until a reserved store uses it.
+  uint32_t reserved_address;
+  // Spin waits left until the next one yields the host thread.
+  int32_t spin_wait_countdown;
+  uint8_t padding[56];
 
   static std::string GetRegisterName(PPCRegister reg);
   std::string GetStringFromValue(PPCRegister reg) const;
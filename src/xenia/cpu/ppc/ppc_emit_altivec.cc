@@ -237,6 +237,8 @@ int InstrEmit_lvrx_(PPCHIRBuilder& f, const InstrData& i, uint32_t vd,
   Value* ea = CalculateEA_0(f, ra, rb);
   Value* eb = f.And(f.Truncate(ea, INT8_TYPE), f.LoadConstantInt8(0xF));
   // Skip if %16=0 (just load zero).
+  // Branched around, so nothing may be left pending.
+  f.FlushPendingFlags();
   auto load_label = f.NewLabel();
   auto end_label = f.NewLabel();
   f.BranchTrue(eb, load_label);
@@ -307,6 +309,8 @@ int InstrEmit_stvrx_(PPCHIRBuilder& f, const InstrData& i, uint32_t vd,
   Value* ea = CalculateEA_0(f, ra, rb);
   Value* eb = f.And(f.Truncate(ea, INT8_TYPE), f.LoadConstantInt8(0xF));
   // Skip if %16=0 (no data to store).
+  // Branched around, so nothing may be left pending.
+  f.FlushPendingFlags();
   auto skip_label = f.NewLabel();
   f.BranchFalse(eb, skip_label);
   // ea &= ~0xF
@@ -72,8 +72,15 @@ int InstrEmit_branch(PPCHIRBuilder& f, const char* src, uint64_t cia,
         f.Branch(label, branch_flags);
       }
     } else {
-      // Call function.
+      // Call function, or inline it if it's small enough or a register
+      // save/restore helper.
       auto function = f.LookupFunction(nia_value);
+      if (!cond && f.TryInlineSaveRestore(function, lk)) {
+        return 0;
+      }
+      if (!cond && lk && f.TryInlineCall(function)) {
+        return 0;
+      }
       if (cond) {
         if (!expect_true) {
           cond = f.IsFalse(cond);
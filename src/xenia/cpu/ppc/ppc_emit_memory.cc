@@ -638,6 +638,17 @@ int InstrEmit_isync(PPCHIRBuilder& f, const InstrData& i) {
   return 0;
 }
 
+// Reservations are emulated with a host compare exchange against the value
+// the reserved load saw, so none of these need the global lock. A reserved
+// store only succeeds to the address of the last reserved load, and only once.
+// The value may have been changed and changed back by other threads in
+// between, which a real reservation would catch. Guest code where that
+// matters, like the kernel SList headers, carries a sequence number in the
+// reserved value instead.
+//
+// No barriers are needed: host loads aren't reordered with other loads, and
+// the locked compare exchange is a full barrier.
+
 int InstrEmit_ldarx(PPCHIRBuilder& f, const InstrData& i) {
   // if RA = 0 then
   //   b <- 0
@@ -649,15 +660,9 @@ int InstrEmit_ldarx(PPCHIRBuilder& f, const InstrData& i) {
   // RESERVE_ADDR <- real_addr(EA)
   // RT <- MEM(EA, 8)
 
-  // NOTE: we assume we are within a global lock.
-  // We could assert here that the block (or its parent) has taken a global lock
-  // already, but I haven't see anything but interrupt callbacks (which are
-  // always under a global lock) do that yet.
-  // We issue a memory barrier here to make sure that we get good values.
-  f.MemoryBarrier();
-
   Value* ea = CalculateEA_0(f, i.X.RA, i.X.RB);
   Value* rt = f.ByteSwap(f.Load(ea, INT64_TYPE));
+  f.StoreReservedAddress(f.Truncate(ea, INT32_TYPE));
   f.StoreReserved(rt);
   f.StoreGPR(i.X.RT, rt);
   return 0;
@@ -674,20 +679,33 @@ int InstrEmit_lwarx(PPCHIRBuilder& f, const InstrData& i) {
   // RESERVE_ADDR <- real_addr(EA)
   // RT <- i32.0 || MEM(EA, 4)
 
-  // NOTE: we assume we are within a global lock.
-  // We could assert here that the block (or its parent) has taken a global lock
-  // already, but I haven't see anything but interrupt callbacks (which are
-  // always under a global lock) do that yet.
-  // We issue a memory barrier here to make sure that we get good values.
-  f.MemoryBarrier();
-
   Value* ea = CalculateEA_0(f, i.X.RA, i.X.RB);
   Value* rt = f.ZeroExtend(f.ByteSwap(f.Load(ea, INT32_TYPE)), INT64_TYPE);
+  f.StoreReservedAddress(f.Truncate(ea, INT32_TYPE));
   f.StoreReserved(rt);
   f.StoreGPR(i.X.RT, rt);
   return 0;
 }
 
+// Stores the value with a compare exchange if the address is reserved, and
+// sets CR0[EQ] to whether it was stored.
+void EmitStoreConditional(PPCHIRBuilder& f, Value* ea, Value* expected,
+                          Value* value) {
+  // Branched around below, so nothing may be left pending.
+  f.FlushPendingFlags();
+  Value* reserved =
+      f.CompareEQ(f.Truncate(ea, INT32_TYPE), f.LoadReservedAddress());
+  // Unaligned, so no reserved load can have used it.
+  f.StoreReservedAddress(f.LoadConstantUint32(1));
+  f.StoreCRField(0, 0, f.LoadZeroInt8());
+  f.StoreCRField(0, 1, f.LoadZeroInt8());
+  f.StoreCRField(0, 2, f.LoadZeroInt8());
+  auto end_label = f.NewLabel();
+  f.BranchFalse(reserved, end_label);
+  f.StoreCRField(0, 2, f.AtomicCompareExchange(ea, expected, value));
+  f.MarkLabel(end_label);
+}
+
 int InstrEmit_stdcx(PPCHIRBuilder& f, const InstrData& i) {
   // if RA = 0 then
   //   b <- 0
@@ -699,25 +717,10 @@ int InstrEmit_stdcx(PPCHIRBuilder& f, const InstrData& i) {
   // n <- 1 if store performed
   // CR0[LT GT EQ SO] = 0b00 || n || XER[SO]
 
-  // NOTE: we assume we are within a global lock.
-  // As we have been exclusively executing this entire time, we assume that no
-  // one else could have possibly touched the memory and must always succeed.
-  // We use atomic compare exchange here to support reserved load/store without
-  // being under the global lock (flag disable_global_lock - see mtmsr/mtmsrd).
-  // This will always succeed if under the global lock, however.
-
   Value* ea = CalculateEA_0(f, i.X.RA, i.X.RB);
   Value* rt = f.ByteSwap(f.LoadGPR(i.X.RT));
   Value* res = f.ByteSwap(f.LoadReserved());
-  Value* v = f.AtomicCompareExchange(ea, res, rt);
-  f.StoreContext(offsetof(PPCContext, cr0.cr0_eq), v);
-  f.StoreContext(offsetof(PPCContext, cr0.cr0_lt), f.LoadZeroInt8());
-  f.StoreContext(offsetof(PPCContext, cr0.cr0_gt), f.LoadZeroInt8());
-
-  // Issue memory barrier for when we go out of lock and want others to see our
-  // updates.
-  f.MemoryBarrier();
-
+  EmitStoreConditional(f, ea, res, rt);
   return 0;
 }
 
@@ -732,25 +735,10 @@ int InstrEmit_stwcx(PPCHIRBuilder& f, const InstrData& i) {
   // n <- 1 if store performed
   // CR0[LT GT EQ SO] = 0b00 || n || XER[SO]
 
-  // NOTE: we assume we are within a global lock.
-  // As we have been exclusively executing this entire time, we assume that no
-  // one else could have possibly touched the memory and must always succeed.
-  // We use atomic compare exchange here to support reserved load/store without
-  // being under the global lock (flag disable_global_lock - see mtmsr/mtmsrd).
-  // This will always succeed if under the global lock, however.
-
   Value* ea = CalculateEA_0(f, i.X.RA, i.X.RB);
   Value* rt = f.ByteSwap(f.Truncate(f.LoadGPR(i.X.RT), INT32_TYPE));
   Value* res = f.ByteSwap(f.Truncate(f.LoadReserved(), INT32_TYPE));
-  Value* v = f.AtomicCompareExchange(ea, res, rt);
-  f.StoreContext(offsetof(PPCContext, cr0.cr0_eq), v);
-  f.StoreContext(offsetof(PPCContext, cr0.cr0_lt), f.LoadZeroInt8());
-  f.StoreContext(offsetof(PPCContext, cr0.cr0_gt), f.LoadZeroInt8());
-
-  // Issue memory barrier for when we go out of lock and want others to see our
-  // updates.
-  f.MemoryBarrier();
-
+  EmitStoreConditional(f, ea, res, rt);
   return 0;
 }
 
@@ -982,18 +970,27 @@ int InstrEmit_dcbst(PPCHIRBuilder& f, const InstrData& i) {
 }
 
 int InstrEmit_dcbt(PPCHIRBuilder& f, const InstrData& i) {
-  // No-op for now.
-  // TODO(benvanik): use prefetch
-  // XEINSTRNOTIMPLEMENTED();
-  f.Nop();
+  // EA <- (RA) + (RB)
+  // prefetch(EA & ~127, 128)
+  // Stream hints (TH != 0) have no host equivalent and are dropped.
+  if (i.X.RT) {
+    f.Nop();
+    return 0;
+  }
+  Value* ea = CalculateEA_0(f, i.X.RA, i.X.RB);
+  f.Prefetch(f.And(ea, f.LoadConstantInt64(~127)), 128, PREFETCH_LOAD);
   return 0;
 }
 
 int InstrEmit_dcbtst(PPCHIRBuilder& f, const InstrData& i) {
-  // No-op for now.
-  // TODO(benvanik): use prefetch
-  // XEINSTRNOTIMPLEMENTED();
-  f.Nop();
+  // EA <- (RA) + (RB)
+  // prefetch(EA & ~127, 128)
+  if (i.X.RT) {
+    f.Nop();
+    return 0;
+  }
+  Value* ea = CalculateEA_0(f, i.X.RA, i.X.RB);
+  f.Prefetch(f.And(ea, f.LoadConstantInt64(~127)), 128, PREFETCH_STORE);
   return 0;
 }
 
@@ -9,9 +9,11 @@
 
 #include "xenia/cpu/ppc/ppc_hir_builder.h"
 
+#include <algorithm>
 #include <cstring>
 
 #include "xenia/base/byte_order.h"
+#include "xenia/base/counters.h"
 #include "xenia/base/logging.h"
 #include "xenia/base/memory.h"
 #include "xenia/base/profiling.h"
@@ -23,6 +25,11 @@
 #include "xenia/cpu/ppc/ppc_opcode_info.h"
 #include "xenia/cpu/processor.h"
 
+DECLARE_bool(debug);
+
+DEFINE_counter(jit_inlined_calls, "cpu.jit_inlined_calls");
+DEFINE_counter(jit_inlined_save_restores, "cpu.jit_inlined_save_restores");
+
 namespace xe {
 namespace cpu {
 namespace ppc {
@@ -67,7 +74,11 @@ void PPCHIRBuilder::Reset() {
   instr_count_ = 0;
   instr_offset_list_ = NULL;
   label_list_ = NULL;
+  inlined_instr_count_ = 0;
   with_debug_info_ = false;
+  lazy_flags_ = false;
+  pending_cr_mask_ = 0;
+  pending_ca_ = nullptr;
   HIRBuilder::Reset();
 }
 
@@ -81,6 +92,11 @@ bool PPCHIRBuilder::Emit(GuestFunction* function, uint32_t flags) {
   instr_count_ = (function_->end_address() - function_->address()) / 4 + 1;
 
   with_debug_info_ = (flags & EMIT_DEBUG_COMMENTS) == EMIT_DEBUG_COMMENTS;
+  // Debuggers expect the context to be current at every instruction.
+  lazy_flags_ = FLAGS_lazy_flags && !FLAGS_debug;
+  pending_cr_mask_ = 0;
+  pending_ca_ = nullptr;
+  inlined_instr_count_ = 0;
   if (with_debug_info_) {
     CommentFormat("%s fn %.8X-%.8X %s", function_->module()->name().c_str(),
                   function_->address(), function_->end_address(),
@@ -101,6 +117,9 @@ bool PPCHIRBuilder::Emit(GuestFunction* function, uint32_t flags) {
 
   // Always mark entry with label.
   label_list_[0] = NewLabel();
+  if (lazy_flags_) {
+    PreallocateLabels();
+  }
 
   uint32_t start_address = function_->address();
   uint32_t end_address = function_->end_address();
@@ -117,6 +136,7 @@ bool PPCHIRBuilder::Emit(GuestFunction* function, uint32_t flags) {
     // as needed.
     Label* label = label_list_[offset];
     if (label) {
+      FlushPendingFlags();
       MarkLabel(label);
     }
 
@@ -150,15 +170,26 @@ bool PPCHIRBuilder::Emit(GuestFunction* function, uint32_t flags) {
     }
     ++opcode_translation_counts[static_cast<int>(opcode)];
 
+    // Only straight-line integer, float and memory instructions may run with
+    // flag updates pending. Anything else may branch, trap or reach into the
+    // context itself.
+    if (opcode_info.group != PPCOpcodeGroup::kI &&
+        opcode_info.group != PPCOpcodeGroup::kF &&
+        opcode_info.group != PPCOpcodeGroup::kM) {
+      FlushPendingFlags();
+    }
+
     // Synchronize the PPC context as required.
     // This will ensure all registers are saved to the PPC context before this
     // instruction executes.
     if (opcode_info.type == PPCOpcodeType::kSync) {
+      FlushPendingFlags();
       ContextBarrier();
     }
 
     if (address == FLAGS_break_on_instruction) {
       Comment("--break-on-instruction target");
+      FlushPendingFlags();
 
       if (FLAGS_break_condition_gpr < 0) {
         DebugBreak();
@@ -183,9 +214,11 @@ bool PPCHIRBuilder::Emit(GuestFunction* function, uint32_t flags) {
       XELOGE("Unimplemented instr %.8llX %.8X %s", address, code,
              disasm_info.name);
       Comment("UNIMPLEMENTED!");
+      FlushPendingFlags();
       DebugBreak();
     }
   }
+  FlushPendingFlags();
 
   if (false) {
     DumpAllOpcodeCounts();
@@ -205,6 +238,195 @@ Function* PPCHIRBuilder::LookupFunction(uint32_t address) {
   return frontend_->processor()->LookupFunction(address);
 }
 
+bool PPCHIRBuilder::CanInline(GuestFunction* target) {
+  // Inlined code is invisible to breakpoints, tracing and profiling of the
+  // callee, and to the persistent code cache checks of the caller.
+  if (FLAGS_inline_max_instructions <= 0 || FLAGS_debug ||
+      FLAGS_trace_functions || FLAGS_profile_guest_code ||
+      !FLAGS_code_cache_path.empty()) {
+    return false;
+  }
+  if (target == function_ || !target->has_end_address() ||
+      target->extern_handler()) {
+    return false;
+  }
+  uint32_t count = (target->end_address() - target->address()) / 4 + 1;
+  // Callers grow by at most twice their own size, so a long run of calls
+  // doesn't blow up.
+  uint32_t budget = std::max(uint32_t(instr_count_) * 2, 64u);
+  if (count > uint32_t(FLAGS_inline_max_instructions) ||
+      inlined_instr_count_ + count > budget) {
+    return false;
+  }
+  if (FLAGS_break_on_instruction >= target->address() &&
+      FLAGS_break_on_instruction <= target->end_address()) {
+    return false;
+  }
+  Memory* memory = frontend_->memory();
+  for (uint32_t address = target->address(); address <= target->end_address();
+       address += 4) {
+    uint32_t code =
+        xe::load_and_swap<uint32_t>(memory->TranslateVirtual(address));
+    if (address == target->end_address()) {
+      // Unconditional blr.
+      return code == 0x4E800020;
+    }
+    // Only what may be emitted without leaving the block or looking at the
+    // function being emitted.
+    auto opcode = LookupOpcode(code);
+    auto& opcode_info = GetOpcodeInfo(opcode);
+    if (opcode == PPCOpcode::kInvalid || !opcode_info.emit ||
+        opcode_info.type == PPCOpcodeType::kSync ||
+        (opcode_info.group != PPCOpcodeGroup::kI &&
+         opcode_info.group != PPCOpcodeGroup::kF &&
+         opcode_info.group != PPCOpcodeGroup::kM)) {
+      return false;
+    }
+  }
+  return false;
+}
+
+bool PPCHIRBuilder::TryInlineCall(Function* target) {
+  if (!target || !target->is_guest()) {
+    return false;
+  }
+  auto guest_target = static_cast<GuestFunction*>(target);
+  if (!CanInline(guest_target)) {
+    return false;
+  }
+  // LR was set by the call and is left as the blr would, so only the body
+  // before the blr is emitted.
+  EmitInlinedBody(guest_target, guest_target->end_address());
+  inlined_instr_count_ +=
+      (guest_target->end_address() - guest_target->address()) / 4 + 1;
+  frontend_->processor()->AddInlinedCall(function_, guest_target);
+  INCREMENT_counter(jit_inlined_calls, 1);
+  return true;
+}
+
+bool PPCHIRBuilder::TryInlineSaveRestore(Function* target, bool lk) {
+  if (!FLAGS_inline_save_restore || FLAGS_debug || FLAGS_trace_functions ||
+      FLAGS_profile_guest_code || !target || !target->is_guest()) {
+    return false;
+  }
+  // The save helpers and __restfpr/__restvmx are called, __restgprlr is
+  // branched to and returns from the caller.
+  bool returns = target->behavior() == Function::Behavior::kEpilogReturn;
+  if (returns ? lk
+              : !lk || (target->behavior() != Function::Behavior::kProlog &&
+                        target->behavior() != Function::Behavior::kEpilog)) {
+    return false;
+  }
+  auto guest_target = static_cast<GuestFunction*>(target);
+  if (guest_target->extern_handler()) {
+    return false;
+  }
+  // The vmx helpers have no end address declared, so look for the blr. They
+  // are at most 64 register moves of two instructions each.
+  Memory* memory = frontend_->memory();
+  uint32_t blr_address = 0;
+  for (uint32_t address = target->address();
+       address < target->address() + (2 * 64 + 4) * 4; address += 4) {
+    uint32_t code =
+        xe::load_and_swap<uint32_t>(memory->TranslateVirtual(address));
+    if (code == 0x4E800020) {
+      blr_address = address;
+      break;
+    }
+    // Stores and loads of registers, their address math and, for
+    // __restgprlr, the mtlr of the saved LR.
+    auto opcode = LookupOpcode(code);
+    auto& opcode_info = GetOpcodeInfo(opcode);
+    if (opcode == PPCOpcode::kInvalid || !opcode_info.emit ||
+        opcode_info.type == PPCOpcodeType::kSync ||
+        (opcode_info.group != PPCOpcodeGroup::kI &&
+         opcode_info.group != PPCOpcodeGroup::kF &&
+         opcode_info.group != PPCOpcodeGroup::kM &&
+         !(returns && opcode == PPCOpcode::mtspr))) {
+      return false;
+    }
+  }
+  if (!blr_address || (FLAGS_break_on_instruction >= target->address() &&
+                       FLAGS_break_on_instruction <= blr_address)) {
+    return false;
+  }
+  EmitInlinedBody(guest_target, blr_address);
+  if (returns) {
+    // The blr of the helper, with LR as restored.
+    CallIndirect(LoadLR(), CALL_TAIL | CALL_POSSIBLE_RETURN);
+  }
+  INCREMENT_counter(jit_inlined_save_restores, 1);
+  return true;
+}
+
+void PPCHIRBuilder::EmitInlinedBody(GuestFunction* target,
+                                    uint32_t end_address) {
+  if (with_debug_info_) {
+    CommentFormat("inlined %.8X-%.8X %s", target->address(), end_address,
+                  target->name().c_str());
+  }
+  Memory* memory = frontend_->memory();
+  for (uint32_t address = target->address(); address < end_address;
+       address += 4) {
+    trace_info_.dest_count = 0;
+    InstrData i;
+    i.address = address;
+    i.code = xe::load_and_swap<uint32_t>(memory->TranslateVirtual(address));
+    i.opcode = LookupOpcode(i.code);
+    i.opcode_info = &GetOpcodeInfo(i.opcode);
+    if (with_debug_info_) {
+      comment_buffer_.Reset();
+      comment_buffer_.AppendFormat("%.8X %.8X ", address, i.code);
+      DisasmPPC(address, i.code, &comment_buffer_);
+      Comment(comment_buffer_);
+    }
+    // Attributes faults to the callee instruction, so MMIO sites found in
+    // the inlined code are picked up when the caller is retranslated.
+    SourceOffset(address);
+    ++opcode_translation_counts[static_cast<int>(i.opcode)];
+    if (i.opcode_info->group != PPCOpcodeGroup::kI &&
+        i.opcode_info->group != PPCOpcodeGroup::kF &&
+        i.opcode_info->group != PPCOpcodeGroup::kM) {
+      FlushPendingFlags();
+    }
+    i.opcode_info->emit(*this, i);
+  }
+}
+
+void PPCHIRBuilder::PreallocateLabels() {
+  // Labels that LookupLabel has to insert behind us split blocks, which
+  // would leave pending flag updates using values from the previous block.
+  // Create them up front for every local branch target instead.
+  Memory* memory = frontend_->memory();
+  uint32_t start_address = function_->address();
+  uint32_t end_address = function_->end_address();
+  for (uint32_t address = start_address; address <= end_address;
+       address += 4) {
+    InstrData i;
+    i.address = address;
+    i.code = xe::load_and_swap<uint32_t>(memory->TranslateVirtual(address));
+    i.opcode = LookupOpcode(i.code);
+    uint32_t nia;
+    bool lk;
+    if (i.opcode == PPCOpcode::bx) {
+      nia = i.I.AA ? uint32_t(XEEXTS26(i.I.LI << 2))
+                   : uint32_t(i.address + XEEXTS26(i.I.LI << 2));
+      lk = i.I.LK != 0;
+    } else if (i.opcode == PPCOpcode::bcx) {
+      nia = i.B.AA ? uint32_t(XEEXTS16(i.B.BD << 2))
+                   : uint32_t(i.address + XEEXTS16(i.B.BD << 2));
+      lk = i.B.LK != 0;
+    } else {
+      continue;
+    }
+    if (nia == start_address && lk) {
+      // Recursion; emitted as a call.
+      continue;
+    }
+    LookupLabel(nia);
+  }
+}
+
 Label* PPCHIRBuilder::LookupLabel(uint32_t address) {
   if (address < start_address_) {
     return nullptr;
@@ -283,6 +505,7 @@ Value* PPCHIRBuilder::LoadCR() {
 }
 
 Value* PPCHIRBuilder::LoadCR(uint32_t n) {
+  FlushCR(n);
   // Construct the entire word of just the bits we care about.
   // This makes it easier for the optimizer to exclude things, though
   // we could be even more clever and watch sequences.
@@ -306,6 +529,9 @@ Value* PPCHIRBuilder::LoadCR(uint32_t n) {
 }
 
 Value* PPCHIRBuilder::LoadCRField(uint32_t n, uint32_t bit) {
+  if (pending_cr_mask_ & (1u << n) && bit < 3) {
+    return MaterializeCRBit(n, bit);
+  }
   return LoadContext(offsetof(PPCContext, cr0) + (4 * n) + bit, INT8_TYPE);
 }
 
@@ -318,6 +544,7 @@ void PPCHIRBuilder::StoreCR(Value* value) {
 }
 
 void PPCHIRBuilder::StoreCR(uint32_t n, Value* value) {
+  DiscardCR(n);
   // Pull out the bits we are interested in.
   // Optimization passes will kill any unneeded stores (mostly).
   StoreContext(offsetof(PPCContext, cr0) + (4 * n) + 0,
@@ -335,6 +562,7 @@ void PPCHIRBuilder::StoreCR(uint32_t n, Value* value) {
 }
 
 void PPCHIRBuilder::StoreCRField(uint32_t n, uint32_t bit, Value* value) {
+  FlushCR(n);
   StoreContext(offsetof(PPCContext, cr0) + (4 * n) + bit, value);
 
   // TODO(benvanik): trace CR.
@@ -346,19 +574,16 @@ void PPCHIRBuilder::UpdateCR(uint32_t n, Value* lhs, bool is_signed) {
 
 void PPCHIRBuilder::UpdateCR(uint32_t n, Value* lhs, Value* rhs,
                              bool is_signed) {
-  if (is_signed) {
-    Value* lt = CompareSLT(lhs, rhs);
-    StoreContext(offsetof(PPCContext, cr0) + (4 * n) + 0, lt);
-    Value* gt = CompareSGT(lhs, rhs);
-    StoreContext(offsetof(PPCContext, cr0) + (4 * n) + 1, gt);
-  } else {
-    Value* lt = CompareULT(lhs, rhs);
-    StoreContext(offsetof(PPCContext, cr0) + (4 * n) + 0, lt);
-    Value* gt = CompareUGT(lhs, rhs);
-    StoreContext(offsetof(PPCContext, cr0) + (4 * n) + 1, gt);
+  // Any update still pending is dead as all of lt/gt/eq are replaced.
+  auto& field = pending_cr_[n];
+  field.lhs = lhs;
+  field.rhs = rhs;
+  field.is_signed = is_signed;
+  field.bits[0] = field.bits[1] = field.bits[2] = nullptr;
+  pending_cr_mask_ |= 1u << n;
+  if (!lazy_flags_) {
+    FlushCR(n);
   }
-  Value* eq = CompareEQ(lhs, rhs);
-  StoreContext(offsetof(PPCContext, cr0) + (4 * n) + 2, eq);
 
   // Value* so = AllocValue(UINT8_TYPE);
   // StoreContext(offsetof(PPCContext, cr) + (4 * n) + 3, so);
@@ -366,10 +591,52 @@ void PPCHIRBuilder::UpdateCR(uint32_t n, Value* lhs, Value* rhs,
   // TOOD(benvanik): trace CR.
 }
 
+Value* PPCHIRBuilder::MaterializeCRBit(uint32_t n, uint32_t bit) {
+  auto& field = pending_cr_[n];
+  if (!field.bits[bit]) {
+    switch (bit) {
+      case 0:
+        field.bits[0] = field.is_signed ? CompareSLT(field.lhs, field.rhs)
+                                        : CompareULT(field.lhs, field.rhs);
+        break;
+      case 1:
+        field.bits[1] = field.is_signed ? CompareSGT(field.lhs, field.rhs)
+                                        : CompareUGT(field.lhs, field.rhs);
+        break;
+      case 2:
+        field.bits[2] = CompareEQ(field.lhs, field.rhs);
+        break;
+    }
+  }
+  return field.bits[bit];
+}
+
+void PPCHIRBuilder::FlushCR(uint32_t n) {
+  if (!(pending_cr_mask_ & (1u << n))) {
+    return;
+  }
+  for (uint32_t bit = 0; bit < 3; ++bit) {
+    StoreContext(offsetof(PPCContext, cr0) + (4 * n) + bit,
+                 MaterializeCRBit(n, bit));
+  }
+  DiscardCR(n);
+}
+
+void PPCHIRBuilder::FlushPendingFlags() {
+  for (uint32_t n = 0; pending_cr_mask_ && n < 8; ++n) {
+    FlushCR(n);
+  }
+  if (pending_ca_) {
+    StoreContext(offsetof(PPCContext, xer_ca), pending_ca_);
+    pending_ca_ = nullptr;
+  }
+}
+
 void PPCHIRBuilder::UpdateCR6(Value* src_value) {
   // Testing for all 1's and all 0's.
   // if (Rc) CR6 = all_equal | 0 | none_equal | 0
   // TODO(benvanik): efficient instruction?
+  DiscardCR(6);
   StoreContext(offsetof(PPCContext, cr6.cr6_1), LoadZeroInt8());
   StoreContext(offsetof(PPCContext, cr6.cr6_3), LoadZeroInt8());
   StoreContext(offsetof(PPCContext, cr6.cr6_all_equal),
@@ -401,6 +668,7 @@ void PPCHIRBuilder::UpdateFPSCR(Value* result, bool update_cr1) {
   Value* ox = LoadConstantInt8(0);
 
   if (update_cr1) {
+    DiscardCR(1);
     // Store into the CR1 field.
     // We do this instead of just calling CopyFPSCRToCR1 so that we don't
     // have to read back the bits and do shifting work.
@@ -423,6 +691,7 @@ void PPCHIRBuilder::UpdateFPSCR(Value* result, bool update_cr1) {
 }
 
 void PPCHIRBuilder::CopyFPSCRToCR1() {
+  DiscardCR(1);
   // Pull out of FPSCR.
   Value* fpscr = LoadFPSCR();
   StoreContext(offsetof(PPCContext, cr1.cr1_fx),
@@ -447,12 +716,19 @@ void PPCHIRBuilder::StoreXER(Value* value) {
 }
 
 Value* PPCHIRBuilder::LoadCA() {
+  if (pending_ca_) {
+    return pending_ca_;
+  }
   return LoadContext(offsetof(PPCContext, xer_ca), INT8_TYPE);
 }
 
 void PPCHIRBuilder::StoreCA(Value* value) {
   assert_true(value->type == INT8_TYPE);
-  StoreContext(offsetof(PPCContext, xer_ca), value);
+  if (lazy_flags_) {
+    pending_ca_ = value;
+  } else {
+    StoreContext(offsetof(PPCContext, xer_ca), value);
+  }
 
   auto& trace_reg = trace_info_.dests[trace_info_.dest_count++];
   trace_reg.reg = 66;
@@ -520,6 +796,15 @@ Value* PPCHIRBuilder::LoadReserved() {
   return LoadContext(offsetof(PPCContext, reserved_val), INT64_TYPE);
 }
 
+void PPCHIRBuilder::StoreReservedAddress(Value* address) {
+  assert_true(address->type == INT32_TYPE);
+  StoreContext(offsetof(PPCContext, reserved_address), address);
+}
+
+Value* PPCHIRBuilder::LoadReservedAddress() {
+  return LoadContext(offsetof(PPCContext, reserved_address), INT32_TYPE);
+}
+
 }  // namespace ppc
 }  // namespace cpu
 }  // namespace xe
@@ -43,6 +43,13 @@ class PPCHIRBuilder : public hir::HIRBuilder {
   GuestFunction* function() const { return function_; }
   Function* LookupFunction(uint32_t address);
   Label* LookupLabel(uint32_t address);
+  // Emits the body of the function in place of a call to it, if it is a
+  // small leaf function made of straight-line code ending in a blr.
+  bool TryInlineCall(Function* target);
+  // Emits the register moves of a __savegprlr/__restgprlr, __savefpr/
+  // __restfpr or __savevmx/__restvmx helper in place of the call or, for
+  // __restgprlr, the branch to it.
+  bool TryInlineSaveRestore(Function* target, bool lk);
 
   Value* LoadLR();
   void StoreLR(Value* value);
@@ -68,6 +75,9 @@ class PPCHIRBuilder : public hir::HIRBuilder {
   // void StoreOV(Value* value);
   Value* LoadCA();
   void StoreCA(Value* value);
+  // Writes back CR and XER[CA] updates that have been deferred, which must
+  // happen before anything that may leave the block or observe the context.
+  void FlushPendingFlags();
   Value* LoadSAT();
   void StoreSAT(Value* value);
 
@@ -80,9 +90,19 @@ class PPCHIRBuilder : public hir::HIRBuilder {
 
   void StoreReserved(Value* val);
   Value* LoadReserved();
+  void StoreReservedAddress(Value* address);
+  Value* LoadReservedAddress();
 
  private:
   void AnnotateLabel(uint32_t address, Label* label);
+  void PreallocateLabels();
+  bool CanInline(GuestFunction* target);
+  // Emits the instructions of the function before end_address.
+  void EmitInlinedBody(GuestFunction* target, uint32_t end_address);
+
+  Value* MaterializeCRBit(uint32_t n, uint32_t bit);
+  void FlushCR(uint32_t n);
+  void DiscardCR(uint32_t n) { pending_cr_mask_ &= ~(1u << n); }
 
   PPCFrontend* frontend_;
 
@@ -96,6 +116,21 @@ class PPCHIRBuilder : public hir::HIRBuilder {
   uint64_t instr_count_;
   Instr** instr_offset_list_;
   Label** label_list_;
+  // Instructions inlined so far, against the budget of the function.
+  uint32_t inlined_instr_count_;
+
+  // Record-form updates are kept as their compare operands until a bit is
+  // read or the block ends, as most are overwritten before that.
+  bool lazy_flags_;
+  struct {
+    Value* lhs;
+    Value* rhs;
+    bool is_signed;
+    // lt, gt, eq; compared on first use.
+    Value* bits[3];
+  } pending_cr_[8];
+  uint32_t pending_cr_mask_;
+  Value* pending_ca_;
 
   // Reset each instruction.
   struct {
@@ -10,540 +10,662 @@ namespace xe {
 namespace cpu {
 namespace ppc {
 
-constexpr uint32_t ExtractBits(uint32_t v, uint32_t a, uint32_t b) {
-  return (v >> (32 - 1 - b)) & ((1 << (b - a + 1)) - 1);
-}
+// Opcodes are decoded with two table lookups, first by the primary opcode
+// and then, if that doesn't identify the instruction, by its extended
+// opcode bits.
+struct PPCDecodePrimaryEntry {
+  // kPPCDecodeExtended if the extended opcode bits must be looked up.
+  uint16_t opcode;
+  uint16_t extended_offset;
+  uint16_t extended_shift;
+  uint16_t extended_mask;
+};
+
+// Extended table entries with it set are an index into
+// ppc_decode_collision_table.
+constexpr uint16_t kPPCDecodeCollision = 0x8000;
+constexpr uint16_t kPPCDecodeExtended = 0xFFFF;
+
+struct PPCDecodeCollisionEntry {
+  uint32_t mask;
+  uint32_t value;
+  uint16_t opcode;
+};
+
+constexpr PPCDecodePrimaryEntry ppc_decode_primary_table[64] = {
+  {  455,     0,  0, 0x000},  //  0
+  {  455,     0,  0, 0x000},  //  1
+  {  248,     0,  0, 0x000},  //  2: tdi
+  {  250,     0,  0, 0x000},  //  3: twi
+  {65535,     0,  0, 0x7FF},  //  4: bits 21-31
+  {65535,  2048,  4, 0x03F},  //  5: bits 22-27
+  {65535,  2112,  4, 0x07F},  //  6: bits 21-27
+  {  164,     0,  0, 0x000},  //  7: mulli
+  {  242,     0,  0, 0x000},  //  8: subficx
+  {  455,     0,  0, 0x000},  //  9
+  {   20,     0,  0, 0x000},  // 10: cmpli
+  {   18,     0,  0, 0x000},  // 11: cmpi
+  {    3,     0,  0, 0x000},  // 12: addic
+  {    4,     0,  0, 0x000},  // 13: addicx
+  {    2,     0,  0, 0x000},  // 14: addi
+  {    5,     0,  0, 0x000},  // 15: addis
+  {   15,     0,  0, 0x000},  // 16: bcx
+  {  182,     0,  0, 0x000},  // 17: sc
+  {   16,     0,  0, 0x000},  // 18: bx
+  {65535,  2240,  1, 0x3FF},  // 19: bits 21-30
+  {  179,     0,  0, 0x000},  // 20: rlwimix
+  {  180,     0,  0, 0x000},  // 21: rlwinmx
+  {  455,     0,  0, 0x000},  // 22
+  {  181,     0,  0, 0x000},  // 23: rlwnmx
+  {  170,     0,  0, 0x000},  // 24: ori
+  {  171,     0,  0, 0x000},  // 25: oris
+  {  452,     0,  0, 0x000},  // 26: xori
+  {  453,     0,  0, 0x000},  // 27: xoris
+  {   11,     0,  0, 0x000},  // 28: andix
+  {   10,     0,  0, 0x000},  // 29: andisx
+  {65535,  3264,  1, 0x00F},  // 30: bits 27-30
+  {65535,  3280,  1, 0x3FF},  // 31: bits 21-30
+  {  137,     0,  0, 0x000},  // 32: lwz
+  {  138,     0,  0, 0x000},  // 33: lwzu
+  {   82,     0,  0, 0x000},  // 34: lbz
+  {   83,     0,  0, 0x000},  // 35: lbzu
+  {  234,     0,  0, 0x000},  // 36: stw
+  {  237,     0,  0, 0x000},  // 37: stwu
+  {  191,     0,  0, 0x000},  // 38: stb
+  {  192,     0,  0, 0x000},  // 39: stbu
+  {  105,     0,  0, 0x000},  // 40: lhz
+  {  106,     0,  0, 0x000},  // 41: lhzu
+  {  100,     0,  0, 0x000},  // 42: lha
+  {  101,     0,  0, 0x000},  // 43: lhau
+  {  210,     0,  0, 0x000},  // 44: sth
+  {  212,     0,  0, 0x000},  // 45: sthu
+  {  109,     0,  0, 0x000},  // 46: lmw
+  {  215,     0,  0, 0x000},  // 47: stmw
+  {   96,     0,  0, 0x000},  // 48: lfs
+  {   97,     0,  0, 0x000},  // 49: lfsu
+  {   92,     0,  0, 0x000},  // 50: lfd
+  {   93,     0,  0, 0x000},  // 51: lfdu
+  {  206,     0,  0, 0x000},  // 52: stfs
+  {  207,     0,  0, 0x000},  // 53: stfsu
+  {  201,     0,  0, 0x000},  // 54: stfd
+  {  202,     0,  0, 0x000},  // 55: stfdu
+  {  455,     0,  0, 0x000},  // 56
+  {  455,     0,  0, 0x000},  // 57
+  {65535,  4304,  0, 0x003},  // 58: bits 30-31
+  {65535,  4308,  1, 0x01F},  // 59: bits 26-30
+  {  455,     0,  0, 0x000},  // 60
+  {  455,     0,  0, 0x000},  // 61
+  {65535,  4340,  0, 0x003},  // 62: bits 30-31
+  {65535,  4344,  1, 0x3FF},  // 63: bits 21-30
+};
 
-#define PPC_DECODER_MISS assert_always(); return PPCOpcode::kInvalid
-#define PPC_DECODER_HIT(name) return PPCOpcode::name;
+constexpr uint16_t ppc_decode_extended_table[5368] = {
+    257,   455,   311,   125,   387,   455,   281,   125,   348,   455,
+    252,   125,   325,   455,   369,   125,   399,   399,   399,   399,
+    399,   399,   399,   399,   399,   399,   399,   399,   399,   399,
+    399,   399,   314,   315,   324,   455,   338,   335,   339,   340,
+    336,   337,   394,   356,   398,   455,   304,   350,   399,   399,
+    399,   399,   399,   399,   399,   399,   399,   399,   399,   399,
+    399,   399,   399,   399,   259,   455,   312,   127,   388,   455,
+    282,   127,   349,   455,   425,   127,   326,   455,   373,   127,
+    399,   399,   399,   399,   399,   399,   399,   399,   399,   399,
+    399,   399,   399,   399,   399,   399,   314,   315,   324,   455,
+    338,   335,   339,   340,   336,   337,   394,   356,   398,   455,
+    304,   350,   399,   399,   399,   399,   399,   399,   399,   399,
+    399,   399,   399,   399,   399,   399,   399,   399,   261,   455,
+    313,   115,   390,   455,   283,   115,   455,   455,   455,   115,
+    327,   455,   371,   115,   399,   399,   399,   399,   399,   399,
+    399,   399,   399,   399,   399,   399,   399,   399,   399,   399,
+    314,   315,   324,   455,   338,   335,   339,   340,   336,   337,
+    394,   356,   398,   455,   304,   350,   399,   399,   399,   399,
+    399,   399,   399,   399,   399,   399,   399,   399,   399,   399,
+    399,   399,   455,   455,   455,   129,   455,   455,   279,   129,
+    455,   455,   455,   129,   455,   455,   375,   129,   399,   399,
+    399,   399,   399,   399,   399,   399,   399,   399,   399,   399,
+    399,   399,   399,   399,   314,   315,   324,   455,   338,   335,
+    339,   340,   336,   337,   394,   356,   398,   455,   304,   350,
+    399,   399,   399,   399,   399,   399,   399,   399,   399,   399,
+    399,   399,   399,   399,   399,   399,   455,   455,   308,   455,
+    397,   455,   455,   455,   346,   455,   377,   455,   329,   455,
+    363,   455,   399,   399,   399,   399,   399,   399,   399,   399,
+    399,   399,   399,   399,   399,   399,   399,   399,   314,   315,
+    324,   455,   338,   335,   339,   340,   336,   337,   394,   356,
+    398,   455,   304,   350,   399,   399,   399,   399,   399,   399,
+    399,   399,   399,   399,   399,   399,   399,   399,   399,   399,
+    455,   455,   309,   455,   400,   455,   455,   455,   347,   455,
+    392,   455,   330,   455,   367,   455,   399,   399,   399,   399,
+    399,   399,   399,   399,   399,   399,   399,   399,   399,   399,
+    399,   399,   314,   315,   324,   455,   338,   335,   339,   340,
+    336,   337,   394,   356,   398,   455,   304,   350,   399,   399,
+    399,   399,   399,   399,   399,   399,   399,   399,   399,   399,
+    399,   399,   399,   399,   251,   455,   310,   221,   403,   455,
+    455,   221,   455,   455,   299,   221,   331,   455,   361,   221,
+    399,   399,   399,   399,   399,   399,   399,   399,   399,   399,
+    399,   399,   399,   399,   399,   399,   314,   315,   324,   455,
+    338,   335,   339,   340,   336,   337,   394,   356,   398,   455,
+    304,   350,   399,   399,   399,   399,   399,   399,   399,   399,
+    399,   399,   399,   399,   399,   399,   399,   399,   455,   455,
+    455,   231,   396,   455,   285,   231,   455,   455,   301,   231,
+    455,   455,   365,   231,   399,   399,   399,   399,   399,   399,
+    399,   399,   399,   399,   399,   399,   399,   399,   399,   399,
+    314,   315,   324,   455,   338,   335,   339,   340,   336,   337,
+    394,   356,   398,   455,   304,   350,   399,   399,   399,   399,
+    399,   399,   399,   399,   399,   399,   399,   399,   399,   399,
+    399,   399,   258,   455,   321,   455,   418,   455,   292,   455,
+    343,   455,   381,   455,   405,   455,   443,   455,   399,   399,
+    399,   399,   399,   399,   399,   399,   399,   399,   399,   399,
+    399,   399,   399,   399,   314,   315,   324,   455,   338,   335,
+    339,   340,   336,   337,   394,   356,   398,   455,   304,   350,
+    399,   399,   399,   399,   399,   399,   399,   399,   399,   399,
+    399,   399,   399,   399,   399,   399,   260,   455,   322,   455,
+    419,   455,   293,   455,   344,   455,   385,   455,   406,   455,
+    445,   455,   399,   399,   399,   399,   399,   399,   399,   399,
+    399,   399,   399,   399,   399,   399,   399,   399,   314,   315,
+    324,   455,   338,   335,   339,   340,   336,   337,   394,   356,
+    398,   455,   304,   350,   399,   399,   399,   399,   399,   399,
+    399,   399,   399,   399,   399,   399,   399,   399,   399,   399,
+    262,   455,   323,   455,   422,   455,   294,   455,   455,   455,
+    383,   455,   411,   455,   447,   455,   399,   399,   399,   399,
+    399,   399,   399,   399,   399,   399,   399,   399,   399,   399,
+    399,   399,   314,   315,   324,   455,   338,   335,   339,   340,
+    336,   337,   394,   356,   398,   455,   304,   350,   399,   399,
+    399,   399,   399,   399,   399,   399,   399,   399,   399,   399,
+    399,   399,   399,   399,   455,   455,   455,   131,   413,   455,
+    287,   131,   455,   455,   379,   131,   455,   455,   449,   131,
+    399,   399,   399,   399,   399,   399,   399,   399,   399,   399,
+    399,   399,   399,   399,   399,   399,   314,   315,   324,   455,
+    338,   335,   339,   340,   336,   337,   394,   356,   398,   455,
+    304,   350,   399,   399,   399,   399,   399,   399,   399,   399,
+    399,   399,   399,   399,   399,   399,   399,   399,   254,   455,
+    318,   455,   414,   455,   289,   455,   341,   455,   276,   455,
+    407,   455,   360,   455,   399,   399,   399,   399,   399,   399,
+    399,   399,   399,   399,   399,   399,   399,   399,   399,   399,
+    314,   315,   324,   455,   338,   335,   339,   340,   336,   337,
+    394,   356,   398,   455,   304,   350,   399,   399,   399,   399,
+    399,   399,   399,   399,   399,   399,   399,   399,   399,   399,
+    399,   399,   255,   455,   319,   455,   415,   455,   290,   455,
+    342,   455,   275,   455,   408,   455,   442,   455,   399,   399,
+    399,   399,   399,   399,   399,   399,   399,   399,   399,   399,
+    399,   399,   399,   399,   314,   315,   324,   455,   338,   335,
+    339,   340,   336,   337,   394,   356,   398,   455,   304,   350,
+    399,   399,   399,   399,   399,   399,   399,   399,   399,   399,
+    399,   399,   399,   399,   399,   399,   256,   455,   320,   455,
+    416,   455,   291,   455,   455,   455,   297,   455,   409,   455,
+    455,   455,   399,   399,   399,   399,   399,   399,   399,   399,
+    399,   399,   399,   399,   399,   399,   399,   399,   314,   315,
+    324,   455,   338,   335,   339,   340,   336,   337,   394,   356,
+    398,   455,   304,   350,   399,   399,   399,   399,   399,   399,
+    399,   399,   399,   399,   399,   399,   399,   399,   399,   399,
+    455,   455,   455,   233,   455,   455,   277,   233,   455,   455,
+    296,   233,   455,   455,   446,   233,   399,   399,   399,   399,
+    399,   399,   399,   399,   399,   399,   399,   399,   399,   399,
+    399,   399,   314,   315,   324,   455,   338,   335,   339,   340,
+    336,   337,   394,   356,   398,   455,   304,   350,   399,   399,
+    399,   399,   399,   399,   399,   399,   399,   399,   399,   399,
+    399,   399,   399,   399,   430,   455,   270,   117,   263,   455,
+    281,   117,   455,   455,   306,   117,   401,   455,   455,   117,
+    399,   399,   399,   399,   399,   399,   399,   399,   399,   399,
+    399,   399,   399,   399,   399,   399,   314,   315,   324,   455,
+    338,   335,   339,   340,   336,   337,   394,   356,   398,   455,
+    304,   350,   399,   399,   399,   399,   399,   399,   399,   399,
+    399,   399,   399,   399,   399,   399,   399,   399,   432,   455,
+    271,   121,   265,   455,   282,   121,   455,   455,   316,   121,
+    420,   455,   455,   121,   399,   399,   399,   399,   399,   399,
+    399,   399,   399,   399,   399,   399,   399,   399,   399,   399,
+    314,   315,   324,   455,   338,   335,   339,   340,   336,   337,
+    394,   356,   398,   455,   304,   350,   399,   399,   399,   399,
+    399,   399,   399,   399,   399,   399,   399,   399,   399,   399,
+    399,   399,   434,   455,   272,   455,   354,   455,   283,   455,
+    455,   455,   455,   455,   455,   455,   455,   455,   399,   399,
+    399,   399,   399,   399,   399,   399,   399,   399,   399,   399,
+    399,   399,   399,   399,   314,   315,   324,   455,   338,   335,
+    339,   340,   336,   337,   394,   356,   398,   455,   304,   350,
+    399,   399,   399,   399,   399,   399,   399,   399,   399,   399,
+    399,   399,   399,   399,   399,   399,   455,   455,   455,   455,
+    450,   455,   279,   455,   455,   455,   455,   455,   455,   455,
+    455,   455,   399,   399,   399,   399,   399,   399,   399,   399,
+    399,   399,   399,   399,   399,   399,   399,   399,   314,   315,
+    324,   455,   338,   335,   339,   340,   336,   337,   394,   356,
+    398,   455,   304,   350,   399,   399,   399,   399,   399,   399,
+    399,   399,   399,   399,   399,   399,   399,   399,   399,   399,
+    455,   455,   267,   223,   352,   455,   455,   223,   455,   455,
+    455,   223,   455,   455,   455,   223,   399,   399,   399,   399,
+    399,   399,   399,   399,   399,   399,   399,   399,   399,   399,
+    399,   399,   314,   315,   324,   455,   338,   335,   339,   340,
+    336,   337,   394,   356,   398,   455,   304,   350,   399,   399,
+    399,   399,   399,   399,   399,   399,   399,   399,   399,   399,
+    399,   399,   399,   399,   455,   455,   268,   227,   455,   455,
+    455,   227,   455,   455,   455,   227,   455,   455,   455,   227,
+    399,   399,   399,   399,   399,   399,   399,   399,   399,   399,
+    399,   399,   399,   399,   399,   399,   314,   315,   324,   455,
+    338,   335,   339,   340,   336,   337,   394,   356,   398,   455,
+    304,   350,   399,   399,   399,   399,   399,   399,   399,   399,
+    399,   399,   399,   399,   399,   399,   399,   399,   424,   455,
+    269,   455,   455,   455,   455,   455,   455,   455,   455,   455,
+    455,   455,   455,   455,   399,   399,   399,   399,   399,   399,
+    399,   399,   399,   399,   399,   399,   399,   399,   399,   399,
+    314,   315,   324,   455,   338,   335,   339,   340,   336,   337,
+    394,   356,   398,   455,   304,   350,   399,   399,   399,   399,
+    399,   399,   399,   399,   399,   399,   399,   399,   399,   399,
+    399,   399,   455,   455,   455,   455,   455,   455,   285,   455,
+    455,   455,   455,   455,   455,   455,   455,   455,   399,   399,
+    399,   399,   399,   399,   399,   399,   399,   399,   399,   399,
+    399,   399,   399,   399,   314,   315,   324,   455,   338,   335,
+    339,   340,   336,   337,   394,   356,   398,   455,   304,   350,
+    399,   399,   399,   399,   399,   399,   399,   399,   399,   399,
+    399,   399,   399,   399,   399,   399,   431,   455,   455,   119,
+    149,   455,   292,   119,   439,   455,   455,   119,   455,   455,
+    455,   119,   399,   399,   399,   399,   399,   399,   399,   399,
+    399,   399,   399,   399,   399,   399,   399,   399,   314,   315,
+    324,   455,   338,   335,   339,   340,   336,   337,   394,   356,
+    398,   455,   304,   350,   399,   399,   399,   399,   399,   399,
+    399,   399,   399,   399,   399,   399,   399,   399,   399,   399,
+    433,   455,   455,   123,   158,   455,   293,   123,   438,   455,
+    455,   123,   455,   455,   455,   123,   399,   399,   399,   399,
+    399,   399,   399,   399,   399,   399,   399,   399,   399,   399,
+    399,   399,   314,   315,   324,   455,   338,   335,   339,   340,
+    336,   337,   394,   356,   398,   455,   304,   350,   399,   399,
+    399,   399,   399,   399,   399,   399,   399,   399,   399,   399,
+    399,   399,   399,   399,   435,   455,   455,   455,   455,   455,
+    294,   455,   436,   455,   455,   455,   455,   455,   455,   455,
+    399,   399,   399,   399,   399,   399,   399,   399,   399,   399,
+    399,   399,   399,   399,   399,   399,   314,   315,   324,   455,
+    338,   335,   339,   340,   336,   337,   394,   356,   398,   455,
+    304,   350,   399,   399,   399,   399,   399,   399,   399,   399,
+    399,   399,   399,   399,   399,   399,   399,   399,   455,   455,
+    455,   455,   455,   455,   287,   455,   455,   455,   455,   455,
+    455,   455,   455,   455,   399,   399,   399,   399,   399,   399,
+    399,   399,   399,   399,   399,   399,   399,   399,   399,   399,
+    314,   315,   324,   455,   338,   335,   339,   340,   336,   337,
+    394,   356,   398,   455,   304,   350,   399,   399,   399,   399,
+    399,   399,   399,   399,   399,   399,   399,   399,   399,   399,
+    399,   399,   427,   455,   455,   225,   455,   455,   289,   225,
+    437,   455,   455,   225,   455,   455,   455,   225,   399,   399,
+    399,   399,   399,   399,   399,   399,   399,   399,   399,   399,
+    399,   399,   399,   399,   314,   315,   324,   455,   338,   335,
+    339,   340,   336,   337,   394,   356,   398,   455,   304,   350,
+    399,   399,   399,   399,   399,   399,   399,   399,   399,   399,
+    399,   399,   399,   399,   399,   399,   428,   455,   455,   229,
+    455,   455,   290,   229,   455,   455,   455,   229,   455,   455,
+    455,   229,   399,   399,   399,   399,   399,   399,   399,   399,
+    399,   399,   399,   399,   399,   399,   399,   399,   314,   315,
+    324,   455,   338,   335,   339,   340,   336,   337,   394,   356,
+    398,   455,   304,   350,   399,   399,   399,   399,   399,   399,
+    399,   399,   399,   399,   399,   399,   399,   399,   399,   399,
+    429,   455,   455,   455,   455,   455,   291,   455,   440,   455,
+    455,   455,   455,   455,   455,   455,   399,   399,   399,   399,
+    399,   399,   399,   399,   399,   399,   399,   399,   399,   399,
+    399,   399,   314,   315,   324,   455,   338,   335,   339,   340,
+    336,   337,   394,   356,   398,   455,   304,   350,   399,   399,
+    399,   399,   399,   399,   399,   399,   399,   399,   399,   399,
+    399,   399,   399,   399,   455,   455,   455,   455,   455,   455,
+    277,   455,   455,   455,   455,   455,   455,   455,   455,   455,
+    399,   399,   399,   399,   399,   399,   399,   399,   399,   399,
+    399,   399,   399,   399,   399,   399,   314,   315,   324,   455,
+    338,   335,   339,   340,   336,   337,   394,   356,   398,   455,
+    304,   350,   399,   399,   399,   399,   399,   399,   399,   399,
+    399,   399,   399,   399,   399,   399,   399,   399,   357,   253,
+    357,   253,   357,   426,   357,   426,   357,   345,   357,   345,
+    357,   305,   357,   305,   357,   303,   357,   303,   357,   351,
+    357,   351,   357,   333,   357,   333,   357,   334,   357,   334,
+    362,   264,   362,   264,   364,   266,   364,   266,   366,   353,
+    366,   353,   368,   355,   368,   355,   370,   451,   370,   451,
+    372,   395,   372,   395,   374,   402,   374,   402,   376,   421,
+    376,   421,   280,   455,   280,   455,   280,   391,   280,   391,
+    286,   455,   286,   455,   286,   404,   286,   404,   288,   455,
+    288,   455,   288,   417,   288,   417,   278,   455,   278,   455,
+    278,   423,   278,   423,   284,   358,   284,   273,   284,   358,
+    284,   274,   307,   358,   307,   295,   317,   358,   317,   298,
+    328,   358,   328,   380,   332,   358,   332,   382,   444,   358,
+    444,   384,   448,   358,   448,   386,   280,   455,   280,   455,
+    280,   391,   280,   391,   286,   455,   286,   455,   286,   404,
+    286,   404,   288,   455,   288,   455,   288,   417,   288,   417,
+    278,   455,   278,   455,   278,   423,   278,   423,   284,   359,
+    284,   378,   284,   359,   284,   393,   307,   359,   307,   300,
+    317,   359,   317,   302,   328,   389,   328,   412,   332,   389,
+    332,   410,   444,   389,   444,   455,   448,   389,   448,   441,
+    141,   455,   455,   455,   455,   455,   455,   455,   455,   455,
+    455,   455,   455,   455,   455,   455,    14,   455,   455,   455,
+    455,   455,   455,   455,   455,   455,   455,   455,   455,   455,
+    455,   455,   455,    27,   455,   455,   455,   455,   455,   455,
+    455,   455,   455,   455,   455,   455,   455,   455,   455,   455,
+    455,   455,   455,   455,   455,   455,   455,   455,   455,   455,
+    455,   455,   455,   455,   455,   455,   455,   455,   455,   455,
+    455,   455,   455,   455,   455,   455,   455,   455,   455,   455,
+    455,   455,   455,   455,   455,   455,   455,   455,   455,   455,
+    455,   455,   455,   455,   455,   455,   455,   455,   455,   455,
+    455,   455,   455,   455,   455,   455,   455,   455,   455,   455,
+    455,   455,   455,   455,   455,   455,   455,   455,   455,   455,
+    455,   455,   455,   455,   455,   455,   455,   455,   455,    24,
+    455,   455,   455,   455,   455,   455,   455,   455,   455,   455,
+    455,   455,   455,   455,   455,   455,   455,   455,   455,   455,
+     81,   455,   455,   455,   455,   455,   455,   455,   455,   455,
+    455,   455,   455,   455,   455,   455,   455,   455,   455,   455,
+    455,   455,   455,   455,   455,   455,   455,   455,   455,   455,
+    455,   455,   455,   455,   455,   455,   455,   455,   455,   455,
+    455,   455,   455,    30,   455,   455,   455,   455,   455,   455,
+    455,   455,   455,   455,   455,   455,   455,   455,   455,   455,
+    455,   455,   455,   455,   455,   455,   455,   455,   455,   455,
+    455,   455,   455,   455,   455,    26,   455,   455,   455,   455,
+    455,   455,   455,   455,   455,   455,   455,   455,   455,   455,
+    455,   455,   455,   455,   455,   455,   455,   455,   455,   455,
+    455,   455,   455,   455,   455,   455,   455,    23,   455,   455,
+    455,   455,   455,   455,   455,   455,   455,   455,   455,   455,
+    455,   455,   455,   455,   455,   455,   455,   455,   455,   455,
+    455,   455,   455,   455,   455,   455,   455,   455,   455,    25,
+    455,   455,   455,   455,   455,   455,   455,   455,   455,   455,
+    455,   455,   455,   455,   455,   455,   455,   455,   455,   455,
+    455,   455,   455,   455,   455,   455,   455,   455,   455,   455,
+    455,   455,   455,   455,   455,   455,   455,   455,   455,   455,
+    455,   455,   455,   455,   455,   455,   455,   455,   455,   455,
+    455,   455,   455,   455,   455,   455,   455,   455,   455,   455,
+    455,   455,   455,   455,   455,   455,   455,   455,   455,   455,
+    455,   455,   455,   455,   455,   455,   455,   455,   455,   455,
+    455,   455,   455,   455,   455,   455,   455,   455,   455,   455,
+    455,   455,   455,   455,   455,   455,   455,   455,   455,   455,
+    455,   455,   455,   455,   455,   455,   455,   455,   455,   455,
+    455,   455,   455,   455,   455,   455,   455,   455,   455,   455,
+    455,   455,   455,   455,   455,   455,   455,    29,   455,   455,
+    455,   455,   455,   455,   455,   455,   455,   455,   455,   455,
+    455,   455,   455,   455,   455,   455,   455,   455,   455,   455,
+    455,   455,   455,   455,   455,   455,   455,   455,   455,    28,
+    455,   455,   455,   455,   455,   455,   455,   455,   455,   455,
+    455,   455,   455,   455,   455,   455,   455,   455,   455,   455,
+    455,   455,   455,   455,   455,   455,   455,   455,   455,   455,
+    455,   455,   455,   455,   455,   455,   455,   455,   455,   455,
+    455,   455,   455,   455,   455,   455,   455,   455,   455,   455,
+    455,   455,   455,   455,   455,   455,   455,   455,   455,   455,
+    455,   455,   455,   455,   455,   455,   455,   455,   455,   455,
+    455,   455,   455,   455,   455,   455,   455,   455,    13,   455,
+    455,   455,   455,   455,   455,   455,   455,   455,   455,   455,
+    455,   455,   455,   455,   455,   455,   455,   455,   455,   455,
+    455,   455,   455,   455,   455,   455,   455,   455,   455,   455,
+    455,   455,   455,   455,   455,   455,   455,   455,   455,   455,
+    455,   455,   455,   455,   455,   455,   455,   455,   455,   455,
+    455,   455,   455,   455,   455,   455,   455,   455,   455,   455,
+    455,   455,   455,   455,   455,   455,   455,   455,   455,   455,
+    455,   455,   455,   455,   455,   455,   455,   455,   455,   455,
+    455,   455,   455,   455,   455,   455,   455,   455,   455,   455,
+    455,   455,   455,   455,   455,   455,   455,   455,   455,   455,
+    455,   455,   455,   455,   455,   455,   455,   455,   455,   455,
+    455,   455,   455,   455,   455,   455,   455,   455,   455,   455,
+    455,   455,   455,   455,   455,   455,   455,   455,   455,   455,
+    455,   455,   455,   455,   455,   455,   455,   455,   455,   455,
+    455,   455,   455,   455,   455,   455,   455,   455,   455,   455,
+    455,   455,   455,   455,   455,   455,   455,   455,   455,   455,
+    455,   455,   455,   455,   455,   455,   455,   455,   455,   455,
+    455,   455,   455,   455,   455,   455,   455,   455,   455,   455,
+    455,   455,   455,   455,   455,   455,   455,   455,   455,   455,
+    455,   455,   455,   455,   455,   455,   455,   455,   455,   455,
+    455,   455,   455,   455,   455,   455,   455,   455,   455,   455,
+    455,   455,   455,   455,   455,   455,   455,   455,   455,   455,
+    455,   455,   455,   455,   455,   455,   455,   455,   455,   455,
+    455,   455,   455,   455,   455,   455,   455,   455,   455,   455,
+    455,   455,   455,   455,   455,   455,   455,   455,   455,   455,
+    455,   455,   455,   455,   455,   455,   455,   455,   455,   455,
+    455,   455,   455,   455,   455,   455,   455,   455,   455,   455,
+    455,   455,   455,   455,   455,   455,   455,   455,   455,   455,
+    455,   455,   455,   455,   455,   455,   455,   455,   455,   455,
+    455,   455,   455,   455,   455,   455,   455,   455,   455,   455,
+    455,   455,   455,   455,   455,   455,   455,   455,   455,   455,
+    455,   455,   455,   455,   455,   455,   455,   455,   455,   455,
+    455,   455,   455,   455,   455,   455,   455,   455,   455,   455,
+    455,   455,   455,   455,   455,   455,   455,   455,   455,   455,
+    455,   455,   455,   455,   455,   455,   455,   455,   455,   455,
+    455,   455,   455,   455,   455,   455,   455,   455,   455,   455,
+    455,   455,   455,   455,   455,   455,   455,   455,   455,   455,
+    455,   455,   455,   455,   455,   455,   455,   455,   455,   455,
+    455,   455,   455,   455,   455,   455,   455,   455,   455,   455,
+    455,   455,   455,   455,   455,   455,   455,   455,   455,   455,
+    455,   455,   455,   455,   455,   455,   455,   455,   455,   455,
+    455,   455,   455,   455,   455,   455,   455,   455,   455,   455,
+    455,   455,   455,   455,   455,   455,   455,   455,   455,   455,
+    455,   455,   455,   455,   455,   455,   455,   455,   455,   455,
+    455,   455,   455,   455,   455,   455,   455,   455,   455,   455,
+    455,   455,   455,   455,   455,   455,   455,   455,   455,   455,
+    455,   455,   455,   455,   455,   455,   455,   455,   455,   455,
+    455,   455,   455,   455,   455,   455,   455,   455,   455,   455,
+    455,   455,   455,   455,   455,   455,   455,   455,   455,   455,
+    455,   455,   455,   455,   175,   175,   176,   176,   177,   177,
+    178,   178,   173,   174,   455,   455,   455,   455,   455,   455,
+     17,   455,   455,   455,   249,   455,   124,   112,   240,   159,
+      0,   161,   455,   455,   455,   455,   455,   455,   455,   144,
+    133,    91,   455,   140,   184,   455,    22,   183,    12,   455,
+    455,   455,    19,   455,   455,   455,   455,   455,   126,   113,
+    244,   455,   455,   455,   455,   455,   455,   455,   455,   455,
+    455,   455,   455,    90,    33,   139,   455,   455,    21,   455,
+      9,   455,   455,   455,   455,   455,   455,   455,   247,   455,
+    455,   114,   455,   160,   455,   162,   455,   455,   455,   455,
+    455,   455,   455,   146,    87,   455,    31,    85,   455,   455,
+    455,   455,   455,   455,   455,   455,   455,   455,   455,   455,
+    455,   455,   455,   128,   167,   455,   455,   455,   455,   455,
+    455,   455,   455,   455,   455,   455,   455,   455,   455,    84,
+    455,   455,   455,   455,   168,   455,   455,   455,   455,   455,
+    455,   455,   455,   455,   455,   218,   241,   455,     1,   455,
+    455,   455,   455,   455,   150,   455,   155,   455,   455,   200,
+    236,   239,   455,   455,   455,   455,   455,   455,   455,   455,
+    455,   455,   455,   455,   455,   455,   455,   219,   455,   455,
+    455,   455,   455,   455,   455,   455,   455,   455,   156,   455,
+    455,   199,   455,   238,   455,   455,   455,   455,   455,   455,
+    455,   455,   455,   455,   455,   455,   455,   455,   455,   220,
+    245,   455,     8,   455,   455,   455,   455,   455,   455,   455,
+    455,   455,   455,   455,   197,   194,   455,   455,   455,   455,
+    455,   455,   455,   455,   455,   455,   455,   455,   455,   455,
+    455,   230,   243,   163,     6,   165,   455,   455,   455,   455,
+    455,   455,   455,   455,   455,   455,    35,   193,   455,   455,
+    455,   455,   455,   455,   455,   455,   455,   455,   455,   455,
+    455,   455,   455,   455,   455,   455,     7,   455,   455,   455,
+    455,   455,   455,   455,   455,   455,   455,   455,    34,   108,
+    455,   455,   455,   455,    43,   455,   455,   455,   455,   455,
+    455,   455,   455,   455,   455,   455,   455,   455,   455,   455,
+    455,   455,   455,   455,   455,   455,   455,   455,   455,   455,
+    455,   107,   455,   455,   455,   455,   454,   455,   455,   455,
+    455,   455,   455,   455,   455,   455,   455,   455,   455,   455,
+    455,   455,   455,   455,   455,   455,   455,   455,   455,   147,
+    455,   135,   455,   103,   455,   455,   455,   455,   455,   455,
+    455,   455,   455,   455,   455,   455,   455,   455,   455,   130,
+    455,   455,   455,   455,   455,   455,   455,   455,   455,   455,
+    455,   148,   455,   134,   455,   102,   455,   455,   455,   455,
+    455,   455,   455,   455,   455,   455,   455,   455,   455,   455,
+    455,   455,   455,   455,   455,   455,   455,   455,   455,   455,
+    455,   455,   455,   455,   455,   455,   455,   214,   455,   455,
+    455,   455,   169,   455,   455,   455,   455,   455,   455,   455,
+    455,   455,   455,   455,   455,   455,   455,   455,   455,   455,
+    455,   455,   455,   455,   455,   455,   455,   455,   455,   213,
+    455,   455,   455,   455,   172,   455,   455,   455,   455,   455,
+    455,   455,   455,   455,   455,   455,   455,    38,   455,    40,
+    455,   455,   455,   455,   455,   455,   455,   157,   455,   455,
+     32,   455,   455,   455,   455,   455,   166,   455,   455,   455,
+    455,   455,   455,   455,   455,   455,   455,   232,   455,    39,
+    455,    41,   455,   455,   455,   455,   455,   455,   455,   455,
+    455,   455,   455,   455,   455,   455,   455,   455,   455,   455,
+    455,   455,   143,   455,   455,   455,   455,   455,   455,   116,
+    240,   159,     0,   161,   455,   455,   455,   455,   455,   455,
+    455,   455,    88,   111,   136,    99,   190,   455,   455,   189,
+    455,   455,   455,   455,   455,   455,   455,   455,   455,   455,
+    455,   120,   244,   455,   455,   455,   455,   455,   455,   455,
+    455,   455,   455,   455,   455,   455,   455,    98,   455,   455,
+    455,   455,   455,   455,   455,   455,   455,   455,   455,   455,
+    455,   455,   455,   455,   455,   160,   455,   162,   455,   455,
+    455,   455,   455,   455,   455,   455,   455,   110,   246,    95,
+    455,   455,   455,   455,   455,   455,   455,   455,   455,   455,
+    455,   455,   455,   455,   455,   455,   167,   455,   455,   455,
+    455,   455,   455,   455,   455,   455,   455,   455,   455,   455,
+    455,    94,   455,   455,   455,   455,   455,   455,   455,   455,
+    455,   455,   455,   455,   455,   455,   455,   222,   241,   455,
+      1,   455,   455,   455,   455,   455,   455,   455,   455,   455,
+    196,   217,   235,   209,   455,   455,   455,   455,   455,   455,
+    455,   455,   455,   455,   455,   455,   455,   455,   455,   226,
+    455,   455,   455,   455,   455,   455,   455,   455,   455,   455,
+    455,   455,   455,   455,   455,   208,   455,   455,   455,   455,
+    455,   455,   455,   455,   455,   455,   455,   455,   455,   455,
+    455,   455,   245,   455,     8,   455,   455,   455,   455,   455,
+    455,   455,   455,   455,   455,   216,   455,   204,   455,   455,
+    455,   455,   455,   455,   455,   455,   455,   455,   455,   455,
+    455,   455,   455,   455,   243,   163,     6,   165,   455,   455,
+    455,   455,   455,   455,   455,   455,   455,   455,   455,   203,
+    455,   455,   455,   455,   455,   455,   455,   455,   455,   455,
+    455,   455,   455,   455,   455,   118,   455,   455,     7,   455,
+    455,   455,   455,   455,   455,   455,   455,   455,   455,   455,
+    104,   455,   188,   455,   186,   455,   455,   455,   455,   455,
+    455,   455,   455,   455,   455,   455,   455,   122,   455,   455,
+    455,   455,   455,   455,   455,   455,   455,   455,   455,   455,
+    455,   455,   455,   455,   187,   455,   185,   185,   455,   455,
+    455,   455,   455,   455,   455,   455,   455,   455,   455,   455,
+    455,   455,   455,   455,   455,   455,   455,   455,   455,   455,
+    455,   455,   455,   455,    42,   455,   455,   455,   455,   455,
+    455,   455,   455,   455,   455,   455,   455,   455,   455,   455,
+    455,   455,   455,   455,   455,   455,   455,   455,   455,   455,
+    455,   455,   455,   455,   455,   455,   455,   455,   455,   455,
+    455,   455,   455,   455,   455,   455,   455,   455,   455,   455,
+    455,   455,   455,   224,   455,   455,   455,   455,   455,   455,
+    455,   455,   455,   455,   455,   455,   455,   455,   211,   455,
+    455,   455,    45,   455,   455,   455,   455,   455,   455,   455,
+    455,   455,   455,   455,   455,   228,   455,   455,   455,   455,
+    455,   455,   455,   455,   455,   455,   455,   455,   455,   455,
+    455,   455,   455,   455,    44,   455,   455,   455,   455,   455,
+    455,   455,   455,   455,   455,   455,   455,   455,   455,    38,
+    455,    40,   455,   455,   455,   455,   455,   455,   455,   455,
+    455,   455,    80,   205,   455,   455,    46,   455,   455,   455,
+    455,   455,   455,   455,   455,   455,   455,   455,   455,   455,
+    455,    39,   455,    41,   455,   455,   455,   455,   455,   455,
+    455,   455,   455,   455, 32768,   455,   455,   455,   455,   455,
+    455,   455,   455,   455,    86,    89,   132,   455,   455,   455,
+    455,   455,   455,   455,   455,   455,   455,   455,   455,   455,
+    455,   455,   455,   455,   455,   455,    57,   455,    78,    48,
+     76,   455,    72,    64,   455,   455,    62,    59,    70,    68,
+    195,   198,   455,   455,    52,   455,   455,   455,   455,   455,
+    455,   455,   455,   455,   455,   455,    73,   455,    55,    56,
+    455,   455,    58,   455,    79,    49,    77,    75,   455,    65,
+     74,   455,    63,    60,    71,    69,    51,   455,   455,   455,
+    455,   455,   152,   455,    67,   455,   455,   455,   455,   455,
+    455,   455,   455,   455,    58,   455,    79,    49,    77,    75,
+    455,    65,    74,   455,    63,    60,    71,    69,   142,   455,
+    455,   455,   455,   455,   151,   455,    61,   455,   455,   455,
+    455,   455,   455,   455,   455,   455,    58,   455,    79,    49,
+     77,    75,   455,    65,    74,   455,    63,    60,    71,    69,
+    455,   455,   455,   455,   455,   455,   455,   455,   455,   455,
+    455,   455,   455,   455,   455,   455,   455,   455,    58,   455,
+     79,    49,    77,    75,   455,    65,    74,   455,    63,    60,
+     71,    69,   455,   455,   455,   455,   455,   455,   153,   455,
+     66,   455,   455,   455,   455,   455,   455,   455,   455,   455,
+     58,   455,    79,    49,    77,    75,   455,    65,    74,   455,
+     63,    60,    71,    69,   455,   455,   455,   455,   455,   455,
+    455,   455,   455,   455,   455,   455,   455,   455,   455,   455,
+    455,   455,    58,   455,    79,    49,    77,    75,   455,    65,
+     74,   455,    63,    60,    71,    69,   455,   455,   455,   455,
+    455,   455,   455,   455,   455,   455,   455,   455,   455,   455,
+    455,   455,   455,   455,    58,   455,    79,    49,    77,    75,
+    455,    65,    74,   455,    63,    60,    71,    69,   455,   455,
+    455,   455,   455,   455,   455,   455,   455,   455,   455,   455,
+    455,   455,   455,   455,   455,   455,    58,   455,    79,    49,
+     77,    75,   455,    65,    74,   455,    63,    60,    71,    69,
+    455,   455,   455,   455,   455,   455,   455,   455,    47,   455,
+    455,   455,   455,   455,   455,   455,   455,   455,    58,   455,
+     79,    49,    77,    75,   455,    65,    74,   455,    63,    60,
+     71,    69,   455,   455,   455,   455,   455,   455,   455,   455,
+    455,   455,   455,   455,   455,   455,   455,   455,   455,   455,
+     58,   455,    79,    49,    77,    75,   455,    65,    74,   455,
+     63,    60,    71,    69,   455,   455,   455,   455,   455,   455,
+    455,   455,   455,   455,   455,   455,   455,   455,   455,   455,
+    455,   455,    58,   455,    79,    49,    77,    75,   455,    65,
+     74,   455,    63,    60,    71,    69,   455,   455,   455,   455,
+    455,   455,   455,   455,   455,   455,   455,   455,   455,   455,
+    455,   455,   455,   455,    58,   455,    79,    49,    77,    75,
+    455,    65,    74,   455,    63,    60,    71,    69,   455,   455,
+    455,   455,   455,   455,   455,   455,   455,   455,   455,   455,
+    455,   455,   455,   455,   455,   455,    58,   455,    79,    49,
+     77,    75,   455,    65,    74,   455,    63,    60,    71,    69,
+    455,   455,   455,   455,   455,   455,   455,   455,   455,   455,
+    455,   455,   455,   455,   455,   455,   455,   455,    58,   455,
+     79,    49,    77,    75,   455,    65,    74,   455,    63,    60,
+     71,    69,   455,   455,   455,   455,   455,   455,   455,   455,
+    455,   455,   455,   455,   455,   455,   455,   455,   455,   455,
+     58,   455,    79,    49,    77,    75,   455,    65,    74,   455,
+     63,    60,    71,    69,   455,   455,   455,   455,   455,   455,
+    455,   455,   455,   455,   455,   455,   455,   455,   455,   455,
+    455,   455,    58,   455,    79,    49,    77,    75,   455,    65,
+     74,   455,    63,    60,    71,    69,   455,   455,   455,   455,
+    455,   455,   455,   455,   455,   455,   455,   455,   455,   455,
+    455,   455,   455,   455,    58,   455,    79,    49,    77,    75,
+    455,    65,    74,   455,    63,    60,    71,    69,   455,   455,
+    455,   455,   455,   455,   455,   455,   455,   455,   455,   455,
+    455,   455,   455,   455,   455,   455,    58,   455,    79,    49,
+     77,    75,   455,    65,    74,   455,    63,    60,    71,    69,
+    455,   455,   455,   455,   455,   455,   455,   145,   455,   455,
+    455,   455,   455,   455,   455,   455,   455,   455,    58,   455,
+     79,    49,    77,    75,   455,    65,    74,   455,    63,    60,
+     71,    69,   455,   455,   455,   455,   455,   455,   455,   455,
+    455,   455,   455,   455,   455,   455,   455,   455,   455,   455,
+     58,   455,    79,    49,    77,    75,   455,    65,    74,   455,
+     63,    60,    71,    69,   455,   455,   455,   455,   455,   455,
+    455,   455,   455,   455,   455,   455,   455,   455,   455,   455,
+    455,   455,    58,   455,    79,    49,    77,    75,   455,    65,
+     74,   455,    63,    60,    71,    69,   455,   455,   455,   455,
+    455,   455,   455,   455,   455,   455,   455,   455,   455,   455,
+    455,   455,   455,   455,    58,   455,    79,    49,    77,    75,
+    455,    65,    74,   455,    63,    60,    71,    69,   455,   455,
+    455,   455,   455,   455,   455,   154,   455,   455,   455,   455,
+    455,   455,   455,   455,   455,   455,    58,   455,    79,    49,
+     77,    75,   455,    65,    74,   455,    63,    60,    71,    69,
+    455,   455,   455,   455,   455,   455,   455,   455,   455,   455,
+    455,   455,   455,   455,   455,   455,   455,   455,    58,   455,
+     79,    49,    77,    75,   455,    65,    74,   455,    63,    60,
+     71,    69,   455,   455,   455,   455,   455,   455,   455,   455,
+    455,   455,   455,   455,   455,   455,   455,   455,   455,   455,
+     58,   455,    79,    49,    77,    75,   455,    65,    74,   455,
+     63,    60,    71,    69,   455,   455,   455,   455,   455,   455,
+    455,   455,   455,   455,   455,   455,   455,   455,    53,    54,
+    455,   455,    58,   455,    79,    49,    77,    75,   455,    65,
+     74,   455,    63,    60,    71,    69,   455,   455,   455,   455,
+    455,   455,   455,   455,   455,   455,   455,   455,   455,   455,
+     50,   455,   455,   455,    58,   455,    79,    49,    77,    75,
+    455,    65,    74,   455,    63,    60,    71,    69,   455,   455,
+    455,   455,   455,   455,   455,   455,   455,   455,   455,   455,
+    455,   455,   455,   455,   455,   455,    58,   455,    79,    49,
+     77,    75,   455,    65,    74,   455,    63,    60,    71,    69,
+    455,   455,   455,   455,   455,   455,   455,   455,   455,   455,
+    455,   455,   455,   455,   455,   455,   455,   455,    58,   455,
+     79,    49,    77,    75,   455,    65,    74,   455,    63,    60,
+     71,    69,   455,   455,   455,   455,   455,   455,   455,   455,
+    455,   455,   455,   455,   455,   455,   455,   455,   455,   455,
+     58,   455,    79,    49,    77,    75,   455,    65,    74,   455,
+     63,    60,    71,    69,   455,   455,   455,   455,   455,   455,
+    455,   455,   455,   455,   455,   455,   455,   455,   455,   455,
+    455,   455,    58,   455,    79,    49,    77,    75,   455,    65,
+     74,   455,    63,    60,    71,    69,   455,   455,   455,   455,
+    455,   455,   455,   455,   455,   455,   455,   455,   455,   455,
+    455,   455,   455,   455,    58,   455,    79,    49,    77,    75,
+    455,    65,    74,   455,    63,    60,    71,    69,
+};
+
+constexpr PPCDecodeCollisionEntry ppc_decode_collision_table[3] = {
+  {0x03E007FE, 0x000007EC,    36},  // dcbz
+  {0x03E007FE, 0x002007EC,    37},  // dcbz128
+  {0x00000000, 0x00000000,   455},  // invalid
+};
 
 PPCOpcode LookupOpcode(uint32_t code) {
-  switch (ExtractBits(code, 0, 5)) {
-  case 2: PPC_DECODER_HIT(tdi);
-  case 3: PPC_DECODER_HIT(twi);
-  case 4:
-    switch ((ExtractBits(code, 21, 27) << 4)|(ExtractBits(code, 30, 31) << 0)) {
-      case 0b00000000011: PPC_DECODER_HIT(lvsl128);
-      case 0b00001000011: PPC_DECODER_HIT(lvsr128);
-      case 0b00010000011: PPC_DECODER_HIT(lvewx128);
-      case 0b00011000011: PPC_DECODER_HIT(lvx128);
-      case 0b00110000011: PPC_DECODER_HIT(stvewx128);
-      case 0b00111000011: PPC_DECODER_HIT(stvx128);
-      case 0b01011000011: PPC_DECODER_HIT(lvxl128);
-      case 0b01111000011: PPC_DECODER_HIT(stvxl128);
-      case 0b10000000011: PPC_DECODER_HIT(lvlx128);
-      case 0b10001000011: PPC_DECODER_HIT(lvrx128);
-      case 0b10100000011: PPC_DECODER_HIT(stvlx128);
-      case 0b10101000011: PPC_DECODER_HIT(stvrx128);
-      case 0b11000000011: PPC_DECODER_HIT(lvlxl128);
-      case 0b11001000011: PPC_DECODER_HIT(lvrxl128);
-      case 0b11100000011: PPC_DECODER_HIT(stvlxl128);
-      case 0b11101000011: PPC_DECODER_HIT(stvrxl128);
-    }
-    switch ((ExtractBits(code, 21, 31) << 0)) {
-      case 0b00000000000: PPC_DECODER_HIT(vaddubm);
-      case 0b00000000010: PPC_DECODER_HIT(vmaxub);
-      case 0b00000000100: PPC_DECODER_HIT(vrlb);
-      case 0b00000001000: PPC_DECODER_HIT(vmuloub);
-      case 0b00000001010: PPC_DECODER_HIT(vaddfp);
-      case 0b00000001100: PPC_DECODER_HIT(vmrghb);
-      case 0b00000001110: PPC_DECODER_HIT(vpkuhum);
-      case 0b00001000000: PPC_DECODER_HIT(vadduhm);
-      case 0b00001000010: PPC_DECODER_HIT(vmaxuh);
-      case 0b00001000100: PPC_DECODER_HIT(vrlh);
-      case 0b00001001000: PPC_DECODER_HIT(vmulouh);
-      case 0b00001001010: PPC_DECODER_HIT(vsubfp);
-      case 0b00001001100: PPC_DECODER_HIT(vmrghh);
-      case 0b00001001110: PPC_DECODER_HIT(vpkuwum);
-      case 0b00010000000: PPC_DECODER_HIT(vadduwm);
-      case 0b00010000010: PPC_DECODER_HIT(vmaxuw);
-      case 0b00010000100: PPC_DECODER_HIT(vrlw);
-      case 0b00010001100: PPC_DECODER_HIT(vmrghw);
-      case 0b00010001110: PPC_DECODER_HIT(vpkuhus);
-      case 0b00011001110: PPC_DECODER_HIT(vpkuwus);
-      case 0b00100000010: PPC_DECODER_HIT(vmaxsb);
-      case 0b00100000100: PPC_DECODER_HIT(vslb);
-      case 0b00100001000: PPC_DECODER_HIT(vmulosb);
-      case 0b00100001010: PPC_DECODER_HIT(vrefp);
-      case 0b00100001100: PPC_DECODER_HIT(vmrglb);
-      case 0b00100001110: PPC_DECODER_HIT(vpkshus);
-      case 0b00101000010: PPC_DECODER_HIT(vmaxsh);
-      case 0b00101000100: PPC_DECODER_HIT(vslh);
-      case 0b00101001000: PPC_DECODER_HIT(vmulosh);
-      case 0b00101001010: PPC_DECODER_HIT(vrsqrtefp);
-      case 0b00101001100: PPC_DECODER_HIT(vmrglh);
-      case 0b00101001110: PPC_DECODER_HIT(vpkswus);
-      case 0b00110000000: PPC_DECODER_HIT(vaddcuw);
-      case 0b00110000010: PPC_DECODER_HIT(vmaxsw);
-      case 0b00110000100: PPC_DECODER_HIT(vslw);
-      case 0b00110001010: PPC_DECODER_HIT(vexptefp);
-      case 0b00110001100: PPC_DECODER_HIT(vmrglw);
-      case 0b00110001110: PPC_DECODER_HIT(vpkshss);
-      case 0b00111000100: PPC_DECODER_HIT(vsl);
-      case 0b00111001010: PPC_DECODER_HIT(vlogefp);
-      case 0b00111001110: PPC_DECODER_HIT(vpkswss);
-      case 0b01000000000: PPC_DECODER_HIT(vaddubs);
-      case 0b01000000010: PPC_DECODER_HIT(vminub);
-      case 0b01000000100: PPC_DECODER_HIT(vsrb);
-      case 0b01000001000: PPC_DECODER_HIT(vmuleub);
-      case 0b01000001010: PPC_DECODER_HIT(vrfin);
-      case 0b01000001100: PPC_DECODER_HIT(vspltb);
-      case 0b01000001110: PPC_DECODER_HIT(vupkhsb);
-      case 0b01001000000: PPC_DECODER_HIT(vadduhs);
-      case 0b01001000010: PPC_DECODER_HIT(vminuh);
-      case 0b01001000100: PPC_DECODER_HIT(vsrh);
-      case 0b01001001000: PPC_DECODER_HIT(vmuleuh);
-      case 0b01001001010: PPC_DECODER_HIT(vrfiz);
-      case 0b01001001100: PPC_DECODER_HIT(vsplth);
-      case 0b01001001110: PPC_DECODER_HIT(vupkhsh);
-      case 0b01010000000: PPC_DECODER_HIT(vadduws);
-      case 0b01010000010: PPC_DECODER_HIT(vminuw);
-      case 0b01010000100: PPC_DECODER_HIT(vsrw);
-      case 0b01010001010: PPC_DECODER_HIT(vrfip);
-      case 0b01010001100: PPC_DECODER_HIT(vspltw);
-      case 0b01010001110: PPC_DECODER_HIT(vupklsb);
-      case 0b01011000100: PPC_DECODER_HIT(vsr);
-      case 0b01011001010: PPC_DECODER_HIT(vrfim);
-      case 0b01011001110: PPC_DECODER_HIT(vupklsh);
-      case 0b01100000000: PPC_DECODER_HIT(vaddsbs);
-      case 0b01100000010: PPC_DECODER_HIT(vminsb);
-      case 0b01100000100: PPC_DECODER_HIT(vsrab);
-      case 0b01100001000: PPC_DECODER_HIT(vmulesb);
-      case 0b01100001010: PPC_DECODER_HIT(vcfux);
-      case 0b01100001100: PPC_DECODER_HIT(vspltisb);
-      case 0b01100001110: PPC_DECODER_HIT(vpkpx);
-      case 0b01101000000: PPC_DECODER_HIT(vaddshs);
-      case 0b01101000010: PPC_DECODER_HIT(vminsh);
-      case 0b01101000100: PPC_DECODER_HIT(vsrah);
-      case 0b01101001000: PPC_DECODER_HIT(vmulesh);
-      case 0b01101001010: PPC_DECODER_HIT(vcfsx);
-      case 0b01101001100: PPC_DECODER_HIT(vspltish);
-      case 0b01101001110: PPC_DECODER_HIT(vupkhpx);
-      case 0b01110000000: PPC_DECODER_HIT(vaddsws);
-      case 0b01110000010: PPC_DECODER_HIT(vminsw);
-      case 0b01110000100: PPC_DECODER_HIT(vsraw);
-      case 0b01110001010: PPC_DECODER_HIT(vctuxs);
-      case 0b01110001100: PPC_DECODER_HIT(vspltisw);
-      case 0b01111001010: PPC_DECODER_HIT(vctsxs);
-      case 0b01111001110: PPC_DECODER_HIT(vupklpx);
-      case 0b10000000000: PPC_DECODER_HIT(vsububm);
-      case 0b10000000010: PPC_DECODER_HIT(vavgub);
-      case 0b10000000100: PPC_DECODER_HIT(vand);
-      case 0b10000001010: PPC_DECODER_HIT(vmaxfp);
-      case 0b10000001100: PPC_DECODER_HIT(vslo);
-      case 0b10001000000: PPC_DECODER_HIT(vsubuhm);
-      case 0b10001000010: PPC_DECODER_HIT(vavguh);
-      case 0b10001000100: PPC_DECODER_HIT(vandc);
-      case 0b10001001010: PPC_DECODER_HIT(vminfp);
-      case 0b10001001100: PPC_DECODER_HIT(vsro);
-      case 0b10010000000: PPC_DECODER_HIT(vsubuwm);
-      case 0b10010000010: PPC_DECODER_HIT(vavguw);
-      case 0b10010000100: PPC_DECODER_HIT(vor);
-      case 0b10011000100: PPC_DECODER_HIT(vxor);
-      case 0b10100000010: PPC_DECODER_HIT(vavgsb);
-      case 0b10100000100: PPC_DECODER_HIT(vnor);
-      case 0b10101000010: PPC_DECODER_HIT(vavgsh);
-      case 0b10110000000: PPC_DECODER_HIT(vsubcuw);
-      case 0b10110000010: PPC_DECODER_HIT(vavgsw);
-      case 0b11000000000: PPC_DECODER_HIT(vsububs);
-      case 0b11000000100: PPC_DECODER_HIT(mfvscr);
-      case 0b11000001000: PPC_DECODER_HIT(vsum4ubs);
-      case 0b11001000000: PPC_DECODER_HIT(vsubuhs);
-      case 0b11001000100: PPC_DECODER_HIT(mtvscr);
-      case 0b11001001000: PPC_DECODER_HIT(vsum4shs);
-      case 0b11010000000: PPC_DECODER_HIT(vsubuws);
-      case 0b11010001000: PPC_DECODER_HIT(vsum2sws);
-      case 0b11100000000: PPC_DECODER_HIT(vsubsbs);
-      case 0b11100001000: PPC_DECODER_HIT(vsum4sbs);
-      case 0b11101000000: PPC_DECODER_HIT(vsubshs);
-      case 0b11110000000: PPC_DECODER_HIT(vsubsws);
-      case 0b11110001000: PPC_DECODER_HIT(vsumsws);
-    }
-    switch ((ExtractBits(code, 22, 31) << 0)) {
-      case 0b0000000110: PPC_DECODER_HIT(vcmpequb);
-      case 0b0001000110: PPC_DECODER_HIT(vcmpequh);
-      case 0b0010000110: PPC_DECODER_HIT(vcmpequw);
-      case 0b0011000110: PPC_DECODER_HIT(vcmpeqfp);
-      case 0b0111000110: PPC_DECODER_HIT(vcmpgefp);
-      case 0b1000000110: PPC_DECODER_HIT(vcmpgtub);
-      case 0b1001000110: PPC_DECODER_HIT(vcmpgtuh);
-      case 0b1010000110: PPC_DECODER_HIT(vcmpgtuw);
-      case 0b1011000110: PPC_DECODER_HIT(vcmpgtfp);
-      case 0b1100000110: PPC_DECODER_HIT(vcmpgtsb);
-      case 0b1101000110: PPC_DECODER_HIT(vcmpgtsh);
-      case 0b1110000110: PPC_DECODER_HIT(vcmpgtsw);
-      case 0b1111000110: PPC_DECODER_HIT(vcmpbfp);
-    }
-    switch ((ExtractBits(code, 26, 31) << 0)) {
-      case 0b100000: PPC_DECODER_HIT(vmhaddshs);
-      case 0b100001: PPC_DECODER_HIT(vmhraddshs);
-      case 0b100010: PPC_DECODER_HIT(vmladduhm);
-      case 0b100100: PPC_DECODER_HIT(vmsumubm);
-      case 0b100101: PPC_DECODER_HIT(vmsummbm);
-      case 0b100110: PPC_DECODER_HIT(vmsumuhm);
-      case 0b100111: PPC_DECODER_HIT(vmsumuhs);
-      case 0b101000: PPC_DECODER_HIT(vmsumshm);
-      case 0b101001: PPC_DECODER_HIT(vmsumshs);
-      case 0b101010: PPC_DECODER_HIT(vsel);
-      case 0b101011: PPC_DECODER_HIT(vperm);
-      case 0b101100: PPC_DECODER_HIT(vsldoi);
-      case 0b101110: PPC_DECODER_HIT(vmaddfp);
-      case 0b101111: PPC_DECODER_HIT(vnmsubfp);
-    }
-    switch ((ExtractBits(code, 27, 27) << 0)) {
-      case 0b1: PPC_DECODER_HIT(vsldoi128);
-    }
-    PPC_DECODER_MISS;
-  case 5:
-    switch ((ExtractBits(code, 22, 22) << 5)|(ExtractBits(code, 27, 27) << 0)) {
-      case 0b000000: PPC_DECODER_HIT(vperm128);
-    }
-    switch ((ExtractBits(code, 22, 25) << 2)|(ExtractBits(code, 27, 27) << 0)) {
-      case 0b000001: PPC_DECODER_HIT(vaddfp128);
-      case 0b000101: PPC_DECODER_HIT(vsubfp128);
-      case 0b001001: PPC_DECODER_HIT(vmulfp128);
-      case 0b001101: PPC_DECODER_HIT(vmaddfp128);
-      case 0b010001: PPC_DECODER_HIT(vmaddcfp128);
-      case 0b010101: PPC_DECODER_HIT(vnmsubfp128);
-      case 0b011001: PPC_DECODER_HIT(vmsum3fp128);
-      case 0b011101: PPC_DECODER_HIT(vmsum4fp128);
-      case 0b100000: PPC_DECODER_HIT(vpkshss128);
-      case 0b100001: PPC_DECODER_HIT(vand128);
-      case 0b100100: PPC_DECODER_HIT(vpkshus128);
-      case 0b100101: PPC_DECODER_HIT(vandc128);
-      case 0b101000: PPC_DECODER_HIT(vpkswss128);
-      case 0b101001: PPC_DECODER_HIT(vnor128);
-      case 0b101100: PPC_DECODER_HIT(vpkswus128);
-      case 0b101101: PPC_DECODER_HIT(vor128);
-      case 0b110000: PPC_DECODER_HIT(vpkuhum128);
-      case 0b110001: PPC_DECODER_HIT(vxor128);
-      case 0b110100: PPC_DECODER_HIT(vpkuhus128);
-      case 0b110101: PPC_DECODER_HIT(vsel128);
-      case 0b111000: PPC_DECODER_HIT(vpkuwum128);
-      case 0b111001: PPC_DECODER_HIT(vslo128);
-      case 0b111100: PPC_DECODER_HIT(vpkuwus128);
-      case 0b111101: PPC_DECODER_HIT(vsro128);
-    }
-    PPC_DECODER_MISS;
-  case 6:
-    switch ((ExtractBits(code, 21, 22) << 5)|(ExtractBits(code, 26, 27) << 0)) {
-      case 0b0100001: PPC_DECODER_HIT(vpermwi128);
-    }
-    switch ((ExtractBits(code, 21, 23) << 4)|(ExtractBits(code, 26, 27) << 0)) {
-      case 0b1100001: PPC_DECODER_HIT(vpkd3d128);
-      case 0b1110001: PPC_DECODER_HIT(vrlimi128);
-    }
-    switch ((ExtractBits(code, 21, 27) << 0)) {
-      case 0b0100011: PPC_DECODER_HIT(vcfpsxws128);
-      case 0b0100111: PPC_DECODER_HIT(vcfpuxws128);
-      case 0b0101011: PPC_DECODER_HIT(vcsxwfp128);
-      case 0b0101111: PPC_DECODER_HIT(vcuxwfp128);
-      case 0b0110011: PPC_DECODER_HIT(vrfim128);
-      case 0b0110111: PPC_DECODER_HIT(vrfin128);
-      case 0b0111011: PPC_DECODER_HIT(vrfip128);
-      case 0b0111111: PPC_DECODER_HIT(vrfiz128);
-      case 0b1100011: PPC_DECODER_HIT(vrefp128);
-      case 0b1100111: PPC_DECODER_HIT(vrsqrtefp128);
-      case 0b1101011: PPC_DECODER_HIT(vexptefp128);
-      case 0b1101111: PPC_DECODER_HIT(vlogefp128);
-      case 0b1110011: PPC_DECODER_HIT(vspltw128);
-      case 0b1110111: PPC_DECODER_HIT(vspltisw128);
-      case 0b1111111: PPC_DECODER_HIT(vupkd3d128);
-    }
-    switch ((ExtractBits(code, 22, 24) << 3)|(ExtractBits(code, 27, 27) << 0)) {
-      case 0b000000: PPC_DECODER_HIT(vcmpeqfp128);
-      case 0b001000: PPC_DECODER_HIT(vcmpgefp128);
-      case 0b010000: PPC_DECODER_HIT(vcmpgtfp128);
-      case 0b011000: PPC_DECODER_HIT(vcmpbfp128);
-      case 0b100000: PPC_DECODER_HIT(vcmpequw128);
+  const auto& primary = ppc_decode_primary_table[code >> 26];
+  uint16_t opcode = primary.opcode;
+  if (opcode == kPPCDecodeExtended) {
+    opcode = ppc_decode_extended_table[primary.extended_offset +
+                                       ((code >> primary.extended_shift) &
+                                        primary.extended_mask)];
+    if (opcode & kPPCDecodeCollision) {
+      // The list ends with an entry that always matches.
+      auto collision =
+          &ppc_decode_collision_table[opcode & ~kPPCDecodeCollision];
+      while ((code & collision->mask) != collision->value) {
+        ++collision;
+      }
+      opcode = collision->opcode;
     }
-    switch ((ExtractBits(code, 22, 25) << 2)|(ExtractBits(code, 27, 27) << 0)) {
-      case 0b000101: PPC_DECODER_HIT(vrlw128);
-      case 0b001101: PPC_DECODER_HIT(vslw128);
-      case 0b010101: PPC_DECODER_HIT(vsraw128);
-      case 0b011101: PPC_DECODER_HIT(vsrw128);
-      case 0b101000: PPC_DECODER_HIT(vmaxfp128);
-      case 0b101100: PPC_DECODER_HIT(vminfp128);
-      case 0b110000: PPC_DECODER_HIT(vmrghw128);
-      case 0b110100: PPC_DECODER_HIT(vmrglw128);
-      case 0b111000: PPC_DECODER_HIT(vupkhsb128);
-      case 0b111100: PPC_DECODER_HIT(vupklsb128);
-    }
-    PPC_DECODER_MISS;
-  case 7: PPC_DECODER_HIT(mulli);
-  case 8: PPC_DECODER_HIT(subficx);
-  case 10: PPC_DECODER_HIT(cmpli);
-  case 11: PPC_DECODER_HIT(cmpi);
-  case 12: PPC_DECODER_HIT(addic);
-  case 13: PPC_DECODER_HIT(addicx);
-  case 14: PPC_DECODER_HIT(addi);
-  case 15: PPC_DECODER_HIT(addis);
-  case 16: PPC_DECODER_HIT(bcx);
-  case 17: PPC_DECODER_HIT(sc);
-  case 18: PPC_DECODER_HIT(bx);
-  case 19:
-    switch ((ExtractBits(code, 21, 30) << 0)) {
-      case 0b0000000000: PPC_DECODER_HIT(mcrf);
-      case 0b0000010000: PPC_DECODER_HIT(bclrx);
-      case 0b0000100001: PPC_DECODER_HIT(crnor);
-      case 0b0010000001: PPC_DECODER_HIT(crandc);
-      case 0b0010010110: PPC_DECODER_HIT(isync);
-      case 0b0011000001: PPC_DECODER_HIT(crxor);
-      case 0b0011100001: PPC_DECODER_HIT(crnand);
-      case 0b0100000001: PPC_DECODER_HIT(crand);
-      case 0b0100100001: PPC_DECODER_HIT(creqv);
-      case 0b0110100001: PPC_DECODER_HIT(crorc);
-      case 0b0111000001: PPC_DECODER_HIT(cror);
-      case 0b1000010000: PPC_DECODER_HIT(bcctrx);
-    }
-    PPC_DECODER_MISS;
-  case 20: PPC_DECODER_HIT(rlwimix);
-  case 21: PPC_DECODER_HIT(rlwinmx);
-  case 23: PPC_DECODER_HIT(rlwnmx);
-  case 24: PPC_DECODER_HIT(ori);
-  case 25: PPC_DECODER_HIT(oris);
-  case 26: PPC_DECODER_HIT(xori);
-  case 27: PPC_DECODER_HIT(xoris);
-  case 28: PPC_DECODER_HIT(andix);
-  case 29: PPC_DECODER_HIT(andisx);
-  case 30:
-    switch ((ExtractBits(code, 27, 29) << 0)) {
-      case 0b000: PPC_DECODER_HIT(rldiclx);
-      case 0b001: PPC_DECODER_HIT(rldicrx);
-      case 0b010: PPC_DECODER_HIT(rldicx);
-      case 0b011: PPC_DECODER_HIT(rldimix);
-    }
-    switch ((ExtractBits(code, 27, 30) << 0)) {
-      case 0b1000: PPC_DECODER_HIT(rldclx);
-      case 0b1001: PPC_DECODER_HIT(rldcrx);
-    }
-    PPC_DECODER_MISS;
-  case 31:
-    switch ((ExtractBits(code, 21, 29) << 0)) {
-      case 0b110011101: PPC_DECODER_HIT(sradix);
-    }
-    switch ((ExtractBits(code, 21, 30) << 0)) {
-      case 0b0000000000: PPC_DECODER_HIT(cmp);
-      case 0b0000000100: PPC_DECODER_HIT(tw);
-      case 0b0000000110: PPC_DECODER_HIT(lvsl);
-      case 0b0000000111: PPC_DECODER_HIT(lvebx);
-      case 0b0000010011: PPC_DECODER_HIT(mfcr);
-      case 0b0000010100: PPC_DECODER_HIT(lwarx);
-      case 0b0000010101: PPC_DECODER_HIT(ldx);
-      case 0b0000010111: PPC_DECODER_HIT(lwzx);
-      case 0b0000011000: PPC_DECODER_HIT(slwx);
-      case 0b0000011010: PPC_DECODER_HIT(cntlzwx);
-      case 0b0000011011: PPC_DECODER_HIT(sldx);
-      case 0b0000011100: PPC_DECODER_HIT(andx);
-      case 0b0000100000: PPC_DECODER_HIT(cmpl);
-      case 0b0000100110: PPC_DECODER_HIT(lvsr);
-      case 0b0000100111: PPC_DECODER_HIT(lvehx);
-      case 0b0000110101: PPC_DECODER_HIT(ldux);
-      case 0b0000110110: PPC_DECODER_HIT(dcbst);
-      case 0b0000110111: PPC_DECODER_HIT(lwzux);
-      case 0b0000111010: PPC_DECODER_HIT(cntlzdx);
-      case 0b0000111100: PPC_DECODER_HIT(andcx);
-      case 0b0001000100: PPC_DECODER_HIT(td);
-      case 0b0001000111: PPC_DECODER_HIT(lvewx);
-      case 0b0001010011: PPC_DECODER_HIT(mfmsr);
-      case 0b0001010100: PPC_DECODER_HIT(ldarx);
-      case 0b0001010110: PPC_DECODER_HIT(dcbf);
-      case 0b0001010111: PPC_DECODER_HIT(lbzx);
-      case 0b0001100111: PPC_DECODER_HIT(lvx);
-      case 0b0001110111: PPC_DECODER_HIT(lbzux);
-      case 0b0001111100: PPC_DECODER_HIT(norx);
-      case 0b0010000111: PPC_DECODER_HIT(stvebx);
-      case 0b0010010000: PPC_DECODER_HIT(mtcrf);
-      case 0b0010010010: PPC_DECODER_HIT(mtmsr);
-      case 0b0010010101: PPC_DECODER_HIT(stdx);
-      case 0b0010010110: PPC_DECODER_HIT(stwcx);
-      case 0b0010010111: PPC_DECODER_HIT(stwx);
-      case 0b0010100111: PPC_DECODER_HIT(stvehx);
-      case 0b0010110010: PPC_DECODER_HIT(mtmsrd);
-      case 0b0010110101: PPC_DECODER_HIT(stdux);
-      case 0b0010110111: PPC_DECODER_HIT(stwux);
-      case 0b0011000111: PPC_DECODER_HIT(stvewx);
-      case 0b0011010110: PPC_DECODER_HIT(stdcx);
-      case 0b0011010111: PPC_DECODER_HIT(stbx);
-      case 0b0011100111: PPC_DECODER_HIT(stvx);
-      case 0b0011110110: PPC_DECODER_HIT(dcbtst);
-      case 0b0011110111: PPC_DECODER_HIT(stbux);
-      case 0b0100010110: PPC_DECODER_HIT(dcbt);
-      case 0b0100010111: PPC_DECODER_HIT(lhzx);
-      case 0b0100011100: PPC_DECODER_HIT(eqvx);
-      case 0b0100110111: PPC_DECODER_HIT(lhzux);
-      case 0b0100111100: PPC_DECODER_HIT(xorx);
-      case 0b0101010011: PPC_DECODER_HIT(mfspr);
-      case 0b0101010101: PPC_DECODER_HIT(lwax);
-      case 0b0101010111: PPC_DECODER_HIT(lhax);
-      case 0b0101100111: PPC_DECODER_HIT(lvxl);
-      case 0b0101110011: PPC_DECODER_HIT(mftb);
-      case 0b0101110101: PPC_DECODER_HIT(lwaux);
-      case 0b0101110111: PPC_DECODER_HIT(lhaux);
-      case 0b0110010111: PPC_DECODER_HIT(sthx);
-      case 0b0110011100: PPC_DECODER_HIT(orcx);
-      case 0b0110110111: PPC_DECODER_HIT(sthux);
-      case 0b0110111100: PPC_DECODER_HIT(orx);
-      case 0b0111010011: PPC_DECODER_HIT(mtspr);
-      case 0b0111010110: PPC_DECODER_HIT(dcbi);
-      case 0b0111011100: PPC_DECODER_HIT(nandx);
-      case 0b0111100111: PPC_DECODER_HIT(stvxl);
-      case 0b1000000000: PPC_DECODER_HIT(mcrxr);
-      case 0b1000000111: PPC_DECODER_HIT(lvlx);
-      case 0b1000010100: PPC_DECODER_HIT(ldbrx);
-      case 0b1000010101: PPC_DECODER_HIT(lswx);
-      case 0b1000010110: PPC_DECODER_HIT(lwbrx);
-      case 0b1000010111: PPC_DECODER_HIT(lfsx);
-      case 0b1000011000: PPC_DECODER_HIT(srwx);
-      case 0b1000011011: PPC_DECODER_HIT(srdx);
-      case 0b1000100111: PPC_DECODER_HIT(lvrx);
-      case 0b1000110111: PPC_DECODER_HIT(lfsux);
-      case 0b1001010101: PPC_DECODER_HIT(lswi);
-      case 0b1001010110: PPC_DECODER_HIT(sync);
-      case 0b1001010111: PPC_DECODER_HIT(lfdx);
-      case 0b1001110111: PPC_DECODER_HIT(lfdux);
-      case 0b1010000111: PPC_DECODER_HIT(stvlx);
-      case 0b1010010100: PPC_DECODER_HIT(stdbrx);
-      case 0b1010010101: PPC_DECODER_HIT(stswx);
-      case 0b1010010110: PPC_DECODER_HIT(stwbrx);
-      case 0b1010010111: PPC_DECODER_HIT(stfsx);
-      case 0b1010100111: PPC_DECODER_HIT(stvrx);
-      case 0b1010110111: PPC_DECODER_HIT(stfsux);
-      case 0b1011010101: PPC_DECODER_HIT(stswi);
-      case 0b1011010111: PPC_DECODER_HIT(stfdx);
-      case 0b1011110111: PPC_DECODER_HIT(stfdux);
-      case 0b1100000111: PPC_DECODER_HIT(lvlxl);
-      case 0b1100010110: PPC_DECODER_HIT(lhbrx);
-      case 0b1100011000: PPC_DECODER_HIT(srawx);
-      case 0b1100011010: PPC_DECODER_HIT(sradx);
-      case 0b1100100111: PPC_DECODER_HIT(lvrxl);
-      case 0b1100111000: PPC_DECODER_HIT(srawix);
-      case 0b1101010110: PPC_DECODER_HIT(eieio);
-      case 0b1110000111: PPC_DECODER_HIT(stvlxl);
-      case 0b1110010110: PPC_DECODER_HIT(sthbrx);
-      case 0b1110011010: PPC_DECODER_HIT(extshx);
-      case 0b1110100111: PPC_DECODER_HIT(stvrxl);
-      case 0b1110111010: PPC_DECODER_HIT(extsbx);
-      case 0b1111010110: PPC_DECODER_HIT(icbi);
-      case 0b1111010111: PPC_DECODER_HIT(stfiwx);
-      case 0b1111011010: PPC_DECODER_HIT(extswx);
-    }
-    switch ((ExtractBits(code, 22, 30) << 0)) {
-      case 0b000001000: PPC_DECODER_HIT(subfcx);
-      case 0b000001001: PPC_DECODER_HIT(mulhdux);
-      case 0b000001010: PPC_DECODER_HIT(addcx);
-      case 0b000001011: PPC_DECODER_HIT(mulhwux);
-      case 0b000101000: PPC_DECODER_HIT(subfx);
-      case 0b001001001: PPC_DECODER_HIT(mulhdx);
-      case 0b001001011: PPC_DECODER_HIT(mulhwx);
-      case 0b001101000: PPC_DECODER_HIT(negx);
-      case 0b010001000: PPC_DECODER_HIT(subfex);
-      case 0b010001010: PPC_DECODER_HIT(addex);
-      case 0b011001000: PPC_DECODER_HIT(subfzex);
-      case 0b011001010: PPC_DECODER_HIT(addzex);
-      case 0b011101000: PPC_DECODER_HIT(subfmex);
-      case 0b011101001: PPC_DECODER_HIT(mulldx);
-      case 0b011101010: PPC_DECODER_HIT(addmex);
-      case 0b011101011: PPC_DECODER_HIT(mullwx);
-      case 0b100001010: PPC_DECODER_HIT(addx);
-      case 0b111001001: PPC_DECODER_HIT(divdux);
-      case 0b111001011: PPC_DECODER_HIT(divwux);
-      case 0b111101001: PPC_DECODER_HIT(divdx);
-      case 0b111101011: PPC_DECODER_HIT(divwx);
-    }
-    switch ((ExtractBits(code, 6, 10) << 20)|(ExtractBits(code, 21, 30) << 0)) {
-      case 0b0000000000000001111110110: PPC_DECODER_HIT(dcbz);
-      case 0b0000100000000001111110110: PPC_DECODER_HIT(dcbz128);
-    }
-    PPC_DECODER_MISS;
-  case 32: PPC_DECODER_HIT(lwz);
-  case 33: PPC_DECODER_HIT(lwzu);
-  case 34: PPC_DECODER_HIT(lbz);
-  case 35: PPC_DECODER_HIT(lbzu);
-  case 36: PPC_DECODER_HIT(stw);
-  case 37: PPC_DECODER_HIT(stwu);
-  case 38: PPC_DECODER_HIT(stb);
-  case 39: PPC_DECODER_HIT(stbu);
-  case 40: PPC_DECODER_HIT(lhz);
-  case 41: PPC_DECODER_HIT(lhzu);
-  case 42: PPC_DECODER_HIT(lha);
-  case 43: PPC_DECODER_HIT(lhau);
-  case 44: PPC_DECODER_HIT(sth);
-  case 45: PPC_DECODER_HIT(sthu);
-  case 46: PPC_DECODER_HIT(lmw);
-  case 47: PPC_DECODER_HIT(stmw);
-  case 48: PPC_DECODER_HIT(lfs);
-  case 49: PPC_DECODER_HIT(lfsu);
-  case 50: PPC_DECODER_HIT(lfd);
-  case 51: PPC_DECODER_HIT(lfdu);
-  case 52: PPC_DECODER_HIT(stfs);
-  case 53: PPC_DECODER_HIT(stfsu);
-  case 54: PPC_DECODER_HIT(stfd);
-  case 55: PPC_DECODER_HIT(stfdu);
-  case 58:
-    switch ((ExtractBits(code, 30, 31) << 0)) {
-      case 0b00: PPC_DECODER_HIT(ld);
-      case 0b01: PPC_DECODER_HIT(ldu);
-      case 0b10: PPC_DECODER_HIT(lwa);
-    }
-    PPC_DECODER_MISS;
-  case 59:
-    switch ((ExtractBits(code, 26, 30) << 0)) {
-      case 0b10010: PPC_DECODER_HIT(fdivsx);
-      case 0b10100: PPC_DECODER_HIT(fsubsx);
-      case 0b10101: PPC_DECODER_HIT(faddsx);
-      case 0b10110: PPC_DECODER_HIT(fsqrtsx);
-      case 0b11000: PPC_DECODER_HIT(fresx);
-      case 0b11001: PPC_DECODER_HIT(fmulsx);
-      case 0b11100: PPC_DECODER_HIT(fmsubsx);
-      case 0b11101: PPC_DECODER_HIT(fmaddsx);
-      case 0b11110: PPC_DECODER_HIT(fnmsubsx);
-      case 0b11111: PPC_DECODER_HIT(fnmaddsx);
-    }
-    PPC_DECODER_MISS;
-  case 62:
-    switch ((ExtractBits(code, 30, 31) << 0)) {
-      case 0b00: PPC_DECODER_HIT(std);
-      case 0b01: PPC_DECODER_HIT(stdu);
-    }
-    PPC_DECODER_MISS;
-  case 63:
-    switch ((ExtractBits(code, 21, 30) << 0)) {
-      case 0b0000000000: PPC_DECODER_HIT(fcmpu);
-      case 0b0000001100: PPC_DECODER_HIT(frspx);
-      case 0b0000001110: PPC_DECODER_HIT(fctiwx);
-      case 0b0000001111: PPC_DECODER_HIT(fctiwzx);
-      case 0b0000100000: PPC_DECODER_HIT(fcmpo);
-      case 0b0000100110: PPC_DECODER_HIT(mtfsb1x);
-      case 0b0000101000: PPC_DECODER_HIT(fnegx);
-      case 0b0001000000: PPC_DECODER_HIT(mcrfs);
-      case 0b0001000110: PPC_DECODER_HIT(mtfsb0x);
-      case 0b0001001000: PPC_DECODER_HIT(fmrx);
-      case 0b0010000110: PPC_DECODER_HIT(mtfsfix);
-      case 0b0010001000: PPC_DECODER_HIT(fnabsx);
-      case 0b0100001000: PPC_DECODER_HIT(fabsx);
-      case 0b1001000111: PPC_DECODER_HIT(mffsx);
-      case 0b1011000111: PPC_DECODER_HIT(mtfsfx);
-      case 0b1100101110: PPC_DECODER_HIT(fctidx);
-      case 0b1100101111: PPC_DECODER_HIT(fctidzx);
-      case 0b1101001110: PPC_DECODER_HIT(fcfidx);
-    }
-    switch ((ExtractBits(code, 26, 30) << 0)) {
-      case 0b10010: PPC_DECODER_HIT(fdivx);
-      case 0b10100: PPC_DECODER_HIT(fsubx);
-      case 0b10101: PPC_DECODER_HIT(faddx);
-      case 0b10110: PPC_DECODER_HIT(fsqrtx);
-      case 0b10111: PPC_DECODER_HIT(fselx);
-      case 0b11001: PPC_DECODER_HIT(fmulx);
-      case 0b11010: PPC_DECODER_HIT(frsqrtex);
-      case 0b11100: PPC_DECODER_HIT(fmsubx);
-      case 0b11101: PPC_DECODER_HIT(fmaddx);
-      case 0b11110: PPC_DECODER_HIT(fnmsubx);
-      case 0b11111: PPC_DECODER_HIT(fnmaddx);
-    }
-    PPC_DECODER_MISS;
-  default: PPC_DECODER_MISS;
   }
+  if (opcode == static_cast<uint16_t>(PPCOpcode::kInvalid)) {
+    assert_always();
+  }
+  return static_cast<PPCOpcode>(opcode);
 }
 
 }  // namespace ppc
@@ -138,8 +138,8 @@ bool PPCScanner::Scan(GuestFunction* function, FunctionDebugInfo* debug_info) {
       uint32_t target = d.I.ADDR();
       if (d.I.LK()) {
         LOGPPC("bl %.8X -> %.8X", address, target);
-        // Queue call target if needed.
-        // GetOrInsertFunction(target);
+        // Queue call target so it's (hopefully) ready by the time we get there.
+        frontend_->processor()->QueueFunction(target);
       } else {
         LOGPPC("b %.8X -> %.8X", address, target);
 
@@ -11,8 +11,14 @@
 
 #include <gflags/gflags.h>
 
+#include <algorithm>
+#include <memory>
+#include <utility>
+#include <vector>
+
 #include "xenia/base/assert.h"
 #include "xenia/base/byte_order.h"
+#include "xenia/base/clock.h"
 #include "xenia/base/memory.h"
 #include "xenia/base/profiling.h"
 #include "xenia/base/reset_scope.h"
@@ -67,15 +73,25 @@ PPCTranslator::PPCTranslator(PPCFrontend* frontend) : frontend_(frontend) {
   }
   compiler_->AddPass(std::make_unique<passes::SimplificationPass>());
   if (validate) compiler_->AddPass(std::make_unique<passes::ValidationPass>());
-  // compiler_->AddPass(std::make_unique<passes::DeadStoreEliminationPass>());
-  // if (validate)
-  // compiler_->AddPass(std::make_unique<passes::ValidationPass>());
+  if (FLAGS_eliminate_dead_stores) {
+    compiler_->AddPass(std::make_unique<passes::DeadStoreEliminationPass>());
+    if (validate)
+      compiler_->AddPass(std::make_unique<passes::ValidationPass>());
+  }
   compiler_->AddPass(std::make_unique<passes::DeadCodeEliminationPass>());
   if (validate) compiler_->AddPass(std::make_unique<passes::ValidationPass>());
+  if (FLAGS_detect_spin_loops) {
+    compiler_->AddPass(std::make_unique<passes::SpinLoopDetectionPass>());
+    if (validate)
+      compiler_->AddPass(std::make_unique<passes::ValidationPass>());
+  }
 
-  //// Removes all unneeded variables. Try not to add new ones after this.
-  // compiler_->AddPass(new passes::ValueReductionPass());
-  // if (validate) compiler_->AddPass(new passes::ValidationPass());
+  // Removes all unneeded variables. Try not to add new ones after this.
+  if (FLAGS_reduce_values) {
+    compiler_->AddPass(std::make_unique<passes::ValueReductionPass>());
+    if (validate)
+      compiler_->AddPass(std::make_unique<passes::ValidationPass>());
+  }
 
   // Register allocation for the target backend.
   // Will modify the HIR to add loads/stores.
@@ -87,10 +103,44 @@ PPCTranslator::PPCTranslator(PPCFrontend* frontend) : frontend_(frontend) {
 
   // Must come last. The HIR is not really HIR after this.
   compiler_->AddPass(std::make_unique<passes::FinalizationPass>());
+
+  // Baseline tier: only what is required to lower the HIR. Used for quick
+  // first translations that are recompiled by the above once hot.
+  baseline_compiler_.reset(new Compiler(frontend->processor()));
+  if (validate) {
+    baseline_compiler_->AddPass(std::make_unique<passes::ValidationPass>());
+  }
+  baseline_compiler_->AddPass(std::make_unique<passes::RegisterAllocationPass>(
+      backend->machine_info()));
+  if (validate) {
+    baseline_compiler_->AddPass(std::make_unique<passes::ValidationPass>());
+  }
+  baseline_compiler_->AddPass(std::make_unique<passes::FinalizationPass>());
 }
 
 PPCTranslator::~PPCTranslator() = default;
 
+void PPCTranslator::set_stats_enabled(bool enabled) {
+  stats_enabled_ = enabled;
+  compiler_->set_stats_enabled(enabled);
+  baseline_compiler_->set_stats_enabled(enabled);
+}
+
+void PPCTranslator::ResetStats() {
+  stats_ = Stats();
+  compiler_->ResetStats();
+  baseline_compiler_->ResetStats();
+}
+
+void PPCTranslator::AccumulateStatsTicks(uint64_t* ticks) {
+  if (!stats_enabled_) {
+    return;
+  }
+  uint64_t now = Clock::QueryHostTickCount();
+  *ticks += now - stats_last_tick_;
+  stats_last_tick_ = now;
+}
+
 bool PPCTranslator::Translate(GuestFunction* function,
                               uint32_t debug_info_flags) {
   SCOPE_profile_cpu_f("cpu");
@@ -98,6 +148,7 @@ bool PPCTranslator::Translate(GuestFunction* function,
   // Reset() all caching when we leave.
   xe::make_reset_scope(builder_);
   xe::make_reset_scope(compiler_);
+  xe::make_reset_scope(baseline_compiler_);
   xe::make_reset_scope(assembler_);
   xe::make_reset_scope(&string_buffer_);
 
@@ -117,15 +168,36 @@ bool PPCTranslator::Translate(GuestFunction* function,
   if (FLAGS_trace_function_data) {
     debug_info_flags |= DebugInfoFlags::kDebugInfoTraceFunctionData;
   }
+  if (FLAGS_trace_block_coverage) {
+    debug_info_flags |= DebugInfoFlags::kDebugInfoTraceBlockCoverage;
+  }
   std::unique_ptr<FunctionDebugInfo> debug_info;
   if (debug_info_flags) {
     debug_info.reset(new FunctionDebugInfo());
+    // Debug info should describe the code that sticks around.
+    function->set_tier(GuestFunction::Tier::kOptimized);
+  }
+
+  if (stats_enabled_) {
+    stats_last_tick_ = Clock::QueryHostTickCount();
   }
 
   // Scan the function to find its extents and gather debug data.
   if (!scanner_->Scan(function, debug_info.get())) {
     return false;
   }
+  AccumulateStatsTicks(&stats_.scan_ticks);
+  // Watched before the code is read for translation, or a write made while
+  // translating would go unnoticed.
+  frontend_->processor()->WatchFunctionCode(function);
+
+  // Reuse code from a previous run if the backend has it cached and the
+  // source is unchanged. Debug info requires a full translation.
+  if (!debug_info_flags && assembler_->AssembleFromCache(function)) {
+    // Cached code is always fully optimized.
+    function->set_tier(GuestFunction::Tier::kOptimized);
+    return true;
+  }
 
   // Setup trace data, if needed.
   if (debug_info_flags & DebugInfoFlags::kDebugInfoTraceFunctions) {
@@ -147,6 +219,19 @@ bool PPCTranslator::Translate(GuestFunction* function,
                             DebugInfoFlags::kDebugInfoTraceFunctionCoverage);
     }
   }
+  if (debug_info_flags & DebugInfoFlags::kDebugInfoTraceBlockCoverage) {
+    size_t coverage_size = FunctionBlockCoverage::SizeOf(
+        function->address(), function->end_address());
+    uint8_t* coverage_data =
+        frontend_->processor()->AllocateBlockCoverageData(coverage_size);
+    if (coverage_data) {
+      function->block_coverage().Reset(coverage_data, coverage_size,
+                                       function->address(),
+                                       function->end_address());
+    } else {
+      debug_info_flags &= ~DebugInfoFlags::kDebugInfoTraceBlockCoverage;
+    }
+  }
 
   // Stash source.
   if (debug_info_flags & DebugInfoFlags::kDebugInfoDisasmSource) {
@@ -163,6 +248,7 @@ bool PPCTranslator::Translate(GuestFunction* function,
   if (!builder_->Emit(function, emit_flags)) {
     return false;
   }
+  AccumulateStatsTicks(&stats_.emit_ticks);
 
   // Stash raw HIR.
   if (debug_info_flags & DebugInfoFlags::kDebugInfoDisasmRawHir) {
@@ -172,9 +258,16 @@ bool PPCTranslator::Translate(GuestFunction* function,
   }
 
   // Compile/optimize/etc.
-  if (!compiler_->Compile(builder_.get())) {
+  auto function_compiler = compiler(function->tier());
+  if (!function_compiler->Compile(builder_.get())) {
     return false;
   }
+  // Recorded before the code can run, so that changes to the callees after
+  // this reach it.
+  for (auto callee : function_compiler->summarized_callees()) {
+    frontend_->processor()->AddInlinedCall(function, callee);
+  }
+  AccumulateStatsTicks(&stats_.compile_ticks);
 
   // Stash optimized HIR.
   if (debug_info_flags & DebugInfoFlags::kDebugInfoDisasmHir) {
@@ -188,10 +281,120 @@ bool PPCTranslator::Translate(GuestFunction* function,
                             std::move(debug_info))) {
     return false;
   }
+  AccumulateStatsTicks(&stats_.assemble_ticks);
+  SummarizeContextUsage(function);
+  ++stats_.function_count;
 
   return true;
 }
 
+void PPCTranslator::SummarizeContextUsage(GuestFunction* function) {
+  // Code that went stale while translating was never installed.
+  if (!FLAGS_summarize_call_context || function->is_invalidated()) {
+    return;
+  }
+  std::vector<bool> reads(sizeof(PPCContext));
+  std::vector<bool> writes(sizeof(PPCContext));
+  auto mark = [](std::vector<bool>* bytes, uint32_t begin, uint32_t end) {
+    std::fill(bytes->begin() + begin, bytes->begin() + end, true);
+  };
+  auto processor = frontend_->processor();
+  for (auto block = builder_->first_block(); block; block = block->next) {
+    for (auto i = block->instr_head; i; i = i->next) {
+      if (i->opcode == &hir::OPCODE_LOAD_CONTEXT_info) {
+        auto offset = static_cast<uint32_t>(i->src1.offset);
+        mark(&reads, offset,
+             offset + static_cast<uint32_t>(GetTypeSize(i->dest->type)));
+      } else if (i->opcode == &hir::OPCODE_STORE_CONTEXT_info) {
+        auto offset = static_cast<uint32_t>(i->src1.offset);
+        mark(&writes, offset,
+             offset + static_cast<uint32_t>(GetTypeSize(i->src2.value->type)));
+      } else if (i->opcode == &hir::OPCODE_CALL_info ||
+                 i->opcode == &hir::OPCODE_CALL_TRUE_info) {
+        // Tail calls included, as they're still within this function's call.
+        Function* symbol = i->opcode == &hir::OPCODE_CALL_info
+                               ? i->src1.symbol
+                               : i->src2.symbol;
+        auto callee = symbol && symbol->is_guest()
+                          ? static_cast<GuestFunction*>(symbol)
+                          : nullptr;
+        auto callee_usage = callee ? callee->context_usage() : nullptr;
+        if (!callee_usage) {
+          // Calls to itself are unknown too, as it has no usage yet.
+          return;
+        }
+        for (auto& range : callee_usage->reads) {
+          mark(&reads, range.first, range.second);
+        }
+        for (auto& range : callee_usage->writes) {
+          mark(&writes, range.first, range.second);
+        }
+        // Callers compiled against this usage depend on the callee's too.
+        processor->AddInlinedCall(function, callee);
+      } else if (i->opcode->flags & hir::OPCODE_FLAG_VOLATILE &&
+                 i->opcode != &hir::OPCODE_BRANCH_TRUE_info &&
+                 i->opcode != &hir::OPCODE_BRANCH_FALSE_info &&
+                 i->opcode != &hir::OPCODE_RETURN_info &&
+                 i->opcode != &hir::OPCODE_RETURN_TRUE_info &&
+                 i->opcode != &hir::OPCODE_MEMORY_BARRIER_info &&
+                 i->opcode != &hir::OPCODE_ATOMIC_EXCHANGE_info &&
+                 i->opcode != &hir::OPCODE_ATOMIC_COMPARE_EXCHANGE_info) {
+        // May leave guest code, which can do anything to the context.
+        return;
+      } else if (i->opcode == &hir::OPCODE_CONTEXT_BARRIER_info) {
+        return;
+      }
+    }
+  }
+
+  auto to_ranges = [](const std::vector<bool>& bytes) {
+    std::vector<std::pair<uint32_t, uint32_t>> ranges;
+    for (uint32_t n = 0; n < bytes.size(); ++n) {
+      if (!bytes[n]) {
+        continue;
+      }
+      if (!ranges.empty() && ranges.back().second == n) {
+        ranges.back().second = n + 1;
+      } else {
+        ranges.emplace_back(n, n + 1);
+      }
+    }
+    return ranges;
+  };
+  auto usage = std::make_shared<ContextUsage>();
+  usage->reads = to_ranges(reads);
+  usage->writes = to_ranges(writes);
+
+  // Callers may already rely on an earlier translation touching no more than
+  // it did, so the usage may only shrink. Invalidation clears it when the
+  // code itself changes.
+  auto old_usage = function->context_usage();
+  if (old_usage) {
+    auto covered = [](const std::vector<std::pair<uint32_t, uint32_t>>& small,
+                      const std::vector<std::pair<uint32_t, uint32_t>>& big) {
+      for (auto& range : small) {
+        bool found = false;
+        for (auto& big_range : big) {
+          if (big_range.first <= range.first &&
+              range.second <= big_range.second) {
+            found = true;
+            break;
+          }
+        }
+        if (!found) {
+          return false;
+        }
+      }
+      return true;
+    };
+    if (!covered(usage->reads, old_usage->reads) ||
+        !covered(usage->writes, old_usage->writes)) {
+      return;
+    }
+  }
+  function->set_context_usage(std::move(usage));
+}
+
 void PPCTranslator::DumpSource(GuestFunction* function,
                                StringBuffer* string_buffer) {
   Memory* memory = frontend_->memory();
@@ -30,18 +30,49 @@ class PPCTranslator {
   explicit PPCTranslator(PPCFrontend* frontend);
   ~PPCTranslator();
 
+  // Accumulated cost of each translation phase, for benchmarking the
+  // translator. Per-pass detail is kept by the compilers themselves.
+  struct Stats {
+    uint64_t function_count = 0;
+    uint64_t scan_ticks = 0;
+    uint64_t emit_ticks = 0;
+    uint64_t compile_ticks = 0;
+    uint64_t assemble_ticks = 0;
+  };
+
   bool Translate(GuestFunction* function, uint32_t debug_info_flags);
 
+  // The compiler used to translate functions of the given tier.
+  compiler::Compiler* compiler(GuestFunction::Tier tier) const {
+    return tier == GuestFunction::Tier::kBaseline ? baseline_compiler_.get()
+                                                  : compiler_.get();
+  }
+
+  bool stats_enabled() const { return stats_enabled_; }
+  // Also enables per-pass stats in both compilers.
+  void set_stats_enabled(bool enabled);
+  const Stats& stats() const { return stats_; }
+  void ResetStats();
+
  private:
   void DumpSource(GuestFunction* function, StringBuffer* string_buffer);
+  void AccumulateStatsTicks(uint64_t* ticks);
+  // Records what the compiled HIR of the function does to the context, for
+  // the functions calling it to be compiled against.
+  void SummarizeContextUsage(GuestFunction* function);
 
   PPCFrontend* frontend_;
   std::unique_ptr<PPCScanner> scanner_;
   std::unique_ptr<PPCHIRBuilder> builder_;
   std::unique_ptr<compiler::Compiler> compiler_;
+  std::unique_ptr<compiler::Compiler> baseline_compiler_;
   std::unique_ptr<backend::Assembler> assembler_;
 
   StringBuffer string_buffer_;
+
+  bool stats_enabled_ = false;
+  uint64_t stats_last_tick_ = 0;
+  Stats stats_;
 };
 
 }  // namespace ppc
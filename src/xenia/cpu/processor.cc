@@ -11,10 +11,14 @@
 
 #include <gflags/gflags.h>
 
+#include <algorithm>
+
 #include "xenia/base/assert.h"
 #include "xenia/base/atomic.h"
 #include "xenia/base/byte_order.h"
 #include "xenia/base/byte_stream.h"
+#include "xenia/base/clock.h"
+#include "xenia/base/counters.h"
 #include "xenia/base/debugging.h"
 #include "xenia/base/exception_handler.h"
 #include "xenia/base/logging.h"
@@ -46,8 +50,14 @@
 DEFINE_bool(debug, DEFAULT_DEBUG_FLAG,
             "Allow debugging and retain debug information.");
 DEFINE_string(trace_function_data_path, "", "File to write trace data to.");
+DEFINE_string(trace_block_coverage_path, "",
+              "File to write block coverage to, merged across runs with "
+              "tools/merge-block-coverage.");
 DEFINE_bool(break_on_start, false, "Break into the debugger on startup.");
 
+DEFINE_counter(jit_compiles, "cpu.jit_compiles");
+DEFINE_counter(code_invalidations, "cpu.code_invalidations");
+
 namespace xe {
 namespace cpu {
 
@@ -78,8 +88,23 @@ Processor::Processor(xe::Memory* memory, ExportResolver* export_resolver)
     : memory_(memory), export_resolver_(export_resolver) {}
 
 Processor::~Processor() {
+  if (sampling_profiler_) {
+    sampling_profiler_->Stop();
+    if (!FLAGS_profile_guest_code_path.empty()) {
+      sampling_profiler_->DumpToFile(
+          xe::to_wstring(FLAGS_profile_guest_code_path));
+    }
+    sampling_profiler_.reset();
+  }
+
+  ShutdownCompileThreads();
+
   {
     auto global_lock = global_critical_region_.Acquire();
+    for (auto& it : code_watches_) {
+      memory_->CancelAccessWatch(it.second.handle);
+    }
+    code_watches_.clear();
     modules_.clear();
   }
 
@@ -90,6 +115,10 @@ Processor::~Processor() {
     functions_trace_file_->Flush();
     functions_trace_file_.reset();
   }
+  if (block_coverage_file_) {
+    block_coverage_file_->Flush();
+    block_coverage_file_.reset();
+  }
 }
 
 bool Processor::Setup() {
@@ -150,6 +179,22 @@ bool Processor::Setup() {
       FLAGS_debug = false;
     }
   }
+  if (stack_walker_) {
+    sampling_profiler_ = std::make_unique<SamplingProfiler>(this);
+    if (FLAGS_profile_guest_code) {
+      sampling_profiler_->Start(uint32_t(FLAGS_profile_guest_code_interval));
+    }
+  } else if (FLAGS_profile_guest_code) {
+    XELOGW("Guest code profiling requires a stack walker");
+  }
+
+  // Spin up background translation, if requested.
+  for (int32_t i = 0; i < FLAGS_compile_threads; ++i) {
+    auto thread = xe::threading::Thread::Create(
+        {}, [this]() { CompileThreadMain(); });
+    thread->set_name("xe::cpu::Processor Compile " + std::to_string(i));
+    compile_threads_.push_back(std::move(thread));
+  }
 
   // Open the trace data path, if requested.
   functions_trace_path_ = xe::to_wstring(FLAGS_trace_function_data_path);
@@ -157,6 +202,11 @@ bool Processor::Setup() {
     functions_trace_file_ = ChunkedMappedMemoryWriter::Open(
         functions_trace_path_, 32 * 1024 * 1024, true);
   }
+  if (!FLAGS_trace_block_coverage_path.empty()) {
+    block_coverage_file_ = ChunkedMappedMemoryWriter::Open(
+        xe::to_wstring(FLAGS_trace_block_coverage_path), 32 * 1024 * 1024,
+        true);
+  }
 
   return true;
 }
@@ -237,27 +287,333 @@ Function* Processor::ResolveFunction(uint32_t address) {
     // Grab symbol declaration.
     auto function = LookupFunction(address);
     if (!function) {
-      entry->status = Entry::STATUS_FAILED;
+      entry_table_.Complete(entry, Entry::STATUS_FAILED);
       return nullptr;
     }
 
     if (!DemandFunction(function)) {
-      entry->status = Entry::STATUS_FAILED;
+      entry_table_.Complete(entry, Entry::STATUS_FAILED);
       return nullptr;
     }
     entry->function = function;
     entry->end_address = function->end_address();
-    status = entry->status = Entry::STATUS_READY;
+    entry_table_.Complete(entry, Entry::STATUS_READY);
+    status = Entry::STATUS_READY;
   }
   if (status == Entry::STATUS_READY) {
-    // Ready to use.
-    return entry->function;
+    // Ready to use, unless a write to its code left it stale, which may
+    // happen again while it is translated.
+    auto function = entry->function;
+    while (function->is_guest() &&
+           static_cast<GuestFunction*>(function)->is_invalidated()) {
+      auto guest_function = static_cast<GuestFunction*>(function);
+      if (!RedefineFunction(guest_function)) {
+        return nullptr;
+      }
+      entry->end_address = guest_function->end_address();
+    }
+    return function;
   } else {
     // Failed or bad state.
     return nullptr;
   }
 }
 
+void Processor::QueueFunction(uint32_t address) {
+  if ((compile_threads_.empty() && !precompiling_) ||
+      entry_table_.Contains(address)) {
+    return;
+  }
+  {
+    std::lock_guard<std::mutex> lock(compile_mutex_);
+    if (compile_shutdown_ || !compile_requested_.insert(address).second) {
+      return;
+    }
+    compile_queue_.push_back(address);
+  }
+  compile_cond_.notify_one();
+}
+
+void Processor::Precompile(const std::vector<uint32_t>& addresses) {
+  auto start_time = xe::Clock::QueryHostUptimeMillis();
+  size_t start_count;
+  {
+    std::lock_guard<std::mutex> lock(compile_mutex_);
+    start_count = compile_requested_.size();
+    precompiling_ = true;
+    for (auto address : addresses) {
+      if (!entry_table_.Contains(address) &&
+          compile_requested_.insert(address).second) {
+        compile_queue_.push_back(address);
+      }
+    }
+  }
+  compile_cond_.notify_all();
+
+  // Background compile threads (if any) help out, but all cores are used
+  // regardless as the guest isn't running yet.
+  std::vector<std::unique_ptr<xe::threading::Thread>> threads;
+  uint32_t thread_count = xe::threading::logical_processor_count();
+  for (uint32_t i = 0; i < std::max(1u, thread_count); ++i) {
+    auto thread = xe::threading::Thread::Create(
+        {}, [this]() { PrecompileThreadMain(); });
+    thread->set_name("xe::cpu::Processor Precompile " + std::to_string(i));
+    threads.push_back(std::move(thread));
+  }
+  for (auto& thread : threads) {
+    xe::threading::Wait(thread.get(), false);
+  }
+
+  size_t count;
+  {
+    std::lock_guard<std::mutex> lock(compile_mutex_);
+    precompiling_ = false;
+    count = compile_requested_.size() - start_count;
+  }
+  XELOGI("Precompiled %d functions in %dms", int(count),
+         int(xe::Clock::QueryHostUptimeMillis() - start_time));
+}
+
+void Processor::OnFunctionHot(GuestFunction* function) {
+  {
+    std::lock_guard<std::mutex> lock(compile_mutex_);
+    if (function->tier() != GuestFunction::Tier::kBaseline) {
+      // Another thread beat us to it.
+      return;
+    }
+    function->set_tier(GuestFunction::Tier::kOptimized);
+    if (!compile_threads_.empty()) {
+      if (!compile_shutdown_) {
+        optimize_queue_.push_back(function);
+        compile_cond_.notify_one();
+      }
+      return;
+    }
+  }
+  OptimizeFunction(function);
+}
+
+void Processor::RetranslateFunction(GuestFunction* function) {
+  std::lock_guard<std::mutex> lock(compile_mutex_);
+  if (compile_threads_.empty() || compile_shutdown_) {
+    return;
+  }
+  std::vector<GuestFunction*> functions;
+  CollectDependentFunctions(function, &functions);
+  for (auto queued_function : functions) {
+    if (std::find(optimize_queue_.begin(), optimize_queue_.end(),
+                  queued_function) != optimize_queue_.end()) {
+      continue;
+    }
+    // Baseline code that gets hot later won't queue it again.
+    queued_function->set_tier(GuestFunction::Tier::kOptimized);
+    optimize_queue_.push_back(queued_function);
+  }
+  compile_cond_.notify_all();
+}
+
+void Processor::AddInlinedCall(GuestFunction* caller, GuestFunction* callee) {
+  std::lock_guard<std::mutex> lock(compile_mutex_);
+  auto callers = inlined_callers_.equal_range(callee);
+  for (auto it = callers.first; it != callers.second; ++it) {
+    if (it->second == caller) {
+      return;
+    }
+  }
+  inlined_callers_.emplace(callee, caller);
+}
+
+void Processor::CollectDependentFunctions(
+    GuestFunction* function, std::vector<GuestFunction*>* functions) {
+  // Callers of callers depend on it too, through the copies and summaries
+  // made from their callees.
+  functions->push_back(function);
+  for (size_t i = 0; i < functions->size(); ++i) {
+    auto callers = inlined_callers_.equal_range((*functions)[i]);
+    for (auto it = callers.first; it != callers.second; ++it) {
+      if (std::find(functions->begin(), functions->end(), it->second) ==
+          functions->end()) {
+        functions->push_back(it->second);
+      }
+    }
+  }
+}
+
+void Processor::OptimizeFunction(GuestFunction* function) {
+  // A retranslation of its changed code must not be replaced with code from
+  // before the change.
+  std::lock_guard<std::mutex> lock(redefine_mutex_);
+  if (function->is_invalidated()) {
+    // Its next call translates it again anyway.
+    return;
+  }
+  // Callers keep running the baseline code until the new code is installed,
+  // which the assembler skips if the code changed in the meantime.
+  if (!frontend_->DefineFunction(function, debug_info_flags_)) {
+    XELOGW("Unable to optimize function %.8X; keeping baseline code",
+           function->address());
+  }
+}
+
+void Processor::WatchFunctionCode(GuestFunction* function) {
+  if (!FLAGS_invalidate_code_on_write || function->extern_handler() ||
+      !function->has_end_address()) {
+    return;
+  }
+  auto global_lock = global_critical_region_.Acquire();
+  auto it = code_watches_.find(function);
+  if (it != code_watches_.end()) {
+    if (it->second.end_address == function->end_address()) {
+      return;
+    }
+    memory_->CancelAccessWatch(it->second.handle);
+    code_watches_.erase(it);
+  }
+  uintptr_t watch_handle = memory_->AddVirtualWriteWatch(
+      function->address(), function->end_address() - function->address() + 4,
+      CodeWriteCallback, this, function);
+  if (watch_handle) {
+    code_watches_[function] = {watch_handle, function->end_address()};
+  }
+}
+
+void Processor::CodeWriteCallback(void* context_ptr, void* data_ptr,
+                                  uint32_t address) {
+  auto processor = reinterpret_cast<Processor*>(context_ptr);
+  auto function = reinterpret_cast<GuestFunction*>(data_ptr);
+  // Watches only fire once.
+  processor->code_watches_.erase(function);
+  processor->InvalidateFunction(function);
+}
+
+void Processor::InvalidateFunction(GuestFunction* function) {
+  std::vector<GuestFunction*> functions;
+  {
+    std::lock_guard<std::mutex> lock(compile_mutex_);
+    CollectDependentFunctions(function, &functions);
+  }
+  auto global_lock = global_critical_region_.Acquire();
+  for (auto invalidated_function : functions) {
+    if (invalidated_function->is_invalidated()) {
+      continue;
+    }
+    invalidated_function->set_invalidated(true);
+    // The new code may touch anything, until it has been translated.
+    invalidated_function->set_context_usage(nullptr);
+    backend_->InvalidateFunction(invalidated_function);
+    INCREMENT_counter(code_invalidations, 1);
+  }
+}
+
+bool Processor::RedefineFunction(GuestFunction* function) {
+  std::lock_guard<std::mutex> lock(redefine_mutex_);
+  {
+    auto global_lock = global_critical_region_.Acquire();
+    if (!function->is_invalidated()) {
+      // Another thread got to it first.
+      return true;
+    }
+    // Watched again before translating, so that a write racing with the
+    // translation leaves the new code invalidated too. The translator
+    // replaces the watch if the extent changes.
+    function->set_invalidated(false);
+    WatchFunctionCode(function);
+  }
+
+  if (!frontend_->DefineFunction(function, debug_info_flags_)) {
+    XELOGE("Unable to translate function %.8X again after its code changed",
+           function->address());
+    return false;
+  }
+  INCREMENT_counter(jit_compiles, 1);
+  OnFunctionDefined(function);
+  return true;
+}
+
+void Processor::CompileThreadMain() {
+  while (true) {
+    uint32_t address;
+    {
+      std::unique_lock<std::mutex> lock(compile_mutex_);
+      compile_cond_.wait(lock, [this]() {
+        return compile_shutdown_ || !compile_queue_.empty() ||
+               !optimize_queue_.empty();
+      });
+      if (compile_shutdown_) {
+        return;
+      }
+      if (!optimize_queue_.empty()) {
+        // Hot functions go first, as they are what we are spending time in.
+        auto function = optimize_queue_.front();
+        optimize_queue_.pop_front();
+        lock.unlock();
+        OptimizeFunction(function);
+        if (backend_->HasReclaimableCode()) {
+          ReclaimCode();
+        }
+        continue;
+      }
+      address = compile_queue_.front();
+      compile_queue_.pop_front();
+      ++compile_active_;
+    }
+
+    // Translation places the code and updates the indirection table, after
+    // which guest calls go straight to it. If a guest thread already claimed
+    // the entry this waits for it (or returns the finished function).
+    ResolveFunction(address);
+
+    {
+      std::lock_guard<std::mutex> lock(compile_mutex_);
+      --compile_active_;
+    }
+    compile_cond_.notify_all();
+  }
+}
+
+void Processor::PrecompileThreadMain() {
+  while (true) {
+    uint32_t address;
+    {
+      std::unique_lock<std::mutex> lock(compile_mutex_);
+      compile_cond_.wait(lock, [this]() {
+        return compile_shutdown_ || !compile_queue_.empty() ||
+               !compile_active_;
+      });
+      if (compile_shutdown_ || compile_queue_.empty()) {
+        // Nothing is left in flight that could discover more work.
+        return;
+      }
+      address = compile_queue_.front();
+      compile_queue_.pop_front();
+      ++compile_active_;
+    }
+
+    // Scanning queues the call targets it finds, growing the set as we go.
+    ResolveFunction(address);
+
+    {
+      std::lock_guard<std::mutex> lock(compile_mutex_);
+      --compile_active_;
+    }
+    compile_cond_.notify_all();
+  }
+}
+
+void Processor::ShutdownCompileThreads() {
+  {
+    std::lock_guard<std::mutex> lock(compile_mutex_);
+    compile_shutdown_ = true;
+    compile_queue_.clear();
+    optimize_queue_.clear();
+  }
+  compile_cond_.notify_all();
+  for (auto& thread : compile_threads_) {
+    xe::threading::Wait(thread.get(), false);
+  }
+  compile_threads_.clear();
+}
+
 Function* Processor::LookupFunction(uint32_t address) {
   // TODO(benvanik): fast reject invalid addresses/log errors.
 
@@ -307,11 +663,16 @@ bool Processor::DemandFunction(Function* function) {
   if (symbol_status == Symbol::Status::kNew) {
     // Symbol is undefined, so define now.
     assert_true(function->is_guest());
-    if (!frontend_->DefineFunction(static_cast<GuestFunction*>(function),
-                                   debug_info_flags_)) {
+    auto guest_function = static_cast<GuestFunction*>(function);
+    if (FLAGS_tier_up_threshold > 0) {
+      guest_function->set_tier(GuestFunction::Tier::kBaseline);
+      guest_function->set_tier_up_countdown(FLAGS_tier_up_threshold);
+    }
+    if (!frontend_->DefineFunction(guest_function, debug_info_flags_)) {
       function->set_status(Symbol::Status::kFailed);
       return false;
     }
+    INCREMENT_counter(jit_compiles, 1);
 
     // Before we give the symbol back to the rest, let the debugger know.
     OnFunctionDefined(function);
@@ -370,7 +731,6 @@ bool Processor::ExecuteRaw(ThreadState* thread_state, uint32_t address) {
     return false;
   }
 
-  auto context = thread_state->context();
   return function->Call(thread_state, 0xBCBCBCBC);
 }
 
@@ -476,6 +836,14 @@ uint8_t* Processor::AllocateFunctionTraceData(size_t size) {
   return functions_trace_file_->Allocate(size);
 }
 
+uint8_t* Processor::AllocateBlockCoverageData(size_t size) {
+  if (!block_coverage_file_) {
+    return nullptr;
+  }
+  std::lock_guard<std::mutex> lock(block_coverage_mutex_);
+  return block_coverage_file_->Allocate(size);
+}
+
 void Processor::OnFunctionDefined(Function* function) {
   auto global_lock = global_critical_region_.Acquire();
   for (auto breakpoint : breakpoints_) {
@@ -561,7 +929,7 @@ void Processor::AddBreakpoint(Breakpoint* breakpoint) {
   // Add to breakpoints map.
   breakpoints_.push_back(breakpoint);
 
-  if (execution_state_ == ExecutionState::kRunning) {
+  if (!breakpoints_suspended_) {
     breakpoint->Resume();
   }
 }
@@ -570,7 +938,7 @@ void Processor::RemoveBreakpoint(Breakpoint* breakpoint) {
   auto global_lock = global_critical_region_.Acquire();
 
   // Uninstall (if needed).
-  if (execution_state_ == ExecutionState::kRunning) {
+  if (!breakpoints_suspended_) {
     breakpoint->Suspend();
   }
 
@@ -637,9 +1005,11 @@ bool Processor::OnThreadBreakpointHit(Exception* ex) {
   }
   auto thread_info = it->second.get();
 
-  // Run through and uninstall all breakpoint UD2s to get us back to a clean
-  // state.
-  if (execution_state_ != ExecutionState::kStepping) {
+  // Breakpoints stay installed if we can resume past this one out of line.
+  // Otherwise run through and uninstall all breakpoint UD2s to get us back to
+  // a clean state.
+  if (execution_state_ != ExecutionState::kStepping &&
+      !backend_->LookupBreakpointTrampoline(ex->pc())) {
     SuspendAllBreakpoints();
   }
 
@@ -686,7 +1056,17 @@ bool Processor::OnThreadBreakpointHit(Exception* ex) {
 
   // Apply thread context changes.
   // TODO(benvanik): apply to all threads?
-  ex->set_resume_pc(thread_info->host_context.rip);
+  uint64_t resume_pc = thread_info->host_context.rip;
+  if (resume_pc == ex->pc()) {
+    // Still on the breakpoint, so skip over it if it's installed.
+    global_lock.lock();
+    uint64_t trampoline = backend_->LookupBreakpointTrampoline(resume_pc);
+    global_lock.unlock();
+    if (trampoline) {
+      resume_pc = trampoline;
+    }
+  }
+  ex->set_resume_pc(resume_pc);
 
   // Resume execution.
   return true;
@@ -745,6 +1125,74 @@ void Processor::ShowDebugger() {
   }
 }
 
+void Processor::ReclaimCode() {
+  // Deep enough for any guest call chain we expect; deeper stacks are treated
+  // as incomplete and nothing is freed.
+  const size_t kMaxFrameCount = 64;
+  std::vector<uint64_t> host_pcs;
+  std::vector<size_t> frame_counts;
+  if (!CaptureThreadStacks(kMaxFrameCount, &host_pcs, &frame_counts)) {
+    return;
+  }
+  for (auto frame_count : frame_counts) {
+    if (!frame_count || frame_count == kMaxFrameCount) {
+      return;
+    }
+  }
+  backend_->ReclaimCode(host_pcs);
+}
+
+bool Processor::CaptureThreadStacks(size_t max_frame_count,
+                                    std::vector<uint64_t>* host_pcs,
+                                    std::vector<size_t>* frame_counts) {
+  host_pcs->clear();
+  frame_counts->clear();
+  auto global_lock = global_critical_region_.Acquire();
+  if (execution_state_ != ExecutionState::kRunning || !stack_walker_) {
+    // The debugger owns thread suspension while paused.
+    return false;
+  }
+
+  // Nothing may allocate while threads are suspended, as they may hold the
+  // heap lock.
+  std::vector<xe::threading::Thread*> threads;
+  threads.reserve(thread_debug_infos_.size());
+  for (auto& it : thread_debug_infos_) {
+    auto thread_info = it.second.get();
+    if (thread_info->state == ThreadDebugInfo::State::kZombie ||
+        thread_info->state == ThreadDebugInfo::State::kExited ||
+        (XThread::IsInThread() &&
+         thread_info->thread_id == XThread::GetCurrentThreadId())) {
+      continue;
+    }
+    threads.push_back(thread_info->thread->thread());
+  }
+  host_pcs->resize(threads.size() * max_frame_count);
+  frame_counts->resize(threads.size());
+
+  size_t suspended_count = 0;
+  bool suspended = true;
+  for (; suspended_count < threads.size(); ++suspended_count) {
+    if (!threads[suspended_count]->Suspend()) {
+      suspended = false;
+      break;
+    }
+  }
+  size_t frame_offset = 0;
+  for (size_t i = 0; suspended && i < suspended_count; ++i) {
+    size_t frame_count = stack_walker_->CaptureStackTrace(
+        threads[i]->native_handle(), host_pcs->data() + frame_offset, 0,
+        max_frame_count, nullptr, nullptr);
+    (*frame_counts)[i] = frame_count;
+    frame_offset += frame_count;
+  }
+  for (size_t i = 0; i < suspended_count; ++i) {
+    threads[i]->Resume();
+  }
+  host_pcs->resize(frame_offset);
+  return suspended;
+}
+
 bool Processor::SuspendAllThreads() {
   auto global_lock = global_critical_region_.Acquire();
   for (auto& it : thread_debug_infos_) {
@@ -874,6 +1322,10 @@ void Processor::UpdateThreadExecutionStates(uint32_t override_thread_id,
 
 void Processor::SuspendAllBreakpoints() {
   auto global_lock = global_critical_region_.Acquire();
+  if (breakpoints_suspended_) {
+    return;
+  }
+  breakpoints_suspended_ = true;
   for (auto breakpoint : breakpoints_) {
     breakpoint->Suspend();
   }
@@ -881,6 +1333,10 @@ void Processor::SuspendAllBreakpoints() {
 
 void Processor::ResumeAllBreakpoints() {
   auto global_lock = global_critical_region_.Acquire();
+  if (!breakpoints_suspended_) {
+    return;
+  }
+  breakpoints_suspended_ = false;
   for (auto breakpoint : breakpoints_) {
     breakpoint->Resume();
   }
@@ -921,6 +1377,9 @@ void Processor::StepHostInstruction(uint32_t thread_id) {
   assert_true(execution_state_ == ExecutionState::kPaused);
   execution_state_ = ExecutionState::kStepping;
 
+  // Breakpoints may have been left installed when the thread stopped on one.
+  SuspendAllBreakpoints();
+
   auto thread_info = QueryThreadDebugInfo(thread_id);
   uint64_t new_host_pc = backend_->CalculateNextHostInstruction(
       thread_info, thread_info->frames[0].host_pc);
@@ -953,6 +1412,9 @@ void Processor::StepGuestInstruction(uint32_t thread_id) {
   assert_true(execution_state_ == ExecutionState::kPaused);
   execution_state_ = ExecutionState::kStepping;
 
+  // Breakpoints may have been left installed when the thread stopped on one.
+  SuspendAllBreakpoints();
+
   auto thread_info = QueryThreadDebugInfo(thread_id);
 
   uint32_t next_pc = CalculateNextGuestInstruction(
@@ -12,13 +12,20 @@
 
 #include <gflags/gflags.h>
 
+#include <atomic>
+#include <condition_variable>
+#include <deque>
 #include <map>
 #include <memory>
+#include <mutex>
 #include <string>
+#include <unordered_map>
+#include <unordered_set>
 #include <vector>
 
 #include "xenia/base/mapped_memory.h"
 #include "xenia/base/mutex.h"
+#include "xenia/base/threading.h"
 #include "xenia/cpu/backend/backend.h"
 #include "xenia/cpu/debug_listener.h"
 #include "xenia/cpu/entry_table.h"
@@ -26,6 +33,7 @@
 #include "xenia/cpu/function.h"
 #include "xenia/cpu/module.h"
 #include "xenia/cpu/ppc/ppc_frontend.h"
+#include "xenia/cpu/sampling_profiler.h"
 #include "xenia/cpu/thread_debug_info.h"
 #include "xenia/cpu/thread_state.h"
 #include "xenia/memory.h"
@@ -67,6 +75,9 @@ class Processor {
 
   Memory* memory() const { return memory_; }
   StackWalker* stack_walker() const { return stack_walker_.get(); }
+  SamplingProfiler* sampling_profiler() const {
+    return sampling_profiler_.get();
+  }
   ppc::PPCFrontend* frontend() const { return frontend_.get(); }
   backend::Backend* backend() const { return backend_.get(); }
   ExportResolver* export_resolver() const { return export_resolver_; }
@@ -115,6 +126,29 @@ class Processor {
   Function* LookupFunction(uint32_t address);
   Function* LookupFunction(Module* module, uint32_t address);
   Function* ResolveFunction(uint32_t address);
+  // Queues the function at the given address for translation on a background
+  // compile thread. A no-op if background compilation is disabled or the
+  // function has already been requested.
+  void QueueFunction(uint32_t address);
+  // Translates the functions at the given addresses and every call target
+  // found while doing so, using all host cores. Returns once all are done.
+  void Precompile(const std::vector<uint32_t>& addresses);
+  // Called by baseline tier code once it is hot. Recompiles the function with
+  // full optimizations, in the background if compile threads are available.
+  void OnFunctionHot(GuestFunction* function);
+  // Queues the function for a full retranslation on a background compile
+  // thread, for when the backend has learned something that changes the code
+  // it would generate. A no-op if background compilation is disabled.
+  void RetranslateFunction(GuestFunction* function);
+  // Records that the code of the caller includes a copy of the callee, or
+  // was compiled against its context usage, so retranslating or invalidating
+  // the callee does the same to the caller.
+  void AddInlinedCall(GuestFunction* caller, GuestFunction* callee);
+  // Watches the guest code of a function for writes, replacing the watch it
+  // had if its extent changed. Called by the translator once the function
+  // has been scanned and before its code is read any further, so that a
+  // write during translation leaves the new code invalidated.
+  void WatchFunctionCode(GuestFunction* function);
 
   bool Execute(ThreadState* thread_state, uint32_t address);
   bool ExecuteRaw(ThreadState* thread_state, uint32_t address);
@@ -134,6 +168,15 @@ class Processor {
   // the kernel.
   std::vector<ThreadDebugInfo*> QueryThreadDebugInfos();
 
+  // Briefly suspends every live thread other than the caller and captures
+  // up to max_frame_count host frames of each, innermost first. Frames of
+  // all threads are appended to host_pcs and frame_counts holds how many
+  // came from each (0 if it couldn't be walked). Returns false if the
+  // threads could not be suspended.
+  bool CaptureThreadStacks(size_t max_frame_count,
+                           std::vector<uint64_t>* host_pcs,
+                           std::vector<size_t>* frame_counts);
+
   // Returns the debugger info for the given thread.
   ThreadDebugInfo* QueryThreadDebugInfo(uint32_t thread_id);
 
@@ -199,11 +242,17 @@ class Processor {
   bool OnThreadBreakpointHit(Exception* ex);
 
   uint8_t* AllocateFunctionTraceData(size_t size);
+  // Returns null if --trace_block_coverage_path isn't set.
+  uint8_t* AllocateBlockCoverageData(size_t size);
 
  private:
   // Synchronously demands a debug listener.
   void DemandDebugListener();
 
+  // Briefly suspends all threads to find running code and lets the backend
+  // free replaced code that isn't on any stack.
+  void ReclaimCode();
+
   // Suspends all known threads (except the caller).
   bool SuspendAllThreads();
   // Resumes the given thread.
@@ -237,8 +286,24 @@ class Processor {
 
   bool DemandFunction(Function* function);
 
+  void OptimizeFunction(GuestFunction* function);
+  // The function and everything that depends on it, directly or through
+  // other callers. Must be called with compile_mutex_ held.
+  void CollectDependentFunctions(GuestFunction* function,
+                                 std::vector<GuestFunction*>* functions);
+  static void CodeWriteCallback(void* context_ptr, void* data_ptr,
+                                uint32_t address);
+  // Leaves the function and the callers it was inlined into to be translated
+  // again on their next call.
+  void InvalidateFunction(GuestFunction* function);
+  bool RedefineFunction(GuestFunction* function);
+  void CompileThreadMain();
+  void PrecompileThreadMain();
+  void ShutdownCompileThreads();
+
   Memory* memory_ = nullptr;
   std::unique_ptr<StackWalker> stack_walker_;
+  std::unique_ptr<SamplingProfiler> sampling_profiler_;
 
   std::function<DebugListener*(Processor*)> debug_listener_handler_;
   DebugListener* debug_listener_ = nullptr;
@@ -248,12 +313,42 @@ class Processor {
   // If specified, the file trace data gets written to when running.
   std::wstring functions_trace_path_;
   std::unique_ptr<ChunkedMappedMemoryWriter> functions_trace_file_;
+  // Guards block_coverage_file_, as functions are translated in parallel.
+  std::mutex block_coverage_mutex_;
+  std::unique_ptr<ChunkedMappedMemoryWriter> block_coverage_file_;
 
   std::unique_ptr<ppc::PPCFrontend> frontend_;
   std::unique_ptr<backend::Backend> backend_;
   ExportResolver* export_resolver_ = nullptr;
 
   EntryTable entry_table_;
+
+  // Background translation of functions we expect to be called soon.
+  // Jobs only claim their entry when they start, so a guest thread reaching a
+  // function that is still queued translates it itself.
+  std::vector<std::unique_ptr<xe::threading::Thread>> compile_threads_;
+  std::mutex compile_mutex_;
+  std::condition_variable compile_cond_;
+  std::deque<uint32_t> compile_queue_;
+  std::deque<GuestFunction*> optimize_queue_;
+  std::unordered_set<uint32_t> compile_requested_;
+  // Callers by the functions inlined into them.
+  std::unordered_multimap<GuestFunction*, GuestFunction*> inlined_callers_;
+  // Serializes the translation of invalidated and hot functions. The write
+  // watch callbacks run with the global lock held, and never take it.
+  std::mutex redefine_mutex_;
+  struct CodeWatch {
+    uintptr_t handle;
+    uint32_t end_address;
+  };
+  // Write watches on the code of translated functions. Guarded by the global
+  // lock.
+  std::unordered_map<GuestFunction*, CodeWatch> code_watches_;
+  // Jobs currently being translated. Precompile is done once this and the
+  // queue are empty, as nothing else can add to the queue then.
+  uint32_t compile_active_ = 0;
+  std::atomic<bool> precompiling_ = {false};
+  bool compile_shutdown_ = false;
   xe::global_critical_region global_critical_region_;
   ExecutionState execution_state_ = ExecutionState::kPaused;
   std::vector<std::unique_ptr<Module>> modules_;
@@ -266,6 +361,9 @@ class Processor {
 
   // TODO(benvanik): cleanup/change structures.
   std::vector<Breakpoint*> breakpoints_;
+  // True while breakpoints are uninstalled for the debugger, between
+  // SuspendAllBreakpoints and ResumeAllBreakpoints.
+  bool breakpoints_suspended_ = false;
 
   Irql irql_;
 };
@@ -0,0 +1,257 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2016 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#include "xenia/cpu/sampling_profiler.h"
+
+#include <algorithm>
+#include <cinttypes>
+
+#include "xenia/base/filesystem.h"
+#include "xenia/base/logging.h"
+#include "xenia/cpu/backend/code_cache.h"
+#include "xenia/cpu/function.h"
+#include "xenia/cpu/module.h"
+#include "xenia/cpu/processor.h"
+
+namespace xe {
+namespace cpu {
+
+// Guest call chains deeper than this are truncated, which only loses
+// total/call graph samples for the outermost frames.
+static const size_t kMaxFrameCount = 32;
+
+SamplingProfiler::SamplingProfiler(Processor* processor)
+    : processor_(processor) {}
+
+SamplingProfiler::~SamplingProfiler() { Stop(); }
+
+void SamplingProfiler::Start(uint32_t interval_ms) {
+  if (thread_) {
+    return;
+  }
+  interval_ms_ = std::max(interval_ms, 1u);
+  shutdown_event_ = xe::threading::Event::CreateManualResetEvent(false);
+  thread_ = xe::threading::Thread::Create({}, [this]() { ThreadMain(); });
+  thread_->set_name("xe::cpu::SamplingProfiler");
+}
+
+void SamplingProfiler::Stop() {
+  if (!thread_) {
+    return;
+  }
+  shutdown_event_->Set();
+  xe::threading::Wait(thread_.get(), false);
+  thread_.reset();
+  shutdown_event_.reset();
+}
+
+void SamplingProfiler::Reset() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  sample_count_ = 0;
+  functions_.clear();
+}
+
+uint64_t SamplingProfiler::sample_count() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return sample_count_;
+}
+
+void SamplingProfiler::ThreadMain() {
+  while (xe::threading::Wait(shutdown_event_.get(), false,
+                             std::chrono::milliseconds(interval_ms_)) ==
+         xe::threading::WaitResult::kTimeout) {
+    TakeSample();
+  }
+}
+
+void SamplingProfiler::TakeSample() {
+  if (!processor_->CaptureThreadStacks(kMaxFrameCount, &host_pcs_,
+                                       &frame_counts_)) {
+    return;
+  }
+  auto code_cache = processor_->backend()->code_cache();
+
+  std::lock_guard<std::mutex> lock(mutex_);
+  size_t frame_offset = 0;
+  for (auto frame_count : frame_counts_) {
+    const uint64_t* frames = host_pcs_.data() + frame_offset;
+    frame_offset += frame_count;
+
+    // Only threads executing generated code are counted. Those in the kernel
+    // or waiting would otherwise be charged to whatever guest code called in.
+    auto top_function =
+        frame_count ? code_cache->LookupFunction(frames[0]) : nullptr;
+    if (!top_function) {
+      continue;
+    }
+    stack_functions_.clear();
+    for (size_t i = 0; i < frame_count; ++i) {
+      auto function = code_cache->LookupFunction(frames[i]);
+      if (function) {
+        stack_functions_.push_back(function);
+      }
+    }
+    ++sample_count_;
+
+    // Replaced code can't be mapped through the current source map.
+    uint32_t guest_address = top_function->address();
+    auto code = reinterpret_cast<uint64_t>(top_function->machine_code());
+    if (frames[0] >= code &&
+        frames[0] < code + top_function->machine_code_length()) {
+      guest_address =
+          top_function->MapMachineCodeToGuestAddress(uintptr_t(frames[0]));
+    }
+    auto& top_samples = functions_[top_function];
+    ++top_samples.self_samples;
+    ++top_samples.address_samples[guest_address];
+
+    for (size_t i = 0; i < stack_functions_.size(); ++i) {
+      auto function = stack_functions_[i];
+      auto& samples = functions_[function];
+      auto frames_begin = stack_functions_.begin();
+      if (std::find(frames_begin, frames_begin + i, function) ==
+          frames_begin + i) {
+        // Recursive calls only count once.
+        ++samples.total_samples;
+      }
+      if (i + 1 < stack_functions_.size()) {
+        auto caller = stack_functions_[i + 1];
+        ++samples.callers[caller];
+        ++functions_[caller].callees[function];
+      }
+    }
+  }
+}
+
+std::vector<SamplingProfiler::ModuleProfile> SamplingProfiler::QueryProfile() {
+  auto function_name = [](GuestFunction* function) {
+    if (!function->name().empty()) {
+      return function->name();
+    }
+    char name[16];
+    std::snprintf(name, sizeof(name), "sub_%.8X", function->address());
+    return std::string(name);
+  };
+
+  std::map<Module*, ModuleProfile> modules;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (auto& it : functions_) {
+      auto function = it.first;
+      auto& samples = it.second;
+      auto& module = modules[function->module()];
+      module.self_samples += samples.self_samples;
+
+      FunctionProfile profile;
+      profile.address = function->address();
+      profile.name = function_name(function);
+      profile.self_samples = samples.self_samples;
+      profile.total_samples = samples.total_samples;
+      profile.address_samples = samples.address_samples;
+      for (auto& caller : samples.callers) {
+        profile.callers[caller.first->address()] += caller.second;
+      }
+      for (auto& callee : samples.callees) {
+        profile.callees[callee.first->address()] += callee.second;
+      }
+      module.functions.push_back(std::move(profile));
+    }
+  }
+
+  std::vector<ModuleProfile> result;
+  for (auto& it : modules) {
+    auto& module = it.second;
+    module.name = it.first->name();
+    std::sort(module.functions.begin(), module.functions.end(),
+              [](const FunctionProfile& a, const FunctionProfile& b) {
+                return a.self_samples != b.self_samples
+                           ? a.self_samples > b.self_samples
+                           : a.total_samples > b.total_samples;
+              });
+    result.push_back(std::move(module));
+  }
+  std::sort(result.begin(), result.end(),
+            [](const ModuleProfile& a, const ModuleProfile& b) {
+              return a.self_samples > b.self_samples;
+            });
+  return result;
+}
+
+bool SamplingProfiler::DumpToFile(const std::wstring& path) {
+  auto modules = QueryProfile();
+  uint64_t total = std::max(sample_count(), uint64_t(1));
+
+  FILE* file = xe::filesystem::OpenFile(path, "w");
+  if (!file) {
+    XELOGE("Unable to open profile file %S", path.c_str());
+    return false;
+  }
+  fprintf(file, "Guest code profile: %" PRIu64 " samples every %ums\n",
+          sample_count(), interval_ms_);
+  for (auto& module : modules) {
+    fprintf(file, "\n== %s: %" PRIu64 " samples (%.2f%%)\n",
+            module.name.c_str(), module.self_samples,
+            100.0 * module.self_samples / total);
+
+    // Flat profile.
+    fprintf(file, "\n  self%%  total%%       self      total  function\n");
+    std::map<uint32_t, const FunctionProfile*> by_address;
+    for (auto& function : module.functions) {
+      by_address[function.address] = &function;
+      fprintf(file, "%6.2f %7.2f %10" PRIu64 " %10" PRIu64 "  %.8X %s\n",
+              100.0 * function.self_samples / total,
+              100.0 * function.total_samples / total, function.self_samples,
+              function.total_samples, function.address,
+              function.name.c_str());
+    }
+
+    // Call graph and hottest instructions of each function with self time.
+    fprintf(file, "\n  Call graph:\n");
+    for (auto& function : module.functions) {
+      if (!function.self_samples) {
+        continue;
+      }
+      fprintf(file, "\n  %.8X %s\n", function.address, function.name.c_str());
+      for (auto& caller : function.callers) {
+        auto caller_function = by_address.find(caller.first);
+        fprintf(file, "    <- %10" PRIu64 "  %.8X %s\n", caller.second,
+                caller.first,
+                caller_function != by_address.end()
+                    ? caller_function->second->name.c_str()
+                    : "");
+      }
+      for (auto& callee : function.callees) {
+        auto callee_function = by_address.find(callee.first);
+        fprintf(file, "    -> %10" PRIu64 "  %.8X %s\n", callee.second,
+                callee.first,
+                callee_function != by_address.end()
+                    ? callee_function->second->name.c_str()
+                    : "");
+      }
+      std::vector<std::pair<uint32_t, uint64_t>> hot_addresses(
+          function.address_samples.begin(), function.address_samples.end());
+      std::sort(hot_addresses.begin(), hot_addresses.end(),
+                [](const std::pair<uint32_t, uint64_t>& a,
+                   const std::pair<uint32_t, uint64_t>& b) {
+                  return a.second > b.second;
+                });
+      hot_addresses.resize(std::min(hot_addresses.size(), size_t(8)));
+      for (auto& hot_address : hot_addresses) {
+        fprintf(file, "    @  %10" PRIu64 "  %.8X\n", hot_address.second,
+                hot_address.first);
+      }
+    }
+  }
+  fclose(file);
+  XELOGI("Wrote guest code profile to %S", path.c_str());
+  return true;
+}
+
+}  // namespace cpu
+}  // namespace xe
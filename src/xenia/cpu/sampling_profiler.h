@@ -0,0 +1,101 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2016 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#ifndef XENIA_CPU_SAMPLING_PROFILER_H_
+#define XENIA_CPU_SAMPLING_PROFILER_H_
+
+#include <atomic>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "xenia/base/threading.h"
+
+namespace xe {
+namespace cpu {
+
+class GuestFunction;
+class Processor;
+
+// Finds where guest time goes by periodically suspending all threads and
+// walking their stacks, attributing each frame to the guest function and
+// instruction it was executing. Unlike the trace_function_* instrumentation
+// generated code is unchanged, so it can be left running in normal use.
+class SamplingProfiler {
+ public:
+  struct FunctionProfile {
+    uint32_t address;
+    std::string name;
+    // Samples where the function was on top of the stack (self) or anywhere
+    // on it, counted once per sample (total).
+    uint64_t self_samples;
+    uint64_t total_samples;
+    // Self samples by guest instruction address, to find hot blocks.
+    std::map<uint32_t, uint64_t> address_samples;
+    // Samples of each edge of the call graph, by function address.
+    std::map<uint32_t, uint64_t> callers;
+    std::map<uint32_t, uint64_t> callees;
+  };
+  struct ModuleProfile {
+    std::string name;
+    uint64_t self_samples;
+    // Sorted by descending self samples.
+    std::vector<FunctionProfile> functions;
+  };
+
+  explicit SamplingProfiler(Processor* processor);
+  ~SamplingProfiler();
+
+  bool is_running() const { return thread_ != nullptr; }
+  void Start(uint32_t interval_ms);
+  void Stop();
+  // Drops all samples taken so far.
+  void Reset();
+
+  // Number of guest thread stacks sampled.
+  uint64_t sample_count();
+  std::vector<ModuleProfile> QueryProfile();
+  bool DumpToFile(const std::wstring& path);
+
+ private:
+  struct FunctionSamples {
+    uint64_t self_samples = 0;
+    uint64_t total_samples = 0;
+    std::map<uint32_t, uint64_t> address_samples;
+    std::map<GuestFunction*, uint64_t> callers;
+    std::map<GuestFunction*, uint64_t> callees;
+  };
+
+  void ThreadMain();
+  void TakeSample();
+
+  Processor* processor_;
+  uint32_t interval_ms_ = 1;
+
+  std::unique_ptr<xe::threading::Thread> thread_;
+  std::unique_ptr<xe::threading::Event> shutdown_event_;
+
+  std::mutex mutex_;
+  uint64_t sample_count_ = 0;
+  std::unordered_map<GuestFunction*, FunctionSamples> functions_;
+
+  // Reused between samples, as nothing may be allocated while threads are
+  // suspended.
+  std::vector<uint64_t> host_pcs_;
+  std::vector<size_t> frame_counts_;
+  std::vector<GuestFunction*> stack_functions_;
+};
+
+}  // namespace cpu
+}  // namespace xe
+
+#endif  // XENIA_CPU_SAMPLING_PROFILER_H_
@@ -14,6 +14,7 @@
 #include "xenia/base/reset_scope.h"
 #include "xenia/base/string.h"
 #include "xenia/cpu/compiler/compiler_passes.h"
+#include "xenia/cpu/cpu_flags.h"
 #include "xenia/cpu/processor.h"
 
 namespace xe {
@@ -48,11 +49,15 @@ TestModule::TestModule(Processor* processor, const std::string& name,
   compiler_->AddPass(std::make_unique<passes::SimplificationPass>());
   compiler_->AddPass(std::make_unique<passes::ConstantPropagationPass>());
   compiler_->AddPass(std::make_unique<passes::SimplificationPass>());
-  // compiler_->AddPass(std::make_unique<passes::DeadStoreEliminationPass>());
+  if (FLAGS_eliminate_dead_stores) {
+    compiler_->AddPass(std::make_unique<passes::DeadStoreEliminationPass>());
+  }
   compiler_->AddPass(std::make_unique<passes::DeadCodeEliminationPass>());
 
-  //// Removes all unneeded variables. Try not to add new ones after this.
-  // compiler_->AddPass(new passes::ValueReductionPass());
+  // Removes all unneeded variables. Try not to add new ones after this.
+  if (FLAGS_reduce_values) {
+    compiler_->AddPass(std::make_unique<passes::ValueReductionPass>());
+  }
 
   // Register allocation for the target backend.
   // Will modify the HIR to add loads/stores.
@@ -15,3 +15,72 @@ test_suite("xenia-cpu-tests", project_root, ".", {
     "xenia-kernel",
   },
 })
+
+group("tests")
+project("xenia-cpu-translation-benchmark")
+  uuid("8c4a5b0e-3f61-4d2a-9e7b-5d1f0a6c2b94")
+  kind("ConsoleApp")
+  language("C++")
+  links({
+    "gflags",
+    "xenia-base",
+    "xenia-core",
+    "xenia-cpu",
+    "xenia-cpu-backend-x64",
+
+    -- TODO(benvanik): remove these dependencies.
+    "xenia-kernel",
+  })
+  files({
+    "translation_benchmark_main.cc",
+    "../../base/main_"..platform_suffix..".cc",
+  })
+  includedirs({
+    project_root.."/third_party/gflags/src",
+  })
+
+group("tests")
+project("xenia-cpu-reservation-benchmark")
+  uuid("3e9f2d71-6b8a-4c05-a1d4-7f0c5e2b9a63")
+  kind("ConsoleApp")
+  language("C++")
+  links({
+    "gflags",
+    "xenia-base",
+    "xenia-core",
+    "xenia-cpu",
+    "xenia-cpu-backend-x64",
+
+    -- TODO(benvanik): remove these dependencies.
+    "xenia-kernel",
+  })
+  files({
+    "reservation_benchmark_main.cc",
+    "../../base/main_"..platform_suffix..".cc",
+  })
+  includedirs({
+    project_root.."/third_party/gflags/src",
+  })
+
+group("tests")
+project("xenia-cpu-sandbox")
+  uuid("b7d04e19-52c3-4a8f-9d6e-21f8c3a5e074")
+  kind("ConsoleApp")
+  language("C++")
+  links({
+    "gflags",
+    "xenia-base",
+    "xenia-core",
+    "xenia-cpu",
+    "xenia-cpu-backend-x64",
+
+    -- TODO(benvanik): remove these dependencies.
+    "xenia-kernel",
+  })
+  files({
+    "sandbox_main.cc",
+    "../../base/main_"..platform_suffix..".cc",
+  })
+  includedirs({
+    project_root.."/third_party/gflags/src",
+  })
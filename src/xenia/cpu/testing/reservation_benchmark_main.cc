@@ -0,0 +1,143 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2016 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#include <gflags/gflags.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cinttypes>
+#include <cstdio>
+#include <memory>
+#include <vector>
+
+#include "xenia/base/byte_order.h"
+#include "xenia/base/clock.h"
+#include "xenia/base/logging.h"
+#include "xenia/base/main.h"
+#include "xenia/base/threading.h"
+#include "xenia/cpu/cpu_flags.h"
+#include "xenia/cpu/processor.h"
+#include "xenia/cpu/raw_module.h"
+#include "xenia/cpu/thread_state.h"
+#include "xenia/memory.h"
+
+DEFINE_int32(benchmark_threads, 4,
+             "Number of host threads incrementing the shared counter.");
+DEFINE_int32(benchmark_increments, 1000000,
+             "Number of increments done by each thread.");
+
+namespace xe {
+namespace cpu {
+namespace test {
+
+const uint32_t kCodeAddress = 0x82000000;
+const uint32_t kCounterAddress = kCodeAddress + 0x1000;
+
+// Increments the word at r3 r4 times, like an interlocked increment:
+//   loop:
+//     lwarx r11, 0, r3
+//     addi r11, r11, 1
+//     stwcx. r11, 0, r3
+//     bne- loop
+//     addi r4, r4, -1
+//     cmpwi r4, 0
+//     bne loop
+//     blr
+const uint32_t kIncrementLoop[] = {
+    0x7D601828, 0x396B0001, 0x7D60192D, 0x4082FFF4,
+    0x3884FFFF, 0x2C040000, 0x4082FFE8, 0x4E800020,
+};
+
+int main(const std::vector<std::wstring>& args) {
+  // Nothing here is worth caching.
+  FLAGS_code_cache_path.clear();
+  uint32_t thread_count = uint32_t(std::max(FLAGS_benchmark_threads, 1));
+  uint32_t increments = uint32_t(std::max(FLAGS_benchmark_increments, 1));
+
+  auto memory = std::make_unique<Memory>();
+  memory->Initialize();
+  auto processor = std::make_unique<Processor>(memory.get(), nullptr);
+  if (!processor->Setup()) {
+    XELOGE("Unable to set up the processor");
+    return 1;
+  }
+
+  memory->LookupHeap(kCodeAddress)
+      ->AllocFixed(kCodeAddress, 0x2000, 0,
+                   kMemoryAllocationReserve | kMemoryAllocationCommit,
+                   kMemoryProtectRead | kMemoryProtectWrite);
+  auto code = memory->TranslateVirtual<uint32_t*>(kCodeAddress);
+  for (size_t i = 0; i < xe::countof(kIncrementLoop); ++i) {
+    xe::store_and_swap<uint32_t>(code + i, kIncrementLoop[i]);
+  }
+  xe::store_and_swap<uint32_t>(memory->TranslateVirtual(kCounterAddress), 0);
+  auto module = std::make_unique<RawModule>(processor.get());
+  module->set_name("reservation_benchmark");
+  module->SetAddressRange(kCodeAddress, sizeof(kIncrementLoop));
+  processor->AddModule(std::move(module));
+  // Translated up front so that only the increments are timed.
+  auto function = processor->ResolveFunction(kCodeAddress);
+  if (!function) {
+    XELOGE("Unable to translate the increment loop");
+    return 1;
+  }
+
+  auto start_event = xe::threading::Event::CreateManualResetEvent(false);
+  std::atomic<uint32_t> ready_count(0);
+  std::vector<std::unique_ptr<xe::threading::Thread>> threads;
+  for (uint32_t i = 0; i < thread_count; ++i) {
+    threads.push_back(xe::threading::Thread::Create({}, [&, i]() {
+      auto thread_state = std::make_unique<ThreadState>(processor.get(), i);
+      ThreadState::Bind(thread_state.get());
+      auto context = thread_state->context();
+      context->r[3] = kCounterAddress;
+      context->r[4] = increments;
+      context->lr = 0xBCBCBCBC;
+      ++ready_count;
+      xe::threading::Wait(start_event.get(), false);
+      function->Call(thread_state.get(), uint32_t(context->lr));
+    }));
+  }
+  while (ready_count < thread_count) {
+    xe::threading::MaybeYield();
+  }
+  uint64_t start_ticks = Clock::QueryHostTickCount();
+  start_event->Set();
+  for (auto& thread : threads) {
+    xe::threading::Wait(thread.get(), false);
+  }
+  uint64_t elapsed_ticks = Clock::QueryHostTickCount() - start_ticks;
+
+  uint64_t total = uint64_t(thread_count) * increments;
+  uint32_t counter =
+      xe::load_and_swap<uint32_t>(memory->TranslateVirtual(kCounterAddress));
+  double elapsed_us = elapsed_ticks * 1000000.0 / Clock::host_tick_frequency();
+  fprintf(stdout, "{\n");
+  fprintf(stdout, "  \"threads\": %u,\n", thread_count);
+  fprintf(stdout, "  \"increments\": %" PRIu64 ",\n", total);
+  fprintf(stdout, "  \"counter\": %u,\n", counter);
+  fprintf(stdout, "  \"time_us\": %.1f,\n", elapsed_us);
+  fprintf(stdout, "  \"ns_per_increment\": %.2f\n",
+          elapsed_us * 1000.0 / total);
+  fprintf(stdout, "}\n");
+
+  threads.clear();
+  processor.reset();
+  memory.reset();
+  // Any other count means reserved stores were lost or done twice.
+  return counter == uint32_t(total) ? 0 : 1;
+}
+
+}  // namespace test
+}  // namespace cpu
+}  // namespace xe
+
+DEFINE_ENTRY_POINT(L"xenia-cpu-reservation-benchmark",
+                   L"xenia-cpu-reservation-benchmark [--benchmark_threads=4]",
+                   xe::cpu::test::main);
@@ -7,78 +7,121 @@
  ******************************************************************************
  */
 
+#include <gflags/gflags.h>
+
+#include <algorithm>
+#include <cinttypes>
+#include <cstdio>
+#include <memory>
+#include <vector>
+
+#include "xenia/base/byte_order.h"
+#include "xenia/base/clock.h"
+#include "xenia/base/logging.h"
 #include "xenia/base/main.h"
-#include "xenia/cpu/backend/x64/x64_backend.h"
-#include "xenia/cpu/cpu.h"
-#include "xenia/cpu/ppc/ppc_context.h"
-#include "xenia/cpu/ppc/ppc_frontend.h"
+#include "xenia/cpu/cpu_flags.h"
+#include "xenia/cpu/processor.h"
 #include "xenia/cpu/raw_module.h"
+#include "xenia/cpu/thread_state.h"
+#include "xenia/memory.h"
 
-#include <gflags/gflags.h>
+DEFINE_int32(sandbox_calls, 1000000,
+             "Number of host to guest calls timed for each call path.");
 
 namespace xe {
 namespace cpu {
 namespace sandbox {
 
-using xe::cpu::ppc::PPCContext;
-using xe::cpu::Runtime;
-
-// TODO(benvanik): simple memory? move more into core?
-
-int main(std::vector<std::wstring>& args) {
-#if XE_OPTION_PROFILING
-  xe::Profiler::Initialize();
-  xe::Profiler::ThreadEnter("main");
-#endif  // XE_OPTION_PROFILING
-
-  size_t memory_size = 16 * 1024 * 1024;
-  auto memory = std::make_unique<SimpleMemory>(memory_size);
-  auto runtime = std::make_unique<Runtime>(memory.get());
-
-  auto frontend =
-      std::make_unique<xe::cpu::frontend::ppc::PPCFrontend>(runtime.get());
-  std::unique_ptr<xe::cpu::backend::Backend> backend;
-  // backend =
-  //     std::make_unique<xe::cpu::backend::ivm::IVMBackend>(runtime.get());
-  // backend =
-  //     std::make_unique<xe::cpu::backend::x64::X64Backend>(runtime.get());
-  runtime->Initialize(std::move(frontend), std::move(backend));
-
-  auto module = std::make_unique<xe::cpu::RawModule>(runtime.get());
-  module->LoadFile(0x00001000, L"test\\codegen\\instr_add.bin");
-  runtime->AddModule(std::move(module));
-
-  {
-    uint64_t stack_size = 64 * 1024;
-    uint64_t stack_address = memory_size - stack_size;
-    uint64_t thread_state_address = stack_address - 0x1000;
-    auto thread_state = std::make_unique<ThreadState>(
-        runtime.get(), 100, stack_address, stack_size, thread_state_address);
-
-    xe::cpu::Function* fn;
-    runtime->ResolveFunction(0x1000, &fn);
-    auto ctx = thread_state->context();
-    ctx->lr = 0xBEBEBEBE;
-    ctx->r[5] = 10;
-    ctx->r[25] = 25;
-    fn->Call(thread_state.get(), ctx->lr);
-    auto result = ctx->r[11];
-    printf("%llu", result);
+const uint32_t kCodeAddress = 0x82000000;
+
+// Makes the calls as cheap as they get, so that only their overhead is timed:
+//   addi r3, r3, 1
+//   blr
+const uint32_t kIncrement[] = {
+    0x38630001, 0x4E800020,
+};
+
+// Returns the average time of a call in nanoseconds.
+template <typename T>
+double TimeCalls(uint32_t call_count, T fn) {
+  uint64_t start_ticks = Clock::QueryHostTickCount();
+  for (uint32_t i = 0; i < call_count; ++i) {
+    fn();
   }
+  uint64_t elapsed_ticks = Clock::QueryHostTickCount() - start_ticks;
+  return elapsed_ticks * 1000000000.0 / Clock::host_tick_frequency() /
+         call_count;
+}
 
-  runtime.reset();
-  memory.reset();
+int main(const std::vector<std::wstring>& args) {
+  // Nothing here is worth caching.
+  FLAGS_code_cache_path.clear();
+  uint32_t call_count = uint32_t(std::max(FLAGS_sandbox_calls, 1));
+
+  auto memory = std::make_unique<Memory>();
+  memory->Initialize();
+  auto processor = std::make_unique<Processor>(memory.get(), nullptr);
+  if (!processor->Setup()) {
+    XELOGE("Unable to set up the processor");
+    return 1;
+  }
 
-#if XE_OPTION_PROFILING
-  xe::Profiler::Dump();
-  xe::Profiler::ThreadExit();
-#endif  // XE_OPTION_PROFILING
+  memory->LookupHeap(kCodeAddress)
+      ->AllocFixed(kCodeAddress, 0x1000, 0,
+                   kMemoryAllocationReserve | kMemoryAllocationCommit,
+                   kMemoryProtectRead | kMemoryProtectWrite);
+  auto code = memory->TranslateVirtual<uint32_t*>(kCodeAddress);
+  for (size_t i = 0; i < xe::countof(kIncrement); ++i) {
+    xe::store_and_swap<uint32_t>(code + i, kIncrement[i]);
+  }
+  auto module = std::make_unique<RawModule>(processor.get());
+  module->set_name("sandbox");
+  module->SetAddressRange(kCodeAddress, sizeof(kIncrement));
+  processor->AddModule(std::move(module));
+  auto function = processor->ResolveFunction(kCodeAddress);
+  if (!function) {
+    XELOGE("Unable to translate the sandbox function");
+    return 1;
+  }
 
-  return 0;
+  // Bound once, as guest threads are, so the calls don't rebind it.
+  auto thread_state = std::make_unique<ThreadState>(processor.get(), 0x100);
+  ThreadState::Bind(thread_state.get());
+  auto context = thread_state->context();
+  context->r[3] = 0;
+
+  double call_ns = TimeCalls(call_count, [&]() {
+    function->Call(thread_state.get(), 0xBCBCBCBC);
+  });
+  double execute_ns = TimeCalls(call_count, [&]() {
+    processor->Execute(thread_state.get(), kCodeAddress);
+  });
+  double execute_args_ns = TimeCalls(call_count, [&]() {
+    uint64_t call_args[] = {context->r[3]};
+    processor->Execute(thread_state.get(), kCodeAddress, call_args,
+                       xe::countof(call_args));
+  });
+
+  uint64_t expected = uint64_t(call_count) * 3;
+  fprintf(stdout, "{\n");
+  fprintf(stdout, "  \"calls\": %u,\n", call_count);
+  fprintf(stdout, "  \"result\": %" PRIu64 ",\n", context->r[3]);
+  fprintf(stdout, "  \"ns_per_call\": %.2f,\n", call_ns);
+  fprintf(stdout, "  \"ns_per_execute\": %.2f,\n", execute_ns);
+  fprintf(stdout, "  \"ns_per_execute_args\": %.2f\n", execute_args_ns);
+  fprintf(stdout, "}\n");
+  bool result_valid = context->r[3] == expected;
+
+  thread_state.reset();
+  processor.reset();
+  memory.reset();
+  return result_valid ? 0 : 1;
 }
 
 }  // namespace sandbox
 }  // namespace cpu
 }  // namespace xe
 
-DEFINE_ENTRY_POINT(L"xenia-cpu-sandbox", L"?", xe::cpu::sandbox::main);
+DEFINE_ENTRY_POINT(L"xenia-cpu-sandbox",
+                   L"xenia-cpu-sandbox [--sandbox_calls=1000000]",
+                   xe::cpu::sandbox::main);
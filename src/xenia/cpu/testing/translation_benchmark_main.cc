@@ -0,0 +1,283 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2016 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#include <gflags/gflags.h>
+
+#include <algorithm>
+#include <cinttypes>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+#include "xenia/base/byte_order.h"
+#include "xenia/base/clock.h"
+#include "xenia/base/filesystem.h"
+#include "xenia/base/logging.h"
+#include "xenia/base/main.h"
+#include "xenia/base/mapped_memory.h"
+#include "xenia/base/string.h"
+#include "xenia/cpu/cpu_flags.h"
+#include "xenia/cpu/ppc/ppc_frontend.h"
+#include "xenia/cpu/ppc/ppc_opcode_info.h"
+#include "xenia/cpu/ppc/ppc_translator.h"
+#include "xenia/cpu/processor.h"
+#include "xenia/cpu/raw_module.h"
+#include "xenia/cpu/xex_module.h"
+#include "xenia/memory.h"
+
+DEFINE_string(benchmark_functions, "",
+              "Text file of hex guest function addresses to translate, one "
+              "per line. Required for raw binaries; added to the entry point "
+              "and .pdata functions of a XEX.");
+DEFINE_string(benchmark_base_address, "82000000",
+              "Hex guest address raw binaries are loaded at.");
+DEFINE_int32(benchmark_iterations, 1,
+             "Number of times every function is translated.");
+DEFINE_bool(benchmark_baseline, false,
+            "Translate at the baseline tier instead of fully optimized.");
+DEFINE_string(benchmark_output, "",
+              "Path the JSON results are written to. Defaults to stdout.");
+
+namespace xe {
+namespace cpu {
+namespace test {
+
+bool ReadFunctionList(const std::wstring& path,
+                      std::vector<uint32_t>* addresses) {
+  FILE* file = xe::filesystem::OpenFile(path, "r");
+  if (!file) {
+    XELOGE("Unable to open function list %S", path.c_str());
+    return false;
+  }
+  char line[64];
+  while (fgets(line, sizeof(line), file)) {
+    uint32_t address;
+    if (std::sscanf(line, "%x", &address) == 1 && !(address & 0x3)) {
+      addresses->push_back(address);
+    }
+  }
+  fclose(file);
+  return true;
+}
+
+Module* LoadModule(Processor* processor, const std::wstring& path,
+                   std::vector<uint32_t>* addresses) {
+  std::string name = xe::to_string(xe::find_name_from_path(path));
+  auto extension = name.substr(std::min(name.size(), name.find_last_of('.')));
+  if (extension == ".xex") {
+    auto mmap = MappedMemory::Open(path, MappedMemory::Mode::kRead);
+    if (!mmap) {
+      XELOGE("Unable to map %S", path.c_str());
+      return nullptr;
+    }
+    // No kernel is needed as imports are never called.
+    auto module = std::make_unique<XexModule>(processor, nullptr);
+    if (!module->Load(name, xe::to_string(path), mmap->data(),
+                      mmap->size())) {
+      XELOGE("Unable to load XEX %S", path.c_str());
+      return nullptr;
+    }
+    auto starts = module->FindFunctionStarts();
+    addresses->insert(addresses->end(), starts.begin(), starts.end());
+    auto result = module.get();
+    processor->AddModule(std::move(module));
+    return result;
+  }
+
+  // Anything else is treated as a raw dump of guest memory.
+  uint32_t base_address =
+      uint32_t(std::strtoul(FLAGS_benchmark_base_address.c_str(), nullptr, 16));
+  auto module = std::make_unique<RawModule>(processor);
+  if (!module->LoadFile(base_address, path)) {
+    XELOGE("Unable to load %S", path.c_str());
+    return nullptr;
+  }
+  auto result = module.get();
+  processor->AddModule(std::move(module));
+  return result;
+}
+
+void WriteResults(FILE* file, const std::string& module_name,
+                  ppc::PPCTranslator* translator, compiler::Compiler* compiler,
+                  uint64_t failed_count, uint64_t guest_bytes,
+                  uint64_t emitted_bytes, uint64_t decode_count,
+                  uint64_t decode_ticks) {
+  double ticks_to_us = 1000000.0 / Clock::host_tick_frequency();
+  auto& stats = translator->stats();
+  uint64_t total_ticks = stats.scan_ticks + stats.emit_ticks +
+                         stats.compile_ticks + stats.assemble_ticks;
+
+  fprintf(file, "{\n");
+  fprintf(file, "  \"module\": \"%s\",\n", module_name.c_str());
+  fprintf(file, "  \"tier\": \"%s\",\n",
+          FLAGS_benchmark_baseline ? "baseline" : "optimized");
+  fprintf(file, "  \"iterations\": %d,\n", FLAGS_benchmark_iterations);
+  fprintf(file, "  \"translation_count\": %" PRIu64 ",\n",
+          stats.function_count);
+  fprintf(file, "  \"failed_count\": %" PRIu64 ",\n", failed_count);
+  fprintf(file, "  \"guest_bytes\": %" PRIu64 ",\n", guest_bytes);
+  fprintf(file, "  \"emitted_bytes\": %" PRIu64 ",\n", emitted_bytes);
+  fprintf(file, "  \"decode\": {\n");
+  fprintf(file, "    \"instructions\": %" PRIu64 ",\n", decode_count);
+  fprintf(file, "    \"time_us\": %.1f,\n", decode_ticks * ticks_to_us);
+  fprintf(file, "    \"ns_per_instruction\": %.2f\n",
+          decode_count ? decode_ticks * ticks_to_us * 1000.0 / decode_count
+                       : 0.0);
+  fprintf(file, "  },\n");
+  fprintf(file, "  \"phases_us\": {\n");
+  fprintf(file, "    \"scan\": %.1f,\n", stats.scan_ticks * ticks_to_us);
+  fprintf(file, "    \"emit\": %.1f,\n", stats.emit_ticks * ticks_to_us);
+  fprintf(file, "    \"compile\": %.1f,\n", stats.compile_ticks * ticks_to_us);
+  fprintf(file, "    \"assemble\": %.1f,\n",
+          stats.assemble_ticks * ticks_to_us);
+  fprintf(file, "    \"total\": %.1f\n", total_ticks * ticks_to_us);
+  fprintf(file, "  },\n");
+  fprintf(file, "  \"passes\": [\n");
+  auto& pass_stats = compiler->pass_stats();
+  for (size_t i = 0; i < pass_stats.size(); ++i) {
+    auto& pass = pass_stats[i];
+    fprintf(file,
+            "    {\"index\": %d, \"name\": \"%s\", \"runs\": %" PRIu64
+            ", \"time_us\": %.1f, \"instrs_before\": %" PRIu64
+            ", \"instrs_after\": %" PRIu64 "}%s\n",
+            int(i), pass.name, pass.run_count, pass.host_ticks * ticks_to_us,
+            pass.instr_count_before, pass.instr_count_after,
+            i + 1 < pass_stats.size() ? "," : "");
+  }
+  fprintf(file, "  ]\n");
+  fprintf(file, "}\n");
+}
+
+int main(const std::vector<std::wstring>& args) {
+  if (args.size() < 2) {
+    XELOGE("Usage: xenia-cpu-translation-benchmark some.xex|some.bin");
+    return 1;
+  }
+  // Cached code would skip the work being measured.
+  FLAGS_code_cache_path.clear();
+
+  auto memory = std::make_unique<Memory>();
+  memory->Initialize();
+  auto processor = std::make_unique<Processor>(memory.get(), nullptr);
+  if (!processor->Setup()) {
+    XELOGE("Unable to set up the processor");
+    return 1;
+  }
+
+  std::vector<uint32_t> addresses;
+  if (!FLAGS_benchmark_functions.empty() &&
+      !ReadFunctionList(xe::to_wstring(FLAGS_benchmark_functions),
+                        &addresses)) {
+    return 1;
+  }
+  auto module = LoadModule(processor.get(), args[1], &addresses);
+  if (!module) {
+    return 1;
+  }
+  std::sort(addresses.begin(), addresses.end());
+  addresses.erase(std::unique(addresses.begin(), addresses.end()),
+                  addresses.end());
+
+  std::vector<GuestFunction*> functions;
+  for (auto address : addresses) {
+    Function* function = nullptr;
+    if (!module->ContainsAddress(address) ||
+        module->DeclareFunction(address, &function) != Symbol::Status::kNew ||
+        module->DefineFunction(function) != Symbol::Status::kNew) {
+      continue;
+    }
+    auto guest_function = static_cast<GuestFunction*>(function);
+    guest_function->set_tier(FLAGS_benchmark_baseline
+                                 ? GuestFunction::Tier::kBaseline
+                                 : GuestFunction::Tier::kOptimized);
+    functions.push_back(guest_function);
+  }
+  if (functions.empty()) {
+    XELOGE("No functions to translate; pass --benchmark_functions");
+    return 1;
+  }
+
+  // Translated directly rather than through the processor so that only
+  // translator time is measured and nothing is resolved lazily.
+  ppc::PPCTranslator translator(processor->frontend());
+  translator.set_stats_enabled(true);
+  uint64_t failed_count = 0;
+  for (int32_t i = 0; i < std::max(FLAGS_benchmark_iterations, 1); ++i) {
+    for (auto function : functions) {
+      if (!translator.Translate(function, 0)) {
+        ++failed_count;
+      }
+    }
+  }
+
+  uint64_t guest_bytes = 0;
+  uint64_t emitted_bytes = 0;
+  for (auto function : functions) {
+    if (function->machine_code()) {
+      function->set_status(Symbol::Status::kDefined);
+      guest_bytes += function->end_address() - function->address() + 4;
+      emitted_bytes += function->machine_code_length();
+    } else {
+      function->set_status(Symbol::Status::kFailed);
+    }
+  }
+
+  // Decoding is timed on its own over the same code, as the scanner, the HIR
+  // builder and the disassembler all share it.
+  uint64_t decode_count = 0;
+  uint32_t opcode_sum = 0;
+  uint64_t decode_start_ticks = Clock::QueryHostTickCount();
+  for (int32_t i = 0; i < std::max(FLAGS_benchmark_iterations, 1); ++i) {
+    for (auto function : functions) {
+      if (!function->machine_code()) {
+        continue;
+      }
+      for (uint32_t address = function->address();
+           address <= function->end_address(); address += 4) {
+        uint32_t code = xe::load_and_swap<uint32_t>(
+            memory->TranslateVirtual(address));
+        opcode_sum += static_cast<uint32_t>(ppc::LookupOpcode(code));
+        ++decode_count;
+      }
+    }
+  }
+  uint64_t decode_ticks = Clock::QueryHostTickCount() - decode_start_ticks;
+  // Keeps the lookups from being optimized away.
+  XELOGI("Opcode checksum %.8X", opcode_sum);
+
+  FILE* file = stdout;
+  if (!FLAGS_benchmark_output.empty()) {
+    file = xe::filesystem::OpenFile(xe::to_wstring(FLAGS_benchmark_output),
+                                    "w");
+    if (!file) {
+      XELOGE("Unable to open %s", FLAGS_benchmark_output.c_str());
+      return 1;
+    }
+  }
+  auto compiler = translator.compiler(FLAGS_benchmark_baseline
+                                         ? GuestFunction::Tier::kBaseline
+                                         : GuestFunction::Tier::kOptimized);
+  WriteResults(file, module->name(), &translator, compiler, failed_count,
+               guest_bytes, emitted_bytes, decode_count, decode_ticks);
+  if (file != stdout) {
+    fclose(file);
+  }
+
+  processor.reset();
+  memory.reset();
+  return 0;
+}
+
+}  // namespace test
+}  // namespace cpu
+}  // namespace xe
+
+DEFINE_ENTRY_POINT(L"xenia-cpu-translation-benchmark",
+                   L"xenia-cpu-translation-benchmark some.xex|some.bin",
+                   xe::cpu::test::main);
@@ -10,9 +10,16 @@
 #ifndef XENIA_CPU_TESTING_UTIL_H_
 #define XENIA_CPU_TESTING_UTIL_H_
 
+#include <gflags/gflags.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <string>
 #include <vector>
 
 #include "xenia/base/main.h"
+#include "xenia/base/platform.h"
 #include "xenia/cpu/backend/x64/x64_backend.h"
 #include "xenia/cpu/hir/hir_builder.h"
 #include "xenia/cpu/ppc/ppc_context.h"
@@ -22,6 +29,16 @@
 
 #include "third_party/catch/single_include/catch.hpp"
 
+#if XE_COMPILER_MSVC
+#include <intrin.h>
+#else
+#include <x86intrin.h>
+#endif  // XE_COMPILER_MSVC
+
+DECLARE_bool(enable_haswell_instructions);
+DECLARE_int32(benchmark_iterations);
+DECLARE_string(benchmark_results_path);
+
 #define XENIA_TEST_X64 1
 
 namespace xe {
@@ -54,6 +71,16 @@ class TestFunction {
             return true;
           });
       processor->AddModule(std::move(module));
+      if (FLAGS_benchmark_iterations > 0) {
+        // Timed the same way to subtract the cost of the call itself.
+        processor->AddModule(std::make_unique<xe::cpu::TestModule>(
+            processor.get(), "Empty",
+            [](uint64_t address) { return address == kEmptyAddress; },
+            [](hir::HIRBuilder& b) {
+              b.Return();
+              return true;
+            }));
+      }
       processor->backend()->CommitExecutableRange(0x80000000, 0x80010000);
     }
   }
@@ -81,12 +108,66 @@ class TestFunction {
       fn->Call(thread_state.get(), uint32_t(ctx->lr));
 
       post_call(ctx);
+
+      if (FLAGS_benchmark_iterations > 0) {
+        Benchmark(processor.get(), thread_state.get(), fn, pre_call);
+      }
     }
+    ++run_index_;
   }
 
+  // Times the function against an empty one, both called with the same
+  // inputs, and reports the difference in TSC cycles per call. That is the
+  // cost of the sequences emitted for the test, so results can be compared
+  // across changes and with --enable_haswell_instructions=false.
+  void Benchmark(Processor* processor, ThreadState* thread_state,
+                 Function* fn, std::function<void(PPCContext*)>& pre_call) {
+    auto empty_fn = processor->ResolveFunction(kEmptyAddress);
+    auto ctx = thread_state->context();
+    uint32_t iterations = uint32_t(FLAGS_benchmark_iterations);
+    auto time_calls = [&](Function* target) {
+      // The fastest of a few runs, as the others include interruptions.
+      uint64_t best_cycles = UINT64_MAX;
+      for (int run = 0; run < 5; ++run) {
+        uint64_t start_cycles = __rdtsc();
+        for (uint32_t i = 0; i < iterations; ++i) {
+          pre_call(ctx);
+          target->Call(thread_state, 0xBCBCBCBC);
+        }
+        uint64_t cycles = __rdtsc() - start_cycles;
+        best_cycles = std::min(best_cycles, cycles);
+      }
+      return double(best_cycles) / iterations;
+    };
+    double call_cycles = time_calls(empty_fn);
+    double test_cycles = time_calls(fn);
+
+    std::string name = Catch::getResultCapture().getCurrentTestName();
+    FILE* file = stdout;
+    if (!FLAGS_benchmark_results_path.empty()) {
+      file = std::fopen(FLAGS_benchmark_results_path.c_str(), "a");
+      if (!file) {
+        return;
+      }
+    }
+    std::fprintf(file,
+                 "{\"test\":\"%s\",\"run\":%u,\"haswell\":%s,"
+                 "\"cycles\":%.2f,\"call_cycles\":%.2f}\n",
+                 name.c_str(), run_index_,
+                 FLAGS_enable_haswell_instructions ? "true" : "false",
+                 std::max(test_cycles - call_cycles, 0.0), call_cycles);
+    if (file != stdout) {
+      std::fclose(file);
+    }
+  }
+
+  static const uint32_t kEmptyAddress = 0x80001000;
+
   uint32_t memory_size;
   std::unique_ptr<Memory> memory;
   std::vector<std::unique_ptr<Processor>> processors;
+  // Index of the Run call within the test case.
+  uint32_t run_index_ = 0;
 };
 
 inline hir::Value* LoadGPR(hir::HIRBuilder& b, int reg) {
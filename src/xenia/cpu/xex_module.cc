@@ -10,6 +10,7 @@
 #include "xenia/cpu/xex_module.h"
 
 #include <algorithm>
+#include <cstring>
 
 #include "xenia/base/byte_order.h"
 #include "xenia/base/logging.h"
@@ -32,6 +33,61 @@ void UndefinedImport(ppc::PPCContext* ppc_context, KernelState* kernel_state) {
   XELOGE("call to undefined import");
 }
 
+// memcpy/memmove(r3 = dest, r4 = src, r5 = size), returning dest in r3.
+void HostMemmove(ppc::PPCContext* ppc_context, KernelState* kernel_state) {
+  uint32_t dest = uint32_t(ppc_context->r[3]);
+  uint32_t src = uint32_t(ppc_context->r[4]);
+  uint32_t size = uint32_t(ppc_context->r[5]);
+  if (!size) {
+    return;
+  }
+  auto memory = ppc_context->processor->memory();
+  auto dest_range = memory->LookupVirtualMappedRange(dest);
+  auto src_range = memory->LookupVirtualMappedRange(src);
+  if (!dest_range && !src_range) {
+    // Bytes are copied as stored, so no swapping is needed.
+    std::memmove(ppc_context->virtual_membase + dest,
+                 ppc_context->virtual_membase + src, size);
+    return;
+  }
+  // Host stores to MMIO ranges can't be handled by the fault handler, so
+  // registers are accessed a word at a time like the guest loop would.
+  for (uint32_t i = 0; i + 4 <= size; i += 4) {
+    uint32_t value =
+        src_range
+            ? src_range->read(nullptr, src_range->callback_context, src + i)
+            : xe::load_and_swap<uint32_t>(ppc_context->virtual_membase + src +
+                                          i);
+    if (dest_range) {
+      dest_range->write(nullptr, dest_range->callback_context, dest + i,
+                        value);
+    } else {
+      xe::store_and_swap<uint32_t>(ppc_context->virtual_membase + dest + i,
+                                   value);
+    }
+  }
+}
+
+// memset(r3 = dest, r4 = value, r5 = size), returning dest in r3.
+void HostMemset(ppc::PPCContext* ppc_context, KernelState* kernel_state) {
+  uint32_t dest = uint32_t(ppc_context->r[3]);
+  uint8_t value = uint8_t(ppc_context->r[4]);
+  uint32_t size = uint32_t(ppc_context->r[5]);
+  if (!size) {
+    return;
+  }
+  auto dest_range =
+      ppc_context->processor->memory()->LookupVirtualMappedRange(dest);
+  if (!dest_range) {
+    std::memset(ppc_context->virtual_membase + dest, value, size);
+    return;
+  }
+  uint32_t word = value * 0x01010101u;
+  for (uint32_t i = 0; i + 4 <= size; i += 4) {
+    dest_range->write(nullptr, dest_range->callback_context, dest + i, word);
+  }
+}
+
 XexModule::XexModule(Processor* processor, KernelState* kernel_state)
     : Module(processor), processor_(processor), kernel_state_(kernel_state) {}
 
@@ -123,6 +179,11 @@ uint32_t XexModule::GetProcAddress(uint16_t ordinal) const {
 }
 
 uint32_t XexModule::GetProcAddress(const char* name) const {
+  auto it = export_names_.find(name);
+  return it != export_names_.end() ? it->second : 0;
+}
+
+void XexModule::IndexExportNames() {
   xe::be<uint32_t>* exe_address = nullptr;
   GetOptHeader(XEX_HEADER_IMAGE_BASE_ADDRESS, &exe_address);
   assert_not_null(exe_address);
@@ -130,7 +191,7 @@ uint32_t XexModule::GetProcAddress(const char* name) const {
   xex2_opt_data_directory* pe_export_directory = 0;
   if (!GetOptHeader(XEX_HEADER_EXPORTS_BY_NAME, &pe_export_directory)) {
     // No exports by name.
-    return 0;
+    return;
   }
 
   auto e = memory()->TranslateVirtual<const X_IMAGE_EXPORT_DIRECTORY*>(
@@ -149,18 +210,13 @@ uint32_t XexModule::GetProcAddress(const char* name) const {
   uint16_t* ordinal_table =
       reinterpret_cast<uint16_t*>(uintptr_t(e) + e->AddressOfNameOrdinals);
 
+  export_names_.reserve(e->NumberOfNames);
   for (uint32_t i = 0; i < e->NumberOfNames; i++) {
     auto fn_name = reinterpret_cast<const char*>(uintptr_t(e) + name_table[i]);
     uint16_t ordinal = ordinal_table[i];
-    uint32_t addr = *exe_address + function_table[ordinal];
-    if (!std::strcmp(name, fn_name)) {
-      // We have a match!
-      return addr;
-    }
+    // The first of duplicate names wins, as with a search of the table.
+    export_names_.emplace(fn_name, *exe_address + function_table[ordinal]);
   }
-
-  // No match
-  return 0;
 }
 
 bool XexModule::ApplyPatch(XexModule* module) {
@@ -283,6 +339,9 @@ bool XexModule::Load(const std::string& name, const std::string& path,
     if (!ReadMap(FLAGS_load_module_map.c_str())) {
       return false;
     }
+    if (FLAGS_hle_memory_functions) {
+      SetupMemoryFunctions();
+    }
   }
 
   // Setup memory protection.
@@ -309,6 +368,11 @@ bool XexModule::Load(const std::string& name, const std::string& path,
     page += desc.size;
   }
 
+  IndexExportNames();
+
+  // Code is now in its final state, so let the backend prepare for it.
+  processor_->backend()->OnModuleLoaded(this, low_address_, high_address_);
+
   return true;
 }
 
@@ -323,20 +387,29 @@ bool XexModule::Unload() {
   GetOptHeader(XEX_HEADER_IMAGE_BASE_ADDRESS, &exe_address);
   assert_not_zero(exe_address);
 
+  // Backed by guest memory again first, in case the image was shared.
+  memory()->UnmapSharedFile(*exe_address);
   memory()->LookupHeap(*exe_address)->Release(*exe_address);
   xex_header_mem_.resize(0);
+  export_names_.clear();
 
   return true;
 }
 
 bool XexModule::SetupLibraryImports(const char* name,
                                     const xex2_import_library* library) {
-  ExportResolver* kernel_resolver = nullptr;
-  if (kernel_state_->IsKernelModule(name)) {
-    kernel_resolver = processor_->export_resolver();
+  // Without a kernel (standalone tools) imports are left unresolved but the
+  // thunks are still rewritten so the code can be translated.
+  bool is_kernel_module = kernel_state_ && kernel_state_->IsKernelModule(name);
+  const ExportResolver::Table* kernel_table = nullptr;
+  if (is_kernel_module) {
+    kernel_table = processor_->export_resolver()->GetTable(name);
   }
 
-  auto user_module = kernel_state_->GetModule(name);
+  kernel::object_ref<kernel::XModule> user_module;
+  if (kernel_state_) {
+    user_module = kernel_state_->GetModule(name);
+  }
 
   std::string libbasename = name;
   auto dot = libbasename.find_last_of('.');
@@ -360,8 +433,10 @@ bool XexModule::SetupLibraryImports(const char* name,
     Export* kernel_export = nullptr;
     uint32_t user_export_addr = 0;
 
-    if (kernel_resolver) {
-      kernel_export = kernel_resolver->GetExportByOrdinal(name, ordinal);
+    if (is_kernel_module) {
+      if (kernel_table) {
+        kernel_export = kernel_table->GetExportByOrdinal(ordinal);
+      }
     } else if (user_module) {
       user_export_addr = user_module->GetProcAddressByOrdinal(ordinal);
     }
@@ -493,6 +568,73 @@ bool XexModule::ContainsAddress(uint32_t address) {
   return address >= low_address_ && address < high_address_;
 }
 
+void XexModule::SetupMemoryFunctions() {
+  static const struct {
+    const char* name;
+    GuestFunction::ExternHandler handler;
+  } kMemoryFunctions[] = {
+      {"memcpy", HostMemmove},  {"memmove", HostMemmove},
+      {"memset", HostMemset},   {"XMemCpy", HostMemmove},
+      {"XMemSet", HostMemset},
+  };
+  ForEachFunction([this](Function* function) {
+    if (!function->is_guest() ||
+        function->behavior() != Function::Behavior::kDefault ||
+        function->status() != Symbol::Status::kDeclared) {
+      return;
+    }
+    // C names may be decorated with a leading underscore.
+    const char* name = function->name().c_str();
+    if (name[0] == '_') {
+      ++name;
+    }
+    for (auto& memory_function : kMemoryFunctions) {
+      if (std::strcmp(name, memory_function.name)) {
+        continue;
+      }
+      // Like the kernel imports, the function is replaced with a syscall
+      // into the handler.
+      //     sc
+      //     blr
+      uint8_t* p = memory()->TranslateVirtual(function->address());
+      xe::store_and_swap<uint32_t>(p + 0x0, 0x44000002);
+      xe::store_and_swap<uint32_t>(p + 0x4, 0x4E800020);
+      function->set_end_address(function->address() + 4);
+      static_cast<GuestFunction*>(function)->SetupExtern(
+          memory_function.handler);
+      XELOGI("Using host %s for %s at %.8X", memory_function.name,
+             function->name().c_str(), function->address());
+      break;
+    }
+  });
+}
+
+std::vector<uint32_t> XexModule::FindFunctionStarts() const {
+  std::vector<uint32_t> addresses;
+
+  uint32_t entry_point = 0;
+  if (GetOptHeader(XEX_HEADER_ENTRY_POINT, &entry_point) && entry_point) {
+    addresses.push_back(entry_point);
+  }
+
+  // .pdata holds IMAGE_CE_RUNTIME_FUNCTION_ENTRYs for everything with unwind
+  // info, which is nearly every non-leaf function the compiler emitted.
+  auto pdata = xe_xex2_get_pe_section(xex_, ".pdata");
+  if (pdata) {
+    auto entries = memory()->TranslateVirtual<const xe::be<uint32_t>*>(
+        pdata->address);
+    for (uint32_t i = 0; i + 1 < pdata->size / 4; i += 2) {
+      uint32_t address = entries[i];
+      if (address >= low_address_ && address < high_address_ &&
+          !(address & 0x3)) {
+        addresses.push_back(address);
+      }
+    }
+  }
+
+  return addresses;
+}
+
 std::unique_ptr<Function> XexModule::CreateFunction(uint32_t address) {
   return std::unique_ptr<Function>(
       processor_->backend()->CreateGuestFunction(this, address));
@@ -11,6 +11,7 @@
 #define XENIA_CPU_XEX_MODULE_H_
 
 #include <string>
+#include <unordered_map>
 #include <vector>
 
 #include "xenia/cpu/module.h"
@@ -78,6 +79,10 @@ class XexModule : public xe::cpu::Module {
 
   bool ContainsAddress(uint32_t address) override;
 
+  // Addresses known to start functions: the entry point and the entries of
+  // the .pdata function table. Everything else is found by following calls.
+  std::vector<uint32_t> FindFunctionStarts() const;
+
  protected:
   std::unique_ptr<Function> CreateFunction(uint32_t address) override;
 
@@ -85,6 +90,10 @@ class XexModule : public xe::cpu::Module {
   bool SetupLibraryImports(const char* name,
                            const xex2_import_library* library);
   bool FindSaveRest();
+  // Redirects the bulk memory functions named in the module map to the host.
+  void SetupMemoryFunctions();
+  // Fills export_names_ from the PE export directory of the loaded image.
+  void IndexExportNames();
 
   Processor* processor_ = nullptr;
   kernel::KernelState* kernel_state_ = nullptr;
@@ -97,6 +106,10 @@ class XexModule : public xe::cpu::Module {
   uint32_t base_address_ = 0;
   uint32_t low_address_ = 0;
   uint32_t high_address_ = 0;
+
+  // Addresses of the exports by name, for titles resolving procedures by
+  // name as they run. Not changed after loading, so read without locking.
+  std::unordered_map<std::string, uint32_t> export_names_;
 };
 
 }  // namespace cpu
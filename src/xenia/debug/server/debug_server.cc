@@ -0,0 +1,449 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2016 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#include "xenia/debug/server/debug_server.h"
+
+#include <algorithm>
+#include <cstring>
+#include <string>
+#include <utility>
+
+#include "xenia/base/counters.h"
+#include "xenia/base/logging.h"
+#include "xenia/base/math.h"
+#include "xenia/base/platform.h"
+#include "xenia/cpu/thread_debug_info.h"
+#include "xenia/gpu/graphics_system.h"
+
+namespace xe {
+namespace debug {
+namespace server {
+
+using xe::cpu::Breakpoint;
+using xe::cpu::ThreadDebugInfo;
+using protocol::PacketHeader;
+using protocol::PacketType;
+using protocol::Status;
+
+namespace {
+
+template <typename T>
+void Append(std::vector<uint8_t>* body, T value) {
+  size_t offset = body->size();
+  body->resize(offset + sizeof(T));
+  std::memcpy(body->data() + offset, &value, sizeof(T));
+}
+
+void AppendString(std::vector<uint8_t>* body, const std::string& value) {
+  auto length = uint16_t(std::min(value.size(), size_t(UINT16_MAX)));
+  Append(body, length);
+  body->insert(body->end(), value.begin(), value.begin() + length);
+}
+
+// Reads values from a request body, failing once it runs out.
+class BodyReader {
+ public:
+  BodyReader(const uint8_t* data, size_t length)
+      : data_(data), remaining_(length) {}
+
+  template <typename T>
+  bool Read(T* out_value) {
+    if (remaining_ < sizeof(T)) {
+      return false;
+    }
+    std::memcpy(out_value, data_, sizeof(T));
+    data_ += sizeof(T);
+    remaining_ -= sizeof(T);
+    return true;
+  }
+
+ private:
+  const uint8_t* data_;
+  size_t remaining_;
+};
+
+protocol::ExecutionState ToProtocol(cpu::ExecutionState state) {
+  switch (state) {
+    case cpu::ExecutionState::kRunning:
+      return protocol::ExecutionState::kRunning;
+    case cpu::ExecutionState::kStepping:
+      return protocol::ExecutionState::kStepping;
+    case cpu::ExecutionState::kPaused:
+      return protocol::ExecutionState::kPaused;
+    case cpu::ExecutionState::kEnded:
+    default:
+      return protocol::ExecutionState::kEnded;
+  }
+}
+
+protocol::ThreadState ToProtocol(ThreadDebugInfo::State state) {
+  switch (state) {
+    case ThreadDebugInfo::State::kAlive:
+      return protocol::ThreadState::kAlive;
+    case ThreadDebugInfo::State::kWaiting:
+      return protocol::ThreadState::kWaiting;
+    case ThreadDebugInfo::State::kExited:
+      return protocol::ThreadState::kExited;
+    case ThreadDebugInfo::State::kZombie:
+    default:
+      return protocol::ThreadState::kZombie;
+  }
+}
+
+protocol::BreakpointAddressType ToProtocol(Breakpoint::AddressType type) {
+  return type == Breakpoint::AddressType::kGuest
+             ? protocol::BreakpointAddressType::kGuest
+             : protocol::BreakpointAddressType::kHost;
+}
+
+}  // namespace
+
+DebugServer::DebugServer(Emulator* emulator)
+    : emulator_(emulator), processor_(emulator->processor()) {}
+
+DebugServer::~DebugServer() {
+  if (shutdown_event_) {
+    shutdown_event_->Set();
+  }
+  if (thread_) {
+    xe::threading::Wait(thread_.get(), false);
+  }
+  socket_server_.reset();
+  if (processor_->debug_listener() == this) {
+    processor_->set_debug_listener(nullptr);
+  }
+  std::lock_guard<std::mutex> lock(client_mutex_);
+  if (client_) {
+    client_->Close();
+    client_.reset();
+  }
+}
+
+std::unique_ptr<DebugServer> DebugServer::Create(Emulator* emulator,
+                                                 uint16_t port) {
+  std::unique_ptr<DebugServer> debug_server(new DebugServer(emulator));
+  if (!debug_server->Initialize(port)) {
+    return nullptr;
+  }
+  return debug_server;
+}
+
+bool DebugServer::Initialize(uint16_t port) {
+  shutdown_event_ = xe::threading::Event::CreateManualResetEvent(false);
+  client_event_ = xe::threading::Event::CreateAutoResetEvent(false);
+
+#if XE_PLATFORM_WIN32
+  socket_server_ =
+      SocketServer::Create(port, [this](std::unique_ptr<Socket> client) {
+        AcceptClient(std::move(client));
+      });
+  if (!socket_server_) {
+    XELOGE("Unable to listen on port %d for the debug server", port);
+    return false;
+  }
+#else
+  XELOGE("The debug server isn't supported on this platform");
+  return false;
+#endif  // XE_PLATFORM_WIN32
+
+  thread_ = xe::threading::Thread::Create({}, [this]() { ThreadMain(); });
+  thread_->set_name("Debug Server");
+  XELOGI("Debug server listening on port %d", port);
+  return true;
+}
+
+void DebugServer::AcceptClient(std::unique_ptr<Socket> client) {
+  {
+    std::lock_guard<std::mutex> lock(client_mutex_);
+    if (client_) {
+      XELOGW("Debug server already has a client; refusing another");
+      client->Close();
+      return;
+    }
+    client_ = std::move(client);
+  }
+  XELOGI("Debug client connected");
+  processor_->set_debug_listener(this);
+  client_event_->Set();
+}
+
+void DebugServer::ThreadMain() {
+  while (true) {
+    std::shared_ptr<Socket> client;
+    {
+      std::lock_guard<std::mutex> lock(client_mutex_);
+      client = client_;
+    }
+    xe::threading::WaitHandle* wait_handles[] = {
+        shutdown_event_.get(),
+        client ? client->wait_handle() : client_event_.get(),
+    };
+    auto result = xe::threading::WaitAny(wait_handles, 2, false);
+    if (result.first == xe::threading::WaitResult::kSuccess &&
+        result.second == 0) {
+      break;
+    }
+    if (client && (!client->is_connected() || !ReceivePackets(client.get()))) {
+      DisconnectClient();
+    }
+  }
+}
+
+bool DebugServer::ReceivePackets(Socket* client) {
+  uint8_t buffer[4096];
+  while (true) {
+    size_t length = client->Receive(buffer, sizeof(buffer));
+    if (length == size_t(-1)) {
+      return false;
+    }
+    if (!length) {
+      break;
+    }
+    receive_buffer_.insert(receive_buffer_.end(), buffer, buffer + length);
+  }
+
+  size_t offset = 0;
+  while (receive_buffer_.size() - offset >= sizeof(PacketHeader)) {
+    PacketHeader header;
+    std::memcpy(&header, receive_buffer_.data() + offset, sizeof(header));
+    if (header.body_length > protocol::kMaxBodyLength) {
+      XELOGE("Debug client sent a %u byte packet; disconnecting",
+             header.body_length);
+      return false;
+    }
+    size_t packet_length = sizeof(header) + header.body_length;
+    if (receive_buffer_.size() - offset < packet_length) {
+      break;
+    }
+    HandlePacket(header, receive_buffer_.data() + offset + sizeof(header));
+    offset += packet_length;
+  }
+  receive_buffer_.erase(receive_buffer_.begin(),
+                        receive_buffer_.begin() + offset);
+  return true;
+}
+
+void DebugServer::HandlePacket(const PacketHeader& header,
+                               const uint8_t* body) {
+  BodyReader reader(body, header.body_length);
+  // The status is filled in once the request has been handled.
+  std::vector<uint8_t> response(sizeof(Status));
+  Status status = Status::kSuccess;
+  auto execution_state = processor_->execution_state();
+  bool is_paused = execution_state == cpu::ExecutionState::kPaused;
+  switch (header.type) {
+    case PacketType::kHello: {
+      Append(&response, protocol::kProtocolVersion);
+      Append(&response, ToProtocol(execution_state));
+    } break;
+
+    case PacketType::kPause: {
+      if (execution_state != cpu::ExecutionState::kRunning) {
+        status = Status::kInvalidState;
+        break;
+      }
+      processor_->Pause();
+    } break;
+    case PacketType::kContinue: {
+      if (!is_paused) {
+        status = Status::kInvalidState;
+        break;
+      }
+      processor_->Continue();
+    } break;
+    case PacketType::kStepGuestInstruction:
+    case PacketType::kStepHostInstruction: {
+      uint32_t thread_id;
+      if (!reader.Read(&thread_id) ||
+          !processor_->QueryThreadDebugInfo(thread_id)) {
+        status = Status::kInvalidArgument;
+        break;
+      }
+      if (!is_paused) {
+        status = Status::kInvalidState;
+        break;
+      }
+      if (header.type == PacketType::kStepGuestInstruction) {
+        processor_->StepGuestInstruction(thread_id);
+      } else {
+        processor_->StepHostInstruction(thread_id);
+      }
+    } break;
+
+    case PacketType::kAddBreakpoint:
+    case PacketType::kRemoveBreakpoint: {
+      protocol::BreakpointAddressType protocol_type;
+      uint64_t address;
+      if (!reader.Read(&protocol_type) || !reader.Read(&address) ||
+          (protocol_type != protocol::BreakpointAddressType::kGuest &&
+           protocol_type != protocol::BreakpointAddressType::kHost)) {
+        status = Status::kInvalidArgument;
+        break;
+      }
+      auto address_type =
+          protocol_type == protocol::BreakpointAddressType::kGuest
+              ? Breakpoint::AddressType::kGuest
+              : Breakpoint::AddressType::kHost;
+      std::lock_guard<std::mutex> lock(breakpoints_mutex_);
+      auto it = std::find_if(
+          breakpoints_.begin(), breakpoints_.end(),
+          [&](const std::unique_ptr<Breakpoint>& breakpoint) {
+            return breakpoint->address_type() == address_type &&
+                   breakpoint->address() == address;
+          });
+      if (header.type == PacketType::kAddBreakpoint) {
+        if (it != breakpoints_.end()) {
+          status = Status::kInvalidArgument;
+          break;
+        }
+        auto breakpoint = std::make_unique<Breakpoint>(
+            processor_, address_type, address,
+            [this](Breakpoint* breakpoint, ThreadDebugInfo* thread_info,
+                   uint64_t host_address) {
+              OnBreakpointHit(breakpoint, thread_info);
+            });
+        processor_->AddBreakpoint(breakpoint.get());
+        breakpoints_.push_back(std::move(breakpoint));
+      } else {
+        if (it == breakpoints_.end()) {
+          status = Status::kInvalidArgument;
+          break;
+        }
+        processor_->RemoveBreakpoint(it->get());
+        breakpoints_.erase(it);
+      }
+    } break;
+
+    case PacketType::kQueryThreads: {
+      // The stacks are only sampled, and safe to read, while stopped.
+      if (!is_paused && execution_state != cpu::ExecutionState::kEnded) {
+        status = Status::kInvalidState;
+        break;
+      }
+      auto thread_infos = processor_->QueryThreadDebugInfos();
+      Append(&response, uint32_t(thread_infos.size()));
+      for (auto thread_info : thread_infos) {
+        Append(&response, thread_info->thread_id);
+        Append(&response, thread_info->thread_handle);
+        Append(&response, ToProtocol(thread_info->state));
+        Append(&response, uint32_t(thread_info->suspended ? 1 : 0));
+        Append(&response, uint32_t(thread_info->frames.size()));
+        for (auto& frame : thread_info->frames) {
+          Append(&response, frame.host_pc);
+          Append(&response, frame.guest_pc);
+          AppendString(&response, frame.guest_function
+                                      ? frame.guest_function->name()
+                                      : std::string(frame.name));
+        }
+      }
+    } break;
+    case PacketType::kQueryCounters: {
+      auto counters = Counter::Snapshot();
+      Append(&response, uint32_t(counters.size()));
+      for (auto& counter : counters) {
+        AppendString(&response, counter.first);
+        Append(&response, counter.second);
+      }
+    } break;
+
+    case PacketType::kRequestFrameTrace: {
+      emulator_->graphics_system()->RequestFrameTrace();
+    } break;
+    case PacketType::kBeginTracing: {
+      emulator_->graphics_system()->BeginTracing();
+    } break;
+    case PacketType::kEndTracing: {
+      emulator_->graphics_system()->EndTracing();
+    } break;
+
+    default: {
+      status = Status::kUnknownRequest;
+    } break;
+  }
+
+  if (status != Status::kSuccess) {
+    response.resize(sizeof(Status));
+  }
+  std::memcpy(response.data(), &status, sizeof(status));
+  Send(header.type, header.request_id, response);
+}
+
+void DebugServer::DisconnectClient() {
+  {
+    std::lock_guard<std::mutex> lock(client_mutex_);
+    client_.reset();
+  }
+  receive_buffer_.clear();
+  XELOGI("Debug client disconnected");
+  // Removes the breakpoints and continues execution.
+  if (processor_->debug_listener() == this) {
+    processor_->set_debug_listener(nullptr);
+  }
+}
+
+void DebugServer::Send(PacketType type, uint32_t request_id,
+                       const std::vector<uint8_t>& body) {
+  std::shared_ptr<Socket> client;
+  {
+    std::lock_guard<std::mutex> lock(client_mutex_);
+    client = client_;
+  }
+  if (!client) {
+    return;
+  }
+  PacketHeader header;
+  header.type = type;
+  header.request_id = request_id;
+  header.body_length = uint32_t(body.size());
+  std::pair<const void*, size_t> buffers[] = {
+      {&header, sizeof(header)}, {body.data(), body.size()},
+  };
+  client->Send(buffers, xe::countof(buffers));
+}
+
+void DebugServer::SendExecutionState() {
+  std::vector<uint8_t> body;
+  Append(&body, ToProtocol(processor_->execution_state()));
+  Send(PacketType::kExecutionStateChanged, 0, body);
+}
+
+void DebugServer::OnFocus() {}
+
+void DebugServer::OnDetached() {
+  std::lock_guard<std::mutex> lock(breakpoints_mutex_);
+  for (auto& breakpoint : breakpoints_) {
+    processor_->RemoveBreakpoint(breakpoint.get());
+  }
+  breakpoints_.clear();
+}
+
+void DebugServer::OnExecutionPaused() { SendExecutionState(); }
+
+void DebugServer::OnExecutionContinued() { SendExecutionState(); }
+
+void DebugServer::OnExecutionEnded() { SendExecutionState(); }
+
+void DebugServer::OnStepCompleted(ThreadDebugInfo* thread_info) {
+  std::vector<uint8_t> body;
+  Append(&body, thread_info->thread_id);
+  Send(PacketType::kStepCompleted, 0, body);
+}
+
+void DebugServer::OnBreakpointHit(Breakpoint* breakpoint,
+                                  ThreadDebugInfo* thread_info) {
+  std::vector<uint8_t> body;
+  Append(&body, thread_info->thread_id);
+  Append(&body, ToProtocol(breakpoint->address_type()));
+  Append(&body, breakpoint->address());
+  Send(PacketType::kBreakpointHit, 0, body);
+}
+
+}  // namespace server
+}  // namespace debug
+}  // namespace xe
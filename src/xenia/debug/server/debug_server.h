@@ -0,0 +1,93 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2016 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#ifndef XENIA_DEBUG_SERVER_DEBUG_SERVER_H_
+#define XENIA_DEBUG_SERVER_DEBUG_SERVER_H_
+
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "xenia/base/socket.h"
+#include "xenia/base/threading.h"
+#include "xenia/cpu/breakpoint.h"
+#include "xenia/cpu/debug_listener.h"
+#include "xenia/cpu/processor.h"
+#include "xenia/debug/server/protocol.h"
+#include "xenia/emulator.h"
+
+namespace xe {
+namespace debug {
+namespace server {
+
+// Exposes the processor debugger, the counters and GPU trace capture to a
+// remote client over the protocol in protocol.h, for debugging without the
+// debug window (such as with --headless).
+//
+// One client is served at a time, and the server is the debug listener of
+// the processor while it is connected. Breakpoints added by the client are
+// removed and execution continues when it disconnects.
+class DebugServer : public cpu::DebugListener {
+ public:
+  ~DebugServer();
+
+  // Returns null if the port can't be listened on.
+  static std::unique_ptr<DebugServer> Create(Emulator* emulator,
+                                             uint16_t port);
+
+  void OnFocus() override;
+  void OnDetached() override;
+  void OnExecutionPaused() override;
+  void OnExecutionContinued() override;
+  void OnExecutionEnded() override;
+  void OnStepCompleted(cpu::ThreadDebugInfo* thread_info) override;
+  void OnBreakpointHit(cpu::Breakpoint* breakpoint,
+                       cpu::ThreadDebugInfo* thread_info) override;
+
+ private:
+  explicit DebugServer(Emulator* emulator);
+  bool Initialize(uint16_t port);
+
+  void AcceptClient(std::unique_ptr<Socket> client);
+  void ThreadMain();
+  // Returns false if the client must be dropped.
+  bool ReceivePackets(Socket* client);
+  void HandlePacket(const protocol::PacketHeader& header, const uint8_t* body);
+  void DisconnectClient();
+
+  // Sends the packet to the client, if there is one.
+  void Send(protocol::PacketType type, uint32_t request_id,
+            const std::vector<uint8_t>& body);
+  void SendExecutionState();
+
+  Emulator* emulator_ = nullptr;
+  cpu::Processor* processor_ = nullptr;
+  std::unique_ptr<SocketServer> socket_server_;
+  std::unique_ptr<xe::threading::Thread> thread_;
+  std::unique_ptr<xe::threading::Event> shutdown_event_;
+  // Set when a client has connected.
+  std::unique_ptr<xe::threading::Event> client_event_;
+
+  // Guards client_.
+  std::mutex client_mutex_;
+  std::shared_ptr<Socket> client_;
+  // Received data that doesn't make up a whole packet yet. Only used by the
+  // server thread.
+  std::vector<uint8_t> receive_buffer_;
+
+  // Guards breakpoints_.
+  std::mutex breakpoints_mutex_;
+  std::vector<std::unique_ptr<cpu::Breakpoint>> breakpoints_;
+};
+
+}  // namespace server
+}  // namespace debug
+}  // namespace xe
+
+#endif  // XENIA_DEBUG_SERVER_DEBUG_SERVER_H_
@@ -0,0 +1,19 @@
+project_root = "../../../.."
+include(project_root.."/tools/build")
+
+group("src")
+project("xenia-debug-server")
+  uuid("3c6d8e2a-5f41-4b8e-9d27-6a0f1e4c7b93")
+  kind("StaticLib")
+  language("C++")
+  links({
+    "xenia-base",
+    "xenia-cpu",
+    "xenia-gpu",
+  })
+  defines({
+  })
+  includedirs({
+    project_root.."/third_party/gflags/src",
+  })
+  local_platform_files()
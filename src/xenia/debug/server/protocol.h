@@ -0,0 +1,127 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2016 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#ifndef XENIA_DEBUG_SERVER_PROTOCOL_H_
+#define XENIA_DEBUG_SERVER_PROTOCOL_H_
+
+#include <cstdint>
+
+namespace xe {
+namespace debug {
+namespace server {
+namespace protocol {
+
+// Packets in both directions are a PacketHeader followed by body_length bytes
+// of body. All values are little-endian. Strings are a uint16_t length and
+// that many bytes, without a terminator.
+//
+// Each request is answered by a response packet of the same type and
+// request_id, whose body starts with a uint32_t Status. Events are sent as
+// they happen with a request_id of 0.
+
+static const uint32_t kProtocolVersion = 1;
+
+// Requests larger than this close the connection.
+static const uint32_t kMaxBodyLength = 64 * 1024;
+
+enum class PacketType : uint32_t {
+  // Request: none.
+  // Response: uint32_t protocol version, uint32_t ExecutionState.
+  kHello = 1,
+
+  // Request: none.
+  // Response: none.
+  kPause = 2,
+  kContinue = 3,
+  // Request: uint32_t thread ID.
+  // Response: none.
+  kStepGuestInstruction = 4,
+  kStepHostInstruction = 5,
+
+  // Request: uint32_t BreakpointAddressType, uint64_t address.
+  // Response: none. Adding one that exists or removing one that doesn't
+  // fails with kInvalidArgument.
+  kAddBreakpoint = 10,
+  kRemoveBreakpoint = 11,
+
+  // Request: none.
+  // Response: uint32_t thread count, then for each thread:
+  //   uint32_t thread ID, uint32_t thread handle, uint32_t ThreadState,
+  //   uint32_t suspended (0 or 1), uint32_t frame count, then for each frame:
+  //     uint64_t host pc, uint32_t guest pc (0 if not guest code),
+  //     string function name.
+  // Stacks and states are sampled when execution last stopped.
+  kQueryThreads = 20,
+  // Request: none.
+  // Response: uint32_t counter count, then for each counter:
+  //   string name, uint64_t value.
+  kQueryCounters = 21,
+
+  // Request: none.
+  // Response: none.
+  kRequestFrameTrace = 30,
+  kBeginTracing = 31,
+  kEndTracing = 32,
+
+  // Events. Body: uint32_t ExecutionState.
+  kExecutionStateChanged = 100,
+  // Events. Body: uint32_t thread ID.
+  kStepCompleted = 101,
+  // Events. Body: uint32_t thread ID, uint32_t BreakpointAddressType,
+  //   uint64_t address.
+  kBreakpointHit = 102,
+};
+
+enum class Status : uint32_t {
+  kSuccess = 0,
+  // The packet type isn't known.
+  kUnknownRequest = 1,
+  // The body is malformed or refers to something that doesn't exist.
+  kInvalidArgument = 2,
+  // The request can't be handled in the current execution state.
+  kInvalidState = 3,
+};
+
+// Values of cpu::ExecutionState.
+enum class ExecutionState : uint32_t {
+  kRunning = 0,
+  kStepping = 1,
+  kPaused = 2,
+  kEnded = 3,
+};
+
+// Values of cpu::ThreadDebugInfo::State.
+enum class ThreadState : uint32_t {
+  kAlive = 0,
+  kWaiting = 1,
+  kExited = 2,
+  kZombie = 3,
+};
+
+// Values of cpu::Breakpoint::AddressType.
+enum class BreakpointAddressType : uint32_t {
+  kGuest = 0,
+  kHost = 1,
+};
+
+#pragma pack(push, 1)
+struct PacketHeader {
+  PacketType type;
+  uint32_t request_id;
+  uint32_t body_length;
+};
+#pragma pack(pop)
+static_assert(sizeof(PacketHeader) == 12, "Packet header must be packed");
+
+}  // namespace protocol
+}  // namespace server
+}  // namespace debug
+}  // namespace xe
+
+#endif  // XENIA_DEBUG_SERVER_PROTOCOL_H_
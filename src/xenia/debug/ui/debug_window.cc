@@ -27,6 +27,7 @@
 #include "xenia/base/string_util.h"
 #include "xenia/base/threading.h"
 #include "xenia/cpu/breakpoint.h"
+#include "xenia/cpu/cpu_flags.h"
 #include "xenia/cpu/ppc/ppc_opcode_info.h"
 #include "xenia/cpu/stack_walker.h"
 #include "xenia/gpu/graphics_system.h"
@@ -197,6 +198,9 @@ void DebugWindow::DrawFrame() {
   ImGui::SameLine();
   ImGui::RadioButton("Memory", &state_.right_pane_tab,
                      ImState::kRightPaneMemory);
+  ImGui::SameLine();
+  ImGui::RadioButton("Profile", &state_.right_pane_tab,
+                     ImState::kRightPaneProfile);
   ImGui::EndGroup();
   ImGui::Separator();
   switch (state_.right_pane_tab) {
@@ -210,6 +214,11 @@ void DebugWindow::DrawFrame() {
       DrawMemoryPane();
       ImGui::EndChild();
       break;
+    case ImState::kRightPaneProfile:
+      ImGui::BeginChild("##profile_pane");
+      DrawProfilePane();
+      ImGui::EndChild();
+      break;
   }
   ImGui::EndChild();
   ImGui::InvisibleButton("##hsplitter0", ImVec2(-1, kSplitterWidth));
@@ -446,146 +455,140 @@ void DebugWindow::DrawGuestFunctionSource() {
   //     click code address to jump to code
   //     click memory address to jump to memory browser
   //     if historical data for memory/etc present, show combo boxes
-  auto memory = emulator_->memory();
   auto function = static_cast<cpu::GuestFunction*>(state_.function);
-  auto& source_map = function->source_map();
-  uint32_t source_map_index = 0;
 
-  bool draw_hir = false;
-  bool draw_hir_opt = false;
-  bool draw_x64 = false;
-  switch (state_.source_display_mode) {
-    case 1:
-      draw_hir = true;
-      draw_x64 = true;
-      break;
-    case 2:
-      draw_hir_opt = true;
-      draw_x64 = true;
-      break;
-    case 3:
-      draw_x64 = true;
-      break;
-  }
-
-  auto guest_pc =
-      state_.thread_info
-          ? state_.thread_info->frames[state_.thread_stack_frame_index].guest_pc
-          : 0;
+  // HIR isn't available yet, so all modes other than PPC only add x64.
+  bool draw_x64 = state_.source_display_mode != 0;
+  UpdateSourceCache(function, draw_x64);
+  auto& lines = cache_.source.lines;
 
-  if (draw_hir) {
-    // TODO(benvanik): get HIR and draw preamble.
-  }
-  if (draw_hir_opt) {
-    // TODO(benvanik): get HIR and draw preamble.
-  }
-  if (draw_x64) {
-    // x64 preamble.
-    DrawMachineCodeSource(function->machine_code(), source_map[0].code_offset);
+  uint32_t guest_pc = 0;
+  uint64_t host_pc = 0;
+  if (state_.thread_info) {
+    auto& frame = state_.thread_info->frames[state_.thread_stack_frame_index];
+    guest_pc = frame.guest_pc;
+    host_pc = frame.host_pc;
   }
 
-  StringBuffer str;
-  for (uint32_t address = function->address();
-       address <= function->end_address(); address += 4) {
-    ImGui::PushID(address);
+  // Only the visible lines are drawn, unless the pc has changed and the
+  // current one has to be scrolled to.
+  int display_start = 0;
+  int display_end = static_cast<int>(lines.size());
+  float line_height = ImGui::GetItemsLineHeightWithSpacing();
+  if (!state_.has_changed_pc) {
+    ImGui::CalcListClipping(display_end, line_height, &display_start,
+                            &display_end);
+  }
+  ImGui::SetCursorPosY(ImGui::GetCursorPosY() + display_start * line_height);
+  for (int i = display_start; i < display_end; ++i) {
+    auto& line = lines[i];
+    ImGui::PushID(reinterpret_cast<void*>(line.address));
 
     // TODO(benvanik): check other threads?
-    bool is_current_instr = address == guest_pc;
+    bool is_current_instr;
+    if (line.is_host) {
+      is_current_instr = state_.thread_info && line.address == host_pc;
+    } else {
+      is_current_instr = line.address == guest_pc;
+    }
     if (is_current_instr) {
       ImGui::PushStyleColor(ImGuiCol_Text, ImVec4(0.0f, 1.0f, 0.0f, 1.0f));
-      if (!draw_x64) {
+      if (line.is_host || !draw_x64) {
         ScrollToSourceIfPcChanged();
       }
+    } else if (line.is_host) {
+      ImGui::PushStyleColor(ImGuiCol_Text, ImVec4(1.0f, 1.0f, 1.0f, 0.5f));
     }
 
-    bool has_guest_bp =
-        LookupBreakpointAtAddress(Breakpoint::AddressType::kGuest, address) !=
-        nullptr;
-    DrawBreakpointGutterButton(has_guest_bp, Breakpoint::AddressType::kGuest,
-                               address);
+    auto address_type = line.is_host ? Breakpoint::AddressType::kHost
+                                     : Breakpoint::AddressType::kGuest;
+    bool has_bp = LookupBreakpointAtAddress(address_type, line.address);
+    DrawBreakpointGutterButton(has_bp, address_type, line.address);
     ImGui::SameLine();
 
-    ImGui::Text(" %c ", is_current_instr ? '>' : ' ');
+    char marker = is_current_instr ? '>' : ' ';
+    ImGui::Text(line.is_host ? "    %c " : " %c ", marker);
     ImGui::SameLine();
+    ImGui::Text("%s", line.text.c_str());
 
+    if (is_current_instr || line.is_host) {
+      ImGui::PopStyleColor();
+    }
+
+    ImGui::PopID();
+  }
+  ImGui::SetCursorPosY(ImGui::GetCursorPosY() +
+                       (int(lines.size()) - display_end) * line_height);
+}
+
+void DebugWindow::UpdateSourceCache(cpu::GuestFunction* function,
+                                    bool include_x64) {
+  // Retranslation replaces the machine code of the function.
+  auto& source = cache_.source;
+  if (source.function == function &&
+      source.machine_code == function->machine_code() &&
+      source.machine_code_length == function->machine_code_length() &&
+      source.includes_x64 == include_x64) {
+    return;
+  }
+  source.function = function;
+  source.machine_code = function->machine_code();
+  source.machine_code_length = function->machine_code_length();
+  source.includes_x64 = include_x64;
+  source.lines.clear();
+
+  auto memory = emulator_->memory();
+  auto& source_map = function->source_map();
+  uint32_t source_map_index = 0;
+
+  if (include_x64) {
+    // x64 preamble.
+    AppendMachineCodeSource(function->machine_code(),
+                            source_map[0].code_offset);
+  }
+
+  StringBuffer str;
+  char text[256];
+  for (uint32_t address = function->address();
+       address <= function->end_address(); address += 4) {
     uint32_t code =
         xe::load_and_swap<uint32_t>(memory->TranslateVirtual(address));
     cpu::ppc::DisasmPPC(address, code, &str);
-    ImGui::Text("%.8X %.8X   %s", address, code, str.GetString());
+    std::snprintf(text, xe::countof(text), "%.8X %.8X   %s", address, code,
+                  str.GetString());
     str.Reset();
-
-    if (is_current_instr) {
-      ImGui::PopStyleColor();
-    }
+    source.lines.push_back({false, address, text});
 
     while (source_map_index < source_map.size() &&
            source_map[source_map_index].guest_address != address) {
       ++source_map_index;
     }
-    if (source_map_index < source_map.size()) {
-      if (draw_hir) {
-        // TODO(benvanik): get HIR and draw for this PPC function.
-      }
-      if (draw_hir_opt) {
-        // TODO(benvanik): get HIR and draw for this PPC function.
-      }
-      if (draw_x64) {
-        const uint8_t* machine_code_start =
-            function->machine_code() + source_map[source_map_index].code_offset;
-        const size_t machine_code_length =
-            (source_map_index == source_map.size() - 1
-                 ? function->machine_code_length()
-                 : source_map[source_map_index + 1].code_offset) -
-            source_map[source_map_index].code_offset;
-        DrawMachineCodeSource(machine_code_start, machine_code_length);
-      }
+    if (include_x64 && source_map_index < source_map.size()) {
+      const uint8_t* machine_code_start =
+          function->machine_code() + source_map[source_map_index].code_offset;
+      const size_t machine_code_length =
+          (source_map_index == source_map.size() - 1
+               ? function->machine_code_length()
+               : source_map[source_map_index + 1].code_offset) -
+          source_map[source_map_index].code_offset;
+      AppendMachineCodeSource(machine_code_start, machine_code_length);
     }
-
-    ImGui::PopID();
   }
 }
 
-void DebugWindow::DrawMachineCodeSource(const uint8_t* machine_code_ptr,
-                                        size_t length) {
-  auto host_pc =
-      state_.thread_info
-          ? state_.thread_info->frames[state_.thread_stack_frame_index].host_pc
-          : 0;
-
-  ImGui::PushStyleColor(ImGuiCol_Text, ImVec4(1.0f, 1.0f, 1.0f, 0.5f));
-  auto machine_code_start_ptr = machine_code_ptr;
+void DebugWindow::AppendMachineCodeSource(const uint8_t* machine_code_ptr,
+                                          size_t length) {
   size_t remaining_machine_code_size = length;
   uint64_t host_address = uint64_t(machine_code_ptr);
   cs_insn insn = {0};
+  char text[256];
   while (remaining_machine_code_size &&
          cs_disasm_iter(capstone_handle_, &machine_code_ptr,
                         &remaining_machine_code_size, &host_address, &insn)) {
-    ImGui::PushID(reinterpret_cast<void*>(insn.address));
-
-    bool is_current_instr = state_.thread_info && insn.address == host_pc;
-    if (is_current_instr) {
-      ImGui::PushStyleColor(ImGuiCol_Text, ImVec4(0.0f, 1.0f, 0.0f, 1.0f));
-      ScrollToSourceIfPcChanged();
-    }
-
-    bool has_host_bp = LookupBreakpointAtAddress(Breakpoint::AddressType::kHost,
-                                                 insn.address) != nullptr;
-    DrawBreakpointGutterButton(has_host_bp, Breakpoint::AddressType::kHost,
-                               insn.address);
-    ImGui::SameLine();
-
-    ImGui::Text("    %c ", is_current_instr ? '>' : ' ');
-    ImGui::SameLine();
-    ImGui::Text(" %.8X        %-10s %s", uint32_t(insn.address), insn.mnemonic,
-                insn.op_str);
-
-    if (is_current_instr) {
-      ImGui::PopStyleColor();
-    }
-
-    ImGui::PopID();
+    std::snprintf(text, xe::countof(text), " %.8X        %-10s %s",
+                  uint32_t(insn.address), insn.mnemonic, insn.op_str);
+    cache_.source.lines.push_back({true, insn.address, text});
   }
-  ImGui::PopStyleColor();
 }
 
 void DebugWindow::DrawBreakpointGutterButton(
@@ -998,8 +1001,7 @@ void DebugWindow::DrawThreadsPane() {
   for (size_t i = 0; i < cache_.thread_debug_infos.size(); ++i) {
     auto thread_info = cache_.thread_debug_infos[i];
     bool is_current_thread = thread_info == state_.thread_info;
-    auto thread =
-        emulator_->kernel_state()->GetThreadByID(thread_info->thread_id);
+    auto thread = cache_.threads[i].get();
     if (!thread) {
       // TODO(benvanik): better display of zombie thread states.
       continue;
@@ -1096,6 +1098,86 @@ void DebugWindow::DrawMemoryPane() {
   // https://github.com/ocornut/imgui/wiki/memory_editor_example
 }
 
+void DebugWindow::DrawProfilePane() {
+  auto& state = state_.profile;
+  auto profiler = processor_->sampling_profiler();
+  if (!profiler) {
+    ImGui::Text("Profiling is not supported on this host.");
+    return;
+  }
+
+  if (ImGui::Button(profiler->is_running() ? "Stop" : "Start")) {
+    if (profiler->is_running()) {
+      profiler->Stop();
+    } else {
+      profiler->Start(uint32_t(FLAGS_profile_guest_code_interval));
+    }
+  }
+  ImGui::SameLine();
+  if (ImGui::Button("Reset")) {
+    profiler->Reset();
+    state.last_refresh_time = 0;
+  }
+  uint64_t sample_count = profiler->sample_count();
+  ImGui::SameLine();
+  ImGui::Text("%" PRIu64 " samples", sample_count);
+  ImGui::Separator();
+
+  // Building the profile walks every sampled function, so only do it now and
+  // then.
+  uint64_t now = Clock::QueryHostUptimeMillis();
+  if (!state.last_refresh_time || now - state.last_refresh_time > 1000) {
+    state.modules = profiler->QueryProfile();
+    state.last_refresh_time = now;
+  }
+
+  ImGui::BeginChild("##profile_listing");
+  double total = double(std::max(sample_count, uint64_t(1)));
+  for (auto& module : state.modules) {
+    char module_label[256];
+    std::snprintf(module_label, xe::countof(module_label), "%s (%.1f%%)",
+                  module.name.c_str(), 100.0 * module.self_samples / total);
+    if (!ImGui::CollapsingHeader(module_label, nullptr, true, true)) {
+      continue;
+    }
+    ImGui::Text(" self%%  total%%");
+    for (size_t i = 0; i < std::min(module.functions.size(), size_t(100));
+         ++i) {
+      auto& function = module.functions[i];
+      char function_label[256];
+      std::snprintf(function_label, xe::countof(function_label),
+                    "%5.1f %6.1f  %.8X %s",
+                    100.0 * function.self_samples / total,
+                    100.0 * function.total_samples / total, function.address,
+                    function.name.c_str());
+      if (ImGui::Selectable(function_label)) {
+        auto target = processor_->LookupFunction(function.address);
+        if (target) {
+          // Jump to the hottest instruction.
+          uint32_t guest_pc = 0;
+          uint64_t guest_pc_samples = 0;
+          for (auto& it : function.address_samples) {
+            if (it.second > guest_pc_samples) {
+              guest_pc = it.first;
+              guest_pc_samples = it.second;
+            }
+          }
+          NavigateToFunction(target, guest_pc);
+        }
+      }
+      if (ImGui::IsItemHovered() && !function.callers.empty()) {
+        ImGui::BeginTooltip();
+        ImGui::Text("Callers:");
+        for (auto& caller : function.callers) {
+          ImGui::Text("  %.8X  %" PRIu64, caller.first, caller.second);
+        }
+        ImGui::EndTooltip();
+      }
+    }
+  }
+  ImGui::EndChild();
+}
+
 void DebugWindow::DrawBreakpointsPane() {
   auto& state = state_.breakpoints;
 
@@ -1453,6 +1535,11 @@ void DebugWindow::UpdateCache() {
       object_table->GetObjectsByType<XModule>(XObject::Type::kTypeModule);
 
   cache_.thread_debug_infos = processor_->QueryThreadDebugInfos();
+  cache_.threads.clear();
+  for (auto thread_info : cache_.thread_debug_infos) {
+    cache_.threads.push_back(
+        kernel_state->GetThreadByID(thread_info->thread_id));
+  }
 
   SelectThreadStackFrame(state_.thread_info, state_.thread_stack_frame_index,
                          false);
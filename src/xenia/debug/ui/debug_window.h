@@ -11,6 +11,7 @@
 #define XENIA_DEBUG_UI_DEBUG_WINDOW_H_
 
 #include <memory>
+#include <string>
 #include <vector>
 
 #include "xenia/base/x64_context.h"
@@ -56,7 +57,8 @@ class DebugWindow : public cpu::DebugListener {
   void DrawFunctionsPane();
   void DrawSourcePane();
   void DrawGuestFunctionSource();
-  void DrawMachineCodeSource(const uint8_t* ptr, size_t length);
+  void UpdateSourceCache(cpu::GuestFunction* function, bool include_x64);
+  void AppendMachineCodeSource(const uint8_t* ptr, size_t length);
   void DrawBreakpointGutterButton(bool has_breakpoint,
                                   cpu::Breakpoint::AddressType address_type,
                                   uint64_t address);
@@ -68,6 +70,7 @@ class DebugWindow : public cpu::DebugListener {
   bool DrawRegisterTextBoxes(int id, float* value);
   void DrawThreadsPane();
   void DrawMemoryPane();
+  void DrawProfilePane();
   void DrawBreakpointsPane();
   void DrawLogPane();
 
@@ -101,6 +104,23 @@ class DebugWindow : public cpu::DebugListener {
     bool is_running = false;
     std::vector<kernel::object_ref<kernel::XModule>> modules;
     std::vector<cpu::ThreadDebugInfo*> thread_debug_infos;
+    // The kernel thread of each of thread_debug_infos, or null if it's gone.
+    std::vector<kernel::object_ref<kernel::XThread>> threads;
+
+    // Disassembly of the function in the source pane, rebuilt when another
+    // one is selected or its machine code changes, such as on retranslation.
+    struct SourceLine {
+      bool is_host;
+      uint64_t address;
+      std::string text;
+    };
+    struct {
+      cpu::GuestFunction* function = nullptr;
+      const uint8_t* machine_code = nullptr;
+      size_t machine_code_length = 0;
+      bool includes_x64 = false;
+      std::vector<SourceLine> lines;
+    } source;
   } cache_;
 
   enum class RegisterGroup {
@@ -116,6 +136,7 @@ class DebugWindow : public cpu::DebugListener {
   struct ImState {
     static const int kRightPaneThreads = 0;
     static const int kRightPaneMemory = 1;
+    static const int kRightPaneProfile = 2;
     int right_pane_tab = kRightPaneThreads;
 
     cpu::ThreadDebugInfo* thread_info = nullptr;
@@ -139,6 +160,11 @@ class DebugWindow : public cpu::DebugListener {
           code_breakpoints_by_host_address;
     } breakpoints;
 
+    struct {
+      std::vector<cpu::SamplingProfiler::ModuleProfile> modules;
+      uint64_t last_refresh_time = 0;
+    } profile;
+
     xe::kernel::XThread* isolated_log_thread = nullptr;
   } state_;
 };
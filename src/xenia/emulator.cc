@@ -11,17 +11,31 @@
 
 #include <gflags/gflags.h>
 
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <utility>
+#include <vector>
+
 #include "xenia/apu/audio_system.h"
 #include "xenia/base/assert.h"
 #include "xenia/base/byte_stream.h"
 #include "xenia/base/clock.h"
+#include "xenia/base/counters.h"
 #include "xenia/base/debugging.h"
 #include "xenia/base/exception_handler.h"
+#include "xenia/base/filesystem.h"
 #include "xenia/base/logging.h"
 #include "xenia/base/mapped_memory.h"
+#include "xenia/base/memory.h"
 #include "xenia/base/profiling.h"
 #include "xenia/base/string.h"
+#include "xenia/base/task_scheduler.h"
 #include "xenia/cpu/backend/code_cache.h"
+#include "xenia/gpu/command_processor.h"
+#include "xenia/gpu/gpu_flags.h"
 #include "xenia/gpu/graphics_system.h"
 #include "xenia/hid/input_driver.h"
 #include "xenia/hid/input_system.h"
@@ -32,6 +46,7 @@
 #include "xenia/kernel/xboxkrnl/xboxkrnl_module.h"
 #include "xenia/memory.h"
 #include "xenia/ui/imgui_dialog.h"
+#include "xenia/vfs/devices/compressed_disc_image_device.h"
 #include "xenia/vfs/devices/disc_image_device.h"
 #include "xenia/vfs/devices/host_path_device.h"
 #include "xenia/vfs/devices/stfs_container_device.h"
@@ -39,15 +54,53 @@
 
 DEFINE_double(time_scalar, 1.0,
               "Scalar used to speed or slow time (1x, 2x, 1/2x, etc).");
+DEFINE_int32(benchmark_seconds, 0,
+             "Runs the title unpaced for this many host seconds after "
+             "--benchmark_warmup_seconds, then logs the guest frame rate and "
+             "subsystem utilization and exits. 0 to not benchmark.");
+DEFINE_int32(benchmark_warmup_seconds, 0,
+             "Host seconds to run the title before measuring it, to skip "
+             "loading.");
+DEFINE_string(title_profiles_path, "",
+              "Folder of per-title flag files, named like 4D5307E6.flags, "
+              "whose flags override the command line while that title runs. "
+              "See docs/title_profiles.md.");
+DEFINE_bool(density_mode, false,
+            "Lowers the footprint of each of many instances sharing a host: "
+            "caches on disk are mapped and shared rather than loaded, and "
+            "idle threads sleep rather than spin. Changes the defaults of "
+            "--code_cache_read_only, --xex_share_images, "
+            "--command_processor_idle_spin_us and --headless_vsync.");
+DEFINE_int32(memory_report_interval_ms, 0,
+             "Logs the host memory used by the instance and its subsystems "
+             "this often, in milliseconds. 0 to never report.");
 
 namespace xe {
 
+namespace {
+
+// Logs how long a phase of Setup took, from its start in host uptime.
+void LogSetupPhase(const char* name, uint32_t start_millis) {
+  XELOGI("Setup: %s took %ums", name,
+         Clock::QueryHostUptimeMillis() - start_millis);
+}
+
+}  // namespace
+
 Emulator::Emulator(const std::wstring& command_line)
     : command_line_(command_line) {}
 
 Emulator::~Emulator() {
   // Note that we delete things in the reverse order they were initialized.
 
+  Counter::StopExport();
+  memory_report_timer_.reset();
+
+  if (benchmark_thread_) {
+    benchmark_stop_event_->Set();
+    xe::threading::Wait(benchmark_thread_.get(), false);
+  }
+
   // Give the systems time to shutdown before we delete them.
   if (graphics_system_) {
     graphics_system_->Shutdown();
@@ -79,6 +132,7 @@ X_STATUS Emulator::Setup(
     std::function<std::vector<std::unique_ptr<hid::InputDriver>>(ui::Window*)>
         input_driver_factory) {
   X_STATUS result = X_STATUS_UNSUCCESSFUL;
+  uint32_t setup_start_millis = Clock::QueryHostUptimeMillis();
 
   display_window_ = display_window;
 
@@ -94,21 +148,49 @@ X_STATUS Emulator::Setup(
   // logical processors.
   xe::threading::EnableAffinityConfiguration();
 
+  // Written from now on if --counters_export is set.
+  Counter::StartExport();
+
+  if (FLAGS_density_mode) {
+    // Only the defaults, so flags given explicitly still win. The code cache
+    // is shared read-only, so it must be filled by an instance without it.
+    const char* density_defaults[][2] = {
+        {"code_cache_read_only", "true"},
+        {"xex_share_images", "true"},
+        {"command_processor_idle_spin_us", "500"},
+        {"headless_vsync", "true"},
+    };
+    for (auto& flag : density_defaults) {
+      google::SetCommandLineOptionWithMode(flag[0], flag[1],
+                                           google::SET_FLAGS_DEFAULT);
+    }
+  }
+
+  if (FLAGS_benchmark_seconds > 0) {
+    // Vblanks are issued as fast as possible and swaps never wait for the
+    // display, so the title runs as fast as the host allows.
+    FLAGS_vsync = false;
+  }
+
   // Create memory system first, as it is required for other systems.
+  uint32_t phase_start_millis = Clock::QueryHostUptimeMillis();
   memory_ = std::make_unique<Memory>();
   if (!memory_->Initialize()) {
     return false;
   }
+  LogSetupPhase("memory", phase_start_millis);
 
   // Shared export resolver used to attach and query for HLE exports.
   export_resolver_ = std::make_unique<xe::cpu::ExportResolver>();
 
   // Initialize the CPU.
+  phase_start_millis = Clock::QueryHostUptimeMillis();
   processor_ = std::make_unique<xe::cpu::Processor>(memory_.get(),
                                                     export_resolver_.get());
   if (!processor_->Setup()) {
     return X_STATUS_UNSUCCESSFUL;
   }
+  LogSetupPhase("processor", phase_start_millis);
 
   // Initialize the APU.
   if (audio_system_factory) {
@@ -135,11 +217,11 @@ X_STATUS Emulator::Setup(
       input_system_->AddDriver(std::move(input_drivers[i]));
     }
   }
-
-  result = input_system_->Setup();
-  if (result) {
-    return result;
-  }
+  // Counted by the command processor, which is up by the time the guest
+  // reads input.
+  input_system_->set_vblank_source([this]() {
+    return graphics_system_->command_processor()->counter();
+  });
 
   // Bring up the virtual filesystem used by the kernel.
   file_system_ = std::make_unique<xe::vfs::VirtualFileSystem>();
@@ -147,33 +229,71 @@ X_STATUS Emulator::Setup(
   // Shared kernel state.
   kernel_state_ = std::make_unique<xe::kernel::KernelState>(this);
 
-  // Setup the core components.
-  result = graphics_system_->Setup(processor_.get(), kernel_state_.get(),
-                                   display_window_);
-  if (result) {
-    return result;
-  }
-
+  // The core components only depend on the processor and the kernel state,
+  // not on each other, so the graphics device, the audio driver and the HLE
+  // kernel modules are brought up at once.
+  auto scheduler = xe::threading::TaskScheduler::shared();
+  xe::threading::TaskGroup setup_group;
+  X_STATUS graphics_result = X_STATUS_SUCCESS;
+  scheduler->Submit(
+      [this, &graphics_result]() {
+        uint32_t start_millis = Clock::QueryHostUptimeMillis();
+        graphics_result = graphics_system_->Setup(
+            processor_.get(), kernel_state_.get(), display_window_);
+        LogSetupPhase("graphics", start_millis);
+      },
+      xe::threading::TaskPriority::kHigh, &setup_group);
+  X_STATUS audio_result = X_STATUS_SUCCESS;
   if (audio_system_) {
-    result = audio_system_->Setup(kernel_state_.get());
-    if (result) {
-      return result;
-    }
+    scheduler->Submit(
+        [this, &audio_result]() {
+          uint32_t start_millis = Clock::QueryHostUptimeMillis();
+          audio_result = audio_system_->Setup(kernel_state_.get());
+          LogSetupPhase("audio", start_millis);
+        },
+        xe::threading::TaskPriority::kHigh, &setup_group);
   }
 
+  phase_start_millis = Clock::QueryHostUptimeMillis();
+  result = input_system_->Setup();
+  LogSetupPhase("input", phase_start_millis);
+
   // HLE kernel modules.
+  phase_start_millis = Clock::QueryHostUptimeMillis();
   kernel_state_->LoadKernelModule<kernel::xboxkrnl::XboxkrnlModule>();
   kernel_state_->LoadKernelModule<kernel::xam::XamModule>();
+  LogSetupPhase("kernel modules", phase_start_millis);
+
+  scheduler->Wait(&setup_group);
+  if (result) {
+    return result;
+  }
+  if (graphics_result) {
+    return graphics_result;
+  }
+  if (audio_result) {
+    return audio_result;
+  }
 
   // Initialize emulator fallback exception handling last.
   ExceptionHandler::Install(Emulator::ExceptionCallbackThunk, this);
 
-  // Finish initializing the display.
-  display_window_->loop()->PostSynchronous([this]() {
-    xe::ui::GraphicsContextLock context_lock(display_window_->context());
-    Profiler::set_window(display_window_);
-  });
+  // Finish initializing the display, if there is one.
+  if (display_window_) {
+    display_window_->loop()->PostSynchronous([this]() {
+      xe::ui::GraphicsContextLock context_lock(display_window_->context());
+      Profiler::set_window(display_window_);
+    });
+  }
+
+  if (FLAGS_memory_report_interval_ms > 0) {
+    // On the shared timer thread, so it costs no thread of its own.
+    memory_report_timer_ = xe::threading::HighResolutionTimer::CreateRepeating(
+        std::chrono::milliseconds(FLAGS_memory_report_interval_ms),
+        [this]() { LogMemoryReport(); }, std::chrono::milliseconds(100));
+  }
 
+  LogSetupPhase("setup", setup_start_millis);
   return result;
 }
 
@@ -237,7 +357,13 @@ X_STATUS Emulator::LaunchDiscImage(std::wstring path) {
   auto mount_path = "\\Device\\Cdrom0";
 
   // Register the disc image in the virtual filesystem.
-  auto device = std::make_unique<vfs::DiscImageDevice>(mount_path, path);
+  std::unique_ptr<vfs::Device> device;
+  if (vfs::CompressedDiscImageDevice::IsCompressedImage(path)) {
+    device =
+        std::make_unique<vfs::CompressedDiscImageDevice>(mount_path, path);
+  } else {
+    device = std::make_unique<vfs::DiscImageDevice>(mount_path, path);
+  }
   if (!device->Initialize()) {
     xe::FatalError("Unable to mount disc image; file not found or corrupt.");
     return X_STATUS_NO_SUCH_FILE;
@@ -291,6 +417,8 @@ void Emulator::Pause() {
   auto threads =
       kernel_state()->object_table()->GetObjectsByType<kernel::XThread>(
           kernel::XObject::kTypeThread);
+  // Threads must not be stopped holding any of the kernel locks.
+  auto suspend_locks = kernel_state()->AcquireSuspendLocks();
   for (auto thread : threads) {
     if (!thread->can_debugger_suspend()) {
       // Don't pause host threads.
@@ -330,9 +458,52 @@ void Emulator::Resume() {
   }
 }
 
+// Snapshots start with a header, followed by the processor, graphics, audio
+// and kernel state, and then either all of memory or, in incremental ones,
+// the memory changed since the parent snapshot.
+const uint32_t kSnapshotMagic = 'XSAV';
+const uint32_t kIncrementalSnapshotMagic = 'XSVI';
+
+struct SnapshotHeader {
+  uint32_t magic;
+  // Unique to the snapshot, so a parent overwritten since is detected.
+  uint64_t id;
+  uint64_t parent_id;
+  std::wstring parent_path;
+  uint64_t memory_offset;
+};
+
+static bool ReadSnapshotHeader(ByteStream* stream, SnapshotHeader* header) {
+  header->magic = stream->Read<uint32_t>();
+  if (header->magic != kSnapshotMagic &&
+      header->magic != kIncrementalSnapshotMagic) {
+    return false;
+  }
+  header->id = stream->Read<uint64_t>();
+  header->parent_id = stream->Read<uint64_t>();
+  std::string parent_path(stream->Read<uint32_t>(), '\0');
+  stream->Read(reinterpret_cast<uint8_t*>(&parent_path[0]),
+               parent_path.size());
+  header->parent_path = xe::to_wstring(parent_path);
+  header->memory_offset = stream->Read<uint64_t>();
+  return true;
+}
+
 bool Emulator::SaveToFile(const std::wstring& path) {
+  return SaveSnapshot(path, false);
+}
+
+bool Emulator::SaveIncrementalToFile(const std::wstring& path) {
+  return SaveSnapshot(path, true);
+}
+
+bool Emulator::SaveSnapshot(const std::wstring& path, bool incremental) {
   Pause();
 
+  // Memory can only be saved incrementally since the last snapshot if it
+  // wasn't reset since.
+  incremental = incremental && last_snapshot_id_ && memory_->CanSaveDelta();
+
   filesystem::CreateFile(path);
   auto map = MappedMemory::Open(path, MappedMemory::Mode::kReadWrite, 0,
                                 1024ull * 1024ull * 1024ull * 4ull);
@@ -342,7 +513,17 @@ bool Emulator::SaveToFile(const std::wstring& path) {
 
   // Save the emulator state to a file
   ByteStream stream(map->data(), map->size());
-  stream.Write('XSAV');
+  uint64_t id = std::max(Clock::QueryHostSystemTime(), last_snapshot_id_ + 1);
+  std::string parent_path =
+      incremental ? xe::to_string(last_snapshot_path_) : std::string();
+  stream.Write(incremental ? kIncrementalSnapshotMagic : kSnapshotMagic);
+  stream.Write<uint64_t>(id);
+  stream.Write<uint64_t>(incremental ? last_snapshot_id_ : 0);
+  stream.Write<uint32_t>(uint32_t(parent_path.size()));
+  stream.Write(reinterpret_cast<const uint8_t*>(parent_path.data()),
+               parent_path.size());
+  size_t memory_offset_offset = stream.offset();
+  stream.Write<uint64_t>(0);
 
   // It's important we don't hold the global lock here! XThreads need to step
   // forward (possibly through guarded regions) without worry!
@@ -350,18 +531,55 @@ bool Emulator::SaveToFile(const std::wstring& path) {
   graphics_system_->Save(&stream);
   audio_system_->Save(&stream);
   kernel_state_->Save(&stream);
-  memory_->Save(&stream);
+  xe::store<uint64_t>(map->data() + memory_offset_offset, stream.offset());
+  bool saved =
+      incremental ? memory_->SaveDelta(&stream) : memory_->Save(&stream);
   map->Close(stream.offset());
 
+  if (saved) {
+    last_snapshot_path_ = path;
+    last_snapshot_id_ = id;
+  } else {
+    last_snapshot_id_ = 0;
+  }
+
   Resume();
-  return true;
+  return saved;
 }
 
 bool Emulator::RestoreFromFile(const std::wstring& path) {
-  // Restore the emulator state from a file
-  auto map = MappedMemory::Open(path, MappedMemory::Mode::kReadWrite);
-  if (!map) {
-    return false;
+  // Restore the emulator state from a file, after the chain of snapshots it
+  // is incremental to, from the full one on, has been opened and checked.
+  std::vector<std::unique_ptr<MappedMemory>> maps;
+  std::vector<SnapshotHeader> headers;
+  std::wstring snapshot_path = path;
+  uint64_t expected_id = 0;
+  while (true) {
+    auto map =
+        MappedMemory::Open(snapshot_path, MappedMemory::Mode::kReadWrite);
+    if (!map) {
+      XELOGE("Could not open snapshot %S", snapshot_path.c_str());
+      return false;
+    }
+    ByteStream header_stream(map->data(), map->size());
+    SnapshotHeader header;
+    if (!ReadSnapshotHeader(&header_stream, &header) ||
+        (expected_id && header.id != expected_id)) {
+      XELOGE("Snapshot %S is not the one expected", snapshot_path.c_str());
+      return false;
+    }
+    maps.insert(maps.begin(), std::move(map));
+    headers.insert(headers.begin(), header);
+    if (header.magic == kSnapshotMagic) {
+      break;
+    }
+    // Parents are always older, which ends the chain.
+    if (header.parent_id >= header.id) {
+      XELOGE("Snapshot %S has an invalid parent", snapshot_path.c_str());
+      return false;
+    }
+    snapshot_path = header.parent_path;
+    expected_id = header.parent_id;
   }
 
   restoring_ = true;
@@ -371,10 +589,9 @@ bool Emulator::RestoreFromFile(const std::wstring& path) {
   kernel_state_->TerminateTitle();
 
   auto lock = global_critical_region::AcquireDirect();
-  ByteStream stream(map->data(), map->size());
-  if (stream.Read<uint32_t>() != 'XSAV') {
-    return false;
-  }
+  ByteStream stream(maps.back()->data(), maps.back()->size());
+  SnapshotHeader header;
+  ReadSnapshotHeader(&stream, &header);
 
   if (!processor_->Restore(&stream)) {
     XELOGE("Could not restore processor!");
@@ -392,10 +609,19 @@ bool Emulator::RestoreFromFile(const std::wstring& path) {
     XELOGE("Could not restore kernel state!");
     return false;
   }
-  if (!memory_->Restore(&stream)) {
-    XELOGE("Could not restore memory!");
-    return false;
+  for (size_t i = 0; i < maps.size(); ++i) {
+    ByteStream memory_stream(maps[i]->data(), maps[i]->size(),
+                             size_t(headers[i].memory_offset));
+    bool restored = i ? memory_->RestoreDelta(&memory_stream)
+                      : memory_->Restore(&memory_stream);
+    if (!restored) {
+      XELOGE("Could not restore memory!");
+      last_snapshot_id_ = 0;
+      return false;
+    }
   }
+  last_snapshot_path_ = path;
+  last_snapshot_id_ = headers.back().id;
 
   // Update the main thread.
   auto threads =
@@ -471,11 +697,15 @@ bool Emulator::ExceptionCallback(Exception* ex) {
   }
 
   // Display a dialog telling the user the guest has crashed.
-  display_window()->loop()->PostSynchronous([&]() {
-    xe::ui::ImGuiDialog::ShowMessageBox(display_window(), "Uh-oh!",
-                                        "The guest has crashed.\n\n"
-                                        "Xenia has now paused itself.");
-  });
+  if (display_window()) {
+    display_window()->loop()->PostSynchronous([&]() {
+      xe::ui::ImGuiDialog::ShowMessageBox(display_window(), "Uh-oh!",
+                                          "The guest has crashed.\n\n"
+                                          "Xenia has now paused itself.");
+    });
+  } else {
+    XELOGE("The guest has crashed, pausing");
+  }
 
   // Now suspend ourself (we should be a guest thread).
   assert_true(current_thread->can_debugger_suspend());
@@ -506,6 +736,13 @@ X_STATUS Emulator::CompleteLaunch(const std::wstring& path,
   // Allow xam to request module loads.
   auto xam = kernel_state()->GetKernelModule<kernel::xam::XamModule>("xam.xex");
 
+  file_system_->StartPrefetch();
+
+  // Applied before loading, as translation and the caches read some of the
+  // flags while the module is loaded.
+  ApplyTitleProfile(
+      kernel::UserModule::ReadTitleId(kernel_state_.get(), module_path));
+
   XELOGI("Launching module %s", module_path.c_str());
   auto module = kernel_state_->LoadUserModule(module_path.c_str());
   if (!module) {
@@ -518,6 +755,7 @@ X_STATUS Emulator::CompleteLaunch(const std::wstring& path,
   module->GetOptHeader(XEX_HEADER_EXECUTION_INFO, &info);
   if (info) {
     title_id_ = info->title_id;
+    file_system_->StartBootProfile(title_id_);
   }
 
   kernel_state_->SetExecutableModule(module);
@@ -535,7 +773,7 @@ X_STATUS Emulator::CompleteLaunch(const std::wstring& path,
       if (db.is_valid()) {
         game_title_ = xe::to_wstring(db.title());
         auto icon_block = db.icon();
-        if (icon_block) {
+        if (icon_block && display_window_) {
           display_window_->SetIcon(icon_block.buffer, icon_block.size);
         }
       }
@@ -550,7 +788,154 @@ X_STATUS Emulator::CompleteLaunch(const std::wstring& path,
   on_launch();
   main_thread_ = main_xthread->thread();
 
+  if (FLAGS_benchmark_seconds > 0 && !benchmark_thread_) {
+    benchmark_stop_event_ = xe::threading::Event::CreateManualResetEvent(false);
+    benchmark_thread_ = xe::threading::Thread::Create(
+        {}, [this]() { BenchmarkThreadMain(); });
+    benchmark_thread_->set_name("Benchmark");
+  }
+
   return X_STATUS_SUCCESS;
 }
 
+void Emulator::LogMemoryReport() {
+  std::vector<std::pair<const char*, uint64_t>> usage;
+  // The physical address heaps allocate from the physical heap, so only it
+  // counts.
+  auto heap_stats = memory_->QueryHeapStats();
+  uint64_t committed_size[2] = {0, 0};
+  for (size_t i = 0; i < 5; ++i) {
+    committed_size[i == 4 ? 1 : 0] +=
+        uint64_t(heap_stats[i].committed_page_count) * heap_stats[i].page_size;
+  }
+  usage.emplace_back("guest.virtual", committed_size[0]);
+  usage.emplace_back("guest.physical", committed_size[1]);
+  processor_->backend()->GetMemoryUsage(&usage);
+  if (graphics_system_ && graphics_system_->command_processor()) {
+    graphics_system_->command_processor()->GetMemoryUsage(&usage);
+  }
+
+  // Guest memory is counted as committed, and only becomes resident as it is
+  // touched.
+  std::string report = xe::format_string(
+      "Memory: %.1fMB resident;",
+      xe::memory::QueryResidentSize() / (1024.0 * 1024.0));
+  for (auto& it : usage) {
+    report += xe::format_string(" %s %.1fMB", it.first,
+                                it.second / (1024.0 * 1024.0));
+  }
+  XELOGI("%s", report.c_str());
+}
+
+void Emulator::ApplyTitleProfile(uint32_t title_id) {
+  // Flags set by the profile of the previous title get their values back. In
+  // reverse, in case a profile set one twice.
+  for (auto it = title_profile_defaults_.rbegin();
+       it != title_profile_defaults_.rend(); ++it) {
+    google::SetCommandLineOption(it->first.c_str(), it->second.c_str());
+  }
+  title_profile_defaults_.clear();
+
+  if (FLAGS_title_profiles_path.empty() || !title_id) {
+    return;
+  }
+  auto path = xe::join_paths(xe::to_wstring(FLAGS_title_profiles_path),
+                             xe::format_string(L"%.8X.flags", title_id));
+  FILE* file = xe::filesystem::OpenFile(path, "rb");
+  if (!file) {
+    return;
+  }
+  XELOGI("Applying title profile %S", path.c_str());
+
+  // One --name=value per line, as in a gflags flag file.
+  char line_buffer[1024];
+  while (std::fgets(line_buffer, sizeof(line_buffer), file)) {
+    std::string line = line_buffer;
+    size_t begin = line.find_first_not_of(" \t\r\n");
+    if (begin == std::string::npos || line[begin] == '#') {
+      continue;
+    }
+    line = line.substr(begin, line.find_last_not_of(" \t\r\n") + 1 - begin);
+    if (line.compare(0, 2, "--") == 0) {
+      line = line.substr(2);
+    }
+    size_t equals = line.find('=');
+    std::string name = line.substr(0, equals);
+    // Like on the command line, a bool flag without a value is set.
+    std::string value =
+        equals == std::string::npos ? "true" : line.substr(equals + 1);
+
+    std::string old_value;
+    if (!google::GetCommandLineOption(name.c_str(), &old_value)) {
+      XELOGW("Title profile sets unknown flag %s", name.c_str());
+      continue;
+    }
+    if (google::SetCommandLineOption(name.c_str(), value.c_str()).empty()) {
+      XELOGW("Title profile sets flag %s to invalid value %s", name.c_str(),
+             value.c_str());
+      continue;
+    }
+    XELOGI("Title profile sets --%s=%s", name.c_str(), value.c_str());
+    title_profile_defaults_.emplace_back(name, old_value);
+  }
+  std::fclose(file);
+}
+
+void Emulator::BenchmarkThreadMain() {
+  auto wait_seconds = [this](int32_t seconds) {
+    return xe::threading::Wait(benchmark_stop_event_.get(), false,
+                               std::chrono::seconds(std::max(seconds, 0))) ==
+           xe::threading::WaitResult::kTimeout;
+  };
+  if (!wait_seconds(FLAGS_benchmark_warmup_seconds)) {
+    return;
+  }
+
+  auto& vblank_stats = graphics_system_->interrupt_stats(0);
+  auto& cp_interrupt_stats = graphics_system_->interrupt_stats(1);
+  auto start_counters = Counter::Snapshot();
+  uint64_t start_interrupt_ticks = vblank_stats.callback_ticks.load() +
+                                   cp_interrupt_stats.callback_ticks.load();
+  uint64_t start_ticks = Clock::QueryHostTickCount();
+  if (!wait_seconds(FLAGS_benchmark_seconds)) {
+    XELOGW("Benchmark: the emulator shut down before the end");
+    return;
+  }
+  uint64_t end_ticks = Clock::QueryHostTickCount();
+  uint64_t interrupt_ticks = vblank_stats.callback_ticks.load() +
+                             cp_interrupt_stats.callback_ticks.load() -
+                             start_interrupt_ticks;
+  auto end_counters = Counter::Snapshot();
+
+  // Counters registered meanwhile are appended, so the start snapshot is a
+  // prefix of the end one.
+  double seconds =
+      double(end_ticks - start_ticks) / Clock::host_tick_frequency();
+  auto delta = [&](const char* name) {
+    for (size_t i = 0; i < end_counters.size(); ++i) {
+      if (std::strcmp(end_counters[i].first, name) == 0) {
+        uint64_t start =
+            i < start_counters.size() ? start_counters[i].second : 0;
+        return end_counters[i].second - start;
+      }
+    }
+    return uint64_t(0);
+  };
+  double wall_us = seconds * 1000000.0;
+  XELOGI("Benchmark: %.2f guest frames per second over %.1fs",
+         delta("gpu.swaps") / seconds, seconds);
+  XELOGI("Benchmark: command processor %.1f%% busy",
+         100.0 - delta("gpu.command_processor_idle_us") * 100.0 / wall_us);
+  XELOGI("Benchmark: GPU interrupts %.1f%%, XMA decoding %.1f%%",
+         interrupt_ticks * 100.0 / (end_ticks - start_ticks),
+         delta("apu.xma_decode_us") * 100.0 / wall_us);
+  for (size_t i = 0; i < end_counters.size(); ++i) {
+    XELOGI("Benchmark: %s %.1f/s", end_counters[i].first,
+           delta(end_counters[i].first) / seconds);
+  }
+
+  // Like the guest returning to the firmware, as nothing else stops it.
+  exit(0);
+}
+
 }  // namespace xe
@@ -12,6 +12,8 @@
 
 #include <functional>
 #include <string>
+#include <utility>
+#include <vector>
 
 #include "xenia/base/delegate.h"
 #include "xenia/base/exception_handler.h"
@@ -123,6 +125,12 @@ class Emulator {
   bool is_paused() const { return paused_; }
 
   bool SaveToFile(const std::wstring& path);
+  // Saves only the guest memory changed since the last snapshot saved or
+  // restored, along with the rest of the state, referencing that snapshot.
+  // Saves a full snapshot if there is none to build on.
+  bool SaveIncrementalToFile(const std::wstring& path);
+  // Incremental snapshots are restored on top of the chain of snapshots they
+  // build on, which must all still exist.
   bool RestoreFromFile(const std::wstring& path);
 
   // The game can request another title to be loaded.
@@ -142,6 +150,17 @@ class Emulator {
   X_STATUS CompleteLaunch(const std::wstring& path,
                           const std::string& module_path);
 
+  // Sets the flags in the --title_profiles_path profile of the title, after
+  // restoring those set for the previous one.
+  void ApplyTitleProfile(uint32_t title_id);
+  // Measures the title for --benchmark_seconds, logs the results and exits.
+  void BenchmarkThreadMain();
+  // Logs the host memory used by the subsystems, every
+  // --memory_report_interval_ms.
+  void LogMemoryReport();
+
+  bool SaveSnapshot(const std::wstring& path, bool incremental);
+
   std::wstring command_line_;
   std::wstring game_title_;
 
@@ -160,10 +179,19 @@ class Emulator {
   std::unique_ptr<kernel::KernelState> kernel_state_;
   threading::Thread* main_thread_ = nullptr;
   uint32_t title_id_ = 0;  // Currently running title ID
+  // Flags set by the title profile, with the values they had before.
+  std::vector<std::pair<std::string, std::string>> title_profile_defaults_;
+  std::unique_ptr<threading::Thread> benchmark_thread_;
+  // Set to end the benchmark early, when shutting down.
+  std::unique_ptr<threading::Event> benchmark_stop_event_;
+  std::unique_ptr<threading::HighResolutionTimer> memory_report_timer_;
 
   bool paused_ = false;
   bool restoring_ = false;
   threading::Fence restore_fence_;  // Fired on restore finish.
+  // The snapshot the next incremental one builds on, or 0 if none.
+  std::wstring last_snapshot_path_;
+  uint64_t last_snapshot_id_ = 0;
 };
 
 }  // namespace xe
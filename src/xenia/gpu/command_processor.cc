@@ -10,12 +10,16 @@
 #include "xenia/gpu/command_processor.h"
 
 #include <algorithm>
+#include <cstring>
 
 #include "xenia/base/byte_stream.h"
+#include "xenia/base/clock.h"
+#include "xenia/base/counters.h"
 #include "xenia/base/logging.h"
 #include "xenia/base/math.h"
 #include "xenia/base/profiling.h"
 #include "xenia/base/ring_buffer.h"
+#include "xenia/base/threading.h"
 #include "xenia/gpu/gpu_flags.h"
 #include "xenia/gpu/graphics_system.h"
 #include "xenia/gpu/sampler_info.h"
@@ -24,6 +28,12 @@
 #include "xenia/kernel/kernel_state.h"
 #include "xenia/kernel/user_module.h"
 
+DEFINE_counter(draws, "gpu.draws");
+DEFINE_counter(swaps, "gpu.swaps");
+DEFINE_counter(command_processor_idle_us, "gpu.command_processor_idle_us");
+// Counted by the texture caches of the backends.
+DEFINE_counter(texture_uploads, "gpu.texture_uploads");
+
 namespace xe {
 namespace gpu {
 
@@ -35,6 +45,7 @@ CommandProcessor::CommandProcessor(GraphicsSystem* graphics_system,
       kernel_state_(kernel_state),
       graphics_system_(graphics_system),
       register_file_(graphics_system_->register_file()),
+      dirty_page_tracker_(graphics_system->memory()),
       trace_writer_(graphics_system->memory()->physical_membase()),
       worker_running_(true),
       write_ptr_index_event_(xe::threading::Event::CreateAutoResetEvent(false)),
@@ -53,6 +64,12 @@ bool CommandProcessor::Initialize(
         return 0;
       }));
   worker_thread_->set_name("GraphicsSystem Command Processor");
+  uint64_t host_affinity_mask = 0;
+  if (!xe::threading::ParseProcessorSet(FLAGS_command_processor_cpus,
+                                        &host_affinity_mask)) {
+    XELOGE("Invalid --command_processor_cpus, not pinning");
+  }
+  worker_thread_->set_host_affinity_mask(host_affinity_mask);
   worker_thread_->Create();
 
   return true;
@@ -108,6 +125,7 @@ void CommandProcessor::CallInThread(std::function<void()> fn) {
     fn();
   } else {
     pending_fns_.push(std::move(fn));
+    write_ptr_index_event_->Set();
   }
 }
 
@@ -130,22 +148,31 @@ void CommandProcessor::WorkerThreadMain() {
     uint32_t write_ptr_index = write_ptr_index_.load();
     if (write_ptr_index == 0xBAADF00D || read_ptr_index_ == write_ptr_index) {
       SCOPE_profile_cpu_i("gpu", "xe::gpu::CommandProcessor::Stall");
+      uint64_t idle_start_ticks = Clock::QueryHostTickCount();
       // We've run out of commands to execute.
       // We spin here waiting for new ones, as the overhead of waiting on our
-      // event is too high.
+      // event is too high, unless we've been idle for a while and waking up
+      // late matters less than the CPU time.
+      uint64_t spin_end_ticks = UINT64_MAX;
+      if (FLAGS_command_processor_idle_spin_us >= 0) {
+        spin_end_ticks = idle_start_ticks +
+                         uint64_t(FLAGS_command_processor_idle_spin_us) *
+                             Clock::host_tick_frequency() / 1000000;
+      }
       PrepareForWait();
       do {
-        // TODO(benvanik): if we go longer than Nms, switch to waiting?
-        // It'll keep us from burning power.
-        // const int wait_time_ms = 5;
-        // xe::threading::Wait(write_ptr_index_event_.get(), true,
-        //                     std::chrono::milliseconds(wait_time_ms));
-        xe::threading::MaybeYield();
+        if (Clock::QueryHostTickCount() >= spin_end_ticks) {
+          xe::threading::Wait(write_ptr_index_event_.get(), true,
+                              std::chrono::milliseconds(1));
+        } else {
+          xe::threading::MaybeYield();
+        }
         write_ptr_index = write_ptr_index_.load();
       } while (worker_running_ && pending_fns_.empty() &&
                (write_ptr_index == 0xBAADF00D ||
                 read_ptr_index_ == write_ptr_index));
       ReturnFromWait();
+      idle_ticks_ += Clock::QueryHostTickCount() - idle_start_ticks;
       if (!worker_running_ || !pending_fns_.empty()) {
         continue;
       }
@@ -253,6 +280,7 @@ void CommandProcessor::WriteRegister(uint32_t index, uint32_t value) {
   }
 
   regs->values[index].u32 = value;
+  regs->MarkDirty(index);
 
   // If this is a COHER register, set the dirty flag.
   // This will block the command processor the next time it WAIT_MEM_REGs and
@@ -273,6 +301,54 @@ void CommandProcessor::WriteRegister(uint32_t index, uint32_t value) {
   }
 }
 
+bool CommandProcessor::CanBulkWriteRegisters(uint32_t base_index,
+                                             uint32_t count) {
+  uint32_t end_index = base_index + count;
+  if (base_index >= RegisterFile::kRegisterCount ||
+      count > RegisterFile::kRegisterCount - base_index) {
+    return false;
+  }
+  if (base_index <= XE_GPU_REG_COHER_STATUS_HOST &&
+      end_index > XE_GPU_REG_COHER_STATUS_HOST) {
+    return false;
+  }
+  if (base_index <= XE_GPU_REG_SCRATCH_REG7 &&
+      end_index > XE_GPU_REG_SCRATCH_REG0) {
+    return false;
+  }
+  return true;
+}
+
+void CommandProcessor::WriteRegistersFromRing(RingBuffer* reader,
+                                              uint32_t base_index,
+                                              uint32_t count) {
+  if (!CanBulkWriteRegisters(base_index, count)) {
+    for (uint32_t i = 0; i < count; ++i) {
+      WriteRegister(base_index + i, reader->Read<uint32_t>(true));
+    }
+    return;
+  }
+  RegisterFile* regs = register_file_;
+  reader->ReadAndSwap(reinterpret_cast<uint32_t*>(&regs->values[base_index]),
+                      count);
+  regs->MarkDirtyRange(base_index, count);
+}
+
+void CommandProcessor::WriteRegistersFromMem(uint32_t base_index,
+                                             const uint32_t* base,
+                                             uint32_t count) {
+  if (!CanBulkWriteRegisters(base_index, count)) {
+    for (uint32_t i = 0; i < count; ++i) {
+      WriteRegister(base_index + i, xe::load_and_swap<uint32_t>(base + i));
+    }
+    return;
+  }
+  RegisterFile* regs = register_file_;
+  xe::copy_and_swap(reinterpret_cast<uint32_t*>(&regs->values[base_index]),
+                    base, count);
+  regs->MarkDirtyRange(base_index, count);
+}
+
 void CommandProcessor::MakeCoherent() {
   SCOPE_profile_cpu_f("gpu");
 
@@ -314,6 +390,7 @@ void CommandProcessor::IssueSwap(uint32_t frontbuffer_ptr,
   if (!swap_request_handler_) {
     return;
   }
+  uint64_t issue_host_ticks = Clock::QueryHostTickCount();
 
   // If there was a swap pending we drop it on the floor.
   // This prevents the display from pulling the backbuffer out from under us.
@@ -345,6 +422,8 @@ void CommandProcessor::IssueSwap(uint32_t frontbuffer_ptr,
     // Set pending so that the display will swap the next time it can.
     std::lock_guard<std::mutex> lock(swap_state_.mutex);
     swap_state_.pending = true;
+    swap_state_.pending_host_ticks = issue_host_ticks;
+    swap_state_.pending_vblank = counter_;
   }
 
   // Notify the display a swap is pending so that our changes are picked up.
@@ -376,23 +455,89 @@ uint32_t CommandProcessor::ExecutePrimaryBuffer(uint32_t read_index,
 
   trace_writer_.WritePrimaryBufferStart(start_ptr, write_index - read_index);
 
+  // Unless they're traced from guest memory, commands are copied out of the
+  // ring buffer before executing, and the read pointer is written back once
+  // they're copied, as the prefetch of the real command processor does.
+  // Commands submitted meanwhile are copied between packets, so the guest can
+  // refill the ring while earlier draws are still being set up. Everything
+  // still executes in order, so waits and memory writes are unaffected.
+  bool read_ahead = FLAGS_gpu_read_ahead && !trace_writer_.is_open() &&
+                    trace_state_ == TraceState::kDisabled;
+  uint8_t* buffer;
+  if (read_ahead) {
+    read_ahead_buffer_.resize(primary_buffer_size_);
+    buffer = read_ahead_buffer_.data();
+  } else {
+    buffer = memory_->TranslatePhysical(primary_buffer_ptr_);
+  }
+
   // Execute commands!
-  RingBuffer reader(memory_->TranslatePhysical(primary_buffer_ptr_),
-                    primary_buffer_size_);
+  RingBuffer reader(buffer, primary_buffer_size_);
   reader.set_read_offset(read_index * sizeof(uint32_t));
-  reader.set_write_offset(write_index * sizeof(uint32_t));
-  do {
+  if (read_ahead) {
+    reader.set_write_offset(read_index * sizeof(uint32_t));
+    fetch_ptr_index_ = read_index;
+    executing_read_ahead_ = true;
+    ReadAhead(&reader);
+  } else {
+    reader.set_write_offset(write_index * sizeof(uint32_t));
+  }
+  while (reader.read_count()) {
     if (!ExecutePacket(&reader)) {
       // This probably should be fatal - but we're going to continue anyways.
       XELOGE("**** PRIMARY RINGBUFFER: Failed to execute packet.");
       assert_always();
       break;
     }
-  } while (reader.read_count());
+    // Stop taking more once something else needs the thread.
+    if (read_ahead && worker_running_ && pending_fns_.empty() &&
+        trace_state_ == TraceState::kDisabled) {
+      ReadAhead(&reader);
+    }
+  }
+  executing_read_ahead_ = false;
 
   trace_writer_.WritePrimaryBufferEnd();
 
-  return write_index;
+  return read_ahead ? fetch_ptr_index_ : write_index;
+}
+
+bool CommandProcessor::ReadAhead(RingBuffer* reader) {
+  uint32_t write_ptr_index = write_ptr_index_.load();
+  if (write_ptr_index == 0xBAADF00D || write_ptr_index == fetch_ptr_index_) {
+    return false;
+  }
+  uint32_t size_dwords = primary_buffer_size_ / sizeof(uint32_t);
+  uint32_t count = (write_ptr_index - fetch_ptr_index_) & (size_dwords - 1);
+  if (reader->read_count() / sizeof(uint32_t) + count >= size_dwords) {
+    // Commands not executed yet can't be overwritten, so the guest has to
+    // wait for them with the ring full.
+    if (!ring_full_start_ticks_) {
+      ring_full_start_ticks_ = Clock::QueryHostTickCount();
+    }
+    return false;
+  }
+  if (ring_full_start_ticks_) {
+    ring_full_ticks_ += Clock::QueryHostTickCount() - ring_full_start_ticks_;
+    ring_full_start_ticks_ = 0;
+  }
+
+  // Copied as is, as packets are swapped when they're read.
+  auto ring = memory_->TranslatePhysical(primary_buffer_ptr_);
+  uint32_t first_count = std::min(count, size_dwords - fetch_ptr_index_);
+  std::memcpy(read_ahead_buffer_.data() + fetch_ptr_index_ * sizeof(uint32_t),
+              ring + fetch_ptr_index_ * sizeof(uint32_t),
+              first_count * sizeof(uint32_t));
+  std::memcpy(read_ahead_buffer_.data(), ring,
+              (count - first_count) * sizeof(uint32_t));
+  fetch_ptr_index_ = write_ptr_index;
+  reader->set_write_offset(fetch_ptr_index_ * sizeof(uint32_t));
+
+  if (read_ptr_writeback_ptr_) {
+    xe::store_and_swap<uint32_t>(
+        memory_->TranslatePhysical(read_ptr_writeback_ptr_), fetch_ptr_index_);
+  }
+  return true;
 }
 
 void CommandProcessor::ExecuteIndirectBuffer(uint32_t ptr, uint32_t count) {
@@ -437,19 +582,38 @@ bool CommandProcessor::ExecutePacket(RingBuffer* reader) {
     return true;
   }
 
+  uint64_t start_ticks = stats_enabled_ ? Clock::QueryHostTickCount() : 0;
+  bool result;
   switch (packet_type) {
     case 0x00:
-      return ExecutePacketType0(reader, packet);
+      result = ExecutePacketType0(reader, packet);
+      break;
     case 0x01:
-      return ExecutePacketType1(reader, packet);
+      result = ExecutePacketType1(reader, packet);
+      break;
     case 0x02:
-      return ExecutePacketType2(reader, packet);
+      result = ExecutePacketType2(reader, packet);
+      break;
     case 0x03:
-      return ExecutePacketType3(reader, packet);
+      result = ExecutePacketType3(reader, packet);
+      break;
     default:
       assert_unhandled_case(packet_type);
       return false;
   }
+
+  if (stats_enabled_) {
+    uint64_t ticks = Clock::QueryHostTickCount() - start_ticks;
+    auto& type_stats = stats_.packet_types[packet_type];
+    ++type_stats.count;
+    type_stats.host_ticks += ticks;
+    if (packet_type == 0x03) {
+      auto& opcode_stats = stats_.type3_opcodes[(packet >> 8) & 0x7F];
+      ++opcode_stats.count;
+      opcode_stats.host_ticks += ticks;
+    }
+  }
+  return result;
 }
 
 bool CommandProcessor::ExecutePacketType0(RingBuffer* reader, uint32_t packet) {
@@ -467,10 +631,12 @@ bool CommandProcessor::ExecutePacketType0(RingBuffer* reader, uint32_t packet) {
 
   uint32_t base_index = (packet & 0x7FFF);
   uint32_t write_one_reg = (packet >> 15) & 0x1;
-  for (uint32_t m = 0; m < count; m++) {
-    uint32_t reg_data = reader->Read<uint32_t>(true);
-    uint32_t target_index = write_one_reg ? base_index : base_index + m;
-    WriteRegister(target_index, reg_data);
+  if (write_one_reg) {
+    for (uint32_t m = 0; m < count; m++) {
+      WriteRegister(base_index, reader->Read<uint32_t>(true));
+    }
+  } else {
+    WriteRegistersFromRing(reader, base_index, count);
   }
 
   trace_writer_.WritePacketEnd();
@@ -680,11 +846,7 @@ bool CommandProcessor::ExecutePacketType3_INTERRUPT(RingBuffer* reader,
 
   // generate interrupt from the command stream
   uint32_t cpu_mask = reader->Read<uint32_t>(true);
-  for (int n = 0; n < 6; n++) {
-    if (cpu_mask & (1 << n)) {
-      graphics_system_->DispatchInterruptCallback(1, n);
-    }
-  }
+  graphics_system_->DispatchInterruptCallbacks(1, cpu_mask & 0x3F);
   return true;
 }
 
@@ -695,6 +857,7 @@ bool CommandProcessor::ExecutePacketType3_XE_SWAP(RingBuffer* reader,
 
   XELOGI("XE_SWAP");
 
+  memory_->UpdateProfileCounters();
   Profiler::Flip();
 
   // Xenia-specific VdSwap hook.
@@ -712,7 +875,20 @@ bool CommandProcessor::ExecutePacketType3_XE_SWAP(RingBuffer* reader,
 
   if (swap_mode_ == SwapMode::kNormal) {
     IssueSwap(frontbuffer_ptr, frontbuffer_width, frontbuffer_height);
+  } else if (swap_mode_ == SwapMode::kSubmitOnly) {
+    PerformSwap(frontbuffer_ptr, frontbuffer_width, frontbuffer_height);
   }
+  dirty_page_tracker_.EndFrame();
+  INCREMENT_counter(swaps, 1);
+  double ticks_to_us = 1000000.0 / Clock::host_tick_frequency();
+  INCREMENT_counter(command_processor_idle_us,
+                    uint64_t(idle_ticks_ * ticks_to_us));
+  COUNT_profile_cpu("gpu/command_processor/idle_us",
+                    int(idle_ticks_ * ticks_to_us));
+  COUNT_profile_cpu("gpu/command_processor/ring_full_us",
+                    int(ring_full_ticks_ * ticks_to_us));
+  idle_ticks_ = 0;
+  ring_full_ticks_ = 0;
 
   if (trace_writer_.is_open()) {
     trace_writer_.WriteEvent(EventCommand::Type::kSwap);
@@ -721,8 +897,11 @@ bool CommandProcessor::ExecutePacketType3_XE_SWAP(RingBuffer* reader,
       trace_state_ = TraceState::kDisabled;
       trace_writer_.Close();
     }
-  } else if (trace_state_ == TraceState::kSingleFrame) {
+  } else if (trace_state_ == TraceState::kSingleFrame &&
+             !executing_read_ahead_) {
     // New trace request - we only start tracing at the beginning of a frame.
+    // Commands read ahead aren't in guest memory to trace, so if this swap
+    // was read ahead the trace starts at the next one.
     uint32_t title_id = kernel_state_->GetExecutableModule()->title_id();
     auto file_name = xe::format_string(L"title_%8X_frame_%u.xenia_gpu_trace",
                                        title_id, counter_);
@@ -1030,9 +1209,7 @@ bool CommandProcessor::ExecutePacketType3_EVENT_WRITE_ZPD(RingBuffer* reader,
   // Writeback initiator.
   WriteRegister(XE_GPU_REG_VGT_EVENT_INITIATOR, initiator & 0x3F);
 
-  // TODO: Flag the backend CP to write out zpass counters to
-  // REG_RB_SAMPLE_COUNT_ADDR (probably # pixels passed depth test).
-  // This applies to the last draw, I believe.
+  ZPassDone(register_file_->values[XE_GPU_REG_RB_SAMPLE_COUNT_ADDR].u32);
 
   return true;
 }
@@ -1072,6 +1249,8 @@ bool CommandProcessor::ExecutePacketType3_DRAW_INDX(RingBuffer* reader,
     assert_always();
   }
 
+  dirty_page_tracker_.NotifyWrites();
+  INCREMENT_counter(draws, 1);
   return IssueDraw(prim_type, index_count,
                    is_indexed ? &index_buffer_info : nullptr);
 }
@@ -1091,6 +1270,8 @@ bool CommandProcessor::ExecutePacketType3_DRAW_INDX_2(RingBuffer* reader,
   // uint32_t index_ptr = reader->ptr();
   reader->AdvanceRead((count - 1) * sizeof(uint32_t));
 
+  dirty_page_tracker_.NotifyWrites();
+  INCREMENT_counter(draws, 1);
   return IssueDraw(prim_type, index_count, nullptr);
 }
 
@@ -1124,10 +1305,7 @@ bool CommandProcessor::ExecutePacketType3_SET_CONSTANT(RingBuffer* reader,
       reader->AdvanceRead((count - 1) * sizeof(uint32_t));
       return true;
   }
-  for (uint32_t n = 0; n < count - 1; n++, index++) {
-    uint32_t data = reader->Read<uint32_t>(true);
-    WriteRegister(index, data);
-  }
+  WriteRegistersFromRing(reader, index, count - 1);
   return true;
 }
 
@@ -1136,10 +1314,7 @@ bool CommandProcessor::ExecutePacketType3_SET_CONSTANT2(RingBuffer* reader,
                                                         uint32_t count) {
   uint32_t offset_type = reader->Read<uint32_t>(true);
   uint32_t index = offset_type & 0xFFFF;
-  for (uint32_t n = 0; n < count - 1; n++, index++) {
-    uint32_t data = reader->Read<uint32_t>(true);
-    WriteRegister(index, data);
-  }
+  WriteRegistersFromRing(reader, index, count - 1);
   return true;
 }
 
@@ -1175,11 +1350,10 @@ bool CommandProcessor::ExecutePacketType3_LOAD_ALU_CONSTANT(RingBuffer* reader,
       return true;
   }
   trace_writer_.WriteMemoryRead(CpuToGpu(address), size_dwords * 4);
-  for (uint32_t n = 0; n < size_dwords; n++, index++) {
-    uint32_t data = xe::load_and_swap<uint32_t>(
-        memory_->TranslatePhysical(address + n * 4));
-    WriteRegister(index, data);
-  }
+  WriteRegistersFromMem(
+      index,
+      reinterpret_cast<const uint32_t*>(memory_->TranslatePhysical(address)),
+      size_dwords);
   return true;
 }
 
@@ -1187,10 +1361,7 @@ bool CommandProcessor::ExecutePacketType3_SET_SHADER_CONSTANTS(
     RingBuffer* reader, uint32_t packet, uint32_t count) {
   uint32_t offset_type = reader->Read<uint32_t>(true);
   uint32_t index = offset_type & 0xFFFF;
-  for (uint32_t n = 0; n < count - 1; n++, index++) {
-    uint32_t data = reader->Read<uint32_t>(true);
-    WriteRegister(index, data);
-  }
+  WriteRegistersFromRing(reader, index, count - 1);
   return true;
 }
 
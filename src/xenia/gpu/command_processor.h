@@ -17,10 +17,12 @@
 #include <mutex>
 #include <queue>
 #include <string>
+#include <utility>
 #include <vector>
 
 #include "xenia/base/ring_buffer.h"
 #include "xenia/base/threading.h"
+#include "xenia/gpu/dirty_page_tracker.h"
 #include "xenia/gpu/register_file.h"
 #include "xenia/gpu/trace_writer.h"
 #include "xenia/gpu/xenos.h"
@@ -49,11 +51,40 @@ struct SwapState {
   uintptr_t back_buffer_texture = 0;
   // Whether the back buffer is dirty and a swap is pending.
   bool pending = false;
+  // Host tick count and vblank counter when the guest issued the pending
+  // swap.
+  uint64_t pending_host_ticks = 0;
+  uint32_t pending_vblank = 0;
+  // Host ticks between the guest issuing the swap of the current front
+  // buffer and the display picking it up to present, for measuring latency.
+  uint64_t last_latency_ticks = 0;
 };
 
 enum class SwapMode {
   kNormal,
   kIgnored,
+  // Submits the frame's work like kNormal but never presents it.
+  kSubmitOnly,
+};
+
+// Gathered while stats are enabled, for benchmarking.
+struct CommandProcessorStats {
+  struct PacketStats {
+    uint64_t count = 0;
+    // Includes the packets of indirect buffers the packet executes.
+    uint64_t host_ticks = 0;
+  };
+  PacketStats packet_types[4];
+  PacketStats type3_opcodes[128];
+  // Frames timed on the GPU, if the backend supports it.
+  uint64_t gpu_frame_count = 0;
+  uint64_t gpu_nanoseconds = 0;
+};
+
+struct CacheStats {
+  const char* name;
+  uint64_t hit_count;
+  uint64_t miss_count;
 };
 
 class CommandProcessor {
@@ -67,6 +98,11 @@ class CommandProcessor {
 
   Shader* active_vertex_shader() const { return active_vertex_shader_; }
   Shader* active_pixel_shader() const { return active_pixel_shader_; }
+  // Only used to restore the state of trace playback checkpoints.
+  void set_active_shaders(Shader* vertex_shader, Shader* pixel_shader) {
+    active_vertex_shader_ = vertex_shader;
+    active_pixel_shader_ = pixel_shader;
+  }
 
   virtual bool Initialize(std::unique_ptr<xe::ui::GraphicsContext> context);
   virtual void Shutdown();
@@ -75,6 +111,23 @@ class CommandProcessor {
 
   virtual void ClearCaches();
 
+  // Only changed or read on the command processor thread.
+  bool stats_enabled() const { return stats_enabled_; }
+  void set_stats_enabled(bool stats_enabled) { stats_enabled_ = stats_enabled; }
+  const CommandProcessorStats& stats() const { return stats_; }
+  void ResetStats() { stats_ = CommandProcessorStats(); }
+  // Appends the running hit and miss counts of the backend's caches.
+  virtual void GetCacheStats(std::vector<CacheStats>* cache_stats) {}
+  // Appends the host memory used by the backend's caches, in bytes by name.
+  // Callable from any thread, at the cost of slightly stale values.
+  virtual void GetMemoryUsage(
+      std::vector<std::pair<const char*, uint64_t>>* usage) {}
+  // GPU time of the last frame timed while stats were enabled, readable from
+  // any thread.
+  uint64_t last_gpu_frame_nanoseconds() const {
+    return last_gpu_frame_nanoseconds_;
+  }
+
   SwapState& swap_state() { return swap_state_; }
   void set_swap_mode(SwapMode swap_mode) { swap_mode_ = swap_mode; }
   void IssueSwap(uint32_t frontbuffer_ptr, uint32_t frontbuffer_width,
@@ -83,6 +136,12 @@ class CommandProcessor {
   void set_swap_request_handler(std::function<void()> fn) {
     swap_request_handler_ = fn;
   }
+  // Copies the current front buffer back to host memory, waiting for the GPU.
+  // Null if the backend can't or there is no front buffer yet. Must be called
+  // on the command processor thread.
+  virtual std::unique_ptr<xe::ui::RawImage> ReadBackFrontBuffer() {
+    return nullptr;
+  }
 
   virtual void RequestFrameTrace(const std::wstring& root_path);
   virtual void BeginTracing(const std::wstring& root_path);
@@ -116,6 +175,14 @@ class CommandProcessor {
   virtual void ShutdownContext() = 0;
 
   void WriteRegister(uint32_t index, uint32_t value);
+  // Writes count consecutive registers, swapping and copying them in bulk
+  // unless the range contains registers with side effects.
+  void WriteRegistersFromRing(RingBuffer* reader, uint32_t base_index,
+                              uint32_t count);
+  void WriteRegistersFromMem(uint32_t base_index, const uint32_t* base,
+                             uint32_t count);
+  // True if none of the registers in the range need WriteRegister.
+  static bool CanBulkWriteRegisters(uint32_t base_index, uint32_t count);
 
   virtual void MakeCoherent();
   virtual void PrepareForWait();
@@ -125,6 +192,9 @@ class CommandProcessor {
                            uint32_t frontbuffer_height) = 0;
 
   uint32_t ExecutePrimaryBuffer(uint32_t start_index, uint32_t end_index);
+  // Copies the commands submitted since the last call into the read-ahead
+  // buffer read by reader, if they fit alongside those not executed yet.
+  bool ReadAhead(RingBuffer* reader);
   void ExecuteIndirectBuffer(uint32_t ptr, uint32_t length);
   bool ExecutePacket(RingBuffer* reader);
   bool ExecutePacketType0(RingBuffer* reader, uint32_t packet);
@@ -188,11 +258,17 @@ class CommandProcessor {
   virtual bool IssueDraw(PrimitiveType prim_type, uint32_t index_count,
                          IndexBufferInfo* index_buffer_info) = 0;
   virtual bool IssueCopy() = 0;
+  // Writes the xe_gpu_depth_sample_counts of the draws since the query at
+  // the address began, if the event ends one, or begins one otherwise.
+  // Backends without occlusion queries leave the guest memory alone.
+  virtual void ZPassDone(uint32_t sample_counts_address) {}
 
   Memory* memory_ = nullptr;
   kernel::KernelState* kernel_state_ = nullptr;
   GraphicsSystem* graphics_system_ = nullptr;
   RegisterFile* register_file_ = nullptr;
+  // Shared by the caches of the backend to find out about guest writes.
+  DirtyPageTracker dirty_page_tracker_;
 
   TraceWriter trace_writer_;
   enum class TraceState {
@@ -209,6 +285,9 @@ class CommandProcessor {
 
   std::unique_ptr<xe::ui::GraphicsContext> context_;
   SwapMode swap_mode_ = SwapMode::kNormal;
+  bool stats_enabled_ = false;
+  CommandProcessorStats stats_;
+  std::atomic<uint64_t> last_gpu_frame_nanoseconds_ = {0};
   SwapState swap_state_;
   std::function<void()> swap_request_handler_;
   std::queue<std::function<void()>> pending_fns_;
@@ -225,6 +304,18 @@ class CommandProcessor {
   std::unique_ptr<xe::threading::Event> write_ptr_index_event_;
   std::atomic<uint32_t> write_ptr_index_;
 
+  // Copy of the ring buffer that commands run from when reading ahead, and
+  // the end of the commands copied into it, which the guest sees as the read
+  // pointer.
+  std::vector<uint8_t> read_ahead_buffer_;
+  uint32_t fetch_ptr_index_ = 0;
+  bool executing_read_ahead_ = false;
+  // Host ticks the worker waited for commands, and the guest had commands
+  // that didn't fit in the read-ahead buffer, since the last swap.
+  uint64_t idle_ticks_ = 0;
+  uint64_t ring_full_ticks_ = 0;
+  uint64_t ring_full_start_ticks_ = 0;
+
   uint64_t bin_select_ = 0xFFFFFFFFull;
   uint64_t bin_mask_ = 0xFFFFFFFFull;
 
@@ -0,0 +1,206 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2016 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#include "xenia/gpu/dirty_page_tracker.h"
+
+#include <algorithm>
+
+#include "xenia/base/assert.h"
+#include "xenia/base/math.h"
+#include "xenia/base/memory.h"
+#include "xenia/base/profiling.h"
+
+namespace xe {
+namespace gpu {
+
+// Physical memory is 512MB.
+constexpr uint32_t kPhysicalMemorySize = 0x20000000;
+
+DirtyPageTracker::DirtyPageTracker(Memory* memory) : memory_(memory) {
+  page_shift_ = xe::log2_floor(uint32_t(xe::memory::page_size()));
+  uint32_t page_count = kPhysicalMemorySize >> page_shift_;
+  protected_pages_.resize((page_count + 63) / 64);
+  dirty_pages_.resize((page_count + 63) / 64);
+}
+
+DirtyPageTracker::~DirtyPageTracker() {
+  {
+    auto global_lock = global_critical_region_.Acquire();
+    for (auto run : protected_runs_) {
+      memory_->CancelAccessWatch(run->access_watch_handle);
+      delete run;
+    }
+    protected_runs_.clear();
+  }
+  for (auto watch : watches_) {
+    delete watch;
+  }
+  watches_.clear();
+}
+
+uintptr_t DirtyPageTracker::AddWatch(uint32_t physical_address,
+                                     uint32_t length,
+                                     cpu::AccessWatchCallback callback,
+                                     void* callback_context,
+                                     void* callback_data) {
+  physical_address &= kPhysicalMemorySize - 1;
+  length =
+      std::min(std::max(length, 1u), kPhysicalMemorySize - physical_address);
+
+  auto watch = new Watch();
+  watch->first_page = physical_address >> page_shift_;
+  watch->end_page = ((physical_address + length - 1) >> page_shift_) + 1;
+  watch->callback = callback;
+  watch->callback_context = callback_context;
+  watch->callback_data = callback_data;
+  watch->index = watches_.size();
+  watches_.push_back(watch);
+
+  Protect(watch->first_page, watch->end_page);
+  return reinterpret_cast<uintptr_t>(watch);
+}
+
+void DirtyPageTracker::CancelWatch(uintptr_t watch_handle) {
+  // The pages stay protected, as other watches may need them. If none does,
+  // the next write to them costs a fault that nobody hears about.
+  auto watch = reinterpret_cast<Watch*>(watch_handle);
+  assert_true(watch->index < watches_.size() &&
+              watches_[watch->index] == watch);
+  watches_[watch->index] = watches_.back();
+  watches_[watch->index]->index = watch->index;
+  watches_.pop_back();
+  delete watch;
+}
+
+void DirtyPageTracker::Protect(uint32_t first_page, uint32_t end_page) {
+  auto global_lock = global_critical_region_.Acquire();
+  uint32_t page = first_page;
+  while (page < end_page) {
+    if (TestBit(protected_pages_, page)) {
+      ++page;
+      continue;
+    }
+    uint32_t run_end = page + 1;
+    while (run_end < end_page && !TestBit(protected_pages_, run_end)) {
+      ++run_end;
+    }
+    auto run = new ProtectedRun();
+    run->first_page = page;
+    run->page_count = run_end - page;
+    SetBits(&protected_pages_, run->first_page, run->page_count, true);
+    // The callback can't run before this returns, as faults are handled
+    // within the critical region held here.
+    run->access_watch_handle = memory_->AddPhysicalAccessWatch(
+        page << page_shift_, run->page_count << page_shift_,
+        cpu::MMIOHandler::kWatchWrite, ProtectedRunWritten, this, run);
+    protected_runs_.push_back(run);
+    page = run_end;
+  }
+}
+
+void DirtyPageTracker::ProtectedRunWritten(void* context_ptr, void* data_ptr,
+                                           uint32_t address) {
+  // Called within the critical region, and the access watch has already
+  // unprotected the whole run.
+  auto self = reinterpret_cast<DirtyPageTracker*>(context_ptr);
+  auto run = reinterpret_cast<ProtectedRun*>(data_ptr);
+  SetBits(&self->protected_pages_, run->first_page, run->page_count, false);
+  self->written_runs_.push_back(*run);
+  self->has_written_runs_ = true;
+  ++self->frame_fault_count_;
+  auto it = std::find(self->protected_runs_.begin(),
+                      self->protected_runs_.end(), run);
+  assert_true(it != self->protected_runs_.end());
+  if (it != self->protected_runs_.end()) {
+    *it = self->protected_runs_.back();
+    self->protected_runs_.pop_back();
+  }
+  delete run;
+}
+
+void DirtyPageTracker::NotifyWrites() {
+  if (!has_written_runs_) {
+    return;
+  }
+  SCOPE_profile_cpu_f("gpu");
+  {
+    auto global_lock = global_critical_region_.Acquire();
+    std::swap(notified_runs_, written_runs_);
+    has_written_runs_ = false;
+  }
+
+  for (auto& run : notified_runs_) {
+    SetBits(&dirty_pages_, run.first_page, run.page_count, true);
+  }
+  for (size_t i = 0; i < watches_.size();) {
+    auto watch = watches_[i];
+    if (!AnyBitSet(dirty_pages_, watch->first_page, watch->end_page)) {
+      ++i;
+      continue;
+    }
+    fired_watches_.push_back(watch);
+    watches_[i] = watches_.back();
+    watches_[i]->index = i;
+    watches_.pop_back();
+  }
+  for (auto& run : notified_runs_) {
+    SetBits(&dirty_pages_, run.first_page, run.page_count, false);
+  }
+  notified_runs_.clear();
+
+  // Called outside of any lock, so the callbacks may take their own.
+  for (auto watch : fired_watches_) {
+    watch->callback(watch->callback_context, watch->callback_data,
+                    watch->first_page << page_shift_);
+    delete watch;
+  }
+  fired_watches_.clear();
+}
+
+void DirtyPageTracker::EndFrame() {
+  auto global_lock = global_critical_region_.Acquire();
+  COUNT_profile_cpu("gpu/dirty_pages/faults", int(frame_fault_count_));
+  COUNT_profile_cpu("gpu/dirty_pages/watches", int(watches_.size()));
+  frame_fault_count_ = 0;
+}
+
+void DirtyPageTracker::SetBits(std::vector<uint64_t>* bits,
+                               uint32_t first_page, uint32_t page_count,
+                               bool value) {
+  for (uint32_t page = first_page; page < first_page + page_count; ++page) {
+    uint64_t mask = 1ull << (page & 63);
+    if (value) {
+      (*bits)[page >> 6] |= mask;
+    } else {
+      (*bits)[page >> 6] &= ~mask;
+    }
+  }
+}
+
+bool DirtyPageTracker::AnyBitSet(const std::vector<uint64_t>& bits,
+                                 uint32_t first_page, uint32_t end_page) {
+  uint32_t first_word = first_page >> 6;
+  uint32_t last_word = (end_page - 1) >> 6;
+  for (uint32_t i = first_word; i <= last_word; ++i) {
+    uint64_t word = bits[i];
+    if (i == first_word) {
+      word &= ~0ull << (first_page & 63);
+    }
+    if (i == last_word && (end_page & 63)) {
+      word &= ~(~0ull << (end_page & 63));
+    }
+    if (word) {
+      return true;
+    }
+  }
+  return false;
+}
+
+}  // namespace gpu
+}  // namespace xe
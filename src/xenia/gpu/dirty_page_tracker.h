@@ -0,0 +1,104 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2016 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#ifndef XENIA_GPU_DIRTY_PAGE_TRACKER_H_
+#define XENIA_GPU_DIRTY_PAGE_TRACKER_H_
+
+#include <atomic>
+#include <cstdint>
+#include <vector>
+
+#include "xenia/base/mutex.h"
+#include "xenia/cpu/mmio_handler.h"
+#include "xenia/memory.h"
+
+namespace xe {
+namespace gpu {
+
+// Tracks CPU writes to physical memory used by the GPU caches, in pages.
+// Every page is write protected at most once, however many watches cover it,
+// so a frame takes at most one fault per page the guest writes. Writes are
+// only passed on to the watches by NotifyWrites, which is called once per
+// draw batch on the command processor thread.
+//
+// Watches work like those of the MMIO handler: callbacks fire once, and all
+// watches are added, canceled and notified on the command processor thread.
+// As with overlapping MMIO handler watches, another access watch ending on
+// the same pages unprotects them, and writes after that are missed.
+class DirtyPageTracker {
+ public:
+  explicit DirtyPageTracker(Memory* memory);
+  ~DirtyPageTracker();
+
+  // Calls the callback from NotifyWrites once the guest writes any page
+  // overlapping the range. The watch ends when it fires.
+  uintptr_t AddWatch(uint32_t physical_address, uint32_t length,
+                     cpu::AccessWatchCallback callback, void* callback_context,
+                     void* callback_data);
+  void CancelWatch(uintptr_t watch_handle);
+
+  // Fires the watches on pages written since the last call.
+  void NotifyWrites();
+
+  // Publishes the per-frame profiler counters and starts counting again.
+  void EndFrame();
+
+ private:
+  struct Watch {
+    uint32_t first_page;
+    uint32_t end_page;
+    cpu::AccessWatchCallback callback;
+    void* callback_context;
+    void* callback_data;
+    size_t index;
+  };
+  // A run of pages protected with one access watch.
+  struct ProtectedRun {
+    uint32_t first_page;
+    uint32_t page_count;
+    uintptr_t access_watch_handle;
+  };
+
+  static void ProtectedRunWritten(void* context_ptr, void* data_ptr,
+                                  uint32_t address);
+  void Protect(uint32_t first_page, uint32_t end_page);
+
+  static bool TestBit(const std::vector<uint64_t>& bits, uint32_t page) {
+    return (bits[page >> 6] >> (page & 63)) & 1;
+  }
+  static void SetBits(std::vector<uint64_t>* bits, uint32_t first_page,
+                      uint32_t page_count, bool value);
+  static bool AnyBitSet(const std::vector<uint64_t>& bits, uint32_t first_page,
+                        uint32_t end_page);
+
+  Memory* memory_ = nullptr;
+  uint32_t page_shift_ = 12;
+
+  // Guards everything touched from the write callbacks, which run on the
+  // faulting guest thread within the critical region of the MMIO handler.
+  xe::global_critical_region global_critical_region_;
+  // Pages currently write protected by one of the runs.
+  std::vector<uint64_t> protected_pages_;
+  std::vector<ProtectedRun*> protected_runs_;
+  // Runs written since the last NotifyWrites.
+  std::vector<ProtectedRun> written_runs_;
+  std::atomic<bool> has_written_runs_ = {false};
+  uint32_t frame_fault_count_ = 0;
+
+  // Only used on the command processor thread.
+  std::vector<Watch*> watches_;
+  std::vector<uint64_t> dirty_pages_;
+  std::vector<ProtectedRun> notified_runs_;
+  std::vector<Watch*> fired_watches_;
+};
+
+}  // namespace gpu
+}  // namespace xe
+
+#endif  // XENIA_GPU_DIRTY_PAGE_TRACKER_H_
@@ -13,6 +13,7 @@
 
 #include "xenia/base/logging.h"
 #include "xenia/base/math.h"
+#include "xenia/base/profiling.h"
 #include "xenia/gpu/gl4/gl4_gpu_flags.h"
 #include "xenia/gpu/gpu_flags.h"
 
@@ -125,11 +126,31 @@ bool DrawBatcher::ReadbackTFB(void* buffer, size_t size) {
 }
 
 void DrawBatcher::Shutdown() {
+  XELOGI("Draw command buffer high-water mark: %zuKB of %zuKB",
+         command_buffer_.high_water_mark() >> 10,
+         command_buffer_.capacity() >> 10);
+  XELOGI("Draw state buffer high-water mark: %zuKB of %zuKB",
+         state_buffer_.high_water_mark() >> 10,
+         state_buffer_.capacity() >> 10);
   command_buffer_.Shutdown();
   state_buffer_.Shutdown();
   ShutdownTFB();
 }
 
+void DrawBatcher::EndFrame() {
+  assert_zero(batch_state_.draw_count);
+  command_buffer_.EndFrame();
+  state_buffer_.EndFrame();
+  COUNT_profile_cpu("gpu/gl4/command_buffer/peak_kb",
+                    int(command_buffer_.frame_high_water_mark() >> 10));
+  COUNT_profile_cpu("gpu/gl4/command_buffer/waits",
+                    int(command_buffer_.frame_wait_count()));
+  COUNT_profile_cpu("gpu/gl4/state_buffer/peak_kb",
+                    int(state_buffer_.frame_high_water_mark() >> 10));
+  COUNT_profile_cpu("gpu/gl4/state_buffer/waits",
+                    int(state_buffer_.frame_wait_count()));
+}
+
 bool DrawBatcher::ReconfigurePipeline(GL4Shader* vertex_shader,
                                       GL4Shader* pixel_shader,
                                       GLuint pipeline) {
@@ -148,6 +169,40 @@ bool DrawBatcher::ReconfigurePipeline(GL4Shader* vertex_shader,
   return true;
 }
 
+void DrawBatcher::BindVertexBuffer(GLuint vao, GLuint binding_index,
+                                   GLuint buffer, GLintptr offset,
+                                   GLsizei stride) {
+  if (vao != bound_vao_) {
+    bound_vao_ = vao;
+    bound_vertex_buffer_mask_ = 0;
+  }
+  bool tracked = binding_index < kMaxTrackedVertexBuffers;
+  if (tracked && (bound_vertex_buffer_mask_ & (1u << binding_index))) {
+    auto& binding = bound_vertex_buffers_[binding_index];
+    if (binding.buffer == buffer && binding.offset == offset &&
+        binding.stride == stride) {
+      // Already bound - batched draws can share it.
+      return;
+    }
+  }
+
+  // Batched draws read the binding when issued, so they must be issued before
+  // it changes.
+  Flush(FlushMode::kStateChange);
+  glVertexArrayVertexBuffer(vao, binding_index, buffer, offset, stride);
+  if (tracked) {
+    bound_vertex_buffer_mask_ |= 1u << binding_index;
+    bound_vertex_buffers_[binding_index] = {buffer, offset, stride};
+  }
+}
+
+void DrawBatcher::ReserveArrayData(size_t length) {
+  if (!array_data_buffer_->CanAcquire(length)) {
+    // Wrapping restarts the buffer from the beginning.
+    Flush(FlushMode::kMakeCoherent);
+  }
+}
+
 bool DrawBatcher::BeginDrawArrays(PrimitiveType prim_type,
                                   uint32_t index_count) {
   assert_false(draw_open_);
@@ -399,6 +454,8 @@ bool DrawBatcher::Flush(FlushMode mode) {
 #if FINE_GRAINED_DRAW_SCOPES
     SCOPE_profile_cpu_f("gpu");
 #endif  // FINE_GRAINED_DRAW_SCOPES
+    // The closest there is to a render pass here.
+    SCOPE_profile_gpu_i("GPU", "DrawBatch");
 
     assert_not_zero(batch_state_.command_stride);
     assert_not_zero(batch_state_.state_stride);
@@ -466,8 +523,13 @@ bool DrawBatcher::Flush(FlushMode mode) {
 
     if (valid_prim && batch_state_.draw_count == 1) {
       // Fast path for one draw. Removes MDI overhead when not required.
+      // The command is read back from the buffer as a new draw may already
+      // have been begun when a state change flushes the batch.
+      auto command_host_ptr = command_buffer_.host_ptr(
+          size_t(batch_state_.command_range_start));
       if (batch_state_.indexed) {
-        auto& cmd = active_draw_.draw_elements_cmd;
+        auto cmd =
+            reinterpret_cast<DrawElementsIndirectCommand*>(command_host_ptr);
         glDrawElementsInstancedBaseVertexBaseInstance(
             prim_type, cmd->count, batch_state_.index_type,
             reinterpret_cast<void*>(
@@ -475,7 +537,8 @@ bool DrawBatcher::Flush(FlushMode mode) {
                 (batch_state_.index_type == GL_UNSIGNED_SHORT ? 2 : 4)),
             cmd->instance_count, cmd->base_vertex, cmd->base_instance);
       } else {
-        auto& cmd = active_draw_.draw_arrays_cmd;
+        auto cmd =
+            reinterpret_cast<DrawArraysIndirectCommand*>(command_host_ptr);
         glDrawArraysInstancedBaseInstance(prim_type, cmd->first_index,
                                           cmd->count, cmd->instance_count,
                                           cmd->base_instance);
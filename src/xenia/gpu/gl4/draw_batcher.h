@@ -57,6 +57,9 @@ class DrawBatcher {
 
   bool Initialize(CircularBuffer* array_data_buffer);
   void Shutdown();
+  // Fences the command and state data of the frame, which must have been
+  // flushed, and publishes their profiler counters.
+  void EndFrame();
 
   PrimitiveType prim_type() const { return batch_state_.prim_type; }
 
@@ -92,6 +95,15 @@ class DrawBatcher {
   bool ReconfigurePipeline(GL4Shader* vertex_shader, GL4Shader* pixel_shader,
                            GLuint pipeline);
 
+  // Binds a vertex buffer for the open draw. Draws already in the batch are
+  // only flushed if they were using a different binding, so draws sourcing
+  // the same vertex data keep accumulating into one multi-draw.
+  void BindVertexBuffer(GLuint vao, GLuint binding_index, GLuint buffer,
+                        GLintptr offset, GLsizei stride);
+  // Flushes the batch if acquiring length bytes from the array data buffer
+  // would wrap it and overwrite data that batched draws still read.
+  void ReserveArrayData(size_t length);
+
   bool BeginDrawArrays(PrimitiveType prim_type, uint32_t index_count);
   bool BeginDrawElements(PrimitiveType prim_type, uint32_t index_count,
                          IndexFormat index_format);
@@ -130,6 +142,18 @@ class DrawBatcher {
   GLint tfb_prim_count_ = 0;
   bool tfb_enabled_ = false;
 
+  // Vertex buffers currently bound to bound_vao_, tracked so that redundant
+  // rebinds don't break the batch.
+  static const GLuint kMaxTrackedVertexBuffers = 32;
+  struct VertexBufferBinding {
+    GLuint buffer;
+    GLintptr offset;
+    GLsizei stride;
+  };
+  GLuint bound_vao_ = 0;
+  uint32_t bound_vertex_buffer_mask_ = 0;
+  VertexBufferBinding bound_vertex_buffers_[kMaxTrackedVertexBuffers];
+
   struct BatchState {
     bool needs_reconfigure;
     PrimitiveType prim_type;
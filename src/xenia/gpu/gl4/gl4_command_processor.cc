@@ -10,6 +10,7 @@
 #include "xenia/gpu/gl4/gl4_command_processor.h"
 
 #include <algorithm>
+#include <cstring>
 
 #include "xenia/base/logging.h"
 #include "xenia/base/math.h"
@@ -62,6 +63,7 @@ GL4CommandProcessor::GL4CommandProcessor(GL4GraphicsSystem* graphics_system,
 GL4CommandProcessor::~GL4CommandProcessor() = default;
 
 void GL4CommandProcessor::ClearCaches() {
+  draw_batcher_.Flush(DrawBatcher::FlushMode::kMakeCoherent);
   texture_cache()->Clear();
 
   for (auto& cached_framebuffer : cached_framebuffers_) {
@@ -82,6 +84,16 @@ void GL4CommandProcessor::ClearCaches() {
   CommandProcessor::ClearCaches();
 }
 
+void GL4CommandProcessor::GetCacheStats(std::vector<CacheStats>* cache_stats) {
+  cache_stats->push_back(
+      {"texture", texture_cache_.hit_count(), texture_cache_.miss_count()});
+}
+
+void GL4CommandProcessor::GetMemoryUsage(
+    std::vector<std::pair<const char*, uint64_t>>* usage) {
+  usage->emplace_back("gpu.textures", texture_cache_.resident_bytes());
+}
+
 bool GL4CommandProcessor::SetupContext() {
   if (!CommandProcessor::SetupContext()) {
     XELOGE("Unable to initialize base command processor context");
@@ -101,10 +113,19 @@ bool GL4CommandProcessor::SetupContext() {
   }
 
   // Texture cache that keeps track of any textures/samplers used.
-  if (!texture_cache_.Initialize(memory_, &scratch_buffer_)) {
+  if (!texture_cache_.Initialize(memory_, &dirty_page_tracker_,
+                                 &scratch_buffer_)) {
     XELOGE("Unable to initialize texture cache");
     return false;
   }
+  texture_cache_.set_texture_update_callback([this]() {
+    draw_batcher_.Flush(DrawBatcher::FlushMode::kMakeCoherent);
+  });
+
+  // Timestamps of GPU profiling scopes.
+  if (timestamp_pool_.Initialize()) {
+    Profiler::set_gpu_timestamp_source(&timestamp_pool_);
+  }
 
   const std::string geometry_header =
       "#version 450\n"
@@ -320,8 +341,13 @@ void GL4CommandProcessor::ShutdownContext() {
   glDeleteProgram(rect_list_geometry_program_);
   glDeleteProgram(quad_list_geometry_program_);
   glDeleteProgram(line_quad_list_geometry_program_);
+  Profiler::set_gpu_timestamp_source(nullptr);
+  timestamp_pool_.Shutdown();
   texture_cache_.Shutdown();
   draw_batcher_.Shutdown();
+  XELOGI("Scratch buffer high-water mark: %zuKB of %zuKB",
+         scratch_buffer_.high_water_mark() >> 10,
+         scratch_buffer_.capacity() >> 10);
   scratch_buffer_.Shutdown();
 
   all_pipelines_.clear();
@@ -346,6 +372,8 @@ void GL4CommandProcessor::PrepareForWait() {
 
   CommandProcessor::PrepareForWait();
 
+  draw_batcher_.Flush(DrawBatcher::FlushMode::kMakeCoherent);
+
   // TODO(benvanik): fences and fancy stuff. We should figure out a way to
   // make interrupt callbacks from the GPU so that we don't have to do a full
   // synchronize here.
@@ -370,6 +398,7 @@ void GL4CommandProcessor::PerformSwap(uint32_t frontbuffer_ptr,
                                       uint32_t frontbuffer_height) {
   // Ensure we issue any pending draws.
   draw_batcher_.Flush(DrawBatcher::FlushMode::kMakeCoherent);
+  SCOPE_profile_gpu_i("GPU", "Swap");
 
   // One-time initialization.
   // TODO(benvanik): move someplace more sane?
@@ -478,6 +507,16 @@ void GL4CommandProcessor::PerformSwap(uint32_t frontbuffer_ptr,
 
   // Remove any dead textures, etc.
   texture_cache_.Scavenge();
+  texture_cache_.EndFrame();
+
+  // Everything the frame used is fenced, so the buffers can wrap around onto
+  // it as soon as the GPU is done with it.
+  draw_batcher_.EndFrame();
+  scratch_buffer_.EndFrame();
+  COUNT_profile_cpu("gpu/gl4/scratch_buffer/peak_kb",
+                    int(scratch_buffer_.frame_high_water_mark() >> 10));
+  COUNT_profile_cpu("gpu/gl4/scratch_buffer/waits",
+                    int(scratch_buffer_.frame_wait_count()));
 }
 
 Shader* GL4CommandProcessor::LoadShader(ShaderType shader_type,
@@ -560,8 +599,8 @@ bool GL4CommandProcessor::IssueDraw(PrimitiveType prim_type,
     return false;
   }
 
-  // TODO(benvanik): find a way to get around glVertexArrayVertexBuffer below.
-  draw_batcher_.Flush(DrawBatcher::FlushMode::kMakeCoherent);
+  // The draw stays batched until state, vertex buffers or other commands
+  // require it to be issued.
   if (context_->WasLost()) {
     // This draw lost us the context. This typically isn't hit.
     assert_always();
@@ -1350,6 +1389,7 @@ GL4CommandProcessor::UpdateStatus GL4CommandProcessor::PopulateIndexBuffer(
   size_t total_size =
       info.count * (info.format == IndexFormat::kInt32 ? sizeof(uint32_t)
                                                        : sizeof(uint16_t));
+  draw_batcher_.ReserveArrayData(total_size);
   CircularBuffer::Allocation allocation;
   if (!scratch_buffer_.AcquireCached(info.guest_base, total_size,
                                      &allocation)) {
@@ -1402,21 +1442,19 @@ GL4CommandProcessor::UpdateStatus GL4CommandProcessor::PopulateVertexBuffers() {
     trace_writer_.WriteMemoryRead(fetch->address << 2, valid_range);
 
     auto vertex_shader = static_cast<GL4Shader*>(active_vertex_shader_);
+    draw_batcher_.ReserveArrayData(valid_range);
     CircularBuffer::Allocation allocation;
     if (!scratch_buffer_.AcquireCached(fetch->address << 2, valid_range,
                                        &allocation)) {
-      // Copy and byte swap the entire buffer.
+      // Copy the entire buffer. It's swapped by the shader when fetched.
       // We could be smart about this to save GPU bandwidth by building a CRC
       // as we copy and only if it differs from the previous value committing
       // it (and if it matches just discard and reuse).
-      xe::copy_and_swap_32_aligned(
-          allocation.host_ptr,
-          memory_->TranslatePhysical<const uint32_t*>(fetch->address << 2),
-          valid_range / 4);
-
-      // TODO(benvanik): if we could find a way to avoid this, we could use
-      // multidraw without flushing.
-      glVertexArrayVertexBuffer(
+      std::memcpy(allocation.host_ptr,
+                  memory_->TranslatePhysical(fetch->address << 2),
+                  valid_range);
+
+      draw_batcher_.BindVertexBuffer(
           vertex_shader->vao(),
           static_cast<GLuint>(vertex_binding.binding_index),
           scratch_buffer_.handle(), allocation.offset,
@@ -1424,9 +1462,9 @@ GL4CommandProcessor::UpdateStatus GL4CommandProcessor::PopulateVertexBuffers() {
 
       scratch_buffer_.Commit(std::move(allocation));
     } else {
-      // TODO(benvanik): if we could find a way to avoid this, we could use
-      // multidraw without flushing.
-      glVertexArrayVertexBuffer(
+      // Cached data lands at the same offset, so draws reusing the same
+      // vertex buffers keep batching.
+      draw_batcher_.BindVertexBuffer(
           vertex_shader->vao(),
           static_cast<GLuint>(vertex_binding.binding_index),
           scratch_buffer_.handle(), allocation.offset,
@@ -1516,6 +1554,8 @@ GL4CommandProcessor::UpdateStatus GL4CommandProcessor::PopulateSampler(
   trace_writer_.WriteMemoryRead(texture_info.guest_address,
                                 texture_info.input_length);
 
+  // Uploads are staged through the array data buffer.
+  draw_batcher_.ReserveArrayData(texture_info.output_length);
   auto entry_view = texture_cache_.Demand(texture_info, sampler_info);
   if (!entry_view) {
     // Unable to create/fetch/etc.
@@ -1535,6 +1575,10 @@ bool GL4CommandProcessor::IssueCopy() {
   SCOPE_profile_cpu_f("gpu");
   auto& regs = *register_file_;
 
+  // Copies read and clear render targets batched draws are still to write.
+  draw_batcher_.Flush(DrawBatcher::FlushMode::kMakeCoherent);
+  SCOPE_profile_gpu_i("GPU", "Resolve");
+
   // This is used to resolve surfaces, taking them from EDRAM render targets
   // to system memory. It can optionally clear color/depth surfaces, too.
   // The command buffer has stuff for actually doing this by drawing, however
@@ -26,6 +26,7 @@
 #include "xenia/gpu/gl4/gl4_shader.h"
 #include "xenia/gpu/gl4/gl4_shader_cache.h"
 #include "xenia/gpu/gl4/texture_cache.h"
+#include "xenia/gpu/gl4/timestamp_pool.h"
 #include "xenia/gpu/glsl_shader_translator.h"
 #include "xenia/gpu/register_file.h"
 #include "xenia/gpu/xenos.h"
@@ -47,6 +48,9 @@ class GL4CommandProcessor : public CommandProcessor {
   ~GL4CommandProcessor() override;
 
   void ClearCaches() override;
+  void GetCacheStats(std::vector<CacheStats>* cache_stats) override;
+  void GetMemoryUsage(
+      std::vector<std::pair<const char*, uint64_t>>* usage) override;
 
   // HACK: for debugging; would be good to have this in a base type.
   TextureCache* texture_cache() { return &texture_cache_; }
@@ -152,6 +156,7 @@ class GL4CommandProcessor : public CommandProcessor {
 
   DrawBatcher draw_batcher_;
   xe::ui::gl::CircularBuffer scratch_buffer_;
+  TimestampPool timestamp_pool_;
 
  private:
   bool SetShadowRegister(uint32_t* dest, uint32_t register_name);
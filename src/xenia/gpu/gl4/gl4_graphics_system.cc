@@ -12,6 +12,7 @@
 #include <algorithm>
 #include <cstring>
 
+#include "xenia/base/clock.h"
 #include "xenia/base/logging.h"
 #include "xenia/base/profiling.h"
 #include "xenia/cpu/processor.h"
@@ -32,6 +33,12 @@ GL4GraphicsSystem::~GL4GraphicsSystem() = default;
 X_STATUS GL4GraphicsSystem::Setup(cpu::Processor* processor,
                                   kernel::KernelState* kernel_state,
                                   ui::Window* target_window) {
+  if (!target_window) {
+    // GL contexts can't be created without a window.
+    XELOGE("The GL4 backend can't run headless, use --gpu=vulkan");
+    return X_STATUS_NOT_IMPLEMENTED;
+  }
+
   // Must create the provider so we can create contexts.
   provider_ = xe::ui::gl::GLProvider::Create(target_window);
 
@@ -61,10 +68,12 @@ void GL4GraphicsSystem::Swap(xe::ui::UIEvent* e) {
   auto& swap_state = command_processor_->swap_state();
   {
     std::lock_guard<std::mutex> lock(swap_state.mutex);
-    if (swap_state.pending) {
+    if (is_swap_ready()) {
       swap_state.pending = false;
       std::swap(swap_state.front_buffer_texture,
                 swap_state.back_buffer_texture);
+      swap_state.last_latency_ticks =
+          Clock::QueryHostTickCount() - swap_state.pending_host_ticks;
     }
   }
 
@@ -85,73 +85,16 @@ bool GL4Shader::LoadFromBinary(const uint8_t* blob, GLenum binary_format,
 bool GL4Shader::PrepareVertexArrayObject() {
   glCreateVertexArrays(1, &vao_);
 
+  // Attributes are fetched as the raw guest words and decoded in the shader.
   for (const auto& vertex_binding : vertex_bindings()) {
     for (const auto& attrib : vertex_binding.attributes) {
-      auto comp_count = GetVertexFormatComponentCount(
-          attrib.fetch_instr.attributes.data_format);
-      GLenum comp_type = 0;
-      bool is_signed = attrib.fetch_instr.attributes.is_signed;
-      switch (attrib.fetch_instr.attributes.data_format) {
-        case VertexFormat::k_8_8_8_8:
-          comp_type = is_signed ? GL_BYTE : GL_UNSIGNED_BYTE;
-          break;
-        case VertexFormat::k_2_10_10_10:
-          comp_type = is_signed ? GL_INT : GL_UNSIGNED_INT;
-          comp_count = 1;
-          break;
-        case VertexFormat::k_10_11_11:
-          comp_type = is_signed ? GL_INT : GL_UNSIGNED_INT;
-          comp_count = 1;
-          break;
-        case VertexFormat::k_11_11_10:
-          assert_true(is_signed);
-          comp_type = is_signed ? GL_R11F_G11F_B10F : 0;
-          break;
-        case VertexFormat::k_16_16:
-          comp_type = is_signed ? GL_SHORT : GL_UNSIGNED_SHORT;
-          break;
-        case VertexFormat::k_16_16_FLOAT:
-          comp_type = GL_HALF_FLOAT;
-          break;
-        case VertexFormat::k_16_16_16_16:
-          comp_type = is_signed ? GL_SHORT : GL_UNSIGNED_SHORT;
-          break;
-        case VertexFormat::k_16_16_16_16_FLOAT:
-          comp_type = GL_HALF_FLOAT;
-          break;
-        case VertexFormat::k_32:
-          comp_type = is_signed ? GL_INT : GL_UNSIGNED_INT;
-          break;
-        case VertexFormat::k_32_32:
-          comp_type = is_signed ? GL_INT : GL_UNSIGNED_INT;
-          break;
-        case VertexFormat::k_32_32_32_32:
-          comp_type = is_signed ? GL_INT : GL_UNSIGNED_INT;
-          break;
-        case VertexFormat::k_32_FLOAT:
-          comp_type = GL_FLOAT;
-          break;
-        case VertexFormat::k_32_32_FLOAT:
-          comp_type = GL_FLOAT;
-          break;
-        case VertexFormat::k_32_32_32_FLOAT:
-          comp_type = GL_FLOAT;
-          break;
-        case VertexFormat::k_32_32_32_32_FLOAT:
-          comp_type = GL_FLOAT;
-          break;
-        default:
-          assert_unhandled_case(attrib.fetch_instr.attributes.data_format);
-          return false;
-      }
-
       glEnableVertexArrayAttrib(vao_, attrib.attrib_index);
       glVertexArrayAttribBinding(vao_, attrib.attrib_index,
                                  vertex_binding.binding_index);
-      glVertexArrayAttribFormat(vao_, attrib.attrib_index, comp_count,
-                                comp_type,
-                                !attrib.fetch_instr.attributes.is_integer,
-                                attrib.fetch_instr.attributes.offset * 4);
+      glVertexArrayAttribIFormat(
+          vao_, attrib.attrib_index,
+          GetVertexFormatSizeInWords(attrib.fetch_instr.attributes.data_format),
+          GL_UNSIGNED_INT, attrib.fetch_instr.attributes.offset * 4);
     }
   }
 
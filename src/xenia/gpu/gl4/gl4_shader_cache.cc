@@ -10,6 +10,7 @@
 #include "xenia/gpu/gl4/gl4_shader_cache.h"
 
 #include <cinttypes>
+#include <cstring>
 
 #include "xenia/base/filesystem.h"
 #include "xenia/base/logging.h"
@@ -26,9 +27,30 @@ namespace gpu {
 namespace gl4 {
 
 GL4ShaderCache::GL4ShaderCache(GlslShaderTranslator* shader_translator)
-    : shader_translator_(shader_translator) {}
+    : shader_translator_(shader_translator) {
+  if (FLAGS_shader_cache_dir.empty()) {
+    // Cache disabled.
+    return;
+  }
+  cache_dir_ = xe::to_absolute_path(xe::to_wstring(FLAGS_shader_cache_dir));
+  xe::filesystem::CreateFolder(cache_dir_);
+  cache_thread_ =
+      xe::threading::Thread::Create({}, [this]() { CacheThreadMain(); });
+  cache_thread_->set_name("xe::gpu::gl4::ShaderCache");
+}
 
-GL4ShaderCache::~GL4ShaderCache() {}
+GL4ShaderCache::~GL4ShaderCache() {
+  if (cache_thread_) {
+    {
+      std::lock_guard<std::mutex> lock(cache_mutex_);
+      cache_shutdown_ = true;
+    }
+    cache_cond_.notify_all();
+    // Pending writes are finished first.
+    xe::threading::Wait(cache_thread_.get(), false);
+    cache_thread_.reset();
+  }
+}
 
 void GL4ShaderCache::Reset() {
   shader_map_.clear();
@@ -39,61 +61,95 @@ GL4Shader* GL4ShaderCache::LookupOrInsertShader(ShaderType shader_type,
                                                 const uint32_t* dwords,
                                                 uint32_t dword_count) {
   // Hash the input memory and lookup the shader.
-  GL4Shader* shader_ptr = nullptr;
   uint64_t hash = XXH64(dwords, dword_count * sizeof(uint32_t), 0);
   auto it = shader_map_.find(hash);
   if (it != shader_map_.end()) {
     // Shader has been previously loaded.
     // TODO(benvanik): compare bytes? Likelihood of collision is low.
-    shader_ptr = it->second;
-  } else {
-    // Check filesystem cache.
-    shader_ptr = FindCachedShader(shader_type, hash, dwords, dword_count);
-    if (shader_ptr) {
-      // Found!
-      XELOGGPU("Loaded %s shader from cache (hash: %.16" PRIX64 ")",
-               shader_type == ShaderType::kVertex ? "vertex" : "pixel", hash);
-      return shader_ptr;
-    }
+    return it->second;
+  }
 
-    // Not found in cache - load from scratch.
-    auto shader =
-        std::make_unique<GL4Shader>(shader_type, hash, dwords, dword_count);
-    shader_ptr = shader.get();
-    shader_map_.insert({hash, shader_ptr});
-    all_shaders_.emplace_back(std::move(shader));
-
-    // Perform translation.
-    // If this fails the shader will be marked as invalid and ignored later.
-    if (shader_translator_->Translate(shader_ptr)) {
-      shader_ptr->Prepare();
-      if (shader_ptr->is_valid()) {
-        CacheShader(shader_ptr);
-
-        XELOGGPU("Generated %s shader at 0x%.16" PRIX64 " (%db):\n%s",
-                 shader_type == ShaderType::kVertex ? "vertex" : "pixel",
-                 dwords, dword_count * 4,
-                 shader_ptr->ucode_disassembly().c_str());
-      }
+  auto shader =
+      std::make_unique<GL4Shader>(shader_type, hash, dwords, dword_count);
+  auto shader_ptr = shader.get();
+  shader_map_.insert({hash, shader_ptr});
+  all_shaders_.emplace_back(std::move(shader));
+
+  // Perform translation. It is needed even for cached programs, as their key
+  // is the translated source, and is cheap next to linking.
+  // If this fails the shader will be marked as invalid and ignored later.
+  if (!shader_translator_->Translate(shader_ptr)) {
+    XELOGE("Shader failed translation");
+    return shader_ptr;
+  }
 
-      // Dump shader files if desired.
-      if (!FLAGS_dump_shaders.empty()) {
-        shader_ptr->Dump(FLAGS_dump_shaders, "gl4");
+  uint64_t key = cache_thread_ ? GetProgramKey(shader_ptr) : 0;
+  if (cache_thread_ && LoadCachedProgram(shader_ptr, key)) {
+    XELOGGPU("Loaded %s shader from cache (hash: %.16" PRIX64 ")",
+             shader_type == ShaderType::kVertex ? "vertex" : "pixel", hash);
+  } else {
+    shader_ptr->Prepare();
+    if (shader_ptr->is_valid()) {
+      if (cache_thread_) {
+        CacheProgram(shader_ptr, key);
       }
-    } else {
-      XELOGE("Shader failed translation");
+
+      XELOGGPU("Generated %s shader at 0x%.16" PRIX64 " (%db):\n%s",
+               shader_type == ShaderType::kVertex ? "vertex" : "pixel",
+               dwords, dword_count * 4,
+               shader_ptr->ucode_disassembly().c_str());
     }
   }
 
+  // Dump shader files if desired.
+  if (!FLAGS_dump_shaders.empty()) {
+    shader_ptr->Dump(FLAGS_dump_shaders, "gl4");
+  }
+
   return shader_ptr;
 }
 
-void GL4ShaderCache::CacheShader(GL4Shader* shader) {
-  if (FLAGS_shader_cache_dir.empty()) {
-    // Cache disabled.
-    return;
+uint64_t GL4ShaderCache::GetProgramKey(GL4Shader* shader) {
+  if (!driver_hash_) {
+    std::string driver;
+    for (GLenum name : {GL_VENDOR, GL_RENDERER, GL_VERSION}) {
+      auto value = reinterpret_cast<const char*>(glGetString(name));
+      driver += value ? value : "";
+      driver += '\n';
+    }
+    driver_hash_ = XXH64(driver.data(), driver.size(), 0) | 1;
+  }
+  const auto& source = shader->translated_binary();
+  return XXH64(source.data(), source.size(), driver_hash_);
+}
+
+bool GL4ShaderCache::LoadCachedProgram(GL4Shader* shader, uint64_t key) {
+  std::vector<uint8_t> data;
+  {
+    std::lock_guard<std::mutex> lock(cache_mutex_);
+    auto it = preloaded_programs_.find(key);
+    if (it != preloaded_programs_.end()) {
+      data = std::move(it->second);
+      preloaded_programs_.erase(it);
+    }
+  }
+  // Not read ahead yet, or written since. A miss costs far less than the
+  // link that follows it.
+  if (data.empty() && !ReadProgramFile(GetProgramPath(key), &data)) {
+    return false;
+  }
+
+  auto header = reinterpret_cast<const CachedProgramHeader*>(data.data());
+  if (header->key != key) {
+    return false;
   }
+  // Fails if the driver rejects the binary, in which case it is relinked and
+  // cached again.
+  return shader->LoadFromBinary(data.data() + sizeof(CachedProgramHeader),
+                                header->binary_format, header->binary_length);
+}
 
+void GL4ShaderCache::CacheProgram(GL4Shader* shader, uint64_t key) {
   GLenum binary_format = 0;
   auto binary = shader->GetBinary(&binary_format);
   if (binary.size() == 0) {
@@ -101,85 +157,94 @@ void GL4ShaderCache::CacheShader(GL4Shader* shader) {
     return;
   }
 
-  auto cache_dir = xe::to_absolute_path(xe::to_wstring(FLAGS_shader_cache_dir));
-  xe::filesystem::CreateFolder(cache_dir);
-  auto filename =
-      cache_dir + xe::format_string(
-                      L"%.16" PRIX64 ".%s", shader->ucode_data_hash(),
-                      shader->type() == ShaderType::kPixel ? L"frag" : L"vert");
-  auto file = xe::filesystem::OpenFile(filename, "wb");
-  if (!file) {
-    // Not fatal, but not too good.
-    return;
+  WriteJob job;
+  job.key = key;
+  job.data.resize(sizeof(CachedProgramHeader) + binary.size());
+  auto header = reinterpret_cast<CachedProgramHeader*>(job.data.data());
+  header->magic = xe::byte_swap('XGLP');
+  header->version = kCachedProgramVersion;
+  header->key = key;
+  header->binary_format = binary_format;
+  header->binary_length = uint32_t(binary.size());
+  std::memcpy(job.data.data() + sizeof(CachedProgramHeader), binary.data(),
+              binary.size());
+  {
+    std::lock_guard<std::mutex> lock(cache_mutex_);
+    write_queue_.push_back(std::move(job));
   }
+  cache_cond_.notify_all();
+}
 
-  std::vector<uint8_t> cached_shader_mem;
-  // Resize this vector to the final filesize (- 1 to account for dummy array
-  // in CachedShader)
-  cached_shader_mem.resize(sizeof(CachedShader) + binary.size() - 1);
-  auto cached_shader =
-      reinterpret_cast<CachedShader*>(cached_shader_mem.data());
-  cached_shader->magic = xe::byte_swap('XSHD');
-  cached_shader->version = 0;  // TODO
-  cached_shader->shader_type = uint8_t(shader->type());
-  cached_shader->binary_len = uint32_t(binary.size());
-  cached_shader->binary_format = binary_format;
-  std::memcpy(cached_shader->binary, binary.data(), binary.size());
-
-  fwrite(cached_shader_mem.data(), cached_shader_mem.size(), 1, file);
-  fclose(file);
+std::wstring GL4ShaderCache::GetProgramPath(uint64_t key) const {
+  return xe::join_paths(cache_dir_,
+                        xe::format_string(L"%.16" PRIX64 ".glbin", key));
 }
 
-GL4Shader* GL4ShaderCache::FindCachedShader(ShaderType shader_type,
-                                            uint64_t hash,
-                                            const uint32_t* dwords,
-                                            uint32_t dword_count) {
-  if (FLAGS_shader_cache_dir.empty()) {
-    // Cache disabled.
-    return nullptr;
+bool GL4ShaderCache::ReadProgramFile(const std::wstring& path,
+                                     std::vector<uint8_t>* data) {
+  auto file = xe::filesystem::OpenFile(path, "rb");
+  if (!file) {
+    return false;
   }
-
-  auto cache_dir = xe::to_absolute_path(xe::to_wstring(FLAGS_shader_cache_dir));
-  auto filename =
-      cache_dir +
-      xe::format_string(L"%.16" PRIX64 ".%s", hash,
-                        shader_type == ShaderType::kPixel ? L"frag" : L"vert");
-  if (!xe::filesystem::PathExists(filename)) {
-    return nullptr;
+  CachedProgramHeader header;
+  bool valid = fread(&header, sizeof(header), 1, file) == 1 &&
+               header.magic == xe::byte_swap('XGLP') &&
+               header.version == kCachedProgramVersion;
+  if (valid) {
+    data->resize(sizeof(header) + header.binary_length);
+    std::memcpy(data->data(), &header, sizeof(header));
+    // Files cut short by a crash while writing are ignored.
+    valid = fread(data->data() + sizeof(header), 1, header.binary_length,
+                  file) == header.binary_length;
   }
-
-  // Shader is cached. Open it up.
-  auto map = xe::MappedMemory::Open(filename, MappedMemory::Mode::kRead);
-  if (!map) {
-    // Should not fail
-    assert_always();
-    return nullptr;
+  fclose(file);
+  if (!valid) {
+    data->clear();
   }
+  return valid;
+}
 
-  auto cached_shader = reinterpret_cast<CachedShader*>(map->data());
-  // TODO: Compare versions
-  if (cached_shader->magic != xe::byte_swap('XSHD')) {
-    return nullptr;
+void GL4ShaderCache::CacheThreadMain() {
+  for (auto& file_info : xe::filesystem::ListFiles(cache_dir_)) {
+    const std::wstring& name = file_info.name;
+    if (file_info.type != xe::filesystem::FileInfo::Type::kFile ||
+        name.size() != 16 + 6 || name.compare(16, 6, L".glbin") != 0) {
+      continue;
+    }
+    std::vector<uint8_t> data;
+    if (!ReadProgramFile(xe::join_paths(cache_dir_, name), &data)) {
+      continue;
+    }
+    uint64_t key = reinterpret_cast<CachedProgramHeader*>(data.data())->key;
+    std::lock_guard<std::mutex> lock(cache_mutex_);
+    if (cache_shutdown_) {
+      break;
+    }
+    preloaded_programs_.emplace(key, std::move(data));
   }
 
-  auto shader =
-      std::make_unique<GL4Shader>(shader_type, hash, dwords, dword_count);
-
-  // Gather the binding points.
-  // TODO: Make Shader do this on construction.
-  // TODO: Regenerate microcode disasm/etc on load.
-  shader_translator_->GatherAllBindingInformation(shader.get());
-  if (!shader->LoadFromBinary(cached_shader->binary,
-                              cached_shader->binary_format,
-                              cached_shader->binary_len)) {
-    // Failed to load from binary.
-    return nullptr;
+  while (true) {
+    WriteJob job;
+    {
+      std::unique_lock<std::mutex> lock(cache_mutex_);
+      cache_cond_.wait(lock, [this]() {
+        return cache_shutdown_ || !write_queue_.empty();
+      });
+      if (write_queue_.empty()) {
+        // Shutting down with nothing left to write.
+        return;
+      }
+      job = std::move(write_queue_.front());
+      write_queue_.pop_front();
+    }
+    auto file = xe::filesystem::OpenFile(GetProgramPath(job.key), "wb");
+    if (!file) {
+      // Not fatal, but not too good.
+      continue;
+    }
+    fwrite(job.data.data(), job.data.size(), 1, file);
+    fclose(file);
   }
-
-  auto shader_ptr = shader.get();
-  shader_map_.insert({hash, shader_ptr});
-  all_shaders_.emplace_back(std::move(shader));
-  return shader_ptr;
 }
 
 }  // namespace gl4
@@ -10,10 +10,16 @@
 #ifndef XENIA_GPU_GL4_SHADER_CACHE_H_
 #define XENIA_GPU_GL4_SHADER_CACHE_H_
 
+#include <condition_variable>
 #include <cstdint>
+#include <deque>
 #include <memory>
+#include <mutex>
+#include <string>
 #include <unordered_map>
+#include <vector>
 
+#include "xenia/base/threading.h"
 #include "xenia/gpu/xenos.h"
 
 namespace xe {
@@ -24,33 +30,67 @@ namespace gl4 {
 
 class GL4Shader;
 
+// Translated shaders and, if --shader_cache_dir is set, the program binaries
+// the driver linked them into. Binaries are keyed by the hash of the GLSL
+// and of the driver, so that shaders are relinked if either changes. The
+// cache directory is read ahead on a background thread at startup and new
+// binaries are written on the same thread, so the GPU thread only creates
+// programs from binaries that are already in memory.
 class GL4ShaderCache {
  public:
   GL4ShaderCache(GlslShaderTranslator* shader_translator);
   ~GL4ShaderCache();
 
   void Reset();
+  // Must be called on the thread owning the GL context.
   GL4Shader* LookupOrInsertShader(ShaderType shader_type,
                                   const uint32_t* dwords, uint32_t dword_count);
 
  private:
-  // Cached shader file format.
-  struct CachedShader {
+  // Cached program file format, followed by binary_length bytes of binary.
+  struct CachedProgramHeader {
     uint32_t magic;
-    uint32_t version;        // Version of the shader translator used.
-    uint8_t shader_type;     // ShaderType enum
-    uint32_t binary_len;     // Code length
-    uint32_t binary_format;  // Binary format (from OpenGL)
-    uint8_t binary[1];       // Code
+    uint32_t version;
+    // Hash of the translated GLSL and the driver.
+    uint64_t key;
+    uint32_t binary_format;
+    uint32_t binary_length;
   };
+  // Bump whenever the file format changes.
+  static const uint32_t kCachedProgramVersion = 2;
 
-  void CacheShader(GL4Shader* shader);
-  GL4Shader* FindCachedShader(ShaderType shader_type, uint64_t hash,
-                              const uint32_t* dwords, uint32_t dword_count);
+  struct WriteJob {
+    uint64_t key;
+    std::vector<uint8_t> data;
+  };
+
+  uint64_t GetProgramKey(GL4Shader* shader);
+  // Creates the program of the shader from a cached binary, if there is one.
+  bool LoadCachedProgram(GL4Shader* shader, uint64_t key);
+  void CacheProgram(GL4Shader* shader, uint64_t key);
+
+  std::wstring GetProgramPath(uint64_t key) const;
+  bool ReadProgramFile(const std::wstring& path, std::vector<uint8_t>* data);
+  void CacheThreadMain();
 
   GlslShaderTranslator* shader_translator_ = nullptr;
   std::vector<std::unique_ptr<GL4Shader>> all_shaders_;
   std::unordered_map<uint64_t, GL4Shader*> shader_map_;
+
+  // Shader cache directory, or empty if disabled.
+  std::wstring cache_dir_;
+  // Hash of the GL vendor, renderer and version. Only known once the GL
+  // context is current.
+  uint64_t driver_hash_ = 0;
+
+  std::unique_ptr<xe::threading::Thread> cache_thread_;
+  // Guards everything below.
+  std::mutex cache_mutex_;
+  std::condition_variable cache_cond_;
+  // Files read ahead by the cache thread, by key. Taken when used.
+  std::unordered_map<uint64_t, std::vector<uint8_t>> preloaded_programs_;
+  std::deque<WriteJob> write_queue_;
+  bool cache_shutdown_ = false;
 };
 
 }  // namespace gl4
@@ -13,12 +13,15 @@
 #include <cstring>
 
 #include "xenia/base/assert.h"
+#include "xenia/base/counters.h"
 #include "xenia/base/logging.h"
 #include "xenia/base/math.h"
 #include "xenia/base/memory.h"
 #include "xenia/base/profiling.h"
 #include "xenia/gpu/gpu_flags.h"
 
+DECLARE_counter(texture_uploads);
+
 namespace xe {
 namespace gpu {
 namespace gl4 {
@@ -148,8 +151,11 @@ TextureCache::TextureCache() : memory_(nullptr), scratch_buffer_(nullptr) {
 
 TextureCache::~TextureCache() { Shutdown(); }
 
-bool TextureCache::Initialize(Memory* memory, CircularBuffer* scratch_buffer) {
+bool TextureCache::Initialize(Memory* memory,
+                              DirtyPageTracker* dirty_page_tracker,
+                              CircularBuffer* scratch_buffer) {
   memory_ = memory;
+  dirty_page_tracker_ = dirty_page_tracker;
   scratch_buffer_ = scratch_buffer;
   return true;
 }
@@ -170,11 +176,69 @@ void TextureCache::Scavenge() {
   }
 
   for (auto& entry : invalidated_textures) {
+    if (!entry->content_hashes.empty()) {
+      // Refreshed in place by LookupOrInsertTexture when next used.
+      continue;
+    }
     EvictTexture(entry);
   }
   invalidated_textures.clear();
 }
 
+void TextureCache::EndFrame() {
+  SCOPE_profile_cpu_f("gpu");
+
+  uint64_t budget = uint64_t(std::max(FLAGS_texture_cache_budget, 0)) << 20;
+  if (budget && resident_bytes_ > budget) {
+    // Textures taken over from resolves hold what the GPU drew, so only ones
+    // with hashed guest data are known to be safe to upload again.
+    std::vector<TextureEntry*> candidates;
+    for (auto& it : texture_entries_) {
+      auto entry = it.second;
+      if (entry->last_used_frame < frame_number_ &&
+          !entry->content_hashes.empty()) {
+        candidates.push_back(entry);
+      }
+    }
+    std::sort(candidates.begin(), candidates.end(),
+              [](const TextureEntry* a, const TextureEntry* b) {
+                return a->last_used_frame < b->last_used_frame;
+              });
+    for (auto entry : candidates) {
+      if (resident_bytes_ <= budget) {
+        break;
+      }
+      // Stop the write watch from queueing it once it's gone.
+      if (entry->write_watch_handle) {
+        dirty_page_tracker_->CancelWatch(entry->write_watch_handle);
+        entry->write_watch_handle = 0;
+      }
+      {
+        std::lock_guard<std::mutex> lock(invalidated_textures_mutex_);
+        for (auto& invalidated_textures : invalidated_textures_sets_) {
+          invalidated_textures.erase(
+              std::remove(invalidated_textures.begin(),
+                          invalidated_textures.end(), entry),
+              invalidated_textures.end());
+        }
+      }
+      EvictTexture(entry);
+      ++eviction_count_;
+    }
+  }
+
+  frame_upload_count_ = upload_count_;
+  upload_count_ = 0;
+  ++frame_number_;
+
+  COUNT_profile_cpu("gpu/texture_cache/textures",
+                    int(texture_entries_.size()));
+  COUNT_profile_cpu("gpu/texture_cache/resident_mb",
+                    int(resident_bytes_ >> 20));
+  COUNT_profile_cpu("gpu/texture_cache/uploads", int(frame_upload_count_));
+  COUNT_profile_cpu("gpu/texture_cache/evictions", int(eviction_count_));
+}
+
 void TextureCache::Clear() {
   EvictAllTextures();
 
@@ -217,6 +281,7 @@ TextureCache::TextureEntryView* TextureCache::Demand(
     XELOGE("Failed to setup texture");
     return nullptr;
   }
+  texture_entry->last_used_frame = frame_number_;
 
   // We likely have the sampler in the texture view listing, so scan for it.
   uint64_t sampler_hash = sampler_info.hash();
@@ -413,23 +478,35 @@ TextureCache::TextureEntry* TextureCache::LookupOrInsertTexture(
   for (auto it = texture_entries_.find(hash); it != texture_entries_.end();
        ++it) {
     if (it->second->pending_invalidation) {
+      if (texture_update_callback_) {
+        texture_update_callback_();
+      }
+      if (it->second->texture_info == texture_info &&
+          RefreshTexture(it->second)) {
+        ++hit_count_;
+        return it->second;
+      }
       // Whoa, we've been invalidated! Let's scavenge to cleanup and try again.
-      // TODO(benvanik): reuse existing texture storage.
       Scavenge();
       break;
     }
     if (it->second->texture_info == texture_info) {
       // Found in cache!
+      ++hit_count_;
       return it->second;
     }
   }
 
   // Not found, create.
+  ++miss_count_;
   auto entry = std::make_unique<TextureEntry>();
   entry->texture_info = texture_info;
   entry->access_watch_handle = 0;
+  entry->write_watch_handle = 0;
   entry->pending_invalidation = false;
   entry->handle = 0;
+  entry->memory_size = texture_info.input_length;
+  entry->last_used_frame = frame_number_;
 
   // Check read buffer textures - there may be one waiting for us.
   // TODO(benvanik): speed up existence check?
@@ -446,6 +523,7 @@ TextureCache::TextureEntry* TextureCache::LookupOrInsertTexture(
       delete read_buffer_entry;
       // TODO(benvanik): set more texture properties? swizzle/etc?
       auto entry_ptr = entry.get();
+      resident_bytes_ += entry->memory_size;
       texture_entries_.insert({hash, entry.release()});
       return entry_ptr;
     }
@@ -477,9 +555,15 @@ TextureCache::TextureEntry* TextureCache::LookupOrInsertTexture(
   // Upload/convert.
   bool uploaded = false;
   switch (texture_info.dimension) {
-    case Dimension::k2D:
+    case Dimension::k2D: {
+      // Hashed so that later invalidations can tell what changed.
+      uint32_t changed_offset;
+      uint32_t changed_length;
+      texture_info.UpdateContentPages(
+          memory_->TranslatePhysical(texture_info.guest_address),
+          &entry->content_hashes, &changed_offset, &changed_length);
       uploaded = UploadTexture2D(entry->handle, texture_info);
-      break;
+    } break;
     case Dimension::kCube:
       uploaded = UploadTextureCube(entry->handle, texture_info);
       break;
@@ -494,29 +578,86 @@ TextureCache::TextureEntry* TextureCache::LookupOrInsertTexture(
   }
 
   // Add a write watch. If any data in the given range is touched we'll get a
-  // callback and evict the texture. We could reuse the storage, though the
-  // driver is likely in a better position to pool that kind of stuff.
-  entry->access_watch_handle = memory_->AddPhysicalAccessWatch(
-      texture_info.guest_address, texture_info.input_length,
-      cpu::MMIOHandler::kWatchWrite,
+  // callback and update or evict the texture.
+  WatchTexture(entry.get());
+
+  // Add to map - map takes ownership.
+  auto entry_ptr = entry.get();
+  resident_bytes_ += entry->memory_size;
+  texture_entries_.insert({hash, entry.release()});
+  return entry_ptr;
+}
+
+void TextureCache::WatchTexture(TextureEntry* entry) {
+  entry->write_watch_handle = dirty_page_tracker_->AddWatch(
+      entry->texture_info.guest_address, entry->texture_info.input_length,
       [](void* context_ptr, void* data_ptr, uint32_t address) {
         auto self = reinterpret_cast<TextureCache*>(context_ptr);
         auto touched_entry = reinterpret_cast<TextureEntry*>(data_ptr);
         // Clear watch handle first so we don't redundantly
         // remove.
-        touched_entry->access_watch_handle = 0;
-        touched_entry->pending_invalidation = true;
+        touched_entry->write_watch_handle = 0;
         // Add to pending list so Scavenge will clean it up.
+        // RefreshTexture may take it back out, so the flag is only changed
+        // under the lock.
         self->invalidated_textures_mutex_.lock();
+        touched_entry->pending_invalidation = true;
         self->invalidated_textures_->push_back(touched_entry);
         self->invalidated_textures_mutex_.unlock();
       },
-      this, entry.get());
+      this, entry);
+}
 
-  // Add to map - map takes ownership.
-  auto entry_ptr = entry.get();
-  texture_entries_.insert({hash, entry.release()});
-  return entry_ptr;
+bool TextureCache::RefreshTexture(TextureEntry* entry) {
+  const auto& texture_info = entry->texture_info;
+  if (entry->content_hashes.empty() ||
+      texture_info.dimension != Dimension::k2D) {
+    return false;
+  }
+
+  // Keep Scavenge from evicting it, and watch again before looking at the data
+  // so that writes made while we do aren't missed.
+  {
+    std::lock_guard<std::mutex> lock(invalidated_textures_mutex_);
+    for (auto& invalidated_textures : invalidated_textures_sets_) {
+      invalidated_textures.erase(
+          std::remove(invalidated_textures.begin(),
+                      invalidated_textures.end(), entry),
+          invalidated_textures.end());
+    }
+    entry->pending_invalidation = false;
+  }
+  WatchTexture(entry);
+
+  // Writes that leave the data as it was don't need an upload at all.
+  uint32_t changed_offset;
+  uint32_t changed_length;
+  if (!texture_info.UpdateContentPages(
+          memory_->TranslatePhysical(texture_info.guest_address),
+          &entry->content_hashes, &changed_offset, &changed_length)) {
+    return true;
+  }
+  uint32_t first_row;
+  uint32_t row_count;
+  texture_info.GetBlockRowsForRange(changed_offset, changed_length,
+                                    &first_row, &row_count);
+  if (!row_count ||
+      UploadTexture2D(entry->handle, texture_info, first_row, row_count)) {
+    return true;
+  }
+
+  // Evict it like any other invalidated texture.
+  entry->content_hashes.clear();
+  if (entry->write_watch_handle) {
+    dirty_page_tracker_->CancelWatch(entry->write_watch_handle);
+    entry->write_watch_handle = 0;
+  }
+  std::lock_guard<std::mutex> lock(invalidated_textures_mutex_);
+  if (!entry->pending_invalidation) {
+    entry->pending_invalidation = true;
+    invalidated_textures_->push_back(entry);
+  }
+  return false;
 }
 
 TextureCache::TextureEntry* TextureCache::LookupAddress(uint32_t guest_address,
@@ -579,6 +720,10 @@ GLuint TextureCache::ConvertTexture(Blitter* blitter, uint32_t guest_address,
     // Setup a read/write access watch. If the game tries to touch the memory
     // we were supposed to populate with this texture, then we'll actually
     // populate it.
+    if (texture_entry->write_watch_handle) {
+      dirty_page_tracker_->CancelWatch(texture_entry->write_watch_handle);
+      texture_entry->write_watch_handle = 0;
+    }
     if (texture_entry->access_watch_handle) {
       memory_->CancelAccessWatch(texture_entry->access_watch_handle);
       texture_entry->access_watch_handle = 0;
@@ -665,6 +810,10 @@ GLuint TextureCache::ConvertTexture(Blitter* blitter, uint32_t guest_address,
 }
 
 void TextureCache::EvictTexture(TextureEntry* entry) {
+  if (entry->write_watch_handle) {
+    dirty_page_tracker_->CancelWatch(entry->write_watch_handle);
+    entry->write_watch_handle = 0;
+  }
   if (entry->access_watch_handle) {
     memory_->CancelAccessWatch(entry->access_watch_handle);
     entry->access_watch_handle = 0;
@@ -680,6 +829,7 @@ void TextureCache::EvictTexture(TextureEntry* entry) {
        it != texture_entries_.end(); ++it) {
     if (it->second == entry) {
       texture_entries_.erase(it);
+      resident_bytes_ -= entry->memory_size;
       break;
     }
   }
@@ -697,7 +847,7 @@ void TextureSwap(Endian endianness, void* dest, const void* src,
       xe::copy_and_swap_32_aligned(dest, src, length / 4);
       break;
     case Endian::k16in32:  // Swap high and low 16 bits within a 32 bit word
-      xe::copy_and_swap_16_in_32_aligned(dest, src, length);
+      xe::copy_and_swap_16_in_32_aligned(dest, src, length / 4);
       break;
     default:
     case Endian::kUnspecified:
@@ -707,8 +857,10 @@ void TextureSwap(Endian endianness, void* dest, const void* src,
 }
 
 bool TextureCache::UploadTexture2D(GLuint texture,
-                                   const TextureInfo& texture_info) {
+                                   const TextureInfo& texture_info,
+                                   uint32_t first_row, uint32_t row_count) {
   SCOPE_profile_cpu_f("gpu");
+  INCREMENT_counter(texture_uploads, 1);
   const auto host_address =
       memory_->TranslatePhysical(texture_info.guest_address);
 
@@ -719,29 +871,37 @@ bool TextureCache::UploadTexture2D(GLuint texture,
     return false;
   }
 
-  size_t unpack_length = texture_info.output_length;
-  glTextureStorage2D(texture, 1, config.internal_format,
-                     texture_info.size_2d.output_width,
-                     texture_info.size_2d.output_height);
+  // Rows of blocks to convert, [first_row, end_row).
+  uint32_t end_row = first_row + row_count;
+  size_t unpack_length = row_count * texture_info.size_2d.output_pitch;
+  if (!row_count) {
+    first_row = 0;
+    end_row = std::min(texture_info.size_2d.block_height,
+                       texture_info.size_2d.logical_height);
+    unpack_length = texture_info.output_length;
+    glTextureStorage2D(texture, 1, config.internal_format,
+                       texture_info.size_2d.output_width,
+                       texture_info.size_2d.output_height);
+  }
 
   auto allocation = scratch_buffer_->Acquire(unpack_length);
 
   if (!texture_info.is_tiled) {
     if (texture_info.size_2d.input_pitch == texture_info.size_2d.output_pitch) {
       // Fast path copy entire image.
-      TextureSwap(texture_info.endianness, allocation.host_ptr, host_address,
+      TextureSwap(texture_info.endianness, allocation.host_ptr,
+                  host_address + first_row * texture_info.size_2d.input_pitch,
                   unpack_length);
     } else {
       // Slow path copy row-by-row because strides differ.
       // UNPACK_ROW_LENGTH only works for uncompressed images, and likely does
       // this exact thing under the covers, so we just always do it here.
-      const uint8_t* src = host_address;
+      const uint8_t* src =
+          host_address + first_row * texture_info.size_2d.input_pitch;
       uint8_t* dest = reinterpret_cast<uint8_t*>(allocation.host_ptr);
       uint32_t pitch = std::min(texture_info.size_2d.input_pitch,
                                 texture_info.size_2d.output_pitch);
-      for (uint32_t y = 0; y < std::min(texture_info.size_2d.block_height,
-                                        texture_info.size_2d.logical_height);
-           y++) {
+      for (uint32_t y = first_row; y < end_row; y++) {
         TextureSwap(texture_info.endianness, dest, src, pitch);
         src += texture_info.size_2d.input_pitch;
         dest += texture_info.size_2d.output_pitch;
@@ -750,9 +910,6 @@ bool TextureCache::UploadTexture2D(GLuint texture,
   } else {
     // Untile image.
     // We could do this in a shader to speed things up, as this is pretty slow.
-
-    // TODO(benvanik): optimize this inner loop (or work by tiles).
-    const uint8_t* src = host_address;
     uint8_t* dest = reinterpret_cast<uint8_t*>(allocation.host_ptr);
     uint32_t bytes_per_block = texture_info.format_info->block_width *
                                texture_info.format_info->block_height *
@@ -763,27 +920,12 @@ bool TextureCache::UploadTexture2D(GLuint texture,
     uint32_t offset_y;
     TextureInfo::GetPackedTileOffset(texture_info, &offset_x, &offset_y);
 
-    auto bpp = (bytes_per_block >> 2) +
-               ((bytes_per_block >> 1) >> (bytes_per_block >> 2));
-    for (uint32_t y = 0, output_base_offset = 0;
-         y < std::min(texture_info.size_2d.block_height,
-                      texture_info.size_2d.logical_height);
-         y++, output_base_offset += texture_info.size_2d.output_pitch) {
-      auto input_base_offset = TextureInfo::TiledOffset2DOuter(
-          offset_y + y, (texture_info.size_2d.input_width /
-                         texture_info.format_info->block_width),
-          bpp);
-      for (uint32_t x = 0, output_offset = output_base_offset;
-           x < texture_info.size_2d.block_width;
-           x++, output_offset += bytes_per_block) {
-        auto input_offset =
-            TextureInfo::TiledOffset2DInner(offset_x + x, offset_y + y, bpp,
-                                            input_base_offset) >>
-            bpp;
-        TextureSwap(texture_info.endianness, dest + output_offset,
-                    src + input_offset * bytes_per_block, bytes_per_block);
-      }
-    }
+    TextureInfo::Untile(texture_info.endianness, host_address,
+                        texture_info.size_2d.input_width /
+                            texture_info.format_info->block_width,
+                        dest, texture_info.size_2d.output_pitch,
+                        texture_info.size_2d.block_width, bytes_per_block,
+                        offset_x, offset_y, first_row, end_row);
   }
   size_t unpack_offset = allocation.offset;
   scratch_buffer_->Commit(std::move(allocation));
@@ -791,12 +933,15 @@ bool TextureCache::UploadTexture2D(GLuint texture,
   // buffer.
   scratch_buffer_->Flush();
 
+  uint32_t upload_y = first_row * texture_info.format_info->block_height;
+  uint32_t upload_height =
+      std::min((end_row - first_row) * texture_info.format_info->block_height,
+               texture_info.size_2d.output_height - upload_y);
   glBindBuffer(GL_PIXEL_UNPACK_BUFFER, scratch_buffer_->handle());
   if (texture_info.is_compressed()) {
     glCompressedTextureSubImage2D(
-        texture, 0, 0, 0, texture_info.size_2d.output_width,
-        texture_info.size_2d.output_height, config.format,
-        static_cast<GLsizei>(unpack_length),
+        texture, 0, 0, upload_y, texture_info.size_2d.output_width,
+        upload_height, config.format, static_cast<GLsizei>(unpack_length),
         reinterpret_cast<void*>(unpack_offset));
   } else {
     // Most of these don't seem to have an effect on compressed images.
@@ -805,17 +950,20 @@ bool TextureCache::UploadTexture2D(GLuint texture,
     // glPixelStorei(GL_UNPACK_ROW_LENGTH, texture_info.size_2d.input_width);
     glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
 
-    glTextureSubImage2D(texture, 0, 0, 0, texture_info.size_2d.output_width,
-                        texture_info.size_2d.output_height, config.format,
-                        config.type, reinterpret_cast<void*>(unpack_offset));
+    glTextureSubImage2D(texture, 0, 0, upload_y,
+                        texture_info.size_2d.output_width, upload_height,
+                        config.format, config.type,
+                        reinterpret_cast<void*>(unpack_offset));
   }
   glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+  ++upload_count_;
   return true;
 }
 
 bool TextureCache::UploadTextureCube(GLuint texture,
                                      const TextureInfo& texture_info) {
   SCOPE_profile_cpu_f("gpu");
+  INCREMENT_counter(texture_uploads, 1);
   const auto host_address =
       memory_->TranslatePhysical(texture_info.guest_address);
 
@@ -855,7 +1003,6 @@ bool TextureCache::UploadTextureCube(GLuint texture,
       }
     }
   } else {
-    // TODO(benvanik): optimize this inner loop (or work by tiles).
     const uint8_t* src = host_address;
     uint8_t* dest = reinterpret_cast<uint8_t*>(allocation.host_ptr);
     uint32_t bytes_per_block = texture_info.format_info->block_width *
@@ -865,27 +1012,14 @@ bool TextureCache::UploadTextureCube(GLuint texture,
     uint32_t offset_x;
     uint32_t offset_y;
     TextureInfo::GetPackedTileOffset(texture_info, &offset_x, &offset_y);
-    auto bpp = (bytes_per_block >> 2) +
-               ((bytes_per_block >> 1) >> (bytes_per_block >> 2));
     for (int face = 0; face < 6; ++face) {
-      for (uint32_t y = 0, output_base_offset = 0;
-           y < texture_info.size_cube.block_height;
-           y++, output_base_offset += texture_info.size_cube.output_pitch) {
-        auto input_base_offset = TextureInfo::TiledOffset2DOuter(
-            offset_y + y, (texture_info.size_cube.input_width /
-                           texture_info.format_info->block_width),
-            bpp);
-        for (uint32_t x = 0, output_offset = output_base_offset;
-             x < texture_info.size_cube.block_width;
-             x++, output_offset += bytes_per_block) {
-          auto input_offset =
-              TextureInfo::TiledOffset2DInner(offset_x + x, offset_y + y, bpp,
-                                              input_base_offset) >>
-              bpp;
-          TextureSwap(texture_info.endianness, dest + output_offset,
-                      src + input_offset * bytes_per_block, bytes_per_block);
-        }
-      }
+      TextureInfo::Untile(texture_info.endianness, src,
+                          texture_info.size_cube.input_width /
+                              texture_info.format_info->block_width,
+                          dest, texture_info.size_cube.output_pitch,
+                          texture_info.size_cube.block_width, bytes_per_block,
+                          offset_x, offset_y, 0,
+                          texture_info.size_cube.block_height);
       src += texture_info.size_cube.input_face_length;
       dest += texture_info.size_cube.output_face_length;
     }
@@ -916,6 +1050,7 @@ bool TextureCache::UploadTextureCube(GLuint texture,
                         config.type, reinterpret_cast<void*>(unpack_offset));
   }
   glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+  ++upload_count_;
   return true;
 }
 
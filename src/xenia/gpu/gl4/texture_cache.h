@@ -10,10 +10,12 @@
 #ifndef XENIA_GPU_GL4_TEXTURE_CACHE_H_
 #define XENIA_GPU_GL4_TEXTURE_CACHE_H_
 
+#include <functional>
 #include <mutex>
 #include <unordered_map>
 #include <vector>
 
+#include "xenia/gpu/dirty_page_tracker.h"
 #include "xenia/gpu/sampler_info.h"
 #include "xenia/gpu/texture_info.h"
 #include "xenia/memory.h"
@@ -44,20 +46,49 @@ class TextureCache {
   };
   struct TextureEntry {
     TextureInfo texture_info;
+    // Read/write watch on a resolve target.
     uintptr_t access_watch_handle;
+    // Dirty page tracker watch on guest data the texture was uploaded from.
+    uintptr_t write_watch_handle;
     GLuint handle;
     bool pending_invalidation;
+    // Hash of each page of guest data, if the texture was uploaded from it.
+    std::vector<uint64_t> content_hashes;
     std::vector<std::unique_ptr<TextureEntryView>> views;
+    // Approximated by the size of the guest data.
+    uint32_t memory_size;
+    // Frame the texture was last used in, for eviction under the budget.
+    uint64_t last_used_frame;
   };
 
   TextureCache();
   ~TextureCache();
 
-  bool Initialize(Memory* memory, CircularBuffer* scratch_buffer);
+  bool Initialize(Memory* memory, DirtyPageTracker* dirty_page_tracker,
+                  CircularBuffer* scratch_buffer);
   void Shutdown();
 
+  // Called before a texture that may be referenced by draws not yet issued is
+  // reuploaded or deleted while looking textures up.
+  void set_texture_update_callback(std::function<void()> callback) {
+    texture_update_callback_ = std::move(callback);
+  }
+
   void Scavenge();
   void Clear();
+  // Ends a frame, evicting the least recently used textures not used in it
+  // while over --texture_cache_budget. The GPU must be done with them.
+  void EndFrame();
+
+  // Lookups that found a cached texture and ones that had to create one.
+  uint64_t hit_count() const { return hit_count_; }
+  uint64_t miss_count() const { return miss_count_; }
+  size_t texture_count() const { return texture_entries_.size(); }
+  uint64_t resident_bytes() const { return resident_bytes_; }
+  // Uploads in the last frame ended and textures evicted over the budget.
+  uint32_t frame_upload_count() const { return frame_upload_count_; }
+  uint64_t eviction_count() const { return eviction_count_; }
+
   void EvictAllTextures();
 
   TextureEntryView* Demand(const TextureInfo& texture_info,
@@ -95,20 +126,40 @@ class TextureCache {
   TextureEntry* LookupOrInsertTexture(const TextureInfo& texture_info,
                                       uint64_t opt_hash = 0);
   void EvictTexture(TextureEntry* entry);
-
-  bool UploadTexture2D(GLuint texture, const TextureInfo& texture_info);
+  // Adds the write watch evicting the texture when its guest data changes.
+  void WatchTexture(TextureEntry* entry);
+  // Brings an invalidated texture up to date in place by reuploading only the
+  // rows whose guest data changed. Returns false if it has to be evicted.
+  bool RefreshTexture(TextureEntry* entry);
+
+  // If row_count is non-zero only those rows of blocks are uploaded into the
+  // existing storage of the texture.
+  bool UploadTexture2D(GLuint texture, const TextureInfo& texture_info,
+                       uint32_t first_row = 0, uint32_t row_count = 0);
   bool UploadTextureCube(GLuint texture, const TextureInfo& texture_info);
 
   Memory* memory_;
+  DirtyPageTracker* dirty_page_tracker_;
   CircularBuffer* scratch_buffer_;
   std::unordered_map<uint64_t, SamplerEntry*> sampler_entries_;
   std::unordered_map<uint64_t, TextureEntry*> texture_entries_;
 
   std::vector<ReadBufferTexture*> read_buffer_textures_;
 
+  std::function<void()> texture_update_callback_;
+
   std::mutex invalidated_textures_mutex_;
   std::vector<TextureEntry*>* invalidated_textures_;
   std::vector<TextureEntry*> invalidated_textures_sets_[2];
+
+  uint64_t hit_count_ = 0;
+  uint64_t miss_count_ = 0;
+
+  uint64_t frame_number_ = 0;
+  uint64_t resident_bytes_ = 0;
+  uint32_t upload_count_ = 0;
+  uint32_t frame_upload_count_ = 0;
+  uint64_t eviction_count_ = 0;
 };
 
 }  // namespace gl4
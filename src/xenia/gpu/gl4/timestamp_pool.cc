@@ -0,0 +1,55 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2016 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#include "xenia/gpu/gl4/timestamp_pool.h"
+
+namespace xe {
+namespace gpu {
+namespace gl4 {
+
+TimestampPool::TimestampPool() = default;
+
+TimestampPool::~TimestampPool() { Shutdown(); }
+
+bool TimestampPool::Initialize() {
+  queries_.resize(kQueryCount);
+  glGenQueries(kQueryCount, queries_.data());
+  return true;
+}
+
+void TimestampPool::Shutdown() {
+  if (queries_.empty()) {
+    return;
+  }
+  glDeleteQueries(GLsizei(queries_.size()), queries_.data());
+  queries_.clear();
+}
+
+uint32_t TimestampPool::InsertTimestamp() {
+  uint32_t key = next_query_;
+  next_query_ = (next_query_ + 1) % kQueryCount;
+  glQueryCounter(queries_[key], GL_TIMESTAMP);
+  return key;
+}
+
+uint64_t TimestampPool::GetTimestamp(uint32_t key) {
+  // Not waited for, so looking timestamps up never stalls the frame.
+  GLint available = 0;
+  glGetQueryObjectiv(queries_[key], GL_QUERY_RESULT_AVAILABLE, &available);
+  if (available) {
+    GLuint64 timestamp = 0;
+    glGetQueryObjectui64v(queries_[key], GL_QUERY_RESULT, &timestamp);
+    last_timestamp_ = timestamp;
+  }
+  return last_timestamp_;
+}
+
+}  // namespace gl4
+}  // namespace gpu
+}  // namespace xe
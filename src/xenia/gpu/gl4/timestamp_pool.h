@@ -0,0 +1,51 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2016 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#ifndef XENIA_GPU_GL4_TIMESTAMP_POOL_H_
+#define XENIA_GPU_GL4_TIMESTAMP_POOL_H_
+
+#include <vector>
+
+#include "xenia/base/profiling.h"
+#include "xenia/ui/gl/gl.h"
+
+namespace xe {
+namespace gpu {
+namespace gl4 {
+
+// ARB_timer_query timestamps for GPU profiling scopes. Queries are reused in
+// a ring, which must be long enough for them to be looked up before that.
+class TimestampPool : public xe::GpuTimestampSource {
+ public:
+  TimestampPool();
+  ~TimestampPool() override;
+
+  bool Initialize();
+  void Shutdown();
+
+  uint32_t InsertTimestamp() override;
+  uint64_t GetTimestamp(uint32_t key) override;
+  // GL_TIMESTAMP is in nanoseconds.
+  uint64_t ticks_per_second() const override { return 1000000000ull; }
+
+ private:
+  static const uint32_t kQueryCount = 8 * 1024;
+
+  std::vector<GLuint> queries_;
+  uint32_t next_query_ = 0;
+  // Returned for timestamps that aren't available, as time mustn't go
+  // backwards for the profiler.
+  uint64_t last_timestamp_ = 0;
+};
+
+}  // namespace gl4
+}  // namespace gpu
+}  // namespace xe
+
+#endif  // XENIA_GPU_GL4_TIMESTAMP_POOL_H_
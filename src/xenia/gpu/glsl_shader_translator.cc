@@ -25,33 +25,11 @@ constexpr int kMaxTemporaryRegisters = 64;
   source_.Append(depth_prefix_); \
   source_.AppendFormat(__VA_ARGS__)
 
-const char* GetVertexFormatTypeName(VertexFormat format, bool is_signed) {
-  switch (format) {
-    case VertexFormat::k_32:
-    case VertexFormat::k_32_FLOAT:
-      return "float";
-    case VertexFormat::k_16_16:
-    case VertexFormat::k_32_32:
-    case VertexFormat::k_16_16_FLOAT:
-    case VertexFormat::k_32_32_FLOAT:
-      return "vec2";
-    case VertexFormat::k_10_11_11:
-      return is_signed ? "int" : "uint";
-    case VertexFormat::k_2_10_10_10:
-      return is_signed ? "int" : "uint";
-    case VertexFormat::k_11_11_10:
-    case VertexFormat::k_32_32_32_FLOAT:
-      return "vec3";
-    case VertexFormat::k_8_8_8_8:
-    case VertexFormat::k_16_16_16_16:
-    case VertexFormat::k_32_32_32_32:
-    case VertexFormat::k_16_16_16_16_FLOAT:
-    case VertexFormat::k_32_32_32_32_FLOAT:
-      return "vec4";
-    default:
-      assert_always();
-      return "vec4";
-  }
+// Vertex inputs are the raw guest words, which are swapped and decoded when
+// fetched.
+const char* GetVertexFormatWordTypeName(VertexFormat format) {
+  static const char* const type_names[] = {"uint", "uvec2", "uvec3", "uvec4"};
+  return type_names[GetVertexFormatSizeInWords(format) - 1];
 }
 
 GlslShaderTranslator::GlslShaderTranslator(Dialect dialect)
@@ -192,36 +170,32 @@ out gl_PerVertex {
 layout(location = 0) flat out uint draw_id;
 layout(location = 1) out VertexData vtx;
 
-vec3 get_10_11_11_u(const uint data_in) {
-  vec3 vec;
-  vec.x = bitfieldExtract(data_in, 22, 10);
-  vec.y = bitfieldExtract(data_in, 11, 11);
-  vec.z = bitfieldExtract(data_in,  0, 11);
-  return vec;
+// Vertex data is bound as it is in guest memory (Endian::k8in32).
+uint swap_8in32(uint v) {
+  return (v << 24) | ((v << 8) & 0xFF0000u) | ((v >> 8) & 0xFF00u) | (v >> 24);
 }
-vec3 get_10_11_11_s(const int data_in) {
-  vec3 vec;
-  vec.x = bitfieldExtract(data_in, 22, 10);
-  vec.y = bitfieldExtract(data_in, 11, 11);
-  vec.z = bitfieldExtract(data_in,  0, 11);
-  return vec;
+uvec2 swap_8in32(uvec2 v) {
+  return (v << 24) | ((v << 8) & 0xFF0000u) | ((v >> 8) & 0xFF00u) | (v >> 24);
 }
-
-vec4 get_2_10_10_10_u(const uint data_in) {
-  vec4 vec;
-  vec.x = bitfieldExtract(data_in, 20, 10);
-  vec.y = bitfieldExtract(data_in, 10, 10);
-  vec.z = bitfieldExtract(data_in,  0, 10);
-  vec.w = bitfieldExtract(data_in, 30,  2);
-  return vec;
+uvec3 swap_8in32(uvec3 v) {
+  return (v << 24) | ((v << 8) & 0xFF0000u) | ((v >> 8) & 0xFF00u) | (v >> 24);
 }
-vec4 get_2_10_10_10_s(const int data_in) {
-  vec4 vec;
-  vec.x = bitfieldExtract(data_in, 20, 10);
-  vec.y = bitfieldExtract(data_in, 10, 10);
-  vec.z = bitfieldExtract(data_in,  0, 10);
-  vec.w = bitfieldExtract(data_in, 30,  2);
-  return vec;
+uvec4 swap_8in32(uvec4 v) {
+  return (v << 24) | ((v << 8) & 0xFF0000u) | ((v >> 8) & 0xFF00u) | (v >> 24);
+}
+// Fixed point components are normalized unless fetched as integers.
+float get_fixed(uint data_in, int offset, int bits, bool is_signed,
+                bool is_normalized) {
+  float value = is_signed ? float(bitfieldExtract(int(data_in), offset, bits))
+                          : float(bitfieldExtract(data_in, offset, bits));
+  if (is_normalized) {
+    if (is_signed) {
+      value = max(value / float((1u << (bits - 1)) - 1u), -1.0);
+    } else {
+      value /= bits == 32 ? 4294967295.0 : float((1u << bits) - 1u);
+    }
+  }
+  return value;
 }
 
 vec4 applyTransform(const in StateData state, vec4 pos) {
@@ -300,9 +274,8 @@ void main() {
           continue;
         }
         defined_locations.insert(key);
-        const char* type_name =
-            GetVertexFormatTypeName(attrib.fetch_instr.attributes.data_format,
-                                    attrib.fetch_instr.attributes.is_signed);
+        const char* type_name = GetVertexFormatWordTypeName(
+            attrib.fetch_instr.attributes.data_format);
         EmitSource("layout(location = %d) in %s vf%u_%d;\n",
                    attrib.attrib_index, type_name, binding.fetch_constant,
                    attrib.fetch_instr.attributes.offset);
@@ -608,26 +581,41 @@ void GlslShaderTranslator::ProcessVertexFetchInstruction(
         EmitSourceDepth("if (src0.x == gl_VertexID) {\n");
         Indent();
 
+        auto format = instr.attributes.data_format;
+        int word_count = GetVertexFormatSizeInWords(format);
+        int component_count = GetVertexFormatComponentCount(format);
+        EmitSourceDepth("%s words = swap_8in32(vf%u_%d);\n",
+                        GetVertexFormatWordTypeName(format),
+                        instr.operands[1].storage_index,
+                        instr.attributes.offset);
         EmitSourceDepth("pv.");
-        for (int i = 0;
-             i < GetVertexFormatComponentCount(instr.attributes.data_format);
-             ++i) {
+        for (int i = 0; i < component_count; ++i) {
           EmitSource("%c", GetCharForComponentIndex(i));
         }
 
-        auto format = instr.attributes.data_format;
-        if (format == VertexFormat::k_10_11_11) {
-          // GL doesn't support this format as a fetch type, so convert it.
-          EmitSource(" = get_10_11_11_%c(vf%u_%d);\n",
-                     instr.attributes.is_signed ? 's' : 'u',
-                     instr.operands[1].storage_index, instr.attributes.offset);
-        } else if (format == VertexFormat::k_2_10_10_10) {
-          EmitSource(" = get_2_10_10_10_%c(vf%u_%d);\n",
-                     instr.attributes.is_signed ? 's' : 'u',
-                     instr.operands[1].storage_index, instr.attributes.offset);
+        VertexFormatComponent components[4];
+        if (GetVertexFormatFixedComponents(format, components)) {
+          EmitSource(" = vec%d(", component_count);
+          for (int i = 0; i < component_count; ++i) {
+            char word[] = "words.x";
+            if (word_count > 1) {
+              word[6] = GetCharForComponentIndex(components[i].word);
+            } else {
+              word[5] = 0;
+            }
+            EmitSource("%sget_fixed(%s, %d, %d, %s, %s)", i ? ", " : "", word,
+                       components[i].offset, components[i].bits,
+                       instr.attributes.is_signed ? "true" : "false",
+                       instr.attributes.is_integer ? "false" : "true");
+          }
+          EmitSource(");\n");
+        } else if (format == VertexFormat::k_16_16_FLOAT) {
+          EmitSource(" = unpackHalf2x16(words);\n");
+        } else if (format == VertexFormat::k_16_16_16_16_FLOAT) {
+          EmitSource(
+              " = vec4(unpackHalf2x16(words.x), unpackHalf2x16(words.y));\n");
         } else {
-          EmitSource(" = vf%u_%d;\n", instr.operands[1].storage_index,
-                     instr.attributes.offset);
+          EmitSource(" = uintBitsToFloat(words);\n");
         }
 
         Unindent();
@@ -959,6 +947,9 @@ void GlslShaderTranslator::EmitStoreResult(const InstructionResult& result,
     case InstructionStorageTarget::kDepth:
       EmitSourceDepth("gl_FragDepth");
       break;
+    case InstructionStorageTarget::kExportAddress:
+    case InstructionStorageTarget::kExportData:
+      // Memexport isn't supported by GLSL shaders.
     case InstructionStorageTarget::kNone:
       return;
   }
@@ -12,8 +12,43 @@
 DEFINE_string(trace_gpu_prefix, "scratch/gpu/",
               "Prefix path for GPU trace files.");
 DEFINE_bool(trace_gpu_stream, false, "Trace all GPU packets.");
+DEFINE_int32(trace_gpu_buffer_size, 64,
+             "Megabytes of GPU trace data that may wait to be written before "
+             "the GPU blocks on the trace writer.");
+DEFINE_int32(trace_checkpoint_interval, 512,
+             "Packets between the checkpoints trace playback records to seek "
+             "backwards within a frame. 0 replays from the frame start.");
 
 DEFINE_string(dump_shaders, "",
               "Path to write GPU shaders to as they are compiled.");
+DEFINE_string(shader_cache_dir, "",
+              "Shader cache directory (relative to Xenia). Specify an empty "
+              "string to disable the cache.");
 
 DEFINE_bool(vsync, true, "Enable VSYNC.");
+DEFINE_bool(present_pacing, false,
+            "Hold guest frames until the guest vblank after their swap "
+            "before presenting them, evening out frame times at the cost of "
+            "up to a vblank of latency.");
+DEFINE_int32(headless_readback_interval, 0,
+             "Without a window, read the presented frame back every this "
+             "many frames and log its hash. 0 to never read frames back.");
+DEFINE_bool(headless_vsync, false,
+            "Without a window, pace vblanks at 60hz rather than every "
+            "millisecond, for titles that only need to run in real time.");
+
+DEFINE_int32(texture_cache_budget, 0,
+             "Megabytes of host memory cached textures may use before the "
+             "least recently used ones are evicted. 0 for no limit.");
+
+DEFINE_bool(gpu_read_ahead, true,
+            "Copy commands out of the ring buffer as soon as the guest "
+            "submits them, letting it reuse the space while earlier commands "
+            "are still executing.");
+
+DEFINE_string(command_processor_cpus, "",
+              "Host logical processors the command processor thread is "
+              "pinned to, e.g. \"6-7\". Empty to not pin it.");
+DEFINE_int32(command_processor_idle_spin_us, -1,
+             "Microseconds the command processor spins waiting for commands "
+             "before it sleeps until they arrive. -1 to always spin.");
@@ -14,9 +14,22 @@
 
 DECLARE_string(trace_gpu_prefix);
 DECLARE_bool(trace_gpu_stream);
+DECLARE_int32(trace_gpu_buffer_size);
+DECLARE_int32(trace_checkpoint_interval);
 
 DECLARE_string(dump_shaders);
+DECLARE_string(shader_cache_dir);
 
 DECLARE_bool(vsync);
+DECLARE_bool(present_pacing);
+DECLARE_int32(headless_readback_interval);
+DECLARE_bool(headless_vsync);
+
+DECLARE_int32(texture_cache_budget);
+
+DECLARE_bool(gpu_read_ahead);
+
+DECLARE_string(command_processor_cpus);
+DECLARE_int32(command_processor_idle_spin_us);
 
 #endif  // XENIA_GPU_GPU_FLAGS_H_
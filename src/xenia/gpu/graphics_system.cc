@@ -9,6 +9,9 @@
 
 #include "xenia/gpu/graphics_system.h"
 
+#include <algorithm>
+#include <cinttypes>
+
 #include "xenia/base/byte_stream.h"
 #include "xenia/base/clock.h"
 #include "xenia/base/logging.h"
@@ -20,6 +23,8 @@
 #include "xenia/ui/graphics_provider.h"
 #include "xenia/ui/loop.h"
 
+#include "third_party/xxhash/xxhash.h"
+
 namespace xe {
 namespace gpu {
 
@@ -50,16 +55,21 @@ X_STATUS GraphicsSystem::Setup(cpu::Processor* processor,
   // Initialize display and rendering context.
   // This must happen on the UI thread.
   std::unique_ptr<xe::ui::GraphicsContext> processor_context;
-  target_window_->loop()->PostSynchronous([&]() {
-    // Create the context used for presentation.
-    assert_null(target_window->context());
-    target_window_->set_context(provider_->CreateContext(target_window_));
-
-    // Setup the GL context the command processor will do all its drawing in.
-    // It's shared with the display context so that we can resolve framebuffers
-    // from it.
+  if (target_window_) {
+    target_window_->loop()->PostSynchronous([&]() {
+      // Create the context used for presentation.
+      assert_null(target_window->context());
+      target_window_->set_context(provider_->CreateContext(target_window_));
+
+      // Setup the GL context the command processor will do all its drawing
+      // in. It's shared with the display context so that we can resolve
+      // framebuffers from it.
+      processor_context = provider()->CreateOffscreenContext();
+    });
+  } else {
+    // Headless, so only the command processor has a context.
     processor_context = provider()->CreateOffscreenContext();
-  });
+  }
   if (!processor_context) {
     xe::FatalError(
         "Unable to initialize GL context. Xenia requires OpenGL 4.5. Ensure "
@@ -75,12 +85,16 @@ X_STATUS GraphicsSystem::Setup(cpu::Processor* processor,
     XELOGE("Unable to initialize command processor");
     return X_STATUS_UNSUCCESSFUL;
   }
-  command_processor_->set_swap_request_handler(
-      [this]() { target_window_->Invalidate(); });
-
-  // Watch for paint requests to do our swap.
-  target_window->on_painting.AddListener(
-      [this](xe::ui::UIEvent* e) { Swap(e); });
+  if (target_window_) {
+    command_processor_->set_swap_request_handler(
+        [this]() { target_window_->Invalidate(); });
+
+    // Watch for paint requests to do our swap.
+    target_window->on_painting.AddListener(
+        [this](xe::ui::UIEvent* e) { Swap(e); });
+  } else {
+    command_processor_->set_swap_request_handler([this]() { HeadlessSwap(); });
+  }
 
   // Let the processor know we want register access callbacks.
   memory_->AddVirtualMappedRange(
@@ -88,21 +102,35 @@ X_STATUS GraphicsSystem::Setup(cpu::Processor* processor,
       reinterpret_cast<cpu::MMIOReadCallback>(ReadRegisterThunk),
       reinterpret_cast<cpu::MMIOWriteCallback>(WriteRegisterThunk));
 
-  // 60hz vsync timer.
+  // 60hz vsync timer. The shared timer thread wakes the worker for each
+  // vblank, sharing its wakeups with the other timers where it can.
   vsync_worker_running_ = true;
+  vsync_event_ = xe::threading::Event::CreateAutoResetEvent(false);
   vsync_worker_thread_ = kernel::object_ref<kernel::XHostThread>(
       new kernel::XHostThread(kernel_state_, 128 * 1024, 0, [this]() {
-        uint64_t vsync_duration = FLAGS_vsync ? 16 : 1;
-        uint64_t last_frame_time = Clock::QueryGuestTickCount();
+        // Vblanks aren't paced to a display when headless.
+        uint64_t vsync_duration =
+            FLAGS_vsync && (target_window_ || FLAGS_headless_vsync) ? 16 : 1;
+        std::unique_ptr<xe::threading::HighResolutionTimer> vsync_timer;
+        double timer_scalar = 0.0;
         while (vsync_worker_running_) {
-          uint64_t current_time = Clock::QueryGuestTickCount();
-          uint64_t elapsed = (current_time - last_frame_time) /
-                             (Clock::guest_tick_frequency() / 1000);
-          if (elapsed >= vsync_duration) {
+          // Vblanks are paced in guest time.
+          double scalar = Clock::guest_time_scalar();
+          if (scalar != timer_scalar) {
+            vsync_timer.reset();
+            vsync_timer = xe::threading::HighResolutionTimer::CreateRepeating(
+                std::chrono::milliseconds(
+                    std::max(uint64_t(vsync_duration / scalar), uint64_t(1))),
+                [this]() { vsync_event_->Set(); },
+                std::chrono::milliseconds(1));
+            timer_scalar = scalar;
+          }
+          if (xe::threading::Wait(vsync_event_.get(), false,
+                                  std::chrono::milliseconds(100)) ==
+                  xe::threading::WaitResult::kSuccess &&
+              vsync_worker_running_) {
             MarkVblank();
-            last_frame_time = current_time;
           }
-          xe::threading::Sleep(std::chrono::milliseconds(1));
         }
         return 0;
       }));
@@ -122,8 +150,28 @@ void GraphicsSystem::Shutdown() {
   EndTracing();
 
   vsync_worker_running_ = false;
+  vsync_event_->Set();
   vsync_worker_thread_->Wait(0, 0, 0, nullptr);
   vsync_worker_thread_.reset();
+  vsync_event_.reset();
+
+  double ticks_to_us = 1000000.0 / Clock::host_tick_frequency();
+  const char* source_names[] = {"vblank", "command processor"};
+  for (uint32_t source = 0; source < kInterruptSourceCount; ++source) {
+    auto& stats = interrupt_stats_[source];
+    uint64_t count = stats.count.load(std::memory_order_relaxed);
+    if (!count) {
+      continue;
+    }
+    XELOGI(
+        "GPU %s interrupts: %" PRIu64 ", lock wait %.1fus avg %.1fus max, callback "
+        "%.1fus avg",
+        source_names[source], count,
+        stats.wait_ticks.load(std::memory_order_relaxed) * ticks_to_us / count,
+        stats.max_wait_ticks.load(std::memory_order_relaxed) * ticks_to_us,
+        stats.callback_ticks.load(std::memory_order_relaxed) * ticks_to_us /
+            count);
+  }
 
   command_processor_->Shutdown();
 
@@ -179,6 +227,7 @@ void GraphicsSystem::WriteRegister(uint32_t addr, uint32_t value) {
 
   assert_true(r < RegisterFile::kRegisterCount);
   register_file_.values[r].u32 = value;
+  register_file_.MarkDirty(r);
 }
 
 void GraphicsSystem::InitializeRingBuffer(uint32_t ptr, uint32_t log2_size) {
@@ -198,25 +247,58 @@ void GraphicsSystem::SetInterruptCallback(uint32_t callback,
 }
 
 void GraphicsSystem::DispatchInterruptCallback(uint32_t source, uint32_t cpu) {
-  if (!interrupt_callback_) {
+  // Pick a CPU, if needed. We're going to guess 2. Because.
+  if (cpu == 0xFFFFFFFF) {
+    cpu = 2;
+  }
+  DispatchInterruptCallbacks(source, 1u << cpu);
+}
+
+void GraphicsSystem::DispatchInterruptCallbacks(uint32_t source,
+                                                uint32_t cpu_mask) {
+  if (!interrupt_callback_ || !cpu_mask) {
     return;
   }
 
   auto thread = kernel::XThread::GetCurrentThread();
   assert_not_null(thread);
 
-  // Pick a CPU, if needed. We're going to guess 2. Because.
-  if (cpu == 0xFFFFFFFF) {
-    cpu = 2;
+  // ExecuteInterrupt takes the lock again for each callback, which is then
+  // uncontended.
+  uint64_t request_ticks = Clock::QueryHostTickCount();
+  auto global_lock = xe::global_critical_region::AcquireDirect();
+  uint64_t start_ticks = Clock::QueryHostTickCount();
+  uint64_t wait_ticks = start_ticks - request_ticks;
+
+  uint32_t count = 0;
+  uint32_t cpu;
+  while (xe::bit_scan_forward(cpu_mask, &cpu)) {
+    cpu_mask &= ~(1u << cpu);
+    thread->SetActiveCpu(cpu);
+
+    // XELOGGPU("Dispatching GPU interrupt at %.8X w/ mode %d on cpu %d",
+    //          interrupt_callback_, source, cpu);
+
+    uint64_t args[] = {source, interrupt_callback_data_};
+    processor_->ExecuteInterrupt(thread->thread_state(), interrupt_callback_,
+                                 args, xe::countof(args));
+    ++count;
   }
-  thread->SetActiveCpu(cpu);
-
-  // XELOGGPU("Dispatching GPU interrupt at %.8X w/ mode %d on cpu %d",
-  //          interrupt_callback_, source, cpu);
 
-  uint64_t args[] = {source, interrupt_callback_data_};
-  processor_->ExecuteInterrupt(thread->thread_state(), interrupt_callback_,
-                               args, xe::countof(args));
+  if (source < kInterruptSourceCount) {
+    auto& stats = interrupt_stats_[source];
+    // Relaxed, as the stats are only read for dumps.
+    stats.count.fetch_add(count, std::memory_order_relaxed);
+    stats.wait_ticks.fetch_add(wait_ticks, std::memory_order_relaxed);
+    stats.callback_ticks.fetch_add(Clock::QueryHostTickCount() - start_ticks,
+                                   std::memory_order_relaxed);
+    uint64_t max_wait_ticks =
+        stats.max_wait_ticks.load(std::memory_order_relaxed);
+    while (wait_ticks > max_wait_ticks &&
+           !stats.max_wait_ticks.compare_exchange_weak(
+               max_wait_ticks, wait_ticks, std::memory_order_relaxed)) {
+    }
+  }
 }
 
 void GraphicsSystem::MarkVblank() {
@@ -229,6 +311,49 @@ void GraphicsSystem::MarkVblank() {
   //     something wrong and the CP will block waiting for code that
   //     needs to be run in the interrupt.
   DispatchInterruptCallback(0, 2);
+
+  if (FLAGS_present_pacing && target_window_) {
+    // Paced swaps are presented by the first paint after a vblank.
+    auto& swap_state = command_processor_->swap_state();
+    std::lock_guard<std::mutex> lock(swap_state.mutex);
+    if (swap_state.pending) {
+      target_window_->Invalidate();
+    }
+  }
+}
+
+void GraphicsSystem::HeadlessSwap() {
+  auto& swap_state = command_processor_->swap_state();
+  {
+    std::lock_guard<std::mutex> lock(swap_state.mutex);
+    swap_state.pending = false;
+    std::swap(swap_state.front_buffer_texture, swap_state.back_buffer_texture);
+    swap_state.last_latency_ticks =
+        Clock::QueryHostTickCount() - swap_state.pending_host_ticks;
+  }
+  ++headless_frame_count_;
+  if (FLAGS_headless_readback_interval <= 0 ||
+      headless_frame_count_ % FLAGS_headless_readback_interval) {
+    return;
+  }
+  auto image = command_processor_->ReadBackFrontBuffer();
+  if (!image) {
+    XELOGW("Headless frame %" PRIu64 " could not be read back",
+           headless_frame_count_);
+    return;
+  }
+  XELOGI("Headless frame %" PRIu64 ": %zux%zu, hash %.16" PRIX64,
+         headless_frame_count_, image->width, image->height,
+         XXH64(image->data.data(), image->data.size(), 0));
+}
+
+bool GraphicsSystem::is_swap_ready() const {
+  auto& swap_state = command_processor_->swap_state();
+  if (!swap_state.pending) {
+    return false;
+  }
+  return !FLAGS_present_pacing ||
+         command_processor_->counter() != swap_state.pending_vblank;
 }
 
 void GraphicsSystem::ClearCaches() {
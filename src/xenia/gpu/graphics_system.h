@@ -14,6 +14,7 @@
 #include <memory>
 #include <thread>
 
+#include "xenia/base/threading.h"
 #include "xenia/cpu/processor.h"
 #include "xenia/gpu/register_file.h"
 #include "xenia/kernel/xthread.h"
@@ -39,6 +40,9 @@ class GraphicsSystem {
   kernel::KernelState* kernel_state() const { return kernel_state_; }
   ui::GraphicsProvider* provider() const { return provider_.get(); }
 
+  // Without a target window nothing is presented: frames are rendered and
+  // dropped, or read back every --headless_readback_interval frames, and
+  // vblanks aren't paced.
   virtual X_STATUS Setup(cpu::Processor* processor,
                          kernel::KernelState* kernel_state,
                          ui::Window* target_window);
@@ -52,8 +56,26 @@ class GraphicsSystem {
   void InitializeRingBuffer(uint32_t ptr, uint32_t log2_size);
   void EnableReadPointerWriteBack(uint32_t ptr, uint32_t block_size);
 
+  // The delivery of guest interrupts from one source, 0 for vblanks and 1
+  // for the command processor, in host ticks.
+  struct InterruptStats {
+    std::atomic<uint64_t> count = {0};
+    // Spent waiting for the global lock to deliver, held by guest code with
+    // interrupts disabled and by other interrupts.
+    std::atomic<uint64_t> wait_ticks = {0};
+    std::atomic<uint64_t> max_wait_ticks = {0};
+    std::atomic<uint64_t> callback_ticks = {0};
+  };
+  static const uint32_t kInterruptSourceCount = 2;
+
   void SetInterruptCallback(uint32_t callback, uint32_t user_data);
   void DispatchInterruptCallback(uint32_t source, uint32_t cpu);
+  // Calls the interrupt callback once for each CPU in the mask, taking the
+  // global lock once for all of them.
+  void DispatchInterruptCallbacks(uint32_t source, uint32_t cpu_mask);
+  const InterruptStats& interrupt_stats(uint32_t source) const {
+    return interrupt_stats_[source];
+  }
 
   virtual void ClearCaches();
 
@@ -81,7 +103,13 @@ class GraphicsSystem {
   void WriteRegister(uint32_t addr, uint32_t value);
 
   void MarkVblank();
+  // Whether the display may pick up the pending swap, if there is one. Must
+  // be called with the swap state lock held.
+  bool is_swap_ready() const;
   virtual void Swap(xe::ui::UIEvent* e) = 0;
+  // Takes the pending swap on the command processor thread in place of the
+  // display when headless.
+  void HeadlessSwap();
 
   Memory* memory_ = nullptr;
   cpu::Processor* processor_ = nullptr;
@@ -91,14 +119,20 @@ class GraphicsSystem {
 
   uint32_t interrupt_callback_ = 0;
   uint32_t interrupt_callback_data_ = 0;
+  InterruptStats interrupt_stats_[kInterruptSourceCount];
 
   std::atomic<bool> vsync_worker_running_;
+  std::unique_ptr<xe::threading::Event> vsync_event_;
   kernel::object_ref<kernel::XHostThread> vsync_worker_thread_;
 
   RegisterFile register_file_;
   std::unique_ptr<CommandProcessor> command_processor_;
 
   bool paused_ = false;
+
+  // Frames swapped without a window, only used on the command processor
+  // thread.
+  uint64_t headless_frame_count_ = 0;
 };
 
 }  // namespace gpu
@@ -59,3 +59,24 @@ project("xenia-gpu-shader-compiler")
         "1>scratch/stdout-shader-compiler.txt",
       })
     end
+
+group("src")
+project("xenia-gpu-texture-untile-benchmark")
+  uuid("3f5d9c42-7a1e-4b8d-9c06-2e4b7f1a8d53")
+  kind("ConsoleApp")
+  language("C++")
+  links({
+    "gflags",
+    "xenia-base",
+    "xenia-gpu",
+    "xxhash",
+  })
+  defines({
+  })
+  includedirs({
+    project_root.."/third_party/gflags/src",
+  })
+  files({
+    "texture_untile_benchmark_main.cc",
+    "../base/main_"..platform_suffix..".cc",
+  })
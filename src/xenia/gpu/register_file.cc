@@ -16,7 +16,10 @@
 namespace xe {
 namespace gpu {
 
-RegisterFile::RegisterFile() { std::memset(values, 0, sizeof(values)); }
+RegisterFile::RegisterFile() {
+  std::memset(values, 0, sizeof(values));
+  std::memset(register_dirty_groups_, 0, sizeof(register_dirty_groups_));
+}
 
 const RegisterInfo* RegisterFile::GetRegisterInfo(uint32_t index) {
   switch (index) {
@@ -34,5 +37,29 @@ const RegisterInfo* RegisterFile::GetRegisterInfo(uint32_t index) {
   }
 }
 
+uint64_t RegisterFile::AddDirtyGroup(const uint32_t* registers, size_t count) {
+  uint32_t index;
+  if (!xe::bit_scan_forward(~used_dirty_groups_, &index)) {
+    return kAlwaysDirtyGroup;
+  }
+  uint64_t group = uint64_t(1) << index;
+  used_dirty_groups_ |= group;
+  for (size_t i = 0; i < count; ++i) {
+    register_dirty_groups_[registers[i]] |= group;
+  }
+  dirty_groups_ |= group;
+  return group;
+}
+
+void RegisterFile::RemoveDirtyGroup(uint64_t group) {
+  if (group == kAlwaysDirtyGroup) {
+    return;
+  }
+  used_dirty_groups_ &= ~group;
+  for (size_t i = 0; i < kRegisterCount; ++i) {
+    register_dirty_groups_[i] &= ~group;
+  }
+}
+
 }  //  namespace gpu
 }  //  namespace xe
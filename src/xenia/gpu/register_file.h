@@ -46,6 +46,39 @@ class RegisterFile {
 
   RegisterValue& operator[](int reg) { return values[reg]; }
   RegisterValue& operator[](Register reg) { return values[reg]; }
+
+  // Registers can be put into up to 63 dirty groups, each a single bit, and
+  // writing a register marks every group it's in as dirty. State caches test
+  // their group with one AND to skip comparing each register against their
+  // shadow copy. Groups start out dirty and are cleared by the command
+  // processor once a draw has consumed all state.
+  // If no bits are left the group returned is always dirty.
+  uint64_t AddDirtyGroup(const uint32_t* registers, size_t count);
+  void RemoveDirtyGroup(uint64_t group);
+  // Must be called on every register write.
+  void MarkDirty(uint32_t index) {
+    dirty_groups_ |= register_dirty_groups_[index];
+  }
+  void MarkDirtyRange(uint32_t first_index, uint32_t count) {
+    uint64_t groups = 0;
+    for (uint32_t i = 0; i < count; ++i) {
+      groups |= register_dirty_groups_[first_index + i];
+    }
+    dirty_groups_ |= groups;
+  }
+  uint64_t dirty_groups() const { return dirty_groups_; }
+  void ClearDirtyGroups() { dirty_groups_ = kAlwaysDirtyGroup; }
+  // Clears only the given groups, for state that hasn't all been consumed.
+  void ClearDirtyGroups(uint64_t groups) {
+    dirty_groups_ = (dirty_groups_ & ~groups) | kAlwaysDirtyGroup;
+  }
+
+ private:
+  static const uint64_t kAlwaysDirtyGroup = uint64_t(1) << 63;
+
+  uint64_t dirty_groups_ = kAlwaysDirtyGroup;
+  uint64_t used_dirty_groups_ = kAlwaysDirtyGroup;
+  uint64_t register_dirty_groups_[kRegisterCount];
 };
 
 }  // namespace gpu
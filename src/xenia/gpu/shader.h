@@ -10,6 +10,7 @@
 #ifndef XENIA_GPU_SHADER_H_
 #define XENIA_GPU_SHADER_H_
 
+#include <set>
 #include <string>
 #include <vector>
 
@@ -35,6 +36,12 @@ enum class InstructionStorageTarget {
   kColorTarget,
   // Result is stored to the depth export (gl_FragDepth).
   kDepth,
+  // Result is stored to the memexport address (eA), made of the stream
+  // constant and the index of the element.
+  kExportAddress,
+  // Result is stored to the memexport data (eM) of the element storage_index
+  // [0-4] after the one addressed by eA.
+  kExportData,
 };
 
 enum class InstructionStorageAddressingMode {
@@ -555,6 +562,12 @@ class Shader {
   // Returns true if the given color target index [0-3].
   bool writes_color_target(int i) const { return writes_color_targets_[i]; }
 
+  // Float constants holding the stream constants memexport addresses are
+  // made from, in the order they're first used. Valid for vertex shaders only.
+  const std::vector<uint32_t>& memexport_stream_constants() const {
+    return memexport_stream_constants_;
+  }
+
   // True if the shader was translated and prepared without error.
   bool is_valid() const { return is_valid_; }
 
@@ -603,11 +616,21 @@ class Shader {
   std::vector<TextureBinding> texture_bindings_;
   ConstantRegisterMap constant_register_map_ = {0};
   bool writes_color_targets_[4] = {false, false, false, false};
+  std::vector<uint32_t> memexport_stream_constants_;
 
   bool is_valid_ = false;
   bool is_translated_ = false;
   std::vector<Error> errors_;
 
+  // Set once the ucode has been scanned for the state above and below, which
+  // doesn't depend on the backend or on the program_cntl translated with, so
+  // that retranslations only redo the code emission.
+  bool is_ucode_analyzed_ = false;
+  // Number of ucode dwords holding control flow instructions.
+  uint32_t cf_dword_count_ = 0;
+  // Control flow instruction indices targeted by loops, calls and jumps.
+  std::set<uint32_t> cf_label_addresses_;
+
   std::string ucode_disassembly_;
   std::vector<uint8_t> translated_binary_;
   std::string host_disassembly_;
@@ -10,6 +10,7 @@
 
 #include "xenia/gpu/shader_translator.h"
 
+#include <algorithm>
 #include <cstdarg>
 #include <set>
 #include <string>
@@ -59,6 +60,7 @@ void ShaderTranslator::Reset() {
   for (size_t i = 0; i < xe::countof(writes_color_targets_); ++i) {
     writes_color_targets_[i] = false;
   }
+  memexport_stream_constants_.clear();
 }
 
 bool ShaderTranslator::GatherAllBindingInformation(Shader* shader) {
@@ -68,31 +70,7 @@ bool ShaderTranslator::GatherAllBindingInformation(Shader* shader) {
   shader_type_ = shader->type();
   ucode_dwords_ = shader->ucode_dwords();
   ucode_dword_count_ = shader->ucode_dword_count();
-
-  uint32_t max_cf_dword_index = static_cast<uint32_t>(ucode_dword_count_);
-  for (uint32_t i = 0; i < max_cf_dword_index; i += 3) {
-    ControlFlowInstruction cf_a;
-    ControlFlowInstruction cf_b;
-    UnpackControlFlowInstructions(ucode_dwords_ + i, &cf_a, &cf_b);
-    if (IsControlFlowOpcodeExec(cf_a.opcode())) {
-      max_cf_dword_index =
-          std::min(max_cf_dword_index, cf_a.exec.address() * 3);
-    }
-    if (IsControlFlowOpcodeExec(cf_b.opcode())) {
-      max_cf_dword_index =
-          std::min(max_cf_dword_index, cf_b.exec.address() * 3);
-    }
-
-    GatherBindingInformation(cf_a);
-    GatherBindingInformation(cf_b);
-  }
-
-  shader->vertex_bindings_ = std::move(vertex_bindings_);
-  shader->texture_bindings_ = std::move(texture_bindings_);
-  for (size_t i = 0; i < xe::countof(writes_color_targets_); ++i) {
-    shader->writes_color_targets_[i] = writes_color_targets_[i];
-  }
-
+  AnalyzeUcode(shader);
   return true;
 }
 
@@ -115,25 +93,16 @@ bool ShaderTranslator::TranslateInternal(Shader* shader) {
   ucode_dwords_ = shader->ucode_dwords();
   ucode_dword_count_ = shader->ucode_dword_count();
 
-  // Run through and gather all binding information.
-  // Translators may need this before they start codegen.
-  uint32_t max_cf_dword_index = static_cast<uint32_t>(ucode_dword_count_);
-  for (uint32_t i = 0; i < max_cf_dword_index; i += 3) {
-    ControlFlowInstruction cf_a;
-    ControlFlowInstruction cf_b;
-    UnpackControlFlowInstructions(ucode_dwords_ + i, &cf_a, &cf_b);
-    if (IsControlFlowOpcodeExec(cf_a.opcode())) {
-      max_cf_dword_index =
-          std::min(max_cf_dword_index, cf_a.exec.address() * 3);
-    }
-    if (IsControlFlowOpcodeExec(cf_b.opcode())) {
-      max_cf_dword_index =
-          std::min(max_cf_dword_index, cf_b.exec.address() * 3);
-    }
-
-    GatherBindingInformation(cf_a);
-    GatherBindingInformation(cf_b);
+  // Gather all binding information, or reuse what an earlier translation of
+  // the shader gathered. Translators may need this before they start codegen.
+  AnalyzeUcode(shader);
+  vertex_bindings_ = shader->vertex_bindings_;
+  texture_bindings_ = shader->texture_bindings_;
+  for (size_t i = 0; i < xe::countof(writes_color_targets_); ++i) {
+    writes_color_targets_[i] = shader->writes_color_targets_[i];
   }
+  cf_dword_count_ = shader->cf_dword_count_;
+  cf_label_addresses_ = shader->cf_label_addresses_;
 
   StartTranslation();
 
@@ -166,6 +135,7 @@ bool ShaderTranslator::TranslateInternal(Shader* shader) {
   for (size_t i = 0; i < xe::countof(writes_color_targets_); ++i) {
     shader->writes_color_targets_[i] = writes_color_targets_[i];
   }
+  shader->memexport_stream_constants_ = std::move(memexport_stream_constants_);
 
   shader->is_valid_ = true;
   shader->is_translated_ = true;
@@ -357,18 +327,19 @@ void AddControlFlowTargetLabel(const ControlFlowInstruction& cf,
   }
 }
 
-bool ShaderTranslator::TranslateBlocks() {
+void ShaderTranslator::AnalyzeUcode(Shader* shader) {
+  if (shader->is_ucode_analyzed_) {
+    return;
+  }
+
   // Control flow instructions come paired in blocks of 3 dwords and all are
   // listed at the top of the ucode.
-  // Each control flow instruction is executed sequentially until the final
-  // ending instruction.
-
   // Guess how long the control flow program is by scanning for the first
   // kExec-ish and instruction and using its address as the upper bound.
   // This is what freedreno does.
   uint32_t max_cf_dword_index = static_cast<uint32_t>(ucode_dword_count_);
   std::set<uint32_t> label_addresses;
-  for (uint32_t i = 0, cf_index = 0; i < max_cf_dword_index; i += 3) {
+  for (uint32_t i = 0; i < max_cf_dword_index; i += 3) {
     ControlFlowInstruction cf_a;
     ControlFlowInstruction cf_b;
     UnpackControlFlowInstructions(ucode_dwords_ + i, &cf_a, &cf_b);
@@ -383,6 +354,30 @@ bool ShaderTranslator::TranslateBlocks() {
     AddControlFlowTargetLabel(cf_a, &label_addresses);
     AddControlFlowTargetLabel(cf_b, &label_addresses);
 
+    GatherBindingInformation(cf_a);
+    GatherBindingInformation(cf_b);
+  }
+
+  shader->vertex_bindings_ = std::move(vertex_bindings_);
+  shader->texture_bindings_ = std::move(texture_bindings_);
+  for (size_t i = 0; i < xe::countof(writes_color_targets_); ++i) {
+    shader->writes_color_targets_[i] = writes_color_targets_[i];
+  }
+  shader->cf_dword_count_ = max_cf_dword_index;
+  shader->cf_label_addresses_ = std::move(label_addresses);
+  shader->is_ucode_analyzed_ = true;
+}
+
+bool ShaderTranslator::TranslateBlocks() {
+  // Each control flow instruction is executed sequentially until the final
+  // ending instruction.
+  uint32_t max_cf_dword_index = cf_dword_count_;
+  const auto& label_addresses = cf_label_addresses_;
+  for (uint32_t i = 0, cf_index = 0; i < max_cf_dword_index; i += 3) {
+    ControlFlowInstruction cf_a;
+    ControlFlowInstruction cf_b;
+    UnpackControlFlowInstructions(ucode_dwords_ + i, &cf_a, &cf_b);
+
     PreProcessControlFlowInstruction(cf_index, cf_a);
     ++cf_index;
     PreProcessControlFlowInstruction(cf_index, cf_b);
@@ -1135,6 +1130,17 @@ void ShaderTranslator::ParseAluVectorInstruction(
       case 63:
         i.result.storage_target = InstructionStorageTarget::kPointSize;
         break;
+      case 32:
+        i.result.storage_target = InstructionStorageTarget::kExportAddress;
+        break;
+      case 33:
+      case 34:
+      case 35:
+      case 36:
+      case 37:
+        i.result.storage_target = InstructionStorageTarget::kExportData;
+        i.result.storage_index = dest_num - 33;
+        break;
       default:
         if (dest_num < 16) {
           i.result.storage_target = InstructionStorageTarget::kInterpolant;
@@ -1221,10 +1227,33 @@ void ShaderTranslator::ParseAluVectorInstruction(
           1ull << (register_index % 64);
     }
   }
+  if (i.result.storage_target == InstructionStorageTarget::kExportAddress) {
+    GatherMemExportStreamConstant(i);
+  }
 
   i.Disassemble(&ucode_disasm_buffer_);
 }
 
+void ShaderTranslator::GatherMemExportStreamConstant(
+    const ParsedAluInstruction& instr) {
+  // eA is usually written as mad eA, rN.x, c.0100, cS, with the stream
+  // constant cS added to the index.
+  for (int i = instr.operand_count - 1; i >= 0; --i) {
+    const auto& operand = instr.operands[i];
+    if (operand.storage_source == InstructionStorageSource::kConstantFloat &&
+        operand.storage_addressing_mode ==
+            InstructionStorageAddressingMode::kStatic) {
+      uint32_t index = uint32_t(operand.storage_index);
+      if (std::find(memexport_stream_constants_.begin(),
+                    memexport_stream_constants_.end(),
+                    index) == memexport_stream_constants_.end()) {
+        memexport_stream_constants_.push_back(index);
+      }
+      return;
+    }
+  }
+}
+
 void ShaderTranslator::ParseAluScalarInstruction(
     const AluInstruction& op, const AluOpcodeInfo& opcode_info,
     ParsedAluInstruction& i) {
@@ -1265,6 +1294,17 @@ void ShaderTranslator::ParseAluScalarInstruction(
       case 63:
         i.result.storage_target = InstructionStorageTarget::kPointSize;
         break;
+      case 32:
+        i.result.storage_target = InstructionStorageTarget::kExportAddress;
+        break;
+      case 33:
+      case 34:
+      case 35:
+      case 36:
+      case 37:
+        i.result.storage_target = InstructionStorageTarget::kExportData;
+        i.result.storage_index = dest_num - 33;
+        break;
       default:
         if (dest_num < 16) {
           i.result.storage_target = InstructionStorageTarget::kInterpolant;
@@ -1335,6 +1375,9 @@ void ShaderTranslator::ParseAluScalarInstruction(
                                       reg2, op.src_negate(3), const_slot,
                                       swiz_b, &i.operands[1]);
   }
+  if (i.result.storage_target == InstructionStorageTarget::kExportAddress) {
+    GatherMemExportStreamConstant(i);
+  }
 
   i.Disassemble(&ucode_disasm_buffer_);
 }
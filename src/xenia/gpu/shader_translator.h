@@ -26,7 +26,8 @@ class ShaderTranslator {
  public:
   virtual ~ShaderTranslator();
 
-  // Gathers all vertex/texture bindings. Implicitly called in Translate.
+  // Gathers all vertex/texture bindings. Implicitly called in Translate, and
+  // only done once per shader.
   // DEPRECATED(benvanik): remove this when shader cache is removed.
   bool GatherAllBindingInformation(Shader* shader);
 
@@ -136,6 +137,9 @@ class ShaderTranslator {
   };
 
   bool TranslateInternal(Shader* shader);
+  // Scans the ucode for bindings and control flow, unless already done for
+  // the shader.
+  void AnalyzeUcode(Shader* shader);
 
   void MarkUcodeInstruction(uint32_t dword_offset);
   void AppendUcodeDisasm(char c);
@@ -184,6 +188,8 @@ class ShaderTranslator {
   void ParseAluScalarInstruction(const ucode::AluInstruction& op,
                                  const AluOpcodeInfo& opcode_info,
                                  ParsedAluInstruction& instr);
+  // Records the stream constant of an instruction writing eA.
+  void GatherMemExportStreamConstant(const ParsedAluInstruction& instr);
 
   // Input shader metadata and microcode.
   ShaderType shader_type_;
@@ -197,6 +203,9 @@ class ShaderTranslator {
 
   // Current control flow dword index.
   uint32_t cf_index_ = 0;
+  // Control flow layout from the ucode analysis.
+  uint32_t cf_dword_count_ = 0;
+  std::set<uint32_t> cf_label_addresses_;
 
   // Microcode disassembly buffer, accumulated throughout the translation.
   StringBuffer ucode_disasm_buffer_;
@@ -214,6 +223,7 @@ class ShaderTranslator {
   std::vector<Shader::TextureBinding> texture_bindings_;
   Shader::ConstantRegisterMap constant_register_map_ = {0};
   bool writes_color_targets_[4] = {false, false, false, false};
+  std::vector<uint32_t> memexport_stream_constants_;
 
   static const AluOpcodeInfo alu_vector_opcode_infos_[0x20];
   static const AluOpcodeInfo alu_scalar_opcode_infos_[0x40];
@@ -45,6 +45,13 @@ void DisassembleResultOperand(const InstructionResult& result,
     case InstructionStorageTarget::kDepth:
       out->Append("oDepth");
       break;
+    case InstructionStorageTarget::kExportAddress:
+      out->Append("eA");
+      break;
+    case InstructionStorageTarget::kExportData:
+      out->Append("eM");
+      uses_storage_index = true;
+      break;
     case InstructionStorageTarget::kNone:
       break;
   }
@@ -19,9 +19,9 @@ void Compiler::AddPass(std::unique_ptr<CompilerPass> pass) {
   compiler_passes_.push_back(std::move(pass));
 }
 
-bool Compiler::Compile(spv::Module* module) {
+bool Compiler::Compile(spv::Builder* builder) {
   for (auto& pass : compiler_passes_) {
-    if (!pass->Run(module)) {
+    if (!pass->Run(builder)) {
       return false;
     }
   }
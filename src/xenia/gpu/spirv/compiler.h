@@ -28,7 +28,7 @@ class Compiler {
 
   void AddPass(std::unique_ptr<CompilerPass> pass);
   void Reset();
-  bool Compile(spv::Module* module);
+  bool Compile(spv::Builder* builder);
 
  private:
   std::vector<std::unique_ptr<CompilerPass>> compiler_passes_;
@@ -0,0 +1,133 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2016 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#include "xenia/gpu/spirv/compiler_pass.h"
+
+namespace xe {
+namespace gpu {
+namespace spirv {
+
+bool CompilerPass::IsPureOpCode(spv::Op opcode) {
+  if ((opcode >= spv::Op::OpVectorExtractDynamic &&
+       opcode <= spv::Op::OpTranspose) ||
+      (opcode >= spv::Op::OpSampledImage &&
+       opcode <= spv::Op::OpImageQuerySamples &&
+       opcode != spv::Op::OpImageWrite) ||
+      (opcode >= spv::Op::OpConvertFToU && opcode <= spv::Op::OpBitcast) ||
+      (opcode >= spv::Op::OpSNegate && opcode <= spv::Op::OpSMulExtended) ||
+      (opcode >= spv::Op::OpAny &&
+       opcode <= spv::Op::OpFUnordGreaterThanEqual) ||
+      (opcode >= spv::Op::OpShiftRightLogical &&
+       opcode <= spv::Op::OpBitCount) ||
+      (opcode >= spv::Op::OpDPdx && opcode <= spv::Op::OpFwidthCoarse)) {
+    return true;
+  }
+  switch (opcode) {
+    case spv::Op::OpUndef:
+    case spv::Op::OpLoad:
+    case spv::Op::OpAccessChain:
+    case spv::Op::OpInBoundsAccessChain:
+    case spv::Op::OpPhi:
+    // Only GLSL.std.450 is imported, which has no side effects.
+    case spv::Op::OpExtInst:
+      return true;
+    default:
+      return false;
+  }
+}
+
+bool CompilerPass::IsIdOperand(spv::Op opcode, int index) {
+  switch (opcode) {
+    case spv::Op::OpExtInst:
+      return index != 1;
+    case spv::Op::OpCompositeExtract:
+    case spv::Op::OpSelectionMerge:
+    case spv::Op::OpLoad:
+      return index < 1;
+    case spv::Op::OpCompositeInsert:
+    case spv::Op::OpVectorShuffle:
+    case spv::Op::OpLoopMerge:
+    case spv::Op::OpStore:
+    case spv::Op::OpCopyMemory:
+      return index < 2;
+    case spv::Op::OpBranchConditional:
+      return index < 3;
+    case spv::Op::OpSwitch:
+      // Selector and default, then pairs of literal and target label.
+      return index < 2 || (index & 1);
+    case spv::Op::OpImageSampleImplicitLod:
+    case spv::Op::OpImageSampleExplicitLod:
+    case spv::Op::OpImageSampleProjImplicitLod:
+    case spv::Op::OpImageSampleProjExplicitLod:
+    case spv::Op::OpImageFetch:
+    case spv::Op::OpImageRead:
+      // Image operands mask.
+      return index != 2;
+    case spv::Op::OpImageSampleDrefImplicitLod:
+    case spv::Op::OpImageSampleDrefExplicitLod:
+    case spv::Op::OpImageSampleProjDrefImplicitLod:
+    case spv::Op::OpImageSampleProjDrefExplicitLod:
+    case spv::Op::OpImageGather:
+    case spv::Op::OpImageDrefGather:
+    case spv::Op::OpImageWrite:
+      return index != 3;
+    default:
+      return true;
+  }
+}
+
+spv::Id CompilerPass::ResolveId(
+    const std::unordered_map<spv::Id, spv::Id>& replacements, spv::Id id) {
+  auto it = replacements.find(id);
+  while (it != replacements.end()) {
+    id = it->second;
+    it = replacements.find(id);
+  }
+  return id;
+}
+
+bool CompilerPass::ReplaceIds(
+    const std::unordered_map<spv::Id, spv::Id>& replacements,
+    spv::Instruction* instr) {
+  if (replacements.empty()) {
+    return false;
+  }
+  bool replaced = false;
+  for (int i = 0; i < instr->getNumOperands(); ++i) {
+    if (!IsIdOperand(instr->getOpCode(), i)) {
+      continue;
+    }
+    auto id = instr->getIdOperand(i);
+    auto new_id = ResolveId(replacements, id);
+    if (new_id != id) {
+      instr->setIdOperand(i, new_id);
+      replaced = true;
+    }
+  }
+  return replaced;
+}
+
+void CompilerPass::ReplaceIds(
+    const std::unordered_map<spv::Id, spv::Id>& replacements,
+    spv::Module* module) {
+  if (replacements.empty()) {
+    return;
+  }
+  for (auto function : module->getFunctions()) {
+    for (auto block : function->getBlocks()) {
+      for (size_t i = 0; i < block->getInstructionCount(); ++i) {
+        ReplaceIds(replacements, block->getInstruction(i));
+      }
+    }
+  }
+}
+
+}  // namespace spirv
+}  // namespace gpu
+}  // namespace xe
@@ -10,6 +10,8 @@
 #ifndef XENIA_GPU_SPIRV_COMPILER_PASS_H_
 #define XENIA_GPU_SPIRV_COMPILER_PASS_H_
 
+#include <unordered_map>
+
 #include "xenia/base/arena.h"
 
 #include "third_party/glslang-spirv/SpvBuilder.h"
@@ -24,7 +26,27 @@ class CompilerPass {
   CompilerPass() = default;
   virtual ~CompilerPass() {}
 
-  virtual bool Run(spv::Module* module) = 0;
+  // Runs over the module of the builder, which may be used to create the
+  // constants and types the pass needs.
+  virtual bool Run(spv::Builder* builder) = 0;
+
+ protected:
+  // Whether the instruction only computes its result from its operands, so
+  // that it may be removed when unused or merged with an identical one.
+  static bool IsPureOpCode(spv::Op opcode);
+  // Whether the operand at the index is an id rather than a literal.
+  static bool IsIdOperand(spv::Op opcode, int index);
+  // Follows replacements of an id until reaching one that isn't replaced.
+  static spv::Id ResolveId(
+      const std::unordered_map<spv::Id, spv::Id>& replacements, spv::Id id);
+  // Replaces the ids used by the instruction, returning whether any were.
+  static bool ReplaceIds(
+      const std::unordered_map<spv::Id, spv::Id>& replacements,
+      spv::Instruction* instr);
+  // Replaces the ids used by all code in the module.
+  static void ReplaceIds(
+      const std::unordered_map<spv::Id, spv::Id>& replacements,
+      spv::Module* module);
 
  private:
   xe::Arena ir_arena_;
@@ -0,0 +1,83 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2016 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#include "xenia/gpu/spirv/passes/common_subexpression_elimination_pass.h"
+
+#include <map>
+#include <unordered_map>
+#include <vector>
+
+namespace xe {
+namespace gpu {
+namespace spirv {
+
+CommonSubexpressionEliminationPass::CommonSubexpressionEliminationPass() {}
+
+bool CommonSubexpressionEliminationPass::Run(spv::Builder* builder) {
+  auto module = builder->getModule();
+  std::unordered_map<spv::Id, spv::Id> replacements;
+  // Opcode, type and operands of earlier instructions to their results.
+  std::map<std::vector<uint32_t>, spv::Id> values;
+  // Pointers to the result of the last load from them.
+  std::unordered_map<spv::Id, spv::Id> loads;
+  std::vector<uint32_t> key;
+  for (auto function : module->getFunctions()) {
+    for (auto block : function->getBlocks()) {
+      values.clear();
+      loads.clear();
+      for (size_t i = 0; i < block->getInstructionCount(); ++i) {
+        auto instr = block->getInstruction(i);
+        ReplaceIds(replacements, instr);
+        auto opcode = instr->getOpCode();
+        auto result_id = instr->getResultId();
+
+        if (opcode == spv::Op::OpLoad) {
+          auto pointer = instr->getIdOperand(0);
+          auto it = loads.find(pointer);
+          if (it != loads.end()) {
+            replacements[result_id] = it->second;
+          } else {
+            loads[pointer] = result_id;
+          }
+          continue;
+        }
+        if (!IsPureOpCode(opcode)) {
+          // Anything else may write memory.
+          loads.clear();
+          continue;
+        }
+        if (opcode == spv::Op::OpPhi || opcode == spv::Op::OpUndef) {
+          // Each undefined value may differ.
+          continue;
+        }
+
+        key.clear();
+        key.push_back(opcode);
+        key.push_back(instr->getTypeId());
+        for (int j = 0; j < instr->getNumOperands(); ++j) {
+          key.push_back(instr->getIdOperand(j));
+        }
+        auto it = values.find(key);
+        if (it != values.end()) {
+          replacements[result_id] = it->second;
+        } else {
+          values.insert({key, result_id});
+        }
+      }
+    }
+  }
+
+  // Uses in later blocks.
+  ReplaceIds(replacements, module);
+  return true;
+}
+
+}  // namespace spirv
+}  // namespace gpu
+}  // namespace xe
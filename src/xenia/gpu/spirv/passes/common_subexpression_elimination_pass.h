@@ -0,0 +1,36 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2016 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#ifndef XENIA_GPU_SPIRV_PASSES_COMMON_SUBEXPRESSION_ELIMINATION_PASS_H_
+#define XENIA_GPU_SPIRV_PASSES_COMMON_SUBEXPRESSION_ELIMINATION_PASS_H_
+
+#include "xenia/gpu/spirv/compiler_pass.h"
+
+namespace xe {
+namespace gpu {
+namespace spirv {
+
+// Common subexpression elimination pass. Within each block, replaces the
+// results of pure instructions identical to an earlier one, and of loads from
+// a pointer already loaded from with no memory writes in between. The
+// replaced instructions are left for dead code elimination to remove.
+class CommonSubexpressionEliminationPass : public CompilerPass {
+ public:
+  CommonSubexpressionEliminationPass();
+
+  bool Run(spv::Builder* builder) override;
+
+ private:
+};
+
+}  // namespace spirv
+}  // namespace gpu
+}  // namespace xe
+
+#endif  // XENIA_GPU_SPIRV_PASSES_COMMON_SUBEXPRESSION_ELIMINATION_PASS_H_
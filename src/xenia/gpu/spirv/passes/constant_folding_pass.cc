@@ -0,0 +1,270 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2016 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#include "xenia/gpu/spirv/passes/constant_folding_pass.h"
+
+#include <cmath>
+#include <cstring>
+#include <unordered_map>
+
+namespace xe {
+namespace gpu {
+namespace spirv {
+
+// Gets the bits of a 32-bit scalar (or boolean) constant.
+static bool GetScalarConstant(spv::Module* module, spv::Id id,
+                              uint32_t* value) {
+  auto def = module->getInstruction(id);
+  if (!def) {
+    return false;
+  }
+  switch (def->getOpCode()) {
+    case spv::Op::OpConstant:
+      if (def->getNumOperands() != 1) {
+        return false;
+      }
+      *value = def->getImmediateOperand(0);
+      return true;
+    case spv::Op::OpConstantTrue:
+      *value = 1;
+      return true;
+    case spv::Op::OpConstantFalse:
+      *value = 0;
+      return true;
+    default:
+      return false;
+  }
+}
+
+static float AsFloat(uint32_t value) {
+  float f;
+  std::memcpy(&f, &value, sizeof(f));
+  return f;
+}
+
+static uint32_t AsBits(float f) {
+  uint32_t value;
+  std::memcpy(&value, &f, sizeof(value));
+  return value;
+}
+
+// Creates a 32-bit scalar (or boolean) constant of the given type.
+static spv::Id MakeScalarConstant(spv::Builder* builder, spv::Id type_id,
+                                  uint32_t value) {
+  auto type = builder->getModule()->getInstruction(type_id);
+  switch (type->getOpCode()) {
+    case spv::Op::OpTypeBool:
+      return builder->makeBoolConstant(value != 0);
+    case spv::Op::OpTypeInt:
+      if (type->getImmediateOperand(0) != 32) {
+        return spv::NoResult;
+      }
+      return type->getImmediateOperand(1)
+                 ? builder->makeIntConstant(int32_t(value))
+                 : builder->makeUintConstant(value);
+    case spv::Op::OpTypeFloat:
+      if (type->getImmediateOperand(0) != 32) {
+        return spv::NoResult;
+      }
+      return builder->makeFloatConstant(AsFloat(value));
+    default:
+      return spv::NoResult;
+  }
+}
+
+ConstantFoldingPass::ConstantFoldingPass() {}
+
+bool ConstantFoldingPass::Run(spv::Builder* builder) {
+  auto module = builder->getModule();
+  std::unordered_map<spv::Id, spv::Id> replacements;
+  for (auto function : module->getFunctions()) {
+    for (auto block : function->getBlocks()) {
+      for (size_t i = 0; i < block->getInstructionCount(); ++i) {
+        auto instr = block->getInstruction(i);
+        // Operands folded earlier may make this foldable.
+        ReplaceIds(replacements, instr);
+        auto folded_id = Fold(builder, instr);
+        if (folded_id) {
+          replacements[instr->getResultId()] = folded_id;
+        }
+      }
+    }
+  }
+
+  ReplaceIds(replacements, module);
+  return true;
+}
+
+spv::Id ConstantFoldingPass::Fold(spv::Builder* builder,
+                                  spv::Instruction* instr) {
+  auto module = builder->getModule();
+  auto opcode = instr->getOpCode();
+  auto type_id = instr->getTypeId();
+  if (!instr->getResultId()) {
+    return spv::NoResult;
+  }
+
+  switch (opcode) {
+    case spv::Op::OpSelect: {
+      uint32_t condition;
+      if (!GetScalarConstant(module, instr->getIdOperand(0), &condition)) {
+        return spv::NoResult;
+      }
+      return instr->getIdOperand(condition ? 1 : 2);
+    }
+    case spv::Op::OpCompositeExtract: {
+      auto composite = module->getInstruction(instr->getIdOperand(0));
+      if (!composite ||
+          composite->getOpCode() != spv::Op::OpConstantComposite ||
+          instr->getNumOperands() != 2) {
+        return spv::NoResult;
+      }
+      uint32_t index = instr->getImmediateOperand(1);
+      if (int(index) >= composite->getNumOperands()) {
+        return spv::NoResult;
+      }
+      return composite->getIdOperand(index);
+    }
+    default:
+      break;
+  }
+
+  // Scalar operations with all constant operands.
+  if (instr->getNumOperands() < 1 || instr->getNumOperands() > 2) {
+    return spv::NoResult;
+  }
+  uint32_t a, b = 0;
+  if (!GetScalarConstant(module, instr->getIdOperand(0), &a) ||
+      (instr->getNumOperands() > 1 &&
+       !GetScalarConstant(module, instr->getIdOperand(1), &b))) {
+    return spv::NoResult;
+  }
+  float fa = AsFloat(a), fb = AsFloat(b);
+  bool ordered = !std::isnan(fa) && !std::isnan(fb);
+  uint32_t value;
+  switch (opcode) {
+    case spv::Op::OpIAdd:
+      value = a + b;
+      break;
+    case spv::Op::OpISub:
+      value = a - b;
+      break;
+    case spv::Op::OpIMul:
+      value = a * b;
+      break;
+    case spv::Op::OpSNegate:
+      value = 0u - a;
+      break;
+    case spv::Op::OpBitwiseAnd:
+      value = a & b;
+      break;
+    case spv::Op::OpBitwiseOr:
+      value = a | b;
+      break;
+    case spv::Op::OpBitwiseXor:
+      value = a ^ b;
+      break;
+    case spv::Op::OpNot:
+      value = ~a;
+      break;
+    case spv::Op::OpShiftLeftLogical:
+    case spv::Op::OpShiftRightLogical:
+    case spv::Op::OpShiftRightArithmetic:
+      if (b >= 32) {
+        // Undefined.
+        return spv::NoResult;
+      }
+      if (opcode == spv::Op::OpShiftLeftLogical) {
+        value = a << b;
+      } else if (opcode == spv::Op::OpShiftRightLogical) {
+        value = a >> b;
+      } else {
+        value = uint32_t(int32_t(a) >> b);
+      }
+      break;
+    case spv::Op::OpIEqual:
+    case spv::Op::OpLogicalEqual:
+      value = a == b;
+      break;
+    case spv::Op::OpINotEqual:
+    case spv::Op::OpLogicalNotEqual:
+      value = a != b;
+      break;
+    case spv::Op::OpULessThan:
+      value = a < b;
+      break;
+    case spv::Op::OpULessThanEqual:
+      value = a <= b;
+      break;
+    case spv::Op::OpUGreaterThan:
+      value = a > b;
+      break;
+    case spv::Op::OpUGreaterThanEqual:
+      value = a >= b;
+      break;
+    case spv::Op::OpSLessThan:
+      value = int32_t(a) < int32_t(b);
+      break;
+    case spv::Op::OpSLessThanEqual:
+      value = int32_t(a) <= int32_t(b);
+      break;
+    case spv::Op::OpSGreaterThan:
+      value = int32_t(a) > int32_t(b);
+      break;
+    case spv::Op::OpSGreaterThanEqual:
+      value = int32_t(a) >= int32_t(b);
+      break;
+    case spv::Op::OpLogicalAnd:
+      value = a && b;
+      break;
+    case spv::Op::OpLogicalOr:
+      value = a || b;
+      break;
+    case spv::Op::OpLogicalNot:
+      value = !a;
+      break;
+    case spv::Op::OpFAdd:
+      value = AsBits(fa + fb);
+      break;
+    case spv::Op::OpFSub:
+      value = AsBits(fa - fb);
+      break;
+    case spv::Op::OpFMul:
+      value = AsBits(fa * fb);
+      break;
+    case spv::Op::OpFNegate:
+      value = a ^ 0x80000000u;
+      break;
+    case spv::Op::OpFOrdEqual:
+      value = fa == fb;
+      break;
+    case spv::Op::OpFOrdNotEqual:
+      value = ordered && fa != fb;
+      break;
+    case spv::Op::OpFOrdLessThan:
+      value = fa < fb;
+      break;
+    case spv::Op::OpFOrdLessThanEqual:
+      value = fa <= fb;
+      break;
+    case spv::Op::OpFOrdGreaterThan:
+      value = fa > fb;
+      break;
+    case spv::Op::OpFOrdGreaterThanEqual:
+      value = fa >= fb;
+      break;
+    default:
+      return spv::NoResult;
+  }
+  return MakeScalarConstant(builder, type_id, value);
+}
+
+}  // namespace spirv
+}  // namespace gpu
+}  // namespace xe
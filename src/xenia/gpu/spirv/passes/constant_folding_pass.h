@@ -0,0 +1,37 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2016 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#ifndef XENIA_GPU_SPIRV_PASSES_CONSTANT_FOLDING_PASS_H_
+#define XENIA_GPU_SPIRV_PASSES_CONSTANT_FOLDING_PASS_H_
+
+#include "xenia/gpu/spirv/compiler_pass.h"
+
+namespace xe {
+namespace gpu {
+namespace spirv {
+
+// Constant folding pass. Replaces operations on constants with their results
+// and selects on constant conditions with the selected value. The folded
+// instructions are left for dead code elimination to remove.
+class ConstantFoldingPass : public CompilerPass {
+ public:
+  ConstantFoldingPass();
+
+  bool Run(spv::Builder* builder) override;
+
+ private:
+  // Returns the id the instruction can be replaced with, if any.
+  spv::Id Fold(spv::Builder* builder, spv::Instruction* instr);
+};
+
+}  // namespace spirv
+}  // namespace gpu
+}  // namespace xe
+
+#endif  // XENIA_GPU_SPIRV_PASSES_CONSTANT_FOLDING_PASS_H_
@@ -15,7 +15,8 @@ namespace spirv {
 
 ControlFlowAnalysisPass::ControlFlowAnalysisPass() {}
 
-bool ControlFlowAnalysisPass::Run(spv::Module* module) {
+bool ControlFlowAnalysisPass::Run(spv::Builder* builder) {
+  auto module = builder->getModule();
   for (auto function : module->getFunctions()) {
     // For each OpBranchConditional, see if we can find a point where control
     // flow converges and then append an OpSelectionMerge.
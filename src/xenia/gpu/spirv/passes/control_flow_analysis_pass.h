@@ -22,7 +22,7 @@ class ControlFlowAnalysisPass : public CompilerPass {
  public:
   ControlFlowAnalysisPass();
 
-  bool Run(spv::Module* module) override;
+  bool Run(spv::Builder* builder) override;
 
  private:
 };
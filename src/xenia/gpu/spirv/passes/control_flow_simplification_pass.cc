@@ -15,7 +15,8 @@ namespace spirv {
 
 ControlFlowSimplificationPass::ControlFlowSimplificationPass() {}
 
-bool ControlFlowSimplificationPass::Run(spv::Module* module) {
+bool ControlFlowSimplificationPass::Run(spv::Builder* builder) {
+  auto module = builder->getModule();
   for (auto function : module->getFunctions()) {
     // Walk through the blocks in the function and merge any blocks which are
     // unconditionally dominated.
@@ -22,7 +22,7 @@ class ControlFlowSimplificationPass : public CompilerPass {
  public:
   ControlFlowSimplificationPass();
 
-  bool Run(spv::Module* module) override;
+  bool Run(spv::Builder* builder) override;
 
  private:
 };
@@ -0,0 +1,71 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2016 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#include "xenia/gpu/spirv/passes/dead_code_elimination_pass.h"
+
+#include <unordered_map>
+
+namespace xe {
+namespace gpu {
+namespace spirv {
+
+DeadCodeEliminationPass::DeadCodeEliminationPass() {}
+
+bool DeadCodeEliminationPass::Run(spv::Builder* builder) {
+  auto module = builder->getModule();
+  std::unordered_map<spv::Id, uint32_t> use_counts;
+  for (auto function : module->getFunctions()) {
+    auto& blocks = function->getBlocks();
+    bool removed = true;
+    while (removed) {
+      removed = false;
+      use_counts.clear();
+      for (auto block : blocks) {
+        for (size_t i = 0; i < block->getInstructionCount(); ++i) {
+          auto instr = block->getInstruction(i);
+          for (int j = 0; j < instr->getNumOperands(); ++j) {
+            if (IsIdOperand(instr->getOpCode(), j)) {
+              ++use_counts[instr->getIdOperand(j)];
+            }
+          }
+        }
+      }
+
+      // Walking backwards releases the operands of removed instructions in
+      // time for the instructions producing them earlier in the block. Uses
+      // in other blocks are picked up by the next iteration.
+      for (auto block : blocks) {
+        for (size_t i = block->getInstructionCount(); i-- > 1;) {
+          auto instr = block->getInstruction(i);
+          auto result_id = instr->getResultId();
+          if (!result_id || !IsPureOpCode(instr->getOpCode())) {
+            continue;
+          }
+          auto it = use_counts.find(result_id);
+          if (it != use_counts.end() && it->second) {
+            continue;
+          }
+          for (int j = 0; j < instr->getNumOperands(); ++j) {
+            if (IsIdOperand(instr->getOpCode(), j)) {
+              --use_counts[instr->getIdOperand(j)];
+            }
+          }
+          block->removeInstruction(i);
+          removed = true;
+        }
+      }
+    }
+  }
+
+  return true;
+}
+
+}  // namespace spirv
+}  // namespace gpu
+}  // namespace xe
@@ -0,0 +1,34 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2016 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#ifndef XENIA_GPU_SPIRV_PASSES_DEAD_CODE_ELIMINATION_PASS_H_
+#define XENIA_GPU_SPIRV_PASSES_DEAD_CODE_ELIMINATION_PASS_H_
+
+#include "xenia/gpu/spirv/compiler_pass.h"
+
+namespace xe {
+namespace gpu {
+namespace spirv {
+
+// Dead code elimination pass. Removes instructions without side effects whose
+// results are never used, such as temporaries of unused register components.
+class DeadCodeEliminationPass : public CompilerPass {
+ public:
+  DeadCodeEliminationPass();
+
+  bool Run(spv::Builder* builder) override;
+
+ private:
+};
+
+}  // namespace spirv
+}  // namespace gpu
+}  // namespace xe
+
+#endif  // XENIA_GPU_SPIRV_PASSES_DEAD_CODE_ELIMINATION_PASS_H_
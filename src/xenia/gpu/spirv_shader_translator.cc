@@ -14,10 +14,16 @@
 #include <cstring>
 
 #include "xenia/base/logging.h"
+#include "xenia/gpu/spirv/passes/common_subexpression_elimination_pass.h"
+#include "xenia/gpu/spirv/passes/constant_folding_pass.h"
 #include "xenia/gpu/spirv/passes/control_flow_analysis_pass.h"
 #include "xenia/gpu/spirv/passes/control_flow_simplification_pass.h"
+#include "xenia/gpu/spirv/passes/dead_code_elimination_pass.h"
 
 DEFINE_bool(spv_validate, false, "Validate SPIR-V shaders after generation");
+DEFINE_bool(spv_optimize, true,
+            "Fold constants and remove redundant and dead code in SPIR-V "
+            "shaders before handing them to the driver.");
 
 namespace xe {
 namespace gpu {
@@ -33,6 +39,13 @@ using spv::Op;
 SpirvShaderTranslator::SpirvShaderTranslator() {
   compiler_.AddPass(std::make_unique<spirv::ControlFlowSimplificationPass>());
   compiler_.AddPass(std::make_unique<spirv::ControlFlowAnalysisPass>());
+  if (FLAGS_spv_optimize) {
+    // Blocks are merged first so subexpressions are found across more code.
+    compiler_.AddPass(std::make_unique<spirv::ConstantFoldingPass>());
+    compiler_.AddPass(
+        std::make_unique<spirv::CommonSubexpressionEliminationPass>());
+    compiler_.AddPass(std::make_unique<spirv::DeadCodeEliminationPass>());
+  }
 }
 
 SpirvShaderTranslator::~SpirvShaderTranslator() = default;
@@ -59,6 +72,8 @@ void SpirvShaderTranslator::StartTranslation() {
   if (is_pixel_shader()) {
     b.addCapability(spv::Capability::CapabilityDerivativeControl);
   }
+  // For the immutable sampler table, which is indexed by push constants.
+  b.addCapability(spv::Capability::CapabilitySampledImageArrayDynamicIndexing);
 
   bool_type_ = b.makeBoolType();
   float_type_ = b.makeFloatType(32);
@@ -100,6 +115,14 @@ void SpirvShaderTranslator::StartTranslation() {
                          vec4_float_type_, "pv");
   a0_ = b.createVariable(spv::StorageClass::StorageClassFunction, int_type_,
                          "a0");
+  memexport_buffer_ = 0;
+  if (is_vertex_shader()) {
+    memexport_address_ = b.createVariable(
+        spv::StorageClass::StorageClassFunction, vec4_float_type_, "eA");
+    memexport_data_ = b.createVariable(
+        spv::StorageClass::StorageClassFunction,
+        b.makeArrayType(vec4_float_type_, b.makeUintConstant(5), 0), "eM");
+  }
 
   // Uniform constants.
   Id float_consts_type =
@@ -147,7 +170,9 @@ void SpirvShaderTranslator::StartTranslation() {
 
   // Push constants, represented by SpirvPushConstants.
   Id push_constants_type = b.makeStructType(
-      {vec4_float_type_, vec4_float_type_, vec4_float_type_, uint_type_},
+      {vec4_float_type_, vec4_float_type_, vec4_float_type_, uint_type_,
+       b.makeArrayType(uint_type_, b.makeUintConstant(8), sizeof(uint32_t)),
+       b.makeArrayType(uint_type_, b.makeUintConstant(2), sizeof(uint32_t))},
       "push_consts_type");
   b.addDecoration(push_constants_type, spv::Decoration::DecorationBlock);
 
@@ -171,22 +196,29 @@ void SpirvShaderTranslator::StartTranslation() {
       push_constants_type, 3, spv::Decoration::DecorationOffset,
       static_cast<int>(offsetof(SpirvPushConstants, ps_param_gen)));
   b.addMemberName(push_constants_type, 3, "ps_param_gen");
+  // uint sampler_indices[8];
+  b.addMemberDecoration(
+      push_constants_type, 4, spv::Decoration::DecorationOffset,
+      static_cast<int>(offsetof(SpirvPushConstants, sampler_indices)));
+  b.addMemberName(push_constants_type, 4, "sampler_indices");
+  // uint memexport_range[2];
+  b.addMemberDecoration(
+      push_constants_type, 5, spv::Decoration::DecorationOffset,
+      static_cast<int>(offsetof(SpirvPushConstants, memexport_range)));
+  b.addMemberName(push_constants_type, 5, "memexport_range");
   push_consts_ = b.createVariable(spv::StorageClass::StorageClassPushConstant,
                                   push_constants_type, "push_consts");
 
   // Texture bindings
-  Id tex_t[] = {b.makeSampledImageType(b.makeImageType(
-                    float_type_, spv::Dim::Dim1D, false, false, false, 1,
-                    spv::ImageFormat::ImageFormatUnknown)),
-                b.makeSampledImageType(b.makeImageType(
-                    float_type_, spv::Dim::Dim2D, false, false, false, 1,
-                    spv::ImageFormat::ImageFormatUnknown)),
-                b.makeSampledImageType(b.makeImageType(
-                    float_type_, spv::Dim::Dim3D, false, false, false, 1,
-                    spv::ImageFormat::ImageFormatUnknown)),
-                b.makeSampledImageType(b.makeImageType(
-                    float_type_, spv::Dim::DimCube, false, false, false, 1,
-                    spv::ImageFormat::ImageFormatUnknown))};
+  Id tex_t[] = {b.makeImageType(float_type_, spv::Dim::Dim1D, false, false,
+                                false, 1, spv::ImageFormat::ImageFormatUnknown),
+                b.makeImageType(float_type_, spv::Dim::Dim2D, false, false,
+                                false, 1, spv::ImageFormat::ImageFormatUnknown),
+                b.makeImageType(float_type_, spv::Dim::Dim3D, false, false,
+                                false, 1, spv::ImageFormat::ImageFormatUnknown),
+                b.makeImageType(float_type_, spv::Dim::DimCube, false, false,
+                                false, 1,
+                                spv::ImageFormat::ImageFormatUnknown)};
 
   Id tex_a_t[] = {b.makeArrayType(tex_t[0], b.makeUintConstant(32), 0),
                   b.makeArrayType(tex_t[1], b.makeUintConstant(32), 0),
@@ -201,41 +233,35 @@ void SpirvShaderTranslator::StartTranslation() {
     b.addDecoration(tex_[i], spv::Decoration::DecorationBinding, i);
   }
 
+  // Samplers are bound apart from the images, as the immutable sampler table
+  // shared by all fetch constants and one sampler for each of them.
+  Id sampler_t = b.makeSamplerType();
+  Id samplers_a_t = b.makeArrayType(
+      sampler_t, b.makeUintConstant(kSpirvImmutableSamplerCount), 0);
+  samplers_ = b.createVariable(spv::StorageClass::StorageClassUniformConstant,
+                               samplers_a_t, "samplers");
+  b.addDecoration(samplers_, spv::Decoration::DecorationDescriptorSet, 1);
+  b.addDecoration(samplers_, spv::Decoration::DecorationBinding, 4);
+  fetch_samplers_ = b.createVariable(
+      spv::StorageClass::StorageClassUniformConstant,
+      b.makeArrayType(sampler_t, b.makeUintConstant(32), 0), "fetch_samplers");
+  b.addDecoration(fetch_samplers_, spv::Decoration::DecorationDescriptorSet,
+                  1);
+  b.addDecoration(fetch_samplers_, spv::Decoration::DecorationBinding, 5);
+
   // Interpolators.
   Id interpolators_type = b.makeArrayType(
       vec4_float_type_, b.makeUintConstant(kMaxInterpolators), 0);
   if (is_vertex_shader()) {
     // Vertex inputs/outputs.
+    // Inputs are the raw guest words, swapped and decoded when fetched.
     for (const auto& binding : vertex_bindings()) {
       for (const auto& attrib : binding.attributes) {
-        Id attrib_type = 0;
-        switch (attrib.fetch_instr.attributes.data_format) {
-          case VertexFormat::k_32:
-          case VertexFormat::k_32_FLOAT:
-            attrib_type = float_type_;
-            break;
-          case VertexFormat::k_16_16:
-          case VertexFormat::k_32_32:
-          case VertexFormat::k_16_16_FLOAT:
-          case VertexFormat::k_32_32_FLOAT:
-            attrib_type = vec2_float_type_;
-            break;
-          case VertexFormat::k_10_11_11:
-          case VertexFormat::k_11_11_10:
-          case VertexFormat::k_32_32_32_FLOAT:
-            attrib_type = vec3_float_type_;
-            break;
-          case VertexFormat::k_8_8_8_8:
-          case VertexFormat::k_2_10_10_10:
-          case VertexFormat::k_16_16_16_16:
-          case VertexFormat::k_32_32_32_32:
-          case VertexFormat::k_16_16_16_16_FLOAT:
-          case VertexFormat::k_32_32_32_32_FLOAT:
-            attrib_type = vec4_float_type_;
-            break;
-          default:
-            assert_always();
-        }
+        int word_count = GetVertexFormatSizeInWords(
+            attrib.fetch_instr.attributes.data_format);
+        Id attrib_type = word_count > 1
+                             ? b.makeVectorType(uint_type_, word_count)
+                             : uint_type_;
 
         auto attrib_var = b.createVariable(
             spv::StorageClass::StorageClassInput, attrib_type,
@@ -506,7 +532,7 @@ std::vector<uint8_t> SpirvShaderTranslator::CompleteTranslation() {
   b.makeReturn(false);
 
   // Compile the spv IR
-  compiler_.Compile(b.getModule());
+  compiler_.Compile(&b);
 
   std::vector<uint32_t> spirv_words;
   b.dump(spirv_words);
@@ -877,33 +903,20 @@ void SpirvShaderTranslator::ProcessVertexFetchInstruction(
   auto vertex_ptr = vertex_binding_map_[instr.operands[1].storage_index]
                                        [instr.attributes.offset];
   assert_not_zero(vertex_ptr);
-  auto vertex = b.createLoad(vertex_ptr);
-
-  switch (instr.attributes.data_format) {
-    case VertexFormat::k_8_8_8_8:
-    case VertexFormat::k_16_16:
-    case VertexFormat::k_16_16_16_16:
-    case VertexFormat::k_16_16_16_16_FLOAT:
-    case VertexFormat::k_32:
-    case VertexFormat::k_32_32:
-    case VertexFormat::k_32_32_32_32:
-    case VertexFormat::k_32_FLOAT:
-    case VertexFormat::k_32_32_FLOAT:
-    case VertexFormat::k_32_32_32_FLOAT:
-    case VertexFormat::k_32_32_32_32_FLOAT:
-      // These are handled, for now.
-      break;
-
-    case VertexFormat::k_10_11_11: {
-      // No conversion needed. Natively supported.
-    } break;
-
-    case VertexFormat::k_11_11_10: {
-      // This needs to be converted.
-    } break;
-  }
+  auto vertex = DecodeVertexWords(b.createLoad(vertex_ptr), instr.attributes);
 
   auto vertex_components = b.getNumComponents(vertex);
+  if (vertex_components == 1) {
+    cond = b.createCompositeExtract(cond, bool_type_, 0);
+  } else if (vertex_components != 4) {
+    std::vector<unsigned> cond_components;
+    for (int i = 0; i < vertex_components; ++i) {
+      cond_components.push_back(i);
+    }
+    cond = b.createRvalueSwizzle(
+        spv::NoPrecision, b.makeVectorType(bool_type_, vertex_components),
+        cond, cond_components);
+  }
   Id alt_vertex = 0;
   switch (vertex_components) {
     case 1:
@@ -936,6 +949,110 @@ void SpirvShaderTranslator::ProcessVertexFetchInstruction(
   StoreToResult(vertex, instr.result);
 }
 
+Id SpirvShaderTranslator::DecodeVertexWords(
+    Id words, const ParsedVertexFetchInstruction::Attributes& attributes) {
+  auto& b = *builder_;
+  auto format = attributes.data_format;
+  int word_count = GetVertexFormatSizeInWords(format);
+  int component_count = GetVertexFormatComponentCount(format);
+  auto word_type = b.getTypeId(words);
+  auto uint_constant = [&](uint32_t value) {
+    auto constant = b.makeUintConstant(value);
+    if (word_count == 1) {
+      return constant;
+    }
+    return b.makeCompositeConstant(
+        word_type, std::vector<Id>(word_count, constant));
+  };
+
+  // Vertex data is bound as it is in guest memory.
+  auto byte_3 = b.createBinOp(spv::Op::OpShiftLeftLogical, word_type, words,
+                              uint_constant(24));
+  auto byte_2 = b.createBinOp(
+      spv::Op::OpBitwiseAnd, word_type,
+      b.createBinOp(spv::Op::OpShiftLeftLogical, word_type, words,
+                    uint_constant(8)),
+      uint_constant(0xFF0000));
+  auto byte_1 = b.createBinOp(
+      spv::Op::OpBitwiseAnd, word_type,
+      b.createBinOp(spv::Op::OpShiftRightLogical, word_type, words,
+                    uint_constant(8)),
+      uint_constant(0xFF00));
+  auto byte_0 = b.createBinOp(spv::Op::OpShiftRightLogical, word_type, words,
+                              uint_constant(24));
+  words = b.createBinOp(
+      spv::Op::OpBitwiseOr, word_type,
+      b.createBinOp(spv::Op::OpBitwiseOr, word_type, byte_3, byte_2),
+      b.createBinOp(spv::Op::OpBitwiseOr, word_type, byte_1, byte_0));
+  std::vector<Id> word_ids;
+  for (int i = 0; i < word_count; ++i) {
+    word_ids.push_back(word_count > 1
+                           ? b.createCompositeExtract(words, uint_type_, i)
+                           : words);
+  }
+
+  std::vector<Id> components;
+  VertexFormatComponent fixed_components[4];
+  if (GetVertexFormatFixedComponents(format, fixed_components)) {
+    // Fixed point components are normalized unless fetched as integers.
+    for (int i = 0; i < component_count; ++i) {
+      const auto& fixed_component = fixed_components[i];
+      Id value = word_ids[fixed_component.word];
+      if (attributes.is_signed) {
+        value = b.createUnaryOp(spv::Op::OpBitcast, int_type_, value);
+      }
+      if (fixed_component.bits < 32) {
+        value = b.createTriOp(attributes.is_signed
+                                  ? spv::Op::OpBitFieldSExtract
+                                  : spv::Op::OpBitFieldUExtract,
+                              attributes.is_signed ? int_type_ : uint_type_,
+                              value, b.makeUintConstant(fixed_component.offset),
+                              b.makeUintConstant(fixed_component.bits));
+      }
+      value = b.createUnaryOp(attributes.is_signed ? spv::Op::OpConvertSToF
+                                                   : spv::Op::OpConvertUToF,
+                              float_type_, value);
+      if (!attributes.is_integer) {
+        double max_value =
+            double((uint64_t(1) << (fixed_component.bits -
+                                    (attributes.is_signed ? 1 : 0))) -
+                   1);
+        value = b.createBinOp(spv::Op::OpFMul, float_type_, value,
+                              b.makeFloatConstant(float(1.0 / max_value)));
+        if (attributes.is_signed) {
+          value = CreateGlslStd450InstructionCall(
+              spv::NoPrecision, float_type_, GLSLstd450::kFMax,
+              {value, b.makeFloatConstant(-1.f)});
+        }
+      }
+      components.push_back(value);
+    }
+  } else if (format == VertexFormat::k_16_16_FLOAT ||
+             format == VertexFormat::k_16_16_16_16_FLOAT) {
+    for (auto word_id : word_ids) {
+      auto halves =
+          CreateGlslStd450InstructionCall(spv::NoPrecision, vec2_float_type_,
+                                          GLSLstd450::kUnpackHalf2x16,
+                                          {word_id});
+      components.push_back(
+          b.createCompositeExtract(halves, float_type_, 0));
+      components.push_back(
+          b.createCompositeExtract(halves, float_type_, 1));
+    }
+  } else {
+    for (auto word_id : word_ids) {
+      components.push_back(
+          b.createUnaryOp(spv::Op::OpBitcast, float_type_, word_id));
+    }
+  }
+
+  if (component_count == 1) {
+    return components[0];
+  }
+  return b.createCompositeConstruct(
+      b.makeVectorType(float_type_, component_count), components);
+}
+
 void SpirvShaderTranslator::ProcessTextureFetchInstruction(
     const ParsedTextureFetchInstruction& instr) {
   auto& b = *builder_;
@@ -993,17 +1110,52 @@ void SpirvShaderTranslator::ProcessTextureFetchInstruction(
 
   switch (instr.opcode) {
     case FetchOpcode::kTextureFetch: {
-      auto texture_index = b.makeUintConstant(instr.operands[1].storage_index);
-      auto texture_ptr =
-          b.createAccessChain(spv::StorageClass::StorageClassUniformConstant,
-                              tex_[dim_idx], std::vector<Id>({texture_index}));
+      uint32_t fetch_constant = instr.operands[1].storage_index;
+      std::vector<Id> texture_index({b.makeUintConstant(fetch_constant)});
+      auto texture_ptr = b.createAccessChain(
+          spv::StorageClass::StorageClassUniformConstant, tex_[dim_idx],
+          texture_index);
       auto texture = b.createLoad(texture_ptr);
-
-      spv::Builder::TextureParameters params = {0};
-      params.coords = src;
-      params.sampler = texture;
-      dest = b.createTextureCall(spv::NoPrecision, vec4_float_type_, false,
-                                 false, false, false, false, params);
+      auto sampled_image_type = b.makeSampledImageType(b.getTypeId(texture));
+
+      // The sampler index is the same for all invocations, so sampling in
+      // either branch still has implicit derivatives.
+      std::vector<Id> sampler_index_offsets(
+          {b.makeUintConstant(4), b.makeUintConstant(fetch_constant / 4)});
+      auto sampler_index = b.createLoad(
+          b.createAccessChain(spv::StorageClass::StorageClassPushConstant,
+                              push_consts_, sampler_index_offsets));
+      sampler_index = b.createBinOp(
+          spv::Op::OpShiftRightLogical, uint_type_, sampler_index,
+          b.makeUintConstant((fetch_constant & 3) * 8));
+      sampler_index = b.createBinOp(spv::Op::OpBitwiseAnd, uint_type_,
+                                    sampler_index, b.makeUintConstant(0xFF));
+      auto use_fetch_sampler = b.createBinOp(
+          spv::Op::OpIEqual, bool_type_, sampler_index,
+          b.makeUintConstant(kSpirvFetchSamplerIndex));
+
+      auto result = b.createVariable(spv::StorageClass::StorageClassFunction,
+                                     vec4_float_type_, "tex_result");
+      auto sample = [&](Id sampler_ptr) {
+        spv::Builder::TextureParameters params = {0};
+        params.coords = src;
+        params.sampler = b.createBinOp(spv::Op::OpSampledImage,
+                                       sampled_image_type, texture,
+                                       b.createLoad(sampler_ptr));
+        b.createStore(
+            b.createTextureCall(spv::NoPrecision, vec4_float_type_, false,
+                                false, false, false, false, params),
+            result);
+      };
+      spv::Builder::If sampler_if(use_fetch_sampler, b);
+      sample(b.createAccessChain(spv::StorageClass::StorageClassUniformConstant,
+                                 fetch_samplers_, texture_index));
+      sampler_if.makeBeginElse();
+      std::vector<Id> sampler_offsets({sampler_index});
+      sample(b.createAccessChain(spv::StorageClass::StorageClassUniformConstant,
+                                 samplers_, sampler_offsets));
+      sampler_if.makeEndIf();
+      dest = b.createLoad(result);
     } break;
     default:
       // TODO: the rest of these
@@ -2138,6 +2290,22 @@ void SpirvShaderTranslator::StoreToResult(Id source_value_id,
       storage_offsets.push_back(0);
       storage_array = false;
       break;
+    case InstructionStorageTarget::kExportAddress:
+      assert_true(is_vertex_shader());
+      storage_pointer = memexport_address_;
+      storage_class = spv::StorageClass::StorageClassFunction;
+      storage_type = vec4_float_type_;
+      storage_offsets.push_back(0);
+      storage_array = false;
+      break;
+    case InstructionStorageTarget::kExportData:
+      assert_true(is_vertex_shader());
+      storage_pointer = memexport_data_;
+      storage_class = spv::StorageClass::StorageClassFunction;
+      storage_type = vec4_float_type_;
+      storage_offsets.push_back(storage_index);
+      storage_array = true;
+      break;
     case InstructionStorageTarget::kNone:
       assert_unhandled_case(result.storage_target);
       break;
@@ -2258,6 +2426,145 @@ void SpirvShaderTranslator::StoreToResult(Id source_value_id,
   assert_true(b.getTypeId(source_value_id) ==
               b.getDerefTypeId(storage_pointer));
   b.createStore(source_value_id, storage_pointer);
+
+  // Each eM# write exports its element right away.
+  if (result.storage_target == InstructionStorageTarget::kExportData &&
+      memexport_enabled_) {
+    EmitMemExport(result.storage_index);
+  }
+}
+
+void SpirvShaderTranslator::EmitMemExport(uint32_t index) {
+  auto& b = *builder_;
+
+  if (!memexport_buffer_) {
+    // struct { uint data[]; } bound as the whole storage buffer the exports
+    // of the draw are written to, at memexport_range[0] and on.
+    Id data_type = b.makeRuntimeArray(uint_type_);
+    b.addDecoration(data_type, spv::Decoration::DecorationArrayStride,
+                    sizeof(uint32_t));
+    Id buffer_type = b.makeStructType({data_type}, "memexport_type");
+    b.addDecoration(buffer_type, spv::Decoration::DecorationBufferBlock);
+    b.addMemberDecoration(buffer_type, 0, spv::Decoration::DecorationOffset,
+                          0);
+    b.addMemberName(buffer_type, 0, "data");
+    memexport_buffer_ = b.createVariable(
+        spv::StorageClass::StorageClassUniform, buffer_type, "memexport");
+    b.addDecoration(memexport_buffer_,
+                    spv::Decoration::DecorationDescriptorSet, 2);
+    b.addDecoration(memexport_buffer_, spv::Decoration::DecorationBinding, 0);
+  }
+
+  // eA is the stream constant with the index of the element added to y, as
+  // xe_gpu_memexport_stream_t. The index and count are the low 23 bits of
+  // floats offset by 2^23.
+  auto address = b.createUnaryOp(spv::Op::OpBitcast, vec4_uint_type_,
+                                 b.createLoad(memexport_address_));
+  auto index_mask = b.makeUintConstant(0x7FFFFF);
+  auto element = b.createBinOp(
+      spv::Op::OpIAdd, uint_type_,
+      b.createBinOp(spv::Op::OpBitwiseAnd, uint_type_,
+                    b.createCompositeExtract(address, uint_type_, 1),
+                    index_mask),
+      b.makeUintConstant(index));
+  auto count =
+      b.createBinOp(spv::Op::OpBitwiseAnd, uint_type_,
+                    b.createCompositeExtract(address, uint_type_, 3),
+                    index_mask);
+  auto format = b.createBinOp(
+      spv::Op::OpBitwiseAnd, uint_type_,
+      b.createBinOp(spv::Op::OpShiftRightLogical, uint_type_,
+                    b.createCompositeExtract(address, uint_type_, 2),
+                    b.makeUintConstant(8)),
+      b.makeUintConstant(0x3F));
+  auto is_format = [&](ColorFormat value) {
+    return b.createBinOp(spv::Op::OpIEqual, bool_type_, format,
+                         b.makeUintConstant(uint32_t(value)));
+  };
+
+  // Packed as it is in little-endian memory, the command processor swaps the
+  // words when writing them to guest memory.
+  auto data = b.createLoad(
+      b.createAccessChain(spv::StorageClass::StorageClassFunction,
+                          memexport_data_,
+                          std::vector<Id>({b.makeUintConstant(index)})));
+  auto data_bits = b.createUnaryOp(spv::Op::OpBitcast, vec4_uint_type_, data);
+  Id words[4];
+  for (int i = 0; i < 4; ++i) {
+    words[i] = b.createCompositeExtract(data_bits, uint_type_, i);
+  }
+  auto half_xy = CreateGlslStd450InstructionCall(
+      spv::NoPrecision, uint_type_, GLSLstd450::kPackHalf2x16,
+      {b.createOp(spv::Op::OpVectorShuffle, vec2_float_type_,
+                  {data, data, 0, 1})});
+  auto half_zw = CreateGlslStd450InstructionCall(
+      spv::NoPrecision, uint_type_, GLSLstd450::kPackHalf2x16,
+      {b.createOp(spv::Op::OpVectorShuffle, vec2_float_type_,
+                  {data, data, 2, 3})});
+  auto unorm = CreateGlslStd450InstructionCall(
+      spv::NoPrecision, uint_type_, GLSLstd450::kPackUnorm4x8,
+      {CreateGlslStd450InstructionCall(
+          spv::NoPrecision, vec4_float_type_, GLSLstd450::kFClamp,
+          {data, vec4_float_zero_, vec4_float_one_})});
+  auto is_8_8_8_8 = is_format(ColorFormat::k_8_8_8_8);
+  auto is_16_16_float = is_format(ColorFormat::k_16_16_FLOAT);
+  auto is_16_16_16_16_float = is_format(ColorFormat::k_16_16_16_16_FLOAT);
+  words[0] = b.createTriOp(
+      spv::Op::OpSelect, uint_type_, is_8_8_8_8, unorm,
+      b.createTriOp(spv::Op::OpSelect, uint_type_,
+                    b.createBinOp(spv::Op::OpLogicalOr, bool_type_,
+                                  is_16_16_float, is_16_16_16_16_float),
+                    half_xy, words[0]));
+  words[1] = b.createTriOp(spv::Op::OpSelect, uint_type_,
+                           is_16_16_16_16_float, half_zw, words[1]);
+
+  // Elements of other formats aren't written, the command processor doesn't
+  // export streams it can't pack.
+  auto word_count = b.makeUintConstant(0);
+  const std::pair<ColorFormat, uint32_t> format_word_counts[] = {
+      {ColorFormat::k_8_8_8_8, 1},
+      {ColorFormat::k_16_16_FLOAT, 1},
+      {ColorFormat::k_16_16_16_16_FLOAT, 2},
+      {ColorFormat::k_32_FLOAT, 1},
+      {ColorFormat::k_32_32_FLOAT, 2},
+      {ColorFormat::k_32_32_32_32_FLOAT, 4},
+  };
+  for (const auto& format_word_count : format_word_counts) {
+    word_count = b.createTriOp(spv::Op::OpSelect, uint_type_,
+                               is_format(format_word_count.first),
+                               b.makeUintConstant(format_word_count.second),
+                               word_count);
+  }
+
+  auto range_first = b.createLoad(b.createAccessChain(
+      spv::StorageClass::StorageClassPushConstant, push_consts_,
+      std::vector<Id>({b.makeUintConstant(5), b.makeUintConstant(0)})));
+  auto range_end = b.createLoad(b.createAccessChain(
+      spv::StorageClass::StorageClassPushConstant, push_consts_,
+      std::vector<Id>({b.makeUintConstant(5), b.makeUintConstant(1)})));
+  auto in_stream =
+      b.createBinOp(spv::Op::OpULessThan, bool_type_, element, count);
+  auto element_first = b.createBinOp(
+      spv::Op::OpIAdd, uint_type_, range_first,
+      b.createBinOp(spv::Op::OpIMul, uint_type_, element, word_count));
+  for (uint32_t i = 0; i < 4; ++i) {
+    auto word_index = b.createBinOp(spv::Op::OpIAdd, uint_type_,
+                                    element_first, b.makeUintConstant(i));
+    auto cond = b.createBinOp(
+        spv::Op::OpLogicalAnd, bool_type_, in_stream,
+        b.createBinOp(spv::Op::OpLogicalAnd, bool_type_,
+                      b.createBinOp(spv::Op::OpULessThan, bool_type_,
+                                    b.makeUintConstant(i), word_count),
+                      b.createBinOp(spv::Op::OpULessThan, bool_type_,
+                                    word_index, range_end)));
+    spv::Builder::If word_if(cond, b);
+    b.createStore(words[i],
+                  b.createAccessChain(
+                      spv::StorageClass::StorageClassUniform,
+                      memexport_buffer_,
+                      std::vector<Id>({b.makeUintConstant(0), word_index})));
+    word_if.makeEndIf();
+  }
 }
 
 }  // namespace gpu
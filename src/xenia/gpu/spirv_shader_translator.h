@@ -10,6 +10,7 @@
 #ifndef XENIA_GPU_SPIRV_SHADER_TRANSLATOR_H_
 #define XENIA_GPU_SPIRV_SHADER_TRANSLATOR_H_
 
+#include <cstddef>
 #include <memory>
 #include <string>
 #include <vector>
@@ -35,6 +36,15 @@ struct SpirvPushConstants {
   // Accessible to fragment shader only:
   float alpha_test[4];  // alpha test enable, func, ref, ?
   uint32_t ps_param_gen;
+
+  // Accessible to both:
+  // Byte per fetch constant with the index of its immutable sampler, or
+  // kSpirvFetchSamplerIndex to use the sampler bound for the fetch constant.
+  uint32_t sampler_indices[8];
+
+  // Accessible to vertex shader only:
+  // First and end dword of the memexport storage buffer range of the draw.
+  uint32_t memexport_range[2];
 };
 static_assert(sizeof(SpirvPushConstants) <= 128,
               "Push constants must fit <= 128b");
@@ -44,13 +54,25 @@ constexpr uint32_t kSpirvPushConstantFragmentRangeOffset =
     kSpirvPushConstantVertexRangeSize;
 constexpr uint32_t kSpirvPushConstantFragmentRangeSize =
     (sizeof(float) * 4) + sizeof(uint32_t);
+constexpr uint32_t kSpirvPushConstantSamplerIndicesOffset =
+    offsetof(SpirvPushConstants, sampler_indices);
+constexpr uint32_t kSpirvPushConstantMemExportRangeOffset =
+    offsetof(SpirvPushConstants, memexport_range);
 constexpr uint32_t kSpirvPushConstantsSize = sizeof(SpirvPushConstants);
 
+// Samplers in the immutable sampler table of the texture descriptor set.
+constexpr uint32_t kSpirvImmutableSamplerCount = 72;
+constexpr uint32_t kSpirvFetchSamplerIndex = 0xFF;
+
 class SpirvShaderTranslator : public ShaderTranslator {
  public:
   SpirvShaderTranslator();
   ~SpirvShaderTranslator() override;
 
+  // Whether eM# writes are stored to the memexport storage buffer, which
+  // needs vertexPipelineStoresAndAtomics. Otherwise they're dropped.
+  void set_memexport_enabled(bool enabled) { memexport_enabled_ = enabled; }
+
  protected:
   void StartTranslation() override;
   std::vector<uint8_t> CompleteTranslation() override;
@@ -82,6 +104,12 @@ class SpirvShaderTranslator : public ShaderTranslator {
   void ProcessVectorAluInstruction(const ParsedAluInstruction& instr);
   void ProcessScalarAluInstruction(const ParsedAluInstruction& instr);
 
+  // Swaps the raw guest words of a vertex fetch (Endian::k8in32) and decodes
+  // them to a float vector of the format's component count.
+  spv::Id DecodeVertexWords(
+      spv::Id words,
+      const ParsedVertexFetchInstruction::Attributes& attributes);
+
   // Creates a call to the given GLSL intrinsic.
   spv::Id SpirvShaderTranslator::CreateGlslStd450InstructionCall(
       spv::Decoration precision, spv::Id result_type,
@@ -95,6 +123,9 @@ class SpirvShaderTranslator : public ShaderTranslator {
   // The value will be transformed into the appropriate form for the result and
   // the proper components will be selected.
   void StoreToResult(spv::Id source_value_id, const InstructionResult& result);
+  // Writes eM# with the element address in eA to the memexport storage
+  // buffer, packed to the format in eA.
+  void EmitMemExport(uint32_t index);
 
   xe::ui::spirv::SpirvDisassembler disassembler_;
   xe::ui::spirv::SpirvValidator validator_;
@@ -131,8 +162,13 @@ class SpirvShaderTranslator : public ShaderTranslator {
   spv::Id interpolators_ = 0;
   spv::Id vertex_id_ = 0;
   spv::Id frag_outputs_ = 0, frag_depth_ = 0;
-  spv::Id samplers_ = 0;
+  spv::Id samplers_ = 0;        // Immutable sampler table
+  spv::Id fetch_samplers_ = 0;  // Samplers of the fetch constants
   spv::Id tex_[4] = {0};  // Images {1D, 2D, 3D, Cube}
+  spv::Id memexport_address_ = 0;  // eA
+  spv::Id memexport_data_ = 0;     // eM0-4
+  spv::Id memexport_buffer_ = 0;   // Created on the first export
+  bool memexport_enabled_ = true;
 
   // SPIR-V IDs that are part of the in/out interface.
   std::vector<spv::Id> interface_ids_;
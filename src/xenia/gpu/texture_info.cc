@@ -9,6 +9,8 @@
 
 #include "xenia/gpu/texture_info.h"
 
+#include <emmintrin.h>
+
 #include <algorithm>
 #include <cstring>
 
@@ -330,6 +332,216 @@ uint32_t TextureInfo::TiledOffset2DInner(uint32_t x, uint32_t y, uint32_t bpp,
          ((y & 16) << 7) + (((((y & 8) >> 2) + (x >> 3)) & 3) << 6);
 }
 
+// Swaps the bytes of texture data in a vector as the endianness requires.
+template <Endian endianness>
+static inline __m128i SwapTexels(__m128i value) {
+  switch (endianness) {
+    case Endian::k8in16:
+      return _mm_or_si128(_mm_slli_epi16(value, 8), _mm_srli_epi16(value, 8));
+    case Endian::k8in32: {
+      __m128i result =
+          _mm_or_si128(_mm_slli_epi32(value, 24), _mm_srli_epi32(value, 24));
+      result = _mm_or_si128(result,
+                            _mm_and_si128(_mm_slli_epi32(value, 8),
+                                          _mm_set1_epi32(0x00FF0000)));
+      return _mm_or_si128(result,
+                          _mm_and_si128(_mm_srli_epi32(value, 8),
+                                        _mm_set1_epi32(0x0000FF00)));
+    }
+    case Endian::k16in32:
+      return _mm_or_si128(_mm_slli_epi32(value, 16),
+                          _mm_srli_epi32(value, 16));
+    default:
+      return value;
+  }
+}
+
+template <Endian endianness>
+static void UntileRuns(const uint8_t* src, uint32_t input_width, uint8_t* dest,
+                       uint32_t output_pitch, uint32_t block_width,
+                       uint32_t log_bpp, uint32_t offset_x, uint32_t offset_y,
+                       uint32_t first_row, uint32_t end_row) {
+  // Within a row, each aligned group of 16 bytes of blocks is contiguous in
+  // the tiled layout too - except for 1 byte blocks, where the base offset of
+  // odd row pairs is only 8 byte aligned.
+  bool full_vectors = log_bpp != 0;
+  uint32_t run_blocks = full_vectors ? 16u >> log_bpp : 8u;
+  for (uint32_t y = first_row; y < end_row; ++y, dest += output_pitch) {
+    uint32_t tiled_y = offset_y + y;
+    uint32_t input_base_offset =
+        TextureInfo::TiledOffset2DOuter(tiled_y, input_width, log_bpp);
+    for (uint32_t x = 0; x < block_width;) {
+      uint32_t tiled_x = offset_x + x;
+      uint32_t run_x = tiled_x & ~(run_blocks - 1);
+      uint32_t skip = tiled_x - run_x;
+      uint32_t count = std::min(run_blocks - skip, block_width - x);
+      auto run_src = reinterpret_cast<const __m128i*>(
+          src + TextureInfo::TiledOffset2DInner(run_x, tiled_y, log_bpp,
+                                                input_base_offset));
+      __m128i value = SwapTexels<endianness>(
+          full_vectors ? _mm_loadu_si128(run_src) : _mm_loadl_epi64(run_src));
+      uint8_t* run_dest = dest + (x << log_bpp);
+      if (count == run_blocks) {
+        if (full_vectors) {
+          _mm_storeu_si128(reinterpret_cast<__m128i*>(run_dest), value);
+        } else {
+          _mm_storel_epi64(reinterpret_cast<__m128i*>(run_dest), value);
+        }
+      } else {
+        // Partial run at the edge of a packed mip.
+        alignas(16) uint8_t run[16];
+        _mm_store_si128(reinterpret_cast<__m128i*>(run), value);
+        std::memcpy(run_dest, run + (skip << log_bpp), count << log_bpp);
+      }
+      x += count;
+    }
+  }
+}
+
+template <Endian endianness>
+static void Untile96BitBlocks(const uint8_t* src, uint32_t input_width,
+                              uint8_t* dest, uint32_t output_pitch,
+                              uint32_t block_width, uint32_t log_bpp,
+                              uint32_t offset_x, uint32_t offset_y,
+                              uint32_t first_row, uint32_t end_row) {
+  // Tiled as if they were 8 bytes, so blocks are addressed individually.
+  for (uint32_t y = first_row; y < end_row; ++y, dest += output_pitch) {
+    uint32_t input_base_offset =
+        TextureInfo::TiledOffset2DOuter(offset_y + y, input_width, log_bpp);
+    for (uint32_t x = 0; x < block_width; ++x) {
+      uint32_t input_offset =
+          TextureInfo::TiledOffset2DInner(offset_x + x, offset_y + y, log_bpp,
+                                          input_base_offset) >>
+          log_bpp;
+      const uint8_t* block_src = src + input_offset * 12;
+      uint8_t* block_dest = dest + x * 12;
+      uint32_t high;
+      std::memcpy(&high, block_src + 8, sizeof(high));
+      __m128i value = _mm_unpacklo_epi64(
+          _mm_loadl_epi64(reinterpret_cast<const __m128i*>(block_src)),
+          _mm_cvtsi32_si128(int(high)));
+      value = SwapTexels<endianness>(value);
+      _mm_storel_epi64(reinterpret_cast<__m128i*>(block_dest), value);
+      high = uint32_t(_mm_cvtsi128_si32(_mm_srli_si128(value, 8)));
+      std::memcpy(block_dest + 8, &high, sizeof(high));
+    }
+  }
+}
+
+template <Endian endianness>
+static void UntileWithEndian(const uint8_t* src, uint32_t input_width,
+                             uint8_t* dest, uint32_t output_pitch,
+                             uint32_t block_width, uint32_t bytes_per_block,
+                             uint32_t offset_x, uint32_t offset_y,
+                             uint32_t first_row, uint32_t end_row) {
+  uint32_t log_bpp = (bytes_per_block >> 2) +
+                     ((bytes_per_block >> 1) >> (bytes_per_block >> 2));
+  if (bytes_per_block == 1u << log_bpp) {
+    UntileRuns<endianness>(src, input_width, dest, output_pitch, block_width,
+                           log_bpp, offset_x, offset_y, first_row, end_row);
+  } else {
+    assert_true(bytes_per_block == 12);
+    Untile96BitBlocks<endianness>(src, input_width, dest, output_pitch,
+                                  block_width, log_bpp, offset_x, offset_y,
+                                  first_row, end_row);
+  }
+}
+
+void TextureInfo::Untile(Endian endianness, const uint8_t* src,
+                         uint32_t input_width, uint8_t* dest,
+                         uint32_t output_pitch, uint32_t block_width,
+                         uint32_t bytes_per_block, uint32_t offset_x,
+                         uint32_t offset_y, uint32_t first_row,
+                         uint32_t end_row) {
+  if (!bytes_per_block || bytes_per_block > 16) {
+    return;
+  }
+  switch (endianness) {
+    case Endian::k8in16:
+      UntileWithEndian<Endian::k8in16>(src, input_width, dest, output_pitch,
+                                       block_width, bytes_per_block, offset_x,
+                                       offset_y, first_row, end_row);
+      break;
+    case Endian::k8in32:
+      UntileWithEndian<Endian::k8in32>(src, input_width, dest, output_pitch,
+                                       block_width, bytes_per_block, offset_x,
+                                       offset_y, first_row, end_row);
+      break;
+    case Endian::k16in32:
+      UntileWithEndian<Endian::k16in32>(src, input_width, dest, output_pitch,
+                                        block_width, bytes_per_block,
+                                        offset_x, offset_y, first_row, end_row);
+      break;
+    default:
+      UntileWithEndian<Endian::kUnspecified>(
+          src, input_width, dest, output_pitch, block_width, bytes_per_block,
+          offset_x, offset_y, first_row, end_row);
+      break;
+  }
+}
+
+bool TextureInfo::UpdateContentPages(const uint8_t* data,
+                                     std::vector<uint64_t>* hashes,
+                                     uint32_t* out_offset,
+                                     uint32_t* out_length) const {
+  uint32_t page_count =
+      xe::round_up(input_length, kContentPageSize) / kContentPageSize;
+  bool is_new = hashes->size() != page_count;
+  hashes->resize(page_count);
+  uint32_t first_page = page_count;
+  uint32_t end_page = 0;
+  for (uint32_t i = 0; i < page_count; ++i) {
+    uint32_t page_offset = i * kContentPageSize;
+    uint64_t hash =
+        XXH64(data + page_offset,
+              std::min(input_length - page_offset, uint32_t(kContentPageSize)),
+              0);
+    if (is_new || hash != (*hashes)[i]) {
+      (*hashes)[i] = hash;
+      first_page = std::min(first_page, i);
+      end_page = i + 1;
+    }
+  }
+  if (first_page >= end_page) {
+    return false;
+  }
+  *out_offset = first_page * kContentPageSize;
+  *out_length =
+      std::min(end_page * kContentPageSize, input_length) - *out_offset;
+  return true;
+}
+
+void TextureInfo::GetBlockRowsForRange(uint32_t offset, uint32_t length,
+                                       uint32_t* out_first_row,
+                                       uint32_t* out_row_count) const {
+  uint32_t row_count = size_2d.output_height / format_info->block_height;
+  uint32_t first_row = 0;
+  uint32_t end_row = row_count;
+  if (!is_tiled) {
+    first_row = offset / size_2d.input_pitch;
+    end_row = xe::round_up(offset + length, size_2d.input_pitch) /
+              size_2d.input_pitch;
+  } else {
+    // Rows of 32x32 block tiles are stored one after another, though the
+    // swizzle moves some blocks up to 1536 bytes into the neighboring tile
+    // rows; a page of slack covers that. Packed mips are always taken whole.
+    uint32_t offset_x;
+    uint32_t offset_y;
+    GetPackedTileOffset(*this, &offset_x, &offset_y);
+    if (!offset_x && !offset_y) {
+      uint32_t tile_row_length = size_2d.input_pitch * 32;
+      uint32_t start = offset - std::min(offset, uint32_t(kContentPageSize));
+      uint32_t end = offset + length + kContentPageSize;
+      first_row = start / tile_row_length * 32;
+      end_row = xe::round_up(end, tile_row_length) / tile_row_length * 32;
+    }
+  }
+  end_row = std::min(end_row, row_count);
+  first_row = std::min(first_row, end_row);
+  *out_first_row = first_row;
+  *out_row_count = end_row - first_row;
+}
+
 uint64_t TextureInfo::hash() const {
   return XXH64(this, sizeof(TextureInfo), 0);
 }
@@ -12,6 +12,7 @@
 
 #include <cstring>
 #include <memory>
+#include <vector>
 
 #include "xenia/base/assert.h"
 #include "xenia/gpu/xenos.h"
@@ -273,6 +274,34 @@ struct TextureInfo {
                                      uint32_t log_bpp);
   static uint32_t TiledOffset2DInner(uint32_t x, uint32_t y, uint32_t bpp,
                                      uint32_t base_offset);
+  // Untiles rows first_row to end_row of a tiled 2D texture (or of one cube
+  // face) at src into linear rows output_pitch bytes apart at dest, swapping
+  // endianness. input_width is the width of the tiled rows and block_width
+  // the number of blocks to copy from each, both in blocks. Offsets from
+  // GetPackedTileOffset are applied to every block.
+  // Blocks that stay contiguous when tiled are moved 16 bytes at a time with
+  // SSE, so the tiled address is only computed once per run of blocks.
+  static void Untile(Endian endianness, const uint8_t* src,
+                     uint32_t input_width, uint8_t* dest,
+                     uint32_t output_pitch, uint32_t block_width,
+                     uint32_t bytes_per_block, uint32_t offset_x,
+                     uint32_t offset_y, uint32_t first_row,
+                     uint32_t end_row);
+
+  // Guest data is hashed in pages of this size, so that when a write watch
+  // fires only the parts that actually changed need to be reuploaded.
+  static const uint32_t kContentPageSize = 4096;
+  // Rehashes every page of the guest data at data (input_length bytes),
+  // updating hashes, and returns the range of guest bytes covering all pages
+  // whose hash changed. An empty hashes vector is filled in and returns the
+  // whole texture. Returns false if nothing changed.
+  bool UpdateContentPages(const uint8_t* data, std::vector<uint64_t>* hashes,
+                          uint32_t* out_offset, uint32_t* out_length) const;
+  // Returns the rows of blocks of a 2D texture that are read from the given
+  // range of guest bytes. Rows that aren't may be included.
+  void GetBlockRowsForRange(uint32_t offset, uint32_t length,
+                            uint32_t* out_first_row,
+                            uint32_t* out_row_count) const;
 
   uint64_t hash() const;
   bool operator==(const TextureInfo& other) const {
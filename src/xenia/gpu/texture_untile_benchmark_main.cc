@@ -0,0 +1,173 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2016 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#include <gflags/gflags.h>
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+#include "xenia/base/clock.h"
+#include "xenia/base/logging.h"
+#include "xenia/base/main.h"
+#include "xenia/base/math.h"
+#include "xenia/base/memory.h"
+#include "xenia/gpu/texture_info.h"
+
+DEFINE_int32(untile_benchmark_size, 1024,
+             "Width and height in texels of the textures untiled.");
+DEFINE_int32(untile_benchmark_iterations, 16,
+             "Number of times every texture is untiled.");
+DEFINE_int32(untile_benchmark_endian, 2,
+             "Endianness of the texture data (0-3, as in fetch constants).");
+
+namespace xe {
+namespace gpu {
+namespace test {
+
+// Same as the backends do per block.
+void TextureSwap(Endian endianness, void* dest, const void* src,
+                 size_t length) {
+  switch (endianness) {
+    case Endian::k8in16:
+      xe::copy_and_swap_16_aligned(dest, src, length / 2);
+      break;
+    case Endian::k8in32:
+      xe::copy_and_swap_32_aligned(dest, src, length / 4);
+      break;
+    case Endian::k16in32:
+      for (size_t i = 0; i + 4 <= length; i += 4) {
+        uint32_t value;
+        std::memcpy(&value, reinterpret_cast<const uint8_t*>(src) + i, 4);
+        value = (value >> 16) | (value << 16);
+        std::memcpy(reinterpret_cast<uint8_t*>(dest) + i, &value, 4);
+      }
+      break;
+    default:
+      std::memcpy(dest, src, length);
+      break;
+  }
+}
+
+// The per-block loop TextureInfo::Untile replaced.
+void UntileScalar(Endian endianness, const uint8_t* src, uint32_t input_width,
+                  uint8_t* dest, uint32_t output_pitch, uint32_t block_width,
+                  uint32_t bytes_per_block, uint32_t offset_x,
+                  uint32_t offset_y, uint32_t first_row, uint32_t end_row) {
+  auto bpp = (bytes_per_block >> 2) +
+             ((bytes_per_block >> 1) >> (bytes_per_block >> 2));
+  for (uint32_t y = first_row, output_base_offset = 0; y < end_row;
+       y++, output_base_offset += output_pitch) {
+    auto input_base_offset =
+        TextureInfo::TiledOffset2DOuter(offset_y + y, input_width, bpp);
+    for (uint32_t x = 0, output_offset = output_base_offset; x < block_width;
+         x++, output_offset += bytes_per_block) {
+      auto input_offset = TextureInfo::TiledOffset2DInner(
+                              offset_x + x, offset_y + y, bpp,
+                              input_base_offset) >>
+                          bpp;
+      TextureSwap(endianness, dest + output_offset,
+                  src + input_offset * bytes_per_block, bytes_per_block);
+    }
+  }
+}
+
+int main(const std::vector<std::wstring>& args) {
+  auto endianness = Endian(FLAGS_untile_benchmark_endian & 3);
+  uint32_t size = uint32_t(std::max(FLAGS_untile_benchmark_size, 32));
+  int32_t iterations = std::max(FLAGS_untile_benchmark_iterations, 1);
+  double ticks_to_us = 1000000.0 / Clock::host_tick_frequency();
+
+  std::printf("%-24s %10s %10s %8s %s\n", "format", "scalar_us", "batched_us",
+              "speedup", "result");
+  int mismatch_count = 0;
+  for (uint32_t i = 0; i < 64; ++i) {
+    auto format_info = FormatInfo::Get(i);
+    uint32_t bytes_per_block = format_info->block_width *
+                               format_info->block_height *
+                               format_info->bits_per_pixel / 8;
+    if (!bytes_per_block || bytes_per_block > 16) {
+      continue;
+    }
+    uint32_t block_width = size / format_info->block_width;
+    uint32_t block_height = size / format_info->block_height;
+    // Packed mips may start up to 16 texels into the tile. With small blocks
+    // the tiled addresses of an odd number of 32x32 block tiles can go past
+    // the end, so pairs of tiles are kept whole.
+    uint32_t input_width = xe::round_up(block_width + 16, 64);
+    uint32_t input_height = xe::round_up(block_height + 16, 64);
+    uint32_t output_pitch = block_width * bytes_per_block;
+    std::vector<uint8_t> src(input_width * input_height * bytes_per_block);
+    for (size_t j = 0; j < src.size(); ++j) {
+      src[j] = uint8_t(j * 2654435761u >> 13);
+    }
+    std::vector<uint8_t> scalar_dest(output_pitch * block_height);
+    std::vector<uint8_t> batched_dest(output_pitch * block_height);
+
+    uint64_t start = Clock::QueryHostTickCount();
+    for (int32_t j = 0; j < iterations; ++j) {
+      UntileScalar(endianness, src.data(), input_width, scalar_dest.data(),
+                   output_pitch, block_width, bytes_per_block, 0, 0, 0,
+                   block_height);
+    }
+    uint64_t scalar_ticks = Clock::QueryHostTickCount() - start;
+    start = Clock::QueryHostTickCount();
+    for (int32_t j = 0; j < iterations; ++j) {
+      TextureInfo::Untile(endianness, src.data(), input_width,
+                          batched_dest.data(), output_pitch, block_width,
+                          bytes_per_block, 0, 0, 0, block_height);
+    }
+    uint64_t batched_ticks = Clock::QueryHostTickCount() - start;
+
+    // Check against untiling data swapped up front, which is what the swap
+    // means for blocks smaller than the swapped words too. A packed mip
+    // offset exercises the partial runs at the edges.
+    std::vector<uint8_t> swapped_src(src.size());
+    TextureSwap(endianness, swapped_src.data(), src.data(), src.size());
+    bool matches = true;
+    for (uint32_t offset = 0; offset <= 16 && matches; offset += 16) {
+      uint32_t offset_x = offset / format_info->block_width;
+      uint32_t offset_y = offset / format_info->block_height;
+      UntileScalar(Endian::kUnspecified, swapped_src.data(), input_width,
+                   scalar_dest.data(), output_pitch, block_width,
+                   bytes_per_block, offset_x, offset_y, 0, block_height);
+      TextureInfo::Untile(endianness, src.data(), input_width,
+                          batched_dest.data(), output_pitch, block_width,
+                          bytes_per_block, offset_x, offset_y, 0,
+                          block_height);
+      matches = scalar_dest == batched_dest;
+    }
+    if (!matches) {
+      ++mismatch_count;
+    }
+
+    double scalar_us = scalar_ticks * ticks_to_us / iterations;
+    double batched_us = batched_ticks * ticks_to_us / iterations;
+    char name[32];
+    std::snprintf(name, sizeof(name), "%u (%ux%u, %u bytes)", i,
+                  format_info->block_width, format_info->block_height,
+                  bytes_per_block);
+    std::printf("%-24s %10.1f %10.1f %7.2fx %s\n", name, scalar_us,
+                batched_us, batched_us > 0.0 ? scalar_us / batched_us : 0.0,
+                matches ? "ok" : "MISMATCH");
+  }
+  if (mismatch_count) {
+    XELOGE("%d formats untiled differently", mismatch_count);
+    return 1;
+  }
+  return 0;
+}
+
+}  // namespace test
+}  // namespace gpu
+}  // namespace xe
+
+DEFINE_ENTRY_POINT(L"xenia-gpu-texture-untile-benchmark",
+                   L"xenia-gpu-texture-untile-benchmark", xe::gpu::test::main);
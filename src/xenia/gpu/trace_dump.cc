@@ -11,7 +11,14 @@
 
 #include <gflags/gflags.h>
 
+#include <algorithm>
+#include <cinttypes>
+#include <cstdio>
+#include <vector>
+
 #include "third_party/stb/stb_image_write.h"
+#include "xenia/base/clock.h"
+#include "xenia/base/filesystem.h"
 #include "xenia/base/logging.h"
 #include "xenia/base/profiling.h"
 #include "xenia/base/string.h"
@@ -30,6 +37,13 @@
 
 DEFINE_string(target_trace_file, "", "Specifies the trace file to load.");
 DEFINE_string(trace_dump_path, "", "Output path for dumped files.");
+DEFINE_bool(trace_dump_benchmark, false,
+            "Replay the trace without presenting and write timings and cache "
+            "hit rates to <trace_dump_path>/<trace>.benchmark.json instead "
+            "of capturing it.");
+DEFINE_int32(trace_dump_benchmark_iterations, 10,
+             "Number of times the trace is replayed when benchmarking. Caches "
+             "are cleared before the first.");
 
 namespace xe {
 namespace gpu {
@@ -100,7 +114,11 @@ int TraceDump::Main(const std::vector<std::wstring>& args) {
   // Ensure output path exists.
   xe::filesystem::CreateParentFolder(base_output_path_);
 
-  Run();
+  if (FLAGS_trace_dump_benchmark) {
+    RunBenchmark();
+  } else {
+    Run();
+  }
   return 0;
 }
 
@@ -228,5 +246,135 @@ void TraceDump::Run() {
   // TODO(benvanik): die if failed to capture?
 }
 
+void TraceDump::RunBenchmark() {
+  auto command_processor = graphics_system_->command_processor();
+  int32_t iterations = std::max(FLAGS_trace_dump_benchmark_iterations, 1);
+
+  // Stats may only be touched on the command processor thread. Cache counters
+  // are never reset, so only what changed during playback is reported.
+  std::vector<CacheStats> start_cache_stats;
+  std::vector<CacheStats> end_cache_stats;
+  CommandProcessorStats stats;
+  xe::threading::Fence stats_fence;
+  command_processor->CallInThread([&]() {
+    command_processor->ResetStats();
+    command_processor->set_stats_enabled(true);
+    command_processor->GetCacheStats(&start_cache_stats);
+    stats_fence.Signal();
+  });
+  stats_fence.Wait();
+
+  std::vector<uint64_t> iteration_ticks;
+  for (int32_t i = 0; i < iterations; ++i) {
+    uint64_t start_ticks = Clock::QueryHostTickCount();
+    player_->PlayAllFrames(i == 0);
+    player_->WaitOnPlayback();
+    iteration_ticks.push_back(Clock::QueryHostTickCount() - start_ticks);
+  }
+
+  command_processor->CallInThread([&]() {
+    command_processor->set_stats_enabled(false);
+    stats = command_processor->stats();
+    command_processor->GetCacheStats(&end_cache_stats);
+    stats_fence.Signal();
+  });
+  stats_fence.Wait();
+
+  auto json_path = base_output_path_ + L".benchmark.json";
+  FILE* file = xe::filesystem::OpenFile(json_path, "w");
+  if (!file) {
+    XELOGE("Unable to open %ls", json_path.c_str());
+  } else {
+    double ticks_to_us = 1000000.0 / Clock::host_tick_frequency();
+    fprintf(file, "{\n");
+    fprintf(file, "  \"trace\": \"%s\",\n",
+            xe::to_string(xe::find_name_from_path(trace_file_path_)).c_str());
+    fprintf(file, "  \"iterations\": %d,\n", iterations);
+    fprintf(file, "  \"iteration_ms\": [");
+    for (size_t i = 0; i < iteration_ticks.size(); ++i) {
+      fprintf(file, "%s%.3f", i ? ", " : "",
+              iteration_ticks[i] * ticks_to_us / 1000.0);
+    }
+    fprintf(file, "],\n");
+
+    // Host time spent on the command processor thread executing packets.
+    fprintf(file, "  \"packet_types\": [\n");
+    for (uint32_t i = 0; i < 4; ++i) {
+      auto& type_stats = stats.packet_types[i];
+      fprintf(file,
+              "    {\"type\": %u, \"count\": %" PRIu64
+              ", \"time_us\": %.1f}%s\n",
+              i, type_stats.count, type_stats.host_ticks * ticks_to_us,
+              i + 1 < 4 ? "," : "");
+    }
+    fprintf(file, "  ],\n");
+    fprintf(file, "  \"type3_opcodes\": [");
+    bool first_opcode = true;
+    for (uint32_t i = 0; i < 128; ++i) {
+      auto& opcode_stats = stats.type3_opcodes[i];
+      if (!opcode_stats.count) {
+        continue;
+      }
+      fprintf(file,
+              "%s\n    {\"opcode\": \"0x%.2X\", \"count\": %" PRIu64
+              ", \"time_us\": %.1f}",
+              first_opcode ? "" : ",", i, opcode_stats.count,
+              opcode_stats.host_ticks * ticks_to_us);
+      first_opcode = false;
+    }
+    fprintf(file, "\n  ],\n");
+    auto& draw_indx_stats = stats.type3_opcodes[PM4_DRAW_INDX];
+    auto& draw_indx_2_stats = stats.type3_opcodes[PM4_DRAW_INDX_2];
+    uint64_t draw_count = draw_indx_stats.count + draw_indx_2_stats.count;
+    uint64_t draw_ticks =
+        draw_indx_stats.host_ticks + draw_indx_2_stats.host_ticks;
+    double draw_us = draw_ticks * ticks_to_us;
+    fprintf(file,
+            "  \"draws\": {\"count\": %" PRIu64
+            ", \"time_us\": %.1f, \"us_per_draw\": %.3f},\n",
+            draw_count, draw_us, draw_count ? draw_us / draw_count : 0.0);
+
+    // Only backends with timestamp support measure GPU time.
+    if (stats.gpu_frame_count) {
+      double gpu_ms = stats.gpu_nanoseconds / 1000000.0;
+      fprintf(file,
+              "  \"gpu\": {\"frames\": %" PRIu64
+              ", \"time_ms\": %.3f, \"ms_per_frame\": %.3f},\n",
+              stats.gpu_frame_count, gpu_ms, gpu_ms / stats.gpu_frame_count);
+    } else {
+      fprintf(file, "  \"gpu\": null,\n");
+    }
+
+    fprintf(file, "  \"caches\": [");
+    for (size_t i = 0; i < end_cache_stats.size(); ++i) {
+      auto& cache_stats = end_cache_stats[i];
+      uint64_t hits = cache_stats.hit_count;
+      uint64_t misses = cache_stats.miss_count;
+      if (i < start_cache_stats.size()) {
+        hits -= start_cache_stats[i].hit_count;
+        misses -= start_cache_stats[i].miss_count;
+      }
+      fprintf(file,
+              "%s\n    {\"name\": \"%s\", \"hits\": %" PRIu64
+              ", \"misses\": %" PRIu64 ", \"hit_rate\": %.4f}",
+              i ? "," : "", cache_stats.name, hits, misses,
+              hits + misses ? double(hits) / (hits + misses) : 0.0);
+    }
+    fprintf(file, "\n  ]\n");
+    fprintf(file, "}\n");
+    fclose(file);
+    XELOGI("Wrote benchmark results to %ls", json_path.c_str());
+  }
+
+  loop_->Quit();
+  loop_->AwaitQuit();
+
+  Profiler::Shutdown();
+  window_.reset();
+  loop_.reset();
+  player_.reset();
+  emulator_.reset();
+}
+
 }  //  namespace gpu
 }  //  namespace xe
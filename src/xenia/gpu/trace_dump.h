@@ -63,6 +63,9 @@ class TraceDump {
   bool Setup();
   bool Load(std::wstring trace_file_path);
   void Run();
+  // Replays the whole trace without presenting and writes timings and cache
+  // stats as JSON.
+  void RunBenchmark();
 
   std::wstring trace_file_path_;
   std::wstring base_output_path_;
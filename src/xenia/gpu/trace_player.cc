@@ -9,7 +9,10 @@
 
 #include "xenia/gpu/trace_player.h"
 
+#include <cstring>
+
 #include "xenia/gpu/command_processor.h"
+#include "xenia/gpu/gpu_flags.h"
 #include "xenia/gpu/graphics_system.h"
 #include "xenia/memory.h"
 
@@ -46,6 +49,7 @@ void TracePlayer::SeekFrame(int target_frame) {
     return;
   }
   current_frame_index_ = target_frame;
+  checkpoints_.clear();
   auto frame = current_frame();
   current_command_index_ = int(frame->commands.size()) - 1;
 
@@ -73,10 +77,35 @@ void TracePlayer::SeekCommand(int target_command) {
               command.end_ptr - previous_command.end_ptr,
               TracePlaybackMode::kBreakOnSwap, false);
   } else {
-    // Full playback from frame start.
-    PlayTrace(frame->start_ptr, command.end_ptr - frame->start_ptr,
-              TracePlaybackMode::kBreakOnSwap, true);
+    // Rewind to the last checkpoint at or before the command, if any.
+    int checkpoint_index = -1;
+    while (checkpoint_index + 1 < int(checkpoints_.size()) &&
+           checkpoints_[checkpoint_index + 1].trace_ptr <= command.end_ptr) {
+      ++checkpoint_index;
+    }
+    if (checkpoint_index != -1) {
+      auto checkpoint_ptr = checkpoints_[checkpoint_index].trace_ptr;
+      PlayTrace(checkpoint_ptr, command.end_ptr - checkpoint_ptr,
+                TracePlaybackMode::kBreakOnSwap, false, checkpoint_index);
+    } else {
+      // Full playback from frame start.
+      PlayTrace(frame->start_ptr, command.end_ptr - frame->start_ptr,
+                TracePlaybackMode::kBreakOnSwap, true);
+    }
+  }
+}
+
+void TracePlayer::PlayAllFrames(bool clear_caches) {
+  if (!frame_count()) {
+    playback_event_->Set();
+    return;
   }
+  auto first_frame = frame(0);
+  auto last_frame = frame(frame_count() - 1);
+  assert_true(first_frame->start_ptr <= last_frame->end_ptr);
+  PlayTrace(first_frame->start_ptr,
+            last_frame->end_ptr - first_frame->start_ptr,
+            TracePlaybackMode::kBenchmark, clear_caches);
 }
 
 void TracePlayer::WaitOnPlayback() {
@@ -84,26 +113,38 @@ void TracePlayer::WaitOnPlayback() {
 }
 
 void TracePlayer::PlayTrace(const uint8_t* trace_data, size_t trace_size,
-                            TracePlaybackMode playback_mode,
-                            bool clear_caches) {
+                            TracePlaybackMode playback_mode, bool clear_caches,
+                            int checkpoint_index) {
   playing_trace_ = true;
   graphics_system_->command_processor()->CallInThread([=]() {
-    PlayTraceOnThread(trace_data, trace_size, playback_mode, clear_caches);
+    PlayTraceOnThread(trace_data, trace_size, playback_mode, clear_caches,
+                      checkpoint_index);
   });
 }
 
 void TracePlayer::PlayTraceOnThread(const uint8_t* trace_data,
                                     size_t trace_size,
                                     TracePlaybackMode playback_mode,
-                                    bool clear_caches) {
+                                    bool clear_caches, int checkpoint_index) {
   auto memory = graphics_system_->memory();
   auto command_processor = graphics_system_->command_processor();
 
   if (clear_caches) {
     command_processor->ClearCaches();
+    // The shaders the checkpoints refer to are gone.
+    checkpoints_.clear();
+  }
+  if (checkpoint_index != -1) {
+    RestoreCheckpoint(checkpoints_[checkpoint_index]);
   }
+  // Only single frames are played from a consistent state of the frame.
+  bool record_checkpoints = playback_mode == TracePlaybackMode::kBreakOnSwap &&
+                            FLAGS_trace_checkpoint_interval > 0;
+  int packets_since_checkpoint = 0;
 
-  command_processor->set_swap_mode(SwapMode::kIgnored);
+  command_processor->set_swap_mode(
+      playback_mode == TracePlaybackMode::kBenchmark ? SwapMode::kSubmitOnly
+                                                     : SwapMode::kIgnored);
   playback_percent_ = 0;
   auto trace_end = trace_data + trace_size;
 
@@ -160,6 +201,11 @@ void TracePlayer::PlayTraceOnThread(const uint8_t* trace_data,
           command_processor->ExecutePacket(pending_packet->base_ptr,
                                            pending_packet->count);
           pending_packet = nullptr;
+          if (record_checkpoints && ++packets_since_checkpoint >=
+                                        FLAGS_trace_checkpoint_interval) {
+            packets_since_checkpoint = 0;
+            SaveCheckpoint(trace_ptr);
+          }
         }
         if (pending_break) {
           playing_trace_ = false;
@@ -201,10 +247,94 @@ void TracePlayer::PlayTraceOnThread(const uint8_t* trace_data,
 
   playing_trace_ = false;
   command_processor->set_swap_mode(SwapMode::kNormal);
-  command_processor->IssueSwap(0, 1280, 720);
+  if (playback_mode != TracePlaybackMode::kBenchmark) {
+    command_processor->IssueSwap(0, 1280, 720);
+  }
 
   playback_event_->Set();
 }
 
+void TracePlayer::SaveCheckpoint(const uint8_t* trace_ptr) {
+  // Playback after rewinding passes checkpoints that already exist.
+  if (!checkpoints_.empty() && checkpoints_.back().trace_ptr >= trace_ptr) {
+    return;
+  }
+  auto command_processor = graphics_system_->command_processor();
+  auto regs = graphics_system_->register_file();
+  Checkpoint checkpoint;
+  checkpoint.trace_ptr = trace_ptr;
+  checkpoint.registers.resize(RegisterFile::kRegisterCount);
+  std::memcpy(checkpoint.registers.data(), regs->values,
+              sizeof(regs->values));
+  checkpoint.vertex_shader = command_processor->active_vertex_shader();
+  checkpoint.pixel_shader = command_processor->active_pixel_shader();
+  checkpoints_.push_back(std::move(checkpoint));
+}
+
+void TracePlayer::RestoreCheckpoint(const Checkpoint& checkpoint) {
+  ReplayMemoryCommands(current_frame()->start_ptr, checkpoint.trace_ptr);
+  auto regs = graphics_system_->register_file();
+  std::memcpy(regs->values, checkpoint.registers.data(), sizeof(regs->values));
+  regs->MarkDirtyRange(0, uint32_t(RegisterFile::kRegisterCount));
+  graphics_system_->command_processor()->set_active_shaders(
+      checkpoint.vertex_shader, checkpoint.pixel_shader);
+}
+
+void TracePlayer::ReplayMemoryCommands(const uint8_t* trace_ptr,
+                                       const uint8_t* trace_end) {
+  auto memory = graphics_system_->memory();
+  while (trace_ptr < trace_end) {
+    auto type = static_cast<TraceCommandType>(xe::load<uint32_t>(trace_ptr));
+    switch (type) {
+      case TraceCommandType::kPrimaryBufferStart: {
+        auto cmd =
+            reinterpret_cast<const PrimaryBufferStartCommand*>(trace_ptr);
+        trace_ptr += sizeof(*cmd) + cmd->count * 4;
+        break;
+      }
+      case TraceCommandType::kPrimaryBufferEnd:
+        trace_ptr += sizeof(PrimaryBufferEndCommand);
+        break;
+      case TraceCommandType::kIndirectBufferStart: {
+        auto cmd =
+            reinterpret_cast<const IndirectBufferStartCommand*>(trace_ptr);
+        trace_ptr += sizeof(*cmd) + cmd->count * 4;
+        break;
+      }
+      case TraceCommandType::kIndirectBufferEnd:
+        trace_ptr += sizeof(IndirectBufferEndCommand);
+        break;
+      case TraceCommandType::kPacketStart: {
+        auto cmd = reinterpret_cast<const PacketStartCommand*>(trace_ptr);
+        trace_ptr += sizeof(*cmd);
+        std::memcpy(memory->TranslatePhysical(cmd->base_ptr), trace_ptr,
+                    cmd->count * 4);
+        trace_ptr += cmd->count * 4;
+        break;
+      }
+      case TraceCommandType::kPacketEnd:
+        trace_ptr += sizeof(PacketEndCommand);
+        break;
+      case TraceCommandType::kMemoryRead: {
+        auto cmd = reinterpret_cast<const MemoryCommand*>(trace_ptr);
+        trace_ptr += sizeof(*cmd);
+        DecompressMemory(cmd->encoding_format, trace_ptr, cmd->encoded_length,
+                         memory->TranslatePhysical(cmd->base_ptr),
+                         cmd->decoded_length);
+        trace_ptr += cmd->encoded_length;
+        break;
+      }
+      case TraceCommandType::kMemoryWrite: {
+        auto cmd = reinterpret_cast<const MemoryCommand*>(trace_ptr);
+        trace_ptr += sizeof(*cmd) + cmd->encoded_length;
+        break;
+      }
+      case TraceCommandType::kEvent:
+        trace_ptr += sizeof(EventCommand);
+        break;
+    }
+  }
+}
+
 }  // namespace gpu
 }  // namespace xe
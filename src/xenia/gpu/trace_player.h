@@ -12,6 +12,7 @@
 
 #include <atomic>
 #include <string>
+#include <vector>
 
 #include "xenia/base/threading.h"
 #include "xenia/gpu/trace_protocol.h"
@@ -22,10 +23,13 @@ namespace xe {
 namespace gpu {
 
 class GraphicsSystem;
+class Shader;
 
 enum class TracePlaybackMode {
   kUntilEnd,
   kBreakOnSwap,
+  // Plays until the end, submitting but never presenting frames.
+  kBenchmark,
 };
 
 class TracePlayer : public TraceReader {
@@ -45,14 +49,35 @@ class TracePlayer : public TraceReader {
 
   void SeekFrame(int target_frame);
   void SeekCommand(int target_command);
+  // Plays every frame in the trace, for benchmarking.
+  void PlayAllFrames(bool clear_caches);
 
   void WaitOnPlayback();
 
  private:
+  // State after a packet of the current frame, restored to seek backwards
+  // without executing every packet before it again. Memory is rebuilt by
+  // replaying only the memory commands up to it, which is much cheaper.
+  // Render targets aren't rewound, so draws before it stay as they are.
+  struct Checkpoint {
+    const uint8_t* trace_ptr;
+    std::vector<uint32_t> registers;
+    Shader* vertex_shader;
+    Shader* pixel_shader;
+  };
+
+  // Playback starts from checkpoints_[checkpoint_index] if it isn't -1, in
+  // which case trace_data must be its trace_ptr.
   void PlayTrace(const uint8_t* trace_data, size_t trace_size,
-                 TracePlaybackMode playback_mode, bool clear_caches);
+                 TracePlaybackMode playback_mode, bool clear_caches,
+                 int checkpoint_index = -1);
   void PlayTraceOnThread(const uint8_t* trace_data, size_t trace_size,
-                         TracePlaybackMode playback_mode, bool clear_caches);
+                         TracePlaybackMode playback_mode, bool clear_caches,
+                         int checkpoint_index);
+  void SaveCheckpoint(const uint8_t* trace_ptr);
+  void RestoreCheckpoint(const Checkpoint& checkpoint);
+  void ReplayMemoryCommands(const uint8_t* trace_ptr,
+                            const uint8_t* trace_end);
 
   xe::ui::Loop* loop_;
   GraphicsSystem* graphics_system_;
@@ -61,6 +86,9 @@ class TracePlayer : public TraceReader {
   bool playing_trace_ = false;
   std::atomic<uint32_t> playback_percent_ = {0};
   std::unique_ptr<xe::threading::Event> playback_event_;
+  // Sorted by trace_ptr. Only changed on the command processor thread while
+  // playing.
+  std::vector<Checkpoint> checkpoints_;
 };
 
 }  // namespace gpu
@@ -214,6 +214,22 @@ bool TraceReader::DecompressMemory(MemoryEncodingFormat encoding_format,
     case MemoryEncodingFormat::kSnappy:
       return snappy::RawUncompress(reinterpret_cast<const char*>(src), src_size,
                                    reinterpret_cast<char*>(dest));
+    case MemoryEncodingFormat::kReference: {
+      assert_true(src_size == sizeof(uint64_t));
+      uint64_t offset;
+      std::memcpy(&offset, src, sizeof(offset));
+      if (offset + sizeof(MemoryCommand) > trace_size_) {
+        return false;
+      }
+      auto cmd = reinterpret_cast<const MemoryCommand*>(trace_data_ + offset);
+      if (cmd->encoding_format == MemoryEncodingFormat::kReference ||
+          cmd->decoded_length != dest_size) {
+        return false;
+      }
+      return DecompressMemory(cmd->encoding_format,
+                              trace_data_ + offset + sizeof(*cmd),
+                              cmd->encoded_length, dest, dest_size);
+    }
     default:
       assert_unhandled_case(encoding_format);
       return false;
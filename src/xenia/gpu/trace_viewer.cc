@@ -144,6 +144,11 @@ bool TraceViewer::Setup() {
 
   player_ = std::make_unique<TracePlayer>(loop_.get(), graphics_system_);
 
+  // For the GPU time of frames, where the backend can measure it.
+  auto command_processor = graphics_system_->command_processor();
+  command_processor->CallInThread(
+      [command_processor]() { command_processor->set_stats_enabled(true); });
+
   window_->on_painting.AddListener([&](xe::ui::UIEvent* e) {
     DrawUI();
 
@@ -245,6 +250,11 @@ void TraceViewer::DrawControllerUI() {
       !player_->is_playing_trace()) {
     player_->SeekFrame(target_frame);
   }
+  uint64_t gpu_nanoseconds =
+      graphics_system_->command_processor()->last_gpu_frame_nanoseconds();
+  if (gpu_nanoseconds) {
+    ImGui::Text("GPU: %.3f ms", gpu_nanoseconds / 1000000.0);
+  }
   ImGui::End();
 }
 
@@ -11,21 +11,25 @@
 
 #include <cstring>
 
-#include "third_party/snappy/snappy-sinksource.h"
 #include "third_party/snappy/snappy.h"
+#include "third_party/xxhash/xxhash.h"
 
 #include "build/version.h"
 #include "xenia/base/assert.h"
 #include "xenia/base/logging.h"
 #include "xenia/base/string.h"
+#include "xenia/gpu/gpu_flags.h"
 
 namespace xe {
 namespace gpu {
 
+// Size chunks are submitted for writing at.
+constexpr size_t kChunkSize = 1024 * 1024;
+
 TraceWriter::TraceWriter(uint8_t* membase)
     : membase_(membase), file_(nullptr) {}
 
-TraceWriter::~TraceWriter() = default;
+TraceWriter::~TraceWriter() { Close(); }
 
 bool TraceWriter::Open(const std::wstring& path, uint32_t title_id) {
   Close();
@@ -46,22 +50,75 @@ bool TraceWriter::Open(const std::wstring& path, uint32_t title_id) {
               sizeof(header.build_commit_sha));
   header.title_id = title_id;
   fwrite(&header, sizeof(header), 1, file_);
+  file_offset_ = sizeof(header);
+
+  current_chunk_ = std::make_unique<Chunk>();
+  current_chunk_->data.reserve(kChunkSize);
+  writer_shutdown_ = false;
+  writer_thread_ = xe::threading::Thread::Create(
+      {}, [this]() { WriterThreadMain(); });
+  writer_thread_->set_name("xe::gpu::TraceWriter");
 
   return true;
 }
 
 void TraceWriter::Flush() {
   if (file_) {
-    fflush(file_);
+    SubmitChunk(true);
   }
 }
 
 void TraceWriter::Close() {
   if (file_) {
+    SubmitChunk(false);
+    {
+      std::lock_guard<std::mutex> lock(chunk_mutex_);
+      writer_shutdown_ = true;
+    }
+    chunk_cond_.notify_all();
+    xe::threading::Wait(writer_thread_.get(), false);
+    writer_thread_.reset();
+
     fflush(file_);
     fclose(file_);
     file_ = nullptr;
+
+    current_chunk_.reset();
+    free_chunks_.clear();
+    written_memory_.clear();
+  }
+}
+
+void TraceWriter::Append(const void* data, size_t length) {
+  auto bytes = reinterpret_cast<const uint8_t*>(data);
+  current_chunk_->data.insert(current_chunk_->data.end(), bytes,
+                              bytes + length);
+}
+
+void TraceWriter::SubmitChunk(bool flush) {
+  if (current_chunk_->data.empty() && !flush) {
+    return;
   }
+  current_chunk_->flush = flush;
+  size_t chunk_size = current_chunk_->data.size();
+  std::unique_lock<std::mutex> lock(chunk_mutex_);
+  // A single chunk larger than the limit still has to be written.
+  size_t max_pending_size = size_t(FLAGS_trace_gpu_buffer_size) * 1024 * 1024;
+  chunk_done_cond_.wait(lock, [&]() {
+    return pending_chunks_.empty() ||
+           pending_size_ + chunk_size <= max_pending_size;
+  });
+  pending_size_ += chunk_size;
+  pending_chunks_.push_back(std::move(current_chunk_));
+  if (!free_chunks_.empty()) {
+    current_chunk_ = std::move(free_chunks_.back());
+    free_chunks_.pop_back();
+  } else {
+    current_chunk_ = std::make_unique<Chunk>();
+    current_chunk_->data.reserve(kChunkSize);
+  }
+  lock.unlock();
+  chunk_cond_.notify_one();
 }
 
 void TraceWriter::WritePrimaryBufferStart(uint32_t base_ptr, uint32_t count) {
@@ -71,7 +128,7 @@ void TraceWriter::WritePrimaryBufferStart(uint32_t base_ptr, uint32_t count) {
   PrimaryBufferStartCommand cmd = {
       TraceCommandType::kPrimaryBufferStart, base_ptr, 0,
   };
-  fwrite(&cmd, 1, sizeof(cmd), file_);
+  Append(&cmd, sizeof(cmd));
 }
 
 void TraceWriter::WritePrimaryBufferEnd() {
@@ -81,7 +138,7 @@ void TraceWriter::WritePrimaryBufferEnd() {
   PrimaryBufferEndCommand cmd = {
       TraceCommandType::kPrimaryBufferEnd,
   };
-  fwrite(&cmd, 1, sizeof(cmd), file_);
+  Append(&cmd, sizeof(cmd));
 }
 
 void TraceWriter::WriteIndirectBufferStart(uint32_t base_ptr, uint32_t count) {
@@ -91,7 +148,7 @@ void TraceWriter::WriteIndirectBufferStart(uint32_t base_ptr, uint32_t count) {
   IndirectBufferStartCommand cmd = {
       TraceCommandType::kIndirectBufferStart, base_ptr, 0,
   };
-  fwrite(&cmd, 1, sizeof(cmd), file_);
+  Append(&cmd, sizeof(cmd));
 }
 
 void TraceWriter::WriteIndirectBufferEnd() {
@@ -101,7 +158,7 @@ void TraceWriter::WriteIndirectBufferEnd() {
   IndirectBufferEndCommand cmd = {
       TraceCommandType::kIndirectBufferEnd,
   };
-  fwrite(&cmd, 1, sizeof(cmd), file_);
+  Append(&cmd, sizeof(cmd));
 }
 
 void TraceWriter::WritePacketStart(uint32_t base_ptr, uint32_t count) {
@@ -111,8 +168,8 @@ void TraceWriter::WritePacketStart(uint32_t base_ptr, uint32_t count) {
   PacketStartCommand cmd = {
       TraceCommandType::kPacketStart, base_ptr, count,
   };
-  fwrite(&cmd, 1, sizeof(cmd), file_);
-  fwrite(membase_ + base_ptr, 4, count, file_);
+  Append(&cmd, sizeof(cmd));
+  Append(membase_ + base_ptr, count * 4);
 }
 
 void TraceWriter::WritePacketEnd() {
@@ -122,7 +179,10 @@ void TraceWriter::WritePacketEnd() {
   PacketEndCommand cmd = {
       TraceCommandType::kPacketEnd,
   };
-  fwrite(&cmd, 1, sizeof(cmd), file_);
+  Append(&cmd, sizeof(cmd));
+  if (current_chunk_->data.size() >= kChunkSize) {
+    SubmitChunk(false);
+  }
 }
 
 void TraceWriter::WriteMemoryRead(uint32_t base_ptr, size_t length) {
@@ -139,18 +199,6 @@ void TraceWriter::WriteMemoryWrite(uint32_t base_ptr, size_t length) {
   WriteMemoryCommand(TraceCommandType::kMemoryWrite, base_ptr, length);
 }
 
-class SnappySink : public snappy::Sink {
- public:
-  SnappySink(FILE* file) : file_(file) {}
-
-  void Append(const char* bytes, size_t n) override {
-    fwrite(bytes, 1, n, file_);
-  }
-
- private:
-  FILE* file_ = nullptr;
-};
-
 void TraceWriter::WriteMemoryCommand(TraceCommandType type, uint32_t base_ptr,
                                      size_t length) {
   MemoryCommand cmd;
@@ -159,31 +207,13 @@ void TraceWriter::WriteMemoryCommand(TraceCommandType type, uint32_t base_ptr,
   cmd.encoding_format = MemoryEncodingFormat::kNone;
   cmd.encoded_length = cmd.decoded_length = static_cast<uint32_t>(length);
 
-  bool compress = compress_output_ && length > compression_threshold_;
-  if (compress) {
-    // Write the header now so we reserve space in the buffer.
-    long header_position = std::ftell(file_);
-    cmd.encoding_format = MemoryEncodingFormat::kSnappy;
-    fwrite(&cmd, 1, sizeof(cmd), file_);
-
-    // Stream the content right to the buffer.
-    snappy::ByteArraySource snappy_source(
-        reinterpret_cast<const char*>(membase_ + cmd.base_ptr),
-        cmd.decoded_length);
-    SnappySink snappy_sink(file_);
-    cmd.encoded_length =
-        static_cast<uint32_t>(snappy::Compress(&snappy_source, &snappy_sink));
-
-    // Seek back and overwrite the header with our final size.
-    std::fseek(file_, header_position, SEEK_SET);
-    fwrite(&cmd, 1, sizeof(cmd), file_);
-    std::fseek(file_, header_position + sizeof(cmd) + cmd.encoded_length,
-               SEEK_SET);
-  } else {
-    // Uncompressed - write buffer directly to the file.
-    cmd.encoding_format = MemoryEncodingFormat::kNone;
-    fwrite(&cmd, 1, sizeof(cmd), file_);
-    fwrite(membase_ + cmd.base_ptr, 1, cmd.decoded_length, file_);
+  // Only copied here, as the guest may change it before it's written.
+  current_chunk_->memory_command_offsets.push_back(
+      current_chunk_->data.size());
+  Append(&cmd, sizeof(cmd));
+  Append(membase_ + cmd.base_ptr, cmd.decoded_length);
+  if (current_chunk_->data.size() >= kChunkSize) {
+    SubmitChunk(false);
   }
 }
 
@@ -194,7 +224,102 @@ void TraceWriter::WriteEvent(EventCommand::Type event_type) {
   EventCommand cmd = {
       TraceCommandType::kEvent, event_type,
   };
-  fwrite(&cmd, 1, sizeof(cmd), file_);
+  Append(&cmd, sizeof(cmd));
+}
+
+void TraceWriter::WriterThreadMain() {
+  while (true) {
+    std::unique_ptr<Chunk> chunk;
+    {
+      std::unique_lock<std::mutex> lock(chunk_mutex_);
+      chunk_cond_.wait(lock, [this]() {
+        return writer_shutdown_ || !pending_chunks_.empty();
+      });
+      if (pending_chunks_.empty()) {
+        // Shutting down with everything written.
+        return;
+      }
+      chunk = std::move(pending_chunks_.front());
+      pending_chunks_.pop_front();
+    }
+
+    WriteChunk(*chunk);
+    if (chunk->flush) {
+      fflush(file_);
+    }
+
+    size_t chunk_size = chunk->data.size();
+    chunk->data.clear();
+    chunk->memory_command_offsets.clear();
+    chunk->flush = false;
+    {
+      std::lock_guard<std::mutex> lock(chunk_mutex_);
+      pending_size_ -= chunk_size;
+      free_chunks_.push_back(std::move(chunk));
+    }
+    chunk_done_cond_.notify_all();
+  }
+}
+
+void TraceWriter::WriteChunk(const Chunk& chunk) {
+  auto data = chunk.data.data();
+  size_t offset = 0;
+  for (size_t memory_command_offset : chunk.memory_command_offsets) {
+    WriteFile(data + offset, memory_command_offset - offset);
+    MemoryCommand cmd;
+    std::memcpy(&cmd, data + memory_command_offset, sizeof(cmd));
+    offset = memory_command_offset + sizeof(cmd);
+    WriteMemoryData(cmd, data + offset);
+    offset += cmd.decoded_length;
+  }
+  WriteFile(data + offset, chunk.data.size() - offset);
+}
+
+void TraceWriter::WriteMemoryData(MemoryCommand cmd, const uint8_t* data) {
+  uint64_t command_offset = file_offset_;
+  if (cmd.decoded_length <= compression_threshold_) {
+    // Uncompressed - write buffer directly to the file.
+    WriteFile(&cmd, sizeof(cmd));
+    WriteFile(data, cmd.decoded_length);
+    return;
+  }
+
+  // Memory that was already written (even to another address) is only
+  // referenced, so that data used every frame is stored once.
+  uint64_t hash = XXH64(data, cmd.decoded_length, 0);
+  auto it = written_memory_.find(hash);
+  if (it != written_memory_.end() &&
+      it->second.length == cmd.decoded_length) {
+    cmd.encoding_format = MemoryEncodingFormat::kReference;
+    cmd.encoded_length = sizeof(uint64_t);
+    WriteFile(&cmd, sizeof(cmd));
+    WriteFile(&it->second.command_offset, sizeof(uint64_t));
+    return;
+  }
+  if (it == written_memory_.end()) {
+    written_memory_.insert({hash, {command_offset, cmd.decoded_length}});
+  }
+
+  if (compress_output_) {
+    compression_buffer_.resize(
+        snappy::MaxCompressedLength(cmd.decoded_length));
+    size_t compressed_length;
+    snappy::RawCompress(reinterpret_cast<const char*>(data),
+                        cmd.decoded_length, compression_buffer_.data(),
+                        &compressed_length);
+    cmd.encoding_format = MemoryEncodingFormat::kSnappy;
+    cmd.encoded_length = static_cast<uint32_t>(compressed_length);
+    WriteFile(&cmd, sizeof(cmd));
+    WriteFile(compression_buffer_.data(), compressed_length);
+  } else {
+    WriteFile(&cmd, sizeof(cmd));
+    WriteFile(data, cmd.decoded_length);
+  }
+}
+
+void TraceWriter::WriteFile(const void* data, size_t length) {
+  fwrite(data, 1, length, file_);
+  file_offset_ += length;
 }
 
 }  //  namespace gpu
@@ -10,14 +10,24 @@
 #ifndef XENIA_GPU_TRACE_WRITER_H_
 #define XENIA_GPU_TRACE_WRITER_H_
 
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
 #include <string>
+#include <unordered_map>
+#include <vector>
 
 #include "xenia/base/filesystem.h"
+#include "xenia/base/threading.h"
 #include "xenia/gpu/trace_protocol.h"
 
 namespace xe {
 namespace gpu {
 
+// Commands are gathered into chunks on the calling thread, copying guest
+// memory as-is, and written by a background thread that compresses memory
+// and replaces contents already in the file with references to them.
 class TraceWriter {
  public:
   explicit TraceWriter(uint8_t* membase);
@@ -26,7 +36,9 @@ class TraceWriter {
   bool is_open() const { return file_ != nullptr; }
 
   bool Open(const std::wstring& path, uint32_t title_id);
+  // Has everything written so far flushed to the file in the background.
   void Flush();
+  // Waits for everything to be written and closes the file.
   void Close();
 
   void WritePrimaryBufferStart(uint32_t base_ptr, uint32_t count);
@@ -40,12 +52,49 @@ class TraceWriter {
   void WriteEvent(EventCommand::Type event_type);
 
  private:
+  struct Chunk {
+    std::vector<uint8_t> data;
+    // Offsets of the memory commands in data, each followed by the raw
+    // memory instead of its encoded form.
+    std::vector<size_t> memory_command_offsets;
+    // Whether the file is flushed once the chunk has been written.
+    bool flush = false;
+  };
+  // Contents of a memory command in the file that later ones can reference.
+  struct WrittenMemory {
+    uint64_t command_offset;
+    uint32_t length;
+  };
+
+  void Append(const void* data, size_t length);
+  // Queues the current chunk for writing, waiting if too much is queued.
+  void SubmitChunk(bool flush);
   void WriteMemoryCommand(TraceCommandType type, uint32_t base_ptr,
                           size_t length);
 
+  void WriterThreadMain();
+  void WriteChunk(const Chunk& chunk);
+  void WriteMemoryData(MemoryCommand cmd, const uint8_t* data);
+  void WriteFile(const void* data, size_t length);
+
   uint8_t* membase_;
   FILE* file_;
 
+  std::unique_ptr<Chunk> current_chunk_;
+  std::unique_ptr<xe::threading::Thread> writer_thread_;
+  std::mutex chunk_mutex_;
+  std::condition_variable chunk_cond_;
+  std::condition_variable chunk_done_cond_;
+  std::deque<std::unique_ptr<Chunk>> pending_chunks_;
+  std::vector<std::unique_ptr<Chunk>> free_chunks_;
+  size_t pending_size_ = 0;
+  bool writer_shutdown_ = false;
+
+  // Only used by the writer thread.
+  uint64_t file_offset_ = 0;
+  std::unordered_map<uint64_t, WrittenMemory> written_memory_;
+  std::vector<char> compression_buffer_;
+
   bool compress_output_ = true;
   size_t compression_threshold_ = 1024;  // Min. number of bytes to compress.
 };
@@ -9,6 +9,10 @@
 
 #include "xenia/gpu/vulkan/buffer_cache.h"
 
+#include <cstring>
+#include <vector>
+
+#include "third_party/xxhash/xxhash.h"
 #include "xenia/base/logging.h"
 #include "xenia/base/math.h"
 #include "xenia/base/memory.h"
@@ -24,10 +28,20 @@ using xe::ui::vulkan::CheckResult;
 
 constexpr VkDeviceSize kConstantRegisterUniformRange =
     512 * 4 * 4 + 8 * 4 + 32 * 4;
-
-BufferCache::BufferCache(RegisterFile* register_file,
+// Pixel shaders only read the last 256 float constants, and the bool and loop
+// constants after them.
+constexpr VkDeviceSize kPixelConstantRegisterOffset = 256 * 4 * 4;
+constexpr VkDeviceSize kPixelConstantRegisterRange =
+    kConstantRegisterUniformRange - kPixelConstantRegisterOffset;
+constexpr VkDeviceSize kGeometryCacheCapacity = 64 * 1024 * 1024;
+
+BufferCache::BufferCache(RegisterFile* register_file, Memory* memory,
+                         DirtyPageTracker* dirty_page_tracker,
                          ui::vulkan::VulkanDevice* device, size_t capacity)
-    : register_file_(register_file), device_(*device) {
+    : register_file_(register_file),
+      memory_(memory),
+      dirty_page_tracker_(dirty_page_tracker),
+      device_(*device) {
   transient_buffer_ = std::make_unique<ui::vulkan::CircularBuffer>(device);
   if (!transient_buffer_->Initialize(capacity,
                                      VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT |
@@ -35,6 +49,35 @@ BufferCache::BufferCache(RegisterFile* register_file,
                                          VK_BUFFER_USAGE_VERTEX_BUFFER_BIT)) {
     assert_always();
   }
+  geometry_buffer_ = std::make_unique<ui::vulkan::CircularBuffer>(device);
+  if (!geometry_buffer_->Initialize(kGeometryCacheCapacity,
+                                    VK_BUFFER_USAGE_INDEX_BUFFER_BIT |
+                                        VK_BUFFER_USAGE_VERTEX_BUFFER_BIT)) {
+    assert_always();
+  }
+
+  // Each stage is only uploaded again when its constants have been written.
+  std::vector<uint32_t> constant_registers;
+  for (uint32_t stage = 0; stage < 2; ++stage) {
+    constant_registers.clear();
+    uint32_t float_base = XE_GPU_REG_SHADER_CONSTANT_000_X + stage * 256 * 4;
+    for (uint32_t i = 0; i < 256 * 4; ++i) {
+      constant_registers.push_back(float_base + i);
+    }
+    for (uint32_t i = 0; i < 8; ++i) {
+      constant_registers.push_back(XE_GPU_REG_SHADER_CONSTANT_BOOL_000_031 + i);
+    }
+    for (uint32_t i = 0; i < 32; ++i) {
+      constant_registers.push_back(XE_GPU_REG_SHADER_CONSTANT_LOOP_00 + i);
+    }
+    uint64_t group = register_file_->AddDirtyGroup(constant_registers.data(),
+                                                   constant_registers.size());
+    if (stage) {
+      pixel_constants_dirty_group_ = group;
+    } else {
+      vertex_constants_dirty_group_ = group;
+    }
+  }
 
   // Descriptor pool used for all of our cached descriptors.
   // In the steady state we don't allocate anything, so these are all manually
@@ -129,10 +172,14 @@ BufferCache::BufferCache(RegisterFile* register_file,
 }
 
 BufferCache::~BufferCache() {
+  register_file_->RemoveDirtyGroup(vertex_constants_dirty_group_);
+  register_file_->RemoveDirtyGroup(pixel_constants_dirty_group_);
+  ClearGeometryCache();
   vkFreeDescriptorSets(device_, descriptor_pool_, 1,
                        &transient_descriptor_set_);
   vkDestroyDescriptorSetLayout(device_, descriptor_set_layout_, nullptr);
   vkDestroyDescriptorPool(device_, descriptor_pool_, nullptr);
+  geometry_buffer_->Shutdown();
   transient_buffer_->Shutdown();
 }
 
@@ -146,26 +193,52 @@ std::pair<VkDeviceSize, VkDeviceSize> BufferCache::UploadConstantRegisters(
   //   uint bool[8];
   //   uint loop[32];
   // };
-  auto offset = AllocateTransientData(kConstantRegisterUniformRange, fence);
-  if (offset == VK_WHOLE_SIZE) {
-    // OOM.
-    return {VK_WHOLE_SIZE, VK_WHOLE_SIZE};
-  }
-
-  // Copy over all the registers.
+  // Each stage only reads its half of the float constants, so only that half
+  // is copied. The previous upload of a stage is reused while its constants
+  // are unchanged, as long as it belongs to the same batch - older data may
+  // have been reclaimed once its fence was signaled.
   const auto& values = register_file_->values;
-  uint8_t* dest_ptr = transient_buffer_->host_base() + offset;
-  std::memcpy(dest_ptr, &values[XE_GPU_REG_SHADER_CONSTANT_000_X].f32,
-              (512 * 4 * 4));
-  dest_ptr += 512 * 4 * 4;
-  std::memcpy(dest_ptr, &values[XE_GPU_REG_SHADER_CONSTANT_BOOL_000_031].u32,
-              8 * 4);
-  dest_ptr += 8 * 4;
-  std::memcpy(dest_ptr, &values[XE_GPU_REG_SHADER_CONSTANT_LOOP_00].u32,
-              32 * 4);
-  dest_ptr += 32 * 4;
+  uint64_t dirty_groups = register_file_->dirty_groups();
+  if ((dirty_groups & vertex_constants_dirty_group_) ||
+      vertex_constants_fence_ != fence) {
+    auto offset = AllocateTransientData(kConstantRegisterUniformRange, fence);
+    if (offset == VK_WHOLE_SIZE) {
+      // OOM.
+      vertex_constants_fence_ = nullptr;
+      return {VK_WHOLE_SIZE, VK_WHOLE_SIZE};
+    }
+    uint8_t* dest_ptr = transient_buffer_->host_base() + offset;
+    std::memcpy(dest_ptr, &values[XE_GPU_REG_SHADER_CONSTANT_000_X].f32,
+                kPixelConstantRegisterOffset);
+    CopyBoolLoopConstants(dest_ptr + 512 * 4 * 4);
+    vertex_constants_offset_ = offset;
+    vertex_constants_fence_ = fence;
+  }
+  if ((dirty_groups & pixel_constants_dirty_group_) ||
+      pixel_constants_fence_ != fence) {
+    // The binding is offset back so that it ends with the allocation, which
+    // is only possible if that doesn't start before the buffer.
+    auto offset = AllocateTransientData(kPixelConstantRegisterRange, fence);
+    if (offset != VK_WHOLE_SIZE && offset >= kPixelConstantRegisterOffset) {
+      offset -= kPixelConstantRegisterOffset;
+    } else if (offset != VK_WHOLE_SIZE) {
+      offset = AllocateTransientData(kConstantRegisterUniformRange, fence);
+    }
+    if (offset == VK_WHOLE_SIZE) {
+      // OOM.
+      pixel_constants_fence_ = nullptr;
+      return {VK_WHOLE_SIZE, VK_WHOLE_SIZE};
+    }
+    uint8_t* dest_ptr =
+        transient_buffer_->host_base() + offset + kPixelConstantRegisterOffset;
+    std::memcpy(dest_ptr, &values[XE_GPU_REG_SHADER_CONSTANT_256_X].f32,
+                256 * 4 * 4);
+    CopyBoolLoopConstants(dest_ptr + 256 * 4 * 4);
+    pixel_constants_offset_ = offset;
+    pixel_constants_fence_ = fence;
+  }
 
-  return {offset, offset};
+  return {vertex_constants_offset_, pixel_constants_offset_};
 
 // Packed upload code.
 // This is not currently supported by the shaders, but would be awesome.
@@ -219,37 +292,216 @@ std::pair<VkDeviceSize, VkDeviceSize> BufferCache::UploadConstantRegisters(
 }
 
 std::pair<VkBuffer, VkDeviceSize> BufferCache::UploadIndexBuffer(
-    const void* source_ptr, size_t source_length, IndexFormat format,
+    uint32_t source_addr, uint32_t source_length, IndexFormat format,
     std::shared_ptr<ui::vulkan::Fence> fence) {
-  // TODO(benvanik): check cache.
+  // TODO(benvanik): get min/max indices and pass back?
+  // TODO(benvanik): memcpy then use compute shaders to swap?
+  // Indices are swapped by their size.
+  return UploadGuestBuffer(
+      source_addr, source_length,
+      format == IndexFormat::kInt32 ? Endian::k8in32 : Endian::k8in16, fence);
+}
 
-  // Allocate space in the buffer for our data.
-  auto offset = AllocateTransientData(source_length, fence);
-  if (offset == VK_WHOLE_SIZE) {
-    // OOM.
-    return {nullptr, VK_WHOLE_SIZE};
+PrimitiveType BufferCache::GetConvertedPrimitiveType(
+    PrimitiveType primitive_type, bool is_line_mode) {
+  switch (primitive_type) {
+    case PrimitiveType::kQuadList:
+      // Quads are drawn as their outlines in line mode.
+      return is_line_mode ? PrimitiveType::kLineList
+                          : PrimitiveType::kTriangleList;
+    case PrimitiveType::kLineLoop:
+      return PrimitiveType::kLineStrip;
+    default:
+      return primitive_type;
   }
+}
 
-  // Copy data into the buffer.
-  // TODO(benvanik): get min/max indices and pass back?
-  // TODO(benvanik): memcpy then use compute shaders to swap?
-  if (format == IndexFormat::kInt16) {
-    // Endian::k8in16, swap half-words.
-    xe::copy_and_swap_16_aligned(transient_buffer_->host_base() + offset,
-                                 source_ptr, source_length / 2);
-  } else if (format == IndexFormat::kInt32) {
-    // Endian::k8in32, swap words.
-    xe::copy_and_swap_32_aligned(transient_buffer_->host_base() + offset,
-                                 source_ptr, source_length / 4);
+uint32_t BufferCache::GetConvertedIndexCount(PrimitiveType primitive_type,
+                                             bool is_line_mode,
+                                             uint32_t index_count) {
+  switch (primitive_type) {
+    case PrimitiveType::kQuadList:
+      return index_count / 4 * (is_line_mode ? 8 : 6);
+    case PrimitiveType::kLineLoop:
+      // The strip ends with the first index again.
+      return index_count >= 2 ? index_count + 1 : 0;
+    default:
+      return index_count;
   }
+}
 
-  return {transient_buffer_->gpu_buffer(), offset};
+// Guest indices are swapped while they are converted.
+template <typename T>
+static void ConvertIndices(PrimitiveType primitive_type, bool is_line_mode,
+                           const T* source, uint32_t index_count, T* dest) {
+  auto index = [source](uint32_t i) {
+    return source ? xe::byte_swap(source[i]) : T(i);
+  };
+  if (primitive_type == PrimitiveType::kQuadList) {
+    for (uint32_t i = 0; i + 4 <= index_count; i += 4) {
+      T v0 = index(i), v1 = index(i + 1), v2 = index(i + 2), v3 = index(i + 3);
+      if (is_line_mode) {
+        T lines[] = {v0, v1, v1, v2, v2, v3, v3, v0};
+        std::memcpy(dest, lines, sizeof(lines));
+        dest += xe::countof(lines);
+      } else {
+        // Split along the same diagonal as the quad_list geometry shader.
+        T triangles[] = {v0, v1, v3, v1, v2, v3};
+        std::memcpy(dest, triangles, sizeof(triangles));
+        dest += xe::countof(triangles);
+      }
+    }
+  } else if (primitive_type == PrimitiveType::kLineLoop) {
+    for (uint32_t i = 0; i < index_count; ++i) {
+      dest[i] = index(i);
+    }
+    dest[index_count] = index(0);
+  }
+}
+
+std::pair<VkBuffer, VkDeviceSize> BufferCache::ConvertIndexBuffer(
+    PrimitiveType primitive_type, bool is_line_mode, uint32_t source_addr,
+    uint32_t index_count, IndexFormat format,
+    std::shared_ptr<ui::vulkan::Fence> fence) {
+  uint32_t converted_count =
+      GetConvertedIndexCount(primitive_type, is_line_mode, index_count);
+  assert_not_zero(converted_count);
+  uint32_t index_size =
+      format == IndexFormat::kInt32 ? sizeof(uint32_t) : sizeof(uint16_t);
+  const void* source_ptr =
+      source_addr ? memory_->TranslatePhysical(source_addr) : nullptr;
+
+  // Keyed by the contents rather than the address, so guest buffers that are
+  // rewritten don't need to be watched.
+  uint64_t seed = uint64_t(primitive_type) << 16 |
+                  uint64_t(is_line_mode) << 8 | uint64_t(format) << 1 |
+                  (source_ptr ? 0 : 1);
+  uint64_t key = source_ptr ? XXH64(source_ptr, index_count * index_size, seed)
+                            : XXH64(&index_count, sizeof(index_count), seed);
+  auto it = converted_index_buffers_.find(key);
+  if (it != converted_index_buffers_.end()) {
+    ++hit_count_;
+    geometry_fence_ = fence;
+    return {geometry_buffer_->gpu_buffer(), it->second};
+  }
+  ++miss_count_;
+
+  VkDeviceSize length = VkDeviceSize(converted_count) * index_size;
+  VkBuffer buffer = nullptr;
+  VkDeviceSize offset = VK_WHOLE_SIZE;
+  uint8_t* dest_ptr = nullptr;
+  if (!geometry_buffer_full_) {
+    auto allocation = geometry_buffer_->Acquire(length, fence);
+    if (allocation) {
+      buffer = geometry_buffer_->gpu_buffer();
+      offset = allocation->offset;
+      dest_ptr = geometry_buffer_->host_base() + offset;
+      geometry_buffer_dirty_ = true;
+      geometry_fence_ = fence;
+      converted_index_buffers_.emplace(key, offset);
+    } else {
+      // Stop caching until Scavenge can clear it out.
+      geometry_buffer_full_ = true;
+    }
+  }
+  if (offset == VK_WHOLE_SIZE) {
+    offset = AllocateTransientData(length, fence);
+    if (offset == VK_WHOLE_SIZE) {
+      // OOM.
+      return {nullptr, VK_WHOLE_SIZE};
+    }
+    buffer = transient_buffer_->gpu_buffer();
+    dest_ptr = transient_buffer_->host_base() + offset;
+  }
+
+  if (format == IndexFormat::kInt32) {
+    ConvertIndices(primitive_type, is_line_mode,
+                   reinterpret_cast<const uint32_t*>(source_ptr), index_count,
+                   reinterpret_cast<uint32_t*>(dest_ptr));
+  } else {
+    ConvertIndices(primitive_type, is_line_mode,
+                   reinterpret_cast<const uint16_t*>(source_ptr), index_count,
+                   reinterpret_cast<uint16_t*>(dest_ptr));
+  }
+  return {buffer, offset};
 }
 
 std::pair<VkBuffer, VkDeviceSize> BufferCache::UploadVertexBuffer(
-    const void* source_ptr, size_t source_length, Endian endian,
+    uint32_t source_addr, uint32_t source_length, Endian endian,
     std::shared_ptr<ui::vulkan::Fence> fence) {
-  // TODO(benvanik): check cache.
+  // Shaders swap vertex data when fetching it, so it's copied as-is.
+  assert_true(endian == Endian::k8in32);
+  return UploadGuestBuffer(source_addr, source_length, Endian::kUnspecified,
+                           fence);
+}
+
+std::pair<VkBuffer, VkDeviceSize> BufferCache::UploadGuestBuffer(
+    uint32_t source_addr, uint32_t source_length, Endian endian,
+    std::shared_ptr<ui::vulkan::Fence> fence) {
+  auto source_ptr = memory_->TranslatePhysical(source_addr);
+  uint64_t key = uint64_t(source_length) << 32 | source_addr;
+
+  auto it = cached_buffers_.find(key);
+  if (it != cached_buffers_.end()) {
+    auto cached_buffer = it->second.get();
+    if (cached_buffer->endian == endian && !cached_buffer->is_dynamic) {
+      bool invalidated;
+      {
+        std::lock_guard<std::mutex> lock(cached_buffers_mutex_);
+        invalidated = cached_buffer->pending_invalidation;
+        cached_buffer->pending_invalidation = false;
+      }
+      if (invalidated) {
+        // Watch again before looking at the data so that writes made while we
+        // do aren't missed. Writes that leave the data as it was (or an
+        // invalidation by the GPU) don't require a new upload.
+        if (!cached_buffer->access_watch_handle) {
+          WatchCachedBuffer(cached_buffer);
+        }
+        if (XXH64(source_ptr, source_length, 0) !=
+            cached_buffer->content_hash) {
+          // Changing data would need a new copy every time it's written, so it
+          // is uploaded like any other transient data from now on.
+          if (cached_buffer->access_watch_handle) {
+            dirty_page_tracker_->CancelWatch(
+                cached_buffer->access_watch_handle);
+            cached_buffer->access_watch_handle = 0;
+          }
+          cached_buffer->is_dynamic = true;
+        }
+      }
+      if (!cached_buffer->is_dynamic) {
+        ++hit_count_;
+        geometry_fence_ = fence;
+        return {geometry_buffer_->gpu_buffer(), cached_buffer->offset};
+      }
+    }
+  }
+  ++miss_count_;
+  if (it == cached_buffers_.end() && !geometry_buffer_full_) {
+    auto allocation = geometry_buffer_->Acquire(source_length, fence);
+    if (allocation) {
+      auto cached_buffer = std::make_unique<CachedBuffer>();
+      cached_buffer->guest_address = source_addr;
+      cached_buffer->length = source_length;
+      cached_buffer->endian = endian;
+      cached_buffer->offset = allocation->offset;
+      cached_buffer->access_watch_handle = 0;
+      cached_buffer->pending_invalidation = false;
+      cached_buffer->is_dynamic = false;
+      WatchCachedBuffer(cached_buffer.get());
+      cached_buffer->content_hash = XXH64(source_ptr, source_length, 0);
+      CopyAndSwap(geometry_buffer_->host_base() + allocation->offset,
+                  source_ptr, source_length, endian);
+      geometry_buffer_dirty_ = true;
+      geometry_fence_ = fence;
+      auto offset = cached_buffer->offset;
+      cached_buffers_.emplace(key, std::move(cached_buffer));
+      return {geometry_buffer_->gpu_buffer(), offset};
+    }
+    // Stop caching until Scavenge can clear it out.
+    geometry_buffer_full_ = true;
+  }
 
   // Allocate space in the buffer for our data.
   auto offset = AllocateTransientData(source_length, fence);
@@ -259,17 +511,63 @@ std::pair<VkBuffer, VkDeviceSize> BufferCache::UploadVertexBuffer(
   }
 
   // Copy data into the buffer.
-  // TODO(benvanik): memcpy then use compute shaders to swap?
-  assert_true(endian == Endian::k8in32);
-  if (endian == Endian::k8in32) {
-    // Endian::k8in32, swap words.
-    xe::copy_and_swap_32_aligned(transient_buffer_->host_base() + offset,
-                                 source_ptr, source_length / 4);
-  }
+  CopyAndSwap(transient_buffer_->host_base() + offset, source_ptr,
+              source_length, endian);
 
   return {transient_buffer_->gpu_buffer(), offset};
 }
 
+void BufferCache::CopyAndSwap(void* dest, const void* src, size_t length,
+                              Endian endian) {
+  if (endian == Endian::k8in16) {
+    // Swap half-words.
+    xe::copy_and_swap_16_aligned(dest, src, length / 2);
+  } else if (endian == Endian::k8in32) {
+    // Swap words.
+    xe::copy_and_swap_32_aligned(dest, src, length / 4);
+  } else {
+    std::memcpy(dest, src, length);
+  }
+}
+
+void BufferCache::WatchCachedBuffer(CachedBuffer* cached_buffer) {
+  cached_buffer->access_watch_handle = dirty_page_tracker_->AddWatch(
+      cached_buffer->guest_address, cached_buffer->length,
+      [](void* context_ptr, void* data_ptr, uint32_t address) {
+        auto self = reinterpret_cast<BufferCache*>(context_ptr);
+        auto touched_buffer = reinterpret_cast<CachedBuffer*>(data_ptr);
+        // Clear watch handle first so we don't redundantly
+        // remove.
+        touched_buffer->access_watch_handle = 0;
+        std::lock_guard<std::mutex> lock(self->cached_buffers_mutex_);
+        touched_buffer->pending_invalidation = true;
+      },
+      this, cached_buffer);
+}
+
+void BufferCache::ClearGeometryCache() {
+  for (auto& it : cached_buffers_) {
+    if (it.second->access_watch_handle) {
+      dirty_page_tracker_->CancelWatch(it.second->access_watch_handle);
+      it.second->access_watch_handle = 0;
+    }
+  }
+  cached_buffers_.clear();
+  converted_index_buffers_.clear();
+  geometry_buffer_->Clear();
+  geometry_buffer_full_ = false;
+  geometry_fence_ = nullptr;
+}
+
+void BufferCache::CopyBoolLoopConstants(uint8_t* dest_ptr) {
+  const auto& values = register_file_->values;
+  std::memcpy(dest_ptr, &values[XE_GPU_REG_SHADER_CONSTANT_BOOL_000_031].u32,
+              8 * 4);
+  dest_ptr += 8 * 4;
+  std::memcpy(dest_ptr, &values[XE_GPU_REG_SHADER_CONSTANT_LOOP_00].u32,
+              32 * 4);
+}
+
 VkDeviceSize BufferCache::AllocateTransientData(
     VkDeviceSize length, std::shared_ptr<ui::vulkan::Fence> fence) {
   // Try fast path (if we have space).
@@ -317,17 +615,40 @@ void BufferCache::Flush(VkCommandBuffer command_buffer) {
   dirty_range.offset = 0;
   dirty_range.size = transient_buffer_->capacity();
   vkFlushMappedMemoryRanges(device_, 1, &dirty_range);
+
+  // Cached geometry is only written when first used.
+  if (geometry_buffer_dirty_) {
+    geometry_buffer_dirty_ = false;
+    dirty_range.memory = geometry_buffer_->gpu_memory();
+    dirty_range.size = geometry_buffer_->capacity();
+    vkFlushMappedMemoryRanges(device_, 1, &dirty_range);
+  }
 }
 
 void BufferCache::InvalidateCache() {
-  // TODO(benvanik): caching.
+  // The GPU may have written guest memory without tripping the watches, so
+  // everything is rehashed when next used.
+  std::lock_guard<std::mutex> lock(cached_buffers_mutex_);
+  for (auto& it : cached_buffers_) {
+    it.second->pending_invalidation = true;
+  }
 }
 
 void BufferCache::ClearCache() {
-  // TODO(benvanik): caching.
+  ClearGeometryCache();
+  vertex_constants_fence_ = nullptr;
+  pixel_constants_fence_ = nullptr;
 }
 
-void BufferCache::Scavenge() { transient_buffer_->Scavenge(); }
+void BufferCache::Scavenge() {
+  transient_buffer_->Scavenge();
+
+  if (geometry_buffer_full_ &&
+      (!geometry_fence_ || geometry_fence_->status() == VK_SUCCESS)) {
+    // Fences are signaled in order, so nothing cached is in use anymore.
+    ClearGeometryCache();
+  }
+}
 
 }  // namespace vulkan
 }  // namespace gpu
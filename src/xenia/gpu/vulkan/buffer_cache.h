@@ -10,9 +10,15 @@
 #ifndef XENIA_GPU_VULKAN_BUFFER_CACHE_H_
 #define XENIA_GPU_VULKAN_BUFFER_CACHE_H_
 
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+
+#include "xenia/gpu/dirty_page_tracker.h"
 #include "xenia/gpu/register_file.h"
 #include "xenia/gpu/shader.h"
 #include "xenia/gpu/xenos.h"
+#include "xenia/memory.h"
 #include "xenia/ui/vulkan/circular_buffer.h"
 #include "xenia/ui/vulkan/vulkan.h"
 #include "xenia/ui/vulkan/vulkan_device.h"
@@ -26,8 +32,9 @@ namespace vulkan {
 // transient data like shader constants.
 class BufferCache {
  public:
-  BufferCache(RegisterFile* register_file, ui::vulkan::VulkanDevice* device,
-              size_t capacity);
+  BufferCache(RegisterFile* register_file, Memory* memory,
+              DirtyPageTracker* dirty_page_tracker,
+              ui::vulkan::VulkanDevice* device, size_t capacity);
   ~BufferCache();
 
   // Descriptor set containing the dynamic uniform buffer used for constant
@@ -39,6 +46,11 @@ class BufferCache {
   VkDescriptorSet constant_descriptor_set() const {
     return transient_descriptor_set_;
   }
+  // Dirty groups of the shader constants, which stay set until the constants
+  // have been uploaded.
+  uint64_t constant_dirty_groups() const {
+    return vertex_constants_dirty_group_ | pixel_constants_dirty_group_;
+  }
   VkDescriptorSetLayout constant_descriptor_set_layout() const {
     return descriptor_set_layout_;
   }
@@ -48,7 +60,8 @@ class BufferCache {
   // The registers are tightly packed in order as [floats, ints, bools].
   // Returns an offset that can be used with the transient_descriptor_set or
   // VK_WHOLE_SIZE if the constants could not be uploaded (OOM).
-  // The returned offsets may alias.
+  // The returned offsets may alias. Stages whose constants haven't been
+  // written since the last upload in the same batch reuse their old offset.
   std::pair<VkDeviceSize, VkDeviceSize> UploadConstantRegisters(
       const Shader::ConstantRegisterMap& vertex_constant_register_map,
       const Shader::ConstantRegisterMap& pixel_constant_register_map,
@@ -59,7 +72,30 @@ class BufferCache {
   // Returns a buffer and offset that can be used with vkCmdBindIndexBuffer.
   // Size will be VK_WHOLE_SIZE if the data could not be uploaded (OOM).
   std::pair<VkBuffer, VkDeviceSize> UploadIndexBuffer(
-      const void* source_ptr, size_t source_length, IndexFormat format,
+      uint32_t source_addr, uint32_t source_length, IndexFormat format,
+      std::shared_ptr<ui::vulkan::Fence> fence);
+
+  // Returns the primitive type Vulkan draws primitive_type as once its indices
+  // have been converted by ConvertIndexBuffer. Types that don't need to be
+  // converted are returned as they are.
+  static PrimitiveType GetConvertedPrimitiveType(PrimitiveType primitive_type,
+                                                 bool is_line_mode);
+  // Returns the number of indices of index_count that ConvertIndexBuffer
+  // writes, 0 if there are too few to make up a primitive.
+  static uint32_t GetConvertedIndexCount(PrimitiveType primitive_type,
+                                         bool is_line_mode,
+                                         uint32_t index_count);
+
+  // Rewrites the indices of a draw into a list of the primitive type returned
+  // by GetConvertedPrimitiveType, so that no geometry shader is needed.
+  // Indices are read from guest memory at source_addr, or are 0 to
+  // index_count - 1 if it is 0 (auto-indexed draws).
+  // Converted lists are cached by the hash of the source indices.
+  // Returns a buffer and offset that can be used with vkCmdBindIndexBuffer.
+  // Size will be VK_WHOLE_SIZE if the data could not be uploaded (OOM).
+  std::pair<VkBuffer, VkDeviceSize> ConvertIndexBuffer(
+      PrimitiveType primitive_type, bool is_line_mode, uint32_t source_addr,
+      uint32_t index_count, IndexFormat format,
       std::shared_ptr<ui::vulkan::Fence> fence);
 
   // Uploads vertex buffer data from guest memory, possibly eliding with
@@ -67,7 +103,7 @@ class BufferCache {
   // Returns a buffer and offset that can be used with vkCmdBindVertexBuffers.
   // Size will be VK_WHOLE_SIZE if the data could not be uploaded (OOM).
   std::pair<VkBuffer, VkDeviceSize> UploadVertexBuffer(
-      const void* source_ptr, size_t source_length, Endian endian,
+      uint32_t source_addr, uint32_t source_length, Endian endian,
       std::shared_ptr<ui::vulkan::Fence> fence);
 
   // Flushes all pending data to the GPU.
@@ -87,7 +123,38 @@ class BufferCache {
   // Wipes all data no longer needed.
   void Scavenge();
 
+  // Guest buffers reused from the geometry buffer and ones that had to be
+  // uploaded.
+  uint64_t hit_count() const { return hit_count_; }
+  uint64_t miss_count() const { return miss_count_; }
+
  private:
+  // Swapped copy of a guest buffer kept in the geometry buffer, reused for as
+  // long as its guest data doesn't change.
+  struct CachedBuffer {
+    uint32_t guest_address;
+    uint32_t length;
+    Endian endian;
+    uint64_t content_hash;
+    VkDeviceSize offset;
+    uintptr_t access_watch_handle;
+    // Set when the guest data may have changed. Only changed under the lock.
+    bool pending_invalidation;
+    // Data changed after being cached, so it's always uploaded as transient.
+    bool is_dynamic;
+  };
+
+  // Returns the cached copy of the guest range, caching it if possible, or
+  // falls back to uploading it to the transient buffer.
+  std::pair<VkBuffer, VkDeviceSize> UploadGuestBuffer(
+      uint32_t source_addr, uint32_t source_length, Endian endian,
+      std::shared_ptr<ui::vulkan::Fence> fence);
+  static void CopyAndSwap(void* dest, const void* src, size_t length,
+                          Endian endian);
+  void WatchCachedBuffer(CachedBuffer* cached_buffer);
+  // Drops all cached buffers. The GPU must be done with them.
+  void ClearGeometryCache();
+
   // Allocates a block of memory in the transient buffer.
   // When memory is not available fences are checked and space is reclaimed.
   // Returns VK_WHOLE_SIZE if requested amount of memory is not available.
@@ -97,14 +164,43 @@ class BufferCache {
   // Returns VK_WHOLE_SIZE if requested amount of memory is not available.
   VkDeviceSize TryAllocateTransientData(
       VkDeviceSize length, std::shared_ptr<ui::vulkan::Fence> fence);
+  // Copies the bool and loop constants that follow the float constants.
+  void CopyBoolLoopConstants(uint8_t* dest_ptr);
 
   RegisterFile* register_file_ = nullptr;
+  Memory* memory_ = nullptr;
+  DirtyPageTracker* dirty_page_tracker_ = nullptr;
   VkDevice device_ = nullptr;
 
   // Staging ringbuffer we cycle through fast. Used for data we don't
   // plan on keeping past the current frame.
   std::unique_ptr<ui::vulkan::CircularBuffer> transient_buffer_ = nullptr;
 
+  // Buffer holding cached guest geometry. Allocations are never scavenged;
+  // once it fills up it's cleared entirely when the GPU is done with it.
+  std::unique_ptr<ui::vulkan::CircularBuffer> geometry_buffer_ = nullptr;
+  bool geometry_buffer_full_ = false;
+  bool geometry_buffer_dirty_ = false;
+  // Last fence any cached buffer was used with.
+  std::shared_ptr<ui::vulkan::Fence> geometry_fence_;
+  // Keyed by guest address and length.
+  std::unordered_map<uint64_t, std::unique_ptr<CachedBuffer>> cached_buffers_;
+  std::mutex cached_buffers_mutex_;
+  // Offsets of converted index lists in the geometry buffer, keyed by the
+  // hash of their source indices and how they were converted.
+  std::unordered_map<uint64_t, VkDeviceSize> converted_index_buffers_;
+
+  uint64_t hit_count_ = 0;
+  uint64_t miss_count_ = 0;
+
+  // Last constant uploads of each stage and the batch they were made in.
+  uint64_t vertex_constants_dirty_group_ = 0;
+  uint64_t pixel_constants_dirty_group_ = 0;
+  VkDeviceSize vertex_constants_offset_ = 0;
+  VkDeviceSize pixel_constants_offset_ = 0;
+  std::shared_ptr<ui::vulkan::Fence> vertex_constants_fence_;
+  std::shared_ptr<ui::vulkan::Fence> pixel_constants_fence_;
+
   VkDescriptorPool descriptor_pool_ = nullptr;
   VkDescriptorSetLayout descriptor_set_layout_ = nullptr;
   VkDescriptorSet transient_descriptor_set_ = nullptr;
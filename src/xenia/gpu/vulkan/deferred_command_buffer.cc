@@ -0,0 +1,387 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2016 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#include "xenia/gpu/vulkan/deferred_command_buffer.h"
+
+#include <cstring>
+
+#include "xenia/base/assert.h"
+
+namespace xe {
+namespace gpu {
+namespace vulkan {
+
+namespace {
+
+struct SetDepthBiasArgs {
+  float constant_factor;
+  float clamp;
+  float slope_factor;
+};
+
+struct SetDepthBoundsArgs {
+  float min_depth_bounds;
+  float max_depth_bounds;
+};
+
+struct SetStencilArgs {
+  VkStencilFaceFlags face_mask;
+  uint32_t value;
+};
+
+// Followed by size bytes of values.
+struct PushConstantsArgs {
+  VkPipelineLayout layout;
+  VkShaderStageFlags stage_flags;
+  uint32_t offset;
+  uint32_t size;
+};
+
+// Followed by the sets and the dynamic offsets.
+struct BindDescriptorSetsArgs {
+  VkPipelineLayout layout;
+  uint32_t first_set;
+  uint32_t set_count;
+  uint32_t dynamic_offset_count;
+};
+
+struct BindIndexBufferArgs {
+  VkBuffer buffer;
+  VkDeviceSize offset;
+  VkIndexType index_type;
+};
+
+// Followed by the buffers and their offsets.
+struct BindVertexBuffersArgs {
+  uint32_t first_binding;
+  uint32_t binding_count;
+};
+
+struct DrawArgs {
+  uint32_t vertex_count;
+  uint32_t instance_count;
+  uint32_t first_vertex;
+  uint32_t first_instance;
+};
+
+struct DrawIndexedArgs {
+  uint32_t index_count;
+  uint32_t instance_count;
+  uint32_t first_index;
+  int32_t vertex_offset;
+  uint32_t first_instance;
+};
+
+struct QueryArgs {
+  VkQueryPool query_pool;
+  uint32_t query;
+  VkQueryControlFlags flags;
+};
+
+// Copies the arguments of a command out of the stream.
+template <typename T>
+T ReadArgs(const uint8_t* args) {
+  T value;
+  std::memcpy(&value, args, sizeof(T));
+  return value;
+}
+
+}  // namespace
+
+void DeferredCommandBuffer::Reset() {
+  data_.clear();
+  draw_count_ = 0;
+}
+
+void DeferredCommandBuffer::Write(Command command, const void* args,
+                                  size_t args_size, const void* array_a,
+                                  size_t array_a_size, const void* array_b,
+                                  size_t array_b_size) {
+  // Arrays start aligned, as the structures before them may contain padding.
+  size_t array_a_offset = (args_size + 7) & ~size_t(7);
+  size_t array_b_offset = (array_a_offset + array_a_size + 7) & ~size_t(7);
+  size_t word_count = (array_b_offset + array_b_size + 7) >> 3;
+  size_t offset = data_.size();
+  data_.resize(offset + 1 + word_count);
+  data_[offset] = uint64_t(command) | (uint64_t(word_count) << 32);
+  auto dest = reinterpret_cast<uint8_t*>(&data_[offset + 1]);
+  std::memcpy(dest, args, args_size);
+  if (array_a_size) {
+    std::memcpy(dest + array_a_offset, array_a, array_a_size);
+  }
+  if (array_b_size) {
+    std::memcpy(dest + array_b_offset, array_b, array_b_size);
+  }
+}
+
+void DeferredCommandBuffer::BindPipeline(VkPipeline pipeline) {
+  Write(Command::kBindPipeline, &pipeline, sizeof(pipeline));
+}
+
+void DeferredCommandBuffer::SetViewport(const VkViewport& viewport) {
+  Write(Command::kSetViewport, &viewport, sizeof(viewport));
+}
+
+void DeferredCommandBuffer::SetScissor(const VkRect2D& scissor) {
+  Write(Command::kSetScissor, &scissor, sizeof(scissor));
+}
+
+void DeferredCommandBuffer::SetBlendConstants(const float blend_constants[4]) {
+  Write(Command::kSetBlendConstants, blend_constants, sizeof(float) * 4);
+}
+
+void DeferredCommandBuffer::SetLineWidth(float line_width) {
+  Write(Command::kSetLineWidth, &line_width, sizeof(line_width));
+}
+
+void DeferredCommandBuffer::SetDepthBias(float constant_factor, float clamp,
+                                         float slope_factor) {
+  SetDepthBiasArgs args = {constant_factor, clamp, slope_factor};
+  Write(Command::kSetDepthBias, &args, sizeof(args));
+}
+
+void DeferredCommandBuffer::SetDepthBounds(float min_depth_bounds,
+                                           float max_depth_bounds) {
+  SetDepthBoundsArgs args = {min_depth_bounds, max_depth_bounds};
+  Write(Command::kSetDepthBounds, &args, sizeof(args));
+}
+
+void DeferredCommandBuffer::SetStencilCompareMask(VkStencilFaceFlags face_mask,
+                                                  uint32_t compare_mask) {
+  SetStencilArgs args = {face_mask, compare_mask};
+  Write(Command::kSetStencilCompareMask, &args, sizeof(args));
+}
+
+void DeferredCommandBuffer::SetStencilReference(VkStencilFaceFlags face_mask,
+                                                uint32_t reference) {
+  SetStencilArgs args = {face_mask, reference};
+  Write(Command::kSetStencilReference, &args, sizeof(args));
+}
+
+void DeferredCommandBuffer::SetStencilWriteMask(VkStencilFaceFlags face_mask,
+                                                uint32_t write_mask) {
+  SetStencilArgs args = {face_mask, write_mask};
+  Write(Command::kSetStencilWriteMask, &args, sizeof(args));
+}
+
+void DeferredCommandBuffer::SetExtendedDynamicState(
+    const ExtendedDynamicState& state) {
+  assert_true(device_->has_extended_dynamic_state());
+  Write(Command::kSetExtendedDynamicState, &state, sizeof(state));
+}
+
+void DeferredCommandBuffer::PushConstants(VkPipelineLayout layout,
+                                          VkShaderStageFlags stage_flags,
+                                          uint32_t offset, uint32_t size,
+                                          const void* values) {
+  PushConstantsArgs args = {layout, stage_flags, offset, size};
+  Write(Command::kPushConstants, &args, sizeof(args), values, size);
+}
+
+void DeferredCommandBuffer::BindDescriptorSets(
+    VkPipelineLayout layout, uint32_t first_set, uint32_t set_count,
+    const VkDescriptorSet* sets, uint32_t dynamic_offset_count,
+    const uint32_t* dynamic_offsets) {
+  BindDescriptorSetsArgs args = {layout, first_set, set_count,
+                                 dynamic_offset_count};
+  Write(Command::kBindDescriptorSets, &args, sizeof(args), sets,
+        sizeof(VkDescriptorSet) * set_count, dynamic_offsets,
+        sizeof(uint32_t) * dynamic_offset_count);
+}
+
+void DeferredCommandBuffer::BindIndexBuffer(VkBuffer buffer,
+                                            VkDeviceSize offset,
+                                            VkIndexType index_type) {
+  BindIndexBufferArgs args = {buffer, offset, index_type};
+  Write(Command::kBindIndexBuffer, &args, sizeof(args));
+}
+
+void DeferredCommandBuffer::BindVertexBuffers(uint32_t first_binding,
+                                              uint32_t binding_count,
+                                              const VkBuffer* buffers,
+                                              const VkDeviceSize* offsets) {
+  BindVertexBuffersArgs args = {first_binding, binding_count};
+  Write(Command::kBindVertexBuffers, &args, sizeof(args), buffers,
+        sizeof(VkBuffer) * binding_count, offsets,
+        sizeof(VkDeviceSize) * binding_count);
+}
+
+void DeferredCommandBuffer::Draw(uint32_t vertex_count,
+                                 uint32_t instance_count,
+                                 uint32_t first_vertex,
+                                 uint32_t first_instance) {
+  DrawArgs args = {vertex_count, instance_count, first_vertex, first_instance};
+  Write(Command::kDraw, &args, sizeof(args));
+  ++draw_count_;
+}
+
+void DeferredCommandBuffer::DrawIndexed(uint32_t index_count,
+                                        uint32_t instance_count,
+                                        uint32_t first_index,
+                                        int32_t vertex_offset,
+                                        uint32_t first_instance) {
+  DrawIndexedArgs args = {index_count, instance_count, first_index,
+                          vertex_offset, first_instance};
+  Write(Command::kDrawIndexed, &args, sizeof(args));
+  ++draw_count_;
+}
+
+void DeferredCommandBuffer::BeginQuery(VkQueryPool query_pool, uint32_t query,
+                                       VkQueryControlFlags flags) {
+  QueryArgs args = {query_pool, query, flags};
+  Write(Command::kBeginQuery, &args, sizeof(args));
+}
+
+void DeferredCommandBuffer::EndQuery(VkQueryPool query_pool, uint32_t query) {
+  QueryArgs args = {query_pool, query, 0};
+  Write(Command::kEndQuery, &args, sizeof(args));
+}
+
+void DeferredCommandBuffer::Replay(VkCommandBuffer command_buffer) const {
+  size_t offset = 0;
+  while (offset < data_.size()) {
+    uint64_t header = data_[offset];
+    auto command = Command(uint32_t(header));
+    auto args = reinterpret_cast<const uint8_t*>(&data_[offset + 1]);
+    offset += 1 + size_t(header >> 32);
+    switch (command) {
+      case Command::kBindPipeline:
+        vkCmdBindPipeline(command_buffer, VK_PIPELINE_BIND_POINT_GRAPHICS,
+                          ReadArgs<VkPipeline>(args));
+        break;
+      case Command::kSetViewport: {
+        auto viewport = ReadArgs<VkViewport>(args);
+        vkCmdSetViewport(command_buffer, 0, 1, &viewport);
+      } break;
+      case Command::kSetScissor: {
+        auto scissor = ReadArgs<VkRect2D>(args);
+        vkCmdSetScissor(command_buffer, 0, 1, &scissor);
+      } break;
+      case Command::kSetBlendConstants: {
+        float blend_constants[4];
+        std::memcpy(blend_constants, args, sizeof(blend_constants));
+        vkCmdSetBlendConstants(command_buffer, blend_constants);
+      } break;
+      case Command::kSetLineWidth:
+        vkCmdSetLineWidth(command_buffer, ReadArgs<float>(args));
+        break;
+      case Command::kSetDepthBias: {
+        auto bias = ReadArgs<SetDepthBiasArgs>(args);
+        vkCmdSetDepthBias(command_buffer, bias.constant_factor, bias.clamp,
+                          bias.slope_factor);
+      } break;
+      case Command::kSetDepthBounds: {
+        auto bounds = ReadArgs<SetDepthBoundsArgs>(args);
+        vkCmdSetDepthBounds(command_buffer, bounds.min_depth_bounds,
+                            bounds.max_depth_bounds);
+      } break;
+      case Command::kSetStencilCompareMask: {
+        auto stencil = ReadArgs<SetStencilArgs>(args);
+        vkCmdSetStencilCompareMask(command_buffer, stencil.face_mask,
+                                   stencil.value);
+      } break;
+      case Command::kSetStencilReference: {
+        auto stencil = ReadArgs<SetStencilArgs>(args);
+        vkCmdSetStencilReference(command_buffer, stencil.face_mask,
+                                 stencil.value);
+      } break;
+      case Command::kSetStencilWriteMask: {
+        auto stencil = ReadArgs<SetStencilArgs>(args);
+        vkCmdSetStencilWriteMask(command_buffer, stencil.face_mask,
+                                 stencil.value);
+      } break;
+      case Command::kSetExtendedDynamicState: {
+        auto state = ReadArgs<ExtendedDynamicState>(args);
+        auto& functions = device_->extended_dynamic_state();
+        functions.vkCmdSetCullModeEXT(command_buffer, state.cull_mode);
+        functions.vkCmdSetFrontFaceEXT(command_buffer, state.front_face);
+        functions.vkCmdSetPrimitiveTopologyEXT(command_buffer,
+                                               state.primitive_topology);
+        functions.vkCmdSetDepthTestEnableEXT(command_buffer,
+                                             state.depth_test_enable);
+        functions.vkCmdSetDepthWriteEnableEXT(command_buffer,
+                                              state.depth_write_enable);
+        functions.vkCmdSetDepthCompareOpEXT(command_buffer,
+                                            state.depth_compare_op);
+        functions.vkCmdSetStencilTestEnableEXT(command_buffer,
+                                               state.stencil_test_enable);
+        functions.vkCmdSetStencilOpEXT(
+            command_buffer, VK_STENCIL_FACE_FRONT_BIT, state.front_fail_op,
+            state.front_pass_op, state.front_depth_fail_op,
+            state.front_compare_op);
+        functions.vkCmdSetStencilOpEXT(
+            command_buffer, VK_STENCIL_FACE_BACK_BIT, state.back_fail_op,
+            state.back_pass_op, state.back_depth_fail_op,
+            state.back_compare_op);
+      } break;
+      case Command::kPushConstants: {
+        auto push = ReadArgs<PushConstantsArgs>(args);
+        size_t values_offset = (sizeof(push) + 7) & ~size_t(7);
+        vkCmdPushConstants(command_buffer, push.layout, push.stage_flags,
+                           push.offset, push.size, args + values_offset);
+      } break;
+      case Command::kBindDescriptorSets: {
+        auto bind = ReadArgs<BindDescriptorSetsArgs>(args);
+        size_t sets_offset = (sizeof(bind) + 7) & ~size_t(7);
+        size_t dynamic_offsets_offset =
+            (sets_offset + sizeof(VkDescriptorSet) * bind.set_count + 7) &
+            ~size_t(7);
+        vkCmdBindDescriptorSets(
+            command_buffer, VK_PIPELINE_BIND_POINT_GRAPHICS, bind.layout,
+            bind.first_set, bind.set_count,
+            reinterpret_cast<const VkDescriptorSet*>(args + sets_offset),
+            bind.dynamic_offset_count,
+            reinterpret_cast<const uint32_t*>(args + dynamic_offsets_offset));
+      } break;
+      case Command::kBindIndexBuffer: {
+        auto bind = ReadArgs<BindIndexBufferArgs>(args);
+        vkCmdBindIndexBuffer(command_buffer, bind.buffer, bind.offset,
+                             bind.index_type);
+      } break;
+      case Command::kBindVertexBuffers: {
+        auto bind = ReadArgs<BindVertexBuffersArgs>(args);
+        size_t buffers_offset = (sizeof(bind) + 7) & ~size_t(7);
+        size_t offsets_offset =
+            (buffers_offset + sizeof(VkBuffer) * bind.binding_count + 7) &
+            ~size_t(7);
+        vkCmdBindVertexBuffers(
+            command_buffer, bind.first_binding, bind.binding_count,
+            reinterpret_cast<const VkBuffer*>(args + buffers_offset),
+            reinterpret_cast<const VkDeviceSize*>(args + offsets_offset));
+      } break;
+      case Command::kDraw: {
+        auto draw = ReadArgs<DrawArgs>(args);
+        vkCmdDraw(command_buffer, draw.vertex_count, draw.instance_count,
+                  draw.first_vertex, draw.first_instance);
+      } break;
+      case Command::kDrawIndexed: {
+        auto draw = ReadArgs<DrawIndexedArgs>(args);
+        vkCmdDrawIndexed(command_buffer, draw.index_count, draw.instance_count,
+                         draw.first_index, draw.vertex_offset,
+                         draw.first_instance);
+      } break;
+      case Command::kBeginQuery: {
+        auto query = ReadArgs<QueryArgs>(args);
+        vkCmdBeginQuery(command_buffer, query.query_pool, query.query,
+                        query.flags);
+      } break;
+      case Command::kEndQuery: {
+        auto query = ReadArgs<QueryArgs>(args);
+        vkCmdEndQuery(command_buffer, query.query_pool, query.query);
+      } break;
+      default:
+        assert_unhandled_case(command);
+        return;
+    }
+  }
+}
+
+}  // namespace vulkan
+}  // namespace gpu
+}  // namespace xe
@@ -0,0 +1,130 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2016 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#ifndef XENIA_GPU_VULKAN_DEFERRED_COMMAND_BUFFER_H_
+#define XENIA_GPU_VULKAN_DEFERRED_COMMAND_BUFFER_H_
+
+#include <cstdint>
+#include <vector>
+
+#include "xenia/ui/vulkan/vulkan.h"
+#include "xenia/ui/vulkan/vulkan_device.h"
+
+namespace xe {
+namespace gpu {
+namespace vulkan {
+
+// Draw commands stored in memory so that they can be recorded into a command
+// buffer later, possibly on another thread. Only holds what draws within a
+// render pass need, and everything is bound to the graphics bind point.
+class DeferredCommandBuffer {
+ public:
+  // The device is only needed for the entry points of extensions.
+  explicit DeferredCommandBuffer(const ui::vulkan::VulkanDevice* device)
+      : device_(device) {}
+
+  bool empty() const { return data_.empty(); }
+  uint32_t draw_count() const { return draw_count_; }
+
+  // Drops all commands, keeping the memory for reuse.
+  void Reset();
+  // Records all commands into the command buffer, in order.
+  void Replay(VkCommandBuffer command_buffer) const;
+
+  void BindPipeline(VkPipeline pipeline);
+  void SetViewport(const VkViewport& viewport);
+  void SetScissor(const VkRect2D& scissor);
+  void SetBlendConstants(const float blend_constants[4]);
+  void SetLineWidth(float line_width);
+  void SetDepthBias(float constant_factor, float clamp, float slope_factor);
+  void SetDepthBounds(float min_depth_bounds, float max_depth_bounds);
+  void SetStencilCompareMask(VkStencilFaceFlags face_mask,
+                             uint32_t compare_mask);
+  void SetStencilReference(VkStencilFaceFlags face_mask, uint32_t reference);
+  void SetStencilWriteMask(VkStencilFaceFlags face_mask, uint32_t write_mask);
+  // All of the state of VK_EXT_extended_dynamic_state that pipelines leave
+  // dynamic, set at once. Requires the device to have the extension.
+  struct ExtendedDynamicState {
+    VkCullModeFlags cull_mode;
+    VkFrontFace front_face;
+    VkPrimitiveTopology primitive_topology;
+    VkBool32 depth_test_enable;
+    VkBool32 depth_write_enable;
+    VkCompareOp depth_compare_op;
+    VkBool32 stencil_test_enable;
+    VkStencilOp front_fail_op;
+    VkStencilOp front_pass_op;
+    VkStencilOp front_depth_fail_op;
+    VkCompareOp front_compare_op;
+    VkStencilOp back_fail_op;
+    VkStencilOp back_pass_op;
+    VkStencilOp back_depth_fail_op;
+    VkCompareOp back_compare_op;
+  };
+  void SetExtendedDynamicState(const ExtendedDynamicState& state);
+  void PushConstants(VkPipelineLayout layout, VkShaderStageFlags stage_flags,
+                     uint32_t offset, uint32_t size, const void* values);
+  void BindDescriptorSets(VkPipelineLayout layout, uint32_t first_set,
+                          uint32_t set_count, const VkDescriptorSet* sets,
+                          uint32_t dynamic_offset_count,
+                          const uint32_t* dynamic_offsets);
+  void BindIndexBuffer(VkBuffer buffer, VkDeviceSize offset,
+                       VkIndexType index_type);
+  void BindVertexBuffers(uint32_t first_binding, uint32_t binding_count,
+                         const VkBuffer* buffers, const VkDeviceSize* offsets);
+  void Draw(uint32_t vertex_count, uint32_t instance_count,
+            uint32_t first_vertex, uint32_t first_instance);
+  void DrawIndexed(uint32_t index_count, uint32_t instance_count,
+                   uint32_t first_index, int32_t vertex_offset,
+                   uint32_t first_instance);
+  void BeginQuery(VkQueryPool query_pool, uint32_t query,
+                  VkQueryControlFlags flags);
+  void EndQuery(VkQueryPool query_pool, uint32_t query);
+
+ private:
+  enum class Command : uint32_t {
+    kBindPipeline,
+    kSetViewport,
+    kSetScissor,
+    kSetBlendConstants,
+    kSetLineWidth,
+    kSetDepthBias,
+    kSetDepthBounds,
+    kSetStencilCompareMask,
+    kSetStencilReference,
+    kSetStencilWriteMask,
+    kSetExtendedDynamicState,
+    kPushConstants,
+    kBindDescriptorSets,
+    kBindIndexBuffer,
+    kBindVertexBuffers,
+    kDraw,
+    kDrawIndexed,
+    kBeginQuery,
+    kEndQuery,
+  };
+
+  // Appends a command with its arguments, followed by up to two arrays.
+  void Write(Command command, const void* args, size_t args_size,
+             const void* array_a = nullptr, size_t array_a_size = 0,
+             const void* array_b = nullptr, size_t array_b_size = 0);
+
+  // Each command is a word with its type in the low and the number of words
+  // of arguments following it in the high 32 bits. Handles and sizes in the
+  // arguments are 64-bit, so everything is kept 8-byte aligned.
+  const ui::vulkan::VulkanDevice* device_ = nullptr;
+  std::vector<uint64_t> data_;
+  uint32_t draw_count_ = 0;
+};
+
+}  // namespace vulkan
+}  // namespace gpu
+}  // namespace xe
+
+#endif  // XENIA_GPU_VULKAN_DEFERRED_COMMAND_BUFFER_H_
@@ -0,0 +1,202 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2016 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#include "xenia/gpu/vulkan/draw_recorder.h"
+
+#include <string>
+
+#include "xenia/base/assert.h"
+#include "xenia/base/profiling.h"
+#include "xenia/ui/vulkan/vulkan_util.h"
+
+namespace xe {
+namespace gpu {
+namespace vulkan {
+
+using xe::ui::vulkan::CheckResult;
+
+DrawRecorder::DrawRecorder(ui::vulkan::VulkanDevice* device,
+                           uint32_t thread_count)
+    : device_(device) {
+  for (uint32_t i = 0; i < thread_count; ++i) {
+    auto worker = std::make_unique<Worker>();
+    worker->command_buffer_pool =
+        std::make_unique<ui::vulkan::CommandBufferPool>(
+            *device_, device_->queue_family_index(),
+            VK_COMMAND_BUFFER_LEVEL_SECONDARY);
+    auto worker_ptr = worker.get();
+    worker->thread = xe::threading::Thread::Create(
+        {}, [this, worker_ptr]() { WorkerThreadMain(worker_ptr); });
+    worker->thread->set_name("xe::gpu::vulkan::DrawRecorder " +
+                             std::to_string(i));
+    workers_.push_back(std::move(worker));
+  }
+}
+
+DrawRecorder::~DrawRecorder() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    shutdown_ = true;
+  }
+  work_cond_.notify_all();
+  for (auto& worker : workers_) {
+    xe::threading::Wait(worker->thread.get(), false);
+  }
+  workers_.clear();
+  jobs_.clear();
+}
+
+std::unique_ptr<DeferredCommandBuffer> DrawRecorder::AcquireCommands() {
+  if (free_commands_.empty()) {
+    return std::make_unique<DeferredCommandBuffer>(device_);
+  }
+  auto commands = std::move(free_commands_.back());
+  free_commands_.pop_back();
+  return commands;
+}
+
+void DrawRecorder::Record(std::unique_ptr<DeferredCommandBuffer>* commands,
+                          VkRenderPass render_pass, VkFramebuffer framebuffer) {
+  if (!batch_open_) {
+    // No worker is busy, as nothing has been queued in this batch yet.
+    for (auto& worker : workers_) {
+      worker->command_buffer_pool->BeginBatch();
+    }
+    batch_open_ = true;
+  }
+
+  auto job = std::make_unique<Job>();
+  job->commands = std::move(*commands);
+  job->render_pass = render_pass;
+  job->framebuffer = framebuffer;
+  job->command_buffer = nullptr;
+  *commands = AcquireCommands();
+
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    workers_[next_worker_]->queue.push_back(job.get());
+    ++pending_job_count_;
+  }
+  work_cond_.notify_all();
+  next_worker_ = (next_worker_ + 1) % workers_.size();
+  jobs_.push_back(std::move(job));
+}
+
+void DrawRecorder::WaitForJobs() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  done_cond_.wait(lock, [this]() { return !pending_job_count_; });
+}
+
+void DrawRecorder::ExecuteRecorded(VkCommandBuffer command_buffer) {
+  if (jobs_.empty()) {
+    return;
+  }
+  {
+    SCOPE_profile_cpu_i("gpu", "xe::gpu::vulkan::DrawRecorder::Wait");
+    WaitForJobs();
+  }
+
+  std::vector<VkCommandBuffer> command_buffers;
+  command_buffers.reserve(jobs_.size());
+  for (auto& job : jobs_) {
+    command_buffers.push_back(job->command_buffer);
+    job->commands->Reset();
+    free_commands_.push_back(std::move(job->commands));
+  }
+  jobs_.clear();
+  vkCmdExecuteCommands(command_buffer, uint32_t(command_buffers.size()),
+                       command_buffers.data());
+}
+
+void DrawRecorder::EndBatch(std::shared_ptr<ui::vulkan::Fence> fence) {
+  assert_true(jobs_.empty());
+  if (!batch_open_) {
+    return;
+  }
+  for (auto& worker : workers_) {
+    worker->command_buffer_pool->EndBatch(fence);
+  }
+  batch_open_ = false;
+}
+
+void DrawRecorder::CancelBatch() {
+  if (!jobs_.empty()) {
+    WaitForJobs();
+    for (auto& job : jobs_) {
+      job->commands->Reset();
+      free_commands_.push_back(std::move(job->commands));
+    }
+    jobs_.clear();
+  }
+  if (!batch_open_) {
+    return;
+  }
+  for (auto& worker : workers_) {
+    worker->command_buffer_pool->CancelBatch();
+  }
+  batch_open_ = false;
+}
+
+void DrawRecorder::Scavenge() {
+  assert_true(jobs_.empty());
+  for (auto& worker : workers_) {
+    worker->command_buffer_pool->Scavenge();
+  }
+}
+
+void DrawRecorder::WorkerThreadMain(Worker* worker) {
+  while (true) {
+    Job* job;
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      work_cond_.wait(lock, [this, worker]() {
+        return shutdown_ || !worker->queue.empty();
+      });
+      if (shutdown_) {
+        return;
+      }
+      job = worker->queue.front();
+      worker->queue.pop_front();
+    }
+
+    VkCommandBufferInheritanceInfo inheritance_info;
+    inheritance_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_INFO;
+    inheritance_info.pNext = nullptr;
+    inheritance_info.renderPass = job->render_pass;
+    inheritance_info.subpass = 0;
+    inheritance_info.framebuffer = job->framebuffer;
+    inheritance_info.occlusionQueryEnable = VK_FALSE;
+    inheritance_info.queryFlags = 0;
+    inheritance_info.pipelineStatistics = 0;
+    VkCommandBufferBeginInfo begin_info;
+    begin_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+    begin_info.pNext = nullptr;
+    begin_info.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT |
+                       VK_COMMAND_BUFFER_USAGE_RENDER_PASS_CONTINUE_BIT;
+    begin_info.pInheritanceInfo = &inheritance_info;
+
+    auto command_buffer = worker->command_buffer_pool->AcquireEntry();
+    auto status = vkBeginCommandBuffer(command_buffer, &begin_info);
+    CheckResult(status, "vkBeginCommandBuffer");
+    job->commands->Replay(command_buffer);
+    status = vkEndCommandBuffer(command_buffer);
+    CheckResult(status, "vkEndCommandBuffer");
+    job->command_buffer = command_buffer;
+
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      --pending_job_count_;
+    }
+    done_cond_.notify_all();
+  }
+}
+
+}  // namespace vulkan
+}  // namespace gpu
+}  // namespace xe
@@ -0,0 +1,96 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2016 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#ifndef XENIA_GPU_VULKAN_DRAW_RECORDER_H_
+#define XENIA_GPU_VULKAN_DRAW_RECORDER_H_
+
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "xenia/base/threading.h"
+#include "xenia/gpu/vulkan/deferred_command_buffer.h"
+#include "xenia/ui/vulkan/fenced_pools.h"
+#include "xenia/ui/vulkan/vulkan.h"
+#include "xenia/ui/vulkan/vulkan_device.h"
+
+namespace xe {
+namespace gpu {
+namespace vulkan {
+
+// Records draw commands into secondary command buffers on worker threads,
+// while the command processor thread goes on setting up the next draws.
+// Each worker has its own command buffer pool, which only it touches while
+// work is queued. Everything recorded has to be executed before the batch
+// is ended or canceled.
+class DrawRecorder {
+ public:
+  DrawRecorder(ui::vulkan::VulkanDevice* device, uint32_t thread_count);
+  ~DrawRecorder();
+
+  // Returns an empty command buffer to store draw commands in.
+  std::unique_ptr<DeferredCommandBuffer> AcquireCommands();
+  // Queues the commands to be recorded for use within subpass 0 of the
+  // render pass, replacing them with an empty command buffer.
+  void Record(std::unique_ptr<DeferredCommandBuffer>* commands,
+              VkRenderPass render_pass, VkFramebuffer framebuffer);
+  // Waits for everything queued to be recorded, and then executes the
+  // secondary command buffers in the render pass open in command_buffer in
+  // the order they were queued.
+  void ExecuteRecorded(VkCommandBuffer command_buffer);
+
+  // Command buffers recorded since the batch was last ended are reused once
+  // the fence is signaled.
+  void EndBatch(std::shared_ptr<ui::vulkan::Fence> fence);
+  void CancelBatch();
+  void Scavenge();
+
+ private:
+  struct Job {
+    std::unique_ptr<DeferredCommandBuffer> commands;
+    VkRenderPass render_pass;
+    VkFramebuffer framebuffer;
+    // Recorded secondary command buffer.
+    VkCommandBuffer command_buffer;
+  };
+  struct Worker {
+    std::unique_ptr<xe::threading::Thread> thread;
+    std::unique_ptr<ui::vulkan::CommandBufferPool> command_buffer_pool;
+    std::deque<Job*> queue;
+  };
+
+  void WorkerThreadMain(Worker* worker);
+  // Waits until all queued jobs have been recorded.
+  void WaitForJobs();
+
+  ui::vulkan::VulkanDevice* device_ = nullptr;
+  std::vector<std::unique_ptr<Worker>> workers_;
+  size_t next_worker_ = 0;
+  // Whether the worker pools have an open batch, begun with the first job.
+  bool batch_open_ = false;
+
+  // Jobs queued since the last ExecuteRecorded, in order.
+  std::vector<std::unique_ptr<Job>> jobs_;
+  std::vector<std::unique_ptr<DeferredCommandBuffer>> free_commands_;
+
+  // Guards the worker queues and pending_job_count_.
+  std::mutex mutex_;
+  std::condition_variable work_cond_;
+  std::condition_variable done_cond_;
+  size_t pending_job_count_ = 0;
+  bool shutdown_ = false;
+};
+
+}  // namespace vulkan
+}  // namespace gpu
+}  // namespace xe
+
+#endif  // XENIA_GPU_VULKAN_DRAW_RECORDER_H_
@@ -0,0 +1,323 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2016 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#include "xenia/gpu/vulkan/memexport_buffer.h"
+
+#include <cstring>
+
+#include "xenia/base/logging.h"
+#include "xenia/base/memory.h"
+#include "xenia/cpu/mmio_handler.h"
+#include "xenia/gpu/spirv_shader_translator.h"
+
+namespace xe {
+namespace gpu {
+namespace vulkan {
+
+using xe::ui::vulkan::CheckResult;
+
+MemExportBuffer::MemExportBuffer(ui::vulkan::VulkanDevice* device,
+                                 Memory* memory, RegisterFile* register_file)
+    : device_(device), memory_(memory), register_file_(register_file) {
+  // The layout is part of the pipeline layout even if nothing can export.
+  VkDescriptorSetLayoutBinding binding;
+  binding.binding = 0;
+  binding.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+  binding.descriptorCount = 1;
+  binding.stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
+  binding.pImmutableSamplers = nullptr;
+  VkDescriptorSetLayoutCreateInfo descriptor_set_layout_info;
+  descriptor_set_layout_info.sType =
+      VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+  descriptor_set_layout_info.pNext = nullptr;
+  descriptor_set_layout_info.flags = 0;
+  descriptor_set_layout_info.bindingCount = 1;
+  descriptor_set_layout_info.pBindings = &binding;
+  auto err = vkCreateDescriptorSetLayout(*device_, &descriptor_set_layout_info,
+                                         nullptr, &descriptor_set_layout_);
+  CheckResult(err, "vkCreateDescriptorSetLayout");
+
+  if (!device_->device_info().features.vertexPipelineStoresAndAtomics) {
+    XELOGW("Vulkan: vertex shader stores unsupported, memexport disabled");
+    return;
+  }
+  buffer_ = std::make_unique<ui::vulkan::CircularBuffer>(device_);
+  if (!buffer_->Initialize(kCapacity, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT)) {
+    XELOGE("Vulkan: unable to create the memexport buffer");
+    buffer_.reset();
+    return;
+  }
+
+  VkDescriptorPoolCreateInfo descriptor_pool_info;
+  descriptor_pool_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+  descriptor_pool_info.pNext = nullptr;
+  descriptor_pool_info.flags =
+      VK_DESCRIPTOR_POOL_CREATE_FREE_DESCRIPTOR_SET_BIT;
+  descriptor_pool_info.maxSets = 1;
+  VkDescriptorPoolSize pool_size;
+  pool_size.type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+  pool_size.descriptorCount = 1;
+  descriptor_pool_info.poolSizeCount = 1;
+  descriptor_pool_info.pPoolSizes = &pool_size;
+  err = vkCreateDescriptorPool(*device_, &descriptor_pool_info, nullptr,
+                               &descriptor_pool_);
+  CheckResult(err, "vkCreateDescriptorPool");
+
+  // Draws are given their ranges with push constants, so one set over the
+  // whole buffer does for all of them.
+  VkDescriptorSetAllocateInfo set_alloc_info;
+  set_alloc_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+  set_alloc_info.pNext = nullptr;
+  set_alloc_info.descriptorPool = descriptor_pool_;
+  set_alloc_info.descriptorSetCount = 1;
+  set_alloc_info.pSetLayouts = &descriptor_set_layout_;
+  err = vkAllocateDescriptorSets(*device_, &set_alloc_info, &descriptor_set_);
+  CheckResult(err, "vkAllocateDescriptorSets");
+
+  VkDescriptorBufferInfo buffer_info;
+  buffer_info.buffer = buffer_->gpu_buffer();
+  buffer_info.offset = 0;
+  buffer_info.range = VK_WHOLE_SIZE;
+  VkWriteDescriptorSet descriptor_write;
+  descriptor_write.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+  descriptor_write.pNext = nullptr;
+  descriptor_write.dstSet = descriptor_set_;
+  descriptor_write.dstBinding = 0;
+  descriptor_write.dstArrayElement = 0;
+  descriptor_write.descriptorCount = 1;
+  descriptor_write.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+  descriptor_write.pImageInfo = nullptr;
+  descriptor_write.pBufferInfo = &buffer_info;
+  descriptor_write.pTexelBufferView = nullptr;
+  vkUpdateDescriptorSets(*device_, 1, &descriptor_write, 0, nullptr);
+}
+
+MemExportBuffer::~MemExportBuffer() {
+  if (descriptor_set_) {
+    vkFreeDescriptorSets(*device_, descriptor_pool_, 1, &descriptor_set_);
+  }
+  if (descriptor_pool_) {
+    vkDestroyDescriptorPool(*device_, descriptor_pool_, nullptr);
+  }
+  vkDestroyDescriptorSetLayout(*device_, descriptor_set_layout_, nullptr);
+  if (buffer_) {
+    buffer_->Shutdown();
+  }
+}
+
+uint32_t MemExportBuffer::GetElementWordCount(ColorFormat format) {
+  // Matches the packing in SpirvShaderTranslator::EmitMemExport.
+  switch (format) {
+    case ColorFormat::k_8_8_8_8:
+    case ColorFormat::k_16_16_FLOAT:
+    case ColorFormat::k_32_FLOAT:
+      return 1;
+    case ColorFormat::k_16_16_16_16_FLOAT:
+    case ColorFormat::k_32_32_FLOAT:
+      return 2;
+    case ColorFormat::k_32_32_32_32_FLOAT:
+      return 4;
+    default:
+      return 0;
+  }
+}
+
+void MemExportBuffer::CopyAndSwap(void* dest, const void* src, size_t length,
+                                  Endian128 endian) {
+  switch (endian) {
+    case Endian128::k8in16:
+      xe::copy_and_swap_16_unaligned(dest, src, length / 2);
+      break;
+    case Endian128::k8in32:
+      xe::copy_and_swap_32_unaligned(dest, src, length / 4);
+      break;
+    case Endian128::k16in32:
+      xe::copy_and_swap_16_in_32_aligned(dest, src, length / 4);
+      break;
+    case Endian128::k8in64:
+      xe::copy_and_swap_64_unaligned(dest, src, length / 8);
+      break;
+    default:
+      std::memcpy(dest, src, length);
+      break;
+  }
+}
+
+bool MemExportBuffer::PrepareDraw(const Shader* vertex_shader,
+                                  DeferredCommandBuffer* command_buffer,
+                                  VkPipelineLayout pipeline_layout,
+                                  std::shared_ptr<ui::vulkan::Fence> fence) {
+  const auto& stream_constants = vertex_shader->memexport_stream_constants();
+  if (stream_constants.empty() ||
+      !device_->device_info().features.vertexPipelineStoresAndAtomics) {
+    // Shaders drop their exports when the device can't store them.
+    return true;
+  }
+  if (!descriptor_set_) {
+    return false;
+  }
+
+  // Elements are only written within the range, so it's left empty when
+  // nothing can be exported.
+  uint32_t range[2] = {0, 0};
+  if (stream_constants.size() > 1 && !warned_unsupported_) {
+    XELOGW("Vulkan: only the first memexport stream of a shader is exported");
+    warned_unsupported_ = true;
+  }
+  xenos::xe_gpu_memexport_stream_t stream;
+  uint32_t stream_register =
+      XE_GPU_REG_SHADER_CONSTANT_000_X + stream_constants[0] * 4;
+  stream.dword_0 = register_file_->values[stream_register].u32;
+  stream.dword_1 = register_file_->values[stream_register + 1].u32;
+  stream.dword_2 = register_file_->values[stream_register + 2].u32;
+  stream.dword_3 = register_file_->values[stream_register + 3].u32;
+  auto endian = static_cast<Endian128>(stream.endianness);
+  uint32_t word_count =
+      GetElementWordCount(static_cast<ColorFormat>(stream.format));
+  uint32_t length = stream.index_count * word_count * 4;
+  uint32_t guest_address = (stream.base_address << 2) & 0x1FFFFFFF;
+  if (!word_count || endian == Endian128::k8in128) {
+    if (!warned_unsupported_) {
+      XELOGW("Vulkan: memexport format %u, endianness %u unsupported",
+             uint32_t(stream.format), uint32_t(stream.endianness));
+      warned_unsupported_ = true;
+    }
+  } else if (length && uint64_t(guest_address) + length <= 0x20000000) {
+    // With a copy each, the draws would write back each other's elements as
+    // they were before the batch.
+    auto shared = FindBatchExport(guest_address, length, endian);
+    auto allocation = shared ? nullptr : buffer_->Acquire(length, fence);
+    if (shared) {
+      range[0] = uint32_t(
+          (shared->offset + (guest_address - shared->guest_address)) / 4);
+      range[1] = range[0] + length / 4;
+    } else if (allocation) {
+      CopyAndSwap(allocation->host_ptr,
+                  memory_->TranslatePhysical(guest_address), length, endian);
+      buffer_->Flush(allocation);
+      range[0] = uint32_t(allocation->offset / 4);
+      range[1] = range[0] + length / 4;
+      Export memexport = {guest_address, length, endian, allocation->offset,
+                          fence};
+      auto host_ptr = reinterpret_cast<const uint8_t*>(allocation->host_ptr);
+      memexport.snapshot.assign(host_ptr, host_ptr + length);
+      exports_.push_back(std::move(memexport));
+      ++batch_export_count_;
+    } else if (!warned_full_) {
+      // Rather than waiting for the GPU, the draw exports nothing.
+      XELOGW("Vulkan: out of memexport buffer space, exports dropped");
+      warned_full_ = true;
+    }
+  }
+
+  command_buffer->BindDescriptorSets(pipeline_layout, 2, 1, &descriptor_set_,
+                                     0, nullptr);
+  command_buffer->PushConstants(
+      pipeline_layout,
+      VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT,
+      kSpirvPushConstantMemExportRangeOffset, sizeof(range), range);
+  return true;
+}
+
+const MemExportBuffer::Export* MemExportBuffer::FindBatchExport(
+    uint32_t guest_address, uint32_t length, Endian128 endian) const {
+  for (size_t i = exports_.size() - batch_export_count_; i < exports_.size();
+       ++i) {
+    auto& memexport = exports_[i];
+    if (memexport.endian == endian &&
+        guest_address >= memexport.guest_address &&
+        guest_address + length <=
+            memexport.guest_address + memexport.length &&
+        !((guest_address - memexport.guest_address) & 3)) {
+      return &memexport;
+    }
+  }
+  return nullptr;
+}
+
+void MemExportBuffer::WriteBack(const Export& memexport) {
+  // Elements the draws left alone aren't written, so exports that partially
+  // overlap keep each other's. Swapped units are compared as a whole.
+  uint32_t unit = 4;
+  if (memexport.endian == Endian128::k8in64 && !(memexport.length & 7)) {
+    unit = 8;
+  }
+  const uint8_t* data = buffer_->host_base() + memexport.offset;
+  const uint8_t* snapshot = memexport.snapshot.data();
+  uint8_t* guest = memory_->TranslatePhysical(memexport.guest_address);
+  bool changed = false;
+  uint32_t run_start = memexport.length;
+  for (uint32_t i = 0; i <= memexport.length; i += unit) {
+    if (i < memexport.length && std::memcmp(data + i, snapshot + i, unit)) {
+      if (run_start == memexport.length) {
+        run_start = i;
+      }
+    } else if (run_start != memexport.length) {
+      CopyAndSwap(guest + run_start, data + run_start, i - run_start,
+                  memexport.endian);
+      run_start = memexport.length;
+      changed = true;
+    }
+  }
+  if (changed) {
+    // Caches watching the range have to see that it changed.
+    cpu::MMIOHandler::global_handler()->InvalidateRange(
+        memexport.guest_address, memexport.length);
+  }
+}
+
+void MemExportBuffer::EndBatch(VkCommandBuffer command_buffer) {
+  if (!batch_export_count_) {
+    return;
+  }
+  batch_export_count_ = 0;
+  VkMemoryBarrier barrier;
+  barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+  barrier.pNext = nullptr;
+  barrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+  barrier.dstAccessMask = VK_ACCESS_HOST_READ_BIT;
+  vkCmdPipelineBarrier(command_buffer, VK_PIPELINE_STAGE_VERTEX_SHADER_BIT,
+                       VK_PIPELINE_STAGE_HOST_BIT, 0, 1, &barrier, 0, nullptr,
+                       0, nullptr);
+}
+
+void MemExportBuffer::CancelBatch() {
+  exports_.resize(exports_.size() - batch_export_count_);
+  batch_export_count_ = 0;
+}
+
+void MemExportBuffer::Scavenge() {
+  if (!buffer_) {
+    return;
+  }
+  // Only the exports of ended batches can be done.
+  size_t done_count = 0;
+  while (done_count < exports_.size() - batch_export_count_ &&
+         exports_[done_count].fence->status() == VK_SUCCESS) {
+    ++done_count;
+  }
+  if (done_count) {
+    VkMappedMemoryRange range;
+    range.sType = VK_STRUCTURE_TYPE_MAPPED_MEMORY_RANGE;
+    range.pNext = nullptr;
+    range.memory = buffer_->gpu_memory();
+    range.offset = 0;
+    range.size = VK_WHOLE_SIZE;
+    vkInvalidateMappedMemoryRanges(*device_, 1, &range);
+  }
+  for (size_t i = 0; i < done_count; ++i) {
+    WriteBack(exports_.front());
+    exports_.pop_front();
+  }
+  buffer_->Scavenge();
+}
+
+}  // namespace vulkan
+}  // namespace gpu
+}  // namespace xe
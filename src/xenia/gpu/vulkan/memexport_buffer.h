@@ -0,0 +1,111 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2016 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#ifndef XENIA_GPU_VULKAN_MEMEXPORT_BUFFER_H_
+#define XENIA_GPU_VULKAN_MEMEXPORT_BUFFER_H_
+
+#include <deque>
+#include <memory>
+#include <vector>
+
+#include "xenia/gpu/register_file.h"
+#include "xenia/gpu/shader.h"
+#include "xenia/gpu/vulkan/deferred_command_buffer.h"
+#include "xenia/gpu/xenos.h"
+#include "xenia/memory.h"
+#include "xenia/ui/vulkan/circular_buffer.h"
+#include "xenia/ui/vulkan/vulkan.h"
+#include "xenia/ui/vulkan/vulkan_device.h"
+
+namespace xe {
+namespace gpu {
+namespace vulkan {
+
+// Storage buffer that vertex shaders write their memexport streams to, in
+// place of guest memory. Each draw that exports gets a range of it filled
+// with the guest data, shared with the later draws of the batch exporting
+// within the same guest range, and the elements written to it are copied
+// back to guest memory once the batch is done. Nothing waits for the GPU, so
+// exports land a batch late.
+class MemExportBuffer {
+ public:
+  MemExportBuffer(ui::vulkan::VulkanDevice* device, Memory* memory,
+                  RegisterFile* register_file);
+  ~MemExportBuffer();
+
+  // Layout of descriptor set 2, with the storage buffer at binding 0 for
+  // vertex shaders.
+  VkDescriptorSetLayout descriptor_set_layout() const {
+    return descriptor_set_layout_;
+  }
+
+  // Binds the buffer and pushes the memexport_range for the stream the
+  // vertex shader exports to, if any. Returns false if the shader stores
+  // exports and the buffer couldn't be created, so that the draw is skipped.
+  bool PrepareDraw(const Shader* vertex_shader,
+                   DeferredCommandBuffer* command_buffer,
+                   VkPipelineLayout pipeline_layout,
+                   std::shared_ptr<ui::vulkan::Fence> fence);
+
+  // Makes the exports of the batch visible to the host, recorded into the
+  // last command buffer of the batch.
+  void EndBatch(VkCommandBuffer command_buffer);
+  // Exports of a batch that was dropped are never written.
+  void CancelBatch();
+  // Writes the exports of the batches that are done to guest memory.
+  void Scavenge();
+
+ private:
+  static const VkDeviceSize kCapacity = 16 * 1024 * 1024;
+
+  struct Export {
+    uint32_t guest_address;
+    uint32_t length;
+    Endian128 endian;
+    VkDeviceSize offset;
+    std::shared_ptr<ui::vulkan::Fence> fence;
+    // The range as it was filled, so that only what the draws changed is
+    // written back over exports that landed since.
+    std::vector<uint8_t> snapshot;
+  };
+
+  // An export of the current batch the range is within, if any.
+  const Export* FindBatchExport(uint32_t guest_address, uint32_t length,
+                                Endian128 endian) const;
+  void WriteBack(const Export& memexport);
+
+  // Words each element of the format takes, 0 if it can't be exported.
+  static uint32_t GetElementWordCount(ColorFormat format);
+  // Swapping is its own inverse, so this is used in both directions.
+  static void CopyAndSwap(void* dest, const void* src, size_t length,
+                          Endian128 endian);
+
+  ui::vulkan::VulkanDevice* device_ = nullptr;
+  Memory* memory_ = nullptr;
+  RegisterFile* register_file_ = nullptr;
+
+  std::unique_ptr<ui::vulkan::CircularBuffer> buffer_;
+  VkDescriptorPool descriptor_pool_ = nullptr;
+  VkDescriptorSetLayout descriptor_set_layout_ = nullptr;
+  // Null if the device can't store from vertex shaders.
+  VkDescriptorSet descriptor_set_ = nullptr;
+
+  // In the order they were made.
+  std::deque<Export> exports_;
+  // Exports made since the last batch was ended or canceled.
+  size_t batch_export_count_ = 0;
+  bool warned_unsupported_ = false;
+  bool warned_full_ = false;
+};
+
+}  // namespace vulkan
+}  // namespace gpu
+}  // namespace xe
+
+#endif  // XENIA_GPU_VULKAN_MEMEXPORT_BUFFER_H_
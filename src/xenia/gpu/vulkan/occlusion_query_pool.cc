@@ -0,0 +1,178 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2016 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#include "xenia/gpu/vulkan/occlusion_query_pool.h"
+
+#include <algorithm>
+#include <cstring>
+
+#include "xenia/base/logging.h"
+#include "xenia/gpu/xenos.h"
+
+namespace xe {
+namespace gpu {
+namespace vulkan {
+
+using xe::ui::vulkan::CheckResult;
+
+OcclusionQueryPool::OcclusionQueryPool(ui::vulkan::VulkanDevice* device,
+                                       Memory* memory)
+    : device_(device), memory_(memory) {
+  VkQueryPoolCreateInfo query_pool_info;
+  std::memset(&query_pool_info, 0, sizeof(query_pool_info));
+  query_pool_info.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+  query_pool_info.queryType = VK_QUERY_TYPE_OCCLUSION;
+  query_pool_info.queryCount = kQueryCount;
+  auto status =
+      vkCreateQueryPool(*device_, &query_pool_info, nullptr, &query_pool_);
+  CheckResult(status, "vkCreateQueryPool");
+  if (status != VK_SUCCESS) {
+    XELOGW("Vulkan: occlusion queries unavailable, sample counts not written");
+    query_pool_ = nullptr;
+    return;
+  }
+  // Without precise queries any non-zero count means some samples passed.
+  if (device_->device_info().features.occlusionQueryPrecise) {
+    control_flags_ = VK_QUERY_CONTROL_PRECISE_BIT;
+  }
+}
+
+OcclusionQueryPool::~OcclusionQueryPool() {
+  if (query_pool_) {
+    vkDestroyQueryPool(*device_, query_pool_, nullptr);
+    query_pool_ = nullptr;
+  }
+}
+
+void OcclusionQueryPool::ZPassDone(uint32_t guest_address) {
+  if (!query_pool_) {
+    return;
+  }
+  auto counts =
+      memory_->TranslatePhysical<xenos::xe_gpu_depth_sample_counts*>(
+          guest_address);
+  bool ends_query = (counts->zpass_a == xenos::kSampleCountsQueryEnd &&
+                     counts->zpass_b == xenos::kSampleCountsQueryEnd) ||
+                    (counts->zfail_a == xenos::kSampleCountsQueryEnd &&
+                     counts->zfail_b == xenos::kSampleCountsQueryEnd);
+  if (ends_query) {
+    open_addresses_.erase(guest_address);
+  } else {
+    std::memset(counts, 0, sizeof(*counts));
+    open_addresses_.insert(guest_address);
+  }
+  events_.push_back({guest_address, next_query_, ends_query});
+  // Handled right away if none of the draws before it are still in flight.
+  ProcessEvents(retired_query_);
+}
+
+uint32_t OcclusionQueryPool::BeginDraw(VkCommandBuffer setup_buffer,
+                                       DeferredCommandBuffer* command_buffer) {
+  if (!query_pool_ || open_addresses_.empty()) {
+    return kNoQuery;
+  }
+  if (next_query_ - retired_query_ >= kQueryCount) {
+    Scavenge();
+    if (next_query_ - retired_query_ >= kQueryCount) {
+      // Rather than waiting for the GPU, the draw goes uncounted.
+      if (!warned_full_) {
+        XELOGW("Vulkan: out of occlusion queries, sample counts will be low");
+        warned_full_ = true;
+      }
+      return kNoQuery;
+    }
+  }
+  uint32_t query = uint32_t(next_query_ % kQueryCount);
+  ++next_query_;
+  vkCmdResetQueryPool(setup_buffer, query_pool_, query, 1);
+  command_buffer->BeginQuery(query_pool_, query, control_flags_);
+  return query;
+}
+
+void OcclusionQueryPool::EndDraw(DeferredCommandBuffer* command_buffer,
+                                 uint32_t query) {
+  if (query != kNoQuery) {
+    command_buffer->EndQuery(query_pool_, query);
+  }
+}
+
+void OcclusionQueryPool::EndBatch(std::shared_ptr<ui::vulkan::Fence> fence) {
+  if (next_query_ == batch_first_query_) {
+    return;
+  }
+  batches_.push_back({batch_first_query_, next_query_, fence});
+  batch_first_query_ = next_query_;
+}
+
+void OcclusionQueryPool::CancelBatch() { EndBatch(nullptr); }
+
+void OcclusionQueryPool::Scavenge() {
+  while (!batches_.empty()) {
+    auto& batch = batches_.front();
+    if (batch.fence && batch.fence->status() != VK_SUCCESS) {
+      break;
+    }
+    uint32_t count = uint32_t(batch.end_query - batch.first_query);
+    results_.assign(count, 0);
+    if (batch.fence) {
+      // The queries of the batch may wrap around the end of the pool.
+      uint32_t first = uint32_t(batch.first_query % kQueryCount);
+      uint32_t first_count = std::min(count, kQueryCount - first);
+      auto status = vkGetQueryPoolResults(
+          *device_, query_pool_, first, first_count,
+          first_count * sizeof(uint64_t), results_.data(), sizeof(uint64_t),
+          VK_QUERY_RESULT_64_BIT);
+      CheckResult(status, "vkGetQueryPoolResults");
+      if (first_count < count) {
+        status = vkGetQueryPoolResults(
+            *device_, query_pool_, 0, count - first_count,
+            (count - first_count) * sizeof(uint64_t),
+            results_.data() + first_count, sizeof(uint64_t),
+            VK_QUERY_RESULT_64_BIT);
+        CheckResult(status, "vkGetQueryPoolResults");
+      }
+    }
+    for (uint32_t i = 0; i < count; ++i) {
+      ProcessEvents(batch.first_query + i);
+      retired_sample_count_ += results_[i];
+    }
+    retired_query_ = batch.end_query;
+    batches_.pop_front();
+  }
+  ProcessEvents(retired_query_);
+}
+
+void OcclusionQueryPool::ProcessEvents(uint64_t query) {
+  while (!events_.empty() && events_.front().query <= query) {
+    auto& event = events_.front();
+    if (!event.ends_query) {
+      begin_sample_counts_[event.guest_address] = retired_sample_count_;
+      events_.pop_front();
+      continue;
+    }
+    // Ended without having begun counts nothing.
+    uint64_t sample_count = 0;
+    auto it = begin_sample_counts_.find(event.guest_address);
+    if (it != begin_sample_counts_.end()) {
+      sample_count = retired_sample_count_ - it->second;
+      begin_sample_counts_.erase(it);
+    }
+    xenos::xe_gpu_depth_sample_counts counts;
+    std::memset(&counts, 0, sizeof(counts));
+    counts.total_a = uint32_t(std::min(sample_count, uint64_t(UINT32_MAX)));
+    counts.zpass_a = counts.total_a;
+    std::memcpy(memory_->TranslatePhysical(event.guest_address), &counts,
+                sizeof(counts));
+    events_.pop_front();
+  }
+}
+
+}  // namespace vulkan
+}  // namespace gpu
+}  // namespace xe
@@ -0,0 +1,105 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2016 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#ifndef XENIA_GPU_VULKAN_OCCLUSION_QUERY_POOL_H_
+#define XENIA_GPU_VULKAN_OCCLUSION_QUERY_POOL_H_
+
+#include <deque>
+#include <memory>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include "xenia/gpu/vulkan/deferred_command_buffer.h"
+#include "xenia/memory.h"
+#include "xenia/ui/vulkan/vulkan.h"
+#include "xenia/ui/vulkan/vulkan_device.h"
+#include "xenia/ui/vulkan/vulkan_util.h"
+
+namespace xe {
+namespace gpu {
+namespace vulkan {
+
+// Counts the samples passing the depth and stencil tests for the guest
+// queries begun and ended by ZPASS_DONE events. While any query is open,
+// every draw gets an occlusion query of its own, as Vulkan queries can't
+// span render passes. The counts are written to guest memory once the
+// batches with the draws are done, so nothing waits for the GPU.
+class OcclusionQueryPool {
+ public:
+  OcclusionQueryPool(ui::vulkan::VulkanDevice* device, Memory* memory);
+  ~OcclusionQueryPool();
+
+  static const uint32_t kNoQuery = UINT32_MAX;
+
+  // Begins or ends the guest query with its counts at the address.
+  void ZPassDone(uint32_t guest_address);
+
+  // Begins counting the samples of a draw if any guest query is open,
+  // recording the reset of the query into setup_buffer. Returns the query to
+  // end after the draw, or kNoQuery.
+  uint32_t BeginDraw(VkCommandBuffer setup_buffer,
+                     DeferredCommandBuffer* command_buffer);
+  void EndDraw(DeferredCommandBuffer* command_buffer, uint32_t query);
+
+  // The draws counted since the last batch was ended or canceled are read
+  // back once the fence is signaled.
+  void EndBatch(std::shared_ptr<ui::vulkan::Fence> fence);
+  // Draws of a batch that was dropped count no samples.
+  void CancelBatch();
+  // Writes the counts of the guest queries whose draws are done.
+  void Scavenge();
+
+ private:
+  static const uint32_t kQueryCount = 8192;
+
+  // Queries are numbered in the order they're handed out, and a query is
+  // at index query % kQueryCount of the pool.
+  struct Batch {
+    uint64_t first_query;
+    uint64_t end_query;
+    // Null for canceled batches.
+    std::shared_ptr<ui::vulkan::Fence> fence;
+  };
+  // A ZPASS_DONE, which counts the draws before the first query after it.
+  struct Event {
+    uint32_t guest_address;
+    uint64_t query;
+    bool ends_query;
+  };
+
+  // Handles the events at or before the query, for which all samples of
+  // earlier queries have been added to retired_sample_count_.
+  void ProcessEvents(uint64_t query);
+
+  ui::vulkan::VulkanDevice* device_ = nullptr;
+  Memory* memory_ = nullptr;
+  VkQueryPool query_pool_ = nullptr;
+  VkQueryControlFlags control_flags_ = 0;
+
+  // Guest queries begun and not yet ended by the command processor.
+  std::unordered_set<uint32_t> open_addresses_;
+  std::deque<Event> events_;
+  std::deque<Batch> batches_;
+  uint64_t next_query_ = 0;
+  uint64_t batch_first_query_ = 0;
+  // Queries before this have been read back, and their samples added up.
+  uint64_t retired_query_ = 0;
+  uint64_t retired_sample_count_ = 0;
+  // retired_sample_count_ when the retired guest queries began.
+  std::unordered_map<uint32_t, uint64_t> begin_sample_counts_;
+  std::vector<uint64_t> results_;
+  bool warned_full_ = false;
+};
+
+}  // namespace vulkan
+}  // namespace gpu
+}  // namespace xe
+
+#endif  // XENIA_GPU_VULKAN_OCCLUSION_QUERY_POOL_H_
@@ -10,15 +10,20 @@
 #include "xenia/gpu/vulkan/pipeline_cache.h"
 
 #include "third_party/xxhash/xxhash.h"
+#include "xenia/base/filesystem.h"
 #include "xenia/base/logging.h"
 #include "xenia/base/math.h"
 #include "xenia/base/memory.h"
 #include "xenia/base/profiling.h"
+#include "xenia/base/string.h"
 #include "xenia/gpu/gpu_flags.h"
 #include "xenia/gpu/vulkan/vulkan_gpu_flags.h"
 
+#include <algorithm>
 #include <cinttypes>
+#include <cstring>
 #include <string>
+#include <type_traits>
 
 namespace xe {
 namespace gpu {
@@ -32,21 +37,157 @@ using xe::ui::vulkan::CheckResult;
 #include "xenia/gpu/vulkan/shaders/bin/quad_list_geom.h"
 #include "xenia/gpu/vulkan/shaders/bin/rect_list_geom.h"
 
+// Header of a translated shader in the shader cache.
+struct CachedTranslation {
+  uint32_t magic;
+  // Bump whenever the translator output changes.
+  uint32_t version;
+  uint64_t ucode_data_hash;
+  uint32_t shader_type;
+  uint32_t program_cntl;
+  Shader::ConstantRegisterMap constant_register_map;
+  uint32_t binary_length;
+  // Stored after the binary.
+  uint32_t memexport_stream_constant_count;
+};
+static const uint32_t kCachedTranslationMagic = 'XSPV';
+static const uint32_t kCachedTranslationVersion = 5;
+
+// Header of the log of created pipelines in the shader cache, followed by
+// PipelineCreateJobs. Any mismatch discards the whole log.
+struct PipelineLogHeader {
+  uint32_t magic;
+  uint32_t version;
+  uint32_t entry_size;
+};
+static const uint32_t kPipelineLogMagic = 'XVKP';
+static const uint32_t kPipelineLogVersion = 2;
+
+// Shaders translated ahead of their first draw don't know the register counts
+// it'll have yet, so they're given the most there can be.
+static xenos::xe_gpu_program_cntl_t GetSpeculativeProgramCntl() {
+  xenos::xe_gpu_program_cntl_t cntl;
+  cntl.dword_0 = 0;
+  cntl.vs_regs = 63;
+  cntl.ps_regs = 63;
+  return cntl;
+}
+
+// Whether polygons are drawn as lines, needing a geometry shader for quads.
+bool PipelineCache::IsLineMode(uint32_t pa_su_sc_mode_cntl) {
+  if (((pa_su_sc_mode_cntl >> 3) & 0x3) != 0) {
+    uint32_t front_poly_mode = (pa_su_sc_mode_cntl >> 5) & 0x7;
+    if (front_poly_mode == 1) {
+      return true;
+    }
+  }
+  return false;
+}
+
 PipelineCache::PipelineCache(
     RegisterFile* register_file, ui::vulkan::VulkanDevice* device,
+    RenderCache* render_cache,
     VkDescriptorSetLayout uniform_descriptor_set_layout,
-    VkDescriptorSetLayout texture_descriptor_set_layout)
-    : register_file_(register_file), device_(*device) {
-  // Initialize the shared driver pipeline cache.
-  // We'll likely want to serialize this and reuse it, if that proves to be
-  // useful. If the shaders are expensive and this helps we could do it per
-  // game, otherwise a single shared cache for render state/etc.
+    VkDescriptorSetLayout texture_descriptor_set_layout,
+    VkDescriptorSetLayout memexport_descriptor_set_layout)
+    : register_file_(register_file),
+      device_(*device),
+      render_cache_(render_cache) {
+  memexport_enabled_ =
+      device->device_info().features.vertexPipelineStoresAndAtomics != 0;
+  shader_translator_.set_memexport_enabled(memexport_enabled_);
+  extended_dynamic_state_ = device->has_extended_dynamic_state();
+  if (extended_dynamic_state_) {
+    pipeline_key_.flags |= PipelineKey::kFlagExtendedDynamicState;
+  }
+  std::memset(&set_extended_dynamic_state_, 0,
+              sizeof(set_extended_dynamic_state_));
+  static const uint32_t shader_stages_registers[] = {
+      XE_GPU_REG_PA_SU_SC_MODE_CNTL, XE_GPU_REG_SQ_PROGRAM_CNTL,
+  };
+  static const uint32_t input_assembly_state_registers[] = {
+      XE_GPU_REG_PA_SU_SC_MODE_CNTL, XE_GPU_REG_VGT_MULTI_PRIM_IB_RESET_INDX,
+  };
+  static const uint32_t rasterization_state_registers[] = {
+      XE_GPU_REG_PA_SU_SC_MODE_CNTL,
+      XE_GPU_REG_PA_SC_SCREEN_SCISSOR_TL,
+      XE_GPU_REG_PA_SC_SCREEN_SCISSOR_BR,
+      XE_GPU_REG_PA_SC_VIZ_QUERY,
+      XE_GPU_REG_VGT_MULTI_PRIM_IB_RESET_INDX,
+  };
+  static const uint32_t multisample_state_registers[] = {
+      XE_GPU_REG_PA_SC_AA_CONFIG, XE_GPU_REG_PA_SU_SC_MODE_CNTL,
+      XE_GPU_REG_RB_SURFACE_INFO,
+  };
+  static const uint32_t depth_stencil_state_registers[] = {
+      XE_GPU_REG_RB_DEPTHCONTROL, XE_GPU_REG_RB_STENCILREFMASK,
+  };
+  static const uint32_t color_blend_state_registers[] = {
+      XE_GPU_REG_RB_COLORCONTROL,   XE_GPU_REG_RB_COLOR_MASK,
+      XE_GPU_REG_RB_BLENDCONTROL_0, XE_GPU_REG_RB_BLENDCONTROL_1,
+      XE_GPU_REG_RB_BLENDCONTROL_2, XE_GPU_REG_RB_BLENDCONTROL_3,
+      XE_GPU_REG_RB_MODECONTROL,
+  };
+  static const uint32_t dynamic_state_registers[] = {
+      XE_GPU_REG_PA_SC_WINDOW_OFFSET,     XE_GPU_REG_PA_SU_SC_MODE_CNTL,
+      XE_GPU_REG_PA_SC_WINDOW_SCISSOR_TL, XE_GPU_REG_PA_SC_WINDOW_SCISSOR_BR,
+      XE_GPU_REG_RB_SURFACE_INFO,         XE_GPU_REG_PA_CL_VTE_CNTL,
+      XE_GPU_REG_PA_CL_VPORT_XOFFSET,     XE_GPU_REG_PA_CL_VPORT_YOFFSET,
+      XE_GPU_REG_PA_CL_VPORT_ZOFFSET,     XE_GPU_REG_PA_CL_VPORT_XSCALE,
+      XE_GPU_REG_PA_CL_VPORT_YSCALE,      XE_GPU_REG_PA_CL_VPORT_ZSCALE,
+      XE_GPU_REG_RB_BLEND_RED,            XE_GPU_REG_RB_BLEND_GREEN,
+      XE_GPU_REG_RB_BLEND_BLUE,           XE_GPU_REG_RB_BLEND_ALPHA,
+      XE_GPU_REG_SQ_PROGRAM_CNTL,         XE_GPU_REG_SQ_CONTEXT_MISC,
+      XE_GPU_REG_RB_COLORCONTROL,         XE_GPU_REG_RB_ALPHA_REF,
+  };
+  shader_stages_dirty_group_ = register_file_->AddDirtyGroup(
+      shader_stages_registers, xe::countof(shader_stages_registers));
+  input_assembly_state_dirty_group_ = register_file_->AddDirtyGroup(
+      input_assembly_state_registers,
+      xe::countof(input_assembly_state_registers));
+  rasterization_state_dirty_group_ = register_file_->AddDirtyGroup(
+      rasterization_state_registers,
+      xe::countof(rasterization_state_registers));
+  multisample_state_dirty_group_ = register_file_->AddDirtyGroup(
+      multisample_state_registers, xe::countof(multisample_state_registers));
+  depth_stencil_state_dirty_group_ = register_file_->AddDirtyGroup(
+      depth_stencil_state_registers,
+      xe::countof(depth_stencil_state_registers));
+  color_blend_state_dirty_group_ = register_file_->AddDirtyGroup(
+      color_blend_state_registers, xe::countof(color_blend_state_registers));
+  dynamic_state_dirty_group_ = register_file_->AddDirtyGroup(
+      dynamic_state_registers, xe::countof(dynamic_state_registers));
+
+  if (!FLAGS_shader_cache_dir.empty()) {
+    cache_dir_ = xe::to_absolute_path(xe::to_wstring(FLAGS_shader_cache_dir));
+    xe::filesystem::CreateFolder(cache_dir_);
+  }
+
+  // Initialize the shared driver pipeline cache, with what it held at the end
+  // of the last run if the shader cache is enabled. The driver ignores data
+  // from other devices or driver versions.
+  std::vector<uint8_t> pipeline_cache_data;
+  if (!cache_dir_.empty()) {
+    auto file = xe::filesystem::OpenFile(
+        xe::join_paths(cache_dir_, L"vulkan_pipeline_cache.bin"), "rb");
+    if (file) {
+      fseek(file, 0, SEEK_END);
+      pipeline_cache_data.resize(size_t(ftell(file)));
+      fseek(file, 0, SEEK_SET);
+      if (fread(pipeline_cache_data.data(), 1, pipeline_cache_data.size(),
+                file) != pipeline_cache_data.size()) {
+        pipeline_cache_data.clear();
+      }
+      fclose(file);
+    }
+  }
   VkPipelineCacheCreateInfo pipeline_cache_info;
   pipeline_cache_info.sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO;
   pipeline_cache_info.pNext = nullptr;
   pipeline_cache_info.flags = 0;
-  pipeline_cache_info.initialDataSize = 0;
-  pipeline_cache_info.pInitialData = nullptr;
+  pipeline_cache_info.initialDataSize = pipeline_cache_data.size();
+  pipeline_cache_info.pInitialData =
+      pipeline_cache_data.empty() ? nullptr : pipeline_cache_data.data();
   auto err = vkCreatePipelineCache(device_, &pipeline_cache_info, nullptr,
                                    &pipeline_cache_);
   CheckResult(err, "vkCreatePipelineCache");
@@ -58,6 +199,8 @@ PipelineCache::PipelineCache(
       uniform_descriptor_set_layout,
       // All texture bindings.
       texture_descriptor_set_layout,
+      // Storage buffer vertex shaders memexport to.
+      memexport_descriptor_set_layout,
   };
 
   // Push constants used for draw parameters.
@@ -113,14 +256,60 @@ PipelineCache::PipelineCache(
   err = vkCreateShaderModule(device_, &shader_module_info, nullptr,
                              &geometry_shaders_.rect_list);
   CheckResult(err, "vkCreateShaderModule");
+
+  // Spin up background pipeline creation, if requested.
+  for (int32_t i = 0; i < FLAGS_vulkan_pipeline_threads; ++i) {
+    auto thread = xe::threading::Thread::Create(
+        {}, [this]() { PipelineThreadMain(); });
+    thread->set_name("xe::gpu::vulkan::PipelineCache " + std::to_string(i));
+    pipeline_threads_.push_back(std::move(thread));
+  }
+  for (int32_t i = 0; i < FLAGS_vulkan_shader_translation_threads; ++i) {
+    auto thread = xe::threading::Thread::Create(
+        {}, [this]() { TranslationThreadMain(); });
+    thread->set_name("xe::gpu::vulkan::ShaderTranslator " + std::to_string(i));
+    translation_threads_.push_back(std::move(thread));
+  }
+
+  if (!cache_dir_.empty()) {
+    std::vector<std::unique_ptr<PipelineCreateJob>> jobs;
+    OpenPipelineLog(&jobs);
+    if (FLAGS_vulkan_precreate_pipelines) {
+      PrecreatePipelines(jobs);
+    }
+  }
 }
 
 PipelineCache::~PipelineCache() {
-  // Destroy all pipelines.
-  for (auto it : cached_pipelines_) {
-    vkDestroyPipeline(device_, it.second, nullptr);
+  ShutdownTranslationThreads();
+  ShutdownPipelineThreads();
+
+  register_file_->RemoveDirtyGroup(shader_stages_dirty_group_);
+  register_file_->RemoveDirtyGroup(input_assembly_state_dirty_group_);
+  register_file_->RemoveDirtyGroup(rasterization_state_dirty_group_);
+  register_file_->RemoveDirtyGroup(multisample_state_dirty_group_);
+  register_file_->RemoveDirtyGroup(depth_stencil_state_dirty_group_);
+  register_file_->RemoveDirtyGroup(color_blend_state_dirty_group_);
+  register_file_->RemoveDirtyGroup(dynamic_state_dirty_group_);
+
+  SavePipelineCacheData();
+  if (pipeline_log_file_) {
+    fclose(pipeline_log_file_);
+    pipeline_log_file_ = nullptr;
   }
-  cached_pipelines_.clear();
+  for (auto shader_module : precreate_shader_modules_) {
+    vkDestroyShaderModule(device_, shader_module, nullptr);
+  }
+  precreate_shader_modules_.clear();
+
+  // Destroy all pipelines.
+  cached_pipelines_.ForEach([this](CachedPipeline& cached_pipeline) {
+    if (cached_pipeline.handle) {
+      vkDestroyPipeline(device_, cached_pipeline.handle, nullptr);
+    }
+  });
+  cached_pipelines_.Clear();
+  fallback_pipelines_.clear();
 
   // Destroy geometry shaders.
   vkDestroyShaderModule(device_, geometry_shaders_.line_quad_list, nullptr);
@@ -157,6 +346,14 @@ VulkanShader* PipelineCache::LoadShader(ShaderType shader_type,
                                           host_address, dword_count);
   shader_map_.insert({data_hash, shader});
 
+  // Start translating it right away so that it's likely done by the time it's
+  // drawn with.
+  if (!translation_threads_.empty()) {
+    std::lock_guard<std::mutex> lock(translation_mutex_);
+    translation_queue_.push_back(shader);
+    translation_cond_.notify_one();
+  }
+
   return shader;
 }
 
@@ -193,14 +390,25 @@ PipelineCache::UpdateStatus PipelineCache::ConfigurePipeline(
       return update_status;
   }
   if (!pipeline) {
-    // Should have a hash key produced by the UpdateState pass.
-    uint64_t hash_key = XXH64_digest(&hash_state_);
-    pipeline = GetPipeline(render_state, hash_key);
-    current_pipeline_ = pipeline;
-    if (!pipeline) {
-      // Unable to create pipeline.
-      return UpdateStatus::kError;
+    // The UpdateState pass has brought the key up to date.
+    bool pending = false;
+    pipeline = GetPipeline(render_state, pipeline_key_, &pending);
+    if (pending) {
+      // Leave the current pipeline unset so that the next draw looks again.
+      current_pipeline_ = nullptr;
+      if (!pipeline) {
+        return UpdateStatus::kPending;
+      }
+    } else {
+      current_pipeline_ = pipeline;
+      if (!pipeline) {
+        // Unable to create pipeline.
+        return UpdateStatus::kError;
+      }
     }
+    // The state may not have changed since a draw that bound another
+    // pipeline (or skipped), so have it bound.
+    update_status = UpdateStatus::kMismatch;
   }
 
   *pipeline_out = pipeline;
@@ -211,21 +419,188 @@ void PipelineCache::ClearCache() {
   // TODO(benvanik): caching.
 }
 
+uint64_t PipelineCache::PipelineKey::Hash() const {
+  uint64_t words[sizeof(PipelineKey) / sizeof(uint64_t)];
+  std::memcpy(words, this, sizeof(words));
+  uint64_t hash = 0;
+  for (size_t i = 0; i < xe::countof(words); ++i) {
+    hash = (hash ^ words[i]) * 0x9E3779B97F4A7C15ull;
+  }
+  return hash ^ (hash >> 32);
+}
+
+PipelineCache::CachedPipeline* PipelineCache::PipelineTable::Find(
+    const PipelineKey& key) {
+  if (entries_.empty()) {
+    return nullptr;
+  }
+  size_t mask = entries_.size() - 1;
+  for (size_t i = size_t(key.Hash()) & mask;; i = (i + 1) & mask) {
+    auto& entry = entries_[i];
+    if (!entry.used) {
+      return nullptr;
+    }
+    if (entry.key == key) {
+      return &entry.pipeline;
+    }
+  }
+}
+
+PipelineCache::CachedPipeline& PipelineCache::PipelineTable::Insert(
+    const PipelineKey& key) {
+  auto existing = Find(key);
+  if (existing) {
+    return *existing;
+  }
+  // Kept at most half full, so that probe sequences stay short.
+  if ((size_ + 1) * 2 > entries_.size()) {
+    std::vector<Entry> old_entries(std::max(entries_.size() * 2, size_t(256)));
+    std::swap(entries_, old_entries);
+    size_ = 0;
+    for (auto& entry : old_entries) {
+      if (entry.used) {
+        Insert(entry.key) = entry.pipeline;
+      }
+    }
+  }
+  size_t mask = entries_.size() - 1;
+  size_t i = size_t(key.Hash()) & mask;
+  while (entries_[i].used) {
+    i = (i + 1) & mask;
+  }
+  auto& entry = entries_[i];
+  entry.used = true;
+  entry.key = key;
+  entry.pipeline = CachedPipeline();
+  ++size_;
+  return entry.pipeline;
+}
+
+void PipelineCache::PipelineTable::Clear() {
+  entries_.clear();
+  size_ = 0;
+}
+
 VkPipeline PipelineCache::GetPipeline(const RenderState* render_state,
-                                      uint64_t hash_key) {
-  // Lookup the pipeline in the cache.
-  auto it = cached_pipelines_.find(hash_key);
-  if (it != cached_pipelines_.end()) {
-    // Found existing pipeline.
-    return it->second;
+                                      const PipelineKey& key,
+                                      bool* pending_out) {
+  *pending_out = false;
+  std::unique_ptr<PipelineCreateJob> job;
+  {
+    std::lock_guard<std::mutex> lock(pipeline_mutex_);
+
+    // Lookup the pipeline in the cache.
+    auto cached_pipeline = cached_pipelines_.Find(key);
+    if (cached_pipeline) {
+      if (!cached_pipeline->pending) {
+        // Found existing pipeline.
+        ++hit_count_;
+        return cached_pipeline->handle;
+      }
+    } else {
+      job = CapturePipelineState(render_state, key);
+      if (pipeline_log_file_) {
+        fwrite(job.get(), sizeof(PipelineCreateJob), 1, pipeline_log_file_);
+        fflush(pipeline_log_file_);
+      }
+      if (!pipeline_threads_.empty()) {
+        // Add to cache with the key now so that it's only queued once.
+        cached_pipelines_.Insert(key).pending = true;
+        pipeline_queue_.push_back(std::move(job));
+        pipeline_cond_.notify_one();
+      }
+    }
+    ++miss_count_;
+
+    if (!job) {
+      // Still being created.
+      *pending_out = true;
+      if (FLAGS_vulkan_pending_pipeline_policy != "fallback") {
+        return nullptr;
+      }
+      auto fallback_it = fallback_pipelines_.find(GetFallbackKey(render_state));
+      return fallback_it != fallback_pipelines_.end() ? fallback_it->second
+                                                      : nullptr;
+    }
   }
 
+  // No pipeline threads, so create it now.
+  VkPipeline pipeline = CreatePipeline(*job);
+
+  // Add to cache with the key for reuse.
+  std::lock_guard<std::mutex> lock(pipeline_mutex_);
+  cached_pipelines_.Insert(key).handle = pipeline;
+  if (pipeline) {
+    fallback_pipelines_[job->fallback_key] = pipeline;
+  }
+  return pipeline;
+}
+
+uint64_t PipelineCache::GetFallbackKey(const RenderState* render_state) {
+  XXH64_state_t hash_state;
+  XXH64_reset(&hash_state, 0);
+  XXH64_update(&hash_state, &update_shader_stages_regs_,
+               sizeof(update_shader_stages_regs_));
+  XXH64_update(&hash_state, &render_state->render_pass_handle,
+               sizeof(render_state->render_pass_handle));
+  return XXH64_digest(&hash_state);
+}
+
+std::unique_ptr<PipelineCache::PipelineCreateJob>
+PipelineCache::CapturePipelineState(const RenderState* render_state,
+                                    const PipelineKey& key) {
+  auto& shader_stages_regs = update_shader_stages_regs_;
+  auto job = std::make_unique<PipelineCreateJob>();
+  std::memset(job.get(), 0, sizeof(PipelineCreateJob));
+  job->key = key;
+  job->fallback_key = GetFallbackKey(render_state);
+  job->render_config = render_state->config;
+  job->vertex_shader_hash = shader_stages_regs.vertex_shader->ucode_data_hash();
+  job->vertex_shader_cntl = shader_stages_regs.vertex_shader->program_cntl();
+  job->pixel_shader_hash = shader_stages_regs.pixel_shader->ucode_data_hash();
+  job->pixel_shader_cntl = shader_stages_regs.pixel_shader->program_cntl();
+  job->primitive_type = shader_stages_regs.primitive_type;
+  job->is_line_mode = IsLineMode(shader_stages_regs.pa_su_sc_mode_cntl);
+  job->render_pass = render_state->render_pass_handle;
+
+  std::memcpy(job->shader_stages_info, update_shader_stages_info_,
+              sizeof(update_shader_stages_info_));
+  job->shader_stages_stage_count = update_shader_stages_stage_count_;
+
+  job->vertex_input_state_info = update_vertex_input_state_info_;
+  std::memcpy(job->vertex_input_state_binding_descrs,
+              update_vertex_input_state_binding_descrs_,
+              sizeof(update_vertex_input_state_binding_descrs_));
+  std::memcpy(job->vertex_input_state_attrib_descrs,
+              update_vertex_input_state_attrib_descrs_,
+              sizeof(update_vertex_input_state_attrib_descrs_));
+  job->vertex_input_state_info.pVertexBindingDescriptions =
+      job->vertex_input_state_binding_descrs;
+  job->vertex_input_state_info.pVertexAttributeDescriptions =
+      job->vertex_input_state_attrib_descrs;
+
+  job->input_assembly_state_info = update_input_assembly_state_info_;
+  job->viewport_state_info = update_viewport_state_info_;
+  job->rasterization_state_info = update_rasterization_state_info_;
+  job->multisample_state_info = update_multisample_state_info_;
+  job->depth_stencil_state_info = update_depth_stencil_state_info_;
+
+  job->color_blend_state_info = update_color_blend_state_info_;
+  std::memcpy(job->color_blend_attachment_states,
+              update_color_blend_attachment_states_,
+              sizeof(update_color_blend_attachment_states_));
+  job->color_blend_state_info.pAttachments =
+      job->color_blend_attachment_states;
+  return job;
+}
+
+VkPipeline PipelineCache::CreatePipeline(const PipelineCreateJob& job) {
   VkPipelineDynamicStateCreateInfo dynamic_state_info;
   dynamic_state_info.sType =
       VK_STRUCTURE_TYPE_PIPELINE_DYNAMIC_STATE_CREATE_INFO;
   dynamic_state_info.pNext = nullptr;
   dynamic_state_info.flags = 0;
-  VkDynamicState dynamic_states[] = {
+  static const VkDynamicState base_dynamic_states[] = {
       VK_DYNAMIC_STATE_VIEWPORT,
       VK_DYNAMIC_STATE_SCISSOR,
       VK_DYNAMIC_STATE_LINE_WIDTH,
@@ -236,31 +611,54 @@ VkPipeline PipelineCache::GetPipeline(const RenderState* render_state,
       VK_DYNAMIC_STATE_STENCIL_WRITE_MASK,
       VK_DYNAMIC_STATE_STENCIL_REFERENCE,
   };
-  dynamic_state_info.dynamicStateCount =
-      static_cast<uint32_t>(xe::countof(dynamic_states));
+  static const VkDynamicState extended_dynamic_states[] = {
+      VK_DYNAMIC_STATE_CULL_MODE_EXT,
+      VK_DYNAMIC_STATE_FRONT_FACE_EXT,
+      VK_DYNAMIC_STATE_PRIMITIVE_TOPOLOGY_EXT,
+      VK_DYNAMIC_STATE_DEPTH_TEST_ENABLE_EXT,
+      VK_DYNAMIC_STATE_DEPTH_WRITE_ENABLE_EXT,
+      VK_DYNAMIC_STATE_DEPTH_COMPARE_OP_EXT,
+      VK_DYNAMIC_STATE_STENCIL_TEST_ENABLE_EXT,
+      VK_DYNAMIC_STATE_STENCIL_OP_EXT,
+  };
+  VkDynamicState
+      dynamic_states[std::extent<decltype(base_dynamic_states)>::value +
+                     std::extent<decltype(extended_dynamic_states)>::value];
+  uint32_t dynamic_state_count = 0;
+  for (auto dynamic_state : base_dynamic_states) {
+    dynamic_states[dynamic_state_count++] = dynamic_state;
+  }
+  if (job.key.flags & PipelineKey::kFlagExtendedDynamicState) {
+    for (auto dynamic_state : extended_dynamic_states) {
+      dynamic_states[dynamic_state_count++] = dynamic_state;
+    }
+  }
+  dynamic_state_info.dynamicStateCount = dynamic_state_count;
   dynamic_state_info.pDynamicStates = dynamic_states;
 
   VkGraphicsPipelineCreateInfo pipeline_info;
   pipeline_info.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
   pipeline_info.pNext = nullptr;
   pipeline_info.flags = VK_PIPELINE_CREATE_DISABLE_OPTIMIZATION_BIT;
-  pipeline_info.stageCount = update_shader_stages_stage_count_;
-  pipeline_info.pStages = update_shader_stages_info_;
-  pipeline_info.pVertexInputState = &update_vertex_input_state_info_;
-  pipeline_info.pInputAssemblyState = &update_input_assembly_state_info_;
+  pipeline_info.stageCount = job.shader_stages_stage_count;
+  pipeline_info.pStages = job.shader_stages_info;
+  pipeline_info.pVertexInputState = &job.vertex_input_state_info;
+  pipeline_info.pInputAssemblyState = &job.input_assembly_state_info;
   pipeline_info.pTessellationState = nullptr;
-  pipeline_info.pViewportState = &update_viewport_state_info_;
-  pipeline_info.pRasterizationState = &update_rasterization_state_info_;
-  pipeline_info.pMultisampleState = &update_multisample_state_info_;
-  pipeline_info.pDepthStencilState = &update_depth_stencil_state_info_;
-  pipeline_info.pColorBlendState = &update_color_blend_state_info_;
+  pipeline_info.pViewportState = &job.viewport_state_info;
+  pipeline_info.pRasterizationState = &job.rasterization_state_info;
+  pipeline_info.pMultisampleState = &job.multisample_state_info;
+  pipeline_info.pDepthStencilState = &job.depth_stencil_state_info;
+  pipeline_info.pColorBlendState = &job.color_blend_state_info;
   pipeline_info.pDynamicState = &dynamic_state_info;
   pipeline_info.layout = pipeline_layout_;
-  pipeline_info.renderPass = render_state->render_pass_handle;
+  pipeline_info.renderPass = job.render_pass;
   pipeline_info.subpass = 0;
   pipeline_info.basePipelineHandle = nullptr;
   pipeline_info.basePipelineIndex = -1;
   VkPipeline pipeline = nullptr;
+  // The driver pipeline cache is internally synchronized, so this may run on
+  // any number of threads at once.
   auto err = vkCreateGraphicsPipelines(device_, pipeline_cache_, 1,
                                        &pipeline_info, nullptr, &pipeline);
   CheckResult(err, "vkCreateGraphicsPipelines");
@@ -270,17 +668,117 @@ VkPipeline PipelineCache::GetPipeline(const RenderState* render_state,
     DumpShaderDisasmNV(pipeline_info);
   }
 
-  // Add to cache with the hash key for reuse.
-  cached_pipelines_.insert({hash_key, pipeline});
-
   return pipeline;
 }
 
-bool PipelineCache::TranslateShader(VulkanShader* shader,
+void PipelineCache::PipelineThreadMain() {
+  while (true) {
+    std::unique_ptr<PipelineCreateJob> job;
+    {
+      std::unique_lock<std::mutex> lock(pipeline_mutex_);
+      pipeline_cond_.wait(lock, [this]() {
+        return pipeline_shutdown_ || !pipeline_queue_.empty();
+      });
+      if (pipeline_shutdown_) {
+        return;
+      }
+      job = std::move(pipeline_queue_.front());
+      pipeline_queue_.pop_front();
+    }
+
+    VkPipeline pipeline = CreatePipeline(*job);
+
+    // Complete the cache entry. Draws pick it up the next time they look.
+    std::lock_guard<std::mutex> lock(pipeline_mutex_);
+    auto& cached_pipeline = cached_pipelines_.Insert(job->key);
+    cached_pipeline.handle = pipeline;
+    cached_pipeline.pending = false;
+    if (pipeline) {
+      fallback_pipelines_[job->fallback_key] = pipeline;
+    }
+  }
+}
+
+void PipelineCache::ShutdownPipelineThreads() {
+  {
+    std::lock_guard<std::mutex> lock(pipeline_mutex_);
+    pipeline_shutdown_ = true;
+    pipeline_queue_.clear();
+  }
+  pipeline_cond_.notify_all();
+  for (auto& thread : pipeline_threads_) {
+    xe::threading::Wait(thread.get(), false);
+  }
+  pipeline_threads_.clear();
+}
+
+void PipelineCache::TranslationThreadMain() {
+  SpirvShaderTranslator shader_translator;
+  shader_translator.set_memexport_enabled(memexport_enabled_);
+  while (true) {
+    VulkanShader* shader;
+    {
+      std::unique_lock<std::mutex> lock(translation_mutex_);
+      translation_cond_.wait(lock, [this]() {
+        return translation_shutdown_ || !translation_queue_.empty();
+      });
+      if (translation_shutdown_) {
+        return;
+      }
+      shader = translation_queue_.front();
+      translation_queue_.pop_front();
+      translating_shaders_.insert(shader);
+    }
+
+    TranslateShader(&shader_translator, shader, GetSpeculativeProgramCntl());
+
+    {
+      std::lock_guard<std::mutex> lock(translation_mutex_);
+      translating_shaders_.erase(shader);
+    }
+    translation_done_cond_.notify_all();
+  }
+}
+
+void PipelineCache::ShutdownTranslationThreads() {
+  {
+    std::lock_guard<std::mutex> lock(translation_mutex_);
+    translation_shutdown_ = true;
+    translation_queue_.clear();
+  }
+  translation_cond_.notify_all();
+  for (auto& thread : translation_threads_) {
+    xe::threading::Wait(thread.get(), false);
+  }
+  translation_threads_.clear();
+}
+
+void PipelineCache::WaitForTranslation(VulkanShader* shader) {
+  if (translation_threads_.empty()) {
+    return;
+  }
+  std::unique_lock<std::mutex> lock(translation_mutex_);
+  auto it =
+      std::find(translation_queue_.begin(), translation_queue_.end(), shader);
+  if (it != translation_queue_.end()) {
+    translation_queue_.erase(it);
+    return;
+  }
+  translation_done_cond_.wait(
+      lock, [this, shader]() { return !translating_shaders_.count(shader); });
+}
+
+bool PipelineCache::TranslateShader(SpirvShaderTranslator* shader_translator,
+                                    VulkanShader* shader,
                                     xenos::xe_gpu_program_cntl_t cntl) {
+  shader->set_program_cntl(cntl.dword_0);
+  if (LoadCachedTranslation(shader_translator, shader, cntl.dword_0)) {
+    return true;
+  }
+
   // Perform translation.
   // If this fails the shader will be marked as invalid and ignored later.
-  if (!shader_translator_.Translate(shader, cntl)) {
+  if (!shader_translator->Translate(shader, cntl)) {
     XELOGE("Shader translation failed; marking shader as ignored");
     return false;
   }
@@ -304,9 +802,303 @@ bool PipelineCache::TranslateShader(VulkanShader* shader,
     shader->Dump(FLAGS_dump_shaders, "vk");
   }
 
+  if (shader->is_valid()) {
+    CacheTranslation(shader);
+  }
   return shader->is_valid();
 }
 
+static std::wstring GetCachedTranslationPath(const std::wstring& cache_dir,
+                                             ShaderType shader_type,
+                                             uint64_t hash,
+                                             uint32_t program_cntl) {
+  return xe::join_paths(
+      cache_dir,
+      xe::format_string(L"%.16" PRIX64 ".%.8X.spv.%s", hash, program_cntl,
+                        shader_type == ShaderType::kPixel ? L"frag" : L"vert"));
+}
+
+static bool ReadCachedTranslation(
+    const std::wstring& path, CachedTranslation* header,
+    std::vector<uint8_t>* binary,
+    std::vector<uint32_t>* memexport_stream_constants) {
+  auto file = xe::filesystem::OpenFile(path, "rb");
+  if (!file) {
+    return false;
+  }
+  bool valid = fread(header, sizeof(*header), 1, file) == 1 &&
+               header->magic == kCachedTranslationMagic &&
+               header->version == kCachedTranslationVersion;
+  if (valid) {
+    binary->resize(header->binary_length);
+    valid = fread(binary->data(), 1, binary->size(), file) == binary->size();
+  }
+  if (valid) {
+    memexport_stream_constants->resize(
+        header->memexport_stream_constant_count);
+    valid = fread(memexport_stream_constants->data(), sizeof(uint32_t),
+                  memexport_stream_constants->size(),
+                  file) == memexport_stream_constants->size();
+  }
+  fclose(file);
+  return valid;
+}
+
+bool PipelineCache::LoadCachedTranslation(
+    SpirvShaderTranslator* shader_translator, VulkanShader* shader,
+    uint32_t program_cntl) {
+  if (cache_dir_.empty()) {
+    // Cache disabled.
+    return false;
+  }
+  CachedTranslation header;
+  std::vector<uint8_t> binary;
+  std::vector<uint32_t> memexport_stream_constants;
+  if (!ReadCachedTranslation(
+          GetCachedTranslationPath(cache_dir_, shader->type(),
+                                   shader->ucode_data_hash(), program_cntl),
+          &header, &binary, &memexport_stream_constants) ||
+      header.ucode_data_hash != shader->ucode_data_hash() ||
+      header.shader_type != uint32_t(shader->type()) ||
+      header.program_cntl != program_cntl) {
+    return false;
+  }
+
+  // Only the translation is stored, so bindings are gathered again.
+  shader_translator->GatherAllBindingInformation(shader);
+  if (!shader->LoadTranslation(binary.data(), binary.size(),
+                               header.constant_register_map,
+                               memexport_stream_constants)) {
+    XELOGE("Unable to load cached shader %.16" PRIX64,
+           shader->ucode_data_hash());
+    return false;
+  }
+  return true;
+}
+
+void PipelineCache::CacheTranslation(VulkanShader* shader) {
+  if (cache_dir_.empty()) {
+    // Cache disabled.
+    return;
+  }
+  auto file = xe::filesystem::OpenFile(
+      GetCachedTranslationPath(cache_dir_, shader->type(),
+                               shader->ucode_data_hash(),
+                               shader->program_cntl()),
+      "wb");
+  if (!file) {
+    // Not fatal, but not too good.
+    return;
+  }
+  auto& binary = shader->translated_binary();
+  CachedTranslation header;
+  std::memset(&header, 0, sizeof(header));
+  header.magic = kCachedTranslationMagic;
+  header.version = kCachedTranslationVersion;
+  header.ucode_data_hash = shader->ucode_data_hash();
+  header.shader_type = uint32_t(shader->type());
+  header.program_cntl = shader->program_cntl();
+  header.constant_register_map = shader->constant_register_map();
+  header.binary_length = uint32_t(binary.size());
+  auto& memexport_stream_constants = shader->memexport_stream_constants();
+  header.memexport_stream_constant_count =
+      uint32_t(memexport_stream_constants.size());
+  fwrite(&header, sizeof(header), 1, file);
+  fwrite(binary.data(), 1, binary.size(), file);
+  fwrite(memexport_stream_constants.data(), sizeof(uint32_t),
+         memexport_stream_constants.size(), file);
+  fclose(file);
+}
+
+VkShaderModule PipelineCache::LoadCachedShaderModule(ShaderType shader_type,
+                                                     uint64_t hash,
+                                                     uint32_t program_cntl) {
+  CachedTranslation header;
+  std::vector<uint8_t> binary;
+  std::vector<uint32_t> memexport_stream_constants;
+  if (!ReadCachedTranslation(GetCachedTranslationPath(cache_dir_, shader_type,
+                                                      hash, program_cntl),
+                             &header, &binary, &memexport_stream_constants)) {
+    return nullptr;
+  }
+  VkShaderModuleCreateInfo shader_info;
+  shader_info.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
+  shader_info.pNext = nullptr;
+  shader_info.flags = 0;
+  shader_info.codeSize = binary.size();
+  shader_info.pCode = reinterpret_cast<const uint32_t*>(binary.data());
+  VkShaderModule shader_module = nullptr;
+  auto err =
+      vkCreateShaderModule(device_, &shader_info, nullptr, &shader_module);
+  CheckResult(err, "vkCreateShaderModule");
+  return err == VK_SUCCESS ? shader_module : nullptr;
+}
+
+void PipelineCache::OpenPipelineLog(
+    std::vector<std::unique_ptr<PipelineCreateJob>>* jobs) {
+  PipelineLogHeader header;
+  header.magic = kPipelineLogMagic;
+  header.version = kPipelineLogVersion;
+  header.entry_size = uint32_t(sizeof(PipelineCreateJob));
+
+  auto path = xe::join_paths(cache_dir_, L"vulkan_pipelines.bin");
+  auto file = xe::filesystem::OpenFile(path, "rb");
+  if (file) {
+    PipelineLogHeader file_header;
+    if (fread(&file_header, sizeof(file_header), 1, file) == 1 &&
+        !std::memcmp(&file_header, &header, sizeof(header))) {
+      while (true) {
+        auto job = std::make_unique<PipelineCreateJob>();
+        if (fread(job.get(), sizeof(PipelineCreateJob), 1, file) != 1) {
+          // End of the log, or an entry cut short by a crash.
+          break;
+        }
+        jobs->push_back(std::move(job));
+      }
+    }
+    fclose(file);
+  }
+
+  // Rewrite the log with only the entries we read.
+  pipeline_log_file_ = xe::filesystem::OpenFile(path, "wb");
+  if (!pipeline_log_file_) {
+    XELOGE("Unable to open pipeline cache file %S", path.c_str());
+    return;
+  }
+  fwrite(&header, sizeof(header), 1, pipeline_log_file_);
+  for (auto& job : *jobs) {
+    fwrite(job.get(), sizeof(PipelineCreateJob), 1, pipeline_log_file_);
+  }
+  fflush(pipeline_log_file_);
+}
+
+void PipelineCache::PrecreatePipelines(
+    const std::vector<std::unique_ptr<PipelineCreateJob>>& jobs) {
+  // Shader modules by ucode hash and program control.
+  std::unordered_map<uint64_t, VkShaderModule> shader_modules;
+  auto get_shader_module = [&](ShaderType shader_type, uint64_t hash,
+                               uint32_t program_cntl) {
+    uint64_t key = hash ^ (uint64_t(program_cntl) << 1) ^ uint64_t(shader_type);
+    auto it = shader_modules.find(key);
+    if (it != shader_modules.end()) {
+      return it->second;
+    }
+    auto shader_module =
+        LoadCachedShaderModule(shader_type, hash, program_cntl);
+    if (shader_module) {
+      precreate_shader_modules_.push_back(shader_module);
+    }
+    shader_modules.insert({key, shader_module});
+    return shader_module;
+  };
+
+  uint32_t pipeline_count = 0;
+  for (auto& cached_job : jobs) {
+    if ((cached_job->key.flags & PipelineKey::kFlagExtendedDynamicState) !=
+        (pipeline_key_.flags & PipelineKey::kFlagExtendedDynamicState)) {
+      // Logged on a device with different support, so never looked up.
+      continue;
+    }
+    {
+      std::lock_guard<std::mutex> lock(pipeline_mutex_);
+      if (cached_pipelines_.Find(cached_job->key)) {
+        continue;
+      }
+    }
+    auto vertex_shader_module =
+        get_shader_module(ShaderType::kVertex, cached_job->vertex_shader_hash,
+                          cached_job->vertex_shader_cntl);
+    auto pixel_shader_module =
+        get_shader_module(ShaderType::kPixel, cached_job->pixel_shader_hash,
+                          cached_job->pixel_shader_cntl);
+    if (!vertex_shader_module || !pixel_shader_module) {
+      continue;
+    }
+
+    // Restore everything the job points to.
+    auto job = std::make_unique<PipelineCreateJob>(*cached_job);
+    job->render_pass = render_cache_->GetRenderPass(job->render_config);
+    for (uint32_t i = 0; i < job->shader_stages_stage_count; ++i) {
+      auto& stage_info = job->shader_stages_info[i];
+      stage_info.pNext = nullptr;
+      stage_info.pName = "main";
+      stage_info.pSpecializationInfo = nullptr;
+      switch (stage_info.stage) {
+        case VK_SHADER_STAGE_VERTEX_BIT:
+          stage_info.module = vertex_shader_module;
+          break;
+        case VK_SHADER_STAGE_GEOMETRY_BIT:
+          stage_info.module =
+              GetGeometryShader(job->primitive_type, job->is_line_mode);
+          break;
+        default:
+          stage_info.module = pixel_shader_module;
+          break;
+      }
+    }
+    job->vertex_input_state_info.pNext = nullptr;
+    job->vertex_input_state_info.pVertexBindingDescriptions =
+        job->vertex_input_state_binding_descrs;
+    job->vertex_input_state_info.pVertexAttributeDescriptions =
+        job->vertex_input_state_attrib_descrs;
+    job->input_assembly_state_info.pNext = nullptr;
+    job->viewport_state_info.pNext = nullptr;
+    job->viewport_state_info.pViewports = nullptr;
+    job->viewport_state_info.pScissors = nullptr;
+    job->rasterization_state_info.pNext = nullptr;
+    job->multisample_state_info.pNext = nullptr;
+    job->multisample_state_info.pSampleMask = nullptr;
+    job->depth_stencil_state_info.pNext = nullptr;
+    job->color_blend_state_info.pNext = nullptr;
+    job->color_blend_state_info.pAttachments =
+        job->color_blend_attachment_states;
+
+    CachedPipeline cached_pipeline;
+    if (pipeline_threads_.empty()) {
+      cached_pipeline.handle = CreatePipeline(*job);
+      if (cached_pipeline.handle) {
+        fallback_pipelines_[job->fallback_key] = cached_pipeline.handle;
+      }
+      std::lock_guard<std::mutex> lock(pipeline_mutex_);
+      cached_pipelines_.Insert(job->key) = cached_pipeline;
+    } else {
+      cached_pipeline.pending = true;
+      std::lock_guard<std::mutex> lock(pipeline_mutex_);
+      cached_pipelines_.Insert(job->key) = cached_pipeline;
+      pipeline_queue_.push_back(std::move(job));
+      pipeline_cond_.notify_one();
+    }
+    ++pipeline_count;
+  }
+  XELOGGPU("Creating %d pipelines from the shader cache", pipeline_count);
+}
+
+void PipelineCache::SavePipelineCacheData() {
+  if (cache_dir_.empty()) {
+    // Cache disabled.
+    return;
+  }
+  size_t data_size = 0;
+  auto err = vkGetPipelineCacheData(device_, pipeline_cache_, &data_size,
+                                    nullptr);
+  if (err != VK_SUCCESS || !data_size) {
+    return;
+  }
+  std::vector<uint8_t> data(data_size);
+  err = vkGetPipelineCacheData(device_, pipeline_cache_, &data_size,
+                               data.data());
+  if (err != VK_SUCCESS) {
+    return;
+  }
+  auto file = xe::filesystem::OpenFile(
+      xe::join_paths(cache_dir_, L"vulkan_pipeline_cache.bin"), "wb");
+  if (!file) {
+    return;
+  }
+  fwrite(data.data(), 1, data_size, file);
+  fclose(file);
+}
+
 void PipelineCache::DumpShaderDisasmNV(
     const VkGraphicsPipelineCreateInfo& pipeline_info) {
   // !! HACK !!: This only works on NVidia drivers. Dumps shader disasm.
@@ -426,13 +1218,64 @@ VkShaderModule PipelineCache::GetGeometryShader(PrimitiveType primitive_type,
   }
 }
 
-bool PipelineCache::SetDynamicState(VkCommandBuffer command_buffer,
+PrimitiveType PipelineCache::GetDynamicTopologyKeyType(
+    PrimitiveType primitive_type, bool primitive_restart) {
+  if (primitive_restart) {
+    // Lists can't be drawn with primitive restart enabled.
+    return primitive_type;
+  }
+  switch (primitive_type) {
+    case PrimitiveType::kLineList:
+    case PrimitiveType::kLineLoop:
+    case PrimitiveType::kLineStrip:
+      return PrimitiveType::kLineList;
+    case PrimitiveType::kTriangleList:
+    case PrimitiveType::kTriangleFan:
+    case PrimitiveType::kTriangleStrip:
+      return PrimitiveType::kTriangleList;
+    default:
+      return primitive_type;
+  }
+}
+
+bool PipelineCache::SetDynamicState(DeferredCommandBuffer* command_buffer,
                                     bool full_update) {
 #if FINE_GRAINED_DRAW_SCOPES
   SCOPE_profile_cpu_f("gpu");
 #endif  // FINE_GRAINED_DRAW_SCOPES
 
+  if (extended_dynamic_state_) {
+    // Taken from the pipeline state the last update brought up to date, as
+    // it doesn't only depend on the dynamic state registers.
+    auto& rasterization_info = update_rasterization_state_info_;
+    auto& depth_stencil_info = update_depth_stencil_state_info_;
+    DeferredCommandBuffer::ExtendedDynamicState state;
+    state.cull_mode = rasterization_info.cullMode;
+    state.front_face = rasterization_info.frontFace;
+    state.primitive_topology = update_input_assembly_state_info_.topology;
+    state.depth_test_enable = depth_stencil_info.depthTestEnable;
+    state.depth_write_enable = depth_stencil_info.depthWriteEnable;
+    state.depth_compare_op = depth_stencil_info.depthCompareOp;
+    state.stencil_test_enable = depth_stencil_info.stencilTestEnable;
+    state.front_fail_op = depth_stencil_info.front.failOp;
+    state.front_pass_op = depth_stencil_info.front.passOp;
+    state.front_depth_fail_op = depth_stencil_info.front.depthFailOp;
+    state.front_compare_op = depth_stencil_info.front.compareOp;
+    state.back_fail_op = depth_stencil_info.back.failOp;
+    state.back_pass_op = depth_stencil_info.back.passOp;
+    state.back_depth_fail_op = depth_stencil_info.back.depthFailOp;
+    state.back_compare_op = depth_stencil_info.back.compareOp;
+    if (full_update || std::memcmp(&state, &set_extended_dynamic_state_,
+                                   sizeof(state))) {
+      set_extended_dynamic_state_ = state;
+      command_buffer->SetExtendedDynamicState(state);
+    }
+  }
+
   auto& regs = set_dynamic_state_registers_;
+  if (!full_update && !IsDirty(dynamic_state_dirty_group_)) {
+    return true;
+  }
 
   bool window_offset_dirty = SetShadowRegister(&regs.pa_sc_window_offset,
                                                XE_GPU_REG_PA_SC_WINDOW_OFFSET);
@@ -470,12 +1313,13 @@ bool PipelineCache::SetDynamicState(VkCommandBuffer command_buffer,
     ws_x += window_offset_x;
     ws_y += window_offset_y;
 
+    uint32_t resolution_scale = render_cache_->resolution_scale();
     VkRect2D scissor_rect;
-    scissor_rect.offset.x = ws_x;
-    scissor_rect.offset.y = ws_y;
-    scissor_rect.extent.width = ws_w;
-    scissor_rect.extent.height = ws_h;
-    vkCmdSetScissor(command_buffer, 0, 1, &scissor_rect);
+    scissor_rect.offset.x = ws_x * int32_t(resolution_scale);
+    scissor_rect.offset.y = ws_y * int32_t(resolution_scale);
+    scissor_rect.extent.width = ws_w * resolution_scale;
+    scissor_rect.extent.height = ws_h * resolution_scale;
+    command_buffer->SetScissor(scissor_rect);
   }
 
   // VK_DYNAMIC_STATE_VIEWPORT
@@ -570,7 +1414,14 @@ bool PipelineCache::SetDynamicState(VkCommandBuffer command_buffer,
     viewport_rect.minDepth = voz;
     viewport_rect.maxDepth = voz + vsz;
 
-    vkCmdSetViewport(command_buffer, 0, 1, &viewport_rect);
+    // Tile views are scaled, so everything drawn into them is too.
+    float resolution_scale = float(render_cache_->resolution_scale());
+    viewport_rect.x *= resolution_scale;
+    viewport_rect.y *= resolution_scale;
+    viewport_rect.width *= resolution_scale;
+    viewport_rect.height *= resolution_scale;
+
+    command_buffer->SetViewport(viewport_rect);
   }
 
   // VK_DYNAMIC_STATE_BLEND_CONSTANTS
@@ -584,27 +1435,27 @@ bool PipelineCache::SetDynamicState(VkCommandBuffer command_buffer,
   blend_constant_state_dirty |=
       SetShadowRegister(&regs.rb_blend_rgba[3], XE_GPU_REG_RB_BLEND_ALPHA);
   if (blend_constant_state_dirty) {
-    vkCmdSetBlendConstants(command_buffer, regs.rb_blend_rgba);
+    command_buffer->SetBlendConstants(regs.rb_blend_rgba);
   }
 
   if (full_update) {
     // VK_DYNAMIC_STATE_LINE_WIDTH
-    vkCmdSetLineWidth(command_buffer, 1.0f);
+    command_buffer->SetLineWidth(1.0f);
 
     // VK_DYNAMIC_STATE_DEPTH_BIAS
-    vkCmdSetDepthBias(command_buffer, 0.0f, 0.0f, 0.0f);
+    command_buffer->SetDepthBias(0.0f, 0.0f, 0.0f);
 
     // VK_DYNAMIC_STATE_DEPTH_BOUNDS
-    vkCmdSetDepthBounds(command_buffer, 0.0f, 1.0f);
+    command_buffer->SetDepthBounds(0.0f, 1.0f);
 
     // VK_DYNAMIC_STATE_STENCIL_COMPARE_MASK
-    vkCmdSetStencilCompareMask(command_buffer, VK_STENCIL_FRONT_AND_BACK, 0);
+    command_buffer->SetStencilCompareMask(VK_STENCIL_FRONT_AND_BACK, 0);
 
     // VK_DYNAMIC_STATE_STENCIL_REFERENCE
-    vkCmdSetStencilReference(command_buffer, VK_STENCIL_FRONT_AND_BACK, 0);
+    command_buffer->SetStencilReference(VK_STENCIL_FRONT_AND_BACK, 0);
 
     // VK_DYNAMIC_STATE_STENCIL_WRITE_MASK
-    vkCmdSetStencilWriteMask(command_buffer, VK_STENCIL_FRONT_AND_BACK, 0);
+    command_buffer->SetStencilWriteMask(VK_STENCIL_FRONT_AND_BACK, 0);
   }
 
   bool push_constants_dirty = full_update || viewport_state_dirty;
@@ -670,10 +1521,11 @@ bool PipelineCache::SetDynamicState(VkCommandBuffer command_buffer,
     int ps_param_gen = (regs.sq_context_misc >> 8) & 0xFF;
     push_constants.ps_param_gen = program_cntl.param_gen ? ps_param_gen : -1;
 
-    vkCmdPushConstants(
-        command_buffer, pipeline_layout_,
+    // The sampler indices are pushed with the texture descriptor set.
+    command_buffer->PushConstants(
+        pipeline_layout_,
         VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT, 0,
-        kSpirvPushConstantsSize, &push_constants);
+        kSpirvPushConstantSamplerIndicesOffset, &push_constants);
   }
 
   return true;
@@ -702,9 +1554,6 @@ PipelineCache::UpdateStatus PipelineCache::UpdateState(
     PrimitiveType primitive_type) {
   bool mismatch = false;
 
-  // Reset hash so we can build it up.
-  XXH64_reset(&hash_state_, 0);
-
 #define CHECK_UPDATE_STATUS(status, mismatch, error_message) \
   {                                                          \
     if (status == UpdateStatus::kError) {                    \
@@ -752,31 +1601,51 @@ PipelineCache::UpdateStatus PipelineCache::UpdateShaderStages(
               register_file_->values[XE_GPU_REG_SQ_PS_CONST].u32 == 0x00000000);
 
   bool dirty = false;
-  dirty |= SetShadowRegister(&regs.pa_su_sc_mode_cntl,
-                             XE_GPU_REG_PA_SU_SC_MODE_CNTL);
-  dirty |= SetShadowRegister(&regs.sq_program_cntl, XE_GPU_REG_SQ_PROGRAM_CNTL);
+  if (IsDirty(shader_stages_dirty_group_)) {
+    dirty |= SetShadowRegister(&regs.pa_su_sc_mode_cntl,
+                               XE_GPU_REG_PA_SU_SC_MODE_CNTL);
+    dirty |=
+        SetShadowRegister(&regs.sq_program_cntl, XE_GPU_REG_SQ_PROGRAM_CNTL);
+  }
   dirty |= regs.vertex_shader != vertex_shader;
   dirty |= regs.pixel_shader != pixel_shader;
   dirty |= regs.primitive_type != primitive_type;
   regs.vertex_shader = vertex_shader;
   regs.pixel_shader = pixel_shader;
   regs.primitive_type = primitive_type;
-  XXH64_update(&hash_state_, &regs, sizeof(regs));
   if (!dirty) {
     return UpdateStatus::kCompatible;
   }
+  // Shaders are keyed by their ucode rather than their address so that the
+  // key stays the same across runs for the pipelines in the shader cache.
+  pipeline_key_.vertex_shader_hash = vertex_shader->ucode_data_hash();
+  pipeline_key_.pixel_shader_hash =
+      pixel_shader ? pixel_shader->ucode_data_hash() : 0;
+  pipeline_key_.sq_program_cntl = regs.sq_program_cntl;
+  pipeline_key_.pa_su_sc_mode_cntl = regs.pa_su_sc_mode_cntl;
+  pipeline_key_.primitive_type = uint8_t(regs.primitive_type);
+  if (extended_dynamic_state_) {
+    // Culling and the front face are set dynamically.
+    pipeline_key_.pa_su_sc_mode_cntl &= ~uint32_t(0x7);
+    pipeline_key_.primitive_type = uint8_t(GetDynamicTopologyKeyType(
+        regs.primitive_type, (regs.pa_su_sc_mode_cntl & (1 << 21)) != 0));
+  }
 
   xenos::xe_gpu_program_cntl_t sq_program_cntl;
   sq_program_cntl.dword_0 = regs.sq_program_cntl;
 
+  // Shaders queued for translation when loaded may still be in progress.
+  WaitForTranslation(vertex_shader);
+  WaitForTranslation(pixel_shader);
+
   if (!vertex_shader->is_translated() &&
-      !TranslateShader(vertex_shader, sq_program_cntl)) {
+      !TranslateShader(&shader_translator_, vertex_shader, sq_program_cntl)) {
     XELOGE("Failed to translate the vertex shader!");
     return UpdateStatus::kError;
   }
 
   if (!pixel_shader->is_translated() &&
-      !TranslateShader(pixel_shader, sq_program_cntl)) {
+      !TranslateShader(&shader_translator_, pixel_shader, sq_program_cntl)) {
     XELOGE("Failed to translate the pixel shader!");
     return UpdateStatus::kError;
   }
@@ -794,13 +1663,7 @@ PipelineCache::UpdateStatus PipelineCache::UpdateShaderStages(
   vertex_pipeline_stage.pName = "main";
   vertex_pipeline_stage.pSpecializationInfo = nullptr;
 
-  bool is_line_mode = false;
-  if (((regs.pa_su_sc_mode_cntl >> 3) & 0x3) != 0) {
-    uint32_t front_poly_mode = (regs.pa_su_sc_mode_cntl >> 5) & 0x7;
-    if (front_poly_mode == 1) {
-      is_line_mode = true;
-    }
-  }
+  bool is_line_mode = IsLineMode(regs.pa_su_sc_mode_cntl);
   auto geometry_shader = GetGeometryShader(primitive_type, is_line_mode);
   if (geometry_shader) {
     auto& geometry_pipeline_stage =
@@ -837,7 +1700,6 @@ PipelineCache::UpdateStatus PipelineCache::UpdateVertexInputState(
   bool dirty = false;
   dirty |= vertex_shader != regs.vertex_shader;
   regs.vertex_shader = vertex_shader;
-  XXH64_update(&hash_state_, &regs, sizeof(regs));
   if (!dirty) {
     return UpdateStatus::kCompatible;
   }
@@ -862,81 +1724,18 @@ PipelineCache::UpdateStatus PipelineCache::UpdateVertexInputState(
       auto& vertex_attrib_descr = vertex_attrib_descrs[vertex_attrib_count++];
       vertex_attrib_descr.location = attrib.attrib_index;
       vertex_attrib_descr.binding = vertex_binding.binding_index;
-      vertex_attrib_descr.format = VK_FORMAT_UNDEFINED;
       vertex_attrib_descr.offset = attrib.fetch_instr.attributes.offset * 4;
 
-      bool is_signed = attrib.fetch_instr.attributes.is_signed;
-      bool is_integer = attrib.fetch_instr.attributes.is_integer;
-      switch (attrib.fetch_instr.attributes.data_format) {
-        case VertexFormat::k_8_8_8_8:
-          vertex_attrib_descr.format =
-              is_signed ? VK_FORMAT_R8G8B8A8_SNORM : VK_FORMAT_R8G8B8A8_UNORM;
-          break;
-        case VertexFormat::k_2_10_10_10:
-          vertex_attrib_descr.format = is_signed
-                                           ? VK_FORMAT_A2R10G10B10_SNORM_PACK32
-                                           : VK_FORMAT_A2R10G10B10_UNORM_PACK32;
-          break;
-        case VertexFormat::k_10_11_11:
-          assert_true(is_signed);
-          vertex_attrib_descr.format = VK_FORMAT_B10G11R11_UFLOAT_PACK32;
-          break;
-        case VertexFormat::k_11_11_10:
-          // Converted in-shader.
-          // TODO(DrChat)
-          assert_always();
-          // vertex_attrib_descr.format = VK_FORMAT_R32_UINT;
-          vertex_attrib_descr.format = VK_FORMAT_B10G11R11_UFLOAT_PACK32;
-          break;
-        case VertexFormat::k_16_16:
-          vertex_attrib_descr.format =
-              is_signed ? VK_FORMAT_R16G16_SNORM : VK_FORMAT_R16G16_UNORM;
-          break;
-        case VertexFormat::k_16_16_FLOAT:
-          vertex_attrib_descr.format =
-              is_signed ? VK_FORMAT_R16G16_SSCALED : VK_FORMAT_R16G16_USCALED;
-          break;
-        case VertexFormat::k_16_16_16_16:
-          vertex_attrib_descr.format = is_signed ? VK_FORMAT_R16G16B16A16_SNORM
-                                                 : VK_FORMAT_R16G16B16A16_UNORM;
-          break;
-        case VertexFormat::k_16_16_16_16_FLOAT:
-          vertex_attrib_descr.format = is_signed
-                                           ? VK_FORMAT_R16G16B16A16_SSCALED
-                                           : VK_FORMAT_R16G16B16A16_USCALED;
-          break;
-        case VertexFormat::k_32:
-          vertex_attrib_descr.format =
-              is_signed ? VK_FORMAT_R32_SINT : VK_FORMAT_R32_UINT;
-          break;
-        case VertexFormat::k_32_32:
-          vertex_attrib_descr.format =
-              is_signed ? VK_FORMAT_R32G32_SINT : VK_FORMAT_R32G32_UINT;
-          break;
-        case VertexFormat::k_32_32_32_32:
-          vertex_attrib_descr.format =
-              is_signed ? VK_FORMAT_R32G32B32A32_SINT : VK_FORMAT_R32_UINT;
-          break;
-        case VertexFormat::k_32_FLOAT:
-          // assert_true(is_signed);
-          vertex_attrib_descr.format = VK_FORMAT_R32_SFLOAT;
-          break;
-        case VertexFormat::k_32_32_FLOAT:
-          // assert_true(is_signed);
-          vertex_attrib_descr.format = VK_FORMAT_R32G32_SFLOAT;
-          break;
-        case VertexFormat::k_32_32_32_FLOAT:
-          // assert_true(is_signed);
-          vertex_attrib_descr.format = VK_FORMAT_R32G32B32_SFLOAT;
-          break;
-        case VertexFormat::k_32_32_32_32_FLOAT:
-          // assert_true(is_signed);
-          vertex_attrib_descr.format = VK_FORMAT_R32G32B32A32_SFLOAT;
-          break;
-        default:
-          assert_unhandled_case(attrib.fetch_instr.attributes.data_format);
-          break;
-      }
+      // Attributes are fetched as the raw guest words and decoded in the
+      // shader.
+      static const VkFormat word_formats[] = {
+          VK_FORMAT_R32_UINT, VK_FORMAT_R32G32_UINT, VK_FORMAT_R32G32B32_UINT,
+          VK_FORMAT_R32G32B32A32_UINT,
+      };
+      vertex_attrib_descr.format =
+          word_formats[GetVertexFormatSizeInWords(
+                           attrib.fetch_instr.attributes.data_format) -
+                       1];
     }
   }
 
@@ -955,12 +1754,13 @@ PipelineCache::UpdateStatus PipelineCache::UpdateInputAssemblyState(
 
   bool dirty = false;
   dirty |= primitive_type != regs.primitive_type;
-  dirty |= SetShadowRegister(&regs.pa_su_sc_mode_cntl,
-                             XE_GPU_REG_PA_SU_SC_MODE_CNTL);
-  dirty |= SetShadowRegister(&regs.multi_prim_ib_reset_index,
-                             XE_GPU_REG_VGT_MULTI_PRIM_IB_RESET_INDX);
+  if (IsDirty(input_assembly_state_dirty_group_)) {
+    dirty |= SetShadowRegister(&regs.pa_su_sc_mode_cntl,
+                               XE_GPU_REG_PA_SU_SC_MODE_CNTL);
+    dirty |= SetShadowRegister(&regs.multi_prim_ib_reset_index,
+                               XE_GPU_REG_VGT_MULTI_PRIM_IB_RESET_INDX);
+  }
   regs.primitive_type = primitive_type;
-  XXH64_update(&hash_state_, &regs, sizeof(regs));
   if (!dirty) {
     return UpdateStatus::kCompatible;
   }
@@ -1051,20 +1851,27 @@ PipelineCache::UpdateStatus PipelineCache::UpdateRasterizationState(
 
   bool dirty = false;
   dirty |= regs.primitive_type != primitive_type;
-  dirty |= SetShadowRegister(&regs.pa_su_sc_mode_cntl,
-                             XE_GPU_REG_PA_SU_SC_MODE_CNTL);
-  dirty |= SetShadowRegister(&regs.pa_sc_screen_scissor_tl,
-                             XE_GPU_REG_PA_SC_SCREEN_SCISSOR_TL);
-  dirty |= SetShadowRegister(&regs.pa_sc_screen_scissor_br,
-                             XE_GPU_REG_PA_SC_SCREEN_SCISSOR_BR);
-  dirty |= SetShadowRegister(&regs.pa_sc_viz_query, XE_GPU_REG_PA_SC_VIZ_QUERY);
-  dirty |= SetShadowRegister(&regs.multi_prim_ib_reset_index,
-                             XE_GPU_REG_VGT_MULTI_PRIM_IB_RESET_INDX);
+  if (IsDirty(rasterization_state_dirty_group_)) {
+    dirty |= SetShadowRegister(&regs.pa_su_sc_mode_cntl,
+                               XE_GPU_REG_PA_SU_SC_MODE_CNTL);
+    dirty |= SetShadowRegister(&regs.pa_sc_screen_scissor_tl,
+                               XE_GPU_REG_PA_SC_SCREEN_SCISSOR_TL);
+    dirty |= SetShadowRegister(&regs.pa_sc_screen_scissor_br,
+                               XE_GPU_REG_PA_SC_SCREEN_SCISSOR_BR);
+    dirty |=
+        SetShadowRegister(&regs.pa_sc_viz_query, XE_GPU_REG_PA_SC_VIZ_QUERY);
+    dirty |= SetShadowRegister(&regs.multi_prim_ib_reset_index,
+                               XE_GPU_REG_VGT_MULTI_PRIM_IB_RESET_INDX);
+  }
   regs.primitive_type = primitive_type;
-  XXH64_update(&hash_state_, &regs, sizeof(regs));
   if (!dirty) {
     return UpdateStatus::kCompatible;
   }
+  if (regs.pa_sc_viz_query & 0x80) {
+    pipeline_key_.flags |= PipelineKey::kFlagKillPixPostEarlyZ;
+  } else {
+    pipeline_key_.flags &= ~PipelineKey::kFlagKillPixPostEarlyZ;
+  }
 
   state_info.sType = VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO;
   state_info.pNext = nullptr;
@@ -1134,14 +1941,18 @@ PipelineCache::UpdateStatus PipelineCache::UpdateMultisampleState() {
   auto& state_info = update_multisample_state_info_;
 
   bool dirty = false;
-  dirty |= SetShadowRegister(&regs.pa_sc_aa_config, XE_GPU_REG_PA_SC_AA_CONFIG);
-  dirty |= SetShadowRegister(&regs.pa_su_sc_mode_cntl,
-                             XE_GPU_REG_PA_SU_SC_MODE_CNTL);
-  dirty |= SetShadowRegister(&regs.rb_surface_info, XE_GPU_REG_RB_SURFACE_INFO);
-  XXH64_update(&hash_state_, &regs, sizeof(regs));
+  if (IsDirty(multisample_state_dirty_group_)) {
+    dirty |=
+        SetShadowRegister(&regs.pa_sc_aa_config, XE_GPU_REG_PA_SC_AA_CONFIG);
+    dirty |= SetShadowRegister(&regs.pa_su_sc_mode_cntl,
+                               XE_GPU_REG_PA_SU_SC_MODE_CNTL);
+    dirty |=
+        SetShadowRegister(&regs.rb_surface_info, XE_GPU_REG_RB_SURFACE_INFO);
+  }
   if (!dirty) {
     return UpdateStatus::kCompatible;
   }
+  pipeline_key_.msaa_samples = uint8_t((regs.rb_surface_info >> 16) & 0x3);
 
   state_info.sType = VK_STRUCTURE_TYPE_PIPELINE_MULTISAMPLE_STATE_CREATE_INFO;
   state_info.pNext = nullptr;
@@ -1187,13 +1998,19 @@ PipelineCache::UpdateStatus PipelineCache::UpdateDepthStencilState() {
   auto& state_info = update_depth_stencil_state_info_;
 
   bool dirty = false;
-  dirty |= SetShadowRegister(&regs.rb_depthcontrol, XE_GPU_REG_RB_DEPTHCONTROL);
-  dirty |=
-      SetShadowRegister(&regs.rb_stencilrefmask, XE_GPU_REG_RB_STENCILREFMASK);
-  XXH64_update(&hash_state_, &regs, sizeof(regs));
+  if (IsDirty(depth_stencil_state_dirty_group_)) {
+    dirty |=
+        SetShadowRegister(&regs.rb_depthcontrol, XE_GPU_REG_RB_DEPTHCONTROL);
+    dirty |= SetShadowRegister(&regs.rb_stencilrefmask,
+                               XE_GPU_REG_RB_STENCILREFMASK);
+  }
   if (!dirty) {
     return UpdateStatus::kCompatible;
   }
+  if (!extended_dynamic_state_) {
+    pipeline_key_.rb_depthcontrol = regs.rb_depthcontrol;
+    pipeline_key_.rb_stencilrefmask = regs.rb_stencilrefmask;
+  }
 
   state_info.sType = VK_STRUCTURE_TYPE_PIPELINE_DEPTH_STENCIL_STATE_CREATE_INFO;
   state_info.pNext = nullptr;
@@ -1281,21 +2098,33 @@ PipelineCache::UpdateStatus PipelineCache::UpdateColorBlendState() {
   //                             reg_file[XE_GPU_REG_RB_ALPHA_REF].f32);
 
   bool dirty = false;
-  dirty |= SetShadowRegister(&regs.rb_colorcontrol, XE_GPU_REG_RB_COLORCONTROL);
-  dirty |= SetShadowRegister(&regs.rb_color_mask, XE_GPU_REG_RB_COLOR_MASK);
-  dirty |=
-      SetShadowRegister(&regs.rb_blendcontrol[0], XE_GPU_REG_RB_BLENDCONTROL_0);
-  dirty |=
-      SetShadowRegister(&regs.rb_blendcontrol[1], XE_GPU_REG_RB_BLENDCONTROL_1);
-  dirty |=
-      SetShadowRegister(&regs.rb_blendcontrol[2], XE_GPU_REG_RB_BLENDCONTROL_2);
-  dirty |=
-      SetShadowRegister(&regs.rb_blendcontrol[3], XE_GPU_REG_RB_BLENDCONTROL_3);
-  dirty |= SetShadowRegister(&regs.rb_modecontrol, XE_GPU_REG_RB_MODECONTROL);
-  XXH64_update(&hash_state_, &regs, sizeof(regs));
+  if (IsDirty(color_blend_state_dirty_group_)) {
+    dirty |=
+        SetShadowRegister(&regs.rb_colorcontrol, XE_GPU_REG_RB_COLORCONTROL);
+    dirty |= SetShadowRegister(&regs.rb_color_mask, XE_GPU_REG_RB_COLOR_MASK);
+    dirty |= SetShadowRegister(&regs.rb_blendcontrol[0],
+                               XE_GPU_REG_RB_BLENDCONTROL_0);
+    dirty |= SetShadowRegister(&regs.rb_blendcontrol[1],
+                               XE_GPU_REG_RB_BLENDCONTROL_1);
+    dirty |= SetShadowRegister(&regs.rb_blendcontrol[2],
+                               XE_GPU_REG_RB_BLENDCONTROL_2);
+    dirty |= SetShadowRegister(&regs.rb_blendcontrol[3],
+                               XE_GPU_REG_RB_BLENDCONTROL_3);
+    dirty |=
+        SetShadowRegister(&regs.rb_modecontrol, XE_GPU_REG_RB_MODECONTROL);
+  }
   if (!dirty) {
     return UpdateStatus::kCompatible;
   }
+  std::memcpy(pipeline_key_.rb_blendcontrol, regs.rb_blendcontrol,
+              sizeof(regs.rb_blendcontrol));
+  pipeline_key_.rb_color_mask = regs.rb_color_mask;
+  pipeline_key_.mode_control = uint8_t(regs.rb_modecontrol & 0x7);
+  if (regs.rb_colorcontrol & 0x20) {
+    pipeline_key_.flags |= PipelineKey::kFlagBlendDisable;
+  } else {
+    pipeline_key_.flags &= ~PipelineKey::kFlagBlendDisable;
+  }
 
   state_info.sType = VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO;
   state_info.pNext = nullptr;
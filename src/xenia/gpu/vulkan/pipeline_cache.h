@@ -10,12 +10,23 @@
 #ifndef XENIA_GPU_VULKAN_PIPELINE_CACHE_H_
 #define XENIA_GPU_VULKAN_PIPELINE_CACHE_H_
 
+#include <condition_variable>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
 #include <unordered_map>
+#include <unordered_set>
+#include <vector>
 
 #include "third_party/xxhash/xxhash.h"
 
+#include "xenia/base/threading.h"
 #include "xenia/gpu/register_file.h"
 #include "xenia/gpu/spirv_shader_translator.h"
+#include "xenia/gpu/vulkan/deferred_command_buffer.h"
 #include "xenia/gpu/vulkan/render_cache.h"
 #include "xenia/gpu/vulkan/vulkan_shader.h"
 #include "xenia/gpu/xenos.h"
@@ -36,14 +47,19 @@ class PipelineCache {
     kCompatible,
     kMismatch,
     kError,
+    // The pipeline is still being created in the background, and the draw
+    // should be skipped.
+    kPending,
   };
 
   PipelineCache(RegisterFile* register_file, ui::vulkan::VulkanDevice* device,
+                RenderCache* render_cache,
                 VkDescriptorSetLayout uniform_descriptor_set_layout,
-                VkDescriptorSetLayout texture_descriptor_set_layout);
+                VkDescriptorSetLayout texture_descriptor_set_layout,
+                VkDescriptorSetLayout memexport_descriptor_set_layout);
   ~PipelineCache();
 
-  // Loads a shader from the cache, possibly translating it.
+  // Loads a shader from the cache, queuing its translation if it's new.
   VulkanShader* LoadShader(ShaderType shader_type, uint32_t guest_address,
                            const uint32_t* host_address, uint32_t dword_count);
 
@@ -59,10 +75,14 @@ class PipelineCache {
                                  PrimitiveType primitive_type,
                                  VkPipeline* pipeline_out);
 
-  // Sets required dynamic state on the command buffer.
+  // Sets required dynamic state on the draw command buffer.
   // Only state that has changed since the last call will be set unless
   // full_update is true.
-  bool SetDynamicState(VkCommandBuffer command_buffer, bool full_update);
+  bool SetDynamicState(DeferredCommandBuffer* command_buffer,
+                       bool full_update);
+
+  // Whether polygons are drawn as their outlines.
+  static bool IsLineMode(uint32_t pa_su_sc_mode_cntl);
 
   // Pipeline layout shared by all pipelines.
   VkPipelineLayout pipeline_layout() const { return pipeline_layout_; }
@@ -70,23 +90,177 @@ class PipelineCache {
   // Clears all cached content.
   void ClearCache();
 
+  // Lookups that found a created pipeline and ones that had to create one or
+  // wait on its creation.
+  uint64_t hit_count() const { return hit_count_; }
+  uint64_t miss_count() const { return miss_count_; }
+
  private:
-  // Creates or retrieves an existing pipeline for the currently configured
-  // state.
-  VkPipeline GetPipeline(const RenderState* render_state, uint64_t hash_key);
+  // Everything the created pipelines depend on, packed so that they can be
+  // looked up without hashing all of the shadowed registers for each draw.
+  // The state updates bring it up to date as the registers change.
+  struct PipelineKey {
+    enum : uint8_t {
+      // PA_SC_VIZ_QUERY KILL_PIX_POST_EARLY_Z.
+      kFlagKillPixPostEarlyZ = 1 << 0,
+      // RB_COLORCONTROL blend disable.
+      kFlagBlendDisable = 1 << 1,
+      // Created with the state of VK_EXT_extended_dynamic_state dynamic, in
+      // which case none of it is in the key.
+      kFlagExtendedDynamicState = 1 << 2,
+    };
+
+    uint64_t vertex_shader_hash;
+    uint64_t pixel_shader_hash;
+    uint32_t sq_program_cntl;
+    uint32_t pa_su_sc_mode_cntl;
+    uint32_t rb_depthcontrol;
+    uint32_t rb_stencilrefmask;
+    uint32_t rb_blendcontrol[4];
+    uint32_t rb_color_mask;
+    uint8_t primitive_type;
+    // RB_SURFACE_INFO MSAA_SAMPLES.
+    uint8_t msaa_samples;
+    // RB_MODECONTROL EDRAM_MODE.
+    uint8_t mode_control;
+    uint8_t flags;
+
+    PipelineKey() { std::memset(this, 0, sizeof(*this)); }
+    bool operator==(const PipelineKey& other) const {
+      return !std::memcmp(this, &other, sizeof(*this));
+    }
+    uint64_t Hash() const;
+  };
+  static_assert(sizeof(PipelineKey) <= 64 &&
+                    sizeof(PipelineKey) % sizeof(uint64_t) == 0,
+                "Pipeline key must be tightly packed");
+
+  // A copy of the configured state of a pipeline to create, so that it can be
+  // created while the state is updated for the following draws. This is also
+  // what is written to the shader cache to create the pipeline in later runs,
+  // with the handles and pointers restored from the fields after them.
+  struct PipelineCreateJob {
+    PipelineKey key;
+    uint64_t fallback_key;
+    RenderConfiguration render_config;
+    uint64_t vertex_shader_hash;
+    uint32_t vertex_shader_cntl;
+    uint64_t pixel_shader_hash;
+    uint32_t pixel_shader_cntl;
+    PrimitiveType primitive_type;
+    bool is_line_mode;
+    VkRenderPass render_pass;
+    VkPipelineShaderStageCreateInfo shader_stages_info[3];
+    uint32_t shader_stages_stage_count;
+    VkPipelineVertexInputStateCreateInfo vertex_input_state_info;
+    VkVertexInputBindingDescription vertex_input_state_binding_descrs[64];
+    VkVertexInputAttributeDescription vertex_input_state_attrib_descrs[64];
+    VkPipelineInputAssemblyStateCreateInfo input_assembly_state_info;
+    VkPipelineViewportStateCreateInfo viewport_state_info;
+    VkPipelineRasterizationStateCreateInfo rasterization_state_info;
+    VkPipelineMultisampleStateCreateInfo multisample_state_info;
+    VkPipelineDepthStencilStateCreateInfo depth_stencil_state_info;
+    VkPipelineColorBlendStateCreateInfo color_blend_state_info;
+    VkPipelineColorBlendAttachmentState color_blend_attachment_states[4];
+  };
 
-  bool TranslateShader(VulkanShader* shader, xenos::xe_gpu_program_cntl_t cntl);
+  struct CachedPipeline {
+    VkPipeline handle = nullptr;
+    // True until a background thread has created the pipeline.
+    bool pending = false;
+  };
+
+  // Open addressing table of pipelines by key, with linear probing.
+  class PipelineTable {
+   public:
+    // Returns nullptr if there's no pipeline for the key.
+    CachedPipeline* Find(const PipelineKey& key);
+    // Returns the pipeline for the key, adding an empty one if needed.
+    // Invalidates pointers returned earlier.
+    CachedPipeline& Insert(const PipelineKey& key);
+    void Clear();
+
+    template <typename Callback>
+    void ForEach(Callback callback) {
+      for (auto& entry : entries_) {
+        if (entry.used) {
+          callback(entry.pipeline);
+        }
+      }
+    }
+
+   private:
+    struct Entry {
+      PipelineKey key;
+      CachedPipeline pipeline;
+      bool used = false;
+    };
+    // Power of two sized.
+    std::vector<Entry> entries_;
+    size_t size_ = 0;
+  };
+
+  // Creates or retrieves an existing pipeline for the currently configured
+  // state. If the pipeline is still being created this sets pending_out and
+  // returns a fallback pipeline, or nullptr if none may be used.
+  VkPipeline GetPipeline(const RenderState* render_state,
+                         const PipelineKey& key, bool* pending_out);
+  // Identifies pipelines that can be drawn with in place of one another while
+  // one is being created: same shaders, primitive type and render pass.
+  uint64_t GetFallbackKey(const RenderState* render_state);
+  std::unique_ptr<PipelineCreateJob> CapturePipelineState(
+      const RenderState* render_state, const PipelineKey& key);
+  VkPipeline CreatePipeline(const PipelineCreateJob& job);
+  void PipelineThreadMain();
+  void ShutdownPipelineThreads();
+
+  // Background shader translation, if enabled. Each thread has its own
+  // translator, as they hold the state of the shader being translated.
+  void TranslationThreadMain();
+  void ShutdownTranslationThreads();
+  // Waits for a background translation of the shader to complete. If no
+  // thread has started on it yet it's dequeued for the caller to translate.
+  void WaitForTranslation(VulkanShader* shader);
+
+  // Shader cache on disk, under --shader_cache_dir.
+  // Translated shaders are stored by ucode hash and program control,
+  // pipelines as the list of all those created and the driver pipeline cache.
+  bool LoadCachedTranslation(SpirvShaderTranslator* shader_translator,
+                             VulkanShader* shader, uint32_t program_cntl);
+  void CacheTranslation(VulkanShader* shader);
+  VkShaderModule LoadCachedShaderModule(ShaderType shader_type, uint64_t hash,
+                                        uint32_t program_cntl);
+  // Reads the pipelines created in previous runs and opens the log for more.
+  void OpenPipelineLog(std::vector<std::unique_ptr<PipelineCreateJob>>* jobs);
+  // Creates all pipelines that were created in previous runs.
+  void PrecreatePipelines(
+      const std::vector<std::unique_ptr<PipelineCreateJob>>& jobs);
+  void SavePipelineCacheData();
+
+  bool TranslateShader(SpirvShaderTranslator* shader_translator,
+                       VulkanShader* shader, xenos::xe_gpu_program_cntl_t cntl);
   void DumpShaderDisasmNV(const VkGraphicsPipelineCreateInfo& info);
 
   // Gets a geometry shader used to emulate the given primitive type.
   // Returns nullptr if the primitive doesn't need to be emulated.
   VkShaderModule GetGeometryShader(PrimitiveType primitive_type,
                                    bool is_line_mode);
+  // Primitive type to key pipelines with a dynamic topology by, which is the
+  // same for all types drawn without a geometry shader in a topology class.
+  static PrimitiveType GetDynamicTopologyKeyType(PrimitiveType primitive_type,
+                                                 bool primitive_restart);
 
   RegisterFile* register_file_ = nullptr;
   VkDevice device_ = nullptr;
-
-  // Reusable shader translator.
+  RenderCache* render_cache_ = nullptr;
+  // Whether the device can store from vertex shaders, for memexport.
+  bool memexport_enabled_ = false;
+  // Whether pipelines leave the state of VK_EXT_extended_dynamic_state to be
+  // set with SetDynamicState.
+  bool extended_dynamic_state_ = false;
+
+  // Reusable shader translator for translation on the command processor
+  // thread.
   SpirvShaderTranslator shader_translator_;
   // Disassembler used to get the SPIRV disasm. Only used in debug.
   xe::ui::spirv::SpirvDisassembler disassembler_;
@@ -108,12 +282,40 @@ class PipelineCache {
     VkShaderModule rect_list;
   } geometry_shaders_;
 
-  // Hash state used to incrementally produce pipeline hashes during update.
-  // By the time the full update pass has run the hash will represent the
-  // current state in a way that can uniquely identify the produced VkPipeline.
-  XXH64_state_t hash_state_;
-  // All previously generated pipelines mapped by hash.
-  std::unordered_map<uint64_t, VkPipeline> cached_pipelines_;
+  // Key of the current state, updated along with the shadow registers. By the
+  // time the full update pass has run it uniquely identifies the VkPipeline
+  // to use.
+  PipelineKey pipeline_key_;
+  // All previously generated pipelines by key, including those still being
+  // created. Guarded by pipeline_mutex_, as pipeline threads complete their
+  // entries.
+  PipelineTable cached_pipelines_;
+  // Most recently created pipeline for each fallback key.
+  std::unordered_map<uint64_t, VkPipeline> fallback_pipelines_;
+
+  // Background pipeline creation, if enabled.
+  std::vector<std::unique_ptr<xe::threading::Thread>> pipeline_threads_;
+  std::mutex pipeline_mutex_;
+  std::condition_variable pipeline_cond_;
+  std::deque<std::unique_ptr<PipelineCreateJob>> pipeline_queue_;
+  bool pipeline_shutdown_ = false;
+
+  std::vector<std::unique_ptr<xe::threading::Thread>> translation_threads_;
+  std::mutex translation_mutex_;
+  std::condition_variable translation_cond_;
+  std::condition_variable translation_done_cond_;
+  std::deque<VulkanShader*> translation_queue_;
+  // Shaders a background thread is translating right now.
+  std::unordered_set<VulkanShader*> translating_shaders_;
+  bool translation_shutdown_ = false;
+
+  // Shader cache directory, or empty if disabled.
+  std::wstring cache_dir_;
+  // Appended to with every new pipeline. Guarded by pipeline_mutex_.
+  FILE* pipeline_log_file_ = nullptr;
+  // Modules of shaders that pipelines were created with ahead of time, as the
+  // shaders themselves are only loaded when first used.
+  std::vector<VkShaderModule> precreate_shader_modules_;
 
   // Previously used pipeline. This matches our current state settings
   // and allows us to quickly(ish) reuse the pipeline if no registers have
@@ -138,6 +340,19 @@ class PipelineCache {
 
   bool SetShadowRegister(uint32_t* dest, uint32_t register_name);
   bool SetShadowRegister(float* dest, uint32_t register_name);
+  // Shadow registers of a state only need to be compared if one of the
+  // registers in its group was written since the last draw.
+  bool IsDirty(uint64_t dirty_group) const {
+    return (register_file_->dirty_groups() & dirty_group) != 0;
+  }
+
+  uint64_t shader_stages_dirty_group_ = 0;
+  uint64_t input_assembly_state_dirty_group_ = 0;
+  uint64_t rasterization_state_dirty_group_ = 0;
+  uint64_t multisample_state_dirty_group_ = 0;
+  uint64_t depth_stencil_state_dirty_group_ = 0;
+  uint64_t color_blend_state_dirty_group_ = 0;
+  uint64_t dynamic_state_dirty_group_ = 0;
 
   struct UpdateRenderTargetsRegisters {
     uint32_t rb_modecontrol;
@@ -168,6 +383,9 @@ class PipelineCache {
   VkPipelineShaderStageCreateInfo update_shader_stages_info_[3];
   uint32_t update_shader_stages_stage_count_ = 0;
 
+  uint64_t hit_count_ = 0;
+  uint64_t miss_count_ = 0;
+
   struct UpdateVertexInputStateRegisters {
     VulkanShader* vertex_shader;
 
@@ -279,6 +497,7 @@ class PipelineCache {
     SetDynamicStateRegisters() { Reset(); }
     void Reset() { std::memset(this, 0, sizeof(*this)); }
   } set_dynamic_state_registers_;
+  DeferredCommandBuffer::ExtendedDynamicState set_extended_dynamic_state_;
 };
 
 }  // namespace vulkan
@@ -11,6 +11,7 @@
 
 #include <algorithm>
 
+#include "third_party/xxhash/xxhash.h"
 #include "xenia/base/logging.h"
 #include "xenia/base/math.h"
 #include "xenia/base/memory.h"
@@ -26,6 +27,7 @@ using namespace xe::gpu::xenos;
 using xe::ui::vulkan::CheckResult;
 
 constexpr uint32_t kEdramBufferCapacity = 10 * 1024 * 1024;
+constexpr uint32_t kEdramTileCount = kEdramBufferCapacity / 5120;
 
 VkFormat ColorRenderTargetFormatToVkFormat(ColorRenderTargetFormat format) {
   switch (format) {
@@ -75,7 +77,15 @@ VkFormat DepthRenderTargetFormatToVkFormat(DepthRenderTargetFormat format) {
 // Each framebuffer is specific to a render pass. Ugh.
 class CachedFramebuffer {
  public:
-  // TODO(benvanik): optimized key? tile base + format for each?
+  // RenderCache::GetFramebufferKey of the configuration it was created for.
+  uint64_t key = 0;
+  // Render pass the framebuffer was created for.
+  CachedRenderPass* render_pass = nullptr;
+  // Frame the framebuffer was last used in, and the batch that did.
+  uint64_t last_used_frame = 0;
+  std::shared_ptr<ui::vulkan::Fence> in_flight_fence;
+  // Position in RenderCache::framebuffer_lru_.
+  std::list<CachedFramebuffer*>::iterator lru_position;
 
   // Framebuffer with the attachments ready for use in the parent render pass.
   VkFramebuffer handle = nullptr;
@@ -88,15 +98,24 @@ class CachedFramebuffer {
   // Reference to depth/stencil attachment, if used.
   CachedTileView* depth_stencil_attachment = nullptr;
 
+  // Scale of the width and height relative to the guest surface.
+  uint32_t resolution_scale = 1;
+
   CachedFramebuffer(VkDevice device, VkRenderPass render_pass,
                     uint32_t surface_width, uint32_t surface_height,
+                    uint32_t surface_scale,
                     CachedTileView* target_color_attachments[4],
                     CachedTileView* target_depth_stencil_attachment);
   ~CachedFramebuffer();
 
   bool IsCompatible(const RenderConfiguration& desired_config) const;
 
+  // The pass to begin to clear the attachments in clear_mask on load.
+  VkRenderPass GetHandle(uint32_t clear_mask);
+
  private:
+  VkRenderPass CreateHandle(uint32_t clear_mask) const;
+
   VkDevice device_ = nullptr;
 };
 
@@ -111,26 +130,37 @@ class CachedRenderPass {
   RenderConfiguration config;
   // Initialized render pass for the register state.
   VkRenderPass handle = nullptr;
-  // Cache of framebuffers for the various tile attachments.
-  std::vector<CachedFramebuffer*> cached_framebuffers;
+  // Compatible variants of the pass clearing some of the attachments on load,
+  // by the mask of their indices (4 for depth/stencil). Created when needed.
+  VkRenderPass clear_handles[32] = {nullptr};
+  // Cache of framebuffers for the various tile attachments, by
+  // RenderCache::GetFramebufferKey. Owned by the RenderCache.
+  std::unordered_multimap<uint64_t, CachedFramebuffer*> cached_framebuffers;
 
   CachedRenderPass(VkDevice device, const RenderConfiguration& desired_config);
   ~CachedRenderPass();
 
   bool IsCompatible(const RenderConfiguration& desired_config) const;
 
+  // The pass to begin to clear the attachments in clear_mask on load.
+  VkRenderPass GetHandle(uint32_t clear_mask);
+
  private:
+  VkRenderPass CreateHandle(uint32_t clear_mask) const;
+
   VkDevice device_ = nullptr;
 };
 
 CachedTileView::CachedTileView(ui::vulkan::VulkanDevice* device,
                                VkCommandBuffer command_buffer,
                                VkDeviceMemory edram_memory,
-                               TileViewKey view_key)
-    : device_(*device), key(std::move(view_key)) {
+                               TileViewKey view_key,
+                               uint32_t resolution_scale)
+    : device_(*device),
+      memory_allocator_(device->memory_allocator()),
+      key(std::move(view_key)) {
   // Map format to Vulkan.
   VkFormat vulkan_format = VK_FORMAT_UNDEFINED;
-  uint32_t bpp = 4;
   if (key.color_or_depth) {
     auto edram_format = static_cast<ColorRenderTargetFormat>(key.edram_format);
     vulkan_format = ColorRenderTargetFormatToVkFormat(edram_format);
@@ -161,8 +191,8 @@ CachedTileView::CachedTileView(ui::vulkan::VulkanDevice* device,
   image_info.flags = 0;
   image_info.imageType = VK_IMAGE_TYPE_2D;
   image_info.format = vulkan_format;
-  image_info.extent.width = key.tile_width * 80;
-  image_info.extent.height = key.tile_height * 16;
+  image_info.extent.width = key.tile_width * 80 * resolution_scale;
+  image_info.extent.height = key.tile_height * 16 * resolution_scale;
   image_info.extent.depth = 1;
   image_info.mipLevels = 1;
   image_info.arrayLayers = 1;
@@ -202,10 +232,9 @@ CachedTileView::CachedTileView(ui::vulkan::VulkanDevice* device,
   VkMemoryRequirements memory_requirements;
   vkGetImageMemoryRequirements(*device, image, &memory_requirements);
 
-  // Bind to a newly allocated chunk.
-  // TODO: Alias from a really big buffer?
-  memory = device->AllocateMemory(memory_requirements, 0);
-  err = vkBindImageMemory(device_, image, memory, 0);
+  // Bind to a chunk of a block shared with other resources.
+  memory_allocator_->Allocate(memory_requirements, 0, false, &memory);
+  err = vkBindImageMemory(device_, image, memory.memory, memory.offset);
   CheckResult(err, "vkBindImageMemory");
 
   // Create the image view we'll use to attach it to a framebuffer.
@@ -262,16 +291,18 @@ CachedTileView::CachedTileView(ui::vulkan::VulkanDevice* device,
 CachedTileView::~CachedTileView() {
   vkDestroyImageView(device_, image_view, nullptr);
   vkDestroyImage(device_, image, nullptr);
-  vkFreeMemory(device_, memory, nullptr);
+  memory_allocator_->Free(memory);
 }
 
 CachedFramebuffer::CachedFramebuffer(
     VkDevice device, VkRenderPass render_pass, uint32_t surface_width,
-    uint32_t surface_height, CachedTileView* target_color_attachments[4],
+    uint32_t surface_height, uint32_t surface_scale,
+    CachedTileView* target_color_attachments[4],
     CachedTileView* target_depth_stencil_attachment)
     : device_(device),
       width(surface_width),
       height(surface_height),
+      resolution_scale(surface_scale),
       depth_stencil_attachment(target_depth_stencil_attachment) {
   for (int i = 0; i < 4; ++i) {
     color_attachments[i] = target_color_attachments[i];
@@ -315,8 +346,8 @@ bool CachedFramebuffer::IsCompatible(
   uint32_t surface_height_px = desired_config.surface_msaa == MsaaSamples::k1X
                                    ? desired_config.surface_height_px
                                    : desired_config.surface_height_px * 2;
-  surface_pitch_px = std::min(surface_pitch_px, 2560u);
-  surface_height_px = std::min(surface_height_px, 2560u);
+  surface_pitch_px = std::min(surface_pitch_px, 2560u) * resolution_scale;
+  surface_height_px = std::min(surface_height_px, 2560u) * resolution_scale;
   if (surface_pitch_px != width || surface_height_px != height) {
     return false;
   }
@@ -349,10 +380,33 @@ CachedRenderPass::CachedRenderPass(VkDevice device,
                                    const RenderConfiguration& desired_config)
     : device_(device) {
   std::memcpy(&config, &desired_config, sizeof(config));
+  handle = CreateHandle(0);
+}
 
+CachedRenderPass::~CachedRenderPass() {
+  vkDestroyRenderPass(device_, handle, nullptr);
+  for (auto clear_handle : clear_handles) {
+    if (clear_handle) {
+      vkDestroyRenderPass(device_, clear_handle, nullptr);
+    }
+  }
+}
+
+VkRenderPass CachedRenderPass::GetHandle(uint32_t clear_mask) {
+  if (!clear_mask) {
+    return handle;
+  }
+  auto& clear_handle = clear_handles[clear_mask];
+  if (!clear_handle) {
+    clear_handle = CreateHandle(clear_mask);
+  }
+  return clear_handle;
+}
+
+VkRenderPass CachedRenderPass::CreateHandle(uint32_t clear_mask) const {
   VkSampleCountFlagBits sample_count;
   if (FLAGS_vulkan_native_msaa) {
-    switch (desired_config.surface_msaa) {
+    switch (config.surface_msaa) {
       case MsaaSamples::k1X:
         sample_count = VK_SAMPLE_COUNT_1_BIT;
         break;
@@ -363,7 +417,7 @@ CachedRenderPass::CachedRenderPass(VkDevice device,
         sample_count = VK_SAMPLE_COUNT_4_BIT;
         break;
       default:
-        assert_unhandled_case(desired_config.surface_msaa);
+        assert_unhandled_case(config.surface_msaa);
         break;
     }
   } else {
@@ -377,7 +431,9 @@ CachedRenderPass::CachedRenderPass(VkDevice device,
     attachments[i].flags = 0;
     attachments[i].format = VK_FORMAT_UNDEFINED;
     attachments[i].samples = sample_count;
-    attachments[i].loadOp = VK_ATTACHMENT_LOAD_OP_LOAD;
+    attachments[i].loadOp = (clear_mask & (1 << i))
+                                ? VK_ATTACHMENT_LOAD_OP_CLEAR
+                                : VK_ATTACHMENT_LOAD_OP_LOAD;
     attachments[i].storeOp = VK_ATTACHMENT_STORE_OP_STORE;
     attachments[i].stencilLoadOp = VK_ATTACHMENT_LOAD_OP_LOAD;
     attachments[i].stencilStoreOp = VK_ATTACHMENT_STORE_OP_STORE;
@@ -388,9 +444,11 @@ CachedRenderPass::CachedRenderPass(VkDevice device,
   depth_stencil_attachment.flags = 0;
   depth_stencil_attachment.format = VK_FORMAT_UNDEFINED;
   depth_stencil_attachment.samples = sample_count;
-  depth_stencil_attachment.loadOp = VK_ATTACHMENT_LOAD_OP_LOAD;
+  depth_stencil_attachment.loadOp = (clear_mask & (1 << 4))
+                                        ? VK_ATTACHMENT_LOAD_OP_CLEAR
+                                        : VK_ATTACHMENT_LOAD_OP_LOAD;
   depth_stencil_attachment.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
-  depth_stencil_attachment.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_LOAD;
+  depth_stencil_attachment.stencilLoadOp = depth_stencil_attachment.loadOp;
   depth_stencil_attachment.stencilStoreOp = VK_ATTACHMENT_STORE_OP_STORE;
   depth_stencil_attachment.initialLayout = VK_IMAGE_LAYOUT_GENERAL;
   depth_stencil_attachment.finalLayout = VK_IMAGE_LAYOUT_GENERAL;
@@ -437,17 +495,11 @@ CachedRenderPass::CachedRenderPass(VkDevice device,
   render_pass_info.pSubpasses = &subpass_info;
   render_pass_info.dependencyCount = 0;
   render_pass_info.pDependencies = nullptr;
-  auto err = vkCreateRenderPass(device_, &render_pass_info, nullptr, &handle);
+  VkRenderPass render_pass = nullptr;
+  auto err =
+      vkCreateRenderPass(device_, &render_pass_info, nullptr, &render_pass);
   CheckResult(err, "vkCreateRenderPass");
-}
-
-CachedRenderPass::~CachedRenderPass() {
-  for (auto framebuffer : cached_framebuffers) {
-    delete framebuffer;
-  }
-  cached_framebuffers.clear();
-
-  vkDestroyRenderPass(device_, handle, nullptr);
+  return render_pass;
 }
 
 bool CachedRenderPass::IsCompatible(
@@ -474,6 +526,25 @@ RenderCache::RenderCache(RegisterFile* register_file,
     : register_file_(register_file), device_(device) {
   VkResult status = VK_SUCCESS;
 
+  static const uint32_t shadow_registers[] = {
+      XE_GPU_REG_RB_MODECONTROL,          XE_GPU_REG_RB_SURFACE_INFO,
+      XE_GPU_REG_RB_COLOR_INFO,           XE_GPU_REG_RB_COLOR1_INFO,
+      XE_GPU_REG_RB_COLOR2_INFO,          XE_GPU_REG_RB_COLOR3_INFO,
+      XE_GPU_REG_RB_DEPTH_INFO,           XE_GPU_REG_PA_SC_WINDOW_SCISSOR_TL,
+      XE_GPU_REG_PA_SC_WINDOW_SCISSOR_BR,
+  };
+  dirty_group_ = register_file_->AddDirtyGroup(shadow_registers,
+                                               xe::countof(shadow_registers));
+  edram_owners_.resize(kEdramTileCount, nullptr);
+
+  resolution_scale_ =
+      uint32_t(std::min(std::max(FLAGS_vulkan_resolution_scale, 1), 3));
+  sync_edram_ = FLAGS_vulkan_sync_edram;
+  if (sync_edram_ && resolution_scale_ > 1) {
+    XELOGW("EDRAM can't be synced with --vulkan_resolution_scale above 1");
+    sync_edram_ = false;
+  }
+
   // Create the buffer we'll bind to our memory.
   VkBufferCreateInfo buffer_info;
   buffer_info.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
@@ -523,17 +594,27 @@ RenderCache::RenderCache(RegisterFile* register_file,
 RenderCache::~RenderCache() {
   // TODO(benvanik): wait for idle.
 
-  // Dispose all render passes (and their framebuffers).
-  for (auto render_pass : cached_render_passes_) {
-    delete render_pass;
+  register_file_->RemoveDirtyGroup(dirty_group_);
+
+  // Dispose all framebuffers, then the render passes they were made for.
+  for (auto framebuffer : framebuffer_lru_) {
+    delete framebuffer;
+  }
+  framebuffer_lru_.clear();
+  for (auto framebuffer : pending_delete_framebuffers_) {
+    delete framebuffer;
   }
-  cached_render_passes_.clear();
+  pending_delete_framebuffers_.clear();
+  for (auto& it : render_passes_) {
+    delete it.second;
+  }
+  render_passes_.clear();
 
   // Dispose all of our cached tile views.
-  for (auto tile_view : cached_tile_views_) {
-    delete tile_view;
+  for (auto& it : tile_views_) {
+    delete it.second;
   }
-  cached_tile_views_.clear();
+  tile_views_.clear();
 
   // Release underlying EDRAM memory.
   vkDestroyBuffer(*device_, edram_buffer_, nullptr);
@@ -543,6 +624,9 @@ RenderCache::~RenderCache() {
 bool RenderCache::dirty() const {
   auto& regs = *register_file_;
   auto& cur_regs = shadow_registers_;
+  if (!(regs.dirty_groups() & dirty_group_)) {
+    return false;
+  }
 
   bool dirty = false;
   dirty |= cur_regs.rb_modecontrol != regs[XE_GPU_REG_RB_MODECONTROL].u32;
@@ -559,9 +643,10 @@ bool RenderCache::dirty() const {
   return dirty;
 }
 
-const RenderState* RenderCache::BeginRenderPass(VkCommandBuffer command_buffer,
-                                                VulkanShader* vertex_shader,
-                                                VulkanShader* pixel_shader) {
+const RenderState* RenderCache::BeginRenderPass(
+    VkCommandBuffer command_buffer, std::shared_ptr<ui::vulkan::Fence> fence,
+    VulkanShader* vertex_shader, VulkanShader* pixel_shader,
+    VkSubpassContents contents) {
 #if FINE_GRAINED_DRAW_SCOPES
   SCOPE_profile_cpu_f("gpu");
 #endif  // FINE_GRAINED_DRAW_SCOPES
@@ -607,28 +692,39 @@ const RenderState* RenderCache::BeginRenderPass(VkCommandBuffer command_buffer,
     current_state_.render_pass_handle = render_pass->handle;
     current_state_.framebuffer = framebuffer;
     current_state_.framebuffer_handle = framebuffer->handle;
+  }
+  if (!render_pass) {
+    return nullptr;
+  }
 
-    // TODO(DrChat): Determine if we actually need an EDRAM buffer.
-    /*
-    // Depth
-    auto depth_target = current_state_.framebuffer->depth_stencil_attachment;
-    if (depth_target && current_state_.config.depth_stencil.used) {
-      UpdateTileView(command_buffer, depth_target, true);
+  framebuffer->last_used_frame = frame_number_;
+  if (framebuffer->in_flight_fence != fence) {
+    batch_framebuffers_.emplace_back(framebuffer,
+                                     std::move(framebuffer->in_flight_fence));
+    framebuffer->in_flight_fence = fence;
+  }
+  framebuffer_lru_.splice(framebuffer_lru_.end(), framebuffer_lru_,
+                          framebuffer->lru_position);
+
+  // Bring in anything written to the attachment tiles through other views.
+  // A clear or resolve in between may have done that even if the registers
+  // haven't changed.
+  if (sync_edram_) {
+    auto depth_target = framebuffer->depth_stencil_attachment;
+    if (depth_target && config->depth_stencil.used) {
+      AcquireTileView(command_buffer, depth_target,
+                      GetTileRowCount(depth_target, config->surface_height_px),
+                      false);
     }
-
-    // Color
     for (int i = 0; i < 4; i++) {
-      auto target = current_state_.framebuffer->color_attachments[i];
-      if (!target || !current_state_.config.color[i].used) {
+      auto target = framebuffer->color_attachments[i];
+      if (!target || !config->color[i].used) {
         continue;
       }
-
-      UpdateTileView(command_buffer, target, true);
+      AcquireTileView(command_buffer, target,
+                      GetTileRowCount(target, config->surface_height_px),
+                      false);
     }
-    */
-  }
-  if (!render_pass) {
-    return nullptr;
   }
 
   // Setup render pass in command buffer.
@@ -637,7 +733,6 @@ const RenderState* RenderCache::BeginRenderPass(VkCommandBuffer command_buffer,
   VkRenderPassBeginInfo render_pass_begin_info;
   render_pass_begin_info.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
   render_pass_begin_info.pNext = nullptr;
-  render_pass_begin_info.renderPass = render_pass->handle;
   render_pass_begin_info.framebuffer = framebuffer->handle;
 
   // Render into the entire buffer (or at least tell the API we are doing
@@ -656,15 +751,39 @@ const RenderState* RenderCache::BeginRenderPass(VkCommandBuffer command_buffer,
     render_pass_begin_info.renderArea.extent.height =
         std::min(config->surface_height_px * 2, 2560u);
   }
-
-  // Configure clear color, if clearing.
-  // TODO(benvanik): enable clearing here during resolve?
-  render_pass_begin_info.clearValueCount = 0;
-  render_pass_begin_info.pClearValues = nullptr;
+  render_pass_begin_info.renderArea.extent.width *= resolution_scale_;
+  render_pass_begin_info.renderArea.extent.height *= resolution_scale_;
+
+  // Clears left pending on the attachments are done on load if the render
+  // area has all of the rows the guest cleared, across the whole image.
+  // Unused attachments are only loaded and stored, so theirs can wait.
+  uint32_t clear_mask = 0;
+  VkClearValue clear_values[5] = {};
+  for (uint32_t i = 0; i < 5; ++i) {
+    auto target = i < 4 ? framebuffer->color_attachments[i]
+                        : framebuffer->depth_stencil_attachment;
+    bool used = i < 4 ? config->color[i].used : config->depth_stencil.used;
+    if (!target || !used || !target->clear_pending) {
+      continue;
+    }
+    if (render_pass_begin_info.renderArea.extent.width >=
+            target->key.tile_width * 80 * resolution_scale_ &&
+        render_pass_begin_info.renderArea.extent.height >=
+            target->clear_rows * 16 * resolution_scale_) {
+      clear_mask |= 1 << i;
+      clear_values[i] = target->clear_value;
+      target->clear_pending = false;
+      target->clear_rows = 0;
+    } else {
+      ApplyPendingClear(command_buffer, target);
+    }
+  }
+  render_pass_begin_info.renderPass = render_pass->GetHandle(clear_mask);
+  render_pass_begin_info.clearValueCount = clear_mask ? 5 : 0;
+  render_pass_begin_info.pClearValues = clear_mask ? clear_values : nullptr;
 
   // Begin the render pass.
-  vkCmdBeginRenderPass(command_buffer, &render_pass_begin_info,
-                       VK_SUBPASS_CONTENTS_INLINE);
+  vkCmdBeginRenderPass(command_buffer, &render_pass_begin_info, contents);
 
   return &current_state_;
 }
@@ -750,6 +869,59 @@ bool RenderCache::ParseConfiguration(RenderConfiguration* config) {
   return true;
 }
 
+uint32_t RenderCache::GetRenderPassKey(const RenderConfiguration& config) {
+  // Matches CachedRenderPass::IsCompatible.
+  uint32_t key = 0;
+  for (int i = 0; i < 4; ++i) {
+    key |= (static_cast<uint32_t>(config.color[i].format) & 0xF) << (i * 4);
+  }
+  key |= (static_cast<uint32_t>(config.depth_stencil.format) & 0x1) << 16;
+  if (FLAGS_vulkan_native_msaa) {
+    key |= (static_cast<uint32_t>(config.surface_msaa) & 0x3) << 17;
+  }
+  return key;
+}
+
+uint64_t RenderCache::GetFramebufferKey(
+    const RenderConfiguration& config) const {
+  // Matches CachedFramebuffer::IsCompatible, given the same render pass.
+  uint32_t surface_pitch_px = config.surface_msaa != MsaaSamples::k4X
+                                  ? config.surface_pitch_px
+                                  : config.surface_pitch_px * 2;
+  uint32_t surface_height_px = config.surface_msaa == MsaaSamples::k1X
+                                   ? config.surface_height_px
+                                   : config.surface_height_px * 2;
+  uint32_t key_data[7];
+  key_data[0] = std::min(surface_pitch_px, 2560u) * resolution_scale_;
+  key_data[1] = std::min(surface_height_px, 2560u) * resolution_scale_;
+  for (int i = 0; i < 4; ++i) {
+    key_data[2 + i] = config.color[i].edram_base |
+                      (static_cast<uint32_t>(config.color[i].format) << 16);
+  }
+  key_data[6] = config.depth_stencil.edram_base |
+                (static_cast<uint32_t>(config.depth_stencil.format) << 16);
+  return XXH64(key_data, sizeof(key_data), 0);
+}
+
+CachedRenderPass* RenderCache::FindOrCreateRenderPass(
+    const RenderConfiguration& config) {
+  // Attempt to find the render pass in our cache.
+  uint32_t key = GetRenderPassKey(config);
+  auto it = render_passes_.find(key);
+  if (it != render_passes_.end()) {
+    return it->second;
+  }
+
+  // If no render pass was found in the cache create a new one.
+  auto render_pass = new CachedRenderPass(*device_, config);
+  render_passes_.emplace(key, render_pass);
+  return render_pass;
+}
+
+VkRenderPass RenderCache::GetRenderPass(const RenderConfiguration& config) {
+  return FindOrCreateRenderPass(config)->handle;
+}
+
 bool RenderCache::ConfigureRenderPass(VkCommandBuffer command_buffer,
                                       RenderConfiguration* config,
                                       CachedRenderPass** out_render_pass,
@@ -757,36 +929,27 @@ bool RenderCache::ConfigureRenderPass(VkCommandBuffer command_buffer,
   *out_render_pass = nullptr;
   *out_framebuffer = nullptr;
 
-  // TODO(benvanik): better lookup.
-  // Attempt to find the render pass in our cache.
-  CachedRenderPass* render_pass = nullptr;
-  for (auto cached_render_pass : cached_render_passes_) {
-    if (cached_render_pass->IsCompatible(*config)) {
-      // Found a match.
-      render_pass = cached_render_pass;
-      break;
-    }
-  }
-
-  // If no render pass was found in the cache create a new one.
-  if (!render_pass) {
-    render_pass = new CachedRenderPass(*device_, *config);
-    cached_render_passes_.push_back(render_pass);
-  }
+  CachedRenderPass* render_pass = FindOrCreateRenderPass(*config);
 
-  // TODO(benvanik): better lookup.
   // Attempt to find the framebuffer in the render pass cache.
   CachedFramebuffer* framebuffer = nullptr;
-  for (auto cached_framebuffer : render_pass->cached_framebuffers) {
-    if (cached_framebuffer->IsCompatible(*config)) {
+  uint64_t framebuffer_key = GetFramebufferKey(*config);
+  auto framebuffer_range =
+      render_pass->cached_framebuffers.equal_range(framebuffer_key);
+  for (auto it = framebuffer_range.first; it != framebuffer_range.second;
+       ++it) {
+    if (it->second->IsCompatible(*config)) {
       // Found a match.
-      framebuffer = cached_framebuffer;
+      framebuffer = it->second;
       break;
     }
   }
 
   // If no framebuffer was found in the cache create a new one.
-  if (!framebuffer) {
+  if (framebuffer) {
+    ++hit_count_;
+  } else {
+    ++miss_count_;
     uint32_t tile_width = config->surface_msaa == MsaaSamples::k4X ? 40 : 80;
     uint32_t tile_height = config->surface_msaa != MsaaSamples::k1X ? 8 : 16;
 
@@ -837,12 +1000,18 @@ bool RenderCache::ConfigureRenderPass(VkCommandBuffer command_buffer,
     uint32_t surface_height_px = config->surface_msaa == MsaaSamples::k1X
                                      ? config->surface_height_px
                                      : config->surface_height_px * 2;
-    surface_pitch_px = std::min(surface_pitch_px, 2560u);
-    surface_height_px = std::min(surface_height_px, 2560u);
+    surface_pitch_px = std::min(surface_pitch_px, 2560u) * resolution_scale_;
+    surface_height_px =
+        std::min(surface_height_px, 2560u) * resolution_scale_;
     framebuffer = new CachedFramebuffer(
         *device_, render_pass->handle, surface_pitch_px, surface_height_px,
-        target_color_attachments, target_depth_stencil_attachment);
-    render_pass->cached_framebuffers.push_back(framebuffer);
+        resolution_scale_, target_color_attachments,
+        target_depth_stencil_attachment);
+    framebuffer->key = framebuffer_key;
+    framebuffer->render_pass = render_pass;
+    framebuffer->lru_position =
+        framebuffer_lru_.insert(framebuffer_lru_.end(), framebuffer);
+    render_pass->cached_framebuffers.emplace(framebuffer_key, framebuffer);
   }
 
   *out_render_pass = render_pass;
@@ -858,57 +1027,49 @@ CachedTileView* RenderCache::FindOrCreateTileView(
   }
 
   // Create a new tile and add to the cache.
-  tile_view =
-      new CachedTileView(device_, command_buffer, edram_memory_, view_key);
-  cached_tile_views_.push_back(tile_view);
+  tile_view = new CachedTileView(device_, command_buffer, edram_memory_,
+                                 view_key, resolution_scale_);
+  tile_views_.emplace(CachedTileView::GetKeyValue(view_key), tile_view);
 
   return tile_view;
 }
 
 void RenderCache::UpdateTileView(VkCommandBuffer command_buffer,
                                  CachedTileView* view, bool load,
-                                 bool insert_barrier) {
+                                 uint32_t first_row, uint32_t row_count) {
   uint32_t tile_width =
       view->key.msaa_samples == uint16_t(MsaaSamples::k4X) ? 40 : 80;
   uint32_t tile_height =
       view->key.msaa_samples != uint16_t(MsaaSamples::k1X) ? 8 : 16;
 
-  if (insert_barrier) {
-    VkBufferMemoryBarrier barrier;
-    barrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
-    barrier.pNext = nullptr;
-    if (load) {
-      barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
-      barrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
-    } else {
-      barrier.srcAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
-      barrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
-    }
-    barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
-    barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
-    barrier.buffer = edram_buffer_;
-    barrier.offset = view->key.tile_offset * 5120;
-    barrier.size = view->key.tile_width * tile_width * view->key.tile_height *
-                           tile_height * view->key.color_or_depth
-                       ? 4
-                       : 1;
-    vkCmdPipelineBarrier(command_buffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
-                         VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, 0, 0, nullptr, 1,
-                         &barrier, 0, nullptr);
-  }
+  ApplyPendingClear(command_buffer, view);
+
+  // Wait for the rendering, clears and copies of the view and the buffer.
+  VkMemoryBarrier barrier;
+  barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+  barrier.pNext = nullptr;
+  barrier.srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT |
+                          VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT |
+                          VK_ACCESS_TRANSFER_WRITE_BIT;
+  barrier.dstAccessMask =
+      VK_ACCESS_TRANSFER_READ_BIT | VK_ACCESS_TRANSFER_WRITE_BIT;
+  vkCmdPipelineBarrier(command_buffer, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT,
+                       VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 1, &barrier, 0,
+                       nullptr, 0, nullptr);
 
   // TODO(DrChat): Stencil copies.
   VkBufferImageCopy region;
-  region.bufferOffset = view->key.tile_offset * 5120;
+  region.bufferOffset =
+      (view->key.tile_offset + first_row * view->row_tile_count()) * 5120;
   region.bufferRowLength = 0;
   region.bufferImageHeight = 0;
   region.imageSubresource = {0, 0, 0, 1};
   region.imageSubresource.aspectMask = view->key.color_or_depth
                                            ? VK_IMAGE_ASPECT_COLOR_BIT
                                            : VK_IMAGE_ASPECT_DEPTH_BIT;
-  region.imageOffset = {0, 0, 0};
+  region.imageOffset = {0, int32_t(first_row * tile_height), 0};
   region.imageExtent = {view->key.tile_width * tile_width,
-                        view->key.tile_height * tile_height, 1};
+                        row_count * tile_height, 1};
   if (load) {
     vkCmdCopyBufferToImage(command_buffer, edram_buffer_, view->image,
                            VK_IMAGE_LAYOUT_GENERAL, 1, &region);
@@ -916,18 +1077,138 @@ void RenderCache::UpdateTileView(VkCommandBuffer command_buffer,
     vkCmdCopyImageToBuffer(command_buffer, view->image, VK_IMAGE_LAYOUT_GENERAL,
                            edram_buffer_, 1, &region);
   }
+
+  barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+  barrier.dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_READ_BIT |
+                          VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT |
+                          VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT |
+                          VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT |
+                          VK_ACCESS_TRANSFER_READ_BIT |
+                          VK_ACCESS_TRANSFER_WRITE_BIT;
+  vkCmdPipelineBarrier(command_buffer, VK_PIPELINE_STAGE_TRANSFER_BIT,
+                       VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, 0, 1, &barrier, 0,
+                       nullptr, 0, nullptr);
 }
 
-CachedTileView* RenderCache::FindTileView(const TileViewKey& view_key) const {
-  // Check the cache.
-  // TODO(benvanik): better lookup.
-  for (auto tile_view : cached_tile_views_) {
-    if (tile_view->IsEqual(view_key)) {
-      return tile_view;
+uint32_t RenderCache::GetTileRowCount(const CachedTileView* view,
+                                      uint32_t height_px) const {
+  uint32_t tile_height =
+      view->key.msaa_samples != uint16_t(MsaaSamples::k1X) ? 8 : 16;
+  if (view->key.tile_offset >= kEdramTileCount || !view->key.tile_width) {
+    return 0;
+  }
+  uint32_t row_count = xe::round_up(height_px, tile_height) / tile_height;
+  row_count = std::min(row_count, uint32_t(view->key.tile_height));
+  return std::min(row_count, (kEdramTileCount - view->key.tile_offset) /
+                                 view->row_tile_count());
+}
+
+void RenderCache::AcquireTileView(VkCommandBuffer command_buffer,
+                                  CachedTileView* view, uint32_t row_count,
+                                  bool discard) {
+  if (!row_count) {
+    return;
+  }
+  uint32_t first_tile = view->key.tile_offset;
+  uint32_t end_tile = first_tile + row_count * view->row_tile_count();
+  bool up_to_date = true;
+  for (uint32_t i = first_tile; i < end_tile; ++i) {
+    if (edram_owners_[i] != view) {
+      up_to_date = false;
+      break;
     }
   }
+  if (up_to_date) {
+    return;
+  }
 
-  return nullptr;
+  // Multisampled images can't be copied to or from buffers, so their
+  // previous contents are lost.
+  if (!discard && view->sample_count == VK_SAMPLE_COUNT_1_BIT) {
+    // This stores the view itself too, as the rows it's up to date in would
+    // otherwise be overwritten with older contents.
+    FlushEDRAM(command_buffer, first_tile, end_tile - first_tile);
+    UpdateTileView(command_buffer, view, true, 0, row_count);
+  }
+  for (uint32_t i = first_tile; i < end_tile; ++i) {
+    edram_owners_[i] = view;
+  }
+  view->owned_rows = std::max(view->owned_rows, row_count);
+}
+
+void RenderCache::StoreTileView(VkCommandBuffer command_buffer,
+                                CachedTileView* view) {
+  // Rows only partly up to date are stored whole, as pixel rows don't map to
+  // tiles of views with a different pitch anyway.
+  uint32_t row_tile_count = view->row_tile_count();
+  uint32_t first_tile = view->key.tile_offset;
+  uint32_t row = 0;
+  while (row < view->owned_rows) {
+    uint32_t end_row = row;
+    while (end_row < view->owned_rows) {
+      uint32_t row_tile = first_tile + end_row * row_tile_count;
+      bool owned = false;
+      for (uint32_t i = row_tile; i < row_tile + row_tile_count; ++i) {
+        if (edram_owners_[i] == view) {
+          edram_owners_[i] = nullptr;
+          owned = true;
+        }
+      }
+      if (!owned) {
+        break;
+      }
+      ++end_row;
+    }
+    if (end_row > row) {
+      if (view->sample_count == VK_SAMPLE_COUNT_1_BIT) {
+        UpdateTileView(command_buffer, view, false, row, end_row - row);
+      }
+      row = end_row;
+    } else {
+      ++row;
+    }
+  }
+  view->owned_rows = 0;
+}
+
+void RenderCache::FlushEDRAM(VkCommandBuffer command_buffer,
+                             uint32_t first_tile, uint32_t tile_count) {
+  if (first_tile >= kEdramTileCount) {
+    return;
+  }
+  uint32_t end_tile = std::min(first_tile + tile_count, kEdramTileCount);
+  for (uint32_t i = first_tile; i < end_tile; ++i) {
+    if (edram_owners_[i]) {
+      StoreTileView(command_buffer, edram_owners_[i]);
+    }
+  }
+}
+
+void RenderCache::ApplyPendingClear(VkCommandBuffer command_buffer,
+                                    CachedTileView* view) {
+  if (!view->clear_pending) {
+    return;
+  }
+  view->clear_pending = false;
+  view->clear_rows = 0;
+  if (view->key.color_or_depth) {
+    VkImageSubresourceRange range = {VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1};
+    vkCmdClearColorImage(command_buffer, view->image, VK_IMAGE_LAYOUT_GENERAL,
+                         &view->clear_value.color, 1, &range);
+  } else {
+    VkImageSubresourceRange range = {
+        VK_IMAGE_ASPECT_DEPTH_BIT | VK_IMAGE_ASPECT_STENCIL_BIT, 0, 1, 0, 1,
+    };
+    vkCmdClearDepthStencilImage(command_buffer, view->image,
+                                VK_IMAGE_LAYOUT_GENERAL,
+                                &view->clear_value.depthStencil, 1, &range);
+  }
+}
+
+CachedTileView* RenderCache::FindTileView(const TileViewKey& view_key) const {
+  // Check the cache.
+  auto it = tile_views_.find(CachedTileView::GetKeyValue(view_key));
+  return it != tile_views_.end() ? it->second : nullptr;
 }
 
 void RenderCache::EndRenderPass() {
@@ -936,50 +1217,96 @@ void RenderCache::EndRenderPass() {
   // End the render pass.
   vkCmdEndRenderPass(current_command_buffer_);
 
-  // Copy all render targets back into our EDRAM buffer.
-  // Don't bother waiting on this command to complete, as next render pass may
-  // reuse previous framebuffer attachments. If they need this, they will wait.
-  // TODO: Should we bother re-tiling the images on copy back?
-  //
-  // FIXME: There's a case where we may have a really big render target (as we
-  // can't get the correct height atm) and we may end up overwriting the valid
-  // contents of another render target by mistake! Need to reorder copy commands
-  // to avoid this.
-
-  // TODO(DrChat): Determine if we actually need an EDRAM buffer.
-  /*
-  std::vector<CachedTileView*> cached_views;
+  // The render targets aren't copied back into the EDRAM buffer here. When
+  // syncing EDRAM they keep the latest contents of their tiles until another
+  // view or a raw copy needs them, so repeated passes and resolves on the same
+  // targets never copy.
 
-  // Depth
-  auto depth_target = current_state_.framebuffer->depth_stencil_attachment;
-  if (depth_target && current_state_.config.depth_stencil.used) {
-    cached_views.push_back(depth_target);
-  }
+  current_command_buffer_ = nullptr;
+}
 
-  // Color
-  for (int i = 0; i < 4; i++) {
-    auto target = current_state_.framebuffer->color_attachments[i];
-    if (!target || !current_state_.config.color[i].used) {
+void RenderCache::ClearCache() {
+  // Render passes and tile views are kept, as pipelines use the former and
+  // the latter hold the EDRAM contents. Framebuffers may still be in flight,
+  // so they're only queued for deletion.
+  auto current_framebuffer =
+      current_command_buffer_ ? current_state_.framebuffer : nullptr;
+  for (auto it = framebuffer_lru_.begin(); it != framebuffer_lru_.end();) {
+    auto framebuffer = *it;
+    if (framebuffer == current_framebuffer) {
+      ++it;
       continue;
     }
-
-    cached_views.push_back(target);
+    EvictFramebuffer(framebuffer);
+    it = framebuffer_lru_.erase(it);
   }
+}
 
-  std::sort(
-      cached_views.begin(), cached_views.end(),
-      [](CachedTileView const* a, CachedTileView const* b) { return *a < *b; });
+void RenderCache::EvictFramebuffer(CachedFramebuffer* framebuffer) {
+  auto& cached_framebuffers = framebuffer->render_pass->cached_framebuffers;
+  auto range = cached_framebuffers.equal_range(framebuffer->key);
+  for (auto it = range.first; it != range.second; ++it) {
+    if (it->second == framebuffer) {
+      cached_framebuffers.erase(it);
+      break;
+    }
+  }
+  if (current_state_.framebuffer == framebuffer) {
+    // Set up again by the next BeginRenderPass.
+    current_state_.render_pass = nullptr;
+    current_state_.render_pass_handle = nullptr;
+    current_state_.framebuffer = nullptr;
+    current_state_.framebuffer_handle = nullptr;
+  }
+  pending_delete_framebuffers_.push_back(framebuffer);
+}
 
-  for (auto view : cached_views) {
-    UpdateTileView(current_command_buffer_, view, false, false);
+void RenderCache::EndFrame() {
+  // The batch of the frame has been submitted.
+  batch_framebuffers_.clear();
+
+  size_t max_count = size_t(std::max(FLAGS_vulkan_framebuffer_cache_size, 0));
+  if (max_count) {
+    // Ones used in the frame are at the back.
+    auto current_framebuffer =
+        current_command_buffer_ ? current_state_.framebuffer : nullptr;
+    while (framebuffer_lru_.size() > max_count) {
+      auto framebuffer = framebuffer_lru_.front();
+      if (framebuffer->last_used_frame >= frame_number_ ||
+          framebuffer == current_framebuffer) {
+        break;
+      }
+      EvictFramebuffer(framebuffer);
+      framebuffer_lru_.pop_front();
+    }
   }
-  */
+  ++frame_number_;
 
-  current_command_buffer_ = nullptr;
+  COUNT_profile_cpu("gpu/render_cache/framebuffers",
+                    int(framebuffer_lru_.size()));
 }
 
-void RenderCache::ClearCache() {
-  // TODO(benvanik): caching.
+void RenderCache::CancelBatch() {
+  for (auto it = batch_framebuffers_.rbegin(); it != batch_framebuffers_.rend();
+       ++it) {
+    it->first->in_flight_fence = std::move(it->second);
+  }
+  batch_framebuffers_.clear();
+}
+
+void RenderCache::Scavenge() {
+  for (auto it = pending_delete_framebuffers_.begin();
+       it != pending_delete_framebuffers_.end();) {
+    auto framebuffer = *it;
+    if (framebuffer->in_flight_fence &&
+        framebuffer->in_flight_fence->status() != VK_SUCCESS) {
+      // Still in flight.
+      ++it;
+      continue;
+    }
+    delete framebuffer;
+    it = pending_delete_framebuffers_.erase(it);
+  }
 }
 
 void RenderCache::RawCopyToImage(VkCommandBuffer command_buffer,
@@ -987,6 +1314,12 @@ void RenderCache::RawCopyToImage(VkCommandBuffer command_buffer,
                                  VkImageLayout image_layout,
                                  bool color_or_depth, VkOffset3D offset,
                                  VkExtent3D extents) {
+  if (sync_edram_) {
+    // TODO: Calculate this accurately (need texel size)
+    FlushEDRAM(command_buffer, edram_base,
+               xe::round_up(extents.width * extents.height * 4, 5120) / 5120);
+  }
+
   // Transition the texture into a transfer destination layout.
   VkImageMemoryBarrier image_barrier;
   image_barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
@@ -1058,7 +1391,7 @@ void RenderCache::BlitToImage(VkCommandBuffer command_buffer,
                               VkImage image, VkImageLayout image_layout,
                               bool color_or_depth, uint32_t format,
                               VkFilter filter, VkOffset3D offset,
-                              VkExtent3D extents) {
+                              VkExtent3D extents, uint32_t image_scale) {
   if (color_or_depth) {
     // Adjust similar formats for easier matching.
     switch (static_cast<ColorRenderTargetFormat>(format)) {
@@ -1090,7 +1423,11 @@ void RenderCache::BlitToImage(VkCommandBuffer command_buffer,
   assert_not_null(tile_view);
 
   // Update the view with the latest contents.
-  // UpdateTileView(command_buffer, tile_view, true, true);
+  if (sync_edram_) {
+    AcquireTileView(command_buffer, tile_view,
+                    GetTileRowCount(tile_view, height), false);
+  }
+  ApplyPendingClear(command_buffer, tile_view);
 
   // Transition the image into a transfer destination layout, if needed.
   // TODO: Util function for this
@@ -1125,8 +1462,11 @@ void RenderCache::BlitToImage(VkCommandBuffer command_buffer,
         color_or_depth
             ? VK_IMAGE_ASPECT_COLOR_BIT
             : VK_IMAGE_ASPECT_DEPTH_BIT | VK_IMAGE_ASPECT_STENCIL_BIT;
+    int32_t src_scale = int32_t(resolution_scale_);
+    int32_t dst_scale = int32_t(image_scale);
     image_blit.srcOffsets[0] = {0, 0, offset.z};
-    image_blit.srcOffsets[1] = {int32_t(extents.width), int32_t(extents.height),
+    image_blit.srcOffsets[1] = {int32_t(extents.width) * src_scale,
+                                int32_t(extents.height) * src_scale,
                                 int32_t(extents.depth)};
 
     image_blit.dstSubresource = {0, 0, 0, 1};
@@ -1134,10 +1474,12 @@ void RenderCache::BlitToImage(VkCommandBuffer command_buffer,
         color_or_depth
             ? VK_IMAGE_ASPECT_COLOR_BIT
             : VK_IMAGE_ASPECT_DEPTH_BIT | VK_IMAGE_ASPECT_STENCIL_BIT;
-    image_blit.dstOffsets[0] = offset;
-    image_blit.dstOffsets[1] = {offset.x + int32_t(extents.width),
-                                offset.y + int32_t(extents.height),
-                                offset.z + int32_t(extents.depth)};
+    image_blit.dstOffsets[0] = {offset.x * dst_scale, offset.y * dst_scale,
+                                offset.z};
+    image_blit.dstOffsets[1] = {
+        (offset.x + int32_t(extents.width)) * dst_scale,
+        (offset.y + int32_t(extents.height)) * dst_scale,
+        offset.z + int32_t(extents.depth)};
     vkCmdBlitImage(command_buffer, tile_view->image, VK_IMAGE_LAYOUT_GENERAL,
                    image, image_layout, 1, &image_blit, filter);
   } else {
@@ -1154,9 +1496,15 @@ void RenderCache::BlitToImage(VkCommandBuffer command_buffer,
         color_or_depth
             ? VK_IMAGE_ASPECT_COLOR_BIT
             : VK_IMAGE_ASPECT_DEPTH_BIT | VK_IMAGE_ASPECT_STENCIL_BIT;
-    image_resolve.dstOffset = offset;
-
-    image_resolve.extent = extents;
+    // Resolves can't scale, so the image has to match the tile views.
+    assert_true(image_scale == resolution_scale_);
+    image_resolve.dstOffset = {offset.x * int32_t(resolution_scale_),
+                               offset.y * int32_t(resolution_scale_),
+                               offset.z};
+
+    image_resolve.extent = {extents.width * resolution_scale_,
+                            extents.height * resolution_scale_,
+                            extents.depth};
     vkCmdResolveImage(command_buffer, tile_view->image, VK_IMAGE_LAYOUT_GENERAL,
                       image, image_layout, 1, &image_resolve);
   }
@@ -1206,16 +1554,24 @@ void RenderCache::ClearEDRAMColor(VkCommandBuffer command_buffer,
   auto tile_view = FindOrCreateTileView(command_buffer, key);
   assert_not_null(tile_view);
 
-  VkImageSubresourceRange range = {VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1};
-  VkClearColorValue clear_value;
-  std::memcpy(clear_value.float32, color, sizeof(float) * 4);
-
-  // Issue a clear command
-  vkCmdClearColorImage(command_buffer, tile_view->image,
-                       VK_IMAGE_LAYOUT_GENERAL, &clear_value, 1, &range);
+  // The whole image is cleared, so the view becomes up to date without
+  // loading anything.
+  uint32_t row_count = GetTileRowCount(tile_view, height);
+  if (sync_edram_) {
+    AcquireTileView(command_buffer, tile_view, row_count, true);
+  }
 
-  // Copy image back into EDRAM buffer
-  // UpdateTileView(command_buffer, tile_view, false, false);
+  // A render pass covering only the rows cleared now would skip the rest of
+  // an earlier clear.
+  if (tile_view->clear_rows > row_count) {
+    ApplyPendingClear(command_buffer, tile_view);
+  }
+  tile_view->clear_pending = true;
+  tile_view->clear_rows = row_count;
+  std::memcpy(tile_view->clear_value.color.float32, color, sizeof(float) * 4);
+  if (!FLAGS_vulkan_deferred_clears) {
+    ApplyPendingClear(command_buffer, tile_view);
+  }
 }
 
 void RenderCache::ClearEDRAMDepthStencil(VkCommandBuffer command_buffer,
@@ -1242,22 +1598,29 @@ void RenderCache::ClearEDRAMDepthStencil(VkCommandBuffer command_buffer,
   auto tile_view = FindOrCreateTileView(command_buffer, key);
   assert_not_null(tile_view);
 
-  VkImageSubresourceRange range = {
-      VK_IMAGE_ASPECT_DEPTH_BIT | VK_IMAGE_ASPECT_STENCIL_BIT, 0, 1, 0, 1,
-  };
-  VkClearDepthStencilValue clear_value;
-  clear_value.depth = depth;
-  clear_value.stencil = stencil;
-
-  // Issue a clear command
-  vkCmdClearDepthStencilImage(command_buffer, tile_view->image,
-                              VK_IMAGE_LAYOUT_GENERAL, &clear_value, 1, &range);
+  uint32_t row_count = GetTileRowCount(tile_view, height);
+  if (sync_edram_) {
+    AcquireTileView(command_buffer, tile_view, row_count, true);
+  }
 
-  // Copy image back into EDRAM buffer
-  // UpdateTileView(command_buffer, tile_view, false, false);
+  if (tile_view->clear_rows > row_count) {
+    ApplyPendingClear(command_buffer, tile_view);
+  }
+  tile_view->clear_pending = true;
+  tile_view->clear_rows = row_count;
+  tile_view->clear_value.depthStencil.depth = depth;
+  tile_view->clear_value.depthStencil.stencil = stencil;
+  if (!FLAGS_vulkan_deferred_clears) {
+    ApplyPendingClear(command_buffer, tile_view);
+  }
 }
 
 void RenderCache::FillEDRAM(VkCommandBuffer command_buffer, uint32_t value) {
+  // Nothing in the views is newer than the fill.
+  std::fill(edram_owners_.begin(), edram_owners_.end(), nullptr);
+  for (auto& it : tile_views_) {
+    it.second->owned_rows = 0;
+  }
   vkCmdFillBuffer(command_buffer, edram_buffer_, 0, kEdramBufferCapacity,
                   value);
 }
@@ -10,6 +10,12 @@
 #ifndef XENIA_GPU_VULKAN_RENDER_CACHE_H_
 #define XENIA_GPU_VULKAN_RENDER_CACHE_H_
 
+#include <list>
+#include <memory>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
 #include "xenia/gpu/register_file.h"
 #include "xenia/gpu/shader.h"
 #include "xenia/gpu/texture_info.h"
@@ -17,6 +23,7 @@
 #include "xenia/gpu/xenos.h"
 #include "xenia/ui/vulkan/vulkan.h"
 #include "xenia/ui/vulkan/vulkan_device.h"
+#include "xenia/ui/vulkan/vulkan_util.h"
 
 namespace xe {
 namespace gpu {
@@ -55,28 +62,48 @@ class CachedTileView {
   VkImage image = nullptr;
   // Simple view on the image matching the format.
   VkImageView image_view = nullptr;
-  // Memory buffer
-  VkDeviceMemory memory = nullptr;
+  // Memory buffer, sub-allocated from the device memory allocator.
+  ui::vulkan::MemoryAllocator::Allocation memory;
   // Image sample count
   VkSampleCountFlagBits sample_count = VK_SAMPLE_COUNT_1_BIT;
-
+  // Bytes per pixel in EDRAM.
+  uint32_t bpp = 4;
+  // Number of leading tile rows that may hold the latest contents of some
+  // EDRAM tiles, when syncing EDRAM.
+  uint32_t owned_rows = 0;
+  // Clear of the whole image that hasn't been done yet, and the number of
+  // leading tile rows the guest cleared. A render pass covering those rows
+  // does it on load.
+  bool clear_pending = false;
+  uint32_t clear_rows = 0;
+  VkClearValue clear_value;
+
+  // The image is resolution_scale times the size of the tiles in each
+  // dimension.
   CachedTileView(ui::vulkan::VulkanDevice* device,
                  VkCommandBuffer command_buffer, VkDeviceMemory edram_memory,
-                 TileViewKey view_key);
+                 TileViewKey view_key, uint32_t resolution_scale);
   ~CachedTileView();
 
   bool IsEqual(const TileViewKey& other_key) const {
-    auto a = reinterpret_cast<const uint64_t*>(&key);
-    auto b = reinterpret_cast<const uint64_t*>(&other_key);
-    return *a == *b;
+    return GetKeyValue(key) == GetKeyValue(other_key);
+  }
+
+  // The key packed into a single value, for hashing.
+  static uint64_t GetKeyValue(const TileViewKey& view_key) {
+    return *reinterpret_cast<const uint64_t*>(&view_key);
   }
 
   bool operator<(const CachedTileView& other) const {
     return key.tile_offset < other.key.tile_offset;
   }
 
+  // Number of EDRAM tiles covered by each row of 80x16 tiles in the view.
+  uint32_t row_tile_count() const { return key.tile_width * bpp / 4; }
+
  private:
   VkDevice device_ = nullptr;
+  ui::vulkan::MemoryAllocator* memory_allocator_ = nullptr;
 };
 
 // Parsed render configuration from the current render state.
@@ -264,23 +291,48 @@ class RenderCache {
   RenderCache(RegisterFile* register_file, ui::vulkan::VulkanDevice* device);
   ~RenderCache();
 
+  // Scale of the width and height of the tile views, and so of everything
+  // drawn into them, relative to the guest.
+  uint32_t resolution_scale() const { return resolution_scale_; }
+
   // Call this to determine if you should start a new render pass or continue
   // with an already open pass.
   bool dirty() const;
 
   // Begins a render pass targeting the state-specified framebuffer formats.
-  // The command buffer will be transitioned into the render pass phase.
-  const RenderState* BeginRenderPass(VkCommandBuffer command_buffer,
-                                     VulkanShader* vertex_shader,
-                                     VulkanShader* pixel_shader);
+  // The command buffer will be transitioned into the render pass phase, with
+  // its contents either recorded inline or executed from secondary command
+  // buffers. The framebuffer is kept alive until the fence is signaled.
+  const RenderState* BeginRenderPass(
+      VkCommandBuffer command_buffer, std::shared_ptr<ui::vulkan::Fence> fence,
+      VulkanShader* vertex_shader, VulkanShader* pixel_shader,
+      VkSubpassContents contents = VK_SUBPASS_CONTENTS_INLINE);
 
   // Ends the current render pass.
   // The command buffer will be transitioned out of the render pass phase.
   void EndRenderPass();
 
+  // Returns a render pass for the given configuration, creating it if
+  // required. Used to create pipelines ahead of the draws that need them.
+  VkRenderPass GetRenderPass(const RenderConfiguration& config);
+
   // Clears all cached content.
   void ClearCache();
 
+  // Ends a frame, evicting the least recently used framebuffers not used in
+  // it while over --vulkan_framebuffer_cache_size. Call before Scavenge.
+  void EndFrame();
+  // Destroys evicted framebuffers that are no longer in flight.
+  void Scavenge();
+  // Framebuffers used by a batch that was dropped go back to waiting for the
+  // batches that used them before, as its fence will never be signaled.
+  void CancelBatch();
+
+  // Render pass setups that found an existing framebuffer and ones that had
+  // to create one.
+  uint64_t hit_count() const { return hit_count_; }
+  uint64_t miss_count() const { return miss_count_; }
+
   // Queues commands to copy EDRAM contents into an image.
   // The command buffer must not be inside of a render pass when calling this.
   void RawCopyToImage(VkCommandBuffer command_buffer, uint32_t edram_base,
@@ -290,19 +342,25 @@ class RenderCache {
 
   // Queues commands to blit EDRAM contents into an image.
   // The command buffer must not be inside of a render pass when calling this.
+  // offset and extents are in guest pixels, and the image is image_scale
+  // times the guest size of its contents.
   void BlitToImage(VkCommandBuffer command_buffer, uint32_t edram_base,
                    uint32_t pitch, uint32_t height, MsaaSamples num_samples,
                    VkImage image, VkImageLayout image_layout,
                    bool color_or_depth, uint32_t format, VkFilter filter,
-                   VkOffset3D offset, VkExtent3D extents);
+                   VkOffset3D offset, VkExtent3D extents,
+                   uint32_t image_scale = 1);
 
   // Queues commands to clear EDRAM contents with a solid color.
   // The command buffer must not be inside of a render pass when calling this.
+  // With --vulkan_deferred_clears the clear is left to the next use of the
+  // tiles, which may be a render pass clearing them on load.
   void ClearEDRAMColor(VkCommandBuffer command_buffer, uint32_t edram_base,
                        ColorRenderTargetFormat format, uint32_t pitch,
                        uint32_t height, MsaaSamples num_samples, float* color);
   // Queues commands to clear EDRAM contents with depth/stencil values.
   // The command buffer must not be inside of a render pass when calling this.
+  // Deferred like ClearEDRAMColor.
   void ClearEDRAMDepthStencil(VkCommandBuffer command_buffer,
                               uint32_t edram_base,
                               DepthRenderTargetFormat format, uint32_t pitch,
@@ -316,6 +374,14 @@ class RenderCache {
   // Parses the current state into a configuration object.
   bool ParseConfiguration(RenderConfiguration* config);
 
+  // Packs everything a render pass is created from into a key.
+  static uint32_t GetRenderPassKey(const RenderConfiguration& config);
+  // Hashes everything a framebuffer of a render pass is created from.
+  uint64_t GetFramebufferKey(const RenderConfiguration& config) const;
+
+  // Finds a compatible render pass or creates a new one.
+  CachedRenderPass* FindOrCreateRenderPass(const RenderConfiguration& config);
+
   // Finds a tile view. Returns nullptr if none found matching the key.
   CachedTileView* FindTileView(const TileViewKey& view_key) const;
 
@@ -323,8 +389,33 @@ class RenderCache {
   CachedTileView* FindOrCreateTileView(VkCommandBuffer command_buffer,
                                        const TileViewKey& view_key);
 
+  // Copies tile rows of the view from or to the EDRAM buffer.
   void UpdateTileView(VkCommandBuffer command_buffer, CachedTileView* view,
-                      bool load, bool insert_barrier = true);
+                      bool load, uint32_t first_row, uint32_t row_count);
+
+  // Returns the number of tile rows of the view covering height_px, clamped
+  // to the view and to the end of EDRAM.
+  uint32_t GetTileRowCount(const CachedTileView* view,
+                           uint32_t height_px) const;
+  // Makes the first row_count tile rows of the view hold the latest contents
+  // of their EDRAM tiles, loading them if another view wrote them last.
+  // If discard is set the rows are about to be overwritten and aren't loaded.
+  void AcquireTileView(VkCommandBuffer command_buffer, CachedTileView* view,
+                       uint32_t row_count, bool discard);
+  // Stores the rows of the view holding the latest contents of their tiles
+  // to the EDRAM buffer.
+  void StoreTileView(VkCommandBuffer command_buffer, CachedTileView* view);
+  // Does the clear left pending on the view, if any, before something else
+  // uses its image.
+  void ApplyPendingClear(VkCommandBuffer command_buffer, CachedTileView* view);
+  // Stores every view holding the latest contents of a tile in the range to
+  // the EDRAM buffer.
+  void FlushEDRAM(VkCommandBuffer command_buffer, uint32_t first_tile,
+                  uint32_t tile_count);
+
+  // Removes the framebuffer from its render pass and queues it for deletion
+  // once it's no longer in flight. The caller removes it from the LRU list.
+  void EvictFramebuffer(CachedFramebuffer* framebuffer);
 
   // Gets or creates a render pass and frame buffer for the given configuration.
   // This attempts to reuse as much as possible across render passes and
@@ -337,17 +428,41 @@ class RenderCache {
   RegisterFile* register_file_ = nullptr;
   ui::vulkan::VulkanDevice* device_ = nullptr;
 
+  uint32_t resolution_scale_ = 1;
+  // The EDRAM buffer is guest sized, so it can only be synced with unscaled
+  // tile views.
+  bool sync_edram_ = false;
+
   // Entire 10MiB of EDRAM.
   VkDeviceMemory edram_memory_ = nullptr;
   // Buffer overlayed 1:1 with edram_memory_ to allow raw access.
   VkBuffer edram_buffer_ = nullptr;
 
-  // Cache of VkImage and VkImageView's for all of our EDRAM tilings.
-  // TODO(benvanik): non-linear lookup? Should only be a small number of these.
-  std::vector<CachedTileView*> cached_tile_views_;
+  // When syncing EDRAM, the view holding newer contents of each 5120b tile
+  // than the EDRAM buffer, or nullptr if the buffer is up to date. Tile views
+  // are only copied from or to the buffer when another view or a raw copy
+  // needs tiles they don't hold the latest contents of.
+  std::vector<CachedTileView*> edram_owners_;
+
+  // Cache of VkImage and VkImageView's for all of our EDRAM tilings, by
+  // packed key. Never evicted, as they hold the contents of their tiles.
+  std::unordered_map<uint64_t, CachedTileView*> tile_views_;
+
+  // Cache of render passes based on formats, by GetRenderPassKey. Never
+  // evicted, as pipelines are created for and cached by their handles.
+  std::unordered_map<uint32_t, CachedRenderPass*> render_passes_;
+
+  // Framebuffers of all render passes, least recently used first.
+  std::list<CachedFramebuffer*> framebuffer_lru_;
+  // Evicted framebuffers waiting for their last use to be done.
+  std::list<CachedFramebuffer*> pending_delete_framebuffers_;
+  // Framebuffers first used in the current batch, with their previous fence.
+  std::vector<std::pair<CachedFramebuffer*, std::shared_ptr<ui::vulkan::Fence>>>
+      batch_framebuffers_;
 
-  // Cache of render passes based on formats.
-  std::vector<CachedRenderPass*> cached_render_passes_;
+  uint64_t hit_count_ = 0;
+  uint64_t miss_count_ = 0;
+  uint64_t frame_number_ = 0;
 
   // Shadows of the registers that impact the render pass we choose.
   // If the registers don't change between passes we can quickly reuse the
@@ -367,6 +482,8 @@ class RenderCache {
     void Reset() { std::memset(this, 0, sizeof(*this)); }
   } shadow_registers_;
   bool SetShadowRegister(uint32_t* dest, uint32_t register_name);
+  // Written registers that may change the shadow registers.
+  uint64_t dirty_group_ = 0;
 
   // Configuration used for the current/previous Begin/End, representing the
   // current shadow register state.
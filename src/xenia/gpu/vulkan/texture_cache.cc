@@ -9,22 +9,39 @@
 
 #include "xenia/gpu/vulkan/texture_cache.h"
 
+#include <algorithm>
+#include <atomic>
+#include <string>
+
+#include "third_party/glslang-spirv/SpvBuilder.h"
+#include "third_party/xxhash/xxhash.h"
+#include "xenia/base/counters.h"
 #include "xenia/base/logging.h"
 #include "xenia/base/math.h"
 #include "xenia/base/memory.h"
 #include "xenia/base/profiling.h"
+#include "xenia/cpu/mmio_handler.h"
 #include "xenia/gpu/gpu_flags.h"
 #include "xenia/gpu/sampler_info.h"
+#include "xenia/gpu/spirv_shader_translator.h"
 #include "xenia/gpu/texture_info.h"
 #include "xenia/gpu/vulkan/vulkan_gpu_flags.h"
 
+DECLARE_counter(texture_uploads);
+
 namespace xe {
 namespace gpu {
 namespace vulkan {
 
+using spv::Id;
+using spv::Op;
 using xe::ui::vulkan::CheckResult;
 
 constexpr uint32_t kMaxTextureSamplers = 32;
+// Cached texture descriptor sets before they're all retired to make room.
+constexpr uint32_t kMaxCachedTextureSets = 1024;
+// New textures with less guest data are always uploaded right away.
+constexpr uint32_t kAsyncUploadMinLength = 256 * 1024;
 constexpr VkDeviceSize kStagingBufferSize = 64 * 1024 * 1024;
 
 struct TextureConfig {
@@ -104,25 +121,296 @@ static const TextureConfig texture_configs[64] = {
     {TextureFormat::kUnknown, VK_FORMAT_UNDEFINED},
 };
 
-TextureCache::TextureCache(Memory* memory, RegisterFile* register_file,
+// Push constants of the untiling and tiling shaders. Offsets and pitches are
+// in dwords within the staging buffer, sizes in blocks.
+struct UntileConstants {
+  uint32_t tiled_offset;
+  uint32_t tiled_length;
+  uint32_t linear_offset;
+  uint32_t linear_pitch;
+  uint32_t block_width;
+  uint32_t block_height;
+  uint32_t offset_x;
+  uint32_t offset_y;
+  uint32_t input_width;
+  uint32_t log_bpp;
+  uint32_t block_dwords;
+  uint32_t endianness;
+};
+
+// Builds a compute shader doing what the CPU path of UploadTexture2D does for
+// tiled textures, one invocation per block: the source block is found with
+// TextureInfo::TiledOffset2DOuter/Inner and each of its dwords is swapped.
+// With tile set it goes the other way, from linear blocks to tiled ones.
+static std::vector<uint32_t> BuildUntileShader(bool tile) {
+  spv::Builder b(0xFFFFFFFF);
+  b.setSource(spv::SourceLanguage::SourceLanguageUnknown, 0);
+  b.setMemoryModel(spv::AddressingModel::AddressingModelLogical,
+                   spv::MemoryModel::MemoryModelGLSL450);
+  b.addCapability(spv::Capability::CapabilityShader);
+
+  Id bool_type = b.makeBoolType();
+  Id uint_type = b.makeUintType(32);
+  Id vec3_uint_type = b.makeVectorType(uint_type, 3);
+
+  // The whole staging buffer, read and written as dwords.
+  Id staging_array_type = b.makeRuntimeArray(uint_type);
+  b.addDecoration(staging_array_type, spv::Decoration::DecorationArrayStride,
+                  4);
+  Id staging_type = b.makeStructType({staging_array_type}, "staging_type");
+  b.addDecoration(staging_type, spv::Decoration::DecorationBufferBlock);
+  b.addMemberDecoration(staging_type, 0, spv::Decoration::DecorationOffset, 0);
+  Id staging = b.createVariable(spv::StorageClass::StorageClassUniform,
+                                staging_type, "staging");
+  b.addDecoration(staging, spv::Decoration::DecorationDescriptorSet, 0);
+  b.addDecoration(staging, spv::Decoration::DecorationBinding, 0);
+
+  // Push constants, represented by UntileConstants.
+  std::vector<Id> constant_types(sizeof(UntileConstants) / 4, uint_type);
+  Id constants_type = b.makeStructType(constant_types, "untile_consts_type");
+  b.addDecoration(constants_type, spv::Decoration::DecorationBlock);
+  for (int i = 0; i < int(constant_types.size()); ++i) {
+    b.addMemberDecoration(constants_type, i, spv::Decoration::DecorationOffset,
+                          i * 4);
+  }
+  Id constants = b.createVariable(spv::StorageClass::StorageClassPushConstant,
+                                  constants_type, "untile_consts");
+
+  Id invocation_id = b.createVariable(spv::StorageClass::StorageClassInput,
+                                      vec3_uint_type, "gl_GlobalInvocationID");
+  b.addDecoration(invocation_id, spv::Decoration::DecorationBuiltIn,
+                  spv::BuiltIn::BuiltInGlobalInvocationId);
+
+  auto main_fn = b.makeMain();
+  auto entry = b.addEntryPoint(spv::ExecutionModel::ExecutionModelGLCompute,
+                               main_fn, "main");
+  entry->addIdOperand(invocation_id);
+  b.addExecutionMode(main_fn, spv::ExecutionMode::ExecutionModeLocalSize, 8, 8,
+                     1);
+
+  auto uconst = [&](uint32_t value) { return b.makeUintConstant(value); };
+  auto op = [&](Op opcode, Id a, Id c) {
+    return b.createBinOp(opcode, uint_type, a, c);
+  };
+  auto load_constant = [&](size_t offset) {
+    std::vector<Id> chain = {uconst(uint32_t(offset / 4))};
+    return b.createLoad(b.createAccessChain(
+        spv::StorageClass::StorageClassPushConstant, constants, chain));
+  };
+  auto staging_dword = [&](Id index) {
+    std::vector<Id> chain = {uconst(0), index};
+    return b.createAccessChain(spv::StorageClass::StorageClassUniform,
+                               staging, chain);
+  };
+
+  Id tiled_offset = load_constant(offsetof(UntileConstants, tiled_offset));
+  Id tiled_length = load_constant(offsetof(UntileConstants, tiled_length));
+  Id linear_offset = load_constant(offsetof(UntileConstants, linear_offset));
+  Id linear_pitch = load_constant(offsetof(UntileConstants, linear_pitch));
+  Id block_width = load_constant(offsetof(UntileConstants, block_width));
+  Id block_height = load_constant(offsetof(UntileConstants, block_height));
+  Id offset_x = load_constant(offsetof(UntileConstants, offset_x));
+  Id offset_y = load_constant(offsetof(UntileConstants, offset_y));
+  Id input_width = load_constant(offsetof(UntileConstants, input_width));
+  Id log_bpp = load_constant(offsetof(UntileConstants, log_bpp));
+  Id block_dwords = load_constant(offsetof(UntileConstants, block_dwords));
+  Id endianness = load_constant(offsetof(UntileConstants, endianness));
+
+  Id id = b.createLoad(invocation_id);
+  Id x = b.createCompositeExtract(id, uint_type, 0);
+  Id y = b.createCompositeExtract(id, uint_type, 1);
+  Id in_bounds = b.createBinOp(
+      Op::OpLogicalAnd, bool_type,
+      b.createBinOp(Op::OpULessThan, bool_type, x, block_width),
+      b.createBinOp(Op::OpULessThan, bool_type, y, block_height));
+  spv::Builder::If bounds_if(in_bounds, b);
+
+  // TiledOffset2DOuter(offset_y + y, input_width, log_bpp).
+  Id tile_y = op(Op::OpIAdd, offset_y, y);
+  Id macro = op(Op::OpShiftLeftLogical,
+                op(Op::OpIMul, op(Op::OpShiftRightLogical, tile_y, uconst(5)),
+                   op(Op::OpShiftRightLogical, input_width, uconst(5))),
+                op(Op::OpIAdd, log_bpp, uconst(7)));
+  Id micro = op(Op::OpShiftLeftLogical,
+                op(Op::OpShiftLeftLogical,
+                   op(Op::OpBitwiseAnd, tile_y, uconst(6)), uconst(2)),
+                log_bpp);
+  Id base_offset = op(
+      Op::OpIAdd,
+      op(Op::OpIAdd,
+         op(Op::OpIAdd, macro,
+            op(Op::OpShiftLeftLogical,
+               op(Op::OpBitwiseAnd, micro, uconst(~15u)), uconst(1))),
+         op(Op::OpBitwiseAnd, micro, uconst(15))),
+      op(Op::OpIAdd,
+         op(Op::OpShiftLeftLogical, op(Op::OpBitwiseAnd, tile_y, uconst(8)),
+            op(Op::OpIAdd, log_bpp, uconst(3))),
+         op(Op::OpShiftLeftLogical, op(Op::OpBitwiseAnd, tile_y, uconst(1)),
+            uconst(4))));
+
+  // TiledOffset2DInner(offset_x + x, offset_y + y, log_bpp, base_offset).
+  Id tile_x = op(Op::OpIAdd, offset_x, x);
+  macro = op(Op::OpShiftLeftLogical,
+             op(Op::OpShiftRightLogical, tile_x, uconst(5)),
+             op(Op::OpIAdd, log_bpp, uconst(7)));
+  micro = op(Op::OpShiftLeftLogical, op(Op::OpBitwiseAnd, tile_x, uconst(7)),
+             log_bpp);
+  Id offset = op(
+      Op::OpIAdd, base_offset,
+      op(Op::OpIAdd,
+         op(Op::OpIAdd, macro,
+            op(Op::OpShiftLeftLogical,
+               op(Op::OpBitwiseAnd, micro, uconst(~15u)), uconst(1))),
+         op(Op::OpBitwiseAnd, micro, uconst(15))));
+  Id tiled_byte_offset = op(
+      Op::OpIAdd,
+      op(Op::OpIAdd,
+         op(Op::OpIAdd,
+            op(Op::OpShiftLeftLogical,
+               op(Op::OpBitwiseAnd, offset, uconst(~511u)), uconst(3)),
+            op(Op::OpShiftLeftLogical,
+               op(Op::OpBitwiseAnd, offset, uconst(448)), uconst(2))),
+         op(Op::OpBitwiseAnd, offset, uconst(63))),
+      op(Op::OpIAdd,
+         op(Op::OpShiftLeftLogical, op(Op::OpBitwiseAnd, tile_y, uconst(16)),
+            uconst(7)),
+         op(Op::OpShiftLeftLogical,
+            op(Op::OpBitwiseAnd,
+               op(Op::OpIAdd,
+                  op(Op::OpShiftRightLogical,
+                     op(Op::OpBitwiseAnd, tile_y, uconst(8)), uconst(2)),
+                  op(Op::OpShiftRightLogical, tile_x, uconst(3))),
+               uconst(3)),
+            uconst(6))));
+
+  Id tiled_block = op(
+      Op::OpIAdd, tiled_offset,
+      op(Op::OpIMul, op(Op::OpShiftRightLogical, tiled_byte_offset, log_bpp),
+         block_dwords));
+  Id tiled_end = op(Op::OpIAdd, tiled_offset, tiled_length);
+  Id linear_block =
+      op(Op::OpIAdd,
+         op(Op::OpIAdd, linear_offset, op(Op::OpIMul, y, linear_pitch)),
+         op(Op::OpIMul, x, block_dwords));
+  Id endian_8in16 =
+      b.createBinOp(Op::OpIEqual, bool_type, endianness,
+                    uconst(uint32_t(Endian::k8in16)));
+  Id endian_8in32 =
+      b.createBinOp(Op::OpIEqual, bool_type, endianness,
+                    uconst(uint32_t(Endian::k8in32)));
+  Id endian_16in32 =
+      b.createBinOp(Op::OpIEqual, bool_type, endianness,
+                    uconst(uint32_t(Endian::k16in32)));
+  for (uint32_t i = 0; i < 4; ++i) {
+    // Blocks are 1, 2 or 4 dwords.
+    std::unique_ptr<spv::Builder::If> dword_if;
+    if (i) {
+      dword_if = std::make_unique<spv::Builder::If>(
+          b.createBinOp(Op::OpULessThan, bool_type, uconst(i), block_dwords),
+          b);
+    }
+
+    // Packed mips may be partially outside of the guest data; those are
+    // zeroed rather than read from unrelated staging memory, and aren't
+    // written when tiling.
+    Id tiled_index = op(Op::OpIAdd, tiled_block, uconst(i));
+    Id linear_index = op(Op::OpIAdd, linear_block, uconst(i));
+    Id in_range =
+        b.createBinOp(Op::OpULessThan, bool_type, tiled_index, tiled_end);
+    Id value;
+    if (tile) {
+      value = b.createLoad(staging_dword(linear_index));
+    } else {
+      value = b.createLoad(staging_dword(b.createTriOp(
+          Op::OpSelect, uint_type, in_range, tiled_index, tiled_offset)));
+      value =
+          b.createTriOp(Op::OpSelect, uint_type, in_range, value, uconst(0));
+    }
+
+    Id swap_8in16 = op(
+        Op::OpBitwiseOr,
+        op(Op::OpShiftLeftLogical,
+           op(Op::OpBitwiseAnd, value, uconst(0x00FF00FF)), uconst(8)),
+        op(Op::OpBitwiseAnd, op(Op::OpShiftRightLogical, value, uconst(8)),
+           uconst(0x00FF00FF)));
+    Id swap_16in32 =
+        op(Op::OpBitwiseOr, op(Op::OpShiftLeftLogical, value, uconst(16)),
+           op(Op::OpShiftRightLogical, value, uconst(16)));
+    Id swap_8in32 =
+        op(Op::OpBitwiseOr, op(Op::OpShiftLeftLogical, swap_8in16, uconst(16)),
+           op(Op::OpShiftRightLogical, swap_8in16, uconst(16)));
+    value = b.createTriOp(Op::OpSelect, uint_type, endian_16in32, swap_16in32,
+                          value);
+    value = b.createTriOp(Op::OpSelect, uint_type, endian_8in32, swap_8in32,
+                          value);
+    value = b.createTriOp(Op::OpSelect, uint_type, endian_8in16, swap_8in16,
+                          value);
+    if (tile) {
+      spv::Builder::If range_if(in_range, b);
+      b.createStore(value, staging_dword(tiled_index));
+      range_if.makeEndIf();
+    } else {
+      b.createStore(value, staging_dword(linear_index));
+    }
+
+    if (dword_if) {
+      dword_if->makeEndIf();
+    }
+  }
+
+  bounds_if.makeEndIf();
+  b.makeReturn(false);
+
+  std::vector<uint32_t> spirv_words;
+  b.dump(spirv_words);
+  return spirv_words;
+}
+
+// Guest data of a new texture, converted by an async upload thread.
+struct TextureCache::AsyncUpload {
+  TextureInfo texture_info;
+  std::vector<uint8_t> data;
+  std::vector<uint64_t> content_hashes;
+  // Set by the thread once data and content_hashes are written.
+  std::atomic<bool> done{false};
+  // Set once the texture no longer needs it, so that it isn't started.
+  std::atomic<bool> canceled{false};
+};
+
+TextureCache::TextureCache(Memory* memory,
+                           DirtyPageTracker* dirty_page_tracker,
+                           RegisterFile* register_file,
                            TraceWriter* trace_writer,
                            ui::vulkan::VulkanDevice* device)
     : memory_(memory),
+      dirty_page_tracker_(dirty_page_tracker),
       register_file_(register_file),
       trace_writer_(trace_writer),
       device_(device),
-      staging_buffer_(device) {
+      staging_buffer_(device),
+      transfer_staging_buffer_(device) {
   // Descriptor pool used for all of our cached descriptors.
   VkDescriptorPoolCreateInfo descriptor_pool_info;
   descriptor_pool_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
   descriptor_pool_info.pNext = nullptr;
   descriptor_pool_info.flags =
       VK_DESCRIPTOR_POOL_CREATE_FREE_DESCRIPTOR_SET_BIT;
-  descriptor_pool_info.maxSets = 8192;
-  VkDescriptorPoolSize pool_sizes[1];
-  pool_sizes[0].type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
-  pool_sizes[0].descriptorCount = 8192;
-  descriptor_pool_info.poolSizeCount = 1;
+  // Room for the cached texture sets and as many retired ones still in
+  // flight, with 4 image bindings of kMaxTextureSamplers each, and the
+  // immutable and fetch constant samplers.
+  descriptor_pool_info.maxSets = 2 * kMaxCachedTextureSets + 1;
+  VkDescriptorPoolSize pool_sizes[3];
+  pool_sizes[0].type = VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE;
+  pool_sizes[0].descriptorCount =
+      2 * kMaxCachedTextureSets * 4 * kMaxTextureSamplers;
+  pool_sizes[1].type = VK_DESCRIPTOR_TYPE_SAMPLER;
+  pool_sizes[1].descriptorCount =
+      2 * kMaxCachedTextureSets *
+      (kSpirvImmutableSamplerCount + kMaxTextureSamplers);
+  // The staging buffer for untiling.
+  pool_sizes[2].type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+  pool_sizes[2].descriptorCount = 1;
+  descriptor_pool_info.poolSizeCount = 3;
   descriptor_pool_info.pPoolSizes = pool_sizes;
   auto err = vkCreateDescriptorPool(*device_, &descriptor_pool_info, nullptr,
                                     &descriptor_pool_);
@@ -130,16 +418,31 @@ TextureCache::TextureCache(Memory* memory, RegisterFile* register_file,
 
   // Create the descriptor set layout used for rendering.
   // We always have the same number of samplers but only some are used.
-  VkDescriptorSetLayoutBinding bindings[4];
+  InitializeImmutableSamplers();
+  VkDescriptorSetLayoutBinding bindings[6];
   for (int i = 0; i < 4; ++i) {
     auto& texture_binding = bindings[i];
     texture_binding.binding = i;
-    texture_binding.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+    texture_binding.descriptorType = VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE;
     texture_binding.descriptorCount = kMaxTextureSamplers;
     texture_binding.stageFlags =
         VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT;
     texture_binding.pImmutableSamplers = nullptr;
   }
+  auto& immutable_sampler_binding = bindings[4];
+  immutable_sampler_binding.binding = 4;
+  immutable_sampler_binding.descriptorType = VK_DESCRIPTOR_TYPE_SAMPLER;
+  immutable_sampler_binding.descriptorCount = kSpirvImmutableSamplerCount;
+  immutable_sampler_binding.stageFlags =
+      VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT;
+  immutable_sampler_binding.pImmutableSamplers = immutable_samplers_.data();
+  auto& fetch_sampler_binding = bindings[5];
+  fetch_sampler_binding.binding = 5;
+  fetch_sampler_binding.descriptorType = VK_DESCRIPTOR_TYPE_SAMPLER;
+  fetch_sampler_binding.descriptorCount = kMaxTextureSamplers;
+  fetch_sampler_binding.stageFlags =
+      VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT;
+  fetch_sampler_binding.pImmutableSamplers = nullptr;
   VkDescriptorSetLayoutCreateInfo descriptor_set_layout_info;
   descriptor_set_layout_info.sType =
       VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
@@ -153,29 +456,204 @@ TextureCache::TextureCache(Memory* memory, RegisterFile* register_file,
   CheckResult(err, "vkCreateDescriptorSetLayout");
 
   if (!staging_buffer_.Initialize(kStagingBufferSize,
-                                  VK_BUFFER_USAGE_TRANSFER_SRC_BIT)) {
+                                  VK_BUFFER_USAGE_TRANSFER_SRC_BIT |
+                                      VK_BUFFER_USAGE_TRANSFER_DST_BIT |
+                                      VK_BUFFER_USAGE_STORAGE_BUFFER_BIT)) {
+    assert_always();
+  }
+  if (device_->transfer_queue() &&
+      !transfer_staging_buffer_.Initialize(kStagingBufferSize,
+                                           VK_BUFFER_USAGE_TRANSFER_SRC_BIT)) {
     assert_always();
   }
 
+  if (FLAGS_vulkan_gpu_untile || FLAGS_vulkan_resolve_writeback) {
+    InitializeUntilePipeline();
+  }
+
   invalidated_textures_sets_[0].reserve(64);
   invalidated_textures_sets_[1].reserve(64);
   invalidated_textures_ = &invalidated_textures_sets_[0];
+
+  for (int32_t i = 0; i < FLAGS_vulkan_async_texture_threads; ++i) {
+    auto thread = xe::threading::Thread::Create(
+        {}, [this]() { AsyncUploadThreadMain(); });
+    thread->set_name("xe::gpu::vulkan::TextureCache " + std::to_string(i));
+    async_upload_threads_.push_back(std::move(thread));
+  }
 }
 
 TextureCache::~TextureCache() {
+  {
+    std::lock_guard<std::mutex> lock(async_upload_mutex_);
+    async_upload_shutdown_ = true;
+    async_upload_queue_.clear();
+  }
+  async_upload_cond_.notify_all();
+  for (auto& thread : async_upload_threads_) {
+    xe::threading::Wait(thread.get(), false);
+  }
+  async_upload_threads_.clear();
+  for (auto& it : placeholder_textures_) {
+    FreeTexture(it.second);
+  }
+  placeholder_textures_.clear();
+
   for (auto it = samplers_.begin(); it != samplers_.end(); ++it) {
     vkDestroySampler(*device_, it->second->sampler, nullptr);
     delete it->second;
   }
   samplers_.clear();
 
+  if (untile_pipeline_) {
+    vkDestroyPipeline(*device_, untile_pipeline_, nullptr);
+  }
+  if (untile_shader_module_) {
+    vkDestroyShaderModule(*device_, untile_shader_module_, nullptr);
+  }
+  if (tile_pipeline_) {
+    vkDestroyPipeline(*device_, tile_pipeline_, nullptr);
+  }
+  if (tile_shader_module_) {
+    vkDestroyShaderModule(*device_, tile_shader_module_, nullptr);
+  }
+  if (untile_pipeline_layout_) {
+    vkDestroyPipelineLayout(*device_, untile_pipeline_layout_, nullptr);
+  }
+  if (untile_descriptor_set_layout_) {
+    vkDestroyDescriptorSetLayout(*device_, untile_descriptor_set_layout_,
+                                 nullptr);
+  }
+
   vkDestroyDescriptorSetLayout(*device_, texture_descriptor_set_layout_,
                                nullptr);
   vkDestroyDescriptorPool(*device_, descriptor_pool_, nullptr);
+  for (auto sampler : immutable_samplers_) {
+    vkDestroySampler(*device_, sampler, nullptr);
+  }
+  immutable_samplers_.clear();
+}
+
+void TextureCache::InitializeUntilePipeline() {
+  VkDescriptorSetLayoutBinding binding;
+  binding.binding = 0;
+  binding.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+  binding.descriptorCount = 1;
+  binding.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+  binding.pImmutableSamplers = nullptr;
+  VkDescriptorSetLayoutCreateInfo descriptor_set_layout_info;
+  descriptor_set_layout_info.sType =
+      VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+  descriptor_set_layout_info.pNext = nullptr;
+  descriptor_set_layout_info.flags = 0;
+  descriptor_set_layout_info.bindingCount = 1;
+  descriptor_set_layout_info.pBindings = &binding;
+  auto err = vkCreateDescriptorSetLayout(*device_, &descriptor_set_layout_info,
+                                         nullptr,
+                                         &untile_descriptor_set_layout_);
+  CheckResult(err, "vkCreateDescriptorSetLayout");
+  if (err != VK_SUCCESS) {
+    return;
+  }
+
+  VkPushConstantRange push_constant_range;
+  push_constant_range.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+  push_constant_range.offset = 0;
+  push_constant_range.size = sizeof(UntileConstants);
+  VkPipelineLayoutCreateInfo pipeline_layout_info;
+  pipeline_layout_info.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+  pipeline_layout_info.pNext = nullptr;
+  pipeline_layout_info.flags = 0;
+  pipeline_layout_info.setLayoutCount = 1;
+  pipeline_layout_info.pSetLayouts = &untile_descriptor_set_layout_;
+  pipeline_layout_info.pushConstantRangeCount = 1;
+  pipeline_layout_info.pPushConstantRanges = &push_constant_range;
+  err = vkCreatePipelineLayout(*device_, &pipeline_layout_info, nullptr,
+                               &untile_pipeline_layout_);
+  CheckResult(err, "vkCreatePipelineLayout");
+  if (err != VK_SUCCESS) {
+    return;
+  }
+
+  // The set always describes the whole staging buffer, so it's written once
+  // and offsets are passed as push constants.
+  VkDescriptorSetAllocateInfo set_alloc_info;
+  set_alloc_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+  set_alloc_info.pNext = nullptr;
+  set_alloc_info.descriptorPool = descriptor_pool_;
+  set_alloc_info.descriptorSetCount = 1;
+  set_alloc_info.pSetLayouts = &untile_descriptor_set_layout_;
+  err = vkAllocateDescriptorSets(*device_, &set_alloc_info,
+                                 &untile_descriptor_set_);
+  CheckResult(err, "vkAllocateDescriptorSets");
+  if (err != VK_SUCCESS) {
+    return;
+  }
+  VkDescriptorBufferInfo buffer_info;
+  buffer_info.buffer = staging_buffer_.gpu_buffer();
+  buffer_info.offset = 0;
+  buffer_info.range = VK_WHOLE_SIZE;
+  VkWriteDescriptorSet descriptor_write;
+  descriptor_write.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+  descriptor_write.pNext = nullptr;
+  descriptor_write.dstSet = untile_descriptor_set_;
+  descriptor_write.dstBinding = 0;
+  descriptor_write.dstArrayElement = 0;
+  descriptor_write.descriptorCount = 1;
+  descriptor_write.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+  descriptor_write.pImageInfo = nullptr;
+  descriptor_write.pBufferInfo = &buffer_info;
+  descriptor_write.pTexelBufferView = nullptr;
+  vkUpdateDescriptorSets(*device_, 1, &descriptor_write, 0, nullptr);
+
+  for (bool tile : {false, true}) {
+    if (!(tile ? FLAGS_vulkan_resolve_writeback : FLAGS_vulkan_gpu_untile)) {
+      continue;
+    }
+    auto shader_module = tile ? &tile_shader_module_ : &untile_shader_module_;
+    auto pipeline = tile ? &tile_pipeline_ : &untile_pipeline_;
+    auto spirv_words = BuildUntileShader(tile);
+    VkShaderModuleCreateInfo shader_module_info;
+    shader_module_info.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
+    shader_module_info.pNext = nullptr;
+    shader_module_info.flags = 0;
+    shader_module_info.codeSize = spirv_words.size() * 4;
+    shader_module_info.pCode = spirv_words.data();
+    err = vkCreateShaderModule(*device_, &shader_module_info, nullptr,
+                               shader_module);
+    CheckResult(err, "vkCreateShaderModule");
+    if (err != VK_SUCCESS) {
+      *shader_module = nullptr;
+      continue;
+    }
+
+    VkComputePipelineCreateInfo pipeline_info;
+    pipeline_info.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+    pipeline_info.pNext = nullptr;
+    pipeline_info.flags = 0;
+    pipeline_info.stage.sType =
+        VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+    pipeline_info.stage.pNext = nullptr;
+    pipeline_info.stage.flags = 0;
+    pipeline_info.stage.stage = VK_SHADER_STAGE_COMPUTE_BIT;
+    pipeline_info.stage.module = *shader_module;
+    pipeline_info.stage.pName = "main";
+    pipeline_info.stage.pSpecializationInfo = nullptr;
+    pipeline_info.layout = untile_pipeline_layout_;
+    pipeline_info.basePipelineHandle = nullptr;
+    pipeline_info.basePipelineIndex = 0;
+    err = vkCreateComputePipelines(*device_, nullptr, 1, &pipeline_info,
+                                   nullptr, pipeline);
+    CheckResult(err, "vkCreateComputePipelines");
+    if (err != VK_SUCCESS) {
+      *pipeline = nullptr;
+    }
+  }
 }
 
 TextureCache::Texture* TextureCache::AllocateTexture(
-    const TextureInfo& texture_info) {
+    const TextureInfo& texture_info, bool format_mutable,
+    uint32_t resolution_scale) {
   // Create an image first.
   VkImageCreateInfo image_info = {};
   image_info.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
@@ -214,8 +692,12 @@ TextureCache::Texture* TextureCache::AllocateTexture(
     // assert_always();
   }
 
+  if (format_mutable) {
+    image_info.flags |= VK_IMAGE_CREATE_MUTABLE_FORMAT_BIT;
+  }
   image_info.format = format;
-  image_info.extent = {texture_info.width + 1, texture_info.height + 1,
+  image_info.extent = {(texture_info.width + 1) * resolution_scale,
+                       (texture_info.height + 1) * resolution_scale,
                        texture_info.depth + 1};
   image_info.mipLevels = 1;
   image_info.arrayLayers = 1;
@@ -227,6 +709,14 @@ TextureCache::Texture* TextureCache::AllocateTexture(
   image_info.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
   image_info.queueFamilyIndexCount = 0;
   image_info.pQueueFamilyIndices = nullptr;
+  // Shared with the transfer queue so uploads need no ownership transfers.
+  uint32_t queue_family_indices[] = {device_->queue_family_index(),
+                                     device_->transfer_queue_family_index()};
+  if (device_->transfer_queue()) {
+    image_info.sharingMode = VK_SHARING_MODE_CONCURRENT;
+    image_info.queueFamilyIndexCount = 2;
+    image_info.pQueueFamilyIndices = queue_family_indices;
+  }
   image_info.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
   VkImage image;
   auto err = vkCreateImage(*device_, &image_info, nullptr, &image);
@@ -235,29 +725,34 @@ TextureCache::Texture* TextureCache::AllocateTexture(
   VkMemoryRequirements mem_requirements;
   vkGetImageMemoryRequirements(*device_, image, &mem_requirements);
 
-  // TODO: Use a circular buffer or something else to allocate this memory.
-  // The device has a limited amount (around 64) of memory allocations that we
-  // can make.
-  // Now that we have the size, back the image with GPU memory.
-  auto memory = device_->AllocateMemory(mem_requirements, 0);
-  if (!memory) {
+  // Now that we have the size, back the image with GPU memory. The device
+  // allows only a limited number of allocations, so it comes from a block
+  // shared with other resources.
+  ui::vulkan::MemoryAllocator::Allocation memory;
+  if (!device_->memory_allocator()->Allocate(mem_requirements, 0, false,
+                                             &memory)) {
     // Crap.
     assert_always();
     vkDestroyImage(*device_, image, nullptr);
     return nullptr;
   }
 
-  err = vkBindImageMemory(*device_, image, memory, 0);
+  err = vkBindImageMemory(*device_, image, memory.memory, memory.offset);
   CheckResult(err, "vkBindImageMemory");
 
   auto texture = new Texture();
   texture->format = image_info.format;
+  texture->is_format_mutable = format_mutable;
+  texture->bits_per_pixel = texture_info.format_info->bits_per_pixel;
+  texture->resolution_scale = resolution_scale;
   texture->image = image;
   texture->image_layout = image_info.initialLayout;
   texture->image_memory = memory;
-  texture->memory_offset = 0;
   texture->memory_size = mem_requirements.size;
   texture->texture_info = texture_info;
+  texture->last_used_frame = frame_number_;
+  ++texture_count_;
+  resident_bytes_ += texture->memory_size;
 
   // Create a default view, just for kicks.
   VkImageViewCreateInfo view_info;
@@ -279,6 +774,7 @@ TextureCache::Texture* TextureCache::AllocateTexture(
     auto texture_view = std::make_unique<TextureView>();
     texture_view->texture = texture;
     texture_view->view = view;
+    texture_view->format = image_info.format;
     texture_view->swiz_x = 0;
     texture_view->swiz_y = 1;
     texture_view->swiz_z = 2;
@@ -296,25 +792,34 @@ bool TextureCache::FreeTexture(Texture* texture) {
     return false;
   }
 
+  CancelAsyncUpload(texture);
+  FreeTextureSets(texture);
   for (auto it = texture->views.begin(); it != texture->views.end();) {
     vkDestroyImageView(*device_, (*it)->view, nullptr);
     it = texture->views.erase(it);
   }
 
   if (texture->access_watch_handle) {
-    memory_->CancelAccessWatch(texture->access_watch_handle);
+    dirty_page_tracker_->CancelWatch(texture->access_watch_handle);
     texture->access_watch_handle = 0;
   }
+  for (auto& writeback : resolve_writebacks_) {
+    if (writeback.texture == texture) {
+      writeback.texture = nullptr;
+    }
+  }
 
   vkDestroyImage(*device_, texture->image, nullptr);
-  vkFreeMemory(*device_, texture->image_memory, nullptr);
+  device_->memory_allocator()->Free(texture->image_memory);
+  --texture_count_;
+  resident_bytes_ -= texture->memory_size;
   delete texture;
   return true;
 }
 
 TextureCache::Texture* TextureCache::DemandResolveTexture(
     const TextureInfo& texture_info, TextureFormat format,
-    VkOffset2D* out_offset) {
+    VkOffset2D* out_offset, uint32_t resolution_scale) {
   // Check to see if we've already used a texture at this location.
   auto texture = LookupAddress(
       texture_info.guest_address, texture_info.size_2d.block_width,
@@ -324,13 +829,19 @@ TextureCache::Texture* TextureCache::DemandResolveTexture(
   }
 
   // No texture at this location. Make a new one.
-  texture = AllocateTexture(texture_info);
+  texture = AllocateTexture(texture_info, true, resolution_scale);
   texture->is_full_texture = false;
 
   // Setup an access watch. If this texture is touched, it is destroyed.
-  texture->access_watch_handle = memory_->AddPhysicalAccessWatch(
-      texture_info.guest_address, texture_info.input_length,
-      cpu::MMIOHandler::kWatchWrite,
+  WatchResolveTexture(texture);
+
+  resolve_textures_.push_back(texture);
+  return texture;
+}
+
+void TextureCache::WatchResolveTexture(Texture* texture) {
+  texture->access_watch_handle = dirty_page_tracker_->AddWatch(
+      texture->texture_info.guest_address, texture->texture_info.input_length,
       [](void* context_ptr, void* data_ptr, uint32_t address) {
         auto self = reinterpret_cast<TextureCache*>(context_ptr);
         auto touched_texture = reinterpret_cast<Texture*>(data_ptr);
@@ -344,24 +855,243 @@ TextureCache::Texture* TextureCache::DemandResolveTexture(
         self->invalidated_resolve_textures_mutex_.unlock();
       },
       this, texture);
+}
 
-  resolve_textures_.push_back(texture);
-  return texture;
+void TextureCache::WriteBackResolve(
+    VkCommandBuffer command_buffer,
+    std::shared_ptr<ui::vulkan::Fence> completion_fence, Texture* texture,
+    Endian128 endian, VkOffset2D offset, VkExtent2D extent) {
+  if (!tile_pipeline_ || !texture->access_watch_handle) {
+    return;
+  }
+  const TextureInfo& info = texture->texture_info;
+  uint32_t bytes_per_block = info.format_info->block_width *
+                             info.format_info->block_height *
+                             info.format_info->bits_per_pixel / 8;
+  // Scaled texels aren't what the guest expects, the shader works in dwords,
+  // and it doesn't swap across dwords.
+  if (texture->resolution_scale != 1 || info.format_info->block_width != 1 ||
+      info.format_info->block_height != 1 || (bytes_per_block & 3) ||
+      (endian != Endian128::kUnspecified && endian != Endian128::k8in16 &&
+       endian != Endian128::k8in32 && endian != Endian128::k16in32)) {
+    if (!warned_writeback_) {
+      XELOGW("Vulkan: resolves to format %u, endianness %u aren't written "
+             "back",
+             uint32_t(info.format_info->format), uint32_t(endian));
+      warned_writeback_ = true;
+    }
+    return;
+  }
+  int32_t end_x = std::min(offset.x + int32_t(extent.width),
+                           int32_t(info.size_2d.logical_width));
+  int32_t end_y = std::min(offset.y + int32_t(extent.height),
+                           int32_t(info.size_2d.logical_height));
+  offset.x = std::max(offset.x, 0);
+  offset.y = std::max(offset.y, 0);
+  if (end_x <= offset.x || end_y <= offset.y) {
+    return;
+  }
+  extent.width = uint32_t(end_x - offset.x);
+  extent.height = uint32_t(end_y - offset.y);
+
+  auto linear = staging_buffer_.Acquire(
+      extent.width * extent.height * bytes_per_block, completion_fence);
+  auto tiled = linear ? staging_buffer_.Acquire(info.input_length,
+                                                completion_fence)
+                      : nullptr;
+  if (!tiled) {
+    if (!warned_writeback_) {
+      XELOGW("Vulkan: out of staging memory, resolves not written back");
+      warned_writeback_ = true;
+    }
+    return;
+  }
+  // Blocks outside of the extent are copied back as they are.
+  std::memcpy(tiled->host_ptr, memory_->TranslatePhysical(info.guest_address),
+              info.input_length);
+  staging_buffer_.Flush(tiled);
+
+  VkImageMemoryBarrier image_barrier;
+  image_barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+  image_barrier.pNext = nullptr;
+  image_barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+  image_barrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+  image_barrier.oldLayout = texture->image_layout;
+  image_barrier.newLayout = texture->image_layout;
+  image_barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+  image_barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+  image_barrier.image = texture->image;
+  image_barrier.subresourceRange = {VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1};
+  vkCmdPipelineBarrier(command_buffer, VK_PIPELINE_STAGE_TRANSFER_BIT,
+                       VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, nullptr, 0,
+                       nullptr, 1, &image_barrier);
+
+  VkBufferImageCopy copy_region;
+  copy_region.bufferOffset = linear->offset;
+  copy_region.bufferRowLength = 0;
+  copy_region.bufferImageHeight = 0;
+  copy_region.imageSubresource = {VK_IMAGE_ASPECT_COLOR_BIT, 0, 0, 1};
+  copy_region.imageOffset = {offset.x, offset.y, 0};
+  copy_region.imageExtent = {extent.width, extent.height, 1};
+  vkCmdCopyImageToBuffer(command_buffer, texture->image,
+                         texture->image_layout, staging_buffer_.gpu_buffer(),
+                         1, &copy_region);
+
+  VkBufferMemoryBarrier barriers[2];
+  barriers[0].sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+  barriers[0].pNext = nullptr;
+  barriers[0].srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+  barriers[0].dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+  barriers[0].srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+  barriers[0].dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+  barriers[0].buffer = staging_buffer_.gpu_buffer();
+  barriers[0].offset = linear->offset;
+  barriers[0].size = linear->aligned_length;
+  barriers[1] = barriers[0];
+  barriers[1].srcAccessMask = VK_ACCESS_HOST_WRITE_BIT;
+  barriers[1].dstAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+  barriers[1].offset = tiled->offset;
+  barriers[1].size = tiled->aligned_length;
+  vkCmdPipelineBarrier(
+      command_buffer,
+      VK_PIPELINE_STAGE_TRANSFER_BIT | VK_PIPELINE_STAGE_HOST_BIT,
+      VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 0, nullptr,
+      uint32_t(xe::countof(barriers)), barriers, 0, nullptr);
+
+  UntileConstants constants;
+  constants.tiled_offset = uint32_t(tiled->offset / 4);
+  constants.tiled_length = info.input_length / 4;
+  constants.linear_offset = uint32_t(linear->offset / 4);
+  constants.linear_pitch = extent.width * bytes_per_block / 4;
+  constants.block_width = extent.width;
+  constants.block_height = extent.height;
+  constants.offset_x = uint32_t(offset.x);
+  constants.offset_y = uint32_t(offset.y);
+  constants.input_width = info.size_2d.input_width;
+  constants.log_bpp = (bytes_per_block >> 2) +
+                      ((bytes_per_block >> 1) >> (bytes_per_block >> 2));
+  constants.block_dwords = bytes_per_block / 4;
+  constants.endianness = uint32_t(endian);
+
+  vkCmdBindPipeline(command_buffer, VK_PIPELINE_BIND_POINT_COMPUTE,
+                    tile_pipeline_);
+  vkCmdBindDescriptorSets(command_buffer, VK_PIPELINE_BIND_POINT_COMPUTE,
+                          untile_pipeline_layout_, 0, 1,
+                          &untile_descriptor_set_, 0, nullptr);
+  vkCmdPushConstants(command_buffer, untile_pipeline_layout_,
+                     VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(constants),
+                     &constants);
+  vkCmdDispatch(command_buffer, xe::round_up(extent.width, 8) / 8,
+                xe::round_up(extent.height, 8) / 8, 1);
+
+  resolve_writebacks_.push_back({texture, info.guest_address,
+                                 info.input_length, tiled->offset,
+                                 completion_fence});
+  ++batch_writeback_count_;
+}
+
+void TextureCache::EndBatch(VkCommandBuffer command_buffer) {
+  if (!batch_writeback_count_) {
+    return;
+  }
+  batch_writeback_count_ = 0;
+  VkMemoryBarrier barrier;
+  barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+  barrier.pNext = nullptr;
+  barrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+  barrier.dstAccessMask = VK_ACCESS_HOST_READ_BIT;
+  vkCmdPipelineBarrier(command_buffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                       VK_PIPELINE_STAGE_HOST_BIT, 0, 1, &barrier, 0, nullptr,
+                       0, nullptr);
+}
+
+void TextureCache::CancelBatch() {
+  resolve_writebacks_.resize(resolve_writebacks_.size() -
+                             batch_writeback_count_);
+  batch_writeback_count_ = 0;
+}
+
+void TextureCache::FlushResolveWritebacks() {
+  // Only the writebacks of ended batches can be done.
+  size_t done_count = 0;
+  while (done_count < resolve_writebacks_.size() - batch_writeback_count_ &&
+         resolve_writebacks_[done_count].fence->status() == VK_SUCCESS) {
+    ++done_count;
+  }
+  if (!done_count) {
+    return;
+  }
+  VkMappedMemoryRange range;
+  range.sType = VK_STRUCTURE_TYPE_MAPPED_MEMORY_RANGE;
+  range.pNext = nullptr;
+  range.memory = staging_buffer_.gpu_memory();
+  range.offset = 0;
+  range.size = VK_WHOLE_SIZE;
+  vkInvalidateMappedMemoryRanges(*device_, 1, &range);
+
+  // Guest writes made since the resolves unwatch their textures here, and
+  // what they wrote is newer than the resolves.
+  dirty_page_tracker_->NotifyWrites();
+  std::vector<Texture*> written_textures;
+  for (size_t i = 0; i < done_count; ++i) {
+    auto& writeback = resolve_writebacks_.front();
+    auto texture = writeback.texture;
+    if (texture && texture->access_watch_handle) {
+      // The texture's own watch would destroy it for the copy.
+      dirty_page_tracker_->CancelWatch(texture->access_watch_handle);
+      texture->access_watch_handle = 0;
+      written_textures.push_back(texture);
+    }
+    if (texture && std::find(written_textures.begin(), written_textures.end(),
+                             texture) != written_textures.end()) {
+      std::memcpy(memory_->TranslatePhysical(writeback.guest_address),
+                  staging_buffer_.host_base() + writeback.offset,
+                  writeback.length);
+      cpu::MMIOHandler::global_handler()->InvalidateRange(
+          writeback.guest_address, writeback.length);
+    }
+    resolve_writebacks_.pop_front();
+  }
+  // Other caches watching the memory see the copies now, and the textures
+  // are watched again after them.
+  dirty_page_tracker_->NotifyWrites();
+  for (auto texture : written_textures) {
+    if (texture->is_full_texture) {
+      WatchTexture(texture);
+    } else {
+      WatchResolveTexture(texture);
+    }
+  }
 }
 
 TextureCache::Texture* TextureCache::Demand(
     const TextureInfo& texture_info, VkCommandBuffer command_buffer,
-    std::shared_ptr<ui::vulkan::Fence> completion_fence) {
+    std::shared_ptr<ui::vulkan::Fence> completion_fence,
+    VkCommandBuffer transfer_command_buffer,
+    std::shared_ptr<ui::vulkan::Fence> transfer_fence) {
   // Run a tight loop to scan for an exact match existing texture.
   auto texture_hash = texture_info.hash();
   for (auto it = textures_.find(texture_hash); it != textures_.end(); ++it) {
     if (it->second->texture_info == texture_info) {
+      if (it->second->async_upload &&
+          !FinishAsyncUpload(it->second, command_buffer, completion_fence)) {
+        return command_buffer ? DemandPlaceholder(texture_info, command_buffer,
+                                                  completion_fence)
+                              : nullptr;
+      }
       if (it->second->pending_invalidation) {
+        if (command_buffer &&
+            RefreshTexture(it->second, command_buffer, completion_fence)) {
+          ++hit_count_;
+          return it->second;
+        }
+
         // This texture has been invalidated!
         Scavenge();
         break;
       }
 
+      ++hit_count_;
       return it->second;
     }
   }
@@ -382,32 +1112,34 @@ TextureCache::Texture* TextureCache::Demand(
       texture->texture_info = texture_info;
 
       if (texture->access_watch_handle) {
-        memory_->CancelAccessWatch(texture->access_watch_handle);
+        dirty_page_tracker_->CancelWatch(texture->access_watch_handle);
       }
-
-      texture->access_watch_handle = memory_->AddPhysicalAccessWatch(
-          texture_info.guest_address, texture_info.input_length,
-          cpu::MMIOHandler::kWatchWrite,
-          [](void* context_ptr, void* data_ptr, uint32_t address) {
-            auto self = reinterpret_cast<TextureCache*>(context_ptr);
-            auto touched_texture = reinterpret_cast<Texture*>(data_ptr);
-            // Clear watch handle first so we don't redundantly
-            // remove.
-            touched_texture->access_watch_handle = 0;
-            touched_texture->pending_invalidation = true;
-            // Add to pending list so Scavenge will clean it up.
-            self->invalidated_textures_mutex_.lock();
-            self->invalidated_textures_->push_back(touched_texture);
-            self->invalidated_textures_mutex_.unlock();
-          },
-          this, texture);
+      WatchTexture(texture);
 
       textures_[texture_hash] = *it;
       it = resolve_textures_.erase(it);
+      ++hit_count_;
       return textures_[texture_hash];
     }
   }
 
+  // An upgraded resolve target may also be sampled with other parameters
+  // (such as another format of the same size). What the GPU wrote is newer
+  // than guest memory, so it's used as-is rather than uploading over it.
+  for (auto it = textures_.begin(); it != textures_.end(); ++it) {
+    auto texture = it->second;
+    if (texture->is_format_mutable && !texture->pending_invalidation &&
+        texture_info.guest_address == texture->texture_info.guest_address &&
+        texture_info.size_2d.logical_width ==
+            texture->texture_info.size_2d.logical_width &&
+        texture_info.size_2d.logical_height ==
+            texture->texture_info.size_2d.logical_height) {
+      ++hit_count_;
+      return texture;
+    }
+  }
+
+  ++miss_count_;
   if (!command_buffer) {
     // Texture not found and no command buffer was passed, preventing us from
     // uploading a new one.
@@ -427,11 +1159,41 @@ TextureCache::Texture* TextureCache::Demand(
     return nullptr;
   }
 
+  if (!async_upload_threads_.empty() &&
+      texture_info.dimension == Dimension::k2D &&
+      texture_info.input_length >= kAsyncUploadMinLength) {
+    // Watched before the thread reads anything, so that writes made while
+    // it converts aren't missed.
+    WatchTexture(texture);
+    auto upload = std::make_shared<AsyncUpload>();
+    upload->texture_info = texture_info;
+    texture->async_upload = upload;
+    {
+      std::lock_guard<std::mutex> lock(async_upload_mutex_);
+      async_upload_queue_.push_back(std::move(upload));
+    }
+    async_upload_cond_.notify_one();
+    textures_[texture_hash] = texture;
+    return DemandPlaceholder(texture_info, command_buffer, completion_fence);
+  }
+
+  // Hashed first so that later invalidations can tell what changed.
+  uint32_t changed_offset;
+  uint32_t changed_length;
+  texture_info.UpdateContentPages(
+      memory_->TranslatePhysical(texture_info.guest_address),
+      &texture->content_hashes, &changed_offset, &changed_length);
+
   bool uploaded = false;
   switch (texture_info.dimension) {
     case Dimension::k2D: {
-      uploaded = UploadTexture2D(command_buffer, completion_fence, texture,
-                                 texture_info);
+      if (transfer_command_buffer) {
+        uploaded = UploadTexture2D(transfer_command_buffer, transfer_fence,
+                                   texture, texture_info, true);
+      } else {
+        uploaded = UploadTexture2D(command_buffer, completion_fence, texture,
+                                   texture_info);
+      }
     } break;
     default:
       assert_unhandled_case(texture_info.dimension);
@@ -468,31 +1230,279 @@ TextureCache::Texture* TextureCache::Demand(
 
   // Okay. Now that the texture is uploaded from system memory, put a writewatch
   // on it to tell us if it's been modified from the guest.
-  texture->access_watch_handle = memory_->AddPhysicalAccessWatch(
-      texture_info.guest_address, texture_info.input_length,
-      cpu::MMIOHandler::kWatchWrite,
+  WatchTexture(texture);
+
+  textures_[texture_hash] = texture;
+  return texture;
+}
+
+void TextureCache::WatchTexture(Texture* texture) {
+  texture->access_watch_handle = dirty_page_tracker_->AddWatch(
+      texture->texture_info.guest_address, texture->texture_info.input_length,
       [](void* context_ptr, void* data_ptr, uint32_t address) {
         auto self = reinterpret_cast<TextureCache*>(context_ptr);
         auto touched_texture = reinterpret_cast<Texture*>(data_ptr);
         // Clear watch handle first so we don't redundantly
         // remove.
         touched_texture->access_watch_handle = 0;
-        touched_texture->pending_invalidation = true;
         // Add to pending list so Scavenge will clean it up.
+        // RefreshTexture may take it back out, so the flag is only changed
+        // under the lock.
         self->invalidated_textures_mutex_.lock();
+        touched_texture->pending_invalidation = true;
         self->invalidated_textures_->push_back(touched_texture);
         self->invalidated_textures_mutex_.unlock();
       },
       this, texture);
+}
 
-  textures_[texture_hash] = texture;
+bool TextureCache::RefreshTexture(
+    Texture* texture, VkCommandBuffer command_buffer,
+    std::shared_ptr<ui::vulkan::Fence> completion_fence) {
+  const auto& texture_info = texture->texture_info;
+  if (texture->content_hashes.empty() || texture->resolution_scale != 1 ||
+      texture_info.dimension != Dimension::k2D) {
+    return false;
+  }
+
+  // Keep Scavenge from freeing it, and watch again before looking at the data
+  // so that writes made while we do aren't missed.
+  {
+    std::lock_guard<std::mutex> lock(invalidated_textures_mutex_);
+    for (auto& invalidated_textures : invalidated_textures_sets_) {
+      invalidated_textures.erase(
+          std::remove(invalidated_textures.begin(),
+                      invalidated_textures.end(), texture),
+          invalidated_textures.end());
+    }
+    texture->pending_invalidation = false;
+  }
+  WatchTexture(texture);
+
+  // Writes that leave the data as it was (such as a title rewriting the same
+  // contents every frame) don't need an upload at all.
+  uint32_t changed_offset;
+  uint32_t changed_length;
+  if (!texture_info.UpdateContentPages(
+          memory_->TranslatePhysical(texture_info.guest_address),
+          &texture->content_hashes, &changed_offset, &changed_length)) {
+    return true;
+  }
+  uint32_t first_row;
+  uint32_t row_count;
+  texture_info.GetBlockRowsForRange(changed_offset, changed_length,
+                                    &first_row, &row_count);
+  if (!row_count ||
+      UploadTexture2D(command_buffer, completion_fence, texture, texture_info,
+                      false, first_row, row_count)) {
+    return true;
+  }
+
+  // Replace it like any other invalidated texture.
+  texture->content_hashes.clear();
+  if (texture->access_watch_handle) {
+    dirty_page_tracker_->CancelWatch(texture->access_watch_handle);
+    texture->access_watch_handle = 0;
+  }
+  std::lock_guard<std::mutex> lock(invalidated_textures_mutex_);
+  if (!texture->pending_invalidation) {
+    texture->pending_invalidation = true;
+    invalidated_textures_->push_back(texture);
+  }
+  return false;
+}
+
+TextureCache::Texture* TextureCache::DemandPlaceholder(
+    const TextureInfo& texture_info, VkCommandBuffer command_buffer,
+    std::shared_ptr<ui::vulkan::Fence> completion_fence) {
+  uint32_t format = uint32_t(texture_info.format_info->format);
+  auto it = placeholder_textures_.find(format);
+  if (it != placeholder_textures_.end()) {
+    return it->second;
+  }
+
+  TextureInfo placeholder_info = texture_info;
+  placeholder_info.width = 0;
+  placeholder_info.height = 0;
+  placeholder_info.depth = 0;
+  auto texture = AllocateTexture(placeholder_info);
+  if (!texture) {
+    return nullptr;
+  }
+  // Enough zeros for a block of any format.
+  auto alloc = staging_buffer_.Acquire(16, completion_fence);
+  if (!alloc) {
+    FreeTexture(texture);
+    return nullptr;
+  }
+  std::memset(alloc->host_ptr, 0, 16);
+  staging_buffer_.Flush(alloc);
+
+  VkImageMemoryBarrier barrier;
+  barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+  barrier.pNext = nullptr;
+  barrier.srcAccessMask = 0;
+  barrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+  barrier.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+  barrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+  barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+  barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+  barrier.image = texture->image;
+  barrier.subresourceRange = {VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1};
+  vkCmdPipelineBarrier(command_buffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
+                       VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, nullptr, 0,
+                       nullptr, 1, &barrier);
+  VkBufferImageCopy copy_region;
+  copy_region.bufferOffset = alloc->offset;
+  copy_region.bufferRowLength = 0;
+  copy_region.bufferImageHeight = 0;
+  copy_region.imageSubresource = {VK_IMAGE_ASPECT_COLOR_BIT, 0, 0, 1};
+  copy_region.imageOffset = {0, 0, 0};
+  copy_region.imageExtent = {1, 1, 1};
+  vkCmdCopyBufferToImage(command_buffer, staging_buffer_.gpu_buffer(),
+                         texture->image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+                         1, &copy_region);
+  barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+  barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+  barrier.oldLayout = barrier.newLayout;
+  barrier.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+  vkCmdPipelineBarrier(command_buffer, VK_PIPELINE_STAGE_TRANSFER_BIT,
+                       VK_PIPELINE_STAGE_VERTEX_SHADER_BIT |
+                           VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
+                       0, 0, nullptr, 0, nullptr, 1, &barrier);
+  texture->image_layout = barrier.newLayout;
+
+  placeholder_textures_[format] = texture;
   return texture;
 }
 
+bool TextureCache::FinishAsyncUpload(
+    Texture* texture, VkCommandBuffer command_buffer,
+    std::shared_ptr<ui::vulkan::Fence> completion_fence) {
+  if (!command_buffer) {
+    return false;
+  }
+  auto upload = texture->async_upload;
+  bool invalidated;
+  {
+    std::lock_guard<std::mutex> lock(invalidated_textures_mutex_);
+    invalidated = texture->pending_invalidation;
+    if (!invalidated && !upload->done) {
+      return false;
+    }
+    if (invalidated) {
+      for (auto& invalidated_textures : invalidated_textures_sets_) {
+        invalidated_textures.erase(
+            std::remove(invalidated_textures.begin(),
+                        invalidated_textures.end(), texture),
+            invalidated_textures.end());
+      }
+      texture->pending_invalidation = false;
+    }
+  }
+  CancelAsyncUpload(texture);
+
+  const auto& texture_info = texture->texture_info;
+  bool uploaded;
+  if (invalidated) {
+    // What the thread converted may be older than the write, so it's
+    // converted again right away rather than waiting for the thread.
+    WatchTexture(texture);
+    uint32_t changed_offset;
+    uint32_t changed_length;
+    texture_info.UpdateContentPages(
+        memory_->TranslatePhysical(texture_info.guest_address),
+        &texture->content_hashes, &changed_offset, &changed_length);
+    uploaded = UploadTexture2D(command_buffer, completion_fence, texture,
+                               texture_info);
+  } else {
+    texture->content_hashes = std::move(upload->content_hashes);
+    uploaded = UploadTexture2D(command_buffer, completion_fence, texture,
+                               texture_info, false, 0, 0, upload->data.data());
+  }
+  if (uploaded) {
+    return true;
+  }
+
+  // Replaced like any other invalidated texture.
+  texture->content_hashes.clear();
+  if (texture->access_watch_handle) {
+    dirty_page_tracker_->CancelWatch(texture->access_watch_handle);
+    texture->access_watch_handle = 0;
+  }
+  std::lock_guard<std::mutex> lock(invalidated_textures_mutex_);
+  if (!texture->pending_invalidation) {
+    texture->pending_invalidation = true;
+    invalidated_textures_->push_back(texture);
+  }
+  return false;
+}
+
+void TextureCache::CancelAsyncUpload(Texture* texture) {
+  auto upload = std::move(texture->async_upload);
+  if (!upload) {
+    return;
+  }
+  // A thread already converting it finishes into its own copy, which is
+  // dropped along with the last reference.
+  upload->canceled = true;
+  std::lock_guard<std::mutex> lock(async_upload_mutex_);
+  async_upload_queue_.erase(std::remove(async_upload_queue_.begin(),
+                                        async_upload_queue_.end(), upload),
+                            async_upload_queue_.end());
+}
+
+void TextureCache::AsyncUploadThreadMain() {
+  while (true) {
+    std::shared_ptr<AsyncUpload> upload;
+    {
+      std::unique_lock<std::mutex> lock(async_upload_mutex_);
+      async_upload_cond_.wait(lock, [this]() {
+        return async_upload_shutdown_ || !async_upload_queue_.empty();
+      });
+      if (async_upload_shutdown_) {
+        return;
+      }
+      upload = std::move(async_upload_queue_.front());
+      async_upload_queue_.pop_front();
+    }
+    if (upload->canceled) {
+      continue;
+    }
+
+    const auto& texture_info = upload->texture_info;
+    uint32_t changed_offset;
+    uint32_t changed_length;
+    texture_info.UpdateContentPages(
+        memory_->TranslatePhysical(texture_info.guest_address),
+        &upload->content_hashes, &changed_offset, &changed_length);
+    upload->data.resize(texture_info.output_length);
+    ConvertTexture2D(texture_info, upload->data.data(),
+                     texture_info.output_length, 0,
+                     std::min(texture_info.size_2d.block_height,
+                              texture_info.size_2d.logical_height));
+    upload->done = true;
+  }
+}
+
+VkFormat TextureCache::GetViewFormat(const Texture* texture,
+                                     const TextureInfo& texture_info) {
+  auto format_info = texture_info.format_info;
+  VkFormat format = texture_configs[int(format_info->format)].host_format;
+  if (!texture->is_format_mutable || format == VK_FORMAT_UNDEFINED ||
+      format == VK_FORMAT_D24_UNORM_S8_UINT ||
+      format_info->type != FormatType::kUncompressed ||
+      format_info->bits_per_pixel != texture->bits_per_pixel) {
+    return texture->format;
+  }
+  return format;
+}
+
 TextureCache::TextureView* TextureCache::DemandView(Texture* texture,
-                                                    uint16_t swizzle) {
+                                                    uint16_t swizzle,
+                                                    VkFormat format) {
   for (auto it = texture->views.begin(); it != texture->views.end(); ++it) {
-    if ((*it)->swizzle == swizzle) {
+    if ((*it)->swizzle == swizzle && (*it)->format == format) {
       return (*it).get();
     }
   }
@@ -502,7 +1512,7 @@ TextureCache::TextureView* TextureCache::DemandView(Texture* texture,
   view_info.pNext = nullptr;
   view_info.flags = 0;
   view_info.image = texture->image;
-  view_info.format = texture->format;
+  view_info.format = format;
 
   switch (texture->texture_info.dimension) {
     case Dimension::k1D:
@@ -563,11 +1573,32 @@ TextureCache::Sampler* TextureCache::Demand(const SamplerInfo& sampler_info) {
     }
   }
 
-  VkResult status = VK_SUCCESS;
+  VkSamplerCreateInfo sampler_create_info;
+  if (!GetSamplerCreateInfo(sampler_info, &sampler_create_info)) {
+    return nullptr;
+  }
 
   // Create a new sampler and cache it.
+  VkSampler vk_sampler;
+  auto status =
+      vkCreateSampler(*device_, &sampler_create_info, nullptr, &vk_sampler);
+  CheckResult(status, "vkCreateSampler");
+  if (status != VK_SUCCESS) {
+    return nullptr;
+  }
+
+  auto sampler = new Sampler();
+  sampler->sampler = vk_sampler;
+  sampler->sampler_info = sampler_info;
+  samplers_[sampler_hash] = sampler;
+
+  return sampler;
+}
+
+bool TextureCache::GetSamplerCreateInfo(const SamplerInfo& sampler_info,
+                                        VkSamplerCreateInfo* out_create_info) {
   // TODO: Actually set the properties
-  VkSamplerCreateInfo sampler_create_info;
+  auto& sampler_create_info = *out_create_info;
   sampler_create_info.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO;
   sampler_create_info.pNext = nullptr;
   sampler_create_info.flags = 0;
@@ -588,7 +1619,7 @@ TextureCache::Sampler* TextureCache::Demand(const SamplerInfo& sampler_info) {
       break;
     default:
       assert_unhandled_case(sampler_info.mip_filter);
-      return nullptr;
+      return false;
   }
 
   VkFilter min_filter;
@@ -601,7 +1632,7 @@ TextureCache::Sampler* TextureCache::Demand(const SamplerInfo& sampler_info) {
       break;
     default:
       assert_unhandled_case(sampler_info.min_filter);
-      return nullptr;
+      return false;
   }
   VkFilter mag_filter;
   switch (sampler_info.mag_filter) {
@@ -613,7 +1644,7 @@ TextureCache::Sampler* TextureCache::Demand(const SamplerInfo& sampler_info) {
       break;
     default:
       assert_unhandled_case(mag_filter);
-      return nullptr;
+      return false;
   }
 
   sampler_create_info.minFilter = min_filter;
@@ -662,7 +1693,7 @@ TextureCache::Sampler* TextureCache::Demand(const SamplerInfo& sampler_info) {
       break;
     default:
       assert_unhandled_case(aniso);
-      return nullptr;
+      return false;
   }
 
   sampler_create_info.anisotropyEnable =
@@ -675,20 +1706,72 @@ TextureCache::Sampler* TextureCache::Demand(const SamplerInfo& sampler_info) {
   sampler_create_info.maxLod = 0.0f;
   sampler_create_info.borderColor = VK_BORDER_COLOR_FLOAT_OPAQUE_BLACK;
   sampler_create_info.unnormalizedCoordinates = VK_FALSE;
-  VkSampler vk_sampler;
-  status =
-      vkCreateSampler(*device_, &sampler_create_info, nullptr, &vk_sampler);
-  CheckResult(status, "vkCreateSampler");
-  if (status != VK_SUCCESS) {
-    return nullptr;
-  }
+  return true;
+}
 
-  auto sampler = new Sampler();
-  sampler->sampler = vk_sampler;
-  sampler->sampler_info = sampler_info;
-  samplers_[sampler_hash] = sampler;
+void TextureCache::InitializeImmutableSamplers() {
+  const TextureFilter filters[] = {TextureFilter::kPoint,
+                                   TextureFilter::kLinear};
+  const ClampMode clamp_modes[] = {
+      ClampMode::kRepeat, ClampMode::kMirroredRepeat, ClampMode::kClampToEdge};
+  immutable_samplers_.resize(kSpirvImmutableSamplerCount);
+  for (uint32_t i = 0; i < kSpirvImmutableSamplerCount; ++i) {
+    SamplerInfo sampler_info;
+    sampler_info.mag_filter = filters[i & 1];
+    sampler_info.min_filter = filters[(i >> 1) & 1];
+    sampler_info.mip_filter = filters[(i >> 2) & 1];
+    sampler_info.clamp_u = clamp_modes[(i >> 3) / 3];
+    sampler_info.clamp_v = clamp_modes[(i >> 3) % 3];
+    sampler_info.clamp_w = sampler_info.clamp_u;
+    sampler_info.aniso_filter = AnisoFilter::kDisabled;
+    assert_true(GetImmutableSamplerIndex(sampler_info, Dimension::k3D) == i);
+
+    VkSamplerCreateInfo sampler_create_info;
+    GetSamplerCreateInfo(sampler_info, &sampler_create_info);
+    auto status = vkCreateSampler(*device_, &sampler_create_info, nullptr,
+                                  &immutable_samplers_[i]);
+    CheckResult(status, "vkCreateSampler");
+  }
+}
 
-  return sampler;
+uint32_t TextureCache::GetImmutableSamplerIndex(const SamplerInfo& sampler_info,
+                                                Dimension dimension) {
+  // Indexed by the Vulkan address modes, so clamping to halfway, which is
+  // clamped to edge for now, shares the samplers clamping to edge.
+  auto clamp_index = [](ClampMode clamp_mode) {
+    switch (clamp_mode) {
+      case ClampMode::kRepeat:
+        return 0;
+      case ClampMode::kMirroredRepeat:
+        return 1;
+      case ClampMode::kClampToEdge:
+      case ClampMode::kClampToHalfway:
+        return 2;
+      default:
+        return -1;
+    }
+  };
+  int u = clamp_index(sampler_info.clamp_u);
+  int v = clamp_index(sampler_info.clamp_v);
+  if (u < 0 || v < 0 || sampler_info.aniso_filter != AnisoFilter::kDisabled) {
+    return kSpirvFetchSamplerIndex;
+  }
+  // Only 3D textures are addressed with W, and the table has it as U.
+  if (dimension == Dimension::k3D &&
+      clamp_index(sampler_info.clamp_w) != u) {
+    return kSpirvFetchSamplerIndex;
+  }
+  if ((sampler_info.min_filter != TextureFilter::kPoint &&
+       sampler_info.min_filter != TextureFilter::kLinear) ||
+      (sampler_info.mag_filter != TextureFilter::kPoint &&
+       sampler_info.mag_filter != TextureFilter::kLinear) ||
+      sampler_info.mip_filter == TextureFilter::kUseFetchConst) {
+    return kSpirvFetchSamplerIndex;
+  }
+  uint32_t min = sampler_info.min_filter == TextureFilter::kLinear ? 1 : 0;
+  uint32_t mag = sampler_info.mag_filter == TextureFilter::kLinear ? 1 : 0;
+  uint32_t mip = sampler_info.mip_filter == TextureFilter::kLinear ? 1 : 0;
+  return ((u * 3 + v) * 2 + mip) * 4 + min * 2 + mag;
 }
 
 TextureCache::Texture* TextureCache::LookupAddress(uint32_t guest_address,
@@ -759,7 +1842,7 @@ void TextureSwap(Endian endianness, void* dest, const void* src,
       xe::copy_and_swap_32_aligned(dest, src, length / 4);
       break;
     case Endian::k16in32:  // Swap high and low 16 bits within a 32 bit word
-      xe::copy_and_swap_16_in_32_aligned(dest, src, length);
+      xe::copy_and_swap_16_in_32_aligned(dest, src, length / 4);
       break;
     default:
     case Endian::kUnspecified:
@@ -768,17 +1851,62 @@ void TextureSwap(Endian endianness, void* dest, const void* src,
   }
 }
 
+void TextureCache::ConvertTexture2D(const TextureInfo& src, uint8_t* dest,
+                                    size_t length, uint32_t first_row,
+                                    uint32_t end_row) const {
+  auto host_address = reinterpret_cast<const uint8_t*>(
+      memory_->TranslatePhysical(src.guest_address));
+  if (!src.is_tiled) {
+    if (src.size_2d.input_pitch == src.size_2d.output_pitch) {
+      // Fast path copy entire image.
+      TextureSwap(src.endianness, dest,
+                  host_address + first_row * src.size_2d.input_pitch, length);
+    } else {
+      // Slow path copy row-by-row because strides differ.
+      // UNPACK_ROW_LENGTH only works for uncompressed images, and likely does
+      // this exact thing under the covers, so we just always do it here.
+      const uint8_t* src_mem =
+          host_address + first_row * src.size_2d.input_pitch;
+      uint32_t pitch =
+          std::min(src.size_2d.input_pitch, src.size_2d.output_pitch);
+      for (uint32_t y = first_row; y < end_row; y++) {
+        TextureSwap(src.endianness, dest, src_mem, pitch);
+        src_mem += src.size_2d.input_pitch;
+        dest += src.size_2d.output_pitch;
+      }
+    }
+    return;
+  }
+
+  // Untile image.
+  uint32_t bytes_per_block = src.format_info->block_width *
+                             src.format_info->block_height *
+                             src.format_info->bits_per_pixel / 8;
+  // Tiled textures can be packed; get the offset into the packed texture.
+  uint32_t offset_x;
+  uint32_t offset_y;
+  TextureInfo::GetPackedTileOffset(src, &offset_x, &offset_y);
+  TextureInfo::Untile(src.endianness, host_address,
+                      src.size_2d.input_width / src.format_info->block_width,
+                      dest, src.size_2d.output_pitch, src.size_2d.block_width,
+                      bytes_per_block, offset_x, offset_y, first_row, end_row);
+}
+
 bool TextureCache::UploadTexture2D(
     VkCommandBuffer command_buffer,
     std::shared_ptr<ui::vulkan::Fence> completion_fence, Texture* dest,
-    TextureInfo src) {
+    TextureInfo src, bool on_transfer_queue, uint32_t first_row,
+    uint32_t row_count, const uint8_t* converted_data) {
 #if FINE_GRAINED_DRAW_SCOPES
   SCOPE_profile_cpu_f("gpu");
 #endif  // FINE_GRAINED_DRAW_SCOPES
+  INCREMENT_counter(texture_uploads, 1);
 
   assert_true(src.dimension == Dimension::k2D);
 
-  if (!staging_buffer_.CanAcquire(src.input_length)) {
+  auto& staging_buffer =
+      on_transfer_queue ? transfer_staging_buffer_ : staging_buffer_;
+  if (!staging_buffer.CanAcquire(src.input_length)) {
     // Need to have unique memory for every upload for at least one frame. If we
     // run out of memory, we need to flush all queued upload commands to the
     // GPU.
@@ -786,43 +1914,28 @@ bool TextureCache::UploadTexture2D(
     assert_always();
   }
 
+  // Rows of blocks to convert, [first_row, end_row).
+  uint32_t end_row = first_row + row_count;
+  size_t unpack_length = row_count * src.size_2d.output_pitch;
+  if (!row_count) {
+    first_row = 0;
+    end_row = std::min(src.size_2d.block_height, src.size_2d.logical_height);
+    unpack_length = src.output_length;
+  }
+
   // Grab some temporary memory for staging.
-  size_t unpack_length = src.output_length;
-  auto alloc = staging_buffer_.Acquire(unpack_length, completion_fence);
+  auto alloc = staging_buffer.Acquire(unpack_length, completion_fence);
   assert_not_null(alloc);
 
   // Upload texture into GPU memory.
-  // TODO: If the GPU supports it, we can submit a compute batch to convert the
-  // texture and copy it to its destination. Otherwise, fallback to conversion
-  // on the CPU.
-  void* host_address = memory_->TranslatePhysical(src.guest_address);
-  if (!src.is_tiled) {
-    if (src.size_2d.input_pitch == src.size_2d.output_pitch) {
-      // Fast path copy entire image.
-      TextureSwap(src.endianness, alloc->host_ptr, host_address, unpack_length);
-    } else {
-      // Slow path copy row-by-row because strides differ.
-      // UNPACK_ROW_LENGTH only works for uncompressed images, and likely does
-      // this exact thing under the covers, so we just always do it here.
-      const uint8_t* src_mem = reinterpret_cast<const uint8_t*>(host_address);
-      uint8_t* dest = reinterpret_cast<uint8_t*>(alloc->host_ptr);
-      uint32_t pitch =
-          std::min(src.size_2d.input_pitch, src.size_2d.output_pitch);
-      for (uint32_t y = 0;
-           y < std::min(src.size_2d.block_height, src.size_2d.logical_height);
-           y++) {
-        TextureSwap(src.endianness, dest, src_mem, pitch);
-        src_mem += src.size_2d.input_pitch;
-        dest += src.size_2d.output_pitch;
-      }
-    }
+  // Tiled textures are converted by a compute dispatch when possible,
+  // otherwise conversion happens on the CPU.
+  uint8_t* staging_data = reinterpret_cast<uint8_t*>(alloc->host_ptr);
+  if (converted_data) {
+    std::memcpy(staging_data, converted_data, unpack_length);
+  } else if (!src.is_tiled) {
+    ConvertTexture2D(src, staging_data, unpack_length, first_row, end_row);
   } else {
-    // Untile image.
-    // We could do this in a shader to speed things up, as this is pretty slow.
-
-    // TODO(benvanik): optimize this inner loop (or work by tiles).
-    const uint8_t* src_mem = reinterpret_cast<const uint8_t*>(host_address);
-    uint8_t* dest = reinterpret_cast<uint8_t*>(alloc->host_ptr);
     uint32_t bytes_per_block = src.format_info->block_width *
                                src.format_info->block_height *
                                src.format_info->bits_per_pixel / 8;
@@ -833,27 +1946,26 @@ bool TextureCache::UploadTexture2D(
     TextureInfo::GetPackedTileOffset(src, &offset_x, &offset_y);
     auto bpp = (bytes_per_block >> 2) +
                ((bytes_per_block >> 1) >> (bytes_per_block >> 2));
-    for (uint32_t y = 0, output_base_offset = 0;
-         y < std::min(src.size_2d.block_height, src.size_2d.logical_height);
-         y++, output_base_offset += src.size_2d.output_pitch) {
-      auto input_base_offset = TextureInfo::TiledOffset2DOuter(
-          offset_y + y,
-          (src.size_2d.input_width / src.format_info->block_width), bpp);
-      for (uint32_t x = 0, output_offset = output_base_offset;
-           x < src.size_2d.block_width; x++, output_offset += bytes_per_block) {
-        auto input_offset =
-            TextureInfo::TiledOffset2DInner(offset_x + x, offset_y + y, bpp,
-                                            input_base_offset) >>
-            bpp;
-        TextureSwap(src.endianness, dest + output_offset,
-                    src_mem + input_offset * bytes_per_block, bytes_per_block);
-      }
+    // The shader works in dwords, so only blocks of 4, 8 or 16 bytes can be
+    // untiled on the GPU. The transfer queue may not support compute at all.
+    if (!untile_pipeline_ || on_transfer_queue || (bytes_per_block & 3) ||
+        !UntileTexture2D(command_buffer, completion_fence, src, alloc,
+                         bytes_per_block, offset_x, offset_y + first_row,
+                         end_row - first_row, bpp)) {
+      ConvertTexture2D(src, staging_data, unpack_length, first_row,
+                       end_row);
     }
   }
 
-  staging_buffer_.Flush(alloc);
+  staging_buffer.Flush(alloc);
 
-  // Transition the texture into a transfer destination layout.
+  // Transition the texture into a transfer destination layout. Reuploads must
+  // also wait for earlier draws sampling it.
+  VkPipelineStageFlags src_stage_mask = VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT;
+  if (dest->image_layout == VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL) {
+    src_stage_mask = VK_PIPELINE_STAGE_VERTEX_SHADER_BIT |
+                     VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT;
+  }
   VkImageMemoryBarrier barrier;
   barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
   barrier.pNext = nullptr;
@@ -866,20 +1978,23 @@ bool TextureCache::UploadTexture2D(
   barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
   barrier.image = dest->image;
   barrier.subresourceRange = {VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1};
-  vkCmdPipelineBarrier(command_buffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
-                       VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, 0, 0, nullptr, 0,
+  vkCmdPipelineBarrier(command_buffer, src_stage_mask,
+                       VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, nullptr, 0,
                        nullptr, 1, &barrier);
 
   // Now move the converted texture into the destination.
+  uint32_t copy_y = first_row * src.format_info->block_height;
+  uint32_t copy_height =
+      std::min((end_row - first_row) * src.format_info->block_height,
+               src.size_2d.output_height - copy_y);
   VkBufferImageCopy copy_region;
   copy_region.bufferOffset = alloc->offset;
   copy_region.bufferRowLength = src.size_2d.output_width;
-  copy_region.bufferImageHeight = src.size_2d.output_height;
+  copy_region.bufferImageHeight = copy_height;
   copy_region.imageSubresource = {VK_IMAGE_ASPECT_COLOR_BIT, 0, 0, 1};
-  copy_region.imageOffset = {0, 0, 0};
-  copy_region.imageExtent = {src.size_2d.output_width,
-                             src.size_2d.output_height, 1};
-  vkCmdCopyBufferToImage(command_buffer, staging_buffer_.gpu_buffer(),
+  copy_region.imageOffset = {0, int32_t(copy_y), 0};
+  copy_region.imageExtent = {src.size_2d.output_width, copy_height, 1};
+  vkCmdCopyBufferToImage(command_buffer, staging_buffer.gpu_buffer(),
                          dest->image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1,
                          &copy_region);
 
@@ -888,19 +2003,101 @@ bool TextureCache::UploadTexture2D(
   barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
   barrier.oldLayout = barrier.newLayout;
   barrier.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
-  vkCmdPipelineBarrier(command_buffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
-                       VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, 0, 0, nullptr, 0,
-                       nullptr, 1, &barrier);
+  if (on_transfer_queue) {
+    // Shader stages don't exist on the transfer queue. The graphics
+    // submission waits on a semaphore signaled after this, which also makes
+    // the copy visible to it.
+    barrier.dstAccessMask = 0;
+    vkCmdPipelineBarrier(command_buffer, VK_PIPELINE_STAGE_TRANSFER_BIT,
+                         VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0, 0, nullptr,
+                         0, nullptr, 1, &barrier);
+  } else {
+    vkCmdPipelineBarrier(command_buffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
+                         VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, 0, 0, nullptr, 0,
+                         nullptr, 1, &barrier);
+  }
 
   dest->image_layout = barrier.newLayout;
+  ++upload_count_;
+  return true;
+}
+
+bool TextureCache::UntileTexture2D(
+    VkCommandBuffer command_buffer,
+    std::shared_ptr<ui::vulkan::Fence> completion_fence,
+    const TextureInfo& src,
+    const ui::vulkan::CircularBuffer::Allocation* output,
+    uint32_t bytes_per_block, uint32_t offset_x, uint32_t offset_y,
+    uint32_t row_count, uint32_t log_bpp) {
+  auto input = staging_buffer_.Acquire(src.input_length, completion_fence);
+  if (!input) {
+    return false;
+  }
+  std::memcpy(input->host_ptr, memory_->TranslatePhysical(src.guest_address),
+              src.input_length);
+  staging_buffer_.Flush(input);
+
+  VkBufferMemoryBarrier barrier;
+  barrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+  barrier.pNext = nullptr;
+  barrier.srcAccessMask = VK_ACCESS_HOST_WRITE_BIT;
+  barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+  barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+  barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+  barrier.buffer = staging_buffer_.gpu_buffer();
+  barrier.offset = input->offset;
+  barrier.size = input->aligned_length;
+  vkCmdPipelineBarrier(command_buffer, VK_PIPELINE_STAGE_HOST_BIT,
+                       VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 0, nullptr, 1,
+                       &barrier, 0, nullptr);
+
+  // Allocations are aligned to staging_buffer_.alignment(), so offsets are
+  // always whole dwords.
+  UntileConstants constants;
+  constants.tiled_offset = uint32_t(input->offset / 4);
+  constants.tiled_length = (src.input_length + 3) / 4;
+  constants.linear_offset = uint32_t(output->offset / 4);
+  constants.linear_pitch = src.size_2d.output_pitch / 4;
+  constants.block_width = src.size_2d.block_width;
+  constants.block_height = row_count;
+  constants.offset_x = offset_x;
+  constants.offset_y = offset_y;
+  constants.input_width =
+      src.size_2d.input_width / src.format_info->block_width;
+  constants.log_bpp = log_bpp;
+  constants.block_dwords = bytes_per_block / 4;
+  constants.endianness = uint32_t(src.endianness);
+
+  vkCmdBindPipeline(command_buffer, VK_PIPELINE_BIND_POINT_COMPUTE,
+                    untile_pipeline_);
+  vkCmdBindDescriptorSets(command_buffer, VK_PIPELINE_BIND_POINT_COMPUTE,
+                          untile_pipeline_layout_, 0, 1,
+                          &untile_descriptor_set_, 0, nullptr);
+  vkCmdPushConstants(command_buffer, untile_pipeline_layout_,
+                     VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(constants),
+                     &constants);
+  vkCmdDispatch(command_buffer, xe::round_up(constants.block_width, 8) / 8,
+                xe::round_up(constants.block_height, 8) / 8, 1);
+
+  // Make the untiled data visible to the copy into the image.
+  barrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+  barrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+  barrier.offset = output->offset;
+  barrier.size = output->aligned_length;
+  vkCmdPipelineBarrier(command_buffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                       VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, nullptr, 1,
+                       &barrier, 0, nullptr);
   return true;
 }
 
 VkDescriptorSet TextureCache::PrepareTextureSet(
     VkCommandBuffer command_buffer,
     std::shared_ptr<ui::vulkan::Fence> completion_fence,
+    VkCommandBuffer transfer_command_buffer,
+    std::shared_ptr<ui::vulkan::Fence> transfer_fence,
     const std::vector<Shader::TextureBinding>& vertex_bindings,
-    const std::vector<Shader::TextureBinding>& pixel_bindings) {
+    const std::vector<Shader::TextureBinding>& pixel_bindings,
+    uint32_t* sampler_indices) {
   // Clear state.
   auto update_set_info = &update_set_info_;
   update_set_info->has_setup_fetch_mask = 0;
@@ -913,17 +2110,57 @@ VkDescriptorSet TextureCache::PrepareTextureSet(
   // shaders.
   bool any_failed = false;
   any_failed = !SetupTextureBindings(command_buffer, completion_fence,
+                                     transfer_command_buffer, transfer_fence,
                                      update_set_info, vertex_bindings) ||
                any_failed;
   any_failed = !SetupTextureBindings(command_buffer, completion_fence,
+                                     transfer_command_buffer, transfer_fence,
                                      update_set_info, pixel_bindings) ||
                any_failed;
   if (any_failed) {
     XELOGW("Failed to setup one or more texture bindings");
     // TODO(benvanik): actually bail out here?
   }
+  // Read by the shaders as little-endian words.
+  std::memcpy(sampler_indices, update_set_info->sampler_indices,
+              sizeof(update_set_info->sampler_indices));
+
+  // Draws mostly bind the same textures as earlier ones, so look for a set
+  // written with the same images and samplers. Unused parts of the image
+  // writes have been cleared, so they can be hashed and compared as bytes.
+  // Immutable samplers aren't in the writes, so they don't split sets.
+  auto image_infos = update_set_info->image_infos;
+  uint32_t image_write_count = update_set_info->image_write_count;
+  size_t image_infos_size = image_write_count * sizeof(image_infos[0]);
+  uint64_t hash = XXH64(image_infos, image_infos_size, 0);
+  auto range = texture_sets_.equal_range(hash);
+  for (auto it = range.first; it != range.second; ++it) {
+    auto& entry = it->second;
+    if (entry.image_infos.size() == image_write_count &&
+        !std::memcmp(entry.image_infos.data(), image_infos,
+                     image_infos_size)) {
+      entry.in_flight_fence = completion_fence;
+      return entry.set;
+    }
+  }
+
+  if (texture_sets_.size() >= kMaxCachedTextureSets) {
+    RetireTextureSets();
+  }
+  auto descriptor_set = WriteTextureSet(update_set_info);
+  if (!descriptor_set) {
+    return nullptr;
+  }
+  CachedTextureSet entry;
+  entry.set = descriptor_set;
+  entry.image_infos.assign(image_infos, image_infos + image_write_count);
+  entry.in_flight_fence = completion_fence;
+  texture_sets_.insert({hash, std::move(entry)});
+  return descriptor_set;
+}
 
-  // TODO(benvanik): reuse.
+VkDescriptorSet TextureCache::WriteTextureSet(
+    const UpdateSetInfo* update_set_info) {
   VkDescriptorSet descriptor_set = nullptr;
   VkDescriptorSetAllocateInfo set_alloc_info;
   set_alloc_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
@@ -1000,22 +2237,86 @@ VkDescriptorSet TextureCache::PrepareTextureSet(
 
     write_info.dstArrayElement = update_info.tf_binding_base;
     write_info.descriptorCount = uint32_t(update_info.infos.size());
-    write_info.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+    write_info.descriptorType = VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE;
     write_info.pImageInfo = update_info.infos.data();
   }
 
+  // Samplers of the fetch constants not using the immutable sampler table.
+  for (uint32_t i = 0; i < update_set_info->image_write_count; i++) {
+    auto& image_info = update_set_info->image_infos[i];
+    if (!image_info.info.sampler) {
+      continue;
+    }
+    VkWriteDescriptorSet write_info;
+    std::memset(&write_info, 0, sizeof(VkWriteDescriptorSet));
+    write_info.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+    write_info.dstSet = descriptor_set;
+    write_info.dstBinding = 5;
+    write_info.dstArrayElement = image_info.tf_binding;
+    write_info.descriptorCount = 1;
+    write_info.descriptorType = VK_DESCRIPTOR_TYPE_SAMPLER;
+    write_info.pImageInfo = &image_info.info;
+    descriptor_writes.push_back(write_info);
+  }
+
   if (descriptor_writes.size() > 0) {
     vkUpdateDescriptorSets(*device_, uint32_t(descriptor_writes.size()),
                            descriptor_writes.data(), 0, nullptr);
   }
 
-  in_flight_sets_.push_back({descriptor_set, completion_fence});
   return descriptor_set;
 }
 
+void TextureCache::FreeTextureSets(const Texture* texture) {
+  for (auto it = texture_sets_.begin(); it != texture_sets_.end();) {
+    bool uses_texture = false;
+    for (auto& image_info : it->second.image_infos) {
+      for (auto& view : texture->views) {
+        uses_texture |= image_info.info.imageView == view->view;
+      }
+    }
+    if (uses_texture) {
+      vkFreeDescriptorSets(*device_, descriptor_pool_, 1, &it->second.set);
+      it = texture_sets_.erase(it);
+    } else {
+      ++it;
+    }
+  }
+}
+
+void TextureCache::RetireTextureSets() {
+  // The pool only has room for one batch of retired sets besides the cached
+  // ones, so the last batch has to be freed first as far as it can be.
+  ScavengeTextureSets();
+  for (auto& it : texture_sets_) {
+    auto& fence = it.second.in_flight_fence;
+    if (!fence || fence->status() == VK_SUCCESS) {
+      vkFreeDescriptorSets(*device_, descriptor_pool_, 1, &it.second.set);
+    } else {
+      in_flight_sets_.push_back({it.second.set, fence});
+    }
+  }
+  texture_sets_.clear();
+}
+
+void TextureCache::ScavengeTextureSets() {
+  // Retired in hash order rather than in the order their fences complete,
+  // so every set has to be checked.
+  for (auto it = in_flight_sets_.begin(); it != in_flight_sets_.end();) {
+    if (vkGetFenceStatus(*device_, *it->second) == VK_SUCCESS) {
+      vkFreeDescriptorSets(*device_, descriptor_pool_, 1, &it->first);
+      it = in_flight_sets_.erase(it);
+    } else {
+      ++it;
+    }
+  }
+}
+
 bool TextureCache::SetupTextureBindings(
     VkCommandBuffer command_buffer,
     std::shared_ptr<ui::vulkan::Fence> completion_fence,
+    VkCommandBuffer transfer_command_buffer,
+    std::shared_ptr<ui::vulkan::Fence> transfer_fence,
     UpdateSetInfo* update_set_info,
     const std::vector<Shader::TextureBinding>& bindings) {
   bool any_failed = false;
@@ -1023,9 +2324,11 @@ bool TextureCache::SetupTextureBindings(
     uint32_t fetch_bit = 1 << binding.fetch_constant;
     if ((update_set_info->has_setup_fetch_mask & fetch_bit) == 0) {
       // Needs setup.
-      any_failed = !SetupTextureBinding(command_buffer, completion_fence,
-                                        update_set_info, binding) ||
-                   any_failed;
+      any_failed =
+          !SetupTextureBinding(command_buffer, completion_fence,
+                               transfer_command_buffer, transfer_fence,
+                               update_set_info, binding) ||
+          any_failed;
       update_set_info->has_setup_fetch_mask |= fetch_bit;
     }
   }
@@ -1035,6 +2338,8 @@ bool TextureCache::SetupTextureBindings(
 bool TextureCache::SetupTextureBinding(
     VkCommandBuffer command_buffer,
     std::shared_ptr<ui::vulkan::Fence> completion_fence,
+    VkCommandBuffer transfer_command_buffer,
+    std::shared_ptr<ui::vulkan::Fence> transfer_fence,
     UpdateSetInfo* update_set_info, const Shader::TextureBinding& binding) {
 #if FINE_GRAINED_DRAW_SCOPES
   SCOPE_profile_cpu_f("gpu");
@@ -1064,15 +2369,26 @@ bool TextureCache::SetupTextureBinding(
     return false;  // invalid texture used
   }
 
-  auto texture = Demand(texture_info, command_buffer, completion_fence);
-  auto sampler = Demand(sampler_info);
-  // assert_true(texture != nullptr && sampler != nullptr);
-  if (texture == nullptr || sampler == nullptr) {
+  auto texture = Demand(texture_info, command_buffer, completion_fence,
+                        transfer_command_buffer, transfer_fence);
+  // Only samplers missing from the immutable sampler table are bound.
+  auto sampler_index =
+      GetImmutableSamplerIndex(sampler_info, texture_info.dimension);
+  Sampler* sampler = nullptr;
+  if (sampler_index == kSpirvFetchSamplerIndex) {
+    sampler = Demand(sampler_info);
+    if (sampler == nullptr) {
+      return false;
+    }
+  }
+  // assert_true(texture != nullptr);
+  if (texture == nullptr) {
     return false;
   }
 
   uint16_t swizzle = static_cast<uint16_t>(fetch.swizzle);
-  auto view = DemandView(texture, swizzle);
+  auto view =
+      DemandView(texture, swizzle, GetViewFormat(texture, texture_info));
 
   trace_writer_->WriteMemoryRead(texture_info.guest_address,
                                  texture_info.input_length);
@@ -1083,8 +2399,11 @@ bool TextureCache::SetupTextureBinding(
   image_write->tf_binding = binding.fetch_constant;
   image_write->info.imageView = view->view;
   image_write->info.imageLayout = texture->image_layout;
-  image_write->info.sampler = sampler->sampler;
+  image_write->info.sampler = sampler ? sampler->sampler : nullptr;
+  update_set_info->sampler_indices[binding.fetch_constant] =
+      uint8_t(sampler_index);
   texture->in_flight_fence = completion_fence;
+  texture->last_used_frame = frame_number_;
 
   return true;
 }
@@ -1093,22 +2412,75 @@ void TextureCache::ClearCache() {
   // TODO(DrChat): Nuke everything.
 }
 
-void TextureCache::Scavenge() {
-  // Free unused descriptor sets
-  for (auto it = in_flight_sets_.begin(); it != in_flight_sets_.end();) {
-    if (vkGetFenceStatus(*device_, *it->second) == VK_SUCCESS) {
-      // We can free this one.
-      vkFreeDescriptorSets(*device_, descriptor_pool_, 1, &it->first);
-      it = in_flight_sets_.erase(it);
-      continue;
-    }
+void TextureCache::EndFrame() {
+  SCOPE_profile_cpu_f("gpu");
 
-    // We've encountered an item that hasn't been used yet, so any items
-    // afterwards are guaranteed to be unused.
-    break;
+  uint64_t budget = uint64_t(std::max(FLAGS_texture_cache_budget, 0)) << 20;
+  uint64_t cached_bytes = resident_bytes_;
+  for (auto texture : pending_delete_textures_) {
+    cached_bytes -= texture->memory_size;
+  }
+  if (budget && cached_bytes > budget) {
+    // Resolve targets hold what the GPU drew and can't be uploaded again.
+    std::vector<Texture*> candidates;
+    for (auto& it : textures_) {
+      auto texture = it.second;
+      if (texture->last_used_frame < frame_number_ &&
+          !texture->is_format_mutable) {
+        candidates.push_back(texture);
+      }
+    }
+    std::sort(candidates.begin(), candidates.end(),
+              [](const Texture* a, const Texture* b) {
+                return a->last_used_frame < b->last_used_frame;
+              });
+    for (auto texture : candidates) {
+      if (cached_bytes <= budget) {
+        break;
+      }
+      CancelAsyncUpload(texture);
+      // Stop the write watch from queueing it once it's gone.
+      if (texture->access_watch_handle) {
+        dirty_page_tracker_->CancelWatch(texture->access_watch_handle);
+        texture->access_watch_handle = 0;
+      }
+      {
+        std::lock_guard<std::mutex> lock(invalidated_textures_mutex_);
+        for (auto& invalidated_textures : invalidated_textures_sets_) {
+          invalidated_textures.erase(
+              std::remove(invalidated_textures.begin(),
+                          invalidated_textures.end(), texture),
+              invalidated_textures.end());
+        }
+      }
+      textures_.erase(texture->texture_info.hash());
+      pending_delete_textures_.push_back(texture);
+      cached_bytes -= texture->memory_size;
+      ++eviction_count_;
+    }
   }
 
+  frame_upload_count_ = upload_count_;
+  upload_count_ = 0;
+  ++frame_number_;
+
+  COUNT_profile_cpu("gpu/texture_cache/textures", int(texture_count_));
+  COUNT_profile_cpu("gpu/texture_cache/resident_mb",
+                    int(resident_bytes_ >> 20));
+  COUNT_profile_cpu("gpu/texture_cache/uploads", int(frame_upload_count_));
+  COUNT_profile_cpu("gpu/texture_cache/evictions", int(eviction_count_));
+}
+
+void TextureCache::Scavenge() {
+  // Free unused descriptor sets
+  ScavengeTextureSets();
+
+  // Before the staging memory they're in is freed.
+  FlushResolveWritebacks();
   staging_buffer_.Scavenge();
+  if (device_->transfer_queue()) {
+    transfer_staging_buffer_.Scavenge();
+  }
 
   // Kill all pending delete textures.
   if (!pending_delete_textures_.empty()) {
@@ -1134,6 +2506,10 @@ void TextureCache::Scavenge() {
   if (!invalidated_textures.empty()) {
     for (auto it = invalidated_textures.begin();
          it != invalidated_textures.end(); ++it) {
+      if (!(*it)->content_hashes.empty() || (*it)->async_upload) {
+        // Refreshed in place, or converted again, by Demand when next used.
+        continue;
+      }
       pending_delete_textures_.push_back(*it);
       textures_.erase((*it)->texture_info.hash());
     }
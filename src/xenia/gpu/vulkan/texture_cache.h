@@ -10,8 +10,15 @@
 #ifndef XENIA_GPU_VULKAN_TEXTURE_CACHE_H_
 #define XENIA_GPU_VULKAN_TEXTURE_CACHE_H_
 
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
 #include <unordered_map>
+#include <vector>
 
+#include "xenia/base/threading.h"
+#include "xenia/gpu/dirty_page_tracker.h"
 #include "xenia/gpu/register_file.h"
 #include "xenia/gpu/sampler_info.h"
 #include "xenia/gpu/shader.h"
@@ -31,6 +38,7 @@ namespace vulkan {
 class TextureCache {
  public:
   struct TextureView;
+  struct AsyncUpload;
 
   // This represents an uploaded Vulkan texture.
   struct Texture {
@@ -42,22 +50,37 @@ class TextureCache {
     // this texture)
     bool is_full_texture;
     VkFormat format;
+    // Resolve targets are created with a mutable format, so that they can be
+    // sampled as any uncompressed format with the same bits per pixel.
+    bool is_format_mutable;
+    uint32_t bits_per_pixel;
+    // Scale of the image's width and height relative to the guest texture.
+    // Only resolve targets are scaled, and they are never uploaded to, as
+    // the guest data is at the unscaled size.
+    uint32_t resolution_scale;
     VkImage image;
     VkImageLayout image_layout;
-    VkDeviceMemory image_memory;
-    VkDeviceSize memory_offset;
+    // Sub-allocated from the device memory allocator.
+    ui::vulkan::MemoryAllocator::Allocation image_memory;
     VkDeviceSize memory_size;
 
     uintptr_t access_watch_handle;
     bool pending_invalidation;
+    // Hash of each page of guest data, if the texture was uploaded from it.
+    std::vector<uint64_t> content_hashes;
 
     // Pointer to the latest usage fence.
     std::shared_ptr<ui::vulkan::Fence> in_flight_fence;
+    // Frame the texture was last bound in, for eviction under the budget.
+    uint64_t last_used_frame;
+    // Conversion on an async upload thread, until the texture is uploaded.
+    std::shared_ptr<AsyncUpload> async_upload;
   };
 
   struct TextureView {
     Texture* texture;
     VkImageView view;
+    VkFormat format;
 
     union {
       struct {
@@ -73,12 +96,15 @@ class TextureCache {
     };
   };
 
-  TextureCache(Memory* memory, RegisterFile* register_file,
-               TraceWriter* trace_writer, ui::vulkan::VulkanDevice* device);
+  TextureCache(Memory* memory, DirtyPageTracker* dirty_page_tracker,
+               RegisterFile* register_file, TraceWriter* trace_writer,
+               ui::vulkan::VulkanDevice* device);
   ~TextureCache();
 
   // Descriptor set layout containing all possible texture bindings.
-  // The set contains one descriptor for each texture sampler [0-31].
+  // The set contains one image descriptor for each fetch constant [0-31] of
+  // every dimension, the immutable sampler table, and one sampler for each
+  // fetch constant, only bound if none of the table matches it.
   VkDescriptorSetLayout texture_descriptor_set_layout() const {
     return texture_descriptor_set_layout_;
   }
@@ -87,11 +113,21 @@ class TextureCache {
   // bindings. The textures will be uploaded/converted/etc as needed.
   // Requires a fence to be provided that will be signaled when finished
   // using the returned descriptor set.
+  // Sets are cached by the images and samplers bound, so the same set may be
+  // returned again for later draws.
+  // The immutable sampler index of every fetch constant is written to
+  // sampler_indices, to be pushed at kSpirvPushConstantSamplerIndicesOffset.
+  // If a command buffer for the device transfer queue is given, new textures
+  // are uploaded with it instead, and it must be submitted before
+  // setup_command_buffer, which waits on it.
   VkDescriptorSet PrepareTextureSet(
       VkCommandBuffer setup_command_buffer,
       std::shared_ptr<ui::vulkan::Fence> completion_fence,
+      VkCommandBuffer transfer_command_buffer,
+      std::shared_ptr<ui::vulkan::Fence> transfer_fence,
       const std::vector<Shader::TextureBinding>& vertex_bindings,
-      const std::vector<Shader::TextureBinding>& pixel_bindings);
+      const std::vector<Shader::TextureBinding>& pixel_bindings,
+      uint32_t* sampler_indices);
 
   // TODO(benvanik): UploadTexture.
   // TODO(benvanik): Resolve.
@@ -116,14 +152,49 @@ class TextureCache {
   // must have an offset applied. If so, the caller must handle this.
   // At the very least, it's guaranteed that the image will be large enough to
   // hold the requested size.
+  // New textures are created resolution_scale times the size, and textures
+  // returned may be of any scale.
   Texture* DemandResolveTexture(const TextureInfo& texture_info,
-                                TextureFormat format, VkOffset2D* out_offset);
+                                TextureFormat format, VkOffset2D* out_offset,
+                                uint32_t resolution_scale = 1);
+
+  // Writes what a resolve blitted into the extent at offset of the texture
+  // back to guest memory, for titles reading resolves with the CPU. The
+  // texels are tiled and swapped into staging memory by a compute shader, and
+  // copied to guest memory once the batch is done, unless the guest has
+  // written the texture's memory since. Does nothing without
+  // --vulkan_resolve_writeback or for textures that can't be tiled that way.
+  void WriteBackResolve(VkCommandBuffer command_buffer,
+                        std::shared_ptr<ui::vulkan::Fence> completion_fence,
+                        Texture* texture, Endian128 endian, VkOffset2D offset,
+                        VkExtent2D extent);
+  // Makes the writebacks of the batch visible to the host, recorded into the
+  // last command buffer of the batch.
+  void EndBatch(VkCommandBuffer command_buffer);
+  // Writebacks of a batch that was dropped are never made.
+  void CancelBatch();
+  // Copies the writebacks of the batches that are done to guest memory. Also
+  // done by Scavenge.
+  void FlushResolveWritebacks();
 
   // Clears all cached content.
   void ClearCache();
 
   // Frees any unused resources
   void Scavenge();
+  // Ends a frame, evicting the least recently used textures not bound in it
+  // while over --texture_cache_budget. Call before Scavenge.
+  void EndFrame();
+
+  // Demands that found an existing texture and ones that had to create one.
+  uint64_t hit_count() const { return hit_count_; }
+  uint64_t miss_count() const { return miss_count_; }
+  // Residency, including textures evicted but still in flight.
+  size_t texture_count() const { return texture_count_; }
+  uint64_t resident_bytes() const { return resident_bytes_; }
+  // Uploads in the last frame ended and textures evicted over the budget.
+  uint32_t frame_upload_count() const { return frame_upload_count_; }
+  uint64_t eviction_count() const { return eviction_count_; }
 
  private:
   struct UpdateSetInfo;
@@ -134,36 +205,131 @@ class TextureCache {
     VkSampler sampler;
   };
 
+  struct ResolveWriteback {
+    // Null once the texture is freed, which drops the writeback.
+    Texture* texture;
+    uint32_t guest_address;
+    uint32_t length;
+    // Of the tiled data in staging_buffer_.
+    VkDeviceSize offset;
+    std::shared_ptr<ui::vulkan::Fence> fence;
+  };
+
   // Allocates a new texture and memory to back it on the GPU.
-  Texture* AllocateTexture(const TextureInfo& texture_info);
+  Texture* AllocateTexture(const TextureInfo& texture_info,
+                           bool format_mutable = false,
+                           uint32_t resolution_scale = 1);
   bool FreeTexture(Texture* texture);
 
   // Demands a texture. If command_buffer is null and the texture hasn't been
   // uploaded to graphics memory already, we will return null and bail.
+  // New textures are uploaded with transfer_command_buffer if one is given.
   Texture* Demand(
       const TextureInfo& texture_info, VkCommandBuffer command_buffer = nullptr,
-      std::shared_ptr<ui::vulkan::Fence> completion_fence = nullptr);
-  TextureView* DemandView(Texture* texture, uint16_t swizzle);
+      std::shared_ptr<ui::vulkan::Fence> completion_fence = nullptr,
+      VkCommandBuffer transfer_command_buffer = nullptr,
+      std::shared_ptr<ui::vulkan::Fence> transfer_fence = nullptr);
+  TextureView* DemandView(Texture* texture, uint16_t swizzle, VkFormat format);
+  // Format to view a texture with when sampled as described by texture_info,
+  // which may differ from the texture's own for resolve targets.
+  static VkFormat GetViewFormat(const Texture* texture,
+                                const TextureInfo& texture_info);
   Sampler* Demand(const SamplerInfo& sampler_info);
-
+  static bool GetSamplerCreateInfo(const SamplerInfo& sampler_info,
+                                   VkSamplerCreateInfo* out_create_info);
+  // Creates the samplers of the immutable sampler table, for every filter
+  // with repeat, mirrored repeat or clamp to edge addressing.
+  void InitializeImmutableSamplers();
+  // Returns the index of the immutable sampler to sample a texture of the
+  // dimension with, or kSpirvFetchSamplerIndex if there's none.
+  static uint32_t GetImmutableSamplerIndex(const SamplerInfo& sampler_info,
+                                           Dimension dimension);
+
+  // Converts rows of blocks [first_row, end_row) of a 2D texture from guest
+  // memory into length bytes at dest on the CPU.
+  void ConvertTexture2D(const TextureInfo& src, uint8_t* dest, size_t length,
+                        uint32_t first_row, uint32_t end_row) const;
   // Queues commands to upload a texture from system memory, applying any
   // conversions necessary. This may flush the command buffer to the GPU if we
   // run out of staging memory.
+  // If row_count is non-zero only those rows of blocks are uploaded, keeping
+  // the rest of the image.
+  // Commands for the transfer queue may only upload whole, unused textures,
+  // and are converted on the CPU.
+  // If converted_data is given, it's the whole texture already converted by
+  // ConvertTexture2D, and is copied as-is.
   bool UploadTexture2D(VkCommandBuffer command_buffer,
                        std::shared_ptr<ui::vulkan::Fence> completion_fence,
-                       Texture* dest, TextureInfo src);
+                       Texture* dest, TextureInfo src,
+                       bool on_transfer_queue = false, uint32_t first_row = 0,
+                       uint32_t row_count = 0,
+                       const uint8_t* converted_data = nullptr);
+  // Puts a write watch on the guest data of a full texture, invalidating it
+  // when touched.
+  void WatchTexture(Texture* texture);
+  // Watches a texture only known from resolves, which is destroyed once
+  // touched.
+  void WatchResolveTexture(Texture* texture);
+  // Brings an invalidated texture up to date in place by reuploading only the
+  // rows whose guest data changed. Returns false if it has to be replaced.
+  bool RefreshTexture(Texture* texture, VkCommandBuffer command_buffer,
+                      std::shared_ptr<ui::vulkan::Fence> completion_fence);
+
+  // Returns the 1x1 black texture of the format of texture_info, sampled in
+  // place of textures still being converted by an async upload thread.
+  Texture* DemandPlaceholder(
+      const TextureInfo& texture_info, VkCommandBuffer command_buffer,
+      std::shared_ptr<ui::vulkan::Fence> completion_fence);
+  // Uploads a texture once its async conversion is done, or converts it
+  // right away if it was written in the meantime. Returns false if it's
+  // still being converted.
+  bool FinishAsyncUpload(Texture* texture, VkCommandBuffer command_buffer,
+                         std::shared_ptr<ui::vulkan::Fence> completion_fence);
+  // Drops the texture's async upload, unstarted or not, when it goes away.
+  void CancelAsyncUpload(Texture* texture);
+  void AsyncUploadThreadMain();
+
+  // Creates the compute pipelines used by UntileTexture2D and
+  // WriteBackResolve. Leaves them null if that isn't possible.
+  void InitializeUntilePipeline();
+  // Copies the raw guest data of a tiled texture into staging memory and
+  // records a dispatch untiling and swapping row_count rows of blocks, starting
+  // at offset_y, into output. Returns false if there was no staging memory for
+  // the guest data.
+  bool UntileTexture2D(VkCommandBuffer command_buffer,
+                       std::shared_ptr<ui::vulkan::Fence> completion_fence,
+                       const TextureInfo& src,
+                       const ui::vulkan::CircularBuffer::Allocation* output,
+                       uint32_t bytes_per_block, uint32_t offset_x,
+                       uint32_t offset_y, uint32_t row_count,
+                       uint32_t log_bpp);
 
   bool SetupTextureBindings(
       VkCommandBuffer command_buffer,
       std::shared_ptr<ui::vulkan::Fence> completion_fence,
+      VkCommandBuffer transfer_command_buffer,
+      std::shared_ptr<ui::vulkan::Fence> transfer_fence,
       UpdateSetInfo* update_set_info,
       const std::vector<Shader::TextureBinding>& bindings);
   bool SetupTextureBinding(VkCommandBuffer command_buffer,
                            std::shared_ptr<ui::vulkan::Fence> completion_fence,
+                           VkCommandBuffer transfer_command_buffer,
+                           std::shared_ptr<ui::vulkan::Fence> transfer_fence,
                            UpdateSetInfo* update_set_info,
                            const Shader::TextureBinding& binding);
+  // Allocates a descriptor set and writes the images in update_set_info.
+  VkDescriptorSet WriteTextureSet(const UpdateSetInfo* update_set_info);
+  // Frees the cached descriptor sets referencing views of the texture, which
+  // must no longer be in flight.
+  void FreeTextureSets(const Texture* texture);
+  // Frees the cached descriptor sets the GPU is done with and moves the rest
+  // to in_flight_sets_, to be freed once it is.
+  void RetireTextureSets();
+  // Frees the sets in in_flight_sets_ whose fences have completed.
+  void ScavengeTextureSets();
 
   Memory* memory_ = nullptr;
+  DirtyPageTracker* dirty_page_tracker_ = nullptr;
 
   RegisterFile* register_file_ = nullptr;
   TraceWriter* trace_writer_ = nullptr;
@@ -175,8 +341,28 @@ class TextureCache {
       in_flight_sets_;
 
   ui::vulkan::CircularBuffer staging_buffer_;
+  // Staging memory for uploads on the transfer queue, if the device has one.
+  ui::vulkan::CircularBuffer transfer_staging_buffer_;
+
+  // Compute untiling and tiling, reading and writing the whole staging
+  // buffer.
+  VkDescriptorSetLayout untile_descriptor_set_layout_ = nullptr;
+  VkDescriptorSet untile_descriptor_set_ = nullptr;
+  VkPipelineLayout untile_pipeline_layout_ = nullptr;
+  VkShaderModule untile_shader_module_ = nullptr;
+  VkPipeline untile_pipeline_ = nullptr;
+  VkShaderModule tile_shader_module_ = nullptr;
+  VkPipeline tile_pipeline_ = nullptr;
+
+  // In the order they were made.
+  std::deque<ResolveWriteback> resolve_writebacks_;
+  // Writebacks made since the last batch was ended or canceled.
+  size_t batch_writeback_count_ = 0;
+  bool warned_writeback_ = false;
+
   std::unordered_map<uint64_t, Texture*> textures_;
   std::unordered_map<uint64_t, Sampler*> samplers_;
+  std::vector<VkSampler> immutable_samplers_;
   std::vector<Texture*> resolve_textures_;
   std::list<Texture*> pending_delete_textures_;
 
@@ -187,6 +373,25 @@ class TextureCache {
   std::mutex invalidated_resolve_textures_mutex_;
   std::vector<Texture*> invalidated_resolve_textures_;
 
+  // Background conversion of new textures, if enabled.
+  std::vector<std::unique_ptr<xe::threading::Thread>> async_upload_threads_;
+  std::mutex async_upload_mutex_;
+  std::condition_variable async_upload_cond_;
+  std::deque<std::shared_ptr<AsyncUpload>> async_upload_queue_;
+  bool async_upload_shutdown_ = false;
+  // Placeholders by TextureFormat.
+  std::unordered_map<uint32_t, Texture*> placeholder_textures_;
+
+  uint64_t hit_count_ = 0;
+  uint64_t miss_count_ = 0;
+
+  uint64_t frame_number_ = 0;
+  size_t texture_count_ = 0;
+  uint64_t resident_bytes_ = 0;
+  uint32_t upload_count_ = 0;
+  uint32_t frame_upload_count_ = 0;
+  uint64_t eviction_count_ = 0;
+
   struct UpdateSetInfo {
     // Bitmap of all 32 fetch constants and whether they have been setup yet.
     // This prevents duplication across the vertex and pixel shader.
@@ -197,7 +402,17 @@ class TextureCache {
       uint32_t tf_binding;
       VkDescriptorImageInfo info;
     } image_infos[32];
+    uint8_t sampler_indices[32];
   } update_set_info_;
+
+  // Descriptor sets written for a combination of image writes, keyed by a
+  // hash of the writes. They're immutable once written.
+  struct CachedTextureSet {
+    VkDescriptorSet set;
+    std::vector<UpdateSetInfo::ImageSetInfo> image_infos;
+    std::shared_ptr<ui::vulkan::Fence> in_flight_fence;
+  };
+  std::unordered_multimap<uint64_t, CachedTextureSet> texture_sets_;
 };
 
 }  // namespace vulkan
@@ -0,0 +1,104 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2016 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#include "xenia/gpu/vulkan/timestamp_pool.h"
+
+#include <cstring>
+
+#include "xenia/base/logging.h"
+#include "xenia/ui/vulkan/vulkan_util.h"
+
+namespace xe {
+namespace gpu {
+namespace vulkan {
+
+using xe::ui::vulkan::CheckResult;
+
+TimestampPool::TimestampPool(ui::vulkan::VulkanDevice* device)
+    : device_(device) {
+  uint32_t valid_bits =
+      device_->device_info()
+          .queue_family_properties[device_->queue_family_index()]
+          .timestampValidBits;
+  float timestamp_period =
+      device_->device_info().properties.limits.timestampPeriod;
+  if (!valid_bits || timestamp_period <= 0.0f) {
+    XELOGW("Vulkan: timestamps unsupported, GPU profiling disabled");
+    return;
+  }
+  timestamp_mask_ = valid_bits >= 64 ? ~0ull : (1ull << valid_bits) - 1;
+  ticks_per_second_ = uint64_t(1000000000.0 / timestamp_period);
+
+  VkQueryPoolCreateInfo query_pool_info;
+  std::memset(&query_pool_info, 0, sizeof(query_pool_info));
+  query_pool_info.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+  query_pool_info.queryType = VK_QUERY_TYPE_TIMESTAMP;
+  query_pool_info.queryCount = kFrameCount * kQueriesPerFrame;
+  auto status =
+      vkCreateQueryPool(*device_, &query_pool_info, nullptr, &query_pool_);
+  CheckResult(status, "vkCreateQueryPool");
+  if (status != VK_SUCCESS) {
+    query_pool_ = nullptr;
+  }
+}
+
+TimestampPool::~TimestampPool() {
+  if (query_pool_) {
+    vkDestroyQueryPool(*device_, query_pool_, nullptr);
+    query_pool_ = nullptr;
+  }
+}
+
+void TimestampPool::BeginFrame(VkCommandBuffer command_buffer) {
+  if (!query_pool_) {
+    return;
+  }
+  // Queries handed out for work that was since discarded are reset again.
+  vkCmdResetQueryPool(command_buffer, query_pool_,
+                      (frame_index_ % kFrameCount) * kQueriesPerFrame,
+                      kQueriesPerFrame);
+  frame_begun_ = true;
+}
+
+void TimestampPool::EndFrame() {
+  frame_begun_ = false;
+  ++frame_index_;
+  frame_query_count_ = 0;
+}
+
+uint32_t TimestampPool::InsertTimestamp() {
+  if (!frame_begun_ || !command_buffer_ || !*command_buffer_ ||
+      frame_query_count_ >= kQueriesPerFrame) {
+    return kInvalidKey;
+  }
+  uint32_t key =
+      (frame_index_ % kFrameCount) * kQueriesPerFrame + frame_query_count_++;
+  vkCmdWriteTimestamp(*command_buffer_, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT,
+                      query_pool_, key);
+  return key;
+}
+
+uint64_t TimestampPool::GetTimestamp(uint32_t key) {
+  if (key == kInvalidKey) {
+    return last_timestamp_;
+  }
+  // Not waited for, as a query written for discarded work never completes.
+  uint64_t result[2];
+  auto status = vkGetQueryPoolResults(
+      *device_, query_pool_, key, 1, sizeof(result), result, sizeof(result),
+      VK_QUERY_RESULT_64_BIT | VK_QUERY_RESULT_WITH_AVAILABILITY_BIT);
+  if ((status == VK_SUCCESS || status == VK_NOT_READY) && result[1]) {
+    last_timestamp_ = result[0] & timestamp_mask_;
+  }
+  return last_timestamp_;
+}
+
+}  // namespace vulkan
+}  // namespace gpu
+}  // namespace xe
@@ -0,0 +1,71 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2016 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#ifndef XENIA_GPU_VULKAN_TIMESTAMP_POOL_H_
+#define XENIA_GPU_VULKAN_TIMESTAMP_POOL_H_
+
+#include "xenia/base/profiling.h"
+#include "xenia/ui/vulkan/vulkan.h"
+#include "xenia/ui/vulkan/vulkan_device.h"
+
+namespace xe {
+namespace gpu {
+namespace vulkan {
+
+// Timestamp queries for GPU profiling scopes, written to the command buffer
+// being recorded. Each frame has its own range of queries so that they can
+// still be looked up a few frames after they were used.
+class TimestampPool : public xe::GpuTimestampSource {
+ public:
+  explicit TimestampPool(ui::vulkan::VulkanDevice* device);
+  ~TimestampPool() override;
+
+  // False if the graphics queue doesn't support timestamps.
+  bool is_supported() const { return query_pool_ != nullptr; }
+
+  // Points at the command buffer timestamps are written to. Timestamps
+  // inserted while it's null are dropped.
+  void set_command_buffer(const VkCommandBuffer* command_buffer) {
+    command_buffer_ = command_buffer;
+  }
+  // Resets the queries of the current frame. Must be recorded outside of a
+  // render pass, ahead of every timestamp of the frame.
+  void BeginFrame(VkCommandBuffer command_buffer);
+  // Moves on to the queries of the next frame after the frame is submitted.
+  void EndFrame();
+
+  uint32_t InsertTimestamp() override;
+  uint64_t GetTimestamp(uint32_t key) override;
+  uint64_t ticks_per_second() const override { return ticks_per_second_; }
+
+ private:
+  // More than the frames the profiler waits before looking timestamps up.
+  static const uint32_t kFrameCount = 8;
+  static const uint32_t kQueriesPerFrame = 1024;
+  static const uint32_t kInvalidKey = UINT32_MAX;
+
+  ui::vulkan::VulkanDevice* device_ = nullptr;
+  VkQueryPool query_pool_ = nullptr;
+  uint64_t timestamp_mask_ = 0;
+  uint64_t ticks_per_second_ = 0;
+
+  const VkCommandBuffer* command_buffer_ = nullptr;
+  bool frame_begun_ = false;
+  uint32_t frame_index_ = 0;
+  uint32_t frame_query_count_ = 0;
+  // Returned for timestamps that were never written, as time mustn't go
+  // backwards for the profiler.
+  uint64_t last_timestamp_ = 0;
+};
+
+}  // namespace vulkan
+}  // namespace gpu
+}  // namespace xe
+
+#endif  // XENIA_GPU_VULKAN_TIMESTAMP_POOL_H_
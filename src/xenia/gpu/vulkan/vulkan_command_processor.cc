@@ -30,6 +30,12 @@ using namespace xe::gpu::xenos;
 using xe::ui::vulkan::CheckResult;
 
 constexpr size_t kDefaultBufferCacheCapacity = 256 * 1024 * 1024;
+// Draws handed to a recording thread at once when there are any. Every
+// secondary command buffer has to set all of its state again.
+constexpr uint32_t kDrawsPerRecording = 128;
+
+DEFINE_profile_gpu(vulkan_render_pass, "GPU", "RenderPass");
+DEFINE_profile_gpu(vulkan_swap, "GPU", "Swap");
 
 VulkanCommandProcessor::VulkanCommandProcessor(
     VulkanGraphicsSystem* graphics_system, kernel::KernelState* kernel_state)
@@ -52,6 +58,10 @@ void VulkanCommandProcessor::ClearCaches() {
 
   auto status = vkQueueWaitIdle(queue_);
   CheckResult(status, "vkQueueWaitIdle");
+  if (device_->transfer_queue()) {
+    status = vkQueueWaitIdle(device_->transfer_queue());
+    CheckResult(status, "vkQueueWaitIdle");
+  }
 
   buffer_cache_->ClearCache();
   pipeline_cache_->ClearCache();
@@ -59,6 +69,26 @@ void VulkanCommandProcessor::ClearCaches() {
   texture_cache_->ClearCache();
 }
 
+void VulkanCommandProcessor::GetCacheStats(
+    std::vector<CacheStats>* cache_stats) {
+  cache_stats->push_back(
+      {"texture", texture_cache_->hit_count(), texture_cache_->miss_count()});
+  cache_stats->push_back({"pipeline", pipeline_cache_->hit_count(),
+                          pipeline_cache_->miss_count()});
+  cache_stats->push_back(
+      {"buffer", buffer_cache_->hit_count(), buffer_cache_->miss_count()});
+  cache_stats->push_back({"framebuffer", render_cache_->hit_count(),
+                          render_cache_->miss_count()});
+}
+
+void VulkanCommandProcessor::GetMemoryUsage(
+    std::vector<std::pair<const char*, uint64_t>>* usage) {
+  // Created with the context on the command processor thread.
+  if (texture_cache_) {
+    usage->emplace_back("gpu.textures", texture_cache_->resident_bytes());
+  }
+}
+
 bool VulkanCommandProcessor::SetupContext() {
   if (!CommandProcessor::SetupContext()) {
     XELOGE("Unable to initialize base command processor context");
@@ -78,16 +108,65 @@ bool VulkanCommandProcessor::SetupContext() {
   // Setup fenced pools used for all our per-frame/per-draw resources.
   command_buffer_pool_ = std::make_unique<ui::vulkan::CommandBufferPool>(
       *device_, device_->queue_family_index(), VK_COMMAND_BUFFER_LEVEL_PRIMARY);
+  if (device_->transfer_queue()) {
+    transfer_command_buffer_pool_ =
+        std::make_unique<ui::vulkan::CommandBufferPool>(
+            *device_, device_->transfer_queue_family_index(),
+            VK_COMMAND_BUFFER_LEVEL_PRIMARY);
+  }
+  if (FLAGS_vulkan_recording_threads > 0) {
+    draw_recorder_ = std::make_unique<DrawRecorder>(
+        device_, uint32_t(FLAGS_vulkan_recording_threads));
+    draw_commands_ = draw_recorder_->AcquireCommands();
+  } else {
+    draw_commands_ = std::make_unique<DeferredCommandBuffer>(device_);
+  }
+
+  // Timestamps are only used for stats, so it's fine if they're unsupported.
+  uint32_t timestamp_valid_bits =
+      device_->device_info()
+          .queue_family_properties[device_->queue_family_index()]
+          .timestampValidBits;
+  if (timestamp_valid_bits) {
+    VkQueryPoolCreateInfo query_pool_info;
+    std::memset(&query_pool_info, 0, sizeof(query_pool_info));
+    query_pool_info.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+    query_pool_info.queryType = VK_QUERY_TYPE_TIMESTAMP;
+    query_pool_info.queryCount = 2;
+    auto status = vkCreateQueryPool(*device_, &query_pool_info, nullptr,
+                                    &timestamp_query_pool_);
+    CheckResult(status, "vkCreateQueryPool");
+    if (status != VK_SUCCESS) {
+      timestamp_query_pool_ = nullptr;
+    }
+    timestamp_mask_ = timestamp_valid_bits >= 64
+                          ? ~0ull
+                          : (1ull << timestamp_valid_bits) - 1;
+  }
+  timestamp_pool_ = std::make_unique<TimestampPool>(device_);
+  if (timestamp_pool_->is_supported()) {
+    timestamp_pool_->set_command_buffer(&current_command_buffer_);
+    Profiler::set_gpu_timestamp_source(timestamp_pool_.get());
+  } else {
+    timestamp_pool_.reset();
+  }
+  occlusion_query_pool_ =
+      std::make_unique<OcclusionQueryPool>(device_, memory_);
+  memexport_buffer_ =
+      std::make_unique<MemExportBuffer>(device_, memory_, register_file_);
 
   // Initialize the state machine caches.
-  buffer_cache_ = std::make_unique<BufferCache>(register_file_, device_,
-                                                kDefaultBufferCacheCapacity);
-  texture_cache_ = std::make_unique<TextureCache>(memory_, register_file_,
-                                                  &trace_writer_, device_);
-  pipeline_cache_ = std::make_unique<PipelineCache>(
-      register_file_, device_, buffer_cache_->constant_descriptor_set_layout(),
-      texture_cache_->texture_descriptor_set_layout());
+  buffer_cache_ = std::make_unique<BufferCache>(
+      register_file_, memory_, &dirty_page_tracker_, device_,
+      kDefaultBufferCacheCapacity);
+  texture_cache_ = std::make_unique<TextureCache>(
+      memory_, &dirty_page_tracker_, register_file_, &trace_writer_, device_);
   render_cache_ = std::make_unique<RenderCache>(register_file_, device_);
+  pipeline_cache_ = std::make_unique<PipelineCache>(
+      register_file_, device_, render_cache_.get(),
+      buffer_cache_->constant_descriptor_set_layout(),
+      texture_cache_->texture_descriptor_set_layout(),
+      memexport_buffer_->descriptor_set_layout());
 
   return true;
 }
@@ -105,8 +184,30 @@ void VulkanCommandProcessor::ShutdownContext() {
   render_cache_.reset();
   texture_cache_.reset();
 
+  if (timestamp_query_pool_) {
+    vkDestroyQueryPool(*device_, timestamp_query_pool_, nullptr);
+    timestamp_query_pool_ = nullptr;
+  }
+  if (timestamp_pool_) {
+    Profiler::set_gpu_timestamp_source(nullptr);
+    timestamp_pool_.reset();
+  }
+  occlusion_query_pool_.reset();
+  memexport_buffer_.reset();
+
   // Free all pools. This must come after all of our caches clean up.
+  draw_commands_.reset();
+  draw_recorder_.reset();
   command_buffer_pool_.reset();
+  transfer_command_buffer_pool_.reset();
+  for (auto semaphore : free_transfer_semaphores_) {
+    vkDestroySemaphore(*device_, semaphore, nullptr);
+  }
+  free_transfer_semaphores_.clear();
+  for (auto& it : pending_transfer_semaphores_) {
+    vkDestroySemaphore(*device_, it.first, nullptr);
+  }
+  pending_transfer_semaphores_.clear();
 
   // Release queue, if we were using an acquired one.
   if (!queue_mutex_) {
@@ -134,6 +235,14 @@ void VulkanCommandProcessor::PrepareForWait() {
 
   CommandProcessor::PrepareForWait();
 
+  // Counts of the queries in batches finished by now are written while idle.
+  if (occlusion_query_pool_) {
+    occlusion_query_pool_->Scavenge();
+  }
+  // As are the exports and resolve writebacks.
+  memexport_buffer_->Scavenge();
+  texture_cache_->FlushResolveWritebacks();
+
   // TODO(benvanik): fences and fancy stuff. We should figure out a way to
   // make interrupt callbacks from the GPU so that we don't have to do a full
   // synchronize here.
@@ -236,6 +345,49 @@ void VulkanCommandProcessor::DestroySwapImages() {
   bb_memory = nullptr;
 }
 
+void VulkanCommandProcessor::BeginFrameTimestamps(
+    VkCommandBuffer command_buffer) {
+  if (timestamp_pool_) {
+    timestamp_pool_->BeginFrame(command_buffer);
+  }
+  frame_timestamp_started_ = stats_enabled_ && timestamp_query_pool_;
+  if (!frame_timestamp_started_) {
+    return;
+  }
+  vkCmdResetQueryPool(command_buffer, timestamp_query_pool_, 0, 2);
+  vkCmdWriteTimestamp(command_buffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
+                      timestamp_query_pool_, 0);
+}
+
+void VulkanCommandProcessor::EndRenderPass() {
+  if (draw_recorder_) {
+    if (!draw_commands_->empty()) {
+      draw_recorder_->Record(&draw_commands_,
+                             current_render_state_->render_pass_handle,
+                             current_render_state_->framebuffer_handle);
+    }
+    draw_recorder_->ExecuteRecorded(current_command_buffer_);
+  } else {
+    draw_commands_->Replay(current_command_buffer_);
+    draw_commands_->Reset();
+  }
+  render_cache_->EndRenderPass();
+  LEAVE_profile_gpu(vulkan_render_pass, render_pass_profile_tick_);
+}
+
+void VulkanCommandProcessor::CancelBatch() {
+  command_buffer_pool_->CancelBatch();
+  if (draw_recorder_) {
+    draw_recorder_->CancelBatch();
+  }
+  if (occlusion_query_pool_) {
+    occlusion_query_pool_->CancelBatch();
+  }
+  memexport_buffer_->CancelBatch();
+  render_cache_->CancelBatch();
+  texture_cache_->CancelBatch();
+}
+
 void VulkanCommandProcessor::PerformSwap(uint32_t frontbuffer_ptr,
                                          uint32_t frontbuffer_width,
                                          uint32_t frontbuffer_height) {
@@ -262,13 +414,37 @@ void VulkanCommandProcessor::PerformSwap(uint32_t frontbuffer_ptr,
   auto status = vkBeginCommandBuffer(copy_commands, &begin_info);
   CheckResult(status, "vkBeginCommandBuffer");
 
+  // Frames that began before stats were enabled aren't timed.
+  bool time_frame = stats_enabled_ && timestamp_query_pool_ &&
+                    (!current_command_buffer_ || frame_timestamp_started_);
+  if (!current_command_buffer_) {
+    if (time_frame) {
+      BeginFrameTimestamps(copy_commands);
+    } else if (timestamp_pool_) {
+      timestamp_pool_->BeginFrame(copy_commands);
+    }
+  }
+  if (current_render_state_) {
+    // Ended first so that its profiling scope doesn't contain the swap.
+    EndRenderPass();
+    current_render_state_ = nullptr;
+  }
+  if (timestamp_pool_) {
+    timestamp_pool_->set_command_buffer(&copy_commands);
+  }
+  uint64_t swap_profile_tick = ENTER_profile_gpu(vulkan_swap);
+
   if (!frontbuffer_ptr) {
     // Trace viewer does this.
     frontbuffer_ptr = last_copy_base_;
   }
 
+  // The frontbuffer is presented at the size it was rendered at.
+  uint32_t resolution_scale = render_cache_->resolution_scale();
+  uint32_t swap_width = frontbuffer_width * resolution_scale;
+  uint32_t swap_height = frontbuffer_height * resolution_scale;
   if (!swap_state_.back_buffer_texture) {
-    CreateSwapImages(copy_commands, {frontbuffer_width, frontbuffer_height});
+    CreateSwapImages(copy_commands, {swap_width, swap_height});
   }
   auto swap_bb = reinterpret_cast<VkImage>(swap_state_.back_buffer_texture);
 
@@ -302,22 +478,34 @@ void VulkanCommandProcessor::PerformSwap(uint32_t frontbuffer_ptr,
     std::memset(&blit, 0, sizeof(VkImageBlit));
     blit.srcSubresource = {VK_IMAGE_ASPECT_COLOR_BIT, 0, 0, 1};
     blit.srcOffsets[0] = {0, 0, 0};
-    blit.srcOffsets[1] = {int32_t(frontbuffer_width),
-                          int32_t(frontbuffer_height), 1};
+    blit.srcOffsets[1] = {
+        int32_t(frontbuffer_width * texture->resolution_scale),
+        int32_t(frontbuffer_height * texture->resolution_scale), 1};
     blit.dstSubresource = {VK_IMAGE_ASPECT_COLOR_BIT, 0, 0, 1};
     blit.dstOffsets[0] = {0, 0, 0};
-    blit.dstOffsets[1] = {int32_t(frontbuffer_width),
-                          int32_t(frontbuffer_height), 1};
+    blit.dstOffsets[1] = {int32_t(swap_width), int32_t(swap_height), 1};
 
     vkCmdBlitImage(copy_commands, texture->image, texture->image_layout,
                    swap_bb, VK_IMAGE_LAYOUT_GENERAL, 1, &blit,
                    VK_FILTER_LINEAR);
 
     std::lock_guard<std::mutex> lock(swap_state_.mutex);
-    swap_state_.width = frontbuffer_width;
-    swap_state_.height = frontbuffer_height;
+    swap_state_.width = swap_width;
+    swap_state_.height = swap_height;
+  }
+
+  LEAVE_profile_gpu(vulkan_swap, swap_profile_tick);
+  if (timestamp_pool_) {
+    timestamp_pool_->set_command_buffer(&current_command_buffer_);
+  }
+
+  if (time_frame) {
+    vkCmdWriteTimestamp(copy_commands, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT,
+                        timestamp_query_pool_, 1);
   }
 
+  memexport_buffer_->EndBatch(copy_commands);
+  texture_cache_->EndBatch(copy_commands);
   status = vkEndCommandBuffer(copy_commands);
   CheckResult(status, "vkEndCommandBuffer");
 
@@ -325,11 +513,6 @@ void VulkanCommandProcessor::PerformSwap(uint32_t frontbuffer_ptr,
   // TODO(benvanik): bigger batches.
   std::vector<VkCommandBuffer> submit_buffers;
   if (current_command_buffer_) {
-    if (current_render_state_) {
-      render_cache_->EndRenderPass();
-      current_render_state_ = nullptr;
-    }
-
     status = vkEndCommandBuffer(current_setup_buffer_);
     CheckResult(status, "vkEndCommandBuffer");
     status = vkEndCommandBuffer(current_command_buffer_);
@@ -344,6 +527,48 @@ void VulkanCommandProcessor::PerformSwap(uint32_t frontbuffer_ptr,
   }
 
   submit_buffers.push_back(copy_commands);
+
+  // Uploads recorded for the transfer queue go first, and the graphics work
+  // only waits for them once it needs to sample.
+  VkSemaphore transfer_semaphore = nullptr;
+  VkPipelineStageFlags transfer_wait_stage_mask =
+      VK_PIPELINE_STAGE_VERTEX_SHADER_BIT |
+      VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT;
+  if (current_transfer_buffer_) {
+    status = vkEndCommandBuffer(current_transfer_buffer_);
+    CheckResult(status, "vkEndCommandBuffer");
+
+    if (!free_transfer_semaphores_.empty()) {
+      transfer_semaphore = free_transfer_semaphores_.back();
+      free_transfer_semaphores_.pop_back();
+    } else {
+      VkSemaphoreCreateInfo semaphore_info;
+      semaphore_info.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+      semaphore_info.pNext = nullptr;
+      semaphore_info.flags = 0;
+      status = vkCreateSemaphore(*device_, &semaphore_info, nullptr,
+                                 &transfer_semaphore);
+      CheckResult(status, "vkCreateSemaphore");
+    }
+
+    VkSubmitInfo transfer_submit_info;
+    std::memset(&transfer_submit_info, 0, sizeof(VkSubmitInfo));
+    transfer_submit_info.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+    transfer_submit_info.commandBufferCount = 1;
+    transfer_submit_info.pCommandBuffers = &current_transfer_buffer_;
+    transfer_submit_info.signalSemaphoreCount = 1;
+    transfer_submit_info.pSignalSemaphores = &transfer_semaphore;
+    status = vkQueueSubmit(device_->transfer_queue(), 1, &transfer_submit_info,
+                           *current_transfer_fence_);
+    CheckResult(status, "vkQueueSubmit");
+
+    transfer_command_buffer_pool_->EndBatch(current_transfer_fence_);
+    current_transfer_buffer_ = nullptr;
+    current_transfer_fence_ = nullptr;
+    pending_transfer_semaphores_.push_back(
+        {transfer_semaphore, current_batch_fence_});
+  }
+
   if (!submit_buffers.empty()) {
     // TODO(benvanik): move to CP or to host (trace dump, etc).
     // This only needs to surround a vkQueueSubmit.
@@ -356,6 +581,11 @@ void VulkanCommandProcessor::PerformSwap(uint32_t frontbuffer_ptr,
     submit_info.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
     submit_info.commandBufferCount = uint32_t(submit_buffers.size());
     submit_info.pCommandBuffers = submit_buffers.data();
+    if (transfer_semaphore) {
+      submit_info.waitSemaphoreCount = 1;
+      submit_info.pWaitSemaphores = &transfer_semaphore;
+      submit_info.pWaitDstStageMask = &transfer_wait_stage_mask;
+    }
     status = vkQueueSubmit(queue_, 1, &submit_info, *current_batch_fence_);
     CheckResult(status, "vkQueueSubmit");
 
@@ -368,7 +598,33 @@ void VulkanCommandProcessor::PerformSwap(uint32_t frontbuffer_ptr,
     }
   }
 
+  if (time_frame) {
+    // Stalls until the frame is done, so frames don't overlap when timed.
+    uint64_t timestamps[2];
+    status = vkGetQueryPoolResults(
+        *device_, timestamp_query_pool_, 0, 2, sizeof(timestamps), timestamps,
+        sizeof(uint64_t), VK_QUERY_RESULT_64_BIT | VK_QUERY_RESULT_WAIT_BIT);
+    if (status == VK_SUCCESS) {
+      uint64_t ticks = (timestamps[1] - timestamps[0]) & timestamp_mask_;
+      uint64_t nanoseconds = uint64_t(
+          ticks * double(device_->device_info().properties.limits
+                             .timestampPeriod));
+      ++stats_.gpu_frame_count;
+      stats_.gpu_nanoseconds += nanoseconds;
+      last_gpu_frame_nanoseconds_ = nanoseconds;
+    }
+  }
+
   command_buffer_pool_->EndBatch(current_batch_fence_);
+  if (draw_recorder_) {
+    draw_recorder_->EndBatch(current_batch_fence_);
+  }
+  if (occlusion_query_pool_) {
+    occlusion_query_pool_->EndBatch(current_batch_fence_);
+  }
+  if (timestamp_pool_) {
+    timestamp_pool_->EndFrame();
+  }
 
   // Scavenging.
   {
@@ -378,14 +634,164 @@ void VulkanCommandProcessor::PerformSwap(uint32_t frontbuffer_ptr,
         "xe::gpu::vulkan::VulkanCommandProcessor::PerformSwap Scavenging");
 #endif  // FINE_GRAINED_DRAW_SCOPES
     command_buffer_pool_->Scavenge();
+    if (draw_recorder_) {
+      draw_recorder_->Scavenge();
+    }
+    if (transfer_command_buffer_pool_) {
+      transfer_command_buffer_pool_->Scavenge();
+    }
+    if (occlusion_query_pool_) {
+      occlusion_query_pool_->Scavenge();
+    }
+    memexport_buffer_->Scavenge();
+    while (!pending_transfer_semaphores_.empty() &&
+           pending_transfer_semaphores_.front().second->status() ==
+               VK_SUCCESS) {
+      free_transfer_semaphores_.push_back(
+          pending_transfer_semaphores_.front().first);
+      pending_transfer_semaphores_.pop_front();
+    }
 
+    texture_cache_->EndFrame();
     texture_cache_->Scavenge();
     buffer_cache_->Scavenge();
+    render_cache_->EndFrame();
+    render_cache_->Scavenge();
   }
 
   current_batch_fence_ = nullptr;
 }
 
+std::unique_ptr<xe::ui::RawImage>
+VulkanCommandProcessor::ReadBackFrontBuffer() {
+  SCOPE_profile_cpu_f("gpu");
+
+  VkImage front_buffer;
+  uint32_t width, height;
+  {
+    std::lock_guard<std::mutex> lock(swap_state_.mutex);
+    front_buffer = reinterpret_cast<VkImage>(swap_state_.front_buffer_texture);
+    width = swap_state_.width;
+    height = swap_state_.height;
+  }
+  if (!front_buffer || !width || !height) {
+    return nullptr;
+  }
+  VkDeviceSize size = VkDeviceSize(width) * height * 4;
+
+  VkBufferCreateInfo buffer_info;
+  std::memset(&buffer_info, 0, sizeof(buffer_info));
+  buffer_info.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+  buffer_info.size = size;
+  buffer_info.usage = VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+  buffer_info.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+  VkBuffer buffer = nullptr;
+  auto status = vkCreateBuffer(*device_, &buffer_info, nullptr, &buffer);
+  CheckResult(status, "vkCreateBuffer");
+  if (status != VK_SUCCESS) {
+    return nullptr;
+  }
+  VkMemoryRequirements memory_requirements;
+  vkGetBufferMemoryRequirements(*device_, buffer, &memory_requirements);
+  VkDeviceMemory memory = device_->AllocateMemory(
+      memory_requirements, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+                               VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+  if (!memory) {
+    vkDestroyBuffer(*device_, buffer, nullptr);
+    return nullptr;
+  }
+  vkBindBufferMemory(*device_, buffer, memory, 0);
+
+  // Read backs are rare, so a pool is made for each.
+  VkCommandPoolCreateInfo pool_info;
+  pool_info.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+  pool_info.pNext = nullptr;
+  pool_info.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT;
+  pool_info.queueFamilyIndex = device_->queue_family_index();
+  VkCommandPool command_pool = nullptr;
+  status = vkCreateCommandPool(*device_, &pool_info, nullptr, &command_pool);
+  CheckResult(status, "vkCreateCommandPool");
+  VkCommandBufferAllocateInfo command_buffer_info;
+  command_buffer_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+  command_buffer_info.pNext = nullptr;
+  command_buffer_info.commandPool = command_pool;
+  command_buffer_info.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+  command_buffer_info.commandBufferCount = 1;
+  VkCommandBuffer command_buffer = nullptr;
+  status = vkAllocateCommandBuffers(*device_, &command_buffer_info,
+                                    &command_buffer);
+  CheckResult(status, "vkAllocateCommandBuffers");
+
+  VkCommandBufferBeginInfo begin_info;
+  std::memset(&begin_info, 0, sizeof(begin_info));
+  begin_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+  begin_info.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+  vkBeginCommandBuffer(command_buffer, &begin_info);
+
+  // Waits for the swap that copied the frame into the image, submitted
+  // earlier to the same queue.
+  VkImageMemoryBarrier barrier;
+  std::memset(&barrier, 0, sizeof(VkImageMemoryBarrier));
+  barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+  barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+  barrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+  barrier.oldLayout = VK_IMAGE_LAYOUT_GENERAL;
+  barrier.newLayout = VK_IMAGE_LAYOUT_GENERAL;
+  barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+  barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+  barrier.image = front_buffer;
+  barrier.subresourceRange = {VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1};
+  vkCmdPipelineBarrier(command_buffer, VK_PIPELINE_STAGE_TRANSFER_BIT,
+                       VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, nullptr, 0,
+                       nullptr, 1, &barrier);
+
+  VkBufferImageCopy region;
+  std::memset(&region, 0, sizeof(region));
+  region.imageSubresource = {VK_IMAGE_ASPECT_COLOR_BIT, 0, 0, 1};
+  region.imageExtent = {width, height, 1};
+  vkCmdCopyImageToBuffer(command_buffer, front_buffer, VK_IMAGE_LAYOUT_GENERAL,
+                         buffer, 1, &region);
+  vkEndCommandBuffer(command_buffer);
+
+  ui::vulkan::Fence fence(*device_);
+  VkSubmitInfo submit_info;
+  std::memset(&submit_info, 0, sizeof(VkSubmitInfo));
+  submit_info.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+  submit_info.commandBufferCount = 1;
+  submit_info.pCommandBuffers = &command_buffer;
+  if (queue_mutex_) {
+    queue_mutex_->lock();
+  }
+  status = vkQueueSubmit(queue_, 1, &submit_info, fence);
+  CheckResult(status, "vkQueueSubmit");
+  if (queue_mutex_) {
+    queue_mutex_->unlock();
+  }
+
+  std::unique_ptr<xe::ui::RawImage> image;
+  if (status == VK_SUCCESS) {
+    VkFence fence_handle = fence;
+    vkWaitForFences(*device_, 1, &fence_handle, VK_TRUE, UINT64_MAX);
+    void* data = nullptr;
+    status = vkMapMemory(*device_, memory, 0, size, 0, &data);
+    CheckResult(status, "vkMapMemory");
+    if (status == VK_SUCCESS) {
+      image = std::make_unique<xe::ui::RawImage>();
+      image->width = width;
+      image->height = height;
+      image->stride = width * 4;
+      image->data.resize(size_t(size));
+      std::memcpy(image->data.data(), data, size_t(size));
+      vkUnmapMemory(*device_, memory);
+    }
+  }
+
+  vkDestroyCommandPool(*device_, command_pool, nullptr);
+  vkDestroyBuffer(*device_, buffer, nullptr);
+  vkFreeMemory(*device_, memory, nullptr);
+  return image;
+}
+
 Shader* VulkanCommandProcessor::LoadShader(ShaderType shader_type,
                                            uint32_t guest_address,
                                            const uint32_t* host_address,
@@ -459,6 +865,18 @@ bool VulkanCommandProcessor::IssueDraw(PrimitiveType primitive_type,
     status =
         vkBeginCommandBuffer(current_setup_buffer_, &command_buffer_begin_info);
     CheckResult(status, "vkBeginCommandBuffer");
+    BeginFrameTimestamps(current_setup_buffer_);
+
+    // Canceled batches leave the transfer batch open, as what's already been
+    // uploaded with it is still valid.
+    if (transfer_command_buffer_pool_ && !current_transfer_buffer_) {
+      transfer_command_buffer_pool_->BeginBatch();
+      current_transfer_buffer_ = transfer_command_buffer_pool_->AcquireEntry();
+      current_transfer_fence_.reset(new ui::vulkan::Fence(*device_));
+      status = vkBeginCommandBuffer(current_transfer_buffer_,
+                                    &command_buffer_begin_info);
+      CheckResult(status, "vkBeginCommandBuffer");
+    }
 
     static uint32_t frame = 0;
     if (device_->is_renderdoc_attached() && !capturing_ &&
@@ -478,7 +896,6 @@ bool VulkanCommandProcessor::IssueDraw(PrimitiveType primitive_type,
 
     started_command_buffer = true;
   }
-  auto command_buffer = current_command_buffer_;
   auto setup_buffer = current_setup_buffer_;
 
   // Begin the render pass.
@@ -486,58 +903,97 @@ bool VulkanCommandProcessor::IssueDraw(PrimitiveType primitive_type,
   // This reuses a previous render pass if one is already open.
   if (render_cache_->dirty() || !current_render_state_) {
     if (current_render_state_) {
-      render_cache_->EndRenderPass();
+      EndRenderPass();
       current_render_state_ = nullptr;
     }
 
+    // Started outside of the pass, as with a draw recorder only secondary
+    // command buffers may be executed in it.
+    render_pass_profile_tick_ = ENTER_profile_gpu(vulkan_render_pass);
     current_render_state_ = render_cache_->BeginRenderPass(
-        command_buffer, vertex_shader, pixel_shader);
+        current_command_buffer_, current_batch_fence_, vertex_shader,
+        pixel_shader,
+        draw_recorder_ ? VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS
+                       : VK_SUBPASS_CONTENTS_INLINE);
     if (!current_render_state_) {
-      command_buffer_pool_->CancelBatch();
+      CancelBatch();
       current_command_buffer_ = nullptr;
       current_setup_buffer_ = nullptr;
       current_batch_fence_ = nullptr;
       return false;
     }
   }
+  // Draws start out with all state set whenever they may be recorded into a
+  // command buffer of their own.
+  auto command_buffer = draw_commands_.get();
+  bool full_update = started_command_buffer ||
+                     (draw_recorder_ && command_buffer->empty());
+
+  // Primitive types Vulkan can't draw are converted to lists of ones it can by
+  // rewriting their indices.
+  bool is_line_mode =
+      PipelineCache::IsLineMode(regs[XE_GPU_REG_PA_SU_SC_MODE_CNTL].u32);
+  auto host_primitive_type =
+      BufferCache::GetConvertedPrimitiveType(primitive_type, is_line_mode);
+  bool convert_indices = host_primitive_type != primitive_type;
+  if (convert_indices && !BufferCache::GetConvertedIndexCount(
+                             primitive_type, is_line_mode, index_count)) {
+    // Too few indices to make up a primitive.
+    return true;
+  }
 
   // Configure the pipeline for drawing.
   // This encodes all render state (blend, depth, etc), our shader stages,
   // and our vertex input layout.
   VkPipeline pipeline = nullptr;
   auto pipeline_status = pipeline_cache_->ConfigurePipeline(
-      command_buffer, current_render_state_, vertex_shader, pixel_shader,
-      primitive_type, &pipeline);
+      current_command_buffer_, current_render_state_, vertex_shader,
+      pixel_shader, host_primitive_type, &pipeline);
+  if (pipeline_status == PipelineCache::UpdateStatus::kPending) {
+    // Skip the draw rather than stall until the pipeline is created. Dynamic
+    // state still has to be set, as later draws only update what changed.
+    pipeline_cache_->SetDynamicState(command_buffer, full_update);
+    register_file_->ClearDirtyGroups(~buffer_cache_->constant_dirty_groups());
+    return true;
+  }
   if (pipeline_status == PipelineCache::UpdateStatus::kMismatch ||
-      started_command_buffer) {
-    vkCmdBindPipeline(command_buffer, VK_PIPELINE_BIND_POINT_GRAPHICS,
-                      pipeline);
+      full_update) {
+    command_buffer->BindPipeline(pipeline);
   } else if (pipeline_status == PipelineCache::UpdateStatus::kError) {
-    render_cache_->EndRenderPass();
-    command_buffer_pool_->CancelBatch();
+    EndRenderPass();
+    CancelBatch();
     current_command_buffer_ = nullptr;
     current_setup_buffer_ = nullptr;
     current_batch_fence_ = nullptr;
     current_render_state_ = nullptr;
     return false;
   }
-  pipeline_cache_->SetDynamicState(command_buffer, started_command_buffer);
+  pipeline_cache_->SetDynamicState(command_buffer, full_update);
 
   // Pass registers to the shaders.
   if (!PopulateConstants(command_buffer, vertex_shader, pixel_shader)) {
-    render_cache_->EndRenderPass();
-    command_buffer_pool_->CancelBatch();
+    EndRenderPass();
+    CancelBatch();
     current_command_buffer_ = nullptr;
     current_setup_buffer_ = nullptr;
     current_batch_fence_ = nullptr;
     current_render_state_ = nullptr;
     return false;
   }
+  // All register state has been consumed, so only writes from here on need
+  // to be compared against the shadow registers by the next draw.
+  register_file_->ClearDirtyGroups();
 
   // Upload and bind index buffer data (if we have any).
-  if (!PopulateIndexBuffer(command_buffer, index_buffer_info)) {
-    render_cache_->EndRenderPass();
-    command_buffer_pool_->CancelBatch();
+  bool populated_indices =
+      convert_indices
+          ? PopulateConvertedIndexBuffer(command_buffer, primitive_type,
+                                         is_line_mode, index_count,
+                                         index_buffer_info)
+          : PopulateIndexBuffer(command_buffer, index_buffer_info);
+  if (!populated_indices) {
+    EndRenderPass();
+    CancelBatch();
     current_command_buffer_ = nullptr;
     current_setup_buffer_ = nullptr;
     current_batch_fence_ = nullptr;
@@ -547,8 +1003,8 @@ bool VulkanCommandProcessor::IssueDraw(PrimitiveType primitive_type,
 
   // Upload and bind all vertex buffer data.
   if (!PopulateVertexBuffers(command_buffer, vertex_shader)) {
-    render_cache_->EndRenderPass();
-    command_buffer_pool_->CancelBatch();
+    EndRenderPass();
+    CancelBatch();
     current_command_buffer_ = nullptr;
     current_setup_buffer_ = nullptr;
     current_batch_fence_ = nullptr;
@@ -561,8 +1017,8 @@ bool VulkanCommandProcessor::IssueDraw(PrimitiveType primitive_type,
   // Setup buffer may be flushed to GPU if the texture cache needs it.
   if (!PopulateSamplers(command_buffer, setup_buffer, vertex_shader,
                         pixel_shader)) {
-    render_cache_->EndRenderPass();
-    command_buffer_pool_->CancelBatch();
+    EndRenderPass();
+    CancelBatch();
     current_command_buffer_ = nullptr;
     current_setup_buffer_ = nullptr;
     current_batch_fence_ = nullptr;
@@ -570,15 +1026,41 @@ bool VulkanCommandProcessor::IssueDraw(PrimitiveType primitive_type,
     return false;
   }
 
+  // Bind the storage the vertex shader writes its memexport stream to.
+  if (!memexport_buffer_->PrepareDraw(vertex_shader, command_buffer,
+                                      pipeline_cache_->pipeline_layout(),
+                                      current_batch_fence_)) {
+    return true;
+  }
+
   // Actually issue the draw.
-  if (!index_buffer_info) {
+  uint32_t occlusion_query = OcclusionQueryPool::kNoQuery;
+  if (occlusion_query_pool_) {
+    occlusion_query =
+        occlusion_query_pool_->BeginDraw(setup_buffer, command_buffer);
+  }
+  if (convert_indices) {
+    // The converted indices start at the first one, and auto-indexed draws
+    // still offset the vertices.
+    uint32_t instance_count = 1;
+    int32_t vertex_offset = 0;
+    if (!index_buffer_info || !index_buffer_info->guest_base) {
+      vertex_offset =
+          int32_t(register_file_->values[XE_GPU_REG_VGT_INDX_OFFSET].u32);
+    }
+    uint32_t first_instance = 0;
+    command_buffer->DrawIndexed(
+        BufferCache::GetConvertedIndexCount(primitive_type, is_line_mode,
+                                            index_count),
+        instance_count, 0, vertex_offset, first_instance);
+  } else if (!index_buffer_info) {
     // Auto-indexed draw.
     uint32_t instance_count = 1;
     uint32_t first_vertex =
         register_file_->values[XE_GPU_REG_VGT_INDX_OFFSET].u32;
     uint32_t first_instance = 0;
-    vkCmdDraw(command_buffer, index_count, instance_count, first_vertex,
-              first_instance);
+    command_buffer->Draw(index_count, instance_count, first_vertex,
+                         first_instance);
   } else {
     // Index buffer draw.
     uint32_t instance_count = 1;
@@ -586,16 +1068,25 @@ bool VulkanCommandProcessor::IssueDraw(PrimitiveType primitive_type,
         register_file_->values[XE_GPU_REG_VGT_INDX_OFFSET].u32;
     uint32_t vertex_offset = 0;
     uint32_t first_instance = 0;
-    vkCmdDrawIndexed(command_buffer, index_count, instance_count, first_index,
-                     vertex_offset, first_instance);
+    command_buffer->DrawIndexed(index_count, instance_count, first_index,
+                                vertex_offset, first_instance);
+  }
+  if (occlusion_query_pool_) {
+    occlusion_query_pool_->EndDraw(command_buffer, occlusion_query);
+  }
+
+  if (draw_recorder_ && command_buffer->draw_count() >= kDrawsPerRecording) {
+    draw_recorder_->Record(&draw_commands_,
+                           current_render_state_->render_pass_handle,
+                           current_render_state_->framebuffer_handle);
   }
 
   return true;
 }
 
-bool VulkanCommandProcessor::PopulateConstants(VkCommandBuffer command_buffer,
-                                               VulkanShader* vertex_shader,
-                                               VulkanShader* pixel_shader) {
+bool VulkanCommandProcessor::PopulateConstants(
+    DeferredCommandBuffer* command_buffer, VulkanShader* vertex_shader,
+    VulkanShader* pixel_shader) {
 #if FINE_GRAINED_DRAW_SCOPES
   SCOPE_profile_cpu_f("gpu");
 #endif  // FINE_GRAINED_DRAW_SCOPES
@@ -617,9 +1108,8 @@ bool VulkanCommandProcessor::PopulateConstants(VkCommandBuffer command_buffer,
   uint32_t set_constant_offsets[2] = {
       static_cast<uint32_t>(constant_offsets.first),
       static_cast<uint32_t>(constant_offsets.second)};
-  vkCmdBindDescriptorSets(
-      command_buffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline_layout, 0, 1,
-      &constant_descriptor_set,
+  command_buffer->BindDescriptorSets(
+      pipeline_layout, 0, 1, &constant_descriptor_set,
       static_cast<uint32_t>(xe::countof(set_constant_offsets)),
       set_constant_offsets);
 
@@ -627,7 +1117,8 @@ bool VulkanCommandProcessor::PopulateConstants(VkCommandBuffer command_buffer,
 }
 
 bool VulkanCommandProcessor::PopulateIndexBuffer(
-    VkCommandBuffer command_buffer, IndexBufferInfo* index_buffer_info) {
+    DeferredCommandBuffer* command_buffer,
+    IndexBufferInfo* index_buffer_info) {
   auto& regs = *register_file_;
   if (!index_buffer_info || !index_buffer_info->guest_base) {
     // No index buffer or auto draw.
@@ -652,13 +1143,11 @@ bool VulkanCommandProcessor::PopulateIndexBuffer(
   trace_writer_.WriteMemoryRead(info.guest_base, info.length);
 
   // Upload (or get a cached copy of) the buffer.
-  const void* source_ptr =
-      memory_->TranslatePhysical<const void*>(info.guest_base);
-  size_t source_length =
+  uint32_t source_length =
       info.count * (info.format == IndexFormat::kInt32 ? sizeof(uint32_t)
                                                        : sizeof(uint16_t));
   auto buffer_ref = buffer_cache_->UploadIndexBuffer(
-      source_ptr, source_length, info.format, current_batch_fence_);
+      info.guest_base, source_length, info.format, current_batch_fence_);
   if (buffer_ref.second == VK_WHOLE_SIZE) {
     // Failed to upload buffer.
     return false;
@@ -668,14 +1157,56 @@ bool VulkanCommandProcessor::PopulateIndexBuffer(
   VkIndexType index_type = info.format == IndexFormat::kInt32
                                ? VK_INDEX_TYPE_UINT32
                                : VK_INDEX_TYPE_UINT16;
-  vkCmdBindIndexBuffer(command_buffer, buffer_ref.first, buffer_ref.second,
-                       index_type);
+  command_buffer->BindIndexBuffer(buffer_ref.first, buffer_ref.second,
+                                  index_type);
 
   return true;
 }
 
+bool VulkanCommandProcessor::PopulateConvertedIndexBuffer(
+    DeferredCommandBuffer* command_buffer, PrimitiveType primitive_type,
+    bool is_line_mode, uint32_t index_count,
+    IndexBufferInfo* index_buffer_info) {
+#if FINE_GRAINED_DRAW_SCOPES
+  SCOPE_profile_cpu_f("gpu");
+#endif  // FINE_GRAINED_DRAW_SCOPES
+
+  // Auto-indexed draws get 32-bit indices of their own.
+  uint32_t source_addr = 0;
+  IndexFormat format = IndexFormat::kInt32;
+  if (index_buffer_info && index_buffer_info->guest_base) {
+    auto& info = *index_buffer_info;
+    assert_true(info.endianness == Endian::k8in16 ||
+                info.endianness == Endian::k8in32);
+    // Converted from the first index on, which is where the draw starts.
+    uint32_t index_size = info.format == IndexFormat::kInt32
+                              ? sizeof(uint32_t)
+                              : sizeof(uint16_t);
+    source_addr =
+        info.guest_base +
+        register_file_->values[XE_GPU_REG_VGT_INDX_OFFSET].u32 * index_size;
+    format = info.format;
+    trace_writer_.WriteMemoryRead(source_addr, index_count * index_size);
+  }
+
+  auto buffer_ref = buffer_cache_->ConvertIndexBuffer(
+      primitive_type, is_line_mode, source_addr, index_count, format,
+      current_batch_fence_);
+  if (buffer_ref.second == VK_WHOLE_SIZE) {
+    // Failed to upload buffer.
+    return false;
+  }
+
+  VkIndexType index_type = format == IndexFormat::kInt32
+                               ? VK_INDEX_TYPE_UINT32
+                               : VK_INDEX_TYPE_UINT16;
+  command_buffer->BindIndexBuffer(buffer_ref.first, buffer_ref.second,
+                                  index_type);
+  return true;
+}
+
 bool VulkanCommandProcessor::PopulateVertexBuffers(
-    VkCommandBuffer command_buffer, VulkanShader* vertex_shader) {
+    DeferredCommandBuffer* command_buffer, VulkanShader* vertex_shader) {
   auto& regs = *register_file_;
 
 #if FINE_GRAINED_DRAW_SCOPES
@@ -719,12 +1250,9 @@ bool VulkanCommandProcessor::PopulateVertexBuffers(
     trace_writer_.WriteMemoryRead(fetch->address << 2, valid_range);
 
     // Upload (or get a cached copy of) the buffer.
-    const void* source_ptr =
-        memory_->TranslatePhysical<const void*>(fetch->address << 2);
-    size_t source_length = valid_range;
     auto buffer_ref = buffer_cache_->UploadVertexBuffer(
-        source_ptr, source_length, static_cast<Endian>(fetch->endian),
-        current_batch_fence_);
+        fetch->address << 2, uint32_t(valid_range),
+        static_cast<Endian>(fetch->endian), current_batch_fence_);
     if (buffer_ref.second == VK_WHOLE_SIZE) {
       // Failed to upload buffer.
       return false;
@@ -737,35 +1265,48 @@ bool VulkanCommandProcessor::PopulateVertexBuffers(
   }
 
   // Bind buffers.
-  vkCmdBindVertexBuffers(command_buffer, 0, buffer_index, all_buffers,
-                         all_buffer_offsets);
+  command_buffer->BindVertexBuffers(0, buffer_index, all_buffers,
+                                    all_buffer_offsets);
 
   return true;
 }
 
-bool VulkanCommandProcessor::PopulateSamplers(VkCommandBuffer command_buffer,
-                                              VkCommandBuffer setup_buffer,
-                                              VulkanShader* vertex_shader,
-                                              VulkanShader* pixel_shader) {
+bool VulkanCommandProcessor::PopulateSamplers(
+    DeferredCommandBuffer* command_buffer, VkCommandBuffer setup_buffer,
+    VulkanShader* vertex_shader, VulkanShader* pixel_shader) {
 #if FINE_GRAINED_DRAW_SCOPES
   SCOPE_profile_cpu_f("gpu");
 #endif  // FINE_GRAINED_DRAW_SCOPES
 
+  uint32_t sampler_indices[8];
   auto descriptor_set = texture_cache_->PrepareTextureSet(
-      setup_buffer, current_batch_fence_, vertex_shader->texture_bindings(),
-      pixel_shader->texture_bindings());
+      setup_buffer, current_batch_fence_, current_transfer_buffer_,
+      current_transfer_fence_, vertex_shader->texture_bindings(),
+      pixel_shader->texture_bindings(), sampler_indices);
   if (!descriptor_set) {
     // Unable to bind set.
     return false;
   }
 
-  vkCmdBindDescriptorSets(command_buffer, VK_PIPELINE_BIND_POINT_GRAPHICS,
-                          pipeline_cache_->pipeline_layout(), 1, 1,
-                          &descriptor_set, 0, nullptr);
+  command_buffer->BindDescriptorSets(pipeline_cache_->pipeline_layout(), 1, 1,
+                                     &descriptor_set, 0, nullptr);
+  // Sets are shared by draws sampling the same images with different
+  // immutable samplers, so the indices are pushed for every draw.
+  command_buffer->PushConstants(
+      pipeline_cache_->pipeline_layout(),
+      VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT,
+      kSpirvPushConstantSamplerIndicesOffset, sizeof(sampler_indices),
+      sampler_indices);
 
   return true;
 }
 
+void VulkanCommandProcessor::ZPassDone(uint32_t sample_counts_address) {
+  if (occlusion_query_pool_) {
+    occlusion_query_pool_->ZPassDone(sample_counts_address);
+  }
+}
+
 bool VulkanCommandProcessor::IssueCopy() {
   SCOPE_profile_cpu_f("gpu");
   auto& regs = *register_file_;
@@ -935,7 +1476,8 @@ bool VulkanCommandProcessor::IssueCopy() {
   tex_info.size_2d.input_height = dest_block_height;
   tex_info.size_2d.input_pitch = copy_dest_pitch * 4;
   auto texture = texture_cache_->DemandResolveTexture(
-      tex_info, ColorFormatToTextureFormat(copy_dest_format), nullptr);
+      tex_info, ColorFormatToTextureFormat(copy_dest_format), nullptr,
+      render_cache_->resolution_scale());
   assert_not_null(texture);
   texture->in_flight_fence = current_batch_fence_;
 
@@ -962,11 +1504,13 @@ bool VulkanCommandProcessor::IssueCopy() {
     status =
         vkBeginCommandBuffer(current_setup_buffer_, &command_buffer_begin_info);
     CheckResult(status, "vkBeginCommandBuffer");
+    BeginFrameTimestamps(current_setup_buffer_);
   } else if (current_render_state_) {
-    render_cache_->EndRenderPass();
+    EndRenderPass();
     current_render_state_ = nullptr;
   }
   auto command_buffer = current_command_buffer_;
+  SCOPE_profile_gpu_i("GPU", "Resolve");
 
   if (texture->image_layout == VK_IMAGE_LAYOUT_UNDEFINED) {
     // Transition the image to a general layout.
@@ -1014,7 +1558,13 @@ bool VulkanCommandProcessor::IssueCopy() {
           command_buffer, edram_base, surface_pitch, resolve_extent.height,
           surface_msaa, texture->image, texture->image_layout,
           copy_src_select <= 3, src_format, VK_FILTER_LINEAR, resolve_offset,
-          resolve_extent);
+          resolve_extent, texture->resolution_scale);
+      if (copy_src_select <= 3) {
+        texture_cache_->WriteBackResolve(
+            command_buffer, current_batch_fence_, texture, copy_dest_endian,
+            {resolve_offset.x, resolve_offset.y},
+            {resolve_extent.width, resolve_extent.height});
+      }
       break;
 
     case CopyCommand::kConstantOne:
@@ -13,6 +13,7 @@
 #include <atomic>
 #include <cstring>
 #include <functional>
+#include <list>
 #include <memory>
 #include <mutex>
 #include <queue>
@@ -24,9 +25,14 @@
 #include "xenia/gpu/command_processor.h"
 #include "xenia/gpu/register_file.h"
 #include "xenia/gpu/vulkan/buffer_cache.h"
+#include "xenia/gpu/vulkan/deferred_command_buffer.h"
+#include "xenia/gpu/vulkan/draw_recorder.h"
+#include "xenia/gpu/vulkan/memexport_buffer.h"
+#include "xenia/gpu/vulkan/occlusion_query_pool.h"
 #include "xenia/gpu/vulkan/pipeline_cache.h"
 #include "xenia/gpu/vulkan/render_cache.h"
 #include "xenia/gpu/vulkan/texture_cache.h"
+#include "xenia/gpu/vulkan/timestamp_pool.h"
 #include "xenia/gpu/vulkan/vulkan_shader.h"
 #include "xenia/gpu/xenos.h"
 #include "xenia/kernel/xthread.h"
@@ -51,6 +57,10 @@ class VulkanCommandProcessor : public CommandProcessor {
 
   virtual void RequestFrameTrace(const std::wstring& root_path) override;
   void ClearCaches() override;
+  void GetCacheStats(std::vector<CacheStats>* cache_stats) override;
+  void GetMemoryUsage(
+      std::vector<std::pair<const char*, uint64_t>>* usage) override;
+  std::unique_ptr<xe::ui::RawImage> ReadBackFrontBuffer() override;
 
   RenderCache* render_cache() { return render_cache_.get(); }
 
@@ -62,6 +72,15 @@ class VulkanCommandProcessor : public CommandProcessor {
   void PrepareForWait() override;
   void ReturnFromWait() override;
 
+  // Resets the frame timestamps and writes the one the frame starts at, if
+  // stats are enabled.
+  void BeginFrameTimestamps(VkCommandBuffer command_buffer);
+  // Records the draws of the current render pass and ends it along with its
+  // profiling scope.
+  void EndRenderPass();
+  // Releases the command buffers of the open batch without submitting them.
+  void CancelBatch();
+
   void CreateSwapImages(VkCommandBuffer setup_buffer, VkExtent2D extents);
   void DestroySwapImages();
 
@@ -74,18 +93,25 @@ class VulkanCommandProcessor : public CommandProcessor {
 
   bool IssueDraw(PrimitiveType primitive_type, uint32_t index_count,
                  IndexBufferInfo* index_buffer_info) override;
-  bool PopulateConstants(VkCommandBuffer command_buffer,
+  bool PopulateConstants(DeferredCommandBuffer* command_buffer,
                          VulkanShader* vertex_shader,
                          VulkanShader* pixel_shader);
-  bool PopulateIndexBuffer(VkCommandBuffer command_buffer,
+  bool PopulateIndexBuffer(DeferredCommandBuffer* command_buffer,
                            IndexBufferInfo* index_buffer_info);
-  bool PopulateVertexBuffers(VkCommandBuffer command_buffer,
+  // Binds the indices of a draw converted to a list Vulkan can draw without a
+  // geometry shader, see BufferCache::ConvertIndexBuffer.
+  bool PopulateConvertedIndexBuffer(DeferredCommandBuffer* command_buffer,
+                                    PrimitiveType primitive_type,
+                                    bool is_line_mode, uint32_t index_count,
+                                    IndexBufferInfo* index_buffer_info);
+  bool PopulateVertexBuffers(DeferredCommandBuffer* command_buffer,
                              VulkanShader* vertex_shader);
-  bool PopulateSamplers(VkCommandBuffer command_buffer,
+  bool PopulateSamplers(DeferredCommandBuffer* command_buffer,
                         VkCommandBuffer setup_buffer,
                         VulkanShader* vertex_shader,
                         VulkanShader* pixel_shader);
   bool IssueCopy() override;
+  void ZPassDone(uint32_t sample_counts_address) override;
 
   xe::ui::vulkan::VulkanDevice* device_ = nullptr;
 
@@ -117,6 +143,32 @@ class VulkanCommandProcessor : public CommandProcessor {
   VkCommandBuffer current_command_buffer_ = nullptr;
   VkCommandBuffer current_setup_buffer_ = nullptr;
   std::shared_ptr<ui::vulkan::Fence> current_batch_fence_;
+  // Draws of the open render pass. Replayed into the current command buffer
+  // when it ends, or handed to the draw recorder if there is one.
+  std::unique_ptr<DeferredCommandBuffer> draw_commands_;
+  std::unique_ptr<DrawRecorder> draw_recorder_;
+
+  // Start and end of the work of a frame on the graphics queue, for stats.
+  VkQueryPool timestamp_query_pool_ = nullptr;
+  uint64_t timestamp_mask_ = 0;
+  // Whether the current setup buffer starts with the frame timestamp.
+  bool frame_timestamp_started_ = false;
+  // Timestamps of GPU profiling scopes, if the device supports them.
+  std::unique_ptr<TimestampPool> timestamp_pool_;
+  // Sample counts of the guest occlusion queries.
+  std::unique_ptr<OcclusionQueryPool> occlusion_query_pool_;
+  std::unique_ptr<MemExportBuffer> memexport_buffer_;
+  uint64_t render_pass_profile_tick_ = 0;
+
+  // Texture uploads on the device transfer queue, if it has one. Submitted
+  // ahead of the graphics batch, which waits on a semaphore they signal.
+  std::unique_ptr<ui::vulkan::CommandBufferPool> transfer_command_buffer_pool_;
+  VkCommandBuffer current_transfer_buffer_ = nullptr;
+  std::shared_ptr<ui::vulkan::Fence> current_transfer_fence_;
+  // Semaphores are reused once the graphics batch waiting on them is done.
+  std::vector<VkSemaphore> free_transfer_semaphores_;
+  std::list<std::pair<VkSemaphore, std::shared_ptr<ui::vulkan::Fence>>>
+      pending_transfer_semaphores_;
 };
 
 }  // namespace vulkan
@@ -14,3 +14,53 @@ DEFINE_bool(vulkan_renderdoc_capture_all, false,
 DEFINE_bool(vulkan_native_msaa, false, "Use native MSAA");
 DEFINE_bool(vulkan_dump_disasm, false,
             "Dump shader disassembly. NVIDIA only supported.");
+DEFINE_int32(vulkan_pipeline_threads, 0,
+             "Number of threads creating pipelines in the background, with "
+             "draws waiting on one following --vulkan_pending_pipeline_policy. "
+             "With 0 pipelines are created by the draw that first needs them.");
+DEFINE_int32(vulkan_recording_threads, 0,
+             "Number of threads recording draws into secondary command "
+             "buffers while later draws are set up. With 0 draws are "
+             "recorded on the command processor thread.");
+DEFINE_int32(vulkan_shader_translation_threads, 2,
+             "Number of threads translating shaders in the background as soon "
+             "as their ucode is loaded. With 0 shaders are translated by the "
+             "draw that first uses them.");
+DEFINE_string(vulkan_pending_pipeline_policy, "fallback",
+              "What draws do while their pipeline is being created: 'skip' "
+              "the draw, or 'fallback' to a pipeline with the same shaders "
+              "if one exists (otherwise skipping).");
+DEFINE_bool(vulkan_precreate_pipelines, true,
+            "Create all pipelines from the shader cache at startup, rather "
+            "than when they are first drawn with. Requires "
+            "--shader_cache_dir.");
+DEFINE_bool(vulkan_gpu_untile, true,
+            "Untile and endian swap textures in a compute shader instead of "
+            "on the CPU.");
+DEFINE_int32(vulkan_async_texture_threads, 0,
+             "Number of threads converting new textures with at least 256KiB "
+             "of guest data in the background. Until they're done, draws "
+             "sample a 1x1 black placeholder in their place instead of "
+             "waiting. With 0 textures are converted by the draw that first "
+             "uses them.");
+DEFINE_bool(vulkan_sync_edram, false,
+            "Keep EDRAM contents coherent between render targets of "
+            "different formats and raw resolves, copying through the EDRAM "
+            "buffer only when they read tiles written by another one.");
+DEFINE_int32(vulkan_framebuffer_cache_size, 256,
+             "Number of framebuffers kept for render target configurations, "
+             "the least recently used beyond it being destroyed at the end "
+             "of a frame. 0 keeps all of them.");
+DEFINE_int32(vulkan_resolution_scale, 1,
+             "Scale (1-3) of the width and height of render targets and of "
+             "the textures resolved from them, which stay on the GPU. Raw "
+             "EDRAM accesses are unavailable when above 1.");
+DEFINE_bool(vulkan_resolve_writeback, false,
+            "Also write color resolves to guest memory, for titles reading "
+            "them with the CPU. They're tiled and swapped by a compute "
+            "shader, and copied to guest memory once the GPU is done with "
+            "them. Unavailable with --vulkan_resolution_scale above 1.");
+DEFINE_bool(vulkan_deferred_clears, true,
+            "Leave EDRAM clears to the next render pass on the cleared "
+            "render target, which clears it on load if it covers the "
+            "cleared tiles.");
@@ -17,5 +17,17 @@
 DECLARE_bool(vulkan_renderdoc_capture_all);
 DECLARE_bool(vulkan_native_msaa);
 DECLARE_bool(vulkan_dump_disasm);
+DECLARE_int32(vulkan_pipeline_threads);
+DECLARE_int32(vulkan_recording_threads);
+DECLARE_int32(vulkan_shader_translation_threads);
+DECLARE_string(vulkan_pending_pipeline_policy);
+DECLARE_bool(vulkan_precreate_pipelines);
+DECLARE_bool(vulkan_gpu_untile);
+DECLARE_int32(vulkan_async_texture_threads);
+DECLARE_bool(vulkan_sync_edram);
+DECLARE_int32(vulkan_framebuffer_cache_size);
+DECLARE_int32(vulkan_resolution_scale);
+DECLARE_bool(vulkan_resolve_writeback);
+DECLARE_bool(vulkan_deferred_clears);
 
 #endif  // XENIA_GPU_VULKAN_VULKAN_GPU_FLAGS_H_
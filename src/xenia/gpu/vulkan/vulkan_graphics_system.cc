@@ -12,6 +12,7 @@
 #include <algorithm>
 #include <cstring>
 
+#include "xenia/base/clock.h"
 #include "xenia/base/logging.h"
 #include "xenia/base/profiling.h"
 #include "xenia/cpu/processor.h"
@@ -40,8 +41,10 @@ X_STATUS VulkanGraphicsSystem::Setup(cpu::Processor* processor,
     return result;
   }
 
-  display_context_ = reinterpret_cast<xe::ui::vulkan::VulkanContext*>(
-      target_window->context());
+  if (target_window) {
+    display_context_ = reinterpret_cast<xe::ui::vulkan::VulkanContext*>(
+        target_window->context());
+  }
 
   return X_STATUS_SUCCESS;
 }
@@ -59,13 +62,25 @@ void VulkanGraphicsSystem::Swap(xe::ui::UIEvent* e) {
     return;
   }
   // Check for pending swap.
+  auto swap_chain = display_context_->swap_chain();
   auto& swap_state = command_processor_->swap_state();
+  bool swap_ready;
   {
     std::lock_guard<std::mutex> lock(swap_state.mutex);
+    swap_ready = is_swap_ready();
+  }
+  if (swap_ready) {
+    // Frames still in flight may be reading the front buffer, which the
+    // command processor is about to render the next frame into.
+    swap_chain->WaitOnSubmittedFrames();
+    std::lock_guard<std::mutex> lock(swap_state.mutex);
+    // Without vsync the command processor may have dropped it meanwhile.
     if (swap_state.pending) {
       swap_state.pending = false;
       std::swap(swap_state.front_buffer_texture,
                 swap_state.back_buffer_texture);
+      swap_state.last_latency_ticks =
+          Clock::QueryHostTickCount() - swap_state.pending_host_ticks;
     }
   }
 
@@ -74,8 +89,8 @@ void VulkanGraphicsSystem::Swap(xe::ui::UIEvent* e) {
     return;
   }
 
-  auto swap_chain = display_context_->swap_chain();
-  auto copy_cmd_buffer = swap_chain->copy_cmd_buffer();
+  // The blit covers the whole surface, so it isn't cleared first.
+  auto copy_cmd_buffer = swap_chain->BeginCopy(true);
   auto front_buffer =
       reinterpret_cast<VkImage>(swap_state.front_buffer_texture);
 
@@ -51,6 +51,18 @@ bool VulkanShader::Prepare() {
   return status == VK_SUCCESS;
 }
 
+bool VulkanShader::LoadTranslation(
+    const uint8_t* binary, size_t binary_length,
+    const ConstantRegisterMap& constant_register_map,
+    const std::vector<uint32_t>& memexport_stream_constants) {
+  translated_binary_.assign(binary, binary + binary_length);
+  constant_register_map_ = constant_register_map;
+  memexport_stream_constants_ = memexport_stream_constants;
+  is_translated_ = true;
+  is_valid_ = true;
+  return Prepare();
+}
+
 }  // namespace vulkan
 }  // namespace gpu
 }  // namespace xe
@@ -30,9 +30,22 @@ class VulkanShader : public Shader {
 
   bool Prepare();
 
+  // Program control register the shader was translated with, which is part
+  // of the key it is cached on disk with.
+  uint32_t program_cntl() const { return program_cntl_; }
+  void set_program_cntl(uint32_t program_cntl) { program_cntl_ = program_cntl; }
+
+  // Restores a translation made in a previous run in place of translating.
+  // Binding information must have already been gathered.
+  bool LoadTranslation(
+      const uint8_t* binary, size_t binary_length,
+      const ConstantRegisterMap& constant_register_map,
+      const std::vector<uint32_t>& memexport_stream_constants);
+
  private:
   VkDevice device_ = nullptr;
   VkShaderModule shader_module_ = nullptr;
+  uint32_t program_cntl_ = 0;
 };
 
 }  // namespace vulkan
@@ -263,6 +263,62 @@ inline int GetVertexFormatSizeInWords(VertexFormat format) {
   }
 }
 
+// Location of a fixed point vertex component within the vertex words once
+// they have been swapped to host byte order.
+struct VertexFormatComponent {
+  int word;
+  int offset;
+  int bits;
+};
+
+// Fills in the layout of each component of fixed point formats. Returns false
+// for floating point formats.
+inline bool GetVertexFormatFixedComponents(VertexFormat format,
+                                           VertexFormatComponent* components) {
+  static const VertexFormatComponent k_8_8_8_8[] = {
+      {0, 0, 8}, {0, 8, 8}, {0, 16, 8}, {0, 24, 8}};
+  static const VertexFormatComponent k_2_10_10_10[] = {
+      {0, 20, 10}, {0, 10, 10}, {0, 0, 10}, {0, 30, 2}};
+  static const VertexFormatComponent k_10_11_11[] = {
+      {0, 22, 10}, {0, 11, 11}, {0, 0, 11}};
+  static const VertexFormatComponent k_11_11_10[] = {
+      {0, 21, 11}, {0, 10, 11}, {0, 0, 10}};
+  static const VertexFormatComponent k_16_16_16_16[] = {
+      {0, 0, 16}, {0, 16, 16}, {1, 0, 16}, {1, 16, 16}};
+  static const VertexFormatComponent k_32_32_32_32[] = {
+      {0, 0, 32}, {1, 0, 32}, {2, 0, 32}, {3, 0, 32}};
+  const VertexFormatComponent* source;
+  switch (format) {
+    case VertexFormat::k_8_8_8_8:
+      source = k_8_8_8_8;
+      break;
+    case VertexFormat::k_2_10_10_10:
+      source = k_2_10_10_10;
+      break;
+    case VertexFormat::k_10_11_11:
+      source = k_10_11_11;
+      break;
+    case VertexFormat::k_11_11_10:
+      source = k_11_11_10;
+      break;
+    case VertexFormat::k_16_16:
+    case VertexFormat::k_16_16_16_16:
+      source = k_16_16_16_16;
+      break;
+    case VertexFormat::k_32:
+    case VertexFormat::k_32_32:
+    case VertexFormat::k_32_32_32_32:
+      source = k_32_32_32_32;
+      break;
+    default:
+      return false;
+  }
+  for (int i = 0; i < GetVertexFormatComponentCount(format); ++i) {
+    components[i] = source[i];
+  }
+  return true;
+}
+
 namespace xenos {
 
 typedef enum {
@@ -487,6 +543,45 @@ XEPACKEDUNION(xe_gpu_fetch_group_t, {
   });
 });
 
+// Written to RB_SAMPLE_COUNT_ADDR by ZPASS_DONE events. Little-endian, as D3D
+// swaps it itself. D3D sets both ZPass (or ZFail, in older versions) words
+// to kSampleCountsQueryEnd before the event that ends a query, and polls
+// until they change.
+struct xe_gpu_depth_sample_counts {
+  uint32_t total_a;
+  uint32_t total_b;
+  uint32_t zfail_a;
+  uint32_t zfail_b;
+  uint32_t zpass_a;
+  uint32_t zpass_b;
+  uint32_t stencil_fail_a;
+  uint32_t stencil_fail_b;
+};
+const uint32_t kSampleCountsQueryEnd = 0xFFFFFEED;
+
+// Float constant that memexporting shaders write to eA, with the index of the
+// element added to y. The index and count are in the mantissas of floats
+// offset by 2^23.
+XEPACKEDUNION(xe_gpu_memexport_stream_t, {
+  XEPACKEDSTRUCTANONYMOUS({
+    uint32_t base_address : 30;  // +0 in dwords, physical
+    uint32_t const_0x1 : 2;      // +30
+    uint32_t const_0x4b000000;   // +0 element index added to it
+    uint32_t endianness : 3;     // +0 Endian128
+    uint32_t unk_0 : 5;          // +3
+    uint32_t format : 6;         // +8 ColorFormat
+    uint32_t unk_1 : 18;         // +14
+    uint32_t index_count : 23;   // +0
+    uint32_t const_0x96 : 9;     // +23
+  });
+  XEPACKEDSTRUCTANONYMOUS({
+    uint32_t dword_0;
+    uint32_t dword_1;
+    uint32_t dword_2;
+    uint32_t dword_3;
+  });
+});
+
 enum Event {
   SAMPLE_STREAMOUTSTATS1 = (1 << 0),
   SAMPLE_STREAMOUTSTATS2 = (2 << 0),
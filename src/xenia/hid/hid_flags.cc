@@ -8,3 +8,17 @@
  */
 
 #include "xenia/hid/hid_flags.h"
+
+DEFINE_int32(hid_poll_rate, 500,
+             "Times per second input devices are polled in the background, "
+             "and as input arrives, for guests to read the last state of. 0 "
+             "to poll them on each read instead.");
+DEFINE_string(hid_record_path, "",
+              "File to record the input state the guest reads to, along with "
+              "the guest vblank each change was read on, for "
+              "--hid_replay_path.");
+DEFINE_string(hid_replay_path, "",
+              "Recording made with --hid_record_path to give the guest the "
+              "input state from instead of the devices, each change on the "
+              "vblank it was recorded on. Combined with --benchmark_seconds "
+              "for runs comparable across builds.");
@@ -12,4 +12,8 @@
 
 #include <gflags/gflags.h>
 
+DECLARE_int32(hid_poll_rate);
+DECLARE_string(hid_record_path);
+DECLARE_string(hid_replay_path);
+
 #endif  // XENIA_HID_HID_FLAGS_H_
@@ -9,18 +9,92 @@
 
 #include "xenia/hid/input_system.h"
 
+#include <algorithm>
+#include <cinttypes>
+#include <cstring>
+
+#include "xenia/base/clock.h"
+#include "xenia/base/filesystem.h"
+#include "xenia/base/logging.h"
 #include "xenia/base/profiling.h"
+#include "xenia/base/string.h"
 #include "xenia/hid/hid_flags.h"
 #include "xenia/hid/input_driver.h"
+#include "xenia/ui/window.h"
 
 namespace xe {
 namespace hid {
 
-InputSystem::InputSystem(xe::ui::Window* window) : window_(window) {}
+InputSystem::InputSystem(xe::ui::Window* window) : window_(window) {
+  for (uint32_t i = 0; i < kUserCount; ++i) {
+    snapshots_[i].state[0] = 0;
+    snapshots_[i].state[1] = 0;
+    read_versions_[i] = 0;
+  }
+}
+
+InputSystem::~InputSystem() {
+  if (poller_thread_) {
+    poller_running_ = false;
+    poll_event_->Set();
+    xe::threading::Wait(poller_thread_.get(), false);
+  }
+  if (record_file_) {
+    std::fclose(record_file_);
+  }
+
+  uint64_t count = latency_stats_.count.load(std::memory_order_relaxed);
+  if (count) {
+    double ticks_to_us = 1000000.0 / Clock::host_tick_frequency();
+    XELOGI("Input latency over %" PRIu64 " changes: %.1fus avg, %.1fus max",
+           count,
+           latency_stats_.total_ticks.load(std::memory_order_relaxed) *
+               ticks_to_us / count,
+           latency_stats_.max_ticks.load(std::memory_order_relaxed) *
+               ticks_to_us);
+  }
+}
+
+X_STATUS InputSystem::Setup() {
+  if (!FLAGS_hid_replay_path.empty() && vblank_source_) {
+    replaying_ = LoadReplay(xe::to_wstring(FLAGS_hid_replay_path));
+  }
+  if (!FLAGS_hid_record_path.empty() && vblank_source_ && !replaying_) {
+    record_file_ =
+        xe::filesystem::OpenFile(xe::to_wstring(FLAGS_hid_record_path), "wb");
+    if (!record_file_) {
+      XELOGE("Unable to open input recording %s",
+             FLAGS_hid_record_path.c_str());
+    }
+  }
 
-InputSystem::~InputSystem() = default;
+  // The devices aren't read while replaying.
+  if (FLAGS_hid_poll_rate <= 0 || replaying_) {
+    return X_STATUS_SUCCESS;
+  }
 
-X_STATUS InputSystem::Setup() { return X_STATUS_SUCCESS; }
+  // Guests may read the state before the poller first gets to run.
+  Poll();
+
+  poll_event_ = xe::threading::Event::CreateAutoResetEvent(false);
+  if (window_) {
+    // Added after the drivers' listeners, so they have seen the input by the
+    // time the poller runs.
+    auto on_key = [this](ui::KeyEvent* e) {
+      uint64_t expected = 0;
+      input_ticks_.compare_exchange_strong(expected,
+                                           Clock::QueryHostTickCount());
+      poll_event_->Set();
+    };
+    window_->on_key_down.AddListener(on_key);
+    window_->on_key_up.AddListener(on_key);
+  }
+  poller_running_ = true;
+  poller_thread_ =
+      xe::threading::Thread::Create({}, [this]() { PollerThreadMain(); });
+  poller_thread_->set_name("Input Poller");
+  return X_STATUS_SUCCESS;
+}
 
 void InputSystem::AddDriver(std::unique_ptr<InputDriver> driver) {
   drivers_.push_back(std::move(driver));
@@ -30,6 +104,26 @@ X_RESULT InputSystem::GetCapabilities(uint32_t user_index, uint32_t flags,
                                       X_INPUT_CAPABILITIES* out_caps) {
   SCOPE_profile_cpu_f("hid");
 
+  if (replaying_) {
+    // Users in the recording have a gamepad whatever the host has.
+    if (user_index >= kUserCount || replay_records_[user_index].empty()) {
+      return X_ERROR_DEVICE_NOT_CONNECTED;
+    }
+    out_caps->type = 0x01;      // XINPUT_DEVTYPE_GAMEPAD
+    out_caps->sub_type = 0x01;  // XINPUT_DEVSUBTYPE_GAMEPAD
+    out_caps->flags = 0;
+    out_caps->gamepad.buttons = 0xFFFF;
+    out_caps->gamepad.left_trigger = 0xFF;
+    out_caps->gamepad.right_trigger = 0xFF;
+    out_caps->gamepad.thumb_lx = (int16_t)0xFFFFu;
+    out_caps->gamepad.thumb_ly = (int16_t)0xFFFFu;
+    out_caps->gamepad.thumb_rx = (int16_t)0xFFFFu;
+    out_caps->gamepad.thumb_ry = (int16_t)0xFFFFu;
+    out_caps->vibration.left_motor_speed = 0;
+    out_caps->vibration.right_motor_speed = 0;
+    return X_ERROR_SUCCESS;
+  }
+
   bool any_connected = false;
   for (auto& driver : drivers_) {
     X_RESULT result = driver->GetCapabilities(user_index, flags, out_caps);
@@ -44,6 +138,132 @@ X_RESULT InputSystem::GetCapabilities(uint32_t user_index, uint32_t flags,
 }
 
 X_RESULT InputSystem::GetState(uint32_t user_index, X_INPUT_STATE* out_state) {
+  if (replaying_) {
+    return ReplayState(user_index, out_state);
+  }
+  X_RESULT result = ReadState(user_index, out_state);
+  if (record_file_) {
+    RecordState(user_index, result, out_state);
+  }
+  return result;
+}
+
+X_RESULT InputSystem::ReadState(uint32_t user_index,
+                                X_INPUT_STATE* out_state) {
+  if (!poller_thread_ || user_index >= kUserCount) {
+    return PollState(user_index, out_state);
+  }
+
+  auto& snapshot = snapshots_[user_index];
+  uint32_t sequence;
+  X_RESULT result;
+  uint64_t state[2];
+  uint32_t version;
+  uint64_t changed_ticks;
+  do {
+    sequence = snapshot.sequence.load(std::memory_order_acquire);
+    result = snapshot.result.load(std::memory_order_relaxed);
+    state[0] = snapshot.state[0].load(std::memory_order_relaxed);
+    state[1] = snapshot.state[1].load(std::memory_order_relaxed);
+    version = snapshot.version.load(std::memory_order_relaxed);
+    changed_ticks = snapshot.changed_ticks.load(std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_acquire);
+  } while ((sequence & 1) ||
+           snapshot.sequence.load(std::memory_order_relaxed) != sequence);
+  if (result == X_ERROR_SUCCESS) {
+    std::memcpy(out_state, state, sizeof(X_INPUT_STATE));
+  }
+
+  if (read_versions_[user_index].exchange(version,
+                                          std::memory_order_relaxed) !=
+          version &&
+      changed_ticks) {
+    // The first read of a change.
+    uint64_t latency_ticks = Clock::QueryHostTickCount() - changed_ticks;
+    latency_stats_.count.fetch_add(1, std::memory_order_relaxed);
+    latency_stats_.total_ticks.fetch_add(latency_ticks,
+                                         std::memory_order_relaxed);
+    uint64_t max_ticks =
+        latency_stats_.max_ticks.load(std::memory_order_relaxed);
+    while (latency_ticks > max_ticks &&
+           !latency_stats_.max_ticks.compare_exchange_weak(
+               max_ticks, latency_ticks, std::memory_order_relaxed)) {
+    }
+  }
+  return result;
+}
+
+bool InputSystem::LoadReplay(const std::wstring& path) {
+  FILE* file = xe::filesystem::OpenFile(path, "rb");
+  if (!file) {
+    XELOGE("Unable to open input recording %S", path.c_str());
+    return false;
+  }
+  Record record;
+  size_t record_count = 0;
+  while (std::fread(&record, sizeof(record), 1, file) == 1) {
+    if (record.user_index < kUserCount) {
+      replay_records_[record.user_index].push_back(record);
+      ++record_count;
+    }
+  }
+  std::fclose(file);
+  XELOGI("Replaying %" PRIu64 " input changes from %S",
+         uint64_t(record_count), path.c_str());
+  return true;
+}
+
+void InputSystem::RecordState(uint32_t user_index, X_RESULT result,
+                              const X_INPUT_STATE* state) {
+  if (user_index >= kUserCount) {
+    return;
+  }
+  Record record;
+  std::memset(&record, 0, sizeof(record));
+  record.vblank = vblank_source_();
+  record.user_index = user_index;
+  record.result = result;
+  if (result == X_ERROR_SUCCESS) {
+    std::memcpy(&record.state, state, sizeof(record.state));
+  }
+
+  // Only changes are recorded, replays holding each state until the next.
+  std::lock_guard<std::mutex> lock(record_mutex_);
+  auto& last_record = last_records_[user_index];
+  if (recorded_[user_index] && record.result == last_record.result &&
+      !std::memcmp(&record.state, &last_record.state, sizeof(record.state))) {
+    return;
+  }
+  recorded_[user_index] = true;
+  last_record = record;
+  std::fwrite(&record, sizeof(record), 1, record_file_);
+}
+
+X_RESULT InputSystem::ReplayState(uint32_t user_index,
+                                  X_INPUT_STATE* out_state) {
+  if (user_index >= kUserCount) {
+    return X_ERROR_DEVICE_NOT_CONNECTED;
+  }
+  // The last change recorded by this vblank, if any.
+  auto& records = replay_records_[user_index];
+  uint32_t vblank = vblank_source_();
+  auto it = std::upper_bound(
+      records.begin(), records.end(), vblank,
+      [](uint32_t vblank, const Record& record) {
+        return vblank < record.vblank;
+      });
+  if (it == records.begin()) {
+    return X_ERROR_DEVICE_NOT_CONNECTED;
+  }
+  --it;
+  if (it->result == X_ERROR_SUCCESS) {
+    std::memcpy(out_state, &it->state, sizeof(X_INPUT_STATE));
+  }
+  return it->result;
+}
+
+X_RESULT InputSystem::PollState(uint32_t user_index,
+                                X_INPUT_STATE* out_state) {
   SCOPE_profile_cpu_f("hid");
 
   bool any_connected = false;
@@ -59,6 +279,58 @@ X_RESULT InputSystem::GetState(uint32_t user_index, X_INPUT_STATE* out_state) {
   return any_connected ? X_ERROR_EMPTY : X_ERROR_DEVICE_NOT_CONNECTED;
 }
 
+void InputSystem::PollerThreadMain() {
+  auto interval =
+      std::chrono::milliseconds(std::max(1000 / FLAGS_hid_poll_rate, 1));
+  while (poller_running_) {
+    xe::threading::Wait(poll_event_.get(), false, interval);
+    if (poller_running_) {
+      Poll();
+    }
+  }
+}
+
+void InputSystem::Poll() {
+  SCOPE_profile_cpu_f("hid");
+
+  // Input that arrived as a window event is timed from the event.
+  uint64_t poll_ticks = Clock::QueryHostTickCount();
+  uint64_t input_ticks = input_ticks_.exchange(0);
+  uint64_t changed_ticks = input_ticks ? input_ticks : poll_ticks;
+  for (uint32_t i = 0; i < kUserCount; ++i) {
+    X_INPUT_STATE input_state;
+    std::memset(&input_state, 0, sizeof(input_state));
+    X_RESULT result = PollState(i, &input_state);
+    uint64_t state[2];
+    std::memcpy(state, &input_state, sizeof(state));
+
+    // Only this thread writes the snapshots, so reading them needs no lock.
+    // Some drivers advance the packet number on every poll, so it's only
+    // taken along with changes of the gamepad.
+    auto& snapshot = snapshots_[i];
+    uint64_t last_state[2] = {
+        snapshot.state[0].load(std::memory_order_relaxed),
+        snapshot.state[1].load(std::memory_order_relaxed)};
+    X_INPUT_STATE last_input_state;
+    std::memcpy(&last_input_state, last_state, sizeof(last_input_state));
+    if (result == snapshot.result.load(std::memory_order_relaxed) &&
+        !std::memcmp(&input_state.gamepad, &last_input_state.gamepad,
+                     sizeof(X_INPUT_GAMEPAD))) {
+      continue;
+    }
+    uint32_t sequence = snapshot.sequence.load(std::memory_order_relaxed);
+    snapshot.sequence.store(sequence + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    snapshot.result.store(result, std::memory_order_relaxed);
+    snapshot.state[0].store(state[0], std::memory_order_relaxed);
+    snapshot.state[1].store(state[1], std::memory_order_relaxed);
+    snapshot.version.store(snapshot.version.load(std::memory_order_relaxed) + 1,
+                           std::memory_order_relaxed);
+    snapshot.changed_ticks.store(changed_ticks, std::memory_order_relaxed);
+    snapshot.sequence.store(sequence + 2, std::memory_order_release);
+  }
+}
+
 X_RESULT InputSystem::SetState(uint32_t user_index,
                                X_INPUT_VIBRATION* vibration) {
   SCOPE_profile_cpu_f("hid");
@@ -80,6 +352,13 @@ X_RESULT InputSystem::GetKeystroke(uint32_t user_index, uint32_t flags,
                                    X_INPUT_KEYSTROKE* out_keystroke) {
   SCOPE_profile_cpu_f("hid");
 
+  // Keystrokes aren't recorded, so replays have none.
+  if (replaying_) {
+    return user_index < kUserCount && !replay_records_[user_index].empty()
+               ? X_ERROR_EMPTY
+               : X_ERROR_DEVICE_NOT_CONNECTED;
+  }
+
   bool any_connected = false;
   for (auto& driver : drivers_) {
     X_RESULT result = driver->GetKeystroke(user_index, flags, out_keystroke);
@@ -10,9 +10,15 @@
 #ifndef XENIA_HID_INPUT_SYSTEM_H_
 #define XENIA_HID_INPUT_SYSTEM_H_
 
+#include <atomic>
+#include <cstdio>
+#include <functional>
 #include <memory>
+#include <mutex>
+#include <string>
 #include <vector>
 
+#include "xenia/base/threading.h"
 #include "xenia/hid/input.h"
 #include "xenia/hid/input_driver.h"
 #include "xenia/xbox.h"
@@ -26,6 +32,14 @@ class Window;
 namespace xe {
 namespace hid {
 
+// Unless --hid_poll_rate is 0, the drivers are polled for the state of each
+// user on a background thread, at that rate and whenever the window gets
+// key input, and GetState returns the last polled state without locking.
+//
+// The states the guest reads can be recorded with --hid_record_path, keyed
+// by the guest vblank they were read on, and given back to the guest in
+// place of the devices' with --hid_replay_path, so that runs of the same
+// segment get the same input on the same frames.
 class InputSystem {
  public:
   explicit InputSystem(xe::ui::Window* window);
@@ -33,6 +47,13 @@ class InputSystem {
 
   xe::ui::Window* window() const { return window_; }
 
+  // Gives the guest vblank count that recordings are keyed by. Must be set
+  // before Setup for recording or replaying.
+  void set_vblank_source(std::function<uint32_t()> vblank_source) {
+    vblank_source_ = std::move(vblank_source);
+  }
+
+  // Starts polling, so must be called after the drivers are added.
   X_STATUS Setup();
 
   void AddDriver(std::unique_ptr<InputDriver> driver);
@@ -44,10 +65,79 @@ class InputSystem {
   X_RESULT GetKeystroke(uint32_t user_index, uint32_t flags,
                         X_INPUT_KEYSTROKE* out_keystroke);
 
+  // The time from input arriving, or being polled if it didn't come as a
+  // window event, to the guest first reading the changed state, in host
+  // ticks.
+  struct LatencyStats {
+    std::atomic<uint64_t> count = {0};
+    std::atomic<uint64_t> total_ticks = {0};
+    std::atomic<uint64_t> max_ticks = {0};
+  };
+  const LatencyStats& latency_stats() const { return latency_stats_; }
+
  private:
+  static const uint32_t kUserCount = 4;
+
+  // The last polled state of a user, written by the poller only and read
+  // with a sequence lock.
+  struct Snapshot {
+    // Odd while being written.
+    std::atomic<uint32_t> sequence = {0};
+    std::atomic<uint32_t> result = {X_ERROR_DEVICE_NOT_CONNECTED};
+    // The X_INPUT_STATE.
+    std::atomic<uint64_t> state[2];
+    // Counts changes of the state, with the host ticks of the last one.
+    std::atomic<uint32_t> version = {0};
+    std::atomic<uint64_t> changed_ticks = {0};
+  };
+  static_assert(sizeof(X_INPUT_STATE) == sizeof(Snapshot::state),
+                "The state must fit the snapshot");
+
+  // A change of the state of a user as read by the guest, as stored in
+  // recordings.
+  struct Record {
+    uint32_t vblank;
+    uint32_t user_index;
+    X_RESULT result;
+    X_INPUT_STATE state;
+  };
+  static_assert(sizeof(Record) == 12 + sizeof(X_INPUT_STATE),
+                "Records must be tightly packed");
+
+  X_RESULT ReadState(uint32_t user_index, X_INPUT_STATE* out_state);
+  X_RESULT PollState(uint32_t user_index, X_INPUT_STATE* out_state);
+  bool LoadReplay(const std::wstring& path);
+  void RecordState(uint32_t user_index, X_RESULT result,
+                   const X_INPUT_STATE* state);
+  X_RESULT ReplayState(uint32_t user_index, X_INPUT_STATE* out_state);
+  void PollerThreadMain();
+  void Poll();
+
   xe::ui::Window* window_ = nullptr;
 
   std::vector<std::unique_ptr<InputDriver>> drivers_;
+
+  Snapshot snapshots_[kUserCount];
+  // Version of each snapshot the guest has read last.
+  std::atomic<uint32_t> read_versions_[kUserCount];
+  LatencyStats latency_stats_;
+
+  std::atomic<bool> poller_running_ = {false};
+  std::unique_ptr<xe::threading::Event> poll_event_;
+  // Host ticks of the window input that set poll_event_, or 0.
+  std::atomic<uint64_t> input_ticks_ = {0};
+  std::unique_ptr<xe::threading::Thread> poller_thread_;
+
+  std::function<uint32_t()> vblank_source_;
+  FILE* record_file_ = nullptr;
+  // Last state recorded for each user, or none.
+  std::mutex record_mutex_;
+  bool recorded_[kUserCount] = {false};
+  Record last_records_[kUserCount];
+  // Records of each user when replaying, in vblank order. Not changed after
+  // Setup, so reading them needs no lock.
+  bool replaying_ = false;
+  std::vector<Record> replay_records_[kUserCount];
 };
 
 }  // namespace hid
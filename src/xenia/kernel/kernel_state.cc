@@ -11,6 +11,8 @@
 
 #include <gflags/gflags.h>
 
+#include <algorithm>
+#include <iterator>
 #include <string>
 
 #include "xenia/base/assert.h"
@@ -30,7 +32,16 @@
 #include "xenia/kernel/xthread.h"
 
 DEFINE_bool(headless, false,
-            "Don't display any UI, using defaults for prompts as needed.");
+            "Don't display any UI, using defaults for prompts as needed. "
+            "Runs without a window, rendering with Vulkan but not "
+            "presenting, until the title exits.");
+DEFINE_bool(profile_kernel_locks, false,
+            "Log the time spent waiting for kernel locks, by call site.");
+DEFINE_int32(io_threads, 2,
+             "Number of threads running overlapped guest file IO, or 0 to "
+             "run it on the guest thread.");
+DEFINE_int32(thread_stack_pool_size, 16,
+             "Number of guest stacks of exited threads kept for new threads.");
 DEFINE_string(content_root, "content",
               "Root path for content (save/etc) storage.");
 
@@ -54,12 +65,18 @@ KernelState::KernelState(Emulator* emulator)
   processor_ = emulator->processor();
   file_system_ = emulator->file_system();
 
+  xe::profiled_mutex::set_profiling_enabled(FLAGS_profile_kernel_locks);
+
   app_manager_ = std::make_unique<xam::AppManager>();
   user_profile_ = std::make_unique<xam::UserProfile>();
 
   auto content_root = xe::to_wstring(FLAGS_content_root);
   content_root = xe::to_absolute_path(content_root);
   content_manager_ = std::make_unique<xam::ContentManager>(this, content_root);
+  // Only started once the title starts winsock.
+  socket_poller_ = std::make_unique<xam::SocketPoller>();
+
+  timer_wheel_ = std::make_unique<TimerWheel>(this);
 
   assert_null(shared_kernel_state_);
   shared_kernel_state_ = this;
@@ -89,12 +106,31 @@ KernelState::~KernelState() {
   SetExecutableModule(nullptr);
 
   if (dispatch_thread_running_) {
-    dispatch_thread_running_ = false;
-    dispatch_cond_.notify_all();
+    {
+      auto dispatch_lock = dispatch_mutex_.Acquire();
+      dispatch_thread_running_ = false;
+      dispatch_cond_.notify_all();
+    }
     dispatch_thread_->Wait(0, 0, 0, nullptr);
   }
 
+  // Queued IO is finished first, as the guest may be waiting on it.
+  {
+    auto io_lock = io_mutex_.Acquire();
+    io_threads_running_ = false;
+    io_cond_.notify_all();
+  }
+  for (auto& io_thread : io_threads_) {
+    io_thread->Wait(0, 0, 0, nullptr);
+  }
+  io_threads_.clear();
+
+  // Timers stay scheduled until their objects are deleted, but stop firing.
+  timer_wheel_->Shutdown();
+
   executable_module_.reset();
+  std::atomic_store(&module_name_cache_,
+                    std::shared_ptr<const ModuleNameCache>());
   user_modules_.clear();
   kernel_modules_.clear();
 
@@ -110,6 +146,10 @@ KernelState::~KernelState() {
 
   assert_true(shared_kernel_state_ == this);
   shared_kernel_state_ = nullptr;
+
+  if (xe::profiled_mutex::is_profiling_enabled()) {
+    xe::profiled_mutex::DumpProfile();
+  }
 }
 
 KernelState* KernelState::shared() { return shared_kernel_state_; }
@@ -167,7 +207,7 @@ void KernelState::RegisterModule(XModule* module) {}
 void KernelState::UnregisterModule(XModule* module) {}
 
 bool KernelState::RegisterUserModule(object_ref<UserModule> module) {
-  auto lock = global_critical_region_.Acquire();
+  auto module_lock = module_mutex_.Acquire();
 
   for (auto user_module : user_modules_) {
     if (user_module->path() == module->path()) {
@@ -181,14 +221,22 @@ bool KernelState::RegisterUserModule(object_ref<UserModule> module) {
 }
 
 void KernelState::UnregisterUserModule(UserModule* module) {
-  auto lock = global_critical_region_.Acquire();
+  object_ref<UserModule> removed_module;
+  std::shared_ptr<const ModuleNameCache> old_cache;
+  auto module_lock = module_mutex_.Acquire();
+
+  old_cache = std::atomic_exchange(&module_name_cache_,
+                                   std::shared_ptr<const ModuleNameCache>());
 
   for (auto it = user_modules_.begin(); it != user_modules_.end(); it++) {
     if ((*it)->path() == module->path()) {
+      // Released after unlocking.
+      removed_module = std::move(*it);
       user_modules_.erase(it);
-      return;
+      break;
     }
   }
+  module_lock.unlock();
 }
 
 bool KernelState::IsKernelModule(const char* name) {
@@ -227,30 +275,78 @@ object_ref<XModule> KernelState::GetModule(const char* name, bool user_only) {
     return nullptr;
   }
 
-  auto global_lock = global_critical_region_.Acquire();
-
   if (!user_only) {
-    for (auto kernel_module : kernel_modules_) {
-      if (kernel_module->Matches(name)) {
-        return retain_object(kernel_module.get());
+    auto cache = std::atomic_load(&module_name_cache_);
+    if (cache) {
+      auto it = cache->find(name);
+      if (it != cache->end()) {
+        return retain_object(it->second.get());
       }
     }
   }
 
   std::string path(name);
 
-  // Resolve the path to an absolute path.
+  // Resolve the path to an absolute path, before locking as the file system
+  // takes its own locks.
   auto entry = file_system_->ResolvePath(name);
   if (entry) {
     path = entry->absolute_path();
   }
 
-  for (auto user_module : user_modules_) {
-    if (user_module->Matches(path)) {
-      return retain_object(user_module.get());
+  // Released after unlocking.
+  std::shared_ptr<const ModuleNameCache> old_cache;
+  auto module_lock = module_mutex_.Acquire();
+
+  object_ref<XModule> module;
+  if (!user_only) {
+    for (auto kernel_module : kernel_modules_) {
+      if (kernel_module->Matches(name)) {
+        module = kernel_module;
+        break;
+      }
     }
   }
-  return nullptr;
+  if (!module) {
+    for (auto user_module : user_modules_) {
+      if (user_module->Matches(path)) {
+        module = user_module;
+        break;
+      }
+    }
+  }
+
+  // Modules are only appended, so the match stays the first one until one
+  // is removed.
+  if (module && !user_only) {
+    old_cache = std::atomic_load(&module_name_cache_);
+    auto cache = old_cache ? std::make_shared<ModuleNameCache>(*old_cache)
+                           : std::make_shared<ModuleNameCache>();
+    cache->emplace(name, module);
+    std::atomic_store(&module_name_cache_,
+                      std::shared_ptr<const ModuleNameCache>(std::move(cache)));
+  }
+  return module;
+}
+
+std::vector<object_ref<UserModule>> KernelState::GetUserModules() {
+  auto module_lock = module_mutex_.Acquire();
+  return user_modules_;
+}
+
+std::vector<std::unique_lock<xe::profiled_mutex>>
+KernelState::AcquireSuspendLocks() {
+  std::vector<std::unique_lock<xe::profiled_mutex>> locks;
+  locks.reserve(5 + threads_by_id_.size());
+  locks.push_back(module_mutex_.Acquire());
+  locks.push_back(object_table_.AcquireLock());
+  locks.push_back(dispatch_mutex_.Acquire());
+  locks.push_back(io_mutex_.Acquire());
+  locks.push_back(timer_wheel_->AcquireLock());
+  for (auto& it : threads_by_id_) {
+    locks.push_back(it.second->AcquireApcLock());
+  }
+  return locks;
 }
 
 object_ref<UserModule> KernelState::GetExecutableModule() {
@@ -296,17 +392,21 @@ void KernelState::SetExecutableModule(object_ref<UserModule> module) {
     dispatch_thread_running_ = true;
     dispatch_thread_ =
         object_ref<XHostThread>(new XHostThread(this, 128 * 1024, 0, [this]() {
-          while (dispatch_thread_running_) {
-            auto global_lock = global_critical_region_.Acquire();
-            if (dispatch_queue_.empty()) {
-              dispatch_cond_.wait(global_lock);
-              if (!dispatch_thread_running_) {
-                break;
-              }
+          auto dispatch_lock = dispatch_mutex_.Acquire();
+          while (true) {
+            while (dispatch_thread_running_ && dispatch_queue_.empty()) {
+              dispatch_cond_.wait(dispatch_lock);
+            }
+            if (!dispatch_thread_running_) {
+              break;
             }
             auto fn = std::move(dispatch_queue_.front());
             dispatch_queue_.pop_front();
+            // Run unlocked, as the callbacks sleep and take other locks.
+            dispatch_lock.unlock();
             fn();
+            fn = nullptr;
+            dispatch_lock.lock();
           }
           return 0;
         }));
@@ -315,10 +415,30 @@ void KernelState::SetExecutableModule(object_ref<UserModule> module) {
     dispatch_thread_->set_name("Kernel Dispatch Thread");
     dispatch_thread_->Create();
   }
+
+  timer_wheel_->Start();
+
+  // Spin up the overlapped IO workers.
+  if (io_threads_.empty() && FLAGS_io_threads > 0) {
+    {
+      auto io_lock = io_mutex_.Acquire();
+      io_threads_running_ = true;
+    }
+    for (int32_t i = 0; i < FLAGS_io_threads; ++i) {
+      auto io_thread = object_ref<XHostThread>(
+          new XHostThread(this, 128 * 1024, 0, [this]() {
+            IOThreadMain();
+            return 0;
+          }));
+      io_thread->set_name("Kernel IO Thread " + std::to_string(i));
+      io_thread->Create();
+      io_threads_.push_back(std::move(io_thread));
+    }
+  }
 }
 
 void KernelState::LoadKernelModule(object_ref<KernelModule> kernel_module) {
-  auto global_lock = global_critical_region_.Acquire();
+  auto module_lock = module_mutex_.Acquire();
   kernel_modules_.push_back(std::move(kernel_module));
 }
 
@@ -334,7 +454,7 @@ object_ref<UserModule> KernelState::LoadUserModule(const char* raw_name,
 
   object_ref<UserModule> module;
   {
-    auto global_lock = global_critical_region_.Acquire();
+    auto module_lock = module_mutex_.Acquire();
 
     // See if we've already loaded it
     for (auto& existing_module : user_modules_) {
@@ -344,7 +464,7 @@ object_ref<UserModule> KernelState::LoadUserModule(const char* raw_name,
       }
     }
 
-    global_lock.unlock();
+    module_lock.unlock();
 
     // Module wasn't loaded, so load it.
     module = object_ref<UserModule>(new UserModule(this));
@@ -354,7 +474,7 @@ object_ref<UserModule> KernelState::LoadUserModule(const char* raw_name,
       return nullptr;
     }
 
-    global_lock.lock();
+    module_lock.lock();
 
     // Retain when putting into the listing.
     module->Retain();
@@ -413,6 +533,7 @@ void KernelState::TerminateTitle() {
         // so it's guaranteed to not be holding any locks / in host kernel
         // code / etc). Can't do that properly if we have the lock.
         if (!emulator_->is_paused()) {
+          auto suspend_locks = AcquireSuspendLocks();
           thread->thread()->Suspend();
         }
 
@@ -430,13 +551,22 @@ void KernelState::TerminateTitle() {
   }
 
   // Third: Unload all user modules (including the executable).
-  for (size_t i = 0; i < user_modules_.size(); i++) {
-    X_STATUS status = user_modules_[i]->Unload();
+  std::vector<object_ref<UserModule>> user_modules;
+  std::shared_ptr<const ModuleNameCache> old_cache;
+  {
+    auto module_lock = module_mutex_.Acquire();
+    user_modules.swap(user_modules_);
+    old_cache = std::atomic_exchange(&module_name_cache_,
+                                     std::shared_ptr<const ModuleNameCache>());
+  }
+  old_cache.reset();
+  for (auto& user_module : user_modules) {
+    X_STATUS status = user_module->Unload();
     assert_true(XSUCCEEDED(status));
 
-    object_table_.RemoveHandle(user_modules_[i]->handle());
+    object_table_.RemoveHandle(user_module->handle());
   }
-  user_modules_.clear();
+  user_modules.clear();
 
   // Release all objects in the object table.
   object_table_.PurgeAllObjects();
@@ -487,7 +617,7 @@ void KernelState::OnThreadExecute(XThread* thread) {
   // Call DllMain(DLL_THREAD_ATTACH) for each user module:
   // https://msdn.microsoft.com/en-us/library/windows/desktop/ms682583%28v=vs.85%29.aspx
   auto thread_state = thread->thread_state();
-  for (auto user_module : user_modules_) {
+  for (auto user_module : GetUserModules()) {
     if (user_module->is_dll_module() && user_module->entry_point()) {
       uint64_t args[] = {
           user_module->handle(),
@@ -509,7 +639,7 @@ void KernelState::OnThreadExit(XThread* thread) {
   // Call DllMain(DLL_THREAD_DETACH) for each user module:
   // https://msdn.microsoft.com/en-us/library/windows/desktop/ms682583%28v=vs.85%29.aspx
   auto thread_state = thread->thread_state();
-  for (auto user_module : user_modules_) {
+  for (auto user_module : GetUserModules()) {
     if (user_module->is_dll_module() && user_module->entry_point()) {
       uint64_t args[] = {
           user_module->handle(),
@@ -633,7 +763,7 @@ void KernelState::CompleteOverlappedDeferredEx(
   auto ptr = memory()->TranslateVirtual(overlapped_ptr);
   XOverlappedSetResult(ptr, X_ERROR_IO_PENDING);
   XOverlappedSetContext(ptr, XThread::GetCurrentThreadHandle());
-  auto global_lock = global_critical_region_.Acquire();
+  auto dispatch_lock = dispatch_mutex_.Acquire();
   dispatch_queue_.push_back([this, completion_callback, overlapped_ptr, result,
                              extended_error, length]() {
     xe::threading::Sleep(
@@ -644,6 +774,57 @@ void KernelState::CompleteOverlappedDeferredEx(
   dispatch_cond_.notify_all();
 }
 
+void KernelState::IOThreadMain() {
+  auto io_lock = io_mutex_.Acquire();
+  while (true) {
+    while (io_threads_running_ && io_queue_.empty()) {
+      io_cond_.wait(io_lock);
+    }
+    if (io_queue_.empty()) {
+      break;
+    }
+    auto fn = std::move(io_queue_.front());
+    io_queue_.pop_front();
+    io_lock.unlock();
+    fn();
+    fn = nullptr;
+    io_lock.lock();
+  }
+}
+
+bool KernelState::QueueIO(std::function<void()> fn) {
+  auto io_lock = io_mutex_.Acquire();
+  if (!io_threads_running_) {
+    return false;
+  }
+  io_queue_.push_back(std::move(fn));
+  io_cond_.notify_one();
+  return true;
+}
+
+bool KernelState::TakeThreadStack(uint32_t alloc_size,
+                                  uint32_t* out_alloc_base) {
+  auto stack_lock = thread_stack_mutex_.Acquire();
+  for (auto it = thread_stacks_.rbegin(); it != thread_stacks_.rend(); ++it) {
+    if (it->first == alloc_size) {
+      *out_alloc_base = it->second;
+      thread_stacks_.erase(std::next(it).base());
+      return true;
+    }
+  }
+  return false;
+}
+
+bool KernelState::ReturnThreadStack(uint32_t alloc_base, uint32_t alloc_size) {
+  auto stack_lock = thread_stack_mutex_.Acquire();
+  size_t max_stack_count = size_t(std::max(FLAGS_thread_stack_pool_size, 0));
+  if (thread_stacks_.size() >= max_stack_count) {
+    return false;
+  }
+  thread_stacks_.emplace_back(alloc_size, alloc_base);
+  return true;
+}
+
 bool KernelState::Save(ByteStream* stream) {
   XELOGD("Serializing the kernel...");
   stream->Write('KRNL');
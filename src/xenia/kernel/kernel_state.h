@@ -17,15 +17,20 @@
 #include <functional>
 #include <list>
 #include <memory>
+#include <string>
+#include <unordered_map>
+#include <utility>
 #include <vector>
 
 #include "xenia/base/bit_map.h"
 #include "xenia/base/mutex.h"
 #include "xenia/cpu/export_resolver.h"
+#include "xenia/kernel/timer_wheel.h"
 #include "xenia/kernel/util/native_list.h"
 #include "xenia/kernel/util/object_table.h"
 #include "xenia/kernel/xam/app_manager.h"
 #include "xenia/kernel/xam/content_manager.h"
+#include "xenia/kernel/xam/socket_poller.h"
 #include "xenia/kernel/xam/user_profile.h"
 #include "xenia/memory.h"
 #include "xenia/vfs/virtual_file_system.h"
@@ -106,9 +111,11 @@ class KernelState {
     return content_manager_.get();
   }
   xam::UserProfile* user_profile() const { return user_profile_.get(); }
+  xam::SocketPoller* socket_poller() const { return socket_poller_.get(); }
 
-  // Access must be guarded by the global critical region.
+  // Locks itself, see the lock order below.
   util::ObjectTable* object_table() { return &object_table_; }
+  TimerWheel* timer_wheel() { return timer_wheel_.get(); }
 
   uint32_t process_type() const;
   void set_process_type(uint32_t value);
@@ -129,6 +136,12 @@ class KernelState {
   bool IsKernelModule(const char* name);
   object_ref<XModule> GetModule(const char* name, bool user_only = false);
 
+  // Acquires all the kernel leaf locks, including the APC locks of every
+  // thread. Held along with the global critical region while suspending
+  // guest threads from other threads, so none is suspended holding one.
+  // Must be called within the global critical region.
+  std::vector<std::unique_lock<xe::profiled_mutex>> AcquireSuspendLocks();
+
   object_ref<UserModule> GetExecutableModule();
   void SetExecutableModule(object_ref<UserModule> module);
   object_ref<UserModule> LoadUserModule(const char* name,
@@ -175,11 +188,25 @@ class KernelState {
                                     uint32_t overlapped_ptr, X_RESULT result,
                                     uint32_t extended_error, uint32_t length);
 
+  // Runs the function on one of the IO threads, for overlapped file IO.
+  // Returns false if there are none, for the caller to run it itself.
+  bool QueueIO(std::function<void()> fn);
+
+  // Guest stacks of deleted threads are kept, with their guard pages, for
+  // new threads with stacks of the same size. Returns false if there is
+  // none of the size.
+  bool TakeThreadStack(uint32_t alloc_size, uint32_t* out_alloc_base);
+  // Returns false if the pool is full, for the caller to release the stack.
+  bool ReturnThreadStack(uint32_t alloc_base, uint32_t alloc_size);
+
   bool Save(ByteStream* stream);
   bool Restore(ByteStream* stream);
 
  private:
   void LoadKernelModule(object_ref<KernelModule> kernel_module);
+  // A copy of the user module list, to call into without holding its lock.
+  std::vector<object_ref<UserModule>> GetUserModules();
+  void IOThreadMain();
 
   Emulator* emulator_;
   Memory* memory_;
@@ -189,19 +216,44 @@ class KernelState {
   std::unique_ptr<xam::AppManager> app_manager_;
   std::unique_ptr<xam::ContentManager> content_manager_;
   std::unique_ptr<xam::UserProfile> user_profile_;
-
+  std::unique_ptr<xam::SocketPoller> socket_poller_;
+
+  // Lock order: the global critical region is always acquired first. The
+  // rest are leaf locks, split off it so the state they guard isn't
+  // serialized with everything else:
+  //   module_mutex_: the module lists.
+  //   the object table lock: handles and names, not taken by lookups.
+  //   dispatch_mutex_: the deferred dispatch queue.
+  //   io_mutex_: the overlapped IO queue.
+  //   thread_stack_mutex_: the pooled thread stacks.
+  //   the timer wheel lock: guest timers and delays.
+  //   XThread APC locks: the APC list of each thread.
+  // No other lock is acquired while holding a leaf lock, and no other code
+  // (object releases, guest code, memory allocation) is run. Guest threads
+  // may still be suspended with the global critical region held by someone
+  // else, so suspending them also takes the leaf locks, see
+  // AcquireSuspendLocks.
   xe::global_critical_region global_critical_region_;
 
-  // Must be guarded by the global critical region.
   util::ObjectTable object_table_;
+  // Must be guarded by the global critical region.
   std::unordered_map<uint32_t, XThread*> threads_by_id_;
   std::vector<object_ref<NotifyListener>> notify_listeners_;
   bool has_notified_startup_ = false;
 
   uint32_t process_type_ = X_PROCTYPE_USER;
   object_ref<UserModule> executable_module_;
+  xe::profiled_mutex module_mutex_{"module_list"};
+  // Must be guarded by module_mutex_.
   std::vector<object_ref<KernelModule>> kernel_modules_;
   std::vector<object_ref<UserModule>> user_modules_;
+  // Modules GetModule found, by the name asked for, so that titles looking
+  // them up as they run neither resolve the path nor take module_mutex_.
+  // Replaced whole, with module_mutex_ held, and dropped when a module is
+  // removed. Read with std::atomic_load.
+  using ModuleNameCache =
+      std::unordered_map<std::string, object_ref<XModule>>;
+  std::shared_ptr<const ModuleNameCache> module_name_cache_;
   std::vector<TerminateNotification> terminate_notifications_;
 
   uint32_t process_info_block_address_ = 0;
@@ -210,9 +262,25 @@ class KernelState {
   object_ref<XHostThread> dispatch_thread_;
   // Must be guarded by the global critical region.
   util::NativeList dpc_list_;
+  xe::profiled_mutex dispatch_mutex_{"dispatch_queue"};
   std::condition_variable_any dispatch_cond_;
+  // Must be guarded by dispatch_mutex_.
   std::list<std::function<void()>> dispatch_queue_;
 
+  std::vector<object_ref<XHostThread>> io_threads_;
+  xe::profiled_mutex io_mutex_{"io_queue"};
+  std::condition_variable_any io_cond_;
+  // Must be guarded by io_mutex_.
+  bool io_threads_running_ = false;
+  std::list<std::function<void()>> io_queue_;
+
+  std::unique_ptr<TimerWheel> timer_wheel_;
+
+  xe::profiled_mutex thread_stack_mutex_{"thread_stack_pool"};
+  // Must be guarded by thread_stack_mutex_. The sizes and bases of the
+  // pooled allocations.
+  std::vector<std::pair<uint32_t, uint32_t>> thread_stacks_;
+
   BitMap tls_bitmap_;
 
   friend class XObject;
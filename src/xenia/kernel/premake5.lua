@@ -14,6 +14,7 @@ project("xenia-kernel")
     "xenia-hid",
     "xenia-ui",
     "xenia-vfs",
+    "xxhash",
   })
   defines({
   })
@@ -0,0 +1,259 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2016 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#include "xenia/kernel/timer_wheel.h"
+
+#include <gflags/gflags.h>
+
+#include <algorithm>
+
+#include "xenia/base/clock.h"
+#include "xenia/base/math.h"
+#include "xenia/kernel/xthread.h"
+
+DEFINE_int32(timer_wheel_resolution_us, 500,
+             "Granularity of guest timer and delay expirations, in "
+             "microseconds.");
+
+namespace xe {
+namespace kernel {
+
+TimerWheel::TimerWheel(KernelState* kernel_state)
+    : kernel_state_(kernel_state) {
+  start_time_ = clock::now();
+  resolution_ = std::chrono::duration_cast<clock::duration>(
+      std::chrono::microseconds(
+          std::max(FLAGS_timer_wheel_resolution_us, 1)));
+  resolution_ = std::max(resolution_, clock::duration(1));
+}
+
+TimerWheel::~TimerWheel() { Shutdown(); }
+
+void TimerWheel::Start() {
+  {
+    auto lock = mutex_.Acquire();
+    if (running_) {
+      return;
+    }
+    running_ = true;
+  }
+  thread_ = object_ref<XHostThread>(
+      new XHostThread(kernel_state_, 128 * 1024, 0, [this]() {
+        ThreadMain();
+        return 0;
+      }));
+  thread_->set_name("Kernel Timer Wheel");
+  thread_->Create();
+}
+
+void TimerWheel::Shutdown() {
+  if (!thread_) {
+    return;
+  }
+  {
+    auto lock = mutex_.Acquire();
+    running_ = false;
+    cond_.notify_all();
+  }
+  thread_->Wait(0, 0, 0, nullptr);
+  thread_.reset();
+}
+
+TimerWheel::TimerId TimerWheel::Schedule(std::chrono::nanoseconds due_time,
+                                         std::chrono::nanoseconds period,
+                                         std::function<void()> callback) {
+  auto now = clock::now();
+  auto lock = mutex_.Acquire();
+  // The current tick only moves as the thread runs, so it may be far behind
+  // after the thread slept, which would put near timers in the overflow.
+  AdvanceTo(uint64_t((now - start_time_) / resolution_));
+  TimerId timer_id = next_timer_id_++;
+  auto& timer = timers_[timer_id];
+  timer.due_time =
+      now + std::chrono::duration_cast<clock::duration>(
+                std::max(due_time, std::chrono::nanoseconds::zero()));
+  timer.period = std::chrono::duration_cast<clock::duration>(
+      std::max(period, std::chrono::nanoseconds::zero()));
+  timer.callback = std::move(callback);
+  Insert(timer_id, &timer);
+  return timer_id;
+}
+
+bool TimerWheel::Cancel(TimerId timer_id) {
+  auto lock = mutex_.Acquire();
+  // Its ids in the slots and the overflow map are skipped when reached.
+  bool canceled = timers_.erase(timer_id) != 0;
+  if (running_batch_ &&
+      std::any_of(batch_.begin(), batch_.end(),
+                  [timer_id](const std::pair<TimerId, std::function<void()>>&
+                                 entry) { return entry.first == timer_id; })) {
+    canceled = false;
+    if (!XThread::IsInThread(thread_.get())) {
+      while (running_batch_) {
+        batch_cond_.wait(lock);
+      }
+    }
+  }
+  return canceled;
+}
+
+std::chrono::nanoseconds TimerWheel::GuestDueTime(int64_t due_time) {
+  int64_t guest_duration;
+  if (due_time > 0) {
+    // Absolute time, based on January 1, 1601.
+    guest_duration = due_time - int64_t(Clock::QueryGuestSystemTime());
+  } else {
+    guest_duration = -due_time;
+  }
+  if (guest_duration <= 0) {
+    return std::chrono::nanoseconds::zero();
+  }
+  return std::chrono::nanoseconds(
+      int64_t(guest_duration * Clock::guest_time_scalar() * 100));
+}
+
+uint64_t TimerWheel::TickAt(clock::time_point time) const {
+  // Rounded up, so nothing fires early.
+  auto elapsed = std::max(time - start_time_, clock::duration::zero());
+  return uint64_t((elapsed + resolution_ - clock::duration(1)) / resolution_);
+}
+
+void TimerWheel::Insert(TimerId timer_id, Timer* timer) {
+  timer->due_tick = std::max(TickAt(timer->due_time), current_tick_);
+  if (timer->due_tick - current_tick_ >= kSlotCount) {
+    overflow_.emplace(timer->due_tick, timer_id);
+  } else {
+    uint32_t slot = uint32_t(timer->due_tick % kSlotCount);
+    slots_[slot].push_back(timer_id);
+    occupied_slots_[slot / 64] |= 1ull << (slot & 63);
+  }
+  if (timer->due_tick < wake_tick_) {
+    cond_.notify_one();
+  }
+}
+
+void TimerWheel::RefillSlots() {
+  // Overflowing timers may also be due before the current tick if it was
+  // advanced past them, and are then put in its slot.
+  while (!overflow_.empty() &&
+         overflow_.begin()->first < current_tick_ + kSlotCount) {
+    TimerId timer_id = overflow_.begin()->second;
+    overflow_.erase(overflow_.begin());
+    auto it = timers_.find(timer_id);
+    if (it != timers_.end()) {
+      Insert(timer_id, &it->second);
+    }
+  }
+}
+
+uint64_t TimerWheel::FindNextSlotTick() const {
+  // Occupied slots from the current one on, wrapping around.
+  const uint32_t kWordCount = kSlotCount / 64;
+  uint32_t first_slot = uint32_t(current_tick_ % kSlotCount);
+  for (uint32_t i = 0; i <= kWordCount; ++i) {
+    uint32_t word_index = (first_slot / 64 + i) % kWordCount;
+    uint64_t word = occupied_slots_[word_index];
+    if (i == 0) {
+      word &= ~0ull << (first_slot & 63);
+    } else if (i == kWordCount) {
+      word &= ~(~0ull << (first_slot & 63));
+    }
+    uint32_t bit;
+    if (xe::bit_scan_forward(word, &bit)) {
+      uint32_t slot = word_index * 64 + bit;
+      return current_tick_ + (slot + kSlotCount - first_slot) % kSlotCount;
+    }
+  }
+  return UINT64_MAX;
+}
+
+void TimerWheel::AdvanceTo(uint64_t tick) {
+  current_tick_ = std::max(current_tick_, std::min(tick, FindNextSlotTick()));
+}
+
+uint64_t TimerWheel::FindNextDueTick() {
+  RefillSlots();
+  uint64_t slot_tick = FindNextSlotTick();
+  if (slot_tick != UINT64_MAX) {
+    return slot_tick;
+  }
+  return overflow_.empty() ? UINT64_MAX : overflow_.begin()->first;
+}
+
+void TimerWheel::ExpireCurrentTick(clock::time_point now) {
+  uint32_t slot = uint32_t(current_tick_ % kSlotCount);
+  occupied_slots_[slot / 64] &= ~(1ull << (slot & 63));
+  std::swap(expiring_ids_, slots_[slot]);
+  for (TimerId timer_id : expiring_ids_) {
+    auto it = timers_.find(timer_id);
+    if (it == timers_.end() || it->second.due_tick != current_tick_) {
+      continue;
+    }
+    auto& timer = it->second;
+    if (timer.period == clock::duration::zero()) {
+      batch_.emplace_back(timer_id, std::move(timer.callback));
+      timers_.erase(it);
+      continue;
+    }
+    batch_.emplace_back(timer_id, timer.callback);
+    // Periods missed while the host was busy are dropped rather than fired
+    // back to back, keeping the phase.
+    timer.due_time += timer.period;
+    if (timer.due_time <= now) {
+      timer.due_time += ((now - timer.due_time) / timer.period + 1) *
+                        timer.period;
+    }
+    Insert(timer_id, &timer);
+  }
+  expiring_ids_.clear();
+}
+
+void TimerWheel::ThreadMain() {
+  auto lock = mutex_.Acquire();
+  while (running_) {
+    auto now = clock::now();
+    // Ticks are due once their start has passed.
+    uint64_t now_tick = uint64_t((now - start_time_) / resolution_);
+    uint64_t next_tick;
+    while ((next_tick = FindNextDueTick()) <= now_tick) {
+      // The slots before the next due tick are empty. If it's an overflowing
+      // timer's, moving there brings the timer into the current slot.
+      current_tick_ = next_tick;
+      RefillSlots();
+      ExpireCurrentTick(now);
+      ++current_tick_;
+    }
+    AdvanceTo(now_tick + 1);
+
+    if (!batch_.empty()) {
+      // Cancel reads the batch under the lock, and waits for it when needed.
+      running_batch_ = true;
+      lock.unlock();
+      for (auto& entry : batch_) {
+        entry.second();
+      }
+      lock.lock();
+      batch_.clear();
+      running_batch_ = false;
+      batch_cond_.notify_all();
+      continue;
+    }
+
+    wake_tick_ = next_tick;
+    if (next_tick == UINT64_MAX) {
+      cond_.wait(lock);
+    } else {
+      cond_.wait_until(lock, start_time_ + next_tick * resolution_);
+    }
+    wake_tick_ = 0;
+  }
+}
+
+}  // namespace kernel
+}  // namespace xe
@@ -0,0 +1,133 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2016 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#ifndef XENIA_KERNEL_TIMER_WHEEL_H_
+#define XENIA_KERNEL_TIMER_WHEEL_H_
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "xenia/base/mutex.h"
+#include "xenia/kernel/xobject.h"
+
+namespace xe {
+namespace kernel {
+
+class KernelState;
+class XHostThread;
+
+// Expires all guest timers and delays on one host thread, instead of each
+// having a host timer of its own. Due times are rounded up to the wheel
+// resolution, so everything due within the same tick fires in one wakeup,
+// with the callbacks run as a batch outside of the wheel lock. Timers due
+// beyond one turn of the wheel wait in an overflow map until they are within
+// it.
+class TimerWheel {
+ public:
+  typedef uint64_t TimerId;
+  static const TimerId kInvalidTimer = 0;
+
+  explicit TimerWheel(KernelState* kernel_state);
+  ~TimerWheel();
+
+  // Timers may be scheduled before the thread is started, and are expired
+  // once it is.
+  void Start();
+  // Stops the thread. Nothing fires after this returns.
+  void Shutdown();
+
+  // Calls the callback on the wheel thread once the host duration elapsed,
+  // and then every period if it isn't zero.
+  TimerId Schedule(std::chrono::nanoseconds due_time,
+                   std::chrono::nanoseconds period,
+                   std::function<void()> callback);
+  // Returns whether the timer was stopped before its callback was called
+  // again. Once this returns the callback is not running, unless this is
+  // called from it, so callbacks must not take locks held by callers.
+  bool Cancel(TimerId timer_id);
+
+  // Converts a guest due time in 100ns units, absolute system time if
+  // positive and relative to now if negative, into the host duration from
+  // now, scaled by the guest time scalar.
+  static std::chrono::nanoseconds GuestDueTime(int64_t due_time);
+
+  std::unique_lock<xe::profiled_mutex> AcquireLock() {
+    return mutex_.Acquire();
+  }
+
+ private:
+  typedef std::chrono::steady_clock clock;
+  static const uint32_t kSlotCount = 256;
+
+  struct Timer {
+    clock::time_point due_time;
+    clock::duration period;
+    uint64_t due_tick;
+    std::function<void()> callback;
+  };
+
+  uint64_t TickAt(clock::time_point time) const;
+  // Puts the timer into the slot or overflow map of its due time.
+  void Insert(TimerId timer_id, Timer* timer);
+  // Moves the overflowing timers coming within one turn into their slots.
+  void RefillSlots();
+  // Returns the first tick from the current one with a slot holding timers,
+  // or UINT64_MAX if none does.
+  uint64_t FindNextSlotTick() const;
+  // Moves the current tick towards the given one, stopping at timers left
+  // in the slots so that none is skipped.
+  void AdvanceTo(uint64_t tick);
+  // Refills the slots and returns the next tick with timers due, or
+  // UINT64_MAX if none is.
+  uint64_t FindNextDueTick();
+  // Adds the callbacks of the timers due at the current tick to the batch,
+  // and reschedules the periodic ones.
+  void ExpireCurrentTick(clock::time_point now);
+  void ThreadMain();
+
+  KernelState* kernel_state_ = nullptr;
+  clock::time_point start_time_;
+  clock::duration resolution_;
+  object_ref<XHostThread> thread_;
+
+  xe::profiled_mutex mutex_{"timer_wheel"};
+  std::condition_variable_any cond_;
+  // Must be guarded by mutex_.
+  bool running_ = false;
+  TimerId next_timer_id_ = 1;
+  // The ticks before this have been expired.
+  uint64_t current_tick_ = 0;
+  // The tick the thread sleeps until, so earlier timers wake it, or 0 while
+  // it is awake.
+  uint64_t wake_tick_ = 0;
+  std::unordered_map<TimerId, Timer> timers_;
+  // Timers due at tick t within one turn are in slot t % kSlotCount. Slots
+  // may hold the ids of canceled timers, which are skipped.
+  std::vector<TimerId> slots_[kSlotCount];
+  uint64_t occupied_slots_[kSlotCount / 64] = {};
+  std::multimap<uint64_t, TimerId> overflow_;
+  // The callbacks being run by the thread.
+  std::vector<std::pair<TimerId, std::function<void()>>> batch_;
+  bool running_batch_ = false;
+  std::condition_variable_any batch_cond_;
+
+  // Only used on the thread.
+  std::vector<TimerId> expiring_ids_;
+};
+
+}  // namespace kernel
+}  // namespace xe
+
+#endif  // XENIA_KERNEL_TIMER_WHEEL_H_
@@ -13,6 +13,7 @@
 
 #include "xenia/base/byte_stream.h"
 #include "xenia/base/logging.h"
+#include "xenia/cpu/cpu_flags.h"
 #include "xenia/cpu/elf_module.h"
 #include "xenia/cpu/processor.h"
 #include "xenia/cpu/xex_module.h"
@@ -46,6 +47,46 @@ uint32_t UserModule::title_id() const {
   return 0;
 }
 
+uint32_t UserModule::ReadTitleId(KernelState* kernel_state,
+                                 const std::string& path) {
+  auto fs_entry = kernel_state->file_system()->ResolvePath(path);
+  if (!fs_entry) {
+    return 0;
+  }
+  vfs::File* file = nullptr;
+  if (XFAILED(fs_entry->Open(vfs::FileAccess::kGenericRead, &file))) {
+    return 0;
+  }
+
+  // Read the fixed part of the header for its size, then the rest of it.
+  uint32_t title_id = 0;
+  std::vector<uint8_t> buffer(sizeof(xex2_header));
+  size_t bytes_read = 0;
+  if (XSUCCEEDED(file->ReadSync(buffer.data(), buffer.size(), 0,
+                                &bytes_read)) &&
+      bytes_read == buffer.size()) {
+    auto header = reinterpret_cast<const xex2_header*>(buffer.data());
+    uint32_t header_size = header->header_size;
+    if (header->magic == 'XEX2' && header_size >= sizeof(xex2_header) &&
+        header_size <= fs_entry->size() && header_size <= 16 * 1024 * 1024) {
+      buffer.resize(header_size);
+      header = reinterpret_cast<const xex2_header*>(buffer.data());
+      xex2_opt_execution_info* info = nullptr;
+      if (XSUCCEEDED(file->ReadSync(buffer.data(), buffer.size(), 0,
+                                    &bytes_read)) &&
+          bytes_read == buffer.size() &&
+          cpu::XexModule::GetOptHeader(header, XEX_HEADER_EXECUTION_INFO,
+                                       &info) &&
+          reinterpret_cast<const uint8_t*>(info) + sizeof(*info) <=
+              buffer.data() + buffer.size()) {
+        title_id = info->title_id;
+      }
+    }
+  }
+  file->Destroy();
+  return title_id;
+}
+
 X_STATUS UserModule::LoadFromFile(std::string path) {
   X_STATUS result = X_STATUS_UNSUCCESSFUL;
 
@@ -71,8 +112,6 @@ X_STATUS UserModule::LoadFromFile(std::string path) {
     // Load the module.
     result = LoadFromMemory(mmap->data(), mmap->size());
   } else {
-    std::vector<uint8_t> buffer(fs_entry->size());
-
     // Open file for reading.
     vfs::File* file = nullptr;
     result = fs_entry->Open(vfs::FileAccess::kGenericRead, &file);
@@ -80,17 +119,22 @@ X_STATUS UserModule::LoadFromFile(std::string path) {
       return result;
     }
 
-    // Read entire file into memory.
-    // Ugh.
-    size_t bytes_read = 0;
-    result = file->ReadSync(buffer.data(), buffer.size(), 0, &bytes_read);
-    if (XFAILED(result)) {
-      return result;
+    // Load in place if the file is contiguous in a mapping of its device.
+    size_t mapped_length = 0;
+    const uint8_t* mapped_data = file->MapRange(0, &mapped_length);
+    if (mapped_data && mapped_length >= fs_entry->size()) {
+      result = LoadFromMemory(mapped_data, fs_entry->size());
+    } else {
+      // Read entire file into memory.
+      std::vector<uint8_t> buffer(fs_entry->size());
+      size_t bytes_read = 0;
+      result = file->ReadSync(buffer.data(), buffer.size(), 0, &bytes_read);
+      if (XSUCCEEDED(result)) {
+        // Load the module.
+        result = LoadFromMemory(buffer.data(), bytes_read);
+      }
     }
 
-    // Load the module.
-    result = LoadFromMemory(buffer.data(), bytes_read);
-
     // Close the file.
     file->Destroy();
   }
@@ -153,6 +197,10 @@ X_STATUS UserModule::LoadFromMemory(const void* addr, const size_t length) {
     this->xex_module()->GetOptHeader(XEX_HEADER_DEFAULT_STACK_SIZE,
                                      &stack_size_);
     is_dll_module_ = !!(header->module_flags & XEX_MODULE_DLL_MODULE);
+
+    if (FLAGS_precompile_modules) {
+      processor->Precompile(this->xex_module()->FindFunctionStarts());
+    }
   } else if (module_format_ == kModuleFormatElf) {
     auto elf_module =
         std::make_unique<cpu::ElfModule>(processor, kernel_state());
@@ -55,6 +55,10 @@ class UserModule : public XModule {
   uint32_t guest_xex_header() const { return guest_xex_header_; }
   // The title ID in the xex header or 0 if this is not a xex.
   uint32_t title_id() const;
+  // Reads the title ID from the header of the xex at the path without
+  // loading it. Returns 0 if it isn't a readable xex or has none.
+  static uint32_t ReadTitleId(KernelState* kernel_state,
+                              const std::string& path);
   bool is_dll_module() const { return is_dll_module_; }
 
   uint32_t entry_point() const { return entry_point_; }
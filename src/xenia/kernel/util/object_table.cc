@@ -10,9 +10,10 @@
 #include "xenia/kernel/util/object_table.h"
 
 #include <algorithm>
-#include <cstring>
+#include <new>
 
 #include "xenia/base/byte_stream.h"
+#include "xenia/base/threading.h"
 #include "xenia/kernel/xobject.h"
 #include "xenia/kernel/xthread.h"
 
@@ -25,34 +26,54 @@ ObjectTable::ObjectTable() {}
 ObjectTable::~ObjectTable() { Reset(); }
 
 void ObjectTable::Reset() {
-  auto global_lock = global_critical_region_.Acquire();
-
-  // Release all objects.
-  for (uint32_t n = 0; n < table_capacity_; n++) {
-    ObjectTableEntry& entry = table_[n];
-    if (entry.object) {
-      entry.object->Release();
+  {
+    auto table_lock = table_mutex_.Acquire();
+    uint32_t table_capacity = table_capacity_;
+    ObjectTableEntry* table = table_;
+    table_capacity_ = 0;
+    table_ = nullptr;
+    last_free_entry_ = 0;
+    for (uint32_t n = 0; n < table_capacity; n++) {
+      XObject* object = table[n].object;
+      if (object) {
+        Retire(object, nullptr);
+      }
+    }
+    Retire(nullptr, table);
+  }
+
+  // Nothing can be looked up anymore, so this only waits for the lookups
+  // already in the table. Objects are released without the lock, as that
+  // may take other locks.
+  std::vector<XObject*> objects;
+  while (true) {
+    auto table_lock = table_mutex_.Acquire();
+    ReclaimRetired(&objects);
+    bool reclaimed = retired_.empty();
+    table_lock.unlock();
+    ReleaseObjects(objects);
+    objects.clear();
+    if (reclaimed) {
+      break;
     }
+    xe::threading::MaybeYield();
   }
-
-  table_capacity_ = 0;
-  last_free_entry_ = 0;
-  free(table_);
-  table_ = nullptr;
 }
 
 X_STATUS ObjectTable::FindFreeSlot(uint32_t* out_slot) {
   // Find a free slot.
+  uint32_t table_capacity = table_capacity_;
+  ObjectTableEntry* table = table_;
   uint32_t slot = last_free_entry_;
   uint32_t scan_count = 0;
-  while (scan_count < table_capacity_) {
-    ObjectTableEntry& entry = table_[slot];
+  while (scan_count < table_capacity) {
+    ObjectTableEntry& entry = table[slot];
     if (!entry.object) {
       *out_slot = slot;
       return X_STATUS_SUCCESS;
     }
     scan_count++;
-    slot = (slot + 1) % table_capacity_;
+    slot = (slot + 1) % table_capacity;
     if (slot == 0) {
       // Never allow 0 handles.
       scan_count++;
@@ -74,33 +95,64 @@ X_STATUS ObjectTable::FindFreeSlot(uint32_t* out_slot) {
 }
 
 bool ObjectTable::Resize(uint32_t new_capacity) {
-  uint32_t new_size = new_capacity * sizeof(ObjectTableEntry);
-  uint32_t old_size = table_capacity_ * sizeof(ObjectTableEntry);
-  auto new_table =
-      reinterpret_cast<ObjectTableEntry*>(realloc(table_, new_size));
+  uint32_t old_capacity = table_capacity_;
+  ObjectTableEntry* old_table = table_;
+  auto new_table = new (std::nothrow) ObjectTableEntry[new_capacity];
   if (!new_table) {
     return false;
   }
 
-  // Zero out new entries.
-  if (new_size > old_size) {
-    std::memset(reinterpret_cast<uint8_t*>(new_table) + old_size, 0,
-                new_size - old_size);
+  // New entries are zeroed by the constructor.
+  for (uint32_t n = 0; n < std::min(old_capacity, new_capacity); n++) {
+    new_table[n].handle_ref_count = old_table[n].handle_ref_count;
+    new_table[n].object = old_table[n].object.load();
   }
 
-  last_free_entry_ = table_capacity_;
-  table_capacity_ = new_capacity;
-  table_ = new_table;
+  if (new_capacity >= old_capacity) {
+    table_ = new_table;
+    table_capacity_ = new_capacity;
+  } else {
+    table_capacity_ = new_capacity;
+    table_ = new_table;
+  }
+  last_free_entry_ = old_capacity;
+
+  // Lookups may still be using the old table.
+  Retire(nullptr, old_table);
 
   return true;
 }
 
+void ObjectTable::Retire(XObject* object, ObjectTableEntry* table) {
+  if (object || table) {
+    retired_.Retire({object, table});
+  }
+}
+
+void ObjectTable::ReclaimRetired(std::vector<XObject*>* objects) {
+  // Those still in use are reclaimed by whichever change to the table is
+  // next.
+  retired_.Reclaim([objects](const RetiredEntry& entry) {
+    if (entry.object) {
+      objects->push_back(entry.object);
+    }
+    delete[] entry.table;
+  });
+}
+
+void ObjectTable::ReleaseObjects(const std::vector<XObject*>& objects) {
+  for (auto object : objects) {
+    object->Release();
+  }
+}
+
 X_STATUS ObjectTable::AddHandle(XObject* object, X_HANDLE* out_handle) {
   X_STATUS result = X_STATUS_SUCCESS;
 
   uint32_t handle = 0;
+  std::vector<XObject*> released_objects;
   {
-    auto global_lock = global_critical_region_.Acquire();
+    auto table_lock = table_mutex_.Acquire();
 
     // Find a free slot.
     uint32_t slot = 0;
@@ -118,7 +170,9 @@ X_STATUS ObjectTable::AddHandle(XObject* object, X_HANDLE* out_handle) {
       // Retain so long as the object is in the table.
       object->Retain();
     }
+    ReclaimRetired(&released_objects);
   }
+  ReleaseObjects(released_objects);
 
   if (XSUCCEEDED(result)) {
     if (out_handle) {
@@ -133,7 +187,7 @@ X_STATUS ObjectTable::DuplicateHandle(X_HANDLE handle, X_HANDLE* out_handle) {
   X_STATUS result = X_STATUS_SUCCESS;
   handle = TranslateHandle(handle);
 
-  XObject* object = LookupObject(handle, false);
+  XObject* object = LookupObject(handle);
   if (object) {
     result = AddHandle(object, out_handle);
     object->Release();  // Release the ref that LookupObject took
@@ -145,7 +199,7 @@ X_STATUS ObjectTable::DuplicateHandle(X_HANDLE handle, X_HANDLE* out_handle) {
 }
 
 X_STATUS ObjectTable::RetainHandle(X_HANDLE handle) {
-  auto global_lock = global_critical_region_.Acquire();
+  auto table_lock = table_mutex_.Acquire();
 
   ObjectTableEntry* entry = LookupTable(handle);
   if (!entry) {
@@ -157,7 +211,7 @@ X_STATUS ObjectTable::RetainHandle(X_HANDLE handle) {
 }
 
 X_STATUS ObjectTable::ReleaseHandle(X_HANDLE handle) {
-  auto global_lock = global_critical_region_.Acquire();
+  auto table_lock = table_mutex_.Acquire();
 
   ObjectTableEntry* entry = LookupTable(handle);
   if (!entry) {
@@ -166,7 +220,12 @@ X_STATUS ObjectTable::ReleaseHandle(X_HANDLE handle) {
 
   if (--entry->handle_ref_count == 0) {
     // No more references. Remove it from the table.
-    return RemoveHandle(handle);
+    RemoveEntry(handle, entry);
+    std::vector<XObject*> released_objects;
+    ReclaimRetired(&released_objects);
+    table_lock.unlock();
+    ReleaseObjects(released_objects);
+    return X_STATUS_SUCCESS;
   }
 
   // FIXME: Return a status code telling the caller it wasn't released
@@ -175,49 +234,60 @@ X_STATUS ObjectTable::ReleaseHandle(X_HANDLE handle) {
 }
 
 X_STATUS ObjectTable::RemoveHandle(X_HANDLE handle) {
-  X_STATUS result = X_STATUS_SUCCESS;
-
   handle = TranslateHandle(handle);
   if (!handle) {
     return X_STATUS_INVALID_HANDLE;
   }
 
+  auto table_lock = table_mutex_.Acquire();
   ObjectTableEntry* entry = LookupTable(handle);
   if (!entry) {
     return X_STATUS_INVALID_HANDLE;
   }
 
-  auto global_lock = global_critical_region_.Acquire();
-  if (entry->object) {
-    auto object = entry->object;
-    entry->object = nullptr;
-    entry->handle_ref_count = 0;
+  RemoveEntry(handle, entry);
+  std::vector<XObject*> released_objects;
+  ReclaimRetired(&released_objects);
+  table_lock.unlock();
 
-    // Walk the object's handles and remove this one.
-    auto handle_entry =
-        std::find(object->handles().begin(), object->handles().end(), handle);
-    if (handle_entry != object->handles().end()) {
-      object->handles().erase(handle_entry);
-    }
+  // Release now that the lock is released, as that may take other locks.
+  ReleaseObjects(released_objects);
 
-    // Release now that the object has been removed from the table.
-    object->Release();
+  return X_STATUS_SUCCESS;
+}
+
+void ObjectTable::RemoveEntry(X_HANDLE handle, ObjectTableEntry* entry) {
+  XObject* object = entry->object;
+  if (!object) {
+    return;
   }
+  entry->object = nullptr;
+  entry->handle_ref_count = 0;
 
-  return X_STATUS_SUCCESS;
+  // Walk the object's handles and remove this one.
+  handle = TranslateHandle(handle);
+  auto handle_entry =
+      std::find(object->handles().begin(), object->handles().end(), handle);
+  if (handle_entry != object->handles().end()) {
+    object->handles().erase(handle_entry);
+  }
+
+  // A lookup may still be about to retain it.
+  Retire(object, nullptr);
 }
 
 std::vector<object_ref<XObject>> ObjectTable::GetAllObjects() {
-  auto lock = global_critical_region_.Acquire();
+  auto table_lock = table_mutex_.Acquire();
   std::vector<object_ref<XObject>> results;
 
-  for (uint32_t slot = 0; slot < table_capacity_; slot++) {
-    auto& entry = table_[slot];
-    if (entry.object &&
-        std::find(results.begin(), results.end(), entry.object) ==
-            results.end()) {
-      entry.object->Retain();
-      results.push_back(object_ref<XObject>(entry.object));
+  uint32_t table_capacity = table_capacity_;
+  ObjectTableEntry* table = table_;
+  for (uint32_t slot = 0; slot < table_capacity; slot++) {
+    XObject* object = table[slot].object;
+    if (object &&
+        std::find(results.begin(), results.end(), object) == results.end()) {
+      object->Retain();
+      results.push_back(object_ref<XObject>(object));
     }
   }
 
@@ -225,16 +295,23 @@ std::vector<object_ref<XObject>> ObjectTable::GetAllObjects() {
 }
 
 void ObjectTable::PurgeAllObjects() {
-  auto lock = global_critical_region_.Acquire();
-  for (uint32_t slot = 0; slot < table_capacity_; slot++) {
-    auto& entry = table_[slot];
-    if (entry.object && !entry.object->is_host_object()) {
+  auto table_lock = table_mutex_.Acquire();
+  std::vector<XObject*> purged_objects;
+  uint32_t table_capacity = table_capacity_;
+  ObjectTableEntry* table = table_;
+  for (uint32_t slot = 0; slot < table_capacity; slot++) {
+    auto& entry = table[slot];
+    XObject* object = entry.object;
+    if (object && !object->is_host_object()) {
       entry.handle_ref_count = 0;
-      entry.object->Release();
-
       entry.object = nullptr;
+      Retire(object, nullptr);
     }
   }
+
+  ReclaimRetired(&purged_objects);
+  table_lock.unlock();
+  ReleaseObjects(purged_objects);
 }
 
 ObjectTable::ObjectTableEntry* ObjectTable::LookupTable(X_HANDLE handle) {
@@ -243,12 +320,12 @@ ObjectTable::ObjectTableEntry* ObjectTable::LookupTable(X_HANDLE handle) {
     return nullptr;
   }
 
-  auto global_lock = global_critical_region_.Acquire();
+  auto table_lock = table_mutex_.Acquire();
 
   // Lower 2 bits are ignored.
   uint32_t slot = handle >> 2;
-  if (slot <= table_capacity_) {
-    return &table_[slot];
+  if (slot < table_capacity_) {
+    return &table_.load()[slot];
   }
 
   return nullptr;
@@ -257,54 +334,50 @@ ObjectTable::ObjectTableEntry* ObjectTable::LookupTable(X_HANDLE handle) {
 // Generic lookup
 template <>
 object_ref<XObject> ObjectTable::LookupObject<XObject>(X_HANDLE handle) {
-  auto object = ObjectTable::LookupObject(handle, false);
+  auto object = ObjectTable::LookupObject(handle);
   auto result = object_ref<XObject>(reinterpret_cast<XObject*>(object));
   return result;
 }
 
-XObject* ObjectTable::LookupObject(X_HANDLE handle, bool already_locked) {
+XObject* ObjectTable::LookupObject(X_HANDLE handle) {
   handle = TranslateHandle(handle);
   if (!handle) {
     return nullptr;
   }
 
+  // Doesn't take the lock, so lookups on all threads run in parallel.
   XObject* object = nullptr;
-  if (!already_locked) {
-    global_critical_region_.mutex().lock();
-  }
+  uint32_t epoch = retired_.BeginRead();
 
   // Lower 2 bits are ignored.
   uint32_t slot = handle >> 2;
 
   // Verify slot.
   if (slot < table_capacity_) {
-    ObjectTableEntry& entry = table_[slot];
-    if (entry.object) {
-      object = entry.object;
-    }
+    object = table_.load()[slot].object;
   }
 
-  // Retain the object pointer.
+  // Retain the object pointer. The table holds a reference to it until no
+  // lookup that may have loaded it is left.
   if (object) {
     object->Retain();
   }
 
-  if (!already_locked) {
-    global_critical_region_.mutex().unlock();
-  }
-
+  retired_.EndRead(epoch);
   return object;
 }
 
 void ObjectTable::GetObjectsByType(XObject::Type type,
                                    std::vector<object_ref<XObject>>* results) {
-  auto global_lock = global_critical_region_.Acquire();
-  for (uint32_t slot = 0; slot < table_capacity_; ++slot) {
-    auto& entry = table_[slot];
-    if (entry.object) {
-      if (entry.object->type() == type) {
-        entry.object->Retain();
-        results->push_back(object_ref<XObject>(entry.object));
+  auto table_lock = table_mutex_.Acquire();
+  uint32_t table_capacity = table_capacity_;
+  ObjectTableEntry* table = table_;
+  for (uint32_t slot = 0; slot < table_capacity; ++slot) {
+    XObject* object = table[slot].object;
+    if (object) {
+      if (object->type() == type) {
+        object->Retain();
+        results->push_back(object_ref<XObject>(object));
       }
     }
   }
@@ -329,7 +402,7 @@ X_STATUS ObjectTable::AddNameMapping(const std::string& name, X_HANDLE handle) {
   std::transform(lower_name.begin(), lower_name.end(), lower_name.begin(),
                  tolower);
 
-  auto global_lock = global_critical_region_.Acquire();
+  auto table_lock = table_mutex_.Acquire();
   if (name_table_.count(lower_name)) {
     return X_STATUS_OBJECT_NAME_COLLISION;
   }
@@ -343,7 +416,7 @@ void ObjectTable::RemoveNameMapping(const std::string& name) {
   std::transform(lower_name.begin(), lower_name.end(), lower_name.begin(),
                  tolower);
 
-  auto global_lock = global_critical_region_.Acquire();
+  auto table_lock = table_mutex_.Acquire();
   auto it = name_table_.find(lower_name);
   if (it != name_table_.end()) {
     name_table_.erase(it);
@@ -357,7 +430,7 @@ X_STATUS ObjectTable::GetObjectByName(const std::string& name,
   std::transform(lower_name.begin(), lower_name.end(), lower_name.begin(),
                  tolower);
 
-  auto global_lock = global_critical_region_.Acquire();
+  auto table_lock = table_mutex_.Acquire();
   auto it = name_table_.find(lower_name);
   if (it == name_table_.end()) {
     *out_handle = X_INVALID_HANDLE_VALUE;
@@ -366,7 +439,7 @@ X_STATUS ObjectTable::GetObjectByName(const std::string& name,
   *out_handle = it->second;
 
   // We need to ref the handle. I think.
-  auto obj = LookupObject(it->second, true);
+  auto obj = LookupObject(it->second);
   if (obj) {
     obj->RetainHandle();
     obj->Release();
@@ -376,9 +449,12 @@ X_STATUS ObjectTable::GetObjectByName(const std::string& name,
 }
 
 bool ObjectTable::Save(ByteStream* stream) {
-  stream->Write<uint32_t>(table_capacity_);
-  for (uint32_t i = 0; i < table_capacity_; i++) {
-    auto& entry = table_[i];
+  auto table_lock = table_mutex_.Acquire();
+  uint32_t table_capacity = table_capacity_;
+  ObjectTableEntry* table = table_;
+  stream->Write<uint32_t>(table_capacity);
+  for (uint32_t i = 0; i < table_capacity; i++) {
+    auto& entry = table[i];
     stream->Write<int32_t>(entry.handle_ref_count);
   }
 
@@ -386,9 +462,12 @@ bool ObjectTable::Save(ByteStream* stream) {
 }
 
 bool ObjectTable::Restore(ByteStream* stream) {
+  auto table_lock = table_mutex_.Acquire();
   Resize(stream->Read<uint32_t>());
-  for (uint32_t i = 0; i < table_capacity_; i++) {
-    auto& entry = table_[i];
+  uint32_t table_capacity = table_capacity_;
+  ObjectTableEntry* table = table_;
+  for (uint32_t i = 0; i < table_capacity; i++) {
+    auto& entry = table[i];
     // entry.object = nullptr;
     entry.handle_ref_count = stream->Read<int32_t>();
   }
@@ -397,11 +476,12 @@ bool ObjectTable::Restore(ByteStream* stream) {
 }
 
 X_STATUS ObjectTable::RestoreHandle(X_HANDLE handle, XObject* object) {
+  auto table_lock = table_mutex_.Acquire();
   uint32_t slot = handle >> 2;
-  assert_true(table_capacity_ >= slot);
+  assert_true(table_capacity_ > slot);
 
-  if (table_capacity_ >= slot) {
-    auto& entry = table_[slot];
+  if (table_capacity_ > slot) {
+    auto& entry = table_.load()[slot];
     entry.object = object;
     object->Retain();
   }
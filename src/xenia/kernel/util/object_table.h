@@ -10,10 +10,12 @@
 #ifndef XENIA_KERNEL_UTIL_OBJECT_TABLE_H_
 #define XENIA_KERNEL_UTIL_OBJECT_TABLE_H_
 
+#include <atomic>
 #include <string>
 #include <unordered_map>
 #include <vector>
 
+#include "xenia/base/epoch_reclaimer.h"
 #include "xenia/base/mutex.h"
 #include "xenia/kernel/xobject.h"
 #include "xenia/xbox.h"
@@ -46,9 +48,14 @@ class ObjectTable {
   // not use.
   X_STATUS RestoreHandle(X_HANDLE handle, XObject* object);
 
+  // Held by KernelState while suspending guest threads.
+  std::unique_lock<xe::profiled_mutex> AcquireLock() {
+    return table_mutex_.Acquire();
+  }
+
   template <typename T>
   object_ref<T> LookupObject(X_HANDLE handle) {
-    auto object = LookupObject(handle, false);
+    auto object = LookupObject(handle);
     if (object) {
       assert_true(object->type() == T::kType);
     }
@@ -82,12 +89,16 @@ class ObjectTable {
 
  private:
   typedef struct {
+    // Only used with the lock held.
     int handle_ref_count = 0;
-    XObject* object = nullptr;
+    // Also loaded by lookups, without the lock.
+    std::atomic<XObject*> object = {nullptr};
   } ObjectTableEntry;
 
   ObjectTableEntry* LookupTable(X_HANDLE handle);
-  XObject* LookupObject(X_HANDLE handle, bool already_locked);
+  // Clears the entry and retires its object.
+  void RemoveEntry(X_HANDLE handle, ObjectTableEntry* entry);
+  XObject* LookupObject(X_HANDLE handle);
   void GetObjectsByType(XObject::Type type,
                         std::vector<object_ref<XObject>>* results);
 
@@ -95,9 +106,31 @@ class ObjectTable {
   X_STATUS FindFreeSlot(uint32_t* out_slot);
   bool Resize(uint32_t new_capacity);
 
-  xe::global_critical_region global_critical_region_;
-  uint32_t table_capacity_ = 0;
-  ObjectTableEntry* table_ = nullptr;
+  // Defers the release of a removed object or the freeing of a replaced
+  // table until no lookup may still be using it.
+  void Retire(XObject* object, ObjectTableEntry* table);
+  // Frees the retired tables no lookup can be using anymore, and moves their
+  // objects to objects for the caller to release once the lock is released.
+  void ReclaimRetired(std::vector<XObject*>* objects);
+  static void ReleaseObjects(const std::vector<XObject*>& objects);
+
+  struct RetiredEntry {
+    XObject* object;
+    ObjectTableEntry* table;
+  };
+
+  // Guards all changes to the table, but lookups don't take it. Only the
+  // object pointers of the entries are ever changed while lookups may load
+  // them, and replaced tables and removed objects are retired until the
+  // lookups that may have loaded them have left. A leaf lock, see
+  // KernelState.
+  xe::profiled_mutex table_mutex_{"object_table"};
+  // A lookup loads the capacity before the table, so the capacity is only
+  // raised after, and lowered before, the table is replaced.
+  std::atomic<uint32_t> table_capacity_ = {0};
+  std::atomic<ObjectTableEntry*> table_ = {nullptr};
+  // Lookups count themselves in it while they use the table.
+  xe::EpochReclaimer<RetiredEntry> retired_;
   uint32_t last_free_entry_ = 0;
   std::unordered_map<std::string, X_HANDLE> name_table_;
 };
@@ -12,6 +12,8 @@
 DEFINE_bool(log_high_frequency_kernel_calls, false,
             "Log kernel calls with the kHighFrequency tag.");
 
+DEFINE_counter(kernel_calls, "kernel.calls");
+
 namespace xe {
 namespace kernel {
 namespace shim {
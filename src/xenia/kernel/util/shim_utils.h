@@ -16,6 +16,7 @@
 #include <string>
 
 #include "xenia/base/byte_order.h"
+#include "xenia/base/counters.h"
 #include "xenia/base/logging.h"
 #include "xenia/base/memory.h"
 #include "xenia/base/string_buffer.h"
@@ -24,6 +25,7 @@
 #include "xenia/kernel/kernel_state.h"
 
 DECLARE_bool(log_high_frequency_kernel_calls);
+DECLARE_counter(kernel_calls);
 
 namespace xe {
 namespace kernel {
@@ -456,6 +458,7 @@ xe::cpu::Export* RegisterExport(R (*fn)(Ps&...), const char* name,
   struct X {
     static void Trampoline(PPCContext* ppc_context) {
       ++export_entry->function_data.call_count;
+      INCREMENT_counter(kernel_calls, 1);
       Param::Init init = {
           ppc_context, sizeof...(Ps), 0,
       };
@@ -465,6 +468,7 @@ xe::cpu::Export* RegisterExport(R (*fn)(Ps&...), const char* name,
            FLAGS_log_high_frequency_kernel_calls)) {
         PrintKernelCall(export_entry, params);
       }
+      xe::cpu::ExportCallScope call_scope(export_entry);
       auto result =
           KernelTrampoline(FN, std::forward<std::tuple<Ps...>>(params),
                            std::make_index_sequence<sizeof...(Ps)>());
@@ -489,6 +493,7 @@ xe::cpu::Export* RegisterExport(void (*fn)(Ps&...), const char* name,
   struct X {
     static void Trampoline(PPCContext* ppc_context) {
       ++export_entry->function_data.call_count;
+      INCREMENT_counter(kernel_calls, 1);
       Param::Init init = {
           ppc_context, sizeof...(Ps),
       };
@@ -498,6 +503,7 @@ xe::cpu::Export* RegisterExport(void (*fn)(Ps&...), const char* name,
            FLAGS_log_high_frequency_kernel_calls)) {
         PrintKernelCall(export_entry, params);
       }
+      xe::cpu::ExportCallScope call_scope(export_entry);
       KernelTrampoline(FN, std::forward<std::tuple<Ps...>>(params),
                        std::make_index_sequence<sizeof...(Ps)>());
     }
@@ -9,6 +9,8 @@
 
 #include "xenia/kernel/util/xdbf_utils.h"
 
+#include <algorithm>
+
 namespace xe {
 namespace kernel {
 namespace util {
@@ -32,6 +34,14 @@ XdbfWrapper::XdbfWrapper(const uint8_t* data, size_t data_size)
     data_ = nullptr;
     return;
   }
+  uint64_t tables_size =
+      sizeof(XbdfHeader) +
+      uint64_t(sizeof(XbdfEntry)) * header_->entry_count +
+      uint64_t(sizeof(XbdfFileLoc)) * header_->free_count;
+  if (tables_size > data_size_) {
+    data_ = nullptr;
+    return;
+  }
 
   entries_ = reinterpret_cast<const XbdfEntry*>(ptr);
   ptr += sizeof(XbdfEntry) * header_->entry_count;
@@ -40,45 +50,80 @@ XdbfWrapper::XdbfWrapper(const uint8_t* data, size_t data_size)
   ptr += sizeof(XbdfFileLoc) * header_->free_count;
 
   content_offset_ = ptr;
-}
 
-XdbfBlock XdbfWrapper::GetEntry(XdbfSection section, uint64_t id) const {
-  for (uint32_t i = 0; i < header_->entry_used; ++i) {
+  size_t content_size = data_size_ - size_t(tables_size);
+  uint32_t entry_count =
+      std::min(uint32_t(header_->entry_used), uint32_t(header_->entry_count));
+  for (uint32_t i = 0; i < entry_count; ++i) {
     auto& entry = entries_[i];
-    if (entry.section == static_cast<uint16_t>(section) && entry.id == id) {
-      XdbfBlock block;
-      block.buffer = content_offset_ + entry.offset;
-      block.size = entry.size;
-      return block;
+    // Entries past the end of the data are left out, as if they were not
+    // there.
+    if (uint64_t(entry.offset) + entry.size > content_size) {
+      continue;
+    }
+    XdbfBlock block;
+    block.buffer = content_offset_ + entry.offset;
+    block.size = entry.size;
+    auto& section_index = entry_index_[entry.section];
+    // The first of entries with the same ID is the one found.
+    if (section_index.emplace(entry.id, block).second &&
+        entry.section == static_cast<uint16_t>(XdbfSection::kStringTable)) {
+      IndexStringTable(uint32_t(entry.id), block);
     }
   }
-  return {0};
 }
 
-std::string XdbfWrapper::GetStringTableEntry(XdbfLocale locale,
-                                             uint16_t string_id) const {
-  auto language_block =
-      GetEntry(XdbfSection::kStringTable, static_cast<uint64_t>(locale));
-  if (!language_block) {
-    return "";
+void XdbfWrapper::IndexStringTable(uint32_t locale, const XdbfBlock& block) {
+  if (block.size < sizeof(XdbfXstrHeader)) {
+    return;
   }
-
-  auto xstr_head =
-      reinterpret_cast<const XdbfXstrHeader*>(language_block.buffer);
+  auto xstr_head = reinterpret_cast<const XdbfXstrHeader*>(block.buffer);
   assert_true(xstr_head->magic == kXdbfMagicXstr);
   assert_true(xstr_head->version == 1);
 
-  const uint8_t* ptr = language_block.buffer + sizeof(XdbfXstrHeader);
+  auto& locale_index = string_index_[locale];
+  const uint8_t* ptr = block.buffer + sizeof(XdbfXstrHeader);
+  const uint8_t* end = block.buffer + block.size;
   for (uint16_t i = 0; i < xstr_head->string_count; ++i) {
+    if (size_t(end - ptr) < sizeof(XdbfStringTableEntry)) {
+      break;
+    }
     auto entry = reinterpret_cast<const XdbfStringTableEntry*>(ptr);
     ptr += sizeof(XdbfStringTableEntry);
-    if (entry->id == string_id) {
-      return std::string(reinterpret_cast<const char*>(ptr),
-                         entry->string_length);
+    if (size_t(end - ptr) < entry->string_length) {
+      break;
     }
+    locale_index.emplace(
+        uint16_t(entry->id),
+        StringTableEntry{reinterpret_cast<const char*>(ptr),
+                         entry->string_length});
     ptr += entry->string_length;
   }
-  return "";
+}
+
+XdbfBlock XdbfWrapper::GetEntry(XdbfSection section, uint64_t id) const {
+  auto section_it = entry_index_.find(static_cast<uint16_t>(section));
+  if (section_it == entry_index_.end()) {
+    return {0};
+  }
+  auto it = section_it->second.find(id);
+  if (it == section_it->second.end()) {
+    return {0};
+  }
+  return it->second;
+}
+
+std::string XdbfWrapper::GetStringTableEntry(XdbfLocale locale,
+                                             uint16_t string_id) const {
+  auto locale_it = string_index_.find(static_cast<uint32_t>(locale));
+  if (locale_it == string_index_.end()) {
+    return "";
+  }
+  auto it = locale_it->second.find(string_id);
+  if (it == locale_it->second.end()) {
+    return "";
+  }
+  return std::string(it->second.data, it->second.length);
 }
 
 constexpr uint64_t kXdbfIdTitle = 0x8000;
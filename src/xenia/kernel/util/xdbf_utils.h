@@ -11,6 +11,7 @@
 #define XENIA_KERNEL_UTIL_XDBF_UTILS_H_
 
 #include <string>
+#include <unordered_map>
 #include <vector>
 
 #include "xenia/base/memory.h"
@@ -50,6 +51,8 @@ struct XdbfBlock {
 
 // Wraps an XBDF (XboxDataBaseFormat) in-memory database.
 // http://www.free60.org/wiki/XDBF
+// The entries and string tables are indexed when it's created, so lookups
+// don't walk the database.
 class XdbfWrapper {
  public:
   XdbfWrapper(const uint8_t* data, size_t data_size);
@@ -115,6 +118,13 @@ class XdbfWrapper {
 #pragma pack(pop)
 
  private:
+  struct StringTableEntry {
+    const char* data;
+    size_t length;
+  };
+
+  void IndexStringTable(uint32_t locale, const XdbfBlock& block);
+
   const uint8_t* data_ = nullptr;
   size_t data_size_ = 0;
   const uint8_t* content_offset_ = nullptr;
@@ -122,6 +132,13 @@ class XdbfWrapper {
   const XbdfHeader* header_ = nullptr;
   const XbdfEntry* entries_ = nullptr;
   const XbdfFileLoc* files_ = nullptr;
+
+  // Entries by section, then by ID.
+  std::unordered_map<uint16_t, std::unordered_map<uint64_t, XdbfBlock>>
+      entry_index_;
+  // Strings by locale, then by string ID.
+  std::unordered_map<uint32_t, std::unordered_map<uint16_t, StringTableEntry>>
+      string_index_;
 };
 
 class XdbfGameData : public XdbfWrapper {
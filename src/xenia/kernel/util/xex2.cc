@@ -12,7 +12,11 @@
 #include <gflags/gflags.h>
 
 #include <algorithm>
+#include <atomic>
 #include <cstring>
+#include <functional>
+#include <memory>
+#include <string>
 #include <vector>
 
 #include "third_party/crypto/rijndael-alg-fst.c"
@@ -20,20 +24,32 @@
 #include "third_party/mspack/lzxd.c"
 #include "third_party/mspack/mspack.h"
 #include "third_party/pe/pe_image.h"
+#include "third_party/xxhash/xxhash.h"
 
+#include "xenia/base/filesystem.h"
 #include "xenia/base/logging.h"
 #include "xenia/base/math.h"
 #include "xenia/base/memory.h"
 #include "xenia/base/platform.h"
+#include "xenia/base/string.h"
+#include "xenia/base/threading.h"
 
 namespace xe {}  // namespace xe
 
 DEFINE_bool(xex_dev_key, false, "Use the devkit key.");
+DEFINE_string(xex_image_cache_path, "",
+              "Path to keep decrypted and decompressed XEX images in, so they "
+              "are loaded directly on later runs. Disabled when empty.");
+DEFINE_bool(xex_share_images, false,
+            "Map images from the XEX image cache copy-on-write, so instances "
+            "running the same title share the image pages neither wrote.");
 
 typedef struct xe_xex2 {
   xe::Memory* memory;
 
   xe_xex2_header_t header;
+  // Bytes decoded at header.exe_address.
+  uint32_t image_size;
 
   std::vector<PESection*>* sections;
 
@@ -48,6 +64,8 @@ int xe_xex2_read_header(const uint8_t* addr, const size_t length,
 int xe_xex2_decrypt_key(xe_xex2_header_t* header);
 int xe_xex2_read_image(xe_xex2_ref xex, const uint8_t* xex_addr,
                        const uint32_t xex_length, xe::Memory* memory);
+bool xe_xex2_read_cached_image(xe_xex2_ref xex, uint64_t xex_hash);
+void xe_xex2_write_cached_image(xe_xex2_ref xex, uint64_t xex_hash);
 int xe_xex2_load_pe(xe_xex2_ref xex);
 int xe_xex2_find_import_infos(xe_xex2_ref xex,
                               const xe_xex2_import_library_t* library);
@@ -69,7 +87,16 @@ xe_xex2_ref xe_xex2_load(xe::Memory* memory, const void* addr,
     return nullptr;
   }
 
-  if (xe_xex2_read_image(xex, (const uint8_t*)addr, uint32_t(length), memory)) {
+  // The key decrypted with depends on the flag as well as the file.
+  uint64_t xex_hash = 0;
+  bool cached = false;
+  if (!FLAGS_xex_image_cache_path.empty()) {
+    xex_hash = XXH64(addr, length, FLAGS_xex_dev_key ? 1 : 0);
+    cached = xe_xex2_read_cached_image(xex, xex_hash);
+  }
+
+  if (!cached &&
+      xe_xex2_read_image(xex, (const uint8_t*)addr, uint32_t(length), memory)) {
     xe_xex2_dealloc(xex);
     return nullptr;
   }
@@ -79,6 +106,10 @@ xe_xex2_ref xe_xex2_load(xe::Memory* memory, const void* addr,
     return nullptr;
   }
 
+  if (!FLAGS_xex_image_cache_path.empty() && !cached) {
+    xe_xex2_write_cached_image(xex, xex_hash);
+  }
+
   for (size_t n = 0; n < xex->header.import_library_count; n++) {
     auto library = &xex->header.import_libraries[n];
     if (xe_xex2_find_import_infos(xex, library)) {
@@ -515,31 +546,76 @@ struct mspack_system* mspack_memory_sys_create() {
 }
 void mspack_memory_sys_destroy(struct mspack_system* sys) { free(sys); }
 
-void xe_xex2_decrypt_buffer(const uint8_t* session_key,
-                            const uint8_t* input_buffer,
-                            const size_t input_size, uint8_t* output_buffer,
-                            const size_t output_size) {
-  uint32_t rk[4 * (MAXNR + 1)];
-  uint8_t ivec[16] = {0};
-  int32_t Nr = rijndaelKeySetupDec(rk, session_key, 128);
-  const uint8_t* ct = input_buffer;
-  uint8_t* pt = output_buffer;
+// Calls the function with each index below the count, spread over all host
+// cores.
+void xe_xex2_parallel_for(size_t count,
+                          const std::function<void(size_t)>& function) {
+  size_t thread_count =
+      std::min(size_t(std::max(1u, xe::threading::logical_processor_count())),
+               count);
+  std::atomic<size_t> next_index(0);
+  auto worker = [&]() {
+    size_t index;
+    while ((index = next_index.fetch_add(1)) < count) {
+      function(index);
+    }
+  };
+  std::vector<std::unique_ptr<xe::threading::Thread>> threads;
+  for (size_t i = 1; i < thread_count; ++i) {
+    auto thread = xe::threading::Thread::Create({}, worker);
+    thread->set_name("xe_xex2 Decode " + std::to_string(i));
+    threads.push_back(std::move(thread));
+  }
+  worker();
+  for (auto& thread : threads) {
+    xe::threading::Wait(thread.get(), false);
+  }
+}
+
+// AES-CBC decrypts the input, chained on from the 16 ciphertext bytes before
+// it, or from zeros at the start of the stream. As each block only depends
+// on the ciphertext, any part of a stream can be decrypted on its own.
+void xe_xex2_decrypt_chained(const uint32_t* rk, int32_t Nr,
+                             const uint8_t* previous, const uint8_t* input,
+                             size_t input_size, uint8_t* output) {
+  static const uint8_t kZeroes[16] = {0};
+  const uint8_t* ivec = previous ? previous : kZeroes;
+  const uint8_t* ct = input;
+  uint8_t* pt = output;
   for (size_t n = 0; n < input_size; n += 16, ct += 16, pt += 16) {
     // Decrypt 16 uint8_ts from input -> output.
     rijndaelDecrypt(rk, Nr, ct, pt);
     for (size_t i = 0; i < 16; i++) {
       // XOR with previous.
       pt[i] ^= ivec[i];
-      // Set previous.
-      ivec[i] = ct[i];
     }
+    ivec = ct;
   }
 }
 
+void xe_xex2_decrypt_buffer(const uint8_t* session_key,
+                            const uint8_t* input_buffer,
+                            const size_t input_size, uint8_t* output_buffer,
+                            const size_t output_size) {
+  uint32_t rk[4 * (MAXNR + 1)];
+  int32_t Nr = rijndaelKeySetupDec(rk, session_key, 128);
+  // Must be a multiple of the AES block size.
+  const size_t kSliceSize = 1024 * 1024;
+  size_t slice_count = (input_size + kSliceSize - 1) / kSliceSize;
+  xe_xex2_parallel_for(slice_count, [&](size_t slice) {
+    size_t offset = slice * kSliceSize;
+    const uint8_t* previous = offset ? input_buffer + offset - 16 : nullptr;
+    xe_xex2_decrypt_chained(rk, Nr, previous, input_buffer + offset,
+                            std::min(kSliceSize, input_size - offset),
+                            output_buffer + offset);
+  });
+}
+
 int xe_xex2_read_image_uncompressed(const xe_xex2_header_t* header,
                                     const uint8_t* xex_addr,
                                     const uint32_t xex_length,
-                                    xe::Memory* memory) {
+                                    xe::Memory* memory,
+                                    uint32_t* out_image_size) {
   // Allocate in-place the XEX memory.
   const uint32_t exe_length = xex_length - header->exe_offset;
   uint32_t uncompressed_size = exe_length;
@@ -554,6 +630,7 @@ int xe_xex2_read_image_uncompressed(const xe_xex2_header_t* header,
            uncompressed_size);
     return 2;
   }
+  *out_image_size = uncompressed_size;
   uint8_t* buffer = memory->TranslateVirtual(header->exe_address);
   std::memset(buffer, 0, uncompressed_size);
 
@@ -581,18 +658,24 @@ int xe_xex2_read_image_uncompressed(const xe_xex2_header_t* header,
 int xe_xex2_read_image_basic_compressed(const xe_xex2_header_t* header,
                                         const uint8_t* xex_addr,
                                         const uint32_t xex_length,
-                                        xe::Memory* memory) {
+                                        xe::Memory* memory,
+                                        uint32_t* out_image_size) {
   const uint32_t exe_length = xex_length - header->exe_offset;
   const uint8_t* source_buffer = (const uint8_t*)xex_addr + header->exe_offset;
-  const uint8_t* p = source_buffer;
 
-  // Calculate uncompressed length.
+  // Calculate uncompressed length, and where each block is read from and
+  // written to so they can be decoded independently.
   uint32_t uncompressed_size = 0;
   const xe_xex2_file_basic_compression_info_t* comp_info =
       &header->file_format_info.compression_info.basic;
+  std::vector<std::pair<uint32_t, uint32_t>> block_offsets(
+      comp_info->block_count);
+  uint32_t source_size = 0;
   for (uint32_t n = 0; n < comp_info->block_count; n++) {
     const uint32_t data_size = comp_info->blocks[n].data_size;
     const uint32_t zero_size = comp_info->blocks[n].zero_size;
+    block_offsets[n] = {source_size, uncompressed_size};
+    source_size += data_size;
     uncompressed_size += data_size + zero_size;
   }
 
@@ -616,49 +699,45 @@ int xe_xex2_read_image_basic_compressed(const xe_xex2_header_t* header,
            uncompressed_size);
     return 1;
   }
+  *out_image_size = total_size;
   uint8_t* buffer = memory->TranslateVirtual(header->exe_address);
   std::memset(buffer, 0, total_size);  // Quickly zero the contents.
-  uint8_t* d = buffer;
+
+  // Blocks may not overflow the file or the image.
+  if (source_size > exe_length) {
+    return 1;
+  }
+  for (uint32_t n = 0; n < comp_info->block_count; n++) {
+    if (block_offsets[n].second + comp_info->blocks[n].data_size >
+        total_size) {
+      return 1;
+    }
+  }
 
   uint32_t rk[4 * (MAXNR + 1)];
-  uint8_t ivec[16] = {0};
   int32_t Nr = rijndaelKeySetupDec(rk, header->session_key, 128);
 
-  for (size_t n = 0; n < comp_info->block_count; n++) {
+  switch (header->file_format_info.encryption_type) {
+    case XEX_ENCRYPTION_NONE:
+    case XEX_ENCRYPTION_NORMAL:
+      break;
+    default:
+      assert_always();
+      return 1;
+  }
+  // The blocks are encrypted as one stream, so each one is chained on from
+  // the end of the block before it.
+  xe_xex2_parallel_for(comp_info->block_count, [&](size_t n) {
     const uint32_t data_size = comp_info->blocks[n].data_size;
-    const uint32_t zero_size = comp_info->blocks[n].zero_size;
-
-    switch (header->file_format_info.encryption_type) {
-      case XEX_ENCRYPTION_NONE:
-        if (exe_length - (p - source_buffer) >
-            uncompressed_size - (d - buffer)) {
-          // Overflow.
-          return 1;
-        }
-        memcpy(d, p, exe_length - (p - source_buffer));
-        break;
-      case XEX_ENCRYPTION_NORMAL: {
-        const uint8_t* ct = p;
-        uint8_t* pt = d;
-        for (size_t m = 0; m < data_size; m += 16, ct += 16, pt += 16) {
-          // Decrypt 16 uint8_ts from input -> output.
-          rijndaelDecrypt(rk, Nr, ct, pt);
-          for (size_t i = 0; i < 16; i++) {
-            // XOR with previous.
-            pt[i] ^= ivec[i];
-            // Set previous.
-            ivec[i] = ct[i];
-          }
-        }
-      } break;
-      default:
-        assert_always();
-        return 1;
+    const uint8_t* p = source_buffer + block_offsets[n].first;
+    uint8_t* d = buffer + block_offsets[n].second;
+    if (header->file_format_info.encryption_type == XEX_ENCRYPTION_NONE) {
+      memcpy(d, p, data_size);
+    } else {
+      const uint8_t* previous = block_offsets[n].first ? p - 16 : nullptr;
+      xe_xex2_decrypt_chained(rk, Nr, previous, p, data_size, d);
     }
-
-    p += data_size;
-    d += data_size + zero_size;
-  }
+  });
 
   return 0;
 }
@@ -666,7 +745,8 @@ int xe_xex2_read_image_basic_compressed(const xe_xex2_header_t* header,
 int xe_xex2_read_image_compressed(const xe_xex2_header_t* header,
                                   const uint8_t* xex_addr,
                                   const uint32_t xex_length,
-                                  xe::Memory* memory) {
+                                  xe::Memory* memory,
+                                  uint32_t* out_image_size) {
   const uint32_t exe_length = xex_length - header->exe_offset;
   const uint8_t* exe_buffer = (const uint8_t*)xex_addr + header->exe_offset;
 
@@ -758,6 +838,7 @@ int xe_xex2_read_image_compressed(const xe_xex2_header_t* header,
     assert_always();
     return 1;
   }
+  *out_image_size = uncompressed_size;
   uint8_t* buffer = memory->TranslateVirtual(header->exe_address);
   std::memset(buffer, 0, uncompressed_size);
 
@@ -801,19 +882,129 @@ int xe_xex2_read_image(xe_xex2_ref xex, const uint8_t* xex_addr,
   switch (header->file_format_info.compression_type) {
     case XEX_COMPRESSION_NONE:
       return xe_xex2_read_image_uncompressed(header, xex_addr, xex_length,
-                                             memory);
+                                             memory, &xex->image_size);
     case XEX_COMPRESSION_BASIC:
-      return xe_xex2_read_image_basic_compressed(header, xex_addr, xex_length,
-                                                 memory);
+      return xe_xex2_read_image_basic_compressed(
+          header, xex_addr, xex_length, memory, &xex->image_size);
     case XEX_COMPRESSION_NORMAL:
       return xe_xex2_read_image_compressed(header, xex_addr, xex_length,
-                                           memory);
+                                           memory, &xex->image_size);
     default:
       assert_always();
       return 1;
   }
 }
 
+// Decoded images are cached as this header, followed by the image at
+// kXex2ImageCacheDataOffset. The file is padded to a multiple of that, so
+// the image can be mapped from it.
+typedef struct {
+  uint32_t magic;
+  uint32_t version;
+  uint64_t xex_hash;
+  uint32_t exe_address;
+  uint32_t image_size;
+} xe_xex2_image_cache_header_t;
+static const uint32_t kXex2ImageCacheMagic = 'XIMG';
+static const uint32_t kXex2ImageCacheVersion = 2;
+static const uint32_t kXex2ImageCacheDataOffset = 64 * 1024;
+
+std::wstring xe_xex2_image_cache_path(uint64_t xex_hash) {
+  return xe::join_paths(xe::to_wstring(FLAGS_xex_image_cache_path),
+                        xe::format_string(L"%.16llX.xeximg", xex_hash));
+}
+
+bool xe_xex2_read_cached_image(xe_xex2_ref xex, uint64_t xex_hash) {
+  const xe_xex2_header_t* header = &xex->header;
+  auto path = xe_xex2_image_cache_path(xex_hash);
+  xe::filesystem::FileInfo file_info;
+  if (!xe::filesystem::GetInfo(path, &file_info)) {
+    return false;
+  }
+  FILE* file = xe::filesystem::OpenFile(path, "rb");
+  if (!file) {
+    return false;
+  }
+  xe_xex2_image_cache_header_t cache_header;
+  if (fread(&cache_header, sizeof(cache_header), 1, file) != 1 ||
+      cache_header.magic != kXex2ImageCacheMagic ||
+      cache_header.version != kXex2ImageCacheVersion ||
+      cache_header.xex_hash != xex_hash ||
+      cache_header.exe_address != header->exe_address ||
+      !cache_header.image_size ||
+      file_info.total_size !=
+          kXex2ImageCacheDataOffset +
+              xe::round_up(size_t(cache_header.image_size),
+                           size_t(kXex2ImageCacheDataOffset)) ||
+      fseek(file, kXex2ImageCacheDataOffset, SEEK_SET)) {
+    fclose(file);
+    return false;
+  }
+
+  auto heap = xex->memory->LookupHeap(header->exe_address);
+  if (!heap->AllocFixed(
+          header->exe_address, cache_header.image_size, 4096,
+          xe::kMemoryAllocationReserve | xe::kMemoryAllocationCommit,
+          xe::kMemoryProtectRead | xe::kMemoryProtectWrite)) {
+    fclose(file);
+    return false;
+  }
+  // Read instead if the image can't be mapped.
+  uint32_t mapped_size = xe::round_up(cache_header.image_size,
+                                      kXex2ImageCacheDataOffset);
+  if (FLAGS_xex_share_images &&
+      xex->memory->MapSharedFile(header->exe_address, mapped_size, path,
+                                 kXex2ImageCacheDataOffset)) {
+    fclose(file);
+    xex->image_size = cache_header.image_size;
+    return true;
+  }
+  uint8_t* buffer = xex->memory->TranslateVirtual(header->exe_address);
+  bool read = fread(buffer, 1, cache_header.image_size, file) ==
+              cache_header.image_size;
+  fclose(file);
+  if (!read) {
+    // Decoded from the XEX instead.
+    heap->Release(header->exe_address);
+    return false;
+  }
+  xex->image_size = cache_header.image_size;
+  return true;
+}
+
+void xe_xex2_write_cached_image(xe_xex2_ref xex, uint64_t xex_hash) {
+  const xe_xex2_header_t* header = &xex->header;
+  auto path = xe_xex2_image_cache_path(xex_hash);
+  xe::filesystem::CreateParentFolder(path);
+  FILE* file = xe::filesystem::OpenFile(path, "wb");
+  if (!file) {
+    XELOGW("Unable to write XEX image cache file");
+    return;
+  }
+  xe_xex2_image_cache_header_t cache_header;
+  cache_header.magic = kXex2ImageCacheMagic;
+  cache_header.version = kXex2ImageCacheVersion;
+  cache_header.xex_hash = xex_hash;
+  cache_header.exe_address = header->exe_address;
+  cache_header.image_size = xex->image_size;
+  std::vector<uint8_t> padding(kXex2ImageCacheDataOffset);
+  size_t tail_size =
+      xe::round_up(xex->image_size, kXex2ImageCacheDataOffset) -
+      xex->image_size;
+  bool written =
+      fwrite(&cache_header, sizeof(cache_header), 1, file) == 1 &&
+      fwrite(padding.data(), 1, padding.size() - sizeof(cache_header),
+             file) == padding.size() - sizeof(cache_header) &&
+      fwrite(xex->memory->TranslateVirtual(header->exe_address), 1,
+             xex->image_size, file) == xex->image_size &&
+      fwrite(padding.data(), 1, tail_size, file) == tail_size;
+  fclose(file);
+  if (!written) {
+    // A partial file is rejected by its size, but is removed anyway.
+    xe::filesystem::DeleteFile(path);
+  }
+}
+
 int xe_xex2_load_pe(xe_xex2_ref xex) {
   const xe_xex2_header_t* header = &xex->header;
   const uint8_t* p = xex->memory->TranslateVirtual(header->exe_address);
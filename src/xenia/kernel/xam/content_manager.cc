@@ -95,24 +95,57 @@ std::wstring ContentManager::ResolvePackagePath(const XCONTENT_DATA& data) {
   return package_path;
 }
 
+const ContentManager::ContentIndex& ContentManager::GetContentIndex(
+    const std::wstring& package_root) {
+  // Adding or removing packages updates the write time of the root, so a
+  // stat is enough to tell whether the index is still current.
+  xe::filesystem::FileInfo root_info;
+  bool root_exists = xe::filesystem::GetInfo(package_root, &root_info);
+  uint64_t root_write_timestamp = root_exists ? root_info.write_timestamp : 0;
+  auto it = content_indices_.find(package_root);
+  if (it != content_indices_.end() &&
+      it->second.root_exists == root_exists &&
+      it->second.root_write_timestamp == root_write_timestamp) {
+    return it->second;
+  }
+
+  auto& index = content_indices_[package_root];
+  index.root_exists = root_exists;
+  index.root_write_timestamp = root_write_timestamp;
+  index.package_names.clear();
+  if (root_exists) {
+    auto file_infos = xe::filesystem::ListFiles(package_root);
+    for (const auto& file_info : file_infos) {
+      if (file_info.type != xe::filesystem::FileInfo::Type::kDirectory) {
+        // Directories only.
+        continue;
+      }
+      index.package_names.push_back(file_info.name);
+    }
+  }
+  return index;
+}
+
+void ContentManager::InvalidateContentIndex(uint32_t content_type) {
+  content_indices_.erase(ResolvePackageRoot(content_type));
+}
+
 std::vector<XCONTENT_DATA> ContentManager::ListContent(uint32_t device_id,
                                                        uint32_t content_type) {
   std::vector<XCONTENT_DATA> result;
 
+  auto global_lock = global_critical_region_.Acquire();
+
   // Search path:
   // content_root/title_id/type_name/*
   auto package_root = ResolvePackageRoot(content_type);
-  auto file_infos = xe::filesystem::ListFiles(package_root);
-  for (const auto& file_info : file_infos) {
-    if (file_info.type != xe::filesystem::FileInfo::Type::kDirectory) {
-      // Directories only.
-      continue;
-    }
+  const auto& index = GetContentIndex(package_root);
+  for (const auto& package_name : index.package_names) {
     XCONTENT_DATA content_data;
     content_data.device_id = device_id;
     content_data.content_type = content_type;
-    content_data.display_name = file_info.name;
-    content_data.file_name = xe::to_string(file_info.name);
+    content_data.display_name = package_name;
+    content_data.file_name = xe::to_string(package_name);
     result.emplace_back(std::move(content_data));
   }
 
@@ -156,6 +189,7 @@ X_RESULT ContentManager::CreateContent(std::string root_name,
   if (!xe::filesystem::CreateFolder(package_path)) {
     return X_ERROR_ACCESS_DENIED;
   }
+  InvalidateContentIndex(data.content_type);
 
   auto package = ResolvePackage(root_name, data);
   assert_not_null(package);
@@ -228,6 +262,7 @@ X_RESULT ContentManager::SetContentThumbnail(const XCONTENT_DATA& data,
   auto global_lock = global_critical_region_.Acquire();
   auto package_path = ResolvePackagePath(data);
   xe::filesystem::CreateFolder(package_path);
+  InvalidateContentIndex(data.content_type);
   if (xe::filesystem::PathExists(package_path)) {
     auto thumb_path = xe::join_paths(package_path, kThumbnailFileName);
     auto file = xe::filesystem::OpenFile(thumb_path, "wb");
@@ -245,6 +280,7 @@ X_RESULT ContentManager::DeleteContent(const XCONTENT_DATA& data) {
   auto package_path = ResolvePackagePath(data);
   if (xe::filesystem::PathExists(package_path)) {
     xe::filesystem::DeleteFolder(package_path);
+    InvalidateContentIndex(data.content_type);
     return X_ERROR_SUCCESS;
   } else {
     return X_ERROR_FILE_NOT_FOUND;
@@ -86,8 +86,19 @@ class ContentManager {
   X_RESULT DeleteContent(const XCONTENT_DATA& data);
 
  private:
+  // The packages under a package root, as of when the root directory was
+  // last written.
+  struct ContentIndex {
+    bool root_exists;
+    uint64_t root_write_timestamp;
+    std::vector<std::wstring> package_names;
+  };
+
   std::wstring ResolvePackageRoot(uint32_t content_type);
   std::wstring ResolvePackagePath(const XCONTENT_DATA& data);
+  // Rescans the package root if it changed since it was indexed.
+  const ContentIndex& GetContentIndex(const std::wstring& package_root);
+  void InvalidateContentIndex(uint32_t content_type);
 
   KernelState* kernel_state_;
   std::wstring root_path_;
@@ -95,6 +106,8 @@ class ContentManager {
   // TODO(benvanik): remove use of global lock, it's bad here!
   xe::global_critical_region global_critical_region_;
   std::unordered_map<std::string, ContentPackage*> open_packages_;
+  // Package roots to the packages found in them.
+  std::unordered_map<std::wstring, ContentIndex> content_indices_;
 };
 
 }  // namespace xam
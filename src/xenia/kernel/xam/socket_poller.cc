@@ -0,0 +1,336 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2016 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#include "xenia/kernel/xam/socket_poller.h"
+
+#include <algorithm>
+#include <chrono>
+
+#include "xenia/base/logging.h"
+#include "xenia/base/platform_win.h"
+
+// winsock includes must come after platform_win.h:
+#include <winsock2.h>  // NOLINT(build/include_order)
+
+namespace xe {
+namespace kernel {
+namespace xam {
+
+SocketPoller::SocketPoller() : shutting_down_(false), wake_pending_(false) {}
+
+SocketPoller::~SocketPoller() {
+  if (thread_) {
+    shutting_down_ = true;
+    wake_pending_ = false;
+    Wake();
+    xe::threading::Wait(thread_.get(), false);
+    thread_.reset();
+  }
+  if (wake_socket_ != ~uintptr_t(0)) {
+    closesocket(SOCKET(wake_socket_));
+  }
+}
+
+void SocketPoller::Start() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (thread_ || wake_socket_ != ~uintptr_t(0)) {
+    return;
+  }
+
+  // Connected to itself, so that a send wakes WSAPoll.
+  SOCKET wake_socket = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+  sockaddr_in addr = {0};
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  int addr_length = sizeof(addr);
+  u_long non_blocking = 1;
+  if (wake_socket == INVALID_SOCKET ||
+      bind(wake_socket, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) ||
+      getsockname(wake_socket, reinterpret_cast<sockaddr*>(&addr),
+                  &addr_length) ||
+      connect(wake_socket, reinterpret_cast<sockaddr*>(&addr),
+              sizeof(addr)) ||
+      ioctlsocket(wake_socket, FIONBIO, &non_blocking)) {
+    XELOGE("Unable to create the socket poller wake socket (%d)",
+           WSAGetLastError());
+    if (wake_socket != INVALID_SOCKET) {
+      closesocket(wake_socket);
+    }
+    return;
+  }
+  wake_socket_ = uintptr_t(wake_socket);
+
+  thread_ = xe::threading::Thread::Create({}, [this]() { ThreadMain(); });
+  thread_->set_name("Socket Poller");
+}
+
+void SocketPoller::AddSocket(uint32_t socket_handle, bool is_stream) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (!thread_) {
+    return;
+  }
+  SocketState state;
+  state.is_stream = is_stream;
+  sockets_[socket_handle] = std::move(state);
+}
+
+void SocketPoller::RemoveSocket(uint32_t socket_handle) {
+  int error = FlushSends(socket_handle);
+  if (error) {
+    XELOGW("Queued sends on socket %.8X failed (%d) before it was closed",
+           socket_handle, error);
+  }
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (sockets_.erase(socket_handle)) {
+    Wake();
+  }
+}
+
+void SocketPoller::SetPollable(uint32_t socket_handle) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto it = sockets_.find(socket_handle);
+  if (it == sockets_.end() || it->second.pollable) {
+    return;
+  }
+  it->second.pollable = true;
+  Wake();
+}
+
+void SocketPoller::SetNonBlocking(uint32_t socket_handle, bool non_blocking) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto it = sockets_.find(socket_handle);
+  if (it != sockets_.end()) {
+    it->second.non_blocking = non_blocking;
+  }
+}
+
+bool SocketPoller::GetReadiness(uint32_t socket_handle,
+                                uint32_t* out_readiness,
+                                bool* out_non_blocking) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto it = sockets_.find(socket_handle);
+  if (it == sockets_.end() || !it->second.pollable) {
+    return false;
+  }
+  const auto& state = it->second;
+  *out_readiness = state.readiness | (state.send_error ? kError : 0);
+  *out_non_blocking = state.non_blocking;
+  return true;
+}
+
+bool SocketPoller::Wait(std::vector<WaitRequest>* requests,
+                        int32_t timeout_ms) {
+  std::unique_lock<std::mutex> lock(mutex_);
+  auto deadline = std::chrono::steady_clock::now() +
+                  std::chrono::milliseconds(std::max(timeout_ms, 0));
+  while (true) {
+    bool any_ready = false;
+    for (auto& request : *requests) {
+      auto it = sockets_.find(request.socket_handle);
+      if (it == sockets_.end() || !it->second.pollable) {
+        return false;
+      }
+      const auto& state = it->second;
+      uint32_t readiness = state.readiness | (state.send_error ? kError : 0);
+      request.ready = readiness & request.wanted;
+      any_ready |= request.ready != 0;
+    }
+    if (any_ready || !timeout_ms) {
+      return true;
+    }
+    if (timeout_ms < 0) {
+      ready_cv_.wait(lock);
+    } else if (ready_cv_.wait_until(lock, deadline) ==
+               std::cv_status::timeout) {
+      // Checked once more, as the thread may have been just in time.
+      timeout_ms = 0;
+    }
+  }
+}
+
+void SocketPoller::ClearReadiness(uint32_t socket_handle, uint32_t readiness) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto it = sockets_.find(socket_handle);
+  if (it == sockets_.end() || !(it->second.readiness & readiness)) {
+    return;
+  }
+  it->second.readiness &= ~readiness;
+  Wake();
+}
+
+SocketPoller::SendResult SocketPoller::QueueSend(uint32_t socket_handle,
+                                                 const void* data,
+                                                 size_t length) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto it = sockets_.find(socket_handle);
+  if (it == sockets_.end()) {
+    return SendResult::kSendDirectly;
+  }
+  auto& state = it->second;
+  if (!state.is_stream || !state.pollable || state.send_error) {
+    return SendResult::kSendDirectly;
+  }
+  if (state.send_queue.size() + length > kMaxQueuedSendLength) {
+    return state.non_blocking ? SendResult::kWouldBlock
+                              : SendResult::kSendDirectly;
+  }
+  bool was_empty = state.send_queue.empty();
+  auto bytes = reinterpret_cast<const uint8_t*>(data);
+  state.send_queue.insert(state.send_queue.end(), bytes, bytes + length);
+  // Later sends are written along with this one.
+  if (was_empty) {
+    Wake();
+  }
+  return SendResult::kQueued;
+}
+
+int SocketPoller::FlushSends(uint32_t socket_handle) {
+  std::unique_lock<std::mutex> lock(mutex_);
+  while (true) {
+    auto it = sockets_.find(socket_handle);
+    if (it == sockets_.end()) {
+      return 0;
+    }
+    auto& state = it->second;
+    if (state.send_error) {
+      int error = state.send_error;
+      state.send_error = 0;
+      return error;
+    }
+    if (state.send_queue.empty()) {
+      return 0;
+    }
+    SendQueued(socket_handle, &state);
+    if (!state.send_queue.empty() && !state.send_error) {
+      // Waits for the thread to find the socket writable again.
+      Wake();
+      ready_cv_.wait_for(lock, std::chrono::milliseconds(100));
+    }
+  }
+}
+
+void SocketPoller::Wake() {
+  if (!wake_pending_.exchange(true)) {
+    send(SOCKET(wake_socket_), "", 1, 0);
+  }
+}
+
+void SocketPoller::SendQueued(uint32_t socket_handle, SocketState* state) {
+  auto& queue = state->send_queue;
+  while (!queue.empty()) {
+    int ret = send(SOCKET(socket_handle),
+                   reinterpret_cast<const char*>(queue.data()),
+                   int(queue.size()), 0);
+    if (ret == SOCKET_ERROR) {
+      int error = WSAGetLastError();
+      if (error == WSAEWOULDBLOCK) {
+        state->readiness &= ~kWritable;
+      } else {
+        state->send_error = error;
+        queue.clear();
+      }
+      return;
+    }
+    queue.erase(queue.begin(), queue.begin() + ret);
+  }
+}
+
+void SocketPoller::ThreadMain() {
+  std::vector<WSAPOLLFD> poll_fds;
+  std::vector<uint32_t> poll_handles;
+  while (!shutting_down_) {
+    // Cleared before the list is made, so that a change after it wakes the
+    // poll.
+    wake_pending_ = false;
+    poll_fds.clear();
+    poll_handles.clear();
+    WSAPOLLFD wake_fd;
+    wake_fd.fd = SOCKET(wake_socket_);
+    wake_fd.events = POLLRDNORM;
+    wake_fd.revents = 0;
+    poll_fds.push_back(wake_fd);
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      for (auto& it : sockets_) {
+        const auto& state = it.second;
+        if (!state.pollable || (state.readiness & kError)) {
+          continue;
+        }
+        // Only what isn't known yet is polled for, so that a socket that
+        // stays ready doesn't keep waking the thread.
+        SHORT events = 0;
+        if (!(state.readiness & kReadable)) {
+          events |= POLLRDNORM;
+        }
+        if (!(state.readiness & kWritable) || !state.send_queue.empty()) {
+          events |= POLLWRNORM;
+        }
+        if (!events) {
+          continue;
+        }
+        WSAPOLLFD poll_fd;
+        poll_fd.fd = SOCKET(it.first);
+        poll_fd.events = events;
+        poll_fd.revents = 0;
+        poll_fds.push_back(poll_fd);
+        poll_handles.push_back(it.first);
+      }
+    }
+
+    if (WSAPoll(poll_fds.data(), ULONG(poll_fds.size()), -1) ==
+        SOCKET_ERROR) {
+      XELOGE("WSAPoll failed (%d)", WSAGetLastError());
+      xe::threading::Sleep(std::chrono::milliseconds(1));
+      continue;
+    }
+    if (poll_fds[0].revents & POLLRDNORM) {
+      char wake_data[16];
+      while (recv(SOCKET(wake_socket_), wake_data, sizeof(wake_data), 0) > 0) {
+      }
+    }
+
+    bool any_ready = false;
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      for (size_t i = 0; i < poll_handles.size(); ++i) {
+        SHORT revents = poll_fds[i + 1].revents;
+        if (!revents) {
+          continue;
+        }
+        // Closed while it was polled.
+        auto it = sockets_.find(poll_handles[i]);
+        if (it == sockets_.end()) {
+          continue;
+        }
+        auto& state = it->second;
+        if (revents & (POLLRDNORM | POLLHUP)) {
+          state.readiness |= kReadable;
+        }
+        if (revents & POLLWRNORM) {
+          state.readiness |= kWritable;
+        }
+        if (revents & (POLLERR | POLLNVAL)) {
+          // The call the title makes next gets the error itself.
+          state.readiness |= kReadable | kWritable | kError;
+        }
+        if ((state.readiness & kWritable) && !state.send_queue.empty()) {
+          SendQueued(poll_handles[i], &state);
+        }
+        any_ready = true;
+      }
+    }
+    if (any_ready) {
+      ready_cv_.notify_all();
+    }
+  }
+}
+
+}  // namespace xam
+}  // namespace kernel
+}  // namespace xe
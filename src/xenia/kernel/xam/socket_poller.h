@@ -0,0 +1,126 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2016 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#ifndef XENIA_KERNEL_XAM_SOCKET_POLLER_H_
+#define XENIA_KERNEL_XAM_SOCKET_POLLER_H_
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+#include "xenia/base/threading.h"
+
+namespace xe {
+namespace kernel {
+namespace xam {
+
+// Keeps the readiness of the sockets of a title, so that select and the
+// polling of non-blocking sockets don't each cost a host syscall on the
+// guest thread. One thread waits for all of the sockets at once, and the
+// readiness it finds is kept until a call on the socket has used it up.
+// Sends on stream sockets are queued and written together by the thread.
+//
+// Sockets are only polled once they are bound or connected, and calls on
+// sockets that aren't polled go to the host directly.
+class SocketPoller {
+ public:
+  enum Readiness : uint32_t {
+    kReadable = 1 << 0,
+    kWritable = 1 << 1,
+    kError = 1 << 2,
+  };
+
+  // Stream sockets have up to this much queued before sends block.
+  static const size_t kMaxQueuedSendLength = 64 * 1024;
+
+  SocketPoller();
+  ~SocketPoller();
+
+  // Starts the thread once the title has started winsock. Later calls do
+  // nothing.
+  void Start();
+
+  void AddSocket(uint32_t socket_handle, bool is_stream);
+  // Writes what is still queued for the socket before forgetting it.
+  void RemoveSocket(uint32_t socket_handle);
+  // Starts polling the socket, now that it has an address.
+  void SetPollable(uint32_t socket_handle);
+  void SetNonBlocking(uint32_t socket_handle, bool non_blocking);
+
+  // Returns false if the socket isn't polled, in which case the readiness
+  // is unknown.
+  bool GetReadiness(uint32_t socket_handle, uint32_t* out_readiness,
+                    bool* out_non_blocking);
+  struct WaitRequest {
+    uint32_t socket_handle;
+    uint32_t wanted;
+    uint32_t ready;
+  };
+  // Waits until any of the sockets is ready for what is asked of it, for up
+  // to timeout_ms, or indefinitely if it's negative. The readiness found is
+  // written to each request. Returns false if any socket isn't polled.
+  bool Wait(std::vector<WaitRequest>* requests, int32_t timeout_ms);
+
+  // Called when the host reported that the socket would block, so that the
+  // readiness is checked again by the thread.
+  void ClearReadiness(uint32_t socket_handle, uint32_t readiness);
+
+  enum class SendResult {
+    kQueued,
+    // The queue of the non-blocking socket is full.
+    kWouldBlock,
+    // The socket isn't a polled stream socket, a queued send failed, or the
+    // queue of the blocking socket is full.
+    kSendDirectly,
+  };
+  SendResult QueueSend(uint32_t socket_handle, const void* data,
+                       size_t length);
+  // Writes what is queued for the socket, blocking until it has been. Must
+  // be called before anything that can't be reordered with queued data.
+  // Returns the error a queued send failed with, or 0.
+  int FlushSends(uint32_t socket_handle);
+
+ private:
+  struct SocketState {
+    bool is_stream = false;
+    bool pollable = false;
+    bool non_blocking = false;
+    uint32_t readiness = 0;
+    std::vector<uint8_t> send_queue;
+    // Error of a queued send, returned by the next call on the socket.
+    int send_error = 0;
+  };
+
+  void ThreadMain();
+  void Wake();
+  // Sends as much of the queue as the host takes. The lock must be held.
+  void SendQueued(uint32_t socket_handle, SocketState* state);
+
+  std::unique_ptr<xe::threading::Thread> thread_;
+  std::atomic<bool> shutting_down_;
+  // Loopback datagram socket the thread waits on alongside the sockets, so
+  // that it can be woken.
+  uintptr_t wake_socket_ = ~uintptr_t(0);
+  std::atomic<bool> wake_pending_;
+
+  std::mutex mutex_;
+  // Notified whenever the thread has found sockets ready.
+  std::condition_variable ready_cv_;
+  std::unordered_map<uint32_t, SocketState> sockets_;
+};
+
+}  // namespace xam
+}  // namespace kernel
+}  // namespace xe
+
+#endif  // XENIA_KERNEL_XAM_SOCKET_POLLER_H_
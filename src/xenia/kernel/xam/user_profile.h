@@ -190,8 +190,7 @@ class UserProfile {
  private:
   uint64_t xuid_;
   std::string name_;
-  std::vector<std::unique_ptr<Setting>> setting_list_;
-  std::unordered_map<uint32_t, Setting*> settings_;
+  std::unordered_map<uint32_t, std::unique_ptr<Setting>> settings_;
 };
 
 }  // namespace xam
@@ -176,25 +176,18 @@ dword_result_t XamContentCreateEnumerator(dword_t user_index, dword_t device_id,
     *buffer_size_ptr = (uint32_t)XCONTENT_DATA::kSize;
   }
 
-  auto e =
-      new XStaticEnumerator(kernel_state(), max_count, XCONTENT_DATA::kSize);
+  // The content is listed by the first XamEnumerate.
+  uint32_t list_device_id =
+      device_id ? uint32_t(device_id) : dummy_device_info_.device_id;
+  uint32_t list_content_type = content_type;
+  auto e = new XListEnumerator<XCONTENT_DATA>(
+      kernel_state(), max_count, XCONTENT_DATA::kSize,
+      [list_device_id, list_content_type]() {
+        return kernel_state()->content_manager()->ListContent(
+            list_device_id, list_content_type);
+      });
   e->Initialize();
 
-  // Get all content data.
-  auto content_datas = kernel_state()->content_manager()->ListContent(
-      device_id ? static_cast<uint32_t>(device_id)
-                : dummy_device_info_.device_id,
-      content_type);
-  for (auto& content_data : content_datas) {
-    auto ptr = e->AppendItem();
-    if (!ptr) {
-      // Too many items.
-      break;
-    }
-
-    content_data.Write(ptr);
-  }
-
   *handle_out = e->handle();
   return X_ERROR_SUCCESS;
 }
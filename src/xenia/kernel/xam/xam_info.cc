@@ -226,23 +226,42 @@ dword_result_t XamEnumerate(dword_t handle, dword_t flags, lpvoid_t buffer,
     }
   }
 
+  // As many items as fit are returned at once.
+  uint32_t max_count = uint32_t(buffer_length / e->item_size());
+  if (!max_count) {
+    if (overlapped) {
+      kernel_state()->CompleteOverlappedImmediateEx(
+          overlapped, X_ERROR_INSUFFICIENT_BUFFER, X_ERROR_INSUFFICIENT_BUFFER,
+          0);
+      return X_ERROR_IO_PENDING;
+    }
+    return X_ERROR_INSUFFICIENT_BUFFER;
+  }
   buffer.Zero(buffer_length);
-  X_RESULT result =
-      e->WriteItem(buffer) ? X_ERROR_SUCCESS : X_ERROR_NO_MORE_FILES;
 
-  // Return X_ERROR_NO_MORE_FILES in HRESULT form.
-  X_HRESULT extended_result = result != 0 ? 0x80070012 : 0;
   if (items_returned) {
     assert_true(!overlapped);
-    *items_returned = result == X_ERROR_SUCCESS ? 1 : 0;
-
-    return result;
+    *items_returned = e->WriteNextItems(buffer, max_count);
+    return *items_returned ? X_ERROR_SUCCESS : X_ERROR_NO_MORE_FILES;
   } else if (overlapped) {
     assert_true(!items_returned);
-    kernel_state()->CompleteOverlappedImmediateEx(
-        overlapped, result, extended_result,
-        result == X_ERROR_SUCCESS ? e->item_count() : 0);
-
+    // Listing the items may scan directories, so the guest thread gets the
+    // call back pending while that happens on an IO thread.
+    uint32_t buffer_ptr = buffer.guest_address();
+    uint32_t overlapped_ptr = overlapped.guest_address();
+    XOverlappedSetResult(overlapped, X_ERROR_IO_PENDING);
+    XOverlappedSetContext(overlapped, XThread::GetCurrentThreadHandle());
+    auto complete = [e, buffer_ptr, max_count, overlapped_ptr]() {
+      uint32_t count = e->WriteNextItems(
+          kernel_memory()->TranslateVirtual(buffer_ptr), max_count);
+      // Return X_ERROR_NO_MORE_FILES in HRESULT form.
+      kernel_state()->CompleteOverlappedEx(
+          overlapped_ptr, count ? X_ERROR_SUCCESS : X_ERROR_NO_MORE_FILES,
+          count ? 0 : 0x80070012, count);
+    };
+    if (!kernel_state()->QueueIO(complete)) {
+      complete();
+    }
     return X_ERROR_IO_PENDING;
   } else {
     assert_always();
@@ -8,11 +8,14 @@
  */
 
 #include <cstring>
+#include <vector>
 
 #include "xenia/base/clock.h"
 #include "xenia/base/logging.h"
+#include "xenia/base/math.h"
 #include "xenia/kernel/kernel_state.h"
 #include "xenia/kernel/util/shim_utils.h"
+#include "xenia/kernel/xam/socket_poller.h"
 #include "xenia/kernel/xam/xam_private.h"
 #include "xenia/kernel/xboxkrnl/xboxkrnl_error.h"
 #include "xenia/kernel/xboxkrnl/xboxkrnl_threading.h"
@@ -197,6 +200,9 @@ SHIM_CALL NetDll_WSAStartup_shim(PPCContext* ppc_context,
   WSADATA wsaData;
   ZeroMemory(&wsaData, sizeof(WSADATA));
   int ret = WSAStartup(version, &wsaData);
+  if (!ret) {
+    kernel_state->socket_poller()->Start();
+  }
 
   auto data_out = kernel_state->memory()->TranslateVirtual(data_ptr);
 
@@ -432,6 +438,10 @@ SHIM_CALL NetDll_socket_shim(PPCContext* ppc_context,
 
   SOCKET socket_handle = socket(af, type, protocol);
   assert_true(socket_handle >> 32 == 0);
+  if (socket_handle != INVALID_SOCKET) {
+    kernel_state->socket_poller()->AddSocket(
+        static_cast<uint32_t>(socket_handle), type == SOCK_STREAM);
+  }
 
   XELOGD("NetDll_socket = %.8X", socket_handle);
 
@@ -444,6 +454,8 @@ SHIM_CALL NetDll_closesocket_shim(PPCContext* ppc_context,
   uint32_t socket_handle = SHIM_GET_ARG_32(1);
 
   XELOGD("NetDll_closesocket(%d, %.8X)", caller, socket_handle);
+  // Queued sends are written first.
+  kernel_state->socket_poller()->RemoveSocket(socket_handle);
   int ret = closesocket(socket_handle);
 
   SHIM_SET_RETURN_32(ret);
@@ -479,6 +491,9 @@ SHIM_CALL NetDll_ioctlsocket_shim(PPCContext* ppc_context,
 
   u_long arg = SHIM_MEM_32(arg_ptr);
   int ret = ioctlsocket(socket_handle, cmd, &arg);
+  if (!ret && cmd == static_cast<uint32_t>(FIONBIO)) {
+    kernel_state->socket_poller()->SetNonBlocking(socket_handle, arg != 0);
+  }
 
   SHIM_SET_MEM_32(arg_ptr, arg);
   SHIM_SET_RETURN_32(ret);
@@ -496,6 +511,9 @@ SHIM_CALL NetDll_bind_shim(PPCContext* ppc_context, KernelState* kernel_state) {
   sockaddr name;
   LoadSockaddr(SHIM_MEM_ADDR(name_ptr), &name);
   int ret = bind(socket_handle, &name, namelen);
+  if (!ret) {
+    kernel_state->socket_poller()->SetPollable(socket_handle);
+  }
 
   SHIM_SET_RETURN_32(ret);
 }
@@ -513,6 +531,10 @@ SHIM_CALL NetDll_connect_shim(PPCContext* ppc_context,
   sockaddr name;
   LoadSockaddr(SHIM_MEM_ADDR(name_ptr), &name);
   int ret = connect(socket_handle, &name, namelen);
+  // Sockets connecting in the background are polled for the connection.
+  if (!ret || WSAGetLastError() == WSAEWOULDBLOCK) {
+    kernel_state->socket_poller()->SetPollable(socket_handle);
+  }
 
   SHIM_SET_RETURN_32(ret);
 }
@@ -540,9 +562,26 @@ SHIM_CALL NetDll_accept_shim(PPCContext* ppc_context,
   XELOGD("NetDll_accept(%d, %.8X, %d)", caller, socket_handle, addr_ptr,
          addrlen_ptr);
 
+  auto socket_poller = kernel_state->socket_poller();
+  uint32_t readiness = 0;
+  bool non_blocking = false;
   sockaddr addr;
-  int addrlen;
-  SOCKET ret_socket = accept(socket_handle, &addr, &addrlen);
+  int addrlen = sizeof(addr);
+  SOCKET ret_socket;
+  if (socket_poller->GetReadiness(socket_handle, &readiness, &non_blocking) &&
+      non_blocking &&
+      !(readiness & (SocketPoller::kReadable | SocketPoller::kError))) {
+    // Nobody has connected since the host last said it would block.
+    WSASetLastError(WSAEWOULDBLOCK);
+    ret_socket = INVALID_SOCKET;
+  } else {
+    ret_socket = accept(socket_handle, &addr, &addrlen);
+    if (ret_socket == INVALID_SOCKET ? WSAGetLastError() == WSAEWOULDBLOCK
+                                     : !non_blocking) {
+      socket_poller->ClearReadiness(socket_handle,
+                                    SocketPoller::kReadable);
+    }
+  }
 
   if (ret_socket == INVALID_SOCKET) {
     if (addr_ptr) {
@@ -556,6 +595,11 @@ SHIM_CALL NetDll_accept_shim(PPCContext* ppc_context,
     SHIM_SET_RETURN_32(-1);
   } else {
     assert_true(ret_socket >> 32 == 0);
+    // Accepted sockets are non-blocking if the listening socket is.
+    auto accepted_handle = static_cast<uint32_t>(ret_socket);
+    socket_poller->AddSocket(accepted_handle, true);
+    socket_poller->SetNonBlocking(accepted_handle, non_blocking);
+    socket_poller->SetPollable(accepted_handle);
     if (addr_ptr) {
       StoreSockaddr(addr, SHIM_MEM_ADDR(addr_ptr));
     }
@@ -587,6 +631,55 @@ void StoreFdset(const fd_set& src, uint8_t* dest) {
   }
 }
 
+// Serves select from the readiness the poller keeps, so that checking for
+// readiness doesn't cost a syscall. Returns false if any of the sockets isn't
+// polled, and the host has to be asked.
+bool SelectFromReadiness(SocketPoller* socket_poller, fd_set* readfds,
+                         fd_set* writefds, fd_set* exceptfds,
+                         const timeval* timeout, int* out_ret) {
+  fd_set* fdsets[] = {readfds, writefds, exceptfds};
+  const uint32_t wanted[] = {SocketPoller::kReadable, SocketPoller::kWritable,
+                             SocketPoller::kError};
+  std::vector<SocketPoller::WaitRequest> requests;
+  for (size_t i = 0; i < xe::countof(fdsets); ++i) {
+    if (!fdsets[i]) {
+      continue;
+    }
+    for (u_int j = 0; j < fdsets[i]->fd_count; ++j) {
+      requests.push_back(
+          {static_cast<uint32_t>(fdsets[i]->fd_array[j]), wanted[i], 0});
+    }
+  }
+  if (requests.empty()) {
+    return false;
+  }
+  int32_t timeout_ms = -1;
+  if (timeout) {
+    timeout_ms = timeout->tv_sec * 1000 + (timeout->tv_usec + 999) / 1000;
+  }
+  if (!socket_poller->Wait(&requests, timeout_ms)) {
+    return false;
+  }
+  // Only the sockets that are ready are left in the sets.
+  int ret = 0;
+  size_t request_index = 0;
+  for (size_t i = 0; i < xe::countof(fdsets); ++i) {
+    if (!fdsets[i]) {
+      continue;
+    }
+    u_int ready_count = 0;
+    for (u_int j = 0; j < fdsets[i]->fd_count; ++j) {
+      if (requests[request_index++].ready) {
+        fdsets[i]->fd_array[ready_count++] = fdsets[i]->fd_array[j];
+      }
+    }
+    fdsets[i]->fd_count = ready_count;
+    ret += ready_count;
+  }
+  *out_ret = ret;
+  return true;
+}
+
 SHIM_CALL NetDll_select_shim(PPCContext* ppc_context,
                              KernelState* kernel_state) {
   uint32_t caller = SHIM_GET_ARG_32(0);
@@ -621,9 +714,16 @@ SHIM_CALL NetDll_select_shim(PPCContext* ppc_context,
         reinterpret_cast<int32_t*>(&timeout.tv_usec));
     timeout_in = &timeout;
   }
-  int ret = select(nfds, readfds_ptr ? &readfds : nullptr,
-                   writefds_ptr ? &writefds : nullptr,
-                   exceptfds_ptr ? &exceptfds : nullptr, timeout_in);
+  int ret;
+  if (!SelectFromReadiness(kernel_state->socket_poller(),
+                           readfds_ptr ? &readfds : nullptr,
+                           writefds_ptr ? &writefds : nullptr,
+                           exceptfds_ptr ? &exceptfds : nullptr, timeout_in,
+                           &ret)) {
+    ret = select(nfds, readfds_ptr ? &readfds : nullptr,
+                 writefds_ptr ? &writefds : nullptr,
+                 exceptfds_ptr ? &exceptfds : nullptr, timeout_in);
+  }
   if (readfds_ptr) {
     StoreFdset(readfds, SHIM_MEM_ADDR(readfds_ptr));
   }
@@ -637,6 +737,18 @@ SHIM_CALL NetDll_select_shim(PPCContext* ppc_context,
   SHIM_SET_RETURN_32(ret);
 }
 
+// Readiness is only dropped when the host says the socket would block, as
+// more may have arrived, or after any receive for blocking sockets, which
+// mustn't be reported readable when they would block.
+void UpdateReadinessAfterReceive(SocketPoller* socket_poller,
+                                 uint32_t socket_handle, int ret,
+                                 bool non_blocking) {
+  if (ret == SOCKET_ERROR ? WSAGetLastError() == WSAEWOULDBLOCK
+                          : !non_blocking) {
+    socket_poller->ClearReadiness(socket_handle, SocketPoller::kReadable);
+  }
+}
+
 SHIM_CALL NetDll_recv_shim(PPCContext* ppc_context, KernelState* kernel_state) {
   uint32_t caller = SHIM_GET_ARG_32(0);
   uint32_t socket_handle = SHIM_GET_ARG_32(1);
@@ -647,8 +759,22 @@ SHIM_CALL NetDll_recv_shim(PPCContext* ppc_context, KernelState* kernel_state) {
   XELOGD("NetDll_recv(%d, %.8X, %.8X, %d, %d)", caller, socket_handle, buf_ptr,
          len, flags);
 
-  int ret = recv(socket_handle, reinterpret_cast<char*>(SHIM_MEM_ADDR(buf_ptr)),
-                 len, flags);
+  auto socket_poller = kernel_state->socket_poller();
+  uint32_t readiness = 0;
+  bool non_blocking = false;
+  int ret;
+  if (socket_poller->GetReadiness(socket_handle, &readiness, &non_blocking) &&
+      non_blocking &&
+      !(readiness & (SocketPoller::kReadable | SocketPoller::kError))) {
+    // Nothing has arrived since the host last said it would block.
+    WSASetLastError(WSAEWOULDBLOCK);
+    ret = -1;
+  } else {
+    ret = recv(socket_handle, reinterpret_cast<char*>(SHIM_MEM_ADDR(buf_ptr)),
+               len, flags);
+    UpdateReadinessAfterReceive(socket_poller, socket_handle, ret,
+                                non_blocking);
+  }
 
   SHIM_SET_RETURN_32(ret);
 }
@@ -666,11 +792,24 @@ SHIM_CALL NetDll_recvfrom_shim(PPCContext* ppc_context,
   XELOGD("NetDll_recvfrom(%d, %.8X, %.8X, %d, %d, %.8X, %.8X)", caller,
          socket_handle, buf_ptr, len, flags, from_ptr, fromlen_ptr);
 
+  auto socket_poller = kernel_state->socket_poller();
+  uint32_t readiness = 0;
+  bool non_blocking = false;
   sockaddr from;
   int fromlen = sizeof(from);
-  int ret =
-      recvfrom(socket_handle, reinterpret_cast<char*>(SHIM_MEM_ADDR(buf_ptr)),
-               len, flags, &from, &fromlen);
+  int ret;
+  if (socket_poller->GetReadiness(socket_handle, &readiness, &non_blocking) &&
+      non_blocking &&
+      !(readiness & (SocketPoller::kReadable | SocketPoller::kError))) {
+    WSASetLastError(WSAEWOULDBLOCK);
+    ret = -1;
+  } else {
+    ret =
+        recvfrom(socket_handle, reinterpret_cast<char*>(SHIM_MEM_ADDR(buf_ptr)),
+                 len, flags, &from, &fromlen);
+    UpdateReadinessAfterReceive(socket_poller, socket_handle, ret,
+                                non_blocking);
+  }
   if (ret == -1) {
     std::memset(SHIM_MEM_ADDR(from_ptr), 0, sizeof(from));
     SHIM_SET_MEM_32(fromlen_ptr, sizeof(from));
@@ -692,8 +831,30 @@ SHIM_CALL NetDll_send_shim(PPCContext* ppc_context, KernelState* kernel_state) {
   XELOGD("NetDll_send(%d, %.8X, %.8X, %d, %d)", caller, socket_handle, buf_ptr,
          len, flags);
 
-  int ret = send(socket_handle, reinterpret_cast<char*>(SHIM_MEM_ADDR(buf_ptr)),
-                 len, flags);
+  auto socket_poller = kernel_state->socket_poller();
+  auto buf = reinterpret_cast<char*>(SHIM_MEM_ADDR(buf_ptr));
+  int ret;
+  auto send_result = flags ? SocketPoller::SendResult::kSendDirectly
+                           : socket_poller->QueueSend(socket_handle, buf, len);
+  if (send_result == SocketPoller::SendResult::kQueued) {
+    ret = int(len);
+  } else if (send_result == SocketPoller::SendResult::kWouldBlock) {
+    WSASetLastError(WSAEWOULDBLOCK);
+    ret = -1;
+  } else {
+    // Queued data goes out first, and a queued send that failed fails this
+    // one.
+    int error = socket_poller->FlushSends(socket_handle);
+    if (error) {
+      WSASetLastError(error);
+      ret = -1;
+    } else {
+      ret = send(socket_handle, buf, len, flags);
+      if (ret == SOCKET_ERROR && WSAGetLastError() == WSAEWOULDBLOCK) {
+        socket_poller->ClearReadiness(socket_handle, SocketPoller::kWritable);
+      }
+    }
+  }
 
   SHIM_SET_RETURN_32(ret);
 }
@@ -716,6 +877,10 @@ SHIM_CALL NetDll_sendto_shim(PPCContext* ppc_context,
   int ret =
       sendto(socket_handle, reinterpret_cast<char*>(SHIM_MEM_ADDR(buf_ptr)),
              len, flags, &to, tolen);
+  // Datagram sockets sent from without being bound are bound by it.
+  if (ret != SOCKET_ERROR) {
+    kernel_state->socket_poller()->SetPollable(socket_handle);
+  }
 
   SHIM_SET_RETURN_32(ret);
 }
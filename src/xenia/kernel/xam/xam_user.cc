@@ -8,6 +8,7 @@
  */
 
 #include <cstring>
+#include <vector>
 
 #include "xenia/base/logging.h"
 #include "xenia/kernel/kernel_state.h"
@@ -174,12 +175,14 @@ SHIM_CALL XamUserReadProfileSettings_shim(PPCContext* ppc_context,
   uint32_t base_size_needed = sizeof(X_USER_READ_PROFILE_SETTINGS);
   base_size_needed += setting_count * sizeof(X_USER_READ_PROFILE_SETTING);
 
-  // Compute required extra size.
+  // Compute required extra size. The settings are kept to be written below.
   uint32_t size_needed = base_size_needed;
   bool any_missing = false;
+  std::vector<UserProfile::Setting*> settings(setting_count);
   for (uint32_t n = 0; n < setting_count; ++n) {
     uint32_t setting_id = setting_ids[n];
     auto setting = user_profile->GetSetting(setting_id);
+    settings[n] = setting;
     if (setting) {
       auto extra_size = static_cast<uint32_t>(setting->extra_size());
       size_needed += extra_size;
@@ -225,7 +228,7 @@ SHIM_CALL XamUserReadProfileSettings_shim(PPCContext* ppc_context,
   size_t buffer_offset = base_size_needed;
   for (uint32_t n = 0; n < setting_count; ++n) {
     uint32_t setting_id = setting_ids[n];
-    auto setting = user_profile->GetSetting(setting_id);
+    auto setting = settings[n];
 
     std::memset(out_setting, 0, sizeof(X_USER_READ_PROFILE_SETTING));
     out_setting->from = !setting ? 0 : setting->is_title_specific() ? 2 : 1;
@@ -116,9 +116,10 @@ dword_result_t NtCreateFile(lpdword_t handle_out, dword_t desired_access,
   auto object_name =
       kernel_memory()->TranslateVirtual<X_ANSI_STRING*>(object_attrs->name_ptr);
 
-  // Compute path, possibly attrs relative.
-  std::string target_path =
-      object_name->to_string(kernel_memory()->virtual_membase());
+  // Compute path, possibly attrs relative. Reused by every call on the
+  // thread, so the path doesn't allocate once it has grown.
+  thread_local std::string target_path;
+  object_name->to_string(kernel_memory()->virtual_membase(), &target_path);
   if (object_attrs->root_directory != 0xFFFFFFFD &&  // ObDosDevices
       object_attrs->root_directory != 0) {
     auto root_file = kernel_state()->object_table()->LookupObject<XFile>(
@@ -174,6 +175,57 @@ dword_result_t NtOpenFile(lpdword_t handle_out, dword_t desired_access,
 }
 DECLARE_XBOXKRNL_EXPORT(NtOpenFile, ExportTag::kImplemented);
 
+// Checks once up front that the guest buffer can be read from or written to
+// directly by the file, which copies straight between the host file and
+// guest memory.
+X_STATUS ValidateGuestBuffer(uint32_t address, uint32_t length,
+                             bool written_by_file) {
+  if (!length) {
+    return X_STATUS_SUCCESS;
+  }
+  auto heap = kernel_memory()->LookupHeap(address);
+  uint32_t protect =
+      written_by_file ? kMemoryProtectWrite : kMemoryProtectRead;
+  if (!heap || !heap->IsRangeAccessible(address, length, protect)) {
+    XELOGW("File IO with inaccessible guest buffer %.8X (%d bytes)", address,
+           length);
+    return X_STATUS_ACCESS_VIOLATION;
+  }
+  // some games NtReadFile() directly into texture memory
+  // TODO(rick): better checking of physical address
+  if (written_by_file && address >= 0xA0000000) {
+    cpu::MMIOHandler::global_handler()->InvalidateRange(
+        heap->GetPhysicalAddress(address), length);
+  } else if (written_by_file) {
+    // Host reads don't fault on watched code, so the watches go first.
+    cpu::MMIOHandler::global_handler()->InvalidateVirtualRange(address,
+                                                               length);
+  }
+  return X_STATUS_SUCCESS;
+}
+
+// Completes an overlapped read or write on an IO thread: the status block is
+// written before the event is signaled and the APC queued to the thread that
+// issued the request.
+void CompleteAsyncIO(object_ref<XEvent> ev, object_ref<XThread> thread,
+                     uint32_t io_status_block_ptr, uint32_t apc_routine,
+                     uint32_t apc_context, X_STATUS status,
+                     size_t bytes_transferred) {
+  if (io_status_block_ptr) {
+    auto io_status_block =
+        kernel_memory()->TranslateVirtual<X_IO_STATUS_BLOCK*>(
+            io_status_block_ptr);
+    io_status_block->status = status;
+    io_status_block->information = uint32_t(bytes_transferred);
+  }
+  if (ev) {
+    ev->Set(0, false);
+  }
+  if (apc_routine && apc_context && thread) {
+    thread->EnqueueApc(apc_routine, apc_context, io_status_block_ptr, 0);
+  }
+}
+
 dword_result_t NtReadFile(dword_t file_handle, dword_t event_handle,
                           lpvoid_t apc_routine_ptr, lpvoid_t apc_context,
                           pointer_t<X_IO_STATUS_BLOCK> io_status_block,
@@ -193,63 +245,65 @@ dword_result_t NtReadFile(dword_t file_handle, dword_t event_handle,
   }
 
   if (XSUCCEEDED(result)) {
-    if (true || file->is_synchronous()) {
-      // some games NtReadFile() directly into texture memory
-      // TODO(rick): better checking of physical address
-      if (buffer.guest_address() >= 0xA0000000) {
-        auto heap = kernel_memory()->LookupHeap(buffer.guest_address());
-        cpu::MMIOHandler::global_handler()->InvalidateRange(
-            heap->GetPhysicalAddress(buffer.guest_address()), buffer_length);
-      }
+    result = ValidateGuestBuffer(buffer.guest_address(), buffer_length, true);
+  }
 
-      // Synchronous.
-      size_t bytes_read = 0;
-      result = file->Read(
-          buffer, buffer_length,
-          byte_offset_ptr ? static_cast<uint64_t>(*byte_offset_ptr) : -1,
-          &bytes_read, apc_context);
+  if (XSUCCEEDED(result)) {
+    // Overlapped reads at an offset run on the IO threads, and complete
+    // through the status block, event, APC and completion ports once done.
+    // Low bit of the APC routine probably means do not queue to IO ports.
+    uint32_t apc_routine = uint32_t(apc_routine_ptr) & ~1u;
+    if (!file->is_synchronous() && byte_offset_ptr) {
       if (io_status_block) {
-        io_status_block->status = result;
-        io_status_block->information = static_cast<uint32_t>(bytes_read);
+        io_status_block->status = X_STATUS_PENDING;
+        io_status_block->information = 0;
       }
-
-      // Queue the APC callback. It must be delivered via the APC mechanism even
-      // though were are completing immediately.
-      // Low bit probably means do not queue to IO ports.
-      if ((uint32_t)apc_routine_ptr & ~1) {
-        if (apc_context) {
-          auto thread = XThread::GetCurrentThread();
-          thread->EnqueueApc(static_cast<uint32_t>(apc_routine_ptr) & ~1u,
-                             apc_context, io_status_block, 0);
-        }
+      if (ev) {
+        ev->Reset();
       }
-
-      if (!file->is_synchronous()) {
-        result = X_STATUS_PENDING;
+      uint32_t io_status_block_ptr = io_status_block.guest_address();
+      uint32_t apc_context_ptr = apc_context.guest_address();
+      auto thread = retain_object(XThread::GetCurrentThread());
+      bool queued = file->ReadAsync(
+          buffer, buffer_length, static_cast<uint64_t>(*byte_offset_ptr),
+          apc_context_ptr,
+          [ev, thread, io_status_block_ptr, apc_routine, apc_context_ptr](
+              X_STATUS status, size_t bytes_read) {
+            CompleteAsyncIO(ev, thread, io_status_block_ptr, apc_routine,
+                            apc_context_ptr, status, bytes_read);
+          });
+      if (queued) {
+        return X_STATUS_PENDING;
       }
+    }
 
-      // Mark that we should signal the event now. We do this after
-      // we have written the info out.
-      signal_event = true;
-    } else {
-      // TODO(benvanik): async.
-
-      // X_STATUS_PENDING if not returning immediately.
-      // XFile is waitable and signalled after each async req completes.
-      // reset the input event (->Reset())
-      /*xeNtReadFileState* call_state = new xeNtReadFileState();
-      XAsyncRequest* request = new XAsyncRequest(
-      state, file,
-      (XAsyncRequest::CompletionCallback)xeNtReadFileCompleted,
-      call_state);*/
-      // result = file->Read(buffer, buffer_length, byte_offset, request);
-      if (io_status_block) {
-        io_status_block->status = X_STATUS_PENDING;
-        io_status_block->information = 0;
+    // Synchronous.
+    size_t bytes_read = 0;
+    result = file->Read(
+        buffer, buffer_length,
+        byte_offset_ptr ? static_cast<uint64_t>(*byte_offset_ptr) : -1,
+        &bytes_read, apc_context);
+    if (io_status_block) {
+      io_status_block->status = result;
+      io_status_block->information = static_cast<uint32_t>(bytes_read);
+    }
+
+    // Queue the APC callback. It must be delivered via the APC mechanism even
+    // though were are completing immediately.
+    if (apc_routine) {
+      if (apc_context) {
+        auto thread = XThread::GetCurrentThread();
+        thread->EnqueueApc(apc_routine, apc_context, io_status_block, 0);
       }
+    }
 
+    if (!file->is_synchronous()) {
       result = X_STATUS_PENDING;
     }
+
+    // Mark that we should signal the event now. We do this after
+    // we have written the info out.
+    signal_event = true;
   }
 
   if (XFAILED(result) && io_status_block) {
@@ -271,9 +325,6 @@ dword_result_t NtWriteFile(dword_t file_handle, dword_t event_handle,
                            pointer_t<X_IO_STATUS_BLOCK> io_status_block,
                            lpvoid_t buffer, dword_t buffer_length,
                            lpqword_t byte_offset_ptr) {
-  // Async not supported yet.
-  assert_zero(apc_routine);
-
   X_STATUS result = X_STATUS_SUCCESS;
   uint32_t info = 0;
 
@@ -290,42 +341,68 @@ dword_result_t NtWriteFile(dword_t file_handle, dword_t event_handle,
     result = X_STATUS_INVALID_HANDLE;
   }
 
+  if (XSUCCEEDED(result)) {
+    result = ValidateGuestBuffer(buffer.guest_address(), buffer_length, false);
+  }
+
   // Execute write.
   if (XSUCCEEDED(result)) {
-    // TODO(benvanik): async path.
-    if (true || file->is_synchronous()) {
-      // Synchronous request.
-      size_t bytes_written = 0;
-      result = file->Write(
-          buffer, buffer_length,
-          byte_offset_ptr ? static_cast<uint64_t>(*byte_offset_ptr) : -1,
-          &bytes_written, apc_context);
-      if (XSUCCEEDED(result)) {
-        info = (int32_t)bytes_written;
+    // Overlapped writes at an offset run on the IO threads, as reads do.
+    uint32_t apc_routine_address = uint32_t(apc_routine) & ~1u;
+    if (!file->is_synchronous() && byte_offset_ptr) {
+      if (io_status_block) {
+        io_status_block->status = X_STATUS_PENDING;
+        io_status_block->information = 0;
       }
-
-      if (!file->is_synchronous()) {
-        result = X_STATUS_PENDING;
+      if (ev) {
+        ev->Reset();
       }
-
-      if (io_status_block) {
-        io_status_block->status = X_STATUS_SUCCESS;
-        io_status_block->information = info;
+      uint32_t io_status_block_ptr = io_status_block.guest_address();
+      uint32_t apc_context_ptr = apc_context.guest_address();
+      auto thread = retain_object(XThread::GetCurrentThread());
+      bool queued = file->WriteAsync(
+          buffer, buffer_length, static_cast<uint64_t>(*byte_offset_ptr),
+          apc_context_ptr,
+          [ev, thread, io_status_block_ptr, apc_routine_address,
+           apc_context_ptr](X_STATUS status, size_t bytes_written) {
+            CompleteAsyncIO(ev, thread, io_status_block_ptr,
+                            apc_routine_address, apc_context_ptr, status,
+                            bytes_written);
+          });
+      if (queued) {
+        return X_STATUS_PENDING;
       }
+    }
 
-      // Mark that we should signal the event now. We do this after
-      // we have written the info out.
-      signal_event = true;
-    } else {
-      // X_STATUS_PENDING if not returning immediately.
+    // Synchronous request.
+    size_t bytes_written = 0;
+    result = file->Write(
+        buffer, buffer_length,
+        byte_offset_ptr ? static_cast<uint64_t>(*byte_offset_ptr) : -1,
+        &bytes_written, apc_context);
+    if (XSUCCEEDED(result)) {
+      info = (int32_t)bytes_written;
+    }
+
+    if (!file->is_synchronous()) {
       result = X_STATUS_PENDING;
-      info = 0;
+    }
 
-      if (io_status_block) {
-        io_status_block->status = X_STATUS_SUCCESS;
-        io_status_block->information = info;
-      }
+    if (io_status_block) {
+      io_status_block->status = X_STATUS_SUCCESS;
+      io_status_block->information = info;
+    }
+
+    // Queue the APC callback, as for reads.
+    if (apc_routine_address && apc_context) {
+      auto thread = XThread::GetCurrentThread();
+      thread->EnqueueApc(apc_routine_address, apc_context, io_status_block,
+                         0);
     }
+
+    // Mark that we should signal the event now. We do this after
+    // we have written the info out.
+    signal_event = true;
   }
 
   if (XFAILED(result) && io_status_block) {
@@ -593,8 +670,9 @@ dword_result_t NtQueryFullAttributesFile(
   }
 
   // Resolve the file using the virtual file system.
-  auto entry = kernel_state()->file_system()->ResolvePath(
-      object_name->to_string(kernel_memory()->virtual_membase()));
+  thread_local std::string target_path;
+  object_name->to_string(kernel_memory()->virtual_membase(), &target_path);
+  auto entry = kernel_state()->file_system()->ResolvePath(target_path);
   if (entry) {
     // Found.
     file_info->creation_time = entry->create_timestamp();
@@ -702,15 +780,45 @@ dword_result_t NtQueryDirectoryFile(
   if (length < 72) {
     return X_STATUS_INFO_LENGTH_MISMATCH;
   }
+  X_STATUS result =
+      ValidateGuestBuffer(file_info_ptr.guest_address(), length, true);
+  if (XFAILED(result)) {
+    return result;
+  }
 
-  X_STATUS result = X_STATUS_UNSUCCESSFUL;
   uint32_t info = 0;
 
   auto file = kernel_state()->object_table()->LookupObject<XFile>(file_handle);
   auto name =
       file_name ? file_name->to_string(kernel_memory()->virtual_membase()) : "";
+  auto ev = kernel_state()->object_table()->LookupObject<XEvent>(event_handle);
+  if (file && !file->is_synchronous() && (!event_handle || ev)) {
+    // Listing a large directory may take a while, so overlapped queries run
+    // on the IO threads like reads, completing the same way.
+    if (io_status_block) {
+      io_status_block->status = X_STATUS_PENDING;
+      io_status_block->information = 0;
+    }
+    if (ev) {
+      ev->Reset();
+    }
+    uint32_t io_status_block_ptr = io_status_block.guest_address();
+    uint32_t apc_routine_ptr = uint32_t(apc_routine) & ~1u;
+    uint32_t apc_context_ptr = apc_context.guest_address();
+    auto thread = retain_object(XThread::GetCurrentThread());
+    bool queued = file->QueryDirectoryAsync(
+        file_info_ptr, length, name, restart_scan != 0, apc_context_ptr,
+        [ev, thread, io_status_block_ptr, apc_routine_ptr, apc_context_ptr](
+            X_STATUS status, size_t info_length) {
+          CompleteAsyncIO(ev, thread, io_status_block_ptr, apc_routine_ptr,
+                          apc_context_ptr, status, info_length);
+        });
+    if (queued) {
+      return X_STATUS_PENDING;
+    }
+  }
+
   if (file) {
-    X_FILE_DIRECTORY_INFORMATION dir_info = {0};
     result = file->QueryDirectory(file_info_ptr, length,
                                   !name.empty() ? name.c_str() : nullptr,
                                   restart_scan != 0);
@@ -742,6 +850,12 @@ SHIM_CALL NtFlushBuffersFile_shim(PPCContext* ppc_context,
   XELOGD("NtFlushBuffersFile(%.8X, %.8X)", file_handle, io_status_block_ptr);
 
   auto result = X_STATUS_SUCCESS;
+  auto file = kernel_state->object_table()->LookupObject<XFile>(file_handle);
+  if (file) {
+    result = file->file()->Flush();
+  } else {
+    result = X_STATUS_INVALID_HANDLE;
+  }
 
   if (io_status_block_ptr) {
     SHIM_SET_MEM_32(io_status_block_ptr, result);  // Status
@@ -524,16 +524,9 @@ SHIM_CALL ExAllocatePoolTypeWithTag_shim(PPCContext* ppc_context,
 
   XELOGD("ExAllocatePoolTypeWithTag(%d, %.4s, %d)", size, &tag, zero);
 
-  uint32_t alignment = 8;
-  uint32_t adjusted_size = size;
-  if (adjusted_size < 4 * 1024) {
-    adjusted_size = xe::round_up(adjusted_size, 4 * 1024);
-  } else {
-    alignment = 4 * 1024;
-  }
-
-  uint32_t addr =
-      kernel_state->memory()->SystemHeapAlloc(adjusted_size, alignment);
+  // Small allocations are pooled rather than taking a page each.
+  uint32_t alignment = size < 4 * 1024 ? 8 : 4 * 1024;
+  uint32_t addr = kernel_state->memory()->SystemHeapAlloc(size, alignment);
 
   SHIM_SET_RETURN_32(addr);
 }
@@ -11,6 +11,7 @@
 
 #include <gflags/gflags.h>
 
+#include <cinttypes>
 #include <vector>
 
 #include "xenia/base/clock.h"
@@ -20,6 +21,7 @@
 #include "xenia/kernel/kernel_state.h"
 #include "xenia/kernel/user_module.h"
 #include "xenia/kernel/xboxkrnl/xboxkrnl_private.h"
+#include "xenia/kernel/xboxkrnl/xboxkrnl_threading.h"
 
 namespace xe {
 namespace kernel {
@@ -168,7 +170,16 @@ void XboxkrnlModule::RegisterExportTable(
   export_resolver->RegisterTable("xboxkrnl.exe", &xboxkrnl_exports);
 }
 
-XboxkrnlModule::~XboxkrnlModule() = default;
+XboxkrnlModule::~XboxkrnlModule() {
+  auto lock_stats = GetGuestLockStats();
+  uint64_t contended_count =
+      lock_stats.spin_acquired_count + lock_stats.spin_failed_count;
+  if (contended_count) {
+    XELOGI("Guest locks: %" PRIu64 " of %" PRIu64
+           " contended acquisitions got by spinning",
+           lock_stats.spin_acquired_count, contended_count);
+  }
+}
 
 }  // namespace xboxkrnl
 }  // namespace kernel
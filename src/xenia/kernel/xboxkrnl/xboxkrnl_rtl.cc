@@ -14,6 +14,7 @@
 
 #include "xenia/base/atomic.h"
 #include "xenia/base/logging.h"
+#include "xenia/base/memory.h"
 #include "xenia/base/string.h"
 #include "xenia/base/threading.h"
 #include "xenia/kernel/kernel_state.h"
@@ -44,14 +45,7 @@ dword_result_t RtlCompareMemory(lpvoid_t source1, lpvoid_t source2,
   // we just do this ourselves vs. using memcmp.
   // On Windows we could use the builtin function.
 
-  uint32_t c = 0;
-  for (uint32_t n = 0; n < length; n++, p1++, p2++) {
-    if (*p1 == *p2) {
-      c++;
-    }
-  }
-
-  return c;
+  return uint32_t(xe::count_equal_bytes(p1, p2, length));
 }
 DECLARE_XBOXKRNL_EXPORT(RtlCompareMemory, ExportTag::kImplemented);
 
@@ -63,16 +57,10 @@ dword_result_t RtlCompareMemoryUlong(lpvoid_t source, dword_t length,
     return 0;
   }
 
-  uint32_t n = 0;
-  for (uint32_t i = 0; i < (length / 4); i++) {
-    // FIXME: This assumes as_array returns xe::be
-    uint32_t val = source.as_array<uint32_t>()[i];
-    if (val == pattern) {
-      n++;
-    }
-  }
-
-  return n;
+  // Compared as stored, so the pattern is swapped rather than the memory.
+  return uint32_t(xe::count_equal_32(source.as<uint32_t*>(),
+                                     xe::byte_swap(pattern.value()),
+                                     length / 4));
 }
 DECLARE_XBOXKRNL_EXPORT(RtlCompareMemoryUlong, ExportTag::kImplemented);
 
@@ -81,11 +69,8 @@ void RtlFillMemoryUlong(lpvoid_t destination, dword_t length, dword_t pattern) {
   // NOTE: length must be % 4, so we can work on uint32s.
   uint32_t count = length >> 2;
 
-  uint32_t* p = destination.as<uint32_t*>();
-  uint32_t swapped_pattern = xe::byte_swap(pattern.value());
-  for (uint32_t n = 0; n < count; n++, p++) {
-    *p = swapped_pattern;
-  }
+  xe::fill_32(destination.as<uint32_t*>(), xe::byte_swap(pattern.value()),
+              count);
 }
 DECLARE_XBOXKRNL_EXPORT(RtlFillMemoryUlong, ExportTag::kImplemented);
 
@@ -362,14 +347,23 @@ void RtlEnterCriticalSection(pointer_t<X_RTL_CRITICAL_SECTION> cs) {
     return;
   }
 
-  // Spin loop
-  while (spin_count--) {
-    if (xe::atomic_cas(-1, 0, &cs->lock_count)) {
-      // Acquired.
-      cs->owning_thread = cur_thread;
-      cs->recursion_count = 1;
-      return;
-    }
+  if (xe::atomic_cas(-1, 0, &cs->lock_count)) {
+    // Acquired uncontended.
+    cs->owning_thread = cur_thread;
+    cs->recursion_count = 1;
+    return;
+  }
+
+  // Spin loop, polling before trying so the holder keeps the cache line.
+  auto lock_count = &cs->lock_count;
+  bool acquired = SpinForGuestLock(spin_count, [lock_count]() {
+    return *reinterpret_cast<volatile int32_t*>(lock_count) == -1 &&
+           xe::atomic_cas(-1, 0, lock_count);
+  });
+  if (acquired) {
+    cs->owning_thread = cur_thread;
+    cs->recursion_count = 1;
+    return;
   }
 
   if (xe::atomic_inc(&cs->lock_count) != 0) {
@@ -7,11 +7,19 @@
  ******************************************************************************
  */
 
+#include <gflags/gflags.h>
+
 #include <cstring>
 #include <iomanip>
+#include <memory>
 #include <sstream>
+#include <string>
+#include <unordered_map>
+#include <vector>
 
+#include "third_party/xxhash/xxhash.h"
 #include "xenia/base/logging.h"
+#include "xenia/base/mutex.h"
 #include "xenia/kernel/kernel_state.h"
 #include "xenia/kernel/user_module.h"
 #include "xenia/kernel/util/shim_utils.h"
@@ -20,23 +28,14 @@
 #include "xenia/kernel/xthread.h"
 #include "xenia/xbox.h"
 
+DEFINE_bool(log_dbgprint, true,
+            "Format DbgPrint output into the log. When false DbgPrint returns "
+            "without formatting anything.");
+
 namespace xe {
 namespace kernel {
 namespace xboxkrnl {
 
-enum FormatState {
-  FS_Invalid = 0,
-  FS_Unknown,
-  FS_Start,
-  FS_Flags,
-  FS_Width,
-  FS_PrecisionStart,
-  FS_Precision,
-  FS_Size,
-  FS_Type,
-  FS_End,
-};
-
 enum FormatFlags {
   FF_LeftJustify = 1 << 0,
   FF_AddLeadingZeros = 1 << 1,
@@ -52,21 +51,6 @@ enum FormatFlags {
   FF_ForceLeadingZero = 1 << 11,
 };
 
-enum ArgumentSize {
-  AS_Default = 0,
-  AS_Short,
-  AS_Long,
-  AS_LongLong,
-};
-
-class FormatData {
- public:
-  virtual uint16_t get() = 0;
-  virtual uint16_t peek(int32_t offset) = 0;
-  virtual void skip(int32_t count) = 0;
-  virtual bool put(uint16_t c) = 0;
-};
-
 class ArgList {
  public:
   virtual uint32_t get32() = 0;
@@ -80,6 +64,272 @@ class ArgList {
 // "Format Specification Syntax: printf and wprintf Functions"
 // https://msdn.microsoft.com/en-us/library/56e442dc.aspx
 
+// A run of literal text or a conversion of a format string.
+struct FormatToken {
+  enum class Type : uint8_t {
+    kText,
+    kConversion,
+    // The format ends within a conversion, which fails the call.
+    kInvalid,
+  };
+  Type type;
+  // The type character of the conversion, or 0 if it isn't a known one.
+  uint16_t conversion;
+  bool width_from_args;
+  bool precision_from_args;
+  uint32_t flags;
+  int32_t width;
+  int32_t precision;
+  // The literal characters in CompiledFormat::text.
+  uint32_t text_offset;
+  uint32_t text_length;
+};
+
+// A format string split into tokens once, so repeated calls with the same
+// format only fetch the arguments and write the output.
+struct CompiledFormat {
+  uint64_t hash;
+  // The characters of the format in host order, without the terminator.
+  std::vector<uint16_t> text;
+  std::vector<FormatToken> tokens;
+};
+
+// https://msdn.microsoft.com/en-us/library/8aky45ct.aspx (flags)
+// https://msdn.microsoft.com/en-us/library/25366k66.aspx (width)
+// https://msdn.microsoft.com/en-us/library/0ecbz014.aspx (precision)
+// https://msdn.microsoft.com/en-us/library/tcxf1dw6.aspx (size)
+// https://msdn.microsoft.com/en-us/library/hf4y5e3w.aspx (type)
+void CompileFormat(CompiledFormat* format) {
+  const auto& text = format->text;
+  const size_t length = text.size();
+  auto& tokens = format->tokens;
+  // Characters past the end read as the terminator.
+  auto at = [&](size_t index) -> uint16_t {
+    return index < length ? text[index] : 0;
+  };
+  auto add_text = [&](size_t offset, size_t count) {
+    if (!tokens.empty() && tokens.back().type == FormatToken::Type::kText &&
+        tokens.back().text_offset + tokens.back().text_length == offset) {
+      tokens.back().text_length += uint32_t(count);
+      return;
+    }
+    FormatToken token = {};
+    token.type = FormatToken::Type::kText;
+    token.text_offset = uint32_t(offset);
+    token.text_length = uint32_t(count);
+    tokens.push_back(token);
+  };
+
+  size_t i = 0;
+  while (i < length) {
+    if (text[i] != '%') {
+      size_t start = i;
+      while (i < length && text[i] != '%') {
+        ++i;
+      }
+      add_text(start, i - start);
+      continue;
+    }
+    ++i;
+    if (at(i) == '%') {
+      add_text(i, 1);
+      ++i;
+      continue;
+    }
+
+    FormatToken token = {};
+    token.type = FormatToken::Type::kConversion;
+    token.precision = -1;
+
+    while (true) {
+      uint32_t flag;
+      switch (at(i)) {
+        case '-':
+          flag = FF_LeftJustify;
+          break;
+        case '+':
+          flag = FF_AddPositive;
+          break;
+        case '0':
+          flag = FF_AddLeadingZeros;
+          break;
+        case ' ':
+          flag = FF_AddPositiveAsSpace;
+          break;
+        case '#':
+          flag = FF_AddPrefix;
+          break;
+        default:
+          flag = 0;
+          break;
+      }
+      if (!flag) {
+        break;
+      }
+      token.flags |= flag;
+      ++i;
+    }
+
+    for (uint16_t c = at(i);; c = at(++i)) {
+      if (c == '*') {
+        token.width_from_args = true;
+        ++i;
+        break;
+      } else if (c >= '0' && c <= '9') {
+        token.width = token.width * 10 + (c - '0');
+      } else {
+        break;
+      }
+    }
+
+    if (at(i) == '.') {
+      token.precision = 0;
+      for (uint16_t c = at(++i);; c = at(++i)) {
+        if (c == '*') {
+          token.precision_from_args = true;
+          ++i;
+          break;
+        } else if (c >= '0' && c <= '9') {
+          token.precision = token.precision * 10 + (c - '0');
+        } else {
+          break;
+        }
+      }
+    }
+
+    switch (at(i)) {
+      case 'l':
+        if (at(i + 1) == 'l') {
+          ++i;
+          token.flags |= FF_IsLongLong;
+        } else {
+          token.flags |= FF_IsLong;
+        }
+        ++i;
+        break;
+      case 'h':
+        token.flags |= FF_IsShort;
+        ++i;
+        break;
+      case 'w':
+        token.flags |= FF_IsWide;
+        ++i;
+        break;
+      case 'I':
+        if (at(i + 1) == '6' && at(i + 2) == '4') {
+          i += 2;
+          token.flags |= FF_IsLongLong;
+        } else if (at(i + 1) == '3' && at(i + 2) == '2') {
+          i += 2;
+        }
+        ++i;
+        break;
+    }
+
+    uint16_t c = at(i);
+    if (!c) {
+      FormatToken invalid = {};
+      invalid.type = FormatToken::Type::kInvalid;
+      tokens.push_back(invalid);
+      return;
+    }
+    ++i;
+    switch (c) {
+      // wide character / wide string
+      case 'C':
+      case 'S':
+        if (!(token.flags & (FF_IsShort | FF_IsLong | FF_IsWide))) {
+          token.flags |= FF_IsWide;
+        }
+        token.conversion = c;
+        break;
+      case 'o':
+        if (token.flags & FF_AddPrefix) {
+          token.flags |= FF_ForceLeadingZero;
+        }
+        token.conversion = c;
+        break;
+      case 'c':
+      case 'd':
+      case 'i':
+      case 'u':
+      case 'x':
+      case 'X':
+      case 'e':
+      case 'E':
+      case 'f':
+      case 'g':
+      case 'G':
+      case 'a':
+      case 'A':
+      case 'n':
+      case 'p':
+      case 's':
+        token.conversion = c;
+        break;
+      // ANSI_STRING / UNICODE_STRING ('Z') and anything else.
+      default:
+        assert_always();
+        break;
+    }
+    tokens.push_back(token);
+  }
+}
+
+template <typename T>
+uint16_t FormatCharToHost(T c);
+template <>
+uint16_t FormatCharToHost<uint8_t>(uint8_t c) {
+  return c;
+}
+template <>
+uint16_t FormatCharToHost<uint16_t>(uint16_t c) {
+  return xe::byte_swap(c);
+}
+
+// Formats compiled by guest address and character size. Formats are often
+// built at runtime in reused buffers, so an entry is only used while the
+// string at its address still hashes the same.
+xe::profiled_mutex format_cache_mutex_("format_cache");
+std::unordered_map<uint64_t, std::shared_ptr<const CompiledFormat>>
+    format_cache_;
+const size_t kMaxCachedFormats = 4096;
+
+template <typename T>
+std::shared_ptr<const CompiledFormat> LookupFormat(PPCContext* ppc_context,
+                                                   uint32_t format_ptr) {
+  auto format = reinterpret_cast<const T*>(SHIM_MEM_ADDR(format_ptr));
+  size_t length = 0;
+  while (format[length]) {
+    ++length;
+  }
+  uint64_t hash = XXH64(format, length * sizeof(T), 0);
+  uint64_t key = (uint64_t(format_ptr) << 1) | (sizeof(T) == 2 ? 1 : 0);
+  {
+    auto lock = format_cache_mutex_.Acquire();
+    auto it = format_cache_.find(key);
+    if (it != format_cache_.end() && it->second->hash == hash &&
+        it->second->text.size() == length) {
+      return it->second;
+    }
+  }
+
+  auto compiled = std::make_shared<CompiledFormat>();
+  compiled->hash = hash;
+  compiled->text.resize(length);
+  for (size_t i = 0; i < length; ++i) {
+    compiled->text[i] = FormatCharToHost<T>(format[i]);
+  }
+  CompileFormat(compiled.get());
+
+  auto lock = format_cache_mutex_.Acquire();
+  if (format_cache_.size() >= kMaxCachedFormats) {
+    format_cache_.clear();
+  }
+  format_cache_[key] = compiled;
+  return compiled;
+}
+
 std::string format_double(double value, int32_t precision, uint16_t c,
                           uint32_t flags) {
   if (precision < 0) {
@@ -113,8 +363,11 @@ std::string format_double(double value, int32_t precision, uint16_t c,
   return temp.str();
 }
 
-int32_t format_core(PPCContext* ppc_context, FormatData& data, ArgList& args,
-                    const bool wide) {
+// Returns the number of characters of the output (including any beyond what
+// the output could hold), or -1 if the format or a character is invalid.
+template <typename Output>
+int32_t format_core(PPCContext* ppc_context, const CompiledFormat& format,
+                    ArgList& args, const bool wide, Output& output) {
   int32_t count = 0;
 
   char work[512];
@@ -132,459 +385,285 @@ int32_t format_core(PPCContext* ppc_context, FormatData& data, ArgList& args,
     int32_t length;
   } prefix;
 
-  auto state = FS_Unknown;
-  uint32_t flags = 0;
-  int32_t width = 0;
-  int32_t precision = -1;
-  ArgumentSize size = AS_Default;
-  int32_t radix = 0;
-  const char* digits = nullptr;
-
-  text.buffer = nullptr;
-  text.is_wide = false;
-  text.swap_wide = true;
-  text.length = 0;
-  prefix.buffer[0] = '\0';
-  prefix.length = 0;
-
-  for (uint16_t c = data.get();; c = data.get()) {
-    if (state == FS_Unknown) {
-      if (!c) {  // the end
-        return count;
-      } else if (c != '%') {
-      output:
-        if (!data.put(c)) {
+  for (const FormatToken& token : format.tokens) {
+    if (token.type == FormatToken::Type::kText) {
+      const uint16_t* b = format.text.data() + token.text_offset;
+      for (uint32_t i = 0; i < token.text_length; ++i) {
+        if (!output.put(b[i])) {
           return -1;
         }
-        ++count;
-        continue;
       }
-
-      state = FS_Start;
-      c = data.get();
-      // fall through
-    }
-
-    // in any state, if c is \0, it's bad
-    if (!c) {
+      count += token.text_length;
+      continue;
+    } else if (token.type == FormatToken::Type::kInvalid) {
       return -1;
     }
 
-  restart:
-    switch (state) {
-      case FS_Invalid:
-      case FS_Unknown:
-      case FS_End:
-      default: { assert_always(); }
-
-      case FS_Start: {
-        if (c == '%') {
-          state = FS_Unknown;
-          goto output;
-        }
-
-        state = FS_Flags;
-
-        // reset to defaults
-        flags = 0;
-        width = 0;
+    uint32_t flags = token.flags;
+    int32_t width = token.width;
+    int32_t precision = token.precision;
+    int32_t radix = 0;
+    const char* digits = nullptr;
+    uint16_t c = token.conversion;
+
+    text.buffer = nullptr;
+    text.is_wide = false;
+    text.swap_wide = true;
+    text.length = 0;
+    prefix.buffer[0] = '\0';
+    prefix.length = 0;
+
+    if (token.width_from_args) {
+      width = (int32_t)args.get32();
+      if (width < 0) {
+        flags |= FF_LeftJustify;
+        width = -width;
+      }
+    }
+    if (token.precision_from_args) {
+      precision = (int32_t)args.get32();
+      if (precision < 0) {
         precision = -1;
-        size = AS_Default;
-        radix = 0;
-        digits = nullptr;
-
-        text.buffer = nullptr;
-        text.is_wide = false;
-        text.swap_wide = true;
-        text.length = 0;
-        prefix.buffer[0] = '\0';
-        prefix.length = 0;
-
-        // fall through, don't need to goto restart
       }
+    }
 
-      // https://msdn.microsoft.com/en-us/library/8aky45ct.aspx
-      case FS_Flags: {
-        if (c == '-') {
-          flags |= FF_LeftJustify;
-          continue;
-        } else if (c == '+') {
-          flags |= FF_AddPositive;
-          continue;
-        } else if (c == '0') {
-          flags |= FF_AddLeadingZeros;
-          continue;
-        } else if (c == ' ') {
-          flags |= FF_AddPositiveAsSpace;
-          continue;
-        } else if (c == '#') {
-          flags |= FF_AddPrefix;
-          continue;
+    switch (c) {
+      // wide character
+      case 'C':
+      // character
+      case 'c': {
+        bool is_wide;
+        if (flags & FF_IsLong) {
+          // "An lc, lC, wc or wC type specifier is synonymous with C in
+          // printf functions and with c in wprintf functions."
+          is_wide = true;
+        } else if (flags & FF_IsShort) {
+          // "An hc or hC type specifier is synonymous with c in printf
+          // functions and with C in wprintf functions."
+          is_wide = false;
+        } else {
+          is_wide = ((flags & FF_IsWide) != 0) ^ wide;
         }
 
-        state = FS_Width;
-        // fall through, don't need to goto restart
-      }
-
-      // https://msdn.microsoft.com/en-us/library/25366k66.aspx
-      case FS_Width: {
-        if (c == '*') {
-          width = (int32_t)args.get32();
-          if (width < 0) {
-            flags |= FF_LeftJustify;
-            width = -width;
-          }
-          state = FS_PrecisionStart;
-          continue;
-        } else if (c >= '0' && c <= '9') {
-          width *= 10;
-          width += c - '0';
-          continue;
+        auto value = args.get32();
+
+        if (!is_wide) {
+          work[0] = (uint8_t)value;
+          text.buffer = &work[0];
+          text.length = 1;
+          text.is_wide = false;
+        } else {
+          wwork[0] = (uint16_t)value;
+          text.buffer = &wwork[0];
+          text.length = 1;
+          text.is_wide = true;
+          text.swap_wide = false;
         }
 
-        state = FS_PrecisionStart;
-        // fall through, don't need to goto restart
+        break;
       }
 
-      // https://msdn.microsoft.com/en-us/library/0ecbz014.aspx
-      case FS_PrecisionStart: {
-        if (c == '.') {
-          state = FS_Precision;
-          precision = 0;
-          continue;
+      // signed decimal integer
+      case 'd':
+      case 'i': {
+        flags |= FF_IsSigned;
+        digits = "0123456789";
+        radix = 10;
+
+      integer:
+        assert_not_null(digits);
+        assert_not_zero(radix);
+
+        int64_t value;
+
+        if (flags & FF_IsLongLong) {
+          value = (int64_t)args.get64();
+        } else if (flags & FF_IsLong) {
+          value = (int32_t)args.get32();
+        } else if (flags & FF_IsShort) {
+          value = (int16_t)args.get32();
+        } else {
+          value = (int32_t)args.get32();
         }
 
-        state = FS_Size;
-        goto restart;
-      }
-
-      // https://msdn.microsoft.com/en-us/library/0ecbz014.aspx
-      case FS_Precision: {
-        if (c == '*') {
-          precision = (int32_t)args.get32();
-          if (precision < 0) {
-            precision = -1;
-          }
-          state = FS_Size;
-          continue;
-        } else if (c >= '0' && c <= '9') {
-          precision *= 10;
-          precision += c - '0';
-          continue;
+        if (precision >= 0) {
+          precision = std::min(precision, (int32_t)xe::countof(work));
+        } else {
+          precision = 1;
         }
 
-        state = FS_Size;
-        // fall through
-      }
-
-      // https://msdn.microsoft.com/en-us/library/tcxf1dw6.aspx
-      case FS_Size: {
-        if (c == 'l') {
-          if (data.peek(0) == 'l') {
-            data.skip(1);
-            flags |= FF_IsLongLong;
-          } else {
-            flags |= FF_IsLong;
-          }
-          state = FS_Type;
-          continue;
-        } else if (c == 'h') {
-          flags |= FF_IsShort;
-          state = FS_Type;
-          continue;
-        } else if (c == 'w') {
-          flags |= FF_IsWide;
-          state = FS_Type;
-          continue;
-        } else if (c == 'I') {
-          if (data.peek(0) == '6' && data.peek(1) == '4') {
-            data.skip(2);
-            flags |= FF_IsLongLong;
-            state = FS_Type;
-            continue;
-          } else if (data.peek(0) == '3' && data.peek(1) == '2') {
-            data.skip(2);
-            state = FS_Type;
-            continue;
-          } else {
-            state = FS_Type;
-            continue;
-          }
+        if ((flags & FF_IsSigned) && value < 0) {
+          value = -value;
+          flags |= FF_AddNegative;
         }
 
-        // fall through
-      }
-
-      // https://msdn.microsoft.com/en-us/library/hf4y5e3w.aspx
-      case FS_Type: {
-        // wide character
-        switch (c) {
-          case 'C': {
-            if (!(flags & (FF_IsShort | FF_IsLong | FF_IsWide))) {
-              flags |= FF_IsWide;
-            }
-            // fall through
-          }
-
-          // character
-          case 'c': {
-            bool is_wide;
-            if (flags & FF_IsLong) {
-              // "An lc, lC, wc or wC type specifier is synonymous with C in
-              // printf functions and with c in wprintf functions."
-              is_wide = true;
-            } else if (flags & FF_IsShort) {
-              // "An hc or hC type specifier is synonymous with c in printf
-              // functions and with C in wprintf functions."
-              is_wide = false;
-            } else {
-              is_wide = ((flags & FF_IsWide) != 0) ^ wide;
-            }
-
-            auto value = args.get32();
-
-            if (!is_wide) {
-              work[0] = (uint8_t)value;
-              text.buffer = &work[0];
-              text.length = 1;
-              text.is_wide = false;
-            } else {
-              wwork[0] = (uint16_t)value;
-              text.buffer = &wwork[0];
-              text.length = 1;
-              text.is_wide = true;
-              text.swap_wide = false;
-            }
-
-            break;
-          }
-
-          // signed decimal integer
-          case 'd':
-          case 'i': {
-            flags |= FF_IsSigned;
-            digits = "0123456789";
-            radix = 10;
-
-          integer:
-            assert_not_null(digits);
-            assert_not_zero(radix);
-
-            int64_t value;
-
-            if (flags & FF_IsLongLong) {
-              value = (int64_t)args.get64();
-            } else if (flags & FF_IsLong) {
-              value = (int32_t)args.get32();
-            } else if (flags & FF_IsShort) {
-              value = (int16_t)args.get32();
-            } else {
-              value = (int32_t)args.get32();
-            }
-
-            if (precision >= 0) {
-              precision = std::min(precision, (int32_t)xe::countof(work));
-            } else {
-              precision = 1;
-            }
-
-            if ((flags & FF_IsSigned) && value < 0) {
-              value = -value;
-              flags |= FF_AddNegative;
-            }
-
-            if (!(flags & FF_IsLongLong)) {
-              value &= UINT32_MAX;
-            }
-
-            if (value == 0) {
-              prefix.length = 0;
-            }
-
-            char* end = &work[xe::countof(work) - 1];
-            char* start = end;
-            start[0] = '\0';
-
-            while (precision-- > 0 || value != 0) {
-              auto digit = (int32_t)(value % radix);
-              value /= radix;
-              assert_true(digit < strlen(digits));
-              *--start = digits[digit];
-            }
-
-            if ((flags & FF_ForceLeadingZero) &&
-                (start == end || *start != '0')) {
-              *--start = '0';
-            }
+        if (!(flags & FF_IsLongLong)) {
+          value &= UINT32_MAX;
+        }
 
-            text.buffer = start;
-            text.length = (int32_t)(end - start);
-            text.is_wide = false;
-            break;
-          }
+        if (value == 0) {
+          prefix.length = 0;
+        }
 
-          // unsigned octal integer
-          case 'o': {
-            digits = "01234567";
-            radix = 8;
-            if (flags & FF_AddPrefix) {
-              flags |= FF_ForceLeadingZero;
-            }
-            goto integer;
-          }
+        char* end = &work[xe::countof(work) - 1];
+        char* start = end;
+        start[0] = '\0';
 
-          // unsigned decimal integer
-          case 'u': {
-            digits = "0123456789";
-            radix = 10;
-            goto integer;
-          }
+        while (precision-- > 0 || value != 0) {
+          auto digit = (int32_t)(value % radix);
+          value /= radix;
+          assert_true(digit < strlen(digits));
+          *--start = digits[digit];
+        }
 
-          // unsigned hexadecimal integer
-          case 'x':
-          case 'X': {
-            digits = c == 'x' ? "0123456789abcdef" : "0123456789ABCDEF";
-            radix = 16;
+        if ((flags & FF_ForceLeadingZero) &&
+            (start == end || *start != '0')) {
+          *--start = '0';
+        }
 
-            if (flags & FF_AddPrefix) {
-              prefix.buffer[0] = '0';
-              prefix.buffer[1] = c == 'x' ? 'x' : 'X';
-              prefix.length = 2;
-            }
+        text.buffer = start;
+        text.length = (int32_t)(end - start);
+        text.is_wide = false;
+        break;
+      }
 
-            goto integer;
-          }
+      // unsigned octal integer
+      case 'o': {
+        digits = "01234567";
+        radix = 8;
+        goto integer;
+      }
 
-          // floating-point with exponent
-          case 'e':
-          case 'E': {
-            // fall through
-          }
+      // unsigned decimal integer
+      case 'u': {
+        digits = "0123456789";
+        radix = 10;
+        goto integer;
+      }
 
-          // floating-point without exponent
-          case 'f': {
-          floatingpoint:
-            flags |= FF_IsSigned;
+      // unsigned hexadecimal integer
+      case 'x':
+      case 'X': {
+        digits = c == 'x' ? "0123456789abcdef" : "0123456789ABCDEF";
+        radix = 16;
 
-            int64_t dummy = args.get64();
-            double value = *(double*)&dummy;
+        if (flags & FF_AddPrefix) {
+          prefix.buffer[0] = '0';
+          prefix.buffer[1] = c == 'x' ? 'x' : 'X';
+          prefix.length = 2;
+        }
 
-            if (value < 0) {
-              value = -value;
-              flags |= FF_AddNegative;
-            }
+        goto integer;
+      }
 
-            auto s = format_double(value, precision, c, flags);
-            auto length = (int32_t)s.size();
-            assert_true(length < xe::countof(work));
+      // floating-point with exponent
+      case 'e':
+      case 'E':
+      // floating-point without exponent
+      case 'f':
+      // floating-point with or without exponent
+      case 'g':
+      case 'G':
+      // floating-point in hexadecimal
+      case 'a':
+      case 'A': {
+        flags |= FF_IsSigned;
+
+        int64_t dummy = args.get64();
+        double value = *(double*)&dummy;
+
+        if (value < 0) {
+          value = -value;
+          flags |= FF_AddNegative;
+        }
 
-            auto start = &work[0];
-            auto end = &start[length];
+        auto s = format_double(value, precision, c, flags);
+        auto length = (int32_t)s.size();
+        assert_true(length < xe::countof(work));
 
-            std::memcpy(start, s.c_str(), length);
-            end[0] = '\0';
+        auto start = &work[0];
+        auto end = &start[length];
 
-            text.buffer = start;
-            text.length = (int32_t)(end - start);
-            text.is_wide = false;
-            break;
-          }
+        std::memcpy(start, s.c_str(), length);
+        end[0] = '\0';
 
-          // floating-point with or without exponent
-          case 'g':
-          case 'G': {
-            goto floatingpoint;
-          }
+        text.buffer = start;
+        text.length = (int32_t)(end - start);
+        text.is_wide = false;
+        break;
+      }
 
-          // floating-point in hexadecimal
-          case 'a':
-          case 'A': {
-            goto floatingpoint;
-          }
+      // pointer to integer
+      case 'n': {
+        auto pointer = (uint32_t)args.get32();
+        if (flags & FF_IsShort) {
+          SHIM_SET_MEM_16(pointer, (uint16_t)count);
+        } else {
+          SHIM_SET_MEM_32(pointer, (uint32_t)count);
+        }
+        continue;
+      }
 
-          // pointer to integer
-          case 'n': {
-            auto pointer = (uint32_t)args.get32();
-            if (flags & FF_IsShort) {
-              SHIM_SET_MEM_16(pointer, (uint16_t)count);
-            } else {
-              SHIM_SET_MEM_32(pointer, (uint32_t)count);
-            }
-            continue;
-          }
+      // pointer
+      case 'p': {
+        digits = "0123456789ABCDEF";
+        radix = 16;
+        precision = 8;
+        flags &= ~(FF_IsLongLong | FF_IsShort);
+        flags |= FF_IsLong;
+        goto integer;
+      }
 
-          // pointer
-          case 'p': {
-            digits = "0123456789ABCDEF";
-            radix = 16;
-            precision = 8;
-            flags &= ~(FF_IsLongLong | FF_IsShort);
-            flags |= FF_IsLong;
-            goto integer;
+      // wide string
+      case 'S':
+      // string
+      case 's': {
+        uint32_t pointer = args.get32();
+        int32_t cap = precision < 0 ? INT32_MAX : precision;
+
+        if (pointer == 0) {
+          auto nullstr = "(null)";
+          text.buffer = nullstr;
+          text.length = std::min((int32_t)strlen(nullstr), cap);
+          text.is_wide = false;
+        } else {
+          void* str = SHIM_MEM_ADDR(pointer);
+          bool is_wide;
+          if (flags & FF_IsLong) {
+            // "An ls, lS, ws or wS type specifier is synonymous with S in
+            // printf functions and with s in wprintf functions."
+            is_wide = true;
+          } else if (flags & FF_IsShort) {
+            // "An hs or hS type specifier is synonymous with s in printf
+            // functions and with S in wprintf functions."
+            is_wide = false;
+          } else {
+            is_wide = ((flags & (FF_IsWide)) != 0) ^ wide;
           }
+          int32_t length;
 
-          // wide string
-          case 'S': {
-            if (!(flags & (FF_IsShort | FF_IsLong | FF_IsWide))) {
-              flags |= FF_IsWide;
+          if (!is_wide) {
+            length = 0;
+            for (auto s = (const uint8_t*)str; cap > 0 && *s; ++s, cap--) {
+              length++;
             }
-            // fall through
-          }
-
-          // string
-          case 's': {
-            uint32_t pointer = args.get32();
-            int32_t cap = precision < 0 ? INT32_MAX : precision;
-
-            if (pointer == 0) {
-              auto nullstr = "(null)";
-              text.buffer = nullstr;
-              text.length = std::min((int32_t)strlen(nullstr), cap);
-              text.is_wide = false;
-            } else {
-              void* str = SHIM_MEM_ADDR(pointer);
-              bool is_wide;
-              if (flags & FF_IsLong) {
-                // "An ls, lS, ws or wS type specifier is synonymous with S in
-                // printf functions and with s in wprintf functions."
-                is_wide = true;
-              } else if (flags & FF_IsShort) {
-                // "An hs or hS type specifier is synonymous with s in printf
-                // functions and with S in wprintf functions."
-                is_wide = false;
-              } else {
-                is_wide = ((flags & (FF_IsWide)) != 0) ^ wide;
-              }
-              int32_t length;
-
-              if (!is_wide) {
-                length = 0;
-                for (auto s = (const uint8_t *)str; cap > 0 && *s; ++s, cap--) {
-                  length++;
-                }
-              } else {
-                length = 0;
-                for (auto s = (const uint16_t *)str; cap > 0 && *s;
-                     ++s, cap--) {
-                  length++;
-                }
-              }
-
-              text.buffer = str;
-              text.length = length;
-              text.is_wide = is_wide;
+          } else {
+            length = 0;
+            for (auto s = (const uint16_t*)str; cap > 0 && *s; ++s, cap--) {
+              length++;
             }
-            break;
-          }
-
-          // ANSI_STRING / UNICODE_STRING
-          case 'Z': {
-            assert_always();
           }
 
-          default: { assert_always(); }
+          text.buffer = str;
+          text.length = length;
+          text.is_wide = is_wide;
         }
+        break;
       }
+
+      // Unknown conversions only output their padding.
+      default:
+        break;
     }
 
     if (flags & FF_IsSigned) {
@@ -605,7 +684,7 @@ int32_t format_core(PPCContext* ppc_context, FormatData& data, ArgList& args,
     if (!(flags & (FF_LeftJustify | FF_AddLeadingZeros)) && padding > 0) {
       count += padding;
       while (padding-- > 0) {
-        if (!data.put(' ')) {
+        if (!output.put(' ')) {
           return -1;
         }
       }
@@ -616,7 +695,7 @@ int32_t format_core(PPCContext* ppc_context, FormatData& data, ArgList& args,
       count += prefix.length;
       auto b = &prefix.buffer[0];
       while (remaining-- > 0) {
-        if (!data.put(*b++)) {
+        if (!output.put(*b++)) {
           return -1;
         }
       }
@@ -626,7 +705,7 @@ int32_t format_core(PPCContext* ppc_context, FormatData& data, ArgList& args,
         padding > 0) {
       count += padding;
       while (padding-- > 0) {
-        if (!data.put('0')) {
+        if (!output.put('0')) {
           return -1;
         }
       }
@@ -637,7 +716,7 @@ int32_t format_core(PPCContext* ppc_context, FormatData& data, ArgList& args,
       // it's a const char*
       auto b = (const uint8_t*)text.buffer;
       while (remaining-- > 0) {
-        if (!data.put(*b++)) {
+        if (!output.put(*b++)) {
           return -1;
         }
       }
@@ -646,13 +725,13 @@ int32_t format_core(PPCContext* ppc_context, FormatData& data, ArgList& args,
       auto b = (const uint16_t*)text.buffer;
       if (text.swap_wide) {
         while (remaining-- > 0) {
-          if (!data.put(xe::byte_swap(*b++))) {
+          if (!output.put(xe::byte_swap(*b++))) {
             return -1;
           }
         }
       } else {
         while (remaining-- > 0) {
-          if (!data.put(*b++)) {
+          if (!output.put(*b++)) {
             return -1;
           }
         }
@@ -664,13 +743,11 @@ int32_t format_core(PPCContext* ppc_context, FormatData& data, ArgList& args,
     if ((flags & FF_LeftJustify) && padding > 0) {
       count += padding;
       while (padding-- > 0) {
-        if (!data.put(' ')) {
+        if (!output.put(' ')) {
           return -1;
         }
       }
     }
-
-    state = FS_Unknown;
   }
 
   return count;
@@ -713,109 +790,63 @@ class ArrayArgList : public ArgList {
   int32_t index_;
 };
 
-class StringFormatData : public FormatData {
+// Writes into a guest buffer as the output is formatted, up to its capacity.
+// The characters beyond it are only counted.
+class GuestStringOutput {
  public:
-  StringFormatData(const uint8_t* input) : input_(input) {}
-
-  uint16_t get() {
-    uint16_t result = *input_;
-    if (result) {
-      input_++;
-    }
-    return result;
-  }
-
-  uint16_t peek(int32_t offset) { return input_[offset]; }
-
-  void skip(int32_t count) {
-    while (count-- > 0) {
-      if (!*input_) {
-        break;
-      }
-    }
-  }
+  GuestStringOutput(uint8_t* buffer, size_t capacity)
+      : buffer_(buffer), capacity_(capacity) {}
 
   bool put(uint16_t c) {
     if (c >= 0x100) {
       return false;
     }
-    output_ << (char)c;
+    if (length_ < capacity_) {
+      buffer_[length_] = uint8_t(c);
+    }
+    ++length_;
     return true;
   }
 
-  std::string str() const { return output_.str(); }
-
  private:
-  const uint8_t* input_;
-  std::ostringstream output_;
+  uint8_t* buffer_;
+  size_t capacity_;
+  size_t length_ = 0;
 };
 
-class WideStringFormatData : public FormatData {
+class GuestWideStringOutput {
  public:
-  WideStringFormatData(const uint16_t* input) : input_(input) {}
-
-  uint16_t get() {
-    uint16_t result = *input_;
-    if (result) {
-      input_++;
-    }
-    return xe::byte_swap(result);
-  }
-
-  uint16_t peek(int32_t offset) { return input_[offset]; }
-
-  void skip(int32_t count) {
-    while (count-- > 0) {
-      if (!*input_) {
-        break;
-      }
-    }
-  }
+  explicit GuestWideStringOutput(uint16_t* buffer) : buffer_(buffer) {}
 
   bool put(uint16_t c) {
-    output_ << (wchar_t)c;
+    buffer_[length_++] = xe::byte_swap(c);
     return true;
   }
 
-  std::wstring wstr() const { return output_.str(); }
-
  private:
-  const uint16_t* input_;
-  std::wostringstream output_;
+  uint16_t* buffer_;
+  size_t length_ = 0;
 };
 
-class WideCountFormatData : public FormatData {
+class CountOutput {
  public:
-  WideCountFormatData(const uint16_t* input) : input_(input), count_(0) {}
-
-  uint16_t get() {
-    uint16_t result = *input_;
-    if (result) {
-      input_++;
-    }
-    return xe::byte_swap(result);
-  }
-
-  uint16_t peek(int32_t offset) { return input_[offset]; }
-
-  void skip(int32_t count) {
-    while (count-- > 0) {
-      if (!*input_) {
-        break;
-      }
-    }
-  }
+  bool put(uint16_t c) { return true; }
+};
 
+class HostStringOutput {
+ public:
   bool put(uint16_t c) {
-    ++count_;
+    if (c >= 0x100) {
+      return false;
+    }
+    str_.push_back(char(c));
     return true;
   }
 
-  const int32_t count() const { return count_; }
+  const std::string& str() const { return str_; }
 
  private:
-  const uint16_t* input_;
-  int32_t count_;
+  std::string str_;
 };
 
 SHIM_CALL DbgPrint_shim(PPCContext* ppc_context, KernelState* kernel_state) {
@@ -824,18 +855,22 @@ SHIM_CALL DbgPrint_shim(PPCContext* ppc_context, KernelState* kernel_state) {
     SHIM_SET_RETURN_32(X_STATUS_INVALID_PARAMETER);
     return;
   }
-  auto format = (const uint8_t*)SHIM_MEM_ADDR(format_ptr);
+  if (!FLAGS_log_dbgprint) {
+    SHIM_SET_RETURN_32(X_STATUS_SUCCESS);
+    return;
+  }
+  auto format = LookupFormat<uint8_t>(ppc_context, format_ptr);
 
   StackArgList args(ppc_context, 1);
-  StringFormatData data(format);
+  HostStringOutput output;
 
-  int32_t count = format_core(ppc_context, data, args, false);
+  int32_t count = format_core(ppc_context, *format, args, false, output);
   if (count <= 0) {
     SHIM_SET_RETURN_32(X_STATUS_SUCCESS);
     return;
   }
 
-  XELOGD("(DbgPrint) %s", data.str().c_str());
+  XELOGD("(DbgPrint) %s", output.str().c_str());
 
   SHIM_SET_RETURN_32(X_STATUS_SUCCESS);
 }
@@ -855,23 +890,21 @@ SHIM_CALL _snprintf_shim(PPCContext* ppc_context, KernelState* kernel_state) {
   }
 
   auto buffer = (uint8_t*)SHIM_MEM_ADDR(buffer_ptr);
-  auto format = (const uint8_t*)SHIM_MEM_ADDR(format_ptr);
+  auto format = LookupFormat<uint8_t>(ppc_context, format_ptr);
 
   StackArgList args(ppc_context, 3);
-  StringFormatData data(format);
+  GuestStringOutput output(buffer, buffer_count);
 
-  int32_t count = format_core(ppc_context, data, args, false);
+  int32_t count = format_core(ppc_context, *format, args, false, output);
   if (count < 0) {
     if (buffer_count > 0) {
       buffer[0] = '\0';  // write a null, just to be safe
     }
   } else if (count <= buffer_count) {
-    std::memcpy(buffer, data.str().c_str(), count);
     if (count < buffer_count) {
       buffer[count] = '\0';
     }
   } else {
-    std::memcpy(buffer, data.str().c_str(), buffer_count);
     count = -1;  // for return value
   }
   SHIM_SET_RETURN_32(count);
@@ -890,16 +923,15 @@ SHIM_CALL sprintf_shim(PPCContext* ppc_context, KernelState* kernel_state) {
   }
 
   auto buffer = (uint8_t*)SHIM_MEM_ADDR(buffer_ptr);
-  auto format = (const uint8_t*)SHIM_MEM_ADDR(format_ptr);
+  auto format = LookupFormat<uint8_t>(ppc_context, format_ptr);
 
   StackArgList args(ppc_context, 2);
-  StringFormatData data(format);
+  GuestStringOutput output(buffer, SIZE_MAX);
 
-  int32_t count = format_core(ppc_context, data, args, false);
+  int32_t count = format_core(ppc_context, *format, args, false, output);
   if (count <= 0) {
     buffer[0] = '\0';
   } else {
-    std::memcpy(buffer, data.str().c_str(), count);
     buffer[count] = '\0';
   }
   SHIM_SET_RETURN_32(count);
@@ -918,16 +950,15 @@ SHIM_CALL swprintf_shim(PPCContext* ppc_context, KernelState* kernel_state) {
   }
 
   auto buffer = (uint16_t*)SHIM_MEM_ADDR(buffer_ptr);
-  auto format = (const uint16_t*)SHIM_MEM_ADDR(format_ptr);
+  auto format = LookupFormat<uint16_t>(ppc_context, format_ptr);
 
   StackArgList args(ppc_context, 2);
-  WideStringFormatData data(format);
+  GuestWideStringOutput output(buffer);
 
-  int32_t count = format_core(ppc_context, data, args, false);
+  int32_t count = format_core(ppc_context, *format, args, false, output);
   if (count <= 0) {
     buffer[0] = '\0';
   } else {
-    xe::copy_and_swap(buffer, (uint16_t*)data.wstr().c_str(), count);
     buffer[count] = '\0';
   }
   SHIM_SET_RETURN_32(count);
@@ -949,27 +980,23 @@ SHIM_CALL _vsnprintf_shim(PPCContext* ppc_context, KernelState* kernel_state) {
   }
 
   auto buffer = (uint8_t*)SHIM_MEM_ADDR(buffer_ptr);
-  auto format = (const uint8_t*)SHIM_MEM_ADDR(format_ptr);
+  auto format = LookupFormat<uint8_t>(ppc_context, format_ptr);
 
   ArrayArgList args(ppc_context, arg_ptr);
-  StringFormatData data(format);
+  GuestStringOutput output(buffer, buffer_count);
 
-  int32_t count = format_core(ppc_context, data, args, false);
+  int32_t count = format_core(ppc_context, *format, args, false, output);
   if (count < 0) {
     // Error.
     if (buffer_count > 0) {
       buffer[0] = '\0';  // write a null, just to be safe
     }
-  } else if (count <= buffer_count) {
+  } else if (count < buffer_count) {
     // Fit within the buffer.
-    std::memcpy(buffer, data.str().c_str(), count);
-    if (count < buffer_count) {
-      buffer[count] = '\0';
-    }
-  } else {
-    // Overflowed buffer. We still return the count we would have written.
-    std::memcpy(buffer, data.str().c_str(), buffer_count);
+    buffer[count] = '\0';
   }
+  // Overflowed buffers are filled, and we still return the count we would
+  // have written.
   SHIM_SET_RETURN_32(count);
 }
 
@@ -987,16 +1014,15 @@ SHIM_CALL vsprintf_shim(PPCContext* ppc_context, KernelState* kernel_state) {
   }
 
   auto buffer = (uint8_t*)SHIM_MEM_ADDR(buffer_ptr);
-  auto format = (const uint8_t*)SHIM_MEM_ADDR(format_ptr);
+  auto format = LookupFormat<uint8_t>(ppc_context, format_ptr);
 
   ArrayArgList args(ppc_context, arg_ptr);
-  StringFormatData data(format);
+  GuestStringOutput output(buffer, SIZE_MAX);
 
-  int32_t count = format_core(ppc_context, data, args, false);
+  int32_t count = format_core(ppc_context, *format, args, false, output);
   if (count <= 0) {
     buffer[0] = '\0';
   } else {
-    std::memcpy(buffer, data.str().c_str(), count);
     buffer[count] = '\0';
   }
   SHIM_SET_RETURN_32(count);
@@ -1014,13 +1040,12 @@ SHIM_CALL _vscwprintf_shim(PPCContext* ppc_context, KernelState* kernel_state) {
     return;
   }
 
-  auto format = (const uint16_t*)SHIM_MEM_ADDR(format_ptr);
+  auto format = LookupFormat<uint16_t>(ppc_context, format_ptr);
 
   ArrayArgList args(ppc_context, arg_ptr);
-  WideCountFormatData data(format);
+  CountOutput output;
 
-  int32_t count = format_core(ppc_context, data, args, true);
-  assert_true(count < 0 || data.count() == count);
+  int32_t count = format_core(ppc_context, *format, args, true, output);
   SHIM_SET_RETURN_32(count);
 }
 
@@ -1038,16 +1063,15 @@ SHIM_CALL vswprintf_shim(PPCContext* ppc_context, KernelState* kernel_state) {
   }
 
   auto buffer = (uint16_t*)SHIM_MEM_ADDR(buffer_ptr);
-  auto format = (const uint16_t*)SHIM_MEM_ADDR(format_ptr);
+  auto format = LookupFormat<uint16_t>(ppc_context, format_ptr);
 
   ArrayArgList args(ppc_context, arg_ptr);
-  WideStringFormatData data(format);
+  GuestWideStringOutput output(buffer);
 
-  int32_t count = format_core(ppc_context, data, args, true);
+  int32_t count = format_core(ppc_context, *format, args, true, output);
   if (count <= 0) {
     buffer[0] = '\0';
   } else {
-    xe::copy_and_swap(buffer, (uint16_t*)data.wstr().c_str(), count);
     buffer[count] = '\0';
   }
   SHIM_SET_RETURN_32(count);
@@ -8,6 +8,7 @@
  */
 
 #include <algorithm>
+#include <atomic>
 #include <vector>
 
 #include "xenia/base/atomic.h"
@@ -951,18 +952,63 @@ DECLARE_XBOXKRNL_EXPORT(NtSignalAndWaitForSingleObjectEx,
                         ExportTag::kImplemented | ExportTag::kThreading |
                             ExportTag::kBlocking);
 
+// Spin limits, in pause instructions, each of which is tens of cycles.
+const uint32_t kGuestLockMinSpinLimit = 16;
+const uint32_t kGuestLockInitialSpinLimit = 256;
+const uint32_t kGuestLockMaxSpinLimit = 4096;
+
+thread_local uint32_t guest_lock_spin_limit_ = kGuestLockInitialSpinLimit;
+std::atomic<uint64_t> guest_lock_spin_acquired_count_ = {0};
+std::atomic<uint64_t> guest_lock_spin_failed_count_ = {0};
+
+uint32_t GuestLockSpinLimit() { return guest_lock_spin_limit_; }
+
+void RecordGuestLockSpin(bool acquired) {
+  if (acquired) {
+    guest_lock_spin_limit_ =
+        std::min(guest_lock_spin_limit_ * 2, kGuestLockMaxSpinLimit);
+    guest_lock_spin_acquired_count_.fetch_add(1, std::memory_order_relaxed);
+  } else {
+    guest_lock_spin_limit_ =
+        std::max(guest_lock_spin_limit_ / 2, kGuestLockMinSpinLimit);
+    guest_lock_spin_failed_count_.fetch_add(1, std::memory_order_relaxed);
+  }
+}
+
+GuestLockStats GetGuestLockStats() {
+  GuestLockStats stats;
+  stats.spin_acquired_count = guest_lock_spin_acquired_count_;
+  stats.spin_failed_count = guest_lock_spin_failed_count_;
+  return stats;
+}
+
+void AcquireSpinLock(uint32_t* lock) {
+  if (xe::atomic_cas(0, 1, lock)) {
+    return;
+  }
+  // Only try to take the lock when it looks free, so spinning doesn't keep
+  // taking the cache line away from the holder.
+  auto try_acquire = [lock]() {
+    return *reinterpret_cast<volatile uint32_t*>(lock) == 0 &&
+           xe::atomic_cas(0, 1, lock);
+  };
+  if (SpinForGuestLock(0, try_acquire)) {
+    return;
+  }
+  while (!try_acquire()) {
+    // Held for long, let the holder run.
+    // TODO(benvanik): error on deadlock?
+    xe::threading::MaybeYield();
+  }
+}
+
 dword_result_t KfAcquireSpinLock(lpdword_t lock_ptr) {
   // XELOGD(
   //     "KfAcquireSpinLock(%.8X)",
   //     lock_ptr);
 
   // Lock.
-  auto lock = reinterpret_cast<uint32_t*>(lock_ptr.host_address());
-  while (!xe::atomic_cas(0, 1, lock)) {
-    // Spin!
-    // TODO(benvanik): error on deadlock?
-    xe::threading::MaybeYield();
-  }
+  AcquireSpinLock(reinterpret_cast<uint32_t*>(lock_ptr.host_address()));
 
   // Raise IRQL to DISPATCH.
   XThread* thread = XThread::GetCurrentThread();
@@ -989,11 +1035,7 @@ DECLARE_XBOXKRNL_EXPORT(KfReleaseSpinLock, ExportTag::kImplemented |
 
 void KeAcquireSpinLockAtRaisedIrql(lpdword_t lock_ptr) {
   // Lock.
-  auto lock = reinterpret_cast<uint32_t*>(lock_ptr.host_address());
-  while (!xe::atomic_cas(0, 1, lock)) {
-    // Spin!
-    // TODO(benvanik): error on deadlock?
-  }
+  AcquireSpinLock(reinterpret_cast<uint32_t*>(lock_ptr.host_address()));
 }
 DECLARE_XBOXKRNL_EXPORT(KeAcquireSpinLockAtRaisedIrql,
                         ExportTag::kImplemented | ExportTag::kThreading |
@@ -1042,20 +1084,23 @@ SHIM_CALL KfLowerIrql_shim(PPCContext* ppc_context, KernelState* kernel_state) {
   XThread::GetCurrentThread()->CheckApcs();
 }
 
-SHIM_CALL NtQueueApcThread_shim(PPCContext* ppc_context,
-                                KernelState* kernel_state) {
-  uint32_t thread_handle = SHIM_GET_ARG_32(0);
-  uint32_t apc_routine = SHIM_GET_ARG_32(1);
-  uint32_t arg1 = SHIM_GET_ARG_32(2);
-  uint32_t arg2 = SHIM_GET_ARG_32(3);
-  uint32_t arg3 = SHIM_GET_ARG_32(4);  // ?
-  XELOGD("NtQueueApcThread(%.8X, %.8X, %.8X, %.8X, %.8X)", thread_handle,
-         apc_routine, arg1, arg2, arg3);
-
-  // Alloc APC object (from somewhere) and insert.
+dword_result_t NtQueueApcThread(dword_t thread_handle, lpvoid_t apc_routine,
+                                dword_t arg1, dword_t arg2, dword_t arg3) {
+  auto thread =
+      kernel_state()->object_table()->LookupObject<XThread>(thread_handle);
+  if (!thread) {
+    return X_STATUS_INVALID_HANDLE;
+  }
+  if (!apc_routine) {
+    return X_STATUS_INVALID_PARAMETER;
+  }
 
-  assert_always("not implemented");
+  // apc_routine(arg1, arg2, arg3), from a special APC freed once delivered.
+  thread->EnqueueApc(apc_routine.guest_address(), arg1, arg2, arg3);
+  return X_STATUS_SUCCESS;
 }
+DECLARE_XBOXKRNL_EXPORT(NtQueueApcThread,
+                        ExportTag::kImplemented | ExportTag::kThreading);
 
 SHIM_CALL KeInitializeApc_shim(PPCContext* ppc_context,
                                KernelState* kernel_state) {
@@ -1352,7 +1397,6 @@ void RegisterThreadingExports(xe::cpu::ExportResolver* export_resolver,
   SHIM_SET_MAPPING("xboxkrnl.exe", KeRaiseIrqlToDpcLevel, state);
   SHIM_SET_MAPPING("xboxkrnl.exe", KfLowerIrql, state);
 
-  // SHIM_SET_MAPPING("xboxkrnl.exe", NtQueueApcThread, state);
   SHIM_SET_MAPPING("xboxkrnl.exe", KeInitializeApc, state);
   SHIM_SET_MAPPING("xboxkrnl.exe", KeInsertQueueApc, state);
   SHIM_SET_MAPPING("xboxkrnl.exe", KeRemoveQueueApc, state);
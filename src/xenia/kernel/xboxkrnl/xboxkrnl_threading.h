@@ -10,6 +10,11 @@
 #ifndef XENIA_KERNEL_XBOXKRNL_XBOXKRNL_THREADING_H_
 #define XENIA_KERNEL_XBOXKRNL_XBOXKRNL_THREADING_H_
 
+#include <xmmintrin.h>
+
+#include <algorithm>
+#include <cstdint>
+
 #include "xenia/kernel/util/shim_utils.h"
 #include "xenia/xbox.h"
 
@@ -33,6 +38,37 @@ dword_result_t KeWaitForSingleObject(lpvoid_t object_ptr, dword_t wait_reason,
 dword_result_t KeSetEvent(pointer_t<X_KEVENT> event_ptr, dword_t increment,
                           dword_t wait);
 
+// Contended guest locks (critical sections and spin locks) are spun on in
+// guest memory before their callers fall back to waiting in the host kernel.
+// Each host thread adapts how long it spins: the limit grows while spinning
+// acquires locks, and shrinks while it doesn't.
+struct GuestLockStats {
+  // Contended acquisitions that spinning got the lock for.
+  uint64_t spin_acquired_count;
+  // Contended acquisitions that had to wait or yield.
+  uint64_t spin_failed_count;
+};
+uint32_t GuestLockSpinLimit();
+void RecordGuestLockSpin(bool acquired);
+GuestLockStats GetGuestLockStats();
+
+// Spins until try_acquire succeeds, for at least min_spin_count tries (the
+// guest requested spin count) or the adaptive limit. Returns false if the
+// lock wasn't acquired.
+template <typename F>
+bool SpinForGuestLock(uint32_t min_spin_count, F try_acquire) {
+  uint32_t spin_count = std::max(min_spin_count, GuestLockSpinLimit());
+  for (uint32_t i = 0; i < spin_count; ++i) {
+    _mm_pause();
+    if (try_acquire()) {
+      RecordGuestLockSpin(true);
+      return true;
+    }
+  }
+  RecordGuestLockSpin(false);
+  return false;
+}
+
 }  // namespace xboxkrnl
 }  // namespace kernel
 }  // namespace xe
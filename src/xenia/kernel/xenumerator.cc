@@ -22,5 +22,14 @@ XEnumerator::~XEnumerator() = default;
 
 void XEnumerator::Initialize() {}
 
+uint32_t XEnumerator::WriteNextItems(uint8_t* buffer, uint32_t max_count) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  uint32_t count = 0;
+  while (count < max_count && WriteItem(buffer + count * item_size_)) {
+    ++count;
+  }
+  return count;
+}
+
 }  // namespace kernel
 }  // namespace xe
@@ -11,6 +11,8 @@
 #define XENIA_KERNEL_XENUMERATOR_H_
 
 #include <cstring>
+#include <functional>
+#include <mutex>
 #include <vector>
 
 #include "xenia/kernel/xobject.h"
@@ -33,12 +35,20 @@ class XEnumerator : public XObject {
   virtual void WriteItems(uint8_t* buffer) = 0;
   virtual bool WriteItem(uint8_t* buffer) = 0;
 
+  // Writes up to max_count of the items not enumerated yet, one after the
+  // other, returning how many were written. May be called from any thread.
+  uint32_t WriteNextItems(uint8_t* buffer, uint32_t max_count);
+
+  size_t item_size() const { return item_size_; }
   size_t current_item() const { return current_item_; }
 
  protected:
   size_t item_capacity_ = 0;
   size_t item_size_ = 0;
   size_t current_item_ = 0;
+
+ private:
+  std::mutex mutex_;
 };
 
 class XStaticEnumerator : public XEnumerator {
@@ -81,6 +91,57 @@ class XStaticEnumerator : public XEnumerator {
   std::vector<uint8_t> buffer_;
 };
 
+// Lists its items only once they are first enumerated, possibly on an IO
+// thread, and writes each only as the guest enumerates it, so large listings
+// neither block the call creating the enumerator nor are copied up front.
+// T must have a Write(uint8_t*) writing item_size bytes.
+template <typename T>
+class XListEnumerator : public XEnumerator {
+ public:
+  typedef std::function<std::vector<T>()> ListFunction;
+
+  XListEnumerator(KernelState* kernel_state, size_t item_capacity,
+                  size_t item_size, ListFunction list_function)
+      : XEnumerator(kernel_state, item_capacity, item_size),
+        list_function_(std::move(list_function)) {}
+
+  uint32_t item_count() const override {
+    List();
+    return uint32_t(items_.size());
+  }
+
+  void WriteItems(uint8_t* buffer) override {
+    List();
+    for (auto& item : items_) {
+      item.Write(buffer);
+      buffer += item_size_;
+    }
+  }
+
+  bool WriteItem(uint8_t* buffer) override {
+    List();
+    if (current_item_ >= items_.size()) {
+      return false;
+    }
+    items_[current_item_++].Write(buffer);
+    return true;
+  }
+
+ private:
+  void List() const {
+    std::call_once(list_once_, [this]() {
+      items_ = list_function_();
+      if (items_.size() > item_capacity_) {
+        items_.resize(item_capacity_);
+      }
+    });
+  }
+
+  ListFunction list_function_;
+  mutable std::once_flag list_once_;
+  mutable std::vector<T> items_;
+};
+
 }  // namespace kernel
 }  // namespace xe
 
@@ -40,6 +40,7 @@ X_STATUS XFile::QueryDirectory(X_FILE_DIRECTORY_INFORMATION* out_info,
                                bool restart) {
   assert_not_null(out_info);
 
+  std::lock_guard<std::mutex> lock(find_mutex_);
   vfs::Entry* entry = nullptr;
 
   if (file_name != nullptr) {
@@ -97,23 +98,16 @@ X_STATUS XFile::Read(void* buffer, size_t buffer_length, size_t byte_offset,
 
   size_t bytes_read = 0;
   X_STATUS result =
-      file_->ReadSync(buffer, buffer_length, byte_offset, &bytes_read);
+      file_->Read(buffer, buffer_length, byte_offset, &bytes_read);
   if (XSUCCEEDED(result)) {
     position_ += bytes_read;
   }
 
-  XIOCompletion::IONotification notify;
-  notify.apc_context = apc_context;
-  notify.num_bytes = uint32_t(bytes_read);
-  notify.status = result;
-
-  NotifyIOCompletionPorts(notify);
-
   if (out_bytes_read) {
     *out_bytes_read = bytes_read;
   }
 
-  async_event_->Set();
+  CompleteIO(result, bytes_read, apc_context);
   return result;
 }
 
@@ -127,24 +121,106 @@ X_STATUS XFile::Write(const void* buffer, size_t buffer_length,
 
   size_t bytes_written = 0;
   X_STATUS result =
-      file_->WriteSync(buffer, buffer_length, byte_offset, &bytes_written);
+      file_->Write(buffer, buffer_length, byte_offset, &bytes_written);
   if (XSUCCEEDED(result)) {
     position_ += bytes_written;
   }
 
+  if (out_bytes_written) {
+    *out_bytes_written = bytes_written;
+  }
+
+  CompleteIO(result, bytes_written, apc_context);
+  return result;
+}
+
+bool XFile::ReadAsync(void* buffer, size_t buffer_length, size_t byte_offset,
+                      uint32_t apc_context, IOCallback callback) {
+  // The file is signaled again once the request completes.
+  async_event_->Reset();
+  bool use_position = byte_offset == -1;
+  if (use_position) {
+    // Read from current position.
+    byte_offset = position_;
+  }
+  auto file = retain_object(this);
+  bool queued = kernel_state_->QueueIO(
+      [file, buffer, buffer_length, byte_offset, use_position, apc_context,
+       callback]() {
+        size_t bytes_read = 0;
+        X_STATUS result = file->file_->Read(buffer, buffer_length, byte_offset,
+                                            &bytes_read);
+        if (use_position && XSUCCEEDED(result)) {
+          file->position_ = byte_offset + bytes_read;
+        }
+        callback(result, bytes_read);
+        file->CompleteIO(result, bytes_read, apc_context);
+      });
+  if (!queued) {
+    async_event_->Set();
+  }
+  return queued;
+}
+
+bool XFile::WriteAsync(const void* buffer, size_t buffer_length,
+                       size_t byte_offset, uint32_t apc_context,
+                       IOCallback callback) {
+  async_event_->Reset();
+  bool use_position = byte_offset == -1;
+  if (use_position) {
+    // Write from current position.
+    byte_offset = position_;
+  }
+  auto file = retain_object(this);
+  bool queued = kernel_state_->QueueIO(
+      [file, buffer, buffer_length, byte_offset, use_position, apc_context,
+       callback]() {
+        size_t bytes_written = 0;
+        X_STATUS result = file->file_->Write(buffer, buffer_length, byte_offset,
+                                             &bytes_written);
+        if (use_position && XSUCCEEDED(result)) {
+          file->position_ = byte_offset + bytes_written;
+        }
+        callback(result, bytes_written);
+        file->CompleteIO(result, bytes_written, apc_context);
+      });
+  if (!queued) {
+    async_event_->Set();
+  }
+  return queued;
+}
+
+bool XFile::QueryDirectoryAsync(X_FILE_DIRECTORY_INFORMATION* out_info,
+                                size_t length, std::string file_name,
+                                bool restart, uint32_t apc_context,
+                                IOCallback callback) {
+  async_event_->Reset();
+  auto file = retain_object(this);
+  bool queued = kernel_state_->QueueIO([file, out_info, length, file_name,
+                                        restart, apc_context, callback]() {
+    X_STATUS result = file->QueryDirectory(
+        out_info, length, !file_name.empty() ? file_name.c_str() : nullptr,
+        restart);
+    size_t info_length = XSUCCEEDED(result) ? length : 0;
+    callback(result, info_length);
+    file->CompleteIO(result, info_length, apc_context);
+  });
+  if (!queued) {
+    async_event_->Set();
+  }
+  return queued;
+}
+
+void XFile::CompleteIO(X_STATUS result, size_t bytes_transferred,
+                       uint32_t apc_context) {
   XIOCompletion::IONotification notify;
   notify.apc_context = apc_context;
-  notify.num_bytes = uint32_t(bytes_written);
+  notify.num_bytes = uint32_t(bytes_transferred);
   notify.status = result;
 
   NotifyIOCompletionPorts(notify);
 
-  if (out_bytes_written) {
-    *out_bytes_written = bytes_written;
-  }
-
   async_event_->Set();
-  return result;
 }
 
 void XFile::RegisterIOCompletionPort(uint32_t key,
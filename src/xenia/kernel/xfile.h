@@ -10,6 +10,8 @@
 #ifndef XENIA_KERNEL_XFILE_H_
 #define XENIA_KERNEL_XFILE_H_
 
+#include <atomic>
+#include <functional>
 #include <string>
 
 #include "xenia/base/filesystem.h"
@@ -104,6 +106,24 @@ class XFile : public XObject {
   X_STATUS Write(const void* buffer, size_t buffer_length, size_t byte_offset,
                  size_t* out_bytes_written, uint32_t apc_context);
 
+  // Called on an IO thread with the result of an overlapped request, before
+  // the completion ports are notified and the file is signaled.
+  typedef std::function<void(X_STATUS result, size_t bytes_transferred)>
+      IOCallback;
+  // Overlapped reads and writes at an offset, run on the kernel IO threads.
+  // As with Read and Write, an offset of -1 means the current position,
+  // which is then moved past what was transferred once the request is done.
+  // Return false without doing anything if there are no IO threads.
+  bool ReadAsync(void* buffer, size_t buffer_length, size_t byte_offset,
+                 uint32_t apc_context, IOCallback callback);
+  bool WriteAsync(const void* buffer, size_t buffer_length, size_t byte_offset,
+                  uint32_t apc_context, IOCallback callback);
+  // Overlapped QueryDirectory, passing the callback the length of the
+  // information written.
+  bool QueryDirectoryAsync(X_FILE_DIRECTORY_INFORMATION* out_info,
+                           size_t length, std::string file_name, bool restart,
+                           uint32_t apc_context, IOCallback callback);
+
   void RegisterIOCompletionPort(uint32_t key, object_ref<XIOCompletion> port);
   void RemoveIOCompletionPort(uint32_t key);
 
@@ -115,6 +135,8 @@ class XFile : public XObject {
 
  protected:
   void NotifyIOCompletionPorts(XIOCompletion::IONotification& notification);
+  void CompleteIO(X_STATUS result, size_t bytes_transferred,
+                  uint32_t apc_context);
 
   xe::threading::WaitHandle* GetWaitHandle() override {
     return async_event_.get();
@@ -131,8 +153,11 @@ class XFile : public XObject {
 
   // TODO(benvanik): create flags, open state, etc.
 
-  size_t position_ = 0;
+  // Moved by the IO threads as overlapped requests at the position finish.
+  std::atomic<size_t> position_ = {0};
 
+  // Guards the search, which overlapped queries continue on the IO threads.
+  std::mutex find_mutex_;
   xe::filesystem::WildcardEngine find_engine_;
   size_t find_index_ = 0;
 
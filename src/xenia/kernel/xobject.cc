@@ -13,6 +13,7 @@
 
 #include "xenia/base/byte_stream.h"
 #include "xenia/base/clock.h"
+#include "xenia/cpu/export_resolver.h"
 #include "xenia/kernel/kernel_state.h"
 #include "xenia/kernel/notify_listener.h"
 #include "xenia/kernel/xboxkrnl/xboxkrnl_private.h"
@@ -198,6 +199,7 @@ X_STATUS XObject::Wait(uint32_t wait_reason, uint32_t processor_mode,
                         TimeoutTicksToMs(*opt_timeout)))
                   : std::chrono::milliseconds::max();
 
+  xe::cpu::ExportBlockedScope blocked_scope;
   auto result =
       xe::threading::Wait(wait_handle, alertable ? true : false, timeout_ms);
   switch (result) {
@@ -225,6 +227,7 @@ X_STATUS XObject::SignalAndWait(XObject* signal_object, XObject* wait_object,
                         TimeoutTicksToMs(*opt_timeout)))
                   : std::chrono::milliseconds::max();
 
+  xe::cpu::ExportBlockedScope blocked_scope;
   auto result = xe::threading::SignalAndWait(
       signal_object->GetWaitHandle(), wait_object->GetWaitHandle(),
       alertable ? true : false, timeout_ms);
@@ -260,6 +263,7 @@ X_STATUS XObject::WaitMultiple(uint32_t count, XObject** objects,
                         TimeoutTicksToMs(*opt_timeout)))
                   : std::chrono::milliseconds::max();
 
+  xe::cpu::ExportBlockedScope blocked_scope;
   if (wait_type) {
     auto result = xe::threading::WaitAny(std::move(wait_handles),
                                          alertable ? true : false, timeout_ms);
@@ -367,10 +371,18 @@ object_ref<XObject> XObject::GetNativeObject(KernelState* kernel_state,
   // We identify this by setting wait_list_flink to a magic value. When set,
   // wait_list_blink will hold a handle to our object.
 
-  auto global_lock = xe::global_critical_region::AcquireDirect();
-
   auto header = reinterpret_cast<X_DISPATCH_HEADER*>(native_ptr);
 
+  // Objects already in use, as in every set and wait after the first, are
+  // looked up without the global lock, as object table lookups take none.
+  if (header->wait_list_flink == 'XEN\0') {
+    std::atomic_thread_fence(std::memory_order_acquire);
+    uint32_t handle = header->wait_list_blink;
+    return kernel_state->object_table()->LookupObject<XObject>(handle);
+  }
+
+  auto global_lock = xe::global_critical_region::AcquireDirect();
+
   if (as_type == -1) {
     as_type = header->type;
   }
@@ -206,8 +206,11 @@ class XObject {
 
   // Stash native pointer into X_DISPATCH_HEADER
   static void StashHandle(X_DISPATCH_HEADER* header, uint32_t handle) {
-    header->wait_list_flink = 'XEN\0';
+    // The handle is written first, as GetNativeObject reads it without a
+    // lock once the marker is set.
     header->wait_list_blink = handle;
+    std::atomic_thread_fence(std::memory_order_release);
+    header->wait_list_flink = 'XEN\0';
   }
 
   static uint32_t TimeoutTicksToMs(int64_t timeout_ticks);
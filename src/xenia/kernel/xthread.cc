@@ -12,14 +12,18 @@
 #include <gflags/gflags.h>
 
 #include <cstring>
+#include <string>
+#include <vector>
 
 #include "xenia/base/byte_stream.h"
 #include "xenia/base/clock.h"
 #include "xenia/base/logging.h"
 #include "xenia/base/math.h"
 #include "xenia/base/profiling.h"
+#include "xenia/base/task_scheduler.h"
 #include "xenia/base/threading.h"
 #include "xenia/cpu/breakpoint.h"
+#include "xenia/cpu/export_resolver.h"
 #include "xenia/cpu/ppc/ppc_decode_data.h"
 #include "xenia/cpu/processor.h"
 #include "xenia/emulator.h"
@@ -32,6 +36,11 @@ DEFINE_bool(ignore_thread_priorities, true,
             "Ignores game-specified thread priorities.");
 DEFINE_bool(ignore_thread_affinities, true,
             "Ignores game-specified thread affinities.");
+DEFINE_string(guest_thread_cpus, "",
+              "Host logical processors each of the six guest hardware "
+              "threads runs on, as ';' separated processor sets, e.g. "
+              "\"0-1;2-3;4-5;6-7;8-9;10-11\". Empty runs guest hardware "
+              "thread N on host processor N.");
 
 namespace xe {
 namespace kernel {
@@ -86,6 +95,11 @@ XThread::~XThread() {
   // Notify processor of our impending destruction.
   emulator()->processor()->OnThreadDestroyed(thread_id_);
 
+  // A thread terminated while delayed leaves its delay scheduled.
+  if (delay_timer_id_ != TimerWheel::kInvalidTimer) {
+    kernel_state()->timer_wheel()->Cancel(delay_timer_id_);
+  }
+
   thread_.reset();
 
   if (thread_state_) {
@@ -168,6 +182,52 @@ uint8_t GetFakeCpuNumber(uint8_t proc_mask) {
   return cpu_number;
 }
 
+// Maps a guest affinity mask of hardware threads to host processors, or 0 to
+// run anywhere.
+uint64_t GuestToHostAffinity(uint32_t guest_affinity) {
+  static const std::vector<uint64_t> host_masks = []() {
+    uint64_t available_mask = UINT64_MAX;
+    if (xe::threading::logical_processor_count() < 64) {
+      available_mask =
+          (1ull << xe::threading::logical_processor_count()) - 1;
+    }
+    std::vector<uint64_t> masks(6);
+    for (uint32_t i = 0; i < 6; ++i) {
+      masks[i] = (1ull << i) & available_mask;
+    }
+    std::string sets = FLAGS_guest_thread_cpus;
+    size_t offset = 0;
+    for (uint32_t i = 0; i < 6 && offset < sets.size(); ++i) {
+      size_t end = sets.find(';', offset);
+      if (end == std::string::npos) {
+        end = sets.size();
+      }
+      uint64_t mask;
+      if (!xe::threading::ParseProcessorSet(
+              sets.substr(offset, end - offset), &mask)) {
+        XELOGE("Invalid --guest_thread_cpus, using the default");
+        break;
+      }
+      masks[i] = mask & available_mask;
+      offset = end + 1;
+    }
+    // Background work is kept off the guest hardware threads.
+    uint64_t guest_mask = 0;
+    for (uint64_t mask : masks) {
+      guest_mask |= mask;
+    }
+    xe::threading::TaskScheduler::AvoidProcessors(guest_mask);
+    return masks;
+  }();
+  uint64_t host_mask = 0;
+  for (uint32_t i = 0; i < 6; ++i) {
+    if (guest_affinity & (1 << i)) {
+      host_mask |= host_masks[i];
+    }
+  }
+  return host_mask;
+}
+
 void XThread::InitializeGuestObject() {
   auto guest_thread = guest_object<X_KTHREAD>();
 
@@ -225,6 +285,15 @@ bool XThread::AllocateStack(uint32_t size) {
   auto actual_size = size + padding;
 
   uint32_t address = 0;
+  if (kernel_state_->TakeThreadStack(actual_size, &address)) {
+    // The guard pages are still set up, and the junk is whatever the last
+    // thread left.
+    stack_alloc_base_ = address;
+    stack_alloc_size_ = actual_size;
+    stack_limit_ = address + (padding / 2);
+    stack_base_ = stack_limit_ + size;
+    return true;
+  }
   if (!heap->AllocRange(0x40000000, 0x7F000000, actual_size, alignment,
                         kMemoryAllocationReserve | kMemoryAllocationCommit,
                         kMemoryProtectRead | kMemoryProtectWrite, false,
@@ -249,8 +318,11 @@ bool XThread::AllocateStack(uint32_t size) {
 
 void XThread::FreeStack() {
   if (stack_alloc_base_) {
-    auto heap = memory()->LookupHeap(0x40000000);
-    heap->Release(stack_alloc_base_);
+    if (!kernel_state_->ReturnThreadStack(stack_alloc_base_,
+                                          stack_alloc_size_)) {
+      auto heap = memory()->LookupHeap(0x40000000);
+      heap->Release(stack_alloc_base_);
+    }
 
     stack_alloc_base_ = 0;
     stack_alloc_size_ = 0;
@@ -396,7 +468,13 @@ X_STATUS XThread::Create() {
     XELOGE("CreateThread failed");
     return X_STATUS_NO_MEMORY;
   }
-  thread_->set_affinity_mask(proc_mask);
+  uint64_t host_mask = host_affinity_mask_;
+  if (!host_mask) {
+    host_mask = GuestToHostAffinity(proc_mask);
+  }
+  if (host_mask) {
+    thread_->set_affinity_mask(host_mask);
+  }
 
   // Set the thread name based on host ID (for easier debugging).
   if (name_.empty()) {
@@ -528,11 +606,12 @@ void XThread::LowerIrql(uint32_t new_irql) { irql_ = new_irql; }
 
 void XThread::CheckApcs() { DeliverAPCs(); }
 
-void XThread::LockApc() { EnterCriticalRegion(); }
+void XThread::LockApc() { apc_mutex_.lock(); }
 
 void XThread::UnlockApc(bool queue_delivery) {
   bool needs_apc = apc_list_.HasPending();
-  LeaveCriticalRegion();
+  apc_list_pending_.store(needs_apc, std::memory_order_release);
+  apc_mutex_.unlock();
   if (needs_apc && queue_delivery) {
     thread_->QueueUserCallback([this]() { DeliverAPCs(); });
   }
@@ -540,9 +619,6 @@ void XThread::UnlockApc(bool queue_delivery) {
 
 void XThread::EnqueueApc(uint32_t normal_routine, uint32_t normal_context,
                          uint32_t arg1, uint32_t arg2) {
-  LockApc();
-
-  // Allocate APC.
   // We'll tag it as special and free it when dispatched.
   uint32_t apc_ptr = memory()->SystemHeapAlloc(XAPC::kSize);
   auto apc = reinterpret_cast<XAPC*>(memory()->TranslateVirtual(apc_ptr));
@@ -556,80 +632,138 @@ void XThread::EnqueueApc(uint32_t normal_routine, uint32_t normal_context,
   apc->arg2 = arg2;
   apc->enqueued = 1;
 
-  uint32_t list_entry_ptr = apc_ptr + 8;
-  apc_list_.Insert(list_entry_ptr);
+  // The guest never sees these, so they skip apc_list_ and its lock.
+  uint32_t head = queued_apc_head_.load(std::memory_order_relaxed);
+  do {
+    apc->flink = head;
+  } while (!queued_apc_head_.compare_exchange_weak(
+      head, apc_ptr, std::memory_order_release, std::memory_order_relaxed));
 
-  UnlockApc(true);
+  // Only the first of a batch needs to wake the thread, as all queued so far
+  // are delivered together.
+  if (!head) {
+    thread_->QueueUserCallback([this]() { DeliverAPCs(); });
+  }
+}
+
+uint32_t XThread::TakeQueuedApcs() {
+  uint32_t apc_ptr = queued_apc_head_.exchange(0, std::memory_order_acquire);
+  // Reversed, as the last queued is first.
+  uint32_t first_apc_ptr = 0;
+  while (apc_ptr) {
+    auto apc = reinterpret_cast<XAPC*>(memory()->TranslateVirtual(apc_ptr));
+    uint32_t next_apc_ptr = apc->flink;
+    apc->flink = first_apc_ptr;
+    first_apc_ptr = apc_ptr;
+    apc_ptr = next_apc_ptr;
+  }
+  return first_apc_ptr;
 }
 
 void XThread::DeliverAPCs() {
-  // http://www.drdobbs.com/inside-nts-asynchronous-procedure-call/184416590?pgno=1
-  // http://www.drdobbs.com/inside-nts-asynchronous-procedure-call/184416590?pgno=7
-  auto processor = kernel_state()->processor();
+  // Called whenever APCs may be delivered, so this is checked without locks.
+  if (!queued_apc_head_.load(std::memory_order_relaxed) &&
+      !apc_list_pending_.load(std::memory_order_acquire)) {
+    return;
+  }
+
+  // Those queued by the host are delivered as one batch.
+  uint32_t apc_ptr = TakeQueuedApcs();
+  while (apc_ptr) {
+    auto apc = reinterpret_cast<XAPC*>(memory()->TranslateVirtual(apc_ptr));
+    uint32_t next_apc_ptr = apc->flink;
+    apc->enqueued = 0;
+    DeliverApc(apc_ptr);
+    apc_ptr = next_apc_ptr;
+  }
+
   LockApc();
   while (apc_list_.HasPending()) {
-    // Get APC entry (offset for LIST_ENTRY offset) and cache what we need.
-    // Calling the routine may delete the memory/overwrite it.
+    // Get APC entry (offset for LIST_ENTRY offset).
     uint32_t apc_ptr = apc_list_.Shift() - 8;
     auto apc = reinterpret_cast<XAPC*>(memory()->TranslateVirtual(apc_ptr));
-    bool needs_freeing = apc->kernel_routine == XAPC::kDummyKernelRoutine;
-
-    XELOGD("Delivering APC to %.8X", uint32_t(apc->normal_routine));
 
     // Mark as uninserted so that it can be reinserted again by the routine.
     apc->enqueued = 0;
 
-    // Call kernel routine.
-    // The routine can modify all of its arguments before passing it on.
-    // Since we need to give guest accessible pointers over, we copy things
-    // into and out of scratch.
-    uint8_t* scratch_ptr = memory()->TranslateVirtual(scratch_address_);
-    xe::store_and_swap<uint32_t>(scratch_ptr + 0, apc->normal_routine);
-    xe::store_and_swap<uint32_t>(scratch_ptr + 4, apc->normal_context);
-    xe::store_and_swap<uint32_t>(scratch_ptr + 8, apc->arg1);
-    xe::store_and_swap<uint32_t>(scratch_ptr + 12, apc->arg2);
-    if (apc->kernel_routine != XAPC::kDummyKernelRoutine) {
-      // kernel_routine(apc_address, &normal_routine, &normal_context,
-      // &system_arg1, &system_arg2)
-      uint64_t kernel_args[] = {
-          apc_ptr,
-          scratch_address_ + 0,
-          scratch_address_ + 4,
-          scratch_address_ + 8,
-          scratch_address_ + 12,
-      };
-      processor->Execute(thread_state_, apc->kernel_routine, kernel_args,
-                         xe::countof(kernel_args));
-    }
-    uint32_t normal_routine = xe::load_and_swap<uint32_t>(scratch_ptr + 0);
-    uint32_t normal_context = xe::load_and_swap<uint32_t>(scratch_ptr + 4);
-    uint32_t arg1 = xe::load_and_swap<uint32_t>(scratch_ptr + 8);
-    uint32_t arg2 = xe::load_and_swap<uint32_t>(scratch_ptr + 12);
-
-    // Call the normal routine. Note that it may have been killed by the kernel
-    // routine.
-    if (normal_routine) {
-      UnlockApc(false);
-      // normal_routine(normal_context, system_arg1, system_arg2)
-      uint64_t normal_args[] = {normal_context, arg1, arg2};
-      processor->Execute(thread_state_, normal_routine, normal_args,
-                         xe::countof(normal_args));
-      LockApc();
-    }
+    // The routines run unlocked, as they may queue more APCs.
+    UnlockApc(false);
+    DeliverApc(apc_ptr);
+    LockApc();
+  }
+  UnlockApc(true);
+}
 
-    XELOGD("Completed delivery of APC to %.8X (%.8X, %.8X, %.8X)",
-           normal_routine, normal_context, arg1, arg2);
+void XThread::DeliverApc(uint32_t apc_ptr) {
+  // http://www.drdobbs.com/inside-nts-asynchronous-procedure-call/184416590?pgno=1
+  // http://www.drdobbs.com/inside-nts-asynchronous-procedure-call/184416590?pgno=7
+  auto processor = kernel_state()->processor();
+  // Cache what we need, as calling the routine may delete the
+  // memory/overwrite it.
+  auto apc = reinterpret_cast<XAPC*>(memory()->TranslateVirtual(apc_ptr));
+  bool needs_freeing = apc->kernel_routine == XAPC::kDummyKernelRoutine;
+
+  XELOGD("Delivering APC to %.8X", uint32_t(apc->normal_routine));
+
+  uint32_t kernel_routine = apc->kernel_routine;
+
+  // Call kernel routine.
+  // The routine can modify all of its arguments before passing it on.
+  // Since we need to give guest accessible pointers over, we copy things
+  // into and out of scratch.
+  uint8_t* scratch_ptr = memory()->TranslateVirtual(scratch_address_);
+  xe::store_and_swap<uint32_t>(scratch_ptr + 0, apc->normal_routine);
+  xe::store_and_swap<uint32_t>(scratch_ptr + 4, apc->normal_context);
+  xe::store_and_swap<uint32_t>(scratch_ptr + 8, apc->arg1);
+  xe::store_and_swap<uint32_t>(scratch_ptr + 12, apc->arg2);
+  if (kernel_routine != XAPC::kDummyKernelRoutine) {
+    // kernel_routine(apc_address, &normal_routine, &normal_context,
+    // &system_arg1, &system_arg2)
+    uint64_t kernel_args[] = {
+        apc_ptr,
+        scratch_address_ + 0,
+        scratch_address_ + 4,
+        scratch_address_ + 8,
+        scratch_address_ + 12,
+    };
+    processor->Execute(thread_state_, kernel_routine, kernel_args,
+                       xe::countof(kernel_args));
+  }
+  uint32_t normal_routine = xe::load_and_swap<uint32_t>(scratch_ptr + 0);
+  uint32_t normal_context = xe::load_and_swap<uint32_t>(scratch_ptr + 4);
+  uint32_t arg1 = xe::load_and_swap<uint32_t>(scratch_ptr + 8);
+  uint32_t arg2 = xe::load_and_swap<uint32_t>(scratch_ptr + 12);
+
+  // Call the normal routine. Note that it may have been killed by the kernel
+  // routine.
+  if (normal_routine) {
+    // normal_routine(normal_context, system_arg1, system_arg2)
+    uint64_t normal_args[] = {normal_context, arg1, arg2};
+    processor->Execute(thread_state_, normal_routine, normal_args,
+                       xe::countof(normal_args));
+  }
 
-    // If special, free it.
-    if (needs_freeing) {
-      memory()->SystemHeapFree(apc_ptr);
-    }
+  XELOGD("Completed delivery of APC to %.8X (%.8X, %.8X, %.8X)",
+         normal_routine, normal_context, arg1, arg2);
+
+  // If special, free it.
+  if (needs_freeing) {
+    memory()->SystemHeapFree(apc_ptr);
   }
-  UnlockApc(true);
 }
 
 void XThread::RundownAPCs() {
   assert_true(XThread::GetCurrentThread() == this);
+  // Those queued by the host have no rundown routine.
+  uint32_t queued_apc_ptr = TakeQueuedApcs();
+  while (queued_apc_ptr) {
+    auto apc =
+        reinterpret_cast<XAPC*>(memory()->TranslateVirtual(queued_apc_ptr));
+    uint32_t next_apc_ptr = apc->flink;
+    memory()->SystemHeapFree(queued_apc_ptr);
+    queued_apc_ptr = next_apc_ptr;
+  }
+
   LockApc();
   while (apc_list_.HasPending()) {
     // Get APC entry (offset for LIST_ENTRY offset) and cache what we need.
@@ -640,14 +774,16 @@ void XThread::RundownAPCs() {
 
     // Mark as uninserted so that it can be reinserted again by the routine.
     apc->enqueued = 0;
+    uint32_t rundown_routine = apc->rundown_routine;
+    UnlockApc(false);
 
     // Call the rundown routine.
-    if (apc->rundown_routine == XAPC::kDummyRundownRoutine) {
+    if (rundown_routine == XAPC::kDummyRundownRoutine) {
       // No-op.
-    } else if (apc->rundown_routine) {
+    } else if (rundown_routine) {
       // rundown_routine(apc)
       uint64_t args[] = {apc_ptr};
-      kernel_state()->processor()->Execute(thread_state(), apc->rundown_routine,
+      kernel_state()->processor()->Execute(thread_state(), rundown_routine,
                                            args, xe::countof(args));
     }
 
@@ -655,6 +791,7 @@ void XThread::RundownAPCs() {
     if (needs_freeing) {
       memory()->SystemHeapFree(apc_ptr);
     }
+    LockApc();
   }
   UnlockApc(true);
 }
@@ -696,8 +833,11 @@ void XThread::SetAffinity(uint32_t affinity) {
   }
   SetActiveCpu(GetFakeCpuNumber(affinity));
   affinity_ = affinity;
-  if (!FLAGS_ignore_thread_affinities) {
-    thread_->set_affinity_mask(affinity);
+  if (!FLAGS_ignore_thread_affinities && !host_affinity_mask_) {
+    uint64_t host_mask = GuestToHostAffinity(affinity);
+    if (host_mask) {
+      thread_->set_affinity_mask(host_mask);
+    }
   }
 }
 
@@ -750,9 +890,13 @@ X_STATUS XThread::Suspend(uint32_t* out_suspend_count) {
 
   ++guest_object<X_KTHREAD>()->suspend_count;
 
-  // If we are suspending ourselves, we can't hold the lock.
+  // If we are suspending ourselves, we can't hold the lock. Otherwise the
+  // kernel leaf locks are held too, so the thread isn't stopped in one.
+  std::vector<std::unique_lock<xe::profiled_mutex>> suspend_locks;
   if (XThread::IsInThread() && XThread::GetCurrentThread() == this) {
     global_lock.unlock();
+  } else {
+    suspend_locks = kernel_state_->AcquireSuspendLocks();
   }
 
   if (thread_->Suspend(out_suspend_count)) {
@@ -764,23 +908,33 @@ X_STATUS XThread::Suspend(uint32_t* out_suspend_count) {
 
 X_STATUS XThread::Delay(uint32_t processor_mode, uint32_t alertable,
                         uint64_t interval) {
-  int64_t timeout_ticks = interval;
-  uint32_t timeout_ms;
-  if (timeout_ticks > 0) {
-    // Absolute time, based on January 1, 1601.
-    // TODO(benvanik): convert time to relative time.
-    assert_always();
-    timeout_ms = 0;
-  } else if (timeout_ticks < 0) {
-    // Relative time.
-    timeout_ms = uint32_t(-timeout_ticks / 10000);  // Ticks -> MS
-  } else {
-    timeout_ms = 0;
+  auto due_time = TimerWheel::GuestDueTime(int64_t(interval));
+  if (due_time > std::chrono::nanoseconds::zero()) {
+    // Woken by the timer wheel, so delays ending together share a wakeup.
+    if (!delay_event_) {
+      delay_event_ = xe::threading::Event::CreateAutoResetEvent(false);
+    }
+    auto timer_wheel = kernel_state()->timer_wheel();
+    delay_timer_id_ = timer_wheel->Schedule(
+        due_time, std::chrono::nanoseconds::zero(),
+        [this]() { delay_event_->Set(); });
+    xe::cpu::ExportBlockedScope blocked_scope;
+    auto result = xe::threading::Wait(delay_event_.get(), alertable != 0);
+    if (result == xe::threading::WaitResult::kUserCallback) {
+      if (!timer_wheel->Cancel(delay_timer_id_)) {
+        // Expired while alerted.
+        delay_event_->Reset();
+      }
+      delay_timer_id_ = TimerWheel::kInvalidTimer;
+      return X_STATUS_USER_APC;
+    }
+    delay_timer_id_ = TimerWheel::kInvalidTimer;
+    return X_STATUS_SUCCESS;
   }
-  timeout_ms = Clock::ScaleGuestDurationMillis(timeout_ms);
+
+  // Zero or elapsed delays only yield.
   if (alertable) {
-    auto result =
-        xe::threading::AlertableSleep(std::chrono::milliseconds(timeout_ms));
+    auto result = xe::threading::AlertableSleep(std::chrono::milliseconds(0));
     switch (result) {
       default:
       case xe::threading::SleepResult::kSuccess:
@@ -789,7 +943,7 @@ X_STATUS XThread::Delay(uint32_t processor_mode, uint32_t alertable,
         return X_STATUS_USER_APC;
     }
   } else {
-    xe::threading::Sleep(std::chrono::milliseconds(timeout_ms));
+    xe::threading::Sleep(std::chrono::milliseconds(0));
     return X_STATUS_SUCCESS;
   }
 }
@@ -856,6 +1010,20 @@ bool XThread::Save(ByteStream* stream) {
   stream->Write('THRD');
   stream->Write(name_);
 
+  // APCs queued by the host are saved on the guest list, which delivers them
+  // just the same after a restore. The thread is paused, so this can take
+  // them off for it.
+  LockApc();
+  uint32_t queued_apc_ptr = TakeQueuedApcs();
+  while (queued_apc_ptr) {
+    auto apc =
+        reinterpret_cast<XAPC*>(memory()->TranslateVirtual(queued_apc_ptr));
+    uint32_t next_apc_ptr = apc->flink;
+    apc_list_.Insert(queued_apc_ptr + 8);
+    queued_apc_ptr = next_apc_ptr;
+  }
+  UnlockApc(false);
+
   ThreadSavedState state;
   state.thread_id = thread_id_;
   state.is_main_thread = main_thread_;
@@ -938,6 +1106,7 @@ object_ref<XThread> XThread::Restore(KernelState* kernel_state,
   thread->stack_alloc_size_ = state.stack_alloc_size;
 
   thread->apc_list_.set_memory(kernel_state->memory());
+  thread->apc_list_pending_ = thread->apc_list_.HasPending();
 
   // Register now that we know our thread ID.
   kernel_state->RegisterThread(thread);
@@ -16,6 +16,7 @@
 #include "xenia/base/mutex.h"
 #include "xenia/base/threading.h"
 #include "xenia/cpu/thread_state.h"
+#include "xenia/kernel/timer_wheel.h"
 #include "xenia/kernel/util/native_list.h"
 #include "xenia/kernel/xmutant.h"
 #include "xenia/kernel/xobject.h"
@@ -141,6 +142,9 @@ class XThread : public XObject {
   // work properly.
   bool can_debugger_suspend() const { return can_debugger_suspend_; }
   void set_can_debugger_suspend(bool value) { can_debugger_suspend_ = value; }
+  // Host processors the thread runs on, overriding those of its guest
+  // affinity. Must be set before Create. 0 for no override.
+  void set_host_affinity_mask(uint64_t value) { host_affinity_mask_ = value; }
   bool is_running() const { return running_; }
 
   cpu::ThreadState* thread_state() const { return thread_state_; }
@@ -165,6 +169,11 @@ class XThread : public XObject {
   void LockApc();
   void UnlockApc(bool queue_delivery);
   util::NativeList* apc_list() { return &apc_list_; }
+  std::unique_lock<xe::profiled_mutex> AcquireApcLock() {
+    return apc_mutex_.Acquire();
+  }
+  // Queues a special APC, freed once delivered, without taking the APC lock.
+  // May be called from any thread.
   void EnqueueApc(uint32_t normal_routine, uint32_t normal_context,
                   uint32_t arg1, uint32_t arg2);
 
@@ -203,6 +212,11 @@ class XThread : public XObject {
 
   void DeliverAPCs();
   void RundownAPCs();
+  // Calls the kernel and normal routines of an APC taken off a queue.
+  void DeliverApc(uint32_t apc_ptr);
+  // Takes all APCs queued by EnqueueApc, linked through flink in the order
+  // they were queued.
+  uint32_t TakeQueuedApcs();
 
   xe::threading::WaitHandle* GetWaitHandle() override { return thread_.get(); }
 
@@ -212,6 +226,9 @@ class XThread : public XObject {
 
   uint32_t thread_id_ = 0;
   std::unique_ptr<xe::threading::Thread> thread_;
+  // Set by the kernel timer wheel when a delay of the thread is over.
+  std::unique_ptr<xe::threading::Event> delay_event_;
+  TimerWheel::TimerId delay_timer_id_ = TimerWheel::kInvalidTimer;
   uint32_t scratch_address_ = 0;
   uint32_t scratch_size_ = 0;
   uint32_t tls_static_address_ = 0;
@@ -226,6 +243,7 @@ class XThread : public XObject {
   bool guest_thread_ = false;
   bool main_thread_ = false;  // Entry-point thread
   bool can_debugger_suspend_ = true;
+  uint64_t host_affinity_mask_ = 0;
   bool running_ = false;
 
   std::string name_;
@@ -235,7 +253,16 @@ class XThread : public XObject {
 
   xe::global_critical_region global_critical_region_;
   std::atomic<uint32_t> irql_ = {0};
+  // A kernel leaf lock guarding apc_list_, see KernelState.
+  xe::profiled_mutex apc_mutex_{"apc_list"};
   util::NativeList apc_list_;
+  // Whether apc_list_ had APCs when last unlocked, so checking for APCs
+  // takes no lock when there are none.
+  std::atomic<bool> apc_list_pending_ = {false};
+  // The guest address of the last APC queued by EnqueueApc, which links to
+  // the one before through flink. Pushed to by any thread, and only taken
+  // off as a whole by this one.
+  std::atomic<uint32_t> queued_apc_head_ = {0};
 };
 
 class XHostThread : public XThread {
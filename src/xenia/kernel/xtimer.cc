@@ -12,6 +12,7 @@
 #include "xenia/base/clock.h"
 #include "xenia/base/logging.h"
 #include "xenia/cpu/processor.h"
+#include "xenia/kernel/kernel_state.h"
 #include "xenia/kernel/xthread.h"
 
 namespace xe {
@@ -19,16 +20,16 @@ namespace kernel {
 
 XTimer::XTimer(KernelState* kernel_state) : XObject(kernel_state, kTypeTimer) {}
 
-XTimer::~XTimer() = default;
+XTimer::~XTimer() { Cancel(); }
 
 void XTimer::Initialize(uint32_t timer_type) {
-  assert_false(timer_);
+  assert_false(event_);
   switch (timer_type) {
     case 0:  // NotificationTimer
-      timer_ = xe::threading::Timer::CreateManualResetTimer();
+      event_ = xe::threading::Event::CreateManualResetEvent(false);
       break;
     case 1:  // SynchronizationTimer
-      timer_ = xe::threading::Timer::CreateSynchronizationTimer();
+      event_ = xe::threading::Event::CreateAutoResetEvent(false);
       break;
     default:
       assert_always();
@@ -43,45 +44,47 @@ X_STATUS XTimer::SetTimer(int64_t due_time, uint32_t period_ms,
     return X_STATUS_TIMER_RESUME_IGNORED;
   }
 
-  due_time = Clock::ScaleGuestDurationFileTime(due_time);
-  period_ms = Clock::ScaleGuestDurationMillis(period_ms);
+  // Setting the timer again replaces the pending expiration, and the timer
+  // isn't signaled until it expires.
+  Cancel();
+  event_->Reset();
 
   // Stash routine for callback.
   callback_thread_ = XThread::GetCurrentThread();
   callback_routine_ = routine;
   callback_routine_arg_ = routine_arg;
 
-  // This callback will only be issued when the timer is fired.
-  std::function<void()> callback = nullptr;
-  if (callback_routine_) {
-    callback = [this]() {
-      // Queue APC to call back routine with (arg, low, high).
-      // It'll be executed on the thread that requested the timer.
-      uint64_t time = xe::Clock::QueryGuestSystemTime();
-      uint32_t time_low = static_cast<uint32_t>(time);
-      uint32_t time_high = static_cast<uint32_t>(time >> 32);
-      XELOGI("XTimer enqueuing timer callback to %.8X(%.8X, %.8X, %.8X)",
-             callback_routine_, callback_routine_arg_, time_low, time_high);
-      callback_thread_->EnqueueApc(callback_routine_, callback_routine_arg_,
-                                   time_low, time_high);
-    };
-  }
+  auto timer_wheel = kernel_state()->timer_wheel();
+  timer_id_ = timer_wheel->Schedule(
+      TimerWheel::GuestDueTime(due_time),
+      std::chrono::milliseconds(Clock::ScaleGuestDurationMillis(period_ms)),
+      [this]() { Fire(); });
+  return X_STATUS_SUCCESS;
+}
 
-  bool result;
-  if (!period_ms) {
-    result = timer_->SetOnce(std::chrono::nanoseconds(due_time * 100),
-                             std::move(callback));
-  } else {
-    result = timer_->SetRepeating(std::chrono::nanoseconds(due_time * 100),
-                                  std::chrono::milliseconds(period_ms),
-                                  std::move(callback));
+X_STATUS XTimer::Cancel() {
+  if (timer_id_ != TimerWheel::kInvalidTimer) {
+    // Waits for the callback if it's running.
+    kernel_state()->timer_wheel()->Cancel(timer_id_);
+    timer_id_ = TimerWheel::kInvalidTimer;
   }
-
-  return result ? X_STATUS_SUCCESS : X_STATUS_UNSUCCESSFUL;
+  return X_STATUS_SUCCESS;
 }
 
-X_STATUS XTimer::Cancel() {
-  return timer_->Cancel() ? X_STATUS_SUCCESS : X_STATUS_UNSUCCESSFUL;
+void XTimer::Fire() {
+  // Called on the timer wheel thread.
+  event_->Set();
+  if (callback_routine_) {
+    // Queue APC to call back routine with (arg, low, high).
+    // It'll be executed on the thread that requested the timer.
+    uint64_t time = xe::Clock::QueryGuestSystemTime();
+    uint32_t time_low = static_cast<uint32_t>(time);
+    uint32_t time_high = static_cast<uint32_t>(time >> 32);
+    XELOGI("XTimer enqueuing timer callback to %.8X(%.8X, %.8X, %.8X)",
+           callback_routine_, callback_routine_arg_, time_low, time_high);
+    callback_thread_->EnqueueApc(callback_routine_, callback_routine_arg_,
+                                 time_low, time_high);
+  }
 }
 
 }  // namespace kernel
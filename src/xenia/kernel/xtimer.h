@@ -11,6 +11,7 @@
 #define XENIA_KERNEL_XTIMER_H_
 
 #include "xenia/base/threading.h"
+#include "xenia/kernel/timer_wheel.h"
 #include "xenia/kernel/xobject.h"
 #include "xenia/xbox.h"
 
@@ -33,10 +34,14 @@ class XTimer : public XObject {
   X_STATUS Cancel();
 
  protected:
-  xe::threading::WaitHandle* GetWaitHandle() override { return timer_.get(); }
+  xe::threading::WaitHandle* GetWaitHandle() override { return event_.get(); }
 
  private:
-  std::unique_ptr<xe::threading::Timer> timer_;
+  void Fire();
+
+  // Signaled by the kernel timer wheel, rather than a host timer per timer.
+  std::unique_ptr<xe::threading::Event> event_;
+  TimerWheel::TimerId timer_id_ = TimerWheel::kInvalidTimer;
 
   XThread* callback_thread_ = nullptr;
   uint32_t callback_routine_ = 0;
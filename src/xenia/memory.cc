@@ -13,13 +13,18 @@
 
 #include <algorithm>
 #include <cstring>
+#include <functional>
+#include <string>
 
 #include "xenia/base/byte_stream.h"
 #include "xenia/base/clock.h"
 #include "xenia/base/logging.h"
 #include "xenia/base/math.h"
+#include "xenia/base/profiling.h"
 #include "xenia/base/threading.h"
 #include "xenia/cpu/mmio_handler.h"
+#include "third_party/snappy/snappy.h"
+#include "third_party/xxhash/xxhash.h"
 
 // TODO(benvanik): move xbox.h out
 #include "xenia/xbox.h"
@@ -32,6 +37,16 @@ DEFINE_bool(protect_on_release, false,
 DEFINE_bool(scribble_heap, false,
             "Scribble 0xCD into all allocated heap memory.");
 
+DEFINE_bool(physical_memory_large_pages, false,
+            "Back guest physical memory with host large pages to reduce TLB "
+            "misses, if the process may lock pages in memory. Physical "
+            "memory protection and access watches are then only as fine as "
+            "the large pages.");
+
+DEFINE_bool(system_heap_pool, true,
+            "Pool small system heap allocations instead of giving each its "
+            "own pages.");
+
 namespace xe {
 
 uint32_t get_page_count(uint32_t value, uint32_t page_size) {
@@ -72,6 +87,15 @@ uint32_t get_page_count(uint32_t value, uint32_t page_size) {
 
 static Memory* active_memory_ = nullptr;
 
+// Identifies the pools thread caches were filled from.
+static std::atomic<uint64_t> next_system_pool_id_(1);
+
+struct Memory::SystemPoolCache {
+  uint64_t pool_id = 0;
+  uint32_t counts[2][kSystemPoolClassCount];
+  uint32_t blocks[2][kSystemPoolClassCount][kSystemPoolCacheSize];
+};
+
 void CrashDump() {
   static std::atomic<int> in_crash_dump(0);
   if (in_crash_dump.fetch_add(1)) {
@@ -87,6 +111,7 @@ Memory::Memory() {
   system_page_size_ = uint32_t(xe::memory::page_size());
   assert_zero(active_memory_);
   active_memory_ = this;
+  ResetSystemPools();
 }
 
 Memory::~Memory() {
@@ -113,6 +138,10 @@ Memory::~Memory() {
     mapping_base_ = nullptr;
     mapping_ = nullptr;
   }
+  if (physical_mapping_) {
+    xe::memory::CloseFileMappingHandle(physical_mapping_);
+    physical_mapping_ = nullptr;
+  }
 
   virtual_membase_ = nullptr;
   physical_membase_ = nullptr;
@@ -134,6 +163,24 @@ bool Memory::Initialize() {
     return false;
   }
 
+  // Physical memory can instead have a mapping of its own, backed by large
+  // pages, which is always committed.
+  if (FLAGS_physical_memory_large_pages) {
+    size_t large_page_size = xe::memory::large_page_size();
+    if (large_page_size && 0x20000000 % large_page_size == 0) {
+      physical_mapping_ = xe::memory::CreateFileMappingHandle(
+          file_name_ + L"_physical", 0x20000000,
+          xe::memory::PageAccess::kReadWrite, true, true);
+    }
+    if (physical_mapping_) {
+      physical_page_size_ = uint32_t(large_page_size);
+    } else {
+      XELOGW(
+          "Unable to back physical memory with large pages; the lock pages "
+          "in memory privilege may be missing");
+    }
+  }
+
   // Attempt to create our views. This may fail at the first address
   // we pick, so try a few times.
   mapping_base_ = 0;
@@ -171,6 +218,12 @@ bool Memory::Initialize() {
                               16 * 1024 * 1024, &heaps_.physical);
   heaps_.vE0000000.Initialize(virtual_membase_, 0xE0000000, 0x1FD00000, 4096,
                               &heaps_.physical);
+  if (physical_mapping_) {
+    heaps_.physical.set_host_page_size(physical_page_size_);
+    heaps_.vA0000000.set_host_page_size(physical_page_size_);
+    heaps_.vC0000000.set_host_page_size(physical_page_size_);
+    heaps_.vE0000000.set_host_page_size(physical_page_size_);
+  }
 
   // Take the first page at 0 so we can check for writes.
   heaps_.v00000000.AllocFixed(
@@ -187,8 +240,9 @@ bool Memory::Initialize() {
       kMemoryProtectRead | kMemoryProtectWrite);
 
   // Add handlers for MMIO.
-  mmio_handler_ = cpu::MMIOHandler::Install(virtual_membase_, physical_membase_,
-                                            physical_membase_ + 0x1FFFFFFF);
+  mmio_handler_ = cpu::MMIOHandler::Install(
+      virtual_membase_, physical_membase_, physical_membase_ + 0x1FFFFFFF,
+      physical_mapping_ ? physical_page_size_ : xe::memory::page_size());
   if (!mmio_handler_) {
     XELOGE("Unable to install MMIO handlers");
     assert_always();
@@ -248,10 +302,18 @@ static const struct {
 int Memory::MapViews(uint8_t* mapping_base) {
   assert_true(xe::countof(map_info) == xe::countof(views_.all_views));
   for (size_t n = 0; n < xe::countof(map_info); n++) {
+    // The 0x7F... view only holds MMIO ranges, which are trapped in small
+    // pages, so it stays in the main mapping.
+    bool is_physical = physical_mapping_ &&
+                       map_info[n].target_address >= 0x100000000ull &&
+                       map_info[n].virtual_address_start != 0x7F000000;
     views_.all_views[n] = reinterpret_cast<uint8_t*>(xe::memory::MapFileView(
-        mapping_, mapping_base + map_info[n].virtual_address_start,
+        is_physical ? physical_mapping_ : mapping_,
+        mapping_base + map_info[n].virtual_address_start,
         map_info[n].virtual_address_end - map_info[n].virtual_address_start + 1,
-        xe::memory::PageAccess::kReadWrite, map_info[n].target_address));
+        xe::memory::PageAccess::kReadWrite,
+        map_info[n].target_address - (is_physical ? 0x100000000ull : 0),
+        is_physical));
     if (!views_.all_views[n]) {
       // Failed, so bail and try again.
       UnmapViews();
@@ -263,6 +325,21 @@ int Memory::MapViews(uint8_t* mapping_base) {
 
 void Memory::UnmapViews() {
   for (size_t n = 0; n < xe::countof(views_.all_views); n++) {
+    if (&views_.all_views[n] == &views_.v80000000 &&
+        !v80000000_pieces_.empty()) {
+      for (auto& piece : v80000000_pieces_) {
+        xe::memory::UnmapFileView(mapping_, mapping_base_ + piece.first,
+                                  piece.second);
+      }
+      for (auto& view : shared_file_views_) {
+        xe::memory::UnmapFileView(view.second.mapping,
+                                  mapping_base_ + view.first, view.second.size);
+        xe::memory::CloseFileMappingHandle(view.second.mapping);
+      }
+      v80000000_pieces_.clear();
+      shared_file_views_.clear();
+      continue;
+    }
     if (views_.all_views[n]) {
       size_t length = map_info[n].virtual_address_end -
                       map_info[n].virtual_address_start + 1;
@@ -277,6 +354,112 @@ void Memory::Reset() {
   heaps_.v80000000.Reset();
   heaps_.v90000000.Reset();
   heaps_.physical.Reset();
+  ResetSystemPools();
+  std::vector<uint32_t> shared_addresses;
+  {
+    std::lock_guard<std::mutex> lock(shared_file_mutex_);
+    for (auto& view : shared_file_views_) {
+      shared_addresses.push_back(view.first);
+    }
+  }
+  for (uint32_t address : shared_addresses) {
+    UnmapSharedFile(address);
+  }
+}
+
+bool Memory::MapGuestPiece(uint32_t address, uint32_t size) {
+  // The 0x80000000 view is at the same offset of the mapping as its address.
+  return !size ||
+         xe::memory::MapFileView(mapping_, mapping_base_ + address, size,
+                                 xe::memory::PageAccess::kReadWrite,
+                                 address) == mapping_base_ + address;
+}
+
+bool Memory::MapSharedFile(uint32_t address, uint32_t size,
+                           const std::wstring& path, size_t file_offset) {
+  size_t granularity = xe::memory::allocation_granularity();
+  uint64_t end = uint64_t(address) + size;
+  if (!size || address < 0x80000000 || end > 0x90000000 ||
+      address % granularity || size % granularity ||
+      file_offset % granularity) {
+    return false;
+  }
+  std::lock_guard<std::mutex> lock(shared_file_mutex_);
+  if (v80000000_pieces_.empty()) {
+    v80000000_pieces_[0x80000000] = 0x10000000;
+  }
+  auto piece = v80000000_pieces_.upper_bound(address);
+  if (piece == v80000000_pieces_.begin()) {
+    return false;
+  }
+  --piece;
+  uint32_t piece_address = piece->first;
+  uint32_t piece_size = piece->second;
+  uint64_t piece_end = uint64_t(piece_address) + piece_size;
+  if (end > piece_end) {
+    return false;
+  }
+  auto mapping = xe::memory::OpenFileMappingHandle(path);
+  if (!mapping) {
+    return false;
+  }
+
+  // The view can only be mapped where nothing is, so the piece is remapped
+  // around it.
+  xe::memory::UnmapFileView(mapping_, mapping_base_ + piece_address,
+                            piece_size);
+  uint8_t* view = reinterpret_cast<uint8_t*>(xe::memory::MapFileViewCopyOnWrite(
+      mapping, mapping_base_ + address, size, file_offset));
+  bool mapped = view == mapping_base_ + address;
+  bool mapped_before =
+      mapped && MapGuestPiece(piece_address, address - piece_address);
+  bool mapped_after =
+      mapped_before && MapGuestPiece(uint32_t(end), uint32_t(piece_end - end));
+  if (!mapped_after) {
+    if (mapped_before && address > piece_address) {
+      xe::memory::UnmapFileView(mapping_, mapping_base_ + piece_address,
+                                address - piece_address);
+    }
+    if (view) {
+      xe::memory::UnmapFileView(mapping, view, size);
+    }
+    xe::memory::CloseFileMappingHandle(mapping);
+    if (!MapGuestPiece(piece_address, piece_size)) {
+      XELOGE("Unable to remap guest memory at %.8X", piece_address);
+      assert_always();
+    }
+    return false;
+  }
+
+  v80000000_pieces_.erase(piece);
+  if (address > piece_address) {
+    v80000000_pieces_[piece_address] = address - piece_address;
+  }
+  if (end < piece_end) {
+    v80000000_pieces_[uint32_t(end)] = uint32_t(piece_end - end);
+  }
+  shared_file_views_[address] = {size, mapping};
+  return true;
+}
+
+void Memory::UnmapSharedFile(uint32_t address) {
+  std::lock_guard<std::mutex> lock(shared_file_mutex_);
+  auto it = shared_file_views_.find(address);
+  if (it == shared_file_views_.end()) {
+    return;
+  }
+  uint32_t size = it->second.size;
+  xe::memory::UnmapFileView(it->second.mapping, mapping_base_ + address, size);
+  xe::memory::CloseFileMappingHandle(it->second.mapping);
+  shared_file_views_.erase(it);
+  // Left as a piece of its own, as merging it with its neighbors would unmap
+  // them too.
+  if (MapGuestPiece(address, size)) {
+    v80000000_pieces_[address] = size;
+  } else {
+    XELOGE("Unable to remap guest memory at %.8X", address);
+    assert_always();
+  }
 }
 
 BaseHeap* Memory::LookupHeap(uint32_t address) {
@@ -320,40 +503,48 @@ BaseHeap* Memory::LookupHeapByType(bool physical, uint32_t page_size) {
   }
 }
 
+// Transfers larger than this would evict most of the caches, so they bypass
+// them instead.
+const uint32_t kStreamingTransferSize = 1024 * 1024;
+
 void Memory::Zero(uint32_t address, uint32_t size) {
-  std::memset(TranslateVirtual(address), 0, size);
+  Fill(address, size, 0);
 }
 
 void Memory::Fill(uint32_t address, uint32_t size, uint8_t value) {
-  std::memset(TranslateVirtual(address), value, size);
+  if (size >= kStreamingTransferSize) {
+    xe::fill_streaming(TranslateVirtual(address), value, size);
+  } else {
+    std::memset(TranslateVirtual(address), value, size);
+  }
 }
 
 void Memory::Copy(uint32_t dest, uint32_t src, uint32_t size) {
   uint8_t* pdest = TranslateVirtual(dest);
   const uint8_t* psrc = TranslateVirtual(src);
-  std::memcpy(pdest, psrc, size);
+  if (size >= kStreamingTransferSize) {
+    xe::copy_streaming(pdest, psrc, size);
+  } else {
+    std::memcpy(pdest, psrc, size);
+  }
 }
 
 uint32_t Memory::SearchAligned(uint32_t start, uint32_t end,
                                const uint32_t* values, size_t value_count) {
   assert_true(start <= end);
   auto p = TranslateVirtual<const uint32_t*>(start);
-  auto pe = TranslateVirtual<const uint32_t*>(end);
-  while (p != pe) {
-    if (*p == values[0]) {
-      const uint32_t* pc = p + 1;
-      size_t matched = 1;
-      for (size_t n = 1; n < value_count; n++, pc++) {
-        if (*pc != values[n]) {
-          break;
-        }
-        matched++;
-      }
-      if (matched == value_count) {
-        return uint32_t(reinterpret_cast<const uint8_t*>(p) - virtual_membase_);
-      }
+  size_t count = (end - start) / 4;
+  // Only the candidates matching the first value are compared in full.
+  for (size_t i = 0; i < count; ++i) {
+    i += xe::find_first_equal_32(p + i, values[0], count - i);
+    if (i == count) {
+      break;
+    }
+    if (std::memcmp(p + i + 1, values + 1,
+                    (value_count - 1) * sizeof(uint32_t)) == 0) {
+      return uint32_t(reinterpret_cast<const uint8_t*>(p + i) -
+                      virtual_membase_);
     }
-    p++;
   }
   return 0;
 }
@@ -387,14 +578,28 @@ uintptr_t Memory::AddPhysicalAccessWatch(uint32_t physical_address,
                                                callback_data);
 }
 
+uintptr_t Memory::AddVirtualWriteWatch(uint32_t virtual_address,
+                                       uint32_t length,
+                                       cpu::AccessWatchCallback callback,
+                                       void* callback_context,
+                                       void* callback_data) {
+  return mmio_handler_->AddVirtualWriteWatch(virtual_address, length, callback,
+                                             callback_context, callback_data);
+}
+
 void Memory::CancelAccessWatch(uintptr_t watch_handle) {
   mmio_handler_->CancelAccessWatch(watch_handle);
 }
 
 uint32_t Memory::SystemHeapAlloc(uint32_t size, uint32_t alignment,
                                  uint32_t system_heap_flags) {
-  // TODO(benvanik): lightweight pool.
   bool is_physical = !!(system_heap_flags & kSystemHeapPhysical);
+  if (FLAGS_system_heap_pool) {
+    int size_class = GetSystemPoolClass(size, alignment);
+    if (size_class >= 0) {
+      return SystemPoolAlloc(is_physical, size_class, size);
+    }
+  }
   auto heap = LookupHeapByType(is_physical, 4096);
   uint32_t address;
   if (!heap->Alloc(size, alignment,
@@ -407,14 +612,121 @@ uint32_t Memory::SystemHeapAlloc(uint32_t size, uint32_t alignment,
 }
 
 void Memory::SystemHeapFree(uint32_t address) {
-  if (!address) {
+  if (!address || SystemPoolFree(address)) {
     return;
   }
-  // TODO(benvanik): lightweight pool.
   auto heap = LookupHeap(address);
   heap->Release(address);
 }
 
+Memory::SystemPoolCache* Memory::system_pool_cache() {
+  static thread_local SystemPoolCache cache;
+  if (cache.pool_id != system_pool_id_) {
+    std::memset(cache.counts, 0, sizeof(cache.counts));
+    cache.pool_id = system_pool_id_;
+  }
+  return &cache;
+}
+
+int Memory::GetSystemPoolClass(uint32_t size, uint32_t alignment) {
+  uint32_t block_size =
+      std::max({size, alignment, 1u << kSystemPoolMinBlockShift});
+  int size_class = 0;
+  while ((1u << (kSystemPoolMinBlockShift + size_class)) < block_size) {
+    if (++size_class == kSystemPoolClassCount) {
+      return -1;
+    }
+  }
+  return size_class;
+}
+
+uint32_t Memory::SystemPoolAlloc(bool is_physical, int size_class,
+                                 uint32_t size) {
+  uint32_t pool = is_physical ? 1 : 0;
+  auto cache = system_pool_cache();
+  auto& count = cache->counts[pool][size_class];
+  if (!count) {
+    std::lock_guard<std::mutex> lock(system_pool_mutex_);
+    RefillSystemPoolCache(cache, pool, size_class);
+    if (!count) {
+      return 0;
+    }
+  }
+  uint32_t address = cache->blocks[pool][size_class][--count];
+  Zero(address, size);
+  return address;
+}
+
+bool Memory::SystemPoolFree(uint32_t address) {
+  // Slabs are only added under the lock before their blocks are handed out.
+  uint8_t slab = system_pool_slabs_[address / kSystemPoolSlabSize].load(
+      std::memory_order_relaxed);
+  if (!slab) {
+    return false;
+  }
+  uint32_t pool = uint32_t(slab - 1) >> 4;
+  int size_class = (slab - 1) & 0xF;
+  auto cache = system_pool_cache();
+  auto& count = cache->counts[pool][size_class];
+  auto blocks = cache->blocks[pool][size_class];
+  if (count == kSystemPoolCacheSize) {
+    // Half is kept, so alternating allocs and frees don't take the lock.
+    std::lock_guard<std::mutex> lock(system_pool_mutex_);
+    auto& free_blocks = system_pool_free_blocks_[pool][size_class];
+    free_blocks.insert(free_blocks.end(), blocks + kSystemPoolCacheSize / 2,
+                       blocks + kSystemPoolCacheSize);
+    count = kSystemPoolCacheSize / 2;
+  }
+  blocks[count++] = address;
+  return true;
+}
+
+void Memory::RefillSystemPoolCache(SystemPoolCache* cache, uint32_t pool,
+                                   int size_class) {
+  auto& free_blocks = system_pool_free_blocks_[pool][size_class];
+  if (free_blocks.empty()) {
+    auto heap = LookupHeapByType(pool != 0, 4096);
+    uint32_t slab_address;
+    if (!heap->Alloc(kSystemPoolSlabSize, kSystemPoolSlabSize,
+                     kMemoryAllocationReserve | kMemoryAllocationCommit,
+                     kMemoryProtectRead | kMemoryProtectWrite, false,
+                     &slab_address)) {
+      return;
+    }
+    // Pushed in reverse, so the lowest blocks are handed out first.
+    uint32_t block_size = 1u << (kSystemPoolMinBlockShift + size_class);
+    for (uint32_t offset = kSystemPoolSlabSize; offset;) {
+      offset -= block_size;
+      free_blocks.push_back(slab_address + offset);
+    }
+    system_pool_slabs_[slab_address / kSystemPoolSlabSize].store(
+        uint8_t(1 + (pool << 4 | size_class)), std::memory_order_relaxed);
+  }
+  auto& count = cache->counts[pool][size_class];
+  while (count < kSystemPoolCacheSize / 2 && !free_blocks.empty()) {
+    cache->blocks[pool][size_class][count++] = free_blocks.back();
+    free_blocks.pop_back();
+  }
+}
+
+void Memory::ResetSystemPools() {
+  std::lock_guard<std::mutex> lock(system_pool_mutex_);
+  for (auto& pool_free_blocks : system_pool_free_blocks_) {
+    for (auto& free_blocks : pool_free_blocks) {
+      free_blocks.clear();
+    }
+  }
+  const size_t slab_count = 0x100000000ull / kSystemPoolSlabSize;
+  if (!system_pool_slabs_) {
+    system_pool_slabs_.reset(new std::atomic<uint8_t>[slab_count]);
+  }
+  for (size_t i = 0; i < slab_count; ++i) {
+    system_pool_slabs_[i].store(0, std::memory_order_relaxed);
+  }
+  // Blocks cached by threads belong to the dropped slabs.
+  system_pool_id_ = next_system_pool_id_++;
+}
+
 void Memory::DumpMap() {
   XELOGE("==================================================================");
   XELOGE("Memory Dump");
@@ -443,6 +755,92 @@ void Memory::DumpMap() {
   XELOGE("");
 }
 
+std::vector<HeapStats> Memory::QueryHeapStats() {
+  BaseHeap* heaps[] = {
+      &heaps_.v00000000, &heaps_.v40000000, &heaps_.v80000000,
+      &heaps_.v90000000, &heaps_.physical,  &heaps_.vA0000000,
+      &heaps_.vC0000000, &heaps_.vE0000000,
+  };
+  std::vector<HeapStats> stats(xe::countof(heaps));
+  for (size_t i = 0; i < xe::countof(heaps); ++i) {
+    heaps[i]->QueryStats(&stats[i]);
+  }
+  return stats;
+}
+
+void Memory::UpdateProfileCounters() {
+  if (!Profiler::is_enabled()) {
+    return;
+  }
+  auto& counters = profile_counters_;
+  uint64_t now = Clock::QueryHostTickCount();
+  uint64_t elapsed = now - counters.time;
+  if (elapsed >= Clock::host_tick_frequency()) {
+    // The physical address heaps allocate from the physical heap as well,
+    // so only the physical heap counts.
+    HeapStats stats[5];
+    heaps_.v00000000.QueryStats(&stats[0]);
+    heaps_.v40000000.QueryStats(&stats[1]);
+    heaps_.v80000000.QueryStats(&stats[2]);
+    heaps_.v90000000.QueryStats(&stats[3]);
+    heaps_.physical.QueryStats(&stats[4]);
+    uint64_t committed_size[2] = {0, 0};
+    uint64_t reserved_size[2] = {0, 0};
+    uint64_t largest_free_size[2] = {0, 0};
+    uint64_t alloc_count = 0;
+    uint64_t release_count = 0;
+    uint64_t protect_count = 0;
+    for (size_t i = 0; i < xe::countof(stats); ++i) {
+      auto& heap_stats = stats[i];
+      size_t kind = i == 4 ? 1 : 0;
+      committed_size[kind] +=
+          uint64_t(heap_stats.committed_page_count) * heap_stats.page_size;
+      reserved_size[kind] +=
+          uint64_t(heap_stats.reserved_page_count) * heap_stats.page_size;
+      largest_free_size[kind] = std::max(
+          largest_free_size[kind],
+          uint64_t(heap_stats.largest_free_run_page_count) *
+              heap_stats.page_size);
+      alloc_count += heap_stats.alloc_count;
+      release_count += heap_stats.release_count;
+      protect_count += heap_stats.protect_count;
+    }
+    double seconds = double(elapsed) / Clock::host_tick_frequency();
+    counters.virtual_committed_mb = int(committed_size[0] >> 20);
+    counters.virtual_reserved_mb = int(reserved_size[0] >> 20);
+    counters.largest_free_virtual_kb = int(largest_free_size[0] >> 10);
+    counters.physical_committed_mb = int(committed_size[1] >> 20);
+    counters.physical_reserved_mb = int(reserved_size[1] >> 20);
+    counters.largest_free_physical_kb = int(largest_free_size[1] >> 10);
+    counters.allocs_per_second =
+        int((alloc_count - counters.alloc_count) / seconds);
+    counters.releases_per_second =
+        int((release_count - counters.release_count) / seconds);
+    counters.protects_per_second =
+        int((protect_count - counters.protect_count) / seconds);
+    counters.time = now;
+    counters.alloc_count = alloc_count;
+    counters.release_count = release_count;
+    counters.protect_count = protect_count;
+  }
+  COUNT_profile_cpu("memory/virtual_committed_mb",
+                    counters.virtual_committed_mb);
+  COUNT_profile_cpu("memory/virtual_reserved_mb", counters.virtual_reserved_mb);
+  COUNT_profile_cpu("memory/largest_free_virtual_kb",
+                    counters.largest_free_virtual_kb);
+  COUNT_profile_cpu("memory/physical_committed_mb",
+                    counters.physical_committed_mb);
+  COUNT_profile_cpu("memory/physical_reserved_mb",
+                    counters.physical_reserved_mb);
+  COUNT_profile_cpu("memory/largest_free_physical_kb",
+                    counters.largest_free_physical_kb);
+  COUNT_profile_cpu("memory/allocs_per_second", counters.allocs_per_second);
+  COUNT_profile_cpu("memory/releases_per_second",
+                    counters.releases_per_second);
+  COUNT_profile_cpu("memory/protects_per_second",
+                    counters.protects_per_second);
+}
+
 bool Memory::Save(ByteStream* stream) {
   XELOGD("Serializing memory...");
   heaps_.v00000000.Save(stream);
@@ -450,10 +848,57 @@ bool Memory::Save(ByteStream* stream) {
   heaps_.v80000000.Save(stream);
   heaps_.v90000000.Save(stream);
   heaps_.physical.Save(stream);
+  SaveSystemPools(stream);
+  return true;
+}
+
+bool Memory::CanSaveDelta() const {
+  return heaps_.v00000000.has_saved_state() &&
+         heaps_.v40000000.has_saved_state() &&
+         heaps_.v80000000.has_saved_state() &&
+         heaps_.v90000000.has_saved_state() &&
+         heaps_.physical.has_saved_state();
+}
 
+bool Memory::SaveDelta(ByteStream* stream) {
+  XELOGD("Serializing memory delta...");
+  if (!heaps_.v00000000.SaveDelta(stream) ||
+      !heaps_.v40000000.SaveDelta(stream) ||
+      !heaps_.v80000000.SaveDelta(stream) ||
+      !heaps_.v90000000.SaveDelta(stream) ||
+      !heaps_.physical.SaveDelta(stream)) {
+    return false;
+  }
+  SaveSystemPools(stream);
   return true;
 }
 
+void Memory::SaveSystemPools(ByteStream* stream) {
+  // Blocks cached by other threads are saved as allocated.
+  std::lock_guard<std::mutex> lock(system_pool_mutex_);
+  auto cache = system_pool_cache();
+  const uint32_t slab_count = uint32_t(0x100000000ull / kSystemPoolSlabSize);
+  for (uint32_t i = 0; i < slab_count; ++i) {
+    uint8_t slab = system_pool_slabs_[i].load(std::memory_order_relaxed);
+    if (slab) {
+      stream->Write<uint32_t>(i);
+      stream->Write<uint8_t>(slab);
+    }
+  }
+  stream->Write<uint32_t>(UINT32_MAX);
+  for (uint32_t pool = 0; pool < 2; ++pool) {
+    for (uint32_t size_class = 0; size_class < kSystemPoolClassCount;
+         ++size_class) {
+      auto& free_blocks = system_pool_free_blocks_[pool][size_class];
+      uint32_t cached_count = cache->counts[pool][size_class];
+      stream->Write<uint32_t>(uint32_t(free_blocks.size()) + cached_count);
+      stream->Write(free_blocks.data(), free_blocks.size() * sizeof(uint32_t));
+      stream->Write(cache->blocks[pool][size_class],
+                    cached_count * sizeof(uint32_t));
+    }
+  }
+}
+
 bool Memory::Restore(ByteStream* stream) {
   XELOGD("Restoring memory...");
   heaps_.v00000000.Restore(stream);
@@ -461,10 +906,41 @@ bool Memory::Restore(ByteStream* stream) {
   heaps_.v80000000.Restore(stream);
   heaps_.v90000000.Restore(stream);
   heaps_.physical.Restore(stream);
+  RestoreSystemPools(stream);
+  return true;
+}
 
+bool Memory::RestoreDelta(ByteStream* stream) {
+  XELOGD("Restoring memory delta...");
+  if (!heaps_.v00000000.RestoreDelta(stream) ||
+      !heaps_.v40000000.RestoreDelta(stream) ||
+      !heaps_.v80000000.RestoreDelta(stream) ||
+      !heaps_.v90000000.RestoreDelta(stream) ||
+      !heaps_.physical.RestoreDelta(stream)) {
+    return false;
+  }
+  RestoreSystemPools(stream);
   return true;
 }
 
+void Memory::RestoreSystemPools(ByteStream* stream) {
+  ResetSystemPools();
+  std::lock_guard<std::mutex> lock(system_pool_mutex_);
+  uint32_t slab_index;
+  while ((slab_index = stream->Read<uint32_t>()) != UINT32_MAX) {
+    system_pool_slabs_[slab_index].store(stream->Read<uint8_t>(),
+                                         std::memory_order_relaxed);
+  }
+  for (uint32_t pool = 0; pool < 2; ++pool) {
+    for (uint32_t size_class = 0; size_class < kSystemPoolClassCount;
+         ++size_class) {
+      auto& free_blocks = system_pool_free_blocks_[pool][size_class];
+      free_blocks.resize(stream->Read<uint32_t>());
+      stream->Read(free_blocks.data(), free_blocks.size() * sizeof(uint32_t));
+    }
+  }
+}
+
 xe::memory::PageAccess ToPageAccess(uint32_t protect) {
   if ((protect & kMemoryProtectRead) && !(protect & kMemoryProtectWrite)) {
     return xe::memory::PageAccess::kReadOnly;
@@ -487,7 +963,211 @@ void BaseHeap::Initialize(uint8_t* membase, uint32_t heap_base,
   heap_base_ = heap_base;
   heap_size_ = heap_size - 1;
   page_size_ = page_size;
+  host_page_size_ = uint32_t(xe::memory::page_size());
   page_table_.resize(heap_size / page_size);
+  RebuildFreeRuns();
+}
+
+bool BaseHeap::IsHostPageAligned(uint32_t start_page_number,
+                                 uint32_t page_count) const {
+  return (start_page_number * page_size_) % host_page_size_ == 0 &&
+         (page_count * page_size_) % host_page_size_ == 0;
+}
+
+void* BaseHeap::HostAlloc(uint32_t start_page_number, uint32_t page_count,
+                          xe::memory::AllocationType allocation_type,
+                          uint32_t protect) {
+  uint8_t* address = membase_ + heap_base_ + start_page_number * page_size_;
+  size_t length = page_count * page_size_;
+  if (host_page_size_ == xe::memory::page_size()) {
+    return xe::memory::AllocFixed(address, length, allocation_type,
+                                  ToPageAccess(protect));
+  }
+
+  // Large pages are always committed, but the host pages only partly
+  // allocated must stay accessible for the rest.
+  auto access = memory::PageAccess::kReadWrite;
+  if (IsHostPageAligned(start_page_number, page_count)) {
+    access = ToPageAccess(protect);
+  } else {
+    size_t start = heap_base_ + start_page_number * page_size_;
+    size_t end = start + length;
+    start -= start % host_page_size_;
+    end = xe::round_up(end, size_t(host_page_size_));
+    address = membase_ + start;
+    length = end - start;
+  }
+  if (!xe::memory::Protect(address, length, access, nullptr)) {
+    return nullptr;
+  }
+  return membase_ + heap_base_ + start_page_number * page_size_;
+}
+
+uint32_t BaseHeap::FindFreePages(uint32_t low_page_number,
+                                 uint32_t high_page_number,
+                                 uint32_t page_count, uint32_t page_stride,
+                                 bool top_down, bool best_fit) {
+  // The first aligned page of the run (or last, if top_down) that fits.
+  auto fit = [&](uint32_t run_start, uint32_t run_end) -> uint32_t {
+    run_start = std::max(run_start, low_page_number);
+    run_end = std::min(run_end, high_page_number);
+    if (run_end <= run_start || run_end - run_start < page_count) {
+      return UINT32_MAX;
+    }
+    uint32_t base_page_number;
+    if (top_down) {
+      base_page_number = run_end - page_count;
+      base_page_number -= base_page_number % page_stride;
+      return base_page_number >= run_start ? base_page_number : UINT32_MAX;
+    }
+    base_page_number =
+        (run_start + page_stride - 1) / page_stride * page_stride;
+    return base_page_number <= run_end - page_count ? base_page_number
+                                                    : UINT32_MAX;
+  };
+
+  if (best_fit && !top_down) {
+    // Runs at least a stride longer than needed always fit, so only a few
+    // shorter ones are skipped for their alignment.
+    for (auto it = free_runs_by_size_.lower_bound({page_count, 0});
+         it != free_runs_by_size_.end(); ++it) {
+      uint32_t base_page_number = fit(it->second, it->second + it->first);
+      if (base_page_number != UINT32_MAX) {
+        return base_page_number;
+      }
+    }
+    return UINT32_MAX;
+  }
+
+  if (top_down) {
+    auto it = free_runs_.lower_bound(high_page_number);
+    while (it != free_runs_.begin()) {
+      --it;
+      if (it->first + it->second <= low_page_number) {
+        break;
+      }
+      uint32_t base_page_number = fit(it->first, it->first + it->second);
+      if (base_page_number != UINT32_MAX) {
+        return base_page_number;
+      }
+    }
+    return UINT32_MAX;
+  }
+
+  // The run before the first one starting after the low page may cover it.
+  auto it = free_runs_.upper_bound(low_page_number);
+  if (it != free_runs_.begin()) {
+    --it;
+  }
+  for (; it != free_runs_.end() && it->first < high_page_number; ++it) {
+    uint32_t base_page_number = fit(it->first, it->first + it->second);
+    if (base_page_number != UINT32_MAX) {
+      return base_page_number;
+    }
+  }
+  return UINT32_MAX;
+}
+
+void BaseHeap::MarkPagesFree(uint32_t start_page_number,
+                             uint32_t page_count) {
+  // Coalesced with the runs it overlaps or touches.
+  uint32_t run_start = start_page_number;
+  uint32_t run_end = start_page_number + page_count;
+  auto it = free_runs_.upper_bound(run_start);
+  if (it != free_runs_.begin()) {
+    auto previous = std::prev(it);
+    if (previous->first + previous->second >= run_start) {
+      it = previous;
+    }
+  }
+  while (it != free_runs_.end() && it->first <= run_end) {
+    run_start = std::min(run_start, it->first);
+    run_end = std::max(run_end, it->first + it->second);
+    free_runs_by_size_.erase({it->second, it->first});
+    it = free_runs_.erase(it);
+  }
+  free_runs_.emplace(run_start, run_end - run_start);
+  free_runs_by_size_.emplace(run_end - run_start, run_start);
+}
+
+void BaseHeap::MarkPagesUsed(uint32_t start_page_number,
+                             uint32_t page_count) {
+  uint32_t end_page_number = start_page_number + page_count;
+  auto it = free_runs_.upper_bound(start_page_number);
+  if (it != free_runs_.begin()) {
+    auto previous = std::prev(it);
+    if (previous->first + previous->second > start_page_number) {
+      it = previous;
+    }
+  }
+  while (it != free_runs_.end() && it->first < end_page_number) {
+    uint32_t run_start = it->first;
+    uint32_t run_end = it->first + it->second;
+    free_runs_by_size_.erase({it->second, it->first});
+    it = free_runs_.erase(it);
+    // Keep the parts of the run outside of the range.
+    if (run_start < start_page_number) {
+      free_runs_.emplace(run_start, start_page_number - run_start);
+      free_runs_by_size_.emplace(start_page_number - run_start, run_start);
+    }
+    if (run_end > end_page_number) {
+      it = free_runs_.emplace(end_page_number, run_end - end_page_number)
+               .first;
+      free_runs_by_size_.emplace(run_end - end_page_number, end_page_number);
+      break;
+    }
+  }
+}
+
+void BaseHeap::RebuildFreeRuns() {
+  free_runs_.clear();
+  free_runs_by_size_.clear();
+  uint32_t page_count = uint32_t(page_table_.size());
+  for (uint32_t page_number = 0; page_number < page_count;) {
+    if (page_table_[page_number].state) {
+      ++page_number;
+      continue;
+    }
+    uint32_t run_start = page_number;
+    while (page_number < page_count && !page_table_[page_number].state) {
+      ++page_number;
+    }
+    free_runs_.emplace(run_start, page_number - run_start);
+    free_runs_by_size_.emplace(page_number - run_start, run_start);
+  }
+  page_run_starts_.clear();
+  UpdatePageRuns(0, page_count);
+}
+
+static bool IsSamePageRun(const PageEntry& a, const PageEntry& b) {
+  return a.base_address == b.base_address && a.state == b.state &&
+         a.current_protect == b.current_protect;
+}
+
+void BaseHeap::UpdatePageRuns(uint32_t start_page_number,
+                              uint32_t page_count) {
+  // The pages after the first and the page after them may start runs.
+  uint32_t first_page_number = std::max(start_page_number, 1u);
+  uint32_t last_page_number = std::min(start_page_number + page_count,
+                                       uint32_t(page_table_.size()) - 1);
+  if (first_page_number > last_page_number) {
+    return;
+  }
+  auto next_start = page_run_starts_.erase(
+      page_run_starts_.lower_bound(first_page_number),
+      page_run_starts_.upper_bound(last_page_number));
+  for (uint32_t page_number = first_page_number;
+       page_number <= last_page_number; ++page_number) {
+    if (!IsSamePageRun(page_table_[page_number - 1],
+                       page_table_[page_number])) {
+      page_run_starts_.insert(next_start, page_number);
+    }
+  }
+}
+
+uint32_t BaseHeap::GetPageRunEnd(uint32_t page_number) const {
+  auto it = page_run_starts_.upper_bound(page_number);
+  return it != page_run_starts_.end() ? *it : uint32_t(page_table_.size());
 }
 
 void BaseHeap::Dispose() {
@@ -503,6 +1183,33 @@ void BaseHeap::Dispose() {
   }
 }
 
+void BaseHeap::QueryStats(HeapStats* out_stats) {
+  auto global_lock = global_critical_region_.Acquire();
+  out_stats->heap_base = heap_base_;
+  out_stats->heap_size = heap_size_ + 1;
+  out_stats->page_size = page_size_;
+  uint32_t page_count = uint32_t(page_table_.size());
+  uint32_t free_page_count = 0;
+  for (auto& free_run : free_runs_) {
+    free_page_count += free_run.second;
+  }
+  out_stats->reserved_page_count = page_count - free_page_count;
+  out_stats->committed_page_count = 0;
+  for (uint32_t page_number = 0; page_number < page_count;) {
+    uint32_t run_end = GetPageRunEnd(page_number);
+    if (page_table_[page_number].state & kMemoryAllocationCommit) {
+      out_stats->committed_page_count += run_end - page_number;
+    }
+    page_number = run_end;
+  }
+  out_stats->largest_free_run_page_count =
+      free_runs_by_size_.empty() ? 0 : free_runs_by_size_.rbegin()->first;
+  out_stats->free_run_count = uint32_t(free_runs_.size());
+  out_stats->alloc_count = alloc_count_;
+  out_stats->release_count = release_count_;
+  out_stats->protect_count = protect_count_;
+}
+
 void BaseHeap::DumpMap() {
   auto global_lock = global_critical_region_.Acquire();
   XELOGE("------------------------------------------------------------------");
@@ -551,81 +1258,320 @@ void BaseHeap::DumpMap() {
   }
 }
 
-bool BaseHeap::Save(ByteStream* stream) {
-  XELOGD("Heap %.8X-%.8X", heap_base_, heap_base_ + heap_size_);
+// Saved chunks cover about this much memory, or a page if they are larger.
+const uint32_t kSaveChunkSize = 1024 * 1024;
+// Chunks covering about this much memory are compressed at once.
+const uint32_t kSaveBatchSize = 64 * 1024 * 1024;
+
+enum class SavedPage : uint8_t {
+  kNotCommitted = 0,
+  kZero = 1,
+  kData = 2,
+  // Only in deltas, for pages committed with the same data before.
+  kUnchanged = 3,
+};
 
-  for (size_t i = 0; i < page_table_.size(); i++) {
-    auto& page = page_table_[i];
-    stream->Write(page.qword);
-    if (!page.state) {
-      // Unallocated.
-      continue;
+// Calls the function with the host range made readable, if parts of it
+// weren't, such as by access watches, restoring their protection after.
+static void WithReadableRange(uint8_t* address, size_t length,
+                              const std::function<void()>& function) {
+  std::vector<std::pair<uint8_t*, size_t>> unreadable_regions;
+  for (size_t offset = 0; offset < length;) {
+    size_t region_length = length - offset;
+    auto access = memory::PageAccess::kNoAccess;
+    if (!memory::QueryProtect(address + offset, region_length, access) ||
+        !region_length) {
+      region_length = length - offset;
+    }
+    region_length = std::min(region_length, length - offset);
+    if (access == memory::PageAccess::kNoAccess) {
+      memory::Protect(address + offset, region_length,
+                      memory::PageAccess::kReadOnly, nullptr);
+      unreadable_regions.emplace_back(address + offset, region_length);
     }
+    offset += region_length;
+  }
+  function();
+  for (auto& region : unreadable_regions) {
+    memory::Protect(region.first, region.second,
+                    memory::PageAccess::kNoAccess, nullptr);
+  }
+}
 
-    // TODO(DrChat): write compressed with snappy.
-    if (page.state & kMemoryAllocationCommit) {
-      void* addr = membase_ + heap_base_ + i * page_size_;
+bool BaseHeap::Save(ByteStream* stream) {
+  XELOGD("Heap %.8X-%.8X", heap_base_, heap_base_ + heap_size_);
+  stream->Write(page_table_.data(), page_table_.size() * sizeof(PageEntry));
+  return SavePages(stream, false);
+}
 
-      memory::PageAccess old_access;
-      memory::Protect(addr, page_size_, memory::PageAccess::kReadWrite,
-                      &old_access);
+bool BaseHeap::SaveDelta(ByteStream* stream) {
+  XELOGD("Heap %.8X-%.8X delta", heap_base_, heap_base_ + heap_size_);
+  if (saved_page_table_.size() != page_table_.size()) {
+    XELOGE("BaseHeap::SaveDelta without a previous save or restore");
+    return false;
+  }
 
-      stream->Write(addr, page_size_);
+  // The changed page table entries, as indices and entries, ending with
+  // UINT32_MAX.
+  for (uint32_t i = 0; i < page_table_.size(); ++i) {
+    if (page_table_[i].qword != saved_page_table_[i].qword) {
+      stream->Write<uint32_t>(i);
+      stream->Write<uint64_t>(page_table_[i].qword);
+    }
+  }
+  stream->Write<uint32_t>(UINT32_MAX);
+  return SavePages(stream, true);
+}
 
-      memory::Protect(addr, page_size_, old_access, nullptr);
+bool BaseHeap::SavePages(ByteStream* stream, bool delta) {
+  saved_page_hashes_.resize(page_table_.size());
+  uint32_t chunk_page_count = std::max(1u, kSaveChunkSize / page_size_);
+  uint32_t page_count = uint32_t(page_table_.size());
+  size_t chunk_count = (page_count + chunk_page_count - 1) / chunk_page_count;
+  // Chunks are compressed a batch at a time and written to the stream before
+  // the next batch, so that only a batch is ever held in host memory rather
+  // than a copy of the whole heap.
+  size_t batch_chunk_count = std::max(
+      size_t(1), size_t(kSaveBatchSize / (chunk_page_count * page_size_)));
+  std::vector<std::vector<char>> chunks(
+      std::min(batch_chunk_count, chunk_count));
+  std::vector<size_t> raw_sizes(chunks.size());
+  for (size_t batch_start = 0; batch_start < chunk_count;
+       batch_start += batch_chunk_count) {
+    size_t batch_count = std::min(batch_chunk_count, chunk_count - batch_start);
+    xe::threading::ParallelFor(
+        "Memory Save/Restore", batch_count, [&](size_t batch_index) {
+          uint32_t start_page_number =
+              uint32_t(batch_start + batch_index) * chunk_page_count;
+          uint32_t chunk_pages =
+              std::min(chunk_page_count, page_count - start_page_number);
+          chunks[batch_index] = SaveChunk(start_page_number, chunk_pages,
+                                          delta, &raw_sizes[batch_index]);
+        });
+
+    // Each chunk is its uncompressed and compressed sizes, then the data.
+    for (size_t i = 0; i < batch_count; ++i) {
+      stream->Write<uint32_t>(uint32_t(raw_sizes[i]));
+      stream->Write<uint32_t>(uint32_t(chunks[i].size()));
+      stream->Write(chunks[i].data(), chunks[i].size());
+      std::vector<char>().swap(chunks[i]);
     }
   }
+  saved_page_table_ = page_table_;
 
   return true;
 }
 
+std::vector<char> BaseHeap::SaveChunk(uint32_t start_page_number,
+                                      uint32_t page_count, bool delta,
+                                      size_t* out_raw_size) {
+  // A SavedPage per page, then the data of the kData pages.
+  std::vector<char> raw(page_count, char(SavedPage::kNotCommitted));
+  bool changed = false;
+  uint32_t end_page_number = start_page_number + page_count;
+  for (uint32_t page_number = start_page_number;
+       page_number < end_page_number;) {
+    if (!(page_table_[page_number].state & kMemoryAllocationCommit)) {
+      ++page_number;
+      continue;
+    }
+    uint32_t run_start = page_number;
+    while (page_number < end_page_number &&
+           (page_table_[page_number].state & kMemoryAllocationCommit)) {
+      ++page_number;
+    }
+    uint8_t* run_address = membase_ + heap_base_ + run_start * page_size_;
+    uint32_t run_end = page_number;
+    WithReadableRange(
+        run_address, (run_end - run_start) * page_size_, [&]() {
+          size_t word_count = page_size_ / 4;
+          for (uint32_t i = run_start; i < run_end; ++i) {
+            const uint8_t* page_data =
+                run_address + (i - run_start) * page_size_;
+            auto& flag = raw[i - start_page_number];
+            uint64_t hash = XXH64(page_data, page_size_, 0);
+            if (delta &&
+                (saved_page_table_[i].state & kMemoryAllocationCommit) &&
+                saved_page_hashes_[i] == hash) {
+              flag = char(SavedPage::kUnchanged);
+              continue;
+            }
+            saved_page_hashes_[i] = hash;
+            changed = true;
+            if (xe::count_equal_32(page_data, 0, word_count) == word_count) {
+              flag = char(SavedPage::kZero);
+            } else {
+              flag = char(SavedPage::kData);
+              raw.insert(raw.end(), page_data, page_data + page_size_);
+            }
+          }
+        });
+  }
+
+  // Chunks without changed pages are empty in deltas.
+  if (delta && !changed) {
+    *out_raw_size = 0;
+    return {};
+  }
+  *out_raw_size = raw.size();
+  std::vector<char> compressed(snappy::MaxCompressedLength(raw.size()));
+  size_t compressed_length = 0;
+  snappy::RawCompress(raw.data(), raw.size(), compressed.data(),
+                      &compressed_length);
+  compressed.resize(compressed_length);
+  return compressed;
+}
+
 bool BaseHeap::Restore(ByteStream* stream) {
   XELOGD("Heap %.8X-%.8X", heap_base_, heap_base_ + heap_size_);
+  stream->Read(page_table_.data(), page_table_.size() * sizeof(PageEntry));
+  return RestorePages(stream, false);
+}
 
-  for (size_t i = 0; i < page_table_.size(); i++) {
-    auto& page = page_table_[i];
-    page.qword = stream->Read<uint64_t>();
-    if (!page.state) {
-      // Unallocated.
-      continue;
-    }
+bool BaseHeap::RestoreDelta(ByteStream* stream) {
+  XELOGD("Heap %.8X-%.8X delta", heap_base_, heap_base_ + heap_size_);
+  if (saved_page_table_.size() != page_table_.size()) {
+    XELOGE("BaseHeap::RestoreDelta without a previous restore");
+    return false;
+  }
 
-    memory::PageAccess page_access = memory::PageAccess::kNoAccess;
-    if ((page.current_protect & kMemoryProtectRead) &&
-        (page.current_protect & kMemoryProtectWrite)) {
-      page_access = memory::PageAccess::kReadWrite;
-    } else if (page.current_protect & kMemoryProtectRead) {
-      page_access = memory::PageAccess::kReadOnly;
+  uint32_t page_number;
+  while ((page_number = stream->Read<uint32_t>()) != UINT32_MAX) {
+    if (page_number >= page_table_.size()) {
+      XELOGE("BaseHeap::RestoreDelta read an invalid page %u", page_number);
+      return false;
     }
-
-    // Commit the memory if it isn't already. We do not need to reserve any
-    // memory, as the mapping has already taken care of that.
-    if (page.state & kMemoryAllocationCommit) {
-      xe::memory::AllocFixed(membase_ + heap_base_ + i * page_size_, page_size_,
-                             memory::AllocationType::kCommit,
-                             memory::PageAccess::kReadWrite);
+    auto& page = page_table_[page_number];
+    bool was_committed = (page.state & kMemoryAllocationCommit) != 0;
+    page.qword = stream->Read<uint64_t>();
+    if (was_committed && !(page.state & kMemoryAllocationCommit) &&
+        host_page_size_ == xe::memory::page_size()) {
+      xe::memory::DeallocFixed(
+          membase_ + heap_base_ + page_number * page_size_, page_size_,
+          xe::memory::DeallocationType::kDecommit);
     }
+  }
+  return RestorePages(stream, true);
+}
 
-    // Now read into memory. We'll set R/W protection first, then set the
-    // protection back to its previous state.
-    // TODO(DrChat): read compressed with snappy.
-    if (page.state & kMemoryAllocationCommit) {
-      void* addr = membase_ + heap_base_ + i * page_size_;
-      xe::memory::Protect(addr, page_size_, memory::PageAccess::kReadWrite,
-                          nullptr);
+bool BaseHeap::RestorePages(ByteStream* stream, bool delta) {
+  struct Chunk {
+    const char* data;
+    size_t size;
+    size_t raw_size;
+  };
+  uint32_t chunk_page_count = std::max(1u, kSaveChunkSize / page_size_);
+  uint32_t page_count = uint32_t(page_table_.size());
+  size_t chunk_count = (page_count + chunk_page_count - 1) / chunk_page_count;
+  std::vector<Chunk> chunks(chunk_count);
+  for (auto& chunk : chunks) {
+    chunk.raw_size = stream->Read<uint32_t>();
+    chunk.size = stream->Read<uint32_t>();
+    chunk.data = reinterpret_cast<const char*>(stream->data()) +
+                 stream->offset();
+    stream->Advance(chunk.size);
+  }
 
-      stream->Read(addr, page_size_);
+  saved_page_hashes_.resize(page_table_.size());
+  std::atomic<bool> succeeded(true);
+  xe::threading::ParallelFor(
+      "Memory Save/Restore", chunk_count, [&](size_t chunk_index) {
+        uint32_t start_page_number = uint32_t(chunk_index) * chunk_page_count;
+        uint32_t chunk_pages =
+            std::min(chunk_page_count, page_count - start_page_number);
+        auto& chunk = chunks[chunk_index];
+        if (!RestoreChunk(start_page_number, chunk_pages, delta, chunk.data,
+                          chunk.size, chunk.raw_size)) {
+          succeeded = false;
+        }
+      });
+  saved_page_table_ = page_table_;
+  RebuildFreeRuns();
 
-      xe::memory::Protect(addr, page_size_, page_access, nullptr);
-    }
+  if (!succeeded) {
+    XELOGE("BaseHeap::Restore failed to decompress saved pages");
+    saved_page_table_.clear();
+    return false;
   }
+  return true;
+}
 
+bool BaseHeap::RestoreChunk(uint32_t start_page_number, uint32_t page_count,
+                            bool delta, const char* data, size_t size,
+                            size_t raw_size) {
+  std::vector<char> raw;
+  if (delta && !raw_size) {
+    raw.resize(page_count, char(SavedPage::kUnchanged));
+  } else {
+    raw.resize(raw_size);
+    if (raw_size < page_count ||
+        !snappy::RawUncompress(data, size, raw.data())) {
+      return false;
+    }
+  }
+  const char* page_data = raw.data() + page_count;
+  const char* raw_end = raw.data() + raw.size();
+
+  uint32_t end_page_number = start_page_number + page_count;
+  for (uint32_t page_number = start_page_number;
+       page_number < end_page_number;) {
+    if (!(page_table_[page_number].state & kMemoryAllocationCommit)) {
+      ++page_number;
+      continue;
+    }
+    // Runs of pages with the same protection are committed, filled and
+    // protected at once.
+    uint32_t run_start = page_number;
+    uint32_t protect = page_table_[page_number].current_protect;
+    while (page_number < end_page_number &&
+           (page_table_[page_number].state & kMemoryAllocationCommit) &&
+           page_table_[page_number].current_protect == protect) {
+      ++page_number;
+    }
+    // We do not need to reserve any memory, as the mapping has already
+    // taken care of that.
+    uint8_t* run_address = membase_ + heap_base_ + run_start * page_size_;
+    size_t run_length = (page_number - run_start) * page_size_;
+    HostAlloc(run_start, page_number - run_start,
+              memory::AllocationType::kCommit,
+              kMemoryProtectRead | kMemoryProtectWrite);
+    xe::memory::Protect(run_address, run_length,
+                        memory::PageAccess::kReadWrite, nullptr);
+    for (uint32_t i = run_start; i < page_number; ++i) {
+      uint8_t* address = run_address + (i - run_start) * page_size_;
+      auto flag = SavedPage(raw[i - start_page_number]);
+      if (flag == SavedPage::kUnchanged) {
+        // Deltas only leave pages unchanged that were already committed.
+        if (!delta || !(saved_page_table_[i].state & kMemoryAllocationCommit)) {
+          return false;
+        }
+        continue;
+      }
+      if (flag != SavedPage::kData) {
+        std::memset(address, 0, page_size_);
+      } else {
+        if (raw_end - page_data < ptrdiff_t(page_size_)) {
+          return false;
+        }
+        std::memcpy(address, page_data, page_size_);
+        page_data += page_size_;
+      }
+      saved_page_hashes_[i] = XXH64(address, page_size_, 0);
+    }
+    if (IsHostPageAligned(run_start, page_number - run_start)) {
+      xe::memory::Protect(run_address, run_length, ToPageAccess(protect),
+                          nullptr);
+    }
+  }
   return true;
 }
 
 void BaseHeap::Reset() {
   // TODO(DrChat): protect pages.
   std::memset(page_table_.data(), 0, sizeof(PageEntry) * page_table_.size());
+  saved_page_table_.clear();
+  saved_page_hashes_.clear();
+  RebuildFreeRuns();
 }
 
 bool BaseHeap::Alloc(uint32_t size, uint32_t alignment,
@@ -650,7 +1596,7 @@ bool BaseHeap::AllocFixed(uint32_t base_address, uint32_t size,
   uint32_t start_page_number = (base_address - heap_base_) / page_size_;
   uint32_t end_page_number = start_page_number + page_count - 1;
   if (start_page_number >= page_table_.size() ||
-      end_page_number > page_table_.size()) {
+      end_page_number >= page_table_.size()) {
     XELOGE("BaseHeap::AllocFixed passed out of range address range");
     return false;
   }
@@ -688,9 +1634,8 @@ bool BaseHeap::AllocFixed(uint32_t base_address, uint32_t size,
     auto alloc_type = (allocation_type & kMemoryAllocationCommit)
                           ? xe::memory::AllocationType::kCommit
                           : xe::memory::AllocationType::kReserve;
-    void* result = xe::memory::AllocFixed(
-        membase_ + heap_base_ + start_page_number * page_size_,
-        page_count * page_size_, alloc_type, ToPageAccess(protect));
+    void* result =
+        HostAlloc(start_page_number, page_count, alloc_type, protect);
     if (!result) {
       XELOGE("BaseHeap::AllocFixed failed to alloc range from host");
       return false;
@@ -714,6 +1659,9 @@ bool BaseHeap::AllocFixed(uint32_t base_address, uint32_t size,
     page_entry.current_protect = protect;
     page_entry.state = kMemoryAllocationReserve | allocation_type;
   }
+  MarkPagesUsed(start_page_number, page_count);
+  UpdatePageRuns(start_page_number, page_count);
+  ++alloc_count_;
 
   return true;
 }
@@ -724,6 +1672,8 @@ bool BaseHeap::AllocRange(uint32_t low_address, uint32_t high_address,
                           bool top_down, uint32_t* out_address) {
   *out_address = 0;
 
+  bool whole_heap =
+      low_address <= heap_base_ && high_address >= heap_base_ + heap_size_;
   alignment = xe::round_up(alignment, page_size_);
   uint32_t page_count = get_page_count(size, page_size_);
   low_address = std::max(heap_base_, xe::align(low_address, alignment));
@@ -743,90 +1693,19 @@ bool BaseHeap::AllocRange(uint32_t low_address, uint32_t high_address,
   auto global_lock = global_critical_region_.Acquire();
 
   // Find a free page range.
-  // The base page must match the requested alignment, so we first scan for
-  // a free aligned page and only then check for continuous free pages.
-  // TODO(benvanik): optimized searching (free list buckets, bitmap, etc).
-  uint32_t start_page_number = UINT_MAX;
-  uint32_t end_page_number = UINT_MAX;
+  // The base page must match the requested alignment.
   uint32_t page_scan_stride = alignment / page_size_;
   high_page_number = high_page_number - (high_page_number % page_scan_stride);
-  if (top_down) {
-    for (int64_t base_page_number = high_page_number - page_count;
-         base_page_number >= low_page_number;
-         base_page_number -= page_scan_stride) {
-      if (page_table_[base_page_number].state != 0) {
-        // Base page not free, skip to next usable page.
-        continue;
-      }
-      // Check requested range to ensure free.
-      start_page_number = uint32_t(base_page_number);
-      end_page_number = uint32_t(base_page_number) + page_count - 1;
-      assert_true(end_page_number < page_table_.size());
-      bool any_taken = false;
-      for (uint32_t page_number = uint32_t(base_page_number);
-           !any_taken && page_number <= end_page_number; ++page_number) {
-        bool is_free = page_table_[page_number].state == 0;
-        if (!is_free) {
-          // At least one page in the range is used, skip to next.
-          // We know we'll be starting at least before this page.
-          any_taken = true;
-          if (page_count > page_number) {
-            // Not enough space left to fit entire page range. Breaks outer
-            // loop.
-            base_page_number = -1;
-          } else {
-            base_page_number = page_number - page_count;
-            base_page_number -= base_page_number % page_scan_stride;
-            base_page_number += page_scan_stride;  // cancel out loop logic
-          }
-          break;
-        }
-      }
-      if (!any_taken) {
-        // Found our place.
-        break;
-      }
-      // Retry.
-      start_page_number = end_page_number = UINT_MAX;
-    }
-  } else {
-    for (uint32_t base_page_number = low_page_number;
-         base_page_number <= high_page_number - page_count;
-         base_page_number += page_scan_stride) {
-      if (page_table_[base_page_number].state != 0) {
-        // Base page not free, skip to next usable page.
-        continue;
-      }
-      // Check requested range to ensure free.
-      start_page_number = base_page_number;
-      end_page_number = base_page_number + page_count - 1;
-      bool any_taken = false;
-      for (uint32_t page_number = base_page_number;
-           !any_taken && page_number <= end_page_number; ++page_number) {
-        bool is_free = page_table_[page_number].state == 0;
-        if (!is_free) {
-          // At least one page in the range is used, skip to next.
-          // We know we'll be starting at least after this page.
-          any_taken = true;
-          base_page_number = xe::round_up(page_number + 1, page_scan_stride);
-          base_page_number -= page_scan_stride;  // cancel out loop logic
-          break;
-        }
-      }
-      if (!any_taken) {
-        // Found our place.
-        break;
-      }
-      // Retry.
-      start_page_number = end_page_number = UINT_MAX;
-    }
-  }
-  if (start_page_number == UINT_MAX || end_page_number == UINT_MAX) {
+  uint32_t start_page_number =
+      FindFreePages(low_page_number, high_page_number, page_count,
+                    page_scan_stride, top_down, whole_heap);
+  if (start_page_number == UINT32_MAX) {
     // Out of memory.
     XELOGE("BaseHeap::Alloc failed to find contiguous range");
     assert_always("Heap exhausted!");
     return false;
   }
+  uint32_t end_page_number = start_page_number + page_count - 1;
 
   // Allocate from host.
   if (allocation_type == kMemoryAllocationReserve) {
@@ -835,9 +1714,8 @@ bool BaseHeap::AllocRange(uint32_t low_address, uint32_t high_address,
     auto alloc_type = (allocation_type & kMemoryAllocationCommit)
                           ? xe::memory::AllocationType::kCommit
                           : xe::memory::AllocationType::kReserve;
-    void* result = xe::memory::AllocFixed(
-        membase_ + heap_base_ + start_page_number * page_size_,
-        page_count * page_size_, alloc_type, ToPageAccess(protect));
+    void* result =
+        HostAlloc(start_page_number, page_count, alloc_type, protect);
     if (!result) {
       XELOGE("BaseHeap::Alloc failed to alloc range from host");
       return false;
@@ -858,6 +1736,9 @@ bool BaseHeap::AllocRange(uint32_t low_address, uint32_t high_address,
     page_entry.current_protect = protect;
     page_entry.state = kMemoryAllocationReserve | allocation_type;
   }
+  MarkPagesUsed(start_page_number, page_count);
+  UpdatePageRuns(start_page_number, page_count);
+  ++alloc_count_;
 
   *out_address = heap_base_ + (start_page_number * page_size_);
   return true;
@@ -873,6 +1754,11 @@ bool BaseHeap::Decommit(uint32_t address, uint32_t size) {
 
   auto global_lock = global_critical_region_.Acquire();
 
+  // Code in the range is going away.
+  cpu::MMIOHandler::global_handler()->InvalidateVirtualRange(
+      heap_base_ + start_page_number * page_size_,
+      (end_page_number - start_page_number + 1) * page_size_);
+
   // Release from host.
   // TODO(benvanik): find a way to actually decommit memory;
   //     mapped memory cannot be decommitted.
@@ -890,6 +1776,7 @@ bool BaseHeap::Decommit(uint32_t address, uint32_t size) {
     auto& page_entry = page_table_[page_number];
     page_entry.state &= ~kMemoryAllocationCommit;
   }
+  UpdatePageRuns(start_page_number, end_page_number - start_page_number + 1);
 
   return true;
 }
@@ -909,6 +1796,11 @@ bool BaseHeap::Release(uint32_t base_address, uint32_t* out_region_size) {
     *out_region_size = (base_page_entry.region_page_count * page_size_);
   }
 
+  // Code in the region is going away.
+  cpu::MMIOHandler::global_handler()->InvalidateVirtualRange(
+      heap_base_ + base_page_number * page_size_,
+      base_page_entry.region_page_count * page_size_);
+
   // Release from host not needed as mapping reserves the range for us.
   // TODO(benvanik): protect with NOACCESS?
   /*BOOL result = VirtualFree(
@@ -918,11 +1810,7 @@ bool BaseHeap::Release(uint32_t base_address, uint32_t* out_region_size) {
     return false;
   }*/
   // Instead, we just protect it, if we can.
-  if (page_size_ == xe::memory::page_size() ||
-      ((base_page_entry.region_page_count * page_size_) %
-               xe::memory::page_size() ==
-           0 &&
-       ((base_page_number * page_size_) % xe::memory::page_size() == 0))) {
+  if (IsHostPageAligned(base_page_number, base_page_entry.region_page_count)) {
     // TODO(benvanik): figure out why games are using memory after releasing it.
     // It's possible this is some virtual/physical stuff where the GPU still can
     // access it.
@@ -944,6 +1832,9 @@ bool BaseHeap::Release(uint32_t base_address, uint32_t* out_region_size) {
     auto& page_entry = page_table_[page_number];
     page_entry.qword = 0;
   }
+  MarkPagesFree(base_page_number, base_page_entry.region_page_count);
+  UpdatePageRuns(base_page_number, base_page_entry.region_page_count);
+  ++release_count_;
 
   return true;
 }
@@ -958,14 +1849,14 @@ bool BaseHeap::Protect(uint32_t address, uint32_t size, uint32_t protect) {
 
   auto global_lock = global_critical_region_.Acquire();
 
-  // Ensure all pages are in the same reserved region and all are committed.
-  uint32_t first_base_address = UINT_MAX;
+  // Ensure all pages are in the same reserved region and all are committed,
+  // checking each run of pages once.
+  uint32_t first_base_address = page_table_[start_page_number].base_address;
+  bool unchanged = true;
   for (uint32_t page_number = start_page_number; page_number <= end_page_number;
-       ++page_number) {
+       page_number = GetPageRunEnd(page_number)) {
     auto page_entry = page_table_[page_number];
-    if (first_base_address == UINT_MAX) {
-      first_base_address = page_entry.base_address;
-    } else if (first_base_address != page_entry.base_address) {
+    if (first_base_address != page_entry.base_address) {
       XELOGE("BaseHeap::Protect failed due to request spanning regions");
       return false;
     }
@@ -973,13 +1864,21 @@ bool BaseHeap::Protect(uint32_t address, uint32_t size, uint32_t protect) {
       XELOGE("BaseHeap::Protect failed due to uncommitted page");
       return false;
     }
+    unchanged = unchanged && page_entry.current_protect == protect;
+  }
+  // Games often protect pages again the way they already are.
+  if (unchanged) {
+    return true;
   }
 
+  // Titles make code writable to modify it, and the access restored once the
+  // watches are gone would undo the change.
+  cpu::MMIOHandler::global_handler()->InvalidateVirtualRange(
+      heap_base_ + start_page_number * page_size_, page_count * page_size_);
+
   // Attempt host change (hopefully won't fail).
-  // We can only do this if our size matches system page granularity.
-  if (page_size_ == xe::memory::page_size() ||
-      (((page_count * page_size_) % xe::memory::page_size() == 0) &&
-       ((start_page_number * page_size_) % xe::memory::page_size() == 0))) {
+  // We can only do this if our size matches host page granularity.
+  if (IsHostPageAligned(start_page_number, page_count)) {
     if (!xe::memory::Protect(
             membase_ + heap_base_ + start_page_number * page_size_,
             page_count * page_size_, ToPageAccess(protect), nullptr)) {
@@ -996,6 +1895,8 @@ bool BaseHeap::Protect(uint32_t address, uint32_t size, uint32_t protect) {
     auto& page_entry = page_table_[page_number];
     page_entry.current_protect = protect;
   }
+  UpdatePageRuns(start_page_number, end_page_number - start_page_number + 1);
+  ++protect_count_;
 
   return true;
 }
@@ -1025,29 +1926,16 @@ bool BaseHeap::QueryRegionInfo(uint32_t base_address,
     out_info->state = start_page_entry.state;
     out_info->protect = start_page_entry.current_protect;
     out_info->type = 0x20000;
-    for (uint32_t page_number = start_page_number;
-         page_number < start_page_number + start_page_entry.region_page_count;
-         ++page_number) {
-      auto page_entry = page_table_[page_number];
-      if (page_entry.base_address != start_page_entry.base_address ||
-          page_entry.state != start_page_entry.state ||
-          page_entry.current_protect != start_page_entry.current_protect) {
-        // Different region or different properties within the region; done.
-        break;
-      }
-      out_info->region_size += page_size_;
-    }
+    // Up to a different region or different properties within the region.
+    uint32_t end_page_number =
+        std::min(GetPageRunEnd(start_page_number),
+                 start_page_number + start_page_entry.region_page_count);
+    out_info->region_size = (end_page_number - start_page_number) * page_size_;
   } else {
-    // Free region.
-    for (uint32_t page_number = start_page_number;
-         page_number < page_table_.size(); ++page_number) {
-      auto page_entry = page_table_[page_number];
-      if (page_entry.state) {
-        // First non-free page; done with region.
-        break;
-      }
-      out_info->region_size += page_size_;
-    }
+    // Free region, up to the first non-free page.
+    auto free_run = --free_runs_.upper_bound(start_page_number);
+    out_info->region_size =
+        (free_run->first + free_run->second - start_page_number) * page_size_;
   }
   return true;
 }
@@ -1078,6 +1966,33 @@ bool BaseHeap::QueryProtect(uint32_t address, uint32_t* out_protect) {
   return true;
 }
 
+bool BaseHeap::IsRangeAccessible(uint32_t address, uint32_t size,
+                                 uint32_t protect) {
+  // heap_size_ is the offset of the last byte of the heap.
+  uint32_t offset = address - heap_base_;
+  if (address < heap_base_ || offset > heap_size_) {
+    return false;
+  }
+  if (!size) {
+    return true;
+  }
+  if (size - 1 > heap_size_ - offset) {
+    return false;
+  }
+  uint32_t start_page_number = offset / page_size_;
+  uint32_t end_page_number = (offset + size - 1) / page_size_;
+  auto global_lock = global_critical_region_.Acquire();
+  for (uint32_t page_number = start_page_number;
+       page_number <= end_page_number; ++page_number) {
+    auto page_entry = page_table_[page_number];
+    if (!(page_entry.state & kMemoryAllocationCommit) ||
+        (page_entry.current_protect & protect) != protect) {
+      return false;
+    }
+  }
+  return true;
+}
+
 uint32_t BaseHeap::GetPhysicalAddress(uint32_t address) {
   // Only valid for memory in this range - will be bogus if the origin was
   // outside of it.
@@ -1104,51 +2019,74 @@ PhysicalHeap::~PhysicalHeap() = default;
 void PhysicalHeap::Initialize(uint8_t* membase, uint32_t heap_base,
                               uint32_t heap_size, uint32_t page_size,
                               VirtualHeap* parent_heap) {
-  BaseHeap::Initialize(membase, heap_base, heap_size, page_size);
+  // The page table of the parent heap describes every view of physical
+  // memory, so views have none of their own.
+  membase_ = membase;
+  heap_base_ = heap_base;
+  heap_size_ = heap_size - 1;
+  page_size_ = page_size;
+  host_page_size_ = uint32_t(xe::memory::page_size());
   parent_heap_ = parent_heap;
+  view_protected_pages_.assign(heap_size / page_size, false);
 }
 
-bool PhysicalHeap::Alloc(uint32_t size, uint32_t alignment,
-                         uint32_t allocation_type, uint32_t protect,
-                         bool top_down, uint32_t* out_address) {
-  *out_address = 0;
-
-  // Default top-down. Since parent heap is bottom-up this prevents collisions.
-  top_down = true;
-
-  // Adjust alignment size our page size differs from the parent.
-  size = xe::round_up(size, page_size_);
-  alignment = xe::round_up(alignment, page_size_);
-
-  auto global_lock = global_critical_region_.Acquire();
-
-  // Allocate from parent heap (gets our physical address in 0-512mb).
-  uint32_t parent_low_address = GetPhysicalAddress(heap_base_);
-  uint32_t parent_high_address = GetPhysicalAddress(heap_base_ + heap_size_);
-  uint32_t parent_address;
-  if (!parent_heap_->AllocRange(parent_low_address, parent_high_address, size,
-                                alignment, allocation_type, protect, top_down,
-                                &parent_address)) {
-    XELOGE(
-        "PhysicalHeap::Alloc unable to alloc physical memory in parent heap");
-    return false;
-  }
+uint32_t PhysicalHeap::GetViewAddress(uint32_t parent_address) const {
   if (heap_base_ >= 0xE0000000) {
     parent_address -= 0x1000;
   }
+  return heap_base_ + parent_address;
+}
 
-  // Given the address we've reserved in the parent heap, pin that here.
-  // Shouldn't be possible for it to be allocated already.
-  uint32_t address = heap_base_ + parent_address;
-  if (!BaseHeap::AllocFixed(address, size, alignment, allocation_type,
-                            protect)) {
-    XELOGE(
-        "PhysicalHeap::Alloc unable to pin physical memory in physical heap");
-    // TODO(benvanik): don't leak parent memory.
-    return false;
+void PhysicalHeap::ProtectView(uint32_t address, uint32_t size,
+                               uint32_t protect) {
+  // The parent heap commits the pages for all views, which are read and
+  // write unless protected otherwise through this one, so most allocations
+  // need no host call here.
+  bool read_write = protect == (kMemoryProtectRead | kMemoryProtectWrite);
+  if (read_write && !view_protected_page_count_) {
+    return;
   }
-  *out_address = address;
-  return true;
+  uint32_t start_page_number = (address - heap_base_) / page_size_;
+  uint32_t end_page_number = std::min(
+      get_page_count(address - heap_base_ + size, page_size_),
+      uint32_t(view_protected_pages_.size()));
+  if (read_write &&
+      std::find(view_protected_pages_.begin() + start_page_number,
+                view_protected_pages_.begin() + end_page_number,
+                true) == view_protected_pages_.begin() + end_page_number) {
+    return;
+  }
+  if (end_page_number <= start_page_number ||
+      !IsHostPageAligned(start_page_number,
+                         end_page_number - start_page_number)) {
+    return;
+  }
+  if (!xe::memory::Protect(membase_ + heap_base_ +
+                               start_page_number * page_size_,
+                           (end_page_number - start_page_number) * page_size_,
+                           ToPageAccess(protect), nullptr)) {
+    XELOGW("PhysicalHeap failed to protect the view due to host failure");
+    return;
+  }
+  for (uint32_t page_number = start_page_number;
+       page_number < end_page_number; ++page_number) {
+    if (view_protected_pages_[page_number] == read_write) {
+      view_protected_pages_[page_number] = !read_write;
+      if (read_write) {
+        --view_protected_page_count_;
+      } else {
+        ++view_protected_page_count_;
+      }
+    }
+  }
+}
+
+bool PhysicalHeap::Alloc(uint32_t size, uint32_t alignment,
+                         uint32_t allocation_type, uint32_t protect,
+                         bool top_down, uint32_t* out_address) {
+  // Default top-down. Since parent heap is bottom-up this prevents collisions.
+  return AllocRange(heap_base_, heap_base_ + heap_size_, size, alignment,
+                    allocation_type, protect, true, out_address);
 }
 
 bool PhysicalHeap::AllocFixed(uint32_t base_address, uint32_t size,
@@ -1171,21 +2109,7 @@ bool PhysicalHeap::AllocFixed(uint32_t base_address, uint32_t size,
         "PhysicalHeap::Alloc unable to alloc physical memory in parent heap");
     return false;
   }
-  if (heap_base_ >= 0xE0000000) {
-    parent_base_address -= 0x1000;
-  }
-
-  // Given the address we've reserved in the parent heap, pin that here.
-  // Shouldn't be possible for it to be allocated already.
-  uint32_t address = heap_base_ + parent_base_address;
-  if (!BaseHeap::AllocFixed(address, size, alignment, allocation_type,
-                            protect)) {
-    XELOGE(
-        "PhysicalHeap::Alloc unable to pin physical memory in physical heap");
-    // TODO(benvanik): don't leak parent memory.
-    return false;
-  }
-
+  ProtectView(base_address, size, protect);
   return true;
 }
 
@@ -1214,20 +2138,8 @@ bool PhysicalHeap::AllocRange(uint32_t low_address, uint32_t high_address,
         "PhysicalHeap::Alloc unable to alloc physical memory in parent heap");
     return false;
   }
-  if (heap_base_ >= 0xE0000000) {
-    parent_address -= 0x1000;
-  }
-
-  // Given the address we've reserved in the parent heap, pin that here.
-  // Shouldn't be possible for it to be allocated already.
-  uint32_t address = heap_base_ + parent_address;
-  if (!BaseHeap::AllocFixed(address, size, alignment, allocation_type,
-                            protect)) {
-    XELOGE(
-        "PhysicalHeap::Alloc unable to pin physical memory in physical heap");
-    // TODO(benvanik): don't leak parent memory.
-    return false;
-  }
+  uint32_t address = GetViewAddress(parent_address);
+  ProtectView(address, size, protect);
   *out_address = address;
   return true;
 }
@@ -1239,7 +2151,7 @@ bool PhysicalHeap::Decommit(uint32_t address, uint32_t size) {
     XELOGE("PhysicalHeap::Decommit failed due to parent heap failure");
     return false;
   }
-  return BaseHeap::Decommit(address, size);
+  return true;
 }
 
 bool PhysicalHeap::Release(uint32_t base_address, uint32_t* out_region_size) {
@@ -1255,8 +2167,13 @@ bool PhysicalHeap::Release(uint32_t base_address, uint32_t* out_region_size) {
     XELOGE("PhysicalHeap::Release failed due to parent heap failure");
     return false;
   }
-
-  return BaseHeap::Release(base_address, out_region_size);
+  if (region_size) {
+    ProtectView(base_address, region_size,
+                FLAGS_protect_on_release
+                    ? kMemoryProtectNoAccess
+                    : kMemoryProtectRead | kMemoryProtectWrite);
+  }
+  return true;
 }
 
 bool PhysicalHeap::Protect(uint32_t address, uint32_t size, uint32_t protect) {
@@ -1268,8 +2185,59 @@ bool PhysicalHeap::Protect(uint32_t address, uint32_t size, uint32_t protect) {
     XELOGE("PhysicalHeap::Protect failed due to parent heap failure");
     return false;
   }
+  ProtectView(address, size, protect);
+  return true;
+}
+
+bool PhysicalHeap::QueryRegionInfo(uint32_t base_address,
+                                   HeapAllocationInfo* out_info) {
+  if (base_address < heap_base_ || base_address - heap_base_ > heap_size_) {
+    XELOGE("PhysicalHeap::QueryRegionInfo base address out of range");
+    return false;
+  }
+  if (!parent_heap_->QueryRegionInfo(GetPhysicalAddress(base_address),
+                                     out_info)) {
+    return false;
+  }
+  out_info->base_address = base_address;
+  if (out_info->state) {
+    out_info->allocation_base = GetViewAddress(out_info->allocation_base);
+  }
+  // The parent heap may extend past the end of the view.
+  out_info->region_size = std::min(
+      out_info->region_size, heap_base_ + heap_size_ - base_address + 1);
+  return true;
+}
+
+bool PhysicalHeap::QuerySize(uint32_t address, uint32_t* out_size) {
+  return parent_heap_->QuerySize(GetPhysicalAddress(address), out_size);
+}
+
+bool PhysicalHeap::QueryProtect(uint32_t address, uint32_t* out_protect) {
+  return parent_heap_->QueryProtect(GetPhysicalAddress(address), out_protect);
+}
+
+bool PhysicalHeap::IsRangeAccessible(uint32_t address, uint32_t size,
+                                     uint32_t protect) {
+  uint32_t offset = address - heap_base_;
+  if (address < heap_base_ || offset > heap_size_ ||
+      (size && size - 1 > heap_size_ - offset)) {
+    return false;
+  }
+  return parent_heap_->IsRangeAccessible(GetPhysicalAddress(address), size,
+                                         protect);
+}
+
+void PhysicalHeap::DumpMap() {
+  XELOGE("------------------------------------------------------------------");
+  XELOGE("Heap: %.8X-%.8X, a view of physical memory at %.8X", heap_base_,
+         heap_base_ + heap_size_, GetPhysicalAddress(heap_base_));
+}
 
-  return BaseHeap::Protect(address, size, protect);
+void PhysicalHeap::QueryStats(HeapStats* out_stats) {
+  parent_heap_->QueryStats(out_stats);
+  out_stats->heap_base = heap_base_;
+  out_stats->heap_size = heap_size_ + 1;
 }
 
 }  // namespace xe
@@ -10,9 +10,14 @@
 #ifndef XENIA_MEMORY_H_
 #define XENIA_MEMORY_H_
 
+#include <atomic>
 #include <cstdint>
+#include <map>
 #include <memory>
+#include <mutex>
+#include <set>
 #include <string>
+#include <utility>
 #include <vector>
 
 #include "xenia/base/memory.h"
@@ -67,6 +72,23 @@ struct HeapAllocationInfo {
   uint32_t type;
 };
 
+// Counters of a heap, cheap enough to be queried periodically.
+struct HeapStats {
+  uint32_t heap_base;
+  uint32_t heap_size;
+  uint32_t page_size;
+  // Reserved pages include the committed ones.
+  uint32_t reserved_page_count;
+  uint32_t committed_page_count;
+  // The largest free run bounds the largest allocation that can succeed.
+  uint32_t largest_free_run_page_count;
+  uint32_t free_run_count;
+  // Totals since the heap was initialized, to compute rates from.
+  uint64_t alloc_count;
+  uint64_t release_count;
+  uint64_t protect_count;
+};
+
 // Describes a single page in the page table.
 union PageEntry {
   struct {
@@ -99,7 +121,8 @@ class BaseHeap {
   virtual void Dispose();
 
   // Dumps information about all allocations within the heap to the log.
-  void DumpMap();
+  virtual void DumpMap();
+  virtual void QueryStats(HeapStats* out_stats);
 
   // Allocates pages with the given properties and allocation strategy.
   // This can reserve and commit the pages as well as set protection modes.
@@ -135,21 +158,42 @@ class BaseHeap {
   virtual bool Protect(uint32_t address, uint32_t size, uint32_t protect);
 
   // Queries information about the given region of pages.
-  bool QueryRegionInfo(uint32_t base_address, HeapAllocationInfo* out_info);
+  virtual bool QueryRegionInfo(uint32_t base_address,
+                               HeapAllocationInfo* out_info);
 
   // Queries the size of the region containing the given address.
-  bool QuerySize(uint32_t address, uint32_t* out_size);
+  virtual bool QuerySize(uint32_t address, uint32_t* out_size);
 
   // Queries the current protection mode of the region containing the given
   // address.
-  bool QueryProtect(uint32_t address, uint32_t* out_protect);
+  virtual bool QueryProtect(uint32_t address, uint32_t* out_protect);
+
+  // Checks that all pages of the range are committed within this heap with
+  // all of the given protection flags, so host code can access it directly.
+  virtual bool IsRangeAccessible(uint32_t address, uint32_t size,
+                                 uint32_t protect);
 
   // Gets the physical address of a virtual address.
   // This is only valid if the page is backed by a physical allocation.
   uint32_t GetPhysicalAddress(uint32_t address);
 
+  // Host memory of heaps with pages larger than the system ones, such as
+  // large pages, is always committed and can only be protected in whole
+  // host pages.
+  void set_host_page_size(uint32_t host_page_size) {
+    host_page_size_ = host_page_size;
+  }
+
+  // Committed pages are saved in chunks, compressed and restored in
+  // parallel, with all-zero pages only flagged.
   bool Save(ByteStream* stream);
   bool Restore(ByteStream* stream);
+  // Saves only the page table entries and pages changed since the last save
+  // or restore, found by comparing page hashes. RestoreDelta applies them to
+  // the heap as it was after that save or restore.
+  bool has_saved_state() const { return !saved_page_table_.empty(); }
+  bool SaveDelta(ByteStream* stream);
+  bool RestoreDelta(ByteStream* stream);
 
   void Reset();
 
@@ -159,12 +203,65 @@ class BaseHeap {
   void Initialize(uint8_t* membase, uint32_t heap_base, uint32_t heap_size,
                   uint32_t page_size);
 
+  // Returns the first page of page_count free pages aligned to the stride
+  // within [low_page_number, high_page_number), or UINT32_MAX if there are
+  // none. Bottom-up searches of the whole heap take the smallest free run
+  // that fits, others the lowest or highest (if top_down) pages that do.
+  uint32_t FindFreePages(uint32_t low_page_number, uint32_t high_page_number,
+                         uint32_t page_count, uint32_t page_stride,
+                         bool top_down, bool best_fit);
+  // Must be called whenever pages change from or to a state of 0.
+  void MarkPagesFree(uint32_t start_page_number, uint32_t page_count);
+  void MarkPagesUsed(uint32_t start_page_number, uint32_t page_count);
+  // Rebuilds the free and page runs from the whole page table.
+  void RebuildFreeRuns();
+  // Must be called whenever the region, state or protection of pages
+  // changed.
+  void UpdatePageRuns(uint32_t start_page_number, uint32_t page_count);
+  // Returns the page after the run of pages with the same region, state and
+  // protection that the page is in.
+  uint32_t GetPageRunEnd(uint32_t page_number) const;
+
+  bool IsHostPageAligned(uint32_t start_page_number,
+                         uint32_t page_count) const;
+  // Allocates the host memory of the pages, or returns nullptr if that
+  // failed.
+  void* HostAlloc(uint32_t start_page_number, uint32_t page_count,
+                  xe::memory::AllocationType allocation_type,
+                  uint32_t protect);
+
+  bool SavePages(ByteStream* stream, bool delta);
+  bool RestorePages(ByteStream* stream, bool delta);
+  // Returns the snappy compressed committed pages of the range, or nothing
+  // if this is a delta and none changed.
+  std::vector<char> SaveChunk(uint32_t start_page_number, uint32_t page_count,
+                              bool delta, size_t* out_raw_size);
+  bool RestoreChunk(uint32_t start_page_number, uint32_t page_count,
+                    bool delta, const char* data, size_t size,
+                    size_t raw_size);
+
   uint8_t* membase_;
   uint32_t heap_base_;
   uint32_t heap_size_;
   uint32_t page_size_;
+  uint32_t host_page_size_ = 0;
   xe::global_critical_region global_critical_region_;
   std::vector<PageEntry> page_table_;
+  // Runs of free pages by their first page to their page count, and as
+  // (page count, first page) for finding the best fit.
+  std::map<uint32_t, uint32_t> free_runs_;
+  std::set<std::pair<uint32_t, uint32_t>> free_runs_by_size_;
+  // The first pages of runs of pages with the same region, state and
+  // protection, except for the first page of the heap.
+  std::set<uint32_t> page_run_starts_;
+  // Successful calls changing the page table, for HeapStats.
+  uint64_t alloc_count_ = 0;
+  uint64_t release_count_ = 0;
+  uint64_t protect_count_ = 0;
+  // The page table and page hashes as of the last save or restore, which
+  // deltas are relative to. Empty if there was none since the last reset.
+  std::vector<PageEntry> saved_page_table_;
+  std::vector<uint64_t> saved_page_hashes_;
 };
 
 // Normal heap allowing allocations from guest virtual address ranges.
@@ -184,13 +281,15 @@ class VirtualHeap : public BaseHeap {
 //
 // The physical heap and the behavior of sharing pages with virtual pages is
 // implemented by having a 'parent' heap that is used to perform allocation in
-// the guest virtual address space 1:1 with the physical address space.
+// the guest virtual address space 1:1 with the physical address space. Its
+// page table is the only one of the physical pages, which allocations and
+// queries through every view translate their addresses into.
 class PhysicalHeap : public BaseHeap {
  public:
   PhysicalHeap();
   ~PhysicalHeap() override;
 
-  // Initializes the heap properties and allocates the page table.
+  // Initializes the heap properties.
   void Initialize(uint8_t* membase, uint32_t heap_base, uint32_t heap_size,
                   uint32_t page_size, VirtualHeap* parent_heap);
 
@@ -207,8 +306,26 @@ class PhysicalHeap : public BaseHeap {
                uint32_t* out_region_size = nullptr) override;
   bool Protect(uint32_t address, uint32_t size, uint32_t protect) override;
 
+  bool QueryRegionInfo(uint32_t base_address,
+                       HeapAllocationInfo* out_info) override;
+  bool QuerySize(uint32_t address, uint32_t* out_size) override;
+  bool QueryProtect(uint32_t address, uint32_t* out_protect) override;
+  bool IsRangeAccessible(uint32_t address, uint32_t size,
+                         uint32_t protect) override;
+  void DumpMap() override;
+  // The stats of the parent heap, as it has the pages of all views.
+  void QueryStats(HeapStats* out_stats) override;
+
  protected:
+  // Translates an address in the parent heap into this view.
+  uint32_t GetViewAddress(uint32_t parent_address) const;
+  // Applies the protection to the host pages of this view only.
+  void ProtectView(uint32_t address, uint32_t size, uint32_t protect);
+
   VirtualHeap* parent_heap_;
+  // Pages of this view whose host protection isn't read and write.
+  std::vector<bool> view_protected_pages_;
+  uint32_t view_protected_page_count_ = 0;
 };
 
 // Models the entire guest memory system on the console.
@@ -308,13 +425,21 @@ class Memory {
                                    cpu::AccessWatchCallback callback,
                                    void* callback_context, void* callback_data);
 
-  // Cancels a write watch requested with AddPhysicalAccessWatch.
+  // Adds a write watch for guest code in the 0x80000000-0x9FFFFFFF range,
+  // which also fires when the heap changes the pages. Returns 0 outside it.
+  uintptr_t AddVirtualWriteWatch(uint32_t virtual_address, uint32_t length,
+                                 cpu::AccessWatchCallback callback,
+                                 void* callback_context, void* callback_data);
+
+  // Cancels a write watch requested with AddPhysicalAccessWatch or
+  // AddVirtualWriteWatch.
   void CancelAccessWatch(uintptr_t watch_handle);
 
   // Allocates virtual memory from the 'system' heap.
   // System memory is kept separate from game memory but is still accessible
   // using normal guest virtual addresses. Kernel structures and other internal
   // 'system' allocations should come from this heap when possible.
+  // Small allocations share pages, and are pooled by size.
   uint32_t SystemHeapAlloc(uint32_t size, uint32_t alignment = 0x20,
                            uint32_t system_heap_flags = kSystemHeapDefault);
 
@@ -329,13 +454,64 @@ class Memory {
 
   // Dumps a map of all allocated memory to the log.
   void DumpMap();
+  // Gets the stats of every heap, in the order DumpMap lists them.
+  std::vector<HeapStats> QueryHeapStats();
+  // Reports the memory in use, the largest free runs and the rates of
+  // allocations and protection changes to the profiler, as counters updated
+  // once a second.
+  void UpdateProfileCounters();
 
   bool Save(ByteStream* stream);
   bool Restore(ByteStream* stream);
+  // Saves the pages changed since the last save or restore, to be restored
+  // on top of memory restored to that state.
+  bool CanSaveDelta() const;
+  bool SaveDelta(ByteStream* stream);
+  bool RestoreDelta(ByteStream* stream);
+
+  // Backs the range of the 0x80000000 heap with a copy-on-write view of the
+  // file, so processes mapping the same file share the pages none of them
+  // wrote. The range and offset must be multiples of the allocation
+  // granularity, and the range must be committed and not yet shared. Guest
+  // accesses around the range fault while it is being mapped.
+  bool MapSharedFile(uint32_t address, uint32_t size, const std::wstring& path,
+                     size_t file_offset);
+  // Backs the range mapped at the address with guest memory again, which has
+  // the contents it had before the range was shared.
+  void UnmapSharedFile(uint32_t address);
 
  private:
   int MapViews(uint8_t* mapping_base);
   void UnmapViews();
+  // Maps the range of the 0x80000000 view of the guest memory mapping.
+  bool MapGuestPiece(uint32_t address, uint32_t size);
+
+  void SaveSystemPools(ByteStream* stream);
+  void RestoreSystemPools(ByteStream* stream);
+
+  // Small system heap allocations are blocks of power of two sizes from
+  // 16b to 2KiB, carved out of 64KiB slabs that each hold a single size.
+  static const uint32_t kSystemPoolSlabSize = 64 * 1024;
+  static const uint32_t kSystemPoolMinBlockShift = 4;
+  static const uint32_t kSystemPoolClassCount = 8;
+  // Blocks cached by each thread per pool and size before they are given
+  // back to the shared free lists.
+  static const uint32_t kSystemPoolCacheSize = 32;
+  struct SystemPoolCache;
+  // The cache of the calling thread, emptied if it was filled before the
+  // pools were last reset.
+  SystemPoolCache* system_pool_cache();
+  // Returns the size class for the allocation, or -1 if it's too large.
+  static int GetSystemPoolClass(uint32_t size, uint32_t alignment);
+  uint32_t SystemPoolAlloc(bool is_physical, int size_class, uint32_t size);
+  // Returns false if the address is not from a slab.
+  bool SystemPoolFree(uint32_t address);
+  // Moves shared free blocks into the cache, carving a new slab if there
+  // are none. Must be called with system_pool_mutex_ held.
+  void RefillSystemPoolCache(SystemPoolCache* cache, uint32_t pool,
+                             int size_class);
+  // Frees all blocks, including those cached by threads.
+  void ResetSystemPools();
 
  private:
   std::wstring file_name_;
@@ -345,6 +521,19 @@ class Memory {
 
   xe::memory::FileMappingHandle mapping_ = nullptr;
   uint8_t* mapping_base_ = nullptr;
+  // Set if physical memory is backed by large pages.
+  xe::memory::FileMappingHandle physical_mapping_ = nullptr;
+  uint32_t physical_page_size_ = 0;
+  struct SharedFileView {
+    uint32_t size;
+    xe::memory::FileMappingHandle mapping;
+  };
+  std::mutex shared_file_mutex_;
+  // Once a file is shared, the 0x80000000 view is split into pieces around
+  // the shared ranges, and views_.v80000000 is no longer unmapped by itself.
+  std::map<uint32_t, SharedFileView> shared_file_views_;
+  // The sizes of the pieces of the guest memory mapping, by their address.
+  std::map<uint32_t, uint32_t> v80000000_pieces_;
   union {
     struct {
       uint8_t* v00000000;
@@ -362,6 +551,24 @@ class Memory {
 
   std::unique_ptr<cpu::MMIOHandler> mmio_handler_;
 
+  // The counters last reported, and the totals of the heap stats they were
+  // computed from.
+  struct ProfileCounters {
+    uint64_t time = 0;
+    uint64_t alloc_count = 0;
+    uint64_t release_count = 0;
+    uint64_t protect_count = 0;
+    int virtual_committed_mb = 0;
+    int virtual_reserved_mb = 0;
+    int largest_free_virtual_kb = 0;
+    int physical_committed_mb = 0;
+    int physical_reserved_mb = 0;
+    int largest_free_physical_kb = 0;
+    int allocs_per_second = 0;
+    int releases_per_second = 0;
+    int protects_per_second = 0;
+  } profile_counters_;
+
   struct {
     VirtualHeap v00000000;
     VirtualHeap v40000000;
@@ -374,6 +581,15 @@ class Memory {
     PhysicalHeap vE0000000;
   } heaps_;
 
+  std::mutex system_pool_mutex_;
+  // Free blocks of each size in the virtual and physical pools.
+  std::vector<uint32_t> system_pool_free_blocks_[2][kSystemPoolClassCount];
+  // For each 64KiB of the address space, 0 if it's not a slab, or 1 + the
+  // pool << 4 | the size class of the blocks in it.
+  std::unique_ptr<std::atomic<uint8_t>[]> system_pool_slabs_;
+  // Thread caches filled from other pools than the current are dropped.
+  uint64_t system_pool_id_ = 0;
+
   friend class BaseHeap;
 };
 
@@ -0,0 +1,198 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2016 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#include <gflags/gflags.h>
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <functional>
+#include <vector>
+
+#include "xenia/base/clock.h"
+#include "xenia/base/logging.h"
+#include "xenia/base/main.h"
+#include "xenia/base/memory.h"
+#include "xenia/memory.h"
+
+DEFINE_int32(memory_benchmark_operations, 200000,
+             "Number of allocations and releases made per heap layout.");
+DEFINE_int32(memory_benchmark_transfer_mb, 64,
+             "Size of the buffers searched, copied and filled, in MiB.");
+
+namespace xe {
+namespace test {
+
+// Reserves and releases pages of a heap without host memory behind it, so
+// only the bookkeeping is timed. Allocations are checked not to overlap and
+// to have the requested alignment.
+class HeapBenchmark {
+ public:
+  HeapBenchmark(uint32_t page_size, uint32_t heap_size)
+      : page_size_(page_size), pages_(heap_size / page_size) {
+    heap_.Initialize(nullptr, kHeapBase, heap_size, page_size);
+  }
+
+  bool Run(const char* name, uint32_t max_page_count, uint32_t max_alignment,
+           bool top_down, int32_t operations) {
+    uint32_t state = 0x12345678;
+    auto next_random = [&state]() {
+      state = state * 1664525 + 1013904223;
+      return state >> 8;
+    };
+    // Allocations average half the maximum size, so this keeps the heap
+    // about half full, with holes of all sizes.
+    size_t max_allocation_count = pages_.size() / max_page_count;
+    std::vector<uint32_t> addresses;
+    uint32_t failed_count = 0;
+    bool valid = true;
+    uint64_t start = Clock::QueryHostTickCount();
+    for (int32_t i = 0; i < operations && valid; ++i) {
+      if (addresses.size() >= max_allocation_count ||
+          (!addresses.empty() && next_random() % 2)) {
+        size_t index = next_random() % addresses.size();
+        uint32_t address = addresses[index];
+        addresses[index] = addresses.back();
+        addresses.pop_back();
+        valid = heap_.Release(address) && Unmark(address);
+        continue;
+      }
+      uint32_t size = (1 + next_random() % max_page_count) * page_size_;
+      uint32_t alignment = page_size_ << (next_random() % max_alignment);
+      uint32_t address = 0;
+      if (!heap_.Alloc(size, alignment, kMemoryAllocationReserve,
+                       kMemoryProtectRead | kMemoryProtectWrite, top_down,
+                       &address)) {
+        ++failed_count;
+        continue;
+      }
+      valid = address % alignment == 0 && Mark(address, size);
+      addresses.push_back(address);
+    }
+    uint64_t ticks = Clock::QueryHostTickCount() - start;
+    for (uint32_t address : addresses) {
+      heap_.Release(address);
+      Unmark(address);
+    }
+
+    double us = ticks * 1000000.0 / Clock::host_tick_frequency();
+    std::printf("%-16s %10.3f %8u %s\n", name, us / operations, failed_count,
+                valid ? "ok" : "OVERLAP");
+    return valid;
+  }
+
+ private:
+  static const uint32_t kHeapBase = 0x40000000;
+
+  bool Mark(uint32_t address, uint32_t size) {
+    uint32_t first_page = (address - kHeapBase) / page_size_;
+    uint32_t page_count = size / page_size_;
+    for (uint32_t i = 0; i < page_count; ++i) {
+      if (pages_[first_page + i]) {
+        return false;
+      }
+      pages_[first_page + i] = page_count - i;
+    }
+    return true;
+  }
+
+  bool Unmark(uint32_t address) {
+    uint32_t first_page = (address - kHeapBase) / page_size_;
+    uint32_t page_count = pages_[first_page];
+    if (!page_count) {
+      return false;
+    }
+    for (uint32_t i = 0; i < page_count; ++i) {
+      pages_[first_page + i] = 0;
+    }
+    return true;
+  }
+
+  uint32_t page_size_;
+  VirtualHeap heap_;
+  // The pages left in the allocation from each page, or 0 if free.
+  std::vector<uint32_t> pages_;
+};
+
+// Times the transfer helpers against the loops and library calls they
+// replace, on buffers larger than the caches.
+bool BenchmarkTransfers(size_t size) {
+  std::vector<uint32_t> src(size / 4, 0x11223344);
+  std::vector<uint32_t> dest(size / 4);
+  src.back() = 0xAABBCCDD;
+  double ticks_to_us = 1000000.0 / Clock::host_tick_frequency();
+  bool valid = true;
+  auto measure = [&](const char* name, const std::function<void()>& reference,
+                  const std::function<void()>& function) {
+    uint64_t start = Clock::QueryHostTickCount();
+    reference();
+    uint64_t reference_ticks = Clock::QueryHostTickCount() - start;
+    start = Clock::QueryHostTickCount();
+    function();
+    uint64_t ticks = Clock::QueryHostTickCount() - start;
+    std::printf("%-16s %10.1f %10.1f\n", name, reference_ticks * ticks_to_us,
+                ticks * ticks_to_us);
+  };
+
+  std::printf("%-16s %10s %10s\n", "transfer", "ref_us", "simd_us");
+  size_t reference_index = 0;
+  size_t index = 0;
+  measure("search",
+       [&]() {
+         while (reference_index < src.size() &&
+                src[reference_index] != 0xAABBCCDD) {
+           ++reference_index;
+         }
+       },
+       [&]() {
+         index = xe::find_first_equal_32(src.data(), 0xAABBCCDD, src.size());
+       });
+  valid = valid && index == reference_index;
+  measure("copy", [&]() { std::memcpy(dest.data(), src.data(), size); },
+       [&]() { xe::copy_streaming(dest.data(), src.data(), size); });
+  valid = valid && dest == src;
+  measure("fill", [&]() { std::memset(dest.data(), 0x5A, size); },
+       [&]() { xe::fill_streaming(dest.data(), 0x5A, size); });
+  valid = valid && xe::count_equal_32(dest.data(), 0x5A5A5A5A,
+                                      dest.size()) == dest.size();
+  return valid;
+}
+
+int main(const std::vector<std::wstring>& args) {
+  int32_t operations = std::max(FLAGS_memory_benchmark_operations, 1);
+
+  std::printf("%-16s %10s %8s %s\n", "layout", "us_per_op", "failed",
+              "result");
+  int invalid_count = 0;
+  HeapBenchmark small_pages(4 * 1024, 0x10000000);
+  HeapBenchmark large_pages(64 * 1024, 0x10000000);
+  invalid_count += !small_pages.Run("4k x 1-16", 16, 1, false, operations);
+  invalid_count += !small_pages.Run("4k x 1-256", 256, 4, false, operations);
+  invalid_count += !small_pages.Run("4k top down", 256, 4, true, operations);
+  invalid_count += !large_pages.Run("64k x 1-64", 64, 2, false, operations);
+  if (invalid_count) {
+    XELOGE("%d heap layouts had overlapping or misaligned allocations",
+           invalid_count);
+    return 1;
+  }
+
+  size_t transfer_size =
+      size_t(std::max(FLAGS_memory_benchmark_transfer_mb, 1)) * 1024 * 1024;
+  if (!BenchmarkTransfers(transfer_size)) {
+    XELOGE("Transfer helpers gave different results");
+    return 1;
+  }
+  return 0;
+}
+
+}  // namespace test
+}  // namespace xe
+
+DEFINE_ENTRY_POINT(L"xenia-core-memory-benchmark",
+                   L"xenia-core-memory-benchmark", xe::test::main);
@@ -7,7 +7,9 @@ project("xenia-core")
   kind("StaticLib")
   language("C++")
   links({
+    "snappy",
     "xenia-base",
+    "xxhash",
   })
   defines({
   })
@@ -15,3 +17,27 @@ project("xenia-core")
     project_root.."/third_party/gflags/src",
   })
   files({"*.h", "*.cc"})
+  removefiles({"*_main.cc"})
+
+group("src")
+project("xenia-core-memory-benchmark")
+  uuid("5e1b9c47-2d8a-4f63-b07e-9a4c3d1f8e52")
+  kind("ConsoleApp")
+  language("C++")
+  links({
+    "gflags",
+    "snappy",
+    "xenia-base",
+    "xenia-core",
+    "xenia-cpu",
+    "xxhash",
+  })
+  defines({
+  })
+  includedirs({
+    project_root.."/third_party/gflags/src",
+  })
+  files({
+    "memory_benchmark_main.cc",
+    "base/main_"..platform_suffix..".cc",
+  })
@@ -18,15 +18,25 @@ namespace xe {
 namespace ui {
 namespace gl {
 
+// Fence waits are retried until signaled, as timeouts may be clamped.
+constexpr GLuint64 kFenceWaitTimeout = 1000000000ull;
+
 CircularBuffer::CircularBuffer(size_t capacity, size_t alignment)
     : capacity_(capacity),
       alignment_(alignment),
       write_head_(0),
+      discard_head_(0),
+      frame_tail_(UINT64_MAX),
       dirty_start_(UINT64_MAX),
       dirty_end_(0),
       buffer_(0),
       gpu_base_(0),
-      host_base_(nullptr) {}
+      host_base_(nullptr),
+      frame_high_water_mark_(0),
+      last_frame_high_water_mark_(0),
+      high_water_mark_(0),
+      frame_wait_count_(0),
+      last_frame_wait_count_(0) {}
 
 CircularBuffer::~CircularBuffer() { Shutdown(); }
 
@@ -49,33 +59,95 @@ void CircularBuffer::Shutdown() {
   if (!buffer_) {
     return;
   }
+  for (auto& fence : fences_) {
+    glDeleteSync(fence.sync);
+  }
+  fences_.clear();
   glUnmapNamedBuffer(buffer_);
   glDeleteBuffers(1, &buffer_);
   buffer_ = 0;
 }
 
+uint64_t CircularBuffer::AllocationStart(size_t aligned_length) const {
+  uint64_t offset = write_head_ % capacity_;
+  if (offset + aligned_length > capacity_) {
+    return write_head_ + (capacity_ - offset);
+  }
+  return write_head_;
+}
+
+uint64_t CircularBuffer::tail() const {
+  uint64_t tail = std::min(write_head_, frame_tail_);
+  for (auto& fence : fences_) {
+    tail = std::min(tail, fence.tail);
+  }
+  return tail;
+}
+
+bool CircularBuffer::RetireFences(bool wait) {
+  if (wait) {
+    if (fences_.empty()) {
+      return false;
+    }
+    auto& fence = fences_.front();
+    GLenum result;
+    do {
+      result = glClientWaitSync(fence.sync, GL_SYNC_FLUSH_COMMANDS_BIT,
+                                kFenceWaitTimeout);
+    } while (result == GL_TIMEOUT_EXPIRED);
+    assert_true(result != GL_WAIT_FAILED);
+    glDeleteSync(fence.sync);
+    fences_.pop_front();
+  }
+  while (!fences_.empty()) {
+    auto& fence = fences_.front();
+    GLenum result = glClientWaitSync(fence.sync, 0, 0);
+    if (result != GL_ALREADY_SIGNALED && result != GL_CONDITION_SATISFIED) {
+      break;
+    }
+    glDeleteSync(fence.sync);
+    fences_.pop_front();
+  }
+  return true;
+}
+
 bool CircularBuffer::CanAcquire(size_t length) {
   size_t aligned_length = xe::round_up(length, alignment_);
-  return write_head_ + aligned_length <= capacity_;
+  RetireFences(false);
+  return AllocationStart(aligned_length) + aligned_length - tail() <=
+         capacity_;
 }
 
 CircularBuffer::Allocation CircularBuffer::Acquire(size_t length) {
   // Addresses must always be % 256.
   size_t aligned_length = xe::round_up(length, alignment_);
   assert_true(aligned_length <= capacity_, "Request too large");
-  if (write_head_ + aligned_length > capacity_) {
-    // Flush and wait.
-    WaitUntilClean();
+  uint64_t start = AllocationStart(aligned_length);
+  RetireFences(false);
+  while (start + aligned_length - tail() > capacity_) {
+    ++frame_wait_count_;
+    if (!RetireFences(true)) {
+      // All of the space is used since the last fence, so nothing frees it
+      // up but waiting for everything.
+      WaitUntilClean();
+    }
   }
 
   Allocation allocation;
-  allocation.host_ptr = host_base_ + write_head_;
-  allocation.gpu_ptr = gpu_base_ + write_head_;
-  allocation.offset = write_head_;
+  uintptr_t offset = uintptr_t(start % capacity_);
+  allocation.host_ptr = host_base_ + offset;
+  allocation.gpu_ptr = gpu_base_ + offset;
+  allocation.offset = offset;
   allocation.length = length;
   allocation.aligned_length = aligned_length;
   allocation.cache_key = 0;
-  write_head_ += aligned_length;
+  discard_head_ = write_head_;
+  write_head_ = start + aligned_length;
+  frame_tail_ = std::min(frame_tail_, start);
+
+  size_t used = size_t(write_head_ - tail());
+  frame_high_water_mark_ = std::max(frame_high_water_mark_, used);
+  high_water_mark_ = std::max(high_water_mark_, used);
   return allocation;
 }
 
@@ -84,24 +156,29 @@ bool CircularBuffer::AcquireCached(uint32_t key, size_t length,
   uint64_t full_key = key | (length << 32);
   auto it = allocation_cache_.find(full_key);
   if (it != allocation_cache_.end()) {
-    uintptr_t write_head = it->second;
-    size_t aligned_length = xe::round_up(length, alignment_);
-    out_allocation->host_ptr = host_base_ + write_head;
-    out_allocation->gpu_ptr = gpu_base_ + write_head;
-    out_allocation->offset = write_head;
-    out_allocation->length = length;
-    out_allocation->aligned_length = aligned_length;
-    out_allocation->cache_key = full_key;
-    return true;
-  } else {
-    *out_allocation = Acquire(length);
-    out_allocation->cache_key = full_key;
-    return false;
+    uint64_t position = it->second;
+    if (write_head_ <= position + capacity_) {
+      // Not written over since, and now used again.
+      uintptr_t offset = uintptr_t(position % capacity_);
+      size_t aligned_length = xe::round_up(length, alignment_);
+      out_allocation->host_ptr = host_base_ + offset;
+      out_allocation->gpu_ptr = gpu_base_ + offset;
+      out_allocation->offset = offset;
+      out_allocation->length = length;
+      out_allocation->aligned_length = aligned_length;
+      out_allocation->cache_key = full_key;
+      frame_tail_ = std::min(frame_tail_, position);
+      return true;
+    }
+    allocation_cache_.erase(it);
   }
+  *out_allocation = Acquire(length);
+  out_allocation->cache_key = full_key;
+  return false;
 }
 
 void CircularBuffer::Discard(Allocation allocation) {
-  write_head_ -= allocation.aligned_length;
+  write_head_ = discard_head_;
 }
 
 void CircularBuffer::Commit(Allocation allocation) {
@@ -111,7 +188,12 @@ void CircularBuffer::Commit(Allocation allocation) {
   dirty_end_ = std::max(dirty_end_, end);
   assert_true(dirty_end_ <= capacity_);
   if (allocation.cache_key) {
-    allocation_cache_.insert({allocation.cache_key, allocation.offset});
+    // The allocation is within the last capacity_ bytes written.
+    uint64_t position = write_head_ - write_head_ % capacity_ + start;
+    if (position >= write_head_) {
+      position -= capacity_;
+    }
+    allocation_cache_.insert({allocation.cache_key, position});
   }
 }
 
@@ -130,10 +212,28 @@ void CircularBuffer::ClearCache() { allocation_cache_.clear(); }
 void CircularBuffer::WaitUntilClean() {
   Flush();
   glFinish();
-  write_head_ = 0;
+  for (auto& fence : fences_) {
+    glDeleteSync(fence.sync);
+  }
+  fences_.clear();
+  frame_tail_ = UINT64_MAX;
   ClearCache();
 }
 
+void CircularBuffer::EndFrame() {
+  if (frame_tail_ != UINT64_MAX) {
+    Fence fence;
+    fence.sync = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    fence.tail = frame_tail_;
+    fences_.push_back(fence);
+    frame_tail_ = UINT64_MAX;
+  }
+  last_frame_high_water_mark_ = frame_high_water_mark_;
+  frame_high_water_mark_ = size_t(write_head_ - tail());
+  last_frame_wait_count_ = frame_wait_count_;
+  frame_wait_count_ = 0;
+}
+
 }  // namespace gl
 }  // namespace ui
 }  // namespace xe
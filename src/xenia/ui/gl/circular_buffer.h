@@ -10,6 +10,7 @@
 #ifndef XENIA_UI_GL_CIRCULAR_BUFFER_H_
 #define XENIA_UI_GL_CIRCULAR_BUFFER_H_
 
+#include <deque>
 #include <unordered_map>
 
 #include "xenia/ui/gl/gl.h"
@@ -18,8 +19,9 @@ namespace xe {
 namespace ui {
 namespace gl {
 
-// TODO(benvanik): uh, make this circular.
-// TODO(benvanik): fences to prevent this from ever flushing.
+// Persistently mapped buffer written front to back, wrapping around to the
+// start. Everything acquired in a frame is fenced by EndFrame, so wrapping
+// only waits for the GPU to finish the oldest frames still using the space.
 class CircularBuffer {
  public:
   CircularBuffer(size_t capacity, size_t alignment = 256);
@@ -40,7 +42,9 @@ class CircularBuffer {
   GLuint handle() const { return buffer_; }
   GLuint64 gpu_handle() const { return gpu_base_; }
   size_t capacity() const { return capacity_; }
+  void* host_ptr(size_t offset) const { return host_base_ + offset; }
 
+  // Whether length can be acquired without waiting for the GPU.
   bool CanAcquire(size_t length);
   Allocation Acquire(size_t length);
   bool AcquireCached(uint32_t key, size_t length, Allocation* out_allocation);
@@ -50,18 +54,55 @@ class CircularBuffer {
   void ClearCache();
 
   void WaitUntilClean();
+  // Fences the allocations used since the last call, which are reused once
+  // the GPU is done with the commands issued so far.
+  void EndFrame();
+
+  // Most bytes in use at once, in the last frame ended and since created.
+  size_t frame_high_water_mark() const { return last_frame_high_water_mark_; }
+  size_t high_water_mark() const { return high_water_mark_; }
+  // Times the last frame ended waited for the GPU to acquire space.
+  uint32_t frame_wait_count() const { return last_frame_wait_count_; }
 
  private:
+  struct Fence {
+    GLsync sync;
+    // Lowest position used by the fenced commands.
+    uint64_t tail;
+  };
+
+  // Position the next allocation of aligned_length starts at, which is at
+  // the start of the buffer if it doesn't fit before the end.
+  uint64_t AllocationStart(size_t aligned_length) const;
+  // Lowest position still possibly in use by the GPU.
+  uint64_t tail() const;
+  // Frees the space of the fences already signaled, first waiting for the
+  // oldest if wait is set. Returns false if there were none to wait for.
+  bool RetireFences(bool wait);
+
   size_t capacity_;
   size_t alignment_;
-  uintptr_t write_head_;
+  // Positions are byte counts since initialization. Allocations can't cross
+  // the end of the buffer, so a position is at offset position % capacity_.
+  uint64_t write_head_;
+  uint64_t discard_head_;
+  // Lowest position used since the last fence, UINT64_MAX if none.
+  uint64_t frame_tail_;
   uintptr_t dirty_start_;
   uintptr_t dirty_end_;
   GLuint buffer_;
   GLuint64 gpu_base_;
   uint8_t* host_base_;
+  std::deque<Fence> fences_;
+
+  size_t frame_high_water_mark_;
+  size_t last_frame_high_water_mark_;
+  size_t high_water_mark_;
+  uint32_t frame_wait_count_;
+  uint32_t last_frame_wait_count_;
 
-  std::unordered_map<uint64_t, uintptr_t> allocation_cache_;
+  // Positions of the cached allocations.
+  std::unordered_map<uint64_t, uint64_t> allocation_cache_;
 };
 
 }  // namespace gl
@@ -176,6 +176,10 @@ void ImGuiDrawer::SetupFont() {
 }
 
 void ImGuiDrawer::RenderDrawLists(ImDrawData* data) {
+  if (!data->TotalVtxCount) {
+    // Nothing is visible, so the backend can skip compositing entirely.
+    return;
+  }
   auto drawer = graphics_context_->immediate_drawer();
 
   // Handle cases of screen coordinates != from framebuffer coordinates (e.g.
@@ -203,9 +207,25 @@ void ImGuiDrawer::RenderDrawLists(ImDrawData* data) {
     for (int j = 0; j < cmd_list->CmdBuffer.size(); ++j) {
       const auto& cmd = cmd_list->CmdBuffer[j];
 
+      // Consecutive commands with the same texture and clipping are drawn
+      // together, as their indices are contiguous.
+      int count = cmd.ElemCount;
+      while (j + 1 < cmd_list->CmdBuffer.size() && !cmd.UserCallback) {
+        const auto& next_cmd = cmd_list->CmdBuffer[j + 1];
+        if (next_cmd.UserCallback || next_cmd.TextureId != cmd.TextureId ||
+            next_cmd.ClipRect.x != cmd.ClipRect.x ||
+            next_cmd.ClipRect.y != cmd.ClipRect.y ||
+            next_cmd.ClipRect.z != cmd.ClipRect.z ||
+            next_cmd.ClipRect.w != cmd.ClipRect.w) {
+          break;
+        }
+        count += next_cmd.ElemCount;
+        ++j;
+      }
+
       ImmediateDraw draw;
       draw.primitive_type = ImmediatePrimitiveType::kTriangles;
-      draw.count = cmd.ElemCount;
+      draw.count = count;
       draw.index_offset = index_offset;
       draw.texture_handle =
           reinterpret_cast<uintptr_t>(cmd.TextureId) & ~kIgnoreAlpha;
@@ -219,7 +239,7 @@ void ImGuiDrawer::RenderDrawLists(ImDrawData* data) {
       draw.scissor_rect[3] = static_cast<int>(cmd.ClipRect.w - cmd.ClipRect.y);
       drawer->Draw(draw);
 
-      index_offset += cmd.ElemCount;
+      index_offset += count;
     }
 
     drawer->EndDrawBatch();
@@ -103,8 +103,10 @@ class BaseFencedPool {
     free_batch_list_head_ = batch;
 
     // Relink entries back into free entries list.
-    batch->entry_list_tail->next = free_entry_list_head_;
-    free_entry_list_head_ = batch->entry_list_head;
+    if (batch->entry_list_head) {
+      batch->entry_list_tail->next = free_entry_list_head_;
+      free_entry_list_head_ = batch->entry_list_head;
+    }
     batch->entry_list_head = nullptr;
     batch->entry_list_tail = nullptr;
   }
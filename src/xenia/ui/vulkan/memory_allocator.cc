@@ -0,0 +1,211 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2016 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#include "xenia/ui/vulkan/memory_allocator.h"
+
+#include <gflags/gflags.h>
+
+#include <algorithm>
+#include <cinttypes>
+#include <climits>
+#include <iterator>
+
+#include "xenia/base/assert.h"
+#include "xenia/base/counters.h"
+#include "xenia/base/logging.h"
+#include "xenia/ui/vulkan/vulkan_device.h"
+#include "xenia/ui/vulkan/vulkan_util.h"
+
+DEFINE_int32(vulkan_memory_block_size_mb, 64,
+             "Size of the device memory blocks resources are sub-allocated "
+             "from, in megabytes.");
+
+DEFINE_counter(vulkan_memory_allocations, "vulkan.memory_allocations");
+DEFINE_counter(vulkan_memory_suballocations, "vulkan.memory_suballocations");
+
+namespace xe {
+namespace ui {
+namespace vulkan {
+
+MemoryAllocator::MemoryAllocator(VulkanDevice* device)
+    : device_(device),
+      block_size_(VkDeviceSize(std::max(FLAGS_vulkan_memory_block_size_mb, 1))
+                  << 20) {}
+
+MemoryAllocator::~MemoryAllocator() {
+  auto stats = GetStats();
+  XELOGVK(
+      "Vulkan memory: %u blocks (%" PRIu64 "b), %u dedicated (%" PRIu64
+      "b), %u leaked sub-allocations, %u free ranges",
+      stats.block_count, stats.block_bytes, stats.dedicated_count,
+      stats.dedicated_bytes, stats.allocation_count, stats.free_range_count);
+  assert_zero(allocation_count_);
+  for (auto& block : blocks_) {
+    vkFreeMemory(*device_, block->memory, nullptr);
+  }
+  blocks_.clear();
+}
+
+bool MemoryAllocator::Allocate(const VkMemoryRequirements& requirements,
+                               VkFlags required_properties, bool linear,
+                               Allocation* out_allocation) {
+  uint32_t memory_type =
+      device_->FindMemoryType(requirements, required_properties);
+  if (memory_type == UINT_MAX) {
+    XELOGE("Unable to find a matching memory type");
+    return false;
+  }
+
+  if (requirements.size > block_size_ / 2) {
+    VkMemoryAllocateInfo memory_info;
+    memory_info.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+    memory_info.pNext = nullptr;
+    memory_info.allocationSize = requirements.size;
+    memory_info.memoryTypeIndex = memory_type;
+    VkDeviceMemory memory = nullptr;
+    auto err = vkAllocateMemory(*device_, &memory_info, nullptr, &memory);
+    CheckResult(err, "vkAllocateMemory");
+    if (err != VK_SUCCESS) {
+      return false;
+    }
+    INCREMENT_counter(vulkan_memory_allocations, 1);
+    out_allocation->memory = memory;
+    out_allocation->offset = 0;
+    out_allocation->size = requirements.size;
+    out_allocation->block = nullptr;
+    std::lock_guard<std::mutex> lock(mutex_);
+    ++dedicated_count_;
+    dedicated_bytes_ += requirements.size;
+    return true;
+  }
+
+  VkDeviceSize alignment = std::max(requirements.alignment, VkDeviceSize(1));
+  std::lock_guard<std::mutex> lock(mutex_);
+  for (auto& block : blocks_) {
+    if (block->memory_type == memory_type && block->linear == linear &&
+        AllocateFromBlock(block.get(), requirements.size, alignment,
+                          out_allocation)) {
+      return true;
+    }
+  }
+
+  VkMemoryAllocateInfo memory_info;
+  memory_info.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+  memory_info.pNext = nullptr;
+  memory_info.allocationSize = block_size_;
+  memory_info.memoryTypeIndex = memory_type;
+  VkDeviceMemory memory = nullptr;
+  auto err = vkAllocateMemory(*device_, &memory_info, nullptr, &memory);
+  CheckResult(err, "vkAllocateMemory");
+  if (err != VK_SUCCESS) {
+    return false;
+  }
+  INCREMENT_counter(vulkan_memory_allocations, 1);
+  auto block = std::make_unique<Block>();
+  block->memory = memory;
+  block->size = block_size_;
+  block->memory_type = memory_type;
+  block->linear = linear;
+  block->free_ranges.emplace(0, block_size_);
+  bool allocated = AllocateFromBlock(block.get(), requirements.size,
+                                     alignment, out_allocation);
+  assert_true(allocated);
+  blocks_.push_back(std::move(block));
+  return allocated;
+}
+
+bool MemoryAllocator::AllocateFromBlock(Block* block, VkDeviceSize size,
+                                        VkDeviceSize alignment,
+                                        Allocation* out_allocation) {
+  // First fit, which keeps the low end of the blocks packed.
+  for (auto it = block->free_ranges.begin(); it != block->free_ranges.end();
+       ++it) {
+    VkDeviceSize range_start = it->first;
+    VkDeviceSize range_end = it->first + it->second;
+    VkDeviceSize offset =
+        (range_start + alignment - 1) / alignment * alignment;
+    if (offset + size > range_end) {
+      continue;
+    }
+    block->free_ranges.erase(it);
+    if (offset > range_start) {
+      block->free_ranges.emplace(range_start, offset - range_start);
+    }
+    if (offset + size < range_end) {
+      block->free_ranges.emplace(offset + size, range_end - offset - size);
+    }
+    out_allocation->memory = block->memory;
+    out_allocation->offset = offset;
+    out_allocation->size = size;
+    out_allocation->block = block;
+    ++allocation_count_;
+    allocated_bytes_ += size;
+    INCREMENT_counter(vulkan_memory_suballocations, 1);
+    return true;
+  }
+  return false;
+}
+
+void MemoryAllocator::Free(const Allocation& allocation) {
+  if (!allocation.memory) {
+    return;
+  }
+  if (!allocation.block) {
+    vkFreeMemory(*device_, allocation.memory, nullptr);
+    std::lock_guard<std::mutex> lock(mutex_);
+    --dedicated_count_;
+    dedicated_bytes_ -= allocation.size;
+    return;
+  }
+
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto block = reinterpret_cast<Block*>(allocation.block);
+  auto& free_ranges = block->free_ranges;
+  VkDeviceSize start = allocation.offset;
+  VkDeviceSize end = allocation.offset + allocation.size;
+  // Merge with the free ranges on either side.
+  auto next = free_ranges.lower_bound(start);
+  if (next != free_ranges.begin()) {
+    auto previous = std::prev(next);
+    if (previous->first + previous->second == start) {
+      start = previous->first;
+      free_ranges.erase(previous);
+    }
+  }
+  if (next != free_ranges.end() && next->first == end) {
+    end += next->second;
+    free_ranges.erase(next);
+  }
+  free_ranges.emplace(start, end - start);
+  --allocation_count_;
+  allocated_bytes_ -= allocation.size;
+}
+
+MemoryAllocator::Stats MemoryAllocator::GetStats() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  Stats stats = {};
+  stats.block_count = uint32_t(blocks_.size());
+  stats.dedicated_count = dedicated_count_;
+  stats.dedicated_bytes = dedicated_bytes_;
+  stats.allocation_count = allocation_count_;
+  stats.allocated_bytes = allocated_bytes_;
+  for (auto& block : blocks_) {
+    stats.block_bytes += block->size;
+    stats.free_range_count += uint32_t(block->free_ranges.size());
+    for (auto& range : block->free_ranges) {
+      stats.largest_free_range =
+          std::max(stats.largest_free_range, range.second);
+    }
+  }
+  return stats;
+}
+
+}  // namespace vulkan
+}  // namespace ui
+}  // namespace xe
@@ -0,0 +1,102 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2016 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#ifndef XENIA_UI_VULKAN_MEMORY_ALLOCATOR_H_
+#define XENIA_UI_VULKAN_MEMORY_ALLOCATOR_H_
+
+#include <map>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "xenia/ui/vulkan/vulkan.h"
+
+namespace xe {
+namespace ui {
+namespace vulkan {
+
+class VulkanDevice;
+
+// Sub-allocates device memory from large blocks, as devices only allow a
+// limited number of allocations (as few as 4096) and each one is slow. Each
+// memory type has its own blocks, and linear resources (buffers) are kept
+// apart from optimally tiled images so bufferImageGranularity never needs
+// padding. Requests larger than half a block get their own allocation.
+//
+// All methods are thread safe.
+class MemoryAllocator {
+ public:
+  struct Allocation {
+    VkDeviceMemory memory = nullptr;
+    VkDeviceSize offset = 0;
+    VkDeviceSize size = 0;
+
+   private:
+    friend class MemoryAllocator;
+    // Null for dedicated allocations.
+    void* block = nullptr;
+  };
+
+  struct Stats {
+    // Device memory allocations made for blocks and for large requests.
+    uint32_t block_count;
+    uint32_t dedicated_count;
+    VkDeviceSize block_bytes;
+    VkDeviceSize dedicated_bytes;
+    // Live sub-allocations and the bytes they use within the blocks.
+    uint32_t allocation_count;
+    VkDeviceSize allocated_bytes;
+    // Fragmentation: many free ranges and a small largest one mean the free
+    // block bytes can't be used for large requests.
+    uint32_t free_range_count;
+    VkDeviceSize largest_free_range;
+  };
+
+  explicit MemoryAllocator(VulkanDevice* device);
+  ~MemoryAllocator();
+
+  // Allocates memory of a type matching the requirements and properties.
+  // Returns false if there is none or the device is out of memory.
+  bool Allocate(const VkMemoryRequirements& requirements,
+                VkFlags required_properties, bool linear,
+                Allocation* out_allocation);
+  // Returns the allocation to its block. Blocks are kept once allocated.
+  void Free(const Allocation& allocation);
+
+  Stats GetStats();
+
+ private:
+  struct Block {
+    VkDeviceMemory memory;
+    VkDeviceSize size;
+    uint32_t memory_type;
+    bool linear;
+    // Offset to size of each free range, never adjacent to each other.
+    std::map<VkDeviceSize, VkDeviceSize> free_ranges;
+  };
+
+  bool AllocateFromBlock(Block* block, VkDeviceSize size,
+                         VkDeviceSize alignment, Allocation* out_allocation);
+
+  VulkanDevice* device_ = nullptr;
+  VkDeviceSize block_size_ = 0;
+
+  std::mutex mutex_;
+  std::vector<std::unique_ptr<Block>> blocks_;
+  uint32_t dedicated_count_ = 0;
+  VkDeviceSize dedicated_bytes_ = 0;
+  uint32_t allocation_count_ = 0;
+  VkDeviceSize allocated_bytes_ = 0;
+};
+
+}  // namespace vulkan
+}  // namespace ui
+}  // namespace xe
+
+#endif  // XENIA_UI_VULKAN_MEMORY_ALLOCATOR_H_
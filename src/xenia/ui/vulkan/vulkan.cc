@@ -14,3 +14,22 @@ DEFINE_bool(vulkan_validation, false, "Enable Vulkan validation layers.");
 DEFINE_bool(vulkan_primary_queue_only, false,
             "Force the use of the primary queue, ignoring any additional that "
             "may be present.");
+
+DEFINE_string(vulkan_present_mode, "mailbox",
+              "Present mode to use: 'fifo' (vsync), 'mailbox' (low latency "
+              "without tearing) or 'immediate' (lowest latency, may tear). "
+              "Falls back to fifo if the surface doesn't support it.");
+DEFINE_int32(vulkan_frames_in_flight, 2,
+             "Number of presented frames the GPU may still be working on "
+             "before the display waits for the oldest (1-3). More frames "
+             "smooth out hitches at the cost of latency.");
+
+DEFINE_bool(vulkan_transfer_queue, false,
+            "Upload textures on a dedicated transfer queue, if the device has "
+            "one, so that large uploads overlap with rendering.");
+
+DEFINE_bool(vulkan_extended_dynamic_state, true,
+            "Set cull mode, front face, topology and depth/stencil state "
+            "dynamically if the device supports "
+            "VK_EXT_extended_dynamic_state, so that fewer pipelines are "
+            "created.");
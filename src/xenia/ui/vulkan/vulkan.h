@@ -27,9 +27,53 @@
 // NOTE: header order matters here, unfortunately:
 #include "third_party/vulkan/vk_lunarg_debug_marker.h"
 
+// VK_EXT_extended_dynamic_state is newer than the headers in third_party.
+#ifndef VK_EXT_extended_dynamic_state
+#define VK_EXT_extended_dynamic_state 1
+#define VK_EXT_EXTENDED_DYNAMIC_STATE_EXTENSION_NAME \
+  "VK_EXT_extended_dynamic_state"
+#define VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_EXTENDED_DYNAMIC_STATE_FEATURES_EXT \
+  VkStructureType(1000267000)
+#define VK_DYNAMIC_STATE_CULL_MODE_EXT VkDynamicState(1000267000)
+#define VK_DYNAMIC_STATE_FRONT_FACE_EXT VkDynamicState(1000267001)
+#define VK_DYNAMIC_STATE_PRIMITIVE_TOPOLOGY_EXT VkDynamicState(1000267002)
+#define VK_DYNAMIC_STATE_DEPTH_TEST_ENABLE_EXT VkDynamicState(1000267006)
+#define VK_DYNAMIC_STATE_DEPTH_WRITE_ENABLE_EXT VkDynamicState(1000267007)
+#define VK_DYNAMIC_STATE_DEPTH_COMPARE_OP_EXT VkDynamicState(1000267008)
+#define VK_DYNAMIC_STATE_STENCIL_TEST_ENABLE_EXT VkDynamicState(1000267010)
+#define VK_DYNAMIC_STATE_STENCIL_OP_EXT VkDynamicState(1000267011)
+typedef struct VkPhysicalDeviceExtendedDynamicStateFeaturesEXT {
+  VkStructureType sType;
+  void* pNext;
+  VkBool32 extendedDynamicState;
+} VkPhysicalDeviceExtendedDynamicStateFeaturesEXT;
+typedef void(VKAPI_PTR* PFN_vkCmdSetCullModeEXT)(VkCommandBuffer commandBuffer,
+                                                 VkCullModeFlags cullMode);
+typedef void(VKAPI_PTR* PFN_vkCmdSetFrontFaceEXT)(VkCommandBuffer commandBuffer,
+                                                  VkFrontFace frontFace);
+typedef void(VKAPI_PTR* PFN_vkCmdSetPrimitiveTopologyEXT)(
+    VkCommandBuffer commandBuffer, VkPrimitiveTopology primitiveTopology);
+typedef void(VKAPI_PTR* PFN_vkCmdSetDepthTestEnableEXT)(
+    VkCommandBuffer commandBuffer, VkBool32 depthTestEnable);
+typedef void(VKAPI_PTR* PFN_vkCmdSetDepthWriteEnableEXT)(
+    VkCommandBuffer commandBuffer, VkBool32 depthWriteEnable);
+typedef void(VKAPI_PTR* PFN_vkCmdSetDepthCompareOpEXT)(
+    VkCommandBuffer commandBuffer, VkCompareOp depthCompareOp);
+typedef void(VKAPI_PTR* PFN_vkCmdSetStencilTestEnableEXT)(
+    VkCommandBuffer commandBuffer, VkBool32 stencilTestEnable);
+typedef void(VKAPI_PTR* PFN_vkCmdSetStencilOpEXT)(
+    VkCommandBuffer commandBuffer, VkStencilFaceFlags faceMask,
+    VkStencilOp failOp, VkStencilOp passOp, VkStencilOp depthFailOp,
+    VkCompareOp compareOp);
+#endif  // VK_EXT_extended_dynamic_state
+
 #define XELOGVK XELOGI
 
 DECLARE_bool(vulkan_validation);
 DECLARE_bool(vulkan_primary_queue_only);
+DECLARE_bool(vulkan_transfer_queue);
+DECLARE_string(vulkan_present_mode);
+DECLARE_int32(vulkan_frames_in_flight);
+DECLARE_bool(vulkan_extended_dynamic_state);
 
 #endif  // XENIA_UI_VULKAN_VULKAN_H_
@@ -102,8 +102,6 @@ void VulkanContext::ClearCurrent() {}
 
 void VulkanContext::BeginSwap() {
   SCOPE_profile_cpu_f("gpu");
-  auto provider = static_cast<VulkanProvider*>(provider_);
-  auto device = provider->device();
 
   // If we have a window see if it's been resized since we last swapped.
   // If it has been, we'll need to reinitialize the swap chain before we
@@ -116,29 +114,17 @@ void VulkanContext::BeginSwap() {
     }
   }
 
-  // Acquire the next image and set it up for use.
+  // Acquire the next image and set it up for use. This waits for the GPU if
+  // the maximum number of frames is already in flight.
   swap_chain_->Begin();
-
-  // TODO(benvanik): use a fence instead? May not be possible with target image.
-  std::lock_guard<std::mutex> queue_lock(device->primary_queue_mutex());
-  auto err = vkQueueWaitIdle(device->primary_queue());
-  CheckResult(err, "vkQueueWaitIdle");
 }
 
 void VulkanContext::EndSwap() {
   SCOPE_profile_cpu_f("gpu");
-  auto provider = static_cast<VulkanProvider*>(provider_);
-  auto device = provider->device();
 
   // Notify the presentation engine the image is ready.
   // The contents must be in a coherent state.
   swap_chain_->End();
-
-  // Wait until the queue is idle.
-  // TODO(benvanik): is this required?
-  std::lock_guard<std::mutex> queue_lock(device->primary_queue_mutex());
-  auto err = vkQueueWaitIdle(device->primary_queue());
-  CheckResult(err, "vkQueueWaitIdle");
 }
 
 std::unique_ptr<RawImage> VulkanContext::Capture() {
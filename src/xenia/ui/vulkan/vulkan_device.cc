@@ -12,6 +12,7 @@
 #include <gflags/gflags.h>
 
 #include <cinttypes>
+#include <cstring>
 #include <mutex>
 #include <string>
 
@@ -55,6 +56,7 @@ VulkanDevice::VulkanDevice(VulkanInstance* instance) : instance_(instance) {
 }
 
 VulkanDevice::~VulkanDevice() {
+  memory_allocator_.reset();
   if (handle) {
     vkDestroyDevice(handle, nullptr);
     handle = nullptr;
@@ -95,6 +97,12 @@ bool VulkanDevice::Initialize(DeviceInfo device_info) {
   ENABLE_AND_EXPECT(depthClamp);
   ENABLE_AND_EXPECT(multiViewport);
   ENABLE_AND_EXPECT(independentBlend);
+  ENABLE_AND_EXPECT(shaderSampledImageArrayDynamicIndexing);
+  // Optional features, checked in device_info().features where used.
+  enabled_features.occlusionQueryPrecise =
+      supported_features.occlusionQueryPrecise;
+  enabled_features.vertexPipelineStoresAndAtomics =
+      supported_features.vertexPipelineStoresAndAtomics;
   // TODO(benvanik): add other features.
   if (any_features_missing) {
     XELOGE(
@@ -104,17 +112,19 @@ bool VulkanDevice::Initialize(DeviceInfo device_info) {
   }
 
   // Pick a queue.
-  // Any queue we use must support both graphics and presentation.
+  // Any queue we use must support both graphics and presentation, unless the
+  // instance has no window and nothing is presented.
   // TODO(benvanik): use multiple queues (DMA-only, compute-only, etc).
   if (device_info.queue_family_properties.empty()) {
     FatalVulkanError("No queue families available");
     return false;
   }
+  bool headless = !instance_->has_window();
   uint32_t ideal_queue_family_index = UINT_MAX;
   uint32_t queue_count = 1;
   for (size_t i = 0; i < device_info.queue_family_properties.size(); ++i) {
     auto queue_flags = device_info.queue_family_properties[i].queueFlags;
-    if (!device_info.queue_family_supports_present[i]) {
+    if (!headless && !device_info.queue_family_supports_present[i]) {
       // Can't present from this queue, so ignore it.
       continue;
     }
@@ -137,7 +147,29 @@ bool VulkanDevice::Initialize(DeviceInfo device_info) {
     queue_count = 1;
   }
 
-  VkDeviceQueueCreateInfo queue_info;
+  // Uploads may go on their own queue, preferably a transfer-only family as
+  // those map to the DMA engines. Images are only ever copied whole on it, so
+  // any image transfer granularity is fine.
+  uint32_t transfer_queue_family_index = UINT_MAX;
+  if (FLAGS_vulkan_transfer_queue) {
+    for (size_t i = 0; i < device_info.queue_family_properties.size(); ++i) {
+      auto queue_flags = device_info.queue_family_properties[i].queueFlags;
+      if (!(queue_flags & VK_QUEUE_TRANSFER_BIT) ||
+          (queue_flags & VK_QUEUE_GRAPHICS_BIT)) {
+        continue;
+      }
+      if (transfer_queue_family_index == UINT_MAX ||
+          !(queue_flags & VK_QUEUE_COMPUTE_BIT)) {
+        transfer_queue_family_index = static_cast<uint32_t>(i);
+      }
+    }
+    if (transfer_queue_family_index == UINT_MAX) {
+      XELOGW("No dedicated transfer queue available; uploading on graphics");
+    }
+  }
+
+  VkDeviceQueueCreateInfo queue_infos[2];
+  auto& queue_info = queue_infos[0];
   queue_info.sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO;
   queue_info.pNext = nullptr;
   queue_info.flags = 0;
@@ -147,19 +179,45 @@ bool VulkanDevice::Initialize(DeviceInfo device_info) {
   // Prioritize the primary queue.
   queue_priorities[0] = 1.0f;
   queue_info.pQueuePriorities = queue_priorities.data();
+  float transfer_queue_priority = 1.0f;
+  auto& transfer_queue_info = queue_infos[1];
+  transfer_queue_info.sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO;
+  transfer_queue_info.pNext = nullptr;
+  transfer_queue_info.flags = 0;
+  transfer_queue_info.queueFamilyIndex = transfer_queue_family_index;
+  transfer_queue_info.queueCount = 1;
+  transfer_queue_info.pQueuePriorities = &transfer_queue_priority;
 
   VkDeviceCreateInfo create_info;
   create_info.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO;
   create_info.pNext = nullptr;
   create_info.flags = 0;
-  create_info.queueCreateInfoCount = 1;
-  create_info.pQueueCreateInfos = &queue_info;
+  create_info.queueCreateInfoCount =
+      transfer_queue_family_index != UINT_MAX ? 2 : 1;
+  create_info.pQueueCreateInfos = queue_infos;
   create_info.enabledLayerCount = static_cast<uint32_t>(enabled_layers.size());
   create_info.ppEnabledLayerNames = enabled_layers.data();
   create_info.enabledExtensionCount =
       static_cast<uint32_t>(enabled_extensions.size());
   create_info.ppEnabledExtensionNames = enabled_extensions.data();
   create_info.pEnabledFeatures = &enabled_features;
+  // The feature is required of devices with the extension.
+  bool extended_dynamic_state = false;
+  for (auto extension_name : enabled_extensions) {
+    if (!std::strcmp(extension_name,
+                     VK_EXT_EXTENDED_DYNAMIC_STATE_EXTENSION_NAME)) {
+      extended_dynamic_state = true;
+    }
+  }
+  VkPhysicalDeviceExtendedDynamicStateFeaturesEXT
+      extended_dynamic_state_features;
+  extended_dynamic_state_features.sType =
+      VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_EXTENDED_DYNAMIC_STATE_FEATURES_EXT;
+  extended_dynamic_state_features.pNext = nullptr;
+  extended_dynamic_state_features.extendedDynamicState = VK_TRUE;
+  if (extended_dynamic_state) {
+    create_info.pNext = &extended_dynamic_state_features;
+  }
 
   auto err = vkCreateDevice(device_info.handle, &create_info, nullptr, &handle);
   switch (err) {
@@ -196,6 +254,30 @@ bool VulkanDevice::Initialize(DeviceInfo device_info) {
     free_queues_.push_back(queue);
   }
 
+  if (transfer_queue_family_index != UINT_MAX) {
+    transfer_queue_family_index_ = transfer_queue_family_index;
+    vkGetDeviceQueue(handle, transfer_queue_family_index_, 0,
+                     &transfer_queue_);
+  }
+
+  if (extended_dynamic_state) {
+#define LOAD_DEVICE_FUNCTION(name)                             \
+  extended_dynamic_state_.name = reinterpret_cast<PFN_##name>( \
+      vkGetDeviceProcAddr(handle, #name))
+    LOAD_DEVICE_FUNCTION(vkCmdSetCullModeEXT);
+    LOAD_DEVICE_FUNCTION(vkCmdSetFrontFaceEXT);
+    LOAD_DEVICE_FUNCTION(vkCmdSetPrimitiveTopologyEXT);
+    LOAD_DEVICE_FUNCTION(vkCmdSetDepthTestEnableEXT);
+    LOAD_DEVICE_FUNCTION(vkCmdSetDepthWriteEnableEXT);
+    LOAD_DEVICE_FUNCTION(vkCmdSetDepthCompareOpEXT);
+    LOAD_DEVICE_FUNCTION(vkCmdSetStencilTestEnableEXT);
+    LOAD_DEVICE_FUNCTION(vkCmdSetStencilOpEXT);
+#undef LOAD_DEVICE_FUNCTION
+    XELOGVK("Using VK_EXT_extended_dynamic_state");
+  }
+
+  memory_allocator_ = std::make_unique<MemoryAllocator>(this);
+
   XELOGVK("Device initialized successfully!");
   return true;
 }
@@ -239,11 +321,10 @@ void VulkanDevice::EndRenderDocFrameCapture() {
   api->EndFrameCapture(nullptr, nullptr);
 }
 
-VkDeviceMemory VulkanDevice::AllocateMemory(
-    const VkMemoryRequirements& requirements, VkFlags required_properties) {
+uint32_t VulkanDevice::FindMemoryType(const VkMemoryRequirements& requirements,
+                                      VkFlags required_properties) const {
   // Search memory types to find one matching our requirements and our
   // properties.
-  uint32_t type_index = UINT_MAX;
   for (uint32_t i = 0; i < device_info_.memory_properties.memoryTypeCount;
        ++i) {
     const auto& memory_type = device_info_.memory_properties.memoryTypes[i];
@@ -251,11 +332,16 @@ VkDeviceMemory VulkanDevice::AllocateMemory(
       // Type is available for use; check for a match on properties.
       if ((memory_type.propertyFlags & required_properties) ==
           required_properties) {
-        type_index = i;
-        break;
+        return i;
       }
     }
   }
+  return UINT_MAX;
+}
+
+VkDeviceMemory VulkanDevice::AllocateMemory(
+    const VkMemoryRequirements& requirements, VkFlags required_properties) {
+  uint32_t type_index = FindMemoryType(requirements, required_properties);
   if (type_index == UINT_MAX) {
     XELOGE("Unable to find a matching memory type");
     return nullptr;
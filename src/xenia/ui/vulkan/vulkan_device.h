@@ -10,11 +10,13 @@
 #ifndef XENIA_UI_VULKAN_VULKAN_DEVICE_H_
 #define XENIA_UI_VULKAN_VULKAN_DEVICE_H_
 
+#include <climits>
 #include <memory>
 #include <mutex>
 #include <string>
 #include <vector>
 
+#include "xenia/ui/vulkan/memory_allocator.h"
 #include "xenia/ui/vulkan/vulkan.h"
 #include "xenia/ui/vulkan/vulkan_util.h"
 
@@ -63,6 +65,15 @@ class VulkanDevice {
   VkQueue primary_queue() const { return primary_queue_; }
   const DeviceInfo& device_info() const { return device_info_; }
 
+  // Queue from a family without graphics support (usually a DMA engine),
+  // only created if requested with --vulkan_transfer_queue. Null if the
+  // device has no such family. Only the GPU command processor submits to it,
+  // so it requires no locking.
+  VkQueue transfer_queue() const { return transfer_queue_; }
+  uint32_t transfer_queue_family_index() const {
+    return transfer_queue_family_index_;
+  }
+
   // Acquires a queue for exclusive use by the caller.
   // The queue will not be touched by any other code until it's returned with
   // ReleaseQueue.
@@ -84,10 +95,36 @@ class VulkanDevice {
   // Ends a capture.
   void EndRenderDocFrameCapture();
 
+  // Returns the index of a memory type matching the requirements and the
+  // required properties, or UINT_MAX if there is none.
+  uint32_t FindMemoryType(const VkMemoryRequirements& requirements,
+                          VkFlags required_properties) const;
   // Allocates memory of the given size matching the required properties.
+  // Prefer memory_allocator for resources that come and go.
   VkDeviceMemory AllocateMemory(
       const VkMemoryRequirements& requirements,
       VkFlags required_properties = VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT);
+  // Sub-allocates from shared blocks of device memory.
+  MemoryAllocator* memory_allocator() const { return memory_allocator_.get(); }
+
+  // Entry points of VK_EXT_extended_dynamic_state, all null unless it's
+  // enabled.
+  struct ExtendedDynamicStateFunctions {
+    PFN_vkCmdSetCullModeEXT vkCmdSetCullModeEXT = nullptr;
+    PFN_vkCmdSetFrontFaceEXT vkCmdSetFrontFaceEXT = nullptr;
+    PFN_vkCmdSetPrimitiveTopologyEXT vkCmdSetPrimitiveTopologyEXT = nullptr;
+    PFN_vkCmdSetDepthTestEnableEXT vkCmdSetDepthTestEnableEXT = nullptr;
+    PFN_vkCmdSetDepthWriteEnableEXT vkCmdSetDepthWriteEnableEXT = nullptr;
+    PFN_vkCmdSetDepthCompareOpEXT vkCmdSetDepthCompareOpEXT = nullptr;
+    PFN_vkCmdSetStencilTestEnableEXT vkCmdSetStencilTestEnableEXT = nullptr;
+    PFN_vkCmdSetStencilOpEXT vkCmdSetStencilOpEXT = nullptr;
+  };
+  bool has_extended_dynamic_state() const {
+    return extended_dynamic_state_.vkCmdSetCullModeEXT != nullptr;
+  }
+  const ExtendedDynamicStateFunctions& extended_dynamic_state() const {
+    return extended_dynamic_state_;
+  }
 
  private:
   VulkanInstance* instance_ = nullptr;
@@ -100,6 +137,10 @@ class VulkanDevice {
   std::mutex queue_mutex_;
   VkQueue primary_queue_ = nullptr;
   std::vector<VkQueue> free_queues_;
+  uint32_t transfer_queue_family_index_ = UINT_MAX;
+  VkQueue transfer_queue_ = nullptr;
+  std::unique_ptr<MemoryAllocator> memory_allocator_;
+  ExtendedDynamicStateFunctions extended_dynamic_state_;
 };
 
 }  // namespace vulkan
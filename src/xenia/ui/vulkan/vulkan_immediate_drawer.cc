@@ -84,43 +84,49 @@ class LightweightCircularBuffer {
   VkBuffer vertex_buffer() const { return vertex_buffer_; }
   VkBuffer index_buffer() const { return index_buffer_; }
 
-  // Allocates space for data and copies it into the buffer.
+  // Allocates space for data and copies it into the buffer. The data must be
+  // flushed with Flush before the commands using it are submitted.
   // Returns the offset in the buffer of the data or VK_WHOLE_SIZE if the buffer
   // is full.
   VkDeviceSize Emplace(const void* source_data, size_t source_length) {
     // TODO(benvanik): query actual alignment.
-    source_length = xe::round_up(source_length, 256);
+    size_t aligned_length = xe::round_up(source_length, 256);
+    if (aligned_length > buffer_capacity_) {
+      return VK_WHOLE_SIZE;
+    }
 
     // Run down old fences to free up space.
 
-    // Check to see if we have space.
-    // return VK_WHOLE_SIZE;
-
     // Compute new range and mark as in use.
-    if (current_offset_ + source_length > buffer_capacity_) {
+    if (current_offset_ + aligned_length > buffer_capacity_) {
       // Wraps around.
+      Flush();
       current_offset_ = 0;
+      dirty_offset_ = 0;
     }
     VkDeviceSize offset = current_offset_;
-    current_offset_ += source_length;
+    current_offset_ += aligned_length;
 
     // Copy data.
     auto dest_ptr = reinterpret_cast<uint8_t*>(buffer_data_) + offset;
     std::memcpy(dest_ptr, source_data, source_length);
+    return offset;
+  }
 
-    // Insert fence.
-    // TODO(benvanik): coarse-grained fences, these may be too fine.
-
-    // Flush memory.
-    // TODO(benvanik): do only in large batches? can barrier it.
+  // Flushes everything emplaced since the last flush, so a frame takes one
+  // flush rather than one per upload.
+  void Flush() {
+    if (current_offset_ == dirty_offset_) {
+      return;
+    }
     VkMappedMemoryRange dirty_range;
     dirty_range.sType = VK_STRUCTURE_TYPE_MAPPED_MEMORY_RANGE;
     dirty_range.pNext = nullptr;
     dirty_range.memory = buffer_memory_;
-    dirty_range.offset = offset;
-    dirty_range.size = source_length;
+    dirty_range.offset = dirty_offset_;
+    dirty_range.size = current_offset_ - dirty_offset_;
     vkFlushMappedMemoryRanges(device_, 1, &dirty_range);
-    return offset;
+    dirty_offset_ = current_offset_;
   }
 
  private:
@@ -132,6 +138,8 @@ class LightweightCircularBuffer {
   void* buffer_data_ = nullptr;
   size_t buffer_capacity_ = 0;
   size_t current_offset_ = 0;
+  // Start of the data not flushed yet.
+  size_t dirty_offset_ = 0;
 };
 
 class VulkanImmediateTexture : public ImmediateTexture {
@@ -689,7 +697,7 @@ void VulkanImmediateDrawer::Begin(int render_target_width,
   auto device = context_->device();
   auto swap_chain = context_->swap_chain();
   assert_null(current_cmd_buffer_);
-  current_cmd_buffer_ = swap_chain->render_cmd_buffer();
+  current_cmd_buffer_ = swap_chain->BeginRender();
   current_render_target_width_ = render_target_width;
   current_render_target_height_ = render_target_height;
 
@@ -703,6 +711,12 @@ void VulkanImmediateDrawer::Begin(int render_target_width,
   viewport.maxDepth = 1.0f;
   vkCmdSetViewport(current_cmd_buffer_, 0, 1, &viewport);
 
+  // State is set lazily by Draw, as consecutive draws mostly share it.
+  current_pipeline_ = nullptr;
+  current_texture_set_ = nullptr;
+  current_restrict_texture_samples_ = -1;
+  current_scissor_valid_ = false;
+
   // Update projection matrix.
   const float ortho_projection[4][4] = {
       {2.0f / render_target_width, 0.0f, 0.0f, 0.0f},
@@ -747,16 +761,20 @@ void VulkanImmediateDrawer::BeginDrawBatch(const ImmediateDrawBatch& batch) {
 void VulkanImmediateDrawer::Draw(const ImmediateDraw& draw) {
   auto swap_chain = context_->swap_chain();
 
+  VkPipeline pipeline = nullptr;
   switch (draw.primitive_type) {
     case ImmediatePrimitiveType::kLines:
-      vkCmdBindPipeline(current_cmd_buffer_, VK_PIPELINE_BIND_POINT_GRAPHICS,
-                        line_pipeline_);
+      pipeline = line_pipeline_;
       break;
     case ImmediatePrimitiveType::kTriangles:
-      vkCmdBindPipeline(current_cmd_buffer_, VK_PIPELINE_BIND_POINT_GRAPHICS,
-                        triangle_pipeline_);
+      pipeline = triangle_pipeline_;
       break;
   }
+  if (pipeline != current_pipeline_) {
+    vkCmdBindPipeline(current_cmd_buffer_, VK_PIPELINE_BIND_POINT_GRAPHICS,
+                      pipeline);
+    current_pipeline_ = pipeline;
+  }
 
   // Setup texture binding.
   auto texture = reinterpret_cast<VulkanImmediateTexture*>(draw.texture_handle);
@@ -766,17 +784,23 @@ void VulkanImmediateDrawer::Draw(const ImmediateDraw& draw) {
     }
 
     auto texture_set = texture->descriptor_set();
-    vkCmdBindDescriptorSets(current_cmd_buffer_,
-                            VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline_layout_,
-                            0, 1, &texture_set, 0, nullptr);
+    if (texture_set != current_texture_set_) {
+      vkCmdBindDescriptorSets(current_cmd_buffer_,
+                              VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline_layout_,
+                              0, 1, &texture_set, 0, nullptr);
+      current_texture_set_ = texture_set;
+    }
   }
 
   // Use push constants for our per-draw changes.
   // Here, the restrict_texture_samples uniform.
   int restrict_texture_samples = draw.restrict_texture_samples ? 1 : 0;
-  vkCmdPushConstants(current_cmd_buffer_, pipeline_layout_,
-                     VK_SHADER_STAGE_FRAGMENT_BIT, sizeof(float) * 16,
-                     sizeof(int), &restrict_texture_samples);
+  if (restrict_texture_samples != current_restrict_texture_samples_) {
+    vkCmdPushConstants(current_cmd_buffer_, pipeline_layout_,
+                       VK_SHADER_STAGE_FRAGMENT_BIT, sizeof(float) * 16,
+                       sizeof(int), &restrict_texture_samples);
+    current_restrict_texture_samples_ = restrict_texture_samples;
+  }
 
   // Scissor, if enabled.
   // Scissor can be disabled by making it the full screen.
@@ -793,7 +817,15 @@ void VulkanImmediateDrawer::Draw(const ImmediateDraw& draw) {
     scissor.extent.width = current_render_target_width_;
     scissor.extent.height = current_render_target_height_;
   }
-  vkCmdSetScissor(current_cmd_buffer_, 0, 1, &scissor);
+  if (!current_scissor_valid_ ||
+      scissor.offset.x != current_scissor_.offset.x ||
+      scissor.offset.y != current_scissor_.offset.y ||
+      scissor.extent.width != current_scissor_.extent.width ||
+      scissor.extent.height != current_scissor_.extent.height) {
+    vkCmdSetScissor(current_cmd_buffer_, 0, 1, &scissor);
+    current_scissor_ = scissor;
+    current_scissor_valid_ = true;
+  }
 
   // Issue draw.
   if (batch_has_index_buffer_) {
@@ -806,7 +838,10 @@ void VulkanImmediateDrawer::Draw(const ImmediateDraw& draw) {
 
 void VulkanImmediateDrawer::EndDrawBatch() {}
 
-void VulkanImmediateDrawer::End() { current_cmd_buffer_ = nullptr; }
+void VulkanImmediateDrawer::End() {
+  circular_buffer_->Flush();
+  current_cmd_buffer_ = nullptr;
+}
 
 }  // namespace vulkan
 }  // namespace ui
@@ -66,6 +66,12 @@ class VulkanImmediateDrawer : public ImmediateDrawer {
   VkCommandBuffer current_cmd_buffer_ = nullptr;
   int current_render_target_width_ = 0;
   int current_render_target_height_ = 0;
+  // State last set in the command buffer since Begin.
+  VkPipeline current_pipeline_ = nullptr;
+  VkDescriptorSet current_texture_set_ = nullptr;
+  int current_restrict_texture_samples_ = -1;
+  VkRect2D current_scissor_;
+  bool current_scissor_valid_ = false;
 };
 
 }  // namespace vulkan
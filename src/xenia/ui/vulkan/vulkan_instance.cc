@@ -61,6 +61,7 @@ VulkanInstance::~VulkanInstance() { DestroyInstance(); }
 bool VulkanInstance::Initialize(Window* any_target_window) {
   auto version = Version::Parse(VK_API_VERSION);
   XELOGVK("Initializing Vulkan %s...", version.pretty_string.c_str());
+  has_window_ = any_target_window != nullptr;
 
   // Hook into renderdoc, if it's available.
   EnableRenderDoc();
@@ -364,32 +365,36 @@ bool VulkanInstance::QueryDevices(Window* any_target_window) {
     vkGetPhysicalDeviceQueueFamilyProperties(
         device_handle, &count, device_info.queue_family_properties.data());
 
-    // Gather queue family presentation support.
+    // Gather queue family presentation support. Without a window nothing is
+    // presented, so no family is marked as supporting it.
     // TODO(benvanik): move to swap chain?
-    VkSurfaceKHR any_surface = nullptr;
+    device_info.queue_family_supports_present.resize(
+        device_info.queue_family_properties.size());
+    if (any_target_window) {
+      VkSurfaceKHR any_surface = nullptr;
 #if XE_PLATFORM_WIN32
-    VkWin32SurfaceCreateInfoKHR create_info;
-    create_info.sType = VK_STRUCTURE_TYPE_WIN32_SURFACE_CREATE_INFO_KHR;
-    create_info.pNext = nullptr;
-    create_info.flags = 0;
-    create_info.hinstance =
-        static_cast<HINSTANCE>(any_target_window->native_platform_handle());
-    create_info.hwnd = static_cast<HWND>(any_target_window->native_handle());
-    err = vkCreateWin32SurfaceKHR(handle, &create_info, nullptr, &any_surface);
-    CheckResult(err, "vkCreateWin32SurfaceKHR");
+      VkWin32SurfaceCreateInfoKHR create_info;
+      create_info.sType = VK_STRUCTURE_TYPE_WIN32_SURFACE_CREATE_INFO_KHR;
+      create_info.pNext = nullptr;
+      create_info.flags = 0;
+      create_info.hinstance =
+          static_cast<HINSTANCE>(any_target_window->native_platform_handle());
+      create_info.hwnd = static_cast<HWND>(any_target_window->native_handle());
+      err =
+          vkCreateWin32SurfaceKHR(handle, &create_info, nullptr, &any_surface);
+      CheckResult(err, "vkCreateWin32SurfaceKHR");
 #else
 #error Platform not yet implemented.
 #endif  // XE_PLATFORM_WIN32
-    device_info.queue_family_supports_present.resize(
-        device_info.queue_family_properties.size());
-    for (size_t j = 0; j < device_info.queue_family_supports_present.size();
-         ++j) {
-      err = vkGetPhysicalDeviceSurfaceSupportKHR(
-          device_handle, static_cast<uint32_t>(j), any_surface,
-          &device_info.queue_family_supports_present[j]);
-      CheckResult(err, "vkGetPhysicalDeviceSurfaceSupportKHR");
+      for (size_t j = 0; j < device_info.queue_family_supports_present.size();
+           ++j) {
+        err = vkGetPhysicalDeviceSurfaceSupportKHR(
+            device_handle, static_cast<uint32_t>(j), any_surface,
+            &device_info.queue_family_supports_present[j]);
+        CheckResult(err, "vkGetPhysicalDeviceSurfaceSupportKHR");
+      }
+      vkDestroySurfaceKHR(handle, any_surface, nullptr);
     }
-    vkDestroySurfaceKHR(handle, any_surface, nullptr);
 
     // Gather layers.
     std::vector<VkLayerProperties> layer_properties;
@@ -51,8 +51,12 @@ class VulkanInstance {
   // If initialization succeeds it's likely that no more failures beyond runtime
   // issues will occur.
   // TODO(benvanik): remove need for any_target_window - it's just for queries.
+  // May be null when nothing will be presented, as in headless mode.
   bool Initialize(Window* any_target_window);
 
+  // Whether the instance was initialized for presenting to a window.
+  bool has_window() const { return has_window_; }
+
   // Returns a list of all available devices as detected during initialization.
   const std::vector<DeviceInfo>& available_devices() const {
     return available_devices_;
@@ -97,6 +101,7 @@ class VulkanInstance {
 
   void* renderdoc_api_ = nullptr;
   bool is_renderdoc_attached_ = false;
+  bool has_window_ = false;
 };
 
 }  // namespace vulkan
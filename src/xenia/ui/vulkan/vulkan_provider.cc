@@ -75,6 +75,11 @@ bool VulkanProvider::Initialize() {
   device_ = std::make_unique<VulkanDevice>(instance_.get());
   device_->DeclareRequiredExtension("VK_KHR_swapchain", Version::Make(0, 0, 0),
                                     false);
+  if (FLAGS_vulkan_extended_dynamic_state) {
+    device_->DeclareRequiredExtension(
+        VK_EXT_EXTENDED_DYNAMIC_STATE_EXTENSION_NAME, Version::Make(0, 0, 0),
+        true);
+  }
   if (!device_->Initialize(device_info)) {
     XELOGE("Unable to initialize device");
     return false;
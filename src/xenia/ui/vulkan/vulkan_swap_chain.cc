@@ -11,6 +11,7 @@
 
 #include <gflags/gflags.h>
 
+#include <algorithm>
 #include <mutex>
 #include <string>
 
@@ -95,22 +96,31 @@ bool VulkanSwapChain::Initialize(VkSurfaceKHR surface) {
   surface_width_ = extent.width;
   surface_height_ = extent.height;
 
-  // Always prefer mailbox mode (non-tearing, low-latency).
-  // If it's not available we'll use immediate (tearing, low-latency).
-  // If not even that we fall back to FIFO, which sucks.
+  // FIFO is the only mode that's always supported.
   VkPresentModeKHR present_mode = VK_PRESENT_MODE_FIFO_KHR;
-  for (size_t i = 0; i < present_modes.size(); ++i) {
-    if (present_modes[i] == VK_PRESENT_MODE_MAILBOX_KHR) {
-      // This is the best, so early-out.
-      present_mode = VK_PRESENT_MODE_MAILBOX_KHR;
-      break;
-    } else if (present_modes[i] == VK_PRESENT_MODE_IMMEDIATE_KHR) {
-      present_mode = VK_PRESENT_MODE_IMMEDIATE_KHR;
-    }
+  VkPresentModeKHR requested_present_mode = VK_PRESENT_MODE_FIFO_KHR;
+  if (FLAGS_vulkan_present_mode == "mailbox") {
+    requested_present_mode = VK_PRESENT_MODE_MAILBOX_KHR;
+  } else if (FLAGS_vulkan_present_mode == "immediate") {
+    requested_present_mode = VK_PRESENT_MODE_IMMEDIATE_KHR;
+  } else if (FLAGS_vulkan_present_mode != "fifo") {
+    XELOGW("Unknown present mode '%s'; using fifo",
+           FLAGS_vulkan_present_mode.c_str());
+  }
+  if (std::find(present_modes.begin(), present_modes.end(),
+                requested_present_mode) != present_modes.end()) {
+    present_mode = requested_present_mode;
+  } else {
+    XELOGW("Present mode %s unsupported; using fifo",
+           to_string(requested_present_mode));
   }
 
-  // Determine the number of images (1 + number queued).
-  uint32_t image_count = surface_caps.minImageCount + 1;
+  // Frames in flight are each rendered to their own image, plus the one
+  // being displayed.
+  uint32_t frame_count =
+      uint32_t(std::min(std::max(FLAGS_vulkan_frames_in_flight, 1), 3));
+  uint32_t image_count =
+      std::max(surface_caps.minImageCount + 1, frame_count + 1);
   if (surface_caps.maxImageCount > 0 &&
       image_count > surface_caps.maxImageCount) {
     // Too many requested - use whatever we can.
@@ -176,20 +186,41 @@ bool VulkanSwapChain::Initialize(VkSurfaceKHR surface) {
   err = vkCreateCommandPool(*device_, &cmd_pool_info, nullptr, &cmd_pool_);
   CheckResult(err, "vkCreateCommandPool");
 
-  // Make a command buffer we'll do all our primary rendering from.
+  // Each frame has a command buffer we'll do all our primary rendering from
+  // and another that handles image copies, along with the semaphores and the
+  // fence synchronizing it with the swap chain and us.
   VkCommandBufferAllocateInfo cmd_buffer_info;
   cmd_buffer_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
   cmd_buffer_info.pNext = nullptr;
   cmd_buffer_info.commandPool = cmd_pool_;
   cmd_buffer_info.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
   cmd_buffer_info.commandBufferCount = 1;
-  err =
-      vkAllocateCommandBuffers(*device_, &cmd_buffer_info, &render_cmd_buffer_);
-  CheckResult(err, "vkCreateCommandBuffer");
-
-  // Create another command buffer that handles image copies.
-  err = vkAllocateCommandBuffers(*device_, &cmd_buffer_info, &copy_cmd_buffer_);
-  CheckResult(err, "vkCreateCommandBuffer");
+  VkSemaphoreCreateInfo semaphore_info;
+  semaphore_info.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+  semaphore_info.pNext = nullptr;
+  semaphore_info.flags = 0;
+  VkFenceCreateInfo fence_info;
+  fence_info.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+  fence_info.pNext = nullptr;
+  fence_info.flags = 0;
+  frames_.resize(frame_count);
+  current_frame_index_ = 0;
+  for (auto& frame : frames_) {
+    err = vkAllocateCommandBuffers(*device_, &cmd_buffer_info,
+                                   &frame.render_cmd_buffer);
+    CheckResult(err, "vkCreateCommandBuffer");
+    err = vkAllocateCommandBuffers(*device_, &cmd_buffer_info,
+                                   &frame.copy_cmd_buffer);
+    CheckResult(err, "vkCreateCommandBuffer");
+    err = vkCreateSemaphore(*device_, &semaphore_info, nullptr,
+                            &frame.image_available_semaphore);
+    CheckResult(err, "vkCreateSemaphore");
+    err = vkCreateSemaphore(*device_, &semaphore_info, nullptr,
+                            &frame.render_complete_semaphore);
+    CheckResult(err, "vkCreateSemaphore");
+    err = vkCreateFence(*device_, &fence_info, nullptr, &frame.fence);
+    CheckResult(err, "vkCreateFence");
+  }
 
   // Create the render pass used to draw to the swap chain.
   // The actual framebuffer attached will depend on which image we are drawing
@@ -233,15 +264,6 @@ bool VulkanSwapChain::Initialize(VkSurfaceKHR surface) {
   err = vkCreateRenderPass(*device_, &render_pass_info, nullptr, &render_pass_);
   CheckResult(err, "vkCreateRenderPass");
 
-  // Create a semaphore we'll use to synchronize with the swapchain.
-  VkSemaphoreCreateInfo semaphore_info;
-  semaphore_info.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
-  semaphore_info.pNext = nullptr;
-  semaphore_info.flags = 0;
-  err = vkCreateSemaphore(*device_, &semaphore_info, nullptr,
-                          &image_available_semaphore_);
-  CheckResult(err, "vkCreateSemaphore");
-
   // Get images we will be presenting to.
   // Note that this may differ from our requested amount.
   uint32_t actual_image_count = 0;
@@ -333,23 +355,23 @@ bool VulkanSwapChain::Reinitialize() {
 }
 
 void VulkanSwapChain::Shutdown() {
-  // TODO(benvanik): properly wait for a clean state.
+  WaitOnSubmittedFrames();
   for (auto& buffer : buffers_) {
     DestroyBuffer(&buffer);
   }
   buffers_.clear();
-  if (image_available_semaphore_) {
-    vkDestroySemaphore(*device_, image_available_semaphore_, nullptr);
-    image_available_semaphore_ = nullptr;
+  for (auto& frame : frames_) {
+    vkDestroyFence(*device_, frame.fence, nullptr);
+    vkDestroySemaphore(*device_, frame.render_complete_semaphore, nullptr);
+    vkDestroySemaphore(*device_, frame.image_available_semaphore, nullptr);
+    vkFreeCommandBuffers(*device_, cmd_pool_, 1, &frame.copy_cmd_buffer);
+    vkFreeCommandBuffers(*device_, cmd_pool_, 1, &frame.render_cmd_buffer);
   }
+  frames_.clear();
   if (render_pass_) {
     vkDestroyRenderPass(*device_, render_pass_, nullptr);
     render_pass_ = nullptr;
   }
-  if (render_cmd_buffer_) {
-    vkFreeCommandBuffers(*device_, cmd_pool_, 1, &render_cmd_buffer_);
-    render_cmd_buffer_ = nullptr;
-  }
   if (cmd_pool_) {
     vkDestroyCommandPool(*device_, cmd_pool_, nullptr);
     cmd_pool_ = nullptr;
@@ -365,34 +387,40 @@ void VulkanSwapChain::Shutdown() {
   }
 }
 
-bool VulkanSwapChain::Begin() {
-  // Get the index of the next available swapchain image.
-  auto err =
-      vkAcquireNextImageKHR(*device_, handle, 0, image_available_semaphore_,
-                            nullptr, &current_buffer_index_);
-  CheckResult(err, "vkAcquireNextImageKHR");
+void VulkanSwapChain::WaitOnSubmittedFrames() {
+  for (auto& frame : frames_) {
+    if (frame.submitted) {
+      auto err =
+          vkWaitForFences(*device_, 1, &frame.fence, VK_TRUE, UINT64_MAX);
+      CheckResult(err, "vkWaitForFences");
+      frame.submitted = false;
+    }
+  }
+}
 
-  // Wait for the acquire semaphore to be signaled so that the following
-  // operations know they can start modifying the image.
-  VkSubmitInfo wait_submit_info;
-  wait_submit_info.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
-  wait_submit_info.pNext = nullptr;
-  wait_submit_info.waitSemaphoreCount = 1;
-  wait_submit_info.pWaitSemaphores = &image_available_semaphore_;
-  wait_submit_info.commandBufferCount = 0;
-  wait_submit_info.pCommandBuffers = nullptr;
-  wait_submit_info.signalSemaphoreCount = 0;
-  wait_submit_info.pSignalSemaphores = nullptr;
-  {
-    std::lock_guard<std::mutex> queue_lock(device_->primary_queue_mutex());
-    err =
-        vkQueueSubmit(device_->primary_queue(), 1, &wait_submit_info, nullptr);
+bool VulkanSwapChain::Begin() {
+  // Wait until the GPU is done with the last use of this frame's resources.
+  // This is what limits the number of frames in flight.
+  auto& frame = frames_[current_frame_index_];
+  if (frame.submitted) {
+    auto err = vkWaitForFences(*device_, 1, &frame.fence, VK_TRUE, UINT64_MAX);
+    CheckResult(err, "vkWaitForFences");
+    frame.submitted = false;
   }
-  CheckResult(err, "vkQueueSubmit");
+  vkResetFences(*device_, 1, &frame.fence);
+
+  // Get the index of the next available swapchain image. Rendering to it
+  // waits for the semaphore, so that it starts once the image is released.
+  auto err = vkAcquireNextImageKHR(*device_, handle, UINT64_MAX,
+                                   frame.image_available_semaphore, nullptr,
+                                   &current_buffer_index_);
+  CheckResult(err, "vkAcquireNextImageKHR");
 
   // Reset all command buffers.
-  vkResetCommandBuffer(render_cmd_buffer_, 0);
-  vkResetCommandBuffer(copy_cmd_buffer_, 0);
+  auto render_cmd_buffer = frame.render_cmd_buffer;
+  auto copy_cmd_buffer = frame.copy_cmd_buffer;
+  vkResetCommandBuffer(render_cmd_buffer, 0);
+  vkResetCommandBuffer(copy_cmd_buffer, 0);
   auto& current_buffer = buffers_[current_buffer_index_];
 
   // Build the command buffer that will execute all queued rendering buffers.
@@ -401,11 +429,11 @@ bool VulkanSwapChain::Begin() {
   begin_info.pNext = nullptr;
   begin_info.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
   begin_info.pInheritanceInfo = nullptr;
-  err = vkBeginCommandBuffer(render_cmd_buffer_, &begin_info);
+  err = vkBeginCommandBuffer(render_cmd_buffer, &begin_info);
   CheckResult(err, "vkBeginCommandBuffer");
 
   // Start recording the copy command buffer as well.
-  err = vkBeginCommandBuffer(copy_cmd_buffer_, &begin_info);
+  err = vkBeginCommandBuffer(copy_cmd_buffer, &begin_info);
   CheckResult(err, "vkBeginCommandBuffer");
 
   // Transition the image to a format we can copy to.
@@ -425,11 +453,23 @@ bool VulkanSwapChain::Begin() {
   pre_image_memory_barrier.subresourceRange.levelCount = 1;
   pre_image_memory_barrier.subresourceRange.baseArrayLayer = 0;
   pre_image_memory_barrier.subresourceRange.layerCount = 1;
-  vkCmdPipelineBarrier(copy_cmd_buffer_, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
+  vkCmdPipelineBarrier(copy_cmd_buffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
                        VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, 0, 0, nullptr, 0,
                        nullptr, 1, &pre_image_memory_barrier);
 
-  // First: Issue a command to clear the render target.
+  // The clear and the render pass are recorded on demand, as copies may
+  // cover the whole surface and there may be nothing to composite.
+  clear_pending_ = true;
+  render_pass_begun_ = false;
+
+  return true;
+}
+
+void VulkanSwapChain::ClearIfPending() {
+  if (!clear_pending_) {
+    return;
+  }
+  clear_pending_ = false;
   VkImageSubresourceRange clear_range = {VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1};
   VkClearColorValue clear_color;
   clear_color.float32[0] = 238 / 255.0f;
@@ -442,16 +482,44 @@ bool VulkanSwapChain::Begin() {
     clear_color.float32[1] = 1.0f;
     clear_color.float32[2] = 0.0f;
   }
-  vkCmdClearColorImage(copy_cmd_buffer_, current_buffer.image,
+  vkCmdClearColorImage(frames_[current_frame_index_].copy_cmd_buffer,
+                       buffers_[current_buffer_index_].image,
                        VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, &clear_color, 1,
                        &clear_range);
+}
+
+VkCommandBuffer VulkanSwapChain::BeginCopy(bool covers_surface) {
+  if (covers_surface) {
+    clear_pending_ = false;
+  } else {
+    ClearIfPending();
+  }
+  return frames_[current_frame_index_].copy_cmd_buffer;
+}
+
+VkCommandBuffer VulkanSwapChain::BeginRender() {
+  auto render_cmd_buffer = frames_[current_frame_index_].render_cmd_buffer;
+  if (render_pass_begun_) {
+    return render_cmd_buffer;
+  }
+  render_pass_begun_ = true;
+  ClearIfPending();
+  auto& current_buffer = buffers_[current_buffer_index_];
 
   // Transition the image to a color attachment target for drawing.
+  VkImageMemoryBarrier pre_image_memory_barrier;
+  pre_image_memory_barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+  pre_image_memory_barrier.pNext = nullptr;
   pre_image_memory_barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
   pre_image_memory_barrier.dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
   pre_image_memory_barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
   pre_image_memory_barrier.newLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
-  vkCmdPipelineBarrier(render_cmd_buffer_, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
+  pre_image_memory_barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+  pre_image_memory_barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+  pre_image_memory_barrier.image = current_buffer.image;
+  pre_image_memory_barrier.subresourceRange = {VK_IMAGE_ASPECT_COLOR_BIT, 0, 1,
+                                               0, 1};
+  vkCmdPipelineBarrier(render_cmd_buffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
                        VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, 0, 0, nullptr, 0,
                        nullptr, 1, &pre_image_memory_barrier);
 
@@ -467,28 +535,40 @@ bool VulkanSwapChain::Begin() {
   render_pass_begin_info.renderArea.extent.height = surface_height_;
   render_pass_begin_info.clearValueCount = 0;
   render_pass_begin_info.pClearValues = nullptr;
-  vkCmdBeginRenderPass(render_cmd_buffer_, &render_pass_begin_info,
+  vkCmdBeginRenderPass(render_cmd_buffer, &render_pass_begin_info,
                        VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS);
-
-  return true;
+  return render_cmd_buffer;
 }
 
 bool VulkanSwapChain::End() {
+  auto& frame = frames_[current_frame_index_];
+  auto render_cmd_buffer = frame.render_cmd_buffer;
+  auto copy_cmd_buffer = frame.copy_cmd_buffer;
   auto& current_buffer = buffers_[current_buffer_index_];
 
+  // Nothing may have been copied or drawn.
+  ClearIfPending();
+
   // End render pass.
-  vkCmdEndRenderPass(render_cmd_buffer_);
+  if (render_pass_begun_) {
+    vkCmdEndRenderPass(render_cmd_buffer);
+  }
 
   // Transition the image to a format the presentation engine can source from.
   // FIXME: Do we need more synchronization here between the copy buffer?
   VkImageMemoryBarrier post_image_memory_barrier;
   post_image_memory_barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
   post_image_memory_barrier.pNext = nullptr;
-  post_image_memory_barrier.srcAccessMask =
-      VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+  if (render_pass_begun_) {
+    post_image_memory_barrier.srcAccessMask =
+        VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+    post_image_memory_barrier.oldLayout =
+        VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+  } else {
+    post_image_memory_barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    post_image_memory_barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+  }
   post_image_memory_barrier.dstAccessMask = 0;
-  post_image_memory_barrier.oldLayout =
-      VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
   post_image_memory_barrier.newLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
   post_image_memory_barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
   post_image_memory_barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
@@ -499,35 +579,41 @@ bool VulkanSwapChain::End() {
   post_image_memory_barrier.subresourceRange.levelCount = 1;
   post_image_memory_barrier.subresourceRange.baseArrayLayer = 0;
   post_image_memory_barrier.subresourceRange.layerCount = 1;
-  vkCmdPipelineBarrier(render_cmd_buffer_, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT,
-                       VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, 0, 0, nullptr, 0,
-                       nullptr, 1, &post_image_memory_barrier);
+  vkCmdPipelineBarrier(
+      render_pass_begun_ ? render_cmd_buffer : copy_cmd_buffer,
+      VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, 0,
+      0, nullptr, 0, nullptr, 1, &post_image_memory_barrier);
 
-  auto err = vkEndCommandBuffer(render_cmd_buffer_);
+  auto err = vkEndCommandBuffer(render_cmd_buffer);
   CheckResult(err, "vkEndCommandBuffer");
 
-  err = vkEndCommandBuffer(copy_cmd_buffer_);
+  err = vkEndCommandBuffer(copy_cmd_buffer);
   CheckResult(err, "vkEndCommandBuffer");
 
-  VkCommandBuffer command_buffers[] = {copy_cmd_buffer_, render_cmd_buffer_};
+  // The render command buffer is left out if it's empty.
+  VkCommandBuffer command_buffers[] = {copy_cmd_buffer, render_cmd_buffer};
 
-  // Submit rendering.
+  // Submit rendering once the image has been acquired. The fence tells us
+  // when this frame's resources can be reused.
+  VkPipelineStageFlags wait_dst_stage_mask = VK_PIPELINE_STAGE_ALL_COMMANDS_BIT;
   VkSubmitInfo render_submit_info;
   render_submit_info.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
   render_submit_info.pNext = nullptr;
-  render_submit_info.waitSemaphoreCount = 0;
-  render_submit_info.pWaitSemaphores = nullptr;
-  render_submit_info.commandBufferCount =
-      static_cast<uint32_t>(xe::countof(command_buffers));
+  render_submit_info.waitSemaphoreCount = 1;
+  render_submit_info.pWaitSemaphores = &frame.image_available_semaphore;
+  render_submit_info.pWaitDstStageMask = &wait_dst_stage_mask;
+  render_submit_info.commandBufferCount = render_pass_begun_ ? 2 : 1;
   render_submit_info.pCommandBuffers = command_buffers;
-  render_submit_info.signalSemaphoreCount = 0;
-  render_submit_info.pSignalSemaphores = nullptr;
+  render_submit_info.signalSemaphoreCount = 1;
+  render_submit_info.pSignalSemaphores = &frame.render_complete_semaphore;
   {
     std::lock_guard<std::mutex> queue_lock(device_->primary_queue_mutex());
     err = vkQueueSubmit(device_->primary_queue(), 1, &render_submit_info,
-                        nullptr);
+                        frame.fence);
   }
   CheckResult(err, "vkQueueSubmit");
+  frame.submitted = err == VK_SUCCESS;
+  current_frame_index_ = (current_frame_index_ + 1) % frames_.size();
 
   // Queue the present of our current image.
   const VkSwapchainKHR swap_chains[] = {handle};
@@ -535,8 +621,8 @@ bool VulkanSwapChain::End() {
   VkPresentInfoKHR present_info;
   present_info.sType = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR;
   present_info.pNext = nullptr;
-  present_info.waitSemaphoreCount = 0;
-  present_info.pWaitSemaphores = nullptr;
+  present_info.waitSemaphoreCount = 1;
+  present_info.pWaitSemaphores = &frame.render_complete_semaphore;
   present_info.swapchainCount = static_cast<uint32_t>(xe::countof(swap_chains));
   present_info.pSwapchains = swap_chains;
   present_info.pImageIndices = swap_chain_image_indices;
@@ -41,10 +41,14 @@ class VulkanSwapChain {
 
   // Render pass used for compositing.
   VkRenderPass render_pass() const { return render_pass_; }
-  // Render command buffer, active inside the render pass from Begin to End.
-  VkCommandBuffer render_cmd_buffer() const { return render_cmd_buffer_; }
-  // Copy commands, ran before the render command buffer.
-  VkCommandBuffer copy_cmd_buffer() const { return copy_cmd_buffer_; }
+  // Returns the command buffer for copies into the surface image, which run
+  // before the render command buffer. The surface is cleared before the first
+  // copy of the frame unless the copies cover all of it.
+  VkCommandBuffer BeginCopy(bool covers_surface);
+  // Returns the render command buffer, active inside the render pass until
+  // End. The pass is started on first use, so frames without anything to
+  // composite, such as overlays, skip it.
+  VkCommandBuffer BeginRender();
 
   // Initializes the swap chain with the given WSI surface.
   bool Initialize(VkSurfaceKHR surface);
@@ -58,7 +62,21 @@ class VulkanSwapChain {
   // Ends the swap operation, finalizing rendering and presenting the results.
   bool End();
 
+  // Waits until the GPU is done with all frames submitted by End, such as
+  // before releasing images they read from.
+  void WaitOnSubmittedFrames();
+
  private:
+  // Resources of a frame, reused once the GPU is done with it.
+  struct Frame {
+    VkCommandBuffer copy_cmd_buffer = nullptr;
+    VkCommandBuffer render_cmd_buffer = nullptr;
+    VkSemaphore image_available_semaphore = nullptr;
+    VkSemaphore render_complete_semaphore = nullptr;
+    VkFence fence = nullptr;
+    // Whether the fence is going to be signaled by a submission.
+    bool submitted = false;
+  };
   struct Buffer {
     VkImage image = nullptr;
     VkImageView image_view = nullptr;
@@ -67,6 +85,8 @@ class VulkanSwapChain {
 
   bool InitializeBuffer(Buffer* buffer, VkImage target_image);
   void DestroyBuffer(Buffer* buffer);
+  // Clears the surface image, if it's still to be cleared this frame.
+  void ClearIfPending();
 
   // Safely releases all swap chain resources.
   void Shutdown();
@@ -79,12 +99,15 @@ class VulkanSwapChain {
   uint32_t surface_height_ = 0;
   VkFormat surface_format_ = VK_FORMAT_UNDEFINED;
   VkCommandPool cmd_pool_ = nullptr;
-  VkCommandBuffer copy_cmd_buffer_ = nullptr;
-  VkCommandBuffer render_cmd_buffer_ = nullptr;
   VkRenderPass render_pass_ = nullptr;
-  VkSemaphore image_available_semaphore_ = nullptr;
+  std::vector<Frame> frames_;
+  uint32_t current_frame_index_ = 0;
   uint32_t current_buffer_index_ = 0;
   std::vector<Buffer> buffers_;
+  // Whether the surface image of the frame still has to be cleared.
+  bool clear_pending_ = false;
+  // Whether the render pass has been started this frame.
+  bool render_pass_begun_ = false;
 };
 
 }  // namespace vulkan
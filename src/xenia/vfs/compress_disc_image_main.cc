@@ -0,0 +1,156 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2016 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#include <gflags/gflags.h>
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+#include "xenia/base/clock.h"
+#include "xenia/base/filesystem.h"
+#include "xenia/base/logging.h"
+#include "xenia/base/main.h"
+#include "xenia/base/mapped_memory.h"
+#include "xenia/base/math.h"
+#include "xenia/vfs/devices/compressed_disc_image_device.h"
+
+#include "third_party/snappy/snappy.h"
+
+DEFINE_int32(block_size_kb, 64,
+             "Size of the independently compressed blocks, in KiB. Must be a "
+             "power of two of at least 2.");
+DEFINE_bool(verify, true,
+            "Reads the compressed image back, comparing it with the source "
+            "and timing both.");
+
+namespace xe {
+namespace vfs {
+
+// Reads the whole image back through the device in reads of the given size,
+// checking it against the source.
+bool VerifyImage(const std::wstring& path, const MappedMemory* source,
+                 size_t read_size) {
+  CompressedDiscImageDevice device("\\Device\\Cdrom0", path);
+  if (!device.Initialize()) {
+    XELOGE("Compressed image could not be mounted");
+    return false;
+  }
+  double ticks_to_ms = 1000.0 / Clock::host_tick_frequency();
+  std::vector<uint8_t> buffer(read_size);
+
+  uint64_t start = Clock::QueryHostTickCount();
+  for (size_t offset = 0; offset < source->size(); offset += read_size) {
+    size_t length = std::min(read_size, source->size() - offset);
+    std::memcpy(buffer.data(), source->data() + offset, length);
+  }
+  uint64_t raw_ticks = Clock::QueryHostTickCount() - start;
+
+  bool matches = true;
+  uint64_t compressed_ticks = 0;
+  for (size_t offset = 0; offset < source->size() && matches;
+       offset += read_size) {
+    size_t length = std::min(read_size, source->size() - offset);
+    start = Clock::QueryHostTickCount();
+    matches = device.ReadImage(offset, buffer.data(), length);
+    compressed_ticks += Clock::QueryHostTickCount() - start;
+    matches = matches &&
+              std::memcmp(buffer.data(), source->data() + offset, length) == 0;
+  }
+  std::printf("%8zuk reads: raw %10.1f ms, compressed %10.1f ms %s\n",
+              read_size / 1024, raw_ticks * ticks_to_ms,
+              compressed_ticks * ticks_to_ms, matches ? "ok" : "MISMATCH");
+  return matches;
+}
+
+int compress_disc_image_main(const std::vector<std::wstring>& args) {
+  if (args.size() < 3) {
+    XELOGE("Usage: xenia-vfs-compress-disc-image <source.iso> <dest.xcdi>");
+    return 1;
+  }
+  uint32_t block_size = uint32_t(std::max(FLAGS_block_size_kb, 2)) * 1024;
+  if (block_size & (block_size - 1)) {
+    XELOGE("Block size must be a power of two");
+    return 1;
+  }
+
+  auto source = MappedMemory::Open(args[1], MappedMemory::Mode::kRead);
+  if (!source) {
+    XELOGE("Source image could not be mapped");
+    return 1;
+  }
+  FILE* file = xe::filesystem::OpenFile(args[2], "wb");
+  if (!file) {
+    XELOGE("Destination could not be created");
+    return 1;
+  }
+
+  CompressedDiscImageDevice::Header header;
+  std::memcpy(header.magic, "XCDI", 4);
+  header.version = CompressedDiscImageDevice::kVersion;
+  header.block_size = block_size;
+  header.image_size = source->size();
+  header.block_count = uint32_t(
+      xe::round_up(header.image_size, uint64_t(block_size)) / block_size);
+
+  // The offsets are written once all blocks are.
+  std::vector<uint64_t> offsets(size_t(header.block_count) + 1);
+  uint64_t offset = sizeof(header) + offsets.size() * sizeof(uint64_t);
+  bool written = std::fwrite(&header, sizeof(header), 1, file) == 1 &&
+                 std::fwrite(offsets.data(), sizeof(uint64_t), offsets.size(),
+                             file) == offsets.size();
+  std::vector<char> compressed(snappy::MaxCompressedLength(block_size));
+  for (uint32_t i = 0; i < header.block_count && written; ++i) {
+    size_t block_start = size_t(i) * block_size;
+    size_t length = std::min(size_t(block_size), source->size() - block_start);
+    auto block = reinterpret_cast<const char*>(source->data() + block_start);
+    size_t compressed_length;
+    snappy::RawCompress(block, length, compressed.data(), &compressed_length);
+    offsets[i] = offset;
+    if (compressed_length < length) {
+      written = std::fwrite(compressed.data(), compressed_length, 1, file) == 1;
+      offset += compressed_length;
+    } else {
+      written = std::fwrite(block, length, 1, file) == 1;
+      offset += length;
+    }
+  }
+  offsets.back() = offset;
+  written = written && std::fseek(file, sizeof(header), SEEK_SET) == 0 &&
+            std::fwrite(offsets.data(), sizeof(uint64_t), offsets.size(),
+                        file) == offsets.size();
+  written = std::fclose(file) == 0 && written;
+  if (!written) {
+    XELOGE("Compressed image could not be written");
+    return 1;
+  }
+  std::printf("%llu bytes compressed to %llu (%.1f%%)\n",
+              static_cast<unsigned long long>(header.image_size),
+              static_cast<unsigned long long>(offset),
+              header.image_size ? offset * 100.0 / header.image_size : 0.0);
+
+  if (FLAGS_verify) {
+    for (size_t read_size : {size_t(2 * 1024), size_t(64 * 1024),
+                             size_t(4 * 1024 * 1024)}) {
+      if (!VerifyImage(args[2], source.get(), read_size)) {
+        XELOGE("Compressed image doesn't match the source");
+        return 1;
+      }
+    }
+  }
+  return 0;
+}
+
+}  // namespace vfs
+}  // namespace xe
+
+DEFINE_ENTRY_POINT(L"xenia-vfs-compress-disc-image",
+                   L"xenia-vfs-compress-disc-image <source.iso> <dest.xcdi>",
+                   xe::vfs::compress_disc_image_main);
@@ -9,11 +9,22 @@
 
 #include "xenia/vfs/device.h"
 
+#include <gflags/gflags.h>
+
+#include "xenia/base/clock.h"
 #include "xenia/base/logging.h"
+#include "xenia/base/profiling.h"
+#include "xenia/base/string.h"
+
+DEFINE_int32(vfs_stats_log_interval_s, 0,
+             "Logs the IO stats of each device at most this often while it "
+             "is used, in seconds, or 0 to never log them.");
 
 namespace xe {
 namespace vfs {
 
+IoStats Device::total_io_stats_;
+
 Device::Device(const std::string& mount_path) : mount_path_(mount_path) {}
 
 Device::~Device() = default;
@@ -23,25 +34,148 @@ void Device::Dump(StringBuffer* string_buffer) {
   root_entry_->Dump(string_buffer, 0);
 }
 
-Entry* Device::ResolvePath(std::string path) {
+Entry* Device::ResolvePath(const std::string& path) {
   // The filesystem will have stripped our prefix off already, so the path will
   // be in the form:
   // some\PATH.foo
 
   XELOGFS("Device::ResolvePath(%s)", path.c_str());
 
+  // Reused by every lookup on the thread, so they don't allocate once grown.
+  thread_local std::string key;
+  if (!path_index_.empty()) {
+    auto global_lock = global_critical_region_.Acquire();
+    GetPathIndexKey(path, &key);
+    auto it = path_index_.find(key);
+    return it != path_index_.end() ? it->second : nullptr;
+  }
+
   // Walk the path, one separator at a time.
   auto entry = root_entry_.get();
-  auto path_parts = xe::split_path(path);
-  for (auto& part : path_parts) {
-    entry = entry->GetChild(part);
-    if (!entry) {
-      // Not found.
-      return nullptr;
+  size_t part_start = 0;
+  while (part_start < path.size()) {
+    size_t part_end = path.find_first_of("\\/", part_start);
+    if (part_end == std::string::npos) {
+      part_end = path.size();
+    }
+    if (part_end != part_start) {
+      key.assign(path, part_start, part_end - part_start);
+      entry = entry->GetChild(key);
+      if (!entry) {
+        // Not found.
+        return nullptr;
+      }
     }
+    part_start = part_end + 1;
   }
   return entry;
 }
 
+void Device::RecordRead(size_t bytes, uint64_t latency_us) {
+  io_stats_.RecordRead(bytes, latency_us);
+  total_io_stats_.RecordRead(bytes, latency_us);
+  auto total = total_io_stats_.snapshot();
+  COUNT_profile_cpu("vfs/reads", int(total.read_count));
+  COUNT_profile_cpu("vfs/read_kb", int(total.read_bytes / 1024));
+  LogStatsIfDue();
+}
+
+void Device::RecordWrite(size_t bytes, uint64_t latency_us) {
+  io_stats_.RecordWrite(bytes, latency_us);
+  total_io_stats_.RecordWrite(bytes, latency_us);
+  auto total = total_io_stats_.snapshot();
+  COUNT_profile_cpu("vfs/writes", int(total.write_count));
+  COUNT_profile_cpu("vfs/write_kb", int(total.write_bytes / 1024));
+  LogStatsIfDue();
+}
+
+void Device::RecordCacheAccess(bool hit) {
+  if (hit) {
+    io_stats_.RecordCacheHit();
+    total_io_stats_.RecordCacheHit();
+  } else {
+    io_stats_.RecordCacheMiss();
+    total_io_stats_.RecordCacheMiss();
+  }
+}
+
+void Device::LogStatsIfDue() {
+  if (FLAGS_vfs_stats_log_interval_s <= 0) {
+    return;
+  }
+  uint64_t now = Clock::QueryHostTickCount();
+  uint64_t next = next_stats_log_tick_;
+  // Only the thread moving the next log time on logs.
+  if (now < next ||
+      !next_stats_log_tick_.compare_exchange_strong(
+          next, now + uint64_t(FLAGS_vfs_stats_log_interval_s) *
+                          Clock::host_tick_frequency())) {
+    return;
+  }
+  XELOGI("VFS %s: %s", mount_path_.c_str(),
+         io_stats_.snapshot().ToString().c_str());
+}
+
+void Device::BuildPathIndex() {
+  auto global_lock = global_critical_region_.Acquire();
+  path_index_.clear();
+  if (root_entry_) {
+    IndexEntry(root_entry_.get(), "");
+  }
+}
+
+std::string Device::GetPathIndexKey(const std::string& path) {
+  std::string key;
+  GetPathIndexKey(path, &key);
+  return key;
+}
+
+void Device::GetPathIndexKey(const std::string& path, std::string* out_key) {
+  out_key->clear();
+  bool separated = false;
+  for (char c : path) {
+    if (c == '\\' || c == '/') {
+      separated = true;
+      continue;
+    }
+    if (separated && !out_key->empty()) {
+      *out_key += '\\';
+    }
+    separated = false;
+    *out_key += c >= 'A' && c <= 'Z' ? char(c + ('a' - 'A')) : c;
+  }
+}
+
+void Device::AddToPathIndex(Entry* entry) {
+  auto global_lock = global_critical_region_.Acquire();
+  if (!path_index_.empty()) {
+    IndexEntry(entry, GetPathIndexKey(entry->path()));
+  }
+}
+
+void Device::RemoveFromPathIndex(Entry* entry) {
+  auto global_lock = global_critical_region_.Acquire();
+  if (path_index_.empty()) {
+    return;
+  }
+  auto it = path_index_.find(GetPathIndexKey(entry->path()));
+  if (it != path_index_.end() && it->second == entry) {
+    path_index_.erase(it);
+  }
+  for (size_t i = 0; i < entry->child_count(); ++i) {
+    RemoveFromPathIndex(entry->child(i));
+  }
+}
+
+void Device::IndexEntry(Entry* entry, const std::string& key) {
+  // Of paths differing only in case, the first indexed is kept.
+  path_index_.emplace(key, entry);
+  for (size_t i = 0; i < entry->child_count(); ++i) {
+    auto child = entry->child(i);
+    std::string child_key = xe::to_lower_ascii(child->name());
+    IndexEntry(child, key.empty() ? child_key : key + '\\' + child_key);
+  }
+}
+
 }  // namespace vfs
 }  // namespace xe
@@ -10,12 +10,15 @@
 #ifndef XENIA_VFS_DEVICE_H_
 #define XENIA_VFS_DEVICE_H_
 
+#include <atomic>
 #include <memory>
 #include <string>
+#include <unordered_map>
 
 #include "xenia/base/mutex.h"
 #include "xenia/base/string_buffer.h"
 #include "xenia/vfs/entry.h"
+#include "xenia/vfs/io_stats.h"
 
 namespace xe {
 namespace vfs {
@@ -32,7 +35,20 @@ class Device {
 
   virtual bool is_read_only() const { return true; }
 
-  Entry* ResolvePath(std::string path);
+  Entry* ResolvePath(const std::string& path);
+  // Indexes every entry by its case folded path, so ResolvePath doesn't walk
+  // the tree. Entries created and deleted through Entry keep it current.
+  void BuildPathIndex();
+
+  const IoStats& io_stats() const { return io_stats_; }
+  // The stats of all devices together.
+  static const IoStats& total_io_stats() { return total_io_stats_; }
+  // Counts a file operation in the device and total stats, logging the stats
+  // of the device every --vfs_stats_log_interval_s.
+  void RecordRead(size_t bytes, uint64_t latency_us);
+  void RecordWrite(size_t bytes, uint64_t latency_us);
+  // Counts a read served from, or missing, a cache or read-ahead.
+  void RecordCacheAccess(bool hit);
 
   virtual uint32_t total_allocation_units() const = 0;
   virtual uint32_t available_allocation_units() const = 0;
@@ -43,6 +59,28 @@ class Device {
   xe::global_critical_region global_critical_region_;
   std::string mount_path_;
   std::unique_ptr<Entry> root_entry_;
+
+ private:
+  friend class Entry;
+
+  void LogStatsIfDue();
+
+  IoStats io_stats_;
+  static IoStats total_io_stats_;
+  std::atomic<uint64_t> next_stats_log_tick_ = {0};
+
+  // Adds or removes the entry and everything below it, if the index has been
+  // built.
+  void AddToPathIndex(Entry* entry);
+  void RemoveFromPathIndex(Entry* entry);
+
+  // Returns the path with its parts lowercased and separated by single
+  // backslashes, as the index keys are.
+  static std::string GetPathIndexKey(const std::string& path);
+  static void GetPathIndexKey(const std::string& path, std::string* out_key);
+  void IndexEntry(Entry* entry, const std::string& key);
+
+  std::unordered_map<std::string, Entry*> path_index_;
 };
 
 }  // namespace vfs
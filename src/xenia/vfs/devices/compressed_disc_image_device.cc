@@ -0,0 +1,370 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2016 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#include "xenia/vfs/devices/compressed_disc_image_device.h"
+
+#include <gflags/gflags.h>
+
+#include <algorithm>
+#include <cstring>
+
+#include "xenia/base/filesystem.h"
+#include "xenia/base/logging.h"
+#include "xenia/base/math.h"
+#include "xenia/base/memory.h"
+#include "xenia/base/profiling.h"
+#include "xenia/vfs/devices/compressed_disc_image_entry.h"
+
+#include "third_party/snappy/snappy.h"
+
+DEFINE_int32(compressed_disc_image_cache_mb, 64,
+             "Size of the cache of decompressed disc image blocks, in MiB.");
+DEFINE_int32(compressed_disc_image_threads, 3,
+             "Threads decompressing large reads of compressed disc images "
+             "along with the reading thread, or 0 for none.");
+
+namespace xe {
+namespace vfs {
+
+const size_t kXESectorSize = 2048;
+// Reads decompressing fewer blocks than this into the buffer don't wake the
+// workers.
+const size_t kMinParallelBlockCount = 4;
+
+CompressedDiscImageDevice::CompressedDiscImageDevice(
+    const std::string& mount_path, const std::wstring& local_path)
+    : Device(mount_path), local_path_(local_path) {}
+
+CompressedDiscImageDevice::~CompressedDiscImageDevice() {
+  {
+    std::lock_guard<std::mutex> lock(worker_mutex_);
+    workers_running_ = false;
+    worker_cond_.notify_all();
+  }
+  for (auto& worker : workers_) {
+    xe::threading::Wait(worker.get(), false);
+  }
+}
+
+bool CompressedDiscImageDevice::IsCompressedImage(const std::wstring& path) {
+  FILE* file = xe::filesystem::OpenFile(path, "rb");
+  if (!file) {
+    return false;
+  }
+  char magic[4];
+  bool is_compressed = std::fread(magic, sizeof(magic), 1, file) == 1 &&
+                       std::memcmp(magic, "XCDI", 4) == 0;
+  std::fclose(file);
+  return is_compressed;
+}
+
+bool CompressedDiscImageDevice::Initialize() {
+  mmap_ = MappedMemory::Open(local_path_, MappedMemory::Mode::kRead);
+  if (!mmap_) {
+    XELOGE("Compressed disc image could not be mapped");
+    return false;
+  }
+
+  Header header;
+  if (mmap_->size() < sizeof(header)) {
+    XELOGE("Compressed disc image is truncated");
+    return false;
+  }
+  std::memcpy(&header, mmap_->data(), sizeof(header));
+  if (std::memcmp(header.magic, "XCDI", 4) != 0 ||
+      header.version != kVersion) {
+    XELOGE("Unsupported compressed disc image version %u", header.version);
+    return false;
+  }
+  if (header.block_size < kXESectorSize || header.block_size > 0x1000000 ||
+      (header.block_size & (header.block_size - 1)) ||
+      header.block_count !=
+          xe::round_up(header.image_size, uint64_t(header.block_size)) /
+              header.block_size) {
+    XELOGE("Compressed disc image has an invalid block layout");
+    return false;
+  }
+  block_size_ = header.block_size;
+  block_count_ = header.block_count;
+  image_size_ = header.image_size;
+
+  // The offsets must be in order and within the file, so blocks can be read
+  // without checking them again.
+  size_t index_size = (size_t(block_count_) + 1) * sizeof(uint64_t);
+  if (mmap_->size() - sizeof(header) < index_size) {
+    XELOGE("Compressed disc image is truncated");
+    return false;
+  }
+  block_offsets_ = mmap_->data() + sizeof(header);
+  uint64_t previous_offset = sizeof(header) + index_size;
+  for (uint32_t i = 0; i <= block_count_; ++i) {
+    uint64_t offset = xe::load<uint64_t>(block_offsets_ + i * 8);
+    if (offset < previous_offset || offset > mmap_->size()) {
+      XELOGE("Compressed disc image block %u is out of bounds", i);
+      return false;
+    }
+    previous_offset = offset;
+  }
+
+  cache_shard_capacity_ =
+      size_t(std::max(FLAGS_compressed_disc_image_cache_mb, 0)) * 1024 * 1024 /
+      block_size_ / kCacheShardCount;
+
+  auto root_entry = new CompressedDiscImageEntry(this, nullptr, "");
+  root_entry->attributes_ = kFileAttributeDirectory;
+  root_entry_ = std::unique_ptr<Entry>(root_entry);
+
+  auto result = GdfxParser::Parse(this, root_entry);
+  if (result != GdfxParser::Error::kSuccess) {
+    XELOGE("Failed to read all GDFX entries: %d", result);
+    return false;
+  }
+
+  workers_running_ = true;
+  for (int32_t i = 0; i < FLAGS_compressed_disc_image_threads; ++i) {
+    xe::threading::Thread::CreationParameters params;
+    params.stack_size = 64 * 1024;
+    auto worker = xe::threading::Thread::Create(params,
+                                                [this]() { WorkerMain(); });
+    if (!worker) {
+      break;
+    }
+    worker->set_name("Disc Image Decompression " + std::to_string(i));
+    workers_.push_back(std::move(worker));
+  }
+
+  return true;
+}
+
+bool CompressedDiscImageDevice::ReadImage(size_t offset, void* buffer,
+                                          size_t length) {
+  if (offset > image_size_ || length > image_size_ - offset) {
+    return false;
+  }
+  if (!length) {
+    return true;
+  }
+
+  // Blocks partially covered by the read go through the cache, as the next
+  // reads likely want the rest of them.
+  auto dest = static_cast<uint8_t*>(buffer);
+  std::vector<uint32_t> direct_indices;
+  std::vector<uint8_t*> direct_targets;
+  uint32_t first_block = uint32_t(offset / block_size_);
+  uint32_t last_block = uint32_t((offset + length - 1) / block_size_);
+  for (uint32_t i = first_block; i <= last_block; ++i) {
+    size_t block_start = size_t(i) * block_size_;
+    size_t block_end = block_start + block_length(i);
+    size_t copy_start = std::max(offset, block_start);
+    size_t copy_end = std::min(offset + length, block_end);
+    uint8_t* target = dest + (copy_start - offset);
+    bool entire_block = copy_start == block_start && copy_end == block_end;
+    Block block;
+    if (entire_block) {
+      block = FindBlock(i);
+      if (!block) {
+        direct_indices.push_back(i);
+        direct_targets.push_back(target);
+        continue;
+      }
+    } else {
+      block = GetBlock(i);
+      if (!block) {
+        return false;
+      }
+    }
+    std::memcpy(target, block->data() + (copy_start - block_start),
+                copy_end - copy_start);
+  }
+
+  bool succeeded = true;
+  if (direct_indices.size() >= kMinParallelBlockCount && !workers_.empty()) {
+    DecompressJob job;
+    job.block_indices = direct_indices.data();
+    job.targets = direct_targets.data();
+    job.count = direct_indices.size();
+    job.next_index = 0;
+    job.done_count = 0;
+    job.failed = false;
+    succeeded = RunDecompressJob(&job);
+  } else {
+    for (size_t i = 0; i < direct_indices.size() && succeeded; ++i) {
+      succeeded = DecompressBlock(direct_indices[i], direct_targets[i]);
+    }
+  }
+  direct_count_ += direct_indices.size();
+
+  COUNT_profile_cpu("vfs/compressed_disc_image/cache_hits", int(hit_count_));
+  COUNT_profile_cpu("vfs/compressed_disc_image/cache_misses",
+                    int(miss_count_));
+  return succeeded;
+}
+
+CompressedDiscImageDevice::CacheStats CompressedDiscImageDevice::cache_stats()
+    const {
+  CacheStats stats;
+  stats.hit_count = hit_count_;
+  stats.miss_count = miss_count_;
+  stats.direct_count = direct_count_;
+  return stats;
+}
+
+size_t CompressedDiscImageDevice::block_length(uint32_t block_index) const {
+  return size_t(std::min(uint64_t(block_size_),
+                         image_size_ - uint64_t(block_index) * block_size_));
+}
+
+bool CompressedDiscImageDevice::DecompressBlock(uint32_t block_index,
+                                                uint8_t* target) {
+  uint64_t start = xe::load<uint64_t>(block_offsets_ + block_index * 8);
+  uint64_t end = xe::load<uint64_t>(block_offsets_ + block_index * 8 + 8);
+  auto source = reinterpret_cast<const char*>(mmap_->data() + start);
+  size_t stored_length = size_t(end - start);
+  size_t length = block_length(block_index);
+  if (stored_length >= length) {
+    if (stored_length != length) {
+      XELOGE("Compressed disc image block %u is damaged", block_index);
+      return false;
+    }
+    std::memcpy(target, source, length);
+    return true;
+  }
+  size_t uncompressed_length;
+  if (!snappy::GetUncompressedLength(source, stored_length,
+                                     &uncompressed_length) ||
+      uncompressed_length != length ||
+      !snappy::RawUncompress(source, stored_length,
+                             reinterpret_cast<char*>(target))) {
+    XELOGE("Compressed disc image block %u is damaged", block_index);
+    return false;
+  }
+  return true;
+}
+
+CompressedDiscImageDevice::Block CompressedDiscImageDevice::FindBlock(
+    uint32_t block_index) {
+  auto& shard = cache_shards_[block_index % kCacheShardCount];
+  std::lock_guard<std::mutex> lock(shard.mutex);
+  auto it = shard.index.find(block_index);
+  if (it == shard.index.end()) {
+    return nullptr;
+  }
+  shard.blocks.splice(shard.blocks.begin(), shard.blocks, it->second);
+  ++hit_count_;
+  RecordCacheAccess(true);
+  return it->second->second;
+}
+
+CompressedDiscImageDevice::Block CompressedDiscImageDevice::GetBlock(
+    uint32_t block_index) {
+  Block block = FindBlock(block_index);
+  if (block) {
+    return block;
+  }
+
+  // Decompressed outside of the lock. Two threads missing the same block
+  // both decompress it, and the latter replaces the former in the cache.
+  auto data = std::make_shared<std::vector<uint8_t>>(block_length(block_index));
+  if (!DecompressBlock(block_index, data->data())) {
+    return nullptr;
+  }
+  ++miss_count_;
+  RecordCacheAccess(false);
+  block = std::move(data);
+  if (!cache_shard_capacity_) {
+    return block;
+  }
+
+  auto& shard = cache_shards_[block_index % kCacheShardCount];
+  std::lock_guard<std::mutex> lock(shard.mutex);
+  auto it = shard.index.find(block_index);
+  if (it != shard.index.end()) {
+    shard.blocks.erase(it->second);
+    shard.index.erase(it);
+  }
+  shard.blocks.emplace_front(block_index, block);
+  shard.index[block_index] = shard.blocks.begin();
+  if (shard.blocks.size() > cache_shard_capacity_) {
+    shard.index.erase(shard.blocks.back().first);
+    shard.blocks.pop_back();
+  }
+  return block;
+}
+
+bool CompressedDiscImageDevice::RunDecompressJob(DecompressJob* job) {
+  std::unique_lock<std::mutex> lock(worker_mutex_);
+  jobs_.push_back(job);
+  worker_cond_.notify_all();
+  while (WorkOnJob(lock, job)) {
+  }
+  while (job->done_count < job->count) {
+    job_done_cond_.wait(lock);
+  }
+  return !job->failed;
+}
+
+bool CompressedDiscImageDevice::WorkOnJob(std::unique_lock<std::mutex>& lock,
+                                          DecompressJob* job) {
+  if (job->next_index >= job->count) {
+    return false;
+  }
+  size_t index = job->next_index++;
+  if (job->next_index == job->count) {
+    jobs_.erase(std::find(jobs_.begin(), jobs_.end(), job));
+  }
+  // The job outlives this, as it isn't done until this block is.
+  lock.unlock();
+  bool succeeded = DecompressBlock(job->block_indices[index],
+                                   job->targets[index]);
+  lock.lock();
+  if (!succeeded) {
+    job->failed = true;
+  }
+  if (++job->done_count == job->count) {
+    job_done_cond_.notify_all();
+  }
+  return true;
+}
+
+void CompressedDiscImageDevice::WorkerMain() {
+  std::unique_lock<std::mutex> lock(worker_mutex_);
+  while (true) {
+    while (workers_running_ && jobs_.empty()) {
+      worker_cond_.wait(lock);
+    }
+    if (!workers_running_) {
+      break;
+    }
+    WorkOnJob(lock, jobs_.front());
+  }
+}
+
+Entry* CompressedDiscImageDevice::AddEntry(Entry* parent, std::string name,
+                                           uint32_t attributes, size_t size,
+                                           size_t data_offset,
+                                           size_t data_size) {
+  auto entry = CompressedDiscImageEntry::Create(this, parent, name);
+  entry->attributes_ = attributes;
+  entry->size_ = size;
+  entry->allocation_size_ = xe::round_up(size, bytes_per_sector());
+  entry->create_timestamp_ = 0;
+  entry->access_timestamp_ = 0;
+  entry->write_timestamp_ = 0;
+  entry->data_offset_ = data_offset;
+  entry->data_size_ = data_size;
+
+  // Add to parent.
+  auto result = entry.get();
+  static_cast<CompressedDiscImageEntry*>(parent)->children_.emplace_back(
+      std::move(entry));
+  return result;
+}
+
+}  // namespace vfs
+}  // namespace xe
@@ -0,0 +1,152 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2016 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#ifndef XENIA_VFS_DEVICES_COMPRESSED_DISC_IMAGE_DEVICE_H_
+#define XENIA_VFS_DEVICES_COMPRESSED_DISC_IMAGE_DEVICE_H_
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "xenia/base/mapped_memory.h"
+#include "xenia/base/threading.h"
+#include "xenia/vfs/device.h"
+#include "xenia/vfs/devices/gdfx_parser.h"
+
+namespace xe {
+namespace vfs {
+
+// A disc image split into fixed size blocks, each compressed with snappy on
+// its own so any of them can be read without the ones before it. The file
+// starts with a Header, followed by the file offsets of the blocks and of
+// the end of the last one, and then the blocks. Blocks that didn't get
+// smaller are stored uncompressed.
+//
+// Decompressed blocks are kept in a cache sharded by block index, so reads
+// on different threads rarely contend. Blocks entirely covered by a read
+// are decompressed straight into the buffer instead, by the worker threads
+// as well when there are many.
+class CompressedDiscImageDevice : public Device,
+                                  private GdfxParser::Source {
+ public:
+  static const uint32_t kVersion = 1;
+
+  struct Header {
+    char magic[4];  // 'XCDI'
+    uint32_t version;
+    uint32_t block_size;
+    uint32_t block_count;
+    uint64_t image_size;
+  };
+  static_assert(sizeof(Header) == 24, "Header must be packed");
+
+  CompressedDiscImageDevice(const std::string& mount_path,
+                            const std::wstring& local_path);
+  ~CompressedDiscImageDevice() override;
+
+  // Returns whether the file starts with the header of a compressed image.
+  static bool IsCompressedImage(const std::wstring& path);
+
+  bool Initialize() override;
+
+  uint32_t total_allocation_units() const override {
+    return uint32_t(image_size_ / sectors_per_allocation_unit() /
+                    bytes_per_sector());
+  }
+  uint32_t available_allocation_units() const override { return 0; }
+  uint32_t sectors_per_allocation_unit() const override { return 1; }
+  uint32_t bytes_per_sector() const override { return 2 * 1024; }
+
+  // Reads the range of the uncompressed image, returning false if it is out
+  // of bounds or a block is damaged.
+  bool ReadImage(size_t offset, void* buffer, size_t length) override;
+
+  struct CacheStats {
+    uint64_t hit_count;
+    uint64_t miss_count;
+    // Blocks decompressed into read buffers without going through the cache.
+    uint64_t direct_count;
+  };
+  CacheStats cache_stats() const;
+
+ private:
+  size_t image_size() const override { return size_t(image_size_); }
+  Entry* AddEntry(Entry* parent, std::string name, uint32_t attributes,
+                  size_t size, size_t data_offset, size_t data_size) override;
+
+  typedef std::shared_ptr<const std::vector<uint8_t>> Block;
+
+  static const uint32_t kCacheShardCount = 8;
+  typedef std::list<std::pair<uint32_t, Block>> BlockList;
+  struct CacheShard {
+    std::mutex mutex;
+    // Most recently used first.
+    BlockList blocks;
+    std::unordered_map<uint32_t, BlockList::iterator> index;
+  };
+
+  // Blocks being decompressed into a read buffer by the workers and the
+  // reading thread. Must be guarded by worker_mutex_.
+  struct DecompressJob {
+    const uint32_t* block_indices;
+    uint8_t* const* targets;
+    size_t count;
+    size_t next_index;
+    size_t done_count;
+    bool failed;
+  };
+
+  size_t block_length(uint32_t block_index) const;
+  // Decompresses the block into the target, which must have room for
+  // block_length(block_index) bytes.
+  bool DecompressBlock(uint32_t block_index, uint8_t* target);
+  // Returns the block if it is cached, or null.
+  Block FindBlock(uint32_t block_index);
+  // Returns the block from the cache, decompressing it if it isn't cached.
+  Block GetBlock(uint32_t block_index);
+  // Decompresses all blocks of the job, on the workers too.
+  bool RunDecompressJob(DecompressJob* job);
+  // Decompresses the next block of the job, returning false if all of them
+  // have been taken already.
+  bool WorkOnJob(std::unique_lock<std::mutex>& lock, DecompressJob* job);
+  void WorkerMain();
+
+  std::wstring local_path_;
+  std::unique_ptr<MappedMemory> mmap_;
+  uint32_t block_size_ = 0;
+  uint32_t block_count_ = 0;
+  uint64_t image_size_ = 0;
+  const uint8_t* block_offsets_ = nullptr;
+
+  CacheShard cache_shards_[kCacheShardCount];
+  size_t cache_shard_capacity_ = 0;
+  std::atomic<uint64_t> hit_count_ = {0};
+  std::atomic<uint64_t> miss_count_ = {0};
+  std::atomic<uint64_t> direct_count_ = {0};
+
+  std::vector<std::unique_ptr<xe::threading::Thread>> workers_;
+  std::mutex worker_mutex_;
+  std::condition_variable worker_cond_;
+  std::condition_variable job_done_cond_;
+  // Must be guarded by worker_mutex_.
+  bool workers_running_ = false;
+  std::deque<DecompressJob*> jobs_;
+};
+
+}  // namespace vfs
+}  // namespace xe
+
+#endif  // XENIA_VFS_DEVICES_COMPRESSED_DISC_IMAGE_DEVICE_H_
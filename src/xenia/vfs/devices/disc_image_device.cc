@@ -9,20 +9,41 @@
 
 #include "xenia/vfs/devices/disc_image_device.h"
 
+#include <gflags/gflags.h>
+
+#include <algorithm>
+#include <cstring>
+
 #include "xenia/base/logging.h"
 #include "xenia/base/math.h"
+#include "xenia/base/profiling.h"
 #include "xenia/vfs/devices/disc_image_entry.h"
 
+DEFINE_bool(disc_image_prefetch_thread, false,
+            "Read ahead of files read sequentially from disc images on a "
+            "thread touching the pages, instead of hinting the host.");
+
 namespace xe {
 namespace vfs {
 
-const size_t kXESectorSize = 2048;
+// Ranges queued beyond this are dropped, oldest first, as the reads they
+// were for have likely passed them already.
+const size_t kMaxQueuedPrefetchCount = 64;
 
 DiscImageDevice::DiscImageDevice(const std::string& mount_path,
                                  const std::wstring& local_path)
     : Device(mount_path), local_path_(local_path) {}
 
-DiscImageDevice::~DiscImageDevice() = default;
+DiscImageDevice::~DiscImageDevice() {
+  if (prefetch_thread_) {
+    {
+      std::lock_guard<std::mutex> lock(prefetch_mutex_);
+      prefetch_running_ = false;
+      prefetch_cond_.notify_all();
+    }
+    xe::threading::Wait(prefetch_thread_.get(), false);
+  }
+}
 
 bool DiscImageDevice::Initialize() {
   mmap_ = MappedMemory::Open(local_path_, MappedMemory::Mode::kRead);
@@ -31,138 +52,115 @@ bool DiscImageDevice::Initialize() {
     return false;
   }
 
-  ParseState state = {0};
-  state.ptr = mmap_->data();
-  state.size = mmap_->size();
-  auto result = Verify(&state);
-  if (result != Error::kSuccess) {
-    XELOGE("Failed to verify disc image header: %d", result);
-    return false;
-  }
+  auto root_entry = new DiscImageEntry(this, nullptr, "", mmap_.get());
+  root_entry->attributes_ = kFileAttributeDirectory;
+  root_entry_ = std::unique_ptr<Entry>(root_entry);
 
-  result = ReadAllEntries(&state, state.ptr + state.root_offset);
-  if (result != Error::kSuccess) {
+  auto result = GdfxParser::Parse(this, root_entry);
+  if (result != GdfxParser::Error::kSuccess) {
     XELOGE("Failed to read all GDFX entries: %d", result);
     return false;
   }
 
-  return true;
-}
-
-DiscImageDevice::Error DiscImageDevice::Verify(ParseState* state) {
-  // Find sector 32 of the game partition - try at a few points.
-  static const size_t likely_offsets[] = {
-      0x00000000, 0x0000FB20, 0x00020600, 0x02080000, 0x0FD90000,
-  };
-  bool magic_found = false;
-  for (size_t n = 0; n < xe::countof(likely_offsets); n++) {
-    state->game_offset = likely_offsets[n];
-    if (VerifyMagic(state, state->game_offset + (32 * kXESectorSize))) {
-      magic_found = true;
-      break;
+  if (FLAGS_disc_image_prefetch_thread) {
+    prefetch_running_ = true;
+    xe::threading::Thread::CreationParameters params;
+    params.stack_size = 64 * 1024;
+    prefetch_thread_ = xe::threading::Thread::Create(
+        params, [this]() { PrefetchThreadMain(); });
+    if (prefetch_thread_) {
+      prefetch_thread_->set_name("Disc Image Prefetch");
+    } else {
+      prefetch_running_ = false;
     }
   }
-  if (!magic_found) {
-    // File doesn't have the magic values - likely not a real GDFX source.
-    return Error::kErrorFileMismatch;
-  }
 
-  // Read sector 32 to get FS state.
-  if (state->size < state->game_offset + (32 * kXESectorSize)) {
-    return Error::kErrorReadError;
-  }
-  uint8_t* fs_ptr = state->ptr + state->game_offset + (32 * kXESectorSize);
-  state->root_sector = xe::load<uint32_t>(fs_ptr + 20);
-  state->root_size = xe::load<uint32_t>(fs_ptr + 24);
-  state->root_offset =
-      state->game_offset + (state->root_sector * kXESectorSize);
-  if (state->root_size < 13 || state->root_size > 32 * 1024 * 1024) {
-    return Error::kErrorDamagedFile;
-  }
+  return true;
+}
 
-  return Error::kSuccess;
+DiscImageDevice::ReadAheadStats DiscImageDevice::read_ahead_stats() const {
+  ReadAheadStats stats;
+  stats.read_count = read_count_;
+  stats.hit_count = hit_count_;
+  stats.read_ahead_bytes = read_ahead_bytes_;
+  return stats;
 }
 
-bool DiscImageDevice::VerifyMagic(ParseState* state, size_t offset) {
-  if (offset >= state->size) {
-    return false;
+void DiscImageDevice::ReadAhead(size_t offset, size_t length) {
+  if (offset >= mmap_->size() || !length) {
+    return;
   }
-
-  // Simple check to see if the given offset contains the magic value.
-  return std::memcmp(state->ptr + offset, "MICROSOFT*XBOX*MEDIA", 20) == 0;
+  length = std::min(length, mmap_->size() - offset);
+  read_ahead_bytes_ += length;
+  if (prefetch_thread_) {
+    std::lock_guard<std::mutex> lock(prefetch_mutex_);
+    if (prefetch_queue_.size() >= kMaxQueuedPrefetchCount) {
+      prefetch_queue_.pop_front();
+    }
+    prefetch_queue_.emplace_back(offset, length);
+    prefetch_cond_.notify_one();
+    return;
+  }
+  mmap_->Prefetch(offset, length);
 }
 
-DiscImageDevice::Error DiscImageDevice::ReadAllEntries(
-    ParseState* state, const uint8_t* root_buffer) {
-  auto root_entry = new DiscImageEntry(this, nullptr, "", mmap_.get());
-  root_entry->attributes_ = kFileAttributeDirectory;
-  root_entry_ = std::unique_ptr<Entry>(root_entry);
+void DiscImageDevice::RecordReadAhead(bool hit) {
+  uint64_t read_count = ++read_count_;
+  uint64_t hit_count = hit ? ++hit_count_ : uint64_t(hit_count_);
+  COUNT_profile_cpu("vfs/disc_image/reads", int(read_count));
+  COUNT_profile_cpu("vfs/disc_image/read_ahead_hits", int(hit_count));
+}
 
-  if (!ReadEntry(state, root_buffer, 0, root_entry)) {
-    return Error::kErrorOutOfMemory;
+void DiscImageDevice::PrefetchThreadMain() {
+  const size_t kTouchStride = 4096;
+  std::unique_lock<std::mutex> lock(prefetch_mutex_);
+  while (true) {
+    while (prefetch_running_ && prefetch_queue_.empty()) {
+      prefetch_cond_.wait(lock);
+    }
+    if (!prefetch_running_) {
+      break;
+    }
+    auto range = prefetch_queue_.front();
+    prefetch_queue_.pop_front();
+    lock.unlock();
+    const volatile uint8_t* data = mmap_->data() + range.first;
+    uint8_t sum = 0;
+    for (size_t i = 0; i < range.second; i += kTouchStride) {
+      sum += data[i];
+    }
+    sum += data[range.second - 1];
+    (void)sum;
+    lock.lock();
   }
-
-  return Error::kSuccess;
 }
 
-bool DiscImageDevice::ReadEntry(ParseState* state, const uint8_t* buffer,
-                                uint16_t entry_ordinal,
-                                DiscImageEntry* parent) {
-  const uint8_t* p = buffer + (entry_ordinal * 4);
-
-  uint16_t node_l = xe::load<uint16_t>(p + 0);
-  uint16_t node_r = xe::load<uint16_t>(p + 2);
-  size_t sector = xe::load<uint32_t>(p + 4);
-  size_t length = xe::load<uint32_t>(p + 8);
-  uint8_t attributes = xe::load<uint8_t>(p + 12);
-  uint8_t name_length = xe::load<uint8_t>(p + 13);
-  auto name = reinterpret_cast<const char*>(p + 14);
-
-  if (node_l && !ReadEntry(state, buffer, node_l, parent)) {
+bool DiscImageDevice::ReadImage(size_t offset, void* buffer, size_t length) {
+  if (offset > mmap_->size() || length > mmap_->size() - offset) {
     return false;
   }
+  std::memcpy(buffer, mmap_->data() + offset, length);
+  return true;
+}
 
-  auto entry = DiscImageEntry::Create(
-      this, parent, std::string(name, name_length), mmap_.get());
-  entry->attributes_ = attributes | kFileAttributeReadOnly;
-  entry->size_ = length;
-  entry->allocation_size_ = xe::round_up(length, bytes_per_sector());
+Entry* DiscImageDevice::AddEntry(Entry* parent, std::string name,
+                                 uint32_t attributes, size_t size,
+                                 size_t data_offset, size_t data_size) {
+  auto entry = DiscImageEntry::Create(this, parent, name, mmap_.get());
+  entry->attributes_ = attributes;
+  entry->size_ = size;
+  entry->allocation_size_ = xe::round_up(size, bytes_per_sector());
   entry->create_timestamp_ = 0;
   entry->access_timestamp_ = 0;
   entry->write_timestamp_ = 0;
-
-  if (attributes & kFileAttributeDirectory) {
-    // Folder.
-    entry->data_offset_ = 0;
-    entry->data_size_ = 0;
-    if (length) {
-      // Not a leaf - read in children.
-      if (state->size < state->game_offset + (sector * kXESectorSize)) {
-        // Out of bounds read.
-        return false;
-      }
-      // Read child list.
-      uint8_t* folder_ptr =
-          state->ptr + state->game_offset + (sector * kXESectorSize);
-      if (!ReadEntry(state, folder_ptr, 0, entry.get())) {
-        return false;
-      }
-    }
-  } else {
-    // File.
-    entry->data_offset_ = state->game_offset + (sector * kXESectorSize);
-    entry->data_size_ = length;
-  }
+  entry->data_offset_ = data_offset;
+  entry->data_size_ = data_size;
 
   // Add to parent.
-  parent->children_.emplace_back(std::move(entry));
-
-  // Read next file in the list.
-  if (node_r && !ReadEntry(state, buffer, node_r, parent)) {
-    return false;
-  }
-
-  return true;
+  auto result = entry.get();
+  static_cast<DiscImageEntry*>(parent)->children_.emplace_back(
+      std::move(entry));
+  return result;
 }
 
 }  // namespace vfs
@@ -10,18 +10,23 @@
 #ifndef XENIA_VFS_DEVICES_DISC_IMAGE_DEVICE_H_
 #define XENIA_VFS_DEVICES_DISC_IMAGE_DEVICE_H_
 
+#include <atomic>
+#include <condition_variable>
+#include <deque>
 #include <memory>
+#include <mutex>
 #include <string>
+#include <utility>
 
 #include "xenia/base/mapped_memory.h"
+#include "xenia/base/threading.h"
 #include "xenia/vfs/device.h"
+#include "xenia/vfs/devices/gdfx_parser.h"
 
 namespace xe {
 namespace vfs {
 
-class DiscImageEntry;
-
-class DiscImageDevice : public Device {
+class DiscImageDevice : public Device, private GdfxParser::Source {
  public:
   DiscImageDevice(const std::string& mount_path,
                   const std::wstring& local_path);
@@ -37,32 +42,40 @@ class DiscImageDevice : public Device {
   uint32_t sectors_per_allocation_unit() const override { return 1; }
   uint32_t bytes_per_sector() const override { return 2 * 1024; }
 
- private:
-  enum class Error {
-    kSuccess = 0,
-    kErrorOutOfMemory = -1,
-    kErrorReadError = -10,
-    kErrorFileMismatch = -30,
-    kErrorDamagedFile = -31,
+  struct ReadAheadStats {
+    uint64_t read_count;
+    // Reads of data that had already been read ahead.
+    uint64_t hit_count;
+    uint64_t read_ahead_bytes;
   };
+  ReadAheadStats read_ahead_stats() const;
+
+  // Reads the range of the image ahead of a file being read sequentially,
+  // either by hinting the host or on the prefetch thread.
+  void ReadAhead(size_t offset, size_t length);
+  void RecordReadAhead(bool hit);
+
+ private:
+  size_t image_size() const override { return mmap_->size(); }
+  bool ReadImage(size_t offset, void* buffer, size_t length) override;
+  Entry* AddEntry(Entry* parent, std::string name, uint32_t attributes,
+                  size_t size, size_t data_offset, size_t data_size) override;
 
   std::wstring local_path_;
   std::unique_ptr<MappedMemory> mmap_;
 
-  typedef struct {
-    uint8_t* ptr;
-    size_t size;         // Size (bytes) of total image.
-    size_t game_offset;  // Offset (bytes) of game partition.
-    size_t root_sector;  // Offset (sector) of root.
-    size_t root_offset;  // Offset (bytes) of root.
-    size_t root_size;    // Size (bytes) of root.
-  } ParseState;
+  std::atomic<uint64_t> read_count_ = {0};
+  std::atomic<uint64_t> hit_count_ = {0};
+  std::atomic<uint64_t> read_ahead_bytes_ = {0};
 
-  Error Verify(ParseState* state);
-  bool VerifyMagic(ParseState* state, size_t offset);
-  Error ReadAllEntries(ParseState* state, const uint8_t* root_buffer);
-  bool ReadEntry(ParseState* state, const uint8_t* buffer,
-                 uint16_t entry_ordinal, DiscImageEntry* parent);
+  // Touches the pages of the queued ranges, faulting them in from the file.
+  void PrefetchThreadMain();
+  std::unique_ptr<xe::threading::Thread> prefetch_thread_;
+  std::mutex prefetch_mutex_;
+  std::condition_variable prefetch_cond_;
+  // Must be guarded by prefetch_mutex_.
+  bool prefetch_running_ = false;
+  std::deque<std::pair<size_t, size_t>> prefetch_queue_;
 };
 
 }  // namespace vfs
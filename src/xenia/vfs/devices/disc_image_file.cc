@@ -9,13 +9,23 @@
 
 #include "xenia/vfs/devices/disc_image_file.h"
 
+#include <gflags/gflags.h>
+
 #include <algorithm>
 
+#include "xenia/vfs/devices/disc_image_device.h"
 #include "xenia/vfs/devices/disc_image_entry.h"
 
+DEFINE_int32(disc_image_read_ahead_kb, 4096,
+             "Largest read-ahead of files read sequentially from disc images, "
+             "in KiB, or 0 to disable it.");
+
 namespace xe {
 namespace vfs {
 
+// The first read-ahead of a sequential read, doubled on each read after it.
+const size_t kMinReadAheadSize = 64 * 1024;
+
 DiscImageFile::DiscImageFile(uint32_t file_access, DiscImageEntry* entry)
     : File(file_access, entry), entry_(entry) {}
 
@@ -31,10 +41,62 @@ X_STATUS DiscImageFile::ReadSync(void* buffer, size_t buffer_length,
   size_t real_offset = entry_->data_offset() + byte_offset;
   size_t real_length =
       std::min(buffer_length, entry_->data_size() - byte_offset);
+  size_t read_end = byte_offset + real_length;
+
+  size_t max_window =
+      size_t(std::max(FLAGS_disc_image_read_ahead_kb, 0)) * 1024;
+  if (max_window) {
+    auto device = static_cast<DiscImageDevice*>(entry_->device());
+    size_t read_ahead_offset = 0;
+    size_t read_ahead_length = 0;
+    bool hit;
+    {
+      std::lock_guard<std::mutex> lock(read_ahead_mutex_);
+      hit = byte_offset >= read_ahead_start_ && read_end <= read_ahead_end_;
+      if (byte_offset == next_read_offset_) {
+        read_ahead_window_ = std::min(
+            std::max(read_ahead_window_ * 2, kMinReadAheadSize), max_window);
+      } else {
+        read_ahead_window_ = 0;
+        read_ahead_start_ = read_ahead_end_ = 0;
+      }
+      next_read_offset_ = read_end;
+      // More is read ahead once half of the window has been consumed, so
+      // there are no reads waiting for the disk while it continues.
+      size_t target_end = std::min(read_end + read_ahead_window_,
+                                   size_t(entry_->data_size()));
+      if (read_ahead_window_ &&
+          read_ahead_end_ < read_end + read_ahead_window_ / 2 &&
+          target_end > read_end) {
+        if (read_ahead_end_ < read_end) {
+          read_ahead_start_ = read_ahead_end_ = read_end;
+        }
+        read_ahead_offset = read_ahead_end_;
+        read_ahead_length = target_end - read_ahead_end_;
+        read_ahead_end_ = target_end;
+      }
+    }
+    if (read_ahead_length) {
+      device->ReadAhead(entry_->data_offset() + read_ahead_offset,
+                        read_ahead_length);
+    }
+    device->RecordReadAhead(hit);
+    device->RecordCacheAccess(hit);
+  }
+
   std::memcpy(buffer, entry_->mmap()->data() + real_offset, real_length);
   *out_bytes_read = real_length;
   return X_STATUS_SUCCESS;
 }
 
+const uint8_t* DiscImageFile::MapRange(size_t byte_offset,
+                                       size_t* out_length) {
+  if (byte_offset >= entry_->data_size()) {
+    return nullptr;
+  }
+  *out_length = entry_->data_size() - byte_offset;
+  return entry_->mmap()->data() + entry_->data_offset() + byte_offset;
+}
+
 }  // namespace vfs
 }  // namespace xe
@@ -10,6 +10,8 @@
 #ifndef XENIA_VFS_DEVICES_DISC_IMAGE_FILE_H_
 #define XENIA_VFS_DEVICES_DISC_IMAGE_FILE_H_
 
+#include <mutex>
+
 #include "xenia/vfs/file.h"
 
 namespace xe {
@@ -30,9 +32,18 @@ class DiscImageFile : public File {
                      size_t byte_offset, size_t* out_bytes_written) override {
     return X_STATUS_ACCESS_DENIED;
   }
+  const uint8_t* MapRange(size_t byte_offset, size_t* out_length) override;
 
  private:
   DiscImageEntry* entry_;
+
+  // Sequential reads grow the read-ahead window, and other reads reset it.
+  std::mutex read_ahead_mutex_;
+  size_t next_read_offset_ = 0;
+  size_t read_ahead_window_ = 0;
+  // The range of the file that has been read ahead.
+  size_t read_ahead_start_ = 0;
+  size_t read_ahead_end_ = 0;
 };
 
 }  // namespace vfs
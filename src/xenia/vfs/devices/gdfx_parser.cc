@@ -0,0 +1,147 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2016 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#include "xenia/vfs/devices/gdfx_parser.h"
+
+#include <cstring>
+
+#include "xenia/base/math.h"
+#include "xenia/base/memory.h"
+
+namespace xe {
+namespace vfs {
+
+const size_t kXESectorSize = 2048;
+
+GdfxParser::Error GdfxParser::Parse(Source* source, Entry* root) {
+  ParseState state = {0};
+  state.source = source;
+  auto result = Verify(&state);
+  if (result != Error::kSuccess) {
+    return result;
+  }
+
+  std::vector<uint8_t> root_buffer(state.root_size);
+  if (!source->ReadImage(state.root_offset, root_buffer.data(),
+                         root_buffer.size())) {
+    return Error::kErrorReadError;
+  }
+  if (!ReadEntry(&state, root_buffer, 0, root)) {
+    return Error::kErrorOutOfMemory;
+  }
+
+  return Error::kSuccess;
+}
+
+GdfxParser::Error GdfxParser::Verify(ParseState* state) {
+  // Find sector 32 of the game partition - try at a few points.
+  static const size_t likely_offsets[] = {
+      0x00000000, 0x0000FB20, 0x00020600, 0x02080000, 0x0FD90000,
+  };
+  bool magic_found = false;
+  for (size_t n = 0; n < xe::countof(likely_offsets); n++) {
+    state->game_offset = likely_offsets[n];
+    if (VerifyMagic(state, state->game_offset + (32 * kXESectorSize))) {
+      magic_found = true;
+      break;
+    }
+  }
+  if (!magic_found) {
+    // File doesn't have the magic values - likely not a real GDFX source.
+    return Error::kErrorFileMismatch;
+  }
+
+  // Read sector 32 to get FS state.
+  uint8_t fs_header[28];
+  if (!state->source->ReadImage(state->game_offset + (32 * kXESectorSize),
+                                fs_header, sizeof(fs_header))) {
+    return Error::kErrorReadError;
+  }
+  state->root_sector = xe::load<uint32_t>(fs_header + 20);
+  state->root_size = xe::load<uint32_t>(fs_header + 24);
+  state->root_offset =
+      state->game_offset + (state->root_sector * kXESectorSize);
+  if (state->root_size < 13 || state->root_size > 32 * 1024 * 1024) {
+    return Error::kErrorDamagedFile;
+  }
+
+  return Error::kSuccess;
+}
+
+bool GdfxParser::VerifyMagic(ParseState* state, size_t offset) {
+  // Simple check to see if the given offset contains the magic value.
+  char magic[20];
+  return state->source->ReadImage(offset, magic, sizeof(magic)) &&
+         std::memcmp(magic, "MICROSOFT*XBOX*MEDIA", 20) == 0;
+}
+
+bool GdfxParser::ReadEntry(ParseState* state,
+                           const std::vector<uint8_t>& buffer,
+                           uint16_t entry_ordinal, Entry* parent) {
+  size_t entry_offset = size_t(entry_ordinal) * 4;
+  if (entry_offset + 14 > buffer.size()) {
+    return false;
+  }
+  const uint8_t* p = buffer.data() + entry_offset;
+
+  uint16_t node_l = xe::load<uint16_t>(p + 0);
+  uint16_t node_r = xe::load<uint16_t>(p + 2);
+  size_t sector = xe::load<uint32_t>(p + 4);
+  size_t length = xe::load<uint32_t>(p + 8);
+  uint8_t attributes = xe::load<uint8_t>(p + 12);
+  uint8_t name_length = xe::load<uint8_t>(p + 13);
+  auto name = reinterpret_cast<const char*>(p + 14);
+  if (entry_offset + 14 + name_length > buffer.size()) {
+    return false;
+  }
+
+  if (node_l && !ReadEntry(state, buffer, node_l, parent)) {
+    return false;
+  }
+
+  if (attributes & kFileAttributeDirectory) {
+    // Folder.
+    auto entry = state->source->AddEntry(
+        parent, std::string(name, name_length),
+        attributes | kFileAttributeReadOnly, length, 0, 0);
+    if (length) {
+      // Not a leaf - read in children.
+      std::vector<uint8_t> folder_buffer(length);
+      if (!state->source->ReadImage(
+              state->game_offset + (sector * kXESectorSize),
+              folder_buffer.data(), folder_buffer.size())) {
+        // Out of bounds read.
+        return false;
+      }
+      if (!ReadEntry(state, folder_buffer, 0, entry)) {
+        return false;
+      }
+    }
+  } else {
+    // File.
+    size_t data_offset = state->game_offset + (sector * kXESectorSize);
+    size_t image_size = state->source->image_size();
+    if (data_offset > image_size || length > image_size - data_offset) {
+      return false;
+    }
+    state->source->AddEntry(parent, std::string(name, name_length),
+                            attributes | kFileAttributeReadOnly, length,
+                            data_offset, length);
+  }
+
+  // Read next file in the list.
+  if (node_r && !ReadEntry(state, buffer, node_r, parent)) {
+    return false;
+  }
+
+  return true;
+}
+
+}  // namespace vfs
+}  // namespace xe
@@ -0,0 +1,72 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2016 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#ifndef XENIA_VFS_DEVICES_GDFX_PARSER_H_
+#define XENIA_VFS_DEVICES_GDFX_PARSER_H_
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "xenia/vfs/entry.h"
+
+namespace xe {
+namespace vfs {
+
+// Reads the GDFX file system of a disc image into entries. The image is read
+// through a Source, so raw and compressed images share the parsing.
+class GdfxParser {
+ public:
+  enum class Error {
+    kSuccess = 0,
+    kErrorOutOfMemory = -1,
+    kErrorReadError = -10,
+    kErrorFileMismatch = -30,
+    kErrorDamagedFile = -31,
+  };
+
+  class Source {
+   public:
+    virtual ~Source() = default;
+
+    // Size (bytes) of the image.
+    virtual size_t image_size() const = 0;
+    // Reads the range of the image, returning false if it is out of bounds
+    // or can't be read.
+    virtual bool ReadImage(size_t offset, void* buffer, size_t length) = 0;
+    // Creates an entry at the image range of the file data, and adds it to
+    // the children of the parent.
+    virtual Entry* AddEntry(Entry* parent, std::string name,
+                            uint32_t attributes, size_t size,
+                            size_t data_offset, size_t data_size) = 0;
+  };
+
+  // Adds the entries of the file system to the root, which must be a
+  // directory entry created by the source.
+  static Error Parse(Source* source, Entry* root);
+
+ private:
+  struct ParseState {
+    Source* source;
+    size_t game_offset;  // Offset (bytes) of game partition.
+    size_t root_sector;  // Offset (sector) of root.
+    size_t root_offset;  // Offset (bytes) of root.
+    size_t root_size;    // Size (bytes) of root.
+  };
+
+  static Error Verify(ParseState* state);
+  static bool VerifyMagic(ParseState* state, size_t offset);
+  static bool ReadEntry(ParseState* state, const std::vector<uint8_t>& buffer,
+                        uint16_t entry_ordinal, Entry* parent);
+};
+
+}  // namespace vfs
+}  // namespace xe
+
+#endif  // XENIA_VFS_DEVICES_GDFX_PARSER_H_
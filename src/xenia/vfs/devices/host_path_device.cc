@@ -40,6 +40,10 @@ bool HostPathDevice::Initialize() {
   root_entry_ = std::unique_ptr<Entry>(root_entry);
   PopulateEntry(root_entry);
 
+  // The whole tree has been listed from the host, one call per directory,
+  // so paths probed by titles are looked up without asking the host again.
+  BuildPathIndex();
+
   return true;
 }
 
@@ -49,6 +49,15 @@ HostPathEntry* HostPathEntry::Create(Device* device, Entry* parent,
   return entry;
 }
 
+void HostPathEntry::NotifyWritten(size_t end_offset) {
+  auto global_lock = global_critical_region_.Acquire();
+  if (end_offset > size_) {
+    size_ = end_offset;
+    allocation_size_ = xe::round_up(size_, device_->bytes_per_sector());
+  }
+  Touch();
+}
+
 X_STATUS HostPathEntry::Open(uint32_t desired_access, File** out_file) {
   if (is_read_only() && (desired_access & (FileAccess::kFileWriteData |
                                            FileAccess::kFileAppendData))) {
@@ -32,6 +32,10 @@ class HostPathEntry : public Entry {
 
   const std::wstring& local_path() { return local_path_; }
 
+  // Keeps the metadata read from the host at mount time current after the
+  // file was written up to the offset through the VFS.
+  void NotifyWritten(size_t end_offset);
+
   X_STATUS Open(uint32_t desired_access, File** out_file) override;
 
   bool can_map() const override { return true; }
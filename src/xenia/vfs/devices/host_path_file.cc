@@ -9,8 +9,17 @@
 
 #include "xenia/vfs/devices/host_path_file.h"
 
+#include <gflags/gflags.h>
+
+#include <algorithm>
+
+#include "xenia/base/logging.h"
 #include "xenia/vfs/devices/host_path_entry.h"
 
+DEFINE_int32(host_path_write_buffer_kb, 64,
+             "Size of the buffer gathering small consecutive writes to host "
+             "files, in KiB, or 0 to write each directly.");
+
 namespace xe {
 namespace vfs {
 
@@ -19,7 +28,10 @@ HostPathFile::HostPathFile(
     std::unique_ptr<xe::filesystem::FileHandle> file_handle)
     : File(file_access, entry), file_handle_(std::move(file_handle)) {}
 
-HostPathFile::~HostPathFile() = default;
+HostPathFile::~HostPathFile() {
+  std::lock_guard<std::mutex> lock(buffer_mutex_);
+  FlushWriteBuffer();
+}
 
 void HostPathFile::Destroy() { delete this; }
 
@@ -29,6 +41,16 @@ X_STATUS HostPathFile::ReadSync(void* buffer, size_t buffer_length,
     return X_STATUS_ACCESS_DENIED;
   }
 
+  {
+    // Reads see the buffered writes once they are written out.
+    std::lock_guard<std::mutex> lock(buffer_mutex_);
+    if (!write_buffer_.empty() &&
+        byte_offset < write_buffer_offset_ + write_buffer_.size() &&
+        byte_offset + buffer_length > write_buffer_offset_) {
+      FlushWriteBuffer();
+    }
+  }
+
   if (file_handle_->Read(byte_offset, buffer, buffer_length, out_bytes_read)) {
     return X_STATUS_SUCCESS;
   } else {
@@ -44,12 +66,63 @@ X_STATUS HostPathFile::WriteSync(const void* buffer, size_t buffer_length,
     return X_STATUS_ACCESS_DENIED;
   }
 
-  if (file_handle_->Write(byte_offset, buffer, buffer_length,
-                          out_bytes_written)) {
-    return X_STATUS_SUCCESS;
+  std::lock_guard<std::mutex> lock(buffer_mutex_);
+  size_t capacity =
+      size_t(std::max(FLAGS_host_path_write_buffer_kb, 0)) * 1024;
+  if (!write_buffer_.empty() &&
+      byte_offset != write_buffer_offset_ + write_buffer_.size()) {
+    FlushWriteBuffer();
+  }
+  if (write_failed_) {
+    write_failed_ = false;
+    return X_STATUS_UNSUCCESSFUL;
+  }
+
+  if (write_buffer_.size() + buffer_length > capacity) {
+    // Too large to gather, so written after what is buffered already.
+    if (!FlushWriteBuffer() ||
+        !file_handle_->Write(byte_offset, buffer, buffer_length,
+                             out_bytes_written)) {
+      write_failed_ = false;
+      return X_STATUS_END_OF_FILE;
+    }
   } else {
-    return X_STATUS_END_OF_FILE;
+    if (write_buffer_.empty()) {
+      write_buffer_.reserve(capacity);
+      write_buffer_offset_ = byte_offset;
+    }
+    auto bytes = static_cast<const uint8_t*>(buffer);
+    write_buffer_.insert(write_buffer_.end(), bytes, bytes + buffer_length);
+    *out_bytes_written = buffer_length;
+  }
+  static_cast<HostPathEntry*>(entry_)->NotifyWritten(byte_offset +
+                                                     *out_bytes_written);
+  return X_STATUS_SUCCESS;
+}
+
+X_STATUS HostPathFile::Flush() {
+  std::lock_guard<std::mutex> lock(buffer_mutex_);
+  bool flushed = FlushWriteBuffer() && !write_failed_;
+  write_failed_ = false;
+  file_handle_->Flush();
+  return flushed ? X_STATUS_SUCCESS : X_STATUS_UNSUCCESSFUL;
+}
+
+bool HostPathFile::FlushWriteBuffer() {
+  if (write_buffer_.empty()) {
+    return true;
+  }
+  size_t bytes_written = 0;
+  bool written = file_handle_->Write(write_buffer_offset_, write_buffer_.data(),
+                                     write_buffer_.size(), &bytes_written);
+  if (!written) {
+    XELOGE("Failed to write %zu buffered bytes at %zu to %S",
+           write_buffer_.size(), write_buffer_offset_,
+           file_handle_->path().c_str());
+    write_failed_ = true;
   }
+  write_buffer_.clear();
+  return written;
 }
 
 }  // namespace vfs
@@ -10,7 +10,9 @@
 #ifndef XENIA_VFS_DEVICES_HOST_PATH_FILE_H_
 #define XENIA_VFS_DEVICES_HOST_PATH_FILE_H_
 
+#include <mutex>
 #include <string>
+#include <vector>
 
 #include "xenia/base/filesystem.h"
 #include "xenia/vfs/file.h"
@@ -32,9 +34,23 @@ class HostPathFile : public File {
                     size_t* out_bytes_read) override;
   X_STATUS WriteSync(const void* buffer, size_t buffer_length,
                      size_t byte_offset, size_t* out_bytes_written) override;
+  X_STATUS Flush() override;
 
  private:
+  // Writes out the buffered writes. Must be called with buffer_mutex_ held.
+  bool FlushWriteBuffer();
+
   std::unique_ptr<xe::filesystem::FileHandle> file_handle_;
+
+  // Consecutive small writes are gathered here, and written out once the
+  // buffer is full, when the file is read, flushed or closed, or a write
+  // lands elsewhere.
+  std::mutex buffer_mutex_;
+  std::vector<uint8_t> write_buffer_;
+  size_t write_buffer_offset_ = 0;
+  // Set when buffered data couldn't be written, and returned by the next
+  // write or flush.
+  bool write_failed_ = false;
 };
 
 }  // namespace vfs
@@ -14,11 +14,16 @@
 
 #include "xenia/base/logging.h"
 #include "xenia/base/math.h"
+#include "xenia/base/threading.h"
 #include "xenia/vfs/devices/stfs_container_entry.h"
 
 namespace xe {
 namespace vfs {
 
+// Packages with more file blocks than this resolve the block lists of their
+// files in parallel.
+const size_t kParallelBlockListBlockCount = 0x8000;
+
 uint32_t load_uint24_be(const uint8_t* p) {
   return (static_cast<uint32_t>(p[0]) << 16) |
          (static_cast<uint32_t>(p[1]) << 8) | static_cast<uint32_t>(p[2]);
@@ -127,6 +132,16 @@ StfsContainerDevice::Error StfsContainerDevice::ReadHeaderAndVerify(
     table_size_shift_ = 1;
   }
 
+  if (((header_.header_size + 0x0FFF) & 0xB000) == 0xB000) {
+    block_shift_ = 1;
+  } else {
+    if ((header_.volume_descriptor.block_separation & 0x1) == 0x1) {
+      block_shift_ = 0;
+    } else {
+      block_shift_ = 1;
+    }
+  }
+
   return Error::kSuccess;
 }
 
@@ -138,6 +153,13 @@ StfsContainerDevice::Error StfsContainerDevice::ReadAllEntries(
   root_entry_ = std::unique_ptr<Entry>(root_entry);
 
   std::vector<StfsContainerEntry*> all_entries;
+  struct PendingBlockList {
+    StfsContainerEntry* entry;
+    uint32_t start_block_index;
+    bool consecutive;
+  };
+  std::vector<PendingBlockList> pending_block_lists;
+  size_t pending_block_count = 0;
 
   // Load all listings.
   auto& volume_descriptor = header_.volume_descriptor;
@@ -173,7 +195,7 @@ StfsContainerDevice::Error StfsContainerDevice::ReadAllEntries(
           std::string(reinterpret_cast<const char*>(filename),
                       filename_length_flags & 0x3F),
           mmap_.get());
-      // bit 0x40 = consecutive blocks (not fragmented?)
+      // bit 0x40 = consecutive blocks (not fragmented)
       if (filename_length_flags & 0x80) {
         entry->attributes_ = kFileAttributeDirectory;
       } else {
@@ -189,27 +211,13 @@ StfsContainerDevice::Error StfsContainerDevice::ReadAllEntries(
       entry->write_timestamp_ = update_timestamp;
       all_entries.push_back(entry.get());
 
-      // Fill in all block records.
-      // It's easier to do this now and just look them up later, at the cost
-      // of some memory. Nasty chain walk.
-      // TODO(benvanik): optimize if flag 0x40 (consecutive) is set.
+      // All block records are filled in once the listings have been read,
+      // so reads just look them up later.
       if (entry->attributes() & X_FILE_ATTRIBUTE_NORMAL) {
-        uint32_t block_index = start_block_index;
-        size_t remaining_size = file_size;
-        uint32_t info = 0x80;
-        while (remaining_size && block_index && info >= 0x80) {
-          size_t block_size =
-              std::min(static_cast<size_t>(0x1000), remaining_size);
-          size_t offset = BlockToOffset(ComputeBlockNumber(block_index));
-          entry->block_list_.push_back({offset, block_size});
-          remaining_size -= block_size;
-          auto block_hash = GetBlockHash(map_ptr, block_index, 0);
-          if (table_size_shift_ && block_hash.info < 0x80) {
-            block_hash = GetBlockHash(map_ptr, block_index, 1);
-          }
-          block_index = block_hash.next_block_index;
-          info = block_hash.info;
-        }
+        pending_block_lists.push_back(
+            {entry.get(), start_block_index,
+             (filename_length_flags & 0x40) != 0});
+        pending_block_count += xe::round_up(file_size, 0x1000u) / 0x1000;
       }
 
       parent_entry->children_.emplace_back(std::move(entry));
@@ -225,9 +233,61 @@ StfsContainerDevice::Error StfsContainerDevice::ReadAllEntries(
     }
   }
 
+  auto read_block_list = [&](size_t index) {
+    auto& pending = pending_block_lists[index];
+    ReadBlockList(pending.entry, pending.start_block_index,
+                  pending.consecutive);
+  };
+  if (pending_block_count >= kParallelBlockListBlockCount) {
+    xe::threading::ParallelFor("STFS Block Lists", pending_block_lists.size(),
+                               read_block_list);
+  } else {
+    for (size_t i = 0; i < pending_block_lists.size(); ++i) {
+      read_block_list(i);
+    }
+  }
+
   return Error::kSuccess;
 }
 
+void StfsContainerDevice::ReadBlockList(StfsContainerEntry* entry,
+                                        uint32_t start_block_index,
+                                        bool consecutive) {
+  const uint8_t* map_ptr = mmap_->data();
+  auto& block_list = entry->block_list_;
+  uint32_t block_index = start_block_index;
+  size_t file_offset = 0;
+  uint32_t info = 0x80;
+  while (file_offset < entry->data_size_ && block_index && info >= 0x80) {
+    size_t block_size =
+        std::min(static_cast<size_t>(0x1000), entry->data_size_ - file_offset);
+    size_t offset = BlockToOffset(ComputeBlockNumber(block_index));
+    if (offset > mmap_->size() || block_size > mmap_->size() - offset) {
+      XELOGE("STFS file %s is truncated", entry->path().c_str());
+      break;
+    }
+    // Blocks between hash tables are usually in order, so most files only
+    // need a few records.
+    if (!block_list.empty() &&
+        block_list.back().offset + block_list.back().length == offset) {
+      block_list.back().length += block_size;
+    } else {
+      block_list.push_back({file_offset, offset, block_size});
+    }
+    file_offset += block_size;
+    if (consecutive) {
+      ++block_index;
+      continue;
+    }
+    auto block_hash = GetBlockHash(map_ptr, block_index, 0);
+    if (table_size_shift_ && block_hash.info < 0x80) {
+      block_hash = GetBlockHash(map_ptr, block_index, 1);
+    }
+    block_index = block_hash.next_block_index;
+    info = block_hash.info;
+  }
+}
+
 size_t StfsContainerDevice::BlockToOffset(uint32_t block) {
   if (block >= 0xFFFFFF) {
     return ~0ull;
@@ -237,17 +297,7 @@ size_t StfsContainerDevice::BlockToOffset(uint32_t block) {
 }
 
 uint32_t StfsContainerDevice::ComputeBlockNumber(uint32_t block_index) {
-  uint32_t block_shift = 0;
-  if (((header_.header_size + 0x0FFF) & 0xB000) == 0xB000) {
-    block_shift = 1;
-  } else {
-    if ((header_.volume_descriptor.block_separation & 0x1) == 0x1) {
-      block_shift = 0;
-    } else {
-      block_shift = 1;
-    }
-  }
-
+  uint32_t block_shift = block_shift_;
   uint32_t base = (block_index + 0xAA) / 0xAA;
   if (package_type_ == StfsPackageType::kCon) {
     base <<= block_shift;
@@ -288,7 +338,12 @@ StfsContainerDevice::BlockHash StfsContainerDevice::GetBlockHash(
     }
   }
   // table_index += table_offset - (1 << table_size_shift_);
-  const uint8_t* hash_data = map_ptr + BlockToOffset(table_index);
+  size_t hash_offset = BlockToOffset(table_index);
+  if (hash_offset > mmap_->size() || mmap_->size() - hash_offset < 0x1000) {
+    // Ends the chain.
+    return {0xFFFFFF, 0};
+  }
+  const uint8_t* hash_data = map_ptr + hash_offset;
   const uint8_t* record_data = hash_data + record * 0x18;
   uint32_t info = xe::load_and_swap<uint8_t>(record_data + 0x14);
   uint32_t next_block_index = load_uint24_be(record_data + 0x15);
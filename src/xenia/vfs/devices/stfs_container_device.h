@@ -19,6 +19,8 @@
 namespace xe {
 namespace vfs {
 
+class StfsContainerEntry;
+
 // http://www.free60.org/STFS
 
 enum class StfsPackageType {
@@ -153,6 +155,10 @@ class StfsContainerDevice : public Device {
 
   Error ReadHeaderAndVerify(const uint8_t* map_ptr);
   Error ReadAllEntries(const uint8_t* map_ptr);
+  // Fills in the block records of the file, walking the hash tables unless
+  // its blocks are consecutive. May be called on several threads at once.
+  void ReadBlockList(StfsContainerEntry* entry, uint32_t start_block_index,
+                     bool consecutive);
   size_t BlockToOffset(uint32_t block);
   uint32_t ComputeBlockNumber(uint32_t block_index);
 
@@ -165,6 +171,7 @@ class StfsContainerDevice : public Device {
   StfsPackageType package_type_;
   StfsHeader header_;
   uint32_t table_size_shift_;
+  uint32_t block_shift_;
 };
 
 }  // namespace vfs
@@ -40,7 +40,9 @@ class StfsContainerEntry : public Entry {
 
   X_STATUS Open(uint32_t desired_access, File** out_file) override;
 
+  // Runs of blocks stored contiguously in the container, in file order.
   struct BlockRecord {
+    size_t file_offset;
     size_t offset;
     size_t length;
   };
@@ -31,31 +31,48 @@ X_STATUS StfsContainerFile::ReadSync(void* buffer, size_t buffer_length,
     return X_STATUS_END_OF_FILE;
   }
 
-  // Each block is 4096.
-  // Blocks may not be sequential, so we need to read by blocks and handle the
-  // offsets.
+  // Blocks may not be sequential, so we need to read by runs of blocks and
+  // handle the offsets.
   size_t real_length = std::min(buffer_length, entry_->size() - byte_offset);
-  size_t start_block = byte_offset / 4096;
-  size_t end_block =
-      std::min(entry_->block_list().size(),
-               (size_t)ceil((byte_offset + real_length) / 4096.0));
   uint8_t* dest_ptr = reinterpret_cast<uint8_t*>(buffer);
+  size_t file_offset = byte_offset;
   size_t remaining_length = real_length;
-  for (size_t n = start_block; n < end_block; n++) {
-    auto& record = entry_->block_list()[n];
-    size_t offset = record.offset;
-    size_t read_length = std::min(remaining_length, record.length);
-    if (n == start_block) {
-      offset += byte_offset % 4096;
-      read_length = std::min(read_length, record.length - (byte_offset % 4096));
+  while (remaining_length) {
+    size_t run_length;
+    const uint8_t* src_ptr = MapRange(file_offset, &run_length);
+    if (!src_ptr) {
+      // Past the end of a truncated chain.
+      break;
     }
-    memcpy(dest_ptr, entry_->mmap()->data() + offset, read_length);
+    size_t read_length = std::min(remaining_length, run_length);
+    std::memcpy(dest_ptr, src_ptr, read_length);
     dest_ptr += read_length;
+    file_offset += read_length;
     remaining_length -= read_length;
   }
   *out_bytes_read = real_length;
   return X_STATUS_SUCCESS;
 }
 
+const uint8_t* StfsContainerFile::MapRange(size_t byte_offset,
+                                           size_t* out_length) {
+  auto& block_list = entry_->block_list();
+  auto it = std::upper_bound(
+      block_list.begin(), block_list.end(), byte_offset,
+      [](size_t offset, const StfsContainerEntry::BlockRecord& record) {
+        return offset < record.file_offset;
+      });
+  if (it == block_list.begin() || byte_offset >= entry_->size()) {
+    return nullptr;
+  }
+  --it;
+  size_t record_offset = byte_offset - it->file_offset;
+  if (record_offset >= it->length) {
+    return nullptr;
+  }
+  *out_length = it->length - record_offset;
+  return entry_->mmap()->data() + it->offset + record_offset;
+}
+
 }  // namespace vfs
 }  // namespace xe
@@ -32,6 +32,7 @@ class StfsContainerFile : public File {
                      size_t byte_offset, size_t* out_bytes_written) override {
     return X_STATUS_ACCESS_DENIED;
   }
+  const uint8_t* MapRange(size_t byte_offset, size_t* out_length) override;
 
  private:
   StfsContainerEntry* entry_;
@@ -9,6 +9,7 @@
 
 #include "xenia/vfs/entry.h"
 
+#include "xenia/base/clock.h"
 #include "xenia/base/filesystem.h"
 #include "xenia/base/string.h"
 #include "xenia/vfs/device.h"
@@ -46,7 +47,7 @@ void Entry::Dump(xe::StringBuffer* string_buffer, int indent) {
 
 bool Entry::is_read_only() const { return device_->is_read_only(); }
 
-Entry* Entry::GetChild(std::string name) {
+Entry* Entry::GetChild(const std::string& name) {
   auto global_lock = global_critical_region_.Acquire();
   // TODO(benvanik): a faster search
   for (auto& child : children_) {
@@ -84,6 +85,7 @@ Entry* Entry::CreateEntry(std::string name, uint32_t attributes) {
     return nullptr;
   }
   children_.push_back(std::move(entry));
+  device_->AddToPathIndex(children_.back().get());
   // TODO(benvanik): resort? would break iteration?
   Touch();
   return children_.back().get();
@@ -100,6 +102,7 @@ bool Entry::Delete(Entry* entry) {
   if (!DeleteEntryInternal(entry)) {
     return false;
   }
+  device_->RemoveFromPathIndex(entry);
   for (auto it = children_.begin(); it != children_.end(); ++it) {
     if (it->get() == entry) {
       children_.erase(it);
@@ -116,7 +119,8 @@ bool Entry::Delete() {
 }
 
 void Entry::Touch() {
-  // TODO(benvanik): update timestamps.
+  auto global_lock = global_critical_region_.Acquire();
+  write_timestamp_ = access_timestamp_ = Clock::QueryHostSystemTime();
 }
 
 }  // namespace vfs
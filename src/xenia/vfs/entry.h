@@ -95,9 +95,10 @@ class Entry {
 
   bool is_read_only() const;
 
-  Entry* GetChild(std::string name);
+  Entry* GetChild(const std::string& name);
 
   size_t child_count() const { return children_.size(); }
+  Entry* child(size_t index) const { return children_[index].get(); }
   Entry* IterateChildren(const xe::filesystem::WildcardEngine& engine,
                          size_t* current_index);
 
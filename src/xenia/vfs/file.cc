@@ -0,0 +1,119 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2016 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#include "xenia/vfs/file.h"
+
+#include <gflags/gflags.h>
+
+#include <atomic>
+#include <cstdio>
+#include <mutex>
+
+#include "xenia/base/clock.h"
+#include "xenia/base/filesystem.h"
+#include "xenia/base/logging.h"
+#include "xenia/base/string.h"
+#include "xenia/vfs/device.h"
+#include "xenia/vfs/entry.h"
+
+DEFINE_int32(vfs_slow_read_ms, 0,
+             "Logs file reads taking at least this long, in milliseconds, or "
+             "0 to log none.");
+DEFINE_string(vfs_access_log, "",
+              "Appends the path, offset and length of every file read to the "
+              "file, which can be given to --vfs_prefetch_list on the next "
+              "run.");
+
+namespace xe {
+namespace vfs {
+
+static std::mutex access_callback_mutex;
+static File::AccessCallback access_callback;
+static std::atomic<bool> has_access_callback(false);
+
+void File::set_access_callback(AccessCallback callback) {
+  std::lock_guard<std::mutex> lock(access_callback_mutex);
+  access_callback = std::move(callback);
+  has_access_callback = bool(access_callback);
+}
+
+static void CallAccessCallback(const std::string& path, size_t offset,
+                               size_t length) {
+  if (!has_access_callback || !length) {
+    return;
+  }
+  std::lock_guard<std::mutex> lock(access_callback_mutex);
+  if (access_callback && !access_callback(path, offset, length)) {
+    access_callback = nullptr;
+    has_access_callback = false;
+  }
+}
+
+// Appends a line for the read to the access log, if one was asked for.
+static void LogAccess(const std::string& path, size_t offset, size_t length) {
+  static std::mutex mutex;
+  static FILE* file = nullptr;
+  static bool opened = false;
+  if (FLAGS_vfs_access_log.empty() || !length) {
+    return;
+  }
+  std::lock_guard<std::mutex> lock(mutex);
+  if (!opened) {
+    opened = true;
+    file = xe::filesystem::OpenFile(xe::to_wstring(FLAGS_vfs_access_log),
+                                    "ab");
+    if (!file) {
+      XELOGE("VFS access log %s could not be opened",
+             FLAGS_vfs_access_log.c_str());
+    }
+  }
+  if (file) {
+    std::fprintf(file, "%s\t%zu\t%zu\n", path.c_str(), offset, length);
+    std::fflush(file);
+  }
+}
+
+static uint64_t LatencyUsSince(uint64_t start_tick) {
+  return (Clock::QueryHostTickCount() - start_tick) * 1000000 /
+         Clock::host_tick_frequency();
+}
+
+X_STATUS File::Read(void* buffer, size_t buffer_length, size_t byte_offset,
+                    size_t* out_bytes_read) {
+  uint64_t start_tick = Clock::QueryHostTickCount();
+  X_STATUS result =
+      ReadSync(buffer, buffer_length, byte_offset, out_bytes_read);
+  uint64_t latency_us = LatencyUsSince(start_tick);
+  size_t bytes_read = XSUCCEEDED(result) ? *out_bytes_read : 0;
+  io_stats_.RecordRead(bytes_read, latency_us);
+  entry_->device()->RecordRead(bytes_read, latency_us);
+  if (FLAGS_vfs_slow_read_ms > 0 &&
+      latency_us >= uint64_t(FLAGS_vfs_slow_read_ms) * 1000) {
+    XELOGW("Slow read of %zu bytes at %zu from %s took %.3fms", bytes_read,
+           byte_offset, entry_->absolute_path().c_str(), latency_us / 1000.0);
+  }
+  LogAccess(entry_->absolute_path(), byte_offset, bytes_read);
+  CallAccessCallback(entry_->absolute_path(), byte_offset, bytes_read);
+  return result;
+}
+
+X_STATUS File::Write(const void* buffer, size_t buffer_length,
+                     size_t byte_offset, size_t* out_bytes_written) {
+  uint64_t start_tick = Clock::QueryHostTickCount();
+  X_STATUS result =
+      WriteSync(buffer, buffer_length, byte_offset, out_bytes_written);
+  uint64_t latency_us = LatencyUsSince(start_tick);
+  size_t bytes_written = XSUCCEEDED(result) ? *out_bytes_written : 0;
+  io_stats_.RecordWrite(bytes_written, latency_us);
+  entry_->device()->RecordWrite(bytes_written, latency_us);
+  return result;
+}
+
+}  // namespace vfs
+}  // namespace xe
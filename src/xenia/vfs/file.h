@@ -11,7 +11,10 @@
 #define XENIA_VFS_FILE_H_
 
 #include <cstdint>
+#include <functional>
+#include <string>
 
+#include "xenia/vfs/io_stats.h"
 #include "xenia/xbox.h"
 
 namespace xe {
@@ -32,6 +35,31 @@ class File {
   virtual X_STATUS WriteSync(const void* buffer, size_t buffer_length,
                              size_t byte_offset, size_t* out_bytes_written) = 0;
 
+  // Like ReadSync and WriteSync, also counting the operation in the stats of
+  // the file and its device, and tracing it as the flags ask.
+  X_STATUS Read(void* buffer, size_t buffer_length, size_t byte_offset,
+                size_t* out_bytes_read);
+  X_STATUS Write(const void* buffer, size_t buffer_length, size_t byte_offset,
+                 size_t* out_bytes_written);
+
+  // Writes out anything the file buffers, as for NtFlushBuffersFile.
+  virtual X_STATUS Flush() { return X_STATUS_SUCCESS; }
+
+  // Called with the path, offset and length of every read made through Read,
+  // one at a time, until it returns false or is replaced.
+  typedef std::function<bool(const std::string& path, size_t offset,
+                             size_t length)>
+      AccessCallback;
+  static void set_access_callback(AccessCallback callback);
+
+  // Returns the data at the offset in place, in a mapping that stays valid
+  // until the file is destroyed, with the length of the range contiguous in
+  // it, or null if the file isn't backed by a mapping or the offset is past
+  // the end. Readers wanting more than the length must ReadSync the rest.
+  virtual const uint8_t* MapRange(size_t byte_offset, size_t* out_length) {
+    return nullptr;
+  }
+
   // TODO: Parameters
   virtual X_STATUS ReadAsync(void* buffer, size_t buffer_length,
                              size_t byte_offset, size_t* out_bytes_read) {
@@ -49,10 +77,13 @@ class File {
   const Entry* entry() const { return entry_; }
   Entry* entry() { return entry_; }
 
+  const IoStats& io_stats() const { return io_stats_; }
+
  protected:
   // xe::filesystem::FileAccess
   uint32_t file_access_ = 0;
   Entry* entry_ = nullptr;
+  IoStats io_stats_;
 };
 
 }  // namespace vfs
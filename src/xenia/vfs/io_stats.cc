@@ -0,0 +1,99 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2016 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#include "xenia/vfs/io_stats.h"
+
+#include <algorithm>
+#include <cstdio>
+
+#include "xenia/base/math.h"
+
+namespace xe {
+namespace vfs {
+
+uint64_t IoStats::Snapshot::LatencyPercentileUs(double fraction) const {
+  uint64_t total = 0;
+  for (uint32_t i = 0; i < kLatencyBucketCount; ++i) {
+    total += latency_counts[i];
+  }
+  uint64_t target = uint64_t(total * fraction);
+  uint64_t count = 0;
+  for (uint32_t i = 0; i < kLatencyBucketCount - 1; ++i) {
+    count += latency_counts[i];
+    if (count > target) {
+      return 1ull << i;
+    }
+  }
+  return UINT64_MAX;
+}
+
+std::string IoStats::Snapshot::ToString() const {
+  auto format_percentile = [this](double fraction, char* buffer,
+                                  size_t buffer_size) {
+    uint64_t us = LatencyPercentileUs(fraction);
+    if (us == UINT64_MAX) {
+      std::snprintf(buffer, buffer_size, ">=%lluus",
+                    static_cast<unsigned long long>(
+                        1ull << (kLatencyBucketCount - 2)));
+    } else {
+      std::snprintf(buffer, buffer_size, "<%lluus",
+                    static_cast<unsigned long long>(us));
+    }
+  };
+  char p50[32];
+  char p99[32];
+  format_percentile(0.5, p50, sizeof(p50));
+  format_percentile(0.99, p99, sizeof(p99));
+  char buffer[256];
+  std::snprintf(buffer, sizeof(buffer),
+                "%llu reads (%llu KiB), %llu writes (%llu KiB), %llu cache "
+                "hits, %llu misses, p50 %s, p99 %s",
+                static_cast<unsigned long long>(read_count),
+                static_cast<unsigned long long>(read_bytes / 1024),
+                static_cast<unsigned long long>(write_count),
+                static_cast<unsigned long long>(write_bytes / 1024),
+                static_cast<unsigned long long>(cache_hit_count),
+                static_cast<unsigned long long>(cache_miss_count), p50, p99);
+  return buffer;
+}
+
+void IoStats::RecordRead(size_t bytes, uint64_t latency_us) {
+  ++read_count_;
+  read_bytes_ += bytes;
+  RecordLatency(latency_us);
+}
+
+void IoStats::RecordWrite(size_t bytes, uint64_t latency_us) {
+  ++write_count_;
+  write_bytes_ += bytes;
+  RecordLatency(latency_us);
+}
+
+IoStats::Snapshot IoStats::snapshot() const {
+  Snapshot snapshot;
+  snapshot.read_count = read_count_;
+  snapshot.read_bytes = read_bytes_;
+  snapshot.write_count = write_count_;
+  snapshot.write_bytes = write_bytes_;
+  snapshot.cache_hit_count = cache_hit_count_;
+  snapshot.cache_miss_count = cache_miss_count_;
+  for (uint32_t i = 0; i < kLatencyBucketCount; ++i) {
+    snapshot.latency_counts[i] = latency_counts_[i];
+  }
+  return snapshot;
+}
+
+void IoStats::RecordLatency(uint64_t latency_us) {
+  // The bit length of the latency.
+  uint32_t bucket = 64 - xe::lzcnt(latency_us);
+  ++latency_counts_[std::min(bucket, kLatencyBucketCount - 1)];
+}
+
+}  // namespace vfs
+}  // namespace xe
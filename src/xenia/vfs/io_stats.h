@@ -0,0 +1,67 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2016 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#ifndef XENIA_VFS_IO_STATS_H_
+#define XENIA_VFS_IO_STATS_H_
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+
+namespace xe {
+namespace vfs {
+
+// Counters of the reads and writes of a file, a device or all of them, safe
+// to update from any thread.
+class IoStats {
+ public:
+  // Bucket 0 counts operations under 1us, bucket i those taking from
+  // 2^(i-1) to 2^i us, and the last one everything slower.
+  static const uint32_t kLatencyBucketCount = 16;
+
+  struct Snapshot {
+    uint64_t read_count;
+    uint64_t read_bytes;
+    uint64_t write_count;
+    uint64_t write_bytes;
+    // Reads served from data cached or read ahead by the device, and those
+    // that weren't.
+    uint64_t cache_hit_count;
+    uint64_t cache_miss_count;
+    uint64_t latency_counts[kLatencyBucketCount];
+
+    // Returns the upper bound of the latency bucket the fraction of the
+    // operations is in, in microseconds, or UINT64_MAX for the last bucket.
+    uint64_t LatencyPercentileUs(double fraction) const;
+    std::string ToString() const;
+  };
+
+  void RecordRead(size_t bytes, uint64_t latency_us);
+  void RecordWrite(size_t bytes, uint64_t latency_us);
+  void RecordCacheHit() { ++cache_hit_count_; }
+  void RecordCacheMiss() { ++cache_miss_count_; }
+
+  Snapshot snapshot() const;
+
+ private:
+  void RecordLatency(uint64_t latency_us);
+
+  std::atomic<uint64_t> read_count_ = {0};
+  std::atomic<uint64_t> read_bytes_ = {0};
+  std::atomic<uint64_t> write_count_ = {0};
+  std::atomic<uint64_t> write_bytes_ = {0};
+  std::atomic<uint64_t> cache_hit_count_ = {0};
+  std::atomic<uint64_t> cache_miss_count_ = {0};
+  std::atomic<uint64_t> latency_counts_[kLatencyBucketCount] = {};
+};
+
+}  // namespace vfs
+}  // namespace xe
+
+#endif  // XENIA_VFS_IO_STATS_H_
@@ -7,6 +7,7 @@ project("xenia-vfs")
   kind("StaticLib")
   language("C++")
   links({
+    "snappy",
     "xenia-base",
   })
   defines({
@@ -15,3 +16,23 @@ project("xenia-vfs")
     project_root.."third_party/gflags/src",
   })
   recursive_platform_files()
+
+project("xenia-vfs-compress-disc-image")
+  uuid("6f3b2e1d-8c4a-4f7e-9b5d-2a1c7e8f4d36")
+  kind("ConsoleApp")
+  language("C++")
+  links({
+    "gflags",
+    "snappy",
+    "xenia-base",
+    "xenia-vfs",
+  })
+  defines({
+  })
+  includedirs({
+    project_root.."/third_party/gflags/src",
+  })
+  files({
+    "compress_disc_image_main.cc",
+    "../base/main_"..platform_suffix..".cc",
+  })
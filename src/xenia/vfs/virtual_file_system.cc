@@ -9,17 +9,46 @@
 
 #include "xenia/vfs/virtual_file_system.h"
 
+#include <gflags/gflags.h>
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include "xenia/base/clock.h"
 #include "xenia/base/filesystem.h"
 #include "xenia/base/logging.h"
 #include "xenia/base/string.h"
 #include "xenia/kernel/xfile.h"
 
+DEFINE_string(vfs_boot_profile_path, "",
+              "Folder of the reads each title made early in its last launch, "
+              "which are made ahead of it on the next. Disabled when empty.");
+DEFINE_int32(vfs_boot_profile_seconds, 30,
+             "Seconds after the title is loaded whose reads are recorded "
+             "into its boot profile.");
+DEFINE_string(vfs_prefetch_list, "",
+              "File written by --vfs_access_log on an earlier run, whose reads "
+              "are made ahead of the title on a background thread.");
+
 namespace xe {
 namespace vfs {
 
 VirtualFileSystem::VirtualFileSystem() {}
 
 VirtualFileSystem::~VirtualFileSystem() {
+  // The boot profile is saved early if the emulator exits before its time.
+  File::set_access_callback(nullptr);
+  if (boot_profile_recording_) {
+    SaveBootProfile();
+  }
+  if (prefetch_thread_) {
+    prefetch_running_ = false;
+    xe::threading::Wait(prefetch_thread_.get(), false);
+    prefetch_thread_.reset();
+  }
+
   // Delete all devices.
   // This will explode if anyone is still using data from them.
   devices_.clear();
@@ -28,7 +57,13 @@ VirtualFileSystem::~VirtualFileSystem() {
 
 bool VirtualFileSystem::RegisterDevice(std::unique_ptr<Device> device) {
   auto global_lock = global_critical_region_.Acquire();
+  // Disc images and packages never change, and read only host paths only
+  // through the host.
+  if (device->is_read_only()) {
+    device->BuildPathIndex();
+  }
   devices_.emplace_back(std::move(device));
+  UpdateResolvedPrefixes();
   return true;
 }
 
@@ -36,6 +71,7 @@ bool VirtualFileSystem::RegisterSymbolicLink(std::string path,
                                              std::string target) {
   auto global_lock = global_critical_region_.Acquire();
   symlinks_.insert({path, target});
+  UpdateResolvedPrefixes();
   XELOGD("Registered symbolic link: %s => %s", path.c_str(), target.c_str());
 
   return true;
@@ -51,6 +87,7 @@ bool VirtualFileSystem::UnregisterSymbolicLink(std::string path) {
          it->second.c_str());
 
   symlinks_.erase(it);
+  UpdateResolvedPrefixes();
   return true;
 }
 
@@ -63,69 +100,80 @@ bool VirtualFileSystem::IsSymbolicLink(const std::string& path) {
   return true;
 }
 
-Entry* VirtualFileSystem::ResolvePath(std::string path) {
-  auto global_lock = global_critical_region_.Acquire();
-
-  // Resolve relative paths
-  std::string normalized_path(xe::filesystem::CanonicalizePath(path));
-
-  // Resolve symlinks.
-  std::string device_path;
-  std::string relative_path;
-  for (int i = 0; i < 2; i++) {
-    for (const auto& it : symlinks_) {
-      if (xe::find_first_of_case(normalized_path, it.first) == 0) {
-        // Found symlink!
-        device_path = it.second;
-        if (relative_path.empty()) {
-          relative_path = normalized_path.substr(it.first.size());
+void VirtualFileSystem::UpdateResolvedPrefixes() {
+  resolved_prefixes_.clear();
+  for (const auto& it : symlinks_) {
+    // Allows double symlinks to be resolved.
+    std::string device_path = it.second;
+    if (IsSymbolicLink(device_path)) {
+      for (const auto& link : symlinks_) {
+        if (xe::find_first_of_case(it.second, link.first) == 0) {
+          device_path = link.second;
+          break;
         }
-
-        // Bit of a cheaty move here, but allows double symlinks to be resolved.
-        normalized_path = device_path;
-        break;
       }
     }
-
-    // Break as soon as we've completely resolved the symlinks to a device.
-    if (!IsSymbolicLink(device_path)) {
-      break;
-    }
-  }
-
-  if (device_path.empty()) {
-    // Symlink wasn't passed in - Check if we've received a raw device name.
+    Device* found_device = nullptr;
     for (auto& device : devices_) {
-      if (xe::find_first_of_case(normalized_path, device->mount_path()) == 0) {
-        device_path = device->mount_path();
-        relative_path = normalized_path.substr(device_path.size());
+      if (strcasecmp(device_path.c_str(), device->mount_path().c_str()) == 0) {
+        found_device = device.get();
+        break;
       }
     }
+    resolved_prefixes_.push_back(
+        {xe::to_lower_ascii(it.first), found_device, device_path});
   }
-
-  if (device_path.empty()) {
-    XELOGE("ResolvePath(%s) failed - no root found", path.c_str());
-    return nullptr;
+  size_t link_count = resolved_prefixes_.size();
+  for (auto& device : devices_) {
+    resolved_prefixes_.push_back({xe::to_lower_ascii(device->mount_path()),
+                                  device.get(), device->mount_path()});
   }
+  auto longer = [](const ResolvedPrefix& a, const ResolvedPrefix& b) {
+    return a.path.size() > b.path.size();
+  };
+  std::stable_sort(resolved_prefixes_.begin(),
+                   resolved_prefixes_.begin() + link_count, longer);
+  std::stable_sort(resolved_prefixes_.begin() + link_count,
+                   resolved_prefixes_.end(), longer);
+}
 
-  // Scan all devices.
-  for (auto& device : devices_) {
-    if (strcasecmp(device_path.c_str(), device->mount_path().c_str()) == 0) {
-      return device->ResolvePath(relative_path);
+Entry* VirtualFileSystem::ResolvePath(const std::string& path) {
+  auto global_lock = global_critical_region_.Acquire();
+
+  // Resolve relative paths
+  thread_local std::string normalized_path;
+  normalized_path.assign(path);
+  xe::filesystem::CanonicalizePath(&normalized_path);
+
+  // Resolve symlinks, or raw device names. The prefixes are case folded
+  // already.
+  for (auto& prefix : resolved_prefixes_) {
+    if (normalized_path.size() < prefix.path.size() ||
+        strncasecmp(normalized_path.c_str(), prefix.path.c_str(),
+                    prefix.path.size()) != 0) {
+      continue;
     }
+    if (!prefix.device) {
+      XELOGE("ResolvePath(%s) failed - device not found (%s)", path.c_str(),
+             prefix.device_path.c_str());
+      return nullptr;
+    }
+    normalized_path.erase(0, prefix.path.size());
+    return prefix.device->ResolvePath(normalized_path);
   }
 
-  XELOGE("ResolvePath(%s) failed - device not found (%s)", path.c_str(),
-         device_path.c_str());
+  XELOGE("ResolvePath(%s) failed - no root found", path.c_str());
   return nullptr;
 }
 
-Entry* VirtualFileSystem::ResolveBasePath(std::string path) {
-  auto base_path = xe::find_base_path(path);
+Entry* VirtualFileSystem::ResolveBasePath(const std::string& path) {
+  thread_local std::string base_path;
+  xe::find_base_path(path, &base_path);
   return ResolvePath(base_path);
 }
 
-Entry* VirtualFileSystem::CreatePath(std::string path, uint32_t attributes) {
+Entry* VirtualFileSystem::CreatePath(const std::string& path,
+                                     uint32_t attributes) {
   // Create all required directories recursively.
   auto path_parts = xe::split_path(path);
   if (path_parts.empty()) {
@@ -153,7 +201,7 @@ Entry* VirtualFileSystem::CreatePath(std::string path, uint32_t attributes) {
                                    attributes);
 }
 
-bool VirtualFileSystem::DeletePath(std::string path) {
+bool VirtualFileSystem::DeletePath(const std::string& path) {
   auto entry = ResolvePath(path);
   if (!entry) {
     return false;
@@ -166,7 +214,7 @@ bool VirtualFileSystem::DeletePath(std::string path) {
   return parent->Delete(entry);
 }
 
-X_STATUS VirtualFileSystem::OpenFile(std::string path,
+X_STATUS VirtualFileSystem::OpenFile(const std::string& path,
                                      FileDisposition creation_disposition,
                                      uint32_t desired_access, File** out_file,
                                      FileAction* out_action) {
@@ -185,14 +233,17 @@ X_STATUS VirtualFileSystem::OpenFile(std::string path,
   // If no device or parent, fail.
   Entry* parent_entry = nullptr;
   Entry* entry = nullptr;
-  if (!xe::find_base_path(path).empty()) {
-    parent_entry = ResolveBasePath(path);
+  thread_local std::string base_path;
+  xe::find_base_path(path, &base_path);
+  if (!base_path.empty()) {
+    parent_entry = ResolvePath(base_path);
     if (!parent_entry) {
       *out_action = FileAction::kDoesNotExist;
       return X_STATUS_NO_SUCH_FILE;
     }
 
-    auto file_name = xe::find_name_from_path(path);
+    thread_local std::string file_name;
+    xe::find_name_from_path(path, &file_name);
     entry = parent_entry->GetChild(file_name);
   } else {
     entry = ResolvePath(path);
@@ -286,5 +337,186 @@ X_STATUS VirtualFileSystem::OpenFile(std::string path,
   return result;
 }
 
+void VirtualFileSystem::StartPrefetch() {
+  if (FLAGS_vfs_prefetch_list.empty() || prefetch_thread_) {
+    return;
+  }
+  auto list = std::make_shared<PrefetchList>();
+  if (!LoadPrefetchList(xe::to_wstring(FLAGS_vfs_prefetch_list),
+                        list.get())) {
+    XELOGE("VFS prefetch list %s could not be read",
+           FLAGS_vfs_prefetch_list.c_str());
+    return;
+  }
+  StartPrefetchThread(list);
+}
+
+void VirtualFileSystem::StartBootProfile(uint32_t title_id) {
+  if (FLAGS_vfs_boot_profile_path.empty() || boot_profile_recording_) {
+    return;
+  }
+  boot_profile_path_ =
+      xe::join_paths(xe::to_wstring(FLAGS_vfs_boot_profile_path),
+                     xe::format_string(L"%.8X.vfsprofile", title_id));
+
+  if (!prefetch_thread_ && xe::filesystem::PathExists(boot_profile_path_)) {
+    auto list = std::make_shared<PrefetchList>();
+    if (LoadPrefetchList(boot_profile_path_, list.get())) {
+      XELOGI("Replaying VFS boot profile %S", boot_profile_path_.c_str());
+      StartPrefetchThread(list);
+    }
+  }
+
+  // Recorded anew on every launch, so the profile follows updates of the
+  // title. Prefetches aren't made through File::Read, so it only has the
+  // reads of the title.
+  boot_profile_ = PrefetchList();
+  boot_profile_end_tick_ =
+      Clock::QueryHostTickCount() +
+      uint64_t(std::max(FLAGS_vfs_boot_profile_seconds, 1)) *
+          Clock::host_tick_frequency();
+  boot_profile_recording_ = true;
+  File::set_access_callback(
+      [this](const std::string& path, size_t offset, size_t length) {
+        return RecordBootAccess(path, offset, length);
+      });
+}
+
+bool VirtualFileSystem::RecordBootAccess(const std::string& path,
+                                         size_t offset, size_t length) {
+  if (Clock::QueryHostTickCount() >= boot_profile_end_tick_) {
+    SaveBootProfile();
+    return false;
+  }
+  boot_profile_.Add(path, {offset, length});
+  return true;
+}
+
+void VirtualFileSystem::SaveBootProfile() {
+  boot_profile_recording_ = false;
+  xe::filesystem::CreateFolder(xe::to_wstring(FLAGS_vfs_boot_profile_path));
+  if (!SavePrefetchList(boot_profile_path_, boot_profile_)) {
+    XELOGE("VFS boot profile %S could not be written",
+           boot_profile_path_.c_str());
+    return;
+  }
+  XELOGI("Recorded VFS boot profile %S with %zu files",
+         boot_profile_path_.c_str(), boot_profile_.paths.size());
+}
+
+void VirtualFileSystem::StartPrefetchThread(
+    std::shared_ptr<PrefetchList> list) {
+  prefetch_running_ = true;
+  xe::threading::Thread::CreationParameters params;
+  prefetch_thread_ = xe::threading::Thread::Create(
+      params, [this, list]() { PrefetchThreadMain(*list); });
+  if (prefetch_thread_) {
+    prefetch_thread_->set_name("VFS Prefetch");
+  } else {
+    prefetch_running_ = false;
+  }
+}
+
+void VirtualFileSystem::PrefetchList::Add(const std::string& path,
+                                          PrefetchRange range) {
+  auto it = path_indices.find(path);
+  if (it == path_indices.end()) {
+    it = path_indices.emplace(path, paths.size()).first;
+    paths.emplace_back(path, std::vector<PrefetchRange>());
+  }
+  // Sequential reads are merged into one range.
+  auto& ranges = paths[it->second].second;
+  if (!ranges.empty() && range.offset >= ranges.back().offset &&
+      range.offset <= ranges.back().offset + ranges.back().length) {
+    ranges.back().length = std::max(ranges.back().offset + ranges.back().length,
+                                    range.offset + range.length) -
+                           ranges.back().offset;
+  } else {
+    ranges.push_back(range);
+  }
+}
+
+bool VirtualFileSystem::LoadPrefetchList(const std::wstring& path,
+                                         PrefetchList* list) {
+  FILE* file = xe::filesystem::OpenFile(path, "rb");
+  if (!file) {
+    return false;
+  }
+  char line[4096];
+  while (std::fgets(line, sizeof(line), file)) {
+    // path\toffset\tlength, with the path possibly holding tabs itself.
+    char* length_field = std::strrchr(line, '\t');
+    if (!length_field || length_field == line) {
+      continue;
+    }
+    *length_field++ = 0;
+    char* offset_field = std::strrchr(line, '\t');
+    if (!offset_field) {
+      continue;
+    }
+    *offset_field++ = 0;
+    PrefetchRange range;
+    range.offset = size_t(std::strtoull(offset_field, nullptr, 10));
+    range.length = size_t(std::strtoull(length_field, nullptr, 10));
+    if (range.length) {
+      list->Add(line, range);
+    }
+  }
+  bool succeeded = !std::ferror(file);
+  std::fclose(file);
+  return succeeded;
+}
+
+bool VirtualFileSystem::SavePrefetchList(const std::wstring& path,
+                                         const PrefetchList& list) {
+  FILE* file = xe::filesystem::OpenFile(path, "wb");
+  if (!file) {
+    return false;
+  }
+  for (auto& path_ranges : list.paths) {
+    for (auto& range : path_ranges.second) {
+      std::fprintf(file, "%s\t%zu\t%zu\n", path_ranges.first.c_str(),
+                   range.offset, range.length);
+    }
+  }
+  bool succeeded = !std::ferror(file);
+  return std::fclose(file) == 0 && succeeded;
+}
+
+void VirtualFileSystem::PrefetchThreadMain(const PrefetchList& list) {
+  const size_t kChunkSize = 1024 * 1024;
+  std::vector<uint8_t> buffer(kChunkSize);
+  size_t file_count = 0;
+  size_t byte_count = 0;
+  for (auto& path_ranges : list.paths) {
+    if (!prefetch_running_) {
+      break;
+    }
+    // Paths written by devices that aren't mounted this time are skipped.
+    Entry* entry = ResolvePath(path_ranges.first);
+    File* file = nullptr;
+    if (!entry || XFAILED(entry->Open(FileAccess::kFileReadData, &file))) {
+      continue;
+    }
+    ++file_count;
+    // Read directly, so the access log and stats only see the title.
+    for (auto& range : path_ranges.second) {
+      for (size_t offset = 0; offset < range.length && prefetch_running_;) {
+        size_t bytes_read = 0;
+        size_t length = std::min(kChunkSize, range.length - offset);
+        if (XFAILED(file->ReadSync(buffer.data(), length,
+                                   range.offset + offset, &bytes_read)) ||
+            !bytes_read) {
+          break;
+        }
+        offset += bytes_read;
+        byte_count += bytes_read;
+      }
+    }
+    file->Destroy();
+  }
+  XELOGI("VFS prefetched %zu bytes from %zu files", byte_count, file_count);
+}
+
 }  // namespace vfs
 }  // namespace xe
@@ -10,12 +10,14 @@
 #ifndef XENIA_VFS_VIRTUAL_FILE_SYSTEM_H_
 #define XENIA_VFS_VIRTUAL_FILE_SYSTEM_H_
 
+#include <atomic>
 #include <memory>
 #include <string>
 #include <unordered_map>
 #include <vector>
 
 #include "xenia/base/mutex.h"
+#include "xenia/base/threading.h"
 #include "xenia/vfs/device.h"
 #include "xenia/vfs/entry.h"
 #include "xenia/vfs/file.h"
@@ -34,20 +36,81 @@ class VirtualFileSystem {
   bool UnregisterSymbolicLink(std::string path);
   bool IsSymbolicLink(const std::string& path);
 
-  Entry* ResolvePath(std::string path);
-  Entry* ResolveBasePath(std::string path);
+  // Paths are resolved without allocating once the buffers the calling
+  // thread resolves them in have grown to fit.
+  Entry* ResolvePath(const std::string& path);
+  Entry* ResolveBasePath(const std::string& path);
 
-  Entry* CreatePath(std::string path, uint32_t attributes);
-  bool DeletePath(std::string path);
+  Entry* CreatePath(const std::string& path, uint32_t attributes);
+  bool DeletePath(const std::string& path);
 
-  X_STATUS OpenFile(std::string path, FileDisposition creation_disposition,
+  X_STATUS OpenFile(const std::string& path,
+                    FileDisposition creation_disposition,
                     uint32_t desired_access, File** out_file,
                     FileAction* out_action);
 
+  // Starts reading the ranges listed by --vfs_prefetch_list on a thread of
+  // its own, so the host caches have them by the time the title reads them.
+  // Does nothing if no list was given.
+  void StartPrefetch();
+  // Replays the boot profile of the title recorded by an earlier launch, if
+  // there is one and no --vfs_prefetch_list was given, and records the reads
+  // of the next --vfs_boot_profile_seconds as the new one. Does nothing if
+  // --vfs_boot_profile_path is empty.
+  void StartBootProfile(uint32_t title_id);
+
  private:
+  struct PrefetchRange {
+    size_t offset;
+    size_t length;
+  };
+  // Ranges of each path, in the order the paths were first read, with the
+  // index of each path in it.
+  struct PrefetchList {
+    std::vector<std::pair<std::string, std::vector<PrefetchRange>>> paths;
+    std::unordered_map<std::string, size_t> path_indices;
+
+    // Adds the range, merging it with the previous one of the path if it
+    // continues it.
+    void Add(const std::string& path, PrefetchRange range);
+  };
+  static bool LoadPrefetchList(const std::wstring& path, PrefetchList* list);
+  static bool SavePrefetchList(const std::wstring& path,
+                               const PrefetchList& list);
+  void StartPrefetchThread(std::shared_ptr<PrefetchList> list);
+  void PrefetchThreadMain(const PrefetchList& list);
+
+  bool RecordBootAccess(const std::string& path, size_t offset,
+                        size_t length);
+  void SaveBootProfile();
+
+  // Resolves every symbolic link and mount path to its device, which is
+  // redone whenever links or devices are added or removed.
+  void UpdateResolvedPrefixes();
+
   xe::global_critical_region global_critical_region_;
   std::vector<std::unique_ptr<Device>> devices_;
   std::unordered_map<std::string, std::string> symlinks_;
+
+  // A case folded path prefix, and the device it resolves to, or null with
+  // the device path that wasn't found.
+  struct ResolvedPrefix {
+    std::string path;
+    Device* device;
+    std::string device_path;
+  };
+  // Symbolic links before mount paths, and longer paths first, so nested
+  // paths resolve to the innermost.
+  std::vector<ResolvedPrefix> resolved_prefixes_;
+
+  std::unique_ptr<xe::threading::Thread> prefetch_thread_;
+  std::atomic<bool> prefetch_running_ = {false};
+
+  // Only used by the access callback, or once it has been replaced.
+  bool boot_profile_recording_ = false;
+  std::wstring boot_profile_path_;
+  uint64_t boot_profile_end_tick_ = 0;
+  PrefetchList boot_profile_;
 };
 
 }  // namespace vfs
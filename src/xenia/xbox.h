@@ -293,6 +293,11 @@ struct X_ANSI_STRING {
     return std::string(reinterpret_cast<const char*>(membase + pointer),
                        length);
   }
+  // Copies into the string, without allocating if it has the capacity.
+  void to_string(uint8_t* membase, std::string* out_value) const {
+    out_value->assign(reinterpret_cast<const char*>(membase + pointer),
+                      length);
+  }
 };
 static_assert_size(X_ANSI_STRING, 8);
 
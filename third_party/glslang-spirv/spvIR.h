@@ -127,6 +127,7 @@ public:
     Id getResultId() const { return resultId; }
     Id getTypeId() const { return typeId; }
     Id getIdOperand(int op) const { return operands[op]; }
+    void setIdOperand(int op, Id id) { operands[op] = id; }
     unsigned int getImmediateOperand(int op) const { return operands[op]; }
     const char* getStringOperand() const { return originalString.c_str(); }
 
@@ -392,7 +393,7 @@ public:
         idToInstruction[resultId] = instruction;
     }
 
-    Instruction* getInstruction(Id id) const { return idToInstruction[id]; }
+    Instruction* getInstruction(Id id) const { return id < idToInstruction.size() ? idToInstruction[id] : nullptr; }
     spv::Id getTypeId(Id resultId) const { return idToInstruction[resultId]->getTypeId(); }
     StorageClass getStorageClass(Id typeId) const
     {
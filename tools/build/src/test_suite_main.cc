@@ -18,6 +18,13 @@
 #define CATCH_CONFIG_RUNNER
 #include "third_party/catch/include/catch.hpp"
 
+DEFINE_int32(benchmark_iterations, 0,
+             "Also runs each benchmarked test case this many times in a timed "
+             "loop and reports its timings. 0 only checks the results.");
+DEFINE_string(benchmark_results_path, "",
+              "File the benchmark results are written to as JSON lines. Empty "
+              "writes them to stdout.");
+
 namespace xe {
 
 bool has_console_attached() { return true; }